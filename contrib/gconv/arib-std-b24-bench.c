@@ -0,0 +1,253 @@
+/*
+    ARIB-STD-B24 gconv module throughput benchmark
+
+    Converts EIT text strings from ARIB-STD-B24 through iconv(), the same
+    way libdvbv5 does when parsing the ISDB tables, and reports the
+    throughput. The strings are either read from a file or built from a
+    set of typical event names and descriptions.
+
+    It should be run with GCONV_PATH pointing to the directory with the
+    module being measured.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define N_ELEMENTS(array) (sizeof(array) / sizeof((array)[0]))
+
+#define CHARSET "ARIB-STD-B24"
+
+/* Event names and texts as found on the ISDB-T EITs */
+static const char *default_texts[] = {
+	"ニュース７",
+	"【字】ＮＨＫニュース７　▽台風１５号　関東に接近　交通への影響は",
+	"天気予報・気象情報",
+	"【二】【字】大河ドラマ「光る君へ」（３８）「まぶしき闇」",
+	"平安時代中期、紫式部と藤原道長の生涯を描く。まひろ（吉高由里子）は"
+	"宮中で物語を書き進めるが、思わぬ試練が待ち受けていた。",
+	"【映】【字】ＢＳシネマ「ローマの休日」",
+	"サッカー　Ｊ１リーグ　第３０節　鹿島アントラーズ×浦和レッズ"
+	"　〜県立カシマサッカースタジアムから中継〜",
+	"実況：山田太郎　解説：鈴木一郎",
+	"クローズアップ現代「ＡＩは仕事をどう変えるのか」",
+	"きょうの料理　かぼちゃとひき肉のそぼろ煮",
+	"材料（４人分）かぼちゃ１／４個、豚ひき肉２００ｇ、しょうゆ大さじ２",
+	"【デ】おかあさんといっしょ",
+	"The Great Gatsby (1974) - Robert Redford, Mia Farrow",
+	"ＮＨＫ　ＢＳ１スペシャル　世界のドキュメンタリー",
+	"出演：佐藤花子、田中次郎　ほか",
+	"プロ野球「巨人×阪神」〜東京ドームから中継〜（延長の場合あり）",
+};
+
+struct sample {
+	char *buf;
+	size_t len;
+};
+
+static struct sample *samples;
+static unsigned num_samples;
+
+static void add_sample(const char *buf, size_t len)
+{
+	struct sample *s;
+
+	s = realloc(samples, (num_samples + 1) * sizeof(*samples));
+	if (!s) {
+		perror("realloc");
+		exit(1);
+	}
+	samples = s;
+	s = &samples[num_samples++];
+	s->buf = malloc(len);
+	if (!s->buf) {
+		perror("malloc");
+		exit(1);
+	}
+	memcpy(s->buf, buf, len);
+	s->len = len;
+}
+
+static void build_default_samples(void)
+{
+	char out[1024];
+	iconv_t cd;
+	unsigned i;
+
+	cd = iconv_open(CHARSET, "UTF-8");
+	if (cd == (iconv_t)-1) {
+		perror("iconv_open(" CHARSET ", UTF-8)");
+		exit(1);
+	}
+
+	for (i = 0; i < N_ELEMENTS(default_texts); i++) {
+		char *in = (char *)default_texts[i], *p = out;
+		size_t inlen = strlen(in), outlen = sizeof(out);
+
+		iconv(cd, NULL, NULL, NULL, NULL);
+		if (iconv(cd, &in, &inlen, &p, &outlen) == (size_t)-1 ||
+		    iconv(cd, NULL, NULL, &p, &outlen) == (size_t)-1) {
+			fprintf(stderr, "can't encode \"%s\": %s\n",
+				default_texts[i], strerror(errno));
+			exit(1);
+		}
+		add_sample(out, p - out);
+	}
+	iconv_close(cd);
+}
+
+/*
+ * Reads the strings from a file where each one is preceded by its length
+ * byte, as the text fields on the EIT descriptors.
+ */
+static void read_samples(const char *fname)
+{
+	unsigned char buf[256];
+	FILE *fp;
+	int len;
+
+	fp = fopen(fname, "rb");
+	if (!fp) {
+		perror(fname);
+		exit(1);
+	}
+	while ((len = fgetc(fp)) != EOF) {
+		if (fread(buf, 1, len, fp) != (size_t)len) {
+			fprintf(stderr, "%s: truncated string\n", fname);
+			exit(1);
+		}
+		if (len)
+			add_sample((char *)buf, len);
+	}
+	fclose(fp);
+
+	if (!num_samples) {
+		fprintf(stderr, "%s: no strings\n", fname);
+		exit(1);
+	}
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-f file] [-n iterations] [-t charset]\n"
+	       "  -f file        read the strings from a file, each one preceded\n"
+	       "                 by its length byte\n"
+	       "  -n iterations  number of passes over the strings (default 20000)\n"
+	       "  -t charset     charset to convert into (default UTF-8)\n"
+	       "  -p             print the converted strings and exit\n",
+	       prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *tocode = "UTF-8", *fname = NULL;
+	unsigned long iterations = 20000, n;
+	size_t in_bytes = 0, out_bytes = 0;
+	struct timespec start;
+	char out[4096];
+	int print = 0;
+	iconv_t cd;
+	unsigned i;
+	double t;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "f:n:t:ph")) != -1) {
+		switch (opt) {
+		case 'f':
+			fname = optarg;
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			tocode = optarg;
+			break;
+		case 'p':
+			print = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (fname)
+		read_samples(fname);
+	else
+		build_default_samples();
+
+	cd = iconv_open(tocode, CHARSET);
+	if (cd == (iconv_t)-1) {
+		fprintf(stderr, "iconv_open(%s, " CHARSET "): %s\n",
+			tocode, strerror(errno));
+		return 1;
+	}
+
+	if (print)
+		iterations = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (n = 0; n < iterations; n++) {
+		for (i = 0; i < num_samples; i++) {
+			char *in = samples[i].buf, *p = out;
+			size_t inlen = samples[i].len, outlen = sizeof(out);
+
+			iconv(cd, NULL, NULL, NULL, NULL);
+			if (iconv(cd, &in, &inlen, &p, &outlen) == (size_t)-1) {
+				fprintf(stderr, "string %u: %s\n", i,
+					strerror(errno));
+				return 1;
+			}
+			out_bytes += p - out;
+			if (print)
+				printf("%.*s\n", (int)(p - out), out);
+		}
+	}
+	t = elapsed(&start);
+	iconv_close(cd);
+
+	if (print)
+		return 0;
+
+	for (i = 0; i < num_samples; i++)
+		in_bytes += samples[i].len;
+	in_bytes *= iterations;
+
+	printf("%u strings, %lu iterations: %.3f s\n",
+	       num_samples, iterations, t);
+	printf("%.1f Mstrings/s, %.1f MB/s in, %.1f MB/s out\n",
+	       num_samples * iterations / t / 1e6,
+	       in_bytes / t / 1e6, out_bytes / t / 1e6);
+
+	return 0;
+}
@@ -544,8 +544,145 @@ b24_char_conv (int set, unsigned char c1, unsigned char c2, uint32_t *out)
   return 0;
 }
 
+/*
+ * Fast path for the runs of GL/GR chars of the most used code sets.
+ * The tables hold the UCS-4 char of each char (or pair of chars for KANJI)
+ * in 0x21..0x7e, taken from b24_char_conv(), or 0 if the char must take
+ * the generic path, i.e. it's invalid, not supported or converted into
+ * more than one UCS-4 char. They are built by gconv_init().
+ */
+enum {
+  FAST_ASCII,
+  FAST_HIRAGANA,
+  FAST_KATAKANA,
+  FAST_1B_SETS,
+};
+
+static int b24_fast_ready;
+static uint32_t b24_fast_1b[FAST_1B_SETS][94];
+static uint32_t b24_fast_kanji[94 * 94];
+
+static void
+b24_fast_init (void)
+{
+  static const int set_1b[FAST_1B_SETS] = {
+    [FAST_ASCII] = ASCII_set,
+    [FAST_HIRAGANA] = HIRAGANA_set,
+    [FAST_KATAKANA] = KATAKANA_set,
+  };
+  uint32_t out[FROM_LOOP_MAX_NEEDED_TO];
+  int i, c1, c2;
+
+  for (i = 0; i < FAST_1B_SETS; i++)
+    for (c1 = 0x21; c1 <= 0x7e; c1++)
+      if (b24_char_conv (set_1b[i], c1, 0, out) == 1
+	  && out[0] != __UNKNOWN_10646_CHAR)
+	b24_fast_1b[i][c1 - 0x21] = out[0];
+
+  for (c1 = 0x21; c1 <= 0x7e; c1++)
+    for (c2 = 0x21; c2 <= 0x7e; c2++)
+      if (b24_char_conv (KANJI_set, c1, c2, out) == 1
+	  && out[0] != __UNKNOWN_10646_CHAR)
+	b24_fast_kanji[(c1 - 0x21) * 94 + (c2 - 0x21)] = out[0];
+
+  b24_fast_ready = 1;
+}
+
+static inline const uint32_t *
+b24_fast_table (int set)
+{
+  switch (set)
+    {
+      case KANJI_set:
+	return b24_fast_kanji;
+      case ASCII_set:
+      case ASCII_x_set:
+      case PROP_ASCII_set:
+	return b24_fast_1b[FAST_ASCII];
+      case HIRAGANA_set:
+      case PROP_HIRA_set:
+	return b24_fast_1b[FAST_HIRAGANA];
+      case KATAKANA_set:
+      case PROP_KATA_set:
+	return b24_fast_1b[FAST_KATAKANA];
+      default:
+	return NULL;
+    }
+}
+
+/*
+ * Converts the chars starting at *inptrp while they're in GL/GR and
+ * invoked from a code set with a fast table, stopping at the first one
+ * that needs the generic path, or when the output is full. It must only
+ * be called in NORMAL mode without a single shift, which it doesn't change.
+ */
+static inline void
+b24_fast_conv (const struct state_from *st, const unsigned char **inptrp,
+	       const unsigned char *inend, unsigned char **outptrp,
+	       const unsigned char *outend)
+{
+  const unsigned char *inptr = *inptrp;
+  unsigned char *outptr = *outptrp;
+  const uint32_t *tab[2];
+  int mb[2];
+
+  tab[0] = b24_fast_table (st->g[st->gl]);
+  tab[1] = b24_fast_table (st->g[st->gr]);
+  if (tab[0] == NULL && tab[1] == NULL)
+    return;
+  mb[0] = (st->g[st->gl] == KANJI_set);
+  mb[1] = (st->g[st->gr] == KANJI_set);
+
+  while (inptr < inend && outptr + 4 <= outend)
+    {
+      unsigned int half = *inptr >> 7;
+      unsigned int c1 = (*inptr & 0x7f) - 0x21;
+      uint32_t ch;
+
+      if (tab[half] == NULL || c1 >= 94)
+	break;
+
+      if (mb[half])
+	{
+	  unsigned int c2;
+
+	  if (inptr + 1 >= inend || (inptr[1] >> 7) != half)
+	    break;
+	  c2 = (inptr[1] & 0x7f) - 0x21;
+	  if (c2 >= 94)
+	    break;
+	  ch = tab[half][c1 * 94 + c2];
+	  if (ch == 0)
+	    break;
+	  inptr += 2;
+	}
+      else
+	{
+	  ch = tab[half][c1];
+	  if (ch == 0)
+	    break;
+	  inptr++;
+	}
+
+      memcpy (outptr, &ch, sizeof (ch));
+      outptr += 4;
+    }
+
+  *inptrp = inptr;
+  *outptrp = outptr;
+}
+
 #define BODY \
   {									      \
+    if (__glibc_likely (st.mode == NORMAL && st.ss == 0))		      \
+      {									      \
+	const unsigned char *fast_start = inptr;			      \
+									      \
+	b24_fast_conv (&st, &inptr, inend, &outptr, outend);		      \
+	if (inptr != fast_start)					      \
+	  continue;							      \
+      }									      \
+									      \
     uint32_t ch = *inptr;						      \
 									      \
     if (ch == 0)							      \
@@ -1587,4 +1724,24 @@ next:									      \
 #include <iconv/loop.c>
 
 /* Now define the toplevel functions.  */
+#define gconv_init skeleton_gconv_init
 #include <iconv/skeleton.c>
+#undef gconv_init
+
+/*
+ * Wraps the default init function, to build the tables of the fast path
+ * the first time the conversion from ARIB-STD-B24 is opened. The init
+ * functions are called with the gconv lock held, so there's no race.
+ */
+extern int gconv_init (struct __gconv_step *step);
+int
+gconv_init (struct __gconv_step *step)
+{
+  int ret = skeleton_gconv_init (step);
+
+  if (ret == __GCONV_OK && step->__data == FROM_DIRECTION_VAL
+      && !b24_fast_ready)
+    b24_fast_init ();
+
+  return ret;
+}
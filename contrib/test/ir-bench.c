@@ -0,0 +1,455 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * IR decode latency and error rate benchmark
+ *
+ * Sends IR through a transmitter which loops back into the receiver, like
+ * the rc-loopback driver, and measures how long each message takes from
+ * the write to the lirc device to the scancode reported by the input
+ * device, and how many are lost or decoded wrong.
+ *
+ * The messages are either random scancodes of a kernel protocol, or the
+ * scancodes of a keymap, encoded with the same encoders as ir-ctl, for
+ * both kernel and BPF protocols. The decoders are whatever is enabled on
+ * the device, so load them first, e.g.:
+ *
+ *	ir-keytable -s rc0 -c -w keymap.toml
+ *	ir-bench -d /dev/lirc0 -k keymap.toml
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glob.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/lirc.h>
+
+#include "ir-encode.h"
+#include "keymap.h"
+#include "bpf_encoder.h"
+
+#define LIRCBUF_SIZE 1024
+
+struct message {
+	struct message *next;
+	const char *protocol;
+	uint32_t scancode;
+	unsigned carrier;
+	unsigned len;
+	unsigned buf[];
+};
+
+struct result {
+	struct result *next;
+	const char *protocol;
+	unsigned sent, decoded, missed, wrong;
+	uint64_t ir_us;
+	uint64_t *latency;
+};
+
+static struct option long_options[] = {
+	{"device",	required_argument,	0, 'd'},
+	{"input",	required_argument,	0, 'i'},
+	{"keymap",	required_argument,	0, 'k'},
+	{"protocol",	required_argument,	0, 'p'},
+	{"count",	required_argument,	0, 'n'},
+	{"gap",		required_argument,	0, 'g'},
+	{"timeout",	required_argument,	0, 't'},
+	{"verbose",	no_argument,		0, 'v'},
+	{"help",	no_argument,		0, 'h'},
+	{0, 0, 0, 0}
+};
+
+static void usage(void)
+{
+	printf("Usage: ir-bench [OPTION]...\n"
+	       "  -d, --device=DEV     lirc device to send on (default /dev/lirc0)\n"
+	       "  -i, --input=DEV      input device of the receiver (default: the one\n"
+	       "                       of the lirc device)\n"
+	       "  -k, --keymap=FILE    send the scancodes of a keymap\n"
+	       "  -p, --protocol=PROTO send random scancodes of a kernel protocol,\n"
+	       "                       may be given more than once\n"
+	       "  -n, --count=N        number of messages per protocol (default 200)\n"
+	       "  -g, --gap=MS         time between messages (default 150)\n"
+	       "  -t, --timeout=MS     how long to wait for a scancode (default 500)\n"
+	       "  -v, --verbose        print every message\n"
+	       "  -h, --help           display this help and exit\n");
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void sleep_us(uint64_t us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000,
+	};
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static struct message *new_message(const char *protocol, uint32_t scancode,
+				   unsigned carrier, const unsigned *buf,
+				   unsigned len)
+{
+	struct message *m = malloc(sizeof(*m) + len * sizeof(*buf));
+
+	if (!m) {
+		perror("malloc");
+		exit(1);
+	}
+	m->next = NULL;
+	m->protocol = protocol;
+	m->scancode = scancode;
+	m->carrier = carrier;
+	m->len = len;
+	memcpy(m->buf, buf, len * sizeof(*buf));
+
+	return m;
+}
+
+// count random scancodes of a kernel protocol
+static struct message **add_protocol(struct message **tail, const char *name,
+				     unsigned count)
+{
+	unsigned buf[LIRCBUF_SIZE], scancode, len, i;
+	enum rc_proto proto;
+
+	if (!protocol_match(name, &proto) || !protocol_encoder_available(proto)) {
+		fprintf(stderr, "%s: no encoder for this protocol\n", name);
+		exit(1);
+	}
+
+	for (i = 0; i < count; i++) {
+		scancode = random() & protocol_scancode_mask(proto);
+		protocol_scancode_valid(&proto, &scancode);
+		len = protocol_encode(proto, scancode, buf);
+		*tail = new_message(protocol_name(proto), scancode,
+				    protocol_carrier(proto), buf, len);
+		tail = &(*tail)->next;
+	}
+
+	return tail;
+}
+
+// The scancodes of a keymap, each protocol in turn until count are sent
+static struct message **add_keymap(struct message **tail, struct keymap *map,
+				   unsigned count)
+{
+	unsigned buf[LIRCBUF_SIZE], len, i;
+	struct scancode_entry *se;
+	enum rc_proto proto;
+	int bpf_buf[LIRCBUF_SIZE], length;
+
+	for (; map; map = map->next) {
+		const char *name = map->variant ?: map->protocol;
+		bool kernel = protocol_match(name, &proto);
+
+		if (!map->scancode)
+			continue;
+
+		if (!kernel && !encode_bpf_protocol(map, map->scancode->scancode,
+						    bpf_buf, &length)) {
+			fprintf(stderr, "%s: no encoder for this protocol, skipped\n",
+				name);
+			continue;
+		}
+
+		for (i = 0, se = map->scancode; i < count; i++) {
+			if (kernel) {
+				len = protocol_encode(proto, se->scancode, buf);
+				*tail = new_message(name, se->scancode,
+						    protocol_carrier(proto),
+						    buf, len);
+			} else {
+				encode_bpf_protocol(map, se->scancode, bpf_buf,
+						    &length);
+				*tail = new_message(name, se->scancode,
+						    keymap_param(map, "carrier", 0),
+						    (unsigned *)bpf_buf, length);
+			}
+			tail = &(*tail)->next;
+
+			se = se->next ?: map->scancode;
+		}
+	}
+
+	return tail;
+}
+
+static char *find_input(const char *lirc)
+{
+	const char *name = strrchr(lirc, '/');
+	char pattern[256], *input = NULL;
+	glob_t g;
+
+	snprintf(pattern, sizeof(pattern),
+		 "/sys/class/lirc/%s/device/input*/event*", name ? name + 1 : lirc);
+	if (glob(pattern, 0, NULL, &g) || g.gl_pathc < 1) {
+		fprintf(stderr, "%s: cannot find its input device, use --input\n",
+			lirc);
+		exit(1);
+	}
+	if (asprintf(&input, "/dev/input/%s", strrchr(g.gl_pathv[0], '/') + 1) < 0)
+		exit(1);
+	globfree(&g);
+
+	return input;
+}
+
+static struct result *get_result(struct result **results, const char *protocol,
+				 unsigned count)
+{
+	struct result *r;
+
+	for (; *results; results = &(*results)->next)
+		if (!strcmp((*results)->protocol, protocol))
+			return *results;
+
+	r = calloc(1, sizeof(*r));
+	if (r)
+		r->latency = calloc(count, sizeof(*r->latency));
+	if (!r || !r->latency) {
+		perror("calloc");
+		exit(1);
+	}
+	r->protocol = protocol;
+	*results = r;
+
+	return r;
+}
+
+/*
+ * Waits for the next scancode on the input device. Returns false on
+ * timeout, otherwise the scancode and the time of the event.
+ */
+static bool read_scancode(int fd, uint64_t deadline, uint32_t *scancode,
+			  uint64_t *time)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct input_event ev;
+	uint64_t now;
+
+	for (;;) {
+		now = now_us();
+		if (now >= deadline)
+			return false;
+
+		if (poll(&pfd, 1, (deadline - now + 999) / 1000) <= 0)
+			continue;
+
+		while (read(fd, &ev, sizeof(ev)) == sizeof(ev)) {
+			if (ev.type != EV_MSC || ev.code != MSC_SCAN)
+				continue;
+
+			*scancode = ev.value;
+			*time = ev.input_event_sec * 1000000ULL + ev.input_event_usec;
+			return true;
+		}
+	}
+}
+
+static void drain(int fd)
+{
+	struct input_event ev;
+
+	while (read(fd, &ev, sizeof(ev)) == sizeof(ev))
+		;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const struct result *r, unsigned p)
+{
+	return r->latency[(r->decoded - 1) * p / 100];
+}
+
+int main(int argc, char **argv)
+{
+	const char *lirc = "/dev/lirc0";
+	char *input = NULL;
+	struct message *messages = NULL, **tail = &messages, *m;
+	struct result *results = NULL, *r;
+	unsigned count = 200, gap = 150, timeout = 500, total = 0;
+	unsigned mode = LIRC_MODE_PULSE, carrier = 0;
+	int clock = CLOCK_MONOTONIC;
+	bool verbose = false;
+	int lirc_fd, input_fd, opt, i;
+	int nr_keymaps = 0, nr_protocols = 0;
+	char *keymaps[16], *protocols[16];
+
+	while ((opt = getopt_long(argc, argv, "d:i:k:p:n:g:t:vh",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			lirc = optarg;
+			break;
+		case 'i':
+			input = optarg;
+			break;
+		case 'k':
+			if (nr_keymaps == ARRAY_SIZE(keymaps)) {
+				fprintf(stderr, "too many keymaps\n");
+				return 1;
+			}
+			keymaps[nr_keymaps++] = optarg;
+			break;
+		case 'p':
+			if (nr_protocols == ARRAY_SIZE(protocols)) {
+				fprintf(stderr, "too many protocols\n");
+				return 1;
+			}
+			protocols[nr_protocols++] = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			gap = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (!count || (!nr_keymaps && !nr_protocols)) {
+		usage();
+		return 1;
+	}
+
+	srandom(1);
+	for (i = 0; i < nr_protocols; i++)
+		tail = add_protocol(tail, protocols[i], count);
+	for (i = 0; i < nr_keymaps; i++) {
+		struct keymap *map;
+
+		if (parse_keymap(keymaps[i], &map, false))
+			return 1;
+		tail = add_keymap(tail, map, count);
+	}
+
+	for (m = messages; m; m = m->next)
+		total++;
+
+	lirc_fd = open(lirc, O_RDWR);
+	if (lirc_fd < 0) {
+		perror(lirc);
+		return 1;
+	}
+	if (ioctl(lirc_fd, LIRC_SET_SEND_MODE, &mode)) {
+		fprintf(stderr, "%s: cannot send pulses and spaces: %m\n", lirc);
+		return 1;
+	}
+
+	if (!input)
+		input = find_input(lirc);
+	input_fd = open(input, O_RDONLY | O_NONBLOCK);
+	if (input_fd < 0) {
+		perror(input);
+		return 1;
+	}
+	// so that the event times can be compared with ours
+	if (ioctl(input_fd, EVIOCSCLOCKID, &clock)) {
+		fprintf(stderr, "%s: cannot use the monotonic clock: %m\n", input);
+		return 1;
+	}
+
+	for (m = messages; m; m = m->next) {
+		uint64_t start, time;
+		uint32_t scancode;
+		bool ok;
+
+		r = get_result(&results, m->protocol, total);
+
+		if (m->carrier && m->carrier != carrier &&
+		    !ioctl(lirc_fd, LIRC_SET_SEND_CARRIER, &m->carrier))
+			carrier = m->carrier;
+
+		drain(input_fd);
+
+		start = now_us();
+		if (write(lirc_fd, m->buf, m->len * sizeof(m->buf[0])) < 0) {
+			fprintf(stderr, "%s: %m\n", lirc);
+			return 1;
+		}
+		r->sent++;
+		for (i = 0; i < m->len; i++)
+			r->ir_us += m->buf[i];
+
+		ok = read_scancode(input_fd, start + timeout * 1000ULL,
+				   &scancode, &time);
+		if (!ok) {
+			r->missed++;
+		} else if (scancode != m->scancode) {
+			r->wrong++;
+		} else {
+			r->latency[r->decoded++] = time > start ? time - start : 0;
+		}
+
+		if (verbose && !ok)
+			printf("%s 0x%x: missed\n", m->protocol, m->scancode);
+		else if (verbose && scancode != m->scancode)
+			printf("%s 0x%x: decoded as 0x%x\n", m->protocol,
+			       m->scancode, scancode);
+		else if (verbose)
+			printf("%s 0x%x: %llu us\n", m->protocol, m->scancode,
+			       (unsigned long long)(time - start));
+
+		sleep_us(gap * 1000ULL);
+	}
+
+	printf("%-16s %6s %6s %6s %6s %7s %8s %8s %8s %8s %8s\n",
+	       "protocol", "sent", "ok", "missed", "wrong", "errors",
+	       "ir ms", "p50 us", "p90 us", "p99 us", "max us");
+	for (r = results; r; r = r->next) {
+		printf("%-16s %6u %6u %6u %6u %6.2f%% %8.1f",
+		       r->protocol, r->sent, r->decoded, r->missed, r->wrong,
+		       100.0 * (r->missed + r->wrong) / r->sent,
+		       r->ir_us / 1000.0 / r->sent);
+		if (r->decoded) {
+			qsort(r->latency, r->decoded, sizeof(*r->latency), cmp_u64);
+			printf(" %8llu %8llu %8llu %8llu\n",
+			       (unsigned long long)percentile(r, 50),
+			       (unsigned long long)percentile(r, 90),
+			       (unsigned long long)percentile(r, 99),
+			       (unsigned long long)r->latency[r->decoded - 1]);
+		} else {
+			printf(" %8s %8s %8s %8s\n", "-", "-", "-", "-");
+		}
+	}
+
+	close(input_fd);
+	close(lirc_fd);
+
+	return 0;
+}
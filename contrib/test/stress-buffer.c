@@ -10,42 +10,349 @@
  *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  *  GNU General Public License for more details.
  *
- *  stress-buffer tool makes infinite calls using read() for
- *  any device specified by the command argument.
+ *  stress-buffer stresses the buffer handling of a video device and
+ *  measures how long the buffer ioctls take. It has these modes:
  *
- *  The size of buffer shall be a random number from 0 up to 1000.
+ *  - read: makes infinite calls using read(). The size of buffer shall
+ *    be a random number from 0 up to 1000. Also is automatically created
+ *    a file called: stats-M-D-Y-h-m-s.txt in current directory with data
+ *    executed. This helped to identify real issues like memory leaks and
+ *    specific crashs that are rare and hard to reproduce.
  *
- *  Also is automatically created a file called: stats-M-D-Y-h-m-s.txt
- *  in current directory with data executed.
+ *  - alloc: several threads, each with its own file handle, allocate and
+ *    free buffers as fast as they can with VIDIOC_REQBUFS,
+ *    VIDIOC_CREATE_BUFS and VIDIOC_REMOVE_BUFS. The buffers are created
+ *    with sizes of up to --max-scale times the size of the current format,
+ *    and the allocation time per buffer is reported for each size. This
+ *    qualifies the videobuf2 allocator of a device. For a capture or
+ *    output device only the thread that owns the queue can allocate, the
+ *    others count how often they got EBUSY; a mem2mem device has a queue
+ *    for each file handle, so all threads allocate.
  *
- *  The stress test is performed by several read() calls,
- *  and it helped to identify real issues like:
+ *  - pingpong: queues and dequeues the buffers as fast as the device
+ *    returns them, on both queues of a mem2mem device.
  *
- *  - memory leaks
- *  - specific crashs that are rare and hard to reproduce
+ *  - dmabuf: like pingpong, but with buffers exported by another device
+ *    (--exporter) with VIDIOC_EXPBUF and imported as DMABUF. The first
+ *    VIDIOC_QBUF of each buffer attaches and maps the DMABUF, so it is
+ *    reported separately.
  *
- *  To compile:
- *             gcc -o stress-buffer stress-buffer.c -Wall
+ *  For all modes but read the latency percentiles of each ioctl are
+ *  printed at the end.
  *
  *  To execute:
  *             ./stress-buffer /dev/device_for_test
- *
- *  Example:
- *             ./stress-buffer /dev/video0
+ *             ./stress-buffer -m alloc -t 8 -d /dev/video0
+ *             ./stress-buffer -m dmabuf -d /dev/video1 -e /dev/video0
  */
 
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
 #include <errno.h>
+#include <linux/videodev2.h>
 
-int main(int argc, char **argv)
+#define MAX_THREADS	64
+#define MAX_BUFFERS	32
+#define MAX_SCALES	8
+
+enum {
+	STAT_REQBUFS,
+	STAT_REQBUFS_FREE,
+	STAT_CREATE_BUFS,
+	STAT_REMOVE_BUFS,
+	STAT_QBUF,
+	STAT_QBUF_IMPORT,
+	STAT_DQBUF,
+	STAT_EXPBUF,
+	STAT_FRAME,
+	STAT_COUNT
+};
+
+static const char *stat_names[STAT_COUNT] = {
+	"REQBUFS",
+	"REQBUFS(0)",
+	"CREATE_BUFS",
+	"REMOVE_BUFS",
+	"QBUF",
+	"QBUF(import)",
+	"DQBUF",
+	"EXPBUF",
+	"frame interval",
+};
+
+// Durations in nanoseconds
+struct samples {
+	uint64_t *ns;
+	unsigned n, size;
+};
+
+struct stats {
+	struct samples ioctl[STAT_COUNT];
+	// Allocation time per buffer for each size of CREATE_BUFS
+	struct samples alloc[MAX_SCALES];
+	unsigned busy, errors;
+};
+
+struct queue {
+	struct v4l2_format fmt;
+	__u32 memory;
+	unsigned count;
+	int dmabuf[MAX_BUFFERS];
+	bool imported[MAX_BUFFERS];
+};
+
+struct thread {
+	pthread_t thread;
+	unsigned seed;
+	struct stats stats;
+};
+
+static const char *device = "/dev/video0";
+static const char *exporter;
+static unsigned iterations = 1000;
+static unsigned buffers = 4;
+static unsigned max_scale = 8;
+static bool verbose;
+
+static struct option long_options[] = {
+	{"device",	required_argument,	0, 'd'},
+	{"mode",	required_argument,	0, 'm'},
+	{"threads",	required_argument,	0, 't'},
+	{"count",	required_argument,	0, 'n'},
+	{"buffers",	required_argument,	0, 'b'},
+	{"exporter",	required_argument,	0, 'e'},
+	{"max-scale",	required_argument,	0, 's'},
+	{"verbose",	no_argument,		0, 'v'},
+	{"help",	no_argument,		0, 'h'},
+	{0, 0, 0, 0}
+};
+
+static void usage(void)
+{
+	printf("Usage: stress-buffer [OPTION]... [DEV]\n"
+	       "  -d, --device=DEV     device to test (default /dev/video0)\n"
+	       "  -m, --mode=MODE      read, alloc, pingpong or dmabuf (default read)\n"
+	       "  -t, --threads=N      number of threads in alloc mode (default 4)\n"
+	       "  -n, --count=N        iterations per thread in alloc mode, frames in\n"
+	       "                       pingpong and dmabuf mode (default 1000)\n"
+	       "  -b, --buffers=N      number of buffers per queue (default 4)\n"
+	       "  -e, --exporter=DEV   device that exports the buffers in dmabuf mode\n"
+	       "  -s, --max-scale=N    create buffers of up to N times the size of the\n"
+	       "                       format in alloc mode, a power of two (default 8)\n"
+	       "  -v, --verbose        report every failing ioctl\n"
+	       "  -h, --help           display this help and exit\n");
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_sample(struct samples *s, uint64_t ns)
+{
+	if (s->n == s->size) {
+		s->size = s->size ? s->size * 2 : 1024;
+		s->ns = realloc(s->ns, s->size * sizeof(*s->ns));
+		if (!s->ns) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->ns[s->n++] = ns;
+}
+
+static void merge_samples(struct samples *to, const struct samples *from)
+{
+	unsigned i;
+
+	for (i = 0; i < from->n; i++)
+		add_sample(to, from->ns[i]);
+}
+
+static void merge_stats(struct stats *to, const struct stats *from)
+{
+	unsigned i;
+
+	for (i = 0; i < STAT_COUNT; i++)
+		merge_samples(&to->ioctl[i], &from->ioctl[i]);
+	for (i = 0; i < MAX_SCALES; i++)
+		merge_samples(&to->alloc[i], &from->alloc[i]);
+	to->busy += from->busy;
+	to->errors += from->errors;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+// The p per mille percentile in microseconds, s must be sorted
+static double percentile(const struct samples *s, unsigned p)
+{
+	return s->ns[(uint64_t)(s->n - 1) * p / 1000] / 1000.0;
+}
+
+static void print_samples(const char *name, struct samples *s)
+{
+	if (!s->n)
+		return;
+	qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+	printf("%-16s %8u %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, s->n,
+	       percentile(s, 500), percentile(s, 900), percentile(s, 990),
+	       percentile(s, 999), s->ns[s->n - 1] / 1000.0);
+}
+
+static void print_stats(struct stats *stats, const struct v4l2_format *fmt)
+{
+	bool header = true;
+	unsigned i;
+
+	printf("\n%-16s %8s %10s %10s %10s %10s %10s\n", "ioctl (us)", "count",
+	       "p50", "p90", "p99", "p99.9", "max");
+	for (i = 0; i < STAT_COUNT; i++)
+		print_samples(stat_names[i], &stats->ioctl[i]);
+
+	for (i = 0; i < MAX_SCALES; i++) {
+		char size[32];
+
+		if (!stats->alloc[i].n)
+			continue;
+		if (header)
+			printf("\n%-16s %8s %10s %10s %10s %10s %10s\n",
+			       "alloc/buf (us)", "count",
+			       "p50", "p90", "p99", "p99.9", "max");
+		header = false;
+		if (V4L2_TYPE_IS_MULTIPLANAR(fmt->type))
+			sprintf(size, "%ux sizeimage", 1 << i);
+		else
+			sprintf(size, "%u bytes", fmt->fmt.pix.sizeimage << i);
+		print_samples(size, &stats->alloc[i]);
+	}
+	if (stats->busy)
+		printf("\n%u times the queue was busy\n", stats->busy);
+	if (stats->errors)
+		printf("%u ioctls failed\n", stats->errors);
+}
+
+static int xioctl(int fd, unsigned long req, void *arg)
+{
+	int ret;
+
+	do {
+		ret = ioctl(fd, req, arg);
+	} while (ret && errno == EINTR);
+	return ret;
+}
+
+// Time a successful ioctl, errors are counted and EBUSY is counted apart
+static int timed_ioctl(int fd, unsigned long req, const char *name, void *arg,
+		       struct stats *stats, unsigned stat)
+{
+	uint64_t start = now_ns();
+	int ret = xioctl(fd, req, arg);
+
+	if (!ret) {
+		add_sample(&stats->ioctl[stat], now_ns() - start);
+		return 0;
+	}
+	if (errno == EBUSY) {
+		stats->busy++;
+	} else {
+		stats->errors++;
+		if (verbose)
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+	}
+	return ret;
+}
+
+static int open_device(const char *name)
+{
+	int fd = open(name, O_RDWR);
+
+	if (fd < 0) {
+		fprintf(stderr, "cannot open %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+	return fd;
+}
+
+// The buffer types of a device: both queues of a mem2mem device
+static unsigned find_types(int fd, const char *name, __u32 types[2])
+{
+	struct v4l2_capability cap;
+	unsigned n = 0;
+	__u32 caps;
+
+	memset(&cap, 0, sizeof(cap));
+	if (xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
+		fprintf(stderr, "%s: not a v4l2 device\n", name);
+		exit(1);
+	}
+	caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ?
+		cap.device_caps : cap.capabilities;
+	if (caps & V4L2_CAP_VIDEO_M2M)
+		caps |= V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_OUTPUT;
+	if (caps & V4L2_CAP_VIDEO_M2M_MPLANE)
+		caps |= V4L2_CAP_VIDEO_CAPTURE_MPLANE | V4L2_CAP_VIDEO_OUTPUT_MPLANE;
+
+	if (caps & V4L2_CAP_VIDEO_OUTPUT_MPLANE)
+		types[n++] = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	else if (caps & V4L2_CAP_VIDEO_OUTPUT)
+		types[n++] = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+		types[n++] = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	else if (caps & V4L2_CAP_VIDEO_CAPTURE)
+		types[n++] = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (!n) {
+		fprintf(stderr, "%s: no video capture or output queue\n", name);
+		exit(1);
+	}
+	// A capture or output device streams on a single queue
+	if (n == 2 && !(caps & (V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE)))
+		types[0] = types[--n];
+	return n;
+}
+
+static void get_format(int fd, __u32 type, struct v4l2_format *fmt)
+{
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = type;
+	if (xioctl(fd, VIDIOC_G_FMT, fmt)) {
+		perror("VIDIOC_G_FMT");
+		exit(1);
+	}
+}
+
+static void scale_format(struct v4l2_format *fmt, unsigned scale)
+{
+	unsigned p;
+
+	if (!V4L2_TYPE_IS_MULTIPLANAR(fmt->type)) {
+		fmt->fmt.pix.sizeimage <<= scale;
+		return;
+	}
+	for (p = 0; p < fmt->fmt.pix_mp.num_planes; p++)
+		fmt->fmt.pix_mp.plane_fmt[p].sizeimage <<= scale;
+}
+
+/* The original mode: infinite read() calls of a random size */
+static int stress_read(void)
 {
 	char buffer[1000];
 	char fname[100];
@@ -57,11 +364,6 @@ int main(int argc, char **argv)
 
 	FILE *fd_file;
 
-	if (argc != 2) {
-		printf("Usage: %s /dev/device_to_test\n", argv[0]);
-		return -1;
-	}
-
 	current = time(NULL);
 	timep = localtime(&current);
 
@@ -87,7 +389,7 @@ int main(int argc, char **argv)
 			return -1;
 		}
 
-		fd = open(argv[1], O_RDONLY);
+		fd = open(device, O_RDONLY);
 		if (fd < 0) {
 			perror("error opening device");
 			fclose(fd_file);
@@ -109,7 +411,7 @@ int main(int argc, char **argv)
 		ret = read(fd, buffer, magic_buffer_size);
 		if (ret < 0) {
 			fprintf(fd_file, "[%s] error reading buffer - [%s]\n",
-				argv[1], strerror(errno));
+				device, strerror(errno));
 			fflush(fd_file);
 			perror("error reading buffer from device");
 			return -1;
@@ -138,3 +440,400 @@ int main(int argc, char **argv)
 	}
 	return 0;
 }
+
+/*
+ * Each iteration either allocates a random number of buffers with
+ * REQBUFS, or adds some with CREATE_BUFS with a random size and maybe
+ * removes a random range of them again. When the queue is full or after
+ * REQBUFS the buffers are freed.
+ */
+static void *alloc_thread(void *arg)
+{
+	struct thread *t = arg;
+	struct stats *stats = &t->stats;
+	struct v4l2_requestbuffers req;
+	struct v4l2_format fmt;
+	unsigned scales = 0, allocated = 0, i;
+	bool can_remove;
+	__u32 types[2];
+	int fd;
+
+	fd = open_device(device);
+	find_types(fd, device, types);
+	get_format(fd, types[0], &fmt);
+	while ((1U << (scales + 1)) <= max_scale && scales + 1 < MAX_SCALES)
+		scales++;
+
+	memset(&req, 0, sizeof(req));
+	req.type = fmt.type;
+	req.memory = V4L2_MEMORY_MMAP;
+	xioctl(fd, VIDIOC_REQBUFS, &req);
+	can_remove = req.capabilities & V4L2_BUF_CAP_SUPPORTS_REMOVE_BUFS;
+
+	for (i = 0; i < iterations; i++) {
+		unsigned op = rand_r(&t->seed) % 4;
+
+		if (op == 0 || allocated >= MAX_BUFFERS - 4) {
+			if (allocated) {
+				memset(&req, 0, sizeof(req));
+				req.type = fmt.type;
+				req.memory = V4L2_MEMORY_MMAP;
+				if (!timed_ioctl(fd, VIDIOC_REQBUFS, "VIDIOC_REQBUFS", &req,
+						 stats, STAT_REQBUFS_FREE))
+					allocated = 0;
+			}
+			if (op)
+				continue;
+			memset(&req, 0, sizeof(req));
+			req.count = 1 + rand_r(&t->seed) % buffers;
+			req.type = fmt.type;
+			req.memory = V4L2_MEMORY_MMAP;
+			if (!timed_ioctl(fd, VIDIOC_REQBUFS, "VIDIOC_REQBUFS", &req,
+					 stats, STAT_REQBUFS))
+				allocated = req.count;
+		} else {
+			struct v4l2_create_buffers create;
+			unsigned scale = rand_r(&t->seed) % (scales + 1);
+			uint64_t start;
+
+			memset(&create, 0, sizeof(create));
+			create.count = 1 + rand_r(&t->seed) % 4;
+			create.memory = V4L2_MEMORY_MMAP;
+			create.format = fmt;
+			scale_format(&create.format, scale);
+			start = now_ns();
+			if (timed_ioctl(fd, VIDIOC_CREATE_BUFS, "VIDIOC_CREATE_BUFS", &create,
+					stats, STAT_CREATE_BUFS))
+				continue;
+			if (create.count)
+				add_sample(&stats->alloc[scale],
+					   (now_ns() - start) / create.count);
+			allocated = create.index + create.count;
+
+			if (can_remove && op == 3 && create.count) {
+				struct v4l2_remove_buffers remove;
+
+				memset(&remove, 0, sizeof(remove));
+				remove.type = fmt.type;
+				remove.index = create.index + rand_r(&t->seed) % create.count;
+				remove.count = 1 + rand_r(&t->seed) %
+					(create.index + create.count - remove.index);
+				timed_ioctl(fd, VIDIOC_REMOVE_BUFS, "VIDIOC_REMOVE_BUFS", &remove,
+					    stats, STAT_REMOVE_BUFS);
+			}
+		}
+	}
+	close(fd);
+	return NULL;
+}
+
+static int stress_alloc(unsigned nthreads)
+{
+	struct thread threads[MAX_THREADS];
+	struct stats total;
+	struct v4l2_format fmt;
+	__u32 types[2];
+	unsigned i;
+	int fd;
+
+	fd = open_device(device);
+	find_types(fd, device, types);
+	get_format(fd, types[0], &fmt);
+	close(fd);
+
+	memset(threads, 0, sizeof(threads));
+	for (i = 0; i < nthreads; i++) {
+		threads[i].seed = time(NULL) + i;
+		if (pthread_create(&threads[i].thread, NULL, alloc_thread, &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		merge_stats(&total, &threads[i].stats);
+	}
+	print_stats(&total, &fmt);
+	return 0;
+}
+
+static void init_buffer(const struct queue *q, unsigned index,
+			struct v4l2_buffer *buf, struct v4l2_plane *planes)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->index = index;
+	buf->type = q->fmt.type;
+	buf->memory = q->memory;
+	if (V4L2_TYPE_IS_MULTIPLANAR(q->fmt.type)) {
+		memset(planes, 0, VIDEO_MAX_PLANES * sizeof(*planes));
+		buf->m.planes = planes;
+		buf->length = q->fmt.fmt.pix_mp.num_planes;
+	}
+}
+
+// Output buffers are queued full, imported buffers with their DMABUF
+static void fill_buffer(const struct queue *q, struct v4l2_buffer *buf)
+{
+	bool mplane = V4L2_TYPE_IS_MULTIPLANAR(q->fmt.type);
+	unsigned p;
+
+	if (q->memory == V4L2_MEMORY_DMABUF) {
+		if (mplane) {
+			buf->m.planes[0].m.fd = q->dmabuf[buf->index];
+			buf->m.planes[0].length = q->fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+		} else {
+			buf->m.fd = q->dmabuf[buf->index];
+			buf->length = q->fmt.fmt.pix.sizeimage;
+		}
+	}
+	if (!V4L2_TYPE_IS_OUTPUT(q->fmt.type))
+		return;
+	if (!mplane) {
+		buf->bytesused = q->fmt.fmt.pix.sizeimage;
+		return;
+	}
+	for (p = 0; p < q->fmt.fmt.pix_mp.num_planes; p++)
+		buf->m.planes[p].bytesused = q->fmt.fmt.pix_mp.plane_fmt[p].sizeimage;
+}
+
+static int queue_buffer(int fd, struct queue *q, unsigned index,
+			struct stats *stats)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf;
+	bool import = q->memory == V4L2_MEMORY_DMABUF && !q->imported[index];
+
+	init_buffer(q, index, &buf, planes);
+	fill_buffer(q, &buf);
+	if (timed_ioctl(fd, VIDIOC_QBUF, "VIDIOC_QBUF", &buf, stats,
+			import ? STAT_QBUF_IMPORT : STAT_QBUF))
+		return -1;
+	q->imported[index] = true;
+	return 0;
+}
+
+/*
+ * The exporter creates buffers that are large enough for the format of
+ * the importer, and exports them.
+ */
+static void export_buffers(struct queue *q, struct stats *stats)
+{
+	struct v4l2_create_buffers create;
+	struct v4l2_format fmt;
+	__u32 size, types[2];
+	unsigned i;
+	int fd;
+
+	if (V4L2_TYPE_IS_MULTIPLANAR(q->fmt.type) &&
+	    q->fmt.fmt.pix_mp.num_planes > 1) {
+		fprintf(stderr, "%s: dmabuf mode needs a single plane format\n",
+			device);
+		exit(1);
+	}
+	size = V4L2_TYPE_IS_MULTIPLANAR(q->fmt.type) ?
+		q->fmt.fmt.pix_mp.plane_fmt[0].sizeimage : q->fmt.fmt.pix.sizeimage;
+
+	fd = open_device(exporter);
+	find_types(fd, exporter, types);
+	get_format(fd, types[0], &fmt);
+	if (V4L2_TYPE_IS_MULTIPLANAR(fmt.type)) {
+		fmt.fmt.pix_mp.num_planes = 1;
+		if (fmt.fmt.pix_mp.plane_fmt[0].sizeimage < size)
+			fmt.fmt.pix_mp.plane_fmt[0].sizeimage = size;
+	} else if (fmt.fmt.pix.sizeimage < size) {
+		fmt.fmt.pix.sizeimage = size;
+	}
+
+	memset(&create, 0, sizeof(create));
+	create.count = buffers;
+	create.memory = V4L2_MEMORY_MMAP;
+	create.format = fmt;
+	if (xioctl(fd, VIDIOC_CREATE_BUFS, &create) || create.count < buffers) {
+		fprintf(stderr, "%s: cannot create %u buffers of %u bytes\n",
+			exporter, buffers, size);
+		exit(1);
+	}
+	for (i = 0; i < buffers; i++) {
+		struct v4l2_exportbuffer expbuf;
+
+		memset(&expbuf, 0, sizeof(expbuf));
+		expbuf.type = fmt.type;
+		expbuf.index = create.index + i;
+		expbuf.flags = O_RDWR | O_CLOEXEC;
+		if (timed_ioctl(fd, VIDIOC_EXPBUF, "VIDIOC_EXPBUF", &expbuf,
+				stats, STAT_EXPBUF)) {
+			perror("VIDIOC_EXPBUF");
+			exit(1);
+		}
+		q->dmabuf[i] = expbuf.fd;
+	}
+	// The DMABUFs keep the buffers alive
+	close(fd);
+}
+
+/*
+ * Queue all buffers, then dequeue and requeue each buffer as soon as the
+ * device returns it, for count frames.
+ */
+static int stress_pingpong(bool dmabuf)
+{
+	struct queue queues[2];
+	struct stats stats;
+	uint64_t last = 0;
+	__u32 types[2];
+	unsigned nqueues, frames, i, q;
+	int fd;
+
+	memset(&stats, 0, sizeof(stats));
+	memset(queues, 0, sizeof(queues));
+	fd = open_device(device);
+	nqueues = find_types(fd, device, types);
+
+	for (q = 0; q < nqueues; q++) {
+		struct v4l2_requestbuffers req;
+
+		get_format(fd, types[q], &queues[q].fmt);
+		queues[q].memory = dmabuf ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+		if (dmabuf)
+			export_buffers(&queues[q], &stats);
+
+		memset(&req, 0, sizeof(req));
+		req.count = buffers;
+		req.type = types[q];
+		req.memory = queues[q].memory;
+		if (timed_ioctl(fd, VIDIOC_REQBUFS, "VIDIOC_REQBUFS", &req,
+				&stats, STAT_REQBUFS) || !req.count) {
+			fprintf(stderr, "%s: cannot allocate buffers: %s\n",
+				device, strerror(errno));
+			return 1;
+		}
+		if (dmabuf && req.count < buffers) {
+			fprintf(stderr, "%s: got only %u buffers\n", device, req.count);
+			return 1;
+		}
+		queues[q].count = req.count;
+		for (i = 0; i < req.count; i++)
+			if (queue_buffer(fd, &queues[q], i, &stats))
+				return 1;
+	}
+	for (q = 0; q < nqueues; q++) {
+		if (xioctl(fd, VIDIOC_STREAMON, &types[q])) {
+			perror("VIDIOC_STREAMON");
+			return 1;
+		}
+	}
+
+	for (frames = 0; frames < iterations; frames++) {
+		for (q = 0; q < nqueues; q++) {
+			struct v4l2_plane planes[VIDEO_MAX_PLANES];
+			struct v4l2_buffer buf;
+
+			init_buffer(&queues[q], 0, &buf, planes);
+			if (timed_ioctl(fd, VIDIOC_DQBUF, "VIDIOC_DQBUF", &buf,
+					&stats, STAT_DQBUF)) {
+				perror("VIDIOC_DQBUF");
+				return 1;
+			}
+			// The frame interval of the last queue, capture for mem2mem
+			if (q == nqueues - 1) {
+				uint64_t now = now_ns();
+
+				if (last)
+					add_sample(&stats.ioctl[STAT_FRAME], now - last);
+				last = now;
+			}
+			if (queue_buffer(fd, &queues[q], buf.index, &stats))
+				return 1;
+		}
+	}
+
+	for (q = 0; q < nqueues; q++) {
+		struct v4l2_requestbuffers req;
+
+		xioctl(fd, VIDIOC_STREAMOFF, &types[q]);
+		memset(&req, 0, sizeof(req));
+		req.type = types[q];
+		req.memory = queues[q].memory;
+		timed_ioctl(fd, VIDIOC_REQBUFS, "VIDIOC_REQBUFS", &req,
+			    &stats, STAT_REQBUFS_FREE);
+		for (i = 0; dmabuf && i < buffers; i++)
+			close(queues[q].dmabuf[i]);
+	}
+	close(fd);
+	print_stats(&stats, &queues[0].fmt);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *mode = "read";
+	unsigned threads = 4;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "d:m:t:n:b:e:s:vh",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			buffers = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			exporter = optarg;
+			break;
+		case 's':
+			max_scale = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	// The device used to be the only argument
+	if (optind < argc)
+		device = argv[optind++];
+	if (optind < argc) {
+		usage();
+		return 1;
+	}
+	if (!threads || threads > MAX_THREADS || !buffers ||
+	    buffers > MAX_BUFFERS || !max_scale) {
+		fprintf(stderr, "at most %u threads and %u buffers\n",
+			MAX_THREADS, MAX_BUFFERS);
+		return 1;
+	}
+
+	if (!strcmp(mode, "read"))
+		return stress_read();
+	if (!strcmp(mode, "alloc"))
+		return stress_alloc(threads);
+	if (!strcmp(mode, "pingpong"))
+		return stress_pingpong(false);
+	if (!strcmp(mode, "dmabuf")) {
+		if (!exporter) {
+			fprintf(stderr, "dmabuf mode needs an --exporter\n");
+			return 1;
+		}
+		return stress_pingpong(true);
+	}
+	fprintf(stderr, "unknown mode '%s'\n", mode);
+	usage();
+	return 1;
+}
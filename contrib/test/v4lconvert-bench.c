@@ -0,0 +1,712 @@
+/*
+    libv4lconvert throughput benchmark
+
+    Runs every source -> destination format pair which v4lconvert_convert()
+    supports over synthetic frames at a number of resolutions, with and
+    without flipping, rotating, cropping and software processing, and
+    reports the throughput.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 2.1 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif
+
+#include <libv4lconvert.h>
+#include <libv4l-plugin.h>
+
+#define N_ELEMENTS(array) (sizeof(array) / sizeof((array)[0]))
+
+struct src_fmt {
+	__u32 pixelformat;
+	/* bytes per line = width * bpl_num / bpl_den, 0 for compressed */
+	int bpl_num, bpl_den;
+	/* frame size = bytesperline * height * size_num / size_den */
+	int size_num, size_den;
+	/* width and height must be a multiple of this */
+	int align;
+};
+
+static const struct src_fmt src_fmts[] = {
+	{ V4L2_PIX_FMT_RGB24,		3, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_BGR24,		3, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_YUV420,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_YVU420,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_NV12,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_YUYV,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_RGB565,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_BGR32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_RGB32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_XBGR32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_XRGB32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_ABGR32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_ARGB32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_YVYU,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_UYVY,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_NV16,		1, 1,	2, 1,	2 },
+	{ V4L2_PIX_FMT_NV61,		1, 1,	2, 1,	2 },
+	{ V4L2_PIX_FMT_SPCA501,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_SPCA505,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_SPCA508,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_KONICA420,	1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_M420,		1, 1,	3, 2,	2 },
+	{ V4L2_PIX_FMT_NV12_16L16,	1, 1,	3, 2,	16 },
+	{ V4L2_PIX_FMT_SBGGR8,		1, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_SGBRG8,		1, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_SGRBG8,		1, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_SRGGB8,		1, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_SBGGR10P,	5, 4,	1, 1,	4 },
+	{ V4L2_PIX_FMT_SBGGR10,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_SBGGR16,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_GREY,		1, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_Y10BPACK,	5, 4,	1, 1,	4 },
+	{ V4L2_PIX_FMT_Y16,		2, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_HSV24,		3, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_HSV32,		4, 1,	1, 1,	2 },
+	{ V4L2_PIX_FMT_SN9C10X,		0, 1,	0, 1,	2 },
+	{ V4L2_PIX_FMT_PAC207,		0, 1,	0, 1,	2 },
+	{ V4L2_PIX_FMT_MR97310A,	0, 1,	0, 1,	2 },
+	{ V4L2_PIX_FMT_SN9C2028,	0, 1,	0, 1,	2 },
+	{ V4L2_PIX_FMT_SQ905C,		0, 1,	0, 1,	2 },
+#ifdef HAVE_JPEG
+	{ V4L2_PIX_FMT_MJPEG,		0, 1,	0, 1,	16 },
+#endif
+};
+
+static const __u32 dst_fmts[] = {
+	V4L2_PIX_FMT_RGB24,
+	V4L2_PIX_FMT_BGR24,
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_YUYV,
+};
+
+enum {
+	OPT_NONE,
+	OPT_HFLIP,
+	OPT_VFLIP,
+	OPT_ROTATE90,
+	OPT_CROP,
+	OPT_PROCESSING,
+	OPT_COUNT
+};
+
+static const char * const opt_names[OPT_COUNT] = {
+	"none", "hflip", "vflip", "rotate90", "crop", "processing"
+};
+
+static const struct {
+	int width, height;
+} default_resolutions[] = {
+	{ 640, 480 },
+	{ 1280, 720 },
+	{ 1920, 1080 },
+};
+
+static int resolutions[16][2];
+static int no_resolutions;
+static double min_time = 0.05;
+static int min_frames = 3;
+static int threads = 1;
+static int csv;
+static int verbose;
+static unsigned int opt_mask = (1 << OPT_COUNT) - 1;
+static __u32 only_src, only_dst;
+
+/* The benchmark has no real device behind it, this answers just enough for
+   libv4lcontrol to give us the fake flip / whitebalance / gamma controls */
+static int bench_ioctl(void *priv, int fd, unsigned long int request,
+		       void *arg)
+{
+	if (request == VIDIOC_QUERYCAP) {
+		struct v4l2_capability *cap = arg;
+
+		memset(cap, 0, sizeof(*cap));
+		strcpy((char *)cap->driver, "v4lconvert-bench");
+		strcpy((char *)cap->card, "v4lconvert-bench");
+		strcpy((char *)cap->bus_info, "platform:v4lconvert-bench");
+		cap->capabilities = V4L2_CAP_VIDEO_CAPTURE;
+		cap->device_caps = V4L2_CAP_VIDEO_CAPTURE;
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+static const struct libv4l_dev_ops bench_dev_ops = {
+	.ioctl = bench_ioctl,
+};
+
+static const char *fourcc(__u32 pixelformat, char *buf)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		buf[i] = (pixelformat >> (8 * i)) & 0xff;
+		if (buf[i] == ' ' || buf[i] == 0)
+			buf[i] = '_';
+	}
+	buf[4] = 0;
+
+	return buf;
+}
+
+static __u32 parse_fourcc(const char *s)
+{
+	char buf[4] = { ' ', ' ', ' ', ' ' };
+
+	memcpy(buf, s, strnlen(s, 4));
+	return v4l2_fourcc(buf[0], buf[1], buf[2], buf[3]);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static struct v4lconvert_data *create_instance(int rotate90)
+{
+	struct v4lconvert_data *data;
+
+	/* Enable all fake controls, rotating is a device quirk flag */
+	setenv("LIBV4LCONTROL_CONTROLS", "0xf", 1);
+	setenv("LIBV4LCONTROL_FLAGS", rotate90 ? "0x04" : "0", 1);
+	data = v4lconvert_create_with_dev_ops(-1, NULL, &bench_dev_ops);
+	unsetenv("LIBV4LCONTROL_CONTROLS");
+	unsetenv("LIBV4LCONTROL_FLAGS");
+	if (!data) {
+		fprintf(stderr, "v4lconvert_create failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (v4lconvert_set_threads(data, threads)) {
+		fprintf(stderr, "%s", v4lconvert_get_error_message(data));
+		exit(EXIT_FAILURE);
+	}
+
+	return data;
+}
+
+static void set_ctrl(struct v4lconvert_data *data, __u32 id, int value)
+{
+	struct v4l2_control ctrl = { .id = id, .value = value };
+
+	v4lconvert_vidioc_s_ctrl(data, &ctrl);
+}
+
+/* The control values live in shared memory which is shared between the
+   instances, so always set all of them */
+static void set_option(struct v4lconvert_data *data, int opt)
+{
+	set_ctrl(data, V4L2_CID_HFLIP, opt == OPT_HFLIP);
+	set_ctrl(data, V4L2_CID_VFLIP, opt == OPT_VFLIP);
+	set_ctrl(data, V4L2_CID_AUTO_WHITE_BALANCE, opt == OPT_PROCESSING);
+	set_ctrl(data, V4L2_CID_GAMMA, opt == OPT_PROCESSING ? 1500 : 1000);
+}
+
+#ifdef HAVE_JPEG
+static int make_jpeg(unsigned char *buf, int size, int width, int height)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	unsigned char *row, *out = NULL;
+	unsigned long out_size = 0;
+	int x;
+
+	row = malloc(width * 3);
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_mem_dest(&cinfo, &out, &out_size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 85, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW rows[1] = { row };
+
+		for (x = 0; x < width * 3; x++)
+			row[x] = (x * 3 + cinfo.next_scanline * 5 + x % 3 * 80) & 0xff;
+		jpeg_write_scanlines(&cinfo, rows, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	free(row);
+
+	if ((int)out_size > size)
+		out_size = 0;
+	else
+		memcpy(buf, out, out_size);
+	free(out);
+
+	return out_size;
+}
+#endif
+
+/*
+ * The gspca bridge formats are variable length coded deltas. The frames are
+ * made of codes picked at random from the ones the decoder knows, mostly
+ * short ones, as in a real frame. Codes with raw_bits are followed by an
+ * absolute value of that many bits.
+ */
+struct vlc_code {
+	unsigned char code, len, raw_bits;
+};
+
+static const struct vlc_code sn9c10x_codes[] = {
+	{ 0x00, 1, 0 }, { 0x04, 3, 0 }, { 0x05, 3, 0 }, { 0x0d, 4, 0 },
+	{ 0x0f, 4, 0 }, { 0x19, 5, 0 }, { 0x30, 6, 0 }, { 0x0e, 4, 4 },
+};
+
+static const struct vlc_code pac207_codes[] = {
+	{ 0x00, 2, 0 }, { 0x01, 2, 0 }, { 0x02, 2, 0 }, { 0x0c, 4, 0 },
+	{ 0x0d, 4, 0 }, { 0x1c, 5, 0 }, { 0x1d, 5, 0 }, { 0x3c, 6, 0 },
+	{ 0x3d, 6, 0 }, { 0x1f, 5, 6 },
+};
+
+static const struct vlc_code mr97310a_codes[] = {
+	{ 0x00, 1, 0 }, { 0x06, 3, 0 }, { 0x05, 3, 0 }, { 0x08, 4, 0 },
+	{ 0x09, 4, 0 }, { 0x0f, 4, 0 }, { 0x1c, 5, 0 }, { 0x1d, 5, 5 },
+};
+
+static const struct vlc_code sn9c2028_codes[] = {
+	{ 0x00, 1, 0 }, { 0x05, 3, 0 }, { 0x06, 3, 0 }, { 0x08, 4, 0 },
+	{ 0x09, 4, 0 }, { 0x0f, 4, 0 }, { 0x1c, 5, 0 }, { 0x1d, 5, 5 },
+};
+
+/* The nibble codes, the long ones are 1111 followed by 0000 - 1011 */
+static const struct vlc_code sq905c_codes[] = {
+	{ 0x00, 1, 0 }, { 0x02, 2, 0 }, { 0x06, 3, 0 }, { 0x0e, 4, 0 },
+	{ 0xf0, 8, 0 }, { 0xf1, 8, 0 }, { 0xf2, 8, 0 }, { 0xf3, 8, 0 },
+	{ 0xf4, 8, 0 }, { 0xf5, 8, 0 }, { 0xf6, 8, 0 }, { 0xf7, 8, 0 },
+	{ 0xf8, 8, 0 }, { 0xf9, 8, 0 }, { 0xfa, 8, 0 }, { 0xfb, 8, 0 },
+};
+
+struct bit_writer {
+	unsigned char *buf;
+	int size;
+	int pos;
+	unsigned int seed;
+};
+
+static unsigned int bw_rand(struct bit_writer *bw)
+{
+	bw->seed = bw->seed * 1103515245 + 12345;
+	return bw->seed >> 16;
+}
+
+/* MSB first, anything past the end of the buffer is dropped */
+static void put_bits(struct bit_writer *bw, unsigned int value, int len)
+{
+	while (len--) {
+		if (bw->pos / 8 < bw->size && ((value >> len) & 1))
+			bw->buf[bw->pos / 8] |= 0x80 >> (bw->pos % 8);
+		bw->pos++;
+	}
+}
+
+static void put_code(struct bit_writer *bw, const struct vlc_code *codes,
+		     int no_codes)
+{
+	int i = 0;
+
+	while (i < no_codes - 1 && (bw_rand(bw) & 1))
+		i++;
+	put_bits(bw, codes[i].code, codes[i].len);
+	if (codes[i].raw_bits)
+		put_bits(bw, bw_rand(bw), codes[i].raw_bits);
+}
+
+#define PUT_CODE(bw, codes) put_code(bw, codes, N_ELEMENTS(codes))
+
+static int make_vlc_frame(__u32 pixelformat, unsigned char *buf, int size,
+			  int width, int height)
+{
+	struct bit_writer bw = { buf, size, 0, 0x12345678 };
+	int x, y, footer = 0;
+
+	memset(buf, 0, size);
+
+	switch (pixelformat) {
+	case V4L2_PIX_FMT_SN9C10X:
+	case V4L2_PIX_FMT_MR97310A:
+		/* mr97310a has a 12 byte header and footer */
+		if (pixelformat == V4L2_PIX_FMT_MR97310A) {
+			bw.pos = 12 * 8;
+			footer = 12;
+		}
+		/* The first two pixels of the first two lines are raw */
+		for (y = 0; y < height; y++) {
+			x = 0;
+			if (y < 2) {
+				put_bits(&bw, bw_rand(&bw), 16);
+				x = 2;
+			}
+			for (; x < width; x++) {
+				if (pixelformat == V4L2_PIX_FMT_SN9C10X)
+					PUT_CODE(&bw, sn9c10x_codes);
+				else
+					PUT_CODE(&bw, mr97310a_codes);
+			}
+		}
+		break;
+	case V4L2_PIX_FMT_PAC207:
+		/* Each line has a header and 2 raw pixels, and is padded to
+		   16 bits */
+		for (y = 0; y < height; y++) {
+			put_bits(&bw, 0x1ee1, 16);
+			put_bits(&bw, bw_rand(&bw), 16);
+			for (x = 2; x < width; x++)
+				PUT_CODE(&bw, pac207_codes);
+			bw.pos = (bw.pos + 15) & ~15;
+		}
+		break;
+	case V4L2_PIX_FMT_SN9C2028:
+		/* A 12 byte header, then each line has 2 raw pixels */
+		bw.pos = 12 * 8;
+		for (y = 0; y < height; y++) {
+			put_bits(&bw, bw_rand(&bw), 16);
+			for (x = 2; x < width; x++)
+				PUT_CODE(&bw, sn9c2028_codes);
+		}
+		break;
+	case V4L2_PIX_FMT_SQ905C:
+		/* A 0x50 byte header, then one nibble per pixel */
+		bw.pos = 0x50 * 8;
+		for (x = 0; x < width * height; x++)
+			PUT_CODE(&bw, sq905c_codes);
+		break;
+	default:
+		return 0;
+	}
+
+	size = (bw.pos + 7) / 8 + footer;
+	return size > bw.size ? 0 : size;
+}
+
+static int fill_frame(const struct src_fmt *fmt, unsigned char *buf, int size,
+		      int width, int height)
+{
+	unsigned int seed = 0x12345678;
+	int i, bpl, frame_size;
+
+#ifdef HAVE_JPEG
+	if (fmt->pixelformat == V4L2_PIX_FMT_MJPEG)
+		return make_jpeg(buf, size, width, height);
+#endif
+	if (!fmt->bpl_num)
+		return make_vlc_frame(fmt->pixelformat, buf, size, width, height);
+
+	bpl = width * fmt->bpl_num / fmt->bpl_den;
+	frame_size = bpl * height * fmt->size_num / fmt->size_den;
+	if (frame_size > size)
+		return 0;
+
+	/* Something which is not constant, so that processing has work */
+	for (i = 0; i < frame_size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = ((i % bpl) * 255 / bpl + (seed >> 24) / 8) & 0xff;
+	}
+
+	return frame_size;
+}
+
+static void print_header(void)
+{
+	if (csv)
+		printf("src,dst,width,height,option,threads,frames,ms_per_frame,mpix_per_s,bytes_per_cycle\n");
+	else
+		printf("%-4s -> %-4s %11s %-10s %7s %10s %10s %11s\n",
+		       "src", "dst", "resolution", "option", "frames",
+		       "ms/frame", "MPix/s", "bytes/cycle");
+}
+
+static void bench_pair(struct v4lconvert_data *data, const struct src_fmt *sfmt,
+		       __u32 dst, int width, int height, int opt,
+		       unsigned char *src, int src_size,
+		       unsigned char *dest, int dest_size)
+{
+	struct v4l2_format src_fmt, dest_fmt;
+	unsigned long long start_cycles, used_cycles;
+	double start, elapsed;
+	int frames = 0, res;
+	char s[5], d[5];
+
+	memset(&src_fmt, 0, sizeof(src_fmt));
+	src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	src_fmt.fmt.pix.width = width;
+	src_fmt.fmt.pix.height = height;
+	src_fmt.fmt.pix.pixelformat = sfmt->pixelformat;
+	src_fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	src_fmt.fmt.pix.bytesperline = width * sfmt->bpl_num / sfmt->bpl_den;
+	src_fmt.fmt.pix.sizeimage = src_size;
+
+	dest_fmt = src_fmt;
+	dest_fmt.fmt.pix.pixelformat = dst;
+	if (opt == OPT_ROTATE90) {
+		dest_fmt.fmt.pix.width = height;
+		dest_fmt.fmt.pix.height = width;
+	} else if (opt == OPT_CROP) {
+		dest_fmt.fmt.pix.width = (width * 3 / 4) & ~7;
+		dest_fmt.fmt.pix.height = (height * 3 / 4) & ~7;
+	}
+	v4lconvert_fixup_fmt(&dest_fmt);
+
+	/* The first frame also takes care of allocating buffers, helper
+	   processes, etc. so don't count it */
+	res = v4lconvert_convert(data, &src_fmt, &dest_fmt, src, src_size,
+				 dest, dest_size);
+	if (res < 0) {
+		if (verbose)
+			fprintf(stderr, "%s -> %s %dx%d %s: %s",
+				fourcc(sfmt->pixelformat, s), fourcc(dst, d),
+				width, height, opt_names[opt],
+				v4lconvert_get_error_message(data));
+		return;
+	}
+
+	start = now();
+	start_cycles = cycles();
+	do {
+		v4lconvert_convert(data, &src_fmt, &dest_fmt, src, src_size,
+				   dest, dest_size);
+		frames++;
+		elapsed = now() - start;
+	} while (frames < min_frames || elapsed < min_time);
+	used_cycles = cycles() - start_cycles;
+
+	fourcc(sfmt->pixelformat, s);
+	fourcc(dst, d);
+	if (csv)
+		printf("%s,%s,%d,%d,%s,%d,%d,%.4f,%.2f,%.4f\n", s, d,
+		       width, height, opt_names[opt], threads, frames,
+		       elapsed * 1000 / frames,
+		       (double)width * height * frames / elapsed / 1e6,
+		       used_cycles ? (double)(src_size +
+			dest_fmt.fmt.pix.sizeimage) * frames / used_cycles : 0);
+	else
+		printf("%-4s -> %-4s %5dx%-5d %-10s %7d %10.3f %10.2f %11.4f\n",
+		       s, d, width, height, opt_names[opt], frames,
+		       elapsed * 1000 / frames,
+		       (double)width * height * frames / elapsed / 1e6,
+		       used_cycles ? (double)(src_size +
+			dest_fmt.fmt.pix.sizeimage) * frames / used_cycles : 0);
+	fflush(stdout);
+}
+
+static void usage(FILE *fp, char **argv)
+{
+	fprintf(fp,
+		"Usage: %s [options]\n\n"
+		"Options:\n"
+		"-r | --resolution WxH  Add a resolution (default 640x480, 1280x720\n"
+		"                       and 1920x1080)\n"
+		"-s | --src FOURCC      Only benchmark this source format\n"
+		"-d | --dst FOURCC      Only benchmark this destination format\n"
+		"-o | --option NAME     Only benchmark this option (none, hflip, vflip,\n"
+		"                       rotate90, crop, processing), may be repeated\n"
+		"-t | --time SECONDS    Minimum time per measurement (default %.2f)\n"
+		"-n | --frames COUNT    Minimum frames per measurement (default %d)\n"
+		"-j | --threads COUNT   Conversion threads, 0 for one per cpu\n"
+		"-c | --csv             Print comma separated values\n"
+		"-v | --verbose         Report unsupported pairs on stderr\n"
+		"-h | --help            Print this message\n"
+		"\n"
+		"bytes/cycle counts source plus destination bytes per time stamp\n"
+		"counter cycle and is 0 where no such counter is available.\n",
+		argv[0], min_time, min_frames);
+}
+
+static const char short_options[] = "r:s:d:o:t:n:j:cvh";
+
+static const struct option long_options[] = {
+	{ "resolution", required_argument, NULL, 'r' },
+	{ "src",        required_argument, NULL, 's' },
+	{ "dst",        required_argument, NULL, 'd' },
+	{ "option",     required_argument, NULL, 'o' },
+	{ "time",       required_argument, NULL, 't' },
+	{ "frames",     required_argument, NULL, 'n' },
+	{ "threads",    required_argument, NULL, 'j' },
+	{ "csv",        no_argument,       NULL, 'c' },
+	{ "verbose",    no_argument,       NULL, 'v' },
+	{ "help",       no_argument,       NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	struct v4lconvert_data *data, *rotate_data;
+	unsigned char *src, *dest;
+	int max_size = 0;
+	int i, j, r, opt, c, idx;
+
+	for (;;) {
+		c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'r':
+			if (no_resolutions == (int)N_ELEMENTS(resolutions) ||
+			    sscanf(optarg, "%dx%d", &resolutions[no_resolutions][0],
+				   &resolutions[no_resolutions][1]) != 2 ||
+			    resolutions[no_resolutions][0] <= 0 ||
+			    resolutions[no_resolutions][1] <= 0) {
+				fprintf(stderr, "invalid resolution: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			no_resolutions++;
+			break;
+		case 's':
+			only_src = parse_fourcc(optarg);
+			break;
+		case 'd':
+			only_dst = parse_fourcc(optarg);
+			break;
+		case 'o':
+			for (i = 0; i < OPT_COUNT; i++)
+				if (!strcmp(optarg, opt_names[i]))
+					break;
+			if (i == OPT_COUNT) {
+				fprintf(stderr, "unknown option: %s\n", optarg);
+				exit(EXIT_FAILURE);
+			}
+			/* The first -o replaces the default of all options */
+			if (opt_mask == (1 << OPT_COUNT) - 1)
+				opt_mask = 0;
+			opt_mask |= 1 << i;
+			break;
+		case 't':
+			min_time = strtod(optarg, NULL);
+			break;
+		case 'n':
+			min_frames = strtol(optarg, NULL, 0);
+			break;
+		case 'j':
+			threads = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			csv = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			usage(stdout, argv);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(stderr, argv);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!no_resolutions) {
+		for (i = 0; i < (int)N_ELEMENTS(default_resolutions); i++) {
+			resolutions[i][0] = default_resolutions[i].width;
+			resolutions[i][1] = default_resolutions[i].height;
+		}
+		no_resolutions = N_ELEMENTS(default_resolutions);
+	}
+
+	/* 4 bytes per pixel is the largest source or destination format */
+	for (r = 0; r < no_resolutions; r++)
+		if (resolutions[r][0] * resolutions[r][1] * 4 > max_size)
+			max_size = resolutions[r][0] * resolutions[r][1] * 4;
+
+	src = malloc(max_size);
+	dest = malloc(max_size);
+	if (!src || !dest) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	data = create_instance(0);
+	rotate_data = create_instance(1);
+	threads = v4lconvert_get_threads(data);
+
+	print_header();
+	for (i = 0; i < (int)N_ELEMENTS(src_fmts); i++) {
+		const struct src_fmt *sfmt = &src_fmts[i];
+
+		if (only_src && sfmt->pixelformat != only_src)
+			continue;
+
+		for (r = 0; r < no_resolutions; r++) {
+			int width = resolutions[r][0], height = resolutions[r][1];
+			int src_size;
+
+			if (width % sfmt->align || height % sfmt->align)
+				continue;
+
+			src_size = fill_frame(sfmt, src, max_size, width, height);
+			if (!src_size)
+				continue;
+
+			for (j = 0; j < (int)N_ELEMENTS(dst_fmts); j++) {
+				if (only_dst && dst_fmts[j] != only_dst)
+					continue;
+
+				for (opt = 0; opt < OPT_COUNT; opt++) {
+					struct v4lconvert_data *d =
+						opt == OPT_ROTATE90 ? rotate_data : data;
+
+					if (!(opt_mask & (1 << opt)))
+						continue;
+
+					set_option(d, opt);
+					bench_pair(d, sfmt, dst_fmts[j], width,
+						   height, opt, src, src_size,
+						   dest, max_size);
+				}
+			}
+		}
+	}
+
+	v4lconvert_destroy(rotate_data);
+	v4lconvert_destroy(data);
+	free(dest);
+	free(src);
+
+	return EXIT_SUCCESS;
+}
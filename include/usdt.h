@@ -0,0 +1,25 @@
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * Static probes (USDT) for bpftrace, perf and SystemTap
+ *
+ * When built with the usdt meson option, USDT() adds a probe at the
+ * given point, which costs a single nop when no tracer is attached. The
+ * probes can be listed with "bpftrace -l 'usdt:/path/to/lib:*'" or
+ * "perf list sdt". Without <sys/sdt.h>, the probes are compiled out.
+ *
+ * Providers are libv4l2, libv4lconvert, libdvbv5 and dvbv5_daemon. Most
+ * probes come in pairs, with the result on the second one, so latency
+ * histograms can be built by matching them on the same thread.
+ */
+
+#ifndef _USDT_H
+#define _USDT_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define USDT(provider, name, ...) STAP_PROBEV(provider, name, ##__VA_ARGS__)
+#else
+#define USDT(provider, name, ...) do { } while (0)
+#endif
+
+#endif
@@ -183,6 +183,68 @@ void dvb_hexdump(struct dvb_v5_fe_parms *parms, const char *prefix,
 int  dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 		    uint16_t buflen, struct dvb_desc **head_desc);
 
+/**
+ * @brief Enables or disables the lazy decoding of the descriptors
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer
+ * @param lazy		if not zero, the descriptors found by dvb_desc_parse()
+ *			are decoded only when accessed
+ *
+ * Decoding the descriptors, and converting their strings to the output
+ * charset, takes most of the time spent parsing tables like the SDT and
+ * the EIT. That's a waste when only a few of them are needed, e. g. to
+ * get the service types or the event times.
+ *
+ * On lazy mode, the descriptors of the tables parsed with @a parms are
+ * just copied. Their lists are filled as usual, with the type and the
+ * length of each descriptor, but the fields of the descriptors known by
+ * the library stay zeroed until they're decoded by dvb_desc_decode() or
+ * dvb_desc_get(). The decoded contents are kept, so each descriptor is
+ * decoded at most once. dvb_desc_print() and the table print functions
+ * decode the descriptors by themselves.
+ *
+ * The mode shouldn't change while the tables parsed with @a parms are in
+ * use, as the same @a parms is needed to decode their descriptors. It
+ * shouldn't be enabled while using functions that read the descriptors
+ * themselves, like dvb_scan_transponder(). As with the arena, decoding
+ * is not thread-safe.
+ */
+void dvb_fe_set_lazy_descriptors(struct dvb_v5_fe_parms *parms, int lazy);
+
+/**
+ * @brief Decodes a descriptor, if not decoded yet
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer used to parse the
+ *			table
+ * @param desc		descriptor out of the table lists
+ *
+ * The descriptor is decoded in place, at its first access. When the lazy
+ * mode is not enabled, @a desc is returned, as it is already decoded.
+ *
+ * @return @a desc, or NULL if it couldn't be decoded.
+ */
+struct dvb_desc *dvb_desc_decode(struct dvb_v5_fe_parms *parms,
+				 struct dvb_desc *desc);
+
+/**
+ * @brief Finds a descriptor by its type, decoding it if needed
+ * @ingroup dvb_table
+ *
+ * @param parms		Struct dvb_v5_fe_parms pointer used to parse the
+ *			table
+ * @param list		list of descriptors, as found at the tables
+ * @param type		descriptor type to find
+ *
+ * Only the descriptor found is decoded, see dvb_desc_decode().
+ *
+ * @return the first descriptor of that type that could be decoded, or
+ * NULL if there's none.
+ */
+struct dvb_desc *dvb_desc_get(struct dvb_v5_fe_parms *parms,
+			      struct dvb_desc *list, uint8_t type);
+
 /**
  * @brief frees a dvb_desc linked list
  * @ingroup dvb_table
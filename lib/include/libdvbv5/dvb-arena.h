@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-arena.h
+ * @ingroup ancillary
+ * @brief Provides an arena allocator for the parsed MPEG-TS tables
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ * @author Mauro Carvalho Chehab
+ *
+ * When an arena is set on the frontend parameters, the tables parsed
+ * with them, including their descriptors and strings, are allocated from
+ * big slabs owned by the arena, instead of one malloc() per element. All
+ * of them are then freed at once by dvb_arena_reset() or dvb_arena_free().
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_ARENA_H
+#define _DVB_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @struct dvb_arena
+ * @ingroup ancillary
+ * @brief Opaque arena allocator
+ */
+struct dvb_arena;
+
+struct dvb_v5_fe_parms;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates an arena
+ * @ingroup ancillary
+ *
+ * @param slab_size	size of each slab of memory, or 0 for the default.
+ *
+ * @return a pointer to the arena, or NULL if there's no memory.
+ */
+struct dvb_arena *dvb_arena_alloc(size_t slab_size);
+
+/**
+ * @brief Frees everything allocated from an arena, keeping it usable
+ * @ingroup ancillary
+ *
+ * @param arena		pointer to the arena
+ *
+ * The first slab is kept, to be reused by the next tables.
+ */
+void dvb_arena_reset(struct dvb_arena *arena);
+
+/**
+ * @brief Frees an arena and everything allocated from it
+ * @ingroup ancillary
+ *
+ * @param arena		pointer to the arena
+ */
+void dvb_arena_free(struct dvb_arena *arena);
+
+/**
+ * @brief Sets the arena used for the tables parsed with the given parameters
+ * @ingroup ancillary
+ *
+ * @param parms		pointer to struct dvb_v5_fe_parms
+ * @param arena		pointer to the arena, or NULL to go back to one
+ *			malloc() per element.
+ *
+ * The tables parsed while an arena is set must not be freed with the
+ * dvb_table_*_free() functions, as they're freed with the arena. So, an
+ * arena shouldn't be set while using functions that free the tables
+ * themselves, like dvb_scan_transponder().
+ *
+ * The arena is not thread-safe: tables should be parsed on it by a single
+ * thread at a time.
+ */
+void dvb_fe_set_arena(struct dvb_v5_fe_parms *parms, struct dvb_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
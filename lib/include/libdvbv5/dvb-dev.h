@@ -443,6 +443,41 @@ int dvb_dev_dmx_set_section_filter(struct dvb_open_descriptor *open_dev,
  */
 int dvb_dev_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev, int sid);
 
+/**
+ * @brief Sets the list of PIDs passed by a demux filter
+ * @ingroup dvb_device
+ *
+ * @param open_dev	Points to the struct dvb_open_descriptor
+ * @param pids		array with the Program IDs to filter
+ * @param num_pids	number of PIDs on the array. Zero stops the filter.
+ * @param output	Where the data will be output: DMX_OUT_TS_TAP or
+ *			DMX_OUT_TSDEMUX_TAP.
+ * @param buffersize	Size of the buffer to be allocated to store the
+ *			filtered data.
+ *
+ * Instead of opening one demux per PID, a single filter passes all PIDs
+ * on the list, with the DMX_SET_PES_FILTER ioctl for the first one and
+ * DMX_ADD_PID for the others. When called again with another list, only
+ * the PIDs that changed are added or removed, with DMX_ADD_PID and
+ * DMX_REMOVE_PID, so the PIDs that stay on the list don't lose any
+ * packets.
+ *
+ * If the driver doesn't support DMX_ADD_PID, one extra filter is opened
+ * internally for each PID, and closed together with the demux. As those
+ * can't be read from the demux file descriptor, this fallback only works
+ * with DMX_OUT_TS_TAP.
+ *
+ * See http://linuxtv.org/downloads/v4l-dvb-apis/dvb_demux.html
+ * for more details.
+ *
+ * @return Retuns zero on success, a negative value otherwise.
+ *
+ * @note valid only for DVB_DEVICE_DEMUX.
+ */
+int dvb_dev_dmx_set_pids(struct dvb_open_descriptor *open_dev,
+			 const uint16_t *pids, unsigned num_pids,
+			 dmx_output_t output, int buffersize);
+
 /**
  * @brief Scans a DVB dvb_add_scaned_transponder
  * @ingroup frontend_scan
@@ -471,6 +506,89 @@ struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 					unsigned other_nit,
 					unsigned timeout_multiply);
 
+/**
+ * @brief Called when a command of a batch completes
+ * @ingroup dvb_device
+ *
+ * @param user_priv	pointer given to dvb_dev_batch_start()
+ * @param cmd		name of the command, as sent to the dvbv5-daemon
+ * @param retval	result of the command: zero on success, a negative
+ *			value otherwise
+ *
+ * It is called from the thread receiving the replies of the dvbv5-daemon,
+ * so it should just take note of the result. It must not call any of the
+ * dvb_dev functions.
+ */
+typedef void dvb_dev_complete_t(void *user_priv, const char *cmd, int retval);
+
+/**
+ * @brief Starts a batch of commands
+ * @ingroup dvb_device
+ *
+ * @param dvb		pointer to struct dvb_device
+ * @param complete	called for each command of the batch when it
+ *			completes, or NULL
+ * @param user_priv	pointer passed to @a complete
+ *
+ * On a remote device, each call to the dvbv5-daemon normally waits for its
+ * reply, costing a network round trip. Within a batch, the calls that only
+ * return their result, i. e. dvb_dev_dmx_stop(), dvb_dev_set_bufsize(),
+ * dvb_dev_dmx_set_pesfilter(), dvb_dev_dmx_set_section_filter() and
+ * dvb_dev_dmx_set_pids(), don't wait: they return zero at once, and their
+ * commands are queued and sent to the daemon together. The daemon runs them
+ * in order, and all the replies come back within about one round trip.
+ * Any other call first sends the queued commands, and then waits for its
+ * own reply as usual.
+ *
+ * The devices used within a batch must not be closed before
+ * dvb_dev_batch_wait() returns.
+ *
+ * On local devices and files, the calls complete before they return, with
+ * their result as usual, and @a complete isn't called.
+ *
+ * @return zero on success, a negative value otherwise.
+ */
+int dvb_dev_batch_start(struct dvb_device *dvb,
+			dvb_dev_complete_t *complete, void *user_priv);
+
+/**
+ * @brief Sends the queued commands of a batch, and waits for all of them
+ *	to complete
+ * @ingroup dvb_device
+ *
+ * @param dvb		pointer to struct dvb_device
+ *
+ * This ends the batch started with dvb_dev_batch_start().
+ *
+ * @return zero if all the commands succeeded, otherwise the error of the
+ * first one that failed.
+ */
+int dvb_dev_batch_wait(struct dvb_device *dvb);
+
+/* From dvb-dev-file.c */
+
+/**
+ * @brief initialize the dvb-dev to read a recorded MPEG-TS file, instead
+ *	of the DVB devices.
+ *
+ * @param dvb		pointer to struct dvb_device to be used
+ * @param fname		file name, or "-" for stdin
+ *
+ * The file is seen as adapter 0, with a frontend, a demux and a dvr device.
+ * Tuning does nothing, and the frontend is always locked. The demux filters
+ * are applied in userspace, as fast as the file can be read, so the tables
+ * can be scanned and parsed, and the traffic measured, without a tuner.
+ *
+ * When a section filter reaches the end of the file, it goes on from its
+ * start, up to where it was set: then, dvb_dev_read() returns -ETIMEDOUT.
+ * As stdin can be read just once, only the first device reading it gets
+ * its data. A demux keeps a copy of it on a temporary file, in order to
+ * wrap as well.
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int dvb_dev_file_init(struct dvb_device *d, const char *fname);
+
 /* From dvb-dev-remote.c */
 
 #ifdef HAVE_DVBV5_REMOTE
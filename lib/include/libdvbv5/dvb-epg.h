@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-epg.h
+ * @ingroup dvb_table
+ * @brief Provides an in-memory EPG database, built from EIT sections
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ * @author Mauro Carvalho Chehab
+ *
+ * The EPG database receives the EIT sections, both present/following and
+ * schedule, as they're read from the demux. The events are stored per
+ * service, without duplicates, and can be queried by service and time.
+ * It also tracks which sections of each table were already received, so
+ * the application knows when the EPG of a service is complete.
+ *
+ * @par Relevant specs
+ * - ETSI EN 300 468
+ * - ETSI TS 101 211
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_EPG_H
+#define _DVB_EPG_H
+
+#include <stdint.h>
+#include <unistd.h> /* ssize_t */
+#include <time.h>
+
+/**
+ * @struct dvb_epg
+ * @ingroup dvb_table
+ * @brief Opaque EPG database
+ */
+struct dvb_epg;
+
+/**
+ * @struct dvb_epg_service_id
+ * @ingroup dvb_table
+ * @brief Identifies a service on the EPG database
+ *
+ * @param network_id	original network ID
+ * @param transport_id	transport stream ID
+ * @param service_id	service ID
+ */
+struct dvb_epg_service_id {
+	uint16_t network_id;
+	uint16_t transport_id;
+	uint16_t service_id;
+};
+
+/**
+ * @struct dvb_epg_event
+ * @ingroup dvb_table
+ * @brief An event returned by the EPG database
+ *
+ * @param event_id		event ID, unique inside the service
+ * @param table_id		ID of the last EIT table where it was seen
+ * @param running_status	running status, as in struct dvb_table_eit_event
+ * @param free_CA_mode		free CA mode, as in struct dvb_table_eit_event
+ * @param language		ISO 639 language code of the texts
+ * @param start			start time
+ * @param duration		duration, in seconds
+ * @param name			event name, from the short event descriptor
+ * @param text			event text, from the short event descriptor
+ * @param extended_text		text from the extended event descriptors
+ *
+ * The strings are never NULL, and are owned by the database. They're valid
+ * until the next call to dvb_epg_add_section(), dvb_epg_expire() or
+ * dvb_epg_free().
+ */
+struct dvb_epg_event {
+	uint16_t event_id;
+	uint8_t table_id;
+	uint8_t running_status;
+	uint8_t free_CA_mode;
+	char language[4];
+	time_t start;
+	uint32_t duration;
+	const char *name;
+	const char *text;
+	const char *extended_text;
+};
+
+struct dvb_v5_fe_parms;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates an EPG database
+ * @ingroup dvb_table
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer, used to parse the
+ *			sections and to log errors
+ *
+ * @return a pointer to the database, or NULL if there's no memory.
+ */
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief Frees an EPG database
+ * @ingroup dvb_table
+ *
+ * @param epg		pointer to the database
+ */
+void dvb_epg_free(struct dvb_epg *epg);
+
+/**
+ * @brief Adds the events of an EIT section to an EPG database
+ * @ingroup dvb_table
+ *
+ * @param epg		pointer to the database
+ * @param buf		buffer with the section, including its CRC
+ * @param buflen	length of the section
+ *
+ * Any EIT table ID is accepted, both for the actual and for the other
+ * transport streams. Sections already received with the same version are
+ * ignored. Events already on the database are updated.
+ *
+ * @return 1 if the section was added, 0 if it was already known, or a
+ *	   negative value on errors.
+ */
+int dvb_epg_add_section(struct dvb_epg *epg, const uint8_t *buf,
+			ssize_t buflen);
+
+/**
+ * @brief Removes the events that ended before a given time
+ * @ingroup dvb_table
+ *
+ * @param epg		pointer to the database
+ * @param before	events ending up to this time are removed
+ *
+ * It also compacts the memory used by the strings.
+ */
+void dvb_epg_expire(struct dvb_epg *epg, time_t before);
+
+/**
+ * @brief Gets the services on an EPG database
+ * @ingroup dvb_table
+ *
+ * @param epg		pointer to the database
+ * @param ids		array to be filled with the services
+ * @param max_ids	size of the array
+ *
+ * @return the number of services on the database, that can be bigger than
+ *	   max_ids.
+ */
+unsigned dvb_epg_get_services(struct dvb_epg *epg,
+			      struct dvb_epg_service_id *ids,
+			      unsigned max_ids);
+
+/**
+ * @brief Gets the events of a service during a time range
+ * @ingroup dvb_table
+ *
+ * @param epg		pointer to the database
+ * @param id		service
+ * @param from		start of the time range
+ * @param to		end of the time range
+ * @param events	array to be filled with the events, sorted by their
+ *			start time
+ * @param max_events	size of the array
+ *
+ * All events with some part inside [from, to) are returned.
+ *
+ * @return the number of events inside the time range, that can be bigger
+ *	   than max_events.
+ */
+unsigned dvb_epg_get_events(struct dvb_epg *epg,
+			    const struct dvb_epg_service_id *id,
+			    time_t from, time_t to,
+			    struct dvb_epg_event *events,
+			    unsigned max_events);
+
+/**
+ * @brief Checks if all sections of the EIT tables of a service were received
+ * @ingroup dvb_table
+ *
+ * @param epg		pointer to the database
+ * @param id		service
+ * @param schedule	if zero, checks the present/following table.
+ *			Otherwise, checks all schedule tables, up to the
+ *			last table ID announced on them.
+ *
+ * The schedule tables are split on segments of 8 sections, as described at
+ * ETSI TS 101 211. A segment is complete when all of its sections, up to
+ * its segment_last_section_number, were received.
+ *
+ * @return 1 if complete, 0 otherwise.
+ */
+int dvb_epg_is_complete(struct dvb_epg *epg,
+			const struct dvb_epg_service_id *id,
+			int schedule);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-fe-sampler.h
+ * @ingroup frontend
+ * @brief Provides a background sampler for the frontend statistics
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ * @author Mauro Carvalho Chehab
+ *
+ * The sampler runs a thread that gets the frontend statistics at a fixed
+ * rate, storing them on a ring with the most recent samples. Reading the
+ * samples doesn't lock, nor waits for the frontend, so monitoring the
+ * signal doesn't delay the application. It works with both local and
+ * remote frontends.
+ *
+ * While the sampler runs, the calls that talk to the frontend are
+ * serialized with the sampling, and the application should get the
+ * statistics from the sampler instead of calling dvb_fe_get_stats().
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_FE_SAMPLER_H
+#define _DVB_FE_SAMPLER_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "dvb-fe.h"
+
+/**
+ * @struct dvb_fe_sample
+ * @ingroup frontend
+ * @brief Frontend statistics taken at a given time
+ *
+ * @param time		time when the sample was taken, on CLOCK_MONOTONIC
+ * @param status	frontend status
+ * @param signal_scale	scale of the signal strength
+ * @param signal	signal strength, in dBm if signal_scale is
+ *			FE_SCALE_DECIBEL, or in percent otherwise
+ * @param cnr_scale	scale of the carrier to noise ratio
+ * @param cnr		carrier to noise ratio, in dB if cnr_scale is
+ *			FE_SCALE_DECIBEL, or in percent otherwise
+ * @param pre_ber	bit error rate before the inner code, negative if
+ *			not available
+ * @param ber		bit error rate after the inner code, negative if
+ *			not available
+ * @param per		packet error rate, negative if not available
+ * @param ucb		counter of uncorrected blocks
+ * @param quality	signal quality, as given by
+ *			dvb_fe_retrieve_quality()
+ */
+struct dvb_fe_sample {
+	struct timespec time;
+	fe_status_t status;
+	enum fecap_scale_params signal_scale;
+	double signal;
+	enum fecap_scale_params cnr_scale;
+	double cnr;
+	float pre_ber, ber, per;
+	uint64_t ucb;
+	enum dvb_quality quality;
+};
+
+/**
+ * @struct dvb_fe_sample_range
+ * @ingroup frontend
+ * @brief Range of the values of a statistic on a time window
+ *
+ * @param count		number of samples with the value available
+ * @param min		minimum value
+ * @param avg		average value
+ * @param max		maximum value
+ */
+struct dvb_fe_sample_range {
+	unsigned count;
+	double min, avg, max;
+};
+
+/**
+ * @struct dvb_fe_sample_window
+ * @ingroup frontend
+ * @brief Summary of the samples taken on a time window
+ *
+ * @param samples	number of samples on the window
+ * @param locked	number of samples with FE_HAS_LOCK
+ * @param signal	signal strength, on the scale of the last sample
+ * @param cnr		carrier to noise ratio, on the scale of the last
+ *			sample
+ * @param pre_ber	bit error rate before the inner code
+ * @param ber		bit error rate after the inner code
+ * @param per		packet error rate
+ * @param ucb		uncorrected blocks counted on the window
+ */
+struct dvb_fe_sample_window {
+	unsigned samples, locked;
+	struct dvb_fe_sample_range signal, cnr, pre_ber, ber, per;
+	uint64_t ucb;
+};
+
+/**
+ * @struct dvb_fe_sampler
+ * @ingroup frontend
+ * @brief Opaque struct with the sampler state
+ */
+struct dvb_fe_sampler;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Starts sampling the frontend statistics
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param interval_ms	interval between the samples, in milliseconds
+ * @param history	number of samples to keep
+ *
+ * Only one sampler can run per frontend, and it should be stopped before
+ * closing the frontend.
+ *
+ * @return It returns a pointer to the sampler, or NULL if it fails.
+ */
+struct dvb_fe_sampler *dvb_fe_sampler_start(struct dvb_v5_fe_parms *parms,
+					    unsigned interval_ms,
+					    unsigned history);
+
+/**
+ * @brief Stops the sampler and frees its resources
+ * @ingroup frontend
+ *
+ * @param sampler	sampler returned by dvb_fe_sampler_start()
+ */
+void dvb_fe_sampler_stop(struct dvb_fe_sampler *sampler);
+
+/**
+ * @brief Gets the most recent sample
+ * @ingroup frontend
+ *
+ * @param sampler	sampler returned by dvb_fe_sampler_start()
+ * @param sample	where the sample will be stored
+ *
+ * @return It returns zero on success, or -EAGAIN if no sample was taken
+ * yet.
+ */
+int dvb_fe_sampler_last(struct dvb_fe_sampler *sampler,
+			struct dvb_fe_sample *sample);
+
+/**
+ * @brief Gets the most recent samples
+ * @ingroup frontend
+ *
+ * @param sampler	sampler returned by dvb_fe_sampler_start()
+ * @param samples	array where the samples will be stored, oldest first
+ * @param max_samples	size of the samples array
+ *
+ * @return It returns the number of samples stored.
+ */
+unsigned dvb_fe_sampler_get(struct dvb_fe_sampler *sampler,
+			    struct dvb_fe_sample *samples,
+			    unsigned max_samples);
+
+/**
+ * @brief Summarizes the samples taken on the last milliseconds
+ * @ingroup frontend
+ *
+ * @param sampler	sampler returned by dvb_fe_sampler_start()
+ * @param window_ms	size of the window, in milliseconds
+ * @param window	where the summary will be stored
+ *
+ * @return It returns zero on success, or -EAGAIN if there are no samples
+ * on the window.
+ */
+int dvb_fe_sampler_window(struct dvb_fe_sampler *sampler, unsigned window_ms,
+			  struct dvb_fe_sample_window *window);
+
+/**
+ * @brief Exports the samples as text
+ * @ingroup frontend
+ *
+ * @param sampler	sampler returned by dvb_fe_sampler_start()
+ * @param buf		buffer where the text will be written
+ * @param size		size of the buffer
+ *
+ * Writes one line per sample, oldest first, with the time in milliseconds,
+ * the status, the signal strength and the CNR with their units, the pre
+ * and post inner code BER, the PER and the uncorrected blocks counter,
+ * separated by commas. Values that aren't available are left empty. Like
+ * snprintf(), the output is truncated to fit on the buffer.
+ *
+ * @return It returns the size of the whole output, without the trailing
+ * NUL.
+ */
+ssize_t dvb_fe_sampler_export(struct dvb_fe_sampler *sampler, char *buf,
+			      size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
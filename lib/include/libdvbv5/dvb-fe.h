@@ -105,10 +105,14 @@
  * @param lnb			LNBf description (RW)
  * @param sat_number		Number of the satellite (used by DISEqC setup) (RW)
  * @param freq_bpf		SCR/Unicable band-pass filter frequency to use, in kHz
+ * @param diseqc_wait		Extra time to wait for DiSEqC command completion,
+ *				in ms (RW)
  * @param verbose		Verbosity level of the library (RW)
  * @param dvb_logfunc		Function used to write log messages (RO)
  * @param default_charset	Name of the charset used by the DVB standard (RW)
  * @param output_charset	Name of the charset to output (system specific) (RW)
+ * @param diseqc_settle		Time between two SEC/DiSEqC commands, in ms.
+ *				0 uses the default of 15 ms (RW)
  *
  * @details The fields marked as RO should not be changed by the client, as otherwise
  * undesired effects may happen. The ones marked as RW are ok to either read
@@ -145,6 +149,9 @@ struct dvb_v5_fe_parms {
 	/* Charsets to be used by the conversion utilities */
 	char				*default_charset;
 	char				*output_charset;
+
+	/* Satellite settings added after the first API version */
+	unsigned			diseqc_settle;
 };
 
 #ifdef __cplusplus
@@ -602,6 +609,26 @@ int dvb_fe_snprintf_eng(char *buf, int len, float val);
  */
 int dvb_fe_get_event(struct dvb_v5_fe_parms *parms);
 
+/**
+ * @brief Wait for the frontend to lock
+ * @ingroup frontend
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer to the opened device
+ * @param timeout_ms	maximum time to wait, in milliseconds
+ *
+ * Updates the stats cache, like dvb_fe_get_stats(), until the frontend
+ * status has FE_HAS_LOCK or the timeout expires. The frontend events are
+ * used to wake up as soon as the status changes. The status is also
+ * checked every few tens of milliseconds, for remote devices and for
+ * drivers that don't report all status changes.
+ *
+ * The wait is aborted if parms->abort is set.
+ *
+ * @return It returns 0 if the frontend is locked, -ETIMEDOUT if it didn't
+ * lock in time, -EINTR if aborted or the error of dvb_fe_get_stats().
+ */
+int dvb_fe_wait_lock(struct dvb_v5_fe_parms *parms, unsigned timeout_ms);
+
 /*
  * Other functions, associated to SEC/LNB/DISEqC
  *
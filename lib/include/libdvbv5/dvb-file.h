@@ -336,6 +336,201 @@ struct dvb_file *dvb_read_file_format(const char *fname,
 					   uint32_t delsys,
 					   enum dvb_file_formats format);
 
+/**
+ * @brief Read a single entry from a file at libdvbv5 format
+ * @ingroup file
+ *
+ * @param fname		file name
+ * @param channel	name or virtual channel of the entry to be read
+ * @param frequency	if not zero, frequency of the entry to read when
+ *			no entry matches the channel
+ *
+ * The file is mapped into memory and only the group names and the keys
+ * needed to find the entry are looked at, so reading a single channel
+ * from a large file is much faster than dvb_read_file(). The entry is
+ * chosen like dvb_file_find_channel() does, falling back to the first
+ * entry on the given frequency. Errors on the other entries of the file
+ * are not reported.
+ *
+ * @return It returns a pointer to struct dvb_file with the entry that was
+ * found, or without entries if none matches. If it fails, NULL is
+ * returned.
+ */
+struct dvb_file *dvb_read_file_channel(const char *fname,
+				       const char *channel,
+				       uint32_t frequency);
+
+/**
+ * @struct dvb_file_index
+ * @brief Opaque struct with hash tables to find the entries of a file
+ * @ingroup file
+ */
+struct dvb_file_index;
+
+/**
+ * @brief Create an index to find the entries of a file
+ * @ingroup file
+ *
+ * @param dvb_file	file to be indexed
+ *
+ * The index refers to the entries of dvb_file, and should be freed, and
+ * created again, if entries are added or removed.
+ *
+ * @return It returns a pointer to the index, or NULL if it fails.
+ */
+struct dvb_file_index *dvb_file_index_alloc(struct dvb_file *dvb_file);
+
+/**
+ * @brief Free an index created by dvb_file_index_alloc()
+ * @ingroup file
+ *
+ * @param index		index to be freed
+ */
+void dvb_file_index_free(struct dvb_file_index *index);
+
+/**
+ * @brief Find an entry by its channel name or virtual channel
+ * @ingroup file
+ *
+ * @param index		index of the file
+ * @param name		name of the channel
+ *
+ * If no channel or virtual channel matches, a case insensitive match
+ * of the channel name is tried.
+ *
+ * @return It returns the first entry on the file that matches, or NULL.
+ */
+struct dvb_entry *dvb_file_find_channel(struct dvb_file_index *index,
+					const char *name);
+
+/**
+ * @brief Find an entry by its service ID
+ * @ingroup file
+ *
+ * @param index		index of the file
+ * @param service_id	service ID
+ *
+ * @return It returns the first entry on the file that matches, or NULL.
+ */
+struct dvb_entry *dvb_file_find_service_id(struct dvb_file_index *index,
+					   uint16_t service_id);
+
+/**
+ * @brief Find an entry by its frequency
+ * @ingroup file
+ *
+ * @param index		index of the file
+ * @param frequency	frequency, as stored at DTV_FREQUENCY
+ *
+ * @return It returns the first entry on the file that matches, or NULL.
+ */
+struct dvb_entry *dvb_file_find_frequency(struct dvb_file_index *index,
+					  uint32_t frequency);
+
+/**
+ * @struct dvb_file_reader
+ * @brief Opaque struct used to read a file one entry at a time
+ * @ingroup file
+ */
+struct dvb_file_reader;
+
+/**
+ * @struct dvb_file_writer
+ * @brief Opaque struct used to write a file one entry at a time
+ * @ingroup file
+ */
+struct dvb_file_writer;
+
+/**
+ * @brief Open a file on any format natively supported by the library, to
+ *	  read its entries one at a time
+ * @ingroup file
+ *
+ * @param fname		file name
+ * @param delsys	Delivery system, as specified by enum fe_delivery_system
+ * @param format	Name of the format to be read
+ * @param threads	number of threads used to parse the file. If 0 or 1,
+ *			the file is parsed by the thread reading the entries.
+ *
+ * Unlike dvb_read_file_format(), only a small number of entries are kept
+ * in memory at a time, so large files can be converted without reading
+ * all of them first. With more than one thread, large files are mapped
+ * into memory and split into chunks, always at an entry boundary, that
+ * are parsed in parallel. The entries are still returned in the order
+ * they're on the file.
+ *
+ * @return It returns a pointer to the reader, or NULL if it fails.
+ */
+struct dvb_file_reader *dvb_file_reader_open(const char *fname,
+					     uint32_t delsys,
+					     enum dvb_file_formats format,
+					     unsigned threads);
+
+/**
+ * @brief Read the next entry of a file
+ * @ingroup file
+ *
+ * @param reader	reader returned by dvb_file_reader_open()
+ * @param entry		where the pointer to the entry will be stored
+ *
+ * The entry belongs to the reader, and it is valid only until the next
+ * entries are read, or the reader is closed.
+ *
+ * @return It returns 1 if an entry was read, zero at the end of the file,
+ * or a negative value on errors.
+ */
+int dvb_file_reader_next(struct dvb_file_reader *reader,
+			 struct dvb_entry **entry);
+
+/**
+ * @brief Close a reader and free its resources
+ * @ingroup file
+ *
+ * @param reader	reader returned by dvb_file_reader_open()
+ */
+void dvb_file_reader_close(struct dvb_file_reader *reader);
+
+/**
+ * @brief Create a file on any format natively supported by the library,
+ *	  to write its entries one at a time
+ * @ingroup file
+ *
+ * @param fname		file name
+ * @param delsys	Delivery system, as specified by enum fe_delivery_system
+ * @param format	Name of the format to be written
+ *
+ * @return It returns a pointer to the writer, or NULL if it fails.
+ */
+struct dvb_file_writer *dvb_file_writer_open(const char *fname,
+					     uint32_t delsys,
+					     enum dvb_file_formats format);
+
+/**
+ * @brief Write an entry to a file
+ * @ingroup file
+ *
+ * @param writer	writer returned by dvb_file_writer_open()
+ * @param entry		entry to be written
+ *
+ * Entries that can't be represented on the format are skipped, as done
+ * by dvb_write_file_format().
+ *
+ * @return It returns zero on success, or a negative value on errors.
+ */
+int dvb_file_writer_write(struct dvb_file_writer *writer,
+			  struct dvb_entry *entry);
+
+/**
+ * @brief Close a writer, flushing the file
+ * @ingroup file
+ *
+ * @param writer	writer returned by dvb_file_writer_open()
+ *
+ * @return It returns zero if all entries were written, or a negative
+ * value otherwise.
+ */
+int dvb_file_writer_close(struct dvb_file_writer *writer);
+
 /**
  * @brief Write a file on any format natively supported by
  *			    the library
@@ -244,6 +244,43 @@ struct dvb_v5_descriptors *dvb_scan_alloc_handler_table(uint32_t delivery_system
  */
 void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler);
 
+/**
+ * @brief Enables or disables reading the MPEG-TS tables concurrently
+ * @ingroup frontend_scan
+ *
+ * @param parms			pointer to struct dvb_v5_fe_parms created when
+ *				the frontend is opened
+ * @param enable		if not zero, dvb_get_ts_tables() opens a demux
+ *				filter for each table and reads all of them
+ *				at the same time.
+ *
+ * By default, the tables are read one after the other, each one waiting
+ * for the previous one to be complete or to time out. On the concurrent
+ * mode, the PAT, NIT, SDT and VCT are read together, followed by all PMTs
+ * together. This needs a demux that supports several filters at once.
+ */
+void dvb_scan_set_concurrent_tables(struct dvb_v5_fe_parms *parms, int enable);
+
+/**
+ * @brief Enables or disables the on-disk cache of MPEG-TS table sections
+ * @ingroup frontend_scan
+ *
+ * @param parms			pointer to struct dvb_v5_fe_parms created when
+ *				the frontend is opened
+ * @param dir			directory where the sections are stored. It is
+ *				created if it doesn't exist. NULL disables the
+ *				cache.
+ *
+ * The sections of each table are stored per transponder, PID, table ID and
+ * table ID extension. When a table is read again and its first section has
+ * the same version as the cached one, the cached sections are used, instead
+ * of waiting for all of them to be received. Tables read with section gaps
+ * allowed or for a specific TS ID are not cached.
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int dvb_scan_set_table_cache(struct dvb_v5_fe_parms *parms, const char *dir);
+
 /**
  * @brief Scans a DVB stream, looking for the tables needed to
  *			 identify the programs inside a MPEG-TS
@@ -264,6 +301,11 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler);
  *
  * On sucess, it returns a pointer to a struct dvb_v5_descriptors, that can
  * either be used to tune into a service or to be stored inside a file.
+ *
+ * Each table is waited for about its maximum repetition interval, longer if
+ * the tables of this transport stream arrive late. The tables missing on
+ * the previous transport streams of the same network are only waited for
+ * briefly.
  */
 struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *parms, int dmx_fd,
 					  uint32_t delivery_system,
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+/**
+ * @file dvb-section.h
+ * @ingroup dvb_table
+ * @brief Reassembles the MPEG-TS sections out of the Transport Stream packets
+ * @copyright GNU Lesser General Public License version 2.1 (LGPLv2.1)
+ * @author Mauro Carvalho Chehab
+ *
+ * When the whole Transport Stream is received, e.g. from a dvr device, from
+ * a recorded file or from a remote server, the section filters of the
+ * Kernel can't be used. The section demux gets the sections of the PIDs it
+ * was asked for out of the packets, and passes them either to the table
+ * parsers, as dvb_read_sections() does, or to a handler.
+ *
+ * Unless asked otherwise, sections with a wrong CRC or that aren't
+ * currently applicable are discarded, and so are the sections already
+ * received with the same version. As the tables are repeated all the time,
+ * most of the sections are duplicated: they're dropped as soon as their
+ * header is seen, without being copied or checked.
+ *
+ * @par Relevant specs
+ * - ISO/IEC 13818-1
+ *
+ * @par Bug Report
+ * Please submit bug reports and patches to linux-media@vger.kernel.org
+ */
+
+#ifndef _DVB_SECTION_H
+#define _DVB_SECTION_H
+
+#include <stdint.h>
+#include <unistd.h> /* ssize_t */
+
+/**
+ * @struct dvb_section_demux
+ * @ingroup dvb_table
+ * @brief Opaque section demux
+ */
+struct dvb_section_demux;
+
+/**
+ * @struct dvb_section_demux_stats
+ * @ingroup dvb_table
+ * @brief Counters of a section demux
+ *
+ * @param packets		packets received on the filtered PIDs
+ * @param sections		sections passed to the tables or handlers
+ * @param duplicates		sections dropped, as already received
+ * @param crc_errors		sections dropped due to a wrong CRC
+ * @param lost			sections lost due to missing or bad packets
+ * @param version_changes	times a table changed its version
+ */
+struct dvb_section_demux_stats {
+	uint64_t packets;
+	uint64_t sections;
+	uint64_t duplicates;
+	uint64_t crc_errors;
+	uint64_t lost;
+	uint64_t version_changes;
+};
+
+/**
+ * @brief Pass all sections to the handler, as the Kernel does
+ * @ingroup dvb_table
+ *
+ * Neither the CRC nor the version of the sections are checked.
+ */
+#define DVB_SECTION_RAW		(1 << 0)
+
+/**
+ * @brief Handler called for each section received
+ * @ingroup dvb_table
+ *
+ * @param priv		private data given to dvb_section_demux_add_handler()
+ * @param pid		PID of the section
+ * @param buf		buffer with the section, including its CRC
+ * @param buflen	length of the section
+ */
+typedef void dvb_section_handler_t(void *priv, uint16_t pid,
+				   const uint8_t *buf, size_t buflen);
+
+struct dvb_v5_fe_parms;
+struct dvb_table_filter;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocates a section demux
+ * @ingroup dvb_table
+ *
+ * @param parms		struct dvb_v5_fe_parms pointer, used to parse the
+ *			tables and to log errors
+ *
+ * @return a pointer to the demux, or NULL if there's no memory.
+ */
+struct dvb_section_demux *dvb_section_demux_alloc(struct dvb_v5_fe_parms *parms);
+
+/**
+ * @brief Frees a section demux
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ *
+ * The tables filled by the demux are not freed.
+ */
+void dvb_section_demux_free(struct dvb_section_demux *demux);
+
+/**
+ * @brief Parses a table out of the Transport Stream
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ * @param sect		table filter, as used by dvb_read_sections()
+ *
+ * The sections of sect->tid on sect->pid are parsed into sect->table, in
+ * the same way as dvb_read_sections() does. The table filter should be
+ * kept until the demux is freed. The table should be freed by the caller
+ * with the free function of its type, even if it is not complete.
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int dvb_section_demux_add_table(struct dvb_section_demux *demux,
+				struct dvb_table_filter *sect);
+
+/**
+ * @brief Passes sections out of the Transport Stream to a handler
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ * @param pid		PID of the sections
+ * @param table_id	table ID of the sections
+ * @param mask		bits of the table ID to check
+ * @param flags		0, or DVB_SECTION_RAW
+ * @param handler	called for each section
+ * @param priv		private data passed to the handler
+ *
+ * @return 0 on success, or a negative error code.
+ */
+int dvb_section_demux_add_handler(struct dvb_section_demux *demux,
+				  uint16_t pid, uint8_t table_id,
+				  uint8_t mask, unsigned flags,
+				  dvb_section_handler_t *handler, void *priv);
+
+/**
+ * @brief Removes the tables and handlers of a PID
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ * @param pid		PID to stop filtering
+ *
+ * Also forgets the sections of the PID already received.
+ */
+void dvb_section_demux_remove_pid(struct dvb_section_demux *demux,
+				  uint16_t pid);
+
+/**
+ * @brief Gets the sections out of a buffer with Transport Stream packets
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ * @param buf		buffer with the Transport Stream
+ * @param buflen	length of the buffer
+ *
+ * Any number of packets can be passed at once. The data before the sync
+ * byte of a packet is discarded. A packet partly at the end of the buffer
+ * isn't processed: the caller should pass the remaining bytes again,
+ * followed by the data received later.
+ *
+ * @return the number of bytes processed.
+ */
+ssize_t dvb_section_demux_feed(struct dvb_section_demux *demux,
+			       const uint8_t *buf, ssize_t buflen);
+
+/**
+ * @brief Checks if all tables added to the demux are complete
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ *
+ * @return 1 if all tables are complete, 0 otherwise.
+ */
+int dvb_section_demux_is_done(struct dvb_section_demux *demux);
+
+/**
+ * @brief Returns the counters of a section demux
+ * @ingroup dvb_table
+ *
+ * @param demux		pointer to the demux
+ */
+const struct dvb_section_demux_stats *
+dvb_section_demux_get_stats(struct dvb_section_demux *demux);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
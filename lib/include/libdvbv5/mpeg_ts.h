@@ -46,9 +46,17 @@
  * @def DVB_MPEG_TS_PACKET_SIZE
  *	@brief Size of an MPEG packet
  *	@ingroup dvb_table
+ * @def DVB_MPEG_TS_NUM_PIDS
+ *	@brief Number of possible Packet IDs
+ *	@ingroup dvb_table
+ * @def DVB_MPEG_TS_NULL_PID
+ *	@brief Packet ID of the NULL packets
+ *	@ingroup dvb_table
  */
 #define DVB_MPEG_TS  0x47
 #define DVB_MPEG_TS_PACKET_SIZE  188
+#define DVB_MPEG_TS_NUM_PIDS  0x2000
+#define DVB_MPEG_TS_NULL_PID  0x1fff
 
 /**
  * @struct dvb_mpeg_ts_adaption
@@ -120,6 +128,44 @@ struct dvb_mpeg_ts {
 
 struct dvb_v5_fe_parms;
 
+/**
+ * @struct dvb_mpeg_ts_pid_stats
+ * @brief Packet counters of a single PID
+ * @ingroup dvb_table
+ *
+ * @param packets		Number of packets received
+ * @param cc_errors		Number of continuity counter errors
+ * @param tei_errors		Number of packets with the Transport Error Indicator set
+ * @param last_cc		Last continuity counter, or -1 if unknown
+ */
+struct dvb_mpeg_ts_pid_stats {
+	uint64_t packets;
+	uint64_t cc_errors;
+	uint64_t tei_errors;
+	int8_t last_cc;
+};
+
+/**
+ * @struct dvb_mpeg_ts_stats
+ * @brief Packet counters of an MPEG Transport Stream
+ * @ingroup dvb_table
+ *
+ * @param pid			Counters per PID
+ * @param packets		Total number of packets received
+ * @param cc_errors		Total number of continuity counter errors
+ * @param tei_errors		Total number of packets with the Transport Error Indicator set
+ * @param resyncs		Number of times the sync byte was lost
+ * @param discarded		Number of bytes discarded to get back in sync
+ */
+struct dvb_mpeg_ts_stats {
+	struct dvb_mpeg_ts_pid_stats pid[DVB_MPEG_TS_NUM_PIDS];
+	uint64_t packets;
+	uint64_t cc_errors;
+	uint64_t tei_errors;
+	uint64_t resyncs;
+	uint64_t discarded;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -165,6 +211,37 @@ void dvb_mpeg_ts_free(struct dvb_mpeg_ts *ts);
  */
 void dvb_mpeg_ts_print(struct dvb_v5_fe_parms *parms, struct dvb_mpeg_ts *ts);
 
+/**
+ * @brief Reset the counters of a struct dvb_mpeg_ts_stats
+ * @ingroup dvb_table
+ *
+ * @param stats		Pointer to struct dvb_mpeg_ts_stats to reset
+ */
+void dvb_mpeg_ts_stats_reset(struct dvb_mpeg_ts_stats *stats);
+
+/**
+ * @brief Count the packets of an MPEG Transport Stream buffer, per PID
+ * @ingroup dvb_table
+ *
+ * @param stats		Pointer to struct dvb_mpeg_ts_stats to update
+ * @param buf		Buffer with the Transport Stream
+ * @param buflen	Length of buffer
+ * @param check_cc	If zero, the continuity counters are tracked,
+ *			but not checked for errors
+ *
+ * @return		Number of bytes processed
+ *
+ * This function looks for the sync byte of each packet, discarding
+ * data until it finds a sync byte again if it is lost. The packets and
+ * the packets with the Transport Error Indicator are counted per PID,
+ * and the continuity counters are checked. A packet partly at the end
+ * of the buffer isn't processed: the caller should pass the remaining
+ * bytes again, followed by the data received later.
+ */
+ssize_t dvb_mpeg_ts_stats_update(struct dvb_mpeg_ts_stats *stats,
+				 const uint8_t *buf, ssize_t buflen,
+				 int check_cc);
+
 #ifdef __cplusplus
 }
 #endif
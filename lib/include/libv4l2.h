@@ -104,6 +104,23 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
 /* This flag is *OBSOLETE*, since version 0.5.98 libv4l *always* reports
    emulated formats to ENUM_FMT, except when conversion is disabled. */
 #define V4L2_ENABLE_ENUM_FMT_EMULATION 0x02
+/* Collect the per stage timings returned by v4l2_get_frame_stats(), this
+   can also be enabled by setting the LIBV4L2_FRAME_STATS environment
+   variable. Its value is a number of frames after which the statistics
+   get written to the log file (see v4l2_log_file), 0 for never. */
+#define V4L2_ENABLE_FRAME_STATS 0x04
+/* Convert frames in a background thread when streaming with conversion.
+   The thread dequeues the driver's buffers as soon as they are filled,
+   converts them into one of the buffers queued by the app and requeues the
+   driver's buffer at once, so that DQBUF returns already converted frames.
+   When the app holds on to all its buffers new frames get dropped. Note
+   that poll() / select() still report the state of the driver's queue, so
+   they may signal a converted frame one frame late, apps should use a
+   blocking DQBUF instead. For the read() emulation the thread converts
+   ahead into libv4l2's own buffers, so read() just copies out the oldest
+   converted frame. This can also be enabled by setting the
+   LIBV4L2_ASYNC_CONVERSION environment variable to 1. */
+#define V4L2_ENABLE_ASYNC_CONVERSION 0x08
 
 /* v4l2_fd_open: open an already opened fd for further use through
    v4l2lib and possibly modify libv4l2's default behavior through the
@@ -113,6 +130,35 @@ LIBV4L_PUBLIC int v4l2_get_control(int fd, int cid);
    (note the fd is left open in this case). */
 LIBV4L_PUBLIC int v4l2_fd_open(int fd, int v4l2_flags);
 
+/* Frame statistics of a libv4l2 fd, these cover all frames captured
+   through libv4l2 since the fd got opened or the statistics got reset.
+   dropped is derived from gaps in the buffer sequence numbers, retries
+   counts frames which got discarded because they failed to convert and
+   short_frames counts incomplete frames which got returned anyways. The
+   times are in nanoseconds and are only collected when enabled through
+   V4L2_ENABLE_FRAME_STATS, dequeue_ns is the time spent waiting for the
+   driver in DQBUF or read(), the decode / convert / processing / transform
+   times are those of libv4lconvert (see struct v4lconvert_stats) and
+   max_convert_ns is the longest time libv4lconvert took for a frame. */
+struct v4l2_frame_stats {
+	unsigned long long frames;
+	unsigned long long dropped;
+	unsigned long long retries;
+	unsigned long long decode_errors;
+	unsigned long long short_frames;
+	unsigned long long dequeue_ns;
+	unsigned long long decode_ns;
+	unsigned long long convert_ns;
+	unsigned long long processing_ns;
+	unsigned long long transform_ns;
+	unsigned long long max_convert_ns;
+};
+
+/* Returns 0 on success, -1 with errno EBADF if fd was not opened through
+   libv4l2. */
+LIBV4L_PUBLIC int v4l2_get_frame_stats(int fd, struct v4l2_frame_stats *stats);
+LIBV4L_PUBLIC int v4l2_reset_frame_stats(int fd);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
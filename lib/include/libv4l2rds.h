@@ -51,6 +51,8 @@ extern "C" {
 			* This value is not defined by the standard, but based on observation
 			* of real-world RDS-TMC streams. EON doesn't seem to be a widely used feature
 			* and the maximum number of EON encountered during testing was 8 */
+#define MAX_TMC_MSG_CNT 16	/* number of decoded TMC messages kept in the
+			* ring of the last messages, see v4l2_rds_get_tmc_msg() */
 
 /* Define Constants for the possible types of RDS information
  * used to address the relevant bit in the valid_fields bitmask */
@@ -258,6 +260,11 @@ struct v4l2_rds_tmc {
 
 	/* tuning information for alternative service providers */
 	struct v4l2_tmc_tuning tuning;
+
+	/* ring of the last decoded TMC messages, the last message is also
+	 * in tmc_msg */
+	uint32_t tmc_msg_cnt;	/* number of messages decoded so far */
+	struct v4l2_rds_tmc_msg tmc_msg_ring[MAX_TMC_MSG_CNT];
 };
 
 /* struct to encapsulate state and RDS information for current decoding process */
@@ -321,6 +328,14 @@ LIBV4L_PUBLIC void v4l2_rds_reset(struct v4l2_rds *handle, bool reset_statistics
  * 				on RDS capable V4L2 devices */
 LIBV4L_PUBLIC uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data);
 
+/* adds an array of raw RDS blocks, e.g. as returned by a single read()
+ * @return:	bitmask with the fields updated by any of the completed groups
+ * @rds_data:	array of raw RDS blocks
+ * @count:	number of blocks in the array
+ * v4l2_rds_get_group() only returns the last completed group */
+LIBV4L_PUBLIC uint32_t v4l2_rds_add_blocks(struct v4l2_rds *handle,
+		const struct v4l2_rds_data *rds_data, unsigned int count);
+
 /*
  * group of functions to translate numerical RDS data into strings
  *
@@ -331,6 +346,16 @@ LIBV4L_PUBLIC const char *v4l2_rds_get_language_str(const struct v4l2_rds *handl
 LIBV4L_PUBLIC const char *v4l2_rds_get_country_str(const struct v4l2_rds *handle);
 LIBV4L_PUBLIC const char *v4l2_rds_get_coverage_str(const struct v4l2_rds *handle);
 
+/* returns a pointer to a decoded TMC message without copying it
+ * @seq:	sequence number of the message, the first decoded message is 0
+ *		and the last one is tmc.tmc_msg_cnt - 1
+ * @return:	NULL if the message was not decoded yet, or was overwritten
+ *		because it is older than the last MAX_TMC_MSG_CNT messages
+ * A consumer keeps the sequence number of the next message it wants to
+ * read, so it does not miss messages between two calls */
+LIBV4L_PUBLIC const struct v4l2_rds_tmc_msg *v4l2_rds_get_tmc_msg
+	(const struct v4l2_rds *handle, uint32_t seq);
+
 /* returns a pointer to the last decoded RDS group, in order to give raw
  * access to RDS data if it is required (e.g. ODA decoding) */
 LIBV4L_PUBLIC const struct v4l2_rds_group *v4l2_rds_get_group
@@ -82,6 +82,12 @@ LIBV4L_PUBLIC int v4lconvert_try_format(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, /* in / out */
 		struct v4l2_format *src_fmt); /* out */
 
+/* v4lconvert_try_format() remembers the outcome of the TRY_FMT ioctls it
+   does, call this after anything which may change what the device will
+   accept, such as VIDIOC_S_FMT, VIDIOC_S_INPUT or VIDIOC_S_STD */
+LIBV4L_PUBLIC void v4lconvert_flush_try_format_cache(
+		struct v4lconvert_data *data);
+
 /* Like VIDIOC_ENUM_FMT, but the emulated formats are added at the end of the
    list, except if flipping / processing is active for the device, then only
    supported destination formats are listed */
@@ -151,6 +157,49 @@ LIBV4L_PUBLIC int v4lconvert_supported_dst_format(unsigned int pixelformat);
 LIBV4L_PUBLIC int v4lconvert_get_fps(struct v4lconvert_data *data);
 LIBV4L_PUBLIC void v4lconvert_set_fps(struct v4lconvert_data *data, int fps);
 
+/* Get/set the number of threads used to convert a single frame. The default
+   is 1, which does all work in the thread calling v4lconvert_convert(). A
+   value of 0 uses one thread per online CPU. The default can be overridden
+   through the LIBV4LCONVERT_THREADS environment variable. */
+LIBV4L_PUBLIC int v4lconvert_get_threads(struct v4lconvert_data *data);
+LIBV4L_PUBLIC int v4lconvert_set_threads(struct v4lconvert_data *data,
+		int threads);
+
+/* Get/set concurrent mode. By default an instance must not be used from
+   more than one thread at a time. In concurrent mode multiple threads may
+   call v4lconvert_convert() on the same instance simultaneously, each call
+   then uses its own scratch buffers and decoder state. Frames which need
+   software processing (whitebalance, gamma, ...) still get converted one
+   at a time, and the per instance worker threads are not used. All other
+   functions still need external locking, and the mode must only be
+   changed while no conversions are in progress. */
+LIBV4L_PUBLIC int v4lconvert_get_concurrent(struct v4lconvert_data *data);
+LIBV4L_PUBLIC void v4lconvert_set_concurrent(struct v4lconvert_data *data,
+		int concurrent);
+
+/* Conversion statistics. The counters are always kept, the times (in
+   nanoseconds) only after enabling them with v4lconvert_set_stats().
+   decode_ns is spent decompressing compressed formats, convert_ns
+   converting uncompressed formats, transform_ns rotating, flipping and
+   cropping, and total_ns covers all of v4lconvert_convert(). */
+struct v4lconvert_stats {
+	unsigned long long frames;
+	unsigned long long errors;
+	unsigned long long short_frames; /* errors with errno EPIPE */
+	unsigned long long decode_ns;
+	unsigned long long convert_ns;
+	unsigned long long processing_ns;
+	unsigned long long transform_ns;
+	unsigned long long total_ns;
+};
+
+LIBV4L_PUBLIC int v4lconvert_get_stats_enabled(struct v4lconvert_data *data);
+LIBV4L_PUBLIC void v4lconvert_set_stats_enabled(struct v4lconvert_data *data,
+		int enabled);
+LIBV4L_PUBLIC void v4lconvert_get_stats(struct v4lconvert_data *data,
+		struct v4lconvert_stats *stats);
+LIBV4L_PUBLIC void v4lconvert_reset_stats(struct v4lconvert_data *data);
+
 /* Fixup bytesperline and sizeimage for supported destination formats */
 LIBV4L_PUBLIC void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
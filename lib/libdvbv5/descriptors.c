@@ -56,6 +56,29 @@
 #include <libdvbv5/desc_ca.h>
 #include <libdvbv5/desc_ca_identifier.h>
 #include <libdvbv5/desc_extension.h>
+#include <dvb-arena-priv.h>
+#include "dvb-fe-priv.h"
+
+/*
+ * On lazy mode, the descriptors known by the library are allocated with
+ * their decoded size, but left zeroed. Their contents are kept just after
+ * them, and decoded by dvb_desc_decode() on the first access.
+ */
+enum dvb_desc_state {
+	DVB_DESC_PENDING,
+	DVB_DESC_DECODED,
+	DVB_DESC_FAILED,
+};
+
+struct dvb_desc_raw {
+	uint8_t state;
+	uint8_t data[];
+};
+
+static struct dvb_desc_raw *dvb_desc_raw(struct dvb_desc *desc)
+{
+	return (void *)((uint8_t *)desc + dvb_descriptors[desc->type].size);
+}
 
 static void dvb_desc_init(uint8_t type, uint8_t length, struct dvb_desc *desc)
 {
@@ -138,6 +161,7 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	const uint8_t *ptr = buf, *endbuf = buf + buflen;
 	struct dvb_desc *current = NULL;
 	struct dvb_desc *last = NULL;
+	int lazy = ((struct dvb_v5_fe_parms_priv *)parms)->lazy_desc;
 
 	*head_desc = NULL;
 
@@ -180,25 +204,29 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 			size = sizeof(struct dvb_desc) + desc_len;
 		} else {
 			size = dvb_descriptors[desc_type].size;
+			if (size && lazy)
+				size += sizeof(struct dvb_desc_raw) + desc_len;
 		}
 		if (!size) {
 			dvb_logerr("descriptor type 0x%02x has no size defined", desc_type);
 			return -2;
 		}
 
-		current = calloc(1, size);
+		current = dvb_mem_calloc(parms, 1, size);
 		if (!current) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
 		}
 		dvb_desc_init(desc_type, desc_len, current); /* initialize the standard header */
-		if (init(parms, ptr, current) != 0) {
+		if (lazy && init != dvb_desc_default_init) {
+			memcpy(dvb_desc_raw(current)->data, ptr, desc_len);
+		} else if (init(parms, ptr, current) != 0) {
 			dvb_logwarn("Couldn't handle descriptor type 0x%02x (%s?), size %d",
 				desc_type, dvb_descriptors[desc_type].name, desc_len);
 			if (parms->verbose)
 				dvb_hexdump(parms, "content: ", ptr, desc_len);
 
-			free(current);
+			dvb_mem_free(parms, current);
 			return -4;
 		}
 		if (!*head_desc)
@@ -211,6 +239,53 @@ int dvb_desc_parse(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	return 0;
 }
 
+void dvb_fe_set_lazy_descriptors(struct dvb_v5_fe_parms *__p, int lazy)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	parms->lazy_desc = lazy;
+}
+
+struct dvb_desc *dvb_desc_decode(struct dvb_v5_fe_parms *parms,
+				 struct dvb_desc *desc)
+{
+	struct dvb_desc_raw *raw;
+
+	if (!parms || !((struct dvb_v5_fe_parms_priv *)parms)->lazy_desc ||
+	    !dvb_descriptors[desc->type].init)
+		return desc;
+
+	raw = dvb_desc_raw(desc);
+	if (raw->state == DVB_DESC_PENDING) {
+		if (dvb_descriptors[desc->type].init(parms, raw->data, desc)) {
+			dvb_logwarn("Couldn't handle descriptor type 0x%02x (%s?), size %d",
+				desc->type, dvb_descriptors[desc->type].name, desc->length);
+			if (parms->verbose)
+				dvb_hexdump(parms, "content: ", raw->data, desc->length);
+			raw->state = DVB_DESC_FAILED;
+		} else {
+			raw->state = DVB_DESC_DECODED;
+		}
+	}
+
+	return raw->state == DVB_DESC_DECODED ? desc : NULL;
+}
+
+struct dvb_desc *dvb_desc_get(struct dvb_v5_fe_parms *parms,
+			      struct dvb_desc *list, uint8_t type)
+{
+	struct dvb_desc *desc;
+
+	for (; list; list = list->next) {
+		if (list->type != type)
+			continue;
+		desc = dvb_desc_decode(parms, list);
+		if (desc)
+			return desc;
+	}
+	return NULL;
+}
+
 void dvb_desc_print(struct dvb_v5_fe_parms *parms, struct dvb_desc *desc)
 {
 	while (desc) {
@@ -218,7 +293,8 @@ void dvb_desc_print(struct dvb_v5_fe_parms *parms, struct dvb_desc *desc)
 		if (!print)
 			print = dvb_desc_default_print;
 		dvb_loginfo("|        0x%02x: %s", desc->type, dvb_descriptors[desc->type].name);
-		print(parms, desc);
+		if (dvb_desc_decode(parms, desc))
+			print(parms, desc);
 		desc = desc->next;
 	}
 }
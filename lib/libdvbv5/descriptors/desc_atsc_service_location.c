@@ -20,6 +20,7 @@
 #include <libdvbv5/desc_atsc_service_location.h>
 #include <libdvbv5/dvb-fe.h>
 #include <ctype.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -65,7 +66,7 @@ int atsc_desc_service_location_init(struct dvb_v5_fe_parms *parms,
 	}
 
 	if (s_loc->number_elements) {
-		s_loc->elementary = malloc(len);
+		s_loc->elementary = dvb_mem_alloc(parms, len);
 		if (!s_loc->elementary) {
 			dvb_perror("Can't allocate space for ATSC service location elementary data");
 			return -1;
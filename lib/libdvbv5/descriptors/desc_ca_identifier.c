@@ -20,6 +20,7 @@
 
 #include <libdvbv5/desc_ca_identifier.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -31,7 +32,7 @@ int dvb_desc_ca_identifier_init(struct dvb_v5_fe_parms *parms, const uint8_t *bu
 	int i;
 
 	d->caid_count = d->length >> 1; /* FIXME: warn if odd */
-	d->caids = malloc(d->length);
+	d->caids = dvb_mem_alloc(parms, d->length);
 	if (!d->caids) {
 		dvb_logerr("dvb_desc_ca_identifier_init: out of memory");
 		return -1;
@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_event_extended.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <dvb-arena-priv.h>
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -59,7 +60,7 @@ int dvb_desc_event_extended_init(struct dvb_v5_fe_parms *parms, const uint8_t *b
 		if (first) {
 			first = 0;
 			event->num_items = 1;
-			event->items = calloc(sizeof(struct dvb_desc_event_extended_item), event->num_items);
+			event->items = dvb_mem_calloc(parms, sizeof(struct dvb_desc_event_extended_item), event->num_items);
 			if (!event->items) {
 				dvb_logerr(_("%s: out of memory"), __func__);
 				return -1;
@@ -67,7 +68,7 @@ int dvb_desc_event_extended_init(struct dvb_v5_fe_parms *parms, const uint8_t *b
 			item = event->items;
 		} else {
 			event->num_items++;
-			event->items = realloc(event->items, sizeof(struct dvb_desc_event_extended_item) * (event->num_items));
+			event->items = dvb_mem_realloc(parms, event->items, sizeof(struct dvb_desc_event_extended_item) * (event->num_items));
 			item = event->items + (event->num_items - 1);
 		}
 		len = *buf;
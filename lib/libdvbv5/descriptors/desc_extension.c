@@ -20,6 +20,7 @@
 #include <libdvbv5/desc_extension.h>
 #include <libdvbv5/desc_t2_delivery.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -153,7 +154,7 @@ int dvb_extension_descriptor_init(struct dvb_v5_fe_parms *parms,
 	if (!size)
 		size = desc_len;
 
-	ext->descriptor = calloc(1, size);
+	ext->descriptor = dvb_mem_calloc(parms, 1, size);
 
 	if (init) {
 		if (init(parms, p, ext, ext->descriptor) != 0)
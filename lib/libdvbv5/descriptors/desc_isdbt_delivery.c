@@ -20,6 +20,7 @@
 #include <libdvbv5/desc_isdbt_delivery.h>
 #include <libdvbv5/dvb-fe.h>
 #include <inttypes.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ int isdbt_desc_delivery_init(struct dvb_v5_fe_parms *parms,
 	}
 	if (!d->num_freqs)
 		return 0;
-	d->frequency = malloc(d->num_freqs * sizeof(*d->frequency));
+	d->frequency = dvb_mem_alloc(parms, d->num_freqs * sizeof(*d->frequency));
 	if (!d->frequency) {
 		dvb_perror("Can't allocate space for ISDB-T frequencies");
 		return -2;
@@ -19,6 +19,7 @@
 
 #include <libdvbv5/desc_registration_id.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -40,7 +41,7 @@ int dvb_desc_registration_init(struct dvb_v5_fe_parms *parms,
 	if (desc->length <= size)
 		return 0;
 
-	d->additional_identification_info = malloc(desc->length - size);
+	d->additional_identification_info = dvb_mem_alloc(parms, desc->length - size);
 	memcpy(desc->data, buf + size, desc->length - size);
 
 	return 0;
@@ -21,6 +21,7 @@
 #include <libdvbv5/desc_ts_info.h>
 #include <libdvbv5/dvb-fe.h>
 #include <parse_string.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -52,7 +53,7 @@ int dvb_desc_ts_info_init(struct dvb_v5_fe_parms *parms,
 
 	t = &d->transmission_type;
 
-	d->service_id = malloc(sizeof(*d->service_id) * t->num_of_service);
+	d->service_id = dvb_mem_alloc(parms, sizeof(*d->service_id) * t->num_of_service);
 	if (!d->service_id) {
 		dvb_logerr("%s: out of memory", __func__);
 		return -1;
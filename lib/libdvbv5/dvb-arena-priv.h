@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#ifndef __DVB_ARENA_PRIV_H
+#define __DVB_ARENA_PRIV_H
+
+#include <stddef.h>
+
+#if HAVE_VISIBILITY
+#pragma GCC visibility push(hidden)
+#endif
+
+struct dvb_v5_fe_parms;
+
+/*
+ * Memory for the parsed tables. They use the arena set on parms, if any,
+ * or the usual malloc() family otherwise.
+ */
+void *dvb_mem_alloc(struct dvb_v5_fe_parms *parms, size_t size);
+void *dvb_mem_calloc(struct dvb_v5_fe_parms *parms, size_t nmemb, size_t size);
+void *dvb_mem_realloc(struct dvb_v5_fe_parms *parms, void *ptr, size_t size);
+void dvb_mem_free(struct dvb_v5_fe_parms *parms, void *ptr);
+
+#if HAVE_VISIBILITY
+#pragma GCC visibility pop
+#endif
+
+#endif
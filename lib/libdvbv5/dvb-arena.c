@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dvb-fe-priv.h"
+#include "dvb-arena-priv.h"
+#include <libdvbv5/dvb-arena.h>
+
+#define DVB_ARENA_SLAB_SIZE	(256 * 1024)
+
+/*
+ * Each allocation is preceded by its size, needed by realloc(). The header
+ * is as big as the alignment, so the allocations stay aligned.
+ */
+#define DVB_ARENA_ALIGN		16
+#define DVB_ARENA_HDR		DVB_ARENA_ALIGN
+
+struct dvb_arena_slab {
+	struct dvb_arena_slab *next;
+	size_t size, used;
+	unsigned char data[] __attribute__((aligned(DVB_ARENA_ALIGN)));
+};
+
+struct dvb_arena {
+	size_t slab_size;
+
+	/* The first slab is the one being filled */
+	struct dvb_arena_slab *slabs;
+
+	/* Last allocation, that can be resized in place */
+	unsigned char *last;
+};
+
+static struct dvb_arena_slab *dvb_arena_new_slab(size_t size)
+{
+	struct dvb_arena_slab *slab;
+
+	slab = malloc(sizeof(*slab) + size);
+	if (!slab)
+		return NULL;
+	slab->next = NULL;
+	slab->size = size;
+	slab->used = 0;
+
+	return slab;
+}
+
+struct dvb_arena *dvb_arena_alloc(size_t slab_size)
+{
+	struct dvb_arena *arena;
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena)
+		return NULL;
+	arena->slab_size = slab_size ? slab_size : DVB_ARENA_SLAB_SIZE;
+
+	return arena;
+}
+
+void dvb_arena_reset(struct dvb_arena *arena)
+{
+	struct dvb_arena_slab *slab, *next;
+
+	if (!arena || !arena->slabs)
+		return;
+
+	for (slab = arena->slabs->next; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	arena->slabs->next = NULL;
+	arena->slabs->used = 0;
+	arena->last = NULL;
+}
+
+void dvb_arena_free(struct dvb_arena *arena)
+{
+	if (!arena)
+		return;
+
+	dvb_arena_reset(arena);
+	free(arena->slabs);
+	free(arena);
+}
+
+void dvb_fe_set_arena(struct dvb_v5_fe_parms *__p, struct dvb_arena *arena)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	parms->arena = arena;
+}
+
+static void *dvb_arena_get(struct dvb_arena *arena, size_t size)
+{
+	struct dvb_arena_slab *slab = arena->slabs;
+	size_t need;
+	unsigned char *p;
+
+	size = (size + DVB_ARENA_ALIGN - 1) & ~(size_t)(DVB_ARENA_ALIGN - 1);
+	need = size + DVB_ARENA_HDR;
+
+	/* Big allocations get their own slab, not to waste the current one */
+	if (need > arena->slab_size / 4) {
+		slab = dvb_arena_new_slab(need);
+		if (!slab)
+			return NULL;
+		if (arena->slabs) {
+			slab->next = arena->slabs->next;
+			arena->slabs->next = slab;
+		} else {
+			arena->slabs = slab;
+		}
+	} else if (!slab || slab->used + need > slab->size) {
+		slab = dvb_arena_new_slab(arena->slab_size);
+		if (!slab)
+			return NULL;
+		slab->next = arena->slabs;
+		arena->slabs = slab;
+	}
+
+	p = slab->data + slab->used;
+	slab->used += need;
+	*(size_t *)p = size;
+	p += DVB_ARENA_HDR;
+	if (slab == arena->slabs)
+		arena->last = p;
+
+	return p;
+}
+
+static void *dvb_arena_resize(struct dvb_arena *arena, unsigned char *ptr,
+			      size_t size)
+{
+	struct dvb_arena_slab *slab = arena->slabs;
+	size_t old = *(size_t *)(ptr - DVB_ARENA_HDR);
+	void *p;
+
+	size = (size + DVB_ARENA_ALIGN - 1) & ~(size_t)(DVB_ARENA_ALIGN - 1);
+	if (size <= old && ptr != arena->last)
+		return ptr;
+
+	/* The last allocation grows or shrinks in place, if it fits */
+	if (ptr == arena->last &&
+	    ptr - slab->data + size <= slab->size) {
+		slab->used = ptr - slab->data + size;
+		*(size_t *)(ptr - DVB_ARENA_HDR) = size;
+		return ptr;
+	}
+
+	p = dvb_arena_get(arena, size);
+	if (!p)
+		return NULL;
+	memcpy(p, ptr, old < size ? old : size);
+
+	return p;
+}
+
+void *dvb_mem_alloc(struct dvb_v5_fe_parms *__p, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	if (!parms->arena)
+		return malloc(size);
+
+	return dvb_arena_get(parms->arena, size);
+}
+
+void *dvb_mem_calloc(struct dvb_v5_fe_parms *__p, size_t nmemb, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	void *p;
+
+	if (!parms->arena)
+		return calloc(nmemb, size);
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+	p = dvb_arena_get(parms->arena, nmemb * size);
+	if (p)
+		memset(p, 0, nmemb * size);
+
+	return p;
+}
+
+void *dvb_mem_realloc(struct dvb_v5_fe_parms *__p, void *ptr, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	if (!parms->arena)
+		return realloc(ptr, size);
+
+	if (!ptr)
+		return dvb_arena_get(parms->arena, size);
+
+	return dvb_arena_resize(parms->arena, ptr, size);
+}
+
+void dvb_mem_free(struct dvb_v5_fe_parms *__p, void *ptr)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	/* Arena memory is only freed with the arena */
+	if (!parms->arena)
+		free(ptr);
+}
@@ -0,0 +1,889 @@
+/*
+ * Copyright (c) 2016 - Mauro Carvalho Chehab
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ */
+
+#define _FILE_OFFSET_BITS 64
+#define _LARGEFILE_SOURCE 1
+#define _LARGEFILE64_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dvb-fe-priv.h"
+#include "dvb-dev-priv.h"
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/mpeg_ts.h>
+#include <libdvbv5/dvb-section.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+#else
+# define _(string) string
+#endif
+
+/* taken from glibc unistd.h */
+#ifndef TEMP_FAILURE_RETRY
+#define TEMP_FAILURE_RETRY(expression) \
+    ({ long int __result;                                                     \
+       do __result = (long int) (expression);                                 \
+       while (__result == -1L && errno == EINTR);                             \
+       __result; })
+#endif
+
+/*
+ * A recorded MPEG-TS file, or stdin, seen as adapter 0 with a frontend, a
+ * demux and a dvr device. Tuning does nothing, and the frontend is always
+ * locked.
+ *
+ * Each demux and dvr descriptor reads the file on its own, and the demux
+ * filters are applied here, as fast as the file can be read. The sections
+ * are assembled by a struct dvb_section_demux per descriptor. When a section
+ * filter reaches the end of a seekable file, it goes on from its start, up
+ * to where the filter was set, then its reads return -ETIMEDOUT: a table
+ * that isn't there is noticed without waiting for any timeout. As with a
+ * real demux, the dvr gets the PIDs tapped to it with DMX_OUT_TS_TAP.
+ *
+ * As stdin can only be read once, just the first descriptor reading it gets
+ * its data. A demux copies what it reads from stdin to a temporary file, in
+ * order to go back to its start as well.
+ */
+
+#define DVB_FILE_BUF_SIZE	(512 * DVB_MPEG_TS_PACKET_SIZE)
+#define DVB_FILE_MAX_SECTION	4096
+
+enum dvb_file_filter {
+	DVB_FILE_FILTER_NONE,
+	DVB_FILE_FILTER_SECTION,
+	DVB_FILE_FILTER_PES,
+};
+
+struct dvb_file_open {
+	/* dvb_open_descriptor should be the first element on this struct */
+	struct dvb_open_descriptor open_dev;
+
+	/* Read buffer, whose first byte is at buf_offset on the file */
+	uint8_t buf[DVB_FILE_BUF_SIZE];
+	size_t buf_len, buf_pos;
+	off_t buf_offset;
+	int seekable, eof;
+
+	/* For stdin: the copy read by a demux, and where it comes from */
+	int use_stdin;
+	FILE *spool;
+	int src_fd;
+
+	enum dvb_file_filter filter;
+
+	/* PES filter: the PIDs and where they go */
+	uint8_t pids[DVB_MPEG_TS_NUM_PIDS / 8];
+	int all_pids;
+	dmx_output_t output;
+
+	/* Section filter, with the negative match bits at neg */
+	uint16_t pid;
+	uint8_t value[DMX_FILTER_SIZE];
+	uint8_t mask[DMX_FILTER_SIZE];
+	uint8_t neg[DMX_FILTER_SIZE];
+	unsigned flags;
+	off_t start;
+	int wrapped;
+
+	/* Assembles the sections, and keeps the ones ready to be read */
+	struct dvb_section_demux *sections;
+	uint8_t ready[2 * DVB_FILE_MAX_SECTION];
+	size_t ready_len;
+};
+
+struct dvb_dev_file_priv {
+	/* NULL for stdin */
+	char *fname;
+	struct dvb_file_open *stdin_owner;
+
+	/* PIDs tapped to the dvr */
+	uint8_t tap[DVB_MPEG_TS_NUM_PIDS / 8];
+	int tap_all;
+};
+
+static int dvb_file_has_pid(const uint8_t *pids, int all, unsigned pid)
+{
+	return all || (pids[pid >> 3] & (1 << (pid & 7)));
+}
+
+static void dvb_file_update_tap(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *cur;
+	unsigned i;
+
+	memset(priv->tap, 0, sizeof(priv->tap));
+	priv->tap_all = 0;
+
+	for (cur = dvb->open_list.next; cur; cur = cur->next) {
+		struct dvb_file_open *fo = (void *)cur;
+
+		if (fo->filter != DVB_FILE_FILTER_PES ||
+		    fo->output != DMX_OUT_TS_TAP)
+			continue;
+		priv->tap_all |= fo->all_pids;
+		for (i = 0; i < sizeof(priv->tap); i++)
+			priv->tap[i] |= fo->pids[i];
+	}
+}
+
+static int dvb_file_start_stdin(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_file_open *fo)
+{
+	struct dvb_dev_file_priv *priv = fo->open_dev.dvb->priv;
+
+	if (priv->stdin_owner) {
+		dvb_logerr(_("stdin can be read by just one device"));
+		return -EBUSY;
+	}
+
+	if (fo->open_dev.dev->dvb_type == DVB_DEVICE_DEMUX) {
+		fo->spool = tmpfile();
+		if (!fo->spool) {
+			dvb_perror(_("Can't create a temporary file"));
+			return -errno;
+		}
+		fo->open_dev.fd = fileno(fo->spool);
+		fo->src_fd = STDIN_FILENO;
+		fo->seekable = 1;
+	} else {
+		fo->open_dev.fd = STDIN_FILENO;
+	}
+	fo->use_stdin = 0;
+	priv->stdin_owner = fo;
+
+	return 0;
+}
+
+static ssize_t dvb_file_fill(struct dvb_v5_fe_parms_priv *parms,
+			     struct dvb_file_open *fo, uint8_t *buf,
+			     size_t count)
+{
+	ssize_t ret;
+
+	ret = TEMP_FAILURE_RETRY(read(fo->open_dev.fd, buf, count));
+	if (ret || fo->src_fd < 0)
+		return ret;
+
+	/* At the end of the copy: read more from stdin, and keep it */
+	ret = TEMP_FAILURE_RETRY(read(fo->src_fd, buf, count));
+	if (ret <= 0) {
+		fo->src_fd = -1;
+		return ret;
+	}
+	if (write(fo->open_dev.fd, buf, ret) != ret) {
+		dvb_perror(_("Can't write to the temporary file"));
+		return -1;
+	}
+
+	return ret;
+}
+
+/* Returns the next packet, or NULL at the end of the file */
+static const uint8_t *dvb_file_next_packet(struct dvb_v5_fe_parms_priv *parms,
+					   struct dvb_file_open *fo)
+{
+	ssize_t ret;
+
+	for (;;) {
+		if (fo->buf_len - fo->buf_pos >= DVB_MPEG_TS_PACKET_SIZE) {
+			const uint8_t *p = fo->buf + fo->buf_pos;
+
+			if (p[0] == DVB_MPEG_TS) {
+				fo->buf_pos += DVB_MPEG_TS_PACKET_SIZE;
+				return p;
+			}
+			/* Lost sync: look for the next sync byte */
+			fo->buf_pos++;
+			continue;
+		}
+		if (fo->eof)
+			return NULL;
+
+		/* Keep the partial packet, if any */
+		fo->buf_len -= fo->buf_pos;
+		memmove(fo->buf, fo->buf + fo->buf_pos, fo->buf_len);
+		fo->buf_offset += fo->buf_pos;
+		fo->buf_pos = 0;
+
+		if (fo->use_stdin && dvb_file_start_stdin(parms, fo)) {
+			fo->eof = 1;
+			return NULL;
+		}
+		ret = dvb_file_fill(parms, fo, fo->buf + fo->buf_len,
+				    sizeof(fo->buf) - fo->buf_len);
+		if (ret < 0)
+			dvb_perror(_("read()"));
+		if (ret <= 0)
+			fo->eof = 1;
+		else
+			fo->buf_len += ret;
+	}
+}
+
+static int dvb_file_rewind(struct dvb_file_open *fo)
+{
+	if (!fo->seekable || lseek(fo->open_dev.fd, 0, SEEK_SET) < 0)
+		return -1;
+
+	fo->buf_len = 0;
+	fo->buf_pos = 0;
+	fo->buf_offset = 0;
+	fo->eof = 0;
+
+	return 0;
+}
+
+/* Returns the payload of a packet, or NULL if it has none */
+static const uint8_t *dvb_file_payload(const uint8_t *p)
+{
+	const uint8_t *payload = p + 4;
+
+	if (!(p[3] & 0x10))
+		return NULL;
+	if (p[3] & 0x20)
+		payload += 1 + p[4];
+	if (payload >= p + DVB_MPEG_TS_PACKET_SIZE)
+		return NULL;
+
+	return payload;
+}
+
+/*
+ * Section filters
+ */
+
+static void dvb_file_section_ready(void *priv, uint16_t pid,
+				   const uint8_t *s, size_t len)
+{
+	struct dvb_file_open *fo = priv;
+	int i, has_neg = 0, neg_match = 0;
+
+	/* The filter skips the section length, as the Kernel does */
+	for (i = 0; i < DMX_FILTER_SIZE; i++) {
+		uint8_t xor;
+
+		if (!fo->mask[i])
+			continue;
+		if (i && i + 2 >= len)
+			return;
+
+		xor = (i ? s[i + 2] : s[0]) ^ fo->value[i];
+		if (xor & fo->mask[i] & ~fo->neg[i])
+			return;
+		if (fo->mask[i] & fo->neg[i]) {
+			has_neg = 1;
+			if (xor & fo->mask[i] & fo->neg[i])
+				neg_match = 1;
+		}
+	}
+	if (has_neg && !neg_match)
+		return;
+
+	if ((fo->flags & DMX_CHECK_CRC) && (s[1] & 0x80) &&
+	    dvb_crc32((uint8_t *)s, len, 0xFFFFFFFF))
+		return;
+
+	/* Dropped if not read on time, as on a buffer overflow */
+	if (fo->ready_len + len > sizeof(fo->ready))
+		return;
+	memcpy(fo->ready + fo->ready_len, s, len);
+	fo->ready_len += len;
+}
+
+/* Starts assembling the sections of the filter PID from scratch */
+static int dvb_file_section_start(struct dvb_file_open *fo)
+{
+	dvb_section_demux_remove_pid(fo->sections, fo->pid);
+
+	return dvb_section_demux_add_handler(fo->sections, fo->pid, 0, 0,
+					     DVB_SECTION_RAW,
+					     dvb_file_section_ready, fo);
+}
+
+static void dvb_file_filter_stop(struct dvb_file_open *fo)
+{
+	if (fo->filter == DVB_FILE_FILTER_SECTION)
+		dvb_section_demux_remove_pid(fo->sections, fo->pid);
+	fo->filter = DVB_FILE_FILTER_NONE;
+	fo->ready_len = 0;
+	dvb_file_update_tap(fo->open_dev.dvb);
+}
+
+static ssize_t dvb_file_read_section(struct dvb_v5_fe_parms_priv *parms,
+				     struct dvb_file_open *fo,
+				     void *buf, size_t count)
+{
+	const uint8_t *p;
+	size_t len;
+
+	while (!fo->ready_len) {
+		if (parms->p.abort)
+			return -EINTR;
+		if (fo->wrapped && fo->buf_offset + fo->buf_pos >= fo->start)
+			return -ETIMEDOUT;
+
+		p = dvb_file_next_packet(parms, fo);
+		if (!p) {
+			if (fo->wrapped || !fo->start || dvb_file_rewind(fo))
+				return -ETIMEDOUT;
+			fo->wrapped = 1;
+			if (dvb_file_section_start(fo))
+				return -ENOMEM;
+			continue;
+		}
+		dvb_section_demux_feed(fo->sections, p, DVB_MPEG_TS_PACKET_SIZE);
+	}
+
+	/* One section per read, as the Kernel does */
+	len = 3 + (((fo->ready[1] & 0x0f) << 8) | fo->ready[2]);
+	memcpy(buf, fo->ready, len < count ? len : count);
+	fo->ready_len -= len;
+	memmove(fo->ready, fo->ready + len, fo->ready_len);
+
+	if (fo->flags & DMX_ONESHOT)
+		dvb_file_filter_stop(fo);
+
+	return len < count ? len : count;
+}
+
+/* Reads the packets of the given PIDs, or just their payloads */
+static ssize_t dvb_file_read_ts(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_file_open *fo, void *buf,
+				size_t count, const uint8_t *pids, int all,
+				int payload_only)
+{
+	uint8_t *out = buf;
+	const uint8_t *p, *payload;
+	size_t len = 0, size;
+
+	while (count - len >= DVB_MPEG_TS_PACKET_SIZE && !parms->p.abort) {
+		p = dvb_file_next_packet(parms, fo);
+		if (!p)
+			break;
+		if (!dvb_file_has_pid(pids, all, ((p[1] & 0x1f) << 8) | p[2]))
+			continue;
+
+		if (!payload_only) {
+			memcpy(out + len, p, DVB_MPEG_TS_PACKET_SIZE);
+			len += DVB_MPEG_TS_PACKET_SIZE;
+			continue;
+		}
+		payload = dvb_file_payload(p);
+		if (!payload)
+			continue;
+		size = p + DVB_MPEG_TS_PACKET_SIZE - payload;
+		memcpy(out + len, payload, size);
+		len += size;
+	}
+
+	return len;
+}
+
+/*
+ * Device handling
+ */
+
+static int dvb_file_add_dev(struct dvb_device_priv *dvb,
+			    enum dvb_dev_type type, const char *path)
+{
+	struct dvb_dev_list *dev;
+	int ret;
+
+	dev = realloc(dvb->d.devices,
+		      sizeof(*dvb->d.devices) * (dvb->d.num_devices + 1));
+	if (!dev)
+		return -ENOMEM;
+	dvb->d.devices = dev;
+	dev += dvb->d.num_devices;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->dvb_type = type;
+	ret = asprintf(&dev->sysname, "dvb0.%s0", dev_type_names[type]);
+	if (ret < 0) {
+		dev->sysname = NULL;
+		return -ENOMEM;
+	}
+	dvb->d.num_devices++;
+
+	dev->path = strdup(path);
+	dev->bus_addr = strdup("file");
+	dev->product = strdup("MPEG-TS file");
+	if (!dev->path || !dev->bus_addr || !dev->product)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int dvb_file_find(struct dvb_device_priv *dvb,
+			 dvb_dev_change_t handler, void *user_priv)
+{
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	const char *path = priv->fname ? priv->fname : "-";
+	int i, ret;
+
+	dvb_dev_free_devices(dvb);
+
+	if ((ret = dvb_file_add_dev(dvb, DVB_DEVICE_FRONTEND, path)) ||
+	    (ret = dvb_file_add_dev(dvb, DVB_DEVICE_DEMUX, path)) ||
+	    (ret = dvb_file_add_dev(dvb, DVB_DEVICE_DVR, path))) {
+		dvb_dev_free_devices(dvb);
+		return ret;
+	}
+
+	if (handler)
+		for (i = 0; i < dvb->d.num_devices; i++)
+			handler(strdup(dvb->d.devices[i].sysname), DVB_DEV_ADD,
+				user_priv);
+
+	return 0;
+}
+
+static int dvb_file_stop_monitor(struct dvb_device_priv *dvb)
+{
+	return 0;
+}
+
+/* Every delivery system can be "tuned" */
+static const fe_delivery_system_t dvb_file_systems[] = {
+	SYS_DVBT, SYS_DVBT2, SYS_DVBC_ANNEX_A, SYS_DVBC_ANNEX_B,
+	SYS_DVBC_ANNEX_C, SYS_DVBS, SYS_DVBS2, SYS_TURBO, SYS_ISDBT,
+	SYS_ISDBS, SYS_ATSC, SYS_DTMB,
+};
+
+static int dvb_file_open_frontend(struct dvb_device_priv *dvb)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_frontend_info *info = &parms->p.info;
+	unsigned i;
+
+	memset(info, 0, sizeof(*info));
+	strcpy(info->name, "MPEG-TS file");
+	info->frequency_max = UINT32_MAX;
+	info->symbol_rate_max = UINT32_MAX;
+	info->caps = FE_CAN_INVERSION_AUTO | FE_CAN_FEC_AUTO |
+		     FE_CAN_QAM_AUTO | FE_CAN_TRANSMISSION_MODE_AUTO |
+		     FE_CAN_GUARD_INTERVAL_AUTO | FE_CAN_HIERARCHY_AUTO |
+		     FE_CAN_2G_MODULATION | FE_CAN_MULTISTREAM;
+
+	parms->p.version = 0x50b;
+	parms->p.num_systems = ARRAY_SIZE(dvb_file_systems);
+	for (i = 0; i < ARRAY_SIZE(dvb_file_systems); i++)
+		parms->p.systems[i] = dvb_file_systems[i];
+	if (parms->p.current_sys == SYS_UNDEFINED)
+		parms->p.current_sys = parms->p.systems[0];
+	parms->n_props = dvb_add_parms_for_sys(&parms->p, parms->p.current_sys);
+	dvb_fe_init_stats(parms);
+
+	return 0;
+}
+
+static struct dvb_open_descriptor *dvb_file_open(struct dvb_device_priv *dvb,
+						 const char *sysname,
+						 int flags)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_open_descriptor *cur;
+	struct dvb_dev_list *dev;
+	struct dvb_file_open *fo;
+
+	dev = dvb_local_get_dev_info(dvb, sysname);
+	if (!dev)
+		return NULL;
+
+	fo = calloc(1, sizeof(*fo));
+	if (!fo) {
+		dvb_perror("Can't create file descriptor");
+		return NULL;
+	}
+	fo->open_dev.fd = -1;
+	fo->open_dev.dev = dev;
+	fo->open_dev.dvb = dvb;
+	fo->src_fd = -1;
+
+	if (dev->dvb_type == DVB_DEVICE_FRONTEND) {
+		dvb_file_open_frontend(dvb);
+	} else if (!priv->fname) {
+		/* Claimed when read */
+		fo->use_stdin = 1;
+	} else {
+		fo->open_dev.fd = open(priv->fname, O_RDONLY);
+		if (fo->open_dev.fd < 0) {
+			dvb_logerr(_("Can't open %s: %d %m"), priv->fname, errno);
+			free(fo);
+			return NULL;
+		}
+		fo->seekable = lseek(fo->open_dev.fd, 0, SEEK_CUR) >= 0;
+	}
+
+	cur = &dvb->open_list;
+	while (cur->next)
+		cur = cur->next;
+	cur->next = &fo->open_dev;
+
+	return &fo->open_dev;
+}
+
+static int dvb_file_close(struct dvb_open_descriptor *open_dev)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+	struct dvb_file_open *fo = (void *)open_dev;
+	struct dvb_open_descriptor *cur;
+
+	if (priv->stdin_owner == fo)
+		priv->stdin_owner = NULL;
+	if (fo->spool)
+		fclose(fo->spool);
+	else if (open_dev->fd >= 0 && open_dev->fd != STDIN_FILENO)
+		close(open_dev->fd);
+	dvb_section_demux_free(fo->sections);
+
+	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
+		if (cur->next == open_dev) {
+			cur->next = open_dev->next;
+			free(open_dev);
+			dvb_file_update_tap(dvb);
+			return 0;
+		}
+	}
+
+	/* Should never happen */
+	dvb_logerr(_("Couldn't free device\n"));
+
+	return -ENODEV;
+}
+
+static int dvb_file_get_fd(struct dvb_open_descriptor *open_dev)
+{
+	return open_dev->fd;
+}
+
+static int dvb_file_dmx_stop(struct dvb_open_descriptor *open_dev)
+{
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	dvb_file_filter_stop((void *)open_dev);
+
+	return 0;
+}
+
+static int dvb_file_set_bufsize(struct dvb_open_descriptor *open_dev,
+				int buffersize)
+{
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX &&
+	    open_dev->dev->dvb_type != DVB_DEVICE_DVR)
+		return -EINVAL;
+
+	return 0;
+}
+
+static ssize_t dvb_file_read(struct dvb_open_descriptor *open_dev,
+			     void *buf, size_t count)
+{
+	struct dvb_file_open *fo = (void *)open_dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_file_priv *priv = dvb->priv;
+
+	switch (open_dev->dev->dvb_type) {
+	case DVB_DEVICE_DVR:
+		return dvb_file_read_ts(parms, fo, buf, count,
+					priv->tap, priv->tap_all, 0);
+	case DVB_DEVICE_DEMUX:
+		break;
+	default:
+		dvb_logerr("Trying to read from an invalid device type on fd #%d",
+			   open_dev->fd);
+		return -EINVAL;
+	}
+
+	switch (fo->filter) {
+	case DVB_FILE_FILTER_SECTION:
+		return dvb_file_read_section(parms, fo, buf, count);
+	case DVB_FILE_FILTER_PES:
+		if (fo->output == DMX_OUT_TSDEMUX_TAP || fo->output == DMX_OUT_TAP)
+			return dvb_file_read_ts(parms, fo, buf, count,
+						fo->pids, fo->all_pids,
+						fo->output == DMX_OUT_TAP);
+		/* The data goes to the dvr or to the decoder */
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+static void dvb_file_set_pes(struct dvb_file_open *fo, const uint16_t *pids,
+			     unsigned num_pids, dmx_output_t output)
+{
+	unsigned i;
+
+	fo->filter = DVB_FILE_FILTER_PES;
+	fo->output = output;
+	fo->all_pids = 0;
+	memset(fo->pids, 0, sizeof(fo->pids));
+	for (i = 0; i < num_pids; i++) {
+		if (pids[i] >= DVB_MPEG_TS_NUM_PIDS)
+			fo->all_pids = 1;
+		else
+			fo->pids[pids[i] >> 3] |= 1 << (pids[i] & 7);
+	}
+	dvb_file_update_tap(fo->open_dev.dvb);
+}
+
+static int dvb_file_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
+				      int pid, dmx_pes_type_t type,
+				      dmx_output_t output, int bufsize)
+{
+	uint16_t p = pid;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	dvb_file_set_pes((void *)open_dev, &p, 1, output);
+
+	return 0;
+}
+
+static int dvb_file_dmx_set_pids(struct dvb_open_descriptor *open_dev,
+				 const uint16_t *pids, unsigned num_pids,
+				 dmx_output_t output, int bufsize)
+{
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	if (!num_pids)
+		dvb_file_filter_stop((void *)open_dev);
+	else
+		dvb_file_set_pes((void *)open_dev, pids, num_pids, output);
+
+	return 0;
+}
+
+static int dvb_file_dmx_set_section_filter(struct dvb_open_descriptor *open_dev,
+					   int pid, unsigned filtsize,
+					   unsigned char *filter,
+					   unsigned char *mask,
+					   unsigned char *mode,
+					   unsigned int flags)
+{
+	struct dvb_file_open *fo = (void *)open_dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	if (!fo->sections) {
+		fo->sections = dvb_section_demux_alloc(dvb->d.fe_parms);
+		if (!fo->sections)
+			return -ENOMEM;
+	}
+	dvb_file_filter_stop(fo);
+
+	if (filtsize > DMX_FILTER_SIZE)
+		filtsize = DMX_FILTER_SIZE;
+
+	memset(fo->value, 0, sizeof(fo->value));
+	memset(fo->mask, 0, sizeof(fo->mask));
+	memset(fo->neg, 0, sizeof(fo->neg));
+	if (filter)
+		memcpy(fo->value, filter, filtsize);
+	if (mask)
+		memcpy(fo->mask, mask, filtsize);
+	if (mode)
+		memcpy(fo->neg, mode, filtsize);
+
+	fo->pid = pid;
+	fo->flags = flags;
+	fo->start = fo->buf_offset + fo->buf_pos;
+	fo->wrapped = 0;
+	if (dvb_file_section_start(fo))
+		return -ENOMEM;
+	fo->filter = DVB_FILE_FILTER_SECTION;
+
+	return 0;
+}
+
+static int dvb_file_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev, int sid)
+{
+	struct dvb_file_open *fo = (void *)open_dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	unsigned char tid = 0, mask = 0xff;
+	uint8_t buf[DVB_FILE_MAX_SECTION];
+	int i, section_length;
+	ssize_t count;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	dvb_file_dmx_set_section_filter(open_dev, 0, 1, &tid, &mask, NULL,
+					DMX_IMMEDIATE_START | DMX_CHECK_CRC);
+	count = dvb_file_read_section(parms, fo, buf, sizeof(buf));
+	dvb_file_filter_stop(fo);
+	if (count < 0)
+		return count;
+
+	/* Assumes one section contains the whole PAT */
+	section_length = ((buf[1] & 0x0f) << 8) | buf[2];
+	for (i = 8; i + 4 <= section_length + 3 - 4; i += 4) {
+		if (((buf[i] << 8) | buf[i + 1]) == sid)
+			return ((buf[i + 2] & 0x1f) << 8) | buf[i + 3];
+	}
+
+	return 0;
+}
+
+static struct dvb_v5_descriptors *dvb_file_scan(struct dvb_open_descriptor *open_dev,
+						struct dvb_entry *entry,
+						check_frontend_t *check_frontend,
+						void *args,
+						unsigned other_nit,
+						unsigned timeout_multiply)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_v5_descriptors *desc;
+
+	if (open_dev->dev->dvb_type != DVB_DEVICE_DEMUX) {
+		dvb_logerr(_("dvb_dev_scan: expecting a demux descriptor"));
+		return NULL;
+	}
+
+	/* The tables are read through the filters above */
+	parms->scan_dmx = open_dev;
+	desc = dvb_scan_transponder(dvb->d.fe_parms, entry, -1, check_frontend,
+				    args, other_nit, timeout_multiply);
+	parms->scan_dmx = NULL;
+
+	return desc;
+}
+
+/* Frontend functions */
+
+static int dvb_file_fe_set_sys(struct dvb_v5_fe_parms *p,
+			       fe_delivery_system_t sys)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	int rc;
+
+	rc = dvb_add_parms_for_sys(p, sys);
+	if (rc < 0)
+		return -EINVAL;
+
+	parms->p.current_sys = sys;
+	parms->n_props = rc;
+
+	return 0;
+}
+
+static int dvb_file_fe_get_parms(struct dvb_v5_fe_parms *p)
+{
+	return 0;
+}
+
+static int dvb_file_fe_set_parms(struct dvb_v5_fe_parms *p)
+{
+	return 0;
+}
+
+static int dvb_file_fe_get_stats(struct dvb_v5_fe_parms *p)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	uint32_t status = FE_HAS_SIGNAL | FE_HAS_CARRIER | FE_HAS_VITERBI |
+			  FE_HAS_SYNC | FE_HAS_LOCK;
+
+	dvb_fe_store_stats(parms, DTV_STATUS, FE_SCALE_RELATIVE, 0, status);
+	parms->stats.prev_status = status;
+
+	return 0;
+}
+
+static void dvb_dev_file_free(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_file_priv *priv = dvb->priv;
+
+	free(priv->fname);
+	free(priv);
+}
+
+int dvb_dev_file_init(struct dvb_device *d, const char *fname)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_ops *ops = &dvb->ops;
+	struct dvb_dev_file_priv *priv;
+
+	/* Call an implementation-specific free method, if defined */
+	if (ops->free)
+		ops->free(dvb);
+	memset(ops, 0, sizeof(*ops));
+
+	dvb->priv = priv = calloc(1, sizeof(*priv));
+	if (!priv)
+		return -ENOMEM;
+
+	if (strcmp(fname, "-")) {
+		priv->fname = strdup(fname);
+		if (!priv->fname) {
+			free(priv);
+			dvb->priv = NULL;
+			return -ENOMEM;
+		}
+	}
+	dvb_fe_init_stats(parms);
+
+	ops->find = dvb_file_find;
+	ops->seek_by_adapter = dvb_local_seek_by_adapter;
+	ops->get_dev_info = dvb_local_get_dev_info;
+	ops->stop_monitor = dvb_file_stop_monitor;
+	ops->open = dvb_file_open;
+	ops->close = dvb_file_close;
+	ops->get_fd = dvb_file_get_fd;
+
+	ops->dmx_stop = dvb_file_dmx_stop;
+	ops->set_bufsize = dvb_file_set_bufsize;
+	ops->read = dvb_file_read;
+	ops->dmx_set_pesfilter = dvb_file_dmx_set_pesfilter;
+	ops->dmx_set_section_filter = dvb_file_dmx_set_section_filter;
+	ops->dmx_get_pmt_pid = dvb_file_dmx_get_pmt_pid;
+	ops->dmx_set_pids = dvb_file_dmx_set_pids;
+
+	ops->scan = dvb_file_scan;
+
+	ops->fe_set_sys = dvb_file_fe_set_sys;
+	ops->fe_get_parms = dvb_file_fe_get_parms;
+	ops->fe_set_parms = dvb_file_fe_set_parms;
+	ops->fe_get_stats = dvb_file_fe_get_stats;
+
+	ops->free = dvb_dev_file_free;
+
+	return 0;
+}
@@ -51,6 +51,19 @@
        __result; })
 #endif
 
+/*
+ * Plugging a card creates several udev events per adapter. They're
+ * gathered until no other event arrives for DVB_DEV_EVENT_WINDOW_MS,
+ * and only the last state of each device is handled.
+ */
+#define DVB_DEV_EVENT_WINDOW_MS		100
+#define DVB_DEV_MAX_EVENTS		64
+
+struct dvb_dev_event {
+	struct udev_device *dev;
+	const char *action;
+};
+
 struct dvb_dev_local_priv {
 	dvb_dev_change_t notify_dev_change;
 
@@ -82,6 +95,9 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 	char *buf;
 	int i, ret;
 
+	/* Any change moves the devices at the list */
+	dvb_dev_index_invalidate(dvb);
+
 	/* remove, change, move should all remove the device first */
 	if (!strcmp(action,"add")) {
 		type = DVB_DEV_ADD;
@@ -92,27 +108,28 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 			return -ENODEV;
 		}
 
-		for (i = 0; i < dvb->d.num_devices; i++) {
-			if (!strcmp(sysname, dvb->d.devices[i].sysname)) {
-				memmove(&dvb->d.devices[i],
-					&dvb->d.devices[i + 1],
-					sizeof(*dvb->d.devices) * (dvb->d.num_devices - i));
-				dvb->d.num_devices--;
-
-				if (!dvb->d.num_devices) {
-					free(dvb->d.devices);
-					dvb->d.devices = NULL;
-				} else {
-					d = realloc(dvb->d.devices,
-						    sizeof(*dvb->d.devices) * dvb->d.num_devices);
-					if (!d) {
-						dvb_logerr(_("Can't remove a device from the list of DVB devices"));
-						return -ENODEV;
-					}
-					dvb->d.devices = d;
+		d = dvb_dev_index_lookup(dvb, sysname);
+		if (d) {
+			i = d - dvb->d.devices;
+			free_dvb_dev(d);
+			memmove(&dvb->d.devices[i],
+				&dvb->d.devices[i + 1],
+				sizeof(*dvb->d.devices) * (dvb->d.num_devices - i - 1));
+			dvb->d.num_devices--;
+
+			if (!dvb->d.num_devices) {
+				free(dvb->d.devices);
+				dvb->d.devices = NULL;
+			} else {
+				d = realloc(dvb->d.devices,
+					    sizeof(*dvb->d.devices) * dvb->d.num_devices);
+				if (!d) {
+					dvb_logerr(_("Can't remove a device from the list of DVB devices"));
+					return -ENODEV;
 				}
-				break;
+				dvb->d.devices = d;
 			}
+			dvb_dev_index_invalidate(dvb);
 		}
 
 		/* Return, if the device was removed */
@@ -206,6 +223,26 @@ static int handle_device_change(struct dvb_device_priv *dvb,
 	dvb->d.devices[dvb->d.num_devices - 1] = dev_list;
 	dvb_dev = &dvb->d.devices[dvb->d.num_devices - 1];
 
+	/*
+	 * All devices of an adapter, and all adapters of a multi-tuner card,
+	 * have the same parent: don't read its sysfs attributes again.
+	 */
+	for (i = 0; i < dvb->d.num_devices - 1; i++) {
+		d = &dvb->d.devices[i];
+		if (!d->bus_addr || strcmp(d->bus_addr, dvb_dev->bus_addr) ||
+		    !d->bus_id)
+			continue;
+
+		dvb_dev->bus_id = strdup(d->bus_id);
+		if (d->manufacturer)
+			dvb_dev->manufacturer = strdup(d->manufacturer);
+		if (d->product)
+			dvb_dev->product = strdup(d->product);
+		if (d->serial)
+			dvb_dev->serial = strdup(d->serial);
+		goto added;
+	}
+
 	/* Get optional per-bus fields associated with the device parent */
 	if (!strcmp(bus_type, "pci")) {
 		const char *pci_dev, *pci_vend;
@@ -264,11 +301,52 @@ err_syspath:
 }
 
 #ifdef HAVE_PTHREAD
+static int queue_device_change(struct dvb_dev_event *events, int n,
+			       struct udev_device *dev)
+{
+	const char *action = udev_device_get_action(dev);
+	const char *sysname = udev_device_get_sysname(dev);
+	const char *old;
+	int i;
+
+	if (!action || !sysname) {
+		udev_device_unref(dev);
+		return n;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (strcmp(sysname, udev_device_get_sysname(events[i].dev)))
+			continue;
+
+		/*
+		 * Keep the last event of the device. A device that was
+		 * already at the list has to be removed before being added
+		 * again, and one added by this batch is still new.
+		 */
+		old = events[i].action;
+		if (!strcmp(action, "add") && strcmp(old, "add"))
+			action = "change";
+		else if (!strcmp(old, "add") && strcmp(action, "remove"))
+			action = "add";
+
+		udev_device_unref(events[i].dev);
+		events[i].dev = dev;
+		events[i].action = action;
+		return n;
+	}
+
+	events[n].dev = dev;
+	events[n].action = action;
+	return n + 1;
+}
+
 static void *monitor_device_changes(void *privdata)
 {
 	struct dvb_device_priv *dvb = privdata;
 	struct dvb_dev_local_priv *priv = dvb->priv;
+	struct dvb_dev_event events[DVB_DEV_MAX_EVENTS];
 	struct udev_device *dev;
+	int i, n = 0;
 
 	while (1) {
 		fd_set fds;
@@ -277,19 +355,32 @@ static void *monitor_device_changes(void *privdata)
 
 		FD_ZERO(&fds);
 		FD_SET(priv->udev_fd, &fds);
-		tv.tv_sec = 1;
-		tv.tv_usec = 0;
+		if (n) {
+			tv.tv_sec = 0;
+			tv.tv_usec = DVB_DEV_EVENT_WINDOW_MS * 1000;
+		} else {
+			tv.tv_sec = 1;
+			tv.tv_usec = 0;
+		}
 
 		ret = select(priv->udev_fd + 1, &fds, NULL, NULL, &tv);
 
 		/* Check if our file descriptor has received data. */
 		if (ret > 0 && FD_ISSET(priv->udev_fd, &fds)) {
 			dev = udev_monitor_receive_device(priv->mon);
-			if (dev) {
-				const char *action = udev_device_get_action(dev);
-				handle_device_change(dvb, dev, NULL, action);
-			}
+			if (dev)
+				n = queue_device_change(events, n, dev);
+			if (n < DVB_DEV_MAX_EVENTS)
+				continue;
+		}
+
+		/* No more events for a while: handle the batch */
+		for (i = 0; i < n; i++) {
+			handle_device_change(dvb, events[i].dev, NULL,
+					     events[i].action);
+			udev_device_unref(events[i].dev);
 		}
+		n = 0;
 	}
 	return NULL;
 }
@@ -390,27 +481,21 @@ struct dvb_dev_list *dvb_local_seek_by_adapter(struct dvb_device_priv *dvb,
 					       enum dvb_dev_type type)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	int ret, i;
-	char *p;
+	struct dvb_dev_list *dev;
+	char p[64];
 
-	if (type > dev_type_names_size){
+	if (type >= dev_type_names_size){
 		dvb_logerr(_("Unexpected device type found!"));
 		return NULL;
 	}
 
-	ret = asprintf(&p, "dvb%d.%s%d", adapter, dev_type_names[type], num);
-	if (ret < 0) {
-		dvb_logerr(_("error %d when seeking for device's filename"),
-			   errno);
-		return NULL;
-	}
-	for (i = 0; i < dvb->d.num_devices; i++) {
-		if (!strcmp(p, dvb->d.devices[i].sysname)) {
-			free(p);
-			dvb_dev_dump_device(_("Selected dvb %s device: %s"),
-					    parms, &dvb->d.devices[i]);
-			return &dvb->d.devices[i];
-		}
+	snprintf(p, sizeof(p), "dvb%u.%s%u", adapter, dev_type_names[type], num);
+
+	dev = dvb_dev_index_lookup(dvb, p);
+	if (dev) {
+		dvb_dev_dump_device(_("Selected dvb %s device: %s"),
+				    parms, dev);
+		return dev;
 	}
 
 	dvb_logwarn(_("device %s not found"), p);
@@ -421,18 +506,16 @@ struct dvb_dev_list *dvb_local_get_dev_info(struct dvb_device_priv *dvb,
 					    const char *sysname)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	int i;
+	struct dvb_dev_list *dev;
 
 	if (!sysname) {
 		dvb_logerr(_("Device not specified"));
 		return NULL;
 	}
 
-	for (i = 0; i < dvb->d.num_devices; i++) {
-		if (!strcmp(sysname, dvb->d.devices[i].sysname)) {
-			return &dvb->d.devices[i];
-		}
-	}
+	dev = dvb_dev_index_lookup(dvb, sysname);
+	if (dev)
+		return dev;
 
 	dvb_logerr(_("Can't find device %s"), sysname);
 	return NULL;
@@ -504,6 +587,22 @@ static struct dvb_open_descriptor
 	return open_dev;
 }
 
+static void dvb_local_dmx_release_pids(struct dvb_open_descriptor *open_dev)
+{
+	unsigned i;
+
+	for (i = 0; i < open_dev->num_pids; i++)
+		if (open_dev->pid_fds[i] >= 0)
+			close(open_dev->pid_fds[i]);
+
+	free(open_dev->pids);
+	free(open_dev->pid_fds);
+	open_dev->pids = NULL;
+	open_dev->pid_fds = NULL;
+	open_dev->num_pids = 0;
+	open_dev->max_pids = 0;
+}
+
 static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 {
 	struct dvb_dev_list *dev = open_dev->dev;
@@ -519,6 +618,7 @@ static int dvb_local_close(struct dvb_open_descriptor *open_dev)
 
 		close(open_dev->fd);
 	}
+	dvb_local_dmx_release_pids(open_dev);
 
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
 		if (cur->next == open_dev) {
@@ -567,6 +667,8 @@ static int dvb_local_dmx_stop(struct dvb_open_descriptor *open_dev)
 	if (dev->dvb_type != DVB_DEVICE_DEMUX)
 		return -EINVAL;
 
+	dvb_local_dmx_release_pids(open_dev);
+
 	ret = xioctl(fd, DMX_STOP);
 	if (ret == -1) {
 		dvb_perror(_("DMX_STOP failed"));
@@ -653,6 +755,9 @@ static int dvb_local_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 	if (dev->dvb_type != DVB_DEVICE_DEMUX)
 		return -EINVAL;
 
+	/* The new filter replaces any PID list */
+	dvb_local_dmx_release_pids(open_dev);
+
 	/* Failing here is not fatal, so no need to handle error condition */
 	if (bufsize)
 		dvb_dev_set_bufsize(open_dev, bufsize);
@@ -690,6 +795,8 @@ static int dvb_local_dmx_set_section_filter(struct dvb_open_descriptor *open_dev
 	if (dev->dvb_type != DVB_DEVICE_DEMUX)
 		return -EINVAL;
 
+	dvb_local_dmx_release_pids(open_dev);
+
 	if (filtsize > DMX_FILTER_SIZE)
 		filtsize = DMX_FILTER_SIZE;
 
@@ -775,6 +882,196 @@ static int dvb_local_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev, int s
 	return pmt_pid;
 }
 
+/*
+ * PID lists: one filter passes all PIDs, using DMX_ADD_PID/DMX_REMOVE_PID.
+ * If the driver doesn't support them, each PID gets a filter of its own,
+ * on an extra file descriptor that is only used to keep it running.
+ */
+
+static int dvb_local_dmx_add_pid(struct dvb_open_descriptor *open_dev,
+				 uint16_t pid)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_pes_filter_params pesfilter;
+	int fd = -1, flags, ret;
+
+	if (!open_dev->no_add_pid) {
+		if (xioctl(open_dev->fd, DMX_ADD_PID, &pid) != -1)
+			goto add;
+
+		if (errno != EINVAL && errno != ENOTTY) {
+			dvb_logerr(_("DMX_ADD_PID failed (PID = 0x%04x): %d %m"),
+				   pid, errno);
+			return -errno;
+		}
+		dvb_logdbg(_("DMX_ADD_PID not supported. Using one filter per PID"));
+		open_dev->no_add_pid = 1;
+	}
+
+	if (open_dev->pid_output != DMX_OUT_TS_TAP) {
+		dvb_logerr(_("Can't add PID 0x%04x: DMX_ADD_PID is needed for this output"),
+			   pid);
+		return -EINVAL;
+	}
+
+	flags = fcntl(open_dev->fd, F_GETFL);
+	fd = open(open_dev->dev->path, flags & (O_ACCMODE | O_NONBLOCK));
+	if (fd == -1) {
+		dvb_logerr(_("Can't open %s: %d %m"), open_dev->dev->path, errno);
+		return -errno;
+	}
+
+	memset(&pesfilter, 0, sizeof(pesfilter));
+	pesfilter.pid = pid;
+	pesfilter.input = DMX_IN_FRONTEND;
+	pesfilter.output = DMX_OUT_TS_TAP;
+	pesfilter.pes_type = DMX_PES_OTHER;
+	pesfilter.flags = DMX_IMMEDIATE_START;
+
+	if (xioctl(fd, DMX_SET_PES_FILTER, &pesfilter) == -1) {
+		ret = -errno;
+		dvb_logerr(_("DMX_SET_PES_FILTER failed (PID = 0x%04x): %d %m"),
+			   pid, errno);
+		close(fd);
+		return ret;
+	}
+
+add:
+	open_dev->pids[open_dev->num_pids] = pid;
+	open_dev->pid_fds[open_dev->num_pids] = fd;
+	open_dev->num_pids++;
+
+	return 0;
+}
+
+static int dvb_local_dmx_remove_pid(struct dvb_open_descriptor *open_dev,
+				    unsigned i)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	uint16_t pid = open_dev->pids[i];
+
+	if (open_dev->pid_fds[i] >= 0) {
+		close(open_dev->pid_fds[i]);
+	} else if (xioctl(open_dev->fd, DMX_REMOVE_PID, &pid) == -1) {
+		dvb_logerr(_("DMX_REMOVE_PID failed (PID = 0x%04x): %d %m"),
+			   pid, errno);
+		return -errno;
+	}
+
+	open_dev->num_pids--;
+	open_dev->pids[i] = open_dev->pids[open_dev->num_pids];
+	open_dev->pid_fds[i] = open_dev->pid_fds[open_dev->num_pids];
+
+	return 0;
+}
+
+static int dvb_local_dmx_set_pids(struct dvb_open_descriptor *open_dev,
+				  const uint16_t *pids, unsigned num_pids,
+				  dmx_output_t output, int bufsize)
+{
+	struct dvb_dev_list *dev = open_dev->dev;
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dmx_pes_filter_params pesfilter;
+	uint8_t wanted[0x2000 / 8], cur[0x2000 / 8];
+	unsigned i;
+	int ret;
+
+	if (dev->dvb_type != DVB_DEVICE_DEMUX)
+		return -EINVAL;
+
+	if (output != DMX_OUT_TS_TAP && output != DMX_OUT_TSDEMUX_TAP) {
+		dvb_logerr(_("PID lists need either DMX_OUT_TS_TAP or DMX_OUT_TSDEMUX_TAP"));
+		return -EINVAL;
+	}
+
+	memset(wanted, 0, sizeof(wanted));
+	for (i = 0; i < num_pids; i++) {
+		if (pids[i] > 0x1fff) {
+			dvb_logerr(_("Invalid PID 0x%04x"), pids[i]);
+			return -EINVAL;
+		}
+		wanted[pids[i] >> 3] |= 1 << (pids[i] & 7);
+	}
+
+	if (!num_pids)
+		return dvb_local_dmx_stop(open_dev);
+
+	if (open_dev->num_pids && output != open_dev->pid_output)
+		dvb_local_dmx_stop(open_dev);
+
+	/* At any time, there's at most one entry per wanted PID */
+	if (num_pids > open_dev->max_pids) {
+		uint16_t *new_pids;
+		int *new_fds;
+
+		new_pids = realloc(open_dev->pids, num_pids * sizeof(*new_pids));
+		if (!new_pids)
+			return -ENOMEM;
+		open_dev->pids = new_pids;
+
+		new_fds = realloc(open_dev->pid_fds, num_pids * sizeof(*new_fds));
+		if (!new_fds)
+			return -ENOMEM;
+		open_dev->pid_fds = new_fds;
+
+		open_dev->max_pids = num_pids;
+	}
+
+	if (!open_dev->num_pids) {
+		/* Failing here is not fatal, so no need to handle error condition */
+		if (bufsize)
+			dvb_dev_set_bufsize(open_dev, bufsize);
+
+		memset(&pesfilter, 0, sizeof(pesfilter));
+		pesfilter.pid = pids[0];
+		pesfilter.input = DMX_IN_FRONTEND;
+		pesfilter.output = output;
+		pesfilter.pes_type = DMX_PES_OTHER;
+		pesfilter.flags = DMX_IMMEDIATE_START;
+
+		if (xioctl(open_dev->fd, DMX_SET_PES_FILTER, &pesfilter) == -1) {
+			dvb_logerr(_("DMX_SET_PES_FILTER failed (PID = 0x%04x): %d %m"),
+				   pids[0], errno);
+			return -errno;
+		}
+		open_dev->pids[0] = pids[0];
+		open_dev->pid_fds[0] = -1;
+		open_dev->num_pids = 1;
+		open_dev->pid_output = output;
+	}
+
+	/* Remove the PIDs that aren't wanted anymore */
+	memset(cur, 0, sizeof(cur));
+	for (i = 0; i < open_dev->num_pids;) {
+		uint16_t pid = open_dev->pids[i];
+
+		if (wanted[pid >> 3] & (1 << (pid & 7))) {
+			cur[pid >> 3] |= 1 << (pid & 7);
+			i++;
+			continue;
+		}
+		ret = dvb_local_dmx_remove_pid(open_dev, i);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* And add the new ones */
+	for (i = 0; i < num_pids; i++) {
+		if (cur[pids[i] >> 3] & (1 << (pids[i] & 7)))
+			continue;
+
+		ret = dvb_local_dmx_add_pid(open_dev, pids[i]);
+		if (ret < 0)
+			return ret;
+		cur[pids[i] >> 3] |= 1 << (pids[i] & 7);
+	}
+
+	return 0;
+}
+
 static struct dvb_v5_descriptors *dvb_local_scan(struct dvb_open_descriptor *open_dev,
 					struct dvb_entry *entry,
 					check_frontend_t *check_frontend,
@@ -857,6 +1154,7 @@ void dvb_dev_local_init(struct dvb_device_priv *dvb)
 	ops->dmx_set_pesfilter = dvb_local_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_local_dmx_set_section_filter;
 	ops->dmx_get_pmt_pid = dvb_local_dmx_get_pmt_pid;
+	ops->dmx_set_pids = dvb_local_dmx_set_pids;
 
 	ops->scan = dvb_local_scan;
 
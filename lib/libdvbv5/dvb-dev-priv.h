@@ -29,6 +29,13 @@ struct dvb_open_descriptor {
 	struct dvb_dev_list *dev;
 	struct dvb_device_priv *dvb;
 	struct dvb_open_descriptor *next;
+
+	/* PID list set with dvb_dev_dmx_set_pids() */
+	uint16_t *pids;
+	int *pid_fds;		/* -1 if the PID is on the main filter */
+	unsigned num_pids, max_pids;
+	dmx_output_t pid_output;
+	int no_add_pid;		/* DMX_ADD_PID is not supported */
 };
 
 struct dvb_dev_ops {
@@ -59,6 +66,9 @@ struct dvb_dev_ops {
 				     unsigned char *mode,
 				     unsigned int flags);
 	int (*dmx_get_pmt_pid)(struct dvb_open_descriptor *open_dev, int sid);
+	int (*dmx_set_pids)(struct dvb_open_descriptor *open_dev,
+			    const uint16_t *pids, unsigned num_pids,
+			    dmx_output_t output, int bufsize);
 	struct dvb_v5_descriptors *(*scan)(struct dvb_open_descriptor *open_dev,
 					   struct dvb_entry *entry,
 					   check_frontend_t *check_frontend,
@@ -71,6 +81,10 @@ struct dvb_dev_ops {
 	int (*fe_set_parms)(struct dvb_v5_fe_parms *p);
 	int (*fe_get_stats)(struct dvb_v5_fe_parms *p);
 
+	int (*batch_start)(struct dvb_device_priv *dvb,
+			   dvb_dev_complete_t *complete, void *user_priv);
+	int (*batch_wait)(struct dvb_device_priv *dvb);
+
 	void (*free)(struct dvb_device_priv *dvb);
 	int (*get_fd)(struct dvb_open_descriptor *dvb);
 };
@@ -81,6 +95,15 @@ struct dvb_device_priv {
 
 	struct dvb_open_descriptor open_list;
 
+	/*
+	 * Hash of the device sysnames, with the position of each device
+	 * at d.devices plus one. Rebuilt when the list of devices changes.
+	 */
+	unsigned *dev_index;
+	unsigned dev_index_size;
+	int dev_index_num;
+	struct dvb_dev_list *dev_index_devices;
+
 	/* private data to be used by implementation, if needed */
 	void *priv;
 };
@@ -94,8 +117,36 @@ void dvb_dev_dump_device(char *msg,
 			struct dvb_dev_list *dev);
 void free_dvb_dev(struct dvb_dev_list *dvb_dev);
 void dvb_dev_free_devices(struct dvb_device_priv *dvb);
+void dvb_dev_index_invalidate(struct dvb_device_priv *dvb);
+struct dvb_dev_list *dvb_dev_index_lookup(struct dvb_device_priv *dvb,
+					  const char *sysname);
 
 /* From dvb-dev-local.c */
 void dvb_dev_local_init(struct dvb_device_priv *dvb);
 
+/* Also used by dvb-dev-file.c, as they only look at the device list */
+struct dvb_dev_list *dvb_local_seek_by_adapter(struct dvb_device_priv *dvb,
+					       unsigned int adapter,
+					       unsigned int num,
+					       enum dvb_dev_type type);
+struct dvb_dev_list *dvb_local_get_dev_info(struct dvb_device_priv *dvb,
+					    const char *sysname);
+
+/* From dvb-dev-remote.c */
+
+/*
+ * Binary data frames of the dvbv5-daemon protocol
+ *
+ * When the client asks for REMOTE_FEATURE_BINARY_DATA while checking the daemon
+ * version, and the daemon replies with it after its version, the data read
+ * from demux and DVR devices is sent as binary frames instead of "data_read"
+ * messages: a 32-bit big-endian size with REMOTE_DATA_FRAME set, the uid of
+ * the device and the result of the read as 32-bit big-endian integers, then
+ * the raw data. The daemon reads up to REMOTE_DATA_FRAME_SIZE bytes at a time.
+ * Control messages keep using the text protocol.
+ */
+#define REMOTE_FEATURE_BINARY_DATA	"binary_data"
+#define REMOTE_DATA_FRAME		0x80000000
+#define REMOTE_DATA_FRAME_SIZE		(512 * 188)	/* 96256 bytes */
+
 #endif
@@ -35,10 +35,12 @@
 #include <unistd.h>
 #include <resolv.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include "dvb-fe-priv.h"
 #include "dvb-dev-priv.h"
+#include "usdt.h"
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -63,25 +65,56 @@ const char *daemon_version = "dvbv5-daemon version " V4L_UTILS_VERSION;
  * Internal data structures
  */
 
+/*
+ * Default size of the ring buffer of each open device. It can be changed at
+ * build time, or at run time with the DVB_REMOTE_RINGBUF_SIZE environment
+ * variable. It is always rounded up to a power of two.
+ */
+#ifndef RINGBUF_SIZE
 #define RINGBUF_SIZE (REMOTE_BUF_SIZE * 32)
+#endif
 
+/*
+ * The ring buffer has a single producer, the thread receiving data from the
+ * daemon, and a single consumer, the thread reading from the device. The read
+ * and write counters only grow and are each stored by one side only, so no
+ * lock is needed to pass the data. The lock and the condition are only used
+ * to sleep while the reader waits for data: it sets low_water to the amount
+ * it needs, and the producer wakes it up only once that much data is there.
+ */
 struct ringbuffer {
 	/* Should be the first member of struct */
 	struct dvb_open_descriptor open_dev;
 
 	/* ringbuffer handling */
 	int rc;
-	ssize_t read, write;
-	char buf[RINGBUF_SIZE];
+	size_t size, read, write;
+	size_t low_water;
+	char *buf;
 	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* Data dropped because the reader didn't keep up */
+	unsigned long long overflows, overflow_bytes;
 };
 
+/*
+ * Room for the commands of a batch, sent with a single write. The daemon
+ * handles the commands in the order they were received.
+ */
+#define BATCH_BUF_SIZE	(REMOTE_BUF_SIZE * 4)
+
 #define CMD_SIZE	80
 struct queued_msg {
 	int seq;
 	char cmd[CMD_SIZE];
 	int retval;
 
+	/* Sent within a batch: nobody waits for the reply */
+	int async;
+	dvb_dev_complete_t *complete;
+	void *complete_priv;
+
 	pthread_mutex_t lock;
 	pthread_cond_t cond;
 
@@ -97,6 +130,9 @@ struct dvb_dev_remote_priv {
 
 	int seq, disconnected;
 
+	/* The daemon sends read data as binary frames */
+	int binary_data;
+
 	dvb_dev_change_t notify_dev_change;
 
 	pthread_t recv_id;
@@ -107,6 +143,16 @@ struct dvb_dev_remote_priv {
 
 	struct queued_msg msgs;
 
+	/* Batch started with dvb_dev_batch_start(), protected by lock_io */
+	int batch;
+	dvb_dev_complete_t *batch_complete;
+	void *batch_priv;
+	char *batch_buf;
+	size_t batch_len;
+	int batch_first_seq;
+	int batch_pending, batch_ret;
+	pthread_cond_t batch_cond;
+
 	/* private user data, used by event notifier*/
 	void *user_priv;
 };
@@ -224,20 +270,147 @@ static ssize_t prepare_data(struct dvb_v5_fe_parms_priv *parms,
 	return ret;
 }
 
-static struct queued_msg *send_fmt(struct dvb_device_priv *dvb, int fd,
-				   const char *cmd, const char *fmt, ...)
-	__attribute__ (( format( printf, 4, 5 )));
+/*
+ * Completes a message sent within a batch, once its reply arrived or it
+ * couldn't be sent. Called with lock_io held.
+ */
+static void complete_msg(struct dvb_device_priv *dvb, struct queued_msg *msg,
+			 int retval)
+{
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msgs;
 
-static struct queued_msg *send_fmt(struct dvb_device_priv *dvb, int fd,
-				   const char *cmd, const char *fmt, ...)
+	for (msgs = &priv->msgs; msgs->next; msgs = msgs->next) {
+		if (msgs->next == msg) {
+			msgs->next = msg->next;
+			break;
+		}
+	}
+
+	if (retval < 0 && !priv->batch_ret)
+		priv->batch_ret = retval;
+	if (msg->complete)
+		msg->complete(msg->complete_priv, msg->cmd, retval);
+
+	priv->batch_pending--;
+	pthread_cond_broadcast(&priv->batch_cond);
+
+	pthread_cond_destroy(&msg->cond);
+	pthread_mutex_destroy(&msg->lock);
+	free(msg);
+}
+
+static int write_all(int fd, const char *buf, size_t size)
+{
+	ssize_t ret;
+
+	while (size) {
+		ret = write(fd, buf, size);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Sends the queued commands of a batch. If that fails, they're completed
+ * with -EIO. Called with lock_io held.
+ */
+static int flush_batch(struct dvb_device_priv *dvb, int fd)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
-	struct queued_msg *msg, *msgs;
-	char buf[REMOTE_BUF_SIZE], *p = buf, *endp = &buf[sizeof(buf)];
-	int ret, len, err;
+	struct queued_msg *msg, *next;
+	int ret = 0;
+
+	if (!priv->batch_len)
+		return 0;
+
+	if (write_all(fd, priv->batch_buf, priv->batch_len) < 0) {
+		dvb_perror("write");
+		for (msg = priv->msgs.next; msg; msg = next) {
+			next = msg->next;
+			if (msg->async && msg->seq >= priv->batch_first_seq)
+				complete_msg(dvb, msg, -EIO);
+		}
+		ret = -1;
+	}
+	priv->batch_len = 0;
+
+	return ret;
+}
+
+/*
+ * Sends an encoded message and adds it to the message queue. Called with
+ * lock_io held. Within a batch, the message is queued at the batch buffer.
+ * A message that is waited for is sent at once, together with the queued
+ * ones, so the order of the commands is kept.
+ */
+static int send_msg(struct dvb_device_priv *dvb, int fd,
+		    struct queued_msg *msg, const char *buf, size_t size)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msgs;
 	int32_t i32;
-	va_list ap;
+	ssize_t ret;
+
+	if (!msg->async)
+		pthread_mutex_lock(&msg->lock);
+
+	i32 = htobe32(size);
+	if (priv->batch_buf && (msg->async || priv->batch_len)) {
+		if (priv->batch_len + size + 4 > BATCH_BUF_SIZE)
+			flush_batch(dvb, fd);
+		if (!priv->batch_len)
+			priv->batch_first_seq = msg->seq;
+		memcpy(priv->batch_buf + priv->batch_len, &i32, 4);
+		memcpy(priv->batch_buf + priv->batch_len + 4, buf, size);
+		priv->batch_len += size + 4;
+		if (!msg->async && flush_batch(dvb, fd) < 0)
+			goto error;
+	} else {
+		ret = send(fd, (void *)&i32, 4, MSG_MORE);
+		if (ret == 4)
+			ret = write(fd, buf, size);
+		else if (ret >= 0)
+			ret = 0;
+		if (ret < (ssize_t)size) {
+			if (ret < 0)
+				dvb_perror("write");
+			else
+				dvb_logerr("incomplete send");
+			goto error;
+		}
+	}
+
+	USDT(libdvbv5, remote_send, msg->seq, msg->cmd, size);
+
+	/* Add it to the message queue */
+	for (msgs = &priv->msgs; msgs->next; msgs = msgs->next);
+	msgs->next = msg;
+	if (msg->async)
+		priv->batch_pending++;
+
+	return 0;
+
+error:
+	if (!msg->async)
+		pthread_mutex_unlock(&msg->lock);
+	stack_dump(parms);
+	return -1;
+}
+
+static struct queued_msg *alloc_msg(struct dvb_device_priv *dvb,
+				    const char *cmd, int async)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
 
 	msg = calloc(1, sizeof(*msg));
 	if (!msg) {
@@ -249,172 +422,150 @@ static struct queued_msg *send_fmt(struct dvb_device_priv *dvb, int fd,
 	pthread_mutex_init(&msg->lock, NULL);
 	pthread_cond_init(&msg->cond, NULL);
 	my_strlcpy(msg->cmd, cmd, sizeof(msg->cmd));
+	if (async) {
+		msg->async = 1;
+		msg->complete = priv->batch_complete;
+		msg->complete_priv = priv->batch_priv;
+	}
 
-	pthread_mutex_lock(&priv->lock_io);
-	msg->seq = ++priv->seq;
+	return msg;
+}
+
+static void destroy_msg(struct queued_msg *msg)
+{
+	pthread_mutex_destroy(&msg->lock);
+	pthread_cond_destroy(&msg->cond);
+	free(msg);
+}
+
+/* Encodes the sequence number and the command at buf */
+static ssize_t prepare_cmd(struct dvb_v5_fe_parms_priv *parms,
+			   struct queued_msg *msg, char *buf, size_t size)
+{
+	char *p = buf, *endp = &buf[size];
+	int32_t i32;
+	int len;
 
 	/* Encode sequence number */
 	i32 = htobe32(msg->seq);
 	if (p + 4 > endp) {
 		dvb_logdbg("buffer to short for int32_t");
 		stack_dump(parms);
-		pthread_mutex_unlock(&priv->lock_io);
-		free(msg);
-		return NULL;
+		return -1;
 	}
 	memcpy(p, &i32, 4);
 	p += 4;
 
 	/* Encode command */
-	len = strlen(cmd);
+	len = strlen(msg->cmd);
 	if (p + len + 4 > endp) {
-		dvb_logdbg("buffer too short for command: pos: %zd, len:%d, buffer size:%zd",
-				p - buf, len, sizeof(buf));
+		dvb_logdbg("buffer too short for command: pos: %zd, len:%d, buffer size:%zu",
+				p - buf, len, size);
 		stack_dump(parms);
-		pthread_mutex_unlock(&priv->lock_io);
-		free(msg);
-		return NULL;
+		return -1;
 	}
 	i32 = htobe32(len);
 	memcpy(p, &i32, 4);
 	p += 4;
-	memcpy(p, cmd, len);
+	memcpy(p, msg->cmd, len);
 	p += len;
 
-	/* Encode other parameters */
+	return p - buf;
+}
 
-	va_start(ap, fmt);
-	ret = __prepare_data(parms, p, endp - p, fmt, ap);
-	va_end(ap);
+static struct queued_msg *vsend_fmt(struct dvb_device_priv *dvb, int fd,
+				    int async, const char *cmd,
+				    const char *fmt, va_list ap)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	char buf[REMOTE_BUF_SIZE], *p = buf, *endp = &buf[sizeof(buf)];
+	ssize_t ret;
 
-	if (ret < 0) {
-		pthread_mutex_unlock(&priv->lock_io);
-		free(msg);
+	msg = alloc_msg(dvb, cmd, async);
+	if (!msg)
 		return NULL;
-	}
 
-	p += ret;
+	pthread_mutex_lock(&priv->lock_io);
+	msg->seq = ++priv->seq;
 
-	pthread_mutex_lock(&msg->lock);
-	i32 = htobe32(p - buf);
-	ret = send(fd, (void *)&i32, 4, MSG_MORE);
-	if (ret != 4) {
-		err = 1;
-	} else {
-		err = 0;
-		ret = write(fd, buf, p - buf);
+	ret = prepare_cmd(parms, msg, p, endp - p);
+	if (ret >= 0) {
+		p += ret;
+
+		/* Encode other parameters */
+		ret = __prepare_data(parms, p, endp - p, fmt, ap);
 	}
-	if (ret < 0 || (ret < p - buf) || err) {
-		pthread_mutex_destroy(&msg->lock);
-		pthread_cond_destroy(&msg->cond);
-		free(msg);
-		msg = NULL;
-		if (ret < 0)
-			dvb_perror("write");
-		else
-			dvb_logerr("incomplete send");
-		stack_dump(parms);
-	} else {
-		/* Add it to the message queue */
-		for (msgs = &priv->msgs; msgs->next; msgs = msgs->next);
-		msgs->next = msg;
+	if (ret < 0 || send_msg(dvb, fd, msg, buf, p + ret - buf) < 0) {
+		pthread_mutex_unlock(&priv->lock_io);
+		destroy_msg(msg);
+		return NULL;
 	}
 	pthread_mutex_unlock(&priv->lock_io);
 
 	return msg;
 }
 
+static struct queued_msg *send_fmt(struct dvb_device_priv *dvb, int fd,
+				   const char *cmd, const char *fmt, ...)
+	__attribute__ (( format( printf, 4, 5 )));
+
+static struct queued_msg *send_fmt(struct dvb_device_priv *dvb, int fd,
+				   const char *cmd, const char *fmt, ...)
+{
+	struct queued_msg *msg;
+	va_list ap;
+
+	va_start(ap, fmt);
+	msg = vsend_fmt(dvb, fd, 0, cmd, fmt, ap);
+	va_end(ap);
+
+	return msg;
+}
+
 static struct queued_msg *send_buf(struct dvb_device_priv *dvb, int fd,
 				   const char cmd[CMD_SIZE],
 				   const char *in_buf, const size_t in_size)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
-	struct queued_msg *msg, *msgs;
-	char buf[REMOTE_BUF_SIZE], *p = buf, *endp = &buf[sizeof(buf)];
-	int ret, len, err;
-	int32_t i32;
+	struct queued_msg *msg;
+	char buf[REMOTE_BUF_SIZE], *p = buf;
+	ssize_t ret;
 
-	msg = calloc(1, sizeof(*msg));
-	if (!msg) {
-		dvb_logerr("calloc queued_msg");
-		stack_dump(parms);
+	msg = alloc_msg(dvb, cmd, 0);
+	if (!msg)
 		return NULL;
-	}
-
-	pthread_mutex_init(&msg->lock, NULL);
-	pthread_cond_init(&msg->cond, NULL);
-	my_strlcpy(msg->cmd, cmd, sizeof(msg->cmd));
 
 	pthread_mutex_lock(&priv->lock_io);
 	msg->seq = ++priv->seq;
 
-	/* Encode sequence number */
-	i32 = htobe32(msg->seq);
-	if (p + 4 > endp) {
-		dvb_logdbg("buffer to short for int32_t");
-		stack_dump(parms);
-		pthread_mutex_unlock(&priv->lock_io);
-		free(msg);
-		return NULL;
-	}
-	memcpy(p, &i32, 4);
-	p += 4;
-
-	/* Encode command */
-	len = strlen(cmd);
-	if (p + len + 4 > endp) {
-		dvb_logdbg("buffer too short for command: pos: %zd, len:%d, buffer size:%zd",
-				p - buf, len, sizeof(buf));
-		stack_dump(parms);
-		pthread_mutex_unlock(&priv->lock_io);
-		free(msg);
-		return NULL;
-	}
-	i32 = htobe32(len);
-	memcpy(p, &i32, 4);
-	p += 4;
-	memcpy(p, cmd, len);
-	p += len;
+	ret = prepare_cmd(parms, msg, p, sizeof(buf));
+	if (ret < 0)
+		goto error;
+	p += ret;
 
 	/* Copy buffer contents */
 	if (in_size >= p - buf + REMOTE_BUF_SIZE) {
 		dvb_logdbg("buffer to big!");
 		stack_dump(parms);
-		pthread_mutex_unlock(&priv->lock_io);
-		free(msg);
-		return NULL;
+		goto error;
 	}
 
 	memcpy(p, in_buf, in_size);
 	p += in_size;
 
-	i32 = htobe32(p - buf);
-	ret = send(fd, (void *)&i32, 4, MSG_MORE);
-	if (ret != 4) {
-		err = 1;
-	} else {
-		err = 0;
-		ret = write(fd, buf, p - buf);
-	}
-	if (ret < 0 || (ret < p - buf) || err) {
-		pthread_mutex_destroy(&msg->lock);
-		pthread_cond_destroy(&msg->cond);
-		free(msg);
-		msg = NULL;
-		if (ret < 0)
-			dvb_perror("write");
-		else
-			dvb_logerr("incomplete send");
-		stack_dump(parms);
-	} else {
-		/* Add it to the message queue */
-		for (msgs = &priv->msgs; msgs->next; msgs = msgs->next);
-		msgs->next = msg;
-	}
+	if (send_msg(dvb, fd, msg, buf, p - buf) < 0)
+		goto error;
 	pthread_mutex_unlock(&priv->lock_io);
 
 	return msg;
+
+error:
+	pthread_mutex_unlock(&priv->lock_io);
+	destroy_msg(msg);
+	return NULL;
 }
 
 static void free_msg(struct dvb_device_priv *dvb, struct queued_msg *msg)
@@ -527,6 +678,9 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 		msg->retval = -ENODEV;
 		pthread_cond_signal(&msg->cond);
 	}
+	pthread_mutex_lock(&priv->lock_io);
+	pthread_cond_broadcast(&priv->batch_cond);
+	pthread_mutex_unlock(&priv->lock_io);
 	/* Close the socket */
 	if (priv->fd > 0) {
 		close(priv->fd);
@@ -534,70 +688,179 @@ static void dvb_dev_remote_disconnect(struct dvb_dev_remote_priv *priv)
 	}
 }
 
+static size_t ringbuffer_size(void)
+{
+	const char *env = getenv("DVB_REMOTE_RINGBUF_SIZE");
+	size_t wanted = RINGBUF_SIZE, size = 2 * REMOTE_DATA_FRAME_SIZE;
+
+	if (env && atol(env) > 0)
+		wanted = atol(env);
+
+	while (size < wanted)
+		size <<= 1;
+	return size;
+}
+
+static void wake_ringbuffer(struct ringbuffer *ringbuf)
+{
+	pthread_mutex_lock(&ringbuf->lock);
+	pthread_cond_signal(&ringbuf->cond);
+	pthread_mutex_unlock(&ringbuf->lock);
+}
+
+static void set_ringbuffer_error(struct ringbuffer *ringbuf, int rc)
+{
+	__atomic_store_n(&ringbuf->rc, rc, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ringbuf->low_water, __ATOMIC_SEQ_CST))
+		wake_ringbuffer(ringbuf);
+}
+
+/*
+ * Check that size bytes fit in the ring buffer. If not, they are dropped
+ * instead of overwriting unread data.
+ */
+static int ringbuffer_fits(struct ringbuffer *ringbuf, size_t size)
+{
+	size_t read = __atomic_load_n(&ringbuf->read, __ATOMIC_ACQUIRE);
+
+	if (ringbuf->size - (ringbuf->write - read) >= size)
+		return 1;
+
+	__atomic_add_fetch(&ringbuf->overflows, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&ringbuf->overflow_bytes, size, __ATOMIC_RELAXED);
+	set_ringbuffer_error(ringbuf, -EOVERFLOW);
+	return 0;
+}
+
+/* Make size more bytes written after the write counter visible to the reader */
+static void commit_ringbuffer(struct ringbuffer *ringbuf, size_t size)
+{
+	size_t write = ringbuf->write + size;
+	size_t low_water;
+
+	__atomic_store_n(&ringbuf->write, write, __ATOMIC_SEQ_CST);
+
+	low_water = __atomic_load_n(&ringbuf->low_water, __ATOMIC_SEQ_CST);
+	if (low_water &&
+	    write - __atomic_load_n(&ringbuf->read, __ATOMIC_ACQUIRE) >= low_water)
+		wake_ringbuffer(ringbuf);
+}
+
 static void write_ringbuffer(struct dvb_open_descriptor *open_dev,
 			    ssize_t size, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t len = size, split;
-
-	pthread_mutex_lock(&ringbuf->lock);
+	size_t pos = ringbuf->write & (ringbuf->size - 1);
+	size_t split;
+
+	if (!ringbuffer_fits(ringbuf, size))
+		return;
+
+	split = ringbuf->size - pos;
+	if (split > (size_t)size)
+		split = size;
+	memcpy(&ringbuf->buf[pos], buf, split);
+	memcpy(ringbuf->buf, buf + split, size - split);
+	commit_ringbuffer(ringbuf, size);
+}
 
-	split = (ringbuf->write + size > RINGBUF_SIZE) ?
-		 RINGBUF_SIZE - ringbuf->write : 0;
+static int discard_data(int fd, size_t size)
+{
+	char buf[REMOTE_BUF_SIZE];
+	ssize_t ret;
 
-	if (split > 0) {
-		memcpy(&ringbuf->buf[ringbuf->write], buf, split);
-		buf += split;
-		len -= split;
-		ringbuf->write = 0;
+	while (size) {
+		ret = recv(fd, buf, size < sizeof(buf) ? size : sizeof(buf), MSG_WAITALL);
+		if (ret <= 0)
+			return -1;
+		size -= ret;
 	}
+	return 0;
+}
 
-	memcpy(&ringbuf->buf[ringbuf->write], buf, len);
-	ringbuf->write = (ringbuf->write + len) % RINGBUF_SIZE;
+/* Receive a data frame from the socket straight into the ring buffer */
+static int recv_ringbuffer(struct ringbuffer *ringbuf, int fd, size_t size)
+{
+	size_t pos = ringbuf->write & (ringbuf->size - 1);
+	size_t split;
 
-	/* Detect buffer overflows */
-	if ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < size)
-		ringbuf->rc = -EOVERFLOW;
+	if (!ringbuffer_fits(ringbuf, size))
+		return discard_data(fd, size);
 
-	pthread_mutex_unlock(&ringbuf->lock);
+	split = ringbuf->size - pos;
+	if (split > size)
+		split = size;
+	if (recv(fd, &ringbuf->buf[pos], split, MSG_WAITALL) != (ssize_t)split)
+		return -1;
+	if (size > split &&
+	    recv(fd, ringbuf->buf, size - split, MSG_WAITALL) != (ssize_t)(size - split))
+		return -1;
+	commit_ringbuffer(ringbuf, size);
+	return 0;
 }
 
-static void read_ringbuffer(struct dvb_open_descriptor *open_dev,
-			    size_t *len, char *buf)
+static ssize_t read_ringbuffer(struct dvb_open_descriptor *open_dev,
+			       size_t len, char *buf)
 {
 	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
-	ssize_t size, split;
+	struct dvb_dev_remote_priv *priv = open_dev->dvb->priv;
+	size_t read = ringbuf->read;
+	size_t pos = read & (ringbuf->size - 1);
+	size_t split;
+	int rc;
 
 	/* Sets the read size */
-	if (*len > REMOTE_BUF_SIZE)
-		*len = REMOTE_BUF_SIZE;
+	if (len > REMOTE_BUF_SIZE)
+		len = REMOTE_BUF_SIZE;
 
 	/* Wait for data to arrive */
-	pthread_mutex_lock(&ringbuf->lock);
-	while ((unsigned)((ringbuf->write - ringbuf->read) % RINGBUF_SIZE) < *len) {
-		pthread_mutex_unlock(&ringbuf->lock);
-		usleep(1);
+	if (__atomic_load_n(&ringbuf->write, __ATOMIC_ACQUIRE) - read < len) {
 		pthread_mutex_lock(&ringbuf->lock);
+		__atomic_store_n(&ringbuf->low_water, len, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&ringbuf->write, __ATOMIC_SEQ_CST) - read < len) {
+			struct timespec timeout;
+
+			if (__atomic_load_n(&ringbuf->rc, __ATOMIC_SEQ_CST) ||
+			    priv->disconnected)
+				break;
+
+			/* Wake up from time to time to notice a disconnect */
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec++;
+			pthread_cond_timedwait(&ringbuf->cond, &ringbuf->lock, &timeout);
+		}
+		__atomic_store_n(&ringbuf->low_water, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&ringbuf->lock);
 	}
 
-	size = *len;
+	rc = __atomic_exchange_n(&ringbuf->rc, 0, __ATOMIC_SEQ_CST);
+	if (rc)
+		return rc;
+	if (priv->disconnected)
+		return -ENODEV;
 
-	*len = 0;
-	split = (ringbuf->read + size > RINGBUF_SIZE) ? RINGBUF_SIZE - ringbuf->read : 0;
-	if (split > 0) {
+	split = ringbuf->size - pos;
+	if (split > len)
+		split = len;
+	memcpy(buf, &ringbuf->buf[pos], split);
+	memcpy(buf + split, ringbuf->buf, len - split);
 
-		memcpy(buf, &ringbuf->buf[ringbuf->read], split);
-		buf += split;
-		size -= split;
-		*len += split;
-		ringbuf->read = 0;
-	}
-	memcpy(buf, &ringbuf->buf[ringbuf->read], size);
-	*len += size;
+	__atomic_store_n(&ringbuf->read, read + len, __ATOMIC_RELEASE);
 
-	ringbuf->read = (ringbuf->read + size) % RINGBUF_SIZE;
+	return len;
+}
 
-	pthread_mutex_unlock(&ringbuf->lock);
+static void log_ringbuffer_overflows(struct dvb_open_descriptor *open_dev)
+{
+	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
+	struct dvb_v5_fe_parms_priv *parms = (void *)open_dev->dvb->d.fe_parms;
+	unsigned long long overflows, overflow_bytes;
+
+	overflows = __atomic_load_n(&ringbuf->overflows, __ATOMIC_RELAXED);
+	overflow_bytes = __atomic_load_n(&ringbuf->overflow_bytes, __ATOMIC_RELAXED);
+	if (overflows)
+		dvb_logwarn("ID %d: ring buffer of %zu bytes overflowed %llu times, %llu bytes lost",
+			    open_dev->fd, ringbuf->size, overflows, overflow_bytes);
 }
 
 static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
@@ -628,6 +891,38 @@ static void log_hexdump(struct dvb_v5_fe_parms_priv *parms, int len,
 	}
 }
 
+static int receive_data_frame(struct dvb_device_priv *dvb, size_t size)
+{
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_open_descriptor *cur;
+	int32_t header[2];
+	int uid, retval;
+
+	if (size < sizeof(header) ||
+	    recv(priv->fd, header, sizeof(header), MSG_WAITALL) != sizeof(header))
+		return -1;
+	size -= sizeof(header);
+	uid = be32toh(header[0]);
+	retval = be32toh(header[1]);
+
+	USDT(libdvbv5, remote_data, uid, retval, size);
+
+	for (cur = dvb->open_list.next; cur; cur = cur->next) {
+		struct ringbuffer *ringbuf = (struct ringbuffer *)cur;
+
+		if (cur->fd != uid)
+			continue;
+
+		if (retval < 0)
+			set_ringbuffer_error(ringbuf, retval);
+		return recv_ringbuffer(ringbuf, priv->fd, size);
+	}
+
+	dvb_logerr("received data for unknown ID %d", uid);
+	return discard_data(priv->fd, size);
+}
+
 static void *receive_data(void *privdata)
 {
 	struct dvb_device_priv *dvb = privdata;
@@ -635,7 +930,8 @@ static void *receive_data(void *privdata)
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct queued_msg *msg;
 	struct dvb_open_descriptor *cur;
-	char buf[REMOTE_BUF_SIZE + 8], cmd[REMOTE_BUF_SIZE], *args;
+	/* Room for a "data_read" message with REMOTE_BUF_SIZE bytes of data */
+	char buf[REMOTE_BUF_SIZE + 64], cmd[REMOTE_BUF_SIZE], *args;
 	ssize_t size, args_size;
 	int ret, retval, seq, handled, uid, found;
 
@@ -649,8 +945,23 @@ static void *receive_data(void *privdata)
 			dvb_dev_remote_disconnect(priv);
 			return NULL;
 		}
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
+		size = (uint32_t)(uint8_t)buf[0] << 24 | (uint32_t)(uint8_t)buf[1] << 16 |
+		       (uint32_t)(uint8_t)buf[2] << 8 | (uint32_t)(uint8_t)buf[3];
+
+		if (size & REMOTE_DATA_FRAME) {
+			if (receive_data_frame(dvb, size & ~REMOTE_DATA_FRAME) < 0) {
+				dvb_logerr("remote end disconnected");
+				dvb_dev_remote_disconnect(priv);
+				return NULL;
+			}
+			continue;
+		}
+		if (size > (ssize_t)sizeof(buf)) {
+			dvb_logerr("invalid protocol message with size %zd", size);
+			dvb_dev_remote_disconnect(priv);
+			return NULL;
+		}
+
 		ret = recv(priv->fd, buf, size, MSG_WAITALL);
 		if (ret != size) {
 			if (size < 0)
@@ -674,6 +985,8 @@ static void *receive_data(void *privdata)
 			args += ret;
 			args_size -= ret;
 
+			USDT(libdvbv5, remote_receive, seq, cmd, retval);
+
 			/* Check for messages that aren't command responses */
 			if (seq)
 				break;
@@ -718,7 +1031,7 @@ static void *receive_data(void *privdata)
 
 						found = 1;
 						if (retval < 0) {
-							ringbuf->rc = retval;
+							set_ringbuffer_error(ringbuf, retval);
 							continue;
 						}
 						write_ringbuffer(cur, args_size, args);
@@ -754,6 +1067,11 @@ static void *receive_data(void *privdata)
 				free_msg(dvb, msg);
 				break;
 			}
+			if (msg->async) {
+				complete_msg(dvb, msg, retval);
+				pthread_mutex_unlock(&priv->lock_io);
+				break;
+			}
 			memcpy(msg->args, args, args_size);
 			msg->args_size = args_size;
 			msg->retval = retval;
@@ -777,18 +1095,111 @@ static void *receive_data(void *privdata)
 /*
  * Function handlers
  */
+
+/*
+ * Sends a command whose only result is its return value, and waits for it.
+ * Within a batch, the command is just queued and zero is returned: its
+ * result is reported when it completes, see dvb_dev_batch_start().
+ */
+static int send_cmd(struct dvb_device_priv *dvb, const char *cmd,
+		    const char *fmt, ...)
+	__attribute__ (( format( printf, 3, 4 )));
+
+static int send_cmd(struct dvb_device_priv *dvb, const char *cmd,
+		    const char *fmt, ...)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	struct queued_msg *msg;
+	va_list ap;
+	int ret;
+
+	if (priv->disconnected)
+		return -ENODEV;
+
+	va_start(ap, fmt);
+	msg = vsend_fmt(dvb, priv->fd, priv->batch, cmd, fmt, ap);
+	va_end(ap);
+	if (!msg)
+		return -1;
+	if (msg->async)
+		return 0;
+
+	ret = pthread_cond_wait(&msg->cond, &msg->lock);
+	if (ret < 0)
+		dvb_logerr("error waiting for %s response", msg->cmd);
+	else
+		ret = msg->retval;
+
+	msg->seq = 0; /* Avoids any risk of a recursive call */
+	pthread_mutex_unlock(&msg->lock);
+
+	free_msg(dvb, msg);
+	return ret;
+}
+
+static int dvb_remote_batch_start(struct dvb_device_priv *dvb,
+				  dvb_dev_complete_t *complete,
+				  void *user_priv)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+
+	if (priv->disconnected)
+		return -ENODEV;
+
+	pthread_mutex_lock(&priv->lock_io);
+	if (priv->batch || priv->batch_pending) {
+		pthread_mutex_unlock(&priv->lock_io);
+		dvb_logerr("a batch is already in progress");
+		return -EBUSY;
+	}
+	if (!priv->batch_buf) {
+		priv->batch_buf = malloc(BATCH_BUF_SIZE);
+		if (!priv->batch_buf) {
+			pthread_mutex_unlock(&priv->lock_io);
+			dvb_logerr("can't allocate the batch buffer");
+			return -ENOMEM;
+		}
+	}
+	priv->batch = 1;
+	priv->batch_complete = complete;
+	priv->batch_priv = user_priv;
+	priv->batch_ret = 0;
+	pthread_mutex_unlock(&priv->lock_io);
+
+	return 0;
+}
+
+static int dvb_remote_batch_wait(struct dvb_device_priv *dvb)
+{
+	struct dvb_dev_remote_priv *priv = dvb->priv;
+	int ret;
+
+	pthread_mutex_lock(&priv->lock_io);
+	flush_batch(dvb, priv->fd);
+	priv->batch = 0;
+	while (priv->batch_pending && !priv->disconnected)
+		pthread_cond_wait(&priv->batch_cond, &priv->lock_io);
+	ret = priv->batch_pending ? -ENODEV : priv->batch_ret;
+	pthread_mutex_unlock(&priv->lock_io);
+
+	return ret;
+}
+
 static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
 	struct queued_msg *msg;
-	char version[REMOTE_BUF_SIZE];
+	char version[REMOTE_BUF_SIZE], features[REMOTE_BUF_SIZE];
 	int ret;
 
 	if (priv->disconnected)
 		return -ENODEV;
 
-	msg = send_fmt(dvb, priv->fd, "daemon_get_version", "-");
+	msg = send_fmt(dvb, priv->fd, "daemon_get_version", "%s",
+		       REMOTE_FEATURE_BINARY_DATA);
 	if (!msg)
 		return -1;
 
@@ -814,6 +1225,13 @@ static int dvb_remote_get_version(struct dvb_device_priv *dvb)
 		goto error;
 	}
 
+	/* The daemon lists the features it agreed to use after its version */
+	if (msg->args_size > ret &&
+	    scan_data(parms, msg->args + ret, msg->args_size - ret, "%s", features) > 0)
+		priv->binary_data = !strcmp(features, REMOTE_FEATURE_BINARY_DATA);
+	if (priv->binary_data)
+		dvb_logdbg("Using binary data frames");
+
 	/* version matches */
 	ret = 1;
 
@@ -1048,14 +1466,20 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 		return NULL;
 
 	ringbuf = calloc(1, sizeof(*ringbuf));
-	if (!ringbuf) {
+	if (ringbuf) {
+		ringbuf->size = ringbuffer_size();
+		ringbuf->buf = malloc(ringbuf->size);
+	}
+	if (!ringbuf || !ringbuf->buf) {
 		dvb_perror("Can't create file descriptor");
+		free(ringbuf);
 		return NULL;
 	}
 	open_dev = &ringbuf->open_dev;
 
 	msg = send_fmt(dvb, priv->fd, "dev_open", "%s%i", sysname, flags);
 	if (!msg) {
+		free(ringbuf->buf);
 		free(ringbuf);
 		return NULL;
 	}
@@ -1076,6 +1500,7 @@ static struct dvb_open_descriptor *dvb_remote_open(struct dvb_device_priv *dvb,
 
 	/* Initialize ringbuffer data*/
 	pthread_mutex_init(&ringbuf->lock, NULL);
+	pthread_cond_init(&ringbuf->cond, NULL);
 
 	cur = &dvb->open_list;
 	while (cur->next)
@@ -1093,6 +1518,7 @@ error:
 	pthread_mutex_unlock(&msg->lock);
 
 	free_msg(dvb, msg);
+	free(ringbuf->buf);
 	free(ringbuf);
 	return NULL;
 }
@@ -1132,7 +1558,10 @@ error:
 	for (cur = &dvb->open_list; cur->next; cur = cur->next) {
 		if (cur->next == open_dev) {
 			cur->next = open_dev->next;
+			log_ringbuffer_overflows(open_dev);
+			pthread_cond_destroy(&ringbuffer->cond);
 			pthread_mutex_destroy(&ringbuffer->lock);
+			free(ringbuffer->buf);
 			free(ringbuffer);
 			goto ret;
 		}
@@ -1152,122 +1581,39 @@ ret:
 
 static int dvb_remote_dmx_stop(struct dvb_open_descriptor *open_dev)
 {
-	struct dvb_device_priv *dvb = open_dev->dvb;
-	struct dvb_dev_remote_priv *priv = dvb->priv;
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	struct queued_msg *msg;
-	int ret;
-
-	if (priv->disconnected)
-		return -ENODEV;
-
-	msg = send_fmt(dvb, priv->fd, "dev_dmx_stop", "%i", open_dev->fd);
-	if (!msg)
-		return -1;
-
-	ret = pthread_cond_wait(&msg->cond, &msg->lock);
-	if (ret < 0) {
-		dvb_logerr("error waiting for %s response", msg->cmd);
-		goto error;
-	}
-
-	ret = msg->retval;
-
-error:
-	msg->seq = 0; /* Avoids any risk of a recursive call */
-	pthread_mutex_unlock(&msg->lock);
-
-	free_msg(dvb, msg);
-	return ret;
+	return send_cmd(open_dev->dvb, "dev_dmx_stop", "%i", open_dev->fd);
 }
 
 static int dvb_remote_set_bufsize(struct dvb_open_descriptor *open_dev,
 			int bufsize)
 {
-	struct dvb_device_priv *dvb = open_dev->dvb;
-	struct dvb_dev_remote_priv *priv = dvb->priv;
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	struct queued_msg *msg;
-	int ret;
-
-	if (priv->disconnected)
-		return -ENODEV;
-
-	msg = send_fmt(dvb, priv->fd, "dev_set_bufsize", "%i%i",
-		       open_dev->fd, bufsize);
-	if (!msg)
-		return -1;
-
-	ret = pthread_cond_wait(&msg->cond, &msg->lock);
-	if (ret < 0) {
-		dvb_logerr("error waiting for %s response", msg->cmd);
-		goto error;
-	}
-
-	ret = msg->retval;
-
-error:
-	msg->seq = 0; /* Avoids any risk of a recursive call */
-	pthread_mutex_unlock(&msg->lock);
-
-	free_msg(dvb, msg);
-	return ret;
+	return send_cmd(open_dev->dvb, "dev_set_bufsize", "%i%i",
+			open_dev->fd, bufsize);
 }
 
 static ssize_t dvb_remote_read(struct dvb_open_descriptor *open_dev,
 		     void *buf, size_t count)
 {
-	struct ringbuffer *ringbuf = (struct ringbuffer *)open_dev;
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_remote_priv *priv = dvb->priv;
-	int ret;
+	ssize_t ret;
 
 	if (priv->disconnected)
 		return -ENODEV;
 
-	if (ringbuf->rc) {
-		ret = ringbuf->rc;
-		ringbuf->rc = 0;
-		return ret;
-	}
-
-	read_ringbuffer(open_dev, &count, buf);
+	ret = read_ringbuffer(open_dev, count, buf);
+	if (ret == -EOVERFLOW)
+		log_ringbuffer_overflows(open_dev);
 
-	return count;
+	return ret;
 }
 
 static int dvb_remote_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
 			      int pid, dmx_pes_type_t type,
 			      dmx_output_t output, int bufsize)
 {
-	struct dvb_device_priv *dvb = open_dev->dvb;
-	struct dvb_dev_remote_priv *priv = dvb->priv;
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	struct queued_msg *msg;
-	int ret;
-
-	if (priv->disconnected)
-		return -ENODEV;
-
-	msg = send_fmt(dvb, priv->fd, "dev_dmx_set_pesfilter", "%i%i%i%i%i",
-		       open_dev->fd, pid, type, output, bufsize);
-	if (!msg)
-		return -1;
-
-	ret = pthread_cond_wait(&msg->cond, &msg->lock);
-	if (ret < 0) {
-		dvb_logerr("error waiting for %s response", msg->cmd);
-		goto error;
-	}
-
-	ret = msg->retval;
-
-error:
-	msg->seq = 0; /* Avoids any risk of a recursive call */
-	pthread_mutex_unlock(&msg->lock);
-
-	free_msg(dvb, msg);
-	return ret;
+	return send_cmd(open_dev->dvb, "dev_dmx_set_pesfilter", "%i%i%i%i%i",
+			open_dev->fd, pid, type, output, bufsize);
 }
 
 static int dvb_remote_dmx_set_section_filter(struct dvb_open_descriptor *open_dev,
@@ -1277,32 +1623,9 @@ static int dvb_remote_dmx_set_section_filter(struct dvb_open_descriptor *open_de
 				   unsigned char *mode,
 				   unsigned int flags)
 {
-	struct dvb_device_priv *dvb = open_dev->dvb;
-	struct dvb_dev_remote_priv *priv = dvb->priv;
-	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
-	struct queued_msg *msg;
-	int ret;
-
-	msg = send_fmt(dvb, priv->fd, "dmx_set_section_filter",
-		       "%i%i%i%s%s%s%i", open_dev->fd, pid, filtsize,
-		       filter, mask, mode, flags);
-	if (!msg)
-		return -1;
-
-	ret = pthread_cond_wait(&msg->cond, &msg->lock);
-	if (ret < 0) {
-		dvb_logerr("error waiting for %s response", msg->cmd);
-		goto error;
-	}
-
-	ret = msg->retval;
-
-error:
-	msg->seq = 0; /* Avoids any risk of a recursive call */
-	pthread_mutex_unlock(&msg->lock);
-
-	free_msg(dvb, msg);
-	return ret;
+	return send_cmd(open_dev->dvb, "dmx_set_section_filter",
+			"%i%i%i%s%s%s%i", open_dev->fd, pid, filtsize,
+			filter, mask, mode, flags);
 }
 
 static int dvb_remote_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev, int sid)
@@ -1337,6 +1660,32 @@ error:
 	return ret;
 }
 
+/* The PIDs are sent as a string, with 4 hexadecimal digits per PID */
+#define MAX_REMOTE_PIDS		((REMOTE_BUF_SIZE - 256) / 4)
+
+static int dvb_remote_dmx_set_pids(struct dvb_open_descriptor *open_dev,
+				   const uint16_t *pids, unsigned num_pids,
+				   dmx_output_t output, int bufsize)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->d.fe_parms;
+	char pid_list[MAX_REMOTE_PIDS * 4 + 1];
+	unsigned i;
+
+	if (num_pids > MAX_REMOTE_PIDS) {
+		dvb_logerr("can't set more than %d PIDs on a remote demux",
+			   (int)MAX_REMOTE_PIDS);
+		return -E2BIG;
+	}
+
+	for (i = 0; i < num_pids; i++)
+		sprintf(&pid_list[i * 4], "%04x", pids[i]);
+	pid_list[num_pids * 4] = '\0';
+
+	return send_cmd(dvb, "dev_dmx_set_pids", "%i%i%i%s",
+			open_dev->fd, output, bufsize, pid_list);
+}
+
 int dvb_remote_fe_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
@@ -1695,6 +2044,8 @@ static void dvb_dev_remote_free(struct dvb_device_priv *dvb)
 		msg = next;
 	}
 
+	free(priv->batch_buf);
+	pthread_cond_destroy(&priv->batch_cond);
 	pthread_mutex_destroy(&priv->lock_io);
 
 	/* Close the socket */
@@ -1759,6 +2110,7 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 
 	/* Start receiving messsages from the server */
 	pthread_mutex_init(&priv->lock_io, NULL);
+	pthread_cond_init(&priv->batch_cond, NULL);
 	ret = pthread_create(&priv->recv_id, NULL, receive_data, dvb);
 	if (ret < 0) {
 		dvb_perror("pthread_create");
@@ -1786,6 +2138,7 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	ops->read = dvb_remote_read;
 	ops->dmx_set_pesfilter = dvb_remote_dmx_set_pesfilter;
 	ops->dmx_set_section_filter = dvb_remote_dmx_set_section_filter;
+	ops->dmx_set_pids = dvb_remote_dmx_set_pids;
 	ops->dmx_get_pmt_pid = dvb_remote_dmx_get_pmt_pid;
 
 	ops->scan = dvb_remote_scan;
@@ -1795,6 +2148,9 @@ int dvb_dev_remote_init(struct dvb_device *d, char *server, int port)
 	ops->fe_set_parms = dvb_remote_fe_set_parms;
 	ops->fe_get_stats = dvb_remote_fe_get_stats;
 
+	ops->batch_start = dvb_remote_batch_start;
+	ops->batch_wait = dvb_remote_batch_wait;
+
 	ops->free = dvb_dev_remote_free;
 
 	return 0;
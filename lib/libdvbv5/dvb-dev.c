@@ -25,6 +25,7 @@
 
 #include "dvb-fe-priv.h"
 #include "dvb-dev-priv.h"
+#include "usdt.h"
 
 #ifdef ENABLE_NLS
 # include "gettext.h"
@@ -94,6 +95,98 @@ void dvb_dev_free_devices(struct dvb_device_priv *dvb)
 
 	dvb->d.devices = NULL;
 	dvb->d.num_devices = 0;
+
+	dvb_dev_index_invalidate(dvb);
+}
+
+/*
+ * The device index
+ *
+ * Seeking for a device used to compare the sysname of all devices. With
+ * multi-tuner cards, dozens of devices exist, and the seeks are done at
+ * each open. The backends call dvb_dev_index_invalidate() when they change
+ * the list of devices, and the index is rebuilt at the next lookup. A list
+ * that grew or was moved is also detected.
+ */
+void dvb_dev_index_invalidate(struct dvb_device_priv *dvb)
+{
+	free(dvb->dev_index);
+	dvb->dev_index = NULL;
+	dvb->dev_index_size = 0;
+}
+
+static unsigned dvb_dev_hash(const char *sysname)
+{
+	unsigned hash = 2166136261U;		/* FNV-1a */
+
+	while (*sysname) {
+		hash ^= (unsigned char)*sysname++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static int dvb_dev_index_build(struct dvb_device_priv *dvb)
+{
+	unsigned size = 16, pos, *index;
+	int i;
+
+	dvb_dev_index_invalidate(dvb);
+
+	/* Keeps the table at most half full */
+	while (size < 2 * dvb->d.num_devices)
+		size <<= 1;
+
+	index = calloc(size, sizeof(*index));
+	if (!index)
+		return -ENOMEM;
+
+	for (i = 0; i < dvb->d.num_devices; i++) {
+		if (!dvb->d.devices[i].sysname)
+			continue;
+		pos = dvb_dev_hash(dvb->d.devices[i].sysname) & (size - 1);
+		while (index[pos])
+			pos = (pos + 1) & (size - 1);
+		index[pos] = i + 1;
+	}
+
+	dvb->dev_index = index;
+	dvb->dev_index_size = size;
+	dvb->dev_index_num = dvb->d.num_devices;
+	dvb->dev_index_devices = dvb->d.devices;
+
+	return 0;
+}
+
+struct dvb_dev_list *dvb_dev_index_lookup(struct dvb_device_priv *dvb,
+					  const char *sysname)
+{
+	struct dvb_dev_list *dev;
+	unsigned pos;
+	int i;
+
+	if (!dvb->dev_index || dvb->dev_index_num != dvb->d.num_devices ||
+	    dvb->dev_index_devices != dvb->d.devices) {
+		if (dvb_dev_index_build(dvb) < 0) {
+			/* No memory for the index: seek the slow way */
+			for (i = 0; i < dvb->d.num_devices; i++) {
+				dev = &dvb->d.devices[i];
+				if (dev->sysname && !strcmp(sysname, dev->sysname))
+					return dev;
+			}
+			return NULL;
+		}
+	}
+
+	pos = dvb_dev_hash(sysname) & (dvb->dev_index_size - 1);
+	while (dvb->dev_index[pos]) {
+		dev = &dvb->d.devices[dvb->dev_index[pos] - 1];
+		if (!strcmp(sysname, dev->sysname))
+			return dev;
+		pos = (pos + 1) & (dvb->dev_index_size - 1);
+	}
+
+	return NULL;
 }
 
 void dvb_dev_free(struct dvb_device *d)
@@ -275,11 +368,16 @@ ssize_t dvb_dev_read(struct dvb_open_descriptor *open_dev,
 {
 	struct dvb_device_priv *dvb = open_dev->dvb;
 	struct dvb_dev_ops *ops = &dvb->ops;
+	ssize_t ret;
 
 	if (!ops->read)
 		return -1;
 
-	return ops->read(open_dev, buf, count);
+	USDT(libdvbv5, dev_read_start, open_dev->fd, count);
+	ret = ops->read(open_dev, buf, count);
+	USDT(libdvbv5, dev_read_end, open_dev->fd, ret);
+
+	return ret;
 }
 
 int dvb_dev_dmx_set_pesfilter(struct dvb_open_descriptor *open_dev,
@@ -323,6 +421,42 @@ int dvb_dev_dmx_get_pmt_pid(struct dvb_open_descriptor *open_dev, int sid)
 	return ops->dmx_get_pmt_pid(open_dev, sid);
 }
 
+int dvb_dev_dmx_set_pids(struct dvb_open_descriptor *open_dev,
+			 const uint16_t *pids, unsigned num_pids,
+			 dmx_output_t output, int bufsize)
+{
+	struct dvb_device_priv *dvb = open_dev->dvb;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->dmx_set_pids)
+		return -1;
+
+	return ops->dmx_set_pids(open_dev, pids, num_pids, output, bufsize);
+}
+
+int dvb_dev_batch_start(struct dvb_device *d,
+			dvb_dev_complete_t *complete, void *user_priv)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->batch_start)
+		return 0;
+
+	return ops->batch_start(dvb, complete, user_priv);
+}
+
+int dvb_dev_batch_wait(struct dvb_device *d)
+{
+	struct dvb_device_priv *dvb = (void *)d;
+	struct dvb_dev_ops *ops = &dvb->ops;
+
+	if (!ops->batch_wait)
+		return 0;
+
+	return ops->batch_wait(dvb);
+}
+
 struct dvb_v5_descriptors *dvb_dev_scan(struct dvb_open_descriptor *open_dev,
 					struct dvb_entry *entry,
 					check_frontend_t *check_frontend,
@@ -346,42 +480,62 @@ int dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	struct dvb_device_priv *dvb = parms->dvb;
+	int ret;
 
+	dvb_fe_lock(parms);
 	if (!dvb || !dvb->ops.fe_set_sys)
-		return __dvb_set_sys(p, sys);
+		ret = __dvb_set_sys(p, sys);
+	else
+		ret = dvb->ops.fe_set_sys(p, sys);
+	dvb_fe_unlock(parms);
 
-	return dvb->ops.fe_set_sys(p, sys);
+	return ret;
 }
 
 int dvb_fe_get_parms(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	struct dvb_device_priv *dvb = parms->dvb;
+	int ret;
 
+	dvb_fe_lock(parms);
 	if (!dvb || !dvb->ops.fe_get_parms)
-		return __dvb_fe_get_parms(p);
+		ret = __dvb_fe_get_parms(p);
+	else
+		ret = dvb->ops.fe_get_parms(p);
+	dvb_fe_unlock(parms);
 
-	return dvb->ops.fe_get_parms(p);
+	return ret;
 }
 
 int dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	struct dvb_device_priv *dvb = parms->dvb;
+	int ret;
 
+	dvb_fe_lock(parms);
 	if (!dvb || !dvb->ops.fe_set_parms)
-		return __dvb_fe_set_parms(p);
+		ret = __dvb_fe_set_parms(p);
+	else
+		ret = dvb->ops.fe_set_parms(p);
+	dvb_fe_unlock(parms);
 
-	return dvb->ops.fe_set_parms(p);
+	return ret;
 }
 
 int dvb_fe_get_stats(struct dvb_v5_fe_parms *p)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	struct dvb_device_priv *dvb = parms->dvb;
+	int ret;
 
+	dvb_fe_lock(parms);
 	if (!dvb || !dvb->ops.fe_get_stats)
-		return __dvb_fe_get_stats(p);
+		ret = __dvb_fe_get_stats(p);
+	else
+		ret = dvb->ops.fe_get_stats(p);
+	dvb_fe_unlock(parms);
 
-	return dvb->ops.fe_get_stats(p);
+	return ret;
 }
@@ -0,0 +1,694 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-epg.h>
+#include <libdvbv5/dvb-arena.h>
+#include <libdvbv5/crc32.h>
+#include <libdvbv5/eit.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/desc_event_short.h>
+#include <libdvbv5/desc_event_extended.h>
+
+/*
+ * The events of each service are stored as columns, indexed by the order
+ * they were received, so an event keeps its index when updated. A hash by
+ * event ID finds them for updates, and an index sorted by start time,
+ * rebuilt only when a query follows a change, serves the time queries.
+ * All strings are kept on a single pool, referenced by their offsets.
+ */
+
+/* Present/following for the actual and other TS, and 16 schedule tables for each */
+#define DVB_EPG_NUM_TABLES	(2 + 2 * 16)
+
+#define DVB_EPG_SEGMENT_UNKNOWN	0xff
+
+struct dvb_epg_table {
+	int version;
+	uint8_t last_section;
+	uint8_t segment_last[32];
+	uint8_t received[256 / 8];
+};
+
+struct dvb_epg_service {
+	struct dvb_epg_service_id id;
+
+	unsigned num_events, max_events;
+	uint16_t *event_id;
+	time_t *start;
+	uint32_t *duration;
+	uint8_t *table_id;
+	uint8_t *status;		/* running_status | free_CA_mode << 3 */
+	char (*language)[4];
+	uint32_t *name, *text, *extended_text;
+
+	/* Index + 1 of each event, by event ID */
+	uint32_t *hash;
+	unsigned hash_size;
+
+	/* Event indexes, sorted by start time */
+	uint32_t *by_start;
+	int sorted;
+
+	struct dvb_epg_table tables[DVB_EPG_NUM_TABLES];
+	uint8_t last_table_id[2];
+};
+
+struct dvb_epg {
+	struct dvb_v5_fe_parms_priv *parms;
+	struct dvb_arena *arena;
+
+	/* Sorted by network, transport and service IDs */
+	struct dvb_epg_service **services;
+	unsigned num_services, max_services;
+
+	char *pool;
+	size_t pool_len, pool_size;
+};
+
+static int dvb_epg_table_index(uint8_t table_id)
+{
+	if (table_id == DVB_TABLE_EIT)
+		return 0;
+	if (table_id == DVB_TABLE_EIT_OTHER)
+		return 1;
+	if (table_id >= DVB_TABLE_EIT_SCHEDULE &&
+	    table_id <= DVB_TABLE_EIT_SCHEDULE_OTHER + 0xf)
+		return 2 + table_id - DVB_TABLE_EIT_SCHEDULE;
+	return -1;
+}
+
+static int64_t dvb_epg_key(const struct dvb_epg_service_id *id)
+{
+	return (int64_t)id->network_id << 32 | id->transport_id << 16 |
+	       id->service_id;
+}
+
+/* Returns the position of the service, or where it should be inserted */
+static unsigned dvb_epg_find_pos(struct dvb_epg *epg,
+				 const struct dvb_epg_service_id *id)
+{
+	int64_t key = dvb_epg_key(id);
+	unsigned lo = 0, hi = epg->num_services, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (dvb_epg_key(&epg->services[mid]->id) < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static struct dvb_epg_service *dvb_epg_find(struct dvb_epg *epg,
+					    const struct dvb_epg_service_id *id)
+{
+	unsigned pos = dvb_epg_find_pos(epg, id);
+
+	if (pos < epg->num_services &&
+	    dvb_epg_key(&epg->services[pos]->id) == dvb_epg_key(id))
+		return epg->services[pos];
+	return NULL;
+}
+
+static struct dvb_epg_service *dvb_epg_get_service(struct dvb_epg *epg,
+						   const struct dvb_epg_service_id *id)
+{
+	struct dvb_epg_service *svc, **services;
+	unsigned pos = dvb_epg_find_pos(epg, id);
+	int i;
+
+	if (pos < epg->num_services &&
+	    dvb_epg_key(&epg->services[pos]->id) == dvb_epg_key(id))
+		return epg->services[pos];
+
+	if (epg->num_services == epg->max_services) {
+		services = realloc(epg->services, (epg->max_services + 64) *
+				   sizeof(*services));
+		if (!services)
+			return NULL;
+		epg->services = services;
+		epg->max_services += 64;
+	}
+
+	svc = calloc(1, sizeof(*svc));
+	if (!svc)
+		return NULL;
+	svc->id = *id;
+	for (i = 0; i < DVB_EPG_NUM_TABLES; i++)
+		svc->tables[i].version = -1;
+
+	memmove(&epg->services[pos + 1], &epg->services[pos],
+		(epg->num_services - pos) * sizeof(*epg->services));
+	epg->services[pos] = svc;
+	epg->num_services++;
+
+	return svc;
+}
+
+static void dvb_epg_free_events(struct dvb_epg_service *svc)
+{
+	free(svc->event_id);
+	free(svc->start);
+	free(svc->duration);
+	free(svc->table_id);
+	free(svc->status);
+	free(svc->language);
+	free(svc->name);
+	free(svc->text);
+	free(svc->extended_text);
+	free(svc->hash);
+	free(svc->by_start);
+}
+
+#define DVB_EPG_GROW(ptr, n) ({						\
+	void *__p = realloc(ptr, (n) * sizeof(*(ptr)));			\
+	if (__p)							\
+		ptr = __p;						\
+	__p != NULL;							\
+})
+
+static int dvb_epg_grow_events(struct dvb_epg_service *svc)
+{
+	unsigned n = svc->max_events ? svc->max_events * 2 : 64;
+
+	if (!DVB_EPG_GROW(svc->event_id, n) || !DVB_EPG_GROW(svc->start, n) ||
+	    !DVB_EPG_GROW(svc->duration, n) || !DVB_EPG_GROW(svc->table_id, n) ||
+	    !DVB_EPG_GROW(svc->status, n) || !DVB_EPG_GROW(svc->language, n) ||
+	    !DVB_EPG_GROW(svc->name, n) || !DVB_EPG_GROW(svc->text, n) ||
+	    !DVB_EPG_GROW(svc->extended_text, n) ||
+	    !DVB_EPG_GROW(svc->by_start, n))
+		return -1;
+	svc->max_events = n;
+
+	return 0;
+}
+
+static void dvb_epg_hash_insert(struct dvb_epg_service *svc, uint32_t idx)
+{
+	unsigned mask = svc->hash_size - 1;
+	unsigned h = (svc->event_id[idx] * 0x9e37u) & mask;
+
+	while (svc->hash[h])
+		h = (h + 1) & mask;
+	svc->hash[h] = idx + 1;
+}
+
+static int dvb_epg_hash_rebuild(struct dvb_epg_service *svc, unsigned size)
+{
+	uint32_t i, *hash;
+
+	hash = calloc(size, sizeof(*hash));
+	if (!hash)
+		return -1;
+	free(svc->hash);
+	svc->hash = hash;
+	svc->hash_size = size;
+	for (i = 0; i < svc->num_events; i++)
+		dvb_epg_hash_insert(svc, i);
+
+	return 0;
+}
+
+static int dvb_epg_hash_find(struct dvb_epg_service *svc, uint16_t event_id)
+{
+	unsigned mask = svc->hash_size - 1;
+	unsigned h = (event_id * 0x9e37u) & mask;
+
+	if (!svc->hash_size)
+		return -1;
+	while (svc->hash[h]) {
+		if (svc->event_id[svc->hash[h] - 1] == event_id)
+			return svc->hash[h] - 1;
+		h = (h + 1) & mask;
+	}
+	return -1;
+}
+
+static uint32_t dvb_epg_add_string(struct dvb_epg *epg, uint32_t old,
+				   const char *str)
+{
+	size_t len, size;
+	char *pool;
+	uint32_t off;
+
+	if (!str || !*str)
+		return 0;
+	if (old && !strcmp(epg->pool + old, str))
+		return old;
+
+	len = strlen(str) + 1;
+	if (epg->pool_len + len > epg->pool_size) {
+		size = epg->pool_size * 2;
+		while (size < epg->pool_len + len)
+			size *= 2;
+		pool = realloc(epg->pool, size);
+		if (!pool)
+			return old;
+		epg->pool = pool;
+		epg->pool_size = size;
+	}
+	off = epg->pool_len;
+	memcpy(epg->pool + off, str, len);
+	epg->pool_len += len;
+
+	return off;
+}
+
+/* Concatenates the text of the extended event descriptors */
+static char *dvb_epg_extended_text(struct dvb_table_eit_event *event)
+{
+	struct dvb_desc_event_extended *ext;
+	struct dvb_desc *desc;
+	size_t len = 0;
+	char *text;
+
+	for (desc = event->descriptor; desc; desc = desc->next) {
+		ext = (void *)desc;
+		if (desc->type == extended_event_descriptor && ext->text)
+			len += strlen(ext->text);
+	}
+	if (!len)
+		return NULL;
+
+	text = malloc(len + 1);
+	if (!text)
+		return NULL;
+	*text = '\0';
+	for (desc = event->descriptor; desc; desc = desc->next) {
+		ext = (void *)desc;
+		if (desc->type == extended_event_descriptor && ext->text)
+			strcat(text, ext->text);
+	}
+
+	return text;
+}
+
+static int dvb_epg_add_event(struct dvb_epg *epg, struct dvb_epg_service *svc,
+			     struct dvb_table_eit_event *event, uint8_t table_id)
+{
+	struct dvb_desc_event_short *short_desc = NULL;
+	struct dvb_desc *desc;
+	struct tm tm = event->start;
+	char *extended_text;
+	time_t start;
+	int idx;
+
+	start = timegm(&tm);
+
+	idx = dvb_epg_hash_find(svc, event->event_id);
+	if (idx < 0) {
+		if (svc->num_events == svc->max_events &&
+		    dvb_epg_grow_events(svc))
+			return -1;
+		if (svc->num_events * 2 >= svc->hash_size &&
+		    dvb_epg_hash_rebuild(svc, svc->hash_size ? svc->hash_size * 2 : 128))
+			return -1;
+
+		idx = svc->num_events++;
+		svc->event_id[idx] = event->event_id;
+		svc->name[idx] = 0;
+		svc->text[idx] = 0;
+		svc->extended_text[idx] = 0;
+		memset(svc->language[idx], 0, sizeof(svc->language[idx]));
+		dvb_epg_hash_insert(svc, idx);
+		svc->sorted = 0;
+	} else if (svc->start[idx] != start) {
+		svc->sorted = 0;
+	}
+
+	svc->start[idx] = start;
+	svc->duration[idx] = event->duration;
+	svc->table_id[idx] = table_id;
+	svc->status[idx] = event->running_status | event->free_CA_mode << 3;
+
+	for (desc = event->descriptor; desc; desc = desc->next) {
+		if (desc->type == short_event_descriptor) {
+			short_desc = (void *)desc;
+			break;
+		}
+	}
+	if (short_desc) {
+		memcpy(svc->language[idx], short_desc->language, 3);
+		svc->name[idx] = dvb_epg_add_string(epg, svc->name[idx],
+						    short_desc->name);
+		svc->text[idx] = dvb_epg_add_string(epg, svc->text[idx],
+						    short_desc->text);
+	}
+
+	extended_text = dvb_epg_extended_text(event);
+	if (extended_text) {
+		svc->extended_text[idx] = dvb_epg_add_string(epg,
+							     svc->extended_text[idx],
+							     extended_text);
+		free(extended_text);
+	}
+
+	return 0;
+}
+
+struct dvb_epg *dvb_epg_alloc(struct dvb_v5_fe_parms *parms)
+{
+	struct dvb_epg *epg;
+
+	epg = calloc(1, sizeof(*epg));
+	if (!epg)
+		return NULL;
+	epg->parms = (void *)parms;
+
+	epg->arena = dvb_arena_alloc(0);
+	epg->pool_size = 64 * 1024;
+	epg->pool = malloc(epg->pool_size);
+	if (!epg->arena || !epg->pool) {
+		dvb_epg_free(epg);
+		return NULL;
+	}
+
+	/* Offset 0 is the empty string */
+	epg->pool[0] = '\0';
+	epg->pool_len = 1;
+
+	return epg;
+}
+
+void dvb_epg_free(struct dvb_epg *epg)
+{
+	unsigned i;
+
+	if (!epg)
+		return;
+
+	for (i = 0; i < epg->num_services; i++) {
+		dvb_epg_free_events(epg->services[i]);
+		free(epg->services[i]);
+	}
+	free(epg->services);
+	free(epg->pool);
+	dvb_arena_free(epg->arena);
+	free(epg);
+}
+
+int dvb_epg_add_section(struct dvb_epg *epg, const uint8_t *buf,
+			ssize_t buflen)
+{
+	struct dvb_v5_fe_parms_priv *parms = epg->parms;
+	struct dvb_table_eit *eit = NULL;
+	struct dvb_epg_service_id id;
+	struct dvb_epg_service *svc;
+	struct dvb_epg_table *table;
+	struct dvb_table_header h;
+	struct dvb_arena *arena;
+	uint8_t segment_last;
+	int idx, ret = 1;
+	ssize_t size;
+
+	/* Header, transport and network IDs, segment and last table IDs */
+	size = sizeof(h) + 6;
+	if (buflen < size + DVB_CRC_SIZE) {
+		dvb_logerr("%s: short read %zd/%zd bytes", __func__,
+			   buflen, size + DVB_CRC_SIZE);
+		return -1;
+	}
+	idx = dvb_epg_table_index(buf[0]);
+	if (idx < 0) {
+		dvb_logerr("%s: table 0x%02x is not an EIT", __func__, buf[0]);
+		return -2;
+	}
+	if (dvb_crc32((uint8_t *)buf, buflen, 0xFFFFFFFF)) {
+		dvb_logerr("%s: crc error", __func__);
+		return -3;
+	}
+
+	memcpy(&h, buf, sizeof(h));
+	dvb_table_header_init(&h);
+	id.service_id = h.id;
+	id.transport_id = buf[8] << 8 | buf[9];
+	id.network_id = buf[10] << 8 | buf[11];
+	segment_last = buf[12];
+
+	svc = dvb_epg_get_service(epg, &id);
+	if (!svc) {
+		dvb_logerr("%s: out of memory", __func__);
+		return -4;
+	}
+
+	/* A new version invalidates the sections already received */
+	table = &svc->tables[idx];
+	if (table->version != h.version) {
+		table->version = h.version;
+		memset(table->received, 0, sizeof(table->received));
+		memset(table->segment_last, DVB_EPG_SEGMENT_UNKNOWN,
+		       sizeof(table->segment_last));
+	}
+	if (table->received[h.section_id / 8] & (1 << (h.section_id % 8)))
+		return 0;
+
+	/* The parsed table is only needed until its events are stored */
+	arena = parms->arena;
+	parms->arena = epg->arena;
+	if (dvb_table_eit_init(&parms->p, buf, buflen - DVB_CRC_SIZE, &eit) < 0) {
+		ret = -5;
+	} else {
+		dvb_eit_event_foreach(event, eit) {
+			if (dvb_epg_add_event(epg, svc, event, buf[0]) < 0) {
+				dvb_logerr("%s: out of memory", __func__);
+				ret = -4;
+				break;
+			}
+		}
+	}
+	parms->arena = arena;
+	dvb_arena_reset(epg->arena);
+	if (ret < 0)
+		return ret;
+
+	table->received[h.section_id / 8] |= 1 << (h.section_id % 8);
+	table->last_section = h.last_section;
+	table->segment_last[h.section_id / 8] = segment_last;
+	if (idx >= 2)
+		svc->last_table_id[idx >= 2 + 16] = buf[13];
+
+	return 1;
+}
+
+static int dvb_epg_table_complete(struct dvb_epg_table *table)
+{
+	unsigned seg, sec;
+
+	if (table->version < 0)
+		return 0;
+
+	for (seg = 0; seg <= table->last_section / 8u; seg++) {
+		if (table->segment_last[seg] == DVB_EPG_SEGMENT_UNKNOWN)
+			return 0;
+		for (sec = seg * 8; sec <= table->segment_last[seg] && sec < seg * 8 + 8; sec++)
+			if (!(table->received[sec / 8] & (1 << (sec % 8))))
+				return 0;
+	}
+	return 1;
+}
+
+int dvb_epg_is_complete(struct dvb_epg *epg,
+			const struct dvb_epg_service_id *id,
+			int schedule)
+{
+	struct dvb_epg_service *svc;
+	int other, first, last, i;
+
+	svc = dvb_epg_find(epg, id);
+	if (!svc)
+		return 0;
+
+	/* Use the tables for the actual TS, if any was received */
+	if (!schedule) {
+		other = svc->tables[0].version < 0;
+		return dvb_epg_table_complete(&svc->tables[other]);
+	}
+
+	other = svc->tables[2].version < 0;
+	first = other ? DVB_TABLE_EIT_SCHEDULE_OTHER : DVB_TABLE_EIT_SCHEDULE;
+	last = svc->last_table_id[other];
+	if (last < first || last > first + 0xf)
+		return 0;
+	for (i = first; i <= last; i++)
+		if (!dvb_epg_table_complete(&svc->tables[dvb_epg_table_index(i)]))
+			return 0;
+	return 1;
+}
+
+struct dvb_epg_sort {
+	time_t start;
+	uint32_t idx;
+};
+
+static int dvb_epg_sort_cmp(const void *a, const void *b)
+{
+	const struct dvb_epg_sort *sa = a, *sb = b;
+
+	if (sa->start != sb->start)
+		return sa->start < sb->start ? -1 : 1;
+	return sa->idx < sb->idx ? -1 : sa->idx > sb->idx;
+}
+
+static int dvb_epg_sort(struct dvb_epg_service *svc)
+{
+	struct dvb_epg_sort *sort;
+	uint32_t i;
+
+	if (svc->sorted)
+		return 0;
+
+	sort = malloc(svc->num_events * sizeof(*sort) + 1);
+	if (!sort)
+		return -1;
+	for (i = 0; i < svc->num_events; i++) {
+		sort[i].start = svc->start[i];
+		sort[i].idx = i;
+	}
+	qsort(sort, svc->num_events, sizeof(*sort), dvb_epg_sort_cmp);
+	for (i = 0; i < svc->num_events; i++)
+		svc->by_start[i] = sort[i].idx;
+	free(sort);
+	svc->sorted = 1;
+
+	return 0;
+}
+
+unsigned dvb_epg_get_events(struct dvb_epg *epg,
+			    const struct dvb_epg_service_id *id,
+			    time_t from, time_t to,
+			    struct dvb_epg_event *events,
+			    unsigned max_events)
+{
+	struct dvb_epg_service *svc;
+	struct dvb_epg_event *ev;
+	unsigned lo, hi, mid, n = 0;
+	uint32_t idx;
+
+	svc = dvb_epg_find(epg, id);
+	if (!svc || dvb_epg_sort(svc))
+		return 0;
+
+	/* First event starting at or after from */
+	lo = 0;
+	hi = svc->num_events;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (svc->start[svc->by_start[mid]] < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	/* Plus the ones that started before, but are still running */
+	while (lo > 0) {
+		idx = svc->by_start[lo - 1];
+		if (svc->start[idx] + svc->duration[idx] <= from)
+			break;
+		lo--;
+	}
+
+	for (; lo < svc->num_events; lo++) {
+		idx = svc->by_start[lo];
+		if (svc->start[idx] >= to)
+			break;
+		if (svc->start[idx] + svc->duration[idx] <= from)
+			continue;
+		if (n < max_events) {
+			ev = &events[n];
+			ev->event_id = svc->event_id[idx];
+			ev->table_id = svc->table_id[idx];
+			ev->running_status = svc->status[idx] & 0x7;
+			ev->free_CA_mode = svc->status[idx] >> 3;
+			memcpy(ev->language, svc->language[idx], sizeof(ev->language));
+			ev->start = svc->start[idx];
+			ev->duration = svc->duration[idx];
+			ev->name = epg->pool + svc->name[idx];
+			ev->text = epg->pool + svc->text[idx];
+			ev->extended_text = epg->pool + svc->extended_text[idx];
+		}
+		n++;
+	}
+
+	return n;
+}
+
+unsigned dvb_epg_get_services(struct dvb_epg *epg,
+			      struct dvb_epg_service_id *ids,
+			      unsigned max_ids)
+{
+	unsigned i;
+
+	for (i = 0; i < epg->num_services && i < max_ids; i++)
+		ids[i] = epg->services[i]->id;
+
+	return epg->num_services;
+}
+
+static uint32_t dvb_epg_move_string(struct dvb_epg *epg, char *old_pool,
+				    uint32_t off)
+{
+	return dvb_epg_add_string(epg, 0, old_pool + off);
+}
+
+void dvb_epg_expire(struct dvb_epg *epg, time_t before)
+{
+	struct dvb_epg_service *svc;
+	char *old_pool = epg->pool;
+	unsigned i, r, w;
+
+	/* Copy the strings still in use to a new pool */
+	epg->pool = malloc(epg->pool_size);
+	if (!epg->pool) {
+		epg->pool = old_pool;
+		return;
+	}
+	epg->pool[0] = '\0';
+	epg->pool_len = 1;
+
+	for (i = 0; i < epg->num_services; i++) {
+		svc = epg->services[i];
+		for (r = w = 0; r < svc->num_events; r++) {
+			if (svc->start[r] + svc->duration[r] <= before)
+				continue;
+			svc->event_id[w] = svc->event_id[r];
+			svc->start[w] = svc->start[r];
+			svc->duration[w] = svc->duration[r];
+			svc->table_id[w] = svc->table_id[r];
+			svc->status[w] = svc->status[r];
+			memcpy(svc->language[w], svc->language[r], sizeof(svc->language[w]));
+			svc->name[w] = dvb_epg_move_string(epg, old_pool, svc->name[r]);
+			svc->text[w] = dvb_epg_move_string(epg, old_pool, svc->text[r]);
+			svc->extended_text[w] = dvb_epg_move_string(epg, old_pool,
+								    svc->extended_text[r]);
+			w++;
+		}
+		if (w == svc->num_events)
+			continue;
+		svc->num_events = w;
+		svc->sorted = 0;
+		if (svc->hash_size)
+			dvb_epg_hash_rebuild(svc, svc->hash_size);
+	}
+	free(old_pool);
+}
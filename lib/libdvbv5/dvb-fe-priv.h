@@ -20,6 +20,7 @@
 #ifndef __DVB_FE_PRIV_H
 #define __DVB_FE_PRIV_H
 
+#include <iconv.h>
 #include <libdvbv5/dvb-fe.h>
 #include <libdvbv5/countries.h>
 
@@ -55,6 +56,47 @@ struct dvb_v5_stats {
 };
 
 struct dvb_device_priv;
+struct dvb_open_descriptor;
+struct dvb_table_filter;
+struct dvb_fe_sampler;
+struct dvb_fe_sample;
+struct dvb_entry;
+
+/* Number of charset conversions kept open */
+#define DVB_ICONV_CACHE_SIZE	4
+
+struct dvb_iconv_cache {
+	char input_charset[32];
+	char output_charset[32];
+	iconv_t cd;
+};
+
+/* The last SEC state sent by dvb-sat.c */
+struct dvb_sat_sec_state {
+	int				valid;
+	const struct dvb_sat_lnb	*lnb;
+	int				sat_number;
+	int				high_band;
+	int				pol_v;
+	int				vol_high;
+	int				tone_on;
+};
+
+/* Number of tables with adaptive timeouts, see dvb-scan.c */
+#define DVB_SCAN_TABLE_TYPES		7
+
+/*
+ * The tables found missing on the transponders of the network being
+ * scanned, i.e. of the same delivery system, and of the same LNB and
+ * satellite, if any.
+ */
+struct dvb_scan_absent {
+	uint32_t			delivery_system;
+	const struct dvb_sat_lnb	*lnb;
+	int				sat_number;
+	unsigned			seen;
+	unsigned char			missing[DVB_SCAN_TABLE_TYPES];
+};
 
 struct dvb_v5_fe_parms_priv {
 	/* dvbv_v4_fe_parms should be the first element on this struct */
@@ -78,6 +120,41 @@ struct dvb_v5_fe_parms_priv {
 
 	dvb_logfunc_priv		logfunc_priv;
 	void				*logpriv;
+
+	/* Read the MPEG-TS tables on concurrent demux filters */
+	int				concurrent_tables;
+
+	/* Directory where the table sections are cached */
+	char				*table_cache_dir;
+
+	/* iconv descriptors used to convert the strings */
+	struct dvb_iconv_cache		iconv_cache[DVB_ICONV_CACHE_SIZE];
+	unsigned			iconv_cache_next;
+
+	/* Arena where the parsed tables are allocated, if any */
+	struct dvb_arena		*arena;
+
+	/* Decode the descriptors only when accessed */
+	int				lazy_desc;
+
+	/* Background sampler of the stats, if running */
+	struct dvb_fe_sampler		*sampler;
+
+	/*
+	 * SEC state of the LNB and switches, so an unchanged state isn't sent
+	 * again on every tune. Invalidated by the dvb_fe_sec_* and
+	 * dvb_fe_diseqc_* calls, as those may change it.
+	 */
+	struct dvb_sat_sec_state	sec_state;
+
+	/* Used by dvb-scan.c to wait less for the tables known to be missing */
+	struct dvb_scan_absent		scan_absent;
+
+	/*
+	 * Set while scanning by the dvb_dev backends that don't have a demux
+	 * file descriptor: dvb-scan.c then reads the sections through it.
+	 */
+	struct dvb_open_descriptor	*scan_dmx;
 };
 
 /* Functions used internally by dvb-dev.c. Aren't part of the API */
@@ -86,6 +163,41 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms);
 void __dvb_fe_close(struct dvb_v5_fe_parms_priv *parms);
 
+/* Closes the iconv descriptors opened by parse_string.c */
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms_priv *parms);
+
+/* Serialize the frontend calls with the stats sampler, if running */
+void dvb_fe_lock(struct dvb_v5_fe_parms_priv *parms);
+void dvb_fe_unlock(struct dvb_v5_fe_parms_priv *parms);
+
+/* Fills a sample with the stats got by the last dvb_fe_get_stats() */
+void dvb_fe_fill_sample(struct dvb_v5_fe_parms_priv *parms,
+			struct dvb_fe_sample *sample);
+
+/* Writes an entry at the VDR format, used by the streaming file writer */
+int dvb_write_entry_vdr(FILE *fp, const char *fname,
+			struct dvb_entry *entry, int line);
+
+/* Sets the stats properties filled by dvb_fe_get_stats() */
+void dvb_fe_init_stats(struct dvb_v5_fe_parms_priv *parms);
+
+/* Stores a stats value, for the backends that don't read them from a device */
+struct dtv_stats *dvb_fe_store_stats(struct dvb_v5_fe_parms_priv *parms,
+				     unsigned cmd,
+				     enum fecap_scale_params scale,
+				     unsigned layer,
+				     uint32_t value);
+
+/*
+ * Parses the sections of a table filter, as dvb_read_sections() does.
+ * dvb_parse_section() returns 1 when the table is complete.
+ */
+int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
+			    struct dvb_table_filter *sect);
+int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
+		      struct dvb_table_filter *sect,
+		      const uint8_t *buf, ssize_t buf_length);
+
 /* Functions that can be overriden to be executed remotely */
 int __dvb_set_sys(struct dvb_v5_fe_parms *p, fe_delivery_system_t sys);
 int __dvb_fe_get_parms(struct dvb_v5_fe_parms *p);
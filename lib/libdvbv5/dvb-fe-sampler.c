@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-fe-sampler.h>
+
+#ifdef ENABLE_NLS
+# include "gettext.h"
+# include <libintl.h>
+# define _(string) dgettext(LIBDVBV5_DOMAIN, string)
+
+#else
+# define _(string) string
+#endif
+
+/*
+ * The samples are written by the sampler thread only. Each slot has a
+ * sequence number, odd while the slot is being written, and two times
+ * the number of the sample plus two once written. The readers copy a
+ * slot and check that its sequence didn't change, retrying if the writer
+ * got there, so they never block the sampling.
+ */
+
+struct dvb_fe_sampler_slot {
+	uint64_t seq;
+	struct dvb_fe_sample sample;
+};
+
+struct dvb_fe_sampler {
+	struct dvb_v5_fe_parms_priv *parms;
+
+	/* Serializes the frontend calls with the sampling */
+	pthread_mutex_t lock;
+
+	pthread_t thread;
+	pthread_mutex_t stop_lock;
+	pthread_cond_t stop_cond;
+	int stop;
+	unsigned interval_ms;
+
+	/* Number of samples written so far */
+	uint64_t head;
+	unsigned mask;
+	struct dvb_fe_sampler_slot *slots;
+};
+
+void dvb_fe_lock(struct dvb_v5_fe_parms_priv *parms)
+{
+	if (parms->sampler)
+		pthread_mutex_lock(&parms->sampler->lock);
+}
+
+void dvb_fe_unlock(struct dvb_v5_fe_parms_priv *parms)
+{
+	if (parms->sampler)
+		pthread_mutex_unlock(&parms->sampler->lock);
+}
+
+static void dvb_fe_sampler_push(struct dvb_fe_sampler *sampler,
+				struct dvb_fe_sample *sample)
+{
+	uint64_t head = sampler->head;
+	struct dvb_fe_sampler_slot *slot = &sampler->slots[head & sampler->mask];
+
+	__atomic_store_n(&slot->seq, 2 * head + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->sample = *sample;
+	__atomic_store_n(&slot->seq, 2 * head + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&sampler->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Copies the sample with the given number, if it is still on the ring */
+static int dvb_fe_sampler_read(struct dvb_fe_sampler *sampler, uint64_t n,
+			       struct dvb_fe_sample *sample)
+{
+	struct dvb_fe_sampler_slot *slot = &sampler->slots[n & sampler->mask];
+	uint64_t seq;
+
+	seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+	if (seq != 2 * n + 2)
+		return -EAGAIN;
+	memcpy(sample, &slot->sample, sizeof(*sample));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+		return -EAGAIN;
+
+	return 0;
+}
+
+static void *dvb_fe_sampler_thread(void *privdata)
+{
+	struct dvb_fe_sampler *sampler = privdata;
+	struct dvb_v5_fe_parms_priv *parms = sampler->parms;
+	struct dvb_fe_sample sample;
+	struct timespec next;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	pthread_mutex_lock(&sampler->stop_lock);
+	while (!sampler->stop) {
+		pthread_mutex_unlock(&sampler->stop_lock);
+
+		memset(&sample, 0, sizeof(sample));
+		pthread_mutex_lock(&sampler->lock);
+		ret = dvb_fe_get_stats(&parms->p);
+		clock_gettime(CLOCK_MONOTONIC, &sample.time);
+		if (ret >= 0)
+			dvb_fe_fill_sample(parms, &sample);
+		pthread_mutex_unlock(&sampler->lock);
+		if (ret >= 0)
+			dvb_fe_sampler_push(sampler, &sample);
+
+		next.tv_sec += sampler->interval_ms / 1000;
+		next.tv_nsec += (sampler->interval_ms % 1000) * 1000000;
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+
+		/* If the frontend took too long, don't try to catch up */
+		if (sample.time.tv_sec > next.tv_sec ||
+		    (sample.time.tv_sec == next.tv_sec &&
+		     sample.time.tv_nsec > next.tv_nsec))
+			next = sample.time;
+
+		pthread_mutex_lock(&sampler->stop_lock);
+		while (!sampler->stop &&
+		       pthread_cond_timedwait(&sampler->stop_cond,
+					      &sampler->stop_lock, &next) != ETIMEDOUT);
+	}
+	pthread_mutex_unlock(&sampler->stop_lock);
+
+	return NULL;
+}
+
+struct dvb_fe_sampler *dvb_fe_sampler_start(struct dvb_v5_fe_parms *p,
+					    unsigned interval_ms,
+					    unsigned history)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct dvb_fe_sampler *sampler;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	unsigned size = 2;
+	int ret;
+
+	if (parms->sampler) {
+		dvb_logerr(_("%s: a sampler is already running"), __func__);
+		return NULL;
+	}
+
+	sampler = calloc(1, sizeof(*sampler));
+	if (!sampler)
+		return NULL;
+	while (size < history)
+		size <<= 1;
+	sampler->slots = calloc(size, sizeof(*sampler->slots));
+	if (!sampler->slots) {
+		free(sampler);
+		return NULL;
+	}
+	sampler->mask = size - 1;
+	sampler->parms = parms;
+	sampler->interval_ms = interval_ms ? interval_ms : 1;
+
+	/* The sampling calls dvb_fe_get_parms() on lock changes */
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&sampler->lock, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sampler->stop_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+	pthread_mutex_init(&sampler->stop_lock, NULL);
+
+	parms->sampler = sampler;
+	ret = pthread_create(&sampler->thread, NULL, dvb_fe_sampler_thread,
+			     sampler);
+	if (ret) {
+		dvb_logerr(_("%s: can't create the sampler thread: %s"),
+			   __func__, strerror(ret));
+		parms->sampler = NULL;
+		pthread_mutex_destroy(&sampler->lock);
+		pthread_mutex_destroy(&sampler->stop_lock);
+		pthread_cond_destroy(&sampler->stop_cond);
+		free(sampler->slots);
+		free(sampler);
+		return NULL;
+	}
+
+	return sampler;
+}
+
+void dvb_fe_sampler_stop(struct dvb_fe_sampler *sampler)
+{
+	if (!sampler)
+		return;
+
+	pthread_mutex_lock(&sampler->stop_lock);
+	sampler->stop = 1;
+	pthread_cond_signal(&sampler->stop_cond);
+	pthread_mutex_unlock(&sampler->stop_lock);
+	pthread_join(sampler->thread, NULL);
+
+	sampler->parms->sampler = NULL;
+	pthread_mutex_destroy(&sampler->lock);
+	pthread_mutex_destroy(&sampler->stop_lock);
+	pthread_cond_destroy(&sampler->stop_cond);
+	free(sampler->slots);
+	free(sampler);
+}
+
+int dvb_fe_sampler_last(struct dvb_fe_sampler *sampler,
+			struct dvb_fe_sample *sample)
+{
+	uint64_t head;
+
+	do {
+		head = __atomic_load_n(&sampler->head, __ATOMIC_ACQUIRE);
+		if (!head)
+			return -EAGAIN;
+	} while (dvb_fe_sampler_read(sampler, head - 1, sample));
+
+	return 0;
+}
+
+unsigned dvb_fe_sampler_get(struct dvb_fe_sampler *sampler,
+			    struct dvb_fe_sample *samples,
+			    unsigned max_samples)
+{
+	uint64_t head, first, n;
+	unsigned count;
+
+	head = __atomic_load_n(&sampler->head, __ATOMIC_ACQUIRE);
+
+	/* The oldest slot may be overwritten while copying, so skip it */
+	count = sampler->mask;
+	if (count > head)
+		count = head;
+	if (count > max_samples)
+		count = max_samples;
+	first = head - count;
+
+	/* Samples overwritten meanwhile are dropped */
+	count = 0;
+	for (n = first; n < head; n++)
+		if (!dvb_fe_sampler_read(sampler, n, &samples[count]))
+			count++;
+
+	return count;
+}
+
+static void dvb_fe_range_add(struct dvb_fe_sample_range *range, double val)
+{
+	if (!range->count || val < range->min)
+		range->min = val;
+	if (!range->count || val > range->max)
+		range->max = val;
+	range->avg += val;
+	range->count++;
+}
+
+static void dvb_fe_range_end(struct dvb_fe_sample_range *range)
+{
+	if (range->count)
+		range->avg /= range->count;
+}
+
+int dvb_fe_sampler_window(struct dvb_fe_sampler *sampler, unsigned window_ms,
+			  struct dvb_fe_sample_window *window)
+{
+	struct dvb_fe_sample last, sample;
+	uint64_t head, n, first_ucb = 0;
+	int64_t age_ms;
+
+	memset(window, 0, sizeof(*window));
+	if (dvb_fe_sampler_last(sampler, &last))
+		return -EAGAIN;
+
+	/* Walk back from the newest sample, until leaving the window */
+	head = __atomic_load_n(&sampler->head, __ATOMIC_ACQUIRE);
+	for (n = head; n > 0 && head - n < sampler->mask; n--) {
+		if (dvb_fe_sampler_read(sampler, n - 1, &sample))
+			break;
+		age_ms = (last.time.tv_sec - sample.time.tv_sec) * 1000 +
+			 (last.time.tv_nsec - sample.time.tv_nsec) / 1000000;
+		if (age_ms > window_ms)
+			break;
+
+		if (!window->samples)
+			window->ucb = sample.ucb;
+		first_ucb = sample.ucb;
+		window->samples++;
+		if (sample.status & FE_HAS_LOCK)
+			window->locked++;
+
+		if (sample.signal_scale != FE_SCALE_NOT_AVAILABLE &&
+		    sample.signal_scale == last.signal_scale)
+			dvb_fe_range_add(&window->signal, sample.signal);
+		if (sample.cnr_scale != FE_SCALE_NOT_AVAILABLE &&
+		    sample.cnr_scale == last.cnr_scale)
+			dvb_fe_range_add(&window->cnr, sample.cnr);
+		if (sample.pre_ber >= 0)
+			dvb_fe_range_add(&window->pre_ber, sample.pre_ber);
+		if (sample.ber >= 0)
+			dvb_fe_range_add(&window->ber, sample.ber);
+		if (sample.per >= 0)
+			dvb_fe_range_add(&window->per, sample.per);
+	}
+	if (!window->samples)
+		return -EAGAIN;
+
+	/* The counter may be reset on retune */
+	window->ucb = window->ucb >= first_ucb ? window->ucb - first_ucb : 0;
+
+	dvb_fe_range_end(&window->signal);
+	dvb_fe_range_end(&window->cnr);
+	dvb_fe_range_end(&window->pre_ber);
+	dvb_fe_range_end(&window->ber);
+	dvb_fe_range_end(&window->per);
+
+	return 0;
+}
+
+ssize_t dvb_fe_sampler_export(struct dvb_fe_sampler *sampler, char *buf,
+			      size_t size)
+{
+	struct dvb_fe_sample *samples, *s;
+	unsigned i, n;
+	size_t len = 0;
+	char tmp[160];
+	int ret;
+
+	samples = malloc((sampler->mask + 1) * sizeof(*samples));
+	if (!samples)
+		return -ENOMEM;
+	n = dvb_fe_sampler_get(sampler, samples, sampler->mask + 1);
+
+	if (size)
+		*buf = '\0';
+	for (i = 0; i < n; i++) {
+		s = &samples[i];
+		ret = snprintf(tmp, sizeof(tmp), "%lld,0x%02x,",
+			       (long long)s->time.tv_sec * 1000 +
+			       s->time.tv_nsec / 1000000, s->status);
+		if (s->signal_scale != FE_SCALE_NOT_AVAILABLE)
+			ret += snprintf(tmp + ret, sizeof(tmp) - ret, "%.3f%s",
+					s->signal,
+					s->signal_scale == FE_SCALE_DECIBEL ? "dBm" : "%");
+		ret += snprintf(tmp + ret, sizeof(tmp) - ret, ",");
+		if (s->cnr_scale != FE_SCALE_NOT_AVAILABLE)
+			ret += snprintf(tmp + ret, sizeof(tmp) - ret, "%.3f%s",
+					s->cnr,
+					s->cnr_scale == FE_SCALE_DECIBEL ? "dB" : "%");
+		ret += snprintf(tmp + ret, sizeof(tmp) - ret, ",");
+		if (s->pre_ber >= 0)
+			ret += snprintf(tmp + ret, sizeof(tmp) - ret, "%.3g", s->pre_ber);
+		ret += snprintf(tmp + ret, sizeof(tmp) - ret, ",");
+		if (s->ber >= 0)
+			ret += snprintf(tmp + ret, sizeof(tmp) - ret, "%.3g", s->ber);
+		ret += snprintf(tmp + ret, sizeof(tmp) - ret, ",");
+		if (s->per >= 0)
+			ret += snprintf(tmp + ret, sizeof(tmp) - ret, "%.3g", s->per);
+		ret += snprintf(tmp + ret, sizeof(tmp) - ret, ",%llu\n",
+				(unsigned long long)s->ucb);
+
+		if (len + ret < size)
+			memcpy(buf + len, tmp, ret + 1);
+		else if (len < size)
+			buf[len] = '\0';
+		len += ret;
+	}
+	free(samples);
+
+	return len;
+}
@@ -19,12 +19,14 @@
 
 #include "dvb-fe-priv.h"
 #include "dvb-v5.h"
+#include <libdvbv5/dvb-fe-sampler.h>
 #include <libdvbv5/dvb-dev.h>
 #include <libdvbv5/countries.h>
 #include <libdvbv5/dvb-v5-std.h>
 
 #include <inttypes.h>
 #include <math.h>
+#include <poll.h>
 #include <stddef.h>
 #include <time.h>
 #include <unistd.h>
@@ -82,6 +84,8 @@ void dvb_v5_free(struct dvb_v5_fe_parms_priv *parms)
 {
 	if (parms->fname)
 		free(parms->fname);
+	free(parms->table_cache_dir);
+	dvb_iconv_cache_free(parms);
 
 	free(parms);
 }
@@ -383,6 +387,13 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 		}
 	}
 
+	dvb_fe_init_stats(parms);
+
+	return 0;
+}
+
+void dvb_fe_init_stats(struct dvb_v5_fe_parms_priv *parms)
+{
 	/*
 	 * Prepare the status struct - DVBv5.10 parameters should
 	 * come first, as they'll be read together.
@@ -402,8 +413,6 @@ int dvb_fe_open_fname(struct dvb_v5_fe_parms_priv *parms, char *fname,
 	parms->stats.prop[10].cmd = DTV_PER;
 	parms->stats.prop[11].cmd = DTV_QUALITY;
 	parms->stats.prop[12].cmd = DTV_PRE_BER;
-
-	return 0;
 }
 
 
@@ -978,7 +987,7 @@ int __dvb_fe_set_parms(struct dvb_v5_fe_parms *p)
 	return 0;
 }
 
-static struct dtv_stats *dvb_fe_store_stats(struct dvb_v5_fe_parms_priv *parms,
+struct dtv_stats *dvb_fe_store_stats(struct dvb_v5_fe_parms_priv *parms,
 			      unsigned cmd,
 			      enum fecap_scale_params scale,
 			      unsigned layer,
@@ -1149,6 +1158,49 @@ float dvb_fe_retrieve_per(struct dvb_v5_fe_parms *p, unsigned layer)
 	return ((float)n)/d;
 }
 
+static void dvb_fe_sample_value(struct dvb_v5_fe_parms_priv *parms,
+				unsigned cmd, enum fecap_scale_params *scale,
+				double *value)
+{
+	struct dtv_stats *stat;
+
+	stat = dvb_fe_retrieve_stats_layer(&parms->p, cmd, 0);
+	*scale = stat ? stat->scale : FE_SCALE_NOT_AVAILABLE;
+	if (*scale == FE_SCALE_DECIBEL)
+		*value = stat->svalue / 1000.;
+	else if (*scale == FE_SCALE_RELATIVE)
+		*value = stat->uvalue * 100. / 65535;
+	else
+		*value = 0;
+}
+
+void dvb_fe_fill_sample(struct dvb_v5_fe_parms_priv *parms,
+			struct dvb_fe_sample *sample)
+{
+	enum fecap_scale_params scale;
+	struct dtv_stats *stat;
+	uint32_t status = 0;
+
+	dvb_fe_retrieve_stats(&parms->p, DTV_STATUS, &status);
+	sample->status = status;
+
+	dvb_fe_sample_value(parms, DTV_STAT_SIGNAL_STRENGTH,
+			    &sample->signal_scale, &sample->signal);
+	dvb_fe_sample_value(parms, DTV_STAT_CNR,
+			    &sample->cnr_scale, &sample->cnr);
+
+	sample->pre_ber = calculate_preBER(parms, 0);
+	sample->ber = dvb_fe_retrieve_ber(&parms->p, 0, &scale);
+	if (scale == FE_SCALE_NOT_AVAILABLE)
+		sample->ber = -1;
+	sample->per = dvb_fe_retrieve_per(&parms->p, 0);
+
+	stat = dvb_fe_retrieve_stats_layer(&parms->p, DTV_STAT_ERROR_BLOCK_COUNT, 0);
+	sample->ucb = (stat && stat->scale == FE_SCALE_COUNTER) ? stat->uvalue : 0;
+
+	sample->quality = dvb_fe_retrieve_quality(&parms->p, 0);
+}
+
 struct cnr_to_qual_s {
 	uint32_t modulation;		/* use QAM_AUTO if it doesn't matter */
 	uint32_t fec;			/* Use FEC_NONE if it doesn't matter */
@@ -1594,6 +1646,65 @@ int dvb_fe_get_event(struct dvb_v5_fe_parms *p)
 	return dvb_fe_get_stats(&parms->p);
 }
 
+/* Longest time between two status checks in dvb_fe_wait_lock() */
+#define DVB_FE_LOCK_POLL_MS	50
+
+/*
+ * Waits up to wait_ms for a frontend event and discards the queued
+ * events: the status is read again by the caller anyway.
+ */
+static void dvb_fe_wait_event(struct dvb_v5_fe_parms_priv *parms,
+			      unsigned wait_ms)
+{
+	struct dvb_frontend_event event;
+	struct pollfd pfd;
+
+	/* Only a locally opened frontend has a file descriptor */
+	if (!parms->fname) {
+		usleep(wait_ms * 1000);
+		return;
+	}
+
+	pfd.fd = parms->fd;
+	pfd.events = POLLPRI;
+	while (poll(&pfd, 1, wait_ms) > 0 && (pfd.revents & POLLPRI)) {
+		if (ioctl(parms->fd, FE_GET_EVENT, &event) == -1 &&
+		    errno != EOVERFLOW)
+			break;
+		wait_ms = 0;
+	}
+}
+
+int dvb_fe_wait_lock(struct dvb_v5_fe_parms *p, unsigned timeout_ms)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)p;
+	struct timespec start, now;
+	uint32_t status;
+	unsigned elapsed;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		rc = dvb_fe_get_stats(p);
+		if (rc)
+			return rc;
+		if (!dvb_fe_retrieve_stats(p, DTV_STATUS, &status) &&
+		    (status & FE_HAS_LOCK))
+			return 0;
+		if (p->abort)
+			return -EINTR;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+			  (now.tv_nsec - start.tv_nsec) / 1000000;
+		if (elapsed >= timeout_ms)
+			return -ETIMEDOUT;
+		elapsed = timeout_ms - elapsed;
+		dvb_fe_wait_event(parms, elapsed < DVB_FE_LOCK_POLL_MS ?
+					 elapsed : DVB_FE_LOCK_POLL_MS);
+	}
+}
+
 struct metric_prefixes {
 	int multiply_factor;
 	char *symbol;
@@ -1853,6 +1964,8 @@ int dvb_fe_sec_voltage(struct dvb_v5_fe_parms *p, int on, int v18)
 	fe_sec_voltage_t v;
 	int rc;
 
+	parms->sec_state.valid = 0;
+
 	if (!on) {
 		v = SEC_VOLTAGE_OFF;
 		if (parms->p.verbose)
@@ -1878,6 +1991,8 @@ int dvb_fe_sec_tone(struct dvb_v5_fe_parms *p, fe_sec_tone_mode_t tone)
 {
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	int rc;
+
+	parms->sec_state.valid = 0;
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC TONE: %s"), fe_tone_name[tone] );
 	rc = xioctl(parms->fd, FE_SET_TONE, tone);
@@ -1893,6 +2008,8 @@ int dvb_fe_lnb_high_voltage(struct dvb_v5_fe_parms *p, int on)
 	struct dvb_v5_fe_parms_priv *parms = (void *)p;
 	int rc;
 
+	parms->sec_state.valid = 0;
+
 	if (on) on = 1;
 	if (parms->p.verbose)
 		dvb_log( _("DiSEqC HIGH LNB VOLTAGE: %s"), on ? _("ON") : _("OFF") );
@@ -1910,6 +2027,8 @@ int dvb_fe_diseqc_burst(struct dvb_v5_fe_parms *p, int mini_b)
 	fe_sec_mini_cmd_t mini;
 	int rc;
 
+	parms->sec_state.valid = 0;
+
 	mini = mini_b ? SEC_MINI_B : SEC_MINI_A;
 
 	if (parms->p.verbose)
@@ -1929,6 +2048,8 @@ int dvb_fe_diseqc_cmd(struct dvb_v5_fe_parms *p, const unsigned len,
 	struct dvb_diseqc_master_cmd msg;
 	int rc;
 
+	parms->sec_state.valid = 0;
+
 	if (len > 6)
 		return -EINVAL;
 
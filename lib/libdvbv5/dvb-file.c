@@ -20,8 +20,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <strings.h> /* strcasecmp */
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 
 #include "dvb-fe-priv.h"
 #include <libdvbv5/dvb-file.h>
@@ -216,6 +224,146 @@ static void adjust_delsys(struct dvb_entry *entry)
 	}
 }
 
+/*
+ * Parses a line of a file on a format where each channel is contained into
+ * just one line. On errors, returns -1, with a message at err_msg.
+ */
+static int dvb_parse_line_oneline(struct dvb_file *dvb_file,
+				  struct dvb_entry **__entry, char *p,
+				  uint32_t delsys,
+				  const struct dvb_parse_file *parse_file,
+				  char *err_msg)
+{
+	const char *delimiter = parse_file->delimiter;
+	const struct dvb_parse_struct *formats = parse_file->formats;
+	const struct dvb_parse_struct *fmt;
+	struct dvb_entry *entry = *__entry;
+	const struct dvb_parse_table *table;
+	int i, j, has_inversion;
+	char *save = NULL;
+
+	while (*p == ' ')
+		p++;
+	if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
+		return 0;
+
+	if (parse_file->has_delsys_id) {
+		p = strtok_r(p, delimiter, &save);
+		if (!p) {
+			sprintf(err_msg, _("unknown delivery system type for %s"),
+				p);
+			return -1;
+		}
+
+		/* Parse the type of the delivery system */
+		for (i = 0; formats[i].id != NULL; i++) {
+			if (!strcmp(p, formats[i].id))
+				break;
+		}
+		if (!formats[i].id) {
+			sprintf(err_msg, _("Doesn't know how to handle delimiter '%s'"),
+				p);
+			return -1;
+		}
+	} else {
+		/* Seek for the delivery system */
+		for (i = 0; formats[i].delsys != 0; i++) {
+			if (formats[i].delsys == delsys)
+				break;
+		}
+		if (!formats[i].delsys) {
+			sprintf(err_msg, _("Doesn't know how to parse delivery system %d"),
+				delsys);
+			return -1;
+		}
+	}
+
+
+	fmt = &formats[i];
+	if (!entry) {
+		dvb_file->first_entry = calloc(sizeof(*entry), 1);
+		entry = dvb_file->first_entry;
+	} else {
+		entry->next = calloc(sizeof(*entry), 1);
+		entry = entry->next;
+	}
+	*__entry = entry;
+	entry->sat_number = -1;
+	entry->props[entry->n_props].cmd = DTV_DELIVERY_SYSTEM;
+	entry->props[entry->n_props++].u.data = fmt->delsys;
+	has_inversion = 0;
+	for (i = 0; i < fmt->size; i++) {
+		table = &fmt->table[i];
+		if (delsys && !i) {
+			p = strtok_r(p, delimiter, &save);
+		} else
+			p = strtok_r(NULL, delimiter, &save);
+		if (p && *p == '#')
+			p = NULL;
+		if (!p && !fmt->table[i].has_default_value) {
+			sprintf(err_msg, _("parameter %i (%s) missing"),
+				i, dvb_cmd_name(table->prop));
+			return -1;
+		}
+		if (p && table->size) {
+			for (j = 0; j < table->size; j++)
+				if (!table->table[j] || !strcasecmp(table->table[j], p))
+					break;
+			if (j == table->size) {
+				sprintf(err_msg, _("parameter %s invalid: %s"),
+					dvb_cmd_name(table->prop), p);
+				return -1;
+			}
+			if (table->prop == DTV_BANDWIDTH_HZ)
+				j = fe_bandwidth_name[j];
+			entry->props[entry->n_props].cmd = table->prop;
+			entry->props[entry->n_props++].u.data = j;
+		} else {
+			long v;
+
+			if (!p)
+				v = fmt->table[i].default_value;
+			else
+				v = atol(p);
+
+			if (table->mult_factor)
+				v *= table->mult_factor;
+
+			switch (table->prop) {
+			case DTV_VIDEO_PID:
+				entry->video_pid = calloc(sizeof(*entry->video_pid), 1);
+				entry->video_pid_len = 1;
+				entry->video_pid[0] = v;
+				break;
+			case DTV_AUDIO_PID:
+				entry->audio_pid = calloc(sizeof(*entry->audio_pid), 1);
+				entry->audio_pid_len = 1;
+				entry->audio_pid[0] = v;
+				break;
+			case DTV_SERVICE_ID:
+				entry->service_id = v;
+				break;
+			case DTV_CH_NAME:
+				entry->channel = calloc(strlen(p) + 1, 1);
+				strcpy(entry->channel, p);
+				break;
+			default:
+				entry->props[entry->n_props].cmd = table->prop;
+				entry->props[entry->n_props++].u.data = v;
+			}
+		}
+		if (table->prop == DTV_INVERSION)
+			has_inversion = 1;
+	}
+	if (!has_inversion) {
+		entry->props[entry->n_props].cmd = DTV_INVERSION;
+		entry->props[entry->n_props++].u.data = INVERSION_AUTO;
+	}
+	adjust_delsys(entry);
+
+	return 0;
+}
+
 /*
  * Generic parse function for all formats each channel is contained into
  * just one line.
@@ -224,19 +372,14 @@ struct dvb_file *dvb_parse_format_oneline(const char *fname,
 					  uint32_t delsys,
 					  const struct dvb_parse_file *parse_file)
 {
-	const char *delimiter = parse_file->delimiter;
-	const struct dvb_parse_struct *formats = parse_file->formats;
-	char *buf = NULL, *p;
+	char *buf = NULL;
 	size_t size = 0;
 	int len = 0;
-	int i, j, line = 0;
+	int line = 0;
 	struct dvb_file *dvb_file;
 	FILE *fd;
-	const struct dvb_parse_struct *fmt;
 	struct dvb_entry *entry = NULL;
-	const struct dvb_parse_table *table;
 	char err_msg[80];
-	int has_inversion;
 
 	dvb_file = calloc(sizeof(*dvb_file), 1);
 	if (!dvb_file) {
@@ -257,124 +400,9 @@ struct dvb_file *dvb_parse_format_oneline(const char *fname,
 			break;
 		line++;
 
-		p = buf;
-		while (*p == ' ')
-			p++;
-		if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
-			continue;
-
-		if (parse_file->has_delsys_id) {
-			p = strtok(p, delimiter);
-			if (!p) {
-				sprintf(err_msg, _("unknown delivery system type for %s"),
-					p);
-				goto error;
-			}
-
-			/* Parse the type of the delivery system */
-			for (i = 0; formats[i].id != NULL; i++) {
-				if (!strcmp(p, formats[i].id))
-					break;
-			}
-			if (!formats[i].id) {
-				sprintf(err_msg, _("Doesn't know how to handle delimiter '%s'"),
-					p);
-				goto error;
-			}
-		} else {
-			/* Seek for the delivery system */
-			for (i = 0; formats[i].delsys != 0; i++) {
-				if (formats[i].delsys == delsys)
-					break;
-			}
-			if (!formats[i].delsys) {
-				sprintf(err_msg, _("Doesn't know how to parse delivery system %d"),
-					delsys);
-				goto error;
-			}
-		}
-
-
-		fmt = &formats[i];
-		if (!entry) {
-			dvb_file->first_entry = calloc(sizeof(*entry), 1);
-			entry = dvb_file->first_entry;
-		} else {
-			entry->next = calloc(sizeof(*entry), 1);
-			entry = entry->next;
-		}
-		entry->sat_number = -1;
-		entry->props[entry->n_props].cmd = DTV_DELIVERY_SYSTEM;
-		entry->props[entry->n_props++].u.data = fmt->delsys;
-		has_inversion = 0;
-		for (i = 0; i < fmt->size; i++) {
-			table = &fmt->table[i];
-			if (delsys && !i) {
-				p = strtok(p, delimiter);
-			} else
-				p = strtok(NULL, delimiter);
-			if (p && *p == '#')
-				p = NULL;
-			if (!p && !fmt->table[i].has_default_value) {
-				sprintf(err_msg, _("parameter %i (%s) missing"),
-					i, dvb_cmd_name(table->prop));
-				goto error;
-			}
-			if (p && table->size) {
-				for (j = 0; j < table->size; j++)
-					if (!table->table[j] || !strcasecmp(table->table[j], p))
-						break;
-				if (j == table->size) {
-					sprintf(err_msg, _("parameter %s invalid: %s"),
-						dvb_cmd_name(table->prop), p);
-					goto error;
-				}
-				if (table->prop == DTV_BANDWIDTH_HZ)
-					j = fe_bandwidth_name[j];
-				entry->props[entry->n_props].cmd = table->prop;
-                                entry->props[entry->n_props++].u.data = j;
-			} else {
-				long v;
-
-				if (!p)
-					v = fmt->table[i].default_value;
-				else
-					v = atol(p);
-
-				if (table->mult_factor)
-					v *= table->mult_factor;
-
-				switch (table->prop) {
-				case DTV_VIDEO_PID:
-					entry->video_pid = calloc(sizeof(*entry->video_pid), 1);
-					entry->video_pid_len = 1;
-					entry->video_pid[0] = v;
-					break;
-				case DTV_AUDIO_PID:
-					entry->audio_pid = calloc(sizeof(*entry->audio_pid), 1);
-					entry->audio_pid_len = 1;
-					entry->audio_pid[0] = v;
-					break;
-				case DTV_SERVICE_ID:
-					entry->service_id = v;
-					break;
-				case DTV_CH_NAME:
-					entry->channel = calloc(strlen(p) + 1, 1);
-					strcpy(entry->channel, p);
-					break;
-				default:
-					entry->props[entry->n_props].cmd = table->prop;
-					entry->props[entry->n_props++].u.data = v;
-				}
-			}
-			if (table->prop == DTV_INVERSION)
-				has_inversion = 1;
-		}
-		if (!has_inversion) {
-			entry->props[entry->n_props].cmd = DTV_INVERSION;
-			entry->props[entry->n_props++].u.data = INVERSION_AUTO;
-		}
-		adjust_delsys(entry);
+		if (dvb_parse_line_oneline(dvb_file, &entry, buf, delsys,
+					   parse_file, err_msg) < 0)
+			goto error;
 	} while (1);
 	fclose(fd);
 	if (buf)
@@ -418,159 +446,178 @@ static uint32_t get_compat_format(uint32_t delivery_system)
 	}
 }
 
-int dvb_write_format_oneline(const char *fname,
-			     struct dvb_file *dvb_file,
-			     uint32_t delsys,
-			     const struct dvb_parse_file *parse_file)
+/*
+ * Writes an entry on a format where each channel is contained into just one
+ * line. Returns the number of lines written, or -1 on errors.
+ */
+static int dvb_write_entry_oneline(FILE *fp, const char *fname,
+				   struct dvb_entry *entry, uint32_t *__delsys,
+				   const struct dvb_parse_file *parse_file,
+				   int line)
 {
 	const char delimiter = parse_file->delimiter[0];
 	const struct dvb_parse_struct *formats = parse_file->formats;
-	int i, j, line = 0, first;
-	FILE *fp;
 	const struct dvb_parse_struct *fmt;
-	struct dvb_entry *entry;
 	const struct dvb_parse_table *table;
+	uint32_t delsys = *__delsys, delsys_compat = 0;
 	uint32_t data;
 	char err_msg[80];
-	uint32_t delsys_compat = 0;
+	int i, j, first;
 
-	fp = fopen(fname, "w");
-	if (!fp) {
-		perror(fname);
-		return -errno;
-	}
-
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		for (i = 0; i < entry->n_props; i++) {
-			if (entry->props[i].cmd == DTV_DELIVERY_SYSTEM) {
-				delsys = entry->props[i].u.data;
-				break;
-			}
+	for (i = 0; i < entry->n_props; i++) {
+		if (entry->props[i].cmd == DTV_DELIVERY_SYSTEM) {
+			delsys = entry->props[i].u.data;
+			break;
 		}
+	}
 
+	for (i = 0; formats[i].delsys != 0; i++) {
+		if (formats[i].delsys == delsys)
+			break;
+	}
+	if (!formats[i].delsys) {
+		delsys_compat = get_compat_format(delsys);
 		for (i = 0; formats[i].delsys != 0; i++) {
-			if (formats[i].delsys == delsys)
+			if (formats[i].delsys == delsys_compat) {
+				delsys = delsys_compat;
 				break;
-		}
-		if (!formats[i].delsys) {
-			delsys_compat = get_compat_format(delsys);
-			for (i = 0; formats[i].delsys != 0; i++) {
-				if (formats[i].delsys == delsys_compat) {
-					delsys = delsys_compat;
-					break;
-				}
 			}
 		}
-		if (formats[i].delsys == 0) {
-			sprintf(err_msg,
-				 _("delivery system %d not supported on this format"),
-				 delsys);
-			goto error;
-		}
-		adjust_delsys(entry);
-		if (parse_file->has_delsys_id) {
-			fprintf(fp, "%s", formats[i].id);
+	}
+	*__delsys = delsys;
+	if (formats[i].delsys == 0) {
+		sprintf(err_msg,
+			 _("delivery system %d not supported on this format"),
+			 delsys);
+		goto error;
+	}
+	adjust_delsys(entry);
+	if (parse_file->has_delsys_id) {
+		fprintf(fp, "%s", formats[i].id);
+		first = 0;
+	} else
+		first = 1;
+
+	fmt = &formats[i];
+	for (i = 0; i < fmt->size; i++) {
+		table = &fmt->table[i];
+
+		if (first)
 			first = 0;
-		} else
-			first = 1;
-
-		fmt = &formats[i];
-		for (i = 0; i < fmt->size; i++) {
-			table = &fmt->table[i];
-
-			if (first)
-				first = 0;
-			else
-				fprintf(fp, "%c", delimiter);
+		else
+			fprintf(fp, "%c", delimiter);
 
-			for (j = 0; j < entry->n_props; j++)
-				if (entry->props[j].cmd == table->prop)
-					break;
-			if (fmt->table[i].has_default_value &&
-			   (j < entry->n_props) &&
-			   (fmt->table[i].default_value == entry->props[j].u.data))
+		for (j = 0; j < entry->n_props; j++)
+			if (entry->props[j].cmd == table->prop)
 				break;
-			if (table->size && j < entry->n_props) {
-				data = entry->props[j].u.data;
-
-				if (table->prop == DTV_BANDWIDTH_HZ) {
-					for (j = 0; j < ARRAY_SIZE(fe_bandwidth_name); j++) {
-						if (fe_bandwidth_name[j] == data) {
-							data = j;
-							break;
-						}
+		if (fmt->table[i].has_default_value &&
+		   (j < entry->n_props) &&
+		   (fmt->table[i].default_value == entry->props[j].u.data))
+			break;
+		if (table->size && j < entry->n_props) {
+			data = entry->props[j].u.data;
+
+			if (table->prop == DTV_BANDWIDTH_HZ) {
+				for (j = 0; j < ARRAY_SIZE(fe_bandwidth_name); j++) {
+					if (fe_bandwidth_name[j] == data) {
+						data = j;
+						break;
 					}
-					if (j == ARRAY_SIZE(fe_bandwidth_name))
-						data = BANDWIDTH_AUTO;
-				}
-				if (data >= table->size) {
-					sprintf(err_msg,
-						 _("value not supported"));
-					goto error;
 				}
+				if (j == ARRAY_SIZE(fe_bandwidth_name))
+					data = BANDWIDTH_AUTO;
+			}
+			if (data >= table->size) {
+				sprintf(err_msg,
+					 _("value not supported"));
+				goto error;
+			}
 
-				fprintf(fp, "%s", table->table[data]);
-			} else {
-				switch (table->prop) {
-				case DTV_VIDEO_PID:
-					if (!entry->video_pid) {
-						fprintf(stderr,
-							_("WARNING: missing video PID while parsing entry %d of %s\n"),
-							line, fname);
-						fprintf(fp, "%d",0);
-					} else
-						fprintf(fp, "%d",
-							entry->video_pid[0]);
-					break;
-				case DTV_AUDIO_PID:
-					if (!entry->audio_pid) {
+			fprintf(fp, "%s", table->table[data]);
+		} else {
+			switch (table->prop) {
+			case DTV_VIDEO_PID:
+				if (!entry->video_pid) {
+					fprintf(stderr,
+						_("WARNING: missing video PID while parsing entry %d of %s\n"),
+						line, fname);
+					fprintf(fp, "%d",0);
+				} else
+					fprintf(fp, "%d",
+						entry->video_pid[0]);
+				break;
+			case DTV_AUDIO_PID:
+				if (!entry->audio_pid) {
+					fprintf(stderr,
+						_("WARNING: missing audio PID while parsing entry %d of %s\n"),
+						line, fname);
+					fprintf(fp, "%d",0);
+				} else
+					fprintf(fp, "%d",
+						entry->audio_pid[0]);
+				break;
+			case DTV_SERVICE_ID:
+				fprintf(fp, "%d", entry->service_id);
+				break;
+			case DTV_CH_NAME:
+				fprintf(fp, "%s", entry->channel);
+				break;
+			default:
+				if (j >= entry->n_props) {
+					if (fmt->table[i].has_default_value) {
+						data = fmt->table[i].default_value;
+					} else {
 						fprintf(stderr,
-							_("WARNING: missing audio PID while parsing entry %d of %s\n"),
+							_("property %s not supported while parsing entry %d of %s\n"),
+							dvb_cmd_name(table->prop),
 							line, fname);
-						fprintf(fp, "%d",0);
-					} else
-						fprintf(fp, "%d",
-							entry->audio_pid[0]);
-					break;
-				case DTV_SERVICE_ID:
-					fprintf(fp, "%d", entry->service_id);
-					break;
-				case DTV_CH_NAME:
-					fprintf(fp, "%s", entry->channel);
-					break;
-				default:
-					if (j >= entry->n_props) {
-						if (fmt->table[i].has_default_value) {
-							data = fmt->table[i].default_value;
-						} else {
-							fprintf(stderr,
-								_("property %s not supported while parsing entry %d of %s\n"),
-								dvb_cmd_name(table->prop),
-								line, fname);
-							data = 0;
-						}
-					} else {
-						data = entry->props[j].u.data;
+						data = 0;
 					}
-
-					fprintf(fp, "%d", data);
-					break;
+				} else {
+					data = entry->props[j].u.data;
 				}
+
+				fprintf(fp, "%d", data);
+				break;
 			}
 		}
-		fprintf(fp, "\n");
-		line++;
-	};
-	fclose (fp);
-	return 0;
+	}
+	fprintf(fp, "\n");
+	return 1;
 
 error:
 	fprintf(stderr, _("ERROR: %s while parsing entry %d of %s\n"),
 		 err_msg, line, fname);
-	fclose(fp);
 	return -1;
 }
 
+int dvb_write_format_oneline(const char *fname,
+			     struct dvb_file *dvb_file,
+			     uint32_t delsys,
+			     const struct dvb_parse_file *parse_file)
+{
+	int line = 0;
+	FILE *fp;
+	struct dvb_entry *entry;
+
+	fp = fopen(fname, "w");
+	if (!fp) {
+		perror(fname);
+		return -errno;
+	}
+
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
+		if (dvb_write_entry_oneline(fp, fname, entry, &delsys,
+					    parse_file, line) < 0) {
+			fclose(fp);
+			return -1;
+		}
+		line++;
+	};
+	fclose (fp);
+	return 0;
+}
+
 #define CHANNEL "CHANNEL"
 
 static int fill_entry(struct dvb_entry *entry, char *key, char *value)
@@ -578,7 +625,7 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 	int i, j, len, type = 0;
 	int is_video = 0, is_audio = 0, n_prop;
 	uint16_t *pid = NULL;
-	char *p;
+	char *p, *save = NULL;
 
 	/* Handle the DVBv5 DTV_foo properties */
 	for (i = 0; i < ARRAY_SIZE(dvb_v5_name); i++) {
@@ -672,7 +719,7 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 		if (!type)
 			return 0;
 
-		p = strtok(value," \t");
+		p = strtok_r(value, " \t", &save);
 		if (!p)
 			return 0;
 		while (p) {
@@ -681,7 +728,7 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 						      sizeof (*entry->other_el_pid));
 			entry->other_el_pid[entry->other_el_pid_len].type = type;
 			entry->other_el_pid[entry->other_el_pid_len].pid = atol(p);
-			p = strtok(NULL, " \t\n");
+			p = strtok_r(NULL, " \t\n", &save);
 			entry->other_el_pid_len++;
 		}
 	}
@@ -718,13 +765,13 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 
 	len = 0;
 
-	p = strtok(value," \t");
+	p = strtok_r(value, " \t", &save);
 	if (!p)
 		return 0;
 	while (p) {
 		pid = realloc(pid, (len + 1) * sizeof (*pid));
 		pid[len] = atol(p);
-		p = strtok(NULL, " \t\n");
+		p = strtok_r(NULL, " \t\n", &save);
 		len++;
 	}
 
@@ -740,12 +787,87 @@ static int fill_entry(struct dvb_entry *entry, char *key, char *value)
 }
 
 
+/*
+ * Parses a line of a file in the DVBv5 format. On errors, returns -1,
+ * with a message at err_msg.
+ */
+static int dvb_read_line(struct dvb_file *dvb_file, struct dvb_entry **__entry,
+			 char *p, char *err_msg)
+{
+	struct dvb_entry *entry = *__entry;
+	char *key, *value, *save = NULL;
+	int rc;
+
+	while (*p == ' ' || *p == '\t')
+		p++;
+	if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
+		return 0;
+
+	if (*p == '[') {
+		/* NEW Entry */
+		if (!entry) {
+			dvb_file->first_entry = calloc(sizeof(*entry), 1);
+			entry = dvb_file->first_entry;
+		} else {
+			adjust_delsys(entry);
+			entry->next = calloc(sizeof(*entry), 1);
+			entry = entry->next;
+		}
+		*__entry = entry;
+		entry->sat_number = -1;
+		p++;
+		p = strtok_r(p, "]", &save);
+		if (!p) {
+			sprintf(err_msg, _("Missing channel group"));
+			return -1;
+		}
+		if (!strcasecmp(p, CHANNEL))
+			p += strlen(CHANNEL);
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p) {
+			entry->channel = calloc(strlen(p) + 1, 1);
+			strcpy(entry->channel, p);
+		}
+	} else {
+		if (!entry) {
+			sprintf(err_msg, _("key/value without a channel group"));
+			return -1;
+		}
+		key = strtok_r(p, "=", &save);
+		if (!key) {
+			sprintf(err_msg, _("missing key"));
+			return -1;
+		}
+		p = &key[strlen(key) - 1];
+		while ((p > key) && (*(p - 1) == ' ' || *(p - 1) == '\t'))
+			p--;
+		*p = 0;
+		value = strtok_r(NULL, "\n", &save);
+		if (!value) {
+			sprintf(err_msg, _("missing value"));
+			return -1;
+		}
+		while (*value == ' ' || *value == '\t')
+			value++;
+
+		rc = fill_entry(entry, key, value);
+		if (rc == -2) {
+			sprintf(err_msg, _("value %s is invalid for %s"),
+				value, key);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 struct dvb_file *dvb_read_file(const char *fname)
 {
-	char *buf = NULL, *p, *key, *value;
+	char *buf = NULL;
 	size_t size = 0;
 	int len = 0;
-	int line = 0, rc;
+	int line = 0;
 	struct dvb_file *dvb_file;
 	FILE *fd;
 	struct dvb_entry *entry = NULL;
@@ -769,66 +891,8 @@ struct dvb_file *dvb_read_file(const char *fname)
 		if (len <= 0)
 			break;
 		line++;
-		p = buf;
-		while (*p == ' ' || *p == '\t')
-			p++;
-		if (*p == '\n' || *p == '#' || *p == '\a' || *p == '\0')
-			continue;
-
-		if (*p == '[') {
-			/* NEW Entry */
-			if (!entry) {
-				dvb_file->first_entry = calloc(sizeof(*entry), 1);
-				entry = dvb_file->first_entry;
-			} else {
-				adjust_delsys(entry);
-				entry->next = calloc(sizeof(*entry), 1);
-				entry = entry->next;
-			}
-			entry->sat_number = -1;
-			p++;
-			p = strtok(p, "]");
-			if (!p) {
-				sprintf(err_msg, _("Missing channel group"));
-				goto error;
-			}
-			if (!strcasecmp(p, CHANNEL))
-				p += strlen(CHANNEL);
-			while (*p == ' ' || *p == '\t')
-				p++;
-			if (*p) {
-				entry->channel = calloc(strlen(p) + 1, 1);
-				strcpy(entry->channel, p);
-			}
-		} else {
-			if (!entry) {
-				sprintf(err_msg, _("key/value without a channel group"));
-				goto error;
-			}
-			key = strtok(p, "=");
-			if (!key) {
-				sprintf(err_msg, _("missing key"));
-				goto error;
-			}
-			p = &key[strlen(key) - 1];
-			while ((p > key) && (*(p - 1) == ' ' || *(p - 1) == '\t'))
-				p--;
-			*p = 0;
-			value = strtok(NULL, "\n");
-			if (!value) {
-				sprintf(err_msg, _("missing value"));
-				goto error;
-			}
-			while (*value == ' ' || *value == '\t')
-				value++;
-
-			rc = fill_entry(entry, key, value);
-			if (rc == -2) {
-				sprintf(err_msg, _("value %s is invalid for %s"),
-					value, key);
-				goto error;
-			}
-		}
+		if (dvb_read_line(dvb_file, &entry, buf, err_msg) < 0)
+			goto error;
 	} while (1);
 	if (buf)
 		free(buf);
@@ -847,126 +911,502 @@ error:
 	return NULL;
 };
 
-int dvb_write_file(const char *fname, struct dvb_file *dvb_file)
+/*
+ * Finds the end of the line starting at p, returning where the next one
+ * starts.
+ */
+static const char *dvb_next_line(const char *p, const char *end)
 {
-	FILE *fp;
-	int i;
-	struct dvb_entry *entry = dvb_file->first_entry;
-	static const char *off = "OFF";
+	p = memchr(p, '\n', end - p);
+	return p ? p + 1 : end;
+}
 
-	fp = fopen(fname, "w");
-	if (!fp) {
+static const char *dvb_skip_blank(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+/* Compares a string stored on the file with a NUL-terminated one */
+static int dvb_match(const char *p, size_t len, const char *str, int nocase)
+{
+	if (strlen(str) != len)
+		return 0;
+	if (nocase)
+		return !strncasecmp(p, str, len);
+	return !memcmp(p, str, len);
+}
+
+struct dvb_file *dvb_read_file_channel(const char *fname, const char *channel,
+				       uint32_t frequency)
+{
+	const char *buf, *end, *p, *next, *name, *key, *value;
+	const char *group = NULL, *found[3] = { NULL };
+	size_t name_len = 0, len;
+	struct dvb_file *dvb_file;
+	struct dvb_entry *entry = NULL;
+	int fd, line = 1, match = 0;
+	char err_msg[80], *tmp = NULL;
+	struct stat st;
+
+	dvb_file = calloc(sizeof(*dvb_file), 1);
+	if (!dvb_file) {
+		perror(_("Allocating memory for dvb_file"));
+		return NULL;
+	}
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
 		perror(fname);
-		return -errno;
+		if (fd >= 0)
+			close(fd);
+		free(dvb_file);
+		return NULL;
+	}
+	if (!st.st_size) {
+		close(fd);
+		return dvb_file;
 	}
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		perror(fname);
+		free(dvb_file);
+		return NULL;
+	}
+	end = buf + st.st_size;
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		adjust_delsys(entry);
-		if (entry->channel) {
-			fprintf(fp, "[%s]\n", entry->channel);
-			if (entry->vchannel)
-				fprintf(fp, "\tVCHANNEL = %s\n", entry->vchannel);
-		} else {
-			fprintf(fp, "[CHANNEL]\n");
+	/*
+	 * Look only at the group names and at the keys used to find the
+	 * channel, using the same precedence as the channel lookup at
+	 * dvb_file_find_channel(): the first entry whose name or virtual
+	 * channel matches, then the first name matching without case, and
+	 * then the first entry on the given frequency.
+	 */
+	for (p = buf; p < end && !found[0]; p = next) {
+		next = dvb_next_line(p, end);
+		p = dvb_skip_blank(p, next);
+		if (p == next || *p == '\n' || *p == '#')
+			continue;
+
+		if (*p == '[') {
+			if (match == 1)
+				found[0] = group;
+			group = p++;
+			name = p;
+			while (p < next && *p != ']' && *p != '\n')
+				p++;
+			name_len = p - name;
+			if (name_len == strlen(CHANNEL) &&
+			    !strncasecmp(name, CHANNEL, name_len))
+				name_len = 0;
+			p = dvb_skip_blank(name, name + name_len);
+			name_len -= p - name;
+			name = p;
+
+			match = 0;
+			if (dvb_match(name, name_len, channel, 0))
+				match = 1;
+			else if (!found[1] && dvb_match(name, name_len, channel, 1))
+				found[1] = group;
+			continue;
 		}
+		if (!group || match)
+			continue;
 
-		if (entry->service_id)
-			fprintf(fp, "\tSERVICE_ID = %d\n", entry->service_id);
+		key = p;
+		p = memchr(key, '=', next - key);
+		if (!p)
+			continue;
+		value = dvb_skip_blank(p + 1, next);
+		while (p > key && (p[-1] == ' ' || p[-1] == '\t'))
+			p--;
+		len = p - key;
+		p = value;
+		while (p < next && *p != '\n')
+			p++;
 
-		if (entry->network_id)
-			fprintf(fp, "\tNETWORK_ID = %d\n", entry->network_id);
+		if (len == 8 && !strncasecmp(key, "VCHANNEL", len)) {
+			if (dvb_match(value, p - value, channel, 0))
+				match = 1;
+		} else if (len == 9 && !strncasecmp(key, "FREQUENCY", len)) {
+			if (frequency && !found[2] &&
+			    strtoul(value, NULL, 10) == frequency)
+				found[2] = group;
+		}
+	}
+	if (match == 1)
+		found[0] = group;
 
-		if (entry->transport_id)
-			fprintf(fp, "\tTRANSPORT_ID = %d\n", entry->transport_id);
+	group = found[0] ? found[0] : found[1] ? found[1] : found[2];
+	if (!group)
+		goto done;
 
-		if (entry->video_pid_len){
-			fprintf(fp, "\tVIDEO_PID =");
-			for (i = 0; i < entry->video_pid_len; i++)
-				fprintf(fp, " %d", entry->video_pid[i]);
-			fprintf(fp, "\n");
+	/* Parse just the entry that was found */
+	for (p = group; p < end; p = next) {
+		next = dvb_next_line(p, end);
+		if (entry && *dvb_skip_blank(p, next) == '[')
+			break;
+
+		len = next - p;
+		free(tmp);
+		tmp = malloc(len + 1);
+		if (!tmp) {
+			sprintf(err_msg, _("out of memory"));
+			goto error;
 		}
+		memcpy(tmp, p, len);
+		tmp[len] = '\0';
+		if (dvb_read_line(dvb_file, &entry, tmp, err_msg) < 0)
+			goto error;
+	}
+	if (entry)
+		adjust_delsys(entry);
 
-		if (entry->audio_pid_len) {
-			fprintf(fp, "\tAUDIO_PID =");
-			for (i = 0; i < entry->audio_pid_len; i++)
-				fprintf(fp, " %d", entry->audio_pid[i]);
-			fprintf(fp, "\n");
+done:
+	free(tmp);
+	munmap((void *)buf, st.st_size);
+	return dvb_file;
+
+error:
+	for (next = buf; next < p; next = dvb_next_line(next, end))
+		line++;
+	fprintf (stderr, _("ERROR %s while parsing line %d of %s\n"),
+		 err_msg, line, fname);
+	free(tmp);
+	dvb_file_free(dvb_file);
+	munmap((void *)buf, st.st_size);
+	return NULL;
+}
+
+/*
+ * Hash tables to find the entries of a file. Each index maps a key to the
+ * first entry having it, in file order. For the string keys, the slot
+ * stores the hash of the string, checked before comparing the strings.
+ */
+
+enum dvb_file_index_type {
+	DVB_INDEX_CHANNEL,
+	DVB_INDEX_VCHANNEL,
+	DVB_INDEX_CHANNEL_NOCASE,
+	DVB_INDEX_SERVICE_ID,
+	DVB_INDEX_FREQUENCY,
+	DVB_INDEX_NUM
+};
+
+struct dvb_file_index_slot {
+	uint32_t key;
+	unsigned pos;
+	struct dvb_entry *entry;
+};
+
+struct dvb_file_index {
+	unsigned mask;
+	struct dvb_file_index_slot *slots[DVB_INDEX_NUM];
+};
+
+static uint32_t dvb_index_hash_string(const char *str, int nocase)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *str; str++) {
+		hash ^= nocase ? tolower((unsigned char)*str) : (unsigned char)*str;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static unsigned dvb_index_bucket(struct dvb_file_index *index, uint32_t key)
+{
+	key ^= key >> 16;
+	key *= 0x85ebca6b;
+	key ^= key >> 13;
+	return key & index->mask;
+}
+
+static const char *dvb_index_string(struct dvb_entry *entry,
+				    enum dvb_file_index_type type)
+{
+	switch (type) {
+	case DVB_INDEX_CHANNEL:
+	case DVB_INDEX_CHANNEL_NOCASE:
+		return entry->channel;
+	case DVB_INDEX_VCHANNEL:
+		return entry->vchannel;
+	default:
+		return NULL;
+	}
+}
+
+/* Returns zero if the entry has no such key */
+static int dvb_index_key(struct dvb_entry *entry,
+			 enum dvb_file_index_type type, uint32_t *key)
+{
+	const char *str;
+
+	switch (type) {
+	case DVB_INDEX_SERVICE_ID:
+		*key = entry->service_id;
+		return 1;
+	case DVB_INDEX_FREQUENCY:
+		return !dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, key);
+	default:
+		str = dvb_index_string(entry, type);
+		if (!str)
+			return 0;
+		*key = dvb_index_hash_string(str, type == DVB_INDEX_CHANNEL_NOCASE);
+		return 1;
+	}
+}
+
+static int dvb_index_equal(struct dvb_file_index_slot *slot,
+			   enum dvb_file_index_type type,
+			   uint32_t key, const char *str)
+{
+	const char *entry_str;
+
+	if (slot->key != key)
+		return 0;
+	entry_str = dvb_index_string(slot->entry, type);
+	if (!entry_str)
+		return 1;
+	if (type == DVB_INDEX_CHANNEL_NOCASE)
+		return !strcasecmp(entry_str, str);
+	return !strcmp(entry_str, str);
+}
+
+static struct dvb_file_index_slot *dvb_index_lookup(struct dvb_file_index *index,
+						    enum dvb_file_index_type type,
+						    uint32_t key, const char *str)
+{
+	struct dvb_file_index_slot *slots = index->slots[type];
+	unsigned i = dvb_index_bucket(index, key);
+
+	while (slots[i].entry) {
+		if (dvb_index_equal(&slots[i], type, key, str))
+			return &slots[i];
+		i = (i + 1) & index->mask;
+	}
+	return &slots[i];
+}
+
+struct dvb_file_index *dvb_file_index_alloc(struct dvb_file *dvb_file)
+{
+	struct dvb_file_index_slot *slot;
+	struct dvb_file_index *index;
+	struct dvb_entry *entry;
+	unsigned size = 16, n = 0, pos;
+	uint32_t key;
+	int type;
+
+	for (entry = dvb_file->first_entry; entry; entry = entry->next)
+		n++;
+	while (size < 2 * n)
+		size <<= 1;
+
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+	index->mask = size - 1;
+	for (type = 0; type < DVB_INDEX_NUM; type++) {
+		index->slots[type] = calloc(size, sizeof(*index->slots[type]));
+		if (!index->slots[type]) {
+			dvb_file_index_free(index);
+			return NULL;
 		}
+	}
 
-		if (entry->other_el_pid_len) {
-			int type = -1;
-			for (i = 0; i < entry->other_el_pid_len; i++) {
-				if (type != entry->other_el_pid[i].type) {
-					type = entry->other_el_pid[i].type;
-					if (i)
-						fprintf(fp, "\n");
-					fprintf(fp, "\tPID_%02x =", type);
-				}
-				fprintf(fp, " %d", entry->other_el_pid[i].pid);
+	pos = 0;
+	for (entry = dvb_file->first_entry; entry; entry = entry->next, pos++) {
+		for (type = 0; type < DVB_INDEX_NUM; type++) {
+			if (!dvb_index_key(entry, type, &key))
+				continue;
+			slot = dvb_index_lookup(index, type, key,
+						dvb_index_string(entry, type));
+			/* Keep the first entry with the key */
+			if (slot->entry)
+				continue;
+			slot->key = key;
+			slot->pos = pos;
+			slot->entry = entry;
+		}
+	}
+
+	return index;
+}
+
+void dvb_file_index_free(struct dvb_file_index *index)
+{
+	int type;
+
+	if (!index)
+		return;
+	for (type = 0; type < DVB_INDEX_NUM; type++)
+		free(index->slots[type]);
+	free(index);
+}
+
+struct dvb_entry *dvb_file_find_channel(struct dvb_file_index *index,
+					const char *name)
+{
+	struct dvb_file_index_slot *channel, *vchannel;
+
+	channel = dvb_index_lookup(index, DVB_INDEX_CHANNEL,
+				   dvb_index_hash_string(name, 0), name);
+	vchannel = dvb_index_lookup(index, DVB_INDEX_VCHANNEL,
+				    dvb_index_hash_string(name, 0), name);
+	if (channel->entry && vchannel->entry)
+		return channel->pos < vchannel->pos ? channel->entry : vchannel->entry;
+	if (channel->entry)
+		return channel->entry;
+	if (vchannel->entry)
+		return vchannel->entry;
+
+	/* Give a second shot, using a case insensitive seek */
+	return dvb_index_lookup(index, DVB_INDEX_CHANNEL_NOCASE,
+				dvb_index_hash_string(name, 1), name)->entry;
+}
+
+struct dvb_entry *dvb_file_find_service_id(struct dvb_file_index *index,
+					   uint16_t service_id)
+{
+	return dvb_index_lookup(index, DVB_INDEX_SERVICE_ID,
+				service_id, NULL)->entry;
+}
+
+struct dvb_entry *dvb_file_find_frequency(struct dvb_file_index *index,
+					  uint32_t frequency)
+{
+	return dvb_index_lookup(index, DVB_INDEX_FREQUENCY,
+				frequency, NULL)->entry;
+}
+
+static void dvb_write_entry(FILE *fp, struct dvb_entry *entry)
+{
+	static const char *off = "OFF";
+	int i;
+
+	adjust_delsys(entry);
+	if (entry->channel) {
+		fprintf(fp, "[%s]\n", entry->channel);
+		if (entry->vchannel)
+			fprintf(fp, "\tVCHANNEL = %s\n", entry->vchannel);
+	} else {
+		fprintf(fp, "[CHANNEL]\n");
+	}
+
+	if (entry->service_id)
+		fprintf(fp, "\tSERVICE_ID = %d\n", entry->service_id);
+
+	if (entry->network_id)
+		fprintf(fp, "\tNETWORK_ID = %d\n", entry->network_id);
+
+	if (entry->transport_id)
+		fprintf(fp, "\tTRANSPORT_ID = %d\n", entry->transport_id);
+
+	if (entry->video_pid_len){
+		fprintf(fp, "\tVIDEO_PID =");
+		for (i = 0; i < entry->video_pid_len; i++)
+			fprintf(fp, " %d", entry->video_pid[i]);
+		fprintf(fp, "\n");
+	}
+
+	if (entry->audio_pid_len) {
+		fprintf(fp, "\tAUDIO_PID =");
+		for (i = 0; i < entry->audio_pid_len; i++)
+			fprintf(fp, " %d", entry->audio_pid[i]);
+		fprintf(fp, "\n");
+	}
+
+	if (entry->other_el_pid_len) {
+		int type = -1;
+		for (i = 0; i < entry->other_el_pid_len; i++) {
+			if (type != entry->other_el_pid[i].type) {
+				type = entry->other_el_pid[i].type;
+				if (i)
+					fprintf(fp, "\n");
+				fprintf(fp, "\tPID_%02x =", type);
 			}
-			fprintf(fp, "\n");
+			fprintf(fp, " %d", entry->other_el_pid[i].pid);
 		}
+		fprintf(fp, "\n");
+	}
+
+	if (entry->sat_number >= 0) {
+		fprintf(fp, "\tSAT_NUMBER = %d\n",
+			entry->sat_number);
+	}
+
+	if (entry->freq_bpf > 0) {
+		fprintf(fp, "\tFREQ_BPF = %d\n",
+			entry->freq_bpf);
+	}
+
+	if (entry->diseqc_wait > 0) {
+		fprintf(fp, "\tDISEQC_WAIT = %d\n",
+			entry->diseqc_wait);
+	}
+	if (entry->lnb)
+		fprintf(fp, "\tLNB = %s\n", entry->lnb);
+
+	for (i = 0; i < entry->n_props; i++) {
+		const char * const *attr_name = dvb_attr_names(entry->props[i].cmd);
+		const char *buf;
+
+		if (attr_name) {
+			int j;
 
-		if (entry->sat_number >= 0) {
-			fprintf(fp, "\tSAT_NUMBER = %d\n",
-				entry->sat_number);
+			for (j = 0; j < entry->props[i].u.data; j++) {
+				if (!*attr_name)
+					break;
+				attr_name++;
+			}
 		}
 
-		if (entry->freq_bpf > 0) {
-			fprintf(fp, "\tFREQ_BPF = %d\n",
-				entry->freq_bpf);
+		if (entry->props[i].cmd == DTV_COUNTRY_CODE) {
+			buf = dvb_country_to_2letters(entry->props[i].u.data);
+			attr_name = &buf;
 		}
 
-		if (entry->diseqc_wait > 0) {
-			fprintf(fp, "\tDISEQC_WAIT = %d\n",
-				entry->diseqc_wait);
+		switch (entry->props[i].cmd) {
+		/* Handle parameters with optional values */
+		case DTV_PLS_CODE:
+		case DTV_PLS_MODE:
+			if (entry->props[i].u.data == (unsigned)-1)
+				continue;
+			break;
+		case DTV_PILOT:
+			if (entry->props[i].u.data == (unsigned)-1)
+				attr_name = &off;
+			break;
 		}
-		if (entry->lnb)
-				fprintf(fp, "\tLNB = %s\n", entry->lnb);
-
-		for (i = 0; i < entry->n_props; i++) {
-			const char * const *attr_name = dvb_attr_names(entry->props[i].cmd);
-			const char *buf;
-
-			if (attr_name) {
-				int j;
-
-				for (j = 0; j < entry->props[i].u.data; j++) {
-					if (!*attr_name)
-						break;
-					attr_name++;
-				}
-			}
 
-			if (entry->props[i].cmd == DTV_COUNTRY_CODE) {
-				buf = dvb_country_to_2letters(entry->props[i].u.data);
-				attr_name = &buf;
-			}
+		if (!attr_name || !*attr_name)
+			fprintf(fp, "\t%s = %u\n",
+				dvb_cmd_name(entry->props[i].cmd),
+				entry->props[i].u.data);
+		else
+			fprintf(fp, "\t%s = %s\n",
+				dvb_cmd_name(entry->props[i].cmd),
+				*attr_name);
+	}
+	fprintf(fp, "\n");
+}
 
-			switch (entry->props[i].cmd) {
-			/* Handle parameters with optional values */
-			case DTV_PLS_CODE:
-			case DTV_PLS_MODE:
-				if (entry->props[i].u.data == (unsigned)-1)
-					continue;
-				break;
-			case DTV_PILOT:
-				if (entry->props[i].u.data == (unsigned)-1)
-					attr_name = &off;
-				break;
-			}
+int dvb_write_file(const char *fname, struct dvb_file *dvb_file)
+{
+	FILE *fp;
+	struct dvb_entry *entry;
 
-			if (!attr_name || !*attr_name)
-				fprintf(fp, "\t%s = %u\n",
-					dvb_cmd_name(entry->props[i].cmd),
-					entry->props[i].u.data);
-			else
-				fprintf(fp, "\t%s = %s\n",
-					dvb_cmd_name(entry->props[i].cmd),
-					*attr_name);
-		}
-		fprintf(fp, "\n");
+	fp = fopen(fname, "w");
+	if (!fp) {
+		perror(fname);
+		return -errno;
 	}
+
+	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next)
+		dvb_write_entry(fp, entry);
 	fclose(fp);
 	return 0;
 };
@@ -1611,3 +2051,560 @@ int dvb_write_file_format(const char *fname,
 
 	return ret;
 }
+
+/*
+ * Streaming reader and writer
+ *
+ * The reader parses the file in batches of entries, handed one at a time,
+ * so converting a file doesn't need to keep all of it in memory. When more
+ * than one thread is asked for, the file is mapped into memory and split
+ * into chunks, always at an entry boundary, that are parsed in parallel,
+ * while the entries are still returned in the order they are on the file.
+ */
+
+#define DVB_FILE_BATCH		256		/* entries per batch */
+#define DVB_FILE_CHUNK		(64 * 1024)	/* bytes per parallel chunk */
+
+struct dvb_file_chunk {
+	struct dvb_file *dvb_file;
+	const char *start, *end;
+	int lines;
+	int err_line;		/* line of the error, if not zero */
+	char err_msg[80];
+	int done;
+};
+
+struct dvb_file_reader {
+	char *fname;
+	enum dvb_file_formats format;
+	uint32_t delsys;
+	const struct dvb_parse_file *parse_file;
+
+	/* Batch of entries being returned */
+	struct dvb_file *batch;
+	struct dvb_entry *next;
+	int line;
+	int error;
+
+	/* Serial parsing */
+	FILE *fp;
+	char *buf;
+	size_t size;
+	int pending;		/* buf has the first line of the next batch */
+
+#ifdef HAVE_PTHREAD
+	/* Parallel parsing */
+	char *map;
+	size_t map_size;
+	const char *split;	/* start of the next chunk to be parsed */
+	unsigned threads;
+	pthread_t *thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct dvb_file_chunk *chunks;
+	unsigned num_chunks;	/* size of the chunks ring */
+	unsigned next_chunk, cur_chunk;
+	int stop;
+#endif
+};
+
+struct dvb_file_writer {
+	char *fname;
+	enum dvb_file_formats format;
+	uint32_t delsys;
+	const struct dvb_parse_file *parse_file;
+	FILE *fp;
+	int line;
+	int error;
+};
+
+/* Checks if the file can be split before a line */
+static int dvb_line_starts_entry(struct dvb_file_reader *reader,
+				 const char *p, const char *end)
+{
+	/* On the one line formats, each line is an entry */
+	if (reader->format != FILE_DVBV5)
+		return 1;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	return p < end && *p == '[';
+}
+
+static int dvb_parse_reader_line(struct dvb_file_reader *reader,
+				 struct dvb_file *dvb_file,
+				 struct dvb_entry **entry, char *p,
+				 char *err_msg)
+{
+	if (reader->format == FILE_DVBV5)
+		return dvb_read_line(dvb_file, entry, p, err_msg);
+
+	return dvb_parse_line_oneline(dvb_file, entry, p, reader->delsys,
+				      reader->parse_file, err_msg);
+}
+
+static int dvb_reader_fill(struct dvb_file_reader *reader)
+{
+	struct dvb_file *dvb_file;
+	struct dvb_entry *entry = NULL, *last = NULL;
+	unsigned n_entries = 0;
+	char err_msg[80];
+	ssize_t len;
+
+	dvb_file = calloc(sizeof(*dvb_file), 1);
+	if (!dvb_file) {
+		perror(_("Allocating memory for dvb_file"));
+		return -ENOMEM;
+	}
+
+	while (1) {
+		if (!reader->pending) {
+			len = getline(&reader->buf, &reader->size, reader->fp);
+			if (len <= 0)
+				break;
+			reader->line++;
+		} else {
+			len = strlen(reader->buf);
+		}
+		reader->pending = 0;
+
+		if (n_entries >= DVB_FILE_BATCH &&
+		    dvb_line_starts_entry(reader, reader->buf, reader->buf + len)) {
+			reader->pending = 1;
+			break;
+		}
+
+		if (dvb_parse_reader_line(reader, dvb_file, &entry,
+					  reader->buf, err_msg) < 0) {
+			fprintf(stderr, _("ERROR %s while parsing line %d of %s\n"),
+				err_msg, reader->line, reader->fname);
+			dvb_file_free(dvb_file);
+			return -EINVAL;
+		}
+		if (entry != last) {
+			n_entries++;
+			last = entry;
+		}
+	}
+	if (entry && reader->format == FILE_DVBV5)
+		adjust_delsys(entry);
+
+	reader->batch = dvb_file;
+	reader->next = dvb_file->first_entry;
+
+	return 0;
+}
+
+#ifdef HAVE_PTHREAD
+
+/* Finds where the chunk starting at p ends. Should be called locked */
+static const char *dvb_chunk_end(struct dvb_file_reader *reader,
+				 const char *p)
+{
+	const char *end = reader->map + reader->map_size;
+
+	if (end - p <= DVB_FILE_CHUNK)
+		return end;
+
+	p += DVB_FILE_CHUNK;
+	while (p < end) {
+		p = memchr(p, '\n', end - p);
+		if (!p)
+			return end;
+		p++;
+		if (dvb_line_starts_entry(reader, p, end))
+			return p;
+	}
+
+	return end;
+}
+
+static void dvb_parse_chunk(struct dvb_file_reader *reader,
+			    struct dvb_file_chunk *chunk)
+{
+	struct dvb_entry *entry = NULL;
+	size_t size = chunk->end - chunk->start;
+	char *buf, *p, *eol;
+
+	chunk->dvb_file = calloc(sizeof(*chunk->dvb_file), 1);
+	buf = malloc(size + 1);
+	if (!chunk->dvb_file || !buf) {
+		free(buf);
+		sprintf(chunk->err_msg, _("out of memory"));
+		chunk->err_line = 1;
+		return;
+	}
+	memcpy(buf, chunk->start, size);
+	buf[size] = '\0';
+
+	for (p = buf; *p; p = eol) {
+		eol = strchr(p, '\n');
+		if (eol)
+			*eol++ = '\0';
+		else
+			eol = p + strlen(p);
+		chunk->lines++;
+
+		if (dvb_parse_reader_line(reader, chunk->dvb_file, &entry, p,
+					  chunk->err_msg) < 0) {
+			chunk->err_line = chunk->lines;
+			break;
+		}
+	}
+	if (entry && reader->format == FILE_DVBV5)
+		adjust_delsys(entry);
+
+	free(buf);
+}
+
+static void *dvb_reader_thread(void *privdata)
+{
+	struct dvb_file_reader *reader = privdata;
+	const char *end = reader->map + reader->map_size;
+	struct dvb_file_chunk *chunk;
+
+	pthread_mutex_lock(&reader->lock);
+	while (!reader->stop && reader->split < end) {
+		/* Don't parse too far ahead of the entries being read */
+		if (reader->next_chunk - reader->cur_chunk >= reader->num_chunks) {
+			pthread_cond_wait(&reader->cond, &reader->lock);
+			continue;
+		}
+
+		chunk = &reader->chunks[reader->next_chunk++ % reader->num_chunks];
+		memset(chunk, 0, sizeof(*chunk));
+		chunk->start = reader->split;
+		chunk->end = dvb_chunk_end(reader, reader->split);
+		reader->split = chunk->end;
+		pthread_mutex_unlock(&reader->lock);
+
+		dvb_parse_chunk(reader, chunk);
+
+		pthread_mutex_lock(&reader->lock);
+		chunk->done = 1;
+		pthread_cond_broadcast(&reader->cond);
+	}
+	pthread_mutex_unlock(&reader->lock);
+
+	return NULL;
+}
+
+static int dvb_reader_next_chunk(struct dvb_file_reader *reader)
+{
+	const char *end = reader->map + reader->map_size;
+	struct dvb_file_chunk *chunk = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&reader->lock);
+	while (1) {
+		if (reader->cur_chunk != reader->next_chunk) {
+			chunk = &reader->chunks[reader->cur_chunk % reader->num_chunks];
+			if (chunk->done)
+				break;
+		} else if (reader->split >= end) {
+			chunk = NULL;
+			break;
+		}
+		pthread_cond_wait(&reader->cond, &reader->lock);
+	}
+
+	if (chunk) {
+		if (chunk->err_line) {
+			fprintf(stderr, _("ERROR %s while parsing line %d of %s\n"),
+				chunk->err_msg, reader->line + chunk->err_line,
+				reader->fname);
+			reader->stop = 1;
+			ret = -EINVAL;
+		}
+		reader->batch = chunk->dvb_file;
+		reader->next = ret ? NULL : chunk->dvb_file->first_entry;
+		reader->line += chunk->lines;
+		chunk->dvb_file = NULL;
+		reader->cur_chunk++;
+		pthread_cond_broadcast(&reader->cond);
+	}
+	pthread_mutex_unlock(&reader->lock);
+
+	return ret;
+}
+
+static int dvb_reader_start_threads(struct dvb_file_reader *reader,
+				    unsigned threads)
+{
+	struct stat st;
+	unsigned i;
+	int fd, ret = 0;
+
+	fd = fileno(reader->fp);
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size <= DVB_FILE_CHUNK)
+		return 0;
+
+	reader->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (reader->map == MAP_FAILED) {
+		reader->map = NULL;
+		return 0;
+	}
+	reader->map_size = st.st_size;
+	reader->split = reader->map;
+
+	reader->num_chunks = 2 * threads;
+	reader->chunks = calloc(reader->num_chunks, sizeof(*reader->chunks));
+	reader->thread = calloc(threads, sizeof(*reader->thread));
+	if (!reader->chunks || !reader->thread)
+		return -ENOMEM;
+
+	pthread_mutex_init(&reader->lock, NULL);
+	pthread_cond_init(&reader->cond, NULL);
+
+	for (i = 0; i < threads; i++) {
+		ret = pthread_create(&reader->thread[i], NULL,
+				     dvb_reader_thread, reader);
+		if (ret)
+			break;
+	}
+	reader->threads = i;
+
+	/* Works with less threads, if it can't create all of them */
+	if (!i) {
+		errno = ret;
+		return -ret;
+	}
+
+	return 0;
+}
+
+static void dvb_reader_stop_threads(struct dvb_file_reader *reader)
+{
+	unsigned i;
+
+	if (!reader->map)
+		return;
+
+	if (reader->threads) {
+		pthread_mutex_lock(&reader->lock);
+		reader->stop = 1;
+		pthread_cond_broadcast(&reader->cond);
+		pthread_mutex_unlock(&reader->lock);
+
+		for (i = 0; i < reader->threads; i++)
+			pthread_join(reader->thread[i], NULL);
+	}
+
+	if (reader->chunks) {
+		for (i = 0; i < reader->num_chunks; i++)
+			if (reader->chunks[i].dvb_file)
+				dvb_file_free(reader->chunks[i].dvb_file);
+		free(reader->chunks);
+	}
+	free(reader->thread);
+	munmap(reader->map, reader->map_size);
+	if (reader->threads) {
+		pthread_mutex_destroy(&reader->lock);
+		pthread_cond_destroy(&reader->cond);
+	}
+}
+#endif
+
+struct dvb_file_reader *dvb_file_reader_open(const char *fname,
+					     uint32_t delsys,
+					     enum dvb_file_formats format,
+					     unsigned threads)
+{
+	struct dvb_file_reader *reader;
+
+	reader = calloc(sizeof(*reader), 1);
+	if (!reader) {
+		perror(_("Allocating memory for the file reader"));
+		return NULL;
+	}
+	reader->format = format;
+	reader->delsys = delsys;
+
+	switch (format) {
+	case FILE_CHANNEL:		/* DVB channel/transponder old format */
+		reader->parse_file = &channel_file_format;
+		reader->delsys = SYS_UNDEFINED;
+		break;
+	case FILE_ZAP:
+		reader->parse_file = &channel_file_zap_format;
+		break;
+	case FILE_DVBV5:
+		break;
+	case FILE_VDR:
+		/* FIXME: add support for VDR input */
+		fprintf(stderr, _("Currently, VDR format is supported only for output\n"));
+		free(reader);
+		return NULL;
+	default:
+		fprintf(stderr, _("Format is not supported\n"));
+		free(reader);
+		return NULL;
+	}
+
+	reader->fname = strdup(fname);
+	reader->fp = fopen(fname, "r");
+	if (!reader->fname || !reader->fp) {
+		perror(fname);
+		dvb_file_reader_close(reader);
+		return NULL;
+	}
+
+#ifdef HAVE_PTHREAD
+	if (threads > 1 && dvb_reader_start_threads(reader, threads) < 0) {
+		perror(_("Starting the parser threads"));
+		dvb_file_reader_close(reader);
+		return NULL;
+	}
+#endif
+
+	return reader;
+}
+
+int dvb_file_reader_next(struct dvb_file_reader *reader,
+			 struct dvb_entry **entry)
+{
+	int ret;
+
+	*entry = NULL;
+	if (reader->error)
+		return -EINVAL;
+
+	while (!reader->next) {
+		if (reader->batch) {
+			dvb_file_free(reader->batch);
+			reader->batch = NULL;
+		}
+#ifdef HAVE_PTHREAD
+		if (reader->map) {
+			ret = dvb_reader_next_chunk(reader);
+			if (ret < 0) {
+				reader->error = 1;
+				return ret;
+			}
+			if (!reader->batch)
+				return 0;
+			continue;
+		}
+#endif
+		if (feof(reader->fp) && !reader->pending)
+			return 0;
+
+		ret = dvb_reader_fill(reader);
+		if (ret < 0) {
+			reader->error = 1;
+			return ret;
+		}
+		if (!reader->next && !reader->pending)
+			return 0;
+	}
+
+	*entry = reader->next;
+	reader->next = reader->next->next;
+
+	return 1;
+}
+
+void dvb_file_reader_close(struct dvb_file_reader *reader)
+{
+#ifdef HAVE_PTHREAD
+	dvb_reader_stop_threads(reader);
+#endif
+	if (reader->batch)
+		dvb_file_free(reader->batch);
+	if (reader->fp)
+		fclose(reader->fp);
+	free(reader->buf);
+	free(reader->fname);
+	free(reader);
+}
+
+struct dvb_file_writer *dvb_file_writer_open(const char *fname,
+					     uint32_t delsys,
+					     enum dvb_file_formats format)
+{
+	struct dvb_file_writer *writer;
+
+	writer = calloc(sizeof(*writer), 1);
+	if (!writer) {
+		perror(_("Allocating memory for the file writer"));
+		return NULL;
+	}
+	writer->format = format;
+	writer->delsys = delsys;
+
+	switch (format) {
+	case FILE_CHANNEL:		/* DVB channel/transponder old format */
+		writer->parse_file = &channel_file_format;
+		writer->delsys = SYS_UNDEFINED;
+		break;
+	case FILE_ZAP:
+		writer->parse_file = &channel_file_zap_format;
+		break;
+	case FILE_DVBV5:
+	case FILE_VDR:
+		break;
+	default:
+		fprintf(stderr, _("Format is not supported\n"));
+		free(writer);
+		return NULL;
+	}
+
+	writer->fname = strdup(fname);
+	writer->fp = fopen(fname, "w");
+	if (!writer->fname || !writer->fp) {
+		perror(fname);
+		if (writer->fp)
+			fclose(writer->fp);
+		free(writer->fname);
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+int dvb_file_writer_write(struct dvb_file_writer *writer,
+			  struct dvb_entry *entry)
+{
+	int ret;
+
+	switch (writer->format) {
+	case FILE_DVBV5:
+		dvb_write_entry(writer->fp, entry);
+		ret = 1;
+		break;
+	case FILE_VDR:
+		ret = dvb_write_entry_vdr(writer->fp, writer->fname, entry,
+					  writer->line);
+		break;
+	default:
+		ret = dvb_write_entry_oneline(writer->fp, writer->fname, entry,
+					      &writer->delsys,
+					      writer->parse_file,
+					      writer->line);
+	}
+	if (ret < 0) {
+		writer->error = 1;
+		return -1;
+	}
+	writer->line += ret;
+
+	return 0;
+}
+
+int dvb_file_writer_close(struct dvb_file_writer *writer)
+{
+	int ret = writer->error ? -1 : 0;
+	int err = ferror(writer->fp);
+
+	if (fclose(writer->fp) || err) {
+		perror(writer->fname);
+		ret = -EIO;
+	}
+	free(writer->fname);
+	free(writer);
+
+	return ret;
+}
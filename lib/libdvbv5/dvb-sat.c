@@ -508,9 +508,15 @@ static int dvbsat_scr_odu_channel_change(struct dvb_v5_fe_parms_priv *parms,
 	return dvb_fe_diseqc_cmd(&parms->p, cmd->len, cmd->msg);
 }
 
+/* Default time between two SEC commands, as required by DiSEqC */
+#define DVB_SAT_SETTLE_MS	15
+
 static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 				   uint16_t t)
 {
+	struct dvb_sat_sec_state old = parms->sec_state;
+	unsigned settle = parms->p.diseqc_settle ? parms->p.diseqc_settle :
+			  DVB_SAT_SETTLE_MS;
 	int rc;
 	enum dvb_sat_polarization pol;
 	int pol_v;
@@ -547,6 +553,39 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 		}
 	}
 
+	if (old.valid && old.lnb == parms->p.lnb &&
+	    old.sat_number == sat_number && old.vol_high == vol_high &&
+	    old.tone_on == tone_on) {
+		/*
+		 * Without DiSEqC, only the voltage and the tone select the
+		 * LNB band and polarization: nothing to do if unchanged.
+		 * The SCR channel change command also carries the
+		 * frequency, so it's sent on every tune.
+		 */
+		if (sat_number < 0 ||
+		    (!t && old.high_band == high_band && old.pol_v == pol_v)) {
+			if (parms->p.verbose)
+				dvb_log(_("SEC: unchanged, not sending it again"));
+			return 0;
+		}
+	}
+
+	if (old.valid && old.lnb == parms->p.lnb &&
+	    sat_number < 0 && old.sat_number < 0) {
+		/* Only send what changed, without the tone off/on sequence */
+		if (old.vol_high != vol_high) {
+			rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
+			if (rc)
+				return rc;
+		}
+		if (old.tone_on != tone_on) {
+			rc = dvb_fe_sec_tone(&parms->p, tone_on ? SEC_TONE_ON : SEC_TONE_OFF);
+			if (rc)
+				return rc;
+		}
+		goto done;
+	}
+
 	rc = dvb_fe_sec_voltage(&parms->p, 1, vol_high);
 	if (rc)
 		return rc;
@@ -557,7 +596,7 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 
 	if (sat_number >= 0) {
 		/* DiSEqC is enabled. Send DiSEqC commands */
-		usleep(15 * 1000);
+		usleep(settle * 1000);
 
 		if (!t)
 			rc = dvbsat_diseqc_write_to_port_group(parms, &cmd, high_band,
@@ -570,7 +609,7 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 			dvb_logerr(_("sending diseq failed"));
 			return rc;
 		}
-		usleep((15 + parms->p.diseqc_wait) * 1000);
+		usleep((settle + parms->p.diseqc_wait) * 1000);
 
 		/* miniDiSEqC/Toneburst commands are defined only for up to 2 sattelites */
 		if (parms->p.sat_number < 2) {
@@ -578,12 +617,23 @@ static int dvbsat_diseqc_set_input(struct dvb_v5_fe_parms_priv *parms,
 			if (rc)
 				return rc;
 		}
-		usleep(15 * 1000);
+		usleep(settle * 1000);
 	}
 
 	rc = dvb_fe_sec_tone(&parms->p, tone_on ? SEC_TONE_ON : SEC_TONE_OFF);
+	if (rc)
+		return rc;
 
-	return rc;
+done:
+	parms->sec_state.lnb = parms->p.lnb;
+	parms->sec_state.sat_number = sat_number;
+	parms->sec_state.high_band = high_band;
+	parms->sec_state.pol_v = pol_v;
+	parms->sec_state.vol_high = vol_high;
+	parms->sec_state.tone_on = tone_on;
+	parms->sec_state.valid = 1;
+
+	return 0;
 }
 
 int dvb_sat_real_freq(struct dvb_v5_fe_parms *p, int freq)
@@ -27,6 +27,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -36,8 +38,10 @@
 #include <sys/types.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "dvb-fe-priv.h"
+#include "usdt.h"
 #include <libdvbv5/dvb-scan.h>
 #include <libdvbv5/dvb-frontend.h>
 #include <libdvbv5/descriptors.h>
@@ -46,6 +50,7 @@
 #include <libdvbv5/dvb-scan.h>
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-demux.h>
+#include <libdvbv5/dvb-dev.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/header.h>
 #include <libdvbv5/pat.h>
@@ -72,7 +77,7 @@
 
 # define N_(string) string
 
-static int dvb_poll(struct dvb_v5_fe_parms_priv *parms, int fd, unsigned int seconds)
+static int dvb_poll(struct dvb_v5_fe_parms_priv *parms, int fd, unsigned int ms)
 {
 	fd_set set;
 	struct timeval timeout;
@@ -83,8 +88,8 @@ static int dvb_poll(struct dvb_v5_fe_parms_priv *parms, int fd, unsigned int sec
 	FD_SET (fd, &set);
 
 	/* Initialize the timeout data structure. */
-	timeout.tv_sec = seconds;
-	timeout.tv_usec = 0;
+	timeout.tv_sec = ms / 1000;
+	timeout.tv_usec = (ms % 1000) * 1000;
 
 	/* `select' logfuncreturns 0 if timeout, 1 if input available, -1 if error. */
 	do ret = select (FD_SETSIZE, &set, NULL, NULL, &timeout);
@@ -104,6 +109,9 @@ int dvb_read_section(struct dvb_v5_fe_parms *parms, int dmx_fd,
  * The code below was inspired on Linux Kernel's bitmask implementation
  */
 
+/* Enough for 256 sections of the maximum size */
+#define DVB_TABLE_CACHE_MAX_SIZE	(256 * 4096)
+
 #define BITS_PER_LONG		(8 * sizeof(long))
 #define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
 #define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
@@ -141,6 +149,10 @@ struct dvb_table_filter_ext_priv {
 	int ext_id;
 	int first_section;
 	int done;
+
+	/* Raw sections to be stored at the table cache */
+	uint8_t *cache;
+	size_t cache_len;
 };
 
 struct dvb_table_filter_priv {
@@ -148,8 +160,8 @@ struct dvb_table_filter_priv {
 	struct dvb_table_filter_ext_priv *extensions;
 };
 
-static int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
-				   struct dvb_table_filter *sect)
+int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
+			    struct dvb_table_filter *sect)
 {
 	struct dvb_table_filter_priv *priv;
 
@@ -172,23 +184,150 @@ static int dvb_parse_section_alloc(struct dvb_v5_fe_parms_priv *parms,
 void dvb_table_filter_free(struct dvb_table_filter *sect)
 {
 	struct dvb_table_filter_priv *priv = sect->priv;
+	int i;
 
 	if (priv) {
+		for (i = 0; i < priv->num_extensions; i++)
+			free(priv->extensions[i].cache);
 		free (priv->extensions);
 		free(priv);
 		sect->priv = NULL;
 	}
 }
 
-static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
-			     struct dvb_table_filter *sect,
-			     const uint8_t *buf, ssize_t buf_length)
+/*
+ * Table cache: the raw sections of each table extension are stored on a
+ * file, named after the transponder, the PID, the table ID and the
+ * extension ID. When the first section of an extension has the same
+ * version as the cached one, the cached sections are parsed at once,
+ * instead of waiting for all of them to be received again.
+ */
+
+static int dvb_table_cache_name(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_table_filter *sect,
+				struct dvb_table_filter_ext_priv *ext,
+				char *name, size_t size)
+{
+	uint32_t freq = 0, pol = 0, stream_id = 0;
+
+	dvb_fe_retrieve_parm(&parms->p, DTV_FREQUENCY, &freq);
+	dvb_fe_retrieve_parm(&parms->p, DTV_POLARIZATION, &pol);
+	dvb_fe_retrieve_parm(&parms->p, DTV_STREAM_ID, &stream_id);
+
+	return snprintf(name, size, "%s/%u-%u-%u-%u-%04x-%02x-%04x.sec",
+			parms->table_cache_dir, parms->p.current_sys, freq, pol,
+			stream_id, sect->pid, sect->tid, ext->ext_id);
+}
+
+/* Returns 1 if the extension was parsed from the cache */
+static int dvb_table_cache_load(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_table_filter *sect,
+				struct dvb_table_filter_ext_priv *ext,
+				const struct dvb_table_header *h)
+{
+	struct dvb_table_header ch;
+	char name[PATH_MAX];
+	uint8_t *buf;
+	size_t pos, len, size;
+	FILE *fp;
+	int num_sections = 0;
+
+	dvb_table_cache_name(parms, sect, ext, name, sizeof(name));
+	fp = fopen(name, "r");
+	if (!fp)
+		return 0;
+
+	buf = malloc(DVB_TABLE_CACHE_MAX_SIZE);
+	if (!buf) {
+		fclose(fp);
+		return 0;
+	}
+	len = fread(buf, 1, DVB_TABLE_CACHE_MAX_SIZE, fp);
+	fclose(fp);
+
+	/* Check that the cache is complete and has the same version */
+	for (pos = 0; pos + sizeof(ch) <= len; pos += size) {
+		memcpy(&ch, buf + pos, sizeof(ch));
+		dvb_table_header_init(&ch);
+		size = ch.section_length + 3;
+		if (pos + size > len || ch.table_id != h->table_id ||
+		    ch.id != h->id || ch.version != h->version ||
+		    ch.last_section != h->last_section ||
+		    dvb_crc32(buf + pos, size, 0xFFFFFFFF))
+			break;
+		num_sections++;
+	}
+	if (pos != len || num_sections != h->last_section + 1) {
+		free(buf);
+		return 0;
+	}
+
+	if (parms->p.verbose)
+		dvb_log(_("%s: table 0x%02x, extension ID 0x%04x, version %d: using cache"),
+			__func__, h->table_id, h->id, h->version);
+
+	for (pos = 0; pos < len; pos += size) {
+		memcpy(&ch, buf + pos, sizeof(ch));
+		dvb_table_header_init(&ch);
+		size = ch.section_length + 3;
+		set_bit(ch.section_id, ext->is_read_bits);
+		dvb_table_initializers[h->table_id](&parms->p, buf + pos,
+						    size - DVB_CRC_SIZE,
+						    sect->table);
+	}
+	free(buf);
+
+	return 1;
+}
+
+static void dvb_table_cache_add(struct dvb_table_filter_ext_priv *ext,
+				const uint8_t *buf, ssize_t buf_length)
+{
+	uint8_t *p;
+
+	if (ext->cache_len + buf_length > DVB_TABLE_CACHE_MAX_SIZE)
+		return;
+	p = realloc(ext->cache, ext->cache_len + buf_length);
+	if (!p)
+		return;
+	memcpy(p + ext->cache_len, buf, buf_length);
+	ext->cache = p;
+	ext->cache_len += buf_length;
+}
+
+static void dvb_table_cache_store(struct dvb_v5_fe_parms_priv *parms,
+				  struct dvb_table_filter *sect,
+				  struct dvb_table_filter_ext_priv *ext)
+{
+	char name[PATH_MAX], tmp_name[PATH_MAX + 4];
+	FILE *fp;
+	size_t len;
+
+	dvb_table_cache_name(parms, sect, ext, name, sizeof(name));
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
+
+	/* Write to a temporary file first, to never leave a partial cache */
+	fp = fopen(tmp_name, "w");
+	if (!fp) {
+		dvb_perror(_("can't write to the table cache"));
+		return;
+	}
+	len = fwrite(ext->cache, 1, ext->cache_len, fp);
+	if (fclose(fp) || len != ext->cache_len || rename(tmp_name, name)) {
+		dvb_perror(_("can't write to the table cache"));
+		unlink(tmp_name);
+	}
+}
+
+static int dvb_do_parse_section(struct dvb_v5_fe_parms_priv *parms,
+				struct dvb_table_filter *sect,
+				const uint8_t *buf, ssize_t buf_length)
 {
 	struct dvb_table_header h;
 	struct dvb_table_filter_priv *priv;
 	struct dvb_table_filter_ext_priv *ext;
 	unsigned char tid;
-	int i = 0, new = 0;
+	int i = 0, new = 0, use_cache;
 
 	memcpy(&h, buf, sizeof(struct dvb_table_header));
 	dvb_table_header_init(&h);
@@ -271,6 +410,15 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 		}
 	}
 
+	/* The cache can only be used when all sections are expected */
+	use_cache = parms->table_cache_dir && dvb_table_initializers[tid] &&
+		    !sect->allow_section_gaps && sect->ts_id == -1;
+
+	if (new && use_cache && dvb_table_cache_load(parms, sect, ext, &h)) {
+		use_cache = 0;
+		goto check_done;
+	}
+
 	/* handle the sections */
 	if (!sect->allow_section_gaps && sect->ts_id == -1)
 		set_bit(h.section_id, ext->is_read_bits);
@@ -283,12 +431,19 @@ static int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
 		dvb_logerr(_("%s: no initializer for table %d"),
 			   __func__, tid);
 
+	if (use_cache)
+		dvb_table_cache_add(ext, buf, buf_length);
+
+check_done:
+
 	if (!sect->allow_section_gaps && sect->ts_id == -1 &&
 			is_all_bits_set(ext->last_section, ext->is_read_bits)) {
 		if (parms->p.verbose)
 			dvb_log(_("%s: table 0x%02x, extension ID 0x%04x: done"),
 				__func__, h.table_id, h.id);
 		ext->done = 1;
+		if (use_cache && ext->cache)
+			dvb_table_cache_store(parms, sect, ext);
 	}
 
 	if (!ext->done)
@@ -309,23 +464,68 @@ ret:
 	return 1;
 }
 
-int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
-			     struct dvb_table_filter *sect,
-			     unsigned timeout)
+int dvb_parse_section(struct dvb_v5_fe_parms_priv *parms,
+		      struct dvb_table_filter *sect,
+		      const uint8_t *buf, ssize_t buf_length)
+{
+	int ret;
+
+	USDT(libdvbv5, parse_section_start, sect->pid, buf[0], buf_length);
+	ret = dvb_do_parse_section(parms, sect, buf, buf_length);
+	USDT(libdvbv5, parse_section_end, sect->pid, buf[0], ret);
+
+	return ret;
+}
+
+static long dvb_elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void dvb_read_sections_stop(struct dvb_v5_fe_parms_priv *parms,
+				   int dmx_fd)
+{
+	if (parms->scan_dmx)
+		dvb_dev_dmx_stop(parms->scan_dmx);
+	else
+		dvb_dmx_stop(dmx_fd);
+}
+
+/*
+ * Same as dvb_read_sections(), but with the timeout in ms. If first_ms is
+ * not NULL, it is set to the time the first section took to arrive, or to
+ * -1 if none arrived.
+ */
+static int dvb_read_sections_ms(struct dvb_v5_fe_parms_priv *parms, int dmx_fd,
+				struct dvb_table_filter *sect,
+				unsigned timeout_ms, long *first_ms)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
 	int ret;
 	uint8_t *buf = NULL;
 	uint8_t mask = 0xff;
+	struct timespec start;
+
+	if (first_ms)
+		*first_ms = -1;
 
 	ret = dvb_parse_section_alloc(parms, sect);
 	if (ret < 0)
 		return ret;
 
-	if (dvb_set_section_filter(dmx_fd, sect->pid, 1,
-				   &sect->tid, &mask, NULL,
-				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
-		dvb_dmx_stop(dmx_fd);
+	if (parms->scan_dmx)
+		ret = dvb_dev_dmx_set_section_filter(parms->scan_dmx, sect->pid, 1,
+						     &sect->tid, &mask, NULL,
+						     DMX_IMMEDIATE_START | DMX_CHECK_CRC);
+	else
+		ret = dvb_set_section_filter(dmx_fd, sect->pid, 1,
+					     &sect->tid, &mask, NULL,
+					     DMX_IMMEDIATE_START | DMX_CHECK_CRC);
+	if (ret) {
+		dvb_read_sections_stop(parms, dmx_fd);
 		return -1;
 	}
 	if (parms->p.verbose)
@@ -335,20 +535,31 @@ int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
 	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
 	if (!buf) {
 		dvb_logerr(_("%s: out of memory"), __func__);
-		dvb_dmx_stop(dmx_fd);
+		dvb_read_sections_stop(parms, dmx_fd);
 		dvb_table_filter_free(sect);
 		return -1;
 	}
 
-
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	do {
 		int available;
 		uint32_t crc;
 		ssize_t buf_length = 0;
 
-		do {
-			available = dvb_poll(parms, dmx_fd, timeout);
-		} while (available < 0 && errno == EOVERFLOW);
+		if (parms->scan_dmx) {
+			/* Returns -ETIMEDOUT if the table isn't there */
+			buf_length = dvb_dev_read(parms->scan_dmx, buf,
+						  DVB_MAX_PAYLOAD_PACKET_SIZE);
+			available = buf_length != -ETIMEDOUT;
+			if (buf_length < 0 && available) {
+				errno = -buf_length;
+				buf_length = -1;
+			}
+		} else {
+			do {
+				available = dvb_poll(parms, dmx_fd, timeout_ms);
+			} while (available < 0 && errno == EOVERFLOW);
+		}
 
 		if (parms->p.abort) {
 			ret = 0;
@@ -359,7 +570,8 @@ int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
 			ret = -1;
 			break;
 		}
-		buf_length = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+		if (!parms->scan_dmx)
+			buf_length = read(dmx_fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
 
 		if (!buf_length) {
 			dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
@@ -378,11 +590,13 @@ int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
 			ret = -3;
 			break;
 		}
+		if (first_ms && *first_ms < 0)
+			*first_ms = dvb_elapsed_ms(&start);
 
 		ret = dvb_parse_section(parms, sect, buf, buf_length);
 	} while (!ret);
 	free(buf);
-	dvb_dmx_stop(dmx_fd);
+	dvb_read_sections_stop(parms, dmx_fd);
 	dvb_table_filter_free(sect);
 
 	if (ret > 0)
@@ -391,6 +605,15 @@ int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
 	return ret;
 }
 
+int dvb_read_sections(struct dvb_v5_fe_parms *__p, int dmx_fd,
+			     struct dvb_table_filter *sect,
+			     unsigned timeout)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	return dvb_read_sections_ms(parms, dmx_fd, sect, timeout * 1000, NULL);
+}
+
 int dvb_read_section_with_id(struct dvb_v5_fe_parms *parms, int dmx_fd,
 			     unsigned char tid, uint16_t pid,
 			     int ts_id,
@@ -407,6 +630,209 @@ int dvb_read_section_with_id(struct dvb_v5_fe_parms *parms, int dmx_fd,
 	return dvb_read_sections(parms, dmx_fd, &tab, timeout);
 }
 
+/*
+ * Concurrent table reading: each table gets its own demux filter, and all
+ * of them are polled together. So, a table is done as soon as all its
+ * sections are received, instead of waiting for the tables before it.
+ */
+
+/* Demuxes have a limited number of section filters */
+#define DVB_MAX_CONCURRENT_TABLES	16
+
+struct dvb_table_read {
+	struct dvb_table_filter sect;
+	unsigned timeout_ms;
+	int fd;
+	int rc;
+	struct timespec start;
+	struct timespec deadline;
+	/* Time the first section took to arrive, or -1 */
+	long first_ms;
+};
+
+static void dvb_table_read_add(struct dvb_table_read *tr, unsigned char tid,
+			       uint16_t pid, void **table, unsigned timeout_ms)
+{
+	memset(tr, 0, sizeof(*tr));
+	tr->sect.tid = tid;
+	tr->sect.pid = pid;
+	tr->sect.ts_id = -1;
+	tr->sect.table = table;
+	tr->timeout_ms = timeout_ms;
+	tr->fd = -1;
+	tr->first_ms = -1;
+}
+
+static void dvb_table_read_set_deadline(struct dvb_table_read *tr)
+{
+	clock_gettime(CLOCK_MONOTONIC, &tr->deadline);
+	tr->deadline.tv_sec += tr->timeout_ms / 1000;
+	tr->deadline.tv_nsec += (tr->timeout_ms % 1000) * 1000000;
+	if (tr->deadline.tv_nsec >= 1000000000) {
+		tr->deadline.tv_sec++;
+		tr->deadline.tv_nsec -= 1000000000;
+	}
+}
+
+static int dvb_table_read_start(struct dvb_v5_fe_parms_priv *parms,
+				const char *dmx_path,
+				struct dvb_table_read *tr)
+{
+	uint8_t mask = 0xff;
+
+	tr->rc = dvb_parse_section_alloc(parms, &tr->sect);
+	if (tr->rc < 0)
+		return tr->rc;
+
+	tr->fd = open(dmx_path, O_RDWR | O_NONBLOCK);
+	if (tr->fd < 0) {
+		dvb_perror(_("can't open demux"));
+		dvb_table_filter_free(&tr->sect);
+		return tr->rc = -1;
+	}
+
+	if (dvb_set_section_filter(tr->fd, tr->sect.pid, 1,
+				   &tr->sect.tid, &mask, NULL,
+				   DMX_IMMEDIATE_START | DMX_CHECK_CRC)) {
+		close(tr->fd);
+		tr->fd = -1;
+		dvb_table_filter_free(&tr->sect);
+		return tr->rc = -1;
+	}
+	if (parms->p.verbose)
+		dvb_log(_("%s: waiting for table ID 0x%02x, program ID 0x%02x"),
+			__func__, tr->sect.tid, tr->sect.pid);
+
+	clock_gettime(CLOCK_MONOTONIC, &tr->start);
+	dvb_table_read_set_deadline(tr);
+
+	return 0;
+}
+
+static void dvb_table_read_done(struct dvb_table_read *tr, int rc)
+{
+	dvb_dmx_stop(tr->fd);
+	close(tr->fd);
+	tr->fd = -1;
+	dvb_table_filter_free(&tr->sect);
+	tr->rc = rc > 0 ? 0 : rc;
+}
+
+/* Returns a negative value on errors or 1 when the table is done */
+static int dvb_table_read_section(struct dvb_v5_fe_parms_priv *parms,
+				  struct dvb_table_read *tr, uint8_t *buf)
+{
+	ssize_t buf_length;
+
+	buf_length = read(tr->fd, buf, DVB_MAX_PAYLOAD_PACKET_SIZE);
+	if (buf_length < 0 && (errno == EAGAIN || errno == EOVERFLOW))
+		return 0;
+	if (!buf_length) {
+		dvb_logerr(_("%s: buf returned an empty buffer"), __func__);
+		return -1;
+	}
+	if (buf_length < 0) {
+		dvb_perror(_("dvb_read_section: read error"));
+		return -2;
+	}
+	if (dvb_crc32(buf, buf_length, 0xFFFFFFFF) != 0) {
+		dvb_logerr(_("%s: crc error"), __func__);
+		return -3;
+	}
+	if (tr->first_ms < 0)
+		tr->first_ms = dvb_elapsed_ms(&tr->start);
+
+	/* Tables with several sections may take long to be completed */
+	dvb_table_read_set_deadline(tr);
+
+	return dvb_parse_section(parms, &tr->sect, buf, buf_length);
+}
+
+static void dvb_read_sections_concurrent(struct dvb_v5_fe_parms_priv *parms,
+					 const char *dmx_path,
+					 struct dvb_table_read *reads,
+					 int num_reads)
+{
+	struct dvb_table_read *active[DVB_MAX_CONCURRENT_TABLES];
+	struct pollfd fds[DVB_MAX_CONCURRENT_TABLES];
+	struct timespec now;
+	int i, ret, next = 0, num_active = 0;
+	long timeout_ms, ms;
+	uint8_t *buf;
+
+	buf = calloc(DVB_MAX_PAYLOAD_PACKET_SIZE, 1);
+	if (!buf) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		for (i = 0; i < num_reads; i++)
+			reads[i].rc = -1;
+		return;
+	}
+
+	while (next < num_reads || num_active) {
+		/* Start as many filters as possible */
+		while (next < num_reads && num_active < DVB_MAX_CONCURRENT_TABLES) {
+			if (!dvb_table_read_start(parms, dmx_path, &reads[next]))
+				active[num_active++] = &reads[next];
+			next++;
+		}
+		if (!num_active)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout_ms = -1;
+		for (i = 0; i < num_active; i++) {
+			fds[i].fd = active[i]->fd;
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+
+			ms = (active[i]->deadline.tv_sec - now.tv_sec) * 1000 +
+			     (active[i]->deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if (ms < 0)
+				ms = 0;
+			if (timeout_ms < 0 || ms < timeout_ms)
+				timeout_ms = ms;
+		}
+
+		ret = poll(fds, num_active, timeout_ms);
+		if (parms->p.abort)
+			break;
+		if (ret < 0 && errno != EINTR) {
+			dvb_perror(_("poll"));
+			break;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = num_active - 1; i >= 0; i--) {
+			struct dvb_table_read *tr = active[i];
+
+			ret = 0;
+			if (fds[i].revents)
+				ret = dvb_table_read_section(parms, tr, buf);
+
+			if (!ret && (tr->deadline.tv_sec < now.tv_sec ||
+				     (tr->deadline.tv_sec == now.tv_sec &&
+				      tr->deadline.tv_nsec <= now.tv_nsec))) {
+				dvb_logerr(_("%s: no data read on section filter"),
+					   __func__);
+				ret = -1;
+			}
+			if (!ret)
+				continue;
+
+			dvb_table_read_done(tr, ret);
+			active[i] = active[--num_active];
+		}
+	}
+
+	/* On abort or errors, keep what was already parsed */
+	for (i = 0; i < num_active; i++)
+		dvb_table_read_done(active[i], 0);
+	for (; next < num_reads; next++)
+		reads[next].rc = -1;
+
+	free(buf);
+}
+
 struct dvb_v5_descriptors *dvb_scan_alloc_handler_table(uint32_t delivery_system)
 {
 	struct dvb_v5_descriptors *dvb_scan_handler;
@@ -445,75 +871,500 @@ void dvb_scan_free_handler_table(struct dvb_v5_descriptors *dvb_scan_handler)
 	free(dvb_scan_handler);
 }
 
-struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
-					     int dmx_fd,
-					     uint32_t delivery_system,
-					     unsigned other_nit,
-					     unsigned timeout_multiply)
+/* Get standard timeouts for each table */
+static void dvb_get_ts_tables_timeouts(uint32_t delivery_system,
+				       int *atsc_filter,
+				       unsigned *pat_pmt_time,
+				       unsigned *sdt_time,
+				       unsigned *nit_time,
+				       unsigned *vct_time)
 {
-	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
-	int rc;
-	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
-	int atsc_filter = 0;
-	unsigned num_pmt = 0;
-
-	struct dvb_v5_descriptors *dvb_scan_handler;
+	*atsc_filter = 0;
+	*vct_time = 0;
 
-	dvb_scan_handler = dvb_scan_alloc_handler_table(delivery_system);
-	if (!dvb_scan_handler)
-		return NULL;
-
-	if (!timeout_multiply)
-		timeout_multiply = 1;
-
-	/* Get standard timeouts for each table */
 	switch(delivery_system) {
 		case SYS_DVBC_ANNEX_A:
 		case SYS_DVBC_ANNEX_C:
 		case SYS_DVBS:
 		case SYS_DVBS2:
 		case SYS_TURBO:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 10;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 10;
 			break;
 		case SYS_DVBT:
 		case SYS_DVBT2:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 12;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 12;
 			break;
 		case SYS_ISDBT:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 12;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 12;
 			break;
 		case SYS_ATSC:
-			atsc_filter = ATSC_TABLE_TVCT;
-			pat_pmt_time = 2;
-			vct_time = 2;
-			sdt_time = 5;
-			nit_time = 5;
+			*atsc_filter = ATSC_TABLE_TVCT;
+			*pat_pmt_time = 2;
+			*vct_time = 2;
+			*sdt_time = 5;
+			*nit_time = 5;
 			break;
 		case SYS_DVBC_ANNEX_B:
-			atsc_filter = ATSC_TABLE_CVCT;
-			pat_pmt_time = 2;
-			vct_time = 2;
-			sdt_time = 5;
-			nit_time = 5;
+			*atsc_filter = ATSC_TABLE_CVCT;
+			*pat_pmt_time = 2;
+			*vct_time = 2;
+			*sdt_time = 5;
+			*nit_time = 5;
 			break;
 		default:
-			pat_pmt_time = 1;
-			sdt_time = 2;
-			nit_time = 10;
+			*pat_pmt_time = 1;
+			*sdt_time = 2;
+			*nit_time = 10;
 			break;
 	};
+}
+
+/*
+ * Adaptive table timeouts
+ *
+ * The timeouts above are just upper limits. A table is waited for its
+ * maximum repetition interval, as checked by ETSI TR 101 290 and required
+ * by ATSC A/65, plus some slack. If the first sections of the tables
+ * already read on this transponder arrived later than their own interval,
+ * the timeouts are scaled by the slowest of them. The PAT, read first,
+ * always gets the upper limit.
+ *
+ * A table found missing on DVB_SCAN_ABSENT_MUXES transponders of the
+ * network, and not found on any of them, is only probed for: there's
+ * rarely a NIT other on partly empty satellites, for instance.
+ */
+enum dvb_scan_table {
+	DVB_SCAN_PAT,
+	DVB_SCAN_PMT,
+	DVB_SCAN_VCT,
+	DVB_SCAN_NIT,
+	DVB_SCAN_SDT,
+	DVB_SCAN_NIT2,
+	DVB_SCAN_SDT2,
+};
+
+#define DVB_SCAN_SLACK_MS	100
+#define DVB_SCAN_PROBE_MS	500
+#define DVB_SCAN_ABSENT_MUXES	2
+/* In percent */
+#define DVB_SCAN_MAX_FACTOR	400
+
+static const char *dvb_scan_table_name[DVB_SCAN_TABLE_TYPES] = {
+	[DVB_SCAN_PAT] = "PAT",
+	[DVB_SCAN_PMT] = "PMT",
+	[DVB_SCAN_VCT] = "VCT",
+	[DVB_SCAN_NIT] = "NIT",
+	[DVB_SCAN_SDT] = "SDT",
+	[DVB_SCAN_NIT2] = "NIT other",
+	[DVB_SCAN_SDT2] = "SDT other",
+};
+
+/* Maximum repetition interval of each table, in ms */
+static const unsigned dvb_scan_table_interval[DVB_SCAN_TABLE_TYPES] = {
+	[DVB_SCAN_PAT] = 500,
+	[DVB_SCAN_PMT] = 500,
+	[DVB_SCAN_VCT] = 400,
+	[DVB_SCAN_NIT] = 10000,
+	[DVB_SCAN_SDT] = 2000,
+	[DVB_SCAN_NIT2] = 10000,
+	[DVB_SCAN_SDT2] = 10000,
+};
+
+struct dvb_scan_timing {
+	struct dvb_v5_fe_parms_priv *parms;
+	unsigned multiply;
+	/* Upper limits, in ms */
+	unsigned limit[DVB_SCAN_TABLE_TYPES];
+	/* Slowest arrival seen, in percent of the table interval */
+	unsigned factor;
+};
+
+/* Returns the ATSC VCT table ID, or 0 if there's no VCT */
+static int dvb_scan_timing_init(struct dvb_scan_timing *t,
+				struct dvb_v5_fe_parms_priv *parms,
+				uint32_t delivery_system,
+				unsigned timeout_multiply)
+{
+	struct dvb_scan_absent *absent = &parms->scan_absent;
+	unsigned pat_pmt_time, sdt_time, nit_time, vct_time;
+	int atsc_filter;
+
+	dvb_get_ts_tables_timeouts(delivery_system, &atsc_filter, &pat_pmt_time,
+				   &sdt_time, &nit_time, &vct_time);
+
+	t->parms = parms;
+	t->multiply = timeout_multiply;
+	t->factor = 100;
+	t->limit[DVB_SCAN_PAT] = pat_pmt_time * 1000 * timeout_multiply;
+	t->limit[DVB_SCAN_PMT] = pat_pmt_time * 1000 * timeout_multiply;
+	t->limit[DVB_SCAN_VCT] = vct_time * 1000 * timeout_multiply;
+	t->limit[DVB_SCAN_NIT] = nit_time * 1000 * timeout_multiply;
+	t->limit[DVB_SCAN_SDT] = sdt_time * 1000 * timeout_multiply;
+	t->limit[DVB_SCAN_NIT2] = nit_time * 1000 * timeout_multiply;
+	t->limit[DVB_SCAN_SDT2] = sdt_time * 1000 * timeout_multiply;
+
+	/* A new network: forget what was missing on the previous one */
+	if (absent->delivery_system != delivery_system ||
+	    absent->lnb != parms->p.lnb ||
+	    absent->sat_number != parms->p.sat_number) {
+		memset(absent, 0, sizeof(*absent));
+		absent->delivery_system = delivery_system;
+		absent->lnb = parms->p.lnb;
+		absent->sat_number = parms->p.sat_number;
+	}
+
+	return atsc_filter;
+}
+
+static unsigned dvb_scan_timeout(struct dvb_scan_timing *t,
+				 enum dvb_scan_table type)
+{
+	struct dvb_v5_fe_parms_priv *parms = t->parms;
+	struct dvb_scan_absent *absent = &parms->scan_absent;
+	unsigned ms;
+
+	if (type == DVB_SCAN_PAT)
+		return t->limit[type];
+
+	if (type >= DVB_SCAN_VCT &&
+	    absent->missing[type] >= DVB_SCAN_ABSENT_MUXES &&
+	    !(absent->seen & (1 << type)))
+		ms = DVB_SCAN_PROBE_MS;
+	else
+		ms = dvb_scan_table_interval[type];
+	ms = (ms * t->factor / 100 + DVB_SCAN_SLACK_MS) * t->multiply;
+	if (ms > t->limit[type])
+		ms = t->limit[type];
+
+	if (parms->p.verbose > 1)
+		dvb_log(_("%s: waiting up to %u ms for %s"),
+			__func__, ms, dvb_scan_table_name[type]);
+
+	return ms;
+}
+
+/* Accounts a table read, given the time its first section took to arrive */
+static void dvb_scan_table_done(struct dvb_scan_timing *t,
+				enum dvb_scan_table type, long first_ms)
+{
+	struct dvb_scan_absent *absent = &t->parms->scan_absent;
+	unsigned factor;
+
+	if (first_ms < 0) {
+		if (absent->missing[type] < 255)
+			absent->missing[type]++;
+		return;
+	}
+	absent->seen |= 1 << type;
+
+	factor = first_ms * 100 / (dvb_scan_table_interval[type] * t->multiply);
+	if (factor > DVB_SCAN_MAX_FACTOR)
+		factor = DVB_SCAN_MAX_FACTOR;
+	if (factor > t->factor)
+		t->factor = factor;
+}
+
+static int dvb_scan_read_section(struct dvb_scan_timing *t, int dmx_fd,
+				 unsigned char tid, uint16_t pid, void **table,
+				 enum dvb_scan_table type)
+{
+	struct dvb_table_filter tab;
+	long first_ms;
+	int rc;
+
+	tab.tid = tid;
+	tab.pid = pid;
+	tab.ts_id = -1;
+	tab.table = table;
+	tab.allow_section_gaps = 0;
+
+	rc = dvb_read_sections_ms(t->parms, dmx_fd, &tab,
+				  dvb_scan_timeout(t, type), &first_ms);
+	if (!t->parms->p.abort)
+		dvb_scan_table_done(t, type, first_ms);
+
+	return rc;
+}
+
+static struct dvb_v5_descriptors *
+dvb_get_ts_tables_concurrent(struct dvb_v5_fe_parms_priv *parms,
+			     const char *dmx_path,
+			     uint32_t delivery_system,
+			     unsigned other_nit,
+			     unsigned timeout_multiply)
+{
+	struct dvb_v5_descriptors *dvb_scan_handler;
+	struct dvb_table_read *reads, *pat, *vct = NULL, *nit, *sdt = NULL;
+	struct dvb_table_read *pmt, *nit2 = NULL, *sdt2 = NULL;
+	struct dvb_scan_timing t;
+	int atsc_filter, n = 0;
+	unsigned num_pmt = 0;
+	int i;
+
+	dvb_scan_handler = dvb_scan_alloc_handler_table(delivery_system);
+	if (!dvb_scan_handler)
+		return NULL;
+
+	atsc_filter = dvb_scan_timing_init(&t, parms, delivery_system,
+					   timeout_multiply);
+
+	/* Enough for the first pass */
+	reads = calloc(4, sizeof(*reads));
+	if (!reads) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		dvb_scan_free_handler_table(dvb_scan_handler);
+		return NULL;
+	}
+
+	/*
+	 * First pass: all tables that don't depend on the others. If there's
+	 * a VCT, SDT is only needed if it fails.
+	 */
+	pat = &reads[n++];
+	dvb_table_read_add(pat, DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
+			   (void **)&dvb_scan_handler->pat,
+			   dvb_scan_timeout(&t, DVB_SCAN_PAT));
+	if (atsc_filter) {
+		vct = &reads[n++];
+		dvb_table_read_add(vct, atsc_filter, ATSC_TABLE_VCT_PID,
+				   (void **)&dvb_scan_handler->vct,
+				   dvb_scan_timeout(&t, DVB_SCAN_VCT));
+	}
+	nit = &reads[n++];
+	dvb_table_read_add(nit, DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
+			   (void **)&dvb_scan_handler->nit,
+			   dvb_scan_timeout(&t, DVB_SCAN_NIT));
+	if (!atsc_filter) {
+		sdt = &reads[n++];
+		dvb_table_read_add(sdt, DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
+				   (void **)&dvb_scan_handler->sdt,
+				   dvb_scan_timeout(&t, DVB_SCAN_SDT));
+	}
+
+	dvb_read_sections_concurrent(parms, dmx_path, reads, n);
+	if (parms->p.abort)
+		goto ret;
+
+	dvb_scan_table_done(&t, DVB_SCAN_PAT, pat->first_ms);
+	if (vct)
+		dvb_scan_table_done(&t, DVB_SCAN_VCT, vct->first_ms);
+	dvb_scan_table_done(&t, DVB_SCAN_NIT, nit->first_ms);
+	if (sdt)
+		dvb_scan_table_done(&t, DVB_SCAN_SDT, sdt->first_ms);
+
+	if (pat->rc < 0) {
+		dvb_logerr(_("error while waiting for PAT table"));
+		dvb_scan_free_handler_table(dvb_scan_handler);
+		free(reads);
+		return NULL;
+	}
+	if (parms->p.verbose)
+		dvb_table_pat_print(&parms->p, dvb_scan_handler->pat);
+	if (vct) {
+		if (vct->rc < 0)
+			dvb_logerr(_("error while waiting for VCT table"));
+		else if (parms->p.verbose)
+			atsc_table_vct_print(&parms->p, dvb_scan_handler->vct);
+	}
+	if (nit->rc < 0)
+		dvb_logerr(_("error while reading the NIT table"));
+	else if (parms->p.verbose)
+		dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+	if (sdt) {
+		if (sdt->rc < 0)
+			dvb_logerr(_("error while reading the SDT table"));
+		else if (parms->p.verbose)
+			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+	}
+
+	/* Second pass: the PMTs, got from PAT, and the remaining tables */
+	free(reads);
+	reads = calloc(dvb_scan_handler->pat->programs + 3, sizeof(*reads));
+	dvb_scan_handler->program = calloc(dvb_scan_handler->pat->programs,
+					   sizeof(*dvb_scan_handler->program));
+	if (!reads ||
+	    (dvb_scan_handler->pat->programs && !dvb_scan_handler->program)) {
+		dvb_logerr(_("%s: out of memory"), __func__);
+		goto ret;
+	}
+	n = 0;
+
+	dvb_pat_program_foreach(program, dvb_scan_handler->pat) {
+		dvb_scan_handler->program[num_pmt].pat_pgm = program;
+
+		if (!program->service_id) {
+			if (parms->p.verbose)
+				dvb_log(_("Program #%d is network PID: 0x%04x"),
+					num_pmt, program->pid);
+			num_pmt++;
+			continue;
+		}
+		if (parms->p.verbose)
+			dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
+				num_pmt, program->pid, program->service_id);
+		dvb_table_read_add(&reads[n++], DVB_TABLE_PMT, program->pid,
+				   (void **)&dvb_scan_handler->program[num_pmt].pmt,
+				   dvb_scan_timeout(&t, DVB_SCAN_PMT));
+		num_pmt++;
+	}
+	dvb_scan_handler->num_program = num_pmt;
+	pmt = reads;
+
+	if (atsc_filter && (!dvb_scan_handler->vct || other_nit)) {
+		sdt = &reads[n++];
+		dvb_table_read_add(sdt, DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
+				   (void **)&dvb_scan_handler->sdt,
+				   dvb_scan_timeout(&t, DVB_SCAN_SDT));
+	}
+	if (other_nit) {
+		if (parms->p.verbose)
+			dvb_log(_("Parsing other NIT/SDT"));
+		nit2 = &reads[n++];
+		dvb_table_read_add(nit2, DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
+				   (void **)&dvb_scan_handler->nit,
+				   dvb_scan_timeout(&t, DVB_SCAN_NIT2));
+		sdt2 = &reads[n];
+		dvb_table_read_add(sdt2, DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
+				   (void **)&dvb_scan_handler->sdt,
+				   dvb_scan_timeout(&t, DVB_SCAN_SDT2));
+	}
+
+	/*
+	 * SDT and SDT2 are parsed into the same table, so they can't be read
+	 * at the same time
+	 */
+	if (sdt2 && !(atsc_filter && sdt))
+		n++;
+	dvb_read_sections_concurrent(parms, dmx_path, reads, n);
+	if (sdt2 && atsc_filter && sdt && !parms->p.abort)
+		dvb_read_sections_concurrent(parms, dmx_path, sdt2, 1);
+	if (parms->p.abort)
+		goto ret;
+
+	for (i = 0; i < dvb_scan_handler->num_program; i++) {
+		struct dvb_v5_descriptors_program *program = &dvb_scan_handler->program[i];
+
+		if (!program->pat_pgm->service_id)
+			continue;
+		dvb_scan_table_done(&t, DVB_SCAN_PMT, pmt->first_ms);
+		if (pmt++->rc < 0) {
+			dvb_logerr(_("error while reading the PMT table for service 0x%04x"),
+				   program->pat_pgm->service_id);
+			if (program->pmt)
+				dvb_table_pmt_free(program->pmt);
+			program->pmt = NULL;
+		} else if (parms->p.verbose) {
+			dvb_table_pmt_print(&parms->p, program->pmt);
+		}
+	}
+	if (atsc_filter && sdt) {
+		dvb_scan_table_done(&t, DVB_SCAN_SDT, sdt->first_ms);
+		if (sdt->rc < 0)
+			dvb_logerr(_("error while reading the SDT table"));
+		else if (parms->p.verbose)
+			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+	}
+	if (nit2) {
+		dvb_scan_table_done(&t, DVB_SCAN_NIT2, nit2->first_ms);
+		if (nit2->rc < 0)
+			dvb_logerr(_("error while reading the NIT table"));
+		else if (parms->p.verbose)
+			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
+	}
+	if (sdt2) {
+		dvb_scan_table_done(&t, DVB_SCAN_SDT2, sdt2->first_ms);
+		if (sdt2->rc < 0)
+			dvb_logerr(_("error while reading the SDT table"));
+		else if (parms->p.verbose)
+			dvb_table_sdt_print(&parms->p, dvb_scan_handler->sdt);
+	}
+
+ret:
+	free(reads);
+	return dvb_scan_handler;
+}
+
+void dvb_scan_set_concurrent_tables(struct dvb_v5_fe_parms *__p, int enable)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	parms->concurrent_tables = enable;
+}
+
+int dvb_scan_set_table_cache(struct dvb_v5_fe_parms *__p, const char *dir)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+
+	free(parms->table_cache_dir);
+	parms->table_cache_dir = NULL;
+	if (!dir)
+		return 0;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		dvb_perror(_("can't create the table cache directory"));
+		return -errno;
+	}
+	parms->table_cache_dir = strdup(dir);
+	if (!parms->table_cache_dir)
+		return -ENOMEM;
+
+	return 0;
+}
+
+struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
+					     int dmx_fd,
+					     uint32_t delivery_system,
+					     unsigned other_nit,
+					     unsigned timeout_multiply)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
+	int rc;
+	struct dvb_scan_timing t;
+	int atsc_filter;
+	unsigned num_pmt = 0;
+	char path[64], dmx_path[PATH_MAX];
+	ssize_t len;
+
+	struct dvb_v5_descriptors *dvb_scan_handler;
+
+	if (!timeout_multiply)
+		timeout_multiply = 1;
+
+	/*
+	 * The concurrent mode opens the demux again for each table, so it
+	 * needs its path.
+	 */
+	if (parms->concurrent_tables && !parms->scan_dmx) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", dmx_fd);
+		len = readlink(path, dmx_path, sizeof(dmx_path) - 1);
+		if (len > 0) {
+			dmx_path[len] = '\0';
+			return dvb_get_ts_tables_concurrent(parms, dmx_path,
+							    delivery_system,
+							    other_nit,
+							    timeout_multiply);
+		}
+		dvb_logwarn(_("can't get the demux path. Reading tables one by one"));
+	}
+
+	dvb_scan_handler = dvb_scan_alloc_handler_table(delivery_system);
+	if (!dvb_scan_handler)
+		return NULL;
+
+	atsc_filter = dvb_scan_timing_init(&t, parms, delivery_system,
+					   timeout_multiply);
 
 	/* PAT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
-			      (void **)&dvb_scan_handler->pat,
-			      pat_pmt_time * timeout_multiply);
+	rc = dvb_scan_read_section(&t, dmx_fd,
+				   DVB_TABLE_PAT, DVB_TABLE_PAT_PID,
+				   (void **)&dvb_scan_handler->pat,
+				   DVB_SCAN_PAT);
 	if (parms->p.abort)
 		return dvb_scan_handler;
 	if (rc < 0) {
@@ -526,10 +1377,10 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 
 	/* ATSC-specific VCT table */
 	if (atsc_filter) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      atsc_filter, ATSC_TABLE_VCT_PID,
-				      (void **)&dvb_scan_handler->vct,
-				      vct_time * timeout_multiply);
+		rc = dvb_scan_read_section(&t, dmx_fd,
+					   atsc_filter, ATSC_TABLE_VCT_PID,
+					   (void **)&dvb_scan_handler->vct,
+					   DVB_SCAN_VCT);
 		if (parms->p.abort)
 			return dvb_scan_handler;
 		if (rc < 0)
@@ -555,10 +1406,10 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		if (parms->p.verbose)
 			dvb_log(_("Program #%d ID 0x%04x, service ID 0x%04x"),
 				num_pmt, program->pid, program->service_id);
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_PMT, program->pid,
-				      (void **)&dvb_scan_handler->program[num_pmt].pmt,
-				      pat_pmt_time * timeout_multiply);
+		rc = dvb_scan_read_section(&t, dmx_fd,
+					   DVB_TABLE_PMT, program->pid,
+					   (void **)&dvb_scan_handler->program[num_pmt].pmt,
+					   DVB_SCAN_PMT);
 		if (parms->p.abort) {
 			dvb_scan_handler->num_program = num_pmt + 1;
 			return dvb_scan_handler;
@@ -577,10 +1428,10 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 	dvb_scan_handler->num_program = num_pmt;
 
 	/* NIT table */
-	rc = dvb_read_section(&parms->p, dmx_fd,
-			      DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
-			      (void **)&dvb_scan_handler->nit,
-			      nit_time * timeout_multiply);
+	rc = dvb_scan_read_section(&t, dmx_fd,
+				   DVB_TABLE_NIT, DVB_TABLE_NIT_PID,
+				   (void **)&dvb_scan_handler->nit,
+				   DVB_SCAN_NIT);
 	if (parms->p.abort)
 		return dvb_scan_handler;
 	if (rc < 0)
@@ -590,10 +1441,10 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 
 	/* SDT table */
 	if (!dvb_scan_handler->vct || other_nit) {
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
+		rc = dvb_scan_read_section(&t, dmx_fd,
+					   DVB_TABLE_SDT, DVB_TABLE_SDT_PID,
+					   (void **)&dvb_scan_handler->sdt,
+					   DVB_SCAN_SDT);
 		if (parms->p.abort)
 			return dvb_scan_handler;
 		if (rc < 0)
@@ -606,10 +1457,10 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 	if (other_nit) {
 		if (parms->p.verbose)
 			dvb_log(_("Parsing other NIT/SDT"));
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				      DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
-				      (void **)&dvb_scan_handler->nit,
-				      nit_time * timeout_multiply);
+		rc = dvb_scan_read_section(&t, dmx_fd,
+					   DVB_TABLE_NIT2, DVB_TABLE_NIT_PID,
+					   (void **)&dvb_scan_handler->nit,
+					   DVB_SCAN_NIT2);
 		if (parms->p.abort)
 			return dvb_scan_handler;
 		if (rc < 0)
@@ -617,10 +1468,10 @@ struct dvb_v5_descriptors *dvb_get_ts_tables(struct dvb_v5_fe_parms *__p,
 		else if (parms->p.verbose)
 			dvb_table_nit_print(&parms->p, dvb_scan_handler->nit);
 
-		rc = dvb_read_section(&parms->p, dmx_fd,
-				DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
-				(void **)&dvb_scan_handler->sdt,
-				sdt_time * timeout_multiply);
+		rc = dvb_scan_read_section(&t, dmx_fd,
+					   DVB_TABLE_SDT2, DVB_TABLE_SDT_PID,
+					   (void **)&dvb_scan_handler->sdt,
+					   DVB_SCAN_SDT2);
 		if (parms->p.abort)
 			return dvb_scan_handler;
 		if (rc < 0)
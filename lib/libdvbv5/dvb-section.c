@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation version 2.1 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ * Or, point your browser to http://www.gnu.org/licenses/old-licenses/gpl-2.0.html
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dvb-fe-priv.h"
+#include <libdvbv5/dvb-section.h>
+#include <libdvbv5/dvb-scan.h>
+#include <libdvbv5/descriptors.h>
+#include <libdvbv5/mpeg_ts.h>
+#include <libdvbv5/crc32.h>
+
+/*
+ * Each PID being filtered has its own state, found by a direct lookup, so
+ * the packets of the other PIDs cost just a load. The header of a section
+ * is assembled first: if it was already received with the same version,
+ * the rest of the section is skipped, instead of copied and checked.
+ */
+
+/* Enough for the header of a long section */
+#define DVB_SECTION_HEADER_SIZE	8
+
+struct dvb_section_filter {
+	struct dvb_section_filter *next;
+	uint8_t table_id, mask;
+	unsigned flags;
+
+	/* Either a table, parsed as dvb_read_sections() does, or a handler */
+	struct dvb_table_filter *sect;
+	int done;
+	dvb_section_handler_t *handler;
+	void *priv;
+};
+
+/* The sections already received of a table ID and extension */
+struct dvb_section_version {
+	uint8_t table_id;
+	uint8_t version;
+	uint16_t id;
+	uint8_t received[256 / 8];
+};
+
+struct dvb_section_pid {
+	struct dvb_section_filter *filters;
+	int raw;
+
+	int cc;
+	int in_sect, skip;
+	size_t len;
+
+	struct dvb_section_version *versions;
+	unsigned num_versions;
+
+	uint8_t buf[DVB_MAX_PAYLOAD_PACKET_SIZE];
+};
+
+struct dvb_section_demux {
+	struct dvb_v5_fe_parms_priv *parms;
+	struct dvb_section_demux_stats stats;
+	unsigned pending;
+
+	struct dvb_section_pid *pid[DVB_MPEG_TS_NUM_PIDS];
+};
+
+struct dvb_section_demux *dvb_section_demux_alloc(struct dvb_v5_fe_parms *parms)
+{
+	struct dvb_section_demux *demux;
+
+	demux = calloc(1, sizeof(*demux));
+	if (!demux)
+		return NULL;
+	demux->parms = (void *)parms;
+
+	return demux;
+}
+
+void dvb_section_demux_remove_pid(struct dvb_section_demux *demux,
+				  uint16_t pid)
+{
+	struct dvb_section_pid *ps;
+	struct dvb_section_filter *f, *next;
+
+	if (pid >= DVB_MPEG_TS_NUM_PIDS || !demux->pid[pid])
+		return;
+	ps = demux->pid[pid];
+
+	for (f = ps->filters; f; f = next) {
+		next = f->next;
+		if (f->sect) {
+			dvb_table_filter_free(f->sect);
+			if (!f->done)
+				demux->pending--;
+		}
+		free(f);
+	}
+	free(ps->versions);
+	free(ps);
+	demux->pid[pid] = NULL;
+}
+
+void dvb_section_demux_free(struct dvb_section_demux *demux)
+{
+	unsigned pid;
+
+	if (!demux)
+		return;
+
+	for (pid = 0; pid < DVB_MPEG_TS_NUM_PIDS; pid++)
+		dvb_section_demux_remove_pid(demux, pid);
+	free(demux);
+}
+
+static struct dvb_section_filter *dvb_section_add(struct dvb_section_demux *demux,
+						  uint16_t pid)
+{
+	struct dvb_section_pid *ps;
+	struct dvb_section_filter *f, **last;
+
+	if (pid >= DVB_MPEG_TS_NUM_PIDS)
+		return NULL;
+
+	ps = demux->pid[pid];
+	if (!ps) {
+		ps = calloc(1, sizeof(*ps));
+		if (!ps)
+			return NULL;
+		ps->cc = -1;
+		demux->pid[pid] = ps;
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	for (last = &ps->filters; *last; last = &(*last)->next);
+	*last = f;
+
+	return f;
+}
+
+int dvb_section_demux_add_table(struct dvb_section_demux *demux,
+				struct dvb_table_filter *sect)
+{
+	struct dvb_v5_fe_parms_priv *parms = demux->parms;
+	struct dvb_section_filter *f;
+	int ret;
+
+	ret = dvb_parse_section_alloc(parms, sect);
+	if (ret < 0)
+		return ret;
+
+	f = dvb_section_add(demux, sect->pid);
+	if (!f) {
+		dvb_table_filter_free(sect);
+		return -ENOMEM;
+	}
+	f->table_id = sect->tid;
+	f->mask = 0xff;
+	f->sect = sect;
+	demux->pending++;
+
+	return 0;
+}
+
+int dvb_section_demux_add_handler(struct dvb_section_demux *demux,
+				  uint16_t pid, uint8_t table_id,
+				  uint8_t mask, unsigned flags,
+				  dvb_section_handler_t *handler, void *priv)
+{
+	struct dvb_section_filter *f;
+
+	f = dvb_section_add(demux, pid);
+	if (!f)
+		return -ENOMEM;
+	f->table_id = table_id;
+	f->mask = mask;
+	f->flags = flags;
+	f->handler = handler;
+	f->priv = priv;
+	if (flags & DVB_SECTION_RAW)
+		demux->pid[pid]->raw = 1;
+
+	return 0;
+}
+
+int dvb_section_demux_is_done(struct dvb_section_demux *demux)
+{
+	return !demux->pending;
+}
+
+const struct dvb_section_demux_stats *
+dvb_section_demux_get_stats(struct dvb_section_demux *demux)
+{
+	return &demux->stats;
+}
+
+/*
+ * Version tracking. Only the long sections have a version, and the ones
+ * not yet applicable are never stored.
+ */
+
+static struct dvb_section_version *dvb_section_find_version(struct dvb_section_pid *ps,
+							    const uint8_t *buf)
+{
+	uint16_t id = buf[3] << 8 | buf[4];
+	unsigned i;
+
+	for (i = 0; i < ps->num_versions; i++) {
+		if (ps->versions[i].table_id == buf[0] &&
+		    ps->versions[i].id == id)
+			return &ps->versions[i];
+	}
+
+	return NULL;
+}
+
+static int dvb_section_is_dup(struct dvb_section_pid *ps, const uint8_t *buf)
+{
+	struct dvb_section_version *v;
+
+	if (!(buf[1] & 0x80))
+		return 0;
+
+	v = dvb_section_find_version(ps, buf);
+
+	return v && v->version == ((buf[5] >> 1) & 0x1f) &&
+	       (v->received[buf[6] >> 3] & (1 << (buf[6] & 7)));
+}
+
+static void dvb_section_mark(struct dvb_section_demux *demux,
+			     struct dvb_section_pid *ps, const uint8_t *buf)
+{
+	struct dvb_section_version *v;
+	uint8_t version = (buf[5] >> 1) & 0x1f;
+
+	v = dvb_section_find_version(ps, buf);
+	if (!v) {
+		v = realloc(ps->versions, sizeof(*v) * (ps->num_versions + 1));
+		if (!v)
+			return;
+		ps->versions = v;
+		v += ps->num_versions++;
+		memset(v, 0, sizeof(*v));
+		v->table_id = buf[0];
+		v->id = buf[3] << 8 | buf[4];
+		v->version = version;
+	} else if (v->version != version) {
+		demux->stats.version_changes++;
+		memset(v->received, 0, sizeof(v->received));
+		v->version = version;
+	}
+	v->received[buf[6] >> 3] |= 1 << (buf[6] & 7);
+}
+
+static void dvb_section_done(struct dvb_section_demux *demux, uint16_t pid,
+			     struct dvb_section_pid *ps)
+{
+	struct dvb_v5_fe_parms_priv *parms = demux->parms;
+	const uint8_t *buf = ps->buf;
+	struct dvb_section_filter *f;
+	int checked = 0, ok = 0, passed = 0;
+
+	if (ps->skip) {
+		demux->stats.duplicates++;
+		return;
+	}
+
+	for (f = ps->filters; f; f = f->next) {
+		if (f->done || ((buf[0] ^ f->table_id) & f->mask))
+			continue;
+
+		if (!(f->flags & DVB_SECTION_RAW)) {
+			if (!checked) {
+				checked = 1;
+				if (dvb_section_is_dup(ps, buf)) {
+					demux->stats.duplicates++;
+				} else if ((buf[1] & 0x80) &&
+					   dvb_crc32((uint8_t *)buf, ps->len, 0xFFFFFFFF)) {
+					demux->stats.crc_errors++;
+				} else if (!(buf[1] & 0x80) || (buf[5] & 0x01)) {
+					ok = 1;
+				}
+			}
+			if (!ok)
+				continue;
+		}
+
+		passed = 1;
+		if (f->handler) {
+			f->handler(f->priv, pid, buf, ps->len);
+			continue;
+		}
+		if (dvb_parse_section(parms, f->sect, buf, ps->len) > 0) {
+			f->done = 1;
+			demux->pending--;
+		}
+	}
+
+	if (ok && (buf[1] & 0x80))
+		dvb_section_mark(demux, ps, buf);
+	if (passed)
+		demux->stats.sections++;
+}
+
+/* Adds data to the section being assembled. Returns how much was used */
+static size_t dvb_section_data(struct dvb_section_demux *demux, uint16_t pid,
+			       struct dvb_section_pid *ps,
+			       const uint8_t *data, size_t len)
+{
+	size_t size = 0, want, n, used = 0;
+
+	while (used < len) {
+		if (ps->len < 3) {
+			want = 3;
+		} else {
+			size = 3 + (((ps->buf[1] & 0x0f) << 8) | ps->buf[2]);
+			if (size > sizeof(ps->buf)) {
+				demux->stats.lost++;
+				ps->in_sect = 0;
+				return len;
+			}
+			want = size;
+			if (ps->len < DVB_SECTION_HEADER_SIZE &&
+			    size > DVB_SECTION_HEADER_SIZE)
+				want = DVB_SECTION_HEADER_SIZE;
+		}
+
+		n = want - ps->len;
+		if (n > len - used)
+			n = len - used;
+		if (!ps->skip)
+			memcpy(ps->buf + ps->len, data + used, n);
+		ps->len += n;
+		used += n;
+		if (ps->len < want)
+			break;
+
+		if (ps->len < 3)
+			continue;
+		if (ps->len == size) {
+			ps->in_sect = 0;
+			dvb_section_done(demux, pid, ps);
+			break;
+		}
+		if (ps->len == DVB_SECTION_HEADER_SIZE && !ps->raw)
+			ps->skip = dvb_section_is_dup(ps, ps->buf);
+	}
+
+	return used;
+}
+
+static void dvb_section_lost(struct dvb_section_demux *demux,
+			     struct dvb_section_pid *ps)
+{
+	if (ps->in_sect)
+		demux->stats.lost++;
+	ps->in_sect = 0;
+}
+
+static void dvb_section_packet(struct dvb_section_demux *demux, uint16_t pid,
+			       struct dvb_section_pid *ps, const uint8_t *p)
+{
+	const uint8_t *end = p + DVB_MPEG_TS_PACKET_SIZE;
+	const uint8_t *payload = p + 4;
+	int cc = p[3] & 0x0f;
+	unsigned pointer;
+
+	demux->stats.packets++;
+
+	/* The header of a packet with errors can't be trusted */
+	if (p[1] & 0x80) {
+		dvb_section_lost(demux, ps);
+		ps->cc = -1;
+		return;
+	}
+	if (!(p[3] & 0x10))
+		return;
+	if (p[3] & 0x20)
+		payload += 1 + p[4];
+	if (payload >= end)
+		return;
+
+	if (ps->cc >= 0) {
+		/* A packet may be sent twice, with the same counter */
+		if (cc == ps->cc)
+			return;
+		if (cc != ((ps->cc + 1) & 0x0f))
+			dvb_section_lost(demux, ps);
+	}
+	ps->cc = cc;
+
+	if (!(p[1] & 0x40)) {
+		if (ps->in_sect)
+			dvb_section_data(demux, pid, ps, payload, end - payload);
+		return;
+	}
+
+	/* The pointer field tells where the next section starts */
+	pointer = *payload++;
+	if (payload + pointer > end) {
+		dvb_section_lost(demux, ps);
+		return;
+	}
+	if (ps->in_sect) {
+		dvb_section_data(demux, pid, ps, payload, pointer);
+		dvb_section_lost(demux, ps);
+	}
+	payload += pointer;
+
+	/* Several sections may start on a packet. 0xff is stuffing */
+	while (payload < end && *payload != 0xff) {
+		ps->in_sect = 1;
+		ps->skip = 0;
+		ps->len = 0;
+		payload += dvb_section_data(demux, pid, ps, payload,
+					    end - payload);
+		if (ps->in_sect)
+			break;
+	}
+}
+
+ssize_t dvb_section_demux_feed(struct dvb_section_demux *demux,
+			       const uint8_t *buf, ssize_t buflen)
+{
+	const uint8_t *p = buf, *end = buf + buflen, *sync;
+	struct dvb_section_pid *ps;
+	uint16_t pid;
+
+	while (end - p >= DVB_MPEG_TS_PACKET_SIZE) {
+		if (p[0] == DVB_MPEG_TS) {
+			pid = (p[1] & 0x1f) << 8 | p[2];
+			ps = demux->pid[pid];
+			if (ps)
+				dvb_section_packet(demux, pid, ps, p);
+			p += DVB_MPEG_TS_PACKET_SIZE;
+			continue;
+		}
+
+		/*
+		 * Lost sync: seek for the next sync byte that is followed by
+		 * another one a packet later, if it is in the buffer.
+		 */
+		for (sync = p + 1; sync < end; sync++) {
+			sync = memchr(sync, DVB_MPEG_TS, end - sync);
+			if (!sync || end - sync <= DVB_MPEG_TS_PACKET_SIZE ||
+			    sync[DVB_MPEG_TS_PACKET_SIZE] == DVB_MPEG_TS)
+				break;
+		}
+		p = sync ? sync : end;
+	}
+
+	return p - buf;
+}
@@ -28,6 +28,8 @@
 #include <strings.h> /* strcasecmp */
 
 #include <parse_string.h>
+#include "dvb-fe-priv.h"
+#include "dvb-arena-priv.h"
 #include <libdvbv5/dvb-log.h>
 #include <libdvbv5/dvb-fe.h>
 
@@ -298,20 +300,106 @@ static struct charset_conv en300468_latin_00_to_utf8[256] = {
 	[0xff] = { 2, {0xc2, 0xad, } },
 };
 
-void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
+/*
+ * iconv_open() looks for the gconv modules on each call, so the last used
+ * conversions are kept open
+ */
+static iconv_t dvb_iconv_open(struct dvb_v5_fe_parms_priv *parms,
+			      char *input_charset, char *output_charset)
+{
+	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
+	struct dvb_iconv_cache *cache;
+	iconv_t cd;
+	int i;
+
+	for (i = 0; i < DVB_ICONV_CACHE_SIZE; i++) {
+		cache = &parms->iconv_cache[i];
+		if (cache->input_charset[0] &&
+		    !strcasecmp(cache->input_charset, input_charset) &&
+		    !strcasecmp(cache->output_charset, output_charset)) {
+			/* Reset the shift state left by the last string */
+			iconv(cache->cd, NULL, NULL, NULL, NULL);
+			return cache->cd;
+		}
+	}
+
+	strcpy(out_cs, output_charset);
+	strcat(out_cs, CS_OPTIONS);
+
+	cd = iconv_open(out_cs, input_charset);
+	if (cd == (iconv_t)(-1))
+		return cd;
+
+	if (strlen(input_charset) >= sizeof(cache->input_charset) ||
+	    strlen(output_charset) >= sizeof(cache->output_charset))
+		return cd;
+
+	cache = &parms->iconv_cache[parms->iconv_cache_next];
+	parms->iconv_cache_next = (parms->iconv_cache_next + 1) % DVB_ICONV_CACHE_SIZE;
+	if (cache->input_charset[0])
+		iconv_close(cache->cd);
+	strcpy(cache->input_charset, input_charset);
+	strcpy(cache->output_charset, output_charset);
+	cache->cd = cd;
+
+	return cd;
+}
+
+static void dvb_iconv_close(struct dvb_v5_fe_parms_priv *parms, iconv_t cd)
+{
+	int i;
+
+	for (i = 0; i < DVB_ICONV_CACHE_SIZE; i++)
+		if (parms->iconv_cache[i].input_charset[0] &&
+		    parms->iconv_cache[i].cd == cd)
+			return;
+	iconv_close(cd);
+}
+
+void dvb_iconv_cache_free(struct dvb_v5_fe_parms_priv *parms)
+{
+	int i;
+
+	for (i = 0; i < DVB_ICONV_CACHE_SIZE; i++) {
+		if (parms->iconv_cache[i].input_charset[0])
+			iconv_close(parms->iconv_cache[i].cd);
+		parms->iconv_cache[i].input_charset[0] = '\0';
+	}
+}
+
+/* Charsets where the bytes below 0x80 are the same as in ASCII */
+static int is_ascii_compatible(const char *charset)
+{
+	return !strncasecmp(charset, "ISO-8859", 8) ||
+	       !strcasecmp(charset, "UTF-8") ||
+	       !strcasecmp(charset, "ISO-10646/UTF-8");
+}
+
+void dvb_iconv_to_charset(struct dvb_v5_fe_parms *__p,
 			  char *dest,
 			  size_t destlen,
 			  const unsigned char *src,
 			  size_t len,
 			  char *input_charset, char *output_charset)
 {
-	char out_cs[strlen(output_charset) + 1 + sizeof(CS_OPTIONS)];
+	struct dvb_v5_fe_parms_priv *parms = (void *)__p;
 	char *p = dest;
+	size_t i;
 
-	strcpy(out_cs, output_charset);
-	strcat(out_cs, CS_OPTIONS);
+	/* Pure ASCII strings don't need any conversion */
+	if (len <= destlen && is_ascii_compatible(input_charset) &&
+	    is_ascii_compatible(output_charset)) {
+		for (i = 0; i < len; i++)
+			if (src[i] >= 0x80 || !src[i])
+				break;
+		if (i == len) {
+			memcpy(p, src, len);
+			p[len] = '\0';
+			return;
+		}
+	}
 
-	iconv_t cd = iconv_open(out_cs, input_charset);
+	iconv_t cd = dvb_iconv_open(parms, input_charset, output_charset);
 	if (cd == (iconv_t)(-1)) {
 		memcpy(p, src, len);
 		p[len] = '\0';
@@ -321,7 +409,7 @@ void dvb_iconv_to_charset(struct dvb_v5_fe_parms *parms,
 			dvb_log("Try setting GCONV_PATH to the bundled gconv dir.\n");
 	} else {
 		iconv(cd, (ICONV_CONST char **)&src, &len, &p, &destlen);
-		iconv_close(cd);
+		dvb_iconv_close(parms, cd);
 		*p = '\0';
 	}
 }
@@ -351,7 +439,7 @@ static void charset_conversion(struct dvb_v5_fe_parms *parms, char **dest, const
 			tmp = (unsigned char *)*dest;
 			len = p - *dest;
 
-			*dest = malloc(destlen + 1);
+			*dest = dvb_mem_alloc(parms, destlen + 1);
 			input_charset = "UTF-8";
 			s = tmp;
 		} else
@@ -376,11 +464,11 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	int emphasis = 0;
 
 	if (*dest) {
-		free(*dest);
+		dvb_mem_free(parms, *dest);
 		*dest = NULL;
 	}
 	if (*emph) {
-		free(*emph);
+		dvb_mem_free(parms, *emph);
 		*emph = NULL;
 	}
 	if (!len)
@@ -441,8 +529,8 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	 * use 3 chars for one code, use it for destlen
 	 */
 	destlen = len * 3;
-	*dest = malloc(destlen + 1);
-	*emph = malloc(destlen + 1);
+	*dest = dvb_mem_alloc(parms, destlen + 1);
+	*emph = dvb_mem_alloc(parms, destlen + 1);
 
 	/* Remove special chars */
 	if (!strncasecmp(type, "ISO-8859", 8) || !strcasecmp(type, "ISO-6937") || !strcasecmp(type, "ISO-10646/UTF-8")) {
@@ -519,18 +607,18 @@ void dvb_parse_string(struct dvb_v5_fe_parms *parms, char **dest, char **emph,
 	charset_conversion(parms, dest, s, len, type);
 	/* The code had over-sized the space. Fix it. */
 	if (*dest)
-		*dest = realloc(*dest, strlen(*dest) + 1);
+		*dest = dvb_mem_realloc(parms, *dest, strlen(*dest) + 1);
 
 	if (!len2) {
 		if (tmp2) {
 			free (tmp2);
 			tmp2 = NULL;
 		}
-		free (*emph);
+		dvb_mem_free(parms, *emph);
 		*emph = NULL;
 	} else {
 		charset_conversion(parms, emph, tmp2, len2, type);
-		*emph = realloc(*emph, strlen(*emph) + 1);
+		*emph = dvb_mem_realloc(parms, *emph, strlen(*emph) + 1);
 	}
 
 	if (tmp1)
@@ -20,6 +20,7 @@
 #include <libdvbv5/cat.h>
 #include <libdvbv5/descriptors.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -47,7 +48,7 @@ ssize_t dvb_table_cat_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_cat), 1);
+		*table = dvb_mem_calloc(parms, sizeof(struct dvb_table_cat), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
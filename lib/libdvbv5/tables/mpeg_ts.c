@@ -80,3 +80,116 @@ void dvb_mpeg_ts_print(struct dvb_v5_fe_parms *parms, struct dvb_mpeg_ts *ts)
                 dvb_loginfo("   - extension      %d", ts->adaption->extension);
 	}
 }
+
+void dvb_mpeg_ts_stats_reset(struct dvb_mpeg_ts_stats *stats)
+{
+	int pid;
+
+	memset(stats, 0, sizeof(*stats));
+	for (pid = 0; pid < DVB_MPEG_TS_NUM_PIDS; pid++)
+		stats->pid[pid].last_cc = -1;
+}
+
+static inline void dvb_mpeg_ts_count(struct dvb_mpeg_ts_stats *stats,
+				     const uint8_t *p, int check_cc)
+{
+	unsigned int pid = (p[1] & 0x1f) << 8 | p[2];
+	unsigned int cc = p[3] & 0x0f;
+	struct dvb_mpeg_ts_pid_stats *s = &stats->pid[pid];
+	int8_t last_cc = s->last_cc;
+
+	s->packets++;
+
+	/* The header of a packet with errors can't be trusted */
+	if (p[1] & 0x80) {
+		s->tei_errors++;
+		stats->tei_errors++;
+		s->last_cc = -1;
+		return;
+	}
+
+	/*
+	 * The continuity counter is only incremented on packets with
+	 * payload, and NULL packets don't have a valid one.
+	 */
+	if (pid == DVB_MPEG_TS_NULL_PID || !(p[3] & 0x10))
+		return;
+
+	s->last_cc = cc;
+
+	/* Skip packets with the discontinuity indicator */
+	if ((p[3] & 0x20) && p[4] && (p[5] & 0x80))
+		return;
+
+	/* A packet may be sent twice, with the same counter */
+	if (check_cc && last_cc >= 0 && cc != last_cc &&
+	    cc != ((last_cc + 1) & 0x0f)) {
+		s->cc_errors++;
+		stats->cc_errors++;
+	}
+}
+
+/*
+ * The sync bytes of a batch of packets are checked at once, and only
+ * when one of them is wrong the packets are checked one by one. As the
+ * headers are DVB_MPEG_TS_PACKET_SIZE bytes apart, they can't be loaded
+ * into a vector register at once, so the batches just avoid a branch
+ * per packet.
+ */
+#define DVB_MPEG_TS_BATCH	8
+
+static inline int dvb_mpeg_ts_batch_in_sync(const uint8_t *p)
+{
+	uint8_t diff = 0;
+	int i;
+
+	for (i = 0; i < DVB_MPEG_TS_BATCH; i++)
+		diff |= p[i * DVB_MPEG_TS_PACKET_SIZE] ^ DVB_MPEG_TS;
+
+	return !diff;
+}
+
+ssize_t dvb_mpeg_ts_stats_update(struct dvb_mpeg_ts_stats *stats,
+				 const uint8_t *buf, ssize_t buflen,
+				 int check_cc)
+{
+	const uint8_t *p = buf, *end = buf + buflen, *sync;
+	int i;
+
+	while (end - p >= DVB_MPEG_TS_PACKET_SIZE) {
+		if (end - p >= DVB_MPEG_TS_BATCH * DVB_MPEG_TS_PACKET_SIZE &&
+		    dvb_mpeg_ts_batch_in_sync(p)) {
+			for (i = 0; i < DVB_MPEG_TS_BATCH; i++)
+				dvb_mpeg_ts_count(stats, p + i * DVB_MPEG_TS_PACKET_SIZE,
+						  check_cc);
+			stats->packets += DVB_MPEG_TS_BATCH;
+			p += DVB_MPEG_TS_BATCH * DVB_MPEG_TS_PACKET_SIZE;
+			continue;
+		}
+
+		if (p[0] == DVB_MPEG_TS) {
+			dvb_mpeg_ts_count(stats, p, check_cc);
+			stats->packets++;
+			p += DVB_MPEG_TS_PACKET_SIZE;
+			continue;
+		}
+
+		/*
+		 * Lost sync: seek for the next sync byte that is followed by
+		 * another one a packet later, if it is in the buffer.
+		 */
+		stats->resyncs++;
+		for (sync = p + 1; sync < end; sync++) {
+			sync = memchr(sync, DVB_MPEG_TS, end - sync);
+			if (!sync || end - sync <= DVB_MPEG_TS_PACKET_SIZE ||
+			    sync[DVB_MPEG_TS_PACKET_SIZE] == DVB_MPEG_TS)
+				break;
+		}
+		if (!sync)
+			sync = end;
+		stats->discarded += sync - p;
+		p = sync;
+	}
+
+	return p - buf;
+}
@@ -20,6 +20,7 @@
 
 #include <libdvbv5/nit.h>
 #include <libdvbv5/dvb-fe.h>
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -48,7 +49,7 @@ ssize_t dvb_table_nit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_nit), 1);
+		*table = dvb_mem_calloc(parms, sizeof(struct dvb_table_nit), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -92,7 +93,7 @@ ssize_t dvb_table_nit_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_nit_transport *transport;
 
-		transport = malloc(sizeof(struct dvb_table_nit_transport));
+		transport = dvb_mem_alloc(parms, sizeof(struct dvb_table_nit_transport));
 		if (!transport) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -7;
@@ -172,6 +173,8 @@ void dvb_table_nit_descriptor_handler(
 	if (call_nit || parms->verbose) {
 		dvb_desc_find(struct dvb_desc, desc, nit,
 			      descriptor) {
+			if (!dvb_desc_decode(parms, desc))
+				continue;
 			if (call_nit)
 				call_nit(nit, desc, priv);
 			else
@@ -186,6 +189,8 @@ void dvb_table_nit_descriptor_handler(
 	dvb_nit_transport_foreach(tran, nit) {
 		dvb_desc_find(struct dvb_desc, desc, tran,
 			      descriptor) {
+			if (!dvb_desc_decode(parms, desc))
+				continue;
 			if (call_tran)
 				call_tran(nit, tran, desc, priv);
 			else
@@ -23,6 +23,7 @@
 #include <libdvbv5/dvb-fe.h>
 
 #include <string.h> /* memcpy */
+#include <dvb-arena-priv.h>
 
 #if __GNUC__ >= 9
 #pragma GCC diagnostic ignored "-Waddress-of-packed-member"
@@ -51,7 +52,7 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	}
 
 	if (!*table) {
-		*table = calloc(sizeof(struct dvb_table_pmt), 1);
+		*table = dvb_mem_calloc(parms, sizeof(struct dvb_table_pmt), 1);
 		if (!*table) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -3;
@@ -100,7 +101,7 @@ ssize_t dvb_table_pmt_init(struct dvb_v5_fe_parms *parms, const uint8_t *buf,
 	while (p + size <= endbuf) {
 		struct dvb_table_pmt_stream *stream;
 
-		stream = malloc(sizeof(struct dvb_table_pmt_stream));
+		stream = dvb_mem_alloc(parms, sizeof(struct dvb_table_pmt_stream));
 		if (!stream) {
 			dvb_logerr("%s: out of memory", __func__);
 			return -5;
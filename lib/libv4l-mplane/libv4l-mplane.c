@@ -102,6 +102,10 @@ static void *plugin_init(int fd)
 	if (!plugin.mplane)
 		return NULL;
 
+	/* libv4l2 handles multi-planar capture only devices natively */
+	if (!plugin.mplane_output)
+		return NULL;
+
 	/* Allocate and initialize private data */
 	ret_plugin = calloc(1, sizeof(*ret_plugin));
 	if (!ret_plugin) {
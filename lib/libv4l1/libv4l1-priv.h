@@ -72,6 +72,12 @@ struct v4l1_dev_info {
 	unsigned int min_width, min_height, max_width, max_height;
 	unsigned int width, height;
 	unsigned char *v4l1_frame_pointer;
+	/* 1 if the frames are mapped onto the driver buffers, -1 if that is
+	   not possible for the current format, see v4l1_frames_map() */
+	int v4l1_frames_mapped;
+	int v4l1_frames_streaming;
+	unsigned int v4l1_frame_length[V4L1_NO_FRAMES];
+	unsigned char v4l1_frame_state[V4L1_NO_FRAMES];
 };
 
 /* From log.c */
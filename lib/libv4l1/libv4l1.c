@@ -71,6 +71,11 @@
 #define V4L1_PIX_FMT_TOUCHED    0x04
 #define V4L1_PIX_SIZE_TOUCHED   0x08
 
+/* v4l1_frame_state values of the frames mapped onto driver buffers */
+#define V4L1_FRAME_IDLE         0
+#define V4L1_FRAME_QUEUED       1
+#define V4L1_FRAME_DONE         2
+
 static pthread_mutex_t v4l1_open_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct v4l1_dev_info devices[V4L1_MAX_DEVICES] = {
 	{ .fd = -1 },
@@ -158,6 +163,145 @@ static int count_inputs(int fd)
 	return i;
 }
 
+/* Stop streaming into the driver buffers and put anonymous memory back
+   under the frames, as the application may still have them mapped. */
+static void v4l1_frames_unmap(int index)
+{
+	struct v4l2_requestbuffers req = {
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	int i;
+
+	if (devices[index].v4l1_frames_streaming)
+		v4l2_ioctl(devices[index].fd, VIDIOC_STREAMOFF, &type);
+	devices[index].v4l1_frames_streaming = 0;
+
+	for (i = 0; i < V4L1_NO_FRAMES; i++) {
+		if (!devices[index].v4l1_frame_length[i])
+			continue;
+		SYS_MMAP(devices[index].v4l1_frame_pointer + i * V4L1_FRAME_BUF_SIZE,
+				devices[index].v4l1_frame_length[i],
+				PROT_READ | PROT_WRITE,
+				MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+		devices[index].v4l1_frame_length[i] = 0;
+		devices[index].v4l1_frame_state[i] = V4L1_FRAME_IDLE;
+	}
+	if (devices[index].v4l1_frames_mapped)
+		v4l2_ioctl(devices[index].fd, VIDIOC_REQBUFS, &req);
+	devices[index].v4l1_frames_mapped = 0;
+}
+
+/* VIDIOCMCAPTURE / VIDIOCSYNC used to read() each frame into the v4l1
+   buffer. If libv4l2 passes the driver buffers through unchanged, the
+   frames of the v4l1 buffer are mapped onto them instead, so capturing a
+   frame is just queueing and dequeueing it. If libv4l2 converts or
+   processes the frames, it does so straight into the buffer passed to
+   read(), so then that is kept. */
+static int v4l1_frames_map(int index)
+{
+	struct v4l2_requestbuffers req = {
+		.count = V4L1_NO_FRAMES,
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	int fd = devices[index].fd;
+	int i;
+
+	if (devices[index].v4l1_frames_mapped)
+		return devices[index].v4l1_frames_mapped > 0 ? 0 : -1;
+
+	devices[index].v4l1_frames_mapped = 1;
+	if (v4l2_ioctl(fd, VIDIOC_REQBUFS, &req) || req.count != V4L1_NO_FRAMES)
+		goto fail;
+
+	for (i = 0; i < V4L1_NO_FRAMES; i++) {
+		struct v4l2_buffer buf = {
+			.index = i,
+			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			.memory = V4L2_MEMORY_MMAP,
+		};
+		struct v4l2_buffer drv_buf = buf;
+		void *frame = devices[index].v4l1_frame_pointer +
+			i * V4L1_FRAME_BUF_SIZE;
+
+		if (v4l2_ioctl(fd, VIDIOC_QUERYBUF, &buf) ||
+				SYS_IOCTL(fd, VIDIOC_QUERYBUF, &drv_buf))
+			goto fail;
+		/* libv4l2 hands out its own buffers when it converts */
+		if (buf.m.offset != drv_buf.m.offset ||
+				buf.length > V4L1_FRAME_BUF_SIZE)
+			goto fail;
+		if ((void *)SYS_MMAP(frame, buf.length, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_FIXED, fd, buf.m.offset) == MAP_FAILED)
+			goto fail;
+		devices[index].v4l1_frame_length[i] = buf.length;
+	}
+	V4L1_LOG("v4l1 frames mapped onto the driver buffers\n");
+	return 0;
+
+fail:
+	V4L1_LOG("v4l1 frames cannot be mapped, using read()\n");
+	v4l1_frames_unmap(index);
+	devices[index].v4l1_frames_mapped = -1;
+	return -1;
+}
+
+static int v4l1_frame_capture(int index, int frame)
+{
+	struct v4l2_buffer buf = {
+		.index = frame,
+		.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+	if (devices[index].v4l1_frame_state[frame] == V4L1_FRAME_QUEUED) {
+		errno = EBUSY;
+		return -1;
+	}
+	if (v4l2_ioctl(devices[index].fd, VIDIOC_QBUF, &buf))
+		goto fail;
+	devices[index].v4l1_frame_state[frame] = V4L1_FRAME_QUEUED;
+	if (!devices[index].v4l1_frames_streaming) {
+		if (v4l2_ioctl(devices[index].fd, VIDIOC_STREAMON, &type))
+			goto fail;
+		devices[index].v4l1_frames_streaming = 1;
+	}
+	return 0;
+
+fail:
+	/* VIDIOCSYNC will read() the frame instead */
+	V4L1_LOG("error queueing v4l1 frame: %s, using read()\n", strerror(errno));
+	v4l1_frames_unmap(index);
+	devices[index].v4l1_frames_mapped = -1;
+	return 0;
+}
+
+static int v4l1_frame_sync(int index, int frame)
+{
+	if (devices[index].v4l1_frame_state[frame] == V4L1_FRAME_IDLE) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* The frames may complete in another order than they were queued */
+	while (devices[index].v4l1_frame_state[frame] == V4L1_FRAME_QUEUED) {
+		struct v4l2_buffer buf = {
+			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
+			.memory = V4L2_MEMORY_MMAP,
+		};
+		int result = v4l2_ioctl(devices[index].fd, VIDIOC_DQBUF, &buf);
+
+		if (result)
+			return result;
+		if (buf.index < V4L1_NO_FRAMES)
+			devices[index].v4l1_frame_state[buf.index] = V4L1_FRAME_DONE;
+	}
+	devices[index].v4l1_frame_state[frame] = V4L1_FRAME_IDLE;
+	return 0;
+}
+
 static int v4l1_set_format(int index, unsigned int width,
 		unsigned int height, int v4l1_pal, int width_height_may_differ)
 {
@@ -222,6 +366,9 @@ static int v4l1_set_format(int index, unsigned int width,
 		return 0;
 	}
 
+	/* The driver buffers cannot be kept when the format changes */
+	v4l1_frames_unmap(index);
+
 	result = v4l2_ioctl(devices[index].fd, VIDIOC_S_FMT, &fmt2);
 	if (result) {
 		int saved_err = errno;
@@ -383,6 +530,12 @@ int v4l1_open(const char *file, int oflag, ...)
 	devices[index].open_count = 1;
 	devices[index].v4l1_frame_buf_map_count = 0;
 	devices[index].v4l1_frame_pointer = MAP_FAILED;
+	devices[index].v4l1_frames_mapped = 0;
+	devices[index].v4l1_frames_streaming = 0;
+	memset(devices[index].v4l1_frame_length, 0,
+			sizeof(devices[index].v4l1_frame_length));
+	memset(devices[index].v4l1_frame_state, 0,
+			sizeof(devices[index].v4l1_frame_state));
 	devices[index].width  = fmt2.fmt.pix.width;
 	devices[index].height = fmt2.fmt.pix.height;
 	devices[index].v4l2_pixfmt = fmt2.fmt.pix.pixelformat;
@@ -444,6 +597,7 @@ int v4l1_close(int fd)
 		return v4l2_close(fd);
 
 	/* Free resources */
+	v4l1_frames_unmap(index);
 	if (devices[index].v4l1_frame_pointer != MAP_FAILED) {
 		if (devices[index].v4l1_frame_buf_map_count)
 			V4L1_LOG("v4l1 capture buffer still mapped: %d times on close()\n",
@@ -774,6 +928,12 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 
 		result = v4l1_set_format(index, map->width, map->height,
 				map->format, 0);
+		if (result || devices[index].v4l1_frame_pointer == MAP_FAILED ||
+				map->frame >= V4L1_NO_FRAMES ||
+				v4l1_frames_map(index))
+			break;
+
+		result = v4l1_frame_capture(index, map->frame);
 		break;
 	}
 
@@ -787,6 +947,11 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 			break;
 		}
 
+		if (devices[index].v4l1_frames_mapped > 0) {
+			result = v4l1_frame_sync(index, *frame_index);
+			break;
+		}
+
 		result = v4l2_read(devices[index].fd,
 				devices[index].v4l1_frame_pointer +
 				*frame_index * V4L1_FRAME_BUF_SIZE,
@@ -805,6 +970,7 @@ int v4l1_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOC_S_FMT: {
 		struct v4l2_format *fmt2 = arg;
 
+		v4l1_frames_unmap(index);
 		result = v4l2_ioctl(fd, request, arg);
 
 		if (result == 0 && fmt2->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
@@ -1200,6 +1366,8 @@ ssize_t v4l1_read(int fd, void *buffer, size_t n)
 		return SYS_READ(fd, buffer, n);
 
 	pthread_mutex_lock(&devices[index].stream_lock);
+	/* read() needs the driver buffers for itself */
+	v4l1_frames_unmap(index);
 	result = v4l2_read(fd, buffer, n);
 	pthread_mutex_unlock(&devices[index].stream_lock);
 
@@ -6,6 +6,7 @@ LOCAL_SRC_FILES := \
     log.c \
     libv4l2.c \
     v4l2convert.c \
+    v4l2-mplane.c \
     v4l2-plugin-android.c
 
 LOCAL_CFLAGS += -Wno-missing-field-initializers
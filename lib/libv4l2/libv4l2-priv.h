@@ -25,11 +25,14 @@
 
 #include "../libv4lconvert/libv4lsyscall-priv.h"
 
-#define V4L2_MAX_DEVICES 16
-/* Warning when making this larger the frame_queued and frame_mapped members of
-   the v4l2_dev_info struct can no longer be a bitfield, so the code needs to
-   be adjusted! */
-#define V4L2_MAX_NO_FRAMES 32
+/* Initial size of the fd indexed device table, it grows as needed */
+#define V4L2_MIN_DEVICES_SIZE 64
+/* The per frame bookkeeping gets allocated for the number of frames the
+   driver returns from REQBUFS, but the frame_queued, app_queued and
+   async_free members of the v4l2_dev_info struct are 64 bit bitfields, so
+   REQBUFS counts get limited to this */
+#define V4L2_MAX_NO_FRAMES 64
+#define V4L2_FRAME_BIT(i) (1ULL << (i))
 #define V4L2_DEFAULT_NREADBUFFERS 4
 #define V4L2_IGNORE_FIRST_FRAME_ERRORS 3
 #define V4L2_DEFAULT_FPS 30
@@ -46,7 +49,7 @@
 #define V4L2_PERROR(format, ...)		\
 	do { 					\
 		if (errno == ENODEV) {		\
-			devices[index].gone = 1;\
+			dev->gone = 1;	\
 			break;			\
 		}				\
 		V4L2_LOG_ERR(format ": %s\n", ##__VA_ARGS__, strerror(errno)); \
@@ -81,7 +84,13 @@ struct v4l2_dev_info {
 	struct v4l2_format src_fmt;
 	/* fmt as seen by the application (iow after conversion) */
 	struct v4l2_format dest_fmt;
-	pthread_mutex_t stream_lock;
+	/* Lock order: stream_lock, fmt_lock. Conversion is done with only the
+	   stream_lock held, so format queries and controls never wait for it */
+	pthread_mutex_t stream_lock; /* buffer and streaming state */
+	pthread_mutex_t fmt_lock; /* libv4lconvert format negotiation, the
+				     formats get changed with both held */
+	pthread_mutex_t control_lock; /* libv4lconvert controls */
+	int stream_touched; /* atomic, set by the first stream ioctl */
 	unsigned int no_frames;
 	unsigned int nreadbuffers;
 	int fps;
@@ -90,16 +99,56 @@ struct v4l2_dev_info {
 	unsigned char *convert_mmap_buf;
 	size_t convert_mmap_buf_size;
 	size_t convert_mmap_frame_size;
-	/* Frame bookkeeping is only done when in read or mmap-conversion mode */
-	unsigned char *frame_pointers[V4L2_MAX_NO_FRAMES];
-	int frame_sizes[V4L2_MAX_NO_FRAMES];
-	int frame_queued; /* 1 status bit per frame */
+	/* Frame bookkeeping is only done when in read or mmap-conversion mode.
+	   All the per frame arrays have room for frames_size frames, which
+	   grows with no_frames, see v4l2_set_no_frames() */
+	unsigned int frames_size;
+	unsigned char **frame_pointers;
+	int *frame_sizes;
+	unsigned long long frame_queued; /* 1 status bit per frame */
+	/* Multi-planar only devices, see v4l2-mplane.c. The other planes of
+	   each frame get mapped separately (plane 0 is frame_pointers[x]) and
+	   are gathered into gather_buf for conversion */
+	int mplane;
+	unsigned int src_planes; /* number of planes of src_fmt */
+	unsigned char *(*plane_pointers)[VIDEO_MAX_PLANES];
+	unsigned int (*plane_sizes)[VIDEO_MAX_PLANES];
+	unsigned char *gather_buf;
+	unsigned int gather_buf_size;
 	int frame_info_generation;
 	/* mapping tracking of our fake (converting mmap) frame buffers */
-	unsigned char frame_map_count[V4L2_MAX_NO_FRAMES];
+	unsigned char *frame_map_count;
+	/* When converting to app supplied USERPTR / DMABUF buffers, the driver's
+	   buffers are always MMAP ones and these track the app's buffers */
+	unsigned int memory; /* V4L2_MEMORY_ type of the app's buffers */
+	unsigned long *app_userptr;
+	int *app_dmabuf_fd;
+	unsigned long long *app_dmabuf_ino;
+	unsigned int *app_length;
+	unsigned char **app_dmabuf_map; /* cached mapping */
+	size_t *app_dmabuf_map_size;
 	/* buffer when doing conversion and using read() for read() */
 	int readbuf_size;
 	unsigned char *readbuf;
+	/* frame statistics, the libv4lconvert part is kept by libv4lconvert */
+	struct v4l2_frame_stats stats;
+	int stats_interval;
+	long long last_sequence; /* -1 when not known */
+	/* background conversion (V4L2_ENABLE_ASYNC_CONVERSION) */
+	pthread_t async_thread;
+	pthread_cond_t async_cond; /* signalled when a frame is ready */
+	int async_started; /* the thread still needs to be joined */
+	int async_running; /* the thread is still converting frames */
+	int async_quit;
+	int async_wake[2]; /* pipe to wake up the thread when quitting */
+	int async_error; /* errno to return from the next DQBUF */
+	int async_errors; /* consecutive conversion errors */
+	unsigned long long app_queued; /* 1 bit per frame queued and not yet dequeued by the app */
+	unsigned long long async_free; /* 1 bit per app frame free for the thread to convert into */
+	unsigned char *ready; /* fifo of converted frames */
+	unsigned int ready_first;
+	unsigned int ready_count;
+	struct v4l2_buffer *ready_bufs;
 	/* plugin info */
 	void *plugin_library;
 	void *dev_ops_priv;
@@ -126,6 +175,17 @@ static inline void v4l2_plugin_cleanup(void *plugin_lib, void *plugin_priv,
 }
 #endif /* WITH_V4L_PLUGINS */
 
+/* From v4l2-mplane.c */
+int v4l2_mplane_wrap(const struct v4l2_capability *cap,
+		     const struct libv4l_dev_ops **dev_ops, void **dev_ops_priv);
+void v4l2_mplane_unwrap(const struct libv4l_dev_ops **dev_ops,
+			void **dev_ops_priv);
+int v4l2_mplane_buf_ioctl(void *dev_ops_priv, int fd, unsigned long int request,
+			  struct v4l2_buffer *buf, struct v4l2_plane *planes);
+unsigned int v4l2_mplane_num_planes(void *dev_ops_priv);
+unsigned int v4l2_mplane_plane_size(const struct v4l2_pix_format *pix,
+				    unsigned int plane);
+
 /* From log.c */
 extern const char *v4l2_ioctls[];
 void v4l2_log_ioctl(unsigned long int request, void *arg, int result);
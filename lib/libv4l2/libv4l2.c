@@ -60,14 +60,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#if defined(__has_include)
+#if __has_include(<linux/dma-buf.h>)
+#include <linux/dma-buf.h>
+#endif
+#endif
 #include "libv4l2.h"
 #include "libv4l2-priv.h"
 #include "libv4l-plugin.h"
+#include "usdt.h"
 
 /* Note these flags are stored together with the flags passed to v4l2_fd_open()
    in v4l2_dev_info's flags member, so care should be taken that the do not
@@ -76,7 +84,6 @@
 #define V4L2_BUFFERS_REQUESTED_BY_READ	0x0200
 #define V4L2_STREAM_CONTROLLED_BY_READ	0x0400
 #define V4L2_SUPPORTS_READ		0x0800
-#define V4L2_STREAM_TOUCHED		0x1000
 #define V4L2_USE_READ_FOR_READ		0x2000
 #define V4L2_SUPPORTS_TIMEPERFRAME	0x4000
 
@@ -85,33 +92,144 @@
 static void v4l2_adjust_src_fmt_to_fps(int index, int fps);
 static void v4l2_set_src_and_dest_format(int index,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt);
-
+static int v4l2_async_conversion(int index);
+static int v4l2_async_streamon(int index);
+static void v4l2_async_stop(int index);
+
+/* Our device info, indexed by fd. This gets looked up on every call, also
+   for fds which are not ours, so lookups are done without locking. This
+   works because entries are never freed, on close their fd gets set to -1
+   and they get reused when the same fd gets opened again, and because the
+   table only grows by publishing a larger copy. Old copies get leaked on
+   purpose, as other threads may still be using them, since the size at
+   least doubles each time this wastes less than the size of the table.
+   The table only gets modified with v4l2_open_mutex held. */
 static pthread_mutex_t v4l2_open_mutex = PTHREAD_MUTEX_INITIALIZER;
-static struct v4l2_dev_info devices[V4L2_MAX_DEVICES] = {
-	{ .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 },
-	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
-};
-static int devices_used;
+static struct v4l2_dev_info **devices;
+static int devices_size;
+static int devices_used; /* highest fd ever registered + 1 */
+
+/* Only valid for indexes returned by v4l2_get_index() / v4l2_alloc_index() */
+static struct v4l2_dev_info *v4l2_dev(int index)
+{
+	struct v4l2_dev_info **table = __atomic_load_n(&devices, __ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&table[index], __ATOMIC_ACQUIRE);
+}
+
+static unsigned long long v4l2_stats_time(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	struct timespec ts;
+
+	if (!(dev->flags & V4L2_ENABLE_FRAME_STATS))
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Adds the time passed since start to *stat and returns the current time */
+static unsigned long long v4l2_stats_add(int index, unsigned long long *stat,
+		unsigned long long start)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned long long now;
+
+	if (!(dev->flags & V4L2_ENABLE_FRAME_STATS))
+		return 0;
+
+	now = v4l2_stats_time(index);
+	*stat += now - start;
+	return now;
+}
+
+static void v4l2_stats_convert_done(int index, unsigned long long start)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned long long now;
+
+	if (!(dev->flags & V4L2_ENABLE_FRAME_STATS))
+		return;
+
+	now = v4l2_stats_time(index);
+	if (now - start > dev->stats.max_convert_ns)
+		dev->stats.max_convert_ns = now - start;
+}
+
+static void v4l2_stats_sequence(int index, const struct v4l2_buffer *buf)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if (dev->last_sequence >= 0 &&
+	    buf->sequence > dev->last_sequence + 1)
+		dev->stats.dropped +=
+			buf->sequence - dev->last_sequence - 1;
+	dev->last_sequence = buf->sequence;
+}
+
+static void v4l2_get_stats(int index, struct v4l2_frame_stats *stats)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	struct v4lconvert_stats convert_stats;
+
+	*stats = dev->stats;
+	if (!dev->convert)
+		return;
+
+	v4lconvert_get_stats(dev->convert, &convert_stats);
+	stats->decode_errors = convert_stats.errors;
+	stats->decode_ns = convert_stats.decode_ns;
+	stats->convert_ns = convert_stats.convert_ns;
+	stats->processing_ns = convert_stats.processing_ns;
+	stats->transform_ns = convert_stats.transform_ns;
+}
+
+static void v4l2_stats_frame_done(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	struct v4l2_frame_stats stats;
+
+	dev->stats.frames++;
+
+	if (!v4l2_log_file || !dev->stats_interval ||
+	    dev->stats.frames % dev->stats_interval)
+		return;
+
+	v4l2_get_stats(index, &stats);
+	V4L2_LOG("frame stats fd %d: frames %llu dropped %llu retries %llu "
+		 "decode errors %llu short %llu, avg us: dequeue %llu "
+		 "decode %llu convert %llu processing %llu transform %llu, "
+		 "max convert us %llu\n", dev->fd,
+		 stats.frames, stats.dropped, stats.retries,
+		 stats.decode_errors, stats.short_frames,
+		 stats.dequeue_ns / stats.frames / 1000,
+		 stats.decode_ns / stats.frames / 1000,
+		 stats.convert_ns / stats.frames / 1000,
+		 stats.processing_ns / stats.frames / 1000,
+		 stats.transform_ns / stats.frames / 1000,
+		 stats.max_convert_ns / 1000);
+}
 
 static int v4l2_ensure_convert_mmap_buf(int index)
 {
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if (dev->convert_mmap_buf != MAP_FAILED) {
 		return 0;
 	}
 
-	devices[index].convert_mmap_buf_size =
-		devices[index].convert_mmap_frame_size * devices[index].no_frames;
+	dev->convert_mmap_buf_size =
+		dev->convert_mmap_frame_size * dev->no_frames;
 
-	devices[index].convert_mmap_buf = (void *)SYS_MMAP(NULL,
-			devices[index].convert_mmap_buf_size,
+	dev->convert_mmap_buf = (void *)SYS_MMAP(NULL,
+			dev->convert_mmap_buf_size,
 			PROT_READ | PROT_WRITE,
 			MAP_ANONYMOUS | MAP_PRIVATE,
 			-1, 0);
 
-	if (devices[index].convert_mmap_buf == MAP_FAILED) {
-		devices[index].convert_mmap_buf_size = 0;
+	if (dev->convert_mmap_buf == MAP_FAILED) {
+		dev->convert_mmap_buf_size = 0;
 
 		int saved_err = errno;
 		V4L2_LOG_ERR("allocating conversion buffer\n");
@@ -122,19 +240,119 @@ static int v4l2_ensure_convert_mmap_buf(int index)
 	return 0;
 }
 
+/* Makes room in the per frame bookkeeping for count frames and sets
+   no_frames. The bookkeeping only grows, it gets freed on close. */
+static int v4l2_set_no_frames(int index, unsigned int count)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned int i, p;
+
+	if (count > V4L2_MAX_NO_FRAMES) {
+		V4L2_LOG_WARN("only using %d of %u buffers\n",
+			      V4L2_MAX_NO_FRAMES, count);
+		count = V4L2_MAX_NO_FRAMES;
+	}
+
+	if (count > dev->frames_size) {
+#define V4L2_GROW_FRAMES(array) \
+		do { \
+			void *new_array = realloc(dev->array, \
+					count * sizeof(*dev->array)); \
+			if (!new_array) { \
+				V4L2_LOG_ERR("allocating frame info for %u buffers\n", \
+					     count); \
+				errno = ENOMEM; \
+				return -1; \
+			} \
+			dev->array = new_array; \
+		} while (0)
+		V4L2_GROW_FRAMES(frame_pointers);
+		V4L2_GROW_FRAMES(frame_sizes);
+		V4L2_GROW_FRAMES(plane_pointers);
+		V4L2_GROW_FRAMES(plane_sizes);
+		V4L2_GROW_FRAMES(frame_map_count);
+		V4L2_GROW_FRAMES(app_userptr);
+		V4L2_GROW_FRAMES(app_dmabuf_fd);
+		V4L2_GROW_FRAMES(app_dmabuf_ino);
+		V4L2_GROW_FRAMES(app_length);
+		V4L2_GROW_FRAMES(app_dmabuf_map);
+		V4L2_GROW_FRAMES(app_dmabuf_map_size);
+		V4L2_GROW_FRAMES(ready);
+		V4L2_GROW_FRAMES(ready_bufs);
+#undef V4L2_GROW_FRAMES
+
+		for (i = dev->frames_size; i < count; i++) {
+			dev->frame_pointers[i] = MAP_FAILED;
+			dev->frame_sizes[i] = 0;
+			for (p = 0; p < VIDEO_MAX_PLANES; p++) {
+				dev->plane_pointers[i][p] = MAP_FAILED;
+				dev->plane_sizes[i][p] = 0;
+			}
+			dev->frame_map_count[i] = 0;
+			dev->app_userptr[i] = 0;
+			dev->app_dmabuf_fd[i] = -1;
+			dev->app_dmabuf_ino[i] = 0;
+			dev->app_length[i] = 0;
+			dev->app_dmabuf_map[i] = MAP_FAILED;
+			dev->app_dmabuf_map_size[i] = 0;
+		}
+		dev->frames_size = count;
+		/* The fifo wraps at frames_size, it is empty when not streaming */
+		dev->ready_first = 0;
+	}
+
+	dev->no_frames = count;
+	return 0;
+}
+
+static void v4l2_free_frames(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	free(dev->frame_pointers);
+	free(dev->frame_sizes);
+	free(dev->plane_pointers);
+	free(dev->plane_sizes);
+	free(dev->frame_map_count);
+	free(dev->app_userptr);
+	free(dev->app_dmabuf_fd);
+	free(dev->app_dmabuf_ino);
+	free(dev->app_length);
+	free(dev->app_dmabuf_map);
+	free(dev->app_dmabuf_map_size);
+	free(dev->ready);
+	free(dev->ready_bufs);
+	dev->frame_pointers = NULL;
+	dev->frame_sizes = NULL;
+	dev->plane_pointers = NULL;
+	dev->plane_sizes = NULL;
+	dev->frame_map_count = NULL;
+	dev->app_userptr = NULL;
+	dev->app_dmabuf_fd = NULL;
+	dev->app_dmabuf_ino = NULL;
+	dev->app_length = NULL;
+	dev->app_dmabuf_map = NULL;
+	dev->app_dmabuf_map_size = NULL;
+	dev->ready = NULL;
+	dev->ready_bufs = NULL;
+	dev->frames_size = 0;
+	dev->no_frames = 0;
+}
+
 static int v4l2_request_read_buffers(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result;
 	struct v4l2_requestbuffers req;
 
 	/* Note we re-request the buffers if they are already requested as the format
 	   and thus the needed buffer size may have changed. */
-	req.count = (devices[index].no_frames) ? devices[index].no_frames :
-		devices[index].nreadbuffers;
+	req.count = (dev->no_frames) ? dev->no_frames :
+		dev->nreadbuffers;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req);
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_REQBUFS, &req);
 	if (result < 0) {
 		int saved_err = errno;
 
@@ -143,19 +361,30 @@ static int v4l2_request_read_buffers(int index)
 		return result;
 	}
 
-	if (!devices[index].no_frames && req.count)
-		devices[index].flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
+	if (!dev->no_frames && req.count)
+		dev->flags |= V4L2_BUFFERS_REQUESTED_BY_READ;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	return 0;
+	result = v4l2_set_no_frames(index, req.count);
+	if (result) {
+		int saved_err = errno;
+
+		req.count = 0;
+		dev->dev_ops->ioctl(dev->dev_ops_priv,
+				dev->fd, VIDIOC_REQBUFS, &req);
+		dev->no_frames = 0;
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+		errno = saved_err;
+	}
+	return result;
 }
 
 static void v4l2_unrequest_read_buffers(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	struct v4l2_requestbuffers req;
 
-	if (!(devices[index].flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
-			devices[index].no_frames == 0)
+	if (!(dev->flags & V4L2_BUFFERS_REQUESTED_BY_READ) ||
+			dev->no_frames == 0)
 		return;
 
 	/* (Un)Request buffers, note not all driver support this, and those
@@ -163,32 +392,49 @@ static void v4l2_unrequest_read_buffers(int index)
 	req.count = 0;
 	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	req.memory = V4L2_MEMORY_MMAP;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_REQBUFS, &req) < 0)
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_REQBUFS, &req) < 0)
 		return;
 
-	devices[index].no_frames = MIN(req.count, V4L2_MAX_NO_FRAMES);
-	if (devices[index].no_frames == 0)
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+	if (v4l2_set_no_frames(index, req.count))
+		dev->no_frames = 0;
+	if (dev->no_frames == 0)
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+}
+
+/* Buffer ioctls on the driver's own buffers, multi-planar devices get a
+   real multi-planar buffer, planes then receives the info of all planes */
+static int v4l2_driver_buf_ioctl(int index, unsigned long int request,
+		struct v4l2_buffer *buf, struct v4l2_plane *planes)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if (dev->mplane)
+		return v4l2_mplane_buf_ioctl(dev->dev_ops_priv,
+				dev->fd, request, buf, planes);
+
+	return dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, request, buf);
 }
 
 static int v4l2_map_buffers(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result = 0;
-	unsigned int i;
+	unsigned int i, p;
 	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
 
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED)
+	for (i = 0; i < dev->no_frames; i++) {
+		if (dev->frame_pointers[i] != MAP_FAILED)
 			continue;
 
 		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 		buf.memory = V4L2_MEMORY_MMAP;
 		buf.index = i;
 		buf.reserved = buf.reserved2 = 0;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_QUERYBUF, &buf);
+		result = v4l2_driver_buf_ioctl(index, VIDIOC_QUERYBUF, &buf,
+					       planes);
 		if (result) {
 			int saved_err = errno;
 
@@ -197,10 +443,32 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 
-		devices[index].frame_pointers[i] = (void *)SYS_MMAP(NULL,
-				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, devices[index].fd,
+		/* Map the other planes first, frame_pointers marks the frame
+		   as mapped */
+		for (p = 1; p < dev->src_planes && !result; p++) {
+			if (dev->plane_pointers[i][p] != MAP_FAILED)
+				continue;
+
+			dev->plane_pointers[i][p] = (void *)SYS_MMAP(NULL,
+					(size_t)planes[p].length, PROT_READ | PROT_WRITE,
+					MAP_SHARED, dev->fd,
+					planes[p].m.mem_offset);
+			if (dev->plane_pointers[i][p] == MAP_FAILED) {
+				int saved_err = errno;
+
+				V4L2_PERROR("mmapping buffer %u plane %u", i, p);
+				errno = saved_err;
+				result = -1;
+			}
+			dev->plane_sizes[i][p] = planes[p].length;
+		}
+		if (result)
+			break;
+
+		dev->frame_pointers[i] = (void *)SYS_MMAP(NULL,
+				(size_t)buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd,
 				buf.m.offset);
-		if (devices[index].frame_pointers[i] == MAP_FAILED) {
+		if (dev->frame_pointers[i] == MAP_FAILED) {
 			int saved_err = errno;
 
 			V4L2_PERROR("mmapping buffer %u", i);
@@ -209,9 +477,23 @@ static int v4l2_map_buffers(int index)
 			break;
 		}
 		V4L2_LOG("mapped buffer %u at %p\n", i,
-				devices[index].frame_pointers[i]);
+				dev->frame_pointers[i]);
 
-		devices[index].frame_sizes[i] = buf.length;
+		dev->frame_sizes[i] = buf.length;
+	}
+
+	/* The planes of multi-planar frames get gathered for conversion */
+	if (!result && dev->src_planes > 1 &&
+	    !dev->gather_buf) {
+		dev->gather_buf_size =
+			dev->src_fmt.fmt.pix.sizeimage;
+		dev->gather_buf =
+			malloc(dev->gather_buf_size);
+		if (!dev->gather_buf) {
+			V4L2_LOG_ERR("allocating plane gather buffer\n");
+			errno = ENOMEM;
+			result = -1;
+		}
 	}
 
 	return result;
@@ -219,28 +501,41 @@ static int v4l2_map_buffers(int index)
 
 static void v4l2_unmap_buffers(int index)
 {
-	unsigned int i;
-
-	/* unmap the buffers */
-	for (i = 0; i < devices[index].no_frames; i++) {
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
-			SYS_MUNMAP(devices[index].frame_pointers[i],
-					devices[index].frame_sizes[i]);
-			devices[index].frame_pointers[i] = MAP_FAILED;
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned int i, p;
+
+	/* unmap the buffers, also those of an earlier, larger, REQBUFS */
+	for (i = 0; i < dev->frames_size; i++) {
+		if (dev->frame_pointers[i] != MAP_FAILED) {
+			SYS_MUNMAP(dev->frame_pointers[i],
+					dev->frame_sizes[i]);
+			dev->frame_pointers[i] = MAP_FAILED;
 			V4L2_LOG("unmapped buffer %u\n", i);
 		}
+		for (p = 1; p < VIDEO_MAX_PLANES; p++) {
+			if (dev->plane_pointers[i][p] != MAP_FAILED) {
+				SYS_MUNMAP(dev->plane_pointers[i][p],
+						dev->plane_sizes[i][p]);
+				dev->plane_pointers[i][p] = MAP_FAILED;
+			}
+		}
 	}
+
+	free(dev->gather_buf);
+	dev->gather_buf = NULL;
+	dev->gather_buf_size = 0;
 }
 
 static int v4l2_streamon(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (!(devices[index].flags & V4L2_STREAMON)) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMON, &type);
+	if (!(dev->flags & V4L2_STREAMON)) {
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_STREAMON, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -248,8 +543,9 @@ static int v4l2_streamon(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags |= V4L2_STREAMON;
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->flags |= V4L2_STREAMON;
+		dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->last_sequence = -1;
 	}
 
 	return 0;
@@ -257,13 +553,14 @@ static int v4l2_streamon(int index)
 
 static int v4l2_streamoff(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result;
 	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	if (devices[index].flags & V4L2_STREAMON) {
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_STREAMOFF, &type);
+	if (dev->flags & V4L2_STREAMON) {
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
+				dev->fd, VIDIOC_STREAMOFF, &type);
 		if (result) {
 			int saved_err = errno;
 
@@ -271,10 +568,10 @@ static int v4l2_streamoff(int index)
 			errno = saved_err;
 			return result;
 		}
-		devices[index].flags &= ~V4L2_STREAMON;
+		dev->flags &= ~V4L2_STREAMON;
 
 		/* Stream off also dequeues all our buffers! */
-		devices[index].frame_queued = 0;
+		dev->frame_queued = 0;
 	}
 
 	return 0;
@@ -282,18 +579,19 @@ static int v4l2_streamoff(int index)
 
 static int v4l2_queue_read_buffer(int index, int buffer_index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result;
 	struct v4l2_buffer buf;
 
-	if (devices[index].frame_queued & (1 << buffer_index))
+	if (dev->frame_queued & V4L2_FRAME_BIT(buffer_index))
 		return 0;
 
 	memset(&buf, 0, sizeof(buf));
 	buf.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	buf.memory = V4L2_MEMORY_MMAP;
 	buf.index  = buffer_index;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_QBUF, &buf);
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_QBUF, &buf);
 	if (result) {
 		int saved_err = errno;
 
@@ -302,28 +600,241 @@ static int v4l2_queue_read_buffer(int index, int buffer_index)
 		return result;
 	}
 
-	devices[index].frame_queued |= 1 << buffer_index;
+	dev->frame_queued |= V4L2_FRAME_BIT(buffer_index);
 	return 0;
 }
 
-static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
+/* Is the app's buffer i still queued (so it may not be queued again)? */
+static int v4l2_app_buffer_queued(int index, unsigned int i)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	struct v4l2_buffer buf;
+
+	if (dev->flags & V4L2_ENABLE_ASYNC_CONVERSION)
+		return (dev->app_queued & V4L2_FRAME_BIT(i)) != 0;
+
+	/* Without the conversion thread the driver's buffer i is the app's */
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = i;
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_QUERYBUF, &buf))
+		return 0; /* Let the QBUF fail */
+
+	return (buf.flags & (V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE)) != 0;
+}
+
+/* Remember the app's buffer to convert into when converting to USERPTR or
+   DMABUF buffers */
+static int v4l2_set_app_buffer(int index, struct v4l2_buffer *buf)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned int i = buf->index, length = buf->length;
+
+	if (buf->memory != dev->memory ||
+	    i >= dev->no_frames ||
+	    v4l2_app_buffer_queued(index, i)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (buf->memory == V4L2_MEMORY_USERPTR) {
+		if (!buf->m.userptr) {
+			errno = EINVAL;
+			return -1;
+		}
+		dev->app_userptr[i] = buf->m.userptr;
+	} else {
+		struct stat st;
+
+		if (fstat(buf->m.fd, &st))
+			return -1;
+
+		/* A length of 0 means the whole dmabuf */
+		if (!length) {
+			off_t size = lseek(buf->m.fd, 0, SEEK_END);
+
+			if (size > 0)
+				length = size;
+		}
+
+		/* Drop our mapping if this is a different dmabuf */
+		if (dev->app_dmabuf_map[i] != MAP_FAILED &&
+		    (dev->app_dmabuf_fd[i] != buf->m.fd ||
+		     dev->app_dmabuf_ino[i] != st.st_ino ||
+		     dev->app_dmabuf_map_size[i] != length)) {
+			SYS_MUNMAP(dev->app_dmabuf_map[i],
+				   dev->app_dmabuf_map_size[i]);
+			dev->app_dmabuf_map[i] = MAP_FAILED;
+		}
+		dev->app_dmabuf_fd[i] = buf->m.fd;
+		dev->app_dmabuf_ino[i] = st.st_ino;
+	}
+
+	if (length < dev->dest_fmt.fmt.pix.sizeimage) {
+		V4L2_LOG_ERR("buffer %u too small for the converted frame: %u < %u\n",
+			     i, length, dev->dest_fmt.fmt.pix.sizeimage);
+		errno = EINVAL;
+		return -1;
+	}
+	dev->app_length[i] = length;
+
+	return 0;
+}
+
+static void v4l2_unmap_app_buffers(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned int i;
+
+	for (i = 0; i < dev->frames_size; i++) {
+		if (dev->app_dmabuf_map[i] != MAP_FAILED)
+			SYS_MUNMAP(dev->app_dmabuf_map[i],
+				   dev->app_dmabuf_map_size[i]);
+		dev->app_dmabuf_map[i] = MAP_FAILED;
+		dev->app_dmabuf_fd[i] = -1;
+		dev->app_userptr[i] = 0;
+		dev->app_length[i] = 0;
+	}
+}
+
+/* Returns where the converted frame for the app's buffer frame goes, or
+   NULL if the app's dmabuf could not be mapped */
+static unsigned char *v4l2_frame_dest(int index, unsigned int frame,
+		int *dest_size)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	switch (dev->memory) {
+	case V4L2_MEMORY_USERPTR:
+		*dest_size = dev->app_length[frame];
+		return (unsigned char *)dev->app_userptr[frame];
+
+	case V4L2_MEMORY_DMABUF:
+		if (dev->app_dmabuf_map[frame] == MAP_FAILED) {
+			dev->app_dmabuf_map_size[frame] =
+				dev->app_length[frame];
+			dev->app_dmabuf_map[frame] = (void *)SYS_MMAP(
+				NULL, dev->app_dmabuf_map_size[frame],
+				PROT_READ | PROT_WRITE, MAP_SHARED,
+				dev->app_dmabuf_fd[frame], 0);
+			if (dev->app_dmabuf_map[frame] == MAP_FAILED) {
+				int saved_err = errno;
+
+				V4L2_LOG_ERR("mmapping dmabuf of buffer %u: %s\n",
+					     frame, strerror(errno));
+				errno = saved_err;
+				return NULL;
+			}
+		}
+		*dest_size = dev->app_dmabuf_map_size[frame];
+		return dev->app_dmabuf_map[frame];
+
+	default:
+		*dest_size = dev->convert_mmap_frame_size;
+		return dev->convert_mmap_buf +
+			frame * dev->convert_mmap_frame_size;
+	}
+}
+
+/* Returns the dmabuf fd to pass to v4l2_dmabuf_sync() for frame, or -1 */
+static int v4l2_frame_dmabuf(int index, unsigned int frame)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if (dev->memory != V4L2_MEMORY_DMABUF)
+		return -1;
+
+	return dev->app_dmabuf_fd[frame];
+}
+
+/* Brackets CPU writes to an app's dmabuf, so that caches get handled */
+static void v4l2_dmabuf_sync(int dmabuf_fd, int end)
+{
+#ifdef DMA_BUF_IOCTL_SYNC
+	struct dma_buf_sync sync = {
+		.flags = DMA_BUF_SYNC_WRITE |
+			 (end ? DMA_BUF_SYNC_END : DMA_BUF_SYNC_START),
+	};
+
+	if (dmabuf_fd != -1)
+		SYS_IOCTL(dmabuf_fd, DMA_BUF_IOCTL_SYNC, &sync);
+#endif
+}
+
+/* Returns the data to convert of the driver buffer dequeued into buf, for
+   multi-planar frames this gathers the planes into one contiguous frame */
+static unsigned char *v4l2_frame_src(int index, struct v4l2_buffer *buf,
+		struct v4l2_plane *planes, int *size)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned int p, offset = 0, plane_size, used;
+	unsigned char *src;
+
+	*size = buf->bytesused;
+	if (!dev->mplane)
+		return dev->frame_pointers[buf->index];
+
+	if (dev->src_planes == 1) {
+		if (planes[0].data_offset > planes[0].bytesused)
+			planes[0].data_offset = planes[0].bytesused;
+		*size = planes[0].bytesused - planes[0].data_offset;
+		return dev->frame_pointers[buf->index] +
+		       planes[0].data_offset;
+	}
+
+	for (p = 0; p < dev->src_planes; p++) {
+		src = p ? dev->plane_pointers[buf->index][p] :
+			  dev->frame_pointers[buf->index];
+		plane_size = v4l2_mplane_plane_size(
+				&dev->src_fmt.fmt.pix, p);
+		if (plane_size > dev->gather_buf_size - offset)
+			plane_size = dev->gather_buf_size - offset;
+		used = 0;
+		if (planes[p].bytesused > planes[p].data_offset)
+			used = planes[p].bytesused - planes[p].data_offset;
+		used = MIN(used, plane_size);
+		memcpy(dev->gather_buf + offset,
+		       src + planes[p].data_offset, used);
+		offset += used;
+		/* A short plane makes for a short frame */
+		if (used < plane_size)
+			break;
+	}
+	*size = offset;
+
+	return dev->gather_buf;
+}
+
+static int v4l2_do_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 		unsigned char *dest, int dest_size)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
-	int result, tries = max_tries, frame_info_gen;
+	int result, tries = max_tries, frame_info_gen, frame_size, dmabuf_fd;
+	int src_size;
+	unsigned long long stats_time;
+	unsigned char *src, *frame_dest;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
 
 	/* Make sure we have the real v4l2 buffers mapped */
 	result = v4l2_map_buffers(index);
 	if (result)
 		return result;
 
+	/* The driver's buffers are MMAP ones, whatever the app uses */
+	buf->memory = V4L2_MEMORY_MMAP;
+
 	do {
-		frame_info_gen = devices[index].frame_info_generation;
-		pthread_mutex_unlock(&devices[index].stream_lock);
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
-				devices[index].fd, VIDIOC_DQBUF, buf);
-		pthread_mutex_lock(&devices[index].stream_lock);
+		frame_info_gen = dev->frame_info_generation;
+		stats_time = v4l2_stats_time(index);
+		pthread_mutex_unlock(&dev->stream_lock);
+		result = v4l2_driver_buf_ioctl(index, VIDIOC_DQBUF, buf,
+					       planes);
+		pthread_mutex_lock(&dev->stream_lock);
+		stats_time = v4l2_stats_add(index,
+				&dev->stats.dequeue_ns, stats_time);
 		if (result) {
 			if (errno != EAGAIN) {
 				int saved_err = errno;
@@ -334,27 +845,51 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			return result;
 		}
 
-		devices[index].frame_queued &= ~(1 << buf->index);
+		dev->frame_queued &= ~V4L2_FRAME_BIT(buf->index);
 
-		if (frame_info_gen != devices[index].frame_info_generation) {
+		if (frame_info_gen != dev->frame_info_generation) {
 			errno = -EINVAL;
 			return -1;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].frame_pointers[buf->index],
-				buf->bytesused, dest ? dest : (devices[index].convert_mmap_buf +
-					buf->index * devices[index].convert_mmap_frame_size),
-				dest_size);
+		v4l2_stats_sequence(index, buf);
 
-		if (devices[index].first_frame) {
+		frame_dest = dest;
+		frame_size = dest_size;
+		dmabuf_fd = -1;
+		if (!dest) {
+			frame_dest = v4l2_frame_dest(index, buf->index,
+						     &frame_size);
+			dmabuf_fd = v4l2_frame_dmabuf(index, buf->index);
+			if (!frame_dest) {
+				int saved_err = errno;
+
+				v4l2_queue_read_buffer(index, buf->index);
+				errno = saved_err;
+				return -1;
+			}
+		}
+
+		src = v4l2_frame_src(index, buf, planes, &src_size);
+		v4l2_dmabuf_sync(dmabuf_fd, 0);
+		result = v4lconvert_convert(dev->convert,
+				&dev->src_fmt, &dev->dest_fmt,
+				src, src_size, frame_dest, frame_size);
+		if (dmabuf_fd != -1) {
+			int saved_err = errno;
+
+			v4l2_dmabuf_sync(dmabuf_fd, 1);
+			errno = saved_err;
+		}
+		v4l2_stats_convert_done(index, stats_time);
+
+		if (dev->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			dev->first_frame--;
 		}
 
 		if (result < 0) {
@@ -362,10 +897,10 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 
 			/*
 			 * If this is the last try, and the frame is short
@@ -374,6 +909,8 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 			 */
 			if (!(tries == 1 && errno == EPIPE))
 				v4l2_queue_read_buffer(index, buf->index);
+			if ((errno == EAGAIN || errno == EPIPE) && tries > 1)
+				dev->stats.retries++;
 			errno = saved_err;
 		}
 		tries--;
@@ -381,43 +918,65 @@ static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(dev->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = dev->dest_fmt.fmt.pix.sizeimage;
+		dev->stats.short_frames++;
 		errno = 0;
 	}
 
+	if (result >= 0)
+		v4l2_stats_frame_done(index);
+
+	return result;
+}
+
+static int v4l2_dequeue_and_convert(int index, struct v4l2_buffer *buf,
+		unsigned char *dest, int dest_size)
+{
+	int result;
+
+	USDT(libv4l2, dequeue_and_convert_start, v4l2_dev(index)->fd);
+	result = v4l2_do_dequeue_and_convert(index, buf, dest, dest_size);
+	USDT(libv4l2, dequeue_and_convert_end, v4l2_dev(index)->fd,
+	     result, result < 0 ? errno : buf->index);
+
 	return result;
 }
 
 static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
 	int result, buf_size, tries = max_tries;
+	unsigned long long stats_time;
 
-	buf_size = devices[index].dest_fmt.fmt.pix.sizeimage;
+	buf_size = dev->dest_fmt.fmt.pix.sizeimage;
 
-	if (devices[index].readbuf_size < buf_size) {
+	if (dev->readbuf_size < buf_size) {
 		unsigned char *new_buf;
 
-		new_buf = realloc(devices[index].readbuf, buf_size);
+		new_buf = realloc(dev->readbuf, buf_size);
 		if (!new_buf)
 			return -1;
 
-		devices[index].readbuf = new_buf;
-		devices[index].readbuf_size = buf_size;
+		dev->readbuf = new_buf;
+		dev->readbuf_size = buf_size;
 	}
 
 	do {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
-				devices[index].fd, devices[index].readbuf,
+		stats_time = v4l2_stats_time(index);
+		result = dev->dev_ops->read(
+				dev->dev_ops_priv,
+				dev->fd, dev->readbuf,
 				buf_size);
+		stats_time = v4l2_stats_add(index,
+				&dev->stats.dequeue_ns, stats_time);
 		if (result <= 0) {
 			if (result && errno != EAGAIN) {
 				int saved_err = errno;
@@ -428,17 +987,18 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 			return result;
 		}
 
-		result = v4lconvert_convert(devices[index].convert,
-				&devices[index].src_fmt, &devices[index].dest_fmt,
-				devices[index].readbuf, result, dest, dest_size);
+		result = v4lconvert_convert(dev->convert,
+				&dev->src_fmt, &dev->dest_fmt,
+				dev->readbuf, result, dest, dest_size);
+		v4l2_stats_convert_done(index, stats_time);
 
-		if (devices[index].first_frame) {
+		if (dev->first_frame) {
 			/* Always treat convert errors as EAGAIN during the first few frames, as
 			   some cams produce bad frames at the start of the stream
 			   (hsync and vsync still syncing ??). */
 			if (result < 0)
 				errno = EAGAIN;
-			devices[index].first_frame--;
+			dev->first_frame--;
 		}
 
 		if (result < 0) {
@@ -446,11 +1006,13 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 			if (errno == EAGAIN || errno == EPIPE)
 				V4L2_LOG("warning error while converting frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 			else
 				V4L2_LOG_ERR("converting / decoding frame data: %s",
-						v4lconvert_get_error_message(devices[index].convert));
+						v4lconvert_get_error_message(dev->convert));
 
+			if ((errno == EAGAIN || errno == EPIPE) && tries > 1)
+				dev->stats.retries++;
 			errno = saved_err;
 		}
 		tries--;
@@ -458,28 +1020,33 @@ static int v4l2_read_and_convert(int index, unsigned char *dest, int dest_size)
 
 	if (result < 0 && errno == EAGAIN) {
 		V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
-				max_tries, v4lconvert_get_error_message(devices[index].convert));
+				max_tries, v4lconvert_get_error_message(dev->convert));
 		errno = EIO;
 	}
 
 	if (result < 0 && errno == EPIPE) {
 		V4L2_LOG("got %d consecutive short frame errors, "
 			 "returning short frame", max_tries);
-		result = devices[index].dest_fmt.fmt.pix.sizeimage;
+		result = dev->dest_fmt.fmt.pix.sizeimage;
+		dev->stats.short_frames++;
 		errno = 0;
 	}
 
+	if (result >= 0)
+		v4l2_stats_frame_done(index);
+
 	return result;
 }
 
 static int v4l2_queue_read_buffers(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	unsigned int i;
 	int last_error = EIO, queued = 0;
 
-	for (i = 0; i < devices[index].no_frames; i++) {
+	for (i = 0; i < dev->no_frames; i++) {
 		/* Don't queue unmapped buffers (should never happen) */
-		if (devices[index].frame_pointers[i] != MAP_FAILED) {
+		if (dev->frame_pointers[i] != MAP_FAILED) {
 			if (v4l2_queue_read_buffer(index, i)) {
 				last_error = errno;
 				continue;
@@ -497,9 +1064,10 @@ static int v4l2_queue_read_buffers(int index)
 
 static int v4l2_activate_read_stream(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result;
 
-	if ((devices[index].flags & V4L2_STREAMON) || devices[index].frame_queued) {
+	if ((dev->flags & V4L2_STREAMON) || dev->frame_queued) {
 		errno = EBUSY;
 		return -1;
 	}
@@ -507,20 +1075,46 @@ static int v4l2_activate_read_stream(int index)
 	result = v4l2_request_read_buffers(index);
 	if (!result)
 		result = v4l2_map_buffers(index);
-	if (!result)
-		result = v4l2_queue_read_buffers(index);
 	if (result)
 		return result;
 
-	devices[index].flags |= V4L2_STREAM_CONTROLLED_BY_READ;
+	/* With background conversion all our frames start out free for the
+	   thread, which keeps the driver's queue full and converts ahead, so
+	   that read() only copies out the oldest converted frame */
+	if (v4l2_async_conversion(index) &&
+	    dev->memory == V4L2_MEMORY_MMAP) {
+		unsigned int i;
+
+		for (i = 0; i < dev->no_frames; i++)
+			dev->app_queued |= V4L2_FRAME_BIT(i);
+		dev->async_free = dev->app_queued;
+		dev->flags |= V4L2_STREAM_CONTROLLED_BY_READ;
+
+		result = v4l2_async_streamon(index);
+		if (result) {
+			dev->flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
+			dev->app_queued = 0;
+			dev->async_free = 0;
+		}
+		return result;
+	}
+
+	result = v4l2_queue_read_buffers(index);
+	if (result)
+		return result;
+
+	dev->flags |= V4L2_STREAM_CONTROLLED_BY_READ;
 
 	return v4l2_streamon(index);
 }
 
 static int v4l2_deactivate_read_stream(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	int result;
 
+	v4l2_async_stop(index);
+
 	result = v4l2_streamoff(index);
 	if (result)
 		return result;
@@ -531,32 +1125,55 @@ static int v4l2_deactivate_read_stream(int index)
 
 	v4l2_unrequest_read_buffers(index);
 
-	devices[index].flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
+	dev->flags &= ~V4L2_STREAM_CONTROLLED_BY_READ;
 
 	return 0;
 }
 
 static int v4l2_needs_conversion(int index)
 {
-	if (devices[index].convert == NULL)
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if (dev->convert == NULL)
 		return 0;
 
-	return v4lconvert_needs_conversion(devices[index].convert,
-			&devices[index].src_fmt, &devices[index].dest_fmt);
+	/* The app can not get at separate planes through our single-planar
+	   API, so always gather them, even when the format is the same */
+	if (dev->src_planes > 1)
+		return 1;
+
+	return v4lconvert_needs_conversion(dev->convert,
+			&dev->src_fmt, &dev->dest_fmt);
 }
 
 static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
 	if (!v4l2_needs_conversion(index))
 		return;
 
 	/* This may happen if the ioctl failed */
-	if (buf->index >= devices[index].no_frames)
+	if (buf->index >= dev->no_frames)
 		buf->index = 0;
 
+	if (dev->memory != V4L2_MEMORY_MMAP) {
+		buf->memory = dev->memory;
+		if (buf->memory == V4L2_MEMORY_USERPTR)
+			buf->m.userptr = dev->app_userptr[buf->index];
+		else
+			buf->m.fd = dev->app_dmabuf_fd[buf->index];
+		buf->length = dev->app_length[buf->index];
+		/* Tell the app how large a buffer it needs to queue */
+		if (!buf->length)
+			buf->length = dev->dest_fmt.fmt.pix.sizeimage;
+		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
+		return;
+	}
+
 	buf->m.offset = V4L2_MMAP_OFFSET_MAGIC | buf->index;
-	buf->length = devices[index].convert_mmap_frame_size;
-	if (devices[index].frame_map_count[buf->index])
+	buf->length = dev->convert_mmap_frame_size;
+	if (dev->frame_map_count[buf->index])
 		buf->flags |= V4L2_BUF_FLAG_MAPPED;
 	else
 		buf->flags &= ~V4L2_BUF_FLAG_MAPPED;
@@ -564,20 +1181,21 @@ static void v4l2_set_conversion_buf_params(int index, struct v4l2_buffer *buf)
 
 static int v4l2_buffers_mapped(int index)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	unsigned int i;
 
 	if (!v4l2_needs_conversion(index)) {
 		/* Normal (no conversion) mode */
 		struct v4l2_buffer buf;
 
-		for (i = 0; i < devices[index].no_frames; i++) {
+		for (i = 0; i < dev->no_frames; i++) {
 			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 			buf.memory = V4L2_MEMORY_MMAP;
 			buf.index = i;
 			buf.reserved = buf.reserved2 = 0;
-			if (devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
-					devices[index].fd, VIDIOC_QUERYBUF,
+			if (dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
+					dev->fd, VIDIOC_QUERYBUF,
 					&buf)) {
 				int saved_err = errno;
 
@@ -590,27 +1208,372 @@ static int v4l2_buffers_mapped(int index)
 		}
 	} else {
 		/* Conversion mode */
-		for (i = 0; i < devices[index].no_frames; i++)
-			if (devices[index].frame_map_count[i])
+		for (i = 0; i < dev->no_frames; i++)
+			if (dev->frame_map_count[i])
 				break;
 	}
 
-	if (i != devices[index].no_frames)
+	if (i != dev->no_frames)
 		V4L2_LOG("v4l2_buffers_mapped(): buffers still mapped\n");
 
-	return i != devices[index].no_frames;
+	return i != dev->no_frames;
+}
+
+/* Background conversion (V4L2_ENABLE_ASYNC_CONVERSION): a conversion thread
+   dequeues the driver's buffers as soon as they are filled, converts them
+   into one of the (fake) buffers queued by the app and requeues the driver's
+   buffer right away. DQBUF then just hands out the oldest converted frame.
+   So once streaming, all driver buffers are owned by the thread and the
+   index of a buffer returned to the app no longer matches the driver's. */
+static int v4l2_async_conversion(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	return (dev->flags & V4L2_ENABLE_ASYNC_CONVERSION) &&
+		v4l2_needs_conversion(index);
+}
+
+/* Called with the stream_lock held, returns -1 on fatal errors */
+static int v4l2_async_convert_frame(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	const int max_tries = V4L2_IGNORE_FIRST_FRAME_ERRORS + 1;
+	struct v4l2_format src_fmt, dest_fmt;
+	struct v4l2_buffer buf;
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	unsigned char *src, *dest;
+	unsigned long long stats_time;
+	int result, slot, src_size, dest_size, dmabuf_fd, saved_err;
+
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	pthread_mutex_unlock(&dev->stream_lock);
+	result = v4l2_driver_buf_ioctl(index, VIDIOC_DQBUF, &buf, planes);
+	pthread_mutex_lock(&dev->stream_lock);
+	if (result) {
+		if (errno == EAGAIN)
+			return 0;
+		saved_err = errno;
+		V4L2_PERROR("dequeuing buf");
+		errno = saved_err;
+		return result;
+	}
+
+	dev->frame_queued &= ~V4L2_FRAME_BIT(buf.index);
+	v4l2_stats_sequence(index, &buf);
+
+	/* The app is holding on to all its buffers, drop the frame */
+	if (!dev->async_free) {
+		dev->stats.dropped++;
+		return v4l2_queue_read_buffer(index, buf.index);
+	}
+
+	for (slot = 0; !(dev->async_free & V4L2_FRAME_BIT(slot)); slot++)
+		;
+	dev->async_free &= ~V4L2_FRAME_BIT(slot);
+
+	src_fmt = dev->src_fmt;
+	dest_fmt = dev->dest_fmt;
+	dest = v4l2_frame_dest(index, slot, &dest_size);
+	dmabuf_fd = v4l2_frame_dmabuf(index, slot);
+	if (!dest) {
+		saved_err = errno;
+		v4l2_queue_read_buffer(index, buf.index);
+		errno = saved_err;
+		return -1;
+	}
+	stats_time = v4l2_stats_time(index);
+
+	/* We are the only one using gather_buf while streaming */
+	pthread_mutex_unlock(&dev->stream_lock);
+	src = v4l2_frame_src(index, &buf, planes, &src_size);
+	v4l2_dmabuf_sync(dmabuf_fd, 0);
+	result = v4lconvert_convert(dev->convert, &src_fmt,
+			&dest_fmt, src, src_size, dest, dest_size);
+	saved_err = errno;
+	v4l2_dmabuf_sync(dmabuf_fd, 1);
+	pthread_mutex_lock(&dev->stream_lock);
+	v4l2_stats_convert_done(index, stats_time);
+
+	/* Give the driver its buffer back before anything else */
+	if (v4l2_queue_read_buffer(index, buf.index))
+		return -1;
+
+	/* See v4l2_dequeue_and_convert */
+	if (dev->first_frame) {
+		if (result < 0)
+			saved_err = EAGAIN;
+		dev->first_frame--;
+	}
+
+	if (result < 0) {
+		if (saved_err == EAGAIN || saved_err == EPIPE)
+			V4L2_LOG("warning error while converting frame data: %s",
+					v4lconvert_get_error_message(dev->convert));
+		else
+			V4L2_LOG_ERR("converting / decoding frame data: %s",
+					v4lconvert_get_error_message(dev->convert));
+
+		if ((saved_err == EAGAIN || saved_err == EPIPE) &&
+		    ++dev->async_errors < max_tries) {
+			/* Try again with the next frame */
+			dev->stats.retries++;
+			dev->async_free |= V4L2_FRAME_BIT(slot);
+			return 0;
+		}
+		dev->async_errors = 0;
+
+		if (saved_err == EPIPE) {
+			V4L2_LOG("got %d consecutive short frame errors, "
+				 "returning short frame", max_tries);
+			result = dest_fmt.fmt.pix.sizeimage;
+			dev->stats.short_frames++;
+		} else {
+			if (saved_err == EAGAIN) {
+				V4L2_LOG_ERR("got %d consecutive frame decode errors, last error: %s",
+						max_tries, v4lconvert_get_error_message(dev->convert));
+				saved_err = EIO;
+			}
+			/* Report the error from the app's next DQBUF */
+			dev->async_error = saved_err;
+			dev->async_free |= V4L2_FRAME_BIT(slot);
+			pthread_cond_broadcast(&dev->async_cond);
+			return 0;
+		}
+	}
+	dev->async_errors = 0;
+
+	buf.index = slot;
+	buf.bytesused = result;
+	dev->ready_bufs[slot] = buf;
+	dev->ready[(dev->ready_first +
+		dev->ready_count) % dev->frames_size] = slot;
+	dev->ready_count++;
+	v4l2_stats_frame_done(index);
+	pthread_cond_broadcast(&dev->async_cond);
+
+	return 0;
+}
+
+static void *v4l2_async_thread(void *arg)
+{
+	int index = (long)arg;
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	struct pollfd fds[2];
+
+	fds[0].fd = dev->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = dev->async_wake[0];
+	fds[1].events = POLLIN;
+
+	pthread_mutex_lock(&dev->stream_lock);
+	while (!dev->async_quit) {
+		int result;
+
+		pthread_mutex_unlock(&dev->stream_lock);
+		result = poll(fds, 2, -1);
+		pthread_mutex_lock(&dev->stream_lock);
+		if (dev->async_quit)
+			break;
+
+		if (result < 0) {
+			if (errno == EINTR)
+				continue;
+			dev->async_error = errno;
+			V4L2_LOG_ERR("polling for frames: %s\n", strerror(errno));
+			break;
+		}
+
+		/* Without POLLIN the driver is not going to give us any frames */
+		if (!(fds[0].revents & POLLIN)) {
+			dev->async_error = EIO;
+			V4L2_LOG_ERR("waiting for frames: driver signalled an error\n");
+			break;
+		}
+
+		if (v4l2_async_convert_frame(index)) {
+			dev->async_error = errno;
+			break;
+		}
+	}
+	dev->async_running = 0;
+	pthread_cond_broadcast(&dev->async_cond);
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return NULL;
+}
+
+/* Called with the stream_lock held, starts streaming and the thread */
+static int v4l2_async_streamon(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	int result;
+
+	if (dev->async_started)
+		return 0;
+
+	result = v4l2_map_buffers(index);
+	if (!result && dev->memory == V4L2_MEMORY_MMAP)
+		result = v4l2_ensure_convert_mmap_buf(index);
+	/* From here on the driver's buffers are ours, see above */
+	if (!result)
+		result = v4l2_queue_read_buffers(index);
+	if (!result)
+		result = v4l2_streamon(index);
+	if (result)
+		return result;
+
+	if (pipe(dev->async_wake)) {
+		result = errno;
+		V4L2_LOG_ERR("creating conversion thread pipe: %s\n",
+			     strerror(errno));
+		goto error;
+	}
+	fcntl(dev->async_wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(dev->async_wake[1], F_SETFD, FD_CLOEXEC);
+
+	dev->async_quit = 0;
+	dev->async_error = 0;
+	dev->async_errors = 0;
+	dev->async_running = 1;
+	result = pthread_create(&dev->async_thread, NULL,
+				v4l2_async_thread, (void *)(long)index);
+	if (result) {
+		V4L2_LOG_ERR("creating conversion thread: %s\n",
+			     strerror(result));
+		dev->async_running = 0;
+		SYS_CLOSE(dev->async_wake[0]);
+		SYS_CLOSE(dev->async_wake[1]);
+		goto error;
+	}
+	dev->async_started = 1;
+
+	return 0;
+
+error:
+	v4l2_streamoff(index);
+	errno = result;
+	return -1;
+}
+
+/* Called with the stream_lock held, note this temporarily drops it. This
+   also dequeues all the app's buffers, like STREAMOFF does */
+static void v4l2_async_stop(int index)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	pthread_t thread = dev->async_thread;
+	int was_started = dev->async_started;
+	char c = 0;
+
+	dev->async_started = 0;
+	if (was_started) {
+		dev->async_quit = 1;
+		SYS_WRITE(dev->async_wake[1], &c, 1);
+		pthread_mutex_unlock(&dev->stream_lock);
+		pthread_join(thread, NULL);
+		pthread_mutex_lock(&dev->stream_lock);
+		SYS_CLOSE(dev->async_wake[0]);
+		SYS_CLOSE(dev->async_wake[1]);
+	}
+
+	dev->app_queued = 0;
+	dev->async_free = 0;
+	dev->ready_count = 0;
+}
+
+static int v4l2_async_qbuf(int index, struct v4l2_buffer *buf)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if (buf->index >= dev->no_frames ||
+	    (dev->app_queued & V4L2_FRAME_BIT(buf->index))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	dev->app_queued |= V4L2_FRAME_BIT(buf->index);
+	dev->async_free |= V4L2_FRAME_BIT(buf->index);
+	buf->flags |= V4L2_BUF_FLAG_QUEUED;
+	buf->flags &= ~V4L2_BUF_FLAG_DONE;
+
+	return 0;
+}
+
+static int v4l2_async_dqbuf(int index, struct v4l2_buffer *buf)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	unsigned long long stats_time = v4l2_stats_time(index);
+	int slot;
+
+	while (!dev->ready_count && !dev->async_error) {
+		if (!dev->async_running) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (fcntl(dev->fd, F_GETFL) & O_NONBLOCK) {
+			errno = EAGAIN;
+			return -1;
+		}
+		pthread_cond_wait(&dev->async_cond,
+				  &dev->stream_lock);
+	}
+	v4l2_stats_add(index, &dev->stats.dequeue_ns, stats_time);
+
+	/* Hand out the frames converted before an error first */
+	if (!dev->ready_count) {
+		errno = dev->async_error;
+		/* Errors which stopped the thread keep getting reported */
+		if (dev->async_running)
+			dev->async_error = 0;
+		return -1;
+	}
+
+	slot = dev->ready[dev->ready_first];
+	dev->ready_first =
+		(dev->ready_first + 1) % dev->frames_size;
+	dev->ready_count--;
+	dev->app_queued &= ~V4L2_FRAME_BIT(slot);
+	*buf = dev->ready_bufs[slot];
+
+	return 0;
+}
+
+/* Called with the stream_lock held, copies out the oldest frame converted
+   ahead for read() and gives its buffer back to the thread */
+static int v4l2_async_read(int index, unsigned char *dest, size_t n)
+{
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+	struct v4l2_buffer buf;
+	unsigned char *src;
+	int result, src_size;
+
+	result = v4l2_async_dqbuf(index, &buf);
+	if (result)
+		return result;
+
+	src = v4l2_frame_dest(index, buf.index, &src_size);
+	result = MIN(n, buf.bytesused);
+	memcpy(dest, src, result);
+
+	dev->app_queued |= V4L2_FRAME_BIT(buf.index);
+	dev->async_free |= V4L2_FRAME_BIT(buf.index);
+
+	return result;
 }
 
 static void v4l2_update_fps(int index, struct v4l2_streamparm *parm)
 {
-	if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	if ((dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 	    parm->parm.capture.timeperframe.numerator != 0) {
 		int fps = parm->parm.capture.timeperframe.denominator;
 		fps += parm->parm.capture.timeperframe.numerator - 1;
 		fps /= parm->parm.capture.timeperframe.numerator;
-		devices[index].fps = fps;
+		dev->fps = fps;
 	} else
-		devices[index].fps = 0;
+		dev->fps = 0;
 }
 
 int v4l2_open(const char *file, int oflag, ...)
@@ -647,10 +1610,61 @@ int v4l2_open(const char *file, int oflag, ...)
 	return fd;
 }
 
+/* Returns the index for registering fd, must be called with v4l2_open_mutex
+   held */
+static int v4l2_alloc_index(int fd)
+{
+	struct v4l2_dev_info **table;
+	int size;
+
+	if (fd < 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	if (fd >= devices_size) {
+		size = devices_size ? devices_size * 2 : V4L2_MIN_DEVICES_SIZE;
+		while (size <= fd)
+			size *= 2;
+
+		table = calloc(size, sizeof(*table));
+		if (!table) {
+			errno = ENOMEM;
+			return -1;
+		}
+		if (devices_size)
+			memcpy(table, devices, devices_size * sizeof(*table));
+
+		/* Publish the new table before its size, see v4l2_get_index() */
+		__atomic_store_n(&devices, table, __ATOMIC_RELEASE);
+		__atomic_store_n(&devices_size, size, __ATOMIC_RELEASE);
+	}
+
+	if (!devices[fd]) {
+		struct v4l2_dev_info *dev = calloc(1, sizeof(*dev));
+
+		if (!dev) {
+			errno = ENOMEM;
+			return -1;
+		}
+		dev->fd = -1;
+		__atomic_store_n(&devices[fd], dev, __ATOMIC_RELEASE);
+	} else if (devices[fd]->fd != -1) {
+		/* Already registered, through another v4l2_fd_open call */
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (fd >= devices_used)
+		__atomic_store_n(&devices_used, fd + 1, __ATOMIC_RELEASE);
+
+	return fd;
+}
+
 int v4l2_fd_open(int fd, int v4l2_flags)
 {
-	int i, index;
-	char *lfname;
+	int index, mplane;
+	char *lfname, *stats_env, *async_env, *nreadbuffers_env;
 	struct v4l2_capability cap;
 	struct v4l2_format fmt = { 0, };
 	struct v4l2_streamparm parm = { 0, };
@@ -658,6 +1672,7 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 	void *plugin_library;
 	void *dev_ops_priv;
 	const struct libv4l_dev_ops *dev_ops;
+	struct v4l2_dev_info *dev = NULL;
 	long page_size;
 
 	v4l2_plugin_init(fd, &plugin_library, &dev_ops_priv, &dev_ops);
@@ -690,6 +1705,20 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 		return -1;
 	}
 
+	/* Multi-planar only capture devices are handled natively, with our own
+	   dev_ops translating the format ioctls stacked on top */
+	mplane = v4l2_mplane_wrap(&cap, &dev_ops, &dev_ops_priv);
+	if (mplane == -1 ||
+	    (mplane && dev_ops->ioctl(dev_ops_priv, fd, VIDIOC_QUERYCAP, &cap))) {
+		int saved_err = errno;
+		V4L2_LOG_ERR("setting up multi-planar support: %s\n",
+			     strerror(errno));
+		v4l2_mplane_unwrap(&dev_ops, &dev_ops_priv);
+		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
+		errno = saved_err;
+		return -1;
+	}
+
 	if (cap.capabilities & V4L2_CAP_DEVICE_CAPS)
 		cap.capabilities = cap.device_caps;
 	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
@@ -701,6 +1730,7 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 	if (dev_ops->ioctl(dev_ops_priv, fd, VIDIOC_G_FMT, &fmt)) {
 		int saved_err = errno;
 		V4L2_LOG_ERR("getting pixformat: %s\n", strerror(errno));
+		v4l2_mplane_unwrap(&dev_ops, &dev_ops_priv);
 		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
 		errno = saved_err;
 		return -1;
@@ -716,6 +1746,7 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 		convert = v4lconvert_create_with_dev_ops(fd, dev_ops_priv, dev_ops);
 		if (!convert) {
 			int saved_err = errno;
+			v4l2_mplane_unwrap(&dev_ops, &dev_ops_priv);
 			v4l2_plugin_cleanup(plugin_library, dev_ops_priv,
 					    dev_ops);
 			errno = saved_err;
@@ -726,67 +1757,110 @@ int v4l2_fd_open(int fd, int v4l2_flags)
 no_capture:
 	/* So we have a v4l2 capture device, register it in our devices array */
 	pthread_mutex_lock(&v4l2_open_mutex);
-	for (index = 0; index < V4L2_MAX_DEVICES; index++) {
-		if (devices[index].fd == -1) {
-			devices[index].fd = fd;
-			devices[index].plugin_library = plugin_library;
-			devices[index].dev_ops_priv = dev_ops_priv;
-			devices[index].dev_ops = dev_ops;
-			break;
-		}
+	index = v4l2_alloc_index(fd);
+	if (index != -1) {
+		dev = v4l2_dev(index);
+		dev->fd = fd;
+		dev->plugin_library = plugin_library;
+		dev->dev_ops_priv = dev_ops_priv;
+		dev->dev_ops = dev_ops;
+		dev->mplane = mplane;
+		dev->src_planes = 1;
 	}
 	pthread_mutex_unlock(&v4l2_open_mutex);
 
-	if (index == V4L2_MAX_DEVICES) {
-		V4L2_LOG_ERR("attempting to open more than %d video devices\n",
-				V4L2_MAX_DEVICES);
+	if (index == -1) {
+		int saved_err = errno;
+
+		V4L2_LOG_ERR("registering fd %d: %s\n", fd, strerror(errno));
+		v4lconvert_destroy(convert);
+		v4l2_mplane_unwrap(&dev_ops, &dev_ops_priv);
 		v4l2_plugin_cleanup(plugin_library, dev_ops_priv, dev_ops);
-		errno = EBUSY;
+		errno = saved_err;
 		return -1;
 	}
 
-	devices[index].flags = v4l2_flags;
+	dev->flags = v4l2_flags;
 	if (cap.capabilities & V4L2_CAP_READWRITE)
-		devices[index].flags |= V4L2_SUPPORTS_READ;
+		dev->flags |= V4L2_SUPPORTS_READ;
 	if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-		devices[index].flags |= V4L2_USE_READ_FOR_READ;
+		dev->flags |= V4L2_USE_READ_FOR_READ;
 		/* This device only supports read so the stream gets started by the
 		   driver on the first read */
-		devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+		dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 	}
 	if ((parm.type == V4L2_BUF_TYPE_VIDEO_CAPTURE) &&
 	    (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
-		devices[index].flags |= V4L2_SUPPORTS_TIMEPERFRAME;
-	devices[index].open_count = 1;
-	devices[index].page_size = page_size;
-	devices[index].src_fmt  = fmt;
-	devices[index].dest_fmt = fmt;
-	v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-				     &devices[index].dest_fmt);
-
-	pthread_mutex_init(&devices[index].stream_lock, NULL);
-
-	devices[index].no_frames = 0;
-	devices[index].nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
-	devices[index].convert = convert;
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
-	for (i = 0; i < V4L2_MAX_NO_FRAMES; i++) {
-		devices[index].frame_pointers[i] = MAP_FAILED;
-		devices[index].frame_map_count[i] = 0;
-	}
-	devices[index].frame_queued = 0;
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
-
-	if (index >= devices_used)
-		devices_used = index + 1;
+		dev->flags |= V4L2_SUPPORTS_TIMEPERFRAME;
+	dev->open_count = 1;
+	dev->page_size = page_size;
+	dev->src_fmt  = fmt;
+	dev->dest_fmt = fmt;
+	v4l2_set_src_and_dest_format(index, &dev->src_fmt,
+				     &dev->dest_fmt);
+
+	pthread_mutex_init(&dev->stream_lock, NULL);
+	pthread_mutex_init(&dev->fmt_lock, NULL);
+	pthread_mutex_init(&dev->control_lock, NULL);
+	dev->stream_touched = 0;
+
+	dev->no_frames = 0;
+	dev->nreadbuffers = V4L2_DEFAULT_NREADBUFFERS;
+	/* More buffers avoid dropping frames at high frame rates, fewer save
+	   memory at high resolutions */
+	nreadbuffers_env = getenv("LIBV4L2_READ_BUFFERS");
+	if (nreadbuffers_env) {
+		long n = strtol(nreadbuffers_env, NULL, 0);
+
+		if (n >= 1 && n <= V4L2_MAX_NO_FRAMES)
+			dev->nreadbuffers = n;
+	}
+	dev->convert = convert;
+	dev->convert_mmap_buf = MAP_FAILED;
+	dev->convert_mmap_buf_size = 0;
+	/* The per frame bookkeeping gets allocated by v4l2_set_no_frames() */
+	dev->frames_size = 0;
+	dev->gather_buf = NULL;
+	dev->gather_buf_size = 0;
+	dev->memory = V4L2_MEMORY_MMAP;
+	v4l2_unmap_app_buffers(index);
+	dev->frame_queued = 0;
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	dev->stats_interval = 0;
+	dev->last_sequence = -1;
+	pthread_cond_init(&dev->async_cond, NULL);
+	dev->async_started = 0;
+	dev->async_running = 0;
+	dev->async_error = 0;
+	dev->app_queued = 0;
+	dev->async_free = 0;
+	dev->ready_first = 0;
+	dev->ready_count = 0;
+
+	/* Allow enabling background conversion through the environment */
+	async_env = getenv("LIBV4L2_ASYNC_CONVERSION");
+	if (async_env && strtol(async_env, NULL, 0))
+		dev->flags |= V4L2_ENABLE_ASYNC_CONVERSION;
+
+	/* Allow enabling frame statistics through the environment */
+	stats_env = getenv("LIBV4L2_FRAME_STATS");
+	if (stats_env) {
+		dev->flags |= V4L2_ENABLE_FRAME_STATS;
+		dev->stats_interval = strtol(stats_env, NULL, 0);
+		if (dev->stats_interval < 0)
+			dev->stats_interval = 0;
+	}
+	if (dev->convert)
+		v4lconvert_set_stats_enabled(dev->convert,
+			dev->flags & V4L2_ENABLE_FRAME_STATS);
 
 	/* Note we always tell v4lconvert to optimize src fmt selection for
 	   our default fps, the only exception is the app explicitly selecting
 	   a frame rate using the S_PARM ioctl after a S_FMT */
-	if (devices[index].convert)
-		v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
+	if (dev->convert)
+		v4lconvert_set_fps(dev->convert, V4L2_DEFAULT_FPS);
 	v4l2_update_fps(index, &parm);
 
 	V4L2_LOG("open: %d\n", fd);
@@ -797,67 +1871,75 @@ no_capture:
 /* Is this an fd for which we are emulating v4l1 ? */
 static int v4l2_get_index(int fd)
 {
-	int index;
+	struct v4l2_dev_info *dev;
 
-	/* We never handle fd -1 */
-	if (fd == -1)
+	/* We never handle fd -1. The size is read first, as a table is never
+	   published before its size is known, this suffices */
+	if (fd < 0 || fd >= __atomic_load_n(&devices_size, __ATOMIC_ACQUIRE))
 		return -1;
 
-	for (index = 0; index < devices_used; index++)
-		if (devices[index].fd == fd)
-			break;
-
-	if (index == devices_used)
+	dev = v4l2_dev(fd);
+	if (!dev || dev->fd != fd)
 		return -1;
 
-	return index;
+	return fd;
 }
 
 
 int v4l2_close(int fd)
 {
+	struct v4l2_dev_info *dev;
 	int index, result;
 
 	index = v4l2_get_index(fd);
 	if (index == -1)
 		return SYS_CLOSE(fd);
+	dev = v4l2_dev(index);
 
 	/* Abuse stream_lock to stop 2 closes from racing and trying to free
 	   the resources twice */
-	pthread_mutex_lock(&devices[index].stream_lock);
-	devices[index].open_count--;
-	result = devices[index].open_count != 0;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
+	dev->open_count--;
+	result = dev->open_count != 0;
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	if (result)
 		return 0;
 
-	v4l2_plugin_cleanup(devices[index].plugin_library,
-			devices[index].dev_ops_priv,
-			devices[index].dev_ops);
+	pthread_mutex_lock(&dev->stream_lock);
+	v4l2_async_stop(index);
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	v4l2_mplane_unwrap(&dev->dev_ops,
+			   &dev->dev_ops_priv);
+	v4l2_plugin_cleanup(dev->plugin_library,
+			dev->dev_ops_priv,
+			dev->dev_ops);
 
 	/* Free resources */
 	v4l2_unmap_buffers(index);
-	if (devices[index].convert_mmap_buf != MAP_FAILED) {
+	v4l2_unmap_app_buffers(index);
+	if (dev->convert_mmap_buf != MAP_FAILED) {
 		if (v4l2_buffers_mapped(index)) {
-			if (!devices[index].gone)
+			if (!dev->gone)
 				V4L2_LOG_WARN("v4l2 mmap buffers still mapped on close()\n");
 		} else {
-			SYS_MUNMAP(devices[index].convert_mmap_buf,
-					devices[index].convert_mmap_buf_size);
+			SYS_MUNMAP(dev->convert_mmap_buf,
+					dev->convert_mmap_buf_size);
 		}
-		devices[index].convert_mmap_buf = MAP_FAILED;
-		devices[index].convert_mmap_buf_size = 0;
+		dev->convert_mmap_buf = MAP_FAILED;
+		dev->convert_mmap_buf_size = 0;
 	}
-	v4lconvert_destroy(devices[index].convert);
-	free(devices[index].readbuf);
-	devices[index].readbuf = NULL;
-	devices[index].readbuf_size = 0;
+	v4l2_free_frames(index);
+	v4lconvert_destroy(dev->convert);
+	free(dev->readbuf);
+	dev->readbuf = NULL;
+	dev->readbuf_size = 0;
 
 	/* Remove the fd from our list of managed fds before closing it, because as
 	   soon as we've done the actual close, the fd maybe returned by an open() in
 	   another thread and we don't want to intercept calls to this new fd. */
-	devices[index].fd = -1;
+	dev->fd = -1;
 
 	/* Since we've marked the fd as no longer used, and freed the resources,
 	   redo the close in case it was interrupted */
@@ -877,21 +1959,27 @@ int v4l2_dup(int fd)
 	if (index == -1)
 		return syscall(SYS_dup, fd);
 
-	devices[index].open_count++;
+	v4l2_dev(index)->open_count++;
 
 	return fd;
 }
 
 static int v4l2_check_buffer_change_ok(int index)
 {
-	devices[index].frame_info_generation++;
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
+	/* The conversion thread of a read() stream uses all our buffers */
+	if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ)
+		v4l2_async_stop(index);
+
+	dev->frame_info_generation++;
 	v4l2_unmap_buffers(index);
 
 	/* Check if the app itself still is using the stream */
 	if (v4l2_buffers_mapped(index) ||
-			(!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			 ((devices[index].flags & V4L2_STREAMON) ||
-			  devices[index].frame_queued))) {
+			(!(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			 ((dev->flags & V4L2_STREAMON) ||
+			  dev->frame_queued))) {
 		V4L2_LOG("v4l2_check_buffer_change_ok(): stream busy\n");
 		errno = EBUSY;
 		return -1;
@@ -900,12 +1988,12 @@ static int v4l2_check_buffer_change_ok(int index)
 	/* We may change from convert to non conversion mode and
 	   v4l2_unrequest_read_buffers may change the no_frames, so free the
 	   convert mmap buffer */
-	SYS_MUNMAP(devices[index].convert_mmap_buf,
-			devices[index].convert_mmap_buf_size);
-	devices[index].convert_mmap_buf = MAP_FAILED;
-	devices[index].convert_mmap_buf_size = 0;
+	SYS_MUNMAP(dev->convert_mmap_buf,
+			dev->convert_mmap_buf_size);
+	dev->convert_mmap_buf = MAP_FAILED;
+	dev->convert_mmap_buf_size = 0;
 
-	if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+	if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 		V4L2_LOG("deactivating read-stream for settings change\n");
 		return v4l2_deactivate_read_stream(index);
 	}
@@ -937,6 +2025,8 @@ static int v4l2_pix_fmt_identical(struct v4l2_format *a, struct v4l2_format *b)
 static void v4l2_set_src_and_dest_format(int index,
 		struct v4l2_format *src_fmt, struct v4l2_format *dest_fmt)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
+
 	/*
 	 * When a user does a try_fmt with the current dest_fmt and the
 	 * dest_fmt is a supported one we will align the resolution (see
@@ -965,16 +2055,20 @@ static void v4l2_set_src_and_dest_format(int index,
 	} else
 		v4lconvert_fixup_fmt(dest_fmt);
 
-	devices[index].src_fmt = *src_fmt;
-	devices[index].dest_fmt = *dest_fmt;
+	dev->src_fmt = *src_fmt;
+	dev->dest_fmt = *dest_fmt;
+	if (dev->mplane)
+		dev->src_planes =
+			v4l2_mplane_num_planes(dev->dev_ops_priv);
 	/* round up to full page size */
-	devices[index].convert_mmap_frame_size =
-		(((dest_fmt->fmt.pix.sizeimage + devices[index].page_size - 1)
-		/ devices[index].page_size) * devices[index].page_size);
+	dev->convert_mmap_frame_size =
+		(((dest_fmt->fmt.pix.sizeimage + dev->page_size - 1)
+		/ dev->page_size) * dev->page_size);
 }
 
 static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	struct v4l2_format src_fmt;
 	struct v4l2_pix_format req_pix_fmt;
 	int result;
@@ -989,7 +2083,7 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 				pixfmt >> 24);
 	}
 
-	result = v4lconvert_try_format(devices[index].convert,
+	result = v4lconvert_try_format(dev->convert,
 				       dest_fmt, &src_fmt);
 	if (result) {
 		int saved_err = errno;
@@ -1013,17 +2107,18 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 		return result;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	result = devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-					       devices[index].fd,
+	result = dev->dev_ops->ioctl(dev->dev_ops_priv,
+					       dev->fd,
 					       VIDIOC_S_FMT, &src_fmt);
 	if (result) {
 		int saved_err = errno;
 		V4L2_PERROR("setting pixformat");
 		/* Report to the app dest_fmt has not changed */
-		*dest_fmt = devices[index].dest_fmt;
+		*dest_fmt = dev->dest_fmt;
 		errno = saved_err;
 		return result;
 	}
+	v4lconvert_flush_try_format_cache(dev->convert);
 
 	/* See if we've gotten what try_fmt promised us
 	   (this check should never fail) */
@@ -1037,12 +2132,12 @@ static int v4l2_s_fmt(int index, struct v4l2_format *dest_fmt)
 
 	v4l2_set_src_and_dest_format(index, &src_fmt, dest_fmt);
 
-	if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) {
+	if (dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) {
 		struct v4l2_streamparm parm = {
 			.type = V4L2_BUF_TYPE_VIDEO_CAPTURE,
 		};
-		if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-						  devices[index].fd,
+		if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+						  dev->fd,
 						  VIDIOC_G_PARM, &parm))
 			return 0;
 		v4l2_update_fps(index, &parm);
@@ -1059,8 +2154,10 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 {
 	void *arg;
 	va_list ap;
+	struct v4l2_dev_info *dev;
 	int result, index, saved_err;
 	int is_capture_request = 0, stream_needs_locking = 0;
+	int fmt_needs_locking = 0, control_needs_locking = 0;
 
 	va_start(ap, request);
 	arg = va_arg(ap, void *);
@@ -1069,44 +2166,69 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	index = v4l2_get_index(fd);
 	if (index == -1)
 		return SYS_IOCTL(fd, request, arg);
+	dev = v4l2_dev(index);
 
 	/* Apparently the kernel and / or glibc ignore the 32 most significant bits
 	   when long = 64 bits, and some applications pass an int holding the req to
 	   ioctl, causing it to get sign extended, depending upon this behavior */
 	request = (unsigned int)request;
 
-	if (devices[index].convert == NULL)
+	USDT(libv4l2, ioctl_entry, fd, request, arg);
+
+	if (dev->convert == NULL)
 		goto no_capture_request;
 
 	/* Is this a capture request and do we need to take the stream lock? */
 	switch (request) {
 	case VIDIOC_QUERYCAP:
+		is_capture_request = 1;
+		break;
 	case VIDIOC_QUERYCTRL:
 	case VIDIOC_G_CTRL:
 	case VIDIOC_S_CTRL:
 	case VIDIOC_G_EXT_CTRLS:
 	case VIDIOC_TRY_EXT_CTRLS:
 	case VIDIOC_S_EXT_CTRLS:
+		is_capture_request = 1;
+		control_needs_locking = 1;
+		break;
 	case VIDIOC_ENUM_FRAMESIZES:
 	case VIDIOC_ENUM_FRAMEINTERVALS:
 		is_capture_request = 1;
+		fmt_needs_locking = 1;
 		break;
 	case VIDIOC_ENUM_FMT:
 		if (((struct v4l2_fmtdesc *)arg)->type ==
-				V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
+			fmt_needs_locking = 1;
+		}
 		break;
 	case VIDIOC_TRY_FMT:
 		if (((struct v4l2_format *)arg)->type ==
-				V4L2_BUF_TYPE_VIDEO_CAPTURE)
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
+			fmt_needs_locking = 1;
+		}
 		break;
-	case VIDIOC_S_FMT:
 	case VIDIOC_G_FMT:
+		if (((struct v4l2_format *)arg)->type ==
+				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+			is_capture_request = 1;
+			fmt_needs_locking = 1;
+			/* The first stream ioctl may change the format, see
+			   below, after that the fmt_lock suffices */
+			if (!__atomic_load_n(&dev->stream_touched,
+					     __ATOMIC_ACQUIRE))
+				stream_needs_locking = 1;
+		}
+		break;
+	case VIDIOC_S_FMT:
 		if (((struct v4l2_format *)arg)->type ==
 				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
 			stream_needs_locking = 1;
+			fmt_needs_locking = 1;
 		}
 		break;
 	case VIDIOC_REQBUFS:
@@ -1137,8 +2259,10 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 		if (((struct v4l2_streamparm *)arg)->type ==
 				V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 			is_capture_request = 1;
-			if (devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME)
+			if (dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) {
 				stream_needs_locking = 1;
+				fmt_needs_locking = 1;
+			}
 		}
 		break;
 	case VIDIOC_S_STD:
@@ -1146,15 +2270,17 @@ int v4l2_ioctl(int fd, unsigned long int request, ...)
 	case VIDIOC_S_DV_TIMINGS:
 		is_capture_request = 1;
 		stream_needs_locking = 1;
-		break;		
+		fmt_needs_locking = 1;
+		break;
 	}
 
 	if (!is_capture_request) {
 no_capture_request:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		saved_err = errno;
+		USDT(libv4l2, ioctl_exit, fd, request, result, saved_err);
 		v4l2_log_ioctl(request, arg, result);
 		errno = saved_err;
 		return result;
@@ -1162,55 +2288,62 @@ no_capture_request:
 
 
 	if (stream_needs_locking) {
-		pthread_mutex_lock(&devices[index].stream_lock);
+		pthread_mutex_lock(&dev->stream_lock);
 		/* If this is the first stream-related ioctl, and we should only allow
 		   libv4lconvert supported destination formats (so that it can do flipping,
 		   processing, etc.) and the current destination format is not supported,
 		   try setting the format to RGB24 (which is a supported dest. format). */
-		if (!(devices[index].flags & V4L2_STREAM_TOUCHED) &&
-				v4lconvert_supported_dst_fmt_only(devices[index].convert) &&
+		if (!dev->stream_touched &&
+				v4lconvert_supported_dst_fmt_only(dev->convert) &&
 				!v4lconvert_supported_dst_format(
-					devices[index].dest_fmt.fmt.pix.pixelformat)) {
-			struct v4l2_format fmt = devices[index].dest_fmt;
+					dev->dest_fmt.fmt.pix.pixelformat)) {
+			struct v4l2_format fmt = dev->dest_fmt;
 
 			V4L2_LOG("Setting pixelformat to RGB24 (supported_dst_fmt_only)");
 			fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_RGB24;
+			pthread_mutex_lock(&dev->fmt_lock);
 			v4l2_s_fmt(index, &fmt);
+			pthread_mutex_unlock(&dev->fmt_lock);
 			V4L2_LOG("Done setting pixelformat (supported_dst_fmt_only)");
 		}
-		devices[index].flags |= V4L2_STREAM_TOUCHED;
+		__atomic_store_n(&dev->stream_touched, 1,
+				 __ATOMIC_RELEASE);
 	}
+	if (fmt_needs_locking)
+		pthread_mutex_lock(&dev->fmt_lock);
+	if (control_needs_locking)
+		pthread_mutex_lock(&dev->control_lock);
 
 	switch (request) {
 	case VIDIOC_QUERYCTRL:
-		result = v4lconvert_vidioc_queryctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_queryctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_G_CTRL:
-		result = v4lconvert_vidioc_g_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_S_CTRL:
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ctrl(dev->convert, arg);
 		break;
 
 	case VIDIOC_G_EXT_CTRLS:
-		result = v4lconvert_vidioc_g_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_g_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_TRY_EXT_CTRLS:
-		result = v4lconvert_vidioc_try_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_try_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_S_EXT_CTRLS:
-		result = v4lconvert_vidioc_s_ext_ctrls(devices[index].convert, arg);
+		result = v4lconvert_vidioc_s_ext_ctrls(dev->convert, arg);
 		break;
 
 	case VIDIOC_QUERYCAP: {
 		struct v4l2_capability *cap = arg;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QUERYCAP, cap);
 		if (result == 0) {
 			/* We always support read() as we fake it using mmap mode */
@@ -1221,22 +2354,22 @@ no_capture_request:
 	}
 
 	case VIDIOC_ENUM_FMT:
-		result = v4lconvert_enum_fmt(devices[index].convert, arg);
+		result = v4lconvert_enum_fmt(dev->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMESIZES:
-		result = v4lconvert_enum_framesizes(devices[index].convert, arg);
+		result = v4lconvert_enum_framesizes(dev->convert, arg);
 		break;
 
 	case VIDIOC_ENUM_FRAMEINTERVALS:
-		result = v4lconvert_enum_frameintervals(devices[index].convert, arg);
+		result = v4lconvert_enum_frameintervals(dev->convert, arg);
 		if (result)
 			V4L2_LOG("ENUM_FRAMEINTERVALS Error: %s",
-					v4lconvert_get_error_message(devices[index].convert));
+					v4lconvert_get_error_message(dev->convert));
 		break;
 
 	case VIDIOC_TRY_FMT:
-		result = v4lconvert_try_format(devices[index].convert,
+		result = v4lconvert_try_format(dev->convert,
 					       arg, NULL);
 		break;
 
@@ -1247,7 +2380,7 @@ no_capture_request:
 	case VIDIOC_G_FMT: {
 		struct v4l2_format *fmt = arg;
 
-		*fmt = devices[index].dest_fmt;
+		*fmt = dev->dest_fmt;
 		result = 0;
 		break;
 	}
@@ -1257,18 +2390,21 @@ no_capture_request:
 	case VIDIOC_S_DV_TIMINGS: {
 		struct v4l2_format src_fmt = { 0 };
 		unsigned int orig_dest_pixelformat =
-			devices[index].dest_fmt.fmt.pix.pixelformat;
+			dev->dest_fmt.fmt.pix.pixelformat;
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		if (result)
 			break;
 
+		/* They may also have changed which formats can be used */
+		v4lconvert_flush_try_format_cache(dev->convert);
+
 		/* These ioctls may have changed the device's fmt */
 		src_fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_G_FMT, &src_fmt);
 		if (result) {
 			V4L2_PERROR("getting pixformat after %s",
@@ -1277,17 +2413,17 @@ no_capture_request:
 			break;
 		}
 
-		if (v4l2_pix_fmt_compat(&devices[index].src_fmt, &src_fmt)) {
+		if (v4l2_pix_fmt_compat(&dev->src_fmt, &src_fmt)) {
 			v4l2_set_src_and_dest_format(index, &src_fmt,
-						     &devices[index].dest_fmt);
+						     &dev->dest_fmt);
 			break;
 		}
 
 		/* The fmt has been changed, remember the new format ... */
-		devices[index].src_fmt  = src_fmt;
-		devices[index].dest_fmt = src_fmt;
-		v4l2_set_src_and_dest_format(index, &devices[index].src_fmt,
-					     &devices[index].dest_fmt);
+		dev->src_fmt  = src_fmt;
+		dev->dest_fmt = src_fmt;
+		v4l2_set_src_and_dest_format(index, &dev->src_fmt,
+					     &dev->dest_fmt);
 		/* and try to restore the last set destination pixelformat. */
 		src_fmt.fmt.pix.pixelformat = orig_dest_pixelformat;
 		result = v4l2_s_fmt(index, &src_fmt);
@@ -1303,8 +2439,15 @@ no_capture_request:
 	case VIDIOC_REQBUFS: {
 		struct v4l2_requestbuffers *req = arg;
 
-		/* IMPROVEME (maybe?) add support for userptr's? */
-		if (req->memory != V4L2_MEMORY_MMAP) {
+		unsigned int memory = req->memory;
+
+		/* When converting we always use MMAP buffers with the driver,
+		   the app may supply its own USERPTR / DMABUF buffers to
+		   convert into */
+		if (v4l2_needs_conversion(index) &&
+		    memory != V4L2_MEMORY_MMAP &&
+		    memory != V4L2_MEMORY_USERPTR &&
+		    memory != V4L2_MEMORY_DMABUF) {
 			errno = EINVAL;
 			result = -1;
 			break;
@@ -1315,25 +2458,49 @@ no_capture_request:
 			break;
 
 		/* No more buffers than we can manage please */
-		if (req->count > V4L2_MAX_NO_FRAMES)
+		if (req->count > V4L2_MAX_NO_FRAMES) {
+			V4L2_LOG_WARN("limiting a request for %u buffers to %d\n",
+				      req->count, V4L2_MAX_NO_FRAMES);
 			req->count = V4L2_MAX_NO_FRAMES;
+		}
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		if (v4l2_needs_conversion(index))
+			req->memory = V4L2_MEMORY_MMAP;
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_REQBUFS, req);
+		req->memory = memory;
 		if (result < 0)
 			break;
 		result = 0; /* some drivers return the number of buffers on success */
 
-		devices[index].no_frames = MIN(req->count, V4L2_MAX_NO_FRAMES);
-		devices[index].flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+		v4l2_unmap_app_buffers(index);
+		dev->memory = memory;
+
+		result = v4l2_set_no_frames(index, req->count);
+		if (result) {
+			int saved_err = errno;
+
+			/* Don't leave the driver with buffers we can't track */
+			req->count = 0;
+			if (v4l2_needs_conversion(index))
+				req->memory = V4L2_MEMORY_MMAP;
+			dev->dev_ops->ioctl(dev->dev_ops_priv,
+					fd, VIDIOC_REQBUFS, req);
+			req->memory = memory;
+			dev->no_frames = 0;
+			errno = saved_err;
+		}
+		dev->flags &= ~V4L2_BUFFERS_REQUESTED_BY_READ;
+		dev->app_queued = 0;
+		dev->async_free = 0;
 		break;
 	}
 
 	case VIDIOC_QUERYBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
@@ -1341,10 +2508,19 @@ no_capture_request:
 
 		/* Do a real query even when converting to let the driver fill in
 		   things like buf->field */
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		if (v4l2_needs_conversion(index))
+			buf->memory = V4L2_MEMORY_MMAP;
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QUERYBUF, buf);
 
+		/* The driver's buffer state says nothing about the app's */
+		if (result == 0 && v4l2_async_conversion(index)) {
+			buf->flags &= ~(V4L2_BUF_FLAG_QUEUED | V4L2_BUF_FLAG_DONE);
+			if (dev->app_queued & V4L2_FRAME_BIT(buf->index))
+				buf->flags |= V4L2_BUF_FLAG_QUEUED;
+		}
+
 		v4l2_set_conversion_buf_params(index, buf);
 		break;
 	}
@@ -1352,21 +2528,35 @@ no_capture_request:
 	case VIDIOC_QBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
 		}
 
+		if (v4l2_needs_conversion(index) &&
+		    dev->memory != V4L2_MEMORY_MMAP) {
+			result = v4l2_set_app_buffer(index, buf);
+			if (result)
+				break;
+		}
+
+		if (v4l2_async_conversion(index)) {
+			result = v4l2_async_qbuf(index, buf);
+			v4l2_set_conversion_buf_params(index, buf);
+			break;
+		}
+
 		/* With some drivers the buffers must be mapped before queuing */
 		if (v4l2_needs_conversion(index)) {
 			result = v4l2_map_buffers(index);
 			if (result)
 				break;
+			buf->memory = V4L2_MEMORY_MMAP;
 		}
 
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, VIDIOC_QBUF, arg);
 
 		v4l2_set_conversion_buf_params(index, buf);
@@ -1376,35 +2566,49 @@ no_capture_request:
 	case VIDIOC_DQBUF: {
 		struct v4l2_buffer *buf = arg;
 
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
 		}
 
 		if (!v4l2_needs_conversion(index)) {
-			pthread_mutex_unlock(&devices[index].stream_lock);
-			result = devices[index].dev_ops->ioctl(
-					devices[index].dev_ops_priv,
+			unsigned long long stats_time = v4l2_stats_time(index);
+
+			pthread_mutex_unlock(&dev->stream_lock);
+			result = dev->dev_ops->ioctl(
+					dev->dev_ops_priv,
 					fd, VIDIOC_DQBUF, buf);
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
+			v4l2_stats_add(index, &dev->stats.dequeue_ns,
+				       stats_time);
 			if (result) {
 				saved_err = errno;
 				V4L2_PERROR("dequeuing buf");
 				errno = saved_err;
+				break;
 			}
+			v4l2_stats_sequence(index, buf);
+			v4l2_stats_frame_done(index);
+			break;
+		}
+
+		if (v4l2_async_conversion(index)) {
+			result = v4l2_async_dqbuf(index, buf);
+			v4l2_set_conversion_buf_params(index, buf);
 			break;
 		}
 
 		/* An application can do a DQBUF before mmap-ing in the buffer,
 		   but we need the buffer _now_ to write our converted data
 		   to it! */
-		result = v4l2_ensure_convert_mmap_buf(index);
-		if (result)
-			break;
+		if (dev->memory == V4L2_MEMORY_MMAP) {
+			result = v4l2_ensure_convert_mmap_buf(index);
+			if (result)
+				break;
+		}
 
-		result = v4l2_dequeue_and_convert(index, buf, 0,
-				devices[index].convert_mmap_frame_size);
+		result = v4l2_dequeue_and_convert(index, buf, NULL, 0);
 		if (result >= 0) {
 			buf->bytesused = result;
 			result = 0;
@@ -1416,16 +2620,21 @@ no_capture_request:
 
 	case VIDIOC_STREAMON:
 	case VIDIOC_STREAMOFF:
-		if (devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) {
+		if (dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) {
 			result = v4l2_deactivate_read_stream(index);
 			if (result)
 				break;
 		}
 
-		if (request == VIDIOC_STREAMON)
-			result = v4l2_streamon(index);
-		else
+		if (request == VIDIOC_STREAMON) {
+			if (v4l2_async_conversion(index))
+				result = v4l2_async_streamon(index);
+			else
+				result = v4l2_streamon(index);
+		} else {
+			v4l2_async_stop(index);
 			result = v4l2_streamoff(index);
+		}
 		break;
 
 	case VIDIOC_S_PARM: {
@@ -1433,7 +2642,7 @@ no_capture_request:
 
 		/* See if libv4lconvert wishes to use a different src_fmt
 		   for the new frame rate and set that first */
-		if ((devices[index].flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
+		if ((dev->flags & V4L2_SUPPORTS_TIMEPERFRAME) &&
 		    parm->parm.capture.timeperframe.numerator != 0) {
 			int fps = parm->parm.capture.timeperframe.denominator;
 			fps += parm->parm.capture.timeperframe.numerator - 1;
@@ -1441,8 +2650,8 @@ no_capture_request:
 			v4l2_adjust_src_fmt_to_fps(index, fps);
 		}
 
-		result = devices[index].dev_ops->ioctl(
-						devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+						dev->dev_ops_priv,
 						fd, VIDIOC_S_PARM, parm);
 		if (result)
 			break;
@@ -1452,16 +2661,21 @@ no_capture_request:
 	}
 
 	default:
-		result = devices[index].dev_ops->ioctl(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->ioctl(
+				dev->dev_ops_priv,
 				fd, request, arg);
 		break;
 	}
 
+	if (control_needs_locking)
+		pthread_mutex_unlock(&dev->control_lock);
+	if (fmt_needs_locking)
+		pthread_mutex_unlock(&dev->fmt_lock);
 	if (stream_needs_locking)
-		pthread_mutex_unlock(&devices[index].stream_lock);
+		pthread_mutex_unlock(&dev->stream_lock);
 
 	saved_err = errno;
+	USDT(libv4l2, ioctl_exit, fd, request, result, saved_err);
 	v4l2_log_ioctl(request, arg, result);
 	errno = saved_err;
 
@@ -1470,22 +2684,23 @@ no_capture_request:
 
 static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 {
+	struct v4l2_dev_info *dev = v4l2_dev(index);
 	struct v4l2_pix_format req_pix_fmt;
 	struct v4l2_format src_fmt;
-	struct v4l2_format dest_fmt = devices[index].dest_fmt;
-	struct v4l2_format orig_src_fmt = devices[index].src_fmt;
-	struct v4l2_format orig_dest_fmt = devices[index].dest_fmt;
+	struct v4l2_format dest_fmt = dev->dest_fmt;
+	struct v4l2_format orig_src_fmt = dev->src_fmt;
+	struct v4l2_format orig_dest_fmt = dev->dest_fmt;
 	int r;
 
-	if (fps == devices[index].fps)
+	if (fps == dev->fps)
 		return;
 
 	if (v4l2_check_buffer_change_ok(index))
 		return;
 
-	v4lconvert_set_fps(devices[index].convert, fps);
-	r = v4lconvert_try_format(devices[index].convert, &dest_fmt, &src_fmt);
-	v4lconvert_set_fps(devices[index].convert, V4L2_DEFAULT_FPS);
+	v4lconvert_set_fps(dev->convert, fps);
+	r = v4lconvert_try_format(dev->convert, &dest_fmt, &src_fmt);
+	v4lconvert_set_fps(dev->convert, V4L2_DEFAULT_FPS);
 	if (r)
 		return;
 
@@ -1494,8 +2709,8 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 		return;
 
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt))
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_S_FMT, &src_fmt))
 		return;
 
 	v4l2_set_src_and_dest_format(index, &src_fmt, &dest_fmt);
@@ -1522,8 +2737,8 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 	src_fmt = orig_src_fmt;
 	dest_fmt = orig_dest_fmt;
 	req_pix_fmt = src_fmt.fmt.pix;
-	if (devices[index].dev_ops->ioctl(devices[index].dev_ops_priv,
-			devices[index].fd, VIDIOC_S_FMT, &src_fmt)) {
+	if (dev->dev_ops->ioctl(dev->dev_ops_priv,
+			dev->fd, VIDIOC_S_FMT, &src_fmt)) {
 		V4L2_PERROR("restoring src fmt");
 		return;
 	}
@@ -1537,27 +2752,29 @@ static void v4l2_adjust_src_fmt_to_fps(int index, int fps)
 
 ssize_t v4l2_read(int fd, void *dest, size_t n)
 {
+	struct v4l2_dev_info *dev;
 	ssize_t result;
 	int saved_errno;
 	int index = v4l2_get_index(fd);
 
 	if (index == -1)
 		return SYS_READ(fd, dest, n);
+	dev = v4l2_dev(index);
 
-	if (!devices[index].dev_ops->read) {
+	if (!dev->dev_ops->read) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
 	/* When not converting and the device supports read(), let the kernel handle
 	   it */
-	if (devices[index].convert == NULL ||
-	    ((devices[index].flags & V4L2_SUPPORTS_READ) &&
+	if (dev->convert == NULL ||
+	    ((dev->flags & V4L2_SUPPORTS_READ) &&
 			!v4l2_needs_conversion(index))) {
-		result = devices[index].dev_ops->read(
-				devices[index].dev_ops_priv,
+		result = dev->dev_ops->read(
+				dev->dev_ops_priv,
 				fd, dest, n);
 		goto leave;
 	}
@@ -1570,19 +2787,21 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 	   select or poll() is done before any buffers are requested. So using mmap
 	   mode under the hood will fail if a select() or poll() is done before the
 	   first emulated read() call. */
-	if (!(devices[index].flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
-			!(devices[index].flags & V4L2_USE_READ_FOR_READ)) {
+	if (!(dev->flags & V4L2_STREAM_CONTROLLED_BY_READ) &&
+			!(dev->flags & V4L2_USE_READ_FOR_READ)) {
 		result = v4l2_activate_read_stream(index);
 		if (result) {
 			/* Activating mmap mode failed, use read() instead */
-			devices[index].flags |= V4L2_USE_READ_FOR_READ;
+			dev->flags |= V4L2_USE_READ_FOR_READ;
 			/* The read call done by v4l2_read_and_convert will start the stream */
-			devices[index].first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
+			dev->first_frame = V4L2_IGNORE_FIRST_FRAME_ERRORS;
 		}
 	}
 
-	if (devices[index].flags & V4L2_USE_READ_FOR_READ) {
+	if (dev->flags & V4L2_USE_READ_FOR_READ) {
 		result = v4l2_read_and_convert(index, dest, n);
+	} else if (dev->async_started) {
+		result = v4l2_async_read(index, dest, n);
 	} else {
 		struct v4l2_buffer buf;
 
@@ -1596,7 +2815,7 @@ ssize_t v4l2_read(int fd, void *dest, size_t n)
 
 leave:
 	saved_errno = errno;
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 	errno = saved_errno;
 
 	return result;
@@ -1604,34 +2823,38 @@ leave:
 
 ssize_t v4l2_write(int fd, const void *buffer, size_t n)
 {
+	struct v4l2_dev_info *dev;
 	int index = v4l2_get_index(fd);
 
 	if (index == -1)
 		return SYS_WRITE(fd, buffer, n);
+	dev = v4l2_dev(index);
 
-	if (!devices[index].dev_ops->write) {
+	if (!dev->dev_ops->write) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return devices[index].dev_ops->write(
-			devices[index].dev_ops_priv, fd, buffer, n);
+	return dev->dev_ops->write(dev->dev_ops_priv, fd, buffer, n);
 }
 
 void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		int64_t offset)
 {
+	struct v4l2_dev_info *dev = NULL;
 	int index;
 	unsigned int buffer_index;
 	void *result;
 
 	index = v4l2_get_index(fd);
-	if (index == -1 ||
+	if (index != -1)
+		dev = v4l2_dev(index);
+	if (!dev ||
 			/* Check if the mmap data matches our answer to QUERY_BUF. If it doesn't,
 			   let the kernel handle it (to allow for mmap-based non capture use) */
-			start || length != devices[index].convert_mmap_frame_size ||
+			start || length != dev->convert_mmap_frame_size ||
 			((unsigned int)offset & ~0xFFu) != V4L2_MMAP_OFFSET_MAGIC) {
-		if (index != -1)
+		if (dev)
 			V4L2_LOG("Passing mmap(%p, %d, ..., %x, through to the driver\n",
 					start, (int)length, (int)offset);
 
@@ -1643,10 +2866,10 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		return (void *)SYS_MMAP(start, length, prot, flags, fd, offset);
 	}
 
-	pthread_mutex_lock(&devices[index].stream_lock);
+	pthread_mutex_lock(&dev->stream_lock);
 
 	buffer_index = offset & 0xff;
-	if (buffer_index >= devices[index].no_frames ||
+	if (buffer_index >= dev->no_frames ||
 			/* Got magic offset and not converting ?? */
 			!v4l2_needs_conversion(index)) {
 		errno = EINVAL;
@@ -1660,55 +2883,60 @@ void *v4l2_mmap(void *start, size_t length, int prot, int flags, int fd,
 		goto leave;
 	}
 
-	devices[index].frame_map_count[buffer_index]++;
+	dev->frame_map_count[buffer_index]++;
 
-	result = devices[index].convert_mmap_buf +
-		buffer_index * devices[index].convert_mmap_frame_size;
+	result = dev->convert_mmap_buf +
+		buffer_index * dev->convert_mmap_frame_size;
 
 	V4L2_LOG("Fake (conversion) mmap buf %u, seen by app at: %p\n",
 			buffer_index, result);
 
 leave:
-	pthread_mutex_unlock(&devices[index].stream_lock);
+	pthread_mutex_unlock(&dev->stream_lock);
 
 	return result;
 }
 
 int v4l2_munmap(void *_start, size_t length)
 {
+	struct v4l2_dev_info *dev;
 	int index;
 	unsigned int buffer_index;
 	unsigned char *start = _start;
 
 	/* Is this memory ours? */
 	if (start != MAP_FAILED) {
-		for (index = 0; index < devices_used; index++)
-			if (devices[index].fd != -1 &&
-					devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0)
+		int used = __atomic_load_n(&devices_used, __ATOMIC_ACQUIRE);
+
+		for (index = 0; index < used; index++) {
+			dev = v4l2_dev(index);
+			if (dev && dev->fd != -1 &&
+					dev->convert_mmap_buf != MAP_FAILED &&
+					length == dev->convert_mmap_frame_size &&
+					start >= dev->convert_mmap_buf &&
+					(start - dev->convert_mmap_buf) % length == 0)
 				break;
+		}
 
-		if (index != devices_used) {
+		if (index != used) {
 			int unmapped = 0;
 
-			pthread_mutex_lock(&devices[index].stream_lock);
+			pthread_mutex_lock(&dev->stream_lock);
 
-			buffer_index = (start - devices[index].convert_mmap_buf) / length;
+			buffer_index = (start - dev->convert_mmap_buf) / length;
 
 			/* Re-do our checks now that we have the lock, things may have changed */
-			if (devices[index].convert_mmap_buf != MAP_FAILED &&
-					length == devices[index].convert_mmap_frame_size &&
-					start >= devices[index].convert_mmap_buf &&
-					(start - devices[index].convert_mmap_buf) % length == 0 &&
-					buffer_index < devices[index].no_frames) {
-				if (devices[index].frame_map_count[buffer_index] > 0)
-					devices[index].frame_map_count[buffer_index]--;
+			if (dev->convert_mmap_buf != MAP_FAILED &&
+					length == dev->convert_mmap_frame_size &&
+					start >= dev->convert_mmap_buf &&
+					(start - dev->convert_mmap_buf) % length == 0 &&
+					buffer_index < dev->no_frames) {
+				if (dev->frame_map_count[buffer_index] > 0)
+					dev->frame_map_count[buffer_index]--;
 				unmapped = 1;
 			}
 
-			pthread_mutex_unlock(&devices[index].stream_lock);
+			pthread_mutex_unlock(&dev->stream_lock);
 
 			if (unmapped) {
 				V4L2_LOG("v4l2 fake buffer munmap %p, %d\n", start, (int)length);
@@ -1727,18 +2955,22 @@ int v4l2_set_control(int fd, int cid, int value)
 {
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
+	struct v4l2_dev_info *dev = NULL;
 	int index, result;
 
 	index = v4l2_get_index(fd);
-	if (index == -1 || devices[index].convert == NULL) {
+	if (index != -1)
+		dev = v4l2_dev(index);
+	if (!dev || dev->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	result = v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl);
+	pthread_mutex_lock(&dev->control_lock);
+	result = v4lconvert_vidioc_queryctrl(dev->convert, &qctrl);
 	if (result)
-		return result;
+		goto leave;
 
 	if (!(qctrl.flags & V4L2_CTRL_FLAG_DISABLED) &&
 			!(qctrl.flags & V4L2_CTRL_FLAG_GRABBED)) {
@@ -1748,9 +2980,11 @@ int v4l2_set_control(int fd, int cid, int value)
 			ctrl.value = ((long long) value * (qctrl.maximum - qctrl.minimum) + 32767) / 65535 +
 				qctrl.minimum;
 
-		result = v4lconvert_vidioc_s_ctrl(devices[index].convert, &ctrl);
+		result = v4lconvert_vidioc_s_ctrl(dev->convert, &ctrl);
 	}
 
+leave:
+	pthread_mutex_unlock(&dev->control_lock);
 	return result;
 }
 
@@ -1758,26 +2992,68 @@ int v4l2_get_control(int fd, int cid)
 {
 	struct v4l2_queryctrl qctrl = { .id = cid };
 	struct v4l2_control ctrl = { .id = cid };
-	int index = v4l2_get_index(fd);
+	struct v4l2_dev_info *dev = NULL;
+	int index = v4l2_get_index(fd), result;
 
-	if (index == -1 || devices[index].convert == NULL) {
+	if (index != -1)
+		dev = v4l2_dev(index);
+	if (!dev || dev->convert == NULL) {
 		V4L2_LOG_ERR("v4l2_set_control called with invalid fd: %d\n", fd);
 		errno = EBADF;
 		return -1;
 	}
 
-	if (v4lconvert_vidioc_queryctrl(devices[index].convert, &qctrl))
-		return -1;
-
-	if (qctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
+	pthread_mutex_lock(&dev->control_lock);
+	result = v4lconvert_vidioc_queryctrl(dev->convert, &qctrl);
+	if (!result && (qctrl.flags & V4L2_CTRL_FLAG_DISABLED)) {
 		errno = EINVAL;
-		return -1;
+		result = -1;
 	}
-
-	if (v4lconvert_vidioc_g_ctrl(devices[index].convert, &ctrl))
+	if (!result)
+		result = v4lconvert_vidioc_g_ctrl(dev->convert, &ctrl);
+	pthread_mutex_unlock(&dev->control_lock);
+	if (result)
 		return -1;
 
 	return (((long long) ctrl.value - qctrl.minimum) * 65535 +
 			(qctrl.maximum - qctrl.minimum) / 2) /
 		(qctrl.maximum - qctrl.minimum);
 }
+
+int v4l2_get_frame_stats(int fd, struct v4l2_frame_stats *stats)
+{
+	struct v4l2_dev_info *dev;
+	int index = v4l2_get_index(fd);
+
+	if (index == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	dev = v4l2_dev(index);
+
+	pthread_mutex_lock(&dev->stream_lock);
+	v4l2_get_stats(index, stats);
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return 0;
+}
+
+int v4l2_reset_frame_stats(int fd)
+{
+	struct v4l2_dev_info *dev;
+	int index = v4l2_get_index(fd);
+
+	if (index == -1) {
+		errno = EBADF;
+		return -1;
+	}
+	dev = v4l2_dev(index);
+
+	pthread_mutex_lock(&dev->stream_lock);
+	memset(&dev->stats, 0, sizeof(dev->stats));
+	if (dev->convert)
+		v4lconvert_reset_stats(dev->convert);
+	pthread_mutex_unlock(&dev->stream_lock);
+
+	return 0;
+}
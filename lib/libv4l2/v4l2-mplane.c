@@ -0,0 +1,456 @@
+/*
+
+# Native handling of multi-planar capture devices
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+/* Devices which only support the multi-planar capture API get the dev_ops
+   below stacked on top of their (plugin or default) dev_ops. These present
+   the device as a single-planar one to the rest of libv4l2 and to
+   libv4lconvert, for the format negotiation ioctls. Formats with separate
+   plane buffers (NV12M, YUV420M, ...) are reported as their contiguous
+   equivalent (NV12, YUV420, ...), with a sizeimage covering all planes.
+
+   The per-frame buffer handling of libv4l2 itself does not go through these,
+   it uses v4l2_mplane_buf_ioctl() to queue and dequeue multi-planar buffers
+   directly and maps / gathers the separate planes itself. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libv4l2.h"
+#include "libv4l2-priv.h"
+#include "libv4l-plugin.h"
+
+struct v4l2_mplane_priv {
+	/* The dev_ops we're stacked on top of */
+	const struct libv4l_dev_ops *dev_ops;
+	void *dev_ops_priv;
+	/* Number of planes of the format last set / gotten */
+	unsigned int num_planes;
+};
+
+static const struct {
+	unsigned int pixelformat;	/* contiguous equivalent */
+	unsigned int mplane_pixelformat;
+	unsigned char planes;
+	unsigned char hsub;		/* horizontal chroma bytesperline divider */
+	unsigned char vsub;		/* vertical chroma subsampling */
+} v4l2_mplane_formats[] = {
+	{ V4L2_PIX_FMT_NV12,	V4L2_PIX_FMT_NV12M,	2, 1, 2 },
+	{ V4L2_PIX_FMT_NV21,	V4L2_PIX_FMT_NV21M,	2, 1, 2 },
+	{ V4L2_PIX_FMT_NV16,	V4L2_PIX_FMT_NV16M,	2, 1, 1 },
+	{ V4L2_PIX_FMT_NV61,	V4L2_PIX_FMT_NV61M,	2, 1, 1 },
+	{ V4L2_PIX_FMT_YUV420,	V4L2_PIX_FMT_YUV420M,	3, 2, 2 },
+	{ V4L2_PIX_FMT_YVU420,	V4L2_PIX_FMT_YVU420M,	3, 2, 2 },
+	{ V4L2_PIX_FMT_YUV422P,	V4L2_PIX_FMT_YUV422M,	3, 2, 1 },
+};
+
+#define V4L2_MPLANE_NO_FORMATS \
+	(sizeof(v4l2_mplane_formats) / sizeof(v4l2_mplane_formats[0]))
+
+static int v4l2_mplane_find_format(unsigned int pixelformat, int mplane)
+{
+	unsigned int i;
+
+	for (i = 0; i < V4L2_MPLANE_NO_FORMATS; i++)
+		if ((mplane ? v4l2_mplane_formats[i].mplane_pixelformat :
+			      v4l2_mplane_formats[i].pixelformat) == pixelformat)
+			return i;
+
+	return -1;
+}
+
+static unsigned int v4l2_mplane_contiguous_fmt(unsigned int pixelformat)
+{
+	int i = v4l2_mplane_find_format(pixelformat, 1);
+
+	return i == -1 ? pixelformat : v4l2_mplane_formats[i].pixelformat;
+}
+
+/* Size of plane of pix in the contiguous layout libv4lconvert expects */
+unsigned int v4l2_mplane_plane_size(const struct v4l2_pix_format *pix,
+				    unsigned int plane)
+{
+	int i = v4l2_mplane_find_format(pix->pixelformat, 0);
+
+	if (plane == 0)
+		return i == -1 ? pix->sizeimage : pix->bytesperline * pix->height;
+
+	if (i == -1 || plane >= v4l2_mplane_formats[i].planes)
+		return 0;
+
+	return pix->bytesperline / v4l2_mplane_formats[i].hsub *
+	       (pix->height / v4l2_mplane_formats[i].vsub);
+}
+
+static int v4l2_mplane_type(int type)
+{
+	if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+	return type;
+}
+
+static int v4l2_mplane_ioctl_inner(struct v4l2_mplane_priv *priv, int fd,
+		unsigned long int request, void *arg)
+{
+	return priv->dev_ops->ioctl(priv->dev_ops_priv, fd, request, arg);
+}
+
+static void v4l2_mplane_to_pix(const struct v4l2_format *fmt,
+			       struct v4l2_format *org)
+{
+	const struct v4l2_pix_format_mplane *mp = &fmt->fmt.pix_mp;
+	unsigned int i, sizeimage = 0;
+
+	for (i = 0; i < mp->num_planes && i < VIDEO_MAX_PLANES; i++)
+		sizeimage += mp->plane_fmt[i].sizeimage;
+
+	memset(&org->fmt.pix, 0, sizeof(org->fmt.pix));
+	org->fmt.pix.width = mp->width;
+	org->fmt.pix.height = mp->height;
+	org->fmt.pix.pixelformat = v4l2_mplane_contiguous_fmt(mp->pixelformat);
+	org->fmt.pix.field = mp->field;
+	org->fmt.pix.bytesperline = mp->plane_fmt[0].bytesperline;
+	org->fmt.pix.sizeimage = sizeimage;
+	org->fmt.pix.colorspace = mp->colorspace;
+	org->fmt.pix.priv = V4L2_PIX_FMT_PRIV_MAGIC;
+	org->fmt.pix.flags = mp->flags;
+	org->fmt.pix.ycbcr_enc = mp->ycbcr_enc;
+	org->fmt.pix.quantization = mp->quantization;
+	org->fmt.pix.xfer_func = mp->xfer_func;
+}
+
+static void v4l2_pix_to_mplane(const struct v4l2_format *org,
+			       unsigned int pixelformat,
+			       struct v4l2_format *fmt)
+{
+	const struct v4l2_pix_format *pix = &org->fmt.pix;
+
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	fmt->fmt.pix_mp.width = pix->width;
+	fmt->fmt.pix_mp.height = pix->height;
+	fmt->fmt.pix_mp.pixelformat = pixelformat;
+	fmt->fmt.pix_mp.field = pix->field;
+	fmt->fmt.pix_mp.colorspace = pix->colorspace;
+	fmt->fmt.pix_mp.num_planes = 1;
+	fmt->fmt.pix_mp.plane_fmt[0].bytesperline = pix->bytesperline;
+	fmt->fmt.pix_mp.plane_fmt[0].sizeimage = pix->sizeimage;
+	/* The extended fields are only valid with the magic priv value */
+	if (pix->priv == V4L2_PIX_FMT_PRIV_MAGIC) {
+		fmt->fmt.pix_mp.flags = pix->flags;
+		fmt->fmt.pix_mp.ycbcr_enc = pix->ycbcr_enc;
+		fmt->fmt.pix_mp.quantization = pix->quantization;
+		fmt->fmt.pix_mp.xfer_func = pix->xfer_func;
+	}
+}
+
+static int v4l2_mplane_fmt_ioctl(struct v4l2_mplane_priv *priv, int fd,
+		unsigned long int request, struct v4l2_format *arg)
+{
+	struct v4l2_format fmt;
+	unsigned int pixelformat;
+	int i, result;
+
+	if (arg->type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+
+	if (request == VIDIOC_G_FMT) {
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		result = v4l2_mplane_ioctl_inner(priv, fd, request, &fmt);
+	} else {
+		pixelformat = arg->fmt.pix.pixelformat;
+		v4l2_pix_to_mplane(arg, pixelformat, &fmt);
+		result = v4l2_mplane_ioctl_inner(priv, fd, VIDIOC_TRY_FMT, &fmt);
+		/* If the driver only has the separate planes variant, use that */
+		i = v4l2_mplane_find_format(pixelformat, 0);
+		if (!result && fmt.fmt.pix_mp.pixelformat != pixelformat &&
+		    i != -1) {
+			struct v4l2_format mp_fmt;
+
+			v4l2_pix_to_mplane(arg,
+				v4l2_mplane_formats[i].mplane_pixelformat,
+				&mp_fmt);
+			if (!v4l2_mplane_ioctl_inner(priv, fd, VIDIOC_TRY_FMT,
+						     &mp_fmt) &&
+			    mp_fmt.fmt.pix_mp.pixelformat ==
+			    v4l2_mplane_formats[i].mplane_pixelformat)
+				fmt = mp_fmt;
+		}
+		if (!result && request == VIDIOC_S_FMT)
+			result = v4l2_mplane_ioctl_inner(priv, fd, request,
+							 &fmt);
+	}
+	if (result)
+		return result;
+
+	v4l2_mplane_to_pix(&fmt, arg);
+	if (request != VIDIOC_TRY_FMT)
+		priv->num_planes = fmt.fmt.pix_mp.num_planes;
+
+	return 0;
+}
+
+static int v4l2_mplane_create_bufs(struct v4l2_mplane_priv *priv, int fd,
+		struct v4l2_create_buffers *arg)
+{
+	struct v4l2_create_buffers cbufs;
+	int result;
+
+	if (arg->format.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+		return v4l2_mplane_ioctl_inner(priv, fd, VIDIOC_CREATE_BUFS,
+					       arg);
+
+	cbufs = *arg;
+	v4l2_pix_to_mplane(&arg->format, arg->format.fmt.pix.pixelformat,
+			   &cbufs.format);
+	result = v4l2_mplane_ioctl_inner(priv, fd, VIDIOC_CREATE_BUFS, &cbufs);
+
+	arg->index = cbufs.index;
+	arg->count = cbufs.count;
+	arg->capabilities = cbufs.capabilities;
+	v4l2_mplane_to_pix(&cbufs.format, &arg->format);
+
+	return result;
+}
+
+/* Passes a capture buffer ioctl on as a multi-planar one. The info of plane
+   0 is exchanged through buf itself, planes must point to VIDEO_MAX_PLANES
+   planes and receives the info of all of them. */
+int v4l2_mplane_buf_ioctl(void *dev_ops_priv, int fd, unsigned long int request,
+			  struct v4l2_buffer *buf, struct v4l2_plane *planes)
+{
+	struct v4l2_mplane_priv *priv = dev_ops_priv;
+	struct v4l2_buffer mbuf = *buf;
+	int result;
+
+	memset(planes, 0, VIDEO_MAX_PLANES * sizeof(*planes));
+	memcpy(&planes[0].m, &buf->m, sizeof(planes[0].m));
+	planes[0].length = buf->length;
+	planes[0].bytesused = buf->bytesused;
+
+	mbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	mbuf.m.planes = planes;
+	mbuf.length = VIDEO_MAX_PLANES;
+
+	result = v4l2_mplane_ioctl_inner(priv, fd, request, &mbuf);
+
+	buf->index = mbuf.index;
+	buf->memory = mbuf.memory;
+	buf->flags = mbuf.flags;
+	buf->field = mbuf.field;
+	buf->timestamp = mbuf.timestamp;
+	buf->timecode = mbuf.timecode;
+	buf->sequence = mbuf.sequence;
+	buf->length = planes[0].length;
+	buf->bytesused = planes[0].bytesused;
+	memcpy(&buf->m, &planes[0].m, sizeof(buf->m));
+
+	return result;
+}
+
+/* ENUM_FRAMESIZES / ENUM_FRAMEINTERVALS, for formats we report as their
+   contiguous equivalent the driver may only know the mplane variant */
+static int v4l2_mplane_enum_ioctl(struct v4l2_mplane_priv *priv, int fd,
+		unsigned long int request, void *arg, unsigned int *pixelformat)
+{
+	unsigned int org = *pixelformat;
+	int i, result;
+
+	result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+	i = v4l2_mplane_find_format(org, 0);
+	if (result && errno == EINVAL && i != -1) {
+		*pixelformat = v4l2_mplane_formats[i].mplane_pixelformat;
+		result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+		*pixelformat = org;
+	}
+
+	return result;
+}
+
+unsigned int v4l2_mplane_num_planes(void *dev_ops_priv)
+{
+	struct v4l2_mplane_priv *priv = dev_ops_priv;
+
+	return priv->num_planes;
+}
+
+static int v4l2_mplane_ioctl(void *dev_ops_priv, int fd,
+		unsigned long int request, void *arg)
+{
+	struct v4l2_mplane_priv *priv = dev_ops_priv;
+
+	switch (request) {
+	case VIDIOC_QUERYCAP: {
+		struct v4l2_capability *cap = arg;
+		int result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+
+		if (result)
+			return result;
+
+		/* Report the mplane capture cap as a normal one */
+		if (cap->capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+			cap->capabilities |= V4L2_CAP_VIDEO_CAPTURE;
+		if (cap->device_caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+			cap->device_caps |= V4L2_CAP_VIDEO_CAPTURE;
+		cap->capabilities |= V4L2_CAP_EXT_PIX_FORMAT;
+		cap->device_caps |= V4L2_CAP_EXT_PIX_FORMAT;
+		cap->capabilities &= ~V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+		cap->device_caps &= ~V4L2_CAP_VIDEO_CAPTURE_MPLANE;
+		return 0;
+	}
+	case VIDIOC_TRY_FMT:
+	case VIDIOC_S_FMT:
+	case VIDIOC_G_FMT:
+		return v4l2_mplane_fmt_ioctl(priv, fd, request, arg);
+	case VIDIOC_ENUM_FMT: {
+		struct v4l2_fmtdesc *fmtdesc = arg;
+		int result, type = fmtdesc->type;
+
+		fmtdesc->type = v4l2_mplane_type(type);
+		result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+		fmtdesc->type = type;
+		if (!result && type == V4L2_BUF_TYPE_VIDEO_CAPTURE)
+			fmtdesc->pixelformat =
+				v4l2_mplane_contiguous_fmt(fmtdesc->pixelformat);
+		return result;
+	}
+	case VIDIOC_ENUM_FRAMESIZES:
+		return v4l2_mplane_enum_ioctl(priv, fd, request, arg,
+			&((struct v4l2_frmsizeenum *)arg)->pixel_format);
+	case VIDIOC_ENUM_FRAMEINTERVALS:
+		return v4l2_mplane_enum_ioctl(priv, fd, request, arg,
+			&((struct v4l2_frmivalenum *)arg)->pixel_format);
+	case VIDIOC_G_PARM:
+	case VIDIOC_S_PARM: {
+		struct v4l2_streamparm *parm = arg;
+		int result, type = parm->type;
+
+		parm->type = v4l2_mplane_type(type);
+		result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+		parm->type = type;
+		return result;
+	}
+	case VIDIOC_REQBUFS: {
+		struct v4l2_requestbuffers *req = arg;
+		int result, type = req->type;
+
+		req->type = v4l2_mplane_type(type);
+		result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+		req->type = type;
+		return result;
+	}
+	case VIDIOC_CREATE_BUFS:
+		return v4l2_mplane_create_bufs(priv, fd, arg);
+	case VIDIOC_QUERYBUF:
+	case VIDIOC_QBUF:
+	case VIDIOC_DQBUF:
+	case VIDIOC_PREPARE_BUF: {
+		struct v4l2_plane planes[VIDEO_MAX_PLANES];
+
+		if (((struct v4l2_buffer *)arg)->type !=
+		    V4L2_BUF_TYPE_VIDEO_CAPTURE)
+			return v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+		return v4l2_mplane_buf_ioctl(priv, fd, request, arg, planes);
+	}
+	case VIDIOC_EXPBUF: {
+		struct v4l2_exportbuffer *expbuf = arg;
+		int result, type = expbuf->type;
+
+		expbuf->type = v4l2_mplane_type(type);
+		result = v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+		expbuf->type = type;
+		return result;
+	}
+	case VIDIOC_STREAMON:
+	case VIDIOC_STREAMOFF: {
+		int type = v4l2_mplane_type(*(int *)arg);
+
+		return v4l2_mplane_ioctl_inner(priv, fd, request, &type);
+	}
+	default:
+		return v4l2_mplane_ioctl_inner(priv, fd, request, arg);
+	}
+}
+
+static ssize_t v4l2_mplane_read(void *dev_ops_priv, int fd, void *buf,
+				size_t len)
+{
+	struct v4l2_mplane_priv *priv = dev_ops_priv;
+
+	return priv->dev_ops->read(priv->dev_ops_priv, fd, buf, len);
+}
+
+static ssize_t v4l2_mplane_write(void *dev_ops_priv, int fd, const void *buf,
+				 size_t len)
+{
+	struct v4l2_mplane_priv *priv = dev_ops_priv;
+
+	return priv->dev_ops->write(priv->dev_ops_priv, fd, buf, len);
+}
+
+static const struct libv4l_dev_ops v4l2_mplane_dev_ops = {
+	.ioctl = v4l2_mplane_ioctl,
+	.read = v4l2_mplane_read,
+	.write = v4l2_mplane_write,
+};
+
+/* Stack our dev_ops on top of *dev_ops if cap says this is a multi-planar
+   only capture device, returns 1 if we did, 0 if not needed and -1 on error */
+int v4l2_mplane_wrap(const struct v4l2_capability *cap,
+		     const struct libv4l_dev_ops **dev_ops, void **dev_ops_priv)
+{
+	struct v4l2_mplane_priv *priv;
+	unsigned int caps = cap->capabilities;
+
+	if (caps & V4L2_CAP_DEVICE_CAPS)
+		caps = cap->device_caps;
+	if ((caps & V4L2_CAP_VIDEO_CAPTURE) ||
+	    !(caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE))
+		return 0;
+
+	priv = calloc(1, sizeof(*priv));
+	if (!priv) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	priv->dev_ops = *dev_ops;
+	priv->dev_ops_priv = *dev_ops_priv;
+	priv->num_planes = 1;
+	*dev_ops = &v4l2_mplane_dev_ops;
+	*dev_ops_priv = priv;
+
+	return 1;
+}
+
+/* Undo v4l2_mplane_wrap, a no-op for dev_ops which were not wrapped */
+void v4l2_mplane_unwrap(const struct libv4l_dev_ops **dev_ops,
+			void **dev_ops_priv)
+{
+	struct v4l2_mplane_priv *priv = *dev_ops_priv;
+
+	if (*dev_ops != &v4l2_mplane_dev_ops)
+		return;
+
+	*dev_ops = priv->dev_ops;
+	*dev_ops_priv = priv->dev_ops_priv;
+	free(priv);
+}
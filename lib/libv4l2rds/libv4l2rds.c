@@ -21,6 +21,25 @@
 
 #include "../include/libv4l2rds.h"
 
+/* maximum number of entries of a table that is indexed by PI code */
+#define RDS_PI_INDEX_CNT 32
+/* number of hash buckets of a PI index, a power of 2 */
+#define RDS_PI_BUCKETS 64
+
+/* index of the PI codes of the EON and TMC station tables, as hash
+ * buckets of linked lists. The links are entry numbers + 1, 0 ends a list */
+struct rds_pi_index {
+	uint8_t bucket[RDS_PI_BUCKETS];
+	uint8_t next[RDS_PI_INDEX_CNT];
+	uint16_t pi[RDS_PI_INDEX_CNT];
+};
+
+/* bitmap of the AF codes in an AF list, 256 VHF codes followed by 256 LF/MF
+ * codes */
+struct rds_af_map {
+	uint32_t known[512 / 32];
+};
+
 /* struct to encapsulate the private state information of the decoding process */
 /* the fields (except for handle) are for internal use only - new information
  * is decoded and stored in them until it can be verified and copied to the
@@ -68,6 +87,12 @@ struct rds_private_state {
 	struct v4l2_rds_group prev_tmc_sys_group;
 	struct v4l2_rds_tmc_msg new_tmc_msg;
 
+	/* indexes of the tables in the public part of the handle */
+	struct rds_pi_index eon_index;
+	struct rds_pi_index tmc_station_index;
+	struct rds_af_map af_map;
+	struct rds_af_map eon_af_map[MAX_EON_CNT];
+
 	/* buffers for rds data, before group type specific decoding can
 	 * be done */
 	struct v4l2_rds_group rds_group;
@@ -233,6 +258,40 @@ static bool rds_compare_group(const struct v4l2_rds_group *a,
 	return true;
 }
 
+static unsigned rds_pi_hash(uint16_t pi)
+{
+	return (pi ^ (pi >> 6) ^ (pi >> 12)) & (RDS_PI_BUCKETS - 1);
+}
+
+/* returns the entry of the given PI code, or -1 if there is none */
+static int rds_pi_find(const struct rds_pi_index *index, uint16_t pi)
+{
+	uint8_t link = index->bucket[rds_pi_hash(pi)];
+
+	while (link && index->pi[link - 1] != pi)
+		link = index->next[link - 1];
+	return link - 1;
+}
+
+/* sets the PI code of an entry, replacing the PI code it had
+ * @in_use:	true if the entry already had a PI code */
+static void rds_pi_set(struct rds_pi_index *index, uint8_t entry,
+		       uint16_t pi, bool in_use)
+{
+	uint8_t *link;
+
+	if (in_use) {
+		link = &index->bucket[rds_pi_hash(index->pi[entry])];
+		while (*link != entry + 1)
+			link = &index->next[*link - 1];
+		*link = index->next[entry];
+	}
+	link = &index->bucket[rds_pi_hash(pi)];
+	index->pi[entry] = pi;
+	index->next[entry] = *link;
+	*link = entry + 1;
+}
+
 /* checks if an entry for the given PI already exists and returns the index
  * of that entry if so. Else it adds a new entry to the TMC-Tuning table and returns
  * the index of the new field */
@@ -241,21 +300,31 @@ static int rds_add_tmc_station(struct rds_private_state *priv_state, uint16_t pi
 	struct v4l2_tmc_tuning *tuning = &priv_state->handle.tmc.tuning;
 	uint8_t index = tuning->index;
 	uint8_t size = tuning->station_cnt;
+	int i = rds_pi_find(&priv_state->tmc_station_index, pi);
 
 	/* check if there's an entry for the given PI key */
-	for (int i = 0; i < tuning->station_cnt; i++) {
-		if (tuning->station[i].pi == pi) {
-			return i;
-		}
-	}
+	if (i >= 0)
+		return i;
 	/* if the the maximum table size is reached, overwrite old
 	 * entries, starting at the oldest one = 0 */
+	rds_pi_set(&priv_state->tmc_station_index, index, pi, index < size);
+	memset(&tuning->station[index], 0, sizeof(tuning->station[index]));
 	tuning->station[index].pi = pi;
 	tuning->index = (index+1 < MAX_TMC_ALT_STATIONS) ? (index+1) : 0;
 	tuning->station_cnt = (size+1 <= MAX_TMC_ALT_STATIONS) ? (size+1) : MAX_TMC_ALT_STATIONS;
 	return index;
 }
 
+/* publishes a new TMC message, as the last message and in the ring */
+static void rds_add_tmc_msg(struct rds_private_state *priv_state,
+			    const struct v4l2_rds_tmc_msg *msg)
+{
+	struct v4l2_rds_tmc *tmc = &priv_state->handle.tmc;
+
+	tmc->tmc_msg = *msg;
+	tmc->tmc_msg_ring[tmc->tmc_msg_cnt++ % MAX_TMC_MSG_CNT] = *msg;
+}
+
 /* tries to add new AFs to the relevant entry in the list of RDS-TMC providers */
 static bool rds_add_tmc_af(struct rds_private_state *priv_state)
 {
@@ -458,7 +527,7 @@ static uint32_t rds_decode_tmc_single_group(struct rds_private_state *priv_state
 	msg.sid = 0;
 
 	/* decoding done, store the new message */
-	priv_state->handle.tmc.tmc_msg = msg;
+	rds_add_tmc_msg(priv_state, &msg);
 	priv_state->handle.valid_fields |= V4L2_RDS_TMC_SG;
 	priv_state->handle.valid_fields &= ~V4L2_RDS_TMC_MG;
 
@@ -540,7 +609,7 @@ static uint32_t rds_decode_tmc_multi_group(struct rds_private_state *priv_state)
 	/* complete message received -> decode additional fields and store
 	 * the new message */
 	if (message_completed) {
-		priv_state->handle.tmc.tmc_msg = *msg;
+		rds_add_tmc_msg(priv_state, msg);
 		rds_tmc_decode_additional(priv_state);
 		priv_state->handle.valid_fields |= V4L2_RDS_TMC_MG;
 		priv_state->handle.valid_fields &= ~V4L2_RDS_TMC_SG;
@@ -622,11 +691,15 @@ static bool rds_add_oda(struct rds_private_state *priv_state, struct v4l2_rds_od
 	return true;
 }
 
-/* add a new AF to the list, if it doesn't exist yet */
-static bool rds_add_af_to_list(struct v4l2_rds_af_set *af_set, uint8_t af, bool is_vhf)
+/* add a new AF to the list, if it doesn't exist yet
+ * @af_map:	the AF codes in the list */
+static bool rds_add_af_to_list(struct v4l2_rds_af_set *af_set, struct rds_af_map *af_map,
+			       uint8_t af, bool is_vhf)
 {
 	/* convert the frequency to Hz, skip on errors */
 	uint32_t freq = rds_decode_af(af, is_vhf);
+	unsigned code = is_vhf ? af : 256 + af;
+	uint32_t bit = 1U << (code % 32);
 
 	if (freq == 0) 
 		return false;
@@ -635,11 +708,10 @@ static bool rds_add_af_to_list(struct v4l2_rds_af_set *af_set, uint8_t af, bool
 	if (af_set->size >= MAX_AF_CNT || af_set->size >= af_set->announced_af)
 		return false;
 	/* check if AF already exists */
-	for (int i = 0; i < af_set->size; i++) {
-		if (af_set->af[i] == freq)
-			return false;
-	}
+	if (af_map->known[code / 32] & bit)
+		return false;
 	/* it's a new AF, add it to the list */
+	af_map->known[code / 32] |= bit;
 	af_set->af[af_set->size++] = freq;
 	return true;
 }
@@ -663,7 +735,7 @@ static bool rds_add_af(struct rds_private_state *priv_state)
 
 	/* 250: LF / MF frequency follows */
 	if (c_msb == 250) {
-		if (rds_add_af_to_list(af_set, c_lsb, false))
+		if (rds_add_af_to_list(af_set, &priv_state->af_map, c_lsb, false))
 			updated_af = true;
 		c_lsb = 0; /* invalidate */
 	}
@@ -672,16 +744,17 @@ static bool rds_add_af(struct rds_private_state *priv_state)
 		if (af_set->announced_af != c_msb - 224) {
 			updated_af = true;
 			af_set->size = 0;
+			memset(&priv_state->af_map, 0, sizeof(priv_state->af_map));
 		}
 		af_set->announced_af = c_msb - 224;
 	}
 	/* check if the data represents an AF (for 1 <= val <= 204 the
 	 * value represents an AF) */
 	if (c_msb < 205)
-		if (rds_add_af_to_list(af_set, c_msb, true))
+		if (rds_add_af_to_list(af_set, &priv_state->af_map, c_msb, true))
 			updated_af = true;
 	if (c_lsb < 205)
-		if (rds_add_af_to_list(af_set, c_lsb, true))
+		if (rds_add_af_to_list(af_set, &priv_state->af_map, c_lsb, true))
 			updated_af = true;
 	/* did we receive all announced AFs? */
 	if (af_set->size >= af_set->announced_af && af_set->announced_af != 0)
@@ -720,15 +793,16 @@ static uint8_t rds_add_eon_entry(struct rds_private_state *priv_state, uint16_t
 	struct v4l2_rds *handle = &priv_state->handle;
 	uint8_t index = handle->rds_eon.index;
 	uint8_t size = handle->rds_eon.size;
+	int i = rds_pi_find(&priv_state->eon_index, pi);
 
 	/* check if there's an entry for the given PI key */
-	for (int i = 0; i < handle->rds_eon.size; i++) {
-		if (handle->rds_eon.eon[i].pi == pi) {
-			return i;
-		}
-	}
+	if (i >= 0)
+		return i;
 	/* if the the maximum table size is reached, overwrite old
 	 * entries, starting at the oldest one = 0 */
+	rds_pi_set(&priv_state->eon_index, index, pi, index < size);
+	memset(&handle->rds_eon.eon[index], 0, sizeof(handle->rds_eon.eon[index]));
+	memset(&priv_state->eon_af_map[index], 0, sizeof(priv_state->eon_af_map[index]));
 	handle->rds_eon.eon[index].pi = pi;
 	handle->rds_eon.eon[index].valid_fields |= V4L2_RDS_PI;
 	handle->rds_eon.index = (index+1 < MAX_EON_CNT) ? (index+1) : 0;
@@ -739,15 +813,7 @@ static uint8_t rds_add_eon_entry(struct rds_private_state *priv_state, uint16_t
 /* checks if an entry for the given PI already exists */
 static bool rds_check_eon_entry(struct rds_private_state *priv_state, uint16_t pi)
 {
-	struct v4l2_rds *handle = &priv_state->handle;
-
-	/* check if there's an entry for the given PI key */
-	for (int i = 0; i <= handle->rds_eon.size; i++) {
-		if (handle->rds_eon.eon[i].pi == pi) {
-			return true;
-		}
-	}
-	return false;
+	return rds_pi_find(&priv_state->eon_index, pi) >= 0;
 }
 
 /* group of functions to decode successfully received RDS groups into
@@ -1255,9 +1321,11 @@ static uint32_t rds_decode_group14(struct rds_private_state* priv_state)
 		 * value represents an AF) */
 		if (c_msb < 205)
 			new_a = rds_add_af_to_list(&eon_entry->af,
+					&priv_state->eon_af_map[eon_index],
 					grp->data_c_msb, true);
 		if (c_lsb < 205)
 			new_b = rds_add_af_to_list(&eon_entry->af,
+					&priv_state->eon_af_map[eon_index],
 					grp->data_c_lsb, true);
 		/* check if one of the frequencies was previously unknown */
 		if (new_a || new_b) {
@@ -1365,9 +1433,10 @@ void v4l2_rds_reset(struct v4l2_rds *handle, bool reset_statistics)
  * Decoding is only done once a complete group was received. This is slower compared
  * to decoding the group type independent information up front, but adds a barrier
  * against corrupted data (happens regularly when reception is weak) */
-uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
+static uint32_t rds_add_block(struct rds_private_state *priv_state,
+			      const struct v4l2_rds_data *rds_data)
 {
-	struct rds_private_state *priv_state = (struct rds_private_state *) handle;
+	struct v4l2_rds *handle = &priv_state->handle;
 	struct v4l2_rds_data *rds_data_raw = priv_state->rds_data_raw;
 	struct v4l2_rds_statistics *rds_stats = &handle->rds_statistics;
 	uint32_t updated_fields = 0;
@@ -1450,6 +1519,25 @@ uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
 	return 0;
 }
 
+uint32_t v4l2_rds_add(struct v4l2_rds *handle, struct v4l2_rds_data *rds_data)
+{
+	return rds_add_block((struct rds_private_state *) handle, rds_data);
+}
+
+/* same as v4l2_rds_add() for an array of blocks, the fields of all groups
+ * that were completed are returned */
+uint32_t v4l2_rds_add_blocks(struct v4l2_rds *handle,
+			     const struct v4l2_rds_data *rds_data, unsigned int count)
+{
+	struct rds_private_state *priv_state = (struct rds_private_state *) handle;
+	uint32_t updated_fields = 0;
+	unsigned int i;
+
+	for (i = 0; i < count; i++)
+		updated_fields |= rds_add_block(priv_state, &rds_data[i]);
+	return updated_fields;
+}
+
 const char *v4l2_rds_get_pty_str(const struct v4l2_rds *handle)
 {
 	const uint8_t pty = handle->pty;
@@ -1593,6 +1681,18 @@ const char *v4l2_rds_get_coverage_str(const struct v4l2_rds *handle)
 	return "Not Available";
 }
 
+const struct v4l2_rds_tmc_msg *v4l2_rds_get_tmc_msg
+	(const struct v4l2_rds *handle, uint32_t seq)
+{
+	const struct v4l2_rds_tmc *tmc = &handle->tmc;
+	uint32_t age = tmc->tmc_msg_cnt - seq;
+
+	/* the difference also works when the counter wraps */
+	if (age == 0 || age > MAX_TMC_MSG_CNT)
+		return NULL;
+	return &tmc->tmc_msg_ring[seq % MAX_TMC_MSG_CNT];
+}
+
 const struct v4l2_rds_group *v4l2_rds_get_group(const struct v4l2_rds *handle)
 {
 	struct rds_private_state *priv_state = (struct rds_private_state *) handle;
@@ -5,11 +5,13 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
     bayer.c \
     cpia1.c \
+    cpu.c \
     crop.c \
     flip.c \
     helper.c \
     nv12_16l16.c \
     jidctflt.c \
+    jpeg-m2m.c \
     jl2005bcd.c \
     jpeg.c \
     jpeg_memsrcdest.c \
@@ -18,6 +20,7 @@ LOCAL_SRC_FILES := \
     mr97310a.c \
     pac207.c \
     rgbyuv.c \
+    rgbyuv-simd.c \
     se401.c \
     sn9c10x.c \
     sn9c2028-decomp.c \
@@ -26,6 +29,7 @@ LOCAL_SRC_FILES := \
     spca561-decompress.c \
     sq905c.c \
     stv0680.c \
+    threads.c \
     tinyjpeg.c \
     control/libv4lcontrol.c \
     processing/autogain.c  \
@@ -162,172 +162,391 @@ static void v4lconvert_border_bayer_line_to_bgr24(
 	}
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer_to_rgbbgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt,
+/* From libdc1394, which on turn was based on OpenCV's Bayer decoding,
+   renders a line which is not the top or bottom line, bayer points to the
+   line above it */
+static void bayer_line_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int width, const unsigned int stride,
 		int start_with_green, int blue_line)
 {
-	/* render the first line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer, bayer + stride, bgr, width,
-			start_with_green, blue_line);
-	bgr += width * 3;
-
-	/* reduce height by 2 because of the special case top/bottom line */
-	for (height -= 2; height; height--) {
-		int t0, t1;
-		/* (width - 2) because of the border */
-		const unsigned char *bayer_end = bayer + (width - 2);
-
-		if (start_with_green) {
+	int t0, t1;
+	/* (width - 2) because of the border */
+	const unsigned char *bayer_end = bayer + (width - 2);
 
-			t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
-			/* Write first pixel */
-			t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride];
-			} else {
-				*bgr++ = bayer[stride];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+	if (start_with_green) {
 
-			/* Write second pixel */
-			t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-			} else {
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t0;
-			}
-			bayer++;
+		t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
+		/* Write first pixel */
+		t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride];
 		} else {
-			/* Write first pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride];
-				*bgr++ = t0;
-			}
+			*bgr++ = bayer[stride];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
 
+		/* Write second pixel */
+		t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
 		if (blue_line) {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t1;
-			}
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
 		} else {
-			for (; bayer <= bayer_end - 2; bayer += 2) {
-				t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-					bayer[stride * 2 + 2] + 2) >> 2;
-				t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-					bayer[stride * 2 + 1] + 2) >> 2;
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-
-				t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-				t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t0;
+		}
+		bayer++;
+	} else {
+		/* Write first pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride];
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = bayer[stride];
+			*bgr++ = t0;
 		}
+	}
 
-		if (bayer < bayer_end) {
-			/* write second to last pixel */
+	if (blue_line) {
+		for (; bayer <= bayer_end - 2; bayer += 2) {
 			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
 				bayer[stride * 2 + 2] + 2) >> 2;
 			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
 				bayer[stride * 2 + 1] + 2) >> 2;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
-			/* write last pixel */
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+
 			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = bayer[stride + 2];
-				*bgr++ = t0;
-			}
+			t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t1;
+		}
+	} else {
+		for (; bayer <= bayer_end - 2; bayer += 2) {
+			t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+				bayer[stride * 2 + 2] + 2) >> 2;
+			t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
+				bayer[stride * 2 + 1] + 2) >> 2;
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
 
-			bayer++;
+			t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+			t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
+	}
 
+	if (bayer < bayer_end) {
+		/* write second to last pixel */
+		t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+			bayer[stride * 2 + 2] + 2) >> 2;
+		t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
+			bayer[stride * 2 + 1] + 2) >> 2;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
 		} else {
-			/* write last pixel */
-			t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-			t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
-			if (blue_line) {
-				*bgr++ = t0;
-				*bgr++ = t1;
-				*bgr++ = bayer[stride + 1];
-			} else {
-				*bgr++ = bayer[stride + 1];
-				*bgr++ = t1;
-				*bgr++ = t0;
-			}
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
+		}
+		/* write last pixel */
+		t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = bayer[stride + 2];
+			*bgr++ = t0;
+		}
 
+		bayer++;
+
+	} else {
+		/* write last pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
+		if (blue_line) {
+			*bgr++ = t0;
+			*bgr++ = t1;
+			*bgr++ = bayer[stride + 1];
+		} else {
+			*bgr++ = bayer[stride + 1];
+			*bgr++ = t1;
+			*bgr++ = t0;
 		}
 
-		/* skip 2 border pixels and padding */
-		bayer += (stride - width) + 2;
+	}
+}
 
-		blue_line = !blue_line;
-		start_with_green = !start_with_green;
+static void bayer_to_rgbbgr24(const unsigned char *bayer,
+		unsigned char *bgr, int width, int height, const unsigned int stride,
+		int start_with_green, int blue_line, int start, int end)
+{
+	int y, odd;
+
+	bgr += start * width * 3;
+	for (y = start; y < end; y++) {
+		if (y == 0) {
+			/* render the first line */
+			v4lconvert_border_bayer_line_to_bgr24(bayer,
+					bayer + stride, bgr, width,
+					start_with_green, blue_line);
+		} else if (y == height - 1) {
+			/* render the last line */
+			odd = (height - 2) & 1;
+			v4lconvert_border_bayer_line_to_bgr24(
+					bayer + (height - 1) * stride,
+					bayer + (height - 2) * stride, bgr, width,
+					!(start_with_green ^ odd),
+					!(blue_line ^ odd));
+		} else {
+			/* the pattern alternates every line */
+			odd = (y - 1) & 1;
+			bayer_line_to_rgbbgr24(bayer + (y - 1) * stride, bgr,
+					width, stride, start_with_green ^ odd,
+					blue_line ^ odd);
+		}
+		bgr += width * 3;
 	}
+}
 
-	/* render the last line */
-	v4lconvert_border_bayer_line_to_bgr24(bayer + stride, bayer, bgr, width,
-			!start_with_green, !blue_line);
+struct bayer_job {
+	const unsigned char *bayer;
+	unsigned char *bgr;
+	int width, height;
+	unsigned int stride;
+	int start_with_green, blue_line;
+};
+
+static void bayer_to_rgbbgr24_stripe(void *arg, int start, int end)
+{
+	struct bayer_job *job = arg;
+
+	bayer_to_rgbbgr24(job->bayer, job->bgr, job->width, job->height,
+			job->stride, job->start_with_green, job->blue_line,
+			start, end);
+}
+
+void v4lconvert_bayer_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr,
+		int width, int height, const unsigned int stride, unsigned int pixfmt)
+{
+	struct bayer_job job = {
+		.bayer = bayer, .bgr = bgr,
+		.width = width, .height = height, .stride = stride,
+		.start_with_green = pixfmt == V4L2_PIX_FMT_SGBRG8
+				 || pixfmt == V4L2_PIX_FMT_SGRBG8,
+		.blue_line = pixfmt != V4L2_PIX_FMT_SBGGR8
+			  && pixfmt != V4L2_PIX_FMT_SGBRG8,
+	};
+
+	v4lconvert_run_stripes(data, bayer_to_rgbbgr24_stripe, &job, height, 1);
+}
+
+void v4lconvert_bayer_to_bgr24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *bgr,
+		int width, int height, const unsigned int stride, unsigned int pixfmt)
+{
+	struct bayer_job job = {
+		.bayer = bayer, .bgr = bgr,
+		.width = width, .height = height, .stride = stride,
+		.start_with_green = pixfmt == V4L2_PIX_FMT_SGBRG8
+				 || pixfmt == V4L2_PIX_FMT_SGRBG8,
+		.blue_line = pixfmt == V4L2_PIX_FMT_SBGGR8
+			  || pixfmt == V4L2_PIX_FMT_SGBRG8,
+	};
+
+	v4lconvert_run_stripes(data, bayer_to_rgbbgr24_stripe, &job, height, 1);
+}
+
+/* Maps the 10 bit packed, 10 bit and 16 bit bayer formats to the 8 bit
+   format with the same pattern */
+static unsigned int bayer_deep_to_bayer8(unsigned int pixfmt)
+{
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SBGGR16:
+		return V4L2_PIX_FMT_SBGGR8;
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGBRG16:
+		return V4L2_PIX_FMT_SGBRG8;
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SGRBG16:
+		return V4L2_PIX_FMT_SGRBG8;
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SRGGB16:
+		return V4L2_PIX_FMT_SRGGB8;
+	}
+	return 0;
+}
+
+/* Same results as the v4lconvert_bayer*_to_bayer8 functions, for 1 line */
+static void bayer_deep_line_to_bayer8(const unsigned char *src,
+		unsigned char *dst, int width, unsigned int pixfmt)
+{
+	int x;
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		/* 4 times the 8 msb, followed by a byte with the 2 lsb-s */
+		for (x = 0; x + 4 <= width; x += 4) {
+			dst[x] = src[0];
+			dst[x + 1] = src[1];
+			dst[x + 2] = src[2];
+			dst[x + 3] = src[3];
+			src += 5;
+		}
+		for (; x < width; x++)
+			dst[x] = *src++;
+		break;
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10: {
+		const uint16_t *src16 = (const uint16_t *)src;
+
+		for (x = 0; x < width; x++)
+			dst[x] = src16[x] >> 2;
+		break;
+	}
+	default:
+		for (x = 0; x < width; x++)
+			dst[x] = src[2 * x + 1];
+		break;
+	}
 }
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+struct bayer_deep_job {
+	const unsigned char *src;
+	unsigned char *bgr;
+	unsigned char *scratch;
+	int width, height;
+	unsigned int stride;
+	unsigned int pixfmt;
+	int start_with_green, blue_line;
+	const unsigned char *const *luts;
+	int next_slot;
+};
+
+/*
+ * Unpacks the lines just ahead of the line being demosaiced into a 5 line
+ * window, instead of unpacking the whole frame first. Frame line y gets
+ * stored in window line y % 3, and also in y % 3 + 3 when that fits, so
+ * that bayer_line_to_rgbbgr24() always finds the 3 lines it needs
+ * consecutively.
+ */
+static void bayer_deep_to_rgbbgr24_stripe(void *arg, int start, int end)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt != V4L2_PIX_FMT_SBGGR8		/* blue line */
-			&& pixfmt != V4L2_PIX_FMT_SGBRG8);
+	struct bayer_deep_job *job = arg;
+	int width = job->width, height = job->height;
+	int slot = __atomic_fetch_add(&job->next_slot, 1, __ATOMIC_RELAXED);
+	unsigned char *win = job->scratch + slot * 5 * width;
+	unsigned char *bgr = job->bgr + start * width * 3;
+	int y, odd, next = start > 0 ? start - 1 : 0;
+
+	for (y = start; y < end; y++) {
+		/* Get the lines up to and including y + 1 */
+		for (; next <= y + 1 && next < height; next++) {
+			unsigned char *line = win + (next % 3) * width;
+
+			bayer_deep_line_to_bayer8(job->src + next * job->stride,
+						  line, width, job->pixfmt);
+			if (next % 3 < 2)
+				memcpy(line + 3 * width, line, width);
+		}
+
+		if (y == 0) {
+			v4lconvert_border_bayer_line_to_bgr24(win, win + width,
+					bgr, width, job->start_with_green,
+					job->blue_line);
+		} else if (y == height - 1) {
+			odd = (height - 2) & 1;
+			v4lconvert_border_bayer_line_to_bgr24(
+					win + (y % 3) * width,
+					win + ((y - 1) % 3) * width, bgr, width,
+					!(job->start_with_green ^ odd),
+					!(job->blue_line ^ odd));
+		} else {
+			odd = (y - 1) & 1;
+			bayer_line_to_rgbbgr24(win + ((y - 1) % 3) * width, bgr,
+					width, width, job->start_with_green ^ odd,
+					job->blue_line ^ odd);
+		}
+		if (job->luts)
+			v4lconvert_apply_luts(job->luts, bgr, width);
+		bgr += width * 3;
+	}
 }
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *bgr, int width, int height, const unsigned int stride, unsigned int pixfmt)
+int v4lconvert_bayer_deep_to_rgbbgr24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *bgr,
+		int width, int height, unsigned int stride, unsigned int pixfmt,
+		int rgb)
 {
-	bayer_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-			pixfmt == V4L2_PIX_FMT_SGBRG8		/* start with green */
-			|| pixfmt == V4L2_PIX_FMT_SGRBG8,
-			pixfmt == V4L2_PIX_FMT_SBGGR8		/* blue line */
-			|| pixfmt == V4L2_PIX_FMT_SGBRG8);
+	unsigned int pixfmt8 = bayer_deep_to_bayer8(pixfmt);
+	unsigned int min_stride;
+	struct bayer_deep_job job = {
+		.src = src, .bgr = bgr,
+		.width = width, .height = height,
+		.pixfmt = pixfmt,
+		.luts = data->luts[0] ? data->luts : NULL,
+		.start_with_green = pixfmt8 == V4L2_PIX_FMT_SGBRG8
+				 || pixfmt8 == V4L2_PIX_FMT_SGRBG8,
+	};
+
+	if (rgb)
+		job.blue_line = pixfmt8 != V4L2_PIX_FMT_SBGGR8
+			     && pixfmt8 != V4L2_PIX_FMT_SGBRG8;
+	else
+		job.blue_line = pixfmt8 == V4L2_PIX_FMT_SBGGR8
+			     || pixfmt8 == V4L2_PIX_FMT_SGBRG8;
+
+	switch (pixfmt) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+		min_stride = width * 10 / 8;
+		break;
+	default:
+		min_stride = width * 2;
+		break;
+	}
+	job.stride = stride >= min_stride ? stride : min_stride;
+
+	/* 1 window per stripe, there never are more stripes than threads */
+	job.scratch = v4lconvert_alloc_buffer(data->threads * 5 * width,
+			&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+	if (!job.scratch)
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_run_stripes(data, bayer_deep_to_rgbbgr24_stripe, &job,
+			       height, 1);
+
+	return 0;
 }
 
 static void v4lconvert_border_bayer_line_to_y(
@@ -429,20 +648,13 @@ static void v4lconvert_border_bayer_line_to_y(
 	}
 }
 
-void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
-		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+/* Writes the u and v values uvstep bytes apart, so that this can produce
+   both planar and semi-planar (nv12) output */
+static void bayer_to_yuv(const unsigned char *bayer, unsigned char *ydst,
+		unsigned char *udst, unsigned char *vdst, int uvstep,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt)
 {
 	int blue_line = 0, start_with_green = 0, x, y;
-	unsigned char *ydst = yuv;
-	unsigned char *udst, *vdst;
-
-	if (yvu) {
-		vdst = yuv + width * height;
-		udst = vdst + width * height / 4;
-	} else {
-		udst = yuv + width * height;
-		vdst = udst + width * height / 4;
-	}
 
 	/* First calculate the u and v planes 2x2 pixels at a time */
 	switch (src_pixfmt) {
@@ -455,8 +667,10 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				g  = bayer[x + 1];
 				g += bayer[x + stride];
 				r  = bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				*udst = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
+				*vdst = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				udst += uvstep;
+				vdst += uvstep;
 			}
 			bayer += 2 * stride;
 		}
@@ -472,8 +686,10 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				g  = bayer[x + 1];
 				g += bayer[x + stride];
 				b  = bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				*udst = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
+				*vdst = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				udst += uvstep;
+				vdst += uvstep;
 			}
 			bayer += 2 * stride;
 		}
@@ -488,8 +704,10 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				b  = bayer[x + 1];
 				r  = bayer[x + stride];
 				g += bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				*udst = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
+				*vdst = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				udst += uvstep;
+				vdst += uvstep;
 			}
 			bayer += 2 * stride;
 		}
@@ -506,8 +724,10 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 				r  = bayer[x + 1];
 				b  = bayer[x + stride];
 				g += bayer[x + stride + 1];
-				*udst++ = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
-				*vdst++ = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				*udst = (-4878 * r - 4789 * g + 14456 * b + 4210688) >> 15;
+				*vdst = (14456 * r - 6052 * g -  2351 * b + 4210688) >> 15;
+				udst += uvstep;
+				vdst += uvstep;
 			}
 			bayer += 2 * stride;
 		}
@@ -632,6 +852,31 @@ void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 			!start_with_green, !blue_line);
 }
 
+void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu)
+{
+	unsigned char *udst, *vdst;
+
+	if (yvu) {
+		vdst = yuv + width * height;
+		udst = vdst + width * height / 4;
+	} else {
+		udst = yuv + width * height;
+		vdst = udst + width * height / 4;
+	}
+
+	bayer_to_yuv(bayer, yuv, udst, vdst, 1, width, height, stride, src_pixfmt);
+}
+
+void v4lconvert_bayer_to_nv12(const unsigned char *bayer, unsigned char *nv12,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt)
+{
+	unsigned char *uvdst = nv12 + width * height;
+
+	bayer_to_yuv(bayer, nv12, uvdst, uvdst + 1, 2, width, height, stride,
+		     src_pixfmt);
+}
+
 void v4lconvert_bayer10_to_bayer8(void *bayer10,
 		unsigned char *bayer8, int width, int height)
 {
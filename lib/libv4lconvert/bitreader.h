@@ -0,0 +1,104 @@
+/*
+
+# Bit reader for the decompressors of the cam specific formats
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#ifndef __BITREADER_H
+#define __BITREADER_H
+
+#include <stdint.h>
+
+/*
+ * The bits are read MSB first, which is what all the Huffman-like codes of
+ * the gspca bridges use. Up to 32 bits can be peeked at once, so that a
+ * whole code can be looked up in a table with a single peek. The bit buffer
+ * is refilled a 32 bit word at a time; once the input is exhausted, zero
+ * bits are read, so that a corrupt frame can't make a decoder read past the
+ * end of its input.
+ */
+struct v4lconvert_bitreader {
+	const unsigned char *p, *end;
+	uint64_t bits;		/* MSB aligned */
+	int count;		/* valid bits in bits */
+	unsigned int pos;	/* bits consumed so far */
+};
+
+static inline void v4lconvert_br_init(struct v4lconvert_bitreader *br,
+		const unsigned char *buf, int size)
+{
+	br->p = buf;
+	br->end = buf + (size > 0 ? size : 0);
+	br->bits = 0;
+	br->count = 0;
+	br->pos = 0;
+}
+
+static inline void v4lconvert_br_refill(struct v4lconvert_bitreader *br)
+{
+	if (br->count > 32)
+		return;
+
+	if (br->end - br->p >= 4) {
+		uint32_t word = (uint32_t)br->p[0] << 24 | br->p[1] << 16 |
+				br->p[2] << 8 | br->p[3];
+
+		br->bits |= (uint64_t)word << (32 - br->count);
+		br->p += 4;
+		br->count += 32;
+		return;
+	}
+
+	while (br->count <= 56) {
+		if (br->p < br->end)
+			br->bits |= (uint64_t)*br->p++ << (56 - br->count);
+		br->count += 8;
+	}
+}
+
+/* Returns the next n (1 - 32) bits, without consuming them */
+static inline unsigned int v4lconvert_br_peek(struct v4lconvert_bitreader *br,
+		int n)
+{
+	v4lconvert_br_refill(br);
+	return br->bits >> (64 - n);
+}
+
+/* Consumes n (0 - 32) bits, which must have been peeked before */
+static inline void v4lconvert_br_skip(struct v4lconvert_bitreader *br, int n)
+{
+	br->bits <<= n;
+	br->count -= n;
+	br->pos += n;
+}
+
+static inline unsigned int v4lconvert_br_get(struct v4lconvert_bitreader *br,
+		int n)
+{
+	unsigned int val = v4lconvert_br_peek(br, n);
+
+	v4lconvert_br_skip(br, n);
+	return val;
+}
+
+/* Number of bits consumed since v4lconvert_br_init() */
+static inline unsigned int v4lconvert_br_tell(struct v4lconvert_bitreader *br)
+{
+	return br->pos;
+}
+
+#endif
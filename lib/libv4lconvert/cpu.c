@@ -0,0 +1,38 @@
+/*
+
+# CPU feature detection for the optimized conversion routines
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include "libv4lconvert-priv.h"
+
+unsigned int v4lconvert_get_cpu_flags(void)
+{
+	unsigned int flags = 0;
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		flags |= V4LCONVERT_CPU_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		flags |= V4LCONVERT_CPU_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		flags |= V4LCONVERT_CPU_AVX2;
+#endif
+
+	return flags;
+}
@@ -46,16 +46,28 @@ static void v4lconvert_reduceandcrop_rgbbgr24(
 	}
 }
 
-static void v4lconvert_crop_rgbbgr24(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+struct crop_job {
+	unsigned char *src;
+	unsigned char *dest;
+	const struct v4l2_format *src_fmt;
+	const struct v4l2_format *dest_fmt;
+};
+
+static void v4lconvert_crop_rgbbgr24(void *arg, int start, int end)
 {
+	struct crop_job *job = arg;
+	const struct v4l2_format *src_fmt = job->src_fmt;
+	const struct v4l2_format *dest_fmt = job->dest_fmt;
+	unsigned char *src = job->src;
+	unsigned char *dest = job->dest;
 	int x;
 	int startx = (src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2;
 	int starty = (src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2;
 
-	src += starty * src_fmt->fmt.pix.bytesperline + 3 * startx;
+	src += (starty + start) * src_fmt->fmt.pix.bytesperline + 3 * startx;
+	dest += start * dest_fmt->fmt.pix.bytesperline;
 
-	for (x = 0; x < dest_fmt->fmt.pix.height; x++) {
+	for (x = start; x < end; x++) {
 		memcpy(dest, src, dest_fmt->fmt.pix.width * 3);
 		src += src_fmt->fmt.pix.bytesperline;
 		dest += dest_fmt->fmt.pix.bytesperline;
@@ -109,41 +121,105 @@ static void v4lconvert_reduceandcrop_yuv420(
 	}
 }
 
-static void v4lconvert_crop_yuv420(unsigned char *src, unsigned char *dest,
-		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
+/* Crops Y lines [start, end) and the matching chroma lines, start must be
+   even */
+static void v4lconvert_crop_yuv420(void *arg, int start, int end)
 {
+	struct crop_job *job = arg;
+	const struct v4l2_format *src_fmt = job->src_fmt;
+	const struct v4l2_format *dest_fmt = job->dest_fmt;
+	unsigned char *src = job->src;
+	unsigned char *dest = job->dest;
 	int x;
 	int startx = ((src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2) & ~1;
 	int starty = ((src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2) & ~1;
-	unsigned char *mysrc = src + starty * src_fmt->fmt.pix.bytesperline + startx;
+	unsigned char *mysrc = src + (starty + start) * src_fmt->fmt.pix.bytesperline + startx;
+	unsigned char *mydest = dest + start * dest_fmt->fmt.pix.bytesperline;
 
 	/* Y */
-	for (x = 0; x < dest_fmt->fmt.pix.height; x++) {
-		memcpy(dest, mysrc, dest_fmt->fmt.pix.width);
+	for (x = start; x < end; x++) {
+		memcpy(mydest, mysrc, dest_fmt->fmt.pix.width);
 		mysrc += src_fmt->fmt.pix.bytesperline;
-		dest += dest_fmt->fmt.pix.bytesperline;
+		mydest += dest_fmt->fmt.pix.bytesperline;
 	}
 
 	/* U */
+	dest += dest_fmt->fmt.pix.height * dest_fmt->fmt.pix.bytesperline;
 	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline +
-		(starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (x = 0; x < dest_fmt->fmt.pix.height / 2; x++) {
-		memcpy(dest, mysrc, dest_fmt->fmt.pix.width / 2);
+		(starty / 2 + start / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
+	mydest = dest + (start / 2) * dest_fmt->fmt.pix.bytesperline / 2;
+	for (x = start / 2; x < end / 2; x++) {
+		memcpy(mydest, mysrc, dest_fmt->fmt.pix.width / 2);
 		mysrc += src_fmt->fmt.pix.bytesperline / 2;
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
+		mydest += dest_fmt->fmt.pix.bytesperline / 2;
 	}
 
 	/* V */
+	dest += dest_fmt->fmt.pix.height / 2 * dest_fmt->fmt.pix.bytesperline / 2;
 	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline * 5 / 4
-		+ (starty / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
-	for (x = 0; x < dest_fmt->fmt.pix.height / 2; x++) {
-		memcpy(dest, mysrc, dest_fmt->fmt.pix.width / 2);
+		+ (starty / 2 + start / 2) * src_fmt->fmt.pix.bytesperline / 2 + startx / 2;
+	mydest = dest + (start / 2) * dest_fmt->fmt.pix.bytesperline / 2;
+	for (x = start / 2; x < end / 2; x++) {
+		memcpy(mydest, mysrc, dest_fmt->fmt.pix.width / 2);
 		mysrc += src_fmt->fmt.pix.bytesperline / 2;
-		dest += dest_fmt->fmt.pix.bytesperline / 2;
+		mydest += dest_fmt->fmt.pix.bytesperline / 2;
+	}
+}
+
+/* Crops lines [start, end), keeping the pixel pairs which share their chroma
+   together */
+static void v4lconvert_crop_yuyv(void *arg, int start, int end)
+{
+	struct crop_job *job = arg;
+	const struct v4l2_format *src_fmt = job->src_fmt;
+	const struct v4l2_format *dest_fmt = job->dest_fmt;
+	int y;
+	int startx = ((src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2) & ~1;
+	int starty = (src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2;
+	unsigned char *mysrc = job->src + (starty + start) * src_fmt->fmt.pix.bytesperline +
+		startx * 2;
+	unsigned char *mydest = job->dest + start * dest_fmt->fmt.pix.bytesperline;
+
+	for (y = start; y < end; y++) {
+		memcpy(mydest, mysrc, dest_fmt->fmt.pix.width * 2);
+		mysrc += src_fmt->fmt.pix.bytesperline;
+		mydest += dest_fmt->fmt.pix.bytesperline;
+	}
+}
+
+/* Crops Y lines [start, end) and the matching UV lines, start must be even */
+static void v4lconvert_crop_nv12(void *arg, int start, int end)
+{
+	struct crop_job *job = arg;
+	const struct v4l2_format *src_fmt = job->src_fmt;
+	const struct v4l2_format *dest_fmt = job->dest_fmt;
+	unsigned char *src = job->src;
+	unsigned char *dest = job->dest;
+	int y;
+	int startx = ((src_fmt->fmt.pix.width - dest_fmt->fmt.pix.width) / 2) & ~1;
+	int starty = ((src_fmt->fmt.pix.height - dest_fmt->fmt.pix.height) / 2) & ~1;
+	unsigned char *mysrc = src + (starty + start) * src_fmt->fmt.pix.bytesperline + startx;
+	unsigned char *mydest = dest + start * dest_fmt->fmt.pix.bytesperline;
+
+	/* Y */
+	for (y = start; y < end; y++) {
+		memcpy(mydest, mysrc, dest_fmt->fmt.pix.width);
+		mysrc += src_fmt->fmt.pix.bytesperline;
+		mydest += dest_fmt->fmt.pix.bytesperline;
+	}
+
+	/* UV */
+	dest += dest_fmt->fmt.pix.height * dest_fmt->fmt.pix.bytesperline;
+	mysrc = src + src_fmt->fmt.pix.height * src_fmt->fmt.pix.bytesperline +
+		(starty / 2 + start / 2) * src_fmt->fmt.pix.bytesperline + startx;
+	mydest = dest + (start / 2) * dest_fmt->fmt.pix.bytesperline;
+	for (y = start / 2; y < end / 2; y++) {
+		memcpy(mydest, mysrc, dest_fmt->fmt.pix.width);
+		mysrc += src_fmt->fmt.pix.bytesperline;
+		mydest += dest_fmt->fmt.pix.bytesperline;
 	}
 }
 
-/* Ok, so this is not really cropping, but more the reverse, whatever */
 static void v4lconvert_add_border_rgbbgr24(
 		unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
@@ -257,9 +333,12 @@ static void v4lconvert_add_border_yuv420(
 	}
 }
 
-void v4lconvert_crop(unsigned char *src, unsigned char *dest,
+void v4lconvert_crop(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt)
 {
+	struct crop_job job = { src, dest, src_fmt, dest_fmt };
+
 	switch (dest_fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
@@ -270,7 +349,8 @@ void v4lconvert_crop(unsigned char *src, unsigned char *dest,
 				src_fmt->fmt.pix.height >= 2 * dest_fmt->fmt.pix.height)
 			v4lconvert_reduceandcrop_rgbbgr24(src, dest, src_fmt, dest_fmt);
 		else
-			v4lconvert_crop_rgbbgr24(src, dest, src_fmt, dest_fmt);
+			v4lconvert_run_stripes(data, v4lconvert_crop_rgbbgr24,
+					&job, dest_fmt->fmt.pix.height, 1);
 		break;
 
 	case V4L2_PIX_FMT_YUV420:
@@ -282,7 +362,19 @@ void v4lconvert_crop(unsigned char *src, unsigned char *dest,
 				src_fmt->fmt.pix.height >= 2 * dest_fmt->fmt.pix.height)
 			v4lconvert_reduceandcrop_yuv420(src, dest, src_fmt, dest_fmt);
 		else
-			v4lconvert_crop_yuv420(src, dest, src_fmt, dest_fmt);
+			v4lconvert_run_stripes(data, v4lconvert_crop_yuv420,
+					&job, dest_fmt->fmt.pix.height, 2);
+		break;
+
+	/* Only plain cropping, see v4lconvert_do_convert() */
+	case V4L2_PIX_FMT_YUYV:
+		v4lconvert_run_stripes(data, v4lconvert_crop_yuyv,
+				&job, dest_fmt->fmt.pix.height, 1);
+		break;
+
+	case V4L2_PIX_FMT_NV12:
+		v4lconvert_run_stripes(data, v4lconvert_crop_nv12,
+				&job, dest_fmt->fmt.pix.height, 2);
 		break;
 	}
 }
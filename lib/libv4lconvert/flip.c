@@ -23,18 +23,9 @@
 #include <string.h>
 #include "libv4lconvert-priv.h"
 
-static void v4lconvert_vflip_rgbbgr24(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
-{
-	int y;
-
-	src += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline;
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src -= fmt->fmt.pix.bytesperline;
-		memcpy(dest, src, fmt->fmt.pix.width * 3);
-		dest += fmt->fmt.pix.width * 3;
-	}
-}
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
 
 static void v4lconvert_vflip_yuv420(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt)
@@ -66,24 +57,6 @@ static void v4lconvert_vflip_yuv420(unsigned char *src, unsigned char *dest,
 	}
 }
 
-static void v4lconvert_hflip_rgbbgr24(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
-{
-	int x, y;
-
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		src += fmt->fmt.pix.width * 3;
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			src -= 3;
-			dest[0] = src[0];
-			dest[1] = src[1];
-			dest[2] = src[2];
-			dest += 3;
-		}
-		src += fmt->fmt.pix.bytesperline;
-	}
-}
-
 static void v4lconvert_hflip_yuv420(unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt)
 {
@@ -114,19 +87,106 @@ static void v4lconvert_hflip_yuv420(unsigned char *src, unsigned char *dest,
 	}
 }
 
-static void v4lconvert_rotate180_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int width, int height)
+struct flip_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	int width, height, stride;
+	int hflip, vflip;
+};
+
+/* Handles hflip, vflip and rotate180 (both) for rows [start, end) */
+static void v4lconvert_flip_rgbbgr24(void *arg, int start, int end)
 {
-	int i;
+	struct flip_job *job = arg;
+	const unsigned char *src;
+	unsigned char *dest = job->dest + start * job->width * 3;
+	int x, y;
+
+	for (y = start; y < end; y++) {
+		src = job->src + (job->vflip ? job->height - 1 - y : y) * job->stride;
+		if (job->hflip) {
+			src += job->width * 3;
+			for (x = 0; x < job->width; x++) {
+				src -= 3;
+				dest[0] = src[0];
+				dest[1] = src[1];
+				dest[2] = src[2];
+				dest += 3;
+			}
+		} else {
+			memcpy(dest, src, job->width * 3);
+			dest += job->width * 3;
+		}
+	}
+}
 
-	src += 3 * width * height - 3;
+/* Handles hflip, vflip and rotate180 of yuyv for rows [start, end), pixel
+   pairs share their chroma so they are swapped as a whole */
+static void v4lconvert_flip_yuyv(void *arg, int start, int end)
+{
+	struct flip_job *job = arg;
+	const unsigned char *src;
+	unsigned char *dest = job->dest + start * job->width * 2;
+	int x, y;
+
+	for (y = start; y < end; y++) {
+		src = job->src + (job->vflip ? job->height - 1 - y : y) * job->stride;
+		if (job->hflip) {
+			src += job->width * 2;
+			for (x = 0; x < job->width / 2; x++) {
+				src -= 4;
+				dest[0] = src[2];
+				dest[1] = src[1];
+				dest[2] = src[0];
+				dest[3] = src[3];
+				dest += 4;
+			}
+		} else {
+			memcpy(dest, src, job->width * 2);
+			dest += job->width * 2;
+		}
+	}
+}
+
+/* Handles hflip, vflip and rotate180 of nv12 for Y rows [start, end) and the
+   matching UV rows, start must be even */
+static void v4lconvert_flip_nv12(void *arg, int start, int end)
+{
+	struct flip_job *job = arg;
+	const unsigned char *src;
+	unsigned char *dest = job->dest + start * job->width;
+	int x, y;
+
+	/* Y */
+	for (y = start; y < end; y++) {
+		src = job->src + (job->vflip ? job->height - 1 - y : y) * job->stride;
+		if (job->hflip) {
+			src += job->width;
+			for (x = 0; x < job->width; x++)
+				*dest++ = *--src;
+		} else {
+			memcpy(dest, src, job->width);
+			dest += job->width;
+		}
+	}
 
-	for (i = 0; i < width * height; i++) {
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst += 3;
-		src -= 3;
+	/* UV */
+	dest = job->dest + job->height * job->width + (start / 2) * job->width;
+	for (y = start / 2; y < end / 2; y++) {
+		src = job->src + job->height * job->stride +
+			(job->vflip ? job->height / 2 - 1 - y : y) * job->stride;
+		if (job->hflip) {
+			src += job->width;
+			for (x = 0; x < job->width / 2; x++) {
+				src -= 2;
+				dest[0] = src[0];
+				dest[1] = src[1];
+				dest += 2;
+			}
+		} else {
+			memcpy(dest, src, job->width);
+			dest += job->width;
+		}
 	}
 }
 
@@ -151,87 +211,203 @@ static void v4lconvert_rotate180_yuv420(const unsigned char *src,
 		*dst++ = *src--;
 }
 
-static void v4lconvert_rotate90_rgbbgr24(const unsigned char *src,
-		unsigned char *dst, int destwidth, int destheight)
+/*
+ * Rotating walks the source along its columns, so it is done by square
+ * blocks of ROTATE90_BLOCK pixels, which keeps the source and destination
+ * lines of a block in cache.
+ */
+#define ROTATE90_BLOCK 16
+
+struct rotate90_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	int destwidth, destheight;
+	int bpp;
+	unsigned int cpu_flags;
+};
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+/* Rotates an 8x8 block of bytes: transposes the 8 source lines in reverse
+   order, dest (x, y) = src line (srcheight - 1 - x), column y */
+__attribute__((target("sse2")))
+static void rotate90_8x8_sse2(const unsigned char *src, int srcstride,
+		unsigned char *dest, int deststride)
 {
-	int x, y;
-#define srcwidth destheight
-#define srcheight destwidth
+	__m128i r[8], a[4], b[4], c[4];
+	int i;
 
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = ((srcheight - x - 1) * srcwidth + y) * 3;
-			*dst++ = src[offset++];
-			*dst++ = src[offset++];
-			*dst++ = src[offset];
-		}
+	for (i = 0; i < 8; i++)
+		r[i] = _mm_loadl_epi64((const __m128i *)(src - i * srcstride));
+
+	for (i = 0; i < 4; i++)
+		a[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+	b[0] = _mm_unpacklo_epi16(a[0], a[1]);
+	b[1] = _mm_unpackhi_epi16(a[0], a[1]);
+	b[2] = _mm_unpacklo_epi16(a[2], a[3]);
+	b[3] = _mm_unpackhi_epi16(a[2], a[3]);
+	c[0] = _mm_unpacklo_epi32(b[0], b[2]);
+	c[1] = _mm_unpackhi_epi32(b[0], b[2]);
+	c[2] = _mm_unpacklo_epi32(b[1], b[3]);
+	c[3] = _mm_unpackhi_epi32(b[1], b[3]);
+
+	for (i = 0; i < 4; i++) {
+		_mm_storel_epi64((__m128i *)(dest + 2 * i * deststride), c[i]);
+		_mm_storel_epi64((__m128i *)(dest + (2 * i + 1) * deststride),
+				 _mm_unpackhi_epi64(c[i], c[i]));
+	}
 }
+#endif
 
-static void v4lconvert_rotate90_yuv420(const unsigned char *src,
-		unsigned char *dst, int destwidth, int destheight)
+/* Rotates destination lines [start, end) of a plane */
+static void v4lconvert_rotate90_plane(void *arg, int start, int end)
 {
-	int x, y;
-
-	/* Y-plane */
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+	struct rotate90_job *job = arg;
+	int destwidth = job->destwidth, destheight = job->destheight;
+	int bpp = job->bpp;
+	int x, y, x0, y0, x1, y1;
+#define srcwidth destheight
+#define srcheight destwidth
 
-	/* U-plane */
-	src += srcwidth * srcheight;
-	destwidth /= 2;
-	destheight /= 2;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
+	for (y0 = start; y0 < end; y0 += ROTATE90_BLOCK) {
+		y1 = y0 + ROTATE90_BLOCK < end ? y0 + ROTATE90_BLOCK : end;
+		for (x0 = 0; x0 < destwidth; x0 += ROTATE90_BLOCK) {
+			x1 = x0 + ROTATE90_BLOCK < destwidth ? x0 + ROTATE90_BLOCK :
+							       destwidth;
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+			if (bpp == 1 && (job->cpu_flags & V4LCONVERT_CPU_SSE2) &&
+			    y1 - y0 == ROTATE90_BLOCK && x1 - x0 == ROTATE90_BLOCK) {
+				for (y = y0; y < y1; y += 8)
+					for (x = x0; x < x1; x += 8)
+						rotate90_8x8_sse2(job->src +
+							(srcheight - x - 1) * srcwidth + y,
+							srcwidth,
+							job->dest + y * destwidth + x,
+							destwidth);
+				continue;
+			}
+#endif
+			for (y = y0; y < y1; y++) {
+				const unsigned char *src = job->src +
+					((srcheight - x0 - 1) * srcwidth + y) * bpp;
+				unsigned char *dst = job->dest +
+					(y * destwidth + x0) * bpp;
+
+				/* Copy 4 bytes at once, the extra byte gets
+				   overwritten by the next pixel, unless the
+				   source pixel is the last one of its line */
+				if (bpp == 3 && y < srcwidth - 1) {
+					for (x = x0; x < x1 - 1; x++) {
+						memcpy(dst, src, 4);
+						src -= srcwidth * 3;
+						dst += 3;
+					}
+					dst[0] = src[0];
+					dst[1] = src[1];
+					dst[2] = src[2];
+				} else if (bpp == 3) {
+					for (x = x0; x < x1; x++) {
+						dst[0] = src[0];
+						dst[1] = src[1];
+						dst[2] = src[2];
+						src -= srcwidth * 3;
+						dst += 3;
+					}
+				} else {
+					for (x = x0; x < x1; x++) {
+						*dst++ = *src;
+						src -= srcwidth;
+					}
+				}
+			}
 		}
+	}
+#undef srcwidth
+#undef srcheight
+}
 
-	/* V-plane */
-	src += srcwidth * srcheight;
-	for (y = 0; y < destheight; y++)
-		for (x = 0; x < destwidth; x++) {
-			int offset = (srcheight - x - 1) * srcwidth + y;
-			*dst++ = src[offset];
-		}
+static void v4lconvert_rotate90_run(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int destwidth, int destheight, int bpp)
+{
+	struct rotate90_job job = {
+		.src = src, .dest = dest,
+		.destwidth = destwidth, .destheight = destheight,
+		.bpp = bpp, .cpu_flags = data->cpu_flags,
+	};
+
+	v4lconvert_run_stripes(data, v4lconvert_rotate90_plane, &job,
+			destheight, ROTATE90_BLOCK);
 }
 
-void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt)
+void v4lconvert_rotate90(struct v4lconvert_data *data, unsigned char *src,
+		unsigned char *dest, struct v4l2_format *fmt)
 {
-	int tmp;
+	int width, height, tmp;
 
 	tmp = fmt->fmt.pix.width;
 	fmt->fmt.pix.width = fmt->fmt.pix.height;
 	fmt->fmt.pix.height = tmp;
+	width = fmt->fmt.pix.width;
+	height = fmt->fmt.pix.height;
 
 	switch (fmt->fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
 	case V4L2_PIX_FMT_BGR24:
-		v4lconvert_rotate90_rgbbgr24(src, dest, fmt->fmt.pix.width,
-				fmt->fmt.pix.height);
+		v4lconvert_rotate90_run(data, src, dest, width, height, 3);
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
-		v4lconvert_rotate90_yuv420(src, dest, fmt->fmt.pix.width,
-				fmt->fmt.pix.height);
+		v4lconvert_rotate90_run(data, src, dest, width, height, 1);
+		src += width * height;
+		dest += width * height;
+		v4lconvert_rotate90_run(data, src, dest, width / 2, height / 2, 1);
+		src += (width / 2) * (height / 2);
+		dest += (width / 2) * (height / 2);
+		v4lconvert_rotate90_run(data, src, dest, width / 2, height / 2, 1);
 		break;
 	}
 	v4lconvert_fixup_fmt(fmt);
 }
 
-void v4lconvert_flip(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt, int hflip, int vflip)
+void v4lconvert_flip(struct v4lconvert_data *data, unsigned char *src,
+		unsigned char *dest, struct v4l2_format *fmt, int hflip, int vflip)
 {
+	struct flip_job job = {
+		.src = src, .dest = dest,
+		.width = fmt->fmt.pix.width, .height = fmt->fmt.pix.height,
+		/* rotate180 has always assumed unpadded input */
+		.stride = (hflip && vflip) ? fmt->fmt.pix.width * 3 :
+					     fmt->fmt.pix.bytesperline,
+		.hflip = hflip, .vflip = vflip,
+	};
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		if (hflip || vflip)
+			v4lconvert_run_stripes(data, v4lconvert_flip_rgbbgr24,
+					&job, fmt->fmt.pix.height, 1);
+		/* Our newly written data has no padding */
+		v4lconvert_fixup_fmt(fmt);
+		return;
+
+	case V4L2_PIX_FMT_YUYV:
+		job.stride = fmt->fmt.pix.bytesperline;
+		v4lconvert_run_stripes(data, v4lconvert_flip_yuyv,
+				&job, fmt->fmt.pix.height, 1);
+		v4lconvert_fixup_fmt(fmt);
+		return;
+
+	case V4L2_PIX_FMT_NV12:
+		job.stride = fmt->fmt.pix.bytesperline;
+		v4lconvert_run_stripes(data, v4lconvert_flip_nv12,
+				&job, fmt->fmt.pix.height, 2);
+		v4lconvert_fixup_fmt(fmt);
+		return;
+	}
+
 	if (vflip && hflip) {
 		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_rotate180_rgbbgr24(src, dest, fmt->fmt.pix.width,
-					fmt->fmt.pix.height);
-			break;
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_rotate180_yuv420(src, dest, fmt->fmt.pix.width,
@@ -240,10 +416,6 @@ void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 		}
 	} else if (hflip) {
 		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_hflip_rgbbgr24(src, dest, fmt);
-			break;
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_hflip_yuv420(src, dest, fmt);
@@ -251,10 +423,6 @@ void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 		}
 	} else if (vflip) {
 		switch (fmt->fmt.pix.pixelformat) {
-		case V4L2_PIX_FMT_RGB24:
-		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_vflip_rgbbgr24(src, dest, fmt);
-			break;
 		case V4L2_PIX_FMT_YUV420:
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_vflip_yuv420(src, dest, fmt);
@@ -265,3 +433,53 @@ void v4lconvert_flip(unsigned char *src, unsigned char *dest,
 	/* Our newly written data has no padding */
 	v4lconvert_fixup_fmt(fmt);
 }
+
+/* Flip and (plain) crop in a single pass, returns 0 without doing anything if
+   the combination can not be done in one pass */
+int v4lconvert_flip_crop(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		int hflip, int vflip)
+{
+	int src_width = src_fmt->fmt.pix.width;
+	int src_height = src_fmt->fmt.pix.height;
+	int width = dest_fmt->fmt.pix.width;
+	int height = dest_fmt->fmt.pix.height;
+	int startx, starty, stride;
+	struct flip_job job;
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		break;
+	default:
+		return 0;
+	}
+
+	/* Only plain cropping, see v4lconvert_crop() */
+	if (src_width < width || src_height < height ||
+			(src_width >= 2 * width && src_height >= 2 * height) ||
+			dest_fmt->fmt.pix.bytesperline != width * 3)
+		return 0;
+
+	/* Crop the flipped frame in the center */
+	startx = (src_width - width) / 2;
+	starty = (src_height - height) / 2;
+	if (hflip)
+		startx = src_width - width - startx;
+	if (vflip)
+		starty = src_height - height - starty;
+
+	stride = (hflip && vflip) ? src_width * 3 : src_fmt->fmt.pix.bytesperline;
+
+	job.src = src + starty * stride + startx * 3;
+	job.dest = dest;
+	job.width = width;
+	job.height = height;
+	job.stride = stride;
+	job.hflip = hflip;
+	job.vflip = vflip;
+	v4lconvert_run_stripes(data, v4lconvert_flip_rgbbgr24, &job, height, 1);
+
+	return 1;
+}
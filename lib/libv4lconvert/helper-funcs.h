@@ -29,6 +29,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 static int v4lconvert_helper_write(int fd, const void *b, size_t count,
   char *progname)
@@ -77,3 +79,90 @@ static int v4lconvert_helper_read(int fd, void *b, size_t count,
 
   return 0;
 }
+
+typedef int (*v4lconvert_helper_decompress_func)(unsigned char *src,
+  unsigned char *dest, int width, int height, int yvu, int src_size);
+
+/* Main loop of a decompression helper, see helper.c for the protocol. When
+   started with a memfd fd as argument the frame data is exchanged through
+   the memfd, otherwise it is send over stdin / stdout. */
+static int v4lconvert_helper_run(int argc, char *argv[],
+  v4lconvert_helper_decompress_func decompress,
+  unsigned char *src_buf, int src_buf_size,
+  unsigned char *dest_buf, int dest_buf_size)
+{
+  int msg[6], width, height, yvu, src_size, dest_size, dest_avail;
+  int shm_fd = -1, shm_size = 0;
+  unsigned char *shm = NULL, *src, *dest;
+
+  if (argc > 1)
+    shm_fd = atoi(argv[1]);
+
+  while (1) {
+    if (v4lconvert_helper_read(STDIN_FILENO, msg,
+	  (shm_fd == -1 ? 4 : 6) * sizeof(int), argv[0]))
+      return 1; /* Erm, no way to recover without loosing sync with libv4l */
+
+    width = msg[0];
+    height = msg[1];
+    yvu = msg[2];
+    src_size = msg[3];
+
+    if (shm_fd != -1) {
+      if (msg[4] != shm_size) {
+	if (shm)
+	  munmap(shm, shm_size);
+	shm_size = msg[4];
+	shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   shm_fd, 0);
+	if (shm == MAP_FAILED) {
+	  fprintf(stderr, "%s: error mapping shm: %s\n", argv[0],
+		  strerror(errno));
+	  return 1;
+	}
+      }
+      if (src_size < 0 || src_size > msg[5] || msg[5] > shm_size) {
+	fprintf(stderr, "%s: error: invalid shm layout\n", argv[0]);
+	return 2;
+      }
+      src = shm;
+      dest = shm + msg[5];
+      dest_avail = shm_size - msg[5];
+    } else {
+      if (src_size < 0 || src_size > src_buf_size) {
+	fprintf(stderr, "%s: error: src_buf too small, need: %d\n",
+		argv[0], src_size);
+	return 2;
+      }
+
+      if (v4lconvert_helper_read(STDIN_FILENO, src_buf, src_size, argv[0]))
+	return 1; /* Erm, no way to recover without loosing sync with libv4l */
+
+      src = src_buf;
+      dest = dest_buf;
+      dest_avail = dest_buf_size;
+    }
+
+    dest_size = width * height * 3 / 2;
+    if (width <= 0 || width > SHRT_MAX || height <= 0 || height > SHRT_MAX) {
+      fprintf(stderr, "%s: error: width or height out of bounds\n",
+	      argv[0]);
+      dest_size = -1;
+    } else if (dest_size > dest_avail) {
+      fprintf(stderr, "%s: error: dest_buf too small, need: %d\n",
+	      argv[0], dest_size);
+      dest_size = -1;
+    } else if (decompress(src, dest, width, height, yvu, src_size))
+      dest_size = -1;
+
+    if (v4lconvert_helper_write(STDOUT_FILENO, &dest_size, sizeof(int),
+	  argv[0]))
+      return 1; /* Erm, no way to recover without loosing sync with libv4l */
+
+    if (dest_size == -1 || shm_fd != -1)
+      continue;
+
+    if (v4lconvert_helper_write(STDOUT_FILENO, dest_buf, dest_size, argv[0]))
+      return 1; /* Erm, no way to recover without loosing sync with libv4l */
+  }
+}
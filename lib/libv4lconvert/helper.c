@@ -22,12 +22,17 @@
 #include <errno.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include "libv4lconvert-priv.h"
 
 #define READ_END  0
 #define WRITE_END 1
 
+/* The shared memory is grown in steps of this size */
+#define SHM_SIZE_STEP (256 * 1024)
+
 /* <sigh> Unfortunately I've failed in contact some Authors of decompression
    code of out of tree drivers. So I've no permission to relicense their code
    their code from GPL to LGPL. To work around this, these decompression
@@ -46,11 +51,76 @@
    From the helper to libv4l the following is send:
    int			data length (-1 in case of a decompression error)
    unsigned char[]	data (not present when a decompression error happened)
+
+   When memfd_create is available the frame data is not send through the
+   pipes, instead the fd of a memfd is passed to the helper as its first
+   argument, and the pipes are only used to signal a new frame / a finished
+   frame. In this case libv4l sends:
+   int			width
+   int			height
+   int			flags
+   int			data length (data is at the start of the memfd)
+   int			memfd size (the helper must re-map it when this changes)
+   int			output offset
+
+   And the helper answers with:
+   int			data length (-1 in case of a decompression error)
+
+   With the data at output offset in the memfd.
  */
 
+#ifdef HAVE_MEMFD_CREATE
+static void v4lconvert_helper_shm_free(struct v4lconvert_data *data)
+{
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	if (data->decompress_shm_fd != -1)
+		close(data->decompress_shm_fd);
+	data->decompress_shm = NULL;
+	data->decompress_shm_size = 0;
+	data->decompress_shm_fd = -1;
+}
+
+static int v4lconvert_helper_shm_resize(struct v4lconvert_data *data,
+		int needed)
+{
+	unsigned char *shm;
+	int size;
+
+	if (needed <= data->decompress_shm_size)
+		return 0;
+
+	size = (needed + SHM_SIZE_STEP - 1) / SHM_SIZE_STEP * SHM_SIZE_STEP;
+	if (ftruncate(data->decompress_shm_fd, size)) {
+		V4LCONVERT_ERR("resizing helper shm: %s\n", strerror(errno));
+		return -1;
+	}
+
+	shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   data->decompress_shm_fd, 0);
+	if (shm == MAP_FAILED) {
+		V4LCONVERT_ERR("mapping helper shm: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (data->decompress_shm)
+		munmap(data->decompress_shm, data->decompress_shm_size);
+	data->decompress_shm = shm;
+	data->decompress_shm_size = size;
+
+	return 0;
+}
+#endif
+
 static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		const char *helper)
 {
+#ifdef HAVE_MEMFD_CREATE
+	/* If this fails we simply fall back to sending the data over the pipes */
+	data->decompress_shm_fd = memfd_create("libv4lconvert-helper",
+					       MFD_CLOEXEC);
+#endif
+
 	if (pipe(data->decompress_in_pipe)) {
 		V4LCONVERT_ERR("with helper pipe: %s\n", strerror(errno));
 		goto error;
@@ -85,7 +155,16 @@ static int v4lconvert_helper_start(struct v4lconvert_data *data,
 		}
 
 		/* And execute the helper */
-		execl(helper, helper, NULL);
+		if (data->decompress_shm_fd != -1) {
+			char fd_str[16];
+
+			fcntl(data->decompress_shm_fd, F_SETFD, 0);
+			snprintf(fd_str, sizeof(fd_str), "%d",
+				 data->decompress_shm_fd);
+			execl(helper, helper, fd_str, NULL);
+		} else {
+			execl(helper, helper, NULL);
+		}
 
 		/* We should never get here */
 		perror("libv4lconvert: error starting helper");
@@ -105,6 +184,9 @@ error_close_in_pipe:
 	close(data->decompress_in_pipe[READ_END]);
 	close(data->decompress_in_pipe[WRITE_END]);
 error:
+#ifdef HAVE_MEMFD_CREATE
+	v4lconvert_helper_shm_free(data);
+#endif
 	return -1;
 }
 
@@ -169,23 +251,51 @@ int v4lconvert_helper_decompress(struct v4lconvert_data *data,
 		const char *helper, const unsigned char *src, int src_size,
 		unsigned char *dest, int dest_size, int width, int height, int flags)
 {
-	int r;
+	int r, msg[6];
 
 	if (data->decompress_pid == -1) {
 		if (v4lconvert_helper_start(data, helper))
 			return -1;
 	}
 
-	if (v4lconvert_helper_write(data, &width, sizeof(int)))
-		return -1;
+	msg[0] = width;
+	msg[1] = height;
+	msg[2] = flags;
+	msg[3] = src_size;
 
-	if (v4lconvert_helper_write(data, &height, sizeof(int)))
-		return -1;
+#ifdef HAVE_MEMFD_CREATE
+	if (data->decompress_shm_fd != -1) {
+		/* Page align the output */
+		int dest_offset = (src_size + 4095) & ~4095;
 
-	if (v4lconvert_helper_write(data, &flags, sizeof(int)))
-		return -1;
+		if (v4lconvert_helper_shm_resize(data, dest_offset + dest_size))
+			return -1;
+
+		memcpy(data->decompress_shm, src, src_size);
+		msg[4] = data->decompress_shm_size;
+		msg[5] = dest_offset;
+		if (v4lconvert_helper_write(data, msg, sizeof(msg)))
+			return -1;
+
+		if (v4lconvert_helper_read(data, &r, sizeof(int)))
+			return -1;
+
+		if (r < 0) {
+			V4LCONVERT_ERR("decompressing frame data\n");
+			return -1;
+		}
+
+		if (dest_size < r) {
+			V4LCONVERT_ERR("destination buffer to small\n");
+			return -1;
+		}
+
+		memcpy(dest, data->decompress_shm + dest_offset, r);
+		return 0;
+	}
+#endif
 
-	if (v4lconvert_helper_write(data, &src_size, sizeof(int)))
+	if (v4lconvert_helper_write(data, msg, 4 * sizeof(int)))
 		return -1;
 
 	if (v4lconvert_helper_write(data, src, src_size))
@@ -217,4 +327,7 @@ void v4lconvert_helper_cleanup(struct v4lconvert_data *data)
 		waitpid(data->decompress_pid, &status, 0);
 		data->decompress_pid = -1;
 	}
+#ifdef HAVE_MEMFD_CREATE
+	v4lconvert_helper_shm_free(data);
+#endif
 }
@@ -0,0 +1,567 @@
+/*
+
+# (M)JPEG decoding on a V4L2 mem2mem JPEG decoder, when the system has one
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "libv4lconvert-priv.h"
+#include "libv4lsyscall-priv.h"
+
+/* How long to wait for the decoder before giving up on it, in ms */
+#define JPEG_M2M_TIMEOUT 1000
+
+struct v4lconvert_jpeg_m2m {
+	int fd;
+	unsigned int out_type;
+	unsigned int cap_type;
+	int streaming;
+	/* Current configuration */
+	unsigned int width;
+	unsigned int height;
+	unsigned int dest_pix_fmt;
+	unsigned int cap_pix_fmt;
+	unsigned int cap_bytesperline;
+	unsigned int out_pix_fmt;
+	void *out_mem;
+	unsigned int out_len;
+	void *cap_mem;
+	unsigned int cap_len;
+};
+
+static int jpeg_m2m_has_fmt(int fd, unsigned int type, unsigned int pixfmt)
+{
+	struct v4l2_fmtdesc fmtdesc = { .type = type };
+
+	for (; !SYS_IOCTL(fd, VIDIOC_ENUM_FMT, &fmtdesc); fmtdesc.index++)
+		if (fmtdesc.pixelformat == pixfmt)
+			return 1;
+
+	return 0;
+}
+
+/* Returns the output format the decoder accepts or 0 if it is no decoder */
+static unsigned int jpeg_m2m_check_dev(int fd, unsigned int *out_type,
+		unsigned int *cap_type)
+{
+	struct v4l2_capability cap;
+	unsigned int caps;
+
+	if (SYS_IOCTL(fd, VIDIOC_QUERYCAP, &cap))
+		return 0;
+
+	caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ?
+		cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_STREAMING))
+		return 0;
+
+	if (caps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+		*out_type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+		*cap_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	} else if (caps & V4L2_CAP_VIDEO_M2M) {
+		*out_type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		*cap_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	} else {
+		return 0;
+	}
+
+	if (jpeg_m2m_has_fmt(fd, *out_type, V4L2_PIX_FMT_JPEG))
+		return V4L2_PIX_FMT_JPEG;
+	if (jpeg_m2m_has_fmt(fd, *out_type, V4L2_PIX_FMT_MJPEG))
+		return V4L2_PIX_FMT_MJPEG;
+
+	return 0;
+}
+
+static int jpeg_m2m_open_dev(struct v4lconvert_jpeg_m2m *m2m,
+		const char *devname)
+{
+	int fd;
+
+	fd = SYS_OPEN(devname, O_RDWR | O_NONBLOCK, 0);
+	if (fd == -1)
+		return -1;
+
+	m2m->out_pix_fmt = jpeg_m2m_check_dev(fd, &m2m->out_type,
+					      &m2m->cap_type);
+	if (!m2m->out_pix_fmt) {
+		SYS_CLOSE(fd);
+		return -1;
+	}
+
+	m2m->fd = fd;
+	return 0;
+}
+
+static int jpeg_m2m_find_dev(struct v4lconvert_jpeg_m2m *m2m,
+		const char *devname)
+{
+	char path[PATH_MAX];
+	struct dirent *ent;
+	DIR *dir;
+	int r = -1;
+
+	if (devname)
+		return jpeg_m2m_open_dev(m2m, devname);
+
+	/* Not all JPEG decoder drivers register a media device, so look at
+	   the video nodes themselves */
+	dir = opendir("/dev");
+	if (!dir)
+		return -1;
+
+	while (r && (ent = readdir(dir))) {
+		if (strncmp(ent->d_name, "video", 5))
+			continue;
+		snprintf(path, sizeof(path), "/dev/%s", ent->d_name);
+		r = jpeg_m2m_open_dev(m2m, path);
+	}
+	closedir(dir);
+
+	return r;
+}
+
+static void jpeg_m2m_unmap(struct v4lconvert_jpeg_m2m *m2m)
+{
+	struct v4l2_requestbuffers reqbufs = { .memory = V4L2_MEMORY_MMAP };
+
+	if (m2m->streaming) {
+		SYS_IOCTL(m2m->fd, VIDIOC_STREAMOFF, &m2m->out_type);
+		SYS_IOCTL(m2m->fd, VIDIOC_STREAMOFF, &m2m->cap_type);
+		m2m->streaming = 0;
+	}
+	if (m2m->out_mem) {
+		SYS_MUNMAP(m2m->out_mem, m2m->out_len);
+		m2m->out_mem = NULL;
+		reqbufs.type = m2m->out_type;
+		SYS_IOCTL(m2m->fd, VIDIOC_REQBUFS, &reqbufs);
+	}
+	if (m2m->cap_mem) {
+		SYS_MUNMAP(m2m->cap_mem, m2m->cap_len);
+		m2m->cap_mem = NULL;
+		reqbufs.type = m2m->cap_type;
+		SYS_IOCTL(m2m->fd, VIDIOC_REQBUFS, &reqbufs);
+	}
+	m2m->width = 0;
+}
+
+static int jpeg_m2m_is_mplane(unsigned int type)
+{
+	return type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE ||
+	       type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+}
+
+static int jpeg_m2m_s_fmt(struct v4lconvert_jpeg_m2m *m2m, unsigned int type,
+		unsigned int pixfmt, unsigned int width, unsigned int height,
+		unsigned int sizeimage, unsigned int *bytesperline)
+{
+	struct v4l2_format fmt = { .type = type };
+
+	if (jpeg_m2m_is_mplane(type)) {
+		fmt.fmt.pix_mp.pixelformat = pixfmt;
+		fmt.fmt.pix_mp.width = width;
+		fmt.fmt.pix_mp.height = height;
+		fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+		fmt.fmt.pix_mp.num_planes = 1;
+		fmt.fmt.pix_mp.plane_fmt[0].sizeimage = sizeimage;
+	} else {
+		fmt.fmt.pix.pixelformat = pixfmt;
+		fmt.fmt.pix.width = width;
+		fmt.fmt.pix.height = height;
+		fmt.fmt.pix.field = V4L2_FIELD_NONE;
+		fmt.fmt.pix.sizeimage = sizeimage;
+	}
+
+	if (SYS_IOCTL(m2m->fd, VIDIOC_S_FMT, &fmt))
+		return -1;
+
+	/* We can only deal with exactly what we asked for in 1 plane */
+	if (jpeg_m2m_is_mplane(type)) {
+		if (fmt.fmt.pix_mp.pixelformat != pixfmt ||
+		    fmt.fmt.pix_mp.num_planes != 1 ||
+		    (bytesperline && (fmt.fmt.pix_mp.width != width ||
+				      fmt.fmt.pix_mp.height != height)))
+			return -1;
+		if (bytesperline)
+			*bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+	} else {
+		if (fmt.fmt.pix.pixelformat != pixfmt ||
+		    (bytesperline && (fmt.fmt.pix.width != width ||
+				      fmt.fmt.pix.height != height)))
+			return -1;
+		if (bytesperline)
+			*bytesperline = fmt.fmt.pix.bytesperline;
+	}
+
+	return 0;
+}
+
+static void *jpeg_m2m_map(struct v4lconvert_jpeg_m2m *m2m, unsigned int type,
+		unsigned int *len)
+{
+	struct v4l2_requestbuffers reqbufs = {
+		.count = 1,
+		.type = type,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf = {
+		.type = type,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+	unsigned int offset;
+	void *mem;
+
+	if (SYS_IOCTL(m2m->fd, VIDIOC_REQBUFS, &reqbufs) || reqbufs.count < 1)
+		return NULL;
+
+	if (jpeg_m2m_is_mplane(type)) {
+		buf.m.planes = planes;
+		buf.length = VIDEO_MAX_PLANES;
+	}
+	if (SYS_IOCTL(m2m->fd, VIDIOC_QUERYBUF, &buf))
+		return NULL;
+
+	if (jpeg_m2m_is_mplane(type)) {
+		*len = planes[0].length;
+		offset = planes[0].m.mem_offset;
+	} else {
+		*len = buf.length;
+		offset = buf.m.offset;
+	}
+
+	mem = (void *)SYS_MMAP(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED,
+			       m2m->fd, offset);
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	return mem;
+}
+
+/* Capture formats we can convert from, in order of preference */
+static const unsigned int jpeg_m2m_cap_fmts[] = {
+	V4L2_PIX_FMT_YUV420,
+	V4L2_PIX_FMT_YVU420,
+	V4L2_PIX_FMT_NV12,
+	V4L2_PIX_FMT_YUYV,
+};
+
+static int jpeg_m2m_configure(struct v4lconvert_jpeg_m2m *m2m,
+		unsigned int width, unsigned int height,
+		unsigned int dest_pix_fmt)
+{
+	unsigned int i, pixfmt = 0;
+
+	jpeg_m2m_unmap(m2m);
+
+	/* Prefer decoding straight into the destination format */
+	if (jpeg_m2m_has_fmt(m2m->fd, m2m->cap_type, dest_pix_fmt))
+		pixfmt = dest_pix_fmt;
+	for (i = 0; !pixfmt && i < ARRAY_SIZE(jpeg_m2m_cap_fmts); i++)
+		if (jpeg_m2m_has_fmt(m2m->fd, m2m->cap_type,
+				     jpeg_m2m_cap_fmts[i]))
+			pixfmt = jpeg_m2m_cap_fmts[i];
+	if (!pixfmt)
+		return -1;
+
+	/* A compressed frame should never get bigger than this */
+	if (jpeg_m2m_s_fmt(m2m, m2m->out_type, m2m->out_pix_fmt, width, height,
+			   width * height * 2, NULL) ||
+	    jpeg_m2m_s_fmt(m2m, m2m->cap_type, pixfmt, width, height, 0,
+			   &m2m->cap_bytesperline))
+		return -1;
+
+	m2m->out_mem = jpeg_m2m_map(m2m, m2m->out_type, &m2m->out_len);
+	if (!m2m->out_mem)
+		return -1;
+	m2m->cap_mem = jpeg_m2m_map(m2m, m2m->cap_type, &m2m->cap_len);
+	if (!m2m->cap_mem)
+		return -1;
+
+	if (SYS_IOCTL(m2m->fd, VIDIOC_STREAMON, &m2m->out_type) ||
+	    SYS_IOCTL(m2m->fd, VIDIOC_STREAMON, &m2m->cap_type))
+		return -1;
+	m2m->streaming = 1;
+
+	if (!m2m->cap_bytesperline) {
+		if (pixfmt == V4L2_PIX_FMT_YUYV)
+			m2m->cap_bytesperline = width * 2;
+		else if (pixfmt == V4L2_PIX_FMT_RGB24 ||
+			 pixfmt == V4L2_PIX_FMT_BGR24)
+			m2m->cap_bytesperline = width * 3;
+		else
+			m2m->cap_bytesperline = width;
+	}
+
+	m2m->width = width;
+	m2m->height = height;
+	m2m->dest_pix_fmt = dest_pix_fmt;
+	m2m->cap_pix_fmt = pixfmt;
+
+	return 0;
+}
+
+static int jpeg_m2m_qbuf(struct v4lconvert_jpeg_m2m *m2m, unsigned int type,
+		unsigned int bytesused)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf = {
+		.type = type,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+
+	memset(planes, 0, sizeof(planes));
+	if (jpeg_m2m_is_mplane(type)) {
+		buf.m.planes = planes;
+		buf.length = 1;
+		planes[0].bytesused = bytesused;
+	} else {
+		buf.bytesused = bytesused;
+	}
+
+	return SYS_IOCTL(m2m->fd, VIDIOC_QBUF, &buf);
+}
+
+/* Returns the number of bytes in the buffer, 0 for a buffer flagged as
+   erroneous or -1 on error */
+static int jpeg_m2m_dqbuf(struct v4lconvert_jpeg_m2m *m2m, unsigned int type)
+{
+	struct v4l2_plane planes[VIDEO_MAX_PLANES];
+	struct v4l2_buffer buf = {
+		.type = type,
+		.memory = V4L2_MEMORY_MMAP,
+	};
+
+	if (jpeg_m2m_is_mplane(type)) {
+		buf.m.planes = planes;
+		buf.length = VIDEO_MAX_PLANES;
+	}
+
+	if (SYS_IOCTL(m2m->fd, VIDIOC_DQBUF, &buf))
+		return -1;
+
+	if (buf.flags & V4L2_BUF_FLAG_ERROR)
+		return 0;
+
+	return jpeg_m2m_is_mplane(type) ? (int)planes[0].bytesused :
+					  (int)buf.bytesused;
+}
+
+static void jpeg_m2m_copy_yuv420(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int swap_uv)
+{
+	const unsigned char *usrc, *vsrc;
+	unsigned char *udest, *vdest;
+	int y;
+
+	for (y = 0; y < height; y++)
+		memcpy(dest + y * width, src + y * stride, width);
+
+	usrc = src + stride * height;
+	vsrc = usrc + (stride * height) / 4;
+	udest = dest + width * height;
+	vdest = udest + (width * height) / 4;
+	if (swap_uv) {
+		unsigned char *tmp = udest;
+
+		udest = vdest;
+		vdest = tmp;
+	}
+	for (y = 0; y < height / 2; y++) {
+		memcpy(udest + y * (width / 2), usrc + y * (stride / 2), width / 2);
+		memcpy(vdest + y * (width / 2), vsrc + y * (stride / 2), width / 2);
+	}
+}
+
+static void jpeg_m2m_convert(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_jpeg_m2m *m2m = data->jpeg_m2m;
+	int stride = m2m->cap_bytesperline;
+	int bgr = dest_pix_fmt == V4L2_PIX_FMT_BGR24;
+	int yvu = dest_pix_fmt == V4L2_PIX_FMT_YVU420;
+	int rgb = dest_pix_fmt == V4L2_PIX_FMT_RGB24 || bgr;
+	int y;
+
+	if (m2m->cap_pix_fmt == dest_pix_fmt) {
+		int bpl = width, lines = height;
+
+		switch (dest_pix_fmt) {
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			bpl = width * 3;
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			bpl = width * 2;
+			break;
+		case V4L2_PIX_FMT_NV12:
+			/* The uv plane has the same stride as the y plane */
+			lines = height * 3 / 2;
+			break;
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+			jpeg_m2m_copy_yuv420(src, dest, width, height, stride,
+					     0);
+			return;
+		}
+		for (y = 0; y < lines; y++)
+			memcpy(dest + y * bpl, src + y * stride, bpl);
+		return;
+	}
+
+	switch (m2m->cap_pix_fmt) {
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		if (m2m->cap_pix_fmt == V4L2_PIX_FMT_YVU420)
+			yvu = !yvu;
+		if (bgr)
+			v4lconvert_yuv420_to_bgr24(src, dest, width, height,
+						   stride, yvu);
+		else if (rgb)
+			v4lconvert_yuv420_to_rgb24(src, dest, width, height,
+						   stride, yvu);
+		else if (dest_pix_fmt == V4L2_PIX_FMT_NV12)
+			v4lconvert_yuv420_to_nv12(src, dest, width, height,
+						  stride, yvu);
+		else if (dest_pix_fmt == V4L2_PIX_FMT_YUYV)
+			v4lconvert_yuv420_to_yuyv(src, dest, width, height,
+						  stride, yvu);
+		else
+			jpeg_m2m_copy_yuv420(src, dest, width, height, stride,
+					     yvu);
+		break;
+	case V4L2_PIX_FMT_NV12:
+		if (rgb)
+			v4lconvert_nv12_to_rgb24(src, dest, width, height,
+						 stride, bgr);
+		else if (dest_pix_fmt == V4L2_PIX_FMT_YUYV)
+			v4lconvert_nv12_to_yuyv(src, dest, width, height,
+						stride);
+		else
+			v4lconvert_nv12_to_yuv420(src, dest, width, height,
+						  stride, yvu);
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		if (rgb)
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width,
+					height, stride, V4L2_PIX_FMT_YUYV, bgr, 0);
+		else if (dest_pix_fmt == V4L2_PIX_FMT_NV12)
+			v4lconvert_packed_yuv_to_nv12(data, src, dest, width,
+					height, stride, V4L2_PIX_FMT_YUYV);
+		else
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width,
+					height, stride, V4L2_PIX_FMT_YUYV, yvu, 0);
+		break;
+	}
+}
+
+void v4lconvert_jpeg_m2m_cleanup(struct v4lconvert_data *data)
+{
+	struct v4lconvert_jpeg_m2m *m2m = data->jpeg_m2m;
+
+	if (!m2m)
+		return;
+
+	jpeg_m2m_unmap(m2m);
+	SYS_CLOSE(m2m->fd);
+	free(m2m);
+	data->jpeg_m2m = NULL;
+}
+
+/* Stop using the decoder for the rest of this session */
+static int jpeg_m2m_disable(struct v4lconvert_data *data)
+{
+	v4lconvert_jpeg_m2m_cleanup(data);
+	data->flags |= V4LCONVERT_NO_JPEG_M2M;
+	return -1;
+}
+
+int v4lconvert_decode_jpeg_m2m(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
+{
+	struct v4lconvert_jpeg_m2m *m2m = data->jpeg_m2m;
+	unsigned int width  = fmt->fmt.pix.width;
+	unsigned int height = fmt->fmt.pix.height;
+	struct pollfd pfd;
+	char *env;
+	int r;
+
+	if (data->flags & V4LCONVERT_NO_JPEG_M2M)
+		return -1;
+
+	if (!m2m) {
+		env = getenv("LIBV4LCONVERT_JPEG_M2M");
+		if (env && !strcmp(env, "0"))
+			return jpeg_m2m_disable(data);
+
+		m2m = calloc(1, sizeof(*m2m));
+		if (!m2m)
+			return jpeg_m2m_disable(data);
+		if (jpeg_m2m_find_dev(m2m, env && env[0] == '/' ? env : NULL)) {
+			free(m2m);
+			return jpeg_m2m_disable(data);
+		}
+		data->jpeg_m2m = m2m;
+	}
+
+	if (m2m->width != width || m2m->height != height ||
+	    m2m->dest_pix_fmt != dest_pix_fmt) {
+		if (jpeg_m2m_configure(m2m, width, height, dest_pix_fmt))
+			return jpeg_m2m_disable(data);
+	}
+
+	/* Let the software decoders deal with oversized frames */
+	if ((unsigned int)src_size > m2m->out_len)
+		return -1;
+
+	memcpy(m2m->out_mem, src, src_size);
+	if (jpeg_m2m_qbuf(m2m, m2m->out_type, src_size) ||
+	    jpeg_m2m_qbuf(m2m, m2m->cap_type, 0))
+		return jpeg_m2m_disable(data);
+
+	pfd.fd = m2m->fd;
+	pfd.events = POLLIN;
+	do {
+		r = poll(&pfd, 1, JPEG_M2M_TIMEOUT);
+	} while (r == -1 && errno == EINTR);
+	if (r <= 0) {
+		V4LCONVERT_ERR("JPEG decoder timed out, no longer using it\n");
+		return jpeg_m2m_disable(data);
+	}
+
+	r = jpeg_m2m_dqbuf(m2m, m2m->cap_type);
+	if (r == -1 || jpeg_m2m_dqbuf(m2m, m2m->out_type) == -1)
+		return jpeg_m2m_disable(data);
+	/* A corrupt frame, have the software decoders report on it */
+	if (r == 0)
+		return -1;
+
+	jpeg_m2m_convert(data, m2m->cap_mem, dest, width, height, dest_pix_fmt);
+
+	return 0;
+}
@@ -18,11 +18,79 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include "libv4lconvert-priv.h"
 #ifdef HAVE_JPEG
 #include "jpeg_memsrcdest.h"
 #endif
 
+/*
+ * The jpeg decoders output planar yuv420. For nv12 the y plane gets decoded
+ * straight into dest and the u and v planes into a temp buffer, for yuyv
+ * all planes go through the temp buffer. jpeg_pack_yuv_planes() then builds
+ * the final frame from the temp buffer.
+ */
+static int jpeg_get_yuv_planes(struct v4lconvert_data *data,
+	unsigned char *dest, unsigned int width, unsigned int height,
+	unsigned int dest_pix_fmt, unsigned char *planes[3])
+{
+	unsigned char *buf = NULL;
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_NV12:
+		buf = v4lconvert_alloc_buffer(width * height / 2,
+					      &data->convert_pack_buf,
+					      &data->convert_pack_buf_size);
+		if (!buf)
+			return v4lconvert_oom_error(data);
+		planes[0] = dest;
+		planes[1] = buf;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		buf = v4lconvert_alloc_buffer(width * height * 3 / 2,
+					      &data->convert_pack_buf,
+					      &data->convert_pack_buf_size);
+		if (!buf)
+			return v4lconvert_oom_error(data);
+		planes[0] = buf;
+		planes[1] = buf + width * height;
+		break;
+	default:
+		planes[0] = dest;
+		planes[1] = dest + width * height;
+		break;
+	}
+	planes[2] = planes[1] + width * height / 4;
+
+	if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
+		buf = planes[1];
+		planes[1] = planes[2];
+		planes[2] = buf;
+	}
+
+	return 0;
+}
+
+static void jpeg_pack_yuv_planes(unsigned char *planes[3], unsigned char *dest,
+	unsigned int width, unsigned int height, unsigned int dest_pix_fmt)
+{
+	unsigned char *uvdest = dest + width * height;
+	unsigned int i;
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_NV12:
+		for (i = 0; i < width * height / 4; i++) {
+			*uvdest++ = planes[1][i];
+			*uvdest++ = planes[2][i];
+		}
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		v4lconvert_yuv420_to_yuyv(planes[0], dest, width, height,
+					  width, 0);
+		break;
+	}
+}
+
 int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags)
@@ -37,6 +105,7 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		data->tinyjpeg = tinyjpeg_init();
 		if (!data->tinyjpeg)
 			return v4lconvert_oom_error(data);
+		tinyjpeg_set_v4lconvert_data(data->tinyjpeg, data);
 	}
 	flags |= TINYJPEG_FLAGS_MJPEG_TABLE;
 	tinyjpeg_set_flags(data->tinyjpeg, flags);
@@ -76,16 +145,17 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 		result = tinyjpeg_decode(data->tinyjpeg, TINYJPEG_FMT_BGR24);
 		break;
 	case V4L2_PIX_FMT_YUV420:
-		components[1] = components[0] + width * height;
-		components[2] = components[1] + width * height / 4;
-		tinyjpeg_set_components(data->tinyjpeg, components, 3);
-		result = tinyjpeg_decode(data->tinyjpeg, TINYJPEG_FMT_YUV420P);
-		break;
 	case V4L2_PIX_FMT_YVU420:
-		components[2] = components[0] + width * height;
-		components[1] = components[2] + width * height / 4;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_YUYV:
+		if (jpeg_get_yuv_planes(data, dest, width, height,
+					dest_pix_fmt, components))
+			return -1;
 		tinyjpeg_set_components(data->tinyjpeg, components, 3);
 		result = tinyjpeg_decode(data->tinyjpeg, TINYJPEG_FMT_YUV420P);
+		/* Also pack incomplete frames, see below */
+		jpeg_pack_yuv_planes(components, dest, width, height,
+				     dest_pix_fmt);
 		break;
 	}
 
@@ -176,103 +246,103 @@ static void init_libjpeg_cinfo(struct v4lconvert_data *data)
 	data->cinfo_initialized = 1;
 }
 
-static int decode_libjpeg_h_samp1(struct v4lconvert_data *data,
-	unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
-	int v_samp)
+/*
+ * Copy a band of raw jpeg data from the scratch buffers to the destination
+ * planes, sub-sampling the chroma down to 4:2:0 where necessary. For sources
+ * with 1 chroma line per luma line we use the second line of each pair, and
+ * for sources with 1 chroma pixel per luma pixel the first pixel of each
+ * pair.
+ */
+static void copy_libjpeg_band(struct v4lconvert_data *data,
+	JSAMPARRAY rows[3], int y, int lines, int h_samp, int v_samp,
+	unsigned char *ydest, unsigned char *udest, unsigned char *vdest)
 {
-	struct jpeg_decompress_struct *cinfo = &data->cinfo;
-	int x, y;
-	unsigned char *uv_buf;
-	unsigned int width = cinfo->image_width;
-	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
-	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
+	unsigned int width = data->cinfo.image_width;
+	unsigned int height = data->cinfo.image_height;
+	int i, x, line;
 
-	uv_buf = v4lconvert_alloc_buffer(width * 16,
-					 &data->convert_pixfmt_buf,
-					 &data->convert_pixfmt_buf_size);
-	if (!uv_buf)
-		return v4lconvert_oom_error(data);
+	for (i = 0; i < lines && y + i < height; i++)
+		memcpy(ydest + (y + i) * width, rows[0][i], width);
 
-	for (y = 0; y < 8; y++) {
-		u_rows[y] = uv_buf;
-		uv_buf += width;
-		v_rows[y] = uv_buf;
-		uv_buf += width;
-	}
-	uv_buf -= width * 16;
+	for (i = 0; i < lines / 2 && (y / 2 + i) < height / 2; i++) {
+		unsigned char *u = udest + (y / 2 + i) * (width / 2);
+		unsigned char *v = vdest + (y / 2 + i) * (width / 2);
 
-	while (cinfo->output_scanline < cinfo->image_height) {
-		for (y = 0; y < 8 * v_samp; y++) {
-			y_rows[y] = ydest;
-			ydest += cinfo->image_width;
-		}
-		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
-		if (y != 8 * v_samp)
-			return -1;
-
-		/* For v_samp == 1 skip copying uv vals every other time */
-		if (cinfo->output_scanline % 16)
-			continue;
-
-		/* Copy over every other u + v pixel for 8 lines */
-		for (y = 0; y < 8; y++) {
-			for (x = 0; x < width; x += 2) {
-				*udest++ = *uv_buf++;
-				uv_buf++;
-			}
-			for (x = 0; x < width; x += 2) {
-				*vdest++ = *uv_buf++;
-				uv_buf++;
+		line = (v_samp == 1) ? 2 * i + 1 : i;
+		if (h_samp == 2) {
+			memcpy(u, rows[1][line], width / 2);
+			memcpy(v, rows[2][line], width / 2);
+		} else {
+			for (x = 0; x < width / 2; x++) {
+				u[x] = rows[1][line][2 * x];
+				v[x] = rows[2][line][2 * x];
 			}
 		}
-		uv_buf -= width * 16;
 	}
-	return 0;
 }
 
-static int decode_libjpeg_h_samp2(struct v4lconvert_data *data,
+static int decode_libjpeg_raw(struct v4lconvert_data *data,
 	unsigned char *ydest, unsigned char *udest, unsigned char *vdest,
-	int v_samp)
+	int h_samp, int v_samp)
 {
 	struct jpeg_decompress_struct *cinfo = &data->cinfo;
-	int y;
 	unsigned int width = cinfo->image_width;
+	unsigned int height = cinfo->image_height;
+	/* libjpeg always outputs whole MCUs in raw mode */
+	unsigned int y_width = (width + 8 * h_samp - 1) & ~(8 * h_samp - 1);
+	unsigned int uv_width = y_width / h_samp;
+	int lines = 8 * v_samp;
+	int i, y, direct;
+	unsigned char *buf;
 	JSAMPROW y_rows[16], u_rows[8], v_rows[8];
 	JSAMPARRAY rows[3] = { y_rows, u_rows, v_rows };
 
-	while (cinfo->output_scanline < cinfo->image_height) {
-		for (y = 0; y < 8 * v_samp; y++) {
-			y_rows[y] = ydest;
-			ydest += width;
-		}
+	buf = v4lconvert_alloc_buffer(lines * y_width + 2 * 8 * uv_width,
+				      &data->convert_pixfmt_buf,
+				      &data->convert_pixfmt_buf_size);
+	if (!buf)
+		return v4lconvert_oom_error(data);
+
+	for (y = 0; cinfo->output_scanline < height; y += lines) {
 		/*
-		 * For v_samp == 1 were going to get 1 set of uv values per
-		 * line, but we need only 1 set per 2 lines since our output
-		 * has v_samp == 2. We store every 2 sets in 1 line,
-		 * effectively using the second set for each output line.
+		 * Whole bands of 4:2:x data which fit the destination get
+		 * decoded in place, everything else goes through the scratch
+		 * buffer.
 		 */
-		if (v_samp == 1) {
-			for (y = 0; y < 8; y++) {
-				u_rows[y] = udest;
-				v_rows[y] = vdest;
-				y++;
-				u_rows[y] = udest;
-				v_rows[y] = vdest;
-				udest += width / 2;
-				vdest += width / 2;
+		direct = h_samp == 2 && y_width == width && y + lines <= height;
+		if (direct) {
+			for (i = 0; i < lines; i++)
+				y_rows[i] = ydest + (y + i) * width;
+			/*
+			 * For v_samp == 1 were going to get 1 set of uv values
+			 * per line, but we need only 1 set per 2 lines since
+			 * our output has v_samp == 2. We store every 2 sets in
+			 * 1 line, effectively using the second set for each
+			 * output line.
+			 */
+			for (i = 0; i < 8; i++) {
+				int line = (y / 2) + (v_samp == 1 ? i / 2 : i);
+
+				u_rows[i] = udest + line * (width / 2);
+				v_rows[i] = vdest + line * (width / 2);
 			}
-		} else { /* v_samp == 2 */
-			for (y = 0; y < 8; y++) {
-				u_rows[y] = udest;
-				v_rows[y] = vdest;
-				udest += width / 2;
-				vdest += width / 2;
+		} else {
+			for (i = 0; i < lines; i++)
+				y_rows[i] = buf + i * y_width;
+			for (i = 0; i < 8; i++) {
+				u_rows[i] = buf + lines * y_width + i * uv_width;
+				v_rows[i] = buf + lines * y_width +
+					    (8 + i) * uv_width;
 			}
 		}
 
-		y = jpeg_read_raw_data(cinfo, rows, 8 * v_samp);
-		if (y != 8 * v_samp)
+		i = jpeg_read_raw_data(cinfo, rows, lines);
+		if (i != lines)
 			return -1;
+
+		if (!direct)
+			copy_libjpeg_band(data, rows, y, lines, h_samp, v_samp,
+					  ydest, udest, vdest);
 	}
 	return 0;
 }
@@ -340,20 +410,18 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 #endif
 	} else {
 		int h_samp, v_samp;
-		unsigned char *udest, *vdest;
+		unsigned char *planes[3];
 
 		if (data->cinfo.max_h_samp_factor == 2 &&
 		    data->cinfo.cur_comp_info[0]->h_samp_factor == 2 &&
 		    data->cinfo.cur_comp_info[1]->h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[2]->h_samp_factor == 1) {
 			h_samp = 2;
-#if 0 /* HDG: untested, disable for now */
 		} else if (data->cinfo.max_h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[0]->h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[1]->h_samp_factor == 1 &&
 		    data->cinfo.cur_comp_info[2]->h_samp_factor == 1) {
 			h_samp = 1;
-#endif
 		} else {
 			fprintf(stderr,
 				"libv4lconvert: unsupported jpeg h-sampling "
@@ -388,38 +456,23 @@ int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 			return -1;
 		}
 
-		/* We don't want any padding as that may overflow our dest */
-		if (width % (8 * h_samp) || height % (8 * v_samp)) {
-			V4LCONVERT_ERR(
-				"resolution is not a multiple of dctsize");
-			errno = EIO;
+		if (jpeg_get_yuv_planes(data, dest, width, height,
+					dest_pix_fmt, planes))
 			return -1;
-		}
-
-		if (dest_pix_fmt == V4L2_PIX_FMT_YVU420) {
-			vdest = dest + width * height;
-			udest = vdest + (width * height) / 4;
-		} else {
-			udest = dest + width * height;
-			vdest = udest + (width * height) / 4;
-		}
 
 		data->cinfo.raw_data_out = TRUE;
 		data->cinfo.do_fancy_upsampling = FALSE;
 		jpeg_start_decompress(&data->cinfo);
 		/* Make libjpeg errors report that we've got some data */
 		data->jerr_errno = EPIPE;
-		if (h_samp == 1) {
-			result = decode_libjpeg_h_samp1(data, dest, udest,
-							vdest, v_samp);
-		} else {
-			result = decode_libjpeg_h_samp2(data, dest, udest,
-							vdest, v_samp);
-		}
+		result = decode_libjpeg_raw(data, planes[0], planes[1],
+					    planes[2], h_samp, v_samp);
 		if (result)
 			jpeg_abort_decompress(&data->cinfo);
 		else
 			jpeg_finish_decompress(&data->cinfo);
+		jpeg_pack_yuv_planes(planes, dest, width, height,
+				     dest_pix_fmt);
 	}
 
 	return result;
@@ -25,6 +25,7 @@
 #ifdef HAVE_JPEG
 #include <jpeglib.h>
 #endif
+#include <pthread.h>
 #include <setjmp.h>
 #include "libv4l-plugin.h"
 #include "libv4lconvert.h"
@@ -37,6 +38,8 @@
 
 #define V4LCONVERT_ERROR_MSG_SIZE 256
 #define V4LCONVERT_MAX_FRAMESIZES 256
+#define V4LCONVERT_TRY_FMT_CACHE_SIZE 16
+#define V4LCONVERT_FRAMESIZE_CACHE_SIZE 4
 
 #define V4LCONVERT_ERR(...) \
 	snprintf(data->error_msg, V4LCONVERT_ERROR_MSG_SIZE, \
@@ -45,13 +48,40 @@
 /* Card flags */
 #define V4LCONVERT_IS_UVC                0x01
 #define V4LCONVERT_USE_TINYJPEG          0x02
+#define V4LCONVERT_NO_JPEG_M2M           0x04
+
+/* CPU features used to pick optimized conversion routines */
+#define V4LCONVERT_CPU_SSE2              0x01
+#define V4LCONVERT_CPU_SSSE3             0x02
+#define V4LCONVERT_CPU_AVX2              0x04
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define V4LCONVERT_HAVE_X86_SIMD
+#endif
+
+/* Outcome of a v4lconvert_do_try_format() call, so that apps which keep
+   trying the same formats do not cause a TRY_FMT ioctl storm */
+struct v4lconvert_try_fmt_plan {
+	__u32 type;
+	struct v4l2_pix_format request;
+	int fps;
+	int result;
+	struct v4l2_format dest_fmt;
+	struct v4l2_format src_fmt;
+};
 
 struct v4lconvert_data {
 	int fd;
 	int flags; /* bitfield */
 	int control_flags; /* bitfield */
+	unsigned int cpu_flags; /* bitfield */
 	unsigned int no_formats;
 	unsigned long supported_src_formats[128 / BITS_PER_LONG];
+	/* supported_src_pixfmts indexes, in the order the device enums them */
+	unsigned char src_formats_order[128];
+	int no_src_formats_order;
+	/* Identifies the device for the framesize cache, if cap.driver[0] */
+	struct v4l2_capability cap;
 	char error_msg[V4LCONVERT_ERROR_MSG_SIZE];
 	struct jdec_private *tinyjpeg;
 #ifdef HAVE_JPEG
@@ -65,6 +95,12 @@ struct v4lconvert_data {
 	/* Bitmask of all supported src_formats which can do for a size */
 	int64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES];
 	unsigned int no_framesizes;
+	/* Framesizes are only enumerated once needed */
+	int framesizes_enumerated;
+	/* Cached v4lconvert_do_try_format() results, used round robin */
+	struct v4lconvert_try_fmt_plan try_fmt_plans[V4LCONVERT_TRY_FMT_CACHE_SIZE];
+	int no_try_fmt_plans;
+	int next_try_fmt_plan;
 	int bandwidth;
 	int fps;
 	int convert1_buf_size;
@@ -72,11 +108,16 @@ struct v4lconvert_data {
 	int rotate90_buf_size;
 	int flip_buf_size;
 	int convert_pixfmt_buf_size;
+	int convert_pack_buf_size;
+	int yuv420_buf_size;
 	unsigned char *convert1_buf;
 	unsigned char *convert2_buf;
 	unsigned char *rotate90_buf;
 	unsigned char *flip_buf;
 	unsigned char *convert_pixfmt_buf;
+	/* yuv420 data on its way to nv12 / yuyv */
+	unsigned char *convert_pack_buf;
+	unsigned char *yuv420_buf;
 	struct v4lcontrol_data *control;
 	struct v4lprocessing_data *processing;
 	void *dev_ops_priv;
@@ -86,12 +127,40 @@ struct v4lconvert_data {
 	pid_t decompress_pid;
 	int decompress_in_pipe[2];  /* Data from helper to us */
 	int decompress_out_pipe[2]; /* Data from us to helper */
+	int decompress_shm_fd;      /* Frame data shared with the helper */
+	unsigned char *decompress_shm;
+	int decompress_shm_size;
 
 	/* For mr97310a decoder */
 	int frames_dropped;
 
 	/* For cpia1 decoder */
 	unsigned char *previous_frame;
+
+	/* For JPEG decoding in hardware, see jpeg-m2m.c */
+	struct v4lconvert_jpeg_m2m *jpeg_m2m;
+
+	/* Worker threads for splitting up conversions, see threads.c */
+	int threads;
+	struct v4lconvert_pool *pool;
+
+	/* Processing lookup tables for the 3 bytes of each rgb24 / bgr24 pixel,
+	   set while a converter which supports this should apply them to its
+	   output, see v4lconvert_converter_applies_luts() */
+	const unsigned char *luts[3];
+
+	/* In concurrent mode each v4lconvert_convert() call borrows a context
+	   with its own scratch buffers and decoder state, these share the
+	   device, control and processing data with the instance itself. */
+	int concurrent;
+	pthread_mutex_t context_lock;
+	pthread_mutex_t processing_lock;
+	struct v4lconvert_data *free_contexts;
+	struct v4lconvert_data *next_context;
+	/* Protected by context_lock in concurrent mode, the stats of a
+	   context get added to those of the instance when it is returned */
+	int stats_enabled;
+	struct v4lconvert_stats stats;
 };
 
 struct v4lconvert_pixfmt {
@@ -99,16 +168,38 @@ struct v4lconvert_pixfmt {
 	int bpp;		/* bits per pixel, 0 for compressed formats */
 	int rgb_rank;		/* rank for converting to rgb32 / bgr32 */
 	int yuv_rank;		/* rank for converting to yuv420 / yvu420 */
+	int nv12_rank;		/* rank for converting to nv12 */
+	int yuyv_rank;		/* rank for converting to yuyv */
 	int needs_conversion;
 };
 
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt);
 
+/* Intermediate buffers are aligned for the SIMD code, buffers of at least
+   V4LCONVERT_HUGE_PAGE_SIZE bytes are mmap-ed and may use huge pages */
+#define V4LCONVERT_BUFFER_ALIGN 64
+#define V4LCONVERT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size);
+void v4lconvert_free_buffer(unsigned char *buf, int buf_size);
 
 int v4lconvert_oom_error(struct v4lconvert_data *data);
 
+unsigned int v4lconvert_get_cpu_flags(void);
+
+/* Convert rows start up to end of a frame */
+typedef void (*v4lconvert_stripe_func)(void *arg, int start, int end);
+
+int v4lconvert_threads_init(struct v4lconvert_data *data, int threads);
+
+void v4lconvert_threads_cleanup(struct v4lconvert_data *data);
+
+/* Split rows into stripes of a multiple of align rows and run func on them
+   in parallel, returns when all stripes are done */
+void v4lconvert_run_stripes(struct v4lconvert_data *data,
+		v4lconvert_stripe_func func, void *arg, int rows, int align);
+
 void v4lconvert_rgb24_to_yuv420(const unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, int bgr, int yvu, int bpp);
 
@@ -127,9 +218,37 @@ void v4lconvert_yuyv_to_bgr24(const unsigned char *src, unsigned char *dst,
 void v4lconvert_yuyv_to_yuv420(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride, int yvu);
 
+/* These optionally mirror the output, which requires an even width */
+void v4lconvert_apply_luts(const unsigned char *const *luts,
+		unsigned char *rgb, int width);
+
+void v4lconvert_yuyv_line_to_rgb24(unsigned int cpu_flags,
+		const unsigned char *src, unsigned char *dest, int width, int bgr);
+
+void v4lconvert_packed_yuv_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride,
+		unsigned int src_pix_fmt, int bgr, int hflip);
+
+/* Returns -1 for an odd width with hflip, as the pixel pairs can't be kept */
+int v4lconvert_packed_yuv_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride,
+		unsigned int src_pix_fmt, int yvu, int hflip);
+
 void v4lconvert_nv16_to_yuyv(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride);
 
+void v4lconvert_nv16_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride);
+
+void v4lconvert_packed_yuv_to_nv12(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride, unsigned int src_pix_fmt);
+
+void v4lconvert_packed_yuv_to_yuyv(const unsigned char *src, unsigned char *dst,
+		int width, int height, int stride, unsigned int src_pix_fmt);
+
 void v4lconvert_yvyu_to_rgb24(const unsigned char *src, unsigned char *dst,
 		int width, int height, int stride);
 
@@ -217,6 +336,14 @@ int v4lconvert_decode_jpeg_tinyjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt, int flags);
 
+/* Returns 0 on success, on failure the caller should fall back to a
+   software decoder */
+int v4lconvert_decode_jpeg_m2m(struct v4lconvert_data *data,
+	unsigned char *src, int src_size, unsigned char *dest,
+	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
+
+void v4lconvert_jpeg_m2m_cleanup(struct v4lconvert_data *data);
+
 int v4lconvert_decode_jpeg_libjpeg(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt);
@@ -227,8 +354,8 @@ int v4lconvert_decode_jpgl(const unsigned char *src, int src_size,
 void v4lconvert_decode_spca561(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_decode_sn9c10x(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c10x(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 int v4lconvert_decode_pac207(struct v4lconvert_data *data,
 		const unsigned char *inp, int src_size, unsigned char *outp,
@@ -242,24 +369,36 @@ int v4lconvert_decode_jl2005bcd(struct v4lconvert_data *data,
 		const unsigned char *src, int src_size,
 		unsigned char *dest, int width, int height);
 
-void v4lconvert_decode_sn9c2028(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sn9c2028(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
-void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
-		int width, int height);
+void v4lconvert_decode_sq905c(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height);
 
 void v4lconvert_decode_stv0680(const unsigned char *src, unsigned char *dst,
 		int width, int height);
 
-void v4lconvert_bayer_to_rgb24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+void v4lconvert_bayer_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *rgb,
+		int width, int height, const unsigned int stride, unsigned int pixfmt);
 
-void v4lconvert_bayer_to_bgr24(const unsigned char *bayer,
-		unsigned char *rgb, int width, int height, const unsigned int stride, unsigned int pixfmt);
+void v4lconvert_bayer_to_bgr24(struct v4lconvert_data *data,
+		const unsigned char *bayer, unsigned char *rgb,
+		int width, int height, const unsigned int stride, unsigned int pixfmt);
 
 void v4lconvert_bayer_to_yuv420(const unsigned char *bayer, unsigned char *yuv,
 		int width, int height, const unsigned int stride, unsigned int src_pixfmt, int yvu);
 
+void v4lconvert_bayer_to_nv12(const unsigned char *bayer, unsigned char *nv12,
+		int width, int height, const unsigned int stride, unsigned int src_pixfmt);
+
+/* For the 10 bit packed, 10 bit and 16 bit bayer formats, without
+   unpacking the frame to 8 bit bayer first */
+int v4lconvert_bayer_deep_to_rgbbgr24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *bgr,
+		int width, int height, unsigned int stride, unsigned int pixfmt,
+		int rgb);
+
 void v4lconvert_bayer10_to_bayer8(void *bayer10,
 		unsigned char *bayer8, int width, int height);
 
@@ -269,14 +408,23 @@ void v4lconvert_bayer10p_to_bayer8(unsigned char *bayer10p,
 void v4lconvert_bayer16_to_bayer8(unsigned char *bayer16,
 		unsigned char *bayer8, int width, int height);
 
-void v4lconvert_nv12_16l16_to_rgb24(const unsigned char *src,
-		unsigned char *dst, int width, int height);
+void v4lconvert_nv12_16l16_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst, int width, int height);
 
-void v4lconvert_nv12_16l16_to_bgr24(const unsigned char *src,
-		unsigned char *dst, int width, int height);
+void v4lconvert_nv12_16l16_to_bgr24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst, int width, int height);
 
-void v4lconvert_nv12_16l16_to_yuv420(const unsigned char *src,
-		unsigned char *dst, int width, int height, int yvu);
+void v4lconvert_nv12_16l16_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height, int yvu);
+
+void v4lconvert_nv12_16l16_to_nv12(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height);
+
+void v4lconvert_nv12_16l16_to_yuyv(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dst,
+		int width, int height);
 
 void v4lconvert_hsv_to_rgb24(const unsigned char *src, unsigned char *dest,
 		int width, int height, int bgr, int Xin, unsigned char hsv_enc);
@@ -287,13 +435,29 @@ void v4lconvert_nv12_to_rgb24(const unsigned char *src, unsigned char *dest,
 void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
 		int width, int height, int stride, int yvu);
 
-void v4lconvert_rotate90(unsigned char *src, unsigned char *dest,
-		struct v4l2_format *fmt);
+void v4lconvert_nv12_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride);
+
+void v4lconvert_yuv420_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu);
+
+void v4lconvert_yuv420_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu);
+
+void v4lconvert_rotate90(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest, struct v4l2_format *fmt);
 
-void v4lconvert_flip(unsigned char *src, unsigned char *dest,
+void v4lconvert_flip(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest,
 		struct v4l2_format *fmt, int hflip, int vflip);
 
-void v4lconvert_crop(unsigned char *src, unsigned char *dest,
+int v4lconvert_flip_crop(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		int hflip, int vflip);
+
+void v4lconvert_crop(struct v4lconvert_data *data,
+		unsigned char *src, unsigned char *dest,
 		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt);
 
 int v4lconvert_helper_decompress(struct v4lconvert_data *data,
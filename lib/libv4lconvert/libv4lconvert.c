@@ -19,12 +19,15 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "libv4lconvert.h"
 #include "libv4lconvert-priv.h"
 #include "libv4lsyscall-priv.h"
+#include "usdt.h"
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
@@ -89,8 +92,7 @@ const struct libv4l_dev_ops *v4lconvert_get_default_dev_ops()
 	return &default_dev_ops;
 }
 
-static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
-		unsigned int pixelformat, int index);
+static void v4lconvert_init_framesizes(struct v4lconvert_data *data);
 
 /*
  * Notes:
@@ -102,89 +104,89 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
  *    own decoders.
  */
 #define SUPPORTED_DST_PIXFMTS \
-	/* fourcc			bpp	rgb	yuv	needs      */ \
-	/*					rank	rank	conversion */ \
-	{ V4L2_PIX_FMT_RGB24,		24,	 1,	 5,	0 }, \
-	{ V4L2_PIX_FMT_BGR24,		24,	 1,	 5,	0 }, \
-	{ V4L2_PIX_FMT_YUV420,		12,	 6,	 1,	0 }, \
-	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	0 }
+	/* fourcc			bpp	rgb	yuv	nv12	yuyv	needs      */ \
+	/*					rank	rank	rank	rank	conversion */ \
+	{ V4L2_PIX_FMT_RGB24,		24,	 1,	 5,	 5,	 5,	0 }, \
+	{ V4L2_PIX_FMT_BGR24,		24,	 1,	 5,	 5,	 5,	0 }, \
+	{ V4L2_PIX_FMT_YUV420,		12,	 6,	 1,	 2,	 3,	0 }, \
+	{ V4L2_PIX_FMT_YVU420,		12,	 6,	 1,	 2,	 3,	0 }, \
+	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	 1,	 3,	0 }, \
+	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	 4,	 1,	0 }
 
 static const struct v4lconvert_pixfmt supported_src_pixfmts[] = {
 	SUPPORTED_DST_PIXFMTS,
 	/* packed rgb formats */
-	{ V4L2_PIX_FMT_RGB565,		16,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_BGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_RGB32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_ABGR32,		32,	 4,	 6,	0 },
-	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	0 },
+	{ V4L2_PIX_FMT_RGB565,		16,	 4,	 6,	 6,	 6,	0 },
+	{ V4L2_PIX_FMT_BGR32,		32,	 4,	 6,	 6,	 6,	0 },
+	{ V4L2_PIX_FMT_RGB32,		32,	 4,	 6,	 6,	 6,	0 },
+	{ V4L2_PIX_FMT_XBGR32,		32,	 4,	 6,	 6,	 6,	0 },
+	{ V4L2_PIX_FMT_XRGB32,		32,	 4,	 6,	 6,	 6,	0 },
+	{ V4L2_PIX_FMT_ABGR32,		32,	 4,	 6,	 6,	 6,	0 },
+	{ V4L2_PIX_FMT_ARGB32,		32,	 4,	 6,	 6,	 6,	0 },
 	/* yuv 4:2:2 formats */
-	{ V4L2_PIX_FMT_YUYV,		16,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_YVYU,		16,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_UYVY,		16,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_NV16,		16,	 5,	 4,	1 },
-	{ V4L2_PIX_FMT_NV61,		16,	 5,	 4,	1 },
+	{ V4L2_PIX_FMT_YVYU,		16,	 5,	 4,	 4,	 2,	0 },
+	{ V4L2_PIX_FMT_UYVY,		16,	 5,	 4,	 4,	 2,	0 },
+	{ V4L2_PIX_FMT_NV16,		16,	 5,	 4,	 4,	 2,	1 },
+	{ V4L2_PIX_FMT_NV61,		16,	 5,	 4,	 4,	 3,	1 },
 	/* yuv 4:2:0 formats */
-	{ V4L2_PIX_FMT_SPCA501,		12,      6,	 3,	1 },
-	{ V4L2_PIX_FMT_SPCA505,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_SPCA508,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_CIT_YYVYUY,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_KONICA420,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_SN9C20X_I420,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_M420,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_NV12_16L16,	12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_NV12,		12,	 6,	 3,	1 },
-	{ V4L2_PIX_FMT_CPIA1,		 0,	 6,	 3,	1 },
+	{ V4L2_PIX_FMT_SPCA501,		12,      6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_SPCA505,		12,	 6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_SPCA508,		12,	 6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_CIT_YYVYUY,	12,	 6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_KONICA420,	12,	 6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_SN9C20X_I420,	12,	 6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_M420,		12,	 6,	 3,	 4,	 4,	1 },
+	{ V4L2_PIX_FMT_NV12_16L16,	12,	 6,	 3,	 3,	 4,	1 },
+	{ V4L2_PIX_FMT_CPIA1,		 0,	 6,	 3,	 4,	 4,	1 },
 	/* JPEG and variants */
-	{ V4L2_PIX_FMT_MJPEG,		 0,	 7,	 7,	0 },
-	{ V4L2_PIX_FMT_JPEG,		 0,	 7,	 7,	0 },
-	{ V4L2_PIX_FMT_PJPG,		 0,	 7,	 7,	1 },
-	{ V4L2_PIX_FMT_JPGL,		 0,	 7,	 7,	1 },
+	{ V4L2_PIX_FMT_MJPEG,		 0,	 7,	 7,	 7,	 8,	0 },
+	{ V4L2_PIX_FMT_JPEG,		 0,	 7,	 7,	 7,	 8,	0 },
+	{ V4L2_PIX_FMT_PJPG,		 0,	 7,	 7,	 7,	 8,	1 },
+	{ V4L2_PIX_FMT_JPGL,		 0,	 7,	 7,	 8,	 8,	1 },
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
-	{ V4L2_PIX_FMT_OV511,		 0,	 7,	 7,	1 },
-	{ V4L2_PIX_FMT_OV518,		 0,	 7,	 7,	1 },
+	{ V4L2_PIX_FMT_OV511,		 0,	 7,	 7,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_OV518,		 0,	 7,	 7,	 8,	 8,	1 },
 #endif
 	/* uncompressed bayer */
-	{ V4L2_PIX_FMT_SBGGR8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_SGBRG8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_SGRBG8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_SRGGB8,		 8,	 8,	 8,	0 },
-	{ V4L2_PIX_FMT_STV0680,		 8,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SBGGR10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGBRG10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGRBG10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SRGGB10P,	10,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SBGGR10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGBRG10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGRBG10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SRGGB10,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SBGGR16,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGBRG16,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SGRBG16,		16,	 8,	 8,	1 },
-	{ V4L2_PIX_FMT_SRGGB16,		16,	 8,	 8,	1 },
+	{ V4L2_PIX_FMT_SBGGR8,		 8,	 8,	 8,	 8,	 9,	0 },
+	{ V4L2_PIX_FMT_SGBRG8,		 8,	 8,	 8,	 8,	 9,	0 },
+	{ V4L2_PIX_FMT_SGRBG8,		 8,	 8,	 8,	 8,	 9,	0 },
+	{ V4L2_PIX_FMT_SRGGB8,		 8,	 8,	 8,	 8,	 9,	0 },
+	{ V4L2_PIX_FMT_STV0680,		 8,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SBGGR10P,	10,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SGBRG10P,	10,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SGRBG10P,	10,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SRGGB10P,	10,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SBGGR10,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SGBRG10,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SGRBG10,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SRGGB10,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SBGGR16,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SGBRG16,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SGRBG16,		16,	 8,	 8,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SRGGB16,		16,	 8,	 8,	 8,	 9,	1 },
 	/* compressed bayer */
-	{ V4L2_PIX_FMT_SPCA561,		 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_SN9C10X,		 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_SN9C2028,	 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_PAC207,		 0,	 9,	 9,	1 },
-	{ V4L2_PIX_FMT_MR97310A,	 0,	 9,	 9,	1 },
+	{ V4L2_PIX_FMT_SPCA561,		 0,	 9,	 9,	 9,	10,	1 },
+	{ V4L2_PIX_FMT_SN9C10X,		 0,	 9,	 9,	 9,	10,	1 },
+	{ V4L2_PIX_FMT_SN9C2028,	 0,	 9,	 9,	 9,	10,	1 },
+	{ V4L2_PIX_FMT_PAC207,		 0,	 9,	 9,	 9,	10,	1 },
+	{ V4L2_PIX_FMT_MR97310A,	 0,	 9,	 9,	 9,	10,	1 },
 #ifdef HAVE_JPEG
-	{ V4L2_PIX_FMT_JL2005BCD,	 0,	 9,	 9,	1 },
+	{ V4L2_PIX_FMT_JL2005BCD,	 0,	 9,	 9,	 9,	10,	1 },
 #endif
-	{ V4L2_PIX_FMT_SQ905C,		 0,	 9,	 9,	1 },
+	{ V4L2_PIX_FMT_SQ905C,		 0,	 9,	 9,	 9,	10,	1 },
 	/* special */
-	{ V4L2_PIX_FMT_SE401,		 0,	 8,	 9,	1 },
+	{ V4L2_PIX_FMT_SE401,		 0,	 8,	 9,	 9,	 9,	1 },
 	/* grey formats */
-	{ V4L2_PIX_FMT_GREY,		 8,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y4,		 8,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y6,		 8,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y10BPACK,	10,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y16,		16,	20,	20,	0 },
-	{ V4L2_PIX_FMT_Y16_BE,		16,	20,	20,	0 },
+	{ V4L2_PIX_FMT_GREY,		 8,	20,	20,	20,	20,	0 },
+	{ V4L2_PIX_FMT_Y4,		 8,	20,	20,	20,	20,	0 },
+	{ V4L2_PIX_FMT_Y6,		 8,	20,	20,	20,	20,	0 },
+	{ V4L2_PIX_FMT_Y10BPACK,	10,	20,	20,	20,	20,	0 },
+	{ V4L2_PIX_FMT_Y16,		16,	20,	20,	20,	20,	0 },
+	{ V4L2_PIX_FMT_Y16_BE,		16,	20,	20,	20,	20,	0 },
 	/* hsv formats */
-	{ V4L2_PIX_FMT_HSV32,		32,	 5,	 4,	0 },
-	{ V4L2_PIX_FMT_HSV24,		24,	 5,	 4,	0 },
+	{ V4L2_PIX_FMT_HSV32,		32,	 5,	 4,	 5,	 5,	0 },
+	{ V4L2_PIX_FMT_HSV24,		24,	 5,	 4,	 5,	 5,	0 },
 };
 
 static const struct v4lconvert_pixfmt supported_dst_pixfmts[] = {
@@ -215,6 +217,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	int i, j;
 	struct v4lconvert_data *data = calloc(1, sizeof(struct v4lconvert_data));
 	struct v4l2_capability cap;
+	char *s;
 	/*
 	 * This keeps tracks of device-specific formats for which apps most
 	 * likely don't know. If all a driver can offer are proprietary
@@ -232,9 +235,18 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	data->fd = fd;
 	data->dev_ops = dev_ops;
 	data->dev_ops_priv = dev_ops_priv;
+	pthread_mutex_init(&data->context_lock, NULL);
+	pthread_mutex_init(&data->processing_lock, NULL);
 	data->decompress_pid = -1;
+	data->decompress_shm_fd = -1;
 	data->fps = 30;
 
+	data->cpu_flags = v4lconvert_get_cpu_flags();
+	/* Allow overriding through environment, mainly useful for debugging */
+	s = getenv("LIBV4LCONVERT_CPU_FLAGS");
+	if (s)
+		data->cpu_flags &= strtol(s, NULL, 0);
+
 	/* Check supported formats */
 	for (i = 0; ; i++) {
 		struct v4l2_fmtdesc fmt = { .type = V4L2_BUF_TYPE_VIDEO_CAPTURE };
@@ -251,7 +263,9 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 
 		if (j < ARRAY_SIZE(supported_src_pixfmts)) {
 			set_bit(j, data->supported_src_formats);
-			v4lconvert_get_framesizes(data, fmt.pixelformat, j);
+			if (data->no_src_formats_order <
+			    ARRAY_SIZE(data->src_formats_order))
+				data->src_formats_order[data->no_src_formats_order++] = j;
 			if (!supported_src_pixfmts[j].needs_conversion)
 				always_needs_conversion = 0;
 		} else
@@ -263,6 +277,7 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 	/* Check if this cam has any special flags */
 	if (data->dev_ops->ioctl(data->dev_ops_priv, data->fd,
 			VIDIOC_QUERYCAP, &cap) == 0) {
+		data->cap = cap;
 		if (!strcmp((char *)cap.driver, "uvcvideo"))
 			data->flags |= V4LCONVERT_IS_UVC;
 
@@ -290,16 +305,20 @@ struct v4lconvert_data *v4lconvert_create_with_dev_ops(int fd, void *dev_ops_pri
 		return NULL;
 	}
 
+	data->threads = 1;
+	s = getenv("LIBV4LCONVERT_THREADS");
+	if (s)
+		v4lconvert_threads_init(data, strtol(s, NULL, 0));
+
 	return data;
 }
 
-void v4lconvert_destroy(struct v4lconvert_data *data)
+/* Frees all state which belongs to the conversion of a single frame at a
+   time, as opposed to the device */
+static void v4lconvert_free_conversion_state(struct v4lconvert_data *data)
 {
-	if (!data)
-		return;
-
-	v4lprocessing_destroy(data->processing);
-	v4lcontrol_destroy(data->control);
+	v4lconvert_threads_cleanup(data);
+	v4lconvert_jpeg_m2m_cleanup(data);
 	if (data->tinyjpeg) {
 		unsigned char *comps[3] = { NULL, NULL, NULL };
 
@@ -313,12 +332,42 @@ void v4lconvert_destroy(struct v4lconvert_data *data)
 #ifdef HAVE_LIBV4LCONVERT_HELPERS
 	v4lconvert_helper_cleanup(data);
 #endif
-	free(data->convert1_buf);
-	free(data->convert2_buf);
-	free(data->rotate90_buf);
-	free(data->flip_buf);
-	free(data->convert_pixfmt_buf);
+	v4lconvert_free_buffer(data->convert1_buf, data->convert1_buf_size);
+	v4lconvert_free_buffer(data->convert2_buf, data->convert2_buf_size);
+	v4lconvert_free_buffer(data->rotate90_buf, data->rotate90_buf_size);
+	v4lconvert_free_buffer(data->flip_buf, data->flip_buf_size);
+	v4lconvert_free_buffer(data->convert_pixfmt_buf,
+			       data->convert_pixfmt_buf_size);
+	v4lconvert_free_buffer(data->convert_pack_buf,
+			       data->convert_pack_buf_size);
+	v4lconvert_free_buffer(data->yuv420_buf, data->yuv420_buf_size);
 	free(data->previous_frame);
+}
+
+static void v4lconvert_free_contexts(struct v4lconvert_data *data)
+{
+	struct v4lconvert_data *ctx;
+
+	while ((ctx = data->free_contexts)) {
+		data->free_contexts = ctx->next_context;
+		v4lconvert_free_conversion_state(ctx);
+		pthread_mutex_destroy(&ctx->processing_lock);
+		pthread_mutex_destroy(&ctx->context_lock);
+		free(ctx);
+	}
+}
+
+void v4lconvert_destroy(struct v4lconvert_data *data)
+{
+	if (!data)
+		return;
+
+	v4lconvert_free_contexts(data);
+	v4lconvert_free_conversion_state(data);
+	v4lprocessing_destroy(data->processing);
+	v4lcontrol_destroy(data->control);
+	pthread_mutex_destroy(&data->processing_lock);
+	pthread_mutex_destroy(&data->context_lock);
 	free(data);
 }
 
@@ -391,8 +440,9 @@ int v4lconvert_enum_fmt(struct v4lconvert_data *data, struct v4l2_fmtdesc *fmt)
    when multiple source formats are available for a certain resolution, the
    source format for which this function returns the lowest value wins.
    
-   This function uses the rgb_rank resp. yuv_rank values as a base when
-   converting to rgb32 resp. yuv420. The initial ranks range from 1 - 10,
+   This function uses the rgb_rank, yuv_rank, nv12_rank resp. yuyv_rank
+   values as a base when converting to rgb32, yuv420, nv12 resp. yuyv. The
+   initial ranks range from 1 - 10,
    the initial rank purely expresses the CPU cost of doing the conversion, the
    ranking algorithm will give a penalty of 10 points if
    (width * height * fps * bpp / 8) > bandwidth
@@ -416,10 +466,17 @@ static int v4lconvert_get_rank(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_YVU420:
 		rank = supported_src_pixfmts[src_index].yuv_rank;
 		break;
+	case V4L2_PIX_FMT_NV12:
+		rank = supported_src_pixfmts[src_index].nv12_rank;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		rank = supported_src_pixfmts[src_index].yuyv_rank;
+		break;
 	}
 
 	/* So that if both rgb32 and bgr32 are supported, or both yuv420 and
-	   yvu420 the right one wins */
+	   yvu420 the right one wins, this also makes passing through nv12 /
+	   yuyv win over any conversion */
 	if (supported_src_pixfmts[src_index].fmt == dest_pixelformat)
 		rank--;
 
@@ -452,6 +509,8 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 	int best_format = 0;
 	int best_rank = 100;
 
+	v4lconvert_init_framesizes(data);
+
 	for (i = 0; i < data->no_framesizes; i++) {
 		if (data->framesizes[i].discrete.width <= dest_fmt->fmt.pix.width &&
 				data->framesizes[i].discrete.height <= dest_fmt->fmt.pix.height) {
@@ -503,7 +562,7 @@ static int v4lconvert_do_try_format_uvc(struct v4lconvert_data *data,
 	return 0;
 }
 
-static int v4lconvert_do_try_format(struct v4lconvert_data *data,
+static int v4lconvert_do_try_format_probe(struct v4lconvert_data *data,
 		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
 {
 	int i, size_x_diff, size_y_diff, rank, best_rank = 0;
@@ -511,9 +570,6 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 	unsigned int desired_pixfmt = dest_fmt->fmt.pix.pixelformat;
 	struct v4l2_format try_fmt, closest_fmt = { .type = 0 };
 
-	if (data->flags & V4LCONVERT_IS_UVC)
-		return v4lconvert_do_try_format_uvc(data, dest_fmt, src_fmt);
-
 	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++) {
 		/* is this format supported? */
 		if (!test_bit(i, data->supported_src_formats))
@@ -560,6 +616,59 @@ static int v4lconvert_do_try_format(struct v4lconvert_data *data,
 	return 0;
 }
 
+/* Like v4lconvert_do_try_format_probe(), but remembers the outcome to avoid
+   probing the device with the same TRY_FMT ioctls again and again, the
+   cache gets flushed by v4lconvert_flush_try_format_cache() */
+static int v4lconvert_do_try_format(struct v4lconvert_data *data,
+		struct v4l2_format *dest_fmt, struct v4l2_format *src_fmt)
+{
+	struct v4lconvert_try_fmt_plan *plan;
+	int i, result;
+
+	if (data->flags & V4LCONVERT_IS_UVC)
+		return v4lconvert_do_try_format_uvc(data, dest_fmt, src_fmt);
+
+	for (i = 0; i < data->no_try_fmt_plans; i++) {
+		plan = &data->try_fmt_plans[i];
+		if (plan->type != dest_fmt->type || plan->fps != data->fps ||
+		    memcmp(&plan->request, &dest_fmt->fmt.pix,
+			   sizeof(plan->request)))
+			continue;
+
+		if (plan->result == 0) {
+			*dest_fmt = plan->dest_fmt;
+			*src_fmt = plan->src_fmt;
+		}
+		return plan->result;
+	}
+
+	plan = &data->try_fmt_plans[data->next_try_fmt_plan];
+	plan->type = dest_fmt->type;
+	plan->request = dest_fmt->fmt.pix;
+	plan->fps = data->fps;
+
+	result = v4lconvert_do_try_format_probe(data, dest_fmt, src_fmt);
+
+	plan->result = result;
+	if (result == 0) {
+		plan->dest_fmt = *dest_fmt;
+		plan->src_fmt = *src_fmt;
+	}
+
+	data->next_try_fmt_plan =
+		(data->next_try_fmt_plan + 1) % V4LCONVERT_TRY_FMT_CACHE_SIZE;
+	if (data->no_try_fmt_plans < V4LCONVERT_TRY_FMT_CACHE_SIZE)
+		data->no_try_fmt_plans++;
+
+	return result;
+}
+
+void v4lconvert_flush_try_format_cache(struct v4lconvert_data *data)
+{
+	data->no_try_fmt_plans = 0;
+	data->next_try_fmt_plan = 0;
+}
+
 void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 {
 	switch (fmt->fmt.pix.pixelformat) {
@@ -570,9 +679,14 @@ void v4lconvert_fixup_fmt(struct v4l2_format *fmt)
 		break;
 	case V4L2_PIX_FMT_YUV420:
 	case V4L2_PIX_FMT_YVU420:
+	case V4L2_PIX_FMT_NV12:
 		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width;
 		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_YUYV:
+		fmt->fmt.pix.bytesperline = fmt->fmt.pix.width * 2;
+		fmt->fmt.pix.sizeimage = fmt->fmt.pix.width * fmt->fmt.pix.height * 2;
+		break;
 	}
 }
 
@@ -705,6 +819,37 @@ int v4lconvert_needs_conversion(struct v4lconvert_data *data,
 	return 0;
 }
 
+/* Converters which can apply the processing lookup tables to their output
+   themselves, see v4lprocessing_get_lookup_tables() */
+static int v4lconvert_converter_applies_luts(unsigned int src_pix_fmt,
+		unsigned int dest_pix_fmt)
+{
+	if (dest_pix_fmt != V4L2_PIX_FMT_RGB24 &&
+	    dest_pix_fmt != V4L2_PIX_FMT_BGR24)
+		return 0;
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SBGGR10:
+	case V4L2_PIX_FMT_SGBRG10:
+	case V4L2_PIX_FMT_SGRBG10:
+	case V4L2_PIX_FMT_SRGGB10:
+	case V4L2_PIX_FMT_SBGGR16:
+	case V4L2_PIX_FMT_SGBRG16:
+	case V4L2_PIX_FMT_SGRBG16:
+	case V4L2_PIX_FMT_SRGGB16:
+		return 1;
+	}
+
+	return 0;
+}
+
 static int v4lconvert_processing_needs_double_conversion(
 		unsigned int src_pix_fmt, unsigned int dest_pix_fmt)
 {
@@ -748,18 +893,81 @@ static int v4lconvert_processing_needs_double_conversion(
 	return 1;
 }
 
+/* Intermediate buffers of at least a huge page get their own mapping, so
+   that the kernel can back them with huge pages, everything smaller comes
+   from the heap. Which of the two a buffer is follows from its size. */
+static int v4lconvert_buffer_is_mapped(int size)
+{
+	return size >= V4LCONVERT_HUGE_PAGE_SIZE;
+}
+
+static unsigned char *v4lconvert_map_buffer(int size)
+{
+	void *buf;
+
+#ifdef MAP_HUGETLB
+	/* Only succeeds if the admin reserved huge pages, but then it is a
+	   guaranteed win */
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (buf != MAP_FAILED)
+		return buf;
+#endif
+	buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buf == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	/* Ask for transparent huge pages, failure is harmless */
+	madvise(buf, size, MADV_HUGEPAGE);
+#endif
+	return buf;
+}
+
+void v4lconvert_free_buffer(unsigned char *buf, int buf_size)
+{
+	if (!buf)
+		return;
+
+	if (v4lconvert_buffer_is_mapped(buf_size))
+		munmap(buf, buf_size);
+	else
+		free(buf);
+}
+
+/* Returns a buffer of at least needed bytes which is aligned to
+   V4LCONVERT_BUFFER_ALIGN bytes, (re)allocating *buf when it is too small.
+   The contents are not preserved when the buffer grows. */
 unsigned char *v4lconvert_alloc_buffer(int needed,
 		unsigned char **buf, int *buf_size)
 {
-	if (*buf_size < needed) {
-		free(*buf);
-		*buf = malloc(needed);
-		if (*buf == NULL) {
-			*buf_size = 0;
-			return NULL;
-		}
-		*buf_size = needed;
-	}
+	void *new_buf;
+	int size;
+
+	if (*buf_size >= needed)
+		return *buf;
+
+	v4lconvert_free_buffer(*buf, *buf_size);
+	*buf = NULL;
+	*buf_size = 0;
+
+	/* Round up, so that frames whose size varies slightly (compressed
+	   formats, switching between similar resolutions) don't cause a
+	   new allocation each time they grow a bit */
+	size = (needed + V4LCONVERT_BUFFER_ALIGN - 1) &
+	       ~(V4LCONVERT_BUFFER_ALIGN - 1);
+	if (v4lconvert_buffer_is_mapped(size)) {
+		size = (size + V4LCONVERT_HUGE_PAGE_SIZE - 1) &
+		       ~(V4LCONVERT_HUGE_PAGE_SIZE - 1);
+		new_buf = v4lconvert_map_buffer(size);
+	} else if (posix_memalign(&new_buf, V4LCONVERT_BUFFER_ALIGN, size))
+		new_buf = NULL;
+
+	if (new_buf == NULL)
+		return NULL;
+
+	*buf = new_buf;
+	*buf_size = size;
 	return *buf;
 }
 
@@ -770,6 +978,57 @@ int v4lconvert_oom_error(struct v4lconvert_data *data)
 	return -1;
 }
 
+/* Source formats without a direct conversion to nv12 / yuyv, these get
+   converted to yuv420 first */
+static int v4lconvert_needs_yuv420_step(unsigned int src_pix_fmt)
+{
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_JPGL:
+	case V4L2_PIX_FMT_SE401:
+	case V4L2_PIX_FMT_Y16:
+	case V4L2_PIX_FMT_Y16_BE:
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_Y4:
+	case V4L2_PIX_FMT_Y6:
+	case V4L2_PIX_FMT_Y10BPACK:
+	case V4L2_PIX_FMT_RGB565:
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_ARGB32:
+	case V4L2_PIX_FMT_BGR32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+	case V4L2_PIX_FMT_HSV24:
+	case V4L2_PIX_FMT_HSV32:
+		return 1;
+	}
+
+	return 0;
+}
+
+/* There is no direct hsv -> yuv conversion, go through an rgb24 buffer */
+static int v4lconvert_hsv_to_yuv420(struct v4lconvert_data *data,
+	const unsigned char *src, unsigned char *dest,
+	const struct v4l2_format *fmt, int bits, int yvu)
+{
+	struct v4l2_format rgb_fmt = *fmt;
+	unsigned char *rgb;
+
+	rgb = v4lconvert_alloc_buffer(fmt->fmt.pix.width * fmt->fmt.pix.height * 3,
+			&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
+	if (!rgb)
+		return v4lconvert_oom_error(data);
+
+	v4lconvert_hsv_to_rgb24(src, rgb, fmt->fmt.pix.width,
+				fmt->fmt.pix.height, 0, bits, fmt->fmt.pix.hsv_enc);
+	rgb_fmt.fmt.pix.bytesperline = fmt->fmt.pix.width * 3;
+	v4lconvert_rgb24_to_yuv420(rgb, dest, &rgb_fmt, 0, yvu, 3);
+
+	return 0;
+}
+
 static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned char *src, int src_size, unsigned char *dest, int dest_size,
 	struct v4l2_format *fmt, unsigned int dest_pix_fmt)
@@ -780,10 +1039,43 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	unsigned int height = fmt->fmt.pix.height;
 	unsigned int bytesperline = fmt->fmt.pix.bytesperline;
 
+	if ((dest_pix_fmt == V4L2_PIX_FMT_NV12 ||
+	     dest_pix_fmt == V4L2_PIX_FMT_YUYV) &&
+	    v4lconvert_needs_yuv420_step(src_pix_fmt)) {
+		unsigned char *tmpbuf;
+
+		tmpbuf = v4lconvert_alloc_buffer(width * height * 3 / 2,
+				&data->convert_pack_buf, &data->convert_pack_buf_size);
+		if (!tmpbuf)
+			return v4lconvert_oom_error(data);
+
+		result = v4lconvert_convert_pixfmt(data, src, src_size, tmpbuf,
+				width * height * 3 / 2, fmt, V4L2_PIX_FMT_YUV420);
+		/* Like the direct conversions pass on incomplete frames */
+		if (result && errno != EPIPE)
+			return result;
+
+		if (dest_pix_fmt == V4L2_PIX_FMT_NV12)
+			v4lconvert_yuv420_to_nv12(tmpbuf, dest, width, height,
+						  width, 0);
+		else
+			v4lconvert_yuv420_to_yuyv(tmpbuf, dest, width, height,
+						  width, 0);
+
+		fmt->fmt.pix.pixelformat = dest_pix_fmt;
+		v4lconvert_fixup_fmt(fmt);
+		return result;
+	}
+
 	switch (src_pix_fmt) {
 	/* JPG and variants */
 	case V4L2_PIX_FMT_MJPEG:
 	case V4L2_PIX_FMT_JPEG:
+		/* Use a hardware decoder if there is one */
+		if (!(data->control_flags & V4LCONTROL_ROTATED_90_JPEG) &&
+		    !v4lconvert_decode_jpeg_m2m(data, src, src_size, dest,
+						fmt, dest_pix_fmt))
+			break;
 #ifdef HAVE_JPEG
 		if (data->flags & V4LCONVERT_USE_TINYJPEG) {
 #endif // HAVE_JPEG
@@ -906,6 +1198,14 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			v4lconvert_yuv420_to_bgr24(data->convert_pixfmt_buf, dest, width,
 					height, bytesperline, yvu);
 			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuv420_to_nv12(data->convert_pixfmt_buf, dest, width,
+					height, width, yvu);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv420_to_yuyv(data->convert_pixfmt_buf, dest, width,
+					height, width, yvu);
+			break;
 		}
 		break;
 	}
@@ -914,18 +1214,39 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	case V4L2_PIX_FMT_NV12_16L16:
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_nv12_16l16_to_rgb24(src, dest, width, height);
+			v4lconvert_nv12_16l16_to_rgb24(data, src, dest, width, height);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_nv12_16l16_to_bgr24(src, dest, width, height);
+			v4lconvert_nv12_16l16_to_bgr24(data, src, dest, width, height);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_nv12_16l16_to_yuv420(src, dest, width, height, 0);
+			v4lconvert_nv12_16l16_to_yuv420(data, src, dest, width, height, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_nv12_16l16_to_yuv420(src, dest, width, height, 1);
+			v4lconvert_nv12_16l16_to_yuv420(data, src, dest, width, height, 1);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_nv12_16l16_to_nv12(data, src, dest, width, height);
+			break;
+		case V4L2_PIX_FMT_YUYV: {
+			unsigned char *tmpbuf;
+
+			if (!(width & 1)) {
+				v4lconvert_nv12_16l16_to_yuyv(data, src, dest, width, height);
+				break;
+			}
+
+			tmpbuf = v4lconvert_alloc_buffer(width * height * 3 / 2,
+					&data->convert_pack_buf,
+					&data->convert_pack_buf_size);
+			if (!tmpbuf)
+				return v4lconvert_oom_error(data);
+
+			v4lconvert_nv12_16l16_to_nv12(data, src, tmpbuf, width, height);
+			v4lconvert_nv12_to_yuyv(tmpbuf, dest, width, height, width);
 			break;
 		}
+		}
 		break;
 
 		/* NV12 formats */
@@ -943,6 +1264,17 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_nv12_to_yuv420(src, dest, width, height, bytesperline, 1);
 			break;
+		case V4L2_PIX_FMT_NV12: {
+			unsigned int i;
+
+			/* The uv plane has the same stride as the y plane */
+			for (i = 0; i < height * 3 / 2; i++)
+				memcpy(dest + i * width, src + i * bytesperline, width);
+			break;
+		}
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_nv12_to_yuyv(src, dest, width, height, bytesperline);
+			break;
 		}
 		break;
 
@@ -971,7 +1303,8 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SGBRG8;
 			break;
 		case V4L2_PIX_FMT_SN9C10X:
-			v4lconvert_decode_sn9c10x(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c10x(src, src_size, tmpbuf,
+					width, height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_PAC207:
@@ -1005,11 +1338,13 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 			break;
 #endif
 		case V4L2_PIX_FMT_SN9C2028:
-			v4lconvert_decode_sn9c2028(src, tmpbuf, width, height);
+			v4lconvert_decode_sn9c2028(src, src_size, tmpbuf,
+					width, height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SBGGR8;
 			break;
 		case V4L2_PIX_FMT_SQ905C:
-			v4lconvert_decode_sq905c(src, tmpbuf, width, height);
+			v4lconvert_decode_sq905c(src, src_size, tmpbuf,
+					width, height);
 			tmpfmt.fmt.pix.pixelformat = V4L2_PIX_FMT_SRGGB8;
 			break;
 		case V4L2_PIX_FMT_STV0680:
@@ -1026,6 +1361,7 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		src_pix_fmt = tmpfmt.fmt.pix.pixelformat;
 		src = tmpbuf;
 		src_size = width * height;
+		bytesperline = width;
 		/* fall through */
 	}
 
@@ -1062,6 +1398,15 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 				result = -1;
 				break;
 			}
+			/* Demosaic straight from the unpacked lines */
+			if (dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
+			    dest_pix_fmt == V4L2_PIX_FMT_BGR24) {
+				result = v4lconvert_bayer_deep_to_rgbbgr24(data,
+						src, dest, width, height, bytesperline,
+						fmt->fmt.pix.pixelformat,
+						dest_pix_fmt == V4L2_PIX_FMT_RGB24);
+				break;
+			}
 			v4lconvert_bayer10p_to_bayer8(src, src, width, height);
 			bytesperline = width;
 		}
@@ -1099,6 +1444,15 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 				result = -1;
 				break;
 			}
+			/* Demosaic straight from the unpacked lines */
+			if (dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
+			    dest_pix_fmt == V4L2_PIX_FMT_BGR24) {
+				result = v4lconvert_bayer_deep_to_rgbbgr24(data,
+						src, dest, width, height, bytesperline,
+						fmt->fmt.pix.pixelformat,
+						dest_pix_fmt == V4L2_PIX_FMT_RGB24);
+				break;
+			}
 			v4lconvert_bayer10_to_bayer8(src, src, width, height);
 			bytesperline = width;
 		}
@@ -1136,6 +1490,15 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 				result = -1;
 				break;
 			}
+			/* Demosaic straight from the unpacked lines */
+			if (dest_pix_fmt == V4L2_PIX_FMT_RGB24 ||
+			    dest_pix_fmt == V4L2_PIX_FMT_BGR24) {
+				result = v4lconvert_bayer_deep_to_rgbbgr24(data,
+						src, dest, width, height, bytesperline,
+						fmt->fmt.pix.pixelformat,
+						dest_pix_fmt == V4L2_PIX_FMT_RGB24);
+				break;
+			}
 			v4lconvert_bayer16_to_bayer8(src, src, width, height);
 			bytesperline = width;
 		}
@@ -1153,10 +1516,10 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_bayer_to_rgb24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_rgb24(data, src, dest, width, height, bytesperline, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_bayer_to_bgr24(src, dest, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_bayer_to_bgr24(data, src, dest, width, height, bytesperline, src_pix_fmt);
 			break;
 		case V4L2_PIX_FMT_YUV420:
 			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 0);
@@ -1164,6 +1527,22 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_bayer_to_yuv420(src, dest, width, height, bytesperline, src_pix_fmt, 1);
 			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_bayer_to_nv12(src, dest, width, height, bytesperline, src_pix_fmt);
+			break;
+		case V4L2_PIX_FMT_YUYV: {
+			unsigned char *tmpbuf;
+
+			tmpbuf = v4lconvert_alloc_buffer(width * height * 3 / 2,
+					&data->convert_pack_buf,
+					&data->convert_pack_buf_size);
+			if (!tmpbuf)
+				return v4lconvert_oom_error(data);
+
+			v4lconvert_bayer_to_nv12(src, tmpbuf, width, height, bytesperline, src_pix_fmt);
+			v4lconvert_nv12_to_yuyv(tmpbuf, dest, width, height, width);
+			break;
+		}
 		}
 		break;
 
@@ -1405,6 +1784,14 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YVU420:
 			v4lconvert_swap_uv(src, dest, fmt);
 			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuv420_to_nv12(src, dest, width, height,
+					bytesperline, 0);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv420_to_yuyv(src, dest, width, height,
+					bytesperline, 0);
+			break;
 		}
 		break;
 
@@ -1429,12 +1816,29 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		case V4L2_PIX_FMT_YVU420:
 			memcpy(dest, src, width * height * 3 / 2);
 			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_yuv420_to_nv12(src, dest, width, height,
+					bytesperline, 1);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_yuv420_to_yuyv(src, dest, width, height,
+					bytesperline, 1);
+			break;
 		}
 		break;
 
 	case V4L2_PIX_FMT_NV16: {
 		unsigned char *tmpbuf;
 
+		if (dest_pix_fmt == V4L2_PIX_FMT_NV12) {
+			v4lconvert_nv16_to_nv12(src, dest, width, height, bytesperline);
+			break;
+		}
+		if (dest_pix_fmt == V4L2_PIX_FMT_YUYV) {
+			v4lconvert_nv16_to_yuyv(src, dest, width, height, bytesperline);
+			break;
+		}
+
 		tmpbuf = v4lconvert_alloc_buffer(width * height * 2,
 				&data->convert_pixfmt_buf, &data->convert_pixfmt_buf_size);
 		if (!tmpbuf)
@@ -1454,16 +1858,28 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yuyv_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 0, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yuyv_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 1, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 0, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 1, 0);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_packed_yuv_to_nv12(data, src, dest, width, height,
+					bytesperline, src_pix_fmt);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_packed_yuv_to_yuyv(src, dest, width, height,
+					bytesperline, src_pix_fmt);
 			break;
 		}
 		break;
@@ -1491,18 +1907,28 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_yvyu_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 0, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_yvyu_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 1, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			/* Note we use yuyv_to_yuv420 not v4lconvert_yvyu_to_yuv420,
-			   with the last argument reversed to make it have as we want */
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 1);
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 0, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_yuyv_to_yuv420(src, dest, width, height, bytesperline, 0);
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 1, 0);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_packed_yuv_to_nv12(data, src, dest, width, height,
+					bytesperline, src_pix_fmt);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_packed_yuv_to_yuyv(src, dest, width, height,
+					bytesperline, src_pix_fmt);
 			break;
 		}
 		break;
@@ -1515,16 +1941,28 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 		}
 		switch (dest_pix_fmt) {
 		case V4L2_PIX_FMT_RGB24:
-			v4lconvert_uyvy_to_rgb24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 0, 0);
 			break;
 		case V4L2_PIX_FMT_BGR24:
-			v4lconvert_uyvy_to_bgr24(src, dest, width, height, bytesperline);
+			v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 1, 0);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 0);
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 0, 0);
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_uyvy_to_yuv420(src, dest, width, height, bytesperline, 1);
+			v4lconvert_packed_yuv_to_yuv420(data, src, dest, width, height,
+					bytesperline, src_pix_fmt, 1, 0);
+			break;
+		case V4L2_PIX_FMT_NV12:
+			v4lconvert_packed_yuv_to_nv12(data, src, dest, width, height,
+					bytesperline, src_pix_fmt);
+			break;
+		case V4L2_PIX_FMT_YUYV:
+			v4lconvert_packed_yuv_to_yuyv(src, dest, width, height,
+					bytesperline, src_pix_fmt);
 			break;
 		}
 		break;
@@ -1544,14 +1982,14 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						24, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt,
+						     24, 0))
+				return -1;
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						24, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt,
+						     24, 1))
+				return -1;
 			break;
 		}
 
@@ -1573,14 +2011,14 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 						32, fmt->fmt.pix.hsv_enc);
 			break;
 		case V4L2_PIX_FMT_YUV420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 0, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt,
+						     32, 0))
+				return -1;
 			break;
 		case V4L2_PIX_FMT_YVU420:
-			v4lconvert_hsv_to_rgb24(src, dest, width, height, 0,
-						32, fmt->fmt.pix.hsv_enc);
-			v4lconvert_rgb24_to_yuv420(src, dest, fmt, 0, 1, 3);
+			if (v4lconvert_hsv_to_yuv420(data, src, dest, fmt,
+						     32, 1))
+				return -1;
 			break;
 		}
 
@@ -1600,13 +2038,239 @@ static int v4lconvert_convert_pixfmt(struct v4lconvert_data *data,
 	return result;
 }
 
-int v4lconvert_convert(struct v4lconvert_data *data,
+/* Convert straight into dest doing any flipping and cropping while at it, so
+   that every destination pixel gets written only once. Returns 0 without
+   touching dest when this is not possible for the given formats. */
+static int v4lconvert_convert_fused(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		unsigned char *src, int src_size, unsigned char *dest,
+		int hflip, int vflip)
+{
+	unsigned int dest_pix_fmt = dest_fmt->fmt.pix.pixelformat;
+	int src_width = src_fmt->fmt.pix.width;
+	int src_height = src_fmt->fmt.pix.height;
+	int width = dest_fmt->fmt.pix.width;
+	int height = dest_fmt->fmt.pix.height;
+	int stride = src_fmt->fmt.pix.bytesperline;
+	int yuv420, startx, starty;
+
+	switch (src_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+		break;
+	default:
+		return 0;
+	}
+	yuv420 = dest_pix_fmt == V4L2_PIX_FMT_YUV420 ||
+		 dest_pix_fmt == V4L2_PIX_FMT_YVU420;
+
+	/* Leave short frames to the multi-pass code for identical error
+	   handling */
+	if (src_size < src_width * src_height * 2)
+		return 0;
+
+	/* Only plain cropping, without reducing or adding a border, maps
+	   source lines 1:1 to destination lines */
+	if (src_width < width || src_height < height ||
+			(src_width >= 2 * width && src_height >= 2 * height) ||
+			dest_fmt->fmt.pix.bytesperline !=
+				(yuv420 ? width : width * 3))
+		return 0;
+
+	/* Pixel pairs (and line pairs for yuv420) must stay together */
+	if ((src_width & 1) || (width & 1) ||
+			(yuv420 && ((src_height & 1) || (height & 1))))
+		return 0;
+
+	/* The multi-pass code crops the flipped frame in the center */
+	startx = (src_width - width) / 2;
+	starty = (src_height - height) / 2;
+	if (yuv420) {
+		startx &= ~1;
+		starty &= ~1;
+	}
+	if (hflip)
+		startx = src_width - width - startx;
+	if (vflip)
+		starty = src_height - height - starty;
+	if (startx & 1)
+		return 0;
+
+	src += starty * stride + startx * 2;
+	if (vflip) {
+		src += (height - 1) * stride;
+		stride = -stride;
+	}
+
+	switch (dest_pix_fmt) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		v4lconvert_packed_yuv_to_rgb24(data, src, dest, width, height,
+				stride, src_fmt->fmt.pix.pixelformat,
+				dest_pix_fmt == V4L2_PIX_FMT_BGR24, hflip);
+		break;
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		if (v4lconvert_packed_yuv_to_yuv420(data, src, dest, width,
+				height, stride, src_fmt->fmt.pix.pixelformat,
+				dest_pix_fmt == V4L2_PIX_FMT_YVU420, hflip))
+			return 0;
+		break;
+	}
+
+	return 1;
+}
+
+static unsigned long long v4lconvert_stats_time(struct v4lconvert_data *data)
+{
+	struct timespec ts;
+
+	if (!data->stats_enabled)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Adds the time passed since start to *stat and returns the current time */
+static unsigned long long v4lconvert_stats_add(struct v4lconvert_data *data,
+		unsigned long long *stat, unsigned long long start)
+{
+	unsigned long long now;
+
+	if (!data->stats_enabled)
+		return 0;
+
+	now = v4lconvert_stats_time(data);
+	*stat += now - start;
+	return now;
+}
+
+/* Where to account the time spent converting from src_pix_fmt */
+static unsigned long long *v4lconvert_pixfmt_stat(struct v4lconvert_data *data,
+		unsigned int src_pix_fmt)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(supported_src_pixfmts); i++)
+		if (supported_src_pixfmts[i].fmt == src_pix_fmt &&
+		    supported_src_pixfmts[i].bpp == 0)
+			return &data->stats.decode_ns;
+
+	return &data->stats.convert_ns;
+}
+
+static void v4lconvert_stats_account(struct v4lconvert_data *data,
+		int result, unsigned long long start)
+{
+	if (result >= 0)
+		data->stats.frames++;
+	else {
+		data->stats.errors++;
+		if (errno == EPIPE)
+			data->stats.short_frames++;
+	}
+
+	v4lconvert_stats_add(data, &data->stats.total_ns, start);
+}
+
+static int v4lconvert_do_convert(struct v4lconvert_data *data, int processing,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size);
+
+static int v4lconvert_convert_via_yuv420(struct v4lconvert_data *data,
+		int processing,
+		const struct v4l2_format *src_fmt, const struct v4l2_format *dest_fmt,
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	struct v4l2_format yuv_fmt = *dest_fmt;
+	int width = dest_fmt->fmt.pix.width;
+	int height = dest_fmt->fmt.pix.height;
+	int dest_needed, yuv_size, res;
+	unsigned char *yuv;
+
+	if (dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_NV12)
+		dest_needed = width * height * 3 / 2;
+	else
+		dest_needed = width * height * 2;
+	if (dest_size < dest_needed) {
+		V4LCONVERT_ERR("destination buffer too small (%d < %d)\n",
+				dest_size, dest_needed);
+		errno = EFAULT;
+		return -1;
+	}
+
+	yuv_fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUV420;
+	v4lconvert_fixup_fmt(&yuv_fmt);
+	yuv_size = yuv_fmt.fmt.pix.sizeimage;
+	yuv = v4lconvert_alloc_buffer(yuv_size, &data->yuv420_buf,
+				      &data->yuv420_buf_size);
+	if (!yuv)
+		return v4lconvert_oom_error(data);
+
+	res = v4lconvert_do_convert(data, processing, src_fmt, &yuv_fmt,
+				    src, src_size, yuv, yuv_size);
+	/* Pass on incomplete frames, like the conversion itself would */
+	if (res < 0 && errno != EPIPE)
+		return res;
+
+	if (dest_fmt->fmt.pix.pixelformat == V4L2_PIX_FMT_NV12)
+		v4lconvert_yuv420_to_nv12(yuv, dest, width, height, width, 0);
+	else
+		v4lconvert_yuv420_to_yuyv(yuv, dest, width, height, width, 0);
+
+	return res < 0 ? res : dest_needed;
+}
+
+/* Whether the steps for a nv12 / yuyv destination can be done in that format
+   itself, flipping and plain cropping can, processing, rotating, adding a
+   border and reducing can not. Always true for the other destinations. */
+static int v4lconvert_packed_dst_direct(const struct v4l2_format *src_fmt,
+		const struct v4l2_format *dest_fmt, int processing, int rotate90,
+		int flip, int crop)
+{
+	int src_width = src_fmt->fmt.pix.width;
+	int src_height = src_fmt->fmt.pix.height;
+	int width = dest_fmt->fmt.pix.width;
+	int height = dest_fmt->fmt.pix.height;
+
+	if (!processing && !rotate90 && !flip && !crop)
+		return 1;
+
+	switch (dest_fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_YUYV:
+		/* Pixel pairs must stay together */
+		if ((src_width & 1) || (width & 1))
+			return 0;
+		break;
+	case V4L2_PIX_FMT_NV12:
+		/* And so must line pairs */
+		if ((src_width & 1) || (width & 1) ||
+				(src_height & 1) || (height & 1))
+			return 0;
+		break;
+	default:
+		return 1;
+	}
+
+	if (processing || rotate90)
+		return 0;
+
+	return !crop || (src_width >= width && src_height >= height &&
+			 !(src_width >= 2 * width && src_height >= 2 * height));
+}
+
+/* processing is the result of v4lprocessing_pre_processing() for this frame */
+static int v4lconvert_do_convert(struct v4lconvert_data *data, int processing,
 		const struct v4l2_format *src_fmt,  /* in */
 		const struct v4l2_format *dest_fmt, /* in */
 		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
 {
-	int res, dest_needed, temp_needed, processing, convert = 0;
+	int res, dest_needed, temp_needed, convert = 0;
 	int rotate90, vflip, hflip, crop;
+	unsigned long long stats_time, *stat;
+	const unsigned char *luts[3] = { NULL, NULL, NULL };
 	unsigned char *convert1_dest = dest;
 	int convert1_dest_size = dest_size;
 	unsigned char *convert2_src = src, *convert2_dest = dest;
@@ -1617,7 +2281,6 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 	struct v4l2_format my_src_fmt = *src_fmt;
 	struct v4l2_format my_dest_fmt = *dest_fmt;
 
-	processing = v4lprocessing_pre_processing(data->processing);
 	rotate90 = data->control_flags & V4LCONTROL_ROTATED_90_JPEG;
 	hflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_HFLIP);
 	vflip = v4lcontrol_get_ctrl(data->control, V4LCONTROL_VFLIP);
@@ -1629,12 +2292,28 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 			 !processing && !rotate90 && !hflip && !vflip && !crop) ||
 			/* or if we should do processing/rotating/flipping but the app tries to
 			   use the native cam format, we just return an unprocessed frame copy */
-			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat)) {
+			!v4lconvert_supported_dst_format(dest_fmt->fmt.pix.pixelformat) ||
+			/* which is also what we do for native nv12 / yuyv when that
+			   would need the lossy detour through yuv420 below */
+			(src_fmt->fmt.pix.pixelformat == dest_fmt->fmt.pix.pixelformat &&
+			 !v4lconvert_packed_dst_direct(src_fmt, dest_fmt, processing,
+						       rotate90, hflip || vflip, crop))) {
 		int to_copy = MIN(dest_size, src_size);
 		memcpy(dest, src, to_copy);
 		return to_copy;
 	}
 
+	/* The rest only knows about rgb and planar yuv, so for nv12 / yuyv do
+	   it on yuv420 and convert the end result. This is lossy for yuyv, its
+	   chroma ends up at half the vertical resolution, and processing of
+	   non rgb sources goes through rgb as well. */
+	if (!v4lconvert_packed_dst_direct(&my_src_fmt, &my_dest_fmt,
+					  processing, rotate90, hflip || vflip,
+					  crop))
+		return v4lconvert_convert_via_yuv420(data, processing,
+						     src_fmt, dest_fmt,
+						     src, src_size, dest, dest_size);
+
 	/* sanity check, is the dest buffer large enough? */
 	switch (my_dest_fmt.fmt.pix.pixelformat) {
 	case V4L2_PIX_FMT_RGB24:
@@ -1649,6 +2328,16 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		temp_needed =
 			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3 / 2;
 		break;
+	case V4L2_PIX_FMT_NV12:
+		dest_needed =
+			my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 3 / 2;
+		temp_needed =
+			my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 3 / 2;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		dest_needed = my_dest_fmt.fmt.pix.width * my_dest_fmt.fmt.pix.height * 2;
+		temp_needed = my_src_fmt.fmt.pix.width * my_src_fmt.fmt.pix.height * 2;
+		break;
 	default:
 		V4LCONVERT_ERR("Unknown dest format in conversion\n");
 		errno = EINVAL;
@@ -1678,6 +2367,35 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 		 (!rotate90 && !hflip && !vflip && !crop))
 		convert = 1;
 
+	/* Have the converter apply the processing lookup tables while writing
+	   its output, rather than walking the frame again. This is only possible
+	   when the tables need no update, as the statistics must be gathered
+	   from the unprocessed frame. */
+	if (convert == 1 && processing &&
+			v4lconvert_converter_applies_luts(
+				my_src_fmt.fmt.pix.pixelformat,
+				my_dest_fmt.fmt.pix.pixelformat) &&
+			v4lprocessing_get_lookup_tables(data->processing,
+				&my_dest_fmt, luts))
+		processing = 0;
+
+	/* Try doing everything in one go, processing needs to see the whole
+	   frame before any cropping so it is not supported here */
+	if (convert == 1 && !processing && !rotate90 && (hflip || vflip || crop)) {
+		stats_time = v4lconvert_stats_time(data);
+		memcpy(data->luts, luts, sizeof(data->luts));
+		res = v4lconvert_convert_fused(data, &my_src_fmt, &my_dest_fmt,
+					       src, src_size, dest, hflip, vflip);
+		memset(data->luts, 0, sizeof(data->luts));
+		if (res) {
+			v4lconvert_stats_add(data, v4lconvert_pixfmt_stat(data,
+					my_src_fmt.fmt.pix.pixelformat), stats_time);
+			USDT(libv4lconvert, stage_done, "fused",
+			     my_src_fmt.fmt.pix.pixelformat);
+			return dest_needed;
+		}
+	}
+
 	/* convert_pixfmt (only if convert == 2) -> processing -> convert_pixfmt ->
 	   rotate -> flip -> crop, all steps are optional */
 	if (convert == 2) {
@@ -1722,7 +2440,9 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 
 	/* Done setting sources / dest and allocating intermediate buffers,
 	   real conversion / processing / ... starts here. */
+	stats_time = v4lconvert_stats_time(data);
 	if (convert == 2) {
+		stat = v4lconvert_pixfmt_stat(data, my_src_fmt.fmt.pix.pixelformat);
 		res = v4lconvert_convert_pixfmt(data, src, src_size,
 				convert1_dest, convert1_dest_size,
 				&my_src_fmt,
@@ -1731,40 +2451,204 @@ int v4lconvert_convert(struct v4lconvert_data *data,
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
+		stats_time = v4lconvert_stats_add(data, stat, stats_time);
+		USDT(libv4lconvert, stage_done, "pixfmt", V4L2_PIX_FMT_RGB24);
 	}
 
-	if (processing)
+	if (processing) {
 		v4lprocessing_processing(data->processing, convert2_src, &my_src_fmt);
+		stats_time = v4lconvert_stats_add(data,
+				&data->stats.processing_ns, stats_time);
+		USDT(libv4lconvert, stage_done, "processing",
+		     my_src_fmt.fmt.pix.pixelformat);
+	}
 
 	if (convert) {
+		stat = v4lconvert_pixfmt_stat(data, my_src_fmt.fmt.pix.pixelformat);
+		memcpy(data->luts, luts, sizeof(data->luts));
 		res = v4lconvert_convert_pixfmt(data, convert2_src, src_size,
 				convert2_dest, convert2_dest_size,
 				&my_src_fmt,
 				my_dest_fmt.fmt.pix.pixelformat);
+		memset(data->luts, 0, sizeof(data->luts));
 		if (res)
 			return res;
 
 		src_size = my_src_fmt.fmt.pix.sizeimage;
+		stats_time = v4lconvert_stats_add(data, stat, stats_time);
+		USDT(libv4lconvert, stage_done, "pixfmt",
+		     my_src_fmt.fmt.pix.pixelformat);
 
 		/* We call processing here again in case the source format was not
 		   rgb, but the dest is. v4lprocessing checks it self it only actually
 		   does the processing once per frame. */
-		if (processing)
+		if (processing) {
 			v4lprocessing_processing(data->processing, convert2_dest, &my_src_fmt);
+			stats_time = v4lconvert_stats_add(data,
+					&data->stats.processing_ns, stats_time);
+			USDT(libv4lconvert, stage_done, "processing",
+			     my_src_fmt.fmt.pix.pixelformat);
+		}
 	}
 
 	if (rotate90)
-		v4lconvert_rotate90(rotate90_src, rotate90_dest, &my_src_fmt);
+		v4lconvert_rotate90(data, rotate90_src, rotate90_dest, &my_src_fmt);
+
+	/* Flipping and cropping can often be done in a single pass */
+	if ((hflip || vflip) && crop &&
+			v4lconvert_flip_crop(data, flip_src, dest, &my_src_fmt,
+					     &my_dest_fmt, hflip, vflip)) {
+		v4lconvert_stats_add(data, &data->stats.transform_ns, stats_time);
+		USDT(libv4lconvert, stage_done, "transform",
+		     my_src_fmt.fmt.pix.pixelformat);
+		return dest_needed;
+	}
 
 	if (hflip || vflip)
-		v4lconvert_flip(flip_src, flip_dest, &my_src_fmt, hflip, vflip);
+		v4lconvert_flip(data, flip_src, flip_dest, &my_src_fmt, hflip, vflip);
 
 	if (crop)
-		v4lconvert_crop(crop_src, dest, &my_src_fmt, &my_dest_fmt);
+		v4lconvert_crop(data, crop_src, dest, &my_src_fmt, &my_dest_fmt);
+
+	if (rotate90 || hflip || vflip || crop) {
+		v4lconvert_stats_add(data, &data->stats.transform_ns, stats_time);
+		USDT(libv4lconvert, stage_done, "transform",
+		     my_src_fmt.fmt.pix.pixelformat);
+	}
 
 	return dest_needed;
 }
 
+/* Gets an idle conversion context, creating a new one if necessary */
+static struct v4lconvert_data *v4lconvert_get_context(
+		struct v4lconvert_data *data)
+{
+	struct v4lconvert_data *ctx;
+
+	pthread_mutex_lock(&data->context_lock);
+	ctx = data->free_contexts;
+	if (ctx) {
+		data->free_contexts = ctx->next_context;
+		pthread_mutex_unlock(&data->context_lock);
+		return ctx;
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx) {
+		pthread_mutex_unlock(&data->context_lock);
+		return NULL;
+	}
+
+	/* Share the device, control and processing data, and the settings
+	   the conversions depend on. All the scratch buffers and decoder
+	   state start out empty. */
+	ctx->fd = data->fd;
+	ctx->dev_ops = data->dev_ops;
+	ctx->dev_ops_priv = data->dev_ops_priv;
+	ctx->control = data->control;
+	ctx->processing = data->processing;
+	ctx->flags = data->flags;
+	ctx->control_flags = data->control_flags;
+	ctx->cpu_flags = data->cpu_flags;
+	ctx->stats_enabled = data->stats_enabled;
+	pthread_mutex_unlock(&data->context_lock);
+
+	pthread_mutex_init(&ctx->context_lock, NULL);
+	pthread_mutex_init(&ctx->processing_lock, NULL);
+	ctx->decompress_pid = -1;
+	ctx->decompress_shm_fd = -1;
+	/* Frames already get converted in parallel */
+	ctx->threads = 1;
+
+	return ctx;
+}
+
+static void v4lconvert_put_context(struct v4lconvert_data *data,
+		struct v4lconvert_data *ctx, int result)
+{
+	pthread_mutex_lock(&data->context_lock);
+	if (result < 0)
+		memcpy(data->error_msg, ctx->error_msg, sizeof(data->error_msg));
+	data->stats.frames += ctx->stats.frames;
+	data->stats.errors += ctx->stats.errors;
+	data->stats.short_frames += ctx->stats.short_frames;
+	data->stats.decode_ns += ctx->stats.decode_ns;
+	data->stats.convert_ns += ctx->stats.convert_ns;
+	data->stats.processing_ns += ctx->stats.processing_ns;
+	data->stats.transform_ns += ctx->stats.transform_ns;
+	data->stats.total_ns += ctx->stats.total_ns;
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+	/* Pick up changes made while the context was in use */
+	ctx->stats_enabled = data->stats_enabled;
+	ctx->next_context = data->free_contexts;
+	data->free_contexts = ctx;
+	pthread_mutex_unlock(&data->context_lock);
+}
+
+int v4lconvert_convert(struct v4lconvert_data *data,
+		const struct v4l2_format *src_fmt,  /* in */
+		const struct v4l2_format *dest_fmt, /* in */
+		unsigned char *src, int src_size, unsigned char *dest, int dest_size)
+{
+	struct v4lconvert_data *ctx;
+	int res, processing, saved_errno;
+	unsigned long long stats_start;
+
+	/* Each stage_done probe ends the stage started by the previous one */
+	USDT(libv4lconvert, convert_start, src_fmt->fmt.pix.pixelformat,
+	     dest_fmt->fmt.pix.pixelformat, src_size);
+
+	if (!data->concurrent) {
+		stats_start = v4lconvert_stats_time(data);
+		res = v4lconvert_do_convert(data,
+				v4lprocessing_pre_processing(data->processing),
+				src_fmt, dest_fmt, src, src_size, dest, dest_size);
+		v4lconvert_stats_account(data, res, stats_start);
+		USDT(libv4lconvert, convert_end, res);
+		return res;
+	}
+
+	ctx = v4lconvert_get_context(data);
+	if (!ctx) {
+		USDT(libv4lconvert, convert_end, -1);
+		errno = ENOMEM;
+		return -1;
+	}
+	stats_start = v4lconvert_stats_time(ctx);
+
+	/* The processing data is shared, so frames which need processing are
+	   converted one at a time */
+	pthread_mutex_lock(&data->processing_lock);
+	processing = v4lprocessing_pre_processing(data->processing);
+	if (!processing)
+		pthread_mutex_unlock(&data->processing_lock);
+
+	res = v4lconvert_do_convert(ctx, processing, src_fmt, dest_fmt,
+				    src, src_size, dest, dest_size);
+	v4lconvert_stats_account(ctx, res, stats_start);
+	saved_errno = errno;
+
+	if (processing)
+		pthread_mutex_unlock(&data->processing_lock);
+	v4lconvert_put_context(data, ctx, res);
+	USDT(libv4lconvert, convert_end, res);
+
+	errno = saved_errno;
+	return res;
+}
+
+int v4lconvert_get_concurrent(struct v4lconvert_data *data)
+{
+	return data->concurrent;
+}
+
+void v4lconvert_set_concurrent(struct v4lconvert_data *data, int concurrent)
+{
+	data->concurrent = concurrent;
+	if (!concurrent)
+		v4lconvert_free_contexts(data);
+}
+
 const char *v4lconvert_get_error_message(struct v4lconvert_data *data)
 {
 	return data->error_msg;
@@ -1829,6 +2713,117 @@ static void v4lconvert_get_framesizes(struct v4lconvert_data *data,
 	}
 }
 
+/*
+ * The framesizes of the last devices opened by this process. Apps often
+ * open the same cam several times, e.g. to probe it first, and on UVC cams
+ * each VIDIOC_ENUM_FRAMESIZES is a slow USB control transfer. A device is
+ * only considered the same one if it also offers the same formats.
+ */
+struct v4lconvert_framesize_cache {
+	__u8 driver[16];
+	__u8 card[32];
+	__u8 bus_info[32];
+	__u32 version;
+	unsigned long supported_src_formats[128 / BITS_PER_LONG];
+	struct v4l2_frmsizeenum framesizes[V4LCONVERT_MAX_FRAMESIZES];
+	int64_t framesize_supported_src_formats[V4LCONVERT_MAX_FRAMESIZES];
+	unsigned int no_framesizes;
+};
+
+static struct v4lconvert_framesize_cache *framesize_cache[V4LCONVERT_FRAMESIZE_CACHE_SIZE];
+static int next_framesize_cache;
+static pthread_mutex_t framesize_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int v4lconvert_framesize_cache_match(struct v4lconvert_data *data,
+		struct v4lconvert_framesize_cache *entry)
+{
+	return entry &&
+	       !memcmp(entry->driver, data->cap.driver, sizeof(entry->driver)) &&
+	       !memcmp(entry->card, data->cap.card, sizeof(entry->card)) &&
+	       !memcmp(entry->bus_info, data->cap.bus_info, sizeof(entry->bus_info)) &&
+	       entry->version == data->cap.version &&
+	       !memcmp(entry->supported_src_formats, data->supported_src_formats,
+		       sizeof(entry->supported_src_formats));
+}
+
+static int v4lconvert_framesize_cache_get(struct v4lconvert_data *data)
+{
+	struct v4lconvert_framesize_cache *entry;
+	int i, found = 0;
+
+	pthread_mutex_lock(&framesize_cache_lock);
+	for (i = 0; i < V4LCONVERT_FRAMESIZE_CACHE_SIZE; i++) {
+		entry = framesize_cache[i];
+		if (!v4lconvert_framesize_cache_match(data, entry))
+			continue;
+
+		data->no_framesizes = entry->no_framesizes;
+		memcpy(data->framesizes, entry->framesizes,
+		       entry->no_framesizes * sizeof(entry->framesizes[0]));
+		memcpy(data->framesize_supported_src_formats,
+		       entry->framesize_supported_src_formats,
+		       entry->no_framesizes *
+		       sizeof(entry->framesize_supported_src_formats[0]));
+		found = 1;
+		break;
+	}
+	pthread_mutex_unlock(&framesize_cache_lock);
+
+	return found;
+}
+
+static void v4lconvert_framesize_cache_put(struct v4lconvert_data *data)
+{
+	struct v4lconvert_framesize_cache *entry;
+
+	pthread_mutex_lock(&framesize_cache_lock);
+	entry = framesize_cache[next_framesize_cache];
+	if (!entry)
+		entry = calloc(1, sizeof(*entry));
+	if (entry) {
+		memcpy(entry->driver, data->cap.driver, sizeof(entry->driver));
+		memcpy(entry->card, data->cap.card, sizeof(entry->card));
+		memcpy(entry->bus_info, data->cap.bus_info, sizeof(entry->bus_info));
+		entry->version = data->cap.version;
+		memcpy(entry->supported_src_formats, data->supported_src_formats,
+		       sizeof(entry->supported_src_formats));
+		entry->no_framesizes = data->no_framesizes;
+		memcpy(entry->framesizes, data->framesizes,
+		       data->no_framesizes * sizeof(data->framesizes[0]));
+		memcpy(entry->framesize_supported_src_formats,
+		       data->framesize_supported_src_formats,
+		       data->no_framesizes *
+		       sizeof(data->framesize_supported_src_formats[0]));
+		framesize_cache[next_framesize_cache] = entry;
+		next_framesize_cache = (next_framesize_cache + 1) %
+				       V4LCONVERT_FRAMESIZE_CACHE_SIZE;
+	}
+	pthread_mutex_unlock(&framesize_cache_lock);
+}
+
+/* Enumerates the framesizes of all supported src formats, on first use */
+static void v4lconvert_init_framesizes(struct v4lconvert_data *data)
+{
+	int i, j;
+
+	if (data->framesizes_enumerated)
+		return;
+	data->framesizes_enumerated = 1;
+
+	/* Without bus_info, different devices can't be told apart */
+	if (data->cap.driver[0] && data->cap.bus_info[0] &&
+	    v4lconvert_framesize_cache_get(data))
+		return;
+
+	for (i = 0; i < data->no_src_formats_order; i++) {
+		j = data->src_formats_order[i];
+		v4lconvert_get_framesizes(data, supported_src_pixfmts[j].fmt, j);
+	}
+
+	if (data->cap.driver[0] && data->cap.bus_info[0])
+		v4lconvert_framesize_cache_put(data);
+}
+
 int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 		struct v4l2_frmsizeenum *frmsize)
 {
@@ -1841,6 +2836,8 @@ int v4lconvert_enum_framesizes(struct v4lconvert_data *data,
 				VIDIOC_ENUM_FRAMESIZES, frmsize);
 	}
 
+	v4lconvert_init_framesizes(data);
+
 	if (frmsize->index >= data->no_framesizes) {
 		errno = EINVAL;
 		return -1;
@@ -1989,3 +2986,38 @@ void v4lconvert_set_fps(struct v4lconvert_data *data, int fps)
 {
 	data->fps = fps;
 }
+
+int v4lconvert_get_stats_enabled(struct v4lconvert_data *data)
+{
+	return data->stats_enabled;
+}
+
+void v4lconvert_set_stats_enabled(struct v4lconvert_data *data, int enabled)
+{
+	data->stats_enabled = enabled;
+}
+
+void v4lconvert_get_stats(struct v4lconvert_data *data,
+		struct v4lconvert_stats *stats)
+{
+	pthread_mutex_lock(&data->context_lock);
+	*stats = data->stats;
+	pthread_mutex_unlock(&data->context_lock);
+}
+
+void v4lconvert_reset_stats(struct v4lconvert_data *data)
+{
+	pthread_mutex_lock(&data->context_lock);
+	memset(&data->stats, 0, sizeof(data->stats));
+	pthread_mutex_unlock(&data->context_lock);
+}
+
+int v4lconvert_get_threads(struct v4lconvert_data *data)
+{
+	return data->threads;
+}
+
+int v4lconvert_set_threads(struct v4lconvert_data *data, int threads)
+{
+	return v4lconvert_threads_init(data, threads);
+}
@@ -23,6 +23,11 @@ Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
 #include "libv4lconvert-priv.h"
 #include <string.h>
 
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+#include <immintrin.h>
+#define SSE2_FUNC __attribute__((target("sse2")))
+#endif
+
 /* The NV12_16L16 format is used in the Conexant cx23415/6/8 MPEG encoder devices.
    It is a macroblock format with separate Y and UV planes, each plane
    consisting of 16x16 values. All lines are always 720 bytes long. If the
@@ -40,9 +45,129 @@ Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
 
 static const int stride = 720;
 
-static void v4lconvert_nv12_16l16_to_rgb(const unsigned char *src, unsigned char *dest,
-		int width, int height, int rgb)
+/* Macroblocks are stored one after the other, 45 per row of macroblocks */
+#define MB_SIZE 256
+#define MB_ROW_SIZE (stride * 16)
+
+/* Start of (luma or interleaved chroma) line y in the first macroblock of
+   a macroblock row, line y of the next macroblock is MB_SIZE further on */
+static const unsigned char *mb_line(const unsigned char *plane, int y)
+{
+	return plane + (y / 16) * MB_ROW_SIZE + (y % 16) * 16;
+}
+
+/* Copies one line out of all macroblocks it is spread across, whole 16 byte
+   macroblock lines are moved with a single fixed size copy, which compilers
+   turn into one vector load + store */
+static void detile_line(unsigned char *dst, const unsigned char *src,
+		int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16, src += MB_SIZE)
+		memcpy(dst + x, src, 16);
+	if (x < width)
+		memcpy(dst + x, src, width - x);
+}
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+static SSE2_FUNC int detile_uv_line_sse2(unsigned char *dstu,
+		unsigned char *dstv, const unsigned char *src, int width)
 {
+	const __m128i lo = _mm_set1_epi16(0xff);
+	int x;
+
+	for (x = 0; x + 8 <= width; x += 8, src += MB_SIZE) {
+		__m128i uv = _mm_loadu_si128((const __m128i *)src);
+		__m128i u = _mm_and_si128(uv, lo);
+		__m128i v = _mm_srli_epi16(uv, 8);
+
+		_mm_storel_epi64((__m128i *)(dstu + x), _mm_packus_epi16(u, u));
+		_mm_storel_epi64((__m128i *)(dstv + x), _mm_packus_epi16(v, v));
+	}
+
+	return x;
+}
+
+static SSE2_FUNC int detile_yuyv_line_sse2(unsigned char *dst,
+		const unsigned char *ysrc, const unsigned char *uvsrc, int width)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i y = _mm_loadu_si128((const __m128i *)ysrc);
+		__m128i uv = _mm_loadu_si128((const __m128i *)uvsrc);
+
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(y, uv));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(y, uv));
+		ysrc += MB_SIZE;
+		uvsrc += MB_SIZE;
+		dst += 32;
+	}
+
+	return x;
+}
+#endif
+
+/* Splits one interleaved chroma line into u and v, width is in chroma
+   samples */
+static void detile_uv_line(unsigned int cpu_flags, unsigned char *dstu,
+		unsigned char *dstv, const unsigned char *src, int width)
+{
+	int x = 0, j;
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	if (cpu_flags & V4LCONVERT_CPU_SSE2)
+		x = detile_uv_line_sse2(dstu, dstv, src, width);
+#endif
+	for (src += (x / 8) * MB_SIZE; x < width; x += 8, src += MB_SIZE)
+		for (j = 0; j < 8 && x + j < width; j++) {
+			dstu[x + j] = src[2 * j];
+			dstv[x + j] = src[2 * j + 1];
+		}
+}
+
+/* Builds one line of yuyv from a luma and a chroma line, width must be
+   even */
+static void detile_yuyv_line(unsigned int cpu_flags, unsigned char *dst,
+		const unsigned char *ysrc, const unsigned char *uvsrc, int width)
+{
+	int x = 0, j;
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	if (cpu_flags & V4LCONVERT_CPU_SSE2)
+		x = detile_yuyv_line_sse2(dst, ysrc, uvsrc, width);
+#endif
+	ysrc += (x / 16) * MB_SIZE;
+	uvsrc += (x / 16) * MB_SIZE;
+	dst += 2 * x;
+	for (; x < width; x += 16, ysrc += MB_SIZE, uvsrc += MB_SIZE)
+		for (j = 0; j < 16 && x + j < width; j += 2) {
+			*dst++ = ysrc[j];
+			*dst++ = uvsrc[j];
+			*dst++ = ysrc[j + 1];
+			*dst++ = uvsrc[j + 1];
+		}
+}
+
+struct nv12_16l16_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	int width, height, yvu, rgb;
+	unsigned int dest_pix_fmt;
+	unsigned int cpu_flags;
+};
+
+/* Converts rows [start, end), start must be a multiple of 16, this handles
+   any width, including odd ones */
+static void v4lconvert_nv12_16l16_to_rgb(void *arg, int start, int end)
+{
+	struct nv12_16l16_job *job = arg;
+	const unsigned char *src = job->src;
+	unsigned char *dest = job->dest;
+	int width = job->width;
+	int height = job->height;
+	int rgb = job->rgb;
 	unsigned int y, x, i, j;
 	const unsigned char *y_base = src;
 	const unsigned char *uv_base = src + stride * height;
@@ -52,10 +177,10 @@ static void v4lconvert_nv12_16l16_to_rgb(const unsigned char *src, unsigned char
 	int r = rgb ? 0 : 2;
 	int b = 2 - r;
 
-	for (y = 0; y < height; y += 16) {
+	for (y = start; y < end; y += 16) {
 		int mb_y = (y / 16) * (stride / 16);
 		int mb_uv = (y / 32) * (stride / 16);
-		int maxy = (height - y < 16 ? height - y : 16);
+		int maxy = (end - y < 16 ? end - y : 16);
 
 		for (x = 0; x < width; x += 16, mb_y++, mb_uv++) {
 			int maxx = (width - x < 16 ? width - x : 16);
@@ -91,69 +216,133 @@ static void v4lconvert_nv12_16l16_to_rgb(const unsigned char *src, unsigned char
 	}
 }
 
-void v4lconvert_nv12_16l16_to_rgb24(const unsigned char *src, unsigned char *dest,
-		int width, int height)
+/* Detiles each line into yuyv in a line buffer, and converts that with the
+   (vectorized) packed yuv code, the math is the same as above */
+static void v4lconvert_nv12_16l16_to_rgb_lines(void *arg, int start, int end)
 {
-	v4lconvert_nv12_16l16_to_rgb(src, dest, width, height, 1);
+	struct nv12_16l16_job *job = arg;
+	const unsigned char *uv_base = job->src + stride * job->height;
+	unsigned char line[720 * 2];
+	int y;
+
+	for (y = start; y < end; y++) {
+		detile_yuyv_line(job->cpu_flags, line, mb_line(job->src, y),
+				 mb_line(uv_base, y / 2), job->width);
+		v4lconvert_yuyv_line_to_rgb24(job->cpu_flags, line,
+				job->dest + y * job->width * 3, job->width,
+				!job->rgb);
+	}
 }
 
-void v4lconvert_nv12_16l16_to_bgr24(const unsigned char *src, unsigned char *dest,
-		int width, int height)
+static void nv12_16l16_to_rgbbgr24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest, int width,
+		int height, int rgb)
 {
-	v4lconvert_nv12_16l16_to_rgb(src, dest, width, height, 0);
+	struct nv12_16l16_job job = {
+		.src = src, .dest = dest, .width = width, .height = height,
+		.rgb = rgb, .cpu_flags = data->cpu_flags,
+	};
+
+	if ((width & 1) || width > stride)
+		v4lconvert_run_stripes(data, v4lconvert_nv12_16l16_to_rgb,
+				       &job, height, 16);
+	else
+		v4lconvert_run_stripes(data, v4lconvert_nv12_16l16_to_rgb_lines,
+				       &job, height, 1);
 }
 
-static void de_macro_uv(unsigned char *dstu, unsigned char *dstv,
-		const unsigned char *src, int w, int h)
+void v4lconvert_nv12_16l16_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest, int width, int height)
 {
-	unsigned int y, x, i, j;
+	nv12_16l16_to_rgbbgr24(data, src, dest, width, height, 1);
+}
 
-	for (y = 0; y < h; y += 16) {
-		for (x = 0; x < w; x += 8) {
-			const unsigned char *src_uv = src + y * stride + x * 32;
-			int maxy = (h - y < 16 ? h - y : 16);
-			int maxx = (w - x < 8 ? w - x : 8);
+void v4lconvert_nv12_16l16_to_bgr24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest, int width, int height)
+{
+	nv12_16l16_to_rgbbgr24(data, src, dest, width, height, 0);
+}
 
-			for (i = 0; i < maxy; i++) {
-				int idx = x + (y + i) * w;
+/* Converts rows [start, end) to yuv420 / nv12 / yuyv, start is even */
+static void v4lconvert_nv12_16l16_to_yuv(void *arg, int start, int end)
+{
+	struct nv12_16l16_job *job = arg;
+	const unsigned char *uv_base = job->src + stride * job->height;
+	int width = job->width, height = job->height;
+	unsigned char *dest = job->dest;
+	unsigned char *udest, *vdest;
+	int y;
 
-				for (j = 0; j < maxx; j++) {
-					dstu[idx+j] = src_uv[2 * j];
-					dstv[idx+j] = src_uv[2 * j + 1];
-				}
-				src_uv += 16;
-			}
+	switch (job->dest_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		for (y = start; y < end; y++)
+			detile_yuyv_line(job->cpu_flags,
+					 dest + y * width * 2,
+					 mb_line(job->src, y),
+					 mb_line(uv_base, y / 2), width);
+		return;
+	}
+
+	for (y = start; y < end; y++)
+		detile_line(dest + y * width, mb_line(job->src, y), width);
+	dest += width * height;
+
+	switch (job->dest_pix_fmt) {
+	case V4L2_PIX_FMT_NV12:
+		/* The interleaved UV plane uses the same 16x16 byte macroblocks */
+		for (y = start / 2; y < end / 2; y++)
+			detile_line(dest + y * width, mb_line(uv_base, y), width);
+		break;
+	default:
+		udest = dest;
+		vdest = dest + width * height / 4;
+		if (job->yvu) {
+			udest = vdest;
+			vdest = dest;
 		}
+		for (y = start / 2; y < end / 2; y++)
+			detile_uv_line(job->cpu_flags, udest + y * (width / 2),
+				       vdest + y * (width / 2),
+				       mb_line(uv_base, y), width / 2);
+		break;
 	}
 }
 
-static void de_macro_y(unsigned char *dst, const unsigned char *src,
-		int w, int h)
+static void nv12_16l16_to_yuv(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest, int width,
+		int height, unsigned int dest_pix_fmt, int yvu)
 {
-	unsigned int y, x, i;
-
-	for (y = 0; y < h; y += 16) {
-		for (x = 0; x < w; x += 16) {
-			const unsigned char *src_y = src + y * stride + x * 16;
-			int maxy = (h - y < 16 ? h - y : 16);
-			int maxx = (w - x < 16 ? w - x : 16);
+	struct nv12_16l16_job job = {
+		.src = src, .dest = dest, .width = width, .height = height,
+		.yvu = yvu, .dest_pix_fmt = dest_pix_fmt,
+		.cpu_flags = data->cpu_flags,
+	};
 
-			for (i = 0; i < maxy; i++) {
-				memcpy(dst + x + (y + i) * w, src_y, maxx);
-				src_y += 16;
-			}
-		}
-	}
+	v4lconvert_run_stripes(data, v4lconvert_nv12_16l16_to_yuv, &job,
+			       height, 2);
 }
 
-void v4lconvert_nv12_16l16_to_yuv420(const unsigned char *src, unsigned char *dest,
+void v4lconvert_nv12_16l16_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
 		int width, int height, int yvu)
 {
-	de_macro_y(dest, src, width, height);
-	dest += width * height;
-	src += stride * height;
-	if (yvu)
-		de_macro_uv(dest + width * height / 4, dest, src, width / 2, height / 2);
-	else
-		de_macro_uv(dest, dest + width * height / 4, src, width / 2, height / 2);
+	nv12_16l16_to_yuv(data, src, dest, width, height,
+			  V4L2_PIX_FMT_YUV420, yvu);
+}
+
+void v4lconvert_nv12_16l16_to_nv12(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height)
+{
+	nv12_16l16_to_yuv(data, src, dest, width, height,
+			  V4L2_PIX_FMT_NV12, 0);
+}
+
+/* Width must be even */
+void v4lconvert_nv12_16l16_to_yuyv(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height)
+{
+	nv12_16l16_to_yuv(data, src, dest, width, height,
+			  V4L2_PIX_FMT_YUYV, 0);
 }
@@ -26,6 +26,7 @@
 
 #include <string.h>
 #include "libv4lconvert-priv.h"
+#include "bitreader.h"
 
 #define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
 
@@ -96,50 +97,40 @@ static void init_pixart_decoder(void)
 	decoder_initialized = 1;
 }
 
-static inline unsigned char getByte(const unsigned char *inp,
-		unsigned int bitpos)
-{
-	const unsigned char *addr;
-
-	addr = inp + (bitpos >> 3);
-	return (addr[0] << (bitpos & 7)) | (addr[1] >> (8 - (bitpos & 7)));
-}
-
 static inline unsigned short getShort(const unsigned char *pt)
 {
 	return ((pt[0] << 8) | pt[1]);
 }
 
 static int
-pac_decompress_row(const unsigned char *inp, unsigned char *outp, int width,
-		int step_size, int abs_bits)
+pac_decompress_row(const unsigned char *inp, int size, unsigned char *outp,
+		int width, int step_size, int abs_bits)
 {
+	struct v4lconvert_bitreader br;
 	int col;
 	int val;
-	int bitpos;
 	unsigned char code;
 
 	if (!decoder_initialized)
 		init_pixart_decoder();
 
-	/* first two pixels are stored as raw 8-bit */
-	*outp++ = inp[2];
-	*outp++ = inp[3];
-	bitpos = 32;
+	/* skip the row header, the first two pixels are stored as raw 8-bit */
+	v4lconvert_br_init(&br, inp, size);
+	v4lconvert_br_get(&br, 16);
+	*outp++ = v4lconvert_br_get(&br, 8);
+	*outp++ = v4lconvert_br_get(&br, 8);
 
 	/* main decoding loop */
 	for (col = 2; col < width; col++) {
 		/* get bitcode */
 
-		code = getByte(inp, bitpos);
-		bitpos += table[code].len;
+		code = v4lconvert_br_peek(&br, 8);
+		v4lconvert_br_skip(&br, table[code].len);
 
 		/* calculate pixel value */
 		if (table[code].is_abs) {
 			/* absolute value: get 6 more bits */
-			code = getByte(inp, bitpos);
-			bitpos += abs_bits;
-			*outp++ = code & ~(0xff >> abs_bits);
+			*outp++ = v4lconvert_br_get(&br, abs_bits) << (8 - abs_bits);
 		} else {
 			/* relative to left pixel */
 			val = outp[-2] + table[code].val * step_size;
@@ -148,7 +139,7 @@ pac_decompress_row(const unsigned char *inp, unsigned char *outp, int width,
 	}
 
 	/* return line length, rounded up to next 16-bit word */
-	return 2 * ((bitpos + 15) / 16);
+	return 2 * ((v4lconvert_br_tell(&br) + 15) / 16);
 }
 
 int v4lconvert_decode_pac207(struct v4lconvert_data *data,
@@ -176,15 +167,15 @@ int v4lconvert_decode_pac207(struct v4lconvert_data *data,
 			inp += (2 + width);
 			break;
 		case 0x1EE1:
-			inp += pac_decompress_row(inp, outp, width, 5, 6);
+			inp += pac_decompress_row(inp, end - inp, outp, width, 5, 6);
 			break;
 
 		case 0x2DD2:
-			inp += pac_decompress_row(inp, outp, width, 9, 5);
+			inp += pac_decompress_row(inp, end - inp, outp, width, 9, 5);
 			break;
 
 		case 0x3CC3:
-			inp += pac_decompress_row(inp, outp, width, 17, 4);
+			inp += pac_decompress_row(inp, end - inp, outp, width, 17, 4);
 			break;
 
 		case 0x4BB4:
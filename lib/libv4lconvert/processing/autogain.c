@@ -33,8 +33,9 @@ static int autogain_active(struct v4lprocessing_data *data)
 
 	autogain = v4lcontrol_get_ctrl(data->control, V4LCONTROL_AUTOGAIN);
 	if (!autogain) {
-		/* Reset last_correction val */
+		/* Reset last_correction val and the luminance history */
 		data->last_gain_correction = 0;
+		data->avg_lum = 0;
 	}
 
 	return autogain;
@@ -68,13 +69,63 @@ static void autogain_adjust(struct v4l2_queryctrl *ctrl, int *value,
 	}
 }
 
+/* Returns the average luminance (0 - 255) over the statistics area,
+   which defaults to the center of the frame, or -1 if the area is empty */
+static int autogain_get_avg_lum(struct v4lprocessing_data *data,
+		unsigned char *buf, const struct v4l2_format *fmt)
+{
+	struct v4lprocessing_stats_area area;
+	int x, y, count = 0;
+	unsigned long long lum = 0;
+	unsigned char *line;
+
+	v4lprocessing_get_stats_area(data, fmt, 1, &area);
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SRGGB8:
+		/* Sample whole 2x2 cells, so that all colors get included */
+		for (y = area.y; y < area.y + area.height; y += 2 * area.step) {
+			line = buf + y * fmt->fmt.pix.bytesperline;
+			for (x = area.x; x < area.x + area.width;
+					x += 2 * area.step) {
+				lum += line[x] + line[x + 1] +
+				       line[x + fmt->fmt.pix.bytesperline] +
+				       line[x + fmt->fmt.pix.bytesperline + 1];
+				count += 4;
+			}
+		}
+		break;
+
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		for (y = area.y; y < area.y + area.height; y += area.step) {
+			line = buf + y * fmt->fmt.pix.bytesperline;
+			for (x = area.x; x < area.x + area.width;
+					x += area.step) {
+				lum += line[3 * x] + line[3 * x + 1] +
+				       line[3 * x + 2];
+				count += 3;
+			}
+		}
+		break;
+	}
+
+	if (!count)
+		return -1;
+
+	return lum / count;
+}
+
 /* auto gain and exposure algorithm based on the knee algorithm described here:
 http://ytse.tricolour.net/docs/LowLightOptimization.html */
 static int autogain_calculate_lookup_tables(
 		struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
-	int x, y, target, steps, avg_lum = 0;
+	int target, steps, avg_lum;
 	int gain, exposure, orig_gain, orig_exposure, exposure_low;
 	struct v4l2_control ctrl;
 	struct v4l2_queryctrl gainctrl, expoctrl;
@@ -105,38 +156,11 @@ static int autogain_calculate_lookup_tables(
 		return 0;
 	gain = orig_gain = ctrl.value;
 
-	switch (fmt->fmt.pix.pixelformat) {
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SRGGB8:
-		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
-			fmt->fmt.pix.width / 4;
-
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++)
-				avg_lum += *buf++;
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width / 2;
-		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width / 4;
-		break;
-
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-		buf += fmt->fmt.pix.height * fmt->fmt.pix.bytesperline / 4 +
-			fmt->fmt.pix.width * 3 / 4;
-
-		for (y = 0; y < fmt->fmt.pix.height / 2; y++) {
-			for (x = 0; x < fmt->fmt.pix.width / 2; x++) {
-				avg_lum += *buf++;
-				avg_lum += *buf++;
-				avg_lum += *buf++;
-			}
-			buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3 / 2;
-		}
-		avg_lum /= fmt->fmt.pix.height * fmt->fmt.pix.width * 3 / 4;
-		break;
-	}
+	avg_lum = autogain_get_avg_lum(data, buf, fmt);
+	if (avg_lum < 0)
+		return 0;
+	data->avg_lum = avg_lum =
+		v4lprocessing_smooth(data, data->avg_lum, avg_lum);
 
 	/* If we are off a multiple of deadzone, do multiple steps to reach the
 	   desired lumination fast (with the risc of a slight overshoot) */
@@ -196,7 +220,9 @@ static int autogain_calculate_lookup_tables(
 		   skip the next frame as that is still captured with the old settings,
 		   and another one just to be sure (because if we re-adjust based
 		   on the old settings we might overshoot). */
-		data->lookup_table_update_counter = V4L2PROCESSING_UPDATE_RATE - 2;
+		data->lookup_table_update_counter = data->update_rate - 2;
+		if (data->lookup_table_update_counter < 0)
+			data->lookup_table_update_counter = 0;
 	}
 
 	if (gain != orig_gain) {
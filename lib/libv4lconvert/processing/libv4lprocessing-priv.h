@@ -26,6 +26,17 @@
 
 #define V4L2PROCESSING_UPDATE_RATE 10
 
+/* Part of the frame filters gather their statistics over, in pixels, with
+   every step-th pixel (bayer: every step-th 2x2 cell) in both directions
+   being sampled */
+struct v4lprocessing_stats_area {
+	int x;
+	int y;
+	int width;
+	int height;
+	int step;
+};
+
 struct v4lprocessing_data {
 	struct v4lcontrol_data *control;
 	int fd;
@@ -34,9 +45,20 @@ struct v4lprocessing_data {
 	/* True if any of the lookup tables does not contain
 	   linear 0-255 */
 	int lookup_table_active;
-	/* Counts the number of processed frames until a
-	   V4L2PROCESSING_UPDATE_RATE overflow happens */
+	/* Counts the number of processed frames until an update_rate
+	   overflow happens */
 	int lookup_table_update_counter;
+	/* Statistics sampling settings, see v4lprocessing_create() */
+	int update_rate;
+	int stats_step;
+	int stats_roi[4]; /* left, top, width, height in % of the frame */
+	int stats_smoothing;
+	/* Time spent on statistics and on applying the lookup tables */
+	int log_cost;
+	int cost_frames;
+	int cost_updates;
+	long long cost_stats_ns;
+	long long cost_apply_ns;
 	/* RGB/BGR lookup tables */
 	unsigned char comp1[256];
 	unsigned char green[256];
@@ -51,6 +73,7 @@ struct v4lprocessing_data {
 	unsigned char gamma_table[256];
 	/* autogain.c data */
 	int last_gain_correction;
+	int avg_lum;
 };
 
 struct v4lprocessing_filter {
@@ -61,6 +84,12 @@ struct v4lprocessing_filter {
 			unsigned char *buf, const struct v4l2_format *fmt);
 };
 
+void v4lprocessing_get_stats_area(struct v4lprocessing_data *data,
+		const struct v4l2_format *fmt, int centered,
+		struct v4lprocessing_stats_area *area);
+
+int v4lprocessing_smooth(struct v4lprocessing_data *data, int prev, int cur);
+
 extern const struct v4lprocessing_filter whitebalance_filter;
 extern const struct v4lprocessing_filter autogain_filter;
 extern const struct v4lprocessing_filter gamma_filter;
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include "libv4lprocessing.h"
 #include "libv4lprocessing-priv.h"
@@ -37,6 +38,7 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 {
 	struct v4lprocessing_data *data =
 		calloc(1, sizeof(struct v4lprocessing_data));
+	char *s;
 
 	if (!data) {
 		fprintf(stderr, "libv4lprocessing: error: out of memory!\n");
@@ -46,6 +48,47 @@ struct v4lprocessing_data *v4lprocessing_create(int fd, struct v4lcontrol_data *
 	data->fd = fd;
 	data->control = control;
 
+	/* Allow tuning how much work goes into gathering statistics for
+	   autogain / whitebalance through the environment, this is useful
+	   on slow machines where a full frame scan is too expensive */
+	data->update_rate = V4L2PROCESSING_UPDATE_RATE;
+	s = getenv("LIBV4LPROCESSING_UPDATE_RATE");
+	if (s && strtol(s, NULL, 0) > 0)
+		data->update_rate = strtol(s, NULL, 0);
+
+	data->stats_step = 1;
+	s = getenv("LIBV4LPROCESSING_STATS_STEP");
+	if (s && strtol(s, NULL, 0) > 0)
+		data->stats_step = strtol(s, NULL, 0);
+
+	/* Format: left,top,width,height in percent of the frame */
+	s = getenv("LIBV4LPROCESSING_STATS_ROI");
+	if (s) {
+		int *roi = data->stats_roi;
+
+		if (sscanf(s, "%d,%d,%d,%d", &roi[0], &roi[1], &roi[2],
+				&roi[3]) != 4 || roi[0] < 0 || roi[1] < 0 ||
+				roi[2] <= 0 || roi[3] <= 0 ||
+				roi[0] + roi[2] > 100 || roi[1] + roi[3] > 100) {
+			fprintf(stderr,
+				"libv4lprocessing: ignoring invalid LIBV4LPROCESSING_STATS_ROI: %s\n",
+				s);
+			memset(data->stats_roi, 0, sizeof(data->stats_roi));
+		}
+	}
+
+	/* Weight given to the history when averaging statistics over time */
+	s = getenv("LIBV4LPROCESSING_STATS_SMOOTHING");
+	if (s && strtol(s, NULL, 0) > 0)
+		data->stats_smoothing = strtol(s, NULL, 0);
+	if (data->stats_smoothing > 64)
+		data->stats_smoothing = 64;
+
+	/* Print the processing cost to stderr every log_cost frames */
+	s = getenv("LIBV4LPROCESSING_LOG_COST");
+	if (s && strtol(s, NULL, 0) > 0)
+		data->log_cost = strtol(s, NULL, 0);
+
 	return data;
 }
 
@@ -69,6 +112,80 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data)
 	return data->do_process;
 }
 
+void v4lprocessing_get_stats_area(struct v4lprocessing_data *data,
+		const struct v4l2_format *fmt, int centered,
+		struct v4lprocessing_stats_area *area)
+{
+	int width = fmt->fmt.pix.width;
+	int height = fmt->fmt.pix.height;
+
+	if (data->stats_roi[2]) {
+		area->x = width * data->stats_roi[0] / 100;
+		area->y = height * data->stats_roi[1] / 100;
+		area->width = width * data->stats_roi[2] / 100;
+		area->height = height * data->stats_roi[3] / 100;
+	} else if (centered) {
+		area->x = width / 4;
+		area->y = height / 4;
+		area->width = width / 2;
+		area->height = height / 2;
+	} else {
+		area->x = 0;
+		area->y = 0;
+		area->width = width;
+		area->height = height;
+	}
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_SGBRG8:
+	case V4L2_PIX_FMT_SGRBG8:
+	case V4L2_PIX_FMT_SBGGR8:
+	case V4L2_PIX_FMT_SRGGB8:
+		/* Keep the bayer pattern order intact */
+		area->x &= ~1;
+		area->y &= ~1;
+		area->width &= ~1;
+		area->height &= ~1;
+		break;
+	}
+
+	area->step = data->stats_step;
+}
+
+int v4lprocessing_smooth(struct v4lprocessing_data *data, int prev, int cur)
+{
+	/* prev == 0 means there is no history yet */
+	if (!prev || !data->stats_smoothing)
+		return cur;
+
+	return (prev * data->stats_smoothing + cur) /
+		(data->stats_smoothing + 1);
+}
+
+static long long v4lprocessing_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void v4lprocessing_log_cost(struct v4lprocessing_data *data)
+{
+	fprintf(stderr,
+		"libv4lprocessing: %d frames, %d statistics updates: "
+		"%lld us per update, %lld us per frame for the lookup tables\n",
+		data->cost_frames, data->cost_updates,
+		data->cost_updates ?
+			data->cost_stats_ns / data->cost_updates / 1000 : 0,
+		data->cost_apply_ns / data->cost_frames / 1000);
+
+	data->cost_frames = 0;
+	data->cost_updates = 0;
+	data->cost_stats_ns = 0;
+	data->cost_apply_ns = 0;
+}
+
 static void v4lprocessing_update_lookup_tables(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
@@ -155,6 +272,8 @@ static void v4lprocessing_do_processing(struct v4lprocessing_data *data,
 void v4lprocessing_processing(struct v4lprocessing_data *data,
 		unsigned char *buf, const struct v4l2_format *fmt)
 {
+	long long start = 0, now;
+
 	if (!data->do_process)
 		return;
 
@@ -171,18 +290,68 @@ void v4lprocessing_processing(struct v4lprocessing_data *data,
 		return; /* Non supported pix format */
 	}
 
+	if (data->log_cost)
+		start = v4lprocessing_now_ns();
+
 	if (data->controls_changed ||
-			data->lookup_table_update_counter == V4L2PROCESSING_UPDATE_RATE) {
+			data->lookup_table_update_counter >= data->update_rate) {
 		data->controls_changed = 0;
 		data->lookup_table_update_counter = 0;
 		/* Do this after resetting lookup_table_update_counter so that filters can
 		   force the next update to be sooner when they changed camera settings */
 		v4lprocessing_update_lookup_tables(data, buf, fmt);
+		if (data->log_cost) {
+			now = v4lprocessing_now_ns();
+			data->cost_stats_ns += now - start;
+			data->cost_updates++;
+			start = now;
+		}
 	} else
 		data->lookup_table_update_counter++;
 
 	if (data->lookup_table_active)
 		v4lprocessing_do_processing(data, buf, fmt);
 
+	if (data->log_cost) {
+		data->cost_apply_ns += v4lprocessing_now_ns() - start;
+		if (++data->cost_frames == data->log_cost)
+			v4lprocessing_log_cost(data);
+	}
+
+	data->do_process = 0;
+}
+
+int v4lprocessing_get_lookup_tables(struct v4lprocessing_data *data,
+		const struct v4l2_format *fmt, const unsigned char **luts)
+{
+	if (!data->do_process)
+		return 0;
+
+	switch (fmt->fmt.pix.pixelformat) {
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_BGR24:
+		break;
+	default:
+		return 0;
+	}
+
+	/* The statistics must be gathered from the unprocessed frame */
+	if (data->controls_changed ||
+			data->lookup_table_update_counter >= data->update_rate)
+		return 0;
+
+	data->lookup_table_update_counter++;
+
+	if (data->lookup_table_active) {
+		luts[0] = data->comp1;
+		luts[1] = data->green;
+		luts[2] = data->comp2;
+	} else
+		luts[0] = luts[1] = luts[2] = NULL;
+
+	if (data->log_cost && ++data->cost_frames == data->log_cost)
+		v4lprocessing_log_cost(data);
+
 	data->do_process = 0;
+	return 1;
 }
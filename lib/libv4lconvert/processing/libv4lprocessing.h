@@ -44,4 +44,12 @@ int v4lprocessing_pre_processing(struct v4lprocessing_data *data);
 void v4lprocessing_processing(struct v4lprocessing_data *data,
   unsigned char *buf, const struct v4l2_format *fmt);
 
+/* For converters which can apply the lookup tables to their rgb24 / bgr24
+   output themselves. Returns 1 if no lookup table update is due for this
+   frame, storing the tables for the 3 bytes of each pixel in luts (NULL if
+   there is nothing to do), the frame then counts as processed. Returns 0
+   if v4lprocessing_processing() must be called on the output as usual. */
+int v4lprocessing_get_lookup_tables(struct v4lprocessing_data *data,
+  const struct v4l2_format *fmt, const unsigned char **luts);
+
 #endif
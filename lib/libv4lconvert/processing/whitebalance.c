@@ -55,6 +55,11 @@ static int whitebalance_calculate_lookup_tables_generic(
 	comp1_avg = CLIP(comp1_avg, 512, 3072);
 	comp2_avg = CLIP(comp2_avg, 512, 3072);
 
+	/* Optionally average the measurements over multiple updates */
+	green_avg = v4lprocessing_smooth(data, data->green_avg, green_avg);
+	comp1_avg = v4lprocessing_smooth(data, data->comp1_avg, comp1_avg);
+	comp2_avg = v4lprocessing_smooth(data, data->comp2_avg, comp2_avg);
+
 	/* First frame ? */
 	if (data->green_avg == 0) {
 		data->green_avg = green_avg;
@@ -101,7 +106,7 @@ static int whitebalance_calculate_lookup_tables_generic(
 		 */
 		if (throttling && data->lookup_table_update_counter == 0)
 			data->lookup_table_update_counter =
-						V4L2PROCESSING_UPDATE_RATE;
+						data->update_rate;
 	}
 
 	if (abs(data->green_avg - data->comp1_avg) < threshold &&
@@ -124,37 +129,39 @@ static int whitebalance_calculate_lookup_tables_bayer(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt, int starts_with_green)
 {
-	int x, y, a1 = 0, a2 = 0, b1 = 0, b2 = 0;
+	struct v4lprocessing_stats_area area;
+	int x, y, count = 0;
+	unsigned long long a1 = 0, a2 = 0, b1 = 0, b2 = 0;
 	int green_avg, comp1_avg, comp2_avg;
-
-	for (y = 0; y < fmt->fmt.pix.height; y += 2) {
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			a1 += *buf++;
-			a2 += *buf++;
-		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
-		for (x = 0; x < fmt->fmt.pix.width; x += 2) {
-			b1 += *buf++;
-			b2 += *buf++;
+	unsigned char *line;
+
+	v4lprocessing_get_stats_area(data, fmt, 0, &area);
+
+	for (y = area.y; y < area.y + area.height; y += 2 * area.step) {
+		line = buf + y * fmt->fmt.pix.bytesperline;
+		for (x = area.x; x < area.x + area.width; x += 2 * area.step) {
+			a1 += line[x];
+			a2 += line[x + 1];
+			b1 += line[x + fmt->fmt.pix.bytesperline];
+			b2 += line[x + fmt->fmt.pix.bytesperline + 1];
+			count++;
 		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width;
 	}
 
+	if (!count)
+		return 0;
+
+	/* Norm avg to ~ 0 - 4095 */
 	if (starts_with_green) {
-		green_avg = a1 / 2 + b2 / 2;
-		comp1_avg = a2;
-		comp2_avg = b1;
+		green_avg = (a1 + b2) * 8 / count;
+		comp1_avg = a2 * 16 / count;
+		comp2_avg = b1 * 16 / count;
 	} else {
-		green_avg = a2 / 2 + b1 / 2;
-		comp1_avg = a1;
-		comp2_avg = b2;
+		green_avg = (a2 + b1) * 8 / count;
+		comp1_avg = a1 * 16 / count;
+		comp2_avg = b2 * 16 / count;
 	}
 
-	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 64;
-
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
 }
@@ -163,21 +170,31 @@ static int whitebalance_calculate_lookup_tables_rgb(
 		struct v4lprocessing_data *data, unsigned char *buf,
 		const struct v4l2_format *fmt)
 {
-	int x, y, green_avg = 0, comp1_avg = 0, comp2_avg = 0;
+	struct v4lprocessing_stats_area area;
+	int x, y, count = 0;
+	unsigned long long green = 0, comp1 = 0, comp2 = 0;
+	int green_avg, comp1_avg, comp2_avg;
+	unsigned char *line;
 
-	for (y = 0; y < fmt->fmt.pix.height; y++) {
-		for (x = 0; x < fmt->fmt.pix.width; x++) {
-			comp1_avg += *buf++;
-			green_avg += *buf++;
-			comp2_avg += *buf++;
+	v4lprocessing_get_stats_area(data, fmt, 0, &area);
+
+	for (y = area.y; y < area.y + area.height; y += area.step) {
+		line = buf + y * fmt->fmt.pix.bytesperline;
+		for (x = area.x; x < area.x + area.width; x += area.step) {
+			comp1 += line[3 * x];
+			green += line[3 * x + 1];
+			comp2 += line[3 * x + 2];
+			count++;
 		}
-		buf += fmt->fmt.pix.bytesperline - fmt->fmt.pix.width * 3;
 	}
 
+	if (!count)
+		return 0;
+
 	/* Norm avg to ~ 0 - 4095 */
-	green_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp1_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
-	comp2_avg /= fmt->fmt.pix.width * fmt->fmt.pix.height / 16;
+	green_avg = green * 16 / count;
+	comp1_avg = comp1 * 16 / count;
+	comp2_avg = comp2 * 16 / count;
 
 	return whitebalance_calculate_lookup_tables_generic(data, green_avg,
 			comp1_avg, comp2_avg);
@@ -0,0 +1,708 @@
+/*
+
+# Vectorized packed YUV 4:2:2 conversion routines
+
+# These produce exactly the same output as the C versions in rgbyuv.c, which
+# remain the reference implementation and are used for row remainders and on
+# CPUs without any of the supported instruction set extensions.
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <errno.h>
+
+#include "libv4lconvert-priv.h"
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Byte offsets of the components within a 4 byte pixel pair */
+struct packed_yuv_layout {
+	int y0, y1, u, v;
+};
+
+static const struct packed_yuv_layout yuyv_layout = { 0, 2, 1, 3 };
+static const struct packed_yuv_layout yvyu_layout = { 0, 2, 3, 1 };
+static const struct packed_yuv_layout uyvy_layout = { 1, 3, 0, 2 };
+
+typedef int (*rgb_row_func)(const unsigned char *src, unsigned char *dest,
+		int width, const struct packed_yuv_layout *l, int bgr);
+typedef int (*y_row_func)(const unsigned char *src, unsigned char *ydest,
+		int width, int y_odd);
+typedef int (*uv_row_func)(const unsigned char *src0, const unsigned char *src1,
+		unsigned char *udest, unsigned char *vdest, int width, int y_odd);
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+
+#define SSE2_FUNC  __attribute__((target("sse2")))
+#define SSSE3_FUNC __attribute__((target("ssse3")))
+#define AVX2_FUNC  __attribute__((target("avx2")))
+
+/* pshufb masks to interleave 16 R, G and B values into 48 bytes of RGB24 */
+static const signed char rgb24_pack_masks[3][3][16] = {
+	{
+		{ 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+		{ -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+		{ -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 },
+	}, {
+		{ -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+		{ 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+		{ -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 },
+	}, {
+		{ -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+		{ -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+		{ 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 },
+	},
+};
+
+/* Build pshufb masks which zero extend Y, U and V of 4 pixel pairs (one 16
+   byte block) to 8 16 bit values, 1 per pixel */
+static void build_unpack_masks(const struct packed_yuv_layout *l,
+		signed char *my, signed char *mu, signed char *mv)
+{
+	int p;
+
+	for (p = 0; p < 4; p++) {
+		my[4 * p + 0] = 4 * p + l->y0;
+		my[4 * p + 2] = 4 * p + l->y1;
+		mu[4 * p + 0] = mu[4 * p + 2] = 4 * p + l->u;
+		mv[4 * p + 0] = mv[4 * p + 2] = 4 * p + l->v;
+		my[4 * p + 1] = my[4 * p + 3] = -1;
+		mu[4 * p + 1] = mu[4 * p + 3] = -1;
+		mv[4 * p + 1] = mv[4 * p + 3] = -1;
+	}
+}
+
+static inline SSSE3_FUNC void store_rgb24_16(unsigned char *dest,
+		__m128i r, __m128i g, __m128i b)
+{
+	int k;
+
+	for (k = 0; k < 3; k++) {
+		__m128i o;
+
+		o = _mm_shuffle_epi8(r,
+			_mm_loadu_si128((const __m128i *)rgb24_pack_masks[k][0]));
+		o = _mm_or_si128(o, _mm_shuffle_epi8(g,
+			_mm_loadu_si128((const __m128i *)rgb24_pack_masks[k][1])));
+		o = _mm_or_si128(o, _mm_shuffle_epi8(b,
+			_mm_loadu_si128((const __m128i *)rgb24_pack_masks[k][2])));
+		_mm_storeu_si128((__m128i *)(dest + 16 * k), o);
+	}
+}
+
+/* Same fixed point math as the C code, all intermediates fit in 16 bits */
+static inline SSSE3_FUNC void yuv_to_rgb_8(__m128i blk, __m128i my,
+		__m128i mu, __m128i mv, __m128i *r, __m128i *g, __m128i *b)
+{
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i y = _mm_shuffle_epi8(blk, my);
+	__m128i u = _mm_sub_epi16(_mm_shuffle_epi8(blk, mu), c128);
+	__m128i v = _mm_sub_epi16(_mm_shuffle_epi8(blk, mv), c128);
+	__m128i u1 = _mm_srai_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(129)), 6);
+	__m128i rg = _mm_srai_epi16(_mm_add_epi16(
+			_mm_mullo_epi16(u, _mm_set1_epi16(3)),
+			_mm_mullo_epi16(v, _mm_set1_epi16(6))), 3);
+	__m128i v1 = _mm_srai_epi16(_mm_mullo_epi16(v, _mm_set1_epi16(3)), 1);
+
+	*r = _mm_add_epi16(y, v1);
+	*g = _mm_sub_epi16(y, rg);
+	*b = _mm_add_epi16(y, u1);
+}
+
+static SSSE3_FUNC int packed_yuv_row_to_rgb24_ssse3(const unsigned char *src,
+		unsigned char *dest, int width, const struct packed_yuv_layout *l,
+		int bgr)
+{
+	signed char m[3][16];
+	__m128i my, mu, mv;
+	int x;
+
+	build_unpack_masks(l, m[0], m[1], m[2]);
+	my = _mm_loadu_si128((const __m128i *)m[0]);
+	mu = _mm_loadu_si128((const __m128i *)m[1]);
+	mv = _mm_loadu_si128((const __m128i *)m[2]);
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i ra, ga, ba, rb, gb, bb, r, g, b;
+
+		yuv_to_rgb_8(_mm_loadu_si128((const __m128i *)src),
+			     my, mu, mv, &ra, &ga, &ba);
+		yuv_to_rgb_8(_mm_loadu_si128((const __m128i *)(src + 16)),
+			     my, mu, mv, &rb, &gb, &bb);
+		r = _mm_packus_epi16(ra, rb);
+		g = _mm_packus_epi16(ga, gb);
+		b = _mm_packus_epi16(ba, bb);
+		if (bgr)
+			store_rgb24_16(dest, b, g, r);
+		else
+			store_rgb24_16(dest, r, g, b);
+		src += 32;
+		dest += 48;
+	}
+
+	return x;
+}
+
+static inline AVX2_FUNC void yuv_to_rgb_16(__m256i blk, __m256i my,
+		__m256i mu, __m256i mv, __m256i *r, __m256i *g, __m256i *b)
+{
+	const __m256i c128 = _mm256_set1_epi16(128);
+	__m256i y = _mm256_shuffle_epi8(blk, my);
+	__m256i u = _mm256_sub_epi16(_mm256_shuffle_epi8(blk, mu), c128);
+	__m256i v = _mm256_sub_epi16(_mm256_shuffle_epi8(blk, mv), c128);
+	__m256i u1 = _mm256_srai_epi16(
+			_mm256_mullo_epi16(u, _mm256_set1_epi16(129)), 6);
+	__m256i rg = _mm256_srai_epi16(_mm256_add_epi16(
+			_mm256_mullo_epi16(u, _mm256_set1_epi16(3)),
+			_mm256_mullo_epi16(v, _mm256_set1_epi16(6))), 3);
+	__m256i v1 = _mm256_srai_epi16(
+			_mm256_mullo_epi16(v, _mm256_set1_epi16(3)), 1);
+
+	*r = _mm256_add_epi16(y, v1);
+	*g = _mm256_sub_epi16(y, rg);
+	*b = _mm256_add_epi16(y, u1);
+}
+
+/* packus works per 128 bit lane, put the 4 quadwords back in pixel order */
+static inline AVX2_FUNC __m256i packus_ordered(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+}
+
+static AVX2_FUNC int packed_yuv_row_to_rgb24_avx2(const unsigned char *src,
+		unsigned char *dest, int width, const struct packed_yuv_layout *l,
+		int bgr)
+{
+	signed char m[3][16];
+	__m256i my, mu, mv;
+	int x;
+
+	build_unpack_masks(l, m[0], m[1], m[2]);
+	my = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m[0]));
+	mu = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m[1]));
+	mv = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)m[2]));
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m256i ra, ga, ba, rb, gb, bb, r, g, b;
+
+		yuv_to_rgb_16(_mm256_loadu_si256((const __m256i *)src),
+			      my, mu, mv, &ra, &ga, &ba);
+		yuv_to_rgb_16(_mm256_loadu_si256((const __m256i *)(src + 32)),
+			      my, mu, mv, &rb, &gb, &bb);
+		r = packus_ordered(ra, rb);
+		g = packus_ordered(ga, gb);
+		b = packus_ordered(ba, bb);
+		if (bgr) {
+			__m256i t = r;
+
+			r = b;
+			b = t;
+		}
+		store_rgb24_16(dest, _mm256_castsi256_si128(r),
+			       _mm256_castsi256_si128(g),
+			       _mm256_castsi256_si128(b));
+		store_rgb24_16(dest + 48, _mm256_extracti128_si256(r, 1),
+			       _mm256_extracti128_si256(g, 1),
+			       _mm256_extracti128_si256(b, 1));
+		src += 64;
+		dest += 96;
+	}
+
+	return x;
+}
+
+static inline SSE2_FUNC __m128i luma_words_sse2(__m128i blk, int y_odd)
+{
+	return y_odd ? _mm_srli_epi16(blk, 8) :
+		       _mm_and_si128(blk, _mm_set1_epi16(0xff));
+}
+
+static inline SSE2_FUNC __m128i chroma_words_sse2(__m128i blk, int y_odd)
+{
+	return luma_words_sse2(blk, !y_odd);
+}
+
+/* (a + b) / 2 rounded down, pavgb rounds up */
+static inline SSE2_FUNC __m128i avg_floor_sse2(__m128i a, __m128i b)
+{
+	return _mm_sub_epi8(_mm_avg_epu8(a, b),
+			    _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+static SSE2_FUNC int packed_yuv_row_to_y_sse2(const unsigned char *src,
+		unsigned char *ydest, int width, int y_odd)
+{
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)src);
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+		_mm_storeu_si128((__m128i *)ydest,
+				 _mm_packus_epi16(luma_words_sse2(a, y_odd),
+						  luma_words_sse2(b, y_odd)));
+		src += 32;
+		ydest += 16;
+	}
+
+	return x;
+}
+
+static SSE2_FUNC int packed_yuv_rows_to_uv_sse2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int y_odd)
+{
+	const __m128i mask = _mm_set1_epi16(0xff);
+	int x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i c0 = _mm_packus_epi16(
+			chroma_words_sse2(_mm_loadu_si128((const __m128i *)src0), y_odd),
+			chroma_words_sse2(_mm_loadu_si128((const __m128i *)(src0 + 16)), y_odd));
+		__m128i c1 = _mm_packus_epi16(
+			chroma_words_sse2(_mm_loadu_si128((const __m128i *)src1), y_odd),
+			chroma_words_sse2(_mm_loadu_si128((const __m128i *)(src1 + 16)), y_odd));
+		__m128i c = avg_floor_sse2(c0, c1);
+		__m128i uv = _mm_packus_epi16(_mm_and_si128(c, mask),
+					      _mm_srli_epi16(c, 8));
+
+		_mm_storel_epi64((__m128i *)udest, uv);
+		_mm_storel_epi64((__m128i *)vdest, _mm_srli_si128(uv, 8));
+		src0 += 32;
+		src1 += 32;
+		udest += 8;
+		vdest += 8;
+	}
+
+	return x;
+}
+
+static inline AVX2_FUNC __m256i luma_words_avx2(__m256i blk, int y_odd)
+{
+	return y_odd ? _mm256_srli_epi16(blk, 8) :
+		       _mm256_and_si256(blk, _mm256_set1_epi16(0xff));
+}
+
+static inline AVX2_FUNC __m256i chroma_words_avx2(__m256i blk, int y_odd)
+{
+	return luma_words_avx2(blk, !y_odd);
+}
+
+static AVX2_FUNC int packed_yuv_row_to_y_avx2(const unsigned char *src,
+		unsigned char *ydest, int width, int y_odd)
+{
+	int x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i *)src);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+
+		_mm256_storeu_si256((__m256i *)ydest,
+				    packus_ordered(luma_words_avx2(a, y_odd),
+						   luma_words_avx2(b, y_odd)));
+		src += 64;
+		ydest += 32;
+	}
+
+	return x;
+}
+
+static AVX2_FUNC int packed_yuv_rows_to_uv_avx2(const unsigned char *src0,
+		const unsigned char *src1, unsigned char *udest,
+		unsigned char *vdest, int width, int y_odd)
+{
+	const __m256i mask = _mm256_set1_epi16(0xff);
+	int x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m256i c0 = packus_ordered(
+			chroma_words_avx2(_mm256_loadu_si256((const __m256i *)src0), y_odd),
+			chroma_words_avx2(_mm256_loadu_si256((const __m256i *)(src0 + 32)), y_odd));
+		__m256i c1 = packus_ordered(
+			chroma_words_avx2(_mm256_loadu_si256((const __m256i *)src1), y_odd),
+			chroma_words_avx2(_mm256_loadu_si256((const __m256i *)(src1 + 32)), y_odd));
+		__m256i c = _mm256_sub_epi8(_mm256_avg_epu8(c0, c1),
+			_mm256_and_si256(_mm256_xor_si256(c0, c1),
+					 _mm256_set1_epi8(1)));
+		__m256i uv = packus_ordered(_mm256_and_si256(c, mask),
+					    _mm256_srli_epi16(c, 8));
+
+		_mm_storeu_si128((__m128i *)udest, _mm256_castsi256_si128(uv));
+		_mm_storeu_si128((__m128i *)vdest, _mm256_extracti128_si256(uv, 1));
+		src0 += 64;
+		src1 += 64;
+		udest += 16;
+		vdest += 16;
+	}
+
+	return x;
+}
+
+#endif /* V4LCONVERT_HAVE_X86_SIMD */
+
+static rgb_row_func get_rgb_row_func(unsigned int cpu_flags)
+{
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	if (cpu_flags & V4LCONVERT_CPU_AVX2)
+		return packed_yuv_row_to_rgb24_avx2;
+	if (cpu_flags & V4LCONVERT_CPU_SSSE3)
+		return packed_yuv_row_to_rgb24_ssse3;
+#endif
+	return NULL;
+}
+
+static void packed_yuv_to_rgb24_c(const unsigned char *src,
+		unsigned char *dest, int width, int height, int stride,
+		unsigned int src_pix_fmt, int bgr)
+{
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		if (bgr)
+			v4lconvert_yuyv_to_bgr24(src, dest, width, height, stride);
+		else
+			v4lconvert_yuyv_to_rgb24(src, dest, width, height, stride);
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		if (bgr)
+			v4lconvert_yvyu_to_bgr24(src, dest, width, height, stride);
+		else
+			v4lconvert_yvyu_to_rgb24(src, dest, width, height, stride);
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		if (bgr)
+			v4lconvert_uyvy_to_bgr24(src, dest, width, height, stride);
+		else
+			v4lconvert_uyvy_to_rgb24(src, dest, width, height, stride);
+		break;
+	}
+}
+
+void v4lconvert_yuyv_line_to_rgb24(unsigned int cpu_flags,
+		const unsigned char *src, unsigned char *dest, int width, int bgr)
+{
+	rgb_row_func rgb_func = get_rgb_row_func(cpu_flags);
+	int x = rgb_func ? rgb_func(src, dest, width, &yuyv_layout, bgr) : 0;
+
+	if (x < width)
+		packed_yuv_to_rgb24_c(src + 2 * x, dest + 3 * x, width - x, 1,
+				      2 * (width - x), V4L2_PIX_FMT_YUYV, bgr);
+}
+
+/* Mirror lines in place, done per stripe while the lines are still cached */
+static void hflip_rgb24_lines(unsigned char *dest, int width, int lines)
+{
+	unsigned char *l, *r, t;
+	int i;
+
+	while (lines--) {
+		l = dest;
+		r = dest + 3 * (width - 1);
+		for (; l < r; l += 3, r -= 3)
+			for (i = 0; i < 3; i++) {
+				t = l[i];
+				l[i] = r[i];
+				r[i] = t;
+			}
+		dest += 3 * width;
+	}
+}
+
+static void hflip_lines(unsigned char *dest, int width, int lines)
+{
+	unsigned char *l, *r, t;
+
+	while (lines--) {
+		l = dest;
+		r = dest + width - 1;
+		for (; l < r; l++, r--) {
+			t = *l;
+			*l = *r;
+			*r = t;
+		}
+		dest += width;
+	}
+}
+
+struct packed_yuv_job {
+	const unsigned char *src;
+	unsigned char *dest;
+	int width, height, stride;
+	unsigned int src_pix_fmt;
+	int bgr, yvu, hflip;
+	const unsigned char *const *luts;
+	const struct packed_yuv_layout *l;
+	rgb_row_func rgb_func;
+	y_row_func y_func;
+	uv_row_func uv_func;
+};
+
+static void packed_yuv_to_rgb24_stripe(void *arg, int start, int end)
+{
+	struct packed_yuv_job *job = arg;
+	const unsigned char *src = job->src + start * job->stride;
+	unsigned char *dest = job->dest + start * 3 * job->width;
+	int x, y;
+
+	if (!job->rgb_func && !job->luts) {
+		packed_yuv_to_rgb24_c(src, dest, job->width, end - start,
+				      job->stride, job->src_pix_fmt, job->bgr);
+		if (job->hflip)
+			hflip_rgb24_lines(dest, job->width, end - start);
+		return;
+	}
+
+	for (y = start; y < end; y++) {
+		x = job->rgb_func ?
+			job->rgb_func(src, dest, job->width, job->l, job->bgr) : 0;
+		if (x < job->width)
+			packed_yuv_to_rgb24_c(src + 2 * x, dest + 3 * x,
+					      job->width - x, 1, job->stride,
+					      job->src_pix_fmt, job->bgr);
+		if (job->hflip)
+			hflip_rgb24_lines(dest, job->width, 1);
+		/* Apply processing while the line is still in the cache */
+		if (job->luts)
+			v4lconvert_apply_luts(job->luts, dest, job->width);
+		src += job->stride;
+		dest += 3 * job->width;
+	}
+}
+
+void v4lconvert_packed_yuv_to_rgb24(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride,
+		unsigned int src_pix_fmt, int bgr, int hflip)
+{
+	struct packed_yuv_job job = {
+		.src = src, .dest = dest,
+		.width = width, .height = height, .stride = stride,
+		.src_pix_fmt = src_pix_fmt, .bgr = bgr, .hflip = hflip,
+		.luts = data->luts[0] ? data->luts : NULL,
+		.rgb_func = get_rgb_row_func(data->cpu_flags),
+	};
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		job.l = &yuyv_layout;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		job.l = &yvyu_layout;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		job.l = &uyvy_layout;
+		break;
+	default:
+		return;
+	}
+
+	/* The C code walks the source in pixel pairs also for odd widths, which
+	   shifts each line by a byte pair; leave those to it. */
+	if (width & 1) {
+		packed_yuv_to_rgb24_c(src, dest, width, height, stride,
+				      src_pix_fmt, bgr);
+		if (hflip)
+			hflip_rgb24_lines(dest, width, height);
+		for (; job.luts && height--; dest += 3 * width)
+			v4lconvert_apply_luts(job.luts, dest, width);
+		return;
+	}
+
+	v4lconvert_run_stripes(data, packed_yuv_to_rgb24_stripe, &job, height, 1);
+}
+
+static void packed_yuv_to_yuv420_stripe(void *arg, int start, int end)
+{
+	struct packed_yuv_job *job = arg;
+	int width = job->width, height = job->height;
+	int y_odd = job->l == &uyvy_layout;
+	int uoff = y_odd ? 0 : 1;
+	unsigned char *dest, *udest, *vdest;
+	int i, x;
+
+	/* Y, the layout of the output matches the C implementation */
+	dest = job->dest + start * width;
+	for (i = start; i < end; i++) {
+		const unsigned char *s = job->src + i * job->stride;
+
+		x = job->y_func ? job->y_func(s, dest, width, y_odd) : 0;
+		for (s += 2 * x; x < width; x += 2, s += 4) {
+			dest[x] = s[y_odd];
+			dest[x + 1] = s[y_odd + 2];
+		}
+		if (job->hflip)
+			hflip_lines(dest, width, 1);
+		dest += width;
+	}
+
+	/* U and V, averaged over 2 lines */
+	dest = job->dest + height * width;
+	if (job->yvu) {
+		vdest = dest;
+		udest = dest + width * height / 4;
+	} else {
+		udest = dest;
+		vdest = dest + width * height / 4;
+	}
+	udest += start / 2 * (width / 2);
+	vdest += start / 2 * (width / 2);
+	for (i = start; i < end; i += 2) {
+		const unsigned char *s0 = job->src + i * job->stride;
+		const unsigned char *s1 = s0 + job->stride;
+
+		x = job->uv_func ? job->uv_func(s0, s1, udest, vdest, width, y_odd) : 0;
+		for (s0 += 2 * x, s1 += 2 * x; x < width;
+		     x += 2, s0 += 4, s1 += 4) {
+			udest[x / 2] = ((int)s0[uoff] + s1[uoff]) / 2;
+			vdest[x / 2] = ((int)s0[uoff + 2] + s1[uoff + 2]) / 2;
+		}
+		if (job->hflip) {
+			hflip_lines(udest, width / 2, 1);
+			hflip_lines(vdest, width / 2, 1);
+		}
+		udest += width / 2;
+		vdest += width / 2;
+	}
+}
+
+int v4lconvert_packed_yuv_to_yuv420(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride,
+		unsigned int src_pix_fmt, int yvu, int hflip)
+{
+	struct packed_yuv_job job = {
+		.src = src, .dest = dest,
+		.width = width, .height = height, .stride = stride,
+		.src_pix_fmt = src_pix_fmt, .yvu = yvu, .hflip = hflip,
+	};
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		job.l = &yuyv_layout;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		/* Same as yuyv with the chroma planes swapped */
+		job.l = &yuyv_layout;
+		job.yvu = !yvu;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		job.l = &uyvy_layout;
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Mirroring swaps the pixel pairs, so it needs whole pairs */
+	if (hflip && (width & 1)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	if (data->cpu_flags & V4LCONVERT_CPU_AVX2) {
+		job.y_func = packed_yuv_row_to_y_avx2;
+		job.uv_func = packed_yuv_rows_to_uv_avx2;
+	} else if (data->cpu_flags & V4LCONVERT_CPU_SSE2) {
+		job.y_func = packed_yuv_row_to_y_sse2;
+		job.uv_func = packed_yuv_rows_to_uv_sse2;
+	}
+#endif
+
+	if ((!job.y_func && data->threads == 1 && !hflip) || (width & 1)) {
+		if (job.l == &uyvy_layout)
+			v4lconvert_uyvy_to_yuv420(src, dest, width, height,
+						  stride, job.yvu);
+		else
+			v4lconvert_yuyv_to_yuv420(src, dest, width, height,
+						  stride, job.yvu);
+		return 0;
+	}
+
+	v4lconvert_run_stripes(data, packed_yuv_to_yuv420_stripe, &job, height, 2);
+	return 0;
+}
+
+static void packed_yuv_to_nv12_stripe(void *arg, int start, int end)
+{
+	struct packed_yuv_job *job = arg;
+	int width = job->width;
+	int y_odd = job->l == &uyvy_layout;
+	int uoff = job->l->u, voff = job->l->v;
+	unsigned char *dest;
+	int i, x;
+
+	dest = job->dest + start * width;
+	for (i = start; i < end; i++) {
+		const unsigned char *s = job->src + i * job->stride;
+
+		x = job->y_func ? job->y_func(s, dest, width, y_odd) : 0;
+		for (s += 2 * x; x + 1 < width; x += 2, s += 4) {
+			dest[x] = s[y_odd];
+			dest[x + 1] = s[y_odd + 2];
+		}
+		dest += width;
+	}
+
+	/* Interleaved U and V, averaged over 2 lines */
+	dest = job->dest + job->height * width + start / 2 * width;
+	for (i = start; i < end; i += 2) {
+		const unsigned char *s0 = job->src + i * job->stride;
+		const unsigned char *s1 = s0 + job->stride;
+
+		for (x = 0; x + 1 < width; x += 2, s0 += 4, s1 += 4) {
+			dest[x] = ((int)s0[uoff] + s1[uoff]) / 2;
+			dest[x + 1] = ((int)s0[voff] + s1[voff]) / 2;
+		}
+		dest += width;
+	}
+}
+
+void v4lconvert_packed_yuv_to_nv12(struct v4lconvert_data *data,
+		const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, unsigned int src_pix_fmt)
+{
+	struct packed_yuv_job job = {
+		.src = src, .dest = dest,
+		.width = width, .height = height, .stride = stride,
+		.src_pix_fmt = src_pix_fmt,
+	};
+
+	switch (src_pix_fmt) {
+	case V4L2_PIX_FMT_YUYV:
+		job.l = &yuyv_layout;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		job.l = &yvyu_layout;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		job.l = &uyvy_layout;
+		break;
+	default:
+		return;
+	}
+
+	/* The y row functions only look at the position of the y values */
+#ifdef V4LCONVERT_HAVE_X86_SIMD
+	if (data->cpu_flags & V4LCONVERT_CPU_AVX2)
+		job.y_func = packed_yuv_row_to_y_avx2;
+	else if (data->cpu_flags & V4LCONVERT_CPU_SSE2)
+		job.y_func = packed_yuv_row_to_y_sse2;
+#endif
+
+	v4lconvert_run_stripes(data, packed_yuv_to_nv12_stripe, &job, height, 2);
+}
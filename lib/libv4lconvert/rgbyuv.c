@@ -924,3 +924,150 @@ void v4lconvert_nv12_to_yuv420(const unsigned char *src, unsigned char *dest,
 			uvsrc += stride - width;
 	}
 }
+
+void v4lconvert_yuv420_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	int i, j;
+	const unsigned char *usrc, *vsrc;
+
+	if (yvu) {
+		vsrc = src + stride * height;
+		usrc = vsrc + (stride * height) / 4;
+	} else {
+		usrc = src + stride * height;
+		vsrc = usrc + (stride * height) / 4;
+	}
+
+	for (i = 0; i < height; i++) {
+		memcpy(dest, src, width);
+		dest += width;
+		src += stride;
+	}
+
+	for (i = 0; i < height / 2; i++) {
+		for (j = 0; j < width / 2; j++) {
+			*dest++ = usrc[j];
+			*dest++ = vsrc[j];
+		}
+		usrc += stride / 2;
+		vsrc += stride / 2;
+	}
+}
+
+void v4lconvert_yuv420_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, int yvu)
+{
+	int i, j;
+	const unsigned char *ysrc = src;
+	const unsigned char *usrc, *vsrc;
+
+	if (yvu) {
+		vsrc = src + stride * height;
+		usrc = vsrc + (stride * height) / 4;
+	} else {
+		usrc = src + stride * height;
+		vsrc = usrc + (stride * height) / 4;
+	}
+
+	/* Each line of u and v values gets used for 2 lines */
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*dest++ = ysrc[j];
+			*dest++ = usrc[j / 2];
+			*dest++ = ysrc[j + 1];
+			*dest++ = vsrc[j / 2];
+		}
+		ysrc += stride;
+		if (i & 1) {
+			usrc += stride / 2;
+			vsrc += stride / 2;
+		}
+	}
+}
+
+void v4lconvert_nv12_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	int i, j;
+	const unsigned char *ysrc = src;
+	const unsigned char *uvsrc = src + stride * height;
+
+	for (i = 0; i < height; i++) {
+		for (j = 0; j + 1 < width; j += 2) {
+			*dest++ = ysrc[j];
+			*dest++ = uvsrc[j];
+			*dest++ = ysrc[j + 1];
+			*dest++ = uvsrc[j + 1];
+		}
+		ysrc += stride;
+		if (i & 1)
+			uvsrc += stride;
+	}
+}
+
+void v4lconvert_nv16_to_nv12(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride)
+{
+	int i, j;
+	const unsigned char *cbcr = src + stride * height;
+
+	for (i = 0; i < height; i++) {
+		memcpy(dest, src, width);
+		dest += width;
+		src += stride;
+	}
+
+	/* Average the u and v values of each 2 lines, like yuyv_to_yuv420 */
+	for (i = 0; i < height; i += 2) {
+		for (j = 0; j < width; j++)
+			*dest++ = ((int)cbcr[j] + cbcr[j + stride]) / 2;
+		cbcr += 2 * stride;
+	}
+}
+
+void v4lconvert_packed_yuv_to_yuyv(const unsigned char *src, unsigned char *dest,
+		int width, int height, int stride, unsigned int src_pix_fmt)
+{
+	int i, j;
+
+	for (i = 0; i < height; i++) {
+		switch (src_pix_fmt) {
+		case V4L2_PIX_FMT_YUYV:
+			memcpy(dest, src, width * 2);
+			break;
+		case V4L2_PIX_FMT_YVYU:
+			for (j = 0; j + 1 < width; j += 2) {
+				dest[2 * j] = src[2 * j];
+				dest[2 * j + 1] = src[2 * j + 3];
+				dest[2 * j + 2] = src[2 * j + 2];
+				dest[2 * j + 3] = src[2 * j + 1];
+			}
+			break;
+		case V4L2_PIX_FMT_UYVY:
+			for (j = 0; j + 1 < width; j += 2) {
+				dest[2 * j] = src[2 * j + 1];
+				dest[2 * j + 1] = src[2 * j];
+				dest[2 * j + 2] = src[2 * j + 3];
+				dest[2 * j + 3] = src[2 * j + 2];
+			}
+			break;
+		}
+		dest += width * 2;
+		src += stride;
+	}
+}
+
+void v4lconvert_apply_luts(const unsigned char *const *luts,
+		unsigned char *rgb, int width)
+{
+	const unsigned char *comp1 = luts[0], *green = luts[1], *comp2 = luts[2];
+	int i;
+
+	for (i = 0; i < width; i++) {
+		rgb[0] = comp1[rgb[0]];
+		rgb[1] = green[rgb[1]];
+		rgb[2] = comp2[rgb[2]];
+		rgb += 3;
+	}
+}
@@ -22,6 +22,7 @@
  */
 
 #include "libv4lconvert-priv.h"
+#include "bitreader.h"
 
 #define CLAMP(x)	((x) < 0 ? 0 : ((x) > 255) ? 255 : (x))
 
@@ -114,50 +115,41 @@ static void sonix_decompress_init(void)
    IN	width
    height
    inp		pointer to compressed frame (with header already stripped)
+   src_size	size of the compressed frame
    OUT	outp	pointer to decompressed frame
 
    Returns 0 if the operation was successful.
    Returns <0 if operation failed.
 
  */
-void v4lconvert_decode_sn9c10x(const unsigned char *inp, unsigned char *outp,
-		int width, int height)
+void v4lconvert_decode_sn9c10x(const unsigned char *inp, int src_size,
+		unsigned char *outp, int width, int height)
 {
+	struct v4lconvert_bitreader br;
 	int row, col;
 	int val;
-	int bitpos;
 	unsigned char code;
-	const unsigned char *addr;
 
 	if (!init_done)
 		sonix_decompress_init();
 
-	bitpos = 0;
+	v4lconvert_br_init(&br, inp, src_size);
 	for (row = 0; row < height; row++) {
 		col = 0;
 
 		/* first two pixels in first two rows are stored as raw 8-bit */
 		if (row < 2) {
-			addr = inp + (bitpos >> 3);
-			code = (addr[0] << (bitpos & 7)) | (addr[1] >> (8 - (bitpos & 7)));
-			bitpos += 8;
-			*outp++ = code;
-
-			addr = inp + (bitpos >> 3);
-			code = (addr[0] << (bitpos & 7)) | (addr[1] >> (8 - (bitpos & 7)));
-			bitpos += 8;
-			*outp++ = code;
-
+			*outp++ = v4lconvert_br_get(&br, 8);
+			*outp++ = v4lconvert_br_get(&br, 8);
 			col += 2;
 		}
 
 		while (col < width) {
 			/* get bitcode from bitstream */
-			addr = inp + (bitpos >> 3);
-			code = (addr[0] << (bitpos & 7)) | (addr[1] >> (8 - (bitpos & 7)));
+			code = v4lconvert_br_peek(&br, 8);
 
 			/* update bit position */
-			bitpos += table[code].len;
+			v4lconvert_br_skip(&br, table[code].len);
 
 			/* Skip unknown codes (most likely they indicate
 			   a change of the delta's the various codes encode) */
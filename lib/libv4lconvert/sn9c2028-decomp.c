@@ -37,81 +37,46 @@
  */
 
 #include "libv4lconvert-priv.h"
-
-/* Four defines for bitstream operations, used in the decode function */
-
-#define PEEK_BITS(num, to) { \
-	if (bitBufCount < num) { \
-		do { \
-			bitBuf = (bitBuf << 8) | (*(src++)); \
-			bitBufCount += 8; \
-		} while (bitBufCount < 24); \
-	} \
-	to = bitBuf >> (bitBufCount - num); \
-}
+#include "bitreader.h"
 
 /*
- * PEEK_BITS puts the next <num> bits into the low bits of <to>.
- * when the buffer is empty, it is completely refilled.
- * This strategy tries to reduce memory access. Note that the high bits
- * are NOT set to zero!
+ * The pixel codes, indexed by their first 5 bits: the code length and the
+ * delta it encodes. The code 11101 has length 0 here: it is followed by 5
+ * bits with an absolute value.
  */
+static const struct {
+	signed char len;
+	signed char delta;
+} pixel_codes[32] = {
+	{ 1,   0 }, { 1,   0 }, { 1,   0 }, { 1,   0 },
+	{ 1,   0 }, { 1,   0 }, { 1,   0 }, { 1,   0 },
+	{ 1,   0 }, { 1,   0 }, { 1,   0 }, { 1,   0 },
+	{ 1,   0 }, { 1,   0 }, { 1,   0 }, { 1,   0 },
+	{ 4,   8 }, { 4,   8 }, { 4,  -8 }, { 4,  -8 },
+	{ 3,   3 }, { 3,   3 }, { 3,   3 }, { 3,   3 },
+	{ 3,  -3 }, { 3,  -3 }, { 3,  -3 }, { 3,  -3 },
+	{ 5,  20 }, { 0,   0 }, { 4, -20 }, { 4, -20 }
+};
 
-#define EAT_BITS(num) { bitBufCount -= num; bits_eaten += num; }
+static inline short parse_pixel(struct v4lconvert_bitreader *br, short val)
+{
+	unsigned int bits = v4lconvert_br_peek(br, 10);
+	int len = pixel_codes[bits >> 5].len;
 
-/*
- * EAT_BITS consumes <num> bits (PEEK_BITS does not consume anything,
- * it just peeks)
- */
+	if (!len) {
+		v4lconvert_br_skip(br, 10);
+		return 8 * (bits & 0x1f);
+	}
 
-#define PARSE_PIXEL(val) {\
-	PEEK_BITS(10, bits);\
-	if ((bits & 0x200) == 0) {\
-		EAT_BITS(1);\
-	} \
-	else if ((bits & 0x380) == 0x280) {\
-		EAT_BITS(3);\
-		val += 3;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else if ((bits & 0x380) == 0x300) {\
-		EAT_BITS(3);\
-		val -= 3;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3c0) == 0x200) {\
-		EAT_BITS(4);\
-		val += 8;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else if ((bits & 0x3c0) == 0x240) {\
-		EAT_BITS(4);\
-		val -= 8;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3c0) == 0x3c0) {\
-		EAT_BITS(4);\
-		val -= 20;\
-		if (val < 0)\
-			val = 0;\
-	} \
-	else if ((bits & 0x3e0) == 0x380) {\
-		EAT_BITS(5);\
-		val += 20;\
-		if (val > 255)\
-			val = 255;\
-	} \
-	else {\
-		EAT_BITS(10);\
-		val = 8 * (bits & 0x1f);\
-	} \
+	v4lconvert_br_skip(br, len);
+	val += pixel_codes[bits >> 5].delta;
+	if (val < 0)
+		return 0;
+	if (val > 255)
+		return 255;
+	return val;
 }
 
-
 #define PUT_PIXEL_PAIR {\
 	long pp;\
 	pp = (c1val << 8) + c2val;\
@@ -121,34 +86,28 @@
 
 /* Now the decode function itself */
 
-void v4lconvert_decode_sn9c2028(const unsigned char *src, unsigned char *dst,
-		int width, int height)
+void v4lconvert_decode_sn9c2028(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height)
 {
+	struct v4lconvert_bitreader br;
 	long dst_index = 0;
 	int starting_row = 0;
-	unsigned short bits;
 	short c1val, c2val;
 	int x, y;
-	unsigned long bitBuf = 0;
-	unsigned long bitBufCount = 0;
-	unsigned long bits_eaten = 0;
 
-	src += 12;    /* Remove the header */
+	/* Remove the header */
+	v4lconvert_br_init(&br, src + 12, src_size - 12);
 
 	for (y = starting_row; y < height; y++) {
-		PEEK_BITS(8, bits);
-		EAT_BITS(8);
-		c2val = (bits & 0xff);
-		PEEK_BITS(8, bits);
-		EAT_BITS(8);
-		c1val = (bits & 0xff);
+		c2val = v4lconvert_br_get(&br, 8);
+		c1val = v4lconvert_br_get(&br, 8);
 
 		PUT_PIXEL_PAIR;
 
 		for (x = 2; x < width ; x += 2) {
 			/* The compression reversed the even and odd columns.*/
-			PARSE_PIXEL(c2val);
-			PARSE_PIXEL(c1val);
+			c2val = parse_pixel(&br, c2val);
+			c1val = parse_pixel(&br, c1val);
 			PUT_PIXEL_PAIR;
 		}
 	}
@@ -26,73 +26,63 @@
 #include <stdlib.h>
 
 #include "libv4lconvert-priv.h"
+#include "bitreader.h"
 
 
 #define CLIP(x) ((x) < 0 ? 0 : ((x) > 0xff) ? 0xff : (x))
 
 
+/*
+ * The nibble codes, indexed by their first 4 bits: 0, 10, 110 and 1110, or
+ * 1111 followed by 4 more bits, of which only 0000 - 1011 are valid.
+ */
+static const struct {
+	unsigned char len;
+	unsigned char nibble;
+} nibble_codes[16] = {
+	{ 1, 8 }, { 1, 8 }, { 1, 8 }, { 1, 8 },
+	{ 1, 8 }, { 1, 8 }, { 1, 8 }, { 1, 8 },
+	{ 2, 7 }, { 2, 7 }, { 2, 7 }, { 2, 7 },
+	{ 3, 9 }, { 3, 9 }, { 4, 6 }, { 0, 0 }
+};
+
+static const unsigned char long_nibble_codes[12] = {
+	10, 11, 12, 13, 14, 15, 5, 4, 3, 2, 1, 0
+};
+
+static inline int sq905c_get_nibble(struct v4lconvert_bitreader *br)
+{
+	unsigned int bits = v4lconvert_br_peek(br, 8);
+
+	if (nibble_codes[bits >> 4].len) {
+		v4lconvert_br_skip(br, nibble_codes[bits >> 4].len);
+		return nibble_codes[bits >> 4].nibble;
+	}
+
+	bits &= 0x0f;
+	if (bits >= sizeof(long_nibble_codes))
+		return -1;
+	v4lconvert_br_skip(br, 8);
+	return long_nibble_codes[bits];
+}
+
 	static int
 sq905c_first_decompress(unsigned char *output, const unsigned char *input,
-		unsigned int outputsize)
+		int inputsize, unsigned int outputsize)
 {
-	unsigned char parity = 0;
-	unsigned char nibble_to_keep[2];
-	unsigned char temp1 = 0, temp2 = 0;
-	unsigned char input_byte;
-	unsigned char lookup = 0;
-	unsigned int i = 0;
-	unsigned int bytes_used = 0;
-	unsigned int bytes_done = 0;
-	unsigned int bit_counter = 8;
-	unsigned int cycles = 0;
-	int table[9] = { -1, 0, 2, 6, 0x0e, 0x0e, 0x0e, 0x0e, 0xfb};
-	unsigned char lookup_table[16] = {
-		0, 2, 6, 0x0e, 0xf0, 0xf1, 0xf2, 0xf3, 0xf4,
-		0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb
-	};
-	unsigned char translator[16] = {
-		8, 7, 9, 6, 10, 11, 12, 13,
-		14, 15, 5, 4, 3, 2, 1, 0
-	};
-
-	nibble_to_keep[0] = 0;
-	nibble_to_keep[1] = 0;
+	struct v4lconvert_bitreader br;
+	unsigned int bytes_done;
+	int hi, lo;
 
-	while (bytes_done < outputsize) {
-		while (parity < 2) {
-			while (lookup > table[cycles]) {
-				if (bit_counter == 8) {
-					input_byte = input[bytes_used];
-					bytes_used++;
-					temp1 = input_byte;
-					bit_counter = 0;
-				}
-				input_byte = temp1;
-				temp2 = (temp2 << 1) & 0xFF;
-				input_byte = input_byte >> 7;
-				temp2 = temp2 | input_byte;
-				temp1 = (temp1 << 1) & 0xFF;
-				bit_counter++;
-				cycles++;
-				if (cycles > 8)
-					return -1;
-				lookup = temp2 & 0xff;
-			}
-			temp2 = 0;
-			for (i = 0; i < 17; i++) {
-				if (i == 16)
-					return -1;
-				if (lookup == lookup_table[i]) {
-					nibble_to_keep[parity] = translator[i];
-					break;
-				}
-			}
-			cycles = 0;
-			parity++;
-		}
-		output[bytes_done] = (nibble_to_keep[0]<<4)|nibble_to_keep[1];
-		bytes_done++;
-		parity = 0;
+	v4lconvert_br_init(&br, input, inputsize);
+	for (bytes_done = 0; bytes_done < outputsize; bytes_done++) {
+		hi = sq905c_get_nibble(&br);
+		if (hi < 0)
+			return -1;
+		lo = sq905c_get_nibble(&br);
+		if (lo < 0)
+			return -1;
+		output[bytes_done] = (hi << 4) | lo;
 	}
 	return 0;
 }
@@ -199,8 +189,8 @@ sq905c_second_decompress(unsigned char *uncomp, unsigned char *in,
 	return 0;
 }
 
-void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
-		int width, int height)
+void v4lconvert_decode_sq905c(const unsigned char *src, int src_size,
+		unsigned char *dst, int width, int height)
 {
 	int size;
 	unsigned char *temp_data;
@@ -211,7 +201,7 @@ void v4lconvert_decode_sq905c(const unsigned char *src, unsigned char *dst,
 	temp_data = malloc(size);
 	if (!temp_data)
 		goto out;
-	sq905c_first_decompress(temp_data, raw, size);
+	sq905c_first_decompress(temp_data, raw, src_size - 0x50, size);
 	sq905c_second_decompress(dst, temp_data, width, height);
 out:
 	free(temp_data);
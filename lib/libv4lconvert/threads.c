@@ -0,0 +1,220 @@
+/*
+
+# Worker pool for splitting conversions of a single frame into stripes
+
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Lesser General Public License as published by
+# the Free Software Foundation; either version 2.1 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA  02110-1335  USA
+
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "libv4lconvert-priv.h"
+
+#define V4LCONVERT_MAX_THREADS 64
+
+/* Don't bother with splitting up a frame into stripes smaller than this */
+#define V4LCONVERT_MIN_STRIPE_ROWS 16
+
+struct v4lconvert_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	pthread_t workers[V4LCONVERT_MAX_THREADS];
+	int no_workers;
+	int quit;
+	/* Current job, protected by lock */
+	unsigned int generation;
+	v4lconvert_stripe_func func;
+	void *arg;
+	int rows;
+	int align;
+	int no_stripes;
+	int next_stripe;
+	int stripes_done;
+};
+
+static void v4lconvert_stripe_range(struct v4lconvert_pool *pool, int stripe,
+		int *start, int *end)
+{
+	int units = (pool->rows + pool->align - 1) / pool->align;
+
+	*start = (int)((long long)units * stripe / pool->no_stripes) * pool->align;
+	*end = (int)((long long)units * (stripe + 1) / pool->no_stripes) * pool->align;
+	if (*end > pool->rows)
+		*end = pool->rows;
+}
+
+/* Called with the lock held, returns with the lock held */
+static void v4lconvert_do_stripes(struct v4lconvert_pool *pool)
+{
+	while (pool->next_stripe < pool->no_stripes) {
+		int stripe = pool->next_stripe++;
+		int start, end;
+
+		v4lconvert_stripe_range(pool, stripe, &start, &end);
+		pthread_mutex_unlock(&pool->lock);
+		if (start < end)
+			pool->func(pool->arg, start, end);
+		pthread_mutex_lock(&pool->lock);
+		if (++pool->stripes_done == pool->no_stripes)
+			pthread_cond_signal(&pool->done_cond);
+	}
+}
+
+static void *v4lconvert_worker(void *arg)
+{
+	struct v4lconvert_pool *pool = arg;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		v4lconvert_do_stripes(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void v4lconvert_pool_destroy(struct v4lconvert_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->no_workers; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static struct v4lconvert_pool *v4lconvert_pool_create(int no_workers)
+{
+	struct v4lconvert_pool *pool = calloc(1, sizeof(*pool));
+
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (; pool->no_workers < no_workers; pool->no_workers++)
+		if (pthread_create(&pool->workers[pool->no_workers], NULL,
+				   v4lconvert_worker, pool))
+			break;
+
+	if (!pool->no_workers) {
+		v4lconvert_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+int v4lconvert_threads_init(struct v4lconvert_data *data, int threads)
+{
+	struct v4lconvert_pool *pool = NULL;
+
+	if (threads < 0) {
+		V4LCONVERT_ERR("invalid number of threads: %d\n", threads);
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > V4LCONVERT_MAX_THREADS + 1)
+		threads = V4LCONVERT_MAX_THREADS + 1;
+
+	if (threads == data->threads)
+		return 0;
+
+	/* The calling thread always does its share of the work */
+	if (threads > 1) {
+		pool = v4lconvert_pool_create(threads - 1);
+		if (!pool) {
+			V4LCONVERT_ERR("could not create conversion threads\n");
+			errno = ENOMEM;
+			return -1;
+		}
+		threads = pool->no_workers + 1;
+	}
+
+	v4lconvert_threads_cleanup(data);
+	data->pool = pool;
+	data->threads = threads;
+
+	return 0;
+}
+
+void v4lconvert_threads_cleanup(struct v4lconvert_data *data)
+{
+	if (data->pool)
+		v4lconvert_pool_destroy(data->pool);
+	data->pool = NULL;
+	data->threads = 1;
+}
+
+void v4lconvert_run_stripes(struct v4lconvert_data *data,
+		v4lconvert_stripe_func func, void *arg, int rows, int align)
+{
+	struct v4lconvert_pool *pool = data->pool;
+	int no_stripes;
+
+	if (align < 1)
+		align = 1;
+
+	no_stripes = data->threads;
+	if (no_stripes > rows / V4LCONVERT_MIN_STRIPE_ROWS)
+		no_stripes = rows / V4LCONVERT_MIN_STRIPE_ROWS;
+	if (no_stripes > rows / align)
+		no_stripes = rows / align;
+
+	if (!pool || no_stripes < 2) {
+		func(arg, 0, rows);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->rows = rows;
+	pool->align = align;
+	pool->no_stripes = no_stripes;
+	pool->next_stripe = 0;
+	pool->stripes_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+
+	v4lconvert_do_stripes(pool);
+	while (pool->stripes_done < pool->no_stripes)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
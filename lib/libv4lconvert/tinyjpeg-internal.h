@@ -47,8 +47,8 @@ struct jdec_private;
 
 #define HUFFMAN_TABLES	   4
 #define COMPONENTS	   3
-#define JPEG_MAX_WIDTH	   2048
-#define JPEG_MAX_HEIGHT	   2048
+#define JPEG_MAX_WIDTH	   4096
+#define JPEG_MAX_HEIGHT	   4096
 
 struct huffman_table {
 	/* Fast look up table, using HUFFMAN_HASH_NBITS bits we can have directly the symbol,
@@ -60,6 +60,12 @@ struct huffman_table {
 	 * IMPROVEME: Calculate if 256 value is enough to store all values
 	 */
 	uint16_t slowtable[16 - HUFFMAN_HASH_NBITS][256];
+	/* AC tables only: when the code and the coefficient bits which follow it
+	 * both fit in HUFFMAN_HASH_NBITS bits, this gives the decoded coefficient
+	 * (bits 16-31), the run of zeros before it (bits 8-15) and the total number
+	 * of bits used (bits 0-7). 0 if the slow path must be used.
+	 */
+	int32_t fast_ac[HUFFMAN_HASH_SIZE];
 };
 
 struct component {
@@ -118,6 +124,11 @@ struct jdec_private {
 	/* Temp buffers for multipass planar JPG -> RGB decoding */
 	int tmp_buf_y_size;
 	uint8_t *tmp_buf[COMPONENTS];
+
+	/* For decoding restart intervals in parallel on the worker threads */
+	struct v4lconvert_data *v4lconvert_data;
+	const unsigned char **rst_segments;
+	unsigned int rst_segments_size;
 };
 
 #define IDCT tinyjpeg_idct_float
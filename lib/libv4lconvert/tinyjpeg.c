@@ -134,6 +134,18 @@ static const unsigned char zigzag[64] = {
 	35, 36, 48, 49, 57, 58, 62, 63
 };
 
+/* Inverse of the above: natural order position of each zigzag index */
+static const unsigned char dezigzag[64] = {
+	0,  1,  8, 16,  9,  2,  3, 10,
+	17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
 /* Set up the standard Huffman tables (cf. JPEG standard section K.3) */
 /* IMPORTANT: these are only valid for 8-bit data precision! */
 static const unsigned char bits_dc_luminance[17] = {
@@ -366,10 +378,12 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	unsigned char size_val, count_0;
 
 	struct component *c = &priv->component_infos[component];
-	short int DCT[64];
+	const int32_t *fast_ac = c->AC_table->fast_ac;
+	short int *DCT = c->DCT;
+	int hcode, fast;
 
 	/* Initialize the DCT coef table */
-	memset(DCT, 0, sizeof(DCT));
+	memset(DCT, 0, sizeof(c->DCT));
 
 	/* DC coefficient decoding */
 	huff_code = get_next_huffman_code(priv, c->DC_table);
@@ -382,9 +396,19 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 	}
 
 
-	/* AC coefficient decoding */
+	/* AC coefficient decoding, the coefficients are stored dezigzaged */
 	j = 1;
 	while (j < 64) {
+		/* Most codes + coefficient bits fit in HUFFMAN_HASH_NBITS */
+		look_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, HUFFMAN_HASH_NBITS, hcode);
+		fast = fast_ac[hcode];
+		if (fast && j + ((fast >> 8) & 0xff) < 64) {
+			j += (fast >> 8) & 0xff;
+			skip_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, fast & 0xff);
+			DCT[dezigzag[j++]] = fast >> 16;
+			continue;
+		}
+
 		huff_code = get_next_huffman_code(priv, c->AC_table);
 
 		size_val = huff_code & 0xF;
@@ -398,7 +422,7 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 		} else {
 			j += count_0;	/* skip count_0 zeroes */
 			if (j < 64) {
-				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[j]);
+				get_nbits(priv->reservoir, priv->nbits_in_reservoir, priv->stream, size_val, DCT[dezigzag[j]]);
 				j++;
 			}
 		}
@@ -409,9 +433,6 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
 				"error: more than 63 AC components (%d) in huffman unit\n", (int)j);
 		longjmp(priv->jump_state, -EIO);
 	}
-
-	for (j = 0; j < 64; j++)
-		c->DCT[j] = DCT[zigzag[j]];
 }
 
 /*
@@ -420,6 +441,7 @@ static void process_Huffman_data_unit(struct jdec_private *priv, int component)
  * lookup will return the symbol if the code is less or equal than HUFFMAN_HASH_NBITS.
  * code_size will be used to known how many bits this symbol is encoded.
  * slowtable will be used when the first lookup didn't give the result.
+ * fast_ac directly gives the coefficient for short AC code + value pairs.
  */
 static int build_huffman_table(struct jdec_private *priv, const unsigned char *bits, const unsigned char *vals, struct huffman_table *table)
 {
@@ -499,6 +521,33 @@ static int build_huffman_table(struct jdec_private *priv, const unsigned char *b
 	for (i = 0; i < (16 - HUFFMAN_HASH_NBITS); i++)
 		table->slowtable[i][slowtable_used[i]] = 0;
 
+	/*
+	 * Build the fast AC table, decoding the coefficient bits following the
+	 * code the same way get_nbits does.
+	 */
+	for (i = 0; i < HUFFMAN_HASH_SIZE; i++) {
+		int run, size_val, value;
+
+		table->fast_ac[i] = 0;
+		if (table->lookup[i] < 0)
+			continue;
+
+		val = table->lookup[i];
+		code_size = table->code_size[val];
+		run = val >> 4;
+		size_val = val & 0xf;
+		if (size_val == 0 || code_size + size_val > HUFFMAN_HASH_NBITS)
+			continue;
+
+		value = (i >> (HUFFMAN_HASH_NBITS - code_size - size_val)) &
+			((1 << size_val) - 1);
+		if (value < (1 << (size_val - 1)))
+			value += 1 - (1 << size_val);
+
+		table->fast_ac[i] = value * 65536 + (run << 8) +
+			code_size + size_val;
+	}
+
 	return 0;
 }
 
@@ -1980,6 +2029,9 @@ static int parse_JFIF(struct jdec_private *priv, const unsigned char *stream)
 	int dht_marker_found = 0;
 	const unsigned char *next_chunck;
 
+	/* Unlike the tables, the restart interval is per image */
+	priv->restart_interval = 0;
+
 	/* Parse marker */
 	while (!sos_marker_found) {
 		if (*stream++ != 0xff)
@@ -2100,7 +2152,9 @@ void tinyjpeg_free(struct jdec_private *priv)
 		priv->tmp_buf[i] = NULL;
 	}
 	priv->tmp_buf_y_size = 0;
-	free(priv->stream_filtered);
+	v4lconvert_free_buffer(priv->stream_filtered,
+			       priv->stream_filtered_bufsize);
+	free(priv->rst_segments);
 	free(priv);
 }
 
@@ -2236,6 +2290,128 @@ kernel: 0xff 0xff 0x00 0xff 0x96, and we skip one unknown byte */
  *
  * Note: components will be automaticaly allocated if no memory is attached.
  */
+/*
+ * When the JPEG has restart markers, each restart interval can be decoded
+ * independently of the others, allowing us to spread the decoding of a
+ * single frame over the libv4lconvert worker threads.
+ */
+struct segment_job {
+	struct jdec_private *priv;
+	decode_MCU_fct decode_MCU;
+	convert_colorspace_fct convert_to_pixfmt;
+	unsigned int mcus_per_row, mcus;
+	unsigned int bytes_per_blocklines[3], bytes_per_mcu[3];
+	int error;
+};
+
+/* Find the start of all restart intervals, returns -1 if they are not all
+   there, in which case the normal sequential decoding is used */
+static int find_rst_segments(struct jdec_private *priv, unsigned int segments)
+{
+	const unsigned char *stream = priv->stream;
+	const unsigned char *end = priv->stream_end - 1;
+	unsigned int found = 1;
+
+	if (priv->rst_segments_size < segments) {
+		const unsigned char **new_segments;
+
+		new_segments = realloc(priv->rst_segments,
+				       segments * sizeof(*new_segments));
+		if (!new_segments)
+			return -1;
+		priv->rst_segments = new_segments;
+		priv->rst_segments_size = segments;
+	}
+
+	priv->rst_segments[0] = stream;
+	while (found < segments) {
+		if (stream >= end)
+			return -1;
+		stream = memchr(stream, 0xff, end - stream);
+		if (!stream)
+			return -1;
+		/* Skip any padding ff byte (this is normal) */
+		while (stream < end && stream[1] == 0xff)
+			stream++;
+		if (stream >= end)
+			return -1;
+		stream++;
+		if (*stream == 0x00)
+			continue;
+		if (*stream != RST + ((found - 1) & 7))
+			return -1;
+		priv->rst_segments[found++] = ++stream;
+	}
+
+	return 0;
+}
+
+static void decode_segments(void *arg, int start, int end)
+{
+	struct segment_job *job = arg;
+	struct jdec_private *priv;
+	unsigned int mcu, last, x, y, i;
+	int segment;
+
+	priv = malloc(sizeof(*priv));
+	if (!priv) {
+		if (!__atomic_exchange_n(&job->error, 1, __ATOMIC_RELAXED))
+			snprintf(job->priv->error_string,
+				 sizeof(job->priv->error_string),
+				 "Out of memory!\n");
+		return;
+	}
+	memcpy(priv, job->priv, sizeof(*priv));
+
+	if (setjmp(priv->jump_state)) {
+		if (!__atomic_exchange_n(&job->error, 1, __ATOMIC_RELAXED))
+			memcpy(job->priv->error_string, priv->error_string,
+			       sizeof(priv->error_string));
+		free(priv);
+		return;
+	}
+
+	for (segment = start; segment < end; segment++) {
+		priv->stream = job->priv->rst_segments[segment];
+		resync(priv);
+
+		mcu = segment * priv->restart_interval;
+		last = mcu + priv->restart_interval;
+		if (last > job->mcus)
+			last = job->mcus;
+		for (; mcu < last; mcu++) {
+			x = mcu % job->mcus_per_row;
+			y = mcu / job->mcus_per_row;
+			for (i = 0; i < COMPONENTS; i++)
+				priv->plane[i] = priv->components[i] +
+					y * job->bytes_per_blocklines[i] +
+					x * job->bytes_per_mcu[i];
+			job->decode_MCU(priv);
+			job->convert_to_pixfmt(priv);
+		}
+	}
+
+	free(priv);
+}
+
+/* Returns 1 if the JPEG cannot be decoded in parallel */
+static int decode_parallel(struct jdec_private *priv, struct segment_job *job)
+{
+	unsigned int segments;
+
+	segments = (job->mcus + priv->restart_interval - 1) /
+		   priv->restart_interval;
+	if (segments < 2 || find_rst_segments(priv, segments))
+		return 1;
+
+	job->priv = priv;
+	job->error = 0;
+	v4lconvert_run_stripes(priv->v4lconvert_data, decode_segments, job,
+			       segments, 1);
+
+	return job->error ? -1 : 0;
+}
+
 int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 {
 	unsigned int x, y, xstride_by_mcu, ystride_by_mcu;
@@ -2364,6 +2540,25 @@ int tinyjpeg_decode(struct jdec_private *priv, int pixfmt)
 	bytes_per_mcu[1] *= xstride_by_mcu / 8;
 	bytes_per_mcu[2] *= xstride_by_mcu / 8;
 
+	if (priv->restart_interval > 0 && priv->v4lconvert_data &&
+	    priv->v4lconvert_data->threads > 1 &&
+	    !(priv->flags & TINYJPEG_FLAGS_PIXART_JPEG)) {
+		struct segment_job job;
+		int result;
+
+		job.decode_MCU = decode_MCU;
+		job.convert_to_pixfmt = convert_to_pixfmt;
+		job.mcus_per_row = (priv->width + xstride_by_mcu - 1) / xstride_by_mcu;
+		job.mcus = job.mcus_per_row * (priv->height / ystride_by_mcu);
+		memcpy(job.bytes_per_blocklines, bytes_per_blocklines,
+		       sizeof(bytes_per_blocklines));
+		memcpy(job.bytes_per_mcu, bytes_per_mcu, sizeof(bytes_per_mcu));
+
+		result = decode_parallel(priv, &job);
+		if (result != 1)
+			return result;
+	}
+
 	/* Just the decode the image by macroblock (size is 8x8, 8x16, or 16x16) */
 	for (y = 0; y < priv->height / ystride_by_mcu; y++) {
 		//trace("Decoding row %d\n", y);
@@ -2668,3 +2863,13 @@ int tinyjpeg_set_flags(struct jdec_private *priv, int flags)
 	return oldflags;
 }
 
+/**
+ * Allow decoding JPEGs with restart markers on the worker threads of the
+ * passed in libv4lconvert instance.
+ */
+void tinyjpeg_set_v4lconvert_data(struct jdec_private *priv,
+				  struct v4lconvert_data *data)
+{
+	priv->v4lconvert_data = data;
+}
+
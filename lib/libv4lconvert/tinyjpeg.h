@@ -40,6 +40,7 @@ extern "C" {
 #endif
 
 struct jdec_private;
+struct v4lconvert_data;
 
 /* Flags that can be set by any applications */
 #define TINYJPEG_FLAGS_MJPEG_TABLE	(1<<1)
@@ -65,6 +66,8 @@ int tinyjpeg_get_components(struct jdec_private *priv, unsigned char **component
 int tinyjpeg_set_components(struct jdec_private *priv, unsigned char **components,
 				unsigned int ncomponents);
 int tinyjpeg_set_flags(struct jdec_private *priv, int flags);
+void tinyjpeg_set_v4lconvert_data(struct jdec_private *priv,
+				  struct v4lconvert_data *data);
 
 #ifdef __cplusplus
 }
@@ -3,12 +3,17 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <algorithm>
 #include <sstream>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "cec-compliance.h"
@@ -87,6 +92,11 @@ enum Option {
 	OptSkipTestStandbyResume,
 
 	OptVersion,
+	OptDevices,
+	OptFuzzSeed,
+	OptFuzzDepth,
+	OptFuzzCount,
+	OptFuzzCorpus,
 	OptLast = 256
 };
 
@@ -107,6 +117,7 @@ time_t long_timeout = 60;
 
 static struct option long_options[] = {
 	{"device", required_argument, nullptr, OptSetDevice},
+	{"devices", required_argument, nullptr, OptDevices},
 	{"adapter", required_argument, nullptr, OptSetAdapter},
 	{"driver", required_argument, nullptr, OptSetDriver},
 	{"help", no_argument, nullptr, OptHelp},
@@ -129,6 +140,10 @@ static struct option long_options[] = {
 
 	{"test-adapter", no_argument, nullptr, OptTestAdapter},
 	{"test-fuzzing", no_argument, nullptr, OptTestFuzzing},
+	{"fuzz-seed", required_argument, nullptr, OptFuzzSeed},
+	{"fuzz-depth", required_argument, nullptr, OptFuzzDepth},
+	{"fuzz-count", required_argument, nullptr, OptFuzzCount},
+	{"fuzz-corpus", required_argument, nullptr, OptFuzzCorpus},
 	{"test-core", no_argument, nullptr, OptTestCore},
 	{"test-audio-rate-control", no_argument, nullptr, OptTestAudioRateControl},
 	{"test-audio-return-channel-control", no_argument, nullptr, OptTestARCControl},
@@ -181,6 +196,9 @@ static void usage()
 	printf("Usage:\n"
 	       "  -d, --device <dev>   Use device <dev> instead of /dev/cec0\n"
 	       "                       If <dev> starts with a digit, then /dev/cec<dev> is used.\n"
+	       "  --devices <dev>[,<dev>]*|all\n"
+	       "                       Test the given devices, or all devices, at the same time and\n"
+	       "                       show a report for all of them. Each device is given as for -d.\n"
 	       "  -D, --driver <driver>    Use a cec device with this driver name\n"
 	       "  -a, --adapter <adapter>  Use a cec device with this adapter name\n"
 	       "  -r, --remote [<la>]  As initiator test the remote logical address or all LAs if no LA was given\n"
@@ -191,6 +209,11 @@ static void usage()
 	       "\n"
 	       "  -A, --test-adapter                  Test the CEC adapter API\n"
 	       "  -F, --test-fuzzing                  Test by fuzzing CEC messages\n"
+	       "  --fuzz-seed <seed>                  Seed the fuzzing message generator (default: the time)\n"
+	       "  --fuzz-depth <n>                    Keep up to <n> fuzzing messages in flight (default 1, max 16)\n"
+	       "  --fuzz-count <n>                    Stop fuzzing after <n> messages (default: run forever)\n"
+	       "  --fuzz-corpus <file>                Replay the messages in <file> first, and store there\n"
+	       "                                      the messages that reached new outcomes\n"
 	       "  --test-core                         Test the core functionality\n"
 	       "\n"
 	       "By changing --test to --skip-test in the following options you can skip tests\n"
@@ -645,20 +668,29 @@ retry:
 		goto retry;
 	}
 
-	if (res || !(msg->tx_status & CEC_TX_STATUS_OK))
+	if (res)
+		return false;
+	return transmit_status(node, &original_msg, msg);
+}
+
+bool transmit_status(struct node *node, const struct cec_msg *original_msg,
+		     struct cec_msg *msg, bool check_threshold)
+{
+	if (!(msg->tx_status & CEC_TX_STATUS_OK))
 		return false;
 
-	if (((msg->rx_status & CEC_RX_STATUS_OK) || (msg->rx_status & CEC_RX_STATUS_FEATURE_ABORT))
+	if (check_threshold &&
+	    ((msg->rx_status & CEC_RX_STATUS_OK) || (msg->rx_status & CEC_RX_STATUS_FEATURE_ABORT))
 	    && response_time_ms(msg) > reply_threshold)
 		warn("Waited %4ums for %s to msg %s.\n",
 		     response_time_ms(msg),
 		     (msg->rx_status & CEC_RX_STATUS_OK) ? "reply" : "Feature Abort",
-		     opcode2s(&original_msg).c_str());
+		     opcode2s(original_msg).c_str());
 
 	if (!cec_msg_status_is_abort(msg))
 		return true;
 
-	if (cec_msg_is_broadcast(&original_msg)) {
+	if (cec_msg_is_broadcast(original_msg)) {
 		fail("Received Feature Abort in reply to broadcast message\n");
 		return false;
 	}
@@ -687,7 +719,7 @@ retry:
 		break;
 	}
 	info("Opcode %s was replied to with Feature Abort [%s]\n",
-	     opcode2s(&original_msg).c_str(), reason);
+	     opcode2s(original_msg).c_str(), reason);
 
 	return true;
 }
@@ -887,15 +919,222 @@ static void topology_probe_device(struct node *node, unsigned i, unsigned la)
 	}
 }
 
+static std::string device_name(const char *name)
+{
+	std::string device = name;
+
+	if (device[0] >= '0' && device[0] <= '9' && device.length() <= 3)
+		device = std::string("/dev/cec") + name;
+	return device;
+}
+
+static bool cmp_device_names(const std::string &a, const std::string &b)
+{
+	/* /dev/cec10 goes after /dev/cec9 */
+	if (a.length() != b.length())
+		return a.length() < b.length();
+	return a < b;
+}
+
+static std::vector<std::string> parse_devices(const char *arg)
+{
+	std::vector<std::string> devices;
+
+	if (!strcmp(arg, "all")) {
+		struct dirent *ep;
+		DIR *dp;
+
+		dp = opendir("/dev");
+		if (dp == nullptr) {
+			perror("Couldn't open the directory");
+			return devices;
+		}
+		while ((ep = readdir(dp)))
+			if (!memcmp(ep->d_name, "cec", 3) && isdigit(ep->d_name[3]) &&
+			    ep->d_type != DT_LNK)
+				devices.push_back(std::string("/dev/") + ep->d_name);
+		closedir(dp);
+		std::sort(devices.begin(), devices.end(), cmp_device_names);
+		return devices;
+	}
+
+	std::stringstream ss(arg);
+	std::string name;
+
+	while (std::getline(ss, name, ','))
+		if (!name.empty())
+			devices.push_back(device_name(name.c_str()));
+	return devices;
+}
+
+/*
+ * The results of a device tested by a child process of test_devices().
+ * They are stored when the child exits, in memory shared with the parent.
+ */
+struct device_result {
+	bool done;
+	int tests_total;
+	int tests_ok;
+	unsigned warnings;
+};
+
+static struct device_result *cur_result;
+
+static void store_device_result()
+{
+	cur_result->tests_total = tests_total;
+	cur_result->tests_ok = tests_ok;
+	cur_result->warnings = warnings;
+	cur_result->done = true;
+}
+
+/*
+ * Each device is on its own CEC bus, so the devices can be tested at the
+ * same time, each by a child process. The output of each child is shown
+ * in the order of the devices, as soon as the child and the ones before it
+ * are done, followed by a summary for all devices.
+ *
+ * This returns the device to test in the child processes, while the parent
+ * exits once all are done.
+ */
+static std::string test_devices(const std::vector<std::string> &devices)
+{
+	unsigned num = devices.size();
+	std::vector<std::string> output(num);
+	std::vector<pid_t> pids(num);
+	std::vector<int> fds(num, -1);
+	std::vector<int> status(num);
+	struct device_result *results;
+	unsigned running = num;
+	unsigned shown = 0;
+	int total = 0, ok = 0;
+	unsigned warns = 0;
+	bool failed = false;
+
+	results = static_cast<struct device_result *>(mmap(nullptr, num * sizeof(*results),
+							    PROT_READ | PROT_WRITE,
+							    MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+	if (results == MAP_FAILED) {
+		perror("mmap");
+		std::exit(EXIT_FAILURE);
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+	for (unsigned i = 0; i < num; i++) {
+		int p[2];
+
+		if (pipe(p)) {
+			perror("pipe");
+			std::exit(EXIT_FAILURE);
+		}
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("fork");
+			std::exit(EXIT_FAILURE);
+		}
+		if (pids[i] == 0) {
+			for (unsigned j = 0; j < i; j++)
+				close(fds[j]);
+			close(p[0]);
+			dup2(p[1], STDOUT_FILENO);
+			dup2(p[1], STDERR_FILENO);
+			close(p[1]);
+			/* Keep the order of the lines written to stdout and stderr */
+			setvbuf(stdout, nullptr, _IOLBF, 0);
+			cur_result = &results[i];
+			atexit(store_device_result);
+			return devices[i];
+		}
+		close(p[1]);
+		fds[i] = p[0];
+	}
+
+	while (running) {
+		std::vector<struct pollfd> pfds;
+		std::vector<unsigned> idx;
+
+		for (unsigned i = 0; i < num; i++) {
+			if (fds[i] < 0)
+				continue;
+			struct pollfd pfd = { fds[i], POLLIN, 0 };
+
+			pfds.push_back(pfd);
+			idx.push_back(i);
+		}
+		if (poll(pfds.data(), pfds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			std::exit(EXIT_FAILURE);
+		}
+		for (unsigned p = 0; p < pfds.size(); p++) {
+			unsigned i = idx[p];
+			char buf[4096];
+			ssize_t n;
+
+			if (!pfds[p].revents)
+				continue;
+			n = read(fds[i], buf, sizeof(buf));
+			if (n > 0) {
+				output[i].append(buf, n);
+				continue;
+			}
+			if (n < 0 && errno == EINTR)
+				continue;
+			close(fds[i]);
+			fds[i] = -1;
+			waitpid(pids[i], &status[i], 0);
+			running--;
+		}
+		while (shown < num && fds[shown] < 0) {
+			if (shown)
+				printf("\n");
+			fwrite(output[shown].data(), 1, output[shown].size(), stdout);
+			fflush(stdout);
+			output[shown].clear();
+			shown++;
+		}
+	}
+
+	printf("\nSummary:\n");
+	for (unsigned i = 0; i < num; i++) {
+		const struct device_result &res = results[i];
+
+		if (!WIFEXITED(status[i]) || WEXITSTATUS(status[i]))
+			failed = true;
+		if (!res.done) {
+			if (WIFSIGNALED(status[i]))
+				printf("\t%s: killed by signal %d\n", devices[i].c_str(),
+				       WTERMSIG(status[i]));
+			else
+				printf("\t%s: did not complete\n", devices[i].c_str());
+			continue;
+		}
+		printf("\t%s: Total: %d, Succeeded: %d, Failed: %d, Warnings: %d%s\n",
+		       devices[i].c_str(), res.tests_total, res.tests_ok,
+		       res.tests_total - res.tests_ok, res.warnings,
+		       WIFEXITED(status[i]) && WEXITSTATUS(status[i]) ? " (exited with an error)" : "");
+		total += res.tests_total;
+		ok += res.tests_ok;
+		warns += res.warnings;
+	}
+	printf("Total for %u devices: %d, Succeeded: %d, Failed: %d, Warnings: %d\n",
+	       num, total, ok, total - ok, warns);
+	std::exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 int main(int argc, char **argv)
 {
 	std::string device;
 	const char *driver = nullptr;
 	const char *adapter = nullptr;
+	std::vector<std::string> devices;
 	char short_options[26 * 2 * 3 + 1];
 	int remote_la = -1;
 	bool test_remote = false;
 	unsigned test_tags = 0;
+	struct fuzz_options fuzz_opts = {};
 	int idx = 0;
 	int fd = -1;
 	int ch;
@@ -903,6 +1142,7 @@ int main(int argc, char **argv)
 	const char *env_media_apps_color = getenv("MEDIA_APPS_COLOR");
 
 	srandom(time(nullptr));
+	fuzz_opts.seed = time(nullptr);
 	if (!env_media_apps_color || !strcmp(env_media_apps_color, "auto"))
 		show_colors = isatty(STDOUT_FILENO);
 	else if (!strcmp(env_media_apps_color, "always"))
@@ -954,12 +1194,13 @@ int main(int argc, char **argv)
 			usage();
 			return 0;
 		case OptSetDevice:
-			device = optarg;
-			if (device[0] >= '0' && device[0] <= '9' && device.length() <= 3) {
-				static char newdev[20];
-
-				sprintf(newdev, "/dev/cec%s", optarg);
-				device = newdev;
+			device = device_name(optarg);
+			break;
+		case OptDevices:
+			devices = parse_devices(optarg);
+			if (devices.empty()) {
+				fprintf(stderr, "--devices: no CEC devices found\n");
+				std::exit(EXIT_FAILURE);
 			}
 			break;
 		case OptSetDriver:
@@ -974,6 +1215,18 @@ int main(int argc, char **argv)
 		case OptTimeout:
 			long_timeout = strtoul(optarg, nullptr, 0);
 			break;
+		case OptFuzzSeed:
+			fuzz_opts.seed = strtoul(optarg, nullptr, 0);
+			break;
+		case OptFuzzDepth:
+			fuzz_opts.depth = strtoul(optarg, nullptr, 0);
+			break;
+		case OptFuzzCount:
+			fuzz_opts.count = strtoul(optarg, nullptr, 0);
+			break;
+		case OptFuzzCorpus:
+			fuzz_opts.corpus = optarg;
+			break;
 		case OptColor:
 			if (!strcmp(optarg, "always"))
 				show_colors = true;
@@ -1047,6 +1300,20 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (options[OptDevices]) {
+		if (!device.empty() || driver || adapter) {
+			fprintf(stderr, "--devices cannot be combined with -d, -D or -a\n");
+			usage();
+			return 1;
+		}
+		if (options[OptInteractive]) {
+			fprintf(stderr, "--devices cannot be combined with --interactive\n");
+			usage();
+			return 1;
+		}
+		device = test_devices(devices);
+	}
+
 	if (device.empty() && (driver || adapter)) {
 		device = cec_device_find(driver, adapter);
 		if (device.empty()) {
@@ -1276,7 +1543,7 @@ int main(int argc, char **argv)
 	printf("\n");
 
 	if (options[OptTestFuzzing] && remote_la >= 0)
-		std::exit(testFuzzing(node, laddrs.log_addr[0], remote_la));
+		std::exit(testFuzzing(node, laddrs.log_addr[0], remote_la, fuzz_opts));
 
 	unsigned remote_la_mask = node.remote_la_mask;
 
@@ -392,6 +392,15 @@ static inline unsigned response_time_ms(const struct cec_msg *msg)
 bool transmit_timeout(struct node *node, struct cec_msg *msg,
 		      unsigned timeout = 2000);
 
+/*
+ * Checks the result of a transmit, msg is the result and original_msg the
+ * message as it was transmitted. Returns true if the message was sent.
+ * If check_threshold is set, it warns if the reply took longer than
+ * reply_threshold.
+ */
+bool transmit_status(struct node *node, const struct cec_msg *original_msg,
+		     struct cec_msg *msg, bool check_threshold = true);
+
 static inline bool transmit(struct node *node, struct cec_msg *msg)
 {
 	return transmit_timeout(node, msg, 0);
@@ -436,7 +445,15 @@ void testAdapter(struct node &node, struct cec_log_addrs &laddrs,
 		 const char *device);
 
 // CEC fuzzing test
-int testFuzzing(struct node &node, unsigned me, unsigned la);
+struct fuzz_options {
+	unsigned seed;		// seed of the message generator
+	unsigned depth;		// number of messages in flight
+	unsigned count;		// number of messages to send, 0 means forever
+	const char *corpus;	// corpus file, or nullptr
+};
+
+int testFuzzing(struct node &node, unsigned me, unsigned la,
+		const struct fuzz_options &opts);
 
 // CEC core tests
 int testCore(struct node *node);
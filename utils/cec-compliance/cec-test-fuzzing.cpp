@@ -3,39 +3,98 @@
  * Copyright 2019 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <cerrno>
+#include <csignal>
+#include <cstring>
 #include <ctime>
+#include <map>
 #include <string>
+#include <vector>
 
+#include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/select.h>
 
 #include "cec-compliance.h"
 
-int testFuzzing(struct node &node, unsigned me, unsigned la)
-{
-	printf("test fuzzing CEC local LA %d (%s) to remote LA %d (%s):\n\n",
-	       me, cec_la2s(me), la, cec_la2s(la));
+/*
+ * Fuzzing
+ *
+ * Messages with a random opcode and random operands are sent to the remote
+ * device, which should either Feature Abort them or ignore them. The
+ * messages come from a generator seeded with --fuzz-seed, so a run can be
+ * repeated exactly.
+ *
+ * Most of the time is spent waiting for replies that never come. With
+ * --fuzz-depth several messages are kept in flight: the kernel matches
+ * a Feature Abort to the outstanding message with the aborted opcode,
+ * so only one message per opcode is outstanding at a time.
+ *
+ * The outcome of each message (timed out or the Feature Abort reason) is
+ * recorded per opcode, as well as per opcode, first operand range and
+ * outcome for the opcodes the device recognizes. The messages that reach
+ * a new combination form the corpus: with --fuzz-corpus it is replayed
+ * first, and rewritten with only the messages that still reach something
+ * new followed by the new ones.
+ */
 
-	if (node.remote[la].in_standby) {
-		announce("The remote device is in standby. It should be powered on when fuzzing. Aborting.");
-		return 0;
-	}
-	if (!node.remote[la].has_power_status) {
-		announce("The device didn't support Give Device Power Status.");
-		announce("Assuming that the device is powered on.");
-	}
+#define FUZZ_TIMEOUT_MS	1200
+/*
+ * Feature Abort is opcode 0, and a reply of 0 means that no reply is waited
+ * for. So wait for <Abort> instead, which is never sent as a reply: the
+ * wait still ends when the message is Feature Aborted.
+ */
+#define FUZZ_REPLY	CEC_MSG_ABORT
+#define FUZZ_MAX_DEPTH	16
+// outcomes: timed out, or the Feature Abort reason + 1
+#define FUZZ_OUTCOMES	(CEC_OP_ABORT_UNDETERMINED + 2)
+#define FUZZ_RANGES	16
+// id of the CEC Version query used to check that the device is alive
+#define FUZZ_ALIVE_ID	(~0U)
+
+struct fuzz_msg {
+	unsigned id;
+	struct cec_msg sent;	// the message as it was sent
+	struct cec_msg msg;	// the result
+	bool ok;		// result of transmit_status()
+};
+
+struct fuzz_coverage {
+	unsigned msgs;
+	unsigned outcome_cnt[256][FUZZ_OUTCOMES];
+	bool lengths[256][CEC_MAX_MSG_SIZE + 1];
+	bool ranges[256][FUZZ_RANGES];
+	bool range_outcomes[256][FUZZ_RANGES][FUZZ_OUTCOMES];
+};
+
+static __u64 fuzz_state;
+static volatile bool fuzz_stop;
 
-	unsigned int cnt = 0;
+static void fuzz_sigint(int)
+{
+	fuzz_stop = true;
+}
+
+// xorshift64*, independent of random() so the sequence only depends on the seed
+static __u32 fuzz_random()
+{
+	fuzz_state ^= fuzz_state >> 12;
+	fuzz_state ^= fuzz_state << 25;
+	fuzz_state ^= fuzz_state >> 27;
+	return (fuzz_state * 0x2545f4914f6cdd1dULL) >> 32;
+}
 
+static void fuzz_generate(struct node &node, unsigned me, unsigned la,
+			  struct cec_msg &msg)
+{
 	for (;;) {
-		cec_msg msg;
-		__u8 cmd;
 		unsigned offset = 2;
 
 		cec_msg_init(&msg, me, la);
-		msg.msg[1] = cmd = random() & 0xff;
+		msg.msg[1] = fuzz_random() & 0xff;
 		if (msg.msg[1] == CEC_MSG_STANDBY)
 			continue;
-		msg.len = (random() & 0xf) + 2;
+		msg.len = (fuzz_random() & 0xf) + 2;
 		if (msg.msg[1] == CEC_MSG_VENDOR_COMMAND_WITH_ID &&
 		    node.remote[la].vendor_id != CEC_VENDOR_ID_NONE) {
 			msg.len += 3;
@@ -46,62 +105,412 @@ int testFuzzing(struct node &node, unsigned me, unsigned la)
 		}
 		if (msg.len > CEC_MAX_MSG_SIZE)
 			continue;
+		for (unsigned i = offset; i < msg.len; i++)
+			msg.msg[i] = fuzz_random() & 0xff;
+		return;
+	}
+}
 
-		const char *name = cec_opcode2s(msg.msg[1]);
+/*
+ * The corpus has one message per line: the opcode and the operands as
+ * hex bytes. Empty lines and lines starting with '#' are skipped.
+ */
+static void corpus_read(const char *fname, unsigned me, unsigned la,
+			std::vector<struct cec_msg> &corpus)
+{
+	FILE *f = fopen(fname, "r");
+	char line[256];
 
-		printf("Send message %u:", cnt);
-		for (unsigned int i = 0; i < offset; i++)
-			printf(" %02x", msg.msg[i]);
-		for (unsigned int i = offset; i < msg.len; i++) {
-			msg.msg[i] = random() & 0xff;
-			printf(" %02x", msg.msg[i]);
-		}
-		if (name)
-			printf(" (%s)", name);
-		printf(": ");
-		msg.reply = CEC_MSG_FEATURE_ABORT;
-		fail_on_test(!transmit_timeout(&node, &msg, 1200));
-		printf("%s", timed_out(&msg) ? "Timed out" : "Feature Abort");
-
-		if (cec_msg_status_is_abort(&msg)) {
-			__u8 abort_msg, reason;
-
-			cec_ops_feature_abort(&msg, &abort_msg, &reason);
-			fail_on_test(abort_msg != cmd);
-			switch (reason) {
-			case CEC_OP_ABORT_UNRECOGNIZED_OP:
-				printf(" (Unrecognized Op)");
-				break;
-			case CEC_OP_ABORT_UNDETERMINED:
-				printf(" (Undetermined)");
-				break;
-			case CEC_OP_ABORT_INVALID_OP:
-				printf(" (Invalid Op)");
-				break;
-			case CEC_OP_ABORT_NO_SOURCE:
-				printf(" (No Source)");
-				break;
-			case CEC_OP_ABORT_REFUSED:
-				printf(" (Refused)");
-				break;
-			case CEC_OP_ABORT_INCORRECT_MODE:
-				printf(" (Incorrect Mode)");
-				break;
-			default:
-				printf(" (0x%02x)\n", reason);
-				fail("Invalid reason\n");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		struct cec_msg msg;
+		char *p = line;
+
+		cec_msg_init(&msg, me, la);
+		while (msg.len < CEC_MAX_MSG_SIZE) {
+			char *end;
+			unsigned long v = strtoul(p, &end, 16);
+
+			if (end == p || v > 0xff)
 				break;
-			}
+			msg.msg[msg.len++] = v;
+			p = end;
 		}
-		printf("\n");
-		if (++cnt % 10)
+		if (msg.len > 1 && msg.msg[1] != CEC_MSG_STANDBY)
+			corpus.push_back(msg);
+	}
+	fclose(f);
+}
+
+static void corpus_write(const char *fname, const std::vector<struct cec_msg> &corpus,
+			 const std::vector<struct cec_msg> &replay, unsigned replayed)
+{
+	std::string tmp = std::string(fname) + ".tmp";
+	FILE *f = fopen(tmp.c_str(), "w");
+
+	if (!f) {
+		fprintf(stderr, "Failed to write %s: %s\n", tmp.c_str(), strerror(errno));
+		return;
+	}
+	// Keep the messages that weren't replayed yet
+	for (unsigned j = 0; j < corpus.size() + replay.size() - replayed; j++) {
+		const struct cec_msg &msg = j < corpus.size() ?
+			corpus[j] : replay[replayed + j - corpus.size()];
+
+		for (unsigned i = 1; i < msg.len; i++)
+			fprintf(f, "%s%02x", i > 1 ? " " : "", msg.msg[i]);
+		fprintf(f, "\n");
+	}
+	if (fclose(f) || rename(tmp.c_str(), fname))
+		fprintf(stderr, "Failed to write %s: %s\n", fname, strerror(errno));
+}
+
+// Returns true if the message reached a combination not seen before
+static bool coverage_add(struct fuzz_coverage &cov, const struct cec_msg &msg,
+			 unsigned outcome)
+{
+	__u8 cmd = msg.msg[1];
+	unsigned range = msg.len > 2 ? msg.msg[2] / (256 / FUZZ_RANGES) : 0;
+	bool is_new = !cov.outcome_cnt[cmd][outcome];
+
+	cov.msgs++;
+	cov.outcome_cnt[cmd][outcome]++;
+	cov.lengths[cmd][msg.len] = true;
+	cov.ranges[cmd][range] = true;
+	if (outcome != 1 + CEC_OP_ABORT_UNRECOGNIZED_OP &&
+	    !cov.range_outcomes[cmd][range][outcome]) {
+		cov.range_outcomes[cmd][range][outcome] = true;
+		is_new = true;
+	}
+	return is_new;
+}
+
+static void coverage_show(const struct fuzz_coverage &cov, int corpus_size)
+{
+	static const char *outcomes[FUZZ_OUTCOMES] = {
+		"timeout", "unrec", "mode", "no src", "invalid", "refused", "undet",
+	};
+	unsigned opcodes = 0, recognized = 0, lengths = 0, ranges = 0;
+
+	for (unsigned cmd = 0; cmd < 256; cmd++) {
+		unsigned cnt = 0;
+
+		for (unsigned o = 0; o < FUZZ_OUTCOMES; o++)
+			cnt += cov.outcome_cnt[cmd][o];
+		if (!cnt)
 			continue;
-		if (la == CEC_LOG_ADDR_BROADCAST)
+		opcodes++;
+		if (cnt != cov.outcome_cnt[cmd][1 + CEC_OP_ABORT_UNRECOGNIZED_OP])
+			recognized++;
+		for (unsigned i = 2; i <= CEC_MAX_MSG_SIZE; i++)
+			lengths += cov.lengths[cmd][i];
+		for (unsigned i = 0; i < FUZZ_RANGES; i++)
+			ranges += cov.ranges[cmd][i];
+	}
+
+	printf("\nFuzzing coverage:\n");
+	printf("\tMessages:        %u\n", cov.msgs);
+	printf("\tOpcodes:         %u, not Unrecognized Op: %u\n", opcodes, recognized);
+	printf("\tLengths:         %u of %u\n", lengths, opcodes * (CEC_MAX_MSG_SIZE - 1));
+	printf("\tOperand ranges:  %u of %u\n", ranges, opcodes * FUZZ_RANGES);
+	if (corpus_size >= 0)
+		printf("\tCorpus:          %d messages\n", corpus_size);
+	if (!recognized)
+		return;
+
+	printf("\n\t%-40s", "Outcomes if not Unrecognized Op");
+	for (unsigned o = 0; o < FUZZ_OUTCOMES; o++)
+		printf(" %7s", outcomes[o]);
+	printf("\n");
+	for (unsigned cmd = 0; cmd < 256; cmd++) {
+		const unsigned *cnt = cov.outcome_cnt[cmd];
+		unsigned total = 0;
+		char name[64];
+
+		for (unsigned o = 0; o < FUZZ_OUTCOMES; o++)
+			total += cnt[o];
+		if (total == cnt[1 + CEC_OP_ABORT_UNRECOGNIZED_OP])
 			continue;
-		cec_msg_init(&msg, me, la);
-		cec_msg_get_cec_version(&msg, true);
+		snprintf(name, sizeof(name), "%s (0x%02x):",
+			 cec_opcode2s(cmd) ? cec_opcode2s(cmd) : "Unknown", cmd);
+		printf("\t%-40s", name);
+		for (unsigned o = 0; o < FUZZ_OUTCOMES; o++)
+			printf(" %7u", cnt[o]);
+		printf("\n");
+	}
+}
+
+/*
+ * Shows the result of a message and adds it to the coverage, is_new is set
+ * if it reached a combination not seen before.
+ */
+static int fuzz_result(const struct fuzz_msg &fm, struct fuzz_coverage &cov,
+		       bool &is_new)
+{
+	const struct cec_msg &msg = fm.msg;
+	unsigned outcome = 0;
+
+	is_new = false;
+	if (fm.id == FUZZ_ALIVE_ID) {
 		printf("Query CEC Version: ");
-		fail_on_test(!transmit_timeout(&node, &msg) || timed_out_or_abort(&msg));
+		fail_on_test(!fm.ok || timed_out_or_abort(&msg));
 		printf("OK\n");
+		return 0;
+	}
+
+	const char *name = cec_opcode2s(fm.sent.msg[1]);
+
+	printf("Send message %u:", fm.id);
+	for (unsigned int i = 0; i < fm.sent.len; i++)
+		printf(" %02x", fm.sent.msg[i]);
+	if (name)
+		printf(" (%s)", name);
+	printf(": ");
+	fail_on_test(!fm.ok);
+	printf("%s", timed_out(&msg) ? "Timed out" : "Feature Abort");
+
+	if (cec_msg_status_is_abort(&msg)) {
+		__u8 abort_msg, reason;
+
+		cec_ops_feature_abort(&msg, &abort_msg, &reason);
+		fail_on_test(abort_msg != fm.sent.msg[1]);
+		switch (reason) {
+		case CEC_OP_ABORT_UNRECOGNIZED_OP:
+			printf(" (Unrecognized Op)");
+			break;
+		case CEC_OP_ABORT_UNDETERMINED:
+			printf(" (Undetermined)");
+			break;
+		case CEC_OP_ABORT_INVALID_OP:
+			printf(" (Invalid Op)");
+			break;
+		case CEC_OP_ABORT_NO_SOURCE:
+			printf(" (No Source)");
+			break;
+		case CEC_OP_ABORT_REFUSED:
+			printf(" (Refused)");
+			break;
+		case CEC_OP_ABORT_INCORRECT_MODE:
+			printf(" (Incorrect Mode)");
+			break;
+		default:
+			printf(" (0x%02x)\n", reason);
+			fail("Invalid reason\n");
+			break;
+		}
+		if (reason <= CEC_OP_ABORT_UNDETERMINED)
+			outcome = 1 + reason;
+	}
+	printf("\n");
+
+	if (timed_out(&msg) || outcome)
+		is_new = coverage_add(cov, fm.sent, outcome);
+	return 0;
+}
+
+/*
+ * Keeps up to depth messages in flight, with at most one per opcode.
+ * The results are passed to fuzz_result() in the order they complete.
+ */
+class fuzz_queue {
+public:
+	fuzz_queue(struct node &node, unsigned depth) : node(node), depth(depth)
+	{
+		if (depth > 1) {
+			fl = fcntl(node.fd, F_GETFL);
+			fcntl(node.fd, F_SETFL, fl | O_NONBLOCK);
+		}
+	}
+	~fuzz_queue()
+	{
+		if (depth > 1)
+			fcntl(node.fd, F_SETFL, fl);
+	}
+
+	bool can_transmit(__u8 opcode) const
+	{
+		if (pending.size() >= depth)
+			return false;
+		for (const auto &it : pending)
+			if (it.second.sent.msg[1] == opcode)
+				return false;
+		return true;
+	}
+	int transmit(struct fuzz_msg &fm, __u8 reply, unsigned timeout);
+	int result(struct fuzz_msg &fm);
+	bool empty() const { return pending.empty() && done.empty(); }
+
+private:
+	struct node &node;
+	unsigned depth;
+	int fl = 0;
+	std::map<__u32, struct fuzz_msg> pending;
+	std::vector<struct fuzz_msg> done;
+};
+
+int fuzz_queue::transmit(struct fuzz_msg &fm, __u8 reply, unsigned timeout)
+{
+	fm.msg.reply = reply;
+	fm.sent = fm.msg;
+	if (depth <= 1) {
+		fm.ok = transmit_timeout(&node, &fm.msg, timeout);
+		done.push_back(fm);
+		return 0;
+	}
+
+	fm.msg.timeout = timeout;
+	for (;;) {
+		int res = doioctl(&node, CEC_TRANSMIT, &fm.msg);
+
+		if (res == ENODEV) {
+			printf("Device was disconnected.\n");
+			std::exit(EXIT_FAILURE);
+		}
+		if (res != EBUSY) {
+			if (res) {
+				// Report it like a message that wasn't acked
+				fm.msg.tx_status = fm.msg.rx_status = 0;
+				fm.ok = false;
+				done.push_back(fm);
+			} else {
+				pending[fm.msg.sequence] = fm;
+			}
+			return 0;
+		}
+		// The transmit queue is full, wait for a message to complete
+		struct fuzz_msg res_fm;
+
+		if (result(res_fm))
+			return -1;
+		done.insert(done.begin(), res_fm);
+	}
+}
+
+int fuzz_queue::result(struct fuzz_msg &fm)
+{
+	while (done.empty()) {
+		struct timeval tv = { 1, 0 };
+		fd_set rd_fds;
+		struct cec_msg msg;
+
+		if (pending.empty())
+			return -1;
+		FD_ZERO(&rd_fds);
+		FD_SET(node.fd, &rd_fds);
+		if (select(node.fd + 1, &rd_fds, nullptr, nullptr, &tv) < 0 &&
+		    errno != EINTR)
+			return -1;
+		memset(&msg, 0, sizeof(msg));
+		while (!doioctl(&node, CEC_RECEIVE, &msg)) {
+			auto it = pending.find(msg.sequence);
+
+			if (msg.sequence && it != pending.end()) {
+				it->second.msg = msg;
+				// Other messages in flight delay the replies
+				it->second.ok = transmit_status(&node, &it->second.sent,
+								&it->second.msg, false);
+				done.push_back(it->second);
+				pending.erase(it);
+			}
+			memset(&msg, 0, sizeof(msg));
+		}
+	}
+	fm = done.front();
+	done.erase(done.begin());
+	return 0;
+}
+
+int testFuzzing(struct node &node, unsigned me, unsigned la,
+		const struct fuzz_options &opts)
+{
+	printf("test fuzzing CEC local LA %d (%s) to remote LA %d (%s):\n\n",
+	       me, cec_la2s(me), la, cec_la2s(la));
+
+	if (node.remote[la].in_standby) {
+		announce("The remote device is in standby. It should be powered on when fuzzing. Aborting.");
+		return 0;
+	}
+	if (!node.remote[la].has_power_status) {
+		announce("The device didn't support Give Device Power Status.");
+		announce("Assuming that the device is powered on.");
 	}
+
+	std::vector<struct cec_msg> replay, corpus;
+	auto cov = new fuzz_coverage();
+	unsigned depth = opts.depth ? opts.depth : 1;
+	unsigned cnt = 0, replayed = 0;
+	struct sigaction sa = {}, old_sa;
+	struct fuzz_msg next = {};
+	bool have_next = false;
+	int ret = 0;
+
+	if (depth > FUZZ_MAX_DEPTH)
+		depth = FUZZ_MAX_DEPTH;
+	fuzz_state = opts.seed ? opts.seed : 1;
+	if (opts.corpus)
+		corpus_read(opts.corpus, me, la, replay);
+	printf("Seed: %u, messages in flight: %u", opts.seed, depth);
+	if (opts.corpus)
+		printf(", corpus: %s (%zu messages)", opts.corpus, replay.size());
+	printf("\n\n");
+
+	sa.sa_handler = fuzz_sigint;
+	sigaction(SIGINT, &sa, &old_sa);
+
+	fuzz_queue queue(node, depth);
+
+	for (;;) {
+		bool more = !fuzz_stop && (!opts.count || cnt < opts.count);
+
+		if (more && !have_next) {
+			if (cnt && !(cnt % 10) && la != CEC_LOG_ADDR_BROADCAST &&
+			    next.id != FUZZ_ALIVE_ID) {
+				next.id = FUZZ_ALIVE_ID;
+				cec_msg_init(&next.msg, me, la);
+				cec_msg_get_cec_version(&next.msg, false);
+			} else {
+				next.id = cnt++;
+				if (replayed < replay.size())
+					next.msg = replay[replayed++];
+				else
+					fuzz_generate(node, me, la, next.msg);
+			}
+			have_next = true;
+		}
+		if (have_next && queue.can_transmit(next.msg.msg[1])) {
+			if (next.id == FUZZ_ALIVE_ID)
+				ret = queue.transmit(next, CEC_MSG_CEC_VERSION, 2000);
+			else
+				ret = queue.transmit(next, FUZZ_REPLY, FUZZ_TIMEOUT_MS);
+			if (ret)
+				break;
+			have_next = false;
+			continue;
+		}
+		if (queue.empty() && !have_next)
+			break;
+
+		struct fuzz_msg fm;
+		bool is_new;
+
+		ret = queue.result(fm);
+		if (ret)
+			break;
+		ret = fuzz_result(fm, *cov, is_new);
+		if (ret)
+			break;
+		if (is_new && opts.corpus) {
+			corpus.push_back(fm.sent);
+			corpus_write(opts.corpus, corpus, replay, replayed);
+		}
+	}
+
+	// Drop the replayed messages that didn't reach anything new
+	if (opts.corpus && !ret && corpus.size() != replay.size())
+		corpus_write(opts.corpus, corpus, replay, replayed);
+	sigaction(SIGINT, &old_sa, nullptr);
+	coverage_show(*cov, opts.corpus ? (int)corpus.size() : -1);
+	delete cov;
+	return ret;
 }
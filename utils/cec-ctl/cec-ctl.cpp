@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <cctype>
 #include <cerrno>
+#include <csignal>
 #include <cstring>
 #include <ctime>
 #include <map>
@@ -15,12 +16,14 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include <linux/cec-funcs.h>
+#include "cec-emu.h"
 #include "cec-htng-funcs.h"
 #include "cec-log.h"
 #include "cec-parse.h"
@@ -35,8 +38,6 @@ static bool ignore_la[16];
 static const char *edid_path;
 static bool is_paused;
 
-#define CEC_CTL_VERSION 2
-
 #define POLL_FAKE_OPCODE 256
 static unsigned short ignore_opcode[257];
 
@@ -106,6 +107,12 @@ enum Option {
 	OptIgnore,
 	OptStorePin,
 	OptAnalyzePin,
+	OptExportPin,
+	OptPinStats,
+	OptPinJobs,
+	OptMsgStats,
+	OptTxDepth,
+	OptJson,
 	OptRcTVProfile1,
 	OptRcTVProfile2,
 	OptRcTVProfile3,
@@ -177,6 +184,12 @@ static struct option long_options[] = {
 	{ "ignore", required_argument, nullptr, OptIgnore },
 	{ "store-pin", required_argument, nullptr, OptStorePin },
 	{ "analyze-pin", required_argument, nullptr, OptAnalyzePin },
+	{ "export-pin", required_argument, nullptr, OptExportPin },
+	{ "pin-stats", no_argument, nullptr, OptPinStats },
+	{ "pin-jobs", required_argument, nullptr, OptPinJobs },
+	{ "msg-stats", required_argument, nullptr, OptMsgStats },
+	{ "tx-depth", required_argument, nullptr, OptTxDepth },
+	{ "json", no_argument, nullptr, OptJson },
 	{ "no-reply", no_argument, nullptr, OptToggleNoReply },
 	{ "non-blocking", no_argument, nullptr, OptNonBlocking },
 	{ "logical-address", no_argument, nullptr, OptLogicalAddress },
@@ -252,6 +265,8 @@ static void usage()
 	       "  -A, --list-devices       List all cec devices\n"
 	       "  -d, --device <dev>       Use device <dev> instead of /dev/cec0\n"
 	       "                           If <dev> starts with a digit, then /dev/cec<dev> is used.\n"
+	       "                           If <dev> is emu:<bus>:<n>, then emulated adapter <n> of\n"
+	       "                           the shared memory bus <bus> is used.\n"
 	       "  -D, --driver <driver>    Use a cec device with this driver name\n"
 	       "  -a, --adapter <adapter>  Use a cec device with this adapter name\n"
 	       "  -p, --phys-addr <addr>   Use this physical address\n"
@@ -271,6 +286,8 @@ static void usage()
 	       "  -f, --from <la>          Send message from the given logical address\n"
 	       "                           By default use the first assigned logical address\n"
 	       "  -r, --show-raw           Show the raw CEC message (hex values)\n"
+	       "  --json                   With --monitor or --monitor-all, log the messages and events\n"
+	       "                           as JSON objects, one per line.\n"
 	       "  -s, --skip-info          Skip Driver Info output\n"
 	       "  -S, --show-topology      Show the CEC topology\n"
 	       "  -P, --poll               Send poll message\n"
@@ -324,14 +341,28 @@ static void usage()
 	       "                           <opcode> when monitoring. 'all' can be used for <la>\n"
 	       "                           or <opcode> to match all logical addresses or opcodes.\n"
 	       "                           To ignore poll messages use 'poll' as <opcode>.\n"
+	       "  --msg-stats <secs>       With --monitor or --test-reliability, collect transmit status and\n"
+	       "                           response time statistics and show them every <secs> seconds\n"
+	       "                           (0 means only at the end) and at the end.\n"
 	       "  --store-pin <to>         Store the low-level CEC pin changes to the file <to>.\n"
-	       "                           Use - for stdout.\n"
+	       "                           Files use a compact binary format. Use - for the text\n"
+	       "                           format on stdout.\n"
 	       "  --analyze-pin <from>     Analyze the low-level CEC pin changes from the file <from>.\n"
 	       "                           Use - for stdin.\n"
+	       "  --export-pin <to>        With --analyze-pin, convert the pin changes to the text\n"
+	       "                           format in the file <to> instead of analyzing them.\n"
+	       "                           Use - for stdout.\n"
+	       "  --pin-stats              With --analyze-pin, show statistics of the messages, the\n"
+	       "                           warnings and the bit timings instead of the message log.\n"
+	       "  --pin-jobs <n>           Use <n> threads for --pin-stats (default is one per CPU).\n"
 	       "  --test-reliability <count>\n"
 	       "                           Test CEC line reliability. It transmits <Give Physical Address>\n"
 	       "                           up to <count> times, checking that the broadcast reply is always the same.\n"
 	       "                           If <count> is 0, then keep trying forever.\n"
+	       "  --tx-depth <n>           With --show-topology and --test-reliability, keep up to <n>\n"
+	       "                           messages (max 18) queued for transmit instead of waiting for\n"
+	       "                           the reply to each message before sending the next. The default\n"
+	       "                           is 18 for --show-topology and 1 for --test-reliability.\n"
 	       "  --test-standby-wakeup-cycle [polls=<n>][,sleep=<secs>][,hpd-may-be-low=<0/1>]\n"
 	       "                           Test standby-wakeup cycle behavior of the display. It polls up to\n"
 	       "                           <n> times (default 15), waiting for a state change. If\n"
@@ -448,7 +479,7 @@ static __u64 current_ts()
 static int cec_named_ioctl(int fd, const char *name,
 		    unsigned long int request, void *parm)
 {
-	int retval = ioctl(fd, request, parm);
+	int retval = cec_ioctl(fd, request, parm);
 	int e;
 
 	e = retval == 0 ? 0 : errno;
@@ -459,6 +490,23 @@ static int cec_named_ioctl(int fd, const char *name,
 	return retval == -1 ? e : (retval ? -1 : 0);
 }
 
+/*
+ * The fd of an emulated adapter is only ever readable, so find out what
+ * it is readable for after select().
+ */
+static void emu_select_fds(int fd, fd_set *rd_fds, fd_set *ex_fds)
+{
+	short revents;
+
+	if (!FD_ISSET(fd, rd_fds) || !cec_emu_fd(fd))
+		return;
+	revents = cec_emu_revents(fd);
+	if (!(revents & POLLIN))
+		FD_CLR(fd, rd_fds);
+	if (ex_fds && (revents & POLLPRI))
+		FD_SET(fd, ex_fds);
+}
+
 static void print_bytes(const __u8 *bytes, unsigned len)
 {
 	for (unsigned i = 0; i < len; i++)
@@ -503,6 +551,32 @@ static const char *event2s(__u32 event)
 	}
 }
 
+static void log_event_json(const struct cec_event &ev)
+{
+	printf("{\"event\":");
+	switch (ev.event) {
+	case CEC_EVENT_STATE_CHANGE:
+		printf("\"state-change\",\"ts\":%llu,\"phys-addr\":\"%x.%x.%x.%x\","
+		       "\"log-addr-mask\":%u,\"conn-info\":%s",
+		       ev.ts, cec_phys_addr_exp(ev.state_change.phys_addr),
+		       ev.state_change.log_addr_mask,
+		       ev.state_change.have_conn_info ? "true" : "false");
+		break;
+	case CEC_EVENT_LOST_MSGS:
+		printf("\"lost-msgs\",\"ts\":%llu,\"lost-msgs\":%u",
+		       ev.ts, ev.lost_msgs.lost_msgs);
+		break;
+	default:
+		printf("%u,\"ts\":%llu", ev.event, ev.ts);
+		break;
+	}
+	if (ev.flags & CEC_EVENT_FL_INITIAL_STATE)
+		printf(",\"initial\":true");
+	if (ev.flags & CEC_EVENT_FL_DROPPED_EVENTS)
+		printf(",\"dropped-events\":true");
+	printf("}\n");
+}
+
 static void log_event(struct cec_event &ev, bool show, bool pin_logging = false)
 {
 	bool is_high = ev.event == CEC_EVENT_PIN_CEC_HIGH;
@@ -570,13 +644,180 @@ static void log_event(struct cec_event &ev, bool show, bool pin_logging = false)
 	}
 }
 
+// The kernel queues up to 18 messages for transmit per adapter
+#define MAX_TX_DEPTH 18
+
+/*
+ * Non-blocking transmits: up to depth messages are queued in the kernel
+ * at the same time, and their results, including the replies, are read
+ * back with CEC_RECEIVE and matched by sequence number. This avoids
+ * idling the bus while waiting for each reply in turn.
+ */
+class tx_queue {
+public:
+	tx_queue(const struct node &node, unsigned depth);
+	~tx_queue();
+
+	// Queue a message, waiting for room if needed. Returns 0 or an errno.
+	int transmit(struct cec_msg &msg, unsigned id);
+	// Wait for the next result, returns false if nothing is pending
+	bool result(struct cec_msg &msg, unsigned &id);
+	bool full() const { return seqs.size() >= depth; }
+
+private:
+	void receive();
+
+	const struct node &node;
+	unsigned depth;
+	int flags;
+	std::map<__u32, unsigned> seqs;
+	std::vector<std::pair<unsigned, struct cec_msg>> done;
+};
+
+tx_queue::tx_queue(const struct node &_node, unsigned _depth) :
+	node(_node),
+	depth(std::min(std::max(_depth, 1U), (unsigned)MAX_TX_DEPTH))
+{
+	flags = fcntl(node.fd, F_GETFL);
+	fcntl(node.fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+tx_queue::~tx_queue()
+{
+	fcntl(node.fd, F_SETFL, flags);
+}
+
+void tx_queue::receive()
+{
+	struct cec_msg msg = { };
+	fd_set rd_fds;
+
+	FD_ZERO(&rd_fds);
+	FD_SET(node.fd, &rd_fds);
+	// The kernel always completes a transmit, if need be with a timeout
+	if (select(node.fd + 1, &rd_fds, nullptr, nullptr, nullptr) <= 0)
+		return;
+	emu_select_fds(node.fd, &rd_fds, nullptr);
+	if (!FD_ISSET(node.fd, &rd_fds))
+		return;
+	while (!doioctl(&node, CEC_RECEIVE, &msg)) {
+		auto it = seqs.find(msg.sequence);
+
+		// Skip messages received as follower or monitor
+		if (msg.sequence && it != seqs.end()) {
+			done.push_back(std::make_pair(it->second, msg));
+			seqs.erase(it);
+		}
+		memset(&msg, 0, sizeof(msg));
+	}
+}
+
+int tx_queue::transmit(struct cec_msg &msg, unsigned id)
+{
+	int ret;
+
+	while (full())
+		receive();
+	for (;;) {
+		ret = doioctl(&node, CEC_TRANSMIT, &msg);
+		if (ret != EBUSY)
+			break;
+		// Filled by other filehandles: wait for one of ours or poll
+		if (seqs.empty())
+			usleep(10000);
+		else
+			receive();
+	}
+	if (!ret)
+		seqs[msg.sequence] = id;
+	return ret;
+}
+
+bool tx_queue::result(struct cec_msg &msg, unsigned &id)
+{
+	while (done.empty() && !seqs.empty())
+		receive();
+	if (done.empty())
+		return false;
+	id = done.front().first;
+	msg = done.front().second;
+	done.erase(done.begin());
+	return true;
+}
+
+/*
+ * Transmit the messages, with up to depth of them in flight, and replace
+ * each of them by its result. A zero tx_status means that the message
+ * couldn't be transmitted.
+ */
+static void transmit_msgs(const struct node &node, msg_vec &msgs, unsigned depth)
+{
+	struct cec_msg msg;
+	unsigned id;
+
+	if (depth <= 1) {
+		for (auto &m : msgs)
+			if (doioctl(&node, CEC_TRANSMIT, &m))
+				m.tx_status = m.rx_status = 0;
+		return;
+	}
+
+	tx_queue q(node, depth);
+
+	for (unsigned i = 0; i < msgs.size(); i++) {
+		if (q.transmit(msgs[i], i))
+			msgs[i].tx_status = msgs[i].rx_status = 0;
+	}
+	while (q.result(msg, id))
+		msgs[id] = msg;
+}
+
 /*
  * Bits 23-8 contain the physical address, bits 0-3 the logical address
  * (equal to the index).
  */
 static __u32 phys_addrs[16];
 
-static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
+enum {
+	TOPO_CEC_VERSION,
+	TOPO_PHYS_ADDR,
+	TOPO_VENDOR_ID,
+	TOPO_OSD_NAME,
+	TOPO_MENU_LANGUAGE,
+	TOPO_POWER_STATUS,
+	TOPO_FEATURES,
+	TOPO_NUM_MSGS
+};
+
+static void topologyRequest(struct cec_msg &msg, unsigned req, unsigned la, unsigned i)
+{
+	cec_msg_init(&msg, la, i);
+	switch (req) {
+	case TOPO_CEC_VERSION:
+		cec_msg_get_cec_version(&msg, true);
+		break;
+	case TOPO_PHYS_ADDR:
+		cec_msg_give_physical_addr(&msg, true);
+		break;
+	case TOPO_VENDOR_ID:
+		cec_msg_give_device_vendor_id(&msg, true);
+		break;
+	case TOPO_OSD_NAME:
+		cec_msg_give_osd_name(&msg, true);
+		break;
+	case TOPO_MENU_LANGUAGE:
+		cec_msg_get_menu_language(&msg, true);
+		break;
+	case TOPO_POWER_STATUS:
+		cec_msg_give_device_power_status(&msg, true);
+		break;
+	case TOPO_FEATURES:
+		cec_msg_give_features(&msg, true);
+		break;
+	}
+}
+
+static int showTopologyDevice(unsigned i, unsigned la, const msg_vec &msgs)
 {
 	struct cec_msg msg;
 	char osd_name[15];
@@ -584,15 +825,11 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 	printf("\tSystem Information for device %d (%s) from device %d (%s):\n",
 	       i, cec_la2s(i), la & 0xf, cec_la2s(la));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_get_cec_version(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_CEC_VERSION];
 	printf("\t\tCEC Version                : %s\n",
 	       (!cec_msg_status_is_ok(&msg)) ? cec_status2s(msg).c_str() : cec_version2s(msg.msg[2]));
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_physical_addr(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_PHYS_ADDR];
 	printf("\t\tPhysical Address           : ");
 	if (!cec_msg_status_is_ok(&msg)) {
 		printf("%s\n", cec_status2s(msg).c_str());
@@ -605,9 +842,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		phys_addrs[i] = (phys_addr << 8) | i;
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_device_vendor_id(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_VENDOR_ID];
 	printf("\t\tVendor ID                  : ");
 	if (!cec_msg_status_is_ok(&msg)) {
 		printf("%s\n", cec_status2s(msg).c_str());
@@ -621,9 +856,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 			printf("0x%06x, %u\n", vendor_id, vendor_id);
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_osd_name(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_OSD_NAME];
 	cec_ops_set_osd_name(&msg, osd_name);
 	printf("\t\tOSD Name                   : ");
 	if (cec_msg_status_is_ok(&msg))
@@ -631,9 +864,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 	else
 		printf("%s\n", cec_status2s(msg).c_str());
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_get_menu_language(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_MENU_LANGUAGE];
 	if (cec_msg_status_is_ok(&msg)) {
 		char language[4];
 
@@ -642,9 +873,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		printf("\t\tMenu Language              : %s\n", language);
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_device_power_status(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_POWER_STATUS];
 	if (cec_msg_status_is_ok(&msg)) {
 		__u8 pwr;
 
@@ -653,9 +882,7 @@ static int showTopologyDevice(struct node *node, unsigned i, unsigned la)
 		       power_status2s(pwr));
 	}
 
-	cec_msg_init(&msg, la, i);
-	cec_msg_give_features(&msg, true);
-	doioctl(node, CEC_TRANSMIT, &msg);
+	msg = msgs[TOPO_FEATURES];
 	if (cec_msg_status_is_ok(&msg)) {
 		__u8 vers, all_dev_types;
 		const __u8 *rc, *feat;
@@ -719,10 +946,18 @@ static __u16 calc_mask(__u16 pa)
 	return 0;
 }
 
-static int showTopology(struct node *node)
+/*
+ * All logical addresses are polled at once. The devices that answered
+ * then get the requests in rounds, one per device per round: that way
+ * each device has a single outstanding request, while the devices reply
+ * in parallel and the time outs of unsupported requests overlap.
+ */
+static int showTopology(struct node *node, unsigned tx_depth)
 {
-	struct cec_msg msg;
 	struct cec_log_addrs laddrs = { };
+	msg_vec polls(15);
+	std::vector<msg_vec> replies(15);
+	std::vector<unsigned> present;
 
 	if (!(node->caps & CEC_CAP_TRANSMIT))
 		return -ENOTTY;
@@ -732,17 +967,33 @@ static int showTopology(struct node *node)
 	if (!laddrs.num_log_addrs)
 		return 0;
 
-	for (unsigned i = 0; i < 15; i++) {
-		int ret;
+	for (unsigned i = 0; i < 15; i++)
+		cec_msg_init(&polls[i], laddrs.log_addr[0], i);
+	transmit_msgs(*node, polls, tx_depth);
+
+	for (unsigned i = 0; i < 15; i++)
+		if (polls[i].tx_status & CEC_TX_STATUS_OK)
+			present.push_back(i);
 
-		cec_msg_init(&msg, laddrs.log_addr[0], i);
-		ret = doioctl(node, CEC_TRANSMIT, &msg);
+	for (unsigned req = 0; req < TOPO_NUM_MSGS; req++) {
+		msg_vec round(present.size());
 
-		if (ret)
+		for (unsigned j = 0; j < present.size(); j++)
+			topologyRequest(round[j], req, laddrs.log_addr[0], present[j]);
+		transmit_msgs(*node, round, tx_depth);
+		// The replies replace the requests, so match them by position
+		for (unsigned j = 0; j < present.size(); j++)
+			replies[present[j]].push_back(round[j]);
+	}
+
+	for (unsigned i = 0; i < 15; i++) {
+		const struct cec_msg &msg = polls[i];
+
+		if (!msg.tx_status)
 			continue;
 
 		if (msg.tx_status & CEC_TX_STATUS_OK)
-			showTopologyDevice(node, i, laddrs.log_addr[0]);
+			showTopologyDevice(i, laddrs.log_addr[0], replies[i]);
 		else if (verbose && !(msg.tx_status & CEC_TX_STATUS_MAX_RETRIES))
 			printf("\t\t%s for addr %d\n", cec_status2s(msg).c_str(), i);
 	}
@@ -797,7 +1048,7 @@ static inline unsigned response_time_ms(const struct cec_msg &msg)
 	return 0;
 }
 
-static void generate_eob_event(__u64 ts, FILE *fstore)
+static void generate_eob_event(__u64 ts, pin_writer *pstore, bool show)
 {
 	if (!eob_ts || eob_ts_max >= ts)
 		return;
@@ -807,19 +1058,24 @@ static void generate_eob_event(__u64 ts, FILE *fstore)
 		CEC_EVENT_PIN_CEC_HIGH
 	};
 
-	if (fstore) {
-		fprintf(fstore, "%llu.%09llu 0x%x\n",
-			ev_eob.ts / 1000000000, ev_eob.ts % 1000000000,
-			ev_eob.event - CEC_EVENT_PIN_CEC_LOW);
-		fflush(fstore);
+	if (pstore) {
+		struct pin_rec rec = { };
+
+		rec.type = PIN_REC_EVENT;
+		rec.ts = ev_eob.ts;
+		rec.event = ev_eob.event - CEC_EVENT_PIN_CEC_LOW;
+		pstore->write(rec);
 	}
-	log_event(ev_eob, fstore != stdout, true);
+	log_event(ev_eob, show, true);
 }
 
 static void show_msg(const cec_msg &msg)
 {
+	// Reused for all messages to format each one with a single write
+	static char buf[4096];
 	__u8 from = cec_msg_initiator(&msg);
 	__u8 to = cec_msg_destination(&msg);
+	int len;
 
 	if (ignore_la[from])
 		return;
@@ -827,11 +1083,25 @@ static void show_msg(const cec_msg &msg)
 	    (msg.len > 1 && (ignore_opcode[msg.msg[1]] & (1 << from))))
 		return;
 
+	if (options[OptJson]) {
+		// Even with all operands escaped this is well below 1 kB
+		cec_log_msg_json(buf, sizeof(buf), &msg);
+		puts(buf);
+		return;
+	}
+
 	bool transmitted = msg.tx_status != 0;
-	printf("%s %s to %s (%d to %d): ",
-	       transmitted ? "Transmitted by" : "Received from",
-	       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to);
-	cec_log_msg(&msg);
+	int hdr_len = snprintf(buf, sizeof(buf), "%s %s to %s (%d to %d): ",
+			       transmitted ? "Transmitted by" : "Received from",
+			       cec_la2s(from), to == 0xf ? "all" : cec_la2s(to), from, to);
+
+	len = cec_log_msg_text(buf + hdr_len, sizeof(buf) - hdr_len, &msg);
+	if (hdr_len + len < (int)sizeof(buf)) {
+		fwrite(buf, 1, hdr_len + len, stdout);
+	} else {
+		fwrite(buf, 1, hdr_len, stdout);
+		cec_log_msg(&msg);
+	}
 	if (options[OptShowRaw])
 		log_raw_msg(&msg);
 	std::string status;
@@ -873,6 +1143,7 @@ static void wait_for_msgs(const struct node &node, __u32 monitor_time)
 		res = select(fd + 1, &rd_fds, nullptr, &ex_fds, &tv);
 		if (res < 0)
 			break;
+		emu_select_fds(fd, &rd_fds, &ex_fds);
 		if (FD_ISSET(fd, &ex_fds)) {
 			struct cec_event ev;
 
@@ -894,17 +1165,38 @@ static void wait_for_msgs(const struct node &node, __u32 monitor_time)
 	}
 }
 
-#define MONITOR_STATE_CHANGE		0x10
-#define MONITOR_FL_DROPPED_EVENTS	(1 << 16)
+static volatile sig_atomic_t stop_monitor;
 
-static void monitor(const struct node &node, __u32 monitor_time, const char *store_pin)
+static void stop_monitor_handler(int)
+{
+	stop_monitor = 1;
+}
+
+static void store_time(pin_writer *pstore)
+{
+	struct pin_rec rec = { };
+
+	rec.type = PIN_REC_MONOTONIC;
+	rec.ts = start_monotonic.tv_sec;
+	rec.frac = start_monotonic.tv_nsec;
+	pstore->write(rec);
+	rec.type = PIN_REC_TIMEOFDAY;
+	rec.ts = start_timeofday.tv_sec;
+	rec.frac = start_timeofday.tv_usec;
+	pstore->write(rec);
+}
+
+static void monitor(const struct node &node, __u32 monitor_time, const char *store_pin,
+		    unsigned stats_interval)
 {
 	__u32 monitor = CEC_MODE_MONITOR;
 	fd_set rd_fds;
 	fd_set ex_fds;
 	int fd = node.fd;
 	FILE *fstore = nullptr;
-	time_t t, start_minute;
+	pin_writer *pstore = nullptr;
+	msg_stats *stats = nullptr;
+	time_t t, start_minute, next_stats = 0;
 
 	if (options[OptMonitorAll])
 		monitor = CEC_MODE_MONITOR_ALL;
@@ -946,31 +1238,59 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 				strerror(errno));
 			std::exit(EXIT_FAILURE);
 		}
-		fprintf(fstore, "# cec-ctl --store-pin\n");
-		fprintf(fstore, "# version %d\n", CEC_CTL_VERSION);
-		fprintf(fstore, "# start_monotonic %llu.%09llu\n",
-			(__u64)start_monotonic.tv_sec, (__u64)start_monotonic.tv_nsec);
-		fprintf(fstore, "# start_timeofday %llu.%06llu\n",
-			(__u64)start_timeofday.tv_sec, (__u64)start_timeofday.tv_usec);
-		fprintf(fstore, "# log_addr_mask 0x%04x\n", node.log_addr_mask);
-		fprintf(fstore, "# phys_addr %x.%x.%x.%x\n",
-			cec_phys_addr_exp(node.phys_addr));
+
+		struct pin_store_hdr hdr = { };
+
+		hdr.version = CEC_CTL_VERSION;
+		hdr.start_monotonic = start_monotonic;
+		hdr.start_timeofday = start_timeofday;
+		hdr.log_addr_mask = node.log_addr_mask;
+		hdr.phys_addr = node.phys_addr;
+		/*
+		 * Files get the binary format, so the events are buffered:
+		 * stop on SIGINT/SIGTERM to write them out.
+		 */
+		pstore = new pin_writer(fstore, fstore == stdout);
+		pstore->header(hdr);
 	}
 
-	if (fstore != stdout)
+	if (options[OptMsgStats])
+		stats = new msg_stats;
+
+	/*
+	 * The buffered pin events and the statistics are written out
+	 * when stopped with SIGINT/SIGTERM.
+	 */
+	if ((pstore && fstore != stdout) || stats) {
+		struct sigaction sa = { };
+
+		sa.sa_handler = stop_monitor_handler;
+		sigaction(SIGINT, &sa, nullptr);
+		sigaction(SIGTERM, &sa, nullptr);
+	}
+
+	if (fstore != stdout && !options[OptJson])
 		printf("\n");
 
 	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
 	start_minute = time(nullptr);
 	t = start_minute + monitor_time;
+	if (stats_interval)
+		next_stats = start_minute + stats_interval;
 
-	while (1) {
+	while (!stop_monitor) {
 		time_t now = time(nullptr);
 		struct timeval tv = { 1, 0 };
 		bool pin_event = false;
 		int res;
 
 		fflush(stdout);
+		if (pstore)
+			pstore->tick(now);
+		if (stats && next_stats && now >= next_stats) {
+			stats->show();
+			next_stats = now + stats_interval;
+		}
 		if (monitor_time && now >= t)
 			break;
 		FD_ZERO(&rd_fds);
@@ -980,6 +1300,7 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 		res = select(fd + 1, &rd_fds, nullptr, &ex_fds, &tv);
 		if (res < 0)
 			break;
+		emu_select_fds(fd, &rd_fds, &ex_fds);
 		if (store_pin && now - start_minute > 60 &&
 		    (FD_ISSET(fd, &rd_fds) || FD_ISSET(fd, &ex_fds))) {
 			/*
@@ -990,11 +1311,7 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 			 */
 			clock_gettime(CLOCK_MONOTONIC, &start_monotonic);
 			gettimeofday(&start_timeofday, nullptr);
-			fprintf(fstore, "# start_monotonic %llu.%09llu\n",
-				(__u64)start_monotonic.tv_sec, (__u64)start_monotonic.tv_nsec);
-			fprintf(fstore, "# start_timeofday %llu.%06llu\n",
-				(__u64)start_timeofday.tv_sec, (__u64)start_timeofday.tv_usec);
-			fflush(fstore);
+			store_time(pstore);
 			start_minute = now;
 		}
 		if (FD_ISSET(fd, &rd_fds)) {
@@ -1007,6 +1324,8 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 			}
 			if (!res && fstore != stdout)
 				show_msg(msg);
+			if (!res && stats)
+				stats->add(msg);
 		}
 		if (FD_ISSET(fd, &ex_fds)) {
 			struct cec_event ev;
@@ -1022,27 +1341,26 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 				pin_event = true;
 			if (ev.event == CEC_EVENT_PIN_CEC_LOW ||
 			    ev.event == CEC_EVENT_PIN_CEC_HIGH)
-				generate_eob_event(ev.ts, fstore);
-			if (fstore && ev.event == CEC_EVENT_STATE_CHANGE) {
-				unsigned int v = MONITOR_STATE_CHANGE;
-
-				if (ev.flags & CEC_EVENT_FL_DROPPED_EVENTS)
-					v |= MONITOR_FL_DROPPED_EVENTS;
-
-				fprintf(fstore, "%llu.%09llu 0x%x 0x%04x 0x%04x\n",
-					ev.ts / 1000000000, ev.ts % 1000000000, v,
-					ev.state_change.phys_addr, ev.state_change.log_addr_mask);
-				fflush(fstore);
-			} else if (fstore && pin_event) {
-				unsigned int v = ev.event - CEC_EVENT_PIN_CEC_LOW;
-
+				generate_eob_event(ev.ts, pstore, fstore != stdout);
+			if (pstore && (pin_event || ev.event == CEC_EVENT_STATE_CHANGE)) {
+				struct pin_rec rec = { };
+
+				rec.type = PIN_REC_EVENT;
+				rec.ts = ev.ts;
+				if (ev.event == CEC_EVENT_STATE_CHANGE) {
+					rec.event = MONITOR_STATE_CHANGE;
+					rec.pa = ev.state_change.phys_addr;
+					rec.la_mask = ev.state_change.log_addr_mask;
+				} else {
+					rec.event = ev.event - CEC_EVENT_PIN_CEC_LOW;
+				}
 				if (ev.flags & CEC_EVENT_FL_DROPPED_EVENTS)
-					v |= MONITOR_FL_DROPPED_EVENTS;
-				fprintf(fstore, "%llu.%09llu 0x%x\n",
-					ev.ts / 1000000000, ev.ts % 1000000000, v);
-				fflush(fstore);
+					rec.event |= MONITOR_FL_DROPPED_EVENTS;
+				pstore->write(rec);
 			}
-			if (!pin_event || options[OptMonitorPin])
+			if (!pin_event && options[OptJson])
+				log_event_json(ev);
+			else if (!pin_event || options[OptMonitorPin])
 				log_event(ev, fstore != stdout, true);
 		}
 		if (!res && eob_ts) {
@@ -1051,158 +1369,110 @@ static void monitor(const struct node &node, __u32 monitor_time, const char *sto
 
 			clock_gettime(CLOCK_MONOTONIC, &ts);
 			ts64 = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
-			generate_eob_event(ts64, fstore);
+			generate_eob_event(ts64, pstore, fstore != stdout);
 		}
 	}
+	delete pstore;
 	if (fstore && fstore != stdout)
 		fclose(fstore);
+	if (stats) {
+		stats->show();
+		delete stats;
+	}
 }
 
-static unsigned read_val(char **p)
+static void analyze(const char *analyze_pin, const char *export_pin, unsigned pin_jobs)
 {
-	unsigned v = 0;
+	struct pin_store_hdr hdr;
+	pin_writer *pexport = nullptr;
+	FILE *fexport = nullptr;
+	struct cec_event ev = { };
+	struct pin_rec rec;
+	pin_reader reader;
+	int ret;
 
-	while (**p == ' ')
-		(*p)++;
+	if (!reader.open(analyze_pin))
+		std::exit(EXIT_FAILURE);
+	if (!reader.read_header(hdr)) {
+		if (reader.is_text())
+			fprintf(stderr, "Not a pin store file: malformed data at line %d\n",
+				reader.cur_line());
+		else
+			fprintf(stderr, "Not a pin store file\n");
+		std::exit(EXIT_FAILURE);
+	}
+	start_monotonic = hdr.start_monotonic;
+	start_timeofday = hdr.start_timeofday;
 
-	if ((*p)[0] == '0' && (*p)[1] == 'x') {
-		(*p) += 2;
-		while (isxdigit(**p)) {
-			if (isdigit(**p))
-				v = v * 16 + **p - '0';
-			else
-				v = v * 16 + tolower(**p) - 'a' + 10;
-			(*p)++;
+	if (export_pin) {
+		if (!strcmp(export_pin, "-"))
+			fexport = stdout;
+		else
+			fexport = fopen(export_pin, "w");
+		if (fexport == nullptr) {
+			fprintf(stderr, "Failed to open %s: %s\n", export_pin,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
 		}
+		pexport = new pin_writer(fexport, true);
+		hdr.version = CEC_CTL_VERSION;
+		pexport->header(hdr);
 	} else {
-		while (isdigit(**p)) {
-			v = v * 10 + **p - '0';
-			(*p)++;
-		}
+		printf("Physical Address:     %x.%x.%x.%x\n",
+		       cec_phys_addr_exp(hdr.phys_addr));
+		printf("Logical Address Mask: 0x%04x\n\n", hdr.log_addr_mask);
 	}
-	return v;
-}
 
-static void analyze(const char *analyze_pin)
-{
-	FILE *fanalyze;
-	struct cec_event ev = { };
-	unsigned long tv_sec, tv_nsec, tv_usec;
-	unsigned version;
-	unsigned log_addr_mask;
-	unsigned pa1, pa2, pa3, pa4;
-	unsigned line = 1;
-	char s[100];
-
-	if (!strcmp(analyze_pin, "-"))
-		fanalyze = stdin;
-	else
-		fanalyze = fopen(analyze_pin, "r");
-	if (fanalyze == nullptr) {
-		fprintf(stderr, "Failed to open %s: %s\n", analyze_pin,
-			strerror(errno));
-		std::exit(EXIT_FAILURE);
-	}
-	if (!fgets(s, sizeof(s), fanalyze) ||
-	    strcmp(s, "# cec-ctl --store-pin\n"))
-		goto err;
-	line++;
-	if (!fgets(s, sizeof(s), fanalyze) ||
-	    sscanf(s, "# version %u\n", &version) != 1)
-		goto err;
-	if (version > CEC_CTL_VERSION) {
-		fprintf(stderr, "Pin store file has version %d, but we only support up to version %d\n",
-			version, CEC_CTL_VERSION);
-		std::exit(EXIT_FAILURE);
+	if (options[OptPinStats]) {
+		if (!analyze_pin_stats(reader, pin_jobs))
+			std::exit(EXIT_FAILURE);
+		return;
 	}
-	line++;
-	if (!fgets(s, sizeof(s), fanalyze) ||
-	    sscanf(s, "# start_monotonic %lu.%09lu\n", &tv_sec, &tv_nsec) != 2 ||
-	    tv_nsec >= 1000000000)
-		goto err;
-	start_monotonic.tv_sec = tv_sec;
-	start_monotonic.tv_nsec = tv_nsec;
-	line++;
-	if (!fgets(s, sizeof(s), fanalyze) ||
-	    sscanf(s, "# start_timeofday %lu.%06lu\n", &tv_sec, &tv_usec) != 2 ||
-	    tv_usec >= 1000000)
-		goto err;
-	start_timeofday.tv_sec = tv_sec;
-	start_timeofday.tv_usec = tv_usec;
-	line++;
-	if (!fgets(s, sizeof(s), fanalyze) ||
-	    sscanf(s, "# log_addr_mask 0x%04x\n", &log_addr_mask) != 1)
-		goto err;
-	line++;
-	if (!fgets(s, sizeof(s), fanalyze) ||
-	    sscanf(s, "# phys_addr %x.%x.%x.%x\n", &pa1, &pa2, &pa3, &pa4) != 4)
-		goto err;
-	line++;
-
-	printf("Physical Address:     %x.%x.%x.%x\n", pa1, pa2, pa3, pa4);
-	printf("Logical Address Mask: 0x%04x\n\n", log_addr_mask);
-
-	while (fgets(s, sizeof(s), fanalyze)) {
-		unsigned event;
-		char *p = s;
-
-		if (s[0] == '#') {
-			if (sscanf(s, "# start_monotonic %lu.%09lu\n", &tv_sec, &tv_nsec) == 2 &&
-			    tv_nsec < 1000000000) {
-				start_monotonic.tv_sec = tv_sec;
-				start_monotonic.tv_nsec = tv_nsec;
-			} else if (sscanf(s, "# start_timeofday %lu.%06lu\n", &tv_sec, &tv_usec) == 2 &&
-				   tv_usec < 1000000) {
-				start_timeofday.tv_sec = tv_sec;
-				start_timeofday.tv_usec = tv_usec;
-				valid_until_t = 0;
-			}
-			line++;
-			continue;
-		} else if (s[0] == '\n') {
-			line++;
+
+	while ((ret = reader.next(rec)) > 0) {
+		if (pexport) {
+			pexport->write(rec);
 			continue;
 		}
-		tv_sec = tv_nsec = event = 0;
-		while (isdigit(*p))
-			tv_sec = tv_sec * 10 + *p++ - '0';
-		if (*p == '.')
-			p++;
-		while (isdigit(*p))
-			tv_nsec = tv_nsec * 10 + *p++ - '0';
-		event = read_val(&p);
-
-		bool dropped_events = event & MONITOR_FL_DROPPED_EVENTS;
-		event &= ~MONITOR_FL_DROPPED_EVENTS;
-
-		__u16 pa = 0;
-		__u16 la_mask = 0;
 
-		if (event == MONITOR_STATE_CHANGE) {
-			pa = read_val(&p);
-			la_mask = read_val(&p);
-		}
-		if (*p != '\n') {
-			fprintf(stderr, "malformed data at line %d\n", line);
-			break;
+		if (rec.type == PIN_REC_MONOTONIC) {
+			start_monotonic.tv_sec = rec.ts;
+			start_monotonic.tv_nsec = rec.frac;
+			continue;
 		}
-		if (event != MONITOR_STATE_CHANGE && event > 5) {
-			fprintf(stderr, "unknown event at line %d\n", line);
-			break;
+		if (rec.type == PIN_REC_TIMEOFDAY) {
+			start_timeofday.tv_sec = rec.ts;
+			start_timeofday.tv_usec = rec.frac;
+			valid_until_t = 0;
+			continue;
 		}
-		ev.ts = tv_sec * 1000000000ULL + tv_nsec;
+
+		unsigned event = rec.event & ~MONITOR_FL_DROPPED_EVENTS;
+
+		ev.ts = rec.ts;
 		ev.flags = 0;
-		if (dropped_events)
+		if (rec.event & MONITOR_FL_DROPPED_EVENTS)
 			ev.flags = CEC_EVENT_FL_DROPPED_EVENTS;
 		if (event == MONITOR_STATE_CHANGE) {
 			ev.event = CEC_EVENT_STATE_CHANGE;
-			ev.state_change.phys_addr = pa;
-			ev.state_change.log_addr_mask = la_mask;
+			ev.state_change.phys_addr = rec.pa;
+			ev.state_change.log_addr_mask = rec.la_mask;
 		} else {
 			ev.event = event + CEC_EVENT_PIN_CEC_LOW;
 		}
 		log_event(ev, true, true);
-		line++;
+	}
+
+	if (pexport) {
+		delete pexport;
+		if (ret < 0)
+			std::exit(EXIT_FAILURE);
+		if (fexport != stdout && fclose(fexport)) {
+			fprintf(stderr, "Failed to write %s: %s\n", export_pin,
+				strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		return;
 	}
 
 	if (eob_ts) {
@@ -1210,14 +1480,6 @@ static void analyze(const char *analyze_pin)
 		ev.ts = eob_ts;
 		log_event(ev, true, true);
 	}
-
-	if (fanalyze != stdin)
-		fclose(fanalyze);
-	return;
-
-err:
-	fprintf(stderr, "Not a pin store file: malformed data at line %d\n", line);
-	std::exit(EXIT_FAILURE);
 }
 
 static bool wait_for_pwr_state(const struct node &node, unsigned from,
@@ -1307,13 +1569,16 @@ static int transmit_msg_retry(const struct node &node, struct cec_msg &msg)
 	return ret;
 }
 
-static void test_reliability(const struct node &node, unsigned int to, unsigned int cnt)
+static void test_reliability(const struct node &node, unsigned int to, unsigned int cnt,
+			     unsigned stats_interval, unsigned tx_depth)
 {
 	struct cec_log_addrs laddrs = { };
 	struct cec_msg msg;
-	unsigned from, iter = 0;
+	unsigned from, iter = 0, queued = 0;
 	__u8 prim_dev, cur_prim_dev;
 	__u16 pa, cur_pa;
+	msg_stats *stats = nullptr;
+	time_t next_stats = 0;
 
 	doioctl(&node, CEC_ADAP_G_LOG_ADDRS, &laddrs);
 	if (laddrs.log_addr[0] == CEC_LOG_ADDR_INVALID) {
@@ -1321,9 +1586,15 @@ static void test_reliability(const struct node &node, unsigned int to, unsigned
 		std::exit(EXIT_FAILURE);
 	}
 	from = laddrs.log_addr[0];
+	if (options[OptMsgStats])
+		stats = new msg_stats;
+	if (stats_interval)
+		next_stats = time(nullptr) + stats_interval;
 	cec_msg_init(&msg, from, to);
 	cec_msg_give_physical_addr(&msg, true);
 	doioctl(&node, CEC_TRANSMIT, &msg);
+	if (stats)
+		stats->add_transmit(msg, (from << 4) | to, CEC_MSG_GIVE_PHYSICAL_ADDR);
 	if (!cec_msg_status_is_ok(&msg)) {
 		printf("Iteration 0: FAIL: %s\n", cec_status2s(msg).c_str());
 		std::exit(EXIT_FAILURE);
@@ -1334,13 +1605,32 @@ static void test_reliability(const struct node &node, unsigned int to, unsigned
 	printf("Iteration 0: Physical Address: %x.%x.%x.%x Primary Device Type: %s\n",
 	       cec_phys_addr_exp(pa), cec_prim_type2s(prim_dev));
 
+	tx_queue q(node, tx_depth);
+
 	while (1) {
-		iter++;
-		cec_msg_init(&msg, from, to);
-		cec_msg_give_physical_addr(&msg, true);
-		doioctl(&node, CEC_TRANSMIT, &msg);
+		while (!q.full() && (!cnt || queued < cnt)) {
+			int ret;
+
+			cec_msg_init(&msg, from, to);
+			cec_msg_give_physical_addr(&msg, true);
+			ret = q.transmit(msg, ++queued);
+			if (ret) {
+				printf("Iteration %u: FAIL: %s\n", queued, strerror(ret));
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		if (!q.result(msg, iter))
+			break;
+		if (stats)
+			stats->add_transmit(msg, (from << 4) | to, CEC_MSG_GIVE_PHYSICAL_ADDR);
+		if (stats && next_stats && time(nullptr) >= next_stats) {
+			stats->show();
+			next_stats = time(nullptr) + stats_interval;
+		}
 		if (!cec_msg_status_is_ok(&msg)) {
 			printf("Iteration %u: FAIL: %s\n", iter, cec_status2s(msg).c_str());
+			if (stats)
+				stats->show();
 			std::exit(EXIT_FAILURE);
 		}
 		cur_pa = (msg.msg[2] << 8) | msg.msg[3];
@@ -1352,8 +1642,10 @@ static void test_reliability(const struct node &node, unsigned int to, unsigned
 		       cec_phys_addr_exp(cur_pa), cec_prim_type2s(cur_prim_dev));
 		if (!pass)
 			break;
-		if (cnt && cnt-- == 1)
-			break;
+	}
+	if (stats) {
+		stats->show();
+		delete stats;
 	}
 }
 
@@ -2355,6 +2647,9 @@ int main(int argc, char **argv)
 	char short_options[26 * 2 * 3 + 1];
 	__u32 timeout = 1000;
 	__u32 monitor_time = 0;
+	unsigned pin_jobs = 0;
+	unsigned stats_interval = 0;
+	unsigned tx_depth = 0;
 	__u32 vendor_id = 0x000c03; /* HDMI LLC vendor ID */
 	unsigned int stress_test_standby_wakeup_cycle_cnt = 0;
 	double stress_test_standby_wakeup_cycle_min_sleep = 0;
@@ -2385,6 +2680,7 @@ int main(int argc, char **argv)
 	const char *osd_name = "";
 	const char *store_pin = nullptr;
 	const char *analyze_pin = nullptr;
+	const char *export_pin = nullptr;
 	bool reply = true;
 	int idx = 0;
 	int fd = -1;
@@ -2512,6 +2808,18 @@ int main(int argc, char **argv)
 		case OptAnalyzePin:
 			analyze_pin = optarg;
 			break;
+		case OptExportPin:
+			export_pin = optarg;
+			break;
+		case OptPinJobs:
+			pin_jobs = strtoul(optarg, nullptr, 0);
+			break;
+		case OptMsgStats:
+			stats_interval = strtoul(optarg, nullptr, 0);
+			break;
+		case OptTxDepth:
+			tx_depth = strtoul(optarg, nullptr, 0);
+			break;
 		case OptToggleNoReply:
 			reply = !reply;
 			break;
@@ -2945,8 +3253,31 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	if (export_pin && !analyze_pin) {
+		fprintf(stderr, "--export-pin requires --analyze-pin.\n\n");
+		usage();
+		return 1;
+	}
+
+	if ((options[OptPinStats] || options[OptPinJobs]) && !analyze_pin) {
+		fprintf(stderr, "--pin-stats and --pin-jobs require --analyze-pin.\n\n");
+		usage();
+		return 1;
+	}
+
+	if (options[OptPinStats] && export_pin) {
+		fprintf(stderr, "--pin-stats and --export-pin options cannot be combined.\n\n");
+		usage();
+		return 1;
+	}
+
 	if (analyze_pin) {
-		analyze(analyze_pin);
+		if (!pin_jobs) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+			pin_jobs = cpus > 0 ? cpus : 1;
+		}
+		analyze(analyze_pin, export_pin, pin_jobs);
 		return 0;
 	}
 
@@ -3003,7 +3334,11 @@ int main(int argc, char **argv)
 	clock_gettime(CLOCK_MONOTONIC, &start_monotonic);
 	gettimeofday(&start_timeofday, nullptr);
 
-	if ((fd = open(device.c_str(), O_RDWR)) < 0) {
+	if (cec_emu_is_device(device.c_str()))
+		fd = cec_emu_open(device.c_str());
+	else
+		fd = open(device.c_str(), O_RDWR);
+	if (fd < 0) {
 		fprintf(stderr, "Failed to open %s: %s\n", device.c_str(),
 			strerror(errno));
 		std::exit(EXIT_FAILURE);
@@ -3212,7 +3547,7 @@ int main(int argc, char **argv)
 		from = laddrs.log_addr[0] & 0xf;
 
 	if (options[OptShowTopology])
-		showTopology(&node);
+		showTopology(&node, tx_depth ? tx_depth : MAX_TX_DEPTH);
 
 	if (options[OptLogicalAddress])
 		printf("%d\n", laddrs.log_addr[0] & 0xf);
@@ -3275,7 +3610,7 @@ int main(int argc, char **argv)
 		fcntl(node.fd, F_SETFL, fcntl(node.fd, F_GETFL) & ~O_NONBLOCK);
 
 	if (options[OptTestReliability])
-		test_reliability(node, to, test_reliability_cnt);
+		test_reliability(node, to, test_reliability_cnt, stats_interval, tx_depth ? tx_depth : 1);
 	if (options[OptTestStandbyWakeupCycle])
 		test_standby_wakeup_cycle(node,
 					  test_standby_wakeup_cycle_polls,
@@ -3305,7 +3640,7 @@ int main(int argc, char **argv)
 skip_la:
 	if (options[OptMonitor] || options[OptMonitorAll] ||
 	    options[OptMonitorPin]) {
-		monitor(node, monitor_time, store_pin);
+		monitor(node, monitor_time, store_pin, stats_interval);
 	} else if (options[OptWaitForMsgs]) {
 		wait_for_msgs(node, monitor_time);
 	} else if (options[OptPhysAddrFromEDIDPoll]) {
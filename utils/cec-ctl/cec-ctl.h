@@ -6,6 +6,12 @@
 #ifndef _CEC_CTL_H_
 #define _CEC_CTL_H_
 
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include <sys/time.h>
+
 #include <cec-info.h>
 
 // cec-ctl.cpp
@@ -17,5 +23,159 @@ std::string ts2s(double ts);
 extern __u64 eob_ts;
 extern __u64 eob_ts_max;
 void log_event_pin(bool is_high, __u64 ts, bool show);
+class pin_reader;
+bool analyze_pin_stats(pin_reader &reader, unsigned jobs);
+
+// cec-pin-store.cpp
+#define CEC_CTL_VERSION 2
+
+#define MONITOR_STATE_CHANGE		0x10
+#define MONITOR_FL_DROPPED_EVENTS	(1 << 16)
+
+struct pin_store_hdr {
+	unsigned version;
+	struct timespec start_monotonic;
+	struct timeval start_timeofday;
+	__u16 log_addr_mask;
+	__u16 phys_addr;
+};
+
+enum pin_rec_type {
+	PIN_REC_EVENT,
+	PIN_REC_MONOTONIC,
+	PIN_REC_TIMEOFDAY,
+};
+
+/*
+ * A stored event, or an update of start_monotonic or start_timeofday.
+ * For events, ts is the timestamp in ns and event is the pin event
+ * (event - CEC_EVENT_PIN_CEC_LOW) or MONITOR_STATE_CHANGE, ORed with
+ * MONITOR_FL_DROPPED_EVENTS. For updates, ts holds the seconds and frac
+ * the nanoseconds or microseconds.
+ */
+struct pin_rec {
+	enum pin_rec_type type;
+	__u64 ts;
+	unsigned frac;
+	unsigned event;
+	__u16 pa;
+	__u16 la_mask;
+};
+
+// Writes the pin events in the text or the binary format
+class pin_writer {
+public:
+	pin_writer(FILE *f, bool text);
+	~pin_writer();
+
+	void header(const struct pin_store_hdr &hdr);
+	void write(const struct pin_rec &rec);
+	// flushes the binary events at most once a second
+	void tick(time_t now);
+	void flush();
+
+private:
+	void put_varint(__u64 v);
+
+	FILE *f;
+	bool text;
+	__u8 *buf;
+	size_t len;
+	__u64 last_ts;
+	time_t last_flush;
+};
+
+// Reads the pin events from a file in either format
+class pin_reader {
+public:
+	pin_reader();
+	~pin_reader();
+
+	bool open(const char *fname);
+	bool read_header(struct pin_store_hdr &hdr);
+	// returns 1 if a record was read, 0 at the end, -1 on errors
+	int next(struct pin_rec &rec);
+	bool is_text() const { return text; }
+	unsigned cur_line() const { return line; }
+
+private:
+	bool get_varint(__u64 &v);
+	int next_bin(struct pin_rec &rec);
+
+	FILE *f;
+	void *map;
+	size_t map_len;
+	std::vector<__u8> data;
+	const __u8 *start, *p, *end;
+	bool text;
+	__u64 last_ts;
+	unsigned line;
+	char s[100];
+};
+
+// cec-stats.cpp
+#define STATS_MAX_LATENCY_MS	2000
+
+// Transmit status and response time statistics of the CEC messages
+class msg_stats {
+public:
+	msg_stats();
+
+	// Adds a message seen while monitoring
+	void add(const struct cec_msg &msg);
+	// Adds a message transmitted by cec-ctl, hdr and opcode are the ones
+	// of the transmitted message, since a reply overwrites them
+	void add_transmit(const struct cec_msg &msg, __u8 hdr, unsigned opcode);
+	void show() const;
+
+private:
+	struct latency_hist {
+		__u64 cnt = 0;
+		unsigned min = 0;
+		unsigned max = 0;
+		// 1 ms buckets, the last one also has all longer times
+		std::vector<__u32> buckets;
+
+		void add(unsigned ms);
+		unsigned percentile(unsigned pct) const;
+	};
+	struct pair_stats {
+		__u64 msgs;
+		__u64 nacks;
+	};
+	struct pending_msg {
+		__u64 ts;
+		__u8 opcode;
+	};
+
+	void add_tx_status(const struct cec_msg &msg, __u8 from, __u8 to);
+	void add_latency(__u8 from, __u8 to, unsigned opcode, unsigned ms);
+
+	unsigned start;
+	struct {
+		__u64 msgs;
+		__u64 ok;
+		__u64 nack;
+		__u64 arb_lost;
+		__u64 low_drive;
+		__u64 error;
+		__u64 max_retries;
+		__u64 aborted;
+		__u64 timeout;
+		__u64 arb_lost_cnt;
+		__u64 nack_cnt;
+		__u64 low_drive_cnt;
+		__u64 error_cnt;
+		__u64 retries;
+	} tx;
+	__u64 rx_msgs;
+	__u64 reply_timeouts;
+	__u64 feature_aborts;
+	struct pair_stats pairs[16][16];
+	// The last directed message from an initiator to a follower
+	struct pending_msg pending[16][16];
+	std::map<unsigned, latency_hist> opcodes;
+	std::map<unsigned, latency_hist> pair_latency;
+};
 
 #endif
@@ -0,0 +1,504 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright 2017 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ * Copyright (c) 2026 - agent
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <linux/cec.h>
+
+#include "cec-ctl.h"
+
+/*
+ * Binary pin store format
+ *
+ * The file starts with PIN_STORE_MAGIC, followed by the format version,
+ * the log_addr_mask, the phys_addr, and the start_monotonic seconds and
+ * nanoseconds and the start_timeofday seconds and microseconds.
+ *
+ * Then there is one record per event, starting with a tag byte:
+ *
+ * 0x00-0x05	pin event (event - CEC_EVENT_PIN_CEC_LOW), followed by the
+ *		timestamp delta
+ * 0x06		state change, followed by the timestamp delta, the phys_addr
+ *		and the log_addr_mask
+ * 0x08		flag ORed into the tags above if events were dropped
+ * 0x10		start_monotonic update, followed by the seconds and the
+ *		nanoseconds
+ * 0x11		start_timeofday update, followed by the seconds and the
+ *		microseconds
+ *
+ * All values are unsigned LEB128 varints. The timestamp delta is the
+ * difference in nanoseconds from the timestamp of the previous event, or
+ * from 0 for the first one, zigzag encoded since it can be negative.
+ * So a pin edge usually takes 4 bytes, instead of about 25 in the text
+ * format.
+ */
+#define PIN_STORE_MAGIC		"CECPIN\x1a\n"
+#define PIN_STORE_MAGIC_LEN	8
+#define PIN_STORE_BIN_VERSION	1
+
+#define PIN_TAG_EVENT_MSK	0x07
+#define PIN_TAG_STATE_CHANGE	0x06
+#define PIN_TAG_DROPPED		0x08
+#define PIN_TAG_MONOTONIC	0x10
+#define PIN_TAG_TIMEOFDAY	0x11
+
+// Max size of a record: tag plus up to three 10 bytes varints
+#define PIN_REC_MAX_SIZE	31
+
+#define PIN_WRITE_BUF_SIZE	(256 * 1024)
+
+static const char text_magic[] = "# cec-ctl --store-pin\n";
+
+pin_writer::pin_writer(FILE *f, bool text) :
+	f(f),
+	text(text),
+	len(0),
+	last_ts(0),
+	last_flush(time(nullptr))
+{
+	if (!text)
+		buf = new __u8[PIN_WRITE_BUF_SIZE];
+	else
+		buf = nullptr;
+}
+
+pin_writer::~pin_writer()
+{
+	flush();
+	delete[] buf;
+}
+
+void pin_writer::put_varint(__u64 v)
+{
+	while (v >= 0x80) {
+		buf[len++] = v | 0x80;
+		v >>= 7;
+	}
+	buf[len++] = v;
+}
+
+void pin_writer::header(const struct pin_store_hdr &hdr)
+{
+	if (text) {
+		fprintf(f, "%s", text_magic);
+		fprintf(f, "# version %d\n", hdr.version);
+		fprintf(f, "# start_monotonic %llu.%09llu\n",
+			(__u64)hdr.start_monotonic.tv_sec,
+			(__u64)hdr.start_monotonic.tv_nsec);
+		fprintf(f, "# start_timeofday %llu.%06llu\n",
+			(__u64)hdr.start_timeofday.tv_sec,
+			(__u64)hdr.start_timeofday.tv_usec);
+		fprintf(f, "# log_addr_mask 0x%04x\n", hdr.log_addr_mask);
+		fprintf(f, "# phys_addr %x.%x.%x.%x\n",
+			cec_phys_addr_exp(hdr.phys_addr));
+		fflush(f);
+		return;
+	}
+
+	memcpy(buf, PIN_STORE_MAGIC, PIN_STORE_MAGIC_LEN);
+	len = PIN_STORE_MAGIC_LEN;
+	put_varint(PIN_STORE_BIN_VERSION);
+	put_varint(hdr.log_addr_mask);
+	put_varint(hdr.phys_addr);
+	put_varint(hdr.start_monotonic.tv_sec);
+	put_varint(hdr.start_monotonic.tv_nsec);
+	put_varint(hdr.start_timeofday.tv_sec);
+	put_varint(hdr.start_timeofday.tv_usec);
+	flush();
+}
+
+void pin_writer::write(const struct pin_rec &rec)
+{
+	unsigned event = rec.event & ~MONITOR_FL_DROPPED_EVENTS;
+	__s64 delta;
+	__u8 tag;
+
+	if (text) {
+		switch (rec.type) {
+		case PIN_REC_MONOTONIC:
+			fprintf(f, "# start_monotonic %llu.%09u\n",
+				rec.ts, rec.frac);
+			break;
+		case PIN_REC_TIMEOFDAY:
+			fprintf(f, "# start_timeofday %llu.%06u\n",
+				rec.ts, rec.frac);
+			break;
+		case PIN_REC_EVENT:
+			if (event == MONITOR_STATE_CHANGE)
+				fprintf(f, "%llu.%09llu 0x%x 0x%04x 0x%04x\n",
+					rec.ts / 1000000000, rec.ts % 1000000000,
+					rec.event, rec.pa, rec.la_mask);
+			else
+				fprintf(f, "%llu.%09llu 0x%x\n",
+					rec.ts / 1000000000, rec.ts % 1000000000,
+					rec.event);
+			break;
+		}
+		fflush(f);
+		return;
+	}
+
+	if (len > PIN_WRITE_BUF_SIZE - PIN_REC_MAX_SIZE)
+		flush();
+
+	switch (rec.type) {
+	case PIN_REC_MONOTONIC:
+	case PIN_REC_TIMEOFDAY:
+		buf[len++] = rec.type == PIN_REC_MONOTONIC ?
+			PIN_TAG_MONOTONIC : PIN_TAG_TIMEOFDAY;
+		put_varint(rec.ts);
+		put_varint(rec.frac);
+		break;
+	case PIN_REC_EVENT:
+		tag = event == MONITOR_STATE_CHANGE ? PIN_TAG_STATE_CHANGE : event;
+		if (rec.event & MONITOR_FL_DROPPED_EVENTS)
+			tag |= PIN_TAG_DROPPED;
+		buf[len++] = tag;
+		delta = rec.ts - last_ts;
+		put_varint(((__u64)delta << 1) ^ (__u64)(delta >> 63));
+		last_ts = rec.ts;
+		if (event == MONITOR_STATE_CHANGE) {
+			put_varint(rec.pa);
+			put_varint(rec.la_mask);
+		}
+		break;
+	}
+}
+
+void pin_writer::tick(time_t now)
+{
+	if (now != last_flush)
+		flush();
+}
+
+void pin_writer::flush()
+{
+	last_flush = time(nullptr);
+	if (text || !len)
+		return;
+	if (fwrite(buf, 1, len, f) != len || fflush(f)) {
+		fprintf(stderr, "Failed to write the pin events: %s\n",
+			strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	len = 0;
+}
+
+pin_reader::pin_reader() :
+	f(nullptr),
+	map(nullptr),
+	map_len(0),
+	start(nullptr),
+	p(nullptr),
+	end(nullptr),
+	text(true),
+	last_ts(0),
+	line(1)
+{
+}
+
+pin_reader::~pin_reader()
+{
+	if (map)
+		munmap(map, map_len);
+	if (f && f != stdin)
+		fclose(f);
+}
+
+/*
+ * Binary files are mapped, if possible, or else read into memory, as
+ * with pipes. Text files are read line by line.
+ */
+bool pin_reader::open(const char *fname)
+{
+	struct stat st;
+	int c;
+
+	if (!strcmp(fname, "-"))
+		f = stdin;
+	else
+		f = fopen(fname, "r");
+	if (f == nullptr) {
+		fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	c = getc(f);
+	if (c == EOF)
+		return true;
+	ungetc(c, f);
+	text = c == text_magic[0];
+	if (text)
+		return true;
+
+	if (f != stdin && !fstat(fileno(f), &st) && S_ISREG(st.st_mode) &&
+	    st.st_size > 0) {
+		map_len = st.st_size;
+		map = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE,
+			   fileno(f), 0);
+		if (map == MAP_FAILED) {
+			map = nullptr;
+		} else {
+			madvise(map, map_len, MADV_SEQUENTIAL);
+			start = p = static_cast<const __u8 *>(map);
+			end = p + map_len;
+			return true;
+		}
+	}
+
+	__u8 tmp[65536];
+	size_t n;
+
+	while ((n = fread(tmp, 1, sizeof(tmp), f)) > 0)
+		data.insert(data.end(), tmp, tmp + n);
+	start = p = data.data();
+	end = p + data.size();
+	return true;
+}
+
+bool pin_reader::get_varint(__u64 &v)
+{
+	unsigned shift = 0;
+
+	v = 0;
+	while (p < end && shift < 64) {
+		__u8 b = *p++;
+
+		v |= (__u64)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+		shift += 7;
+	}
+	return false;
+}
+
+static unsigned read_val(char **p)
+{
+	unsigned v = 0;
+
+	while (**p == ' ')
+		(*p)++;
+
+	if ((*p)[0] == '0' && (*p)[1] == 'x') {
+		(*p) += 2;
+		while (isxdigit(**p)) {
+			if (isdigit(**p))
+				v = v * 16 + **p - '0';
+			else
+				v = v * 16 + tolower(**p) - 'a' + 10;
+			(*p)++;
+		}
+	} else {
+		while (isdigit(**p)) {
+			v = v * 10 + **p - '0';
+			(*p)++;
+		}
+	}
+	return v;
+}
+
+bool pin_reader::read_header(struct pin_store_hdr &hdr)
+{
+	unsigned long tv_sec, tv_nsec, tv_usec;
+	unsigned pa1, pa2, pa3, pa4;
+
+	if (!text) {
+		__u64 v[7];
+
+		if (end - p < PIN_STORE_MAGIC_LEN ||
+		    memcmp(p, PIN_STORE_MAGIC, PIN_STORE_MAGIC_LEN))
+			return false;
+		p += PIN_STORE_MAGIC_LEN;
+		for (unsigned i = 0; i < 7; i++)
+			if (!get_varint(v[i]))
+				return false;
+		hdr.version = v[0];
+		if (hdr.version > PIN_STORE_BIN_VERSION) {
+			fprintf(stderr, "Pin store file has binary format version %d, but we only support up to version %d\n",
+				hdr.version, PIN_STORE_BIN_VERSION);
+			std::exit(EXIT_FAILURE);
+		}
+		if (v[1] > 0xffff || v[2] > 0xffff ||
+		    v[4] >= 1000000000 || v[6] >= 1000000)
+			return false;
+		hdr.log_addr_mask = v[1];
+		hdr.phys_addr = v[2];
+		hdr.start_monotonic.tv_sec = v[3];
+		hdr.start_monotonic.tv_nsec = v[4];
+		hdr.start_timeofday.tv_sec = v[5];
+		hdr.start_timeofday.tv_usec = v[6];
+		return true;
+	}
+
+	if (!fgets(s, sizeof(s), f) || strcmp(s, text_magic))
+		return false;
+	line++;
+	if (!fgets(s, sizeof(s), f) || sscanf(s, "# version %u\n", &hdr.version) != 1)
+		return false;
+	if (hdr.version > CEC_CTL_VERSION) {
+		fprintf(stderr, "Pin store file has version %d, but we only support up to version %d\n",
+			hdr.version, CEC_CTL_VERSION);
+		std::exit(EXIT_FAILURE);
+	}
+	line++;
+	if (!fgets(s, sizeof(s), f) ||
+	    sscanf(s, "# start_monotonic %lu.%09lu\n", &tv_sec, &tv_nsec) != 2 ||
+	    tv_nsec >= 1000000000)
+		return false;
+	hdr.start_monotonic.tv_sec = tv_sec;
+	hdr.start_monotonic.tv_nsec = tv_nsec;
+	line++;
+	if (!fgets(s, sizeof(s), f) ||
+	    sscanf(s, "# start_timeofday %lu.%06lu\n", &tv_sec, &tv_usec) != 2 ||
+	    tv_usec >= 1000000)
+		return false;
+	hdr.start_timeofday.tv_sec = tv_sec;
+	hdr.start_timeofday.tv_usec = tv_usec;
+	line++;
+	if (!fgets(s, sizeof(s), f) ||
+	    sscanf(s, "# log_addr_mask 0x%04x\n", &pa1) != 1)
+		return false;
+	hdr.log_addr_mask = pa1;
+	line++;
+	if (!fgets(s, sizeof(s), f) ||
+	    sscanf(s, "# phys_addr %x.%x.%x.%x\n", &pa1, &pa2, &pa3, &pa4) != 4)
+		return false;
+	hdr.phys_addr = (pa1 << 12) | (pa2 << 8) | (pa3 << 4) | pa4;
+	line++;
+	return true;
+}
+
+int pin_reader::next_bin(struct pin_rec &rec)
+{
+	const __u8 *rec_start = p;
+	__u64 v, frac;
+	__u8 tag;
+
+	if (p == end)
+		return 0;
+
+	tag = *p++;
+	rec.event = 0;
+	rec.pa = rec.la_mask = 0;
+	switch (tag) {
+	case PIN_TAG_MONOTONIC:
+	case PIN_TAG_TIMEOFDAY:
+		rec.type = tag == PIN_TAG_MONOTONIC ?
+			PIN_REC_MONOTONIC : PIN_REC_TIMEOFDAY;
+		if (!get_varint(v) || !get_varint(frac) ||
+		    frac >= (tag == PIN_TAG_MONOTONIC ? 1000000000 : 1000000))
+			goto err;
+		rec.ts = v;
+		rec.frac = frac;
+		return 1;
+	default:
+		break;
+	}
+
+	if ((tag & ~(PIN_TAG_EVENT_MSK | PIN_TAG_DROPPED)) ||
+	    (tag & PIN_TAG_EVENT_MSK) > PIN_TAG_STATE_CHANGE)
+		goto err;
+
+	rec.type = PIN_REC_EVENT;
+	if ((tag & PIN_TAG_EVENT_MSK) == PIN_TAG_STATE_CHANGE)
+		rec.event = MONITOR_STATE_CHANGE;
+	else
+		rec.event = tag & PIN_TAG_EVENT_MSK;
+	if (tag & PIN_TAG_DROPPED)
+		rec.event |= MONITOR_FL_DROPPED_EVENTS;
+	if (!get_varint(v))
+		goto err;
+	last_ts += (v >> 1) ^ -(v & 1);
+	rec.ts = last_ts;
+	if ((tag & PIN_TAG_EVENT_MSK) == PIN_TAG_STATE_CHANGE) {
+		if (!get_varint(v) || v > 0xffff)
+			goto err;
+		rec.pa = v;
+		if (!get_varint(v) || v > 0xffff)
+			goto err;
+		rec.la_mask = v;
+	}
+	return 1;
+
+err:
+	fprintf(stderr, "malformed data at offset %zu\n",
+		(size_t)(rec_start - start));
+	return -1;
+}
+
+int pin_reader::next(struct pin_rec &rec)
+{
+	unsigned long tv_sec, tv_nsec, tv_usec;
+
+	if (!text)
+		return next_bin(rec);
+
+	while (fgets(s, sizeof(s), f)) {
+		unsigned event;
+		char *ptr = s;
+
+		if (s[0] == '#') {
+			line++;
+			if (sscanf(s, "# start_monotonic %lu.%09lu\n", &tv_sec, &tv_nsec) == 2 &&
+			    tv_nsec < 1000000000) {
+				rec.type = PIN_REC_MONOTONIC;
+				rec.ts = tv_sec;
+				rec.frac = tv_nsec;
+				return 1;
+			}
+			if (sscanf(s, "# start_timeofday %lu.%06lu\n", &tv_sec, &tv_usec) == 2 &&
+			    tv_usec < 1000000) {
+				rec.type = PIN_REC_TIMEOFDAY;
+				rec.ts = tv_sec;
+				rec.frac = tv_usec;
+				return 1;
+			}
+			continue;
+		} else if (s[0] == '\n') {
+			line++;
+			continue;
+		}
+		tv_sec = tv_nsec = event = 0;
+		while (isdigit(*ptr))
+			tv_sec = tv_sec * 10 + *ptr++ - '0';
+		if (*ptr == '.')
+			ptr++;
+		while (isdigit(*ptr))
+			tv_nsec = tv_nsec * 10 + *ptr++ - '0';
+		event = read_val(&ptr);
+
+		rec.pa = 0;
+		rec.la_mask = 0;
+		if ((event & ~MONITOR_FL_DROPPED_EVENTS) == MONITOR_STATE_CHANGE) {
+			rec.pa = read_val(&ptr);
+			rec.la_mask = read_val(&ptr);
+		}
+		if (*ptr != '\n') {
+			fprintf(stderr, "malformed data at line %d\n", line);
+			return -1;
+		}
+		if ((event & ~MONITOR_FL_DROPPED_EVENTS) != MONITOR_STATE_CHANGE &&
+		    (event & ~MONITOR_FL_DROPPED_EVENTS) > 5) {
+			fprintf(stderr, "unknown event at line %d\n", line);
+			return -1;
+		}
+		rec.type = PIN_REC_EVENT;
+		rec.ts = tv_sec * 1000000000ULL + tv_nsec;
+		rec.event = event;
+		line++;
+		return 1;
+	}
+	return 0;
+}
@@ -5,6 +5,9 @@
 
 #include <string>
 
+#include <pthread.h>
+#include <unistd.h>
+
 #include <linux/cec.h>
 #include "cec-htng.h"
 
@@ -80,158 +83,328 @@ enum cec_state {
 __u64 eob_ts;
 __u64 eob_ts_max;
 
-// Global CEC state
-static enum cec_state state;
-static double ts;
-static __u64 low_usecs;
-static unsigned int rx_bit;
-static __u8 byte;
-static bool eom;
-static bool eom_reached;
-static __u8 byte_cnt;
-static bool bcast;
-static bool cdc;
-static struct cec_msg msg;
-
-static void cec_pin_rx_start_bit_was_high(bool is_high, __u64 usecs, __u64 usecs_min, bool show)
+/*
+ * Pin decoder state. The decoders are independent, so the chunks of a
+ * capture can be decoded in parallel, see analyze_pin_stats().
+ */
+struct cec_pin_decoder {
+	enum cec_state state;
+	double ts;
+	__u64 low_usecs;
+	unsigned int rx_bit;
+	__u8 byte;
+	bool eom;
+	bool eom_reached;
+	__u8 byte_cnt;
+	bool bcast;
+	bool cdc;
+	bool nack;
+	struct cec_msg msg;
+	__u64 eob_ts;
+	__u64 eob_ts_max;
+	__u64 last_ts;
+	__u64 last_change_ts;
+	__u64 last_1_to_0_ts;
+	bool was_high = true;
+	struct cec_pin_stats *stats;
+};
+
+// Decoder used for the events logged by log_event_pin()
+static struct cec_pin_decoder pin_decoder;
+
+enum cec_pin_err {
+	PIN_ERR_START_PERIOD_LONG,
+	PIN_ERR_START_PERIOD_SHORT,
+	PIN_ERR_START_LOW_LONG,
+	PIN_ERR_DATA_PERIOD_LONG,
+	PIN_ERR_DATA_PERIOD_SHORT,
+	PIN_ERR_DATA_LOW_LONG,
+	PIN_ERR_DATA_LOW_SHORT,
+	PIN_ERR_INVALID_0_TO_1,
+	PIN_ERR_UNEXPECTED_START,
+	PIN_ERR_MISSING_EOM,
+	PIN_ERR_SPURIOUS_BYTE,
+	PIN_ERR_LOW_DRIVE,
+	PIN_ERR_LOW_DRIVE_LONG,
+	PIN_ERR_MAX
+};
+
+static const char *pin_err_names[PIN_ERR_MAX] = {
+	"start bit: total period too long",
+	"start bit: total period too short",
+	"start bit: low time too long",
+	"data bit: total period too long",
+	"data bit: total period too short",
+	"data bit: low time too long",
+	"data bit: low time too short",
+	"data bit: invalid 0->1 transition",
+	"unexpected start bit",
+	"missing EOM",
+	"spurious byte",
+	"low drive",
+	"low drive too long",
+};
+
+enum cec_pin_hist_type {
+	PIN_HIST_START_LOW,
+	PIN_HIST_START_PERIOD,
+	PIN_HIST_BIT_0_LOW,
+	PIN_HIST_BIT_1_LOW,
+	PIN_HIST_BIT_PERIOD,
+	PIN_HIST_MAX
+};
+
+static const char *pin_hist_names[PIN_HIST_MAX] = {
+	"Start bit low time",
+	"Start bit total period",
+	"Data bit 0 low time",
+	"Data bit 1 low time",
+	"Data bit total period",
+};
+
+// The histograms have 100 us buckets, the last one also has all longer times
+#define PIN_HIST_BUCKET_USECS		100
+#define PIN_HIST_BUCKETS		80
+
+struct cec_pin_hist {
+	__u64 cnt;
+	__u64 sum;
+	__u64 min;
+	__u64 max;
+	__u64 buckets[PIN_HIST_BUCKETS];
+};
+
+struct cec_pin_la_stats {
+	__u64 tx;
+	__u64 rx;
+	__u64 nacks;
+	__u64 errs;
+};
+
+struct cec_pin_stats {
+	__u64 msgs;
+	__u64 bytes;
+	__u64 errs[PIN_ERR_MAX];
+	// errors before the follower of the message is known
+	__u64 unknown_la_errs;
+	struct cec_pin_la_stats la[16];
+	struct cec_pin_hist hist[PIN_HIST_MAX];
+};
+
+static void pin_err(struct cec_pin_decoder *d, enum cec_pin_err err)
+{
+	struct cec_pin_stats *stats = d->stats;
+
+	if (!stats)
+		return;
+	stats->errs[err]++;
+	if (d->state == CEC_ST_RECEIVING_DATA && d->msg.len)
+		stats->la[cec_msg_destination(&d->msg)].errs++;
+	else
+		stats->unknown_la_errs++;
+}
+
+static void pin_hist(struct cec_pin_decoder *d, enum cec_pin_hist_type type,
+		     __u64 usecs)
+{
+	struct cec_pin_hist *hist;
+	__u64 bucket = usecs / PIN_HIST_BUCKET_USECS;
+
+	if (!d->stats)
+		return;
+	hist = &d->stats->hist[type];
+	if (!hist->cnt || usecs < hist->min)
+		hist->min = usecs;
+	if (usecs > hist->max)
+		hist->max = usecs;
+	hist->cnt++;
+	hist->sum += usecs;
+	hist->buckets[bucket < PIN_HIST_BUCKETS ? bucket : PIN_HIST_BUCKETS - 1]++;
+}
+
+static void cec_pin_rx_start_bit_was_high(struct cec_pin_decoder *d, bool is_high, __u64 usecs, __u64 usecs_min, bool show)
 {
-	bool period_too_long = low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_LONG;
-
-	if (is_high && show)
-		printf("%s: warn: start bit: total period too long\n", ts2s(ts).c_str());
-	else if (low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_MAX && show)
-		printf("%s: warn: start bit: total period too long (%.2f > %.2f ms)\n",
-		       ts2s(ts).c_str(), (low_usecs + usecs) / 1000.0,
-		       CEC_TIM_START_BIT_TOTAL_MAX / 1000.0);
+	bool period_too_long = d->low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_LONG;
+
+	if (is_high) {
+		pin_err(d, PIN_ERR_START_PERIOD_LONG);
+		if (show)
+			printf("%s: warn: start bit: total period too long\n", ts2s(d->ts).c_str());
+	} else if (d->low_usecs + usecs > CEC_TIM_START_BIT_TOTAL_MAX) {
+		pin_err(d, PIN_ERR_START_PERIOD_LONG);
+		if (show)
+			printf("%s: warn: start bit: total period too long (%.2f > %.2f ms)\n",
+			       ts2s(d->ts).c_str(), (d->low_usecs + usecs) / 1000.0,
+			       CEC_TIM_START_BIT_TOTAL_MAX / 1000.0);
+	}
+	if (!is_high)
+		pin_hist(d, PIN_HIST_START_PERIOD, d->low_usecs + usecs);
 	if (is_high || period_too_long) {
 		if (show)
 			printf("\n");
-		state = CEC_ST_IDLE;
+		d->state = CEC_ST_IDLE;
 		return;
 	}
-	if (low_usecs + usecs < CEC_TIM_START_BIT_TOTAL_MIN - CEC_TIM_MARGIN && show)
-		printf("%s: warn: start bit: total period too short (%.2f < %.2f ms)\n",
-		       ts2s(ts).c_str(), (low_usecs + usecs) / 1000.0,
-		       CEC_TIM_START_BIT_TOTAL_MIN / 1000.0);
-	state = CEC_ST_RECEIVING_DATA;
-	rx_bit = 0;
-	byte = 0;
-	eom = false;
-	eom_reached = false;
-	byte_cnt = 0;
-	bcast = false;
-	cdc = false;
-	msg.len = 0;
+	if (d->low_usecs + usecs < CEC_TIM_START_BIT_TOTAL_MIN - CEC_TIM_MARGIN) {
+		pin_err(d, PIN_ERR_START_PERIOD_SHORT);
+		if (show)
+			printf("%s: warn: start bit: total period too short (%.2f < %.2f ms)\n",
+			       ts2s(d->ts).c_str(), (d->low_usecs + usecs) / 1000.0,
+			       CEC_TIM_START_BIT_TOTAL_MIN / 1000.0);
+	}
+	d->state = CEC_ST_RECEIVING_DATA;
+	d->rx_bit = 0;
+	d->byte = 0;
+	d->eom = false;
+	d->eom_reached = false;
+	d->byte_cnt = 0;
+	d->bcast = false;
+	d->cdc = false;
+	d->nack = false;
+	d->msg.len = 0;
 }
 
-static void cec_pin_rx_start_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_min, bool show)
+static void cec_pin_rx_start_bit_was_low(struct cec_pin_decoder *d, __u64 ev_ts, __u64 usecs, __u64 usecs_min, bool show)
 {
-	if (usecs_min > CEC_TIM_START_BIT_LOW_MAX && show)
-		printf("%s: warn: start bit: low time too long (%.2f > %.2f ms)\n",
-			ts2s(ts).c_str(), usecs / 1000.0,
-			CEC_TIM_START_BIT_LOW_MAX / 1000.0);
+	pin_hist(d, PIN_HIST_START_LOW, usecs);
+	if (usecs_min > CEC_TIM_START_BIT_LOW_MAX) {
+		pin_err(d, PIN_ERR_START_LOW_LONG);
+		if (show)
+			printf("%s: warn: start bit: low time too long (%.2f > %.2f ms)\n",
+				ts2s(d->ts).c_str(), usecs / 1000.0,
+				CEC_TIM_START_BIT_LOW_MAX / 1000.0);
+	}
 	if (usecs_min > CEC_TIM_START_BIT_LOW_MAX + CEC_TIM_MARGIN * 5) {
 		if (show)
 			printf("\n");
-		state = CEC_ST_IDLE;
+		d->state = CEC_ST_IDLE;
 		return;
 	}
 	if (usecs_min < CEC_TIM_START_BIT_LOW_MIN - CEC_TIM_MARGIN * 6) {
-		state = CEC_ST_IDLE;
+		d->state = CEC_ST_IDLE;
 		return;
 	}
-	low_usecs = usecs;
-	eob_ts = ev_ts + 1000 * (CEC_TIM_START_BIT_TOTAL - low_usecs);
-	eob_ts_max = ev_ts + 1000 * (CEC_TIM_START_BIT_TOTAL_LONG - low_usecs);
+	d->low_usecs = usecs;
+	d->eob_ts = ev_ts + 1000 * (CEC_TIM_START_BIT_TOTAL - d->low_usecs);
+	d->eob_ts_max = ev_ts + 1000 * (CEC_TIM_START_BIT_TOTAL_LONG - d->low_usecs);
 }
 
-static void cec_pin_rx_data_bit_was_high(bool is_high, __u64 ev_ts,
+static void cec_pin_rx_data_bit_was_high(struct cec_pin_decoder *d, bool is_high, __u64 ev_ts,
 					 __u64 usecs, __u64 usecs_min, bool show)
 {
-	bool period_too_long = low_usecs + usecs > CEC_TIM_DATA_BIT_TOTAL_LONG;
+	bool period_too_long = d->low_usecs + usecs > CEC_TIM_DATA_BIT_TOTAL_LONG;
 	bool bit;
 
-	if (is_high && rx_bit < 9 && show)
-		printf("%s: warn: data bit %d: total period too long\n", ts2s(ts).c_str(), rx_bit);
-	else if (rx_bit < 9 && show &&
-		 low_usecs + usecs > CEC_TIM_DATA_BIT_TOTAL_MAX + CEC_TIM_MARGIN)
-		printf("%s: warn: data bit %d: total period too long (%.2f ms)\n",
-			ts2s(ts).c_str(), rx_bit, (low_usecs + usecs) / 1000.0);
-	if (low_usecs + usecs < CEC_TIM_DATA_BIT_TOTAL_MIN - CEC_TIM_MARGIN && show)
-		printf("%s: warn: data bit %d: total period too short (%.2f ms)\n",
-			ts2s(ts).c_str(), rx_bit, (low_usecs + usecs) / 1000.0);
-
-	bit = low_usecs < CEC_TIM_DATA_BIT_1_LOW_MAX + CEC_TIM_MARGIN;
-	if (rx_bit <= 7) {
-		byte |= bit << (7 - rx_bit);
-	} else if (rx_bit == 8) {
-		eom = bit;
+	if (is_high && d->rx_bit < 9) {
+		pin_err(d, PIN_ERR_DATA_PERIOD_LONG);
+		if (show)
+			printf("%s: warn: data bit %d: total period too long\n", ts2s(d->ts).c_str(), d->rx_bit);
+	} else if (d->rx_bit < 9 &&
+		   d->low_usecs + usecs > CEC_TIM_DATA_BIT_TOTAL_MAX + CEC_TIM_MARGIN) {
+		pin_err(d, PIN_ERR_DATA_PERIOD_LONG);
+		if (show)
+			printf("%s: warn: data bit %d: total period too long (%.2f ms)\n",
+				ts2s(d->ts).c_str(), d->rx_bit, (d->low_usecs + usecs) / 1000.0);
+	}
+	if (d->low_usecs + usecs < CEC_TIM_DATA_BIT_TOTAL_MIN - CEC_TIM_MARGIN) {
+		pin_err(d, PIN_ERR_DATA_PERIOD_SHORT);
+		if (show)
+			printf("%s: warn: data bit %d: total period too short (%.2f ms)\n",
+				ts2s(d->ts).c_str(), d->rx_bit, (d->low_usecs + usecs) / 1000.0);
+	}
+
+	bit = d->low_usecs < CEC_TIM_DATA_BIT_1_LOW_MAX + CEC_TIM_MARGIN;
+	pin_hist(d, bit ? PIN_HIST_BIT_1_LOW : PIN_HIST_BIT_0_LOW, d->low_usecs);
+	if (!is_high)
+		pin_hist(d, PIN_HIST_BIT_PERIOD, d->low_usecs + usecs);
+	if (d->rx_bit <= 7) {
+		d->byte |= bit << (7 - d->rx_bit);
+	} else if (d->rx_bit == 8) {
+		d->eom = bit;
 	} else {
 		std::string s;
 
-		if (byte_cnt == 0) {
-			bcast = (byte & 0xf) == 0xf;
-			s = ": " + std::string(cec_la2s(byte >> 4)) +
-			    " to " + (bcast ? "All" : cec_la2s(byte & 0xf));
-		} else if (byte_cnt == 1) {
-			s = find_opcode_name(byte);
-		} else if (cdc && byte_cnt == 4) {
-			s = find_cdc_opcode_name(byte);
+		if (d->byte_cnt == 0) {
+			d->bcast = (d->byte & 0xf) == 0xf;
+			s = ": " + std::string(cec_la2s(d->byte >> 4)) +
+			    " to " + (d->bcast ? "All" : cec_la2s(d->byte & 0xf));
+		} else if (d->byte_cnt == 1) {
+			s = find_opcode_name(d->byte);
+		} else if (d->cdc && d->byte_cnt == 4) {
+			s = find_cdc_opcode_name(d->byte);
 		}
 
-		bool ack = !(bcast ^ bit);
-
-		if (msg.len < CEC_MAX_MSG_SIZE)
-			msg.msg[msg.len++] = byte;
+		bool ack = !(d->bcast ^ bit);
+
+		if (d->msg.len < CEC_MAX_MSG_SIZE)
+			d->msg.msg[d->msg.len++] = d->byte;
+		if (!ack)
+			d->nack = true;
+		if (d->eom_reached)
+			pin_err(d, PIN_ERR_SPURIOUS_BYTE);
+		if (d->stats && !d->eom_reached) {
+			struct cec_pin_stats *stats = d->stats;
+
+			stats->bytes++;
+			if (d->eom) {
+				stats->msgs++;
+				stats->la[cec_msg_initiator(&d->msg)].tx++;
+				stats->la[cec_msg_destination(&d->msg)].rx++;
+				if (d->nack)
+					stats->la[cec_msg_destination(&d->msg)].nacks++;
+			}
+		}
 		if (show)
-			printf("%s: rx 0x%02x%s%s%s%s%s\n", ts2s(ts).c_str(), byte,
-			       eom ? " EOM" : "", ack ? " ACK" : " NACK",
-			       bcast ? " (broadcast)" : "",
-			       eom_reached ? " (warn: spurious byte)" : "",
+			printf("%s: rx 0x%02x%s%s%s%s%s\n", ts2s(d->ts).c_str(), d->byte,
+			       d->eom ? " EOM" : "", ack ? " ACK" : " NACK",
+			       d->bcast ? " (broadcast)" : "",
+			       d->eom_reached ? " (warn: spurious byte)" : "",
 			       s.c_str());
-		if (!eom_reached && is_high && !eom && ack && show)
-			printf("%s: warn: missing EOM\n", ts2s(ts).c_str());
-		else if (!is_high && !period_too_long && verbose && show)
+		if (!d->eom_reached && is_high && !d->eom && ack) {
+			pin_err(d, PIN_ERR_MISSING_EOM);
+			if (show)
+				printf("%s: warn: missing EOM\n", ts2s(d->ts).c_str());
+		} else if (!is_high && !period_too_long && verbose && show)
 			printf("\n");
-		if (byte_cnt == 1 && byte == CEC_MSG_CDC_MESSAGE)
-			cdc = true;
-		byte_cnt++;
-		if (byte_cnt >= CEC_MAX_MSG_SIZE)
-			eom_reached = true;
-		if (show && eom && msg.len > 2) {
-			msg.rx_status = CEC_RX_STATUS_OK;
-			msg.rx_ts = ev_ts;
+		if (d->byte_cnt == 1 && d->byte == CEC_MSG_CDC_MESSAGE)
+			d->cdc = true;
+		d->byte_cnt++;
+		if (d->byte_cnt >= CEC_MAX_MSG_SIZE)
+			d->eom_reached = true;
+		if (show && d->eom && d->msg.len > 2) {
+			d->msg.rx_status = CEC_RX_STATUS_OK;
+			d->msg.rx_ts = ev_ts;
 			printf("\nTransmit from %s to %s (%d to %d):\n",
-			       cec_la2s(cec_msg_initiator(&msg)),
-			       cec_msg_is_broadcast(&msg) ? "all" : cec_la2s(cec_msg_destination(&msg)),
-			       cec_msg_initiator(&msg), cec_msg_destination(&msg));
-			cec_log_msg(&msg);
+			       cec_la2s(cec_msg_initiator(&d->msg)),
+			       cec_msg_is_broadcast(&d->msg) ? "all" : cec_la2s(cec_msg_destination(&d->msg)),
+			       cec_msg_initiator(&d->msg), cec_msg_destination(&d->msg));
+			cec_log_msg(&d->msg);
 		}
 	}
-	rx_bit++;
-	if ((is_high || period_too_long) && !eom) {
-		eom_reached = false;
+	d->rx_bit++;
+	if ((is_high || period_too_long) && !d->eom) {
+		d->eom_reached = false;
 		if (show)
 			printf("\n");
-		state = is_high ? CEC_ST_IDLE : CEC_ST_RECEIVE_START_BIT;
+		d->state = is_high ? CEC_ST_IDLE : CEC_ST_RECEIVE_START_BIT;
 		return;
 	}
-	if (rx_bit == 10) {
-		if (eom) {
-			eom_reached = true;
+	if (d->rx_bit == 10) {
+		if (d->eom) {
+			d->eom_reached = true;
 			if (is_high) {
 				if (show)
 					printf("\n");
-				state = CEC_ST_IDLE;
+				d->state = CEC_ST_IDLE;
 			}
 		}
-		rx_bit = 0;
-		byte = 0;
-		eom = false;
+		d->rx_bit = 0;
+		d->byte = 0;
+		d->eom = false;
 	}
 }
 
-static void cec_pin_rx_data_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_min, bool show)
+static void cec_pin_rx_data_bit_was_low(struct cec_pin_decoder *d, __u64 ev_ts, __u64 usecs, __u64 usecs_min, bool show)
 {
 	/*
 	 * If the low drive starts at the end of a 0 bit, then the actual
@@ -240,76 +413,85 @@ static void cec_pin_rx_data_bit_was_low(__u64 ev_ts, __u64 usecs, __u64 usecs_mi
 	const unsigned max_low_drive = static_cast<unsigned>(CEC_TIM_LOW_DRIVE_ERROR_MAX) +
 		CEC_TIM_DATA_BIT_0_LOW_MAX + CEC_TIM_MARGIN;
 
-	low_usecs = usecs;
+	d->low_usecs = usecs;
 	if (usecs >= CEC_TIM_LOW_DRIVE_ERROR_MIN - CEC_TIM_MARGIN) {
-		if (usecs >= max_low_drive && show)
-			printf("%s: warn: low drive too long (%.2f > %.2f ms)\n\n",
-			       ts2s(ts).c_str(), usecs / 1000.0,
-			       CEC_TIM_LOW_DRIVE_ERROR_MAX / 1000.0);
+		if (usecs >= max_low_drive) {
+			pin_err(d, PIN_ERR_LOW_DRIVE_LONG);
+			if (show)
+				printf("%s: warn: low drive too long (%.2f > %.2f ms)\n\n",
+				       ts2s(d->ts).c_str(), usecs / 1000.0,
+				       CEC_TIM_LOW_DRIVE_ERROR_MAX / 1000.0);
+		}
 		if (show)
 			printf("\n");
-		state = CEC_ST_IDLE;
+		d->state = CEC_ST_IDLE;
 		return;
 	}
 
-	if (rx_bit == 0 && byte_cnt &&
+	if (d->rx_bit == 0 && d->byte_cnt &&
 	    usecs >= CEC_TIM_START_BIT_LOW_MIN - CEC_TIM_MARGIN) {
+		pin_err(d, PIN_ERR_UNEXPECTED_START);
 		if (show)
-			printf("%s: warn: unexpected start bit\n", ts2s(ts).c_str());
-		cec_pin_rx_start_bit_was_low(ev_ts, usecs, usecs_min, show);
-		state = CEC_ST_RECEIVE_START_BIT;
+			printf("%s: warn: unexpected start bit\n", ts2s(d->ts).c_str());
+		cec_pin_rx_start_bit_was_low(d, ev_ts, usecs, usecs_min, show);
+		d->state = CEC_ST_RECEIVE_START_BIT;
 		return;
 	}
 
 	if (usecs_min > CEC_TIM_DATA_BIT_0_LOW_MAX) {
+		pin_err(d, PIN_ERR_DATA_LOW_LONG);
 		if (show)
 			printf("%s: warn: data bit %d: low time too long (%.2f ms)\n",
-				ts2s(ts).c_str(), rx_bit, usecs / 1000.0);
+				ts2s(d->ts).c_str(), d->rx_bit, usecs / 1000.0);
 		if (usecs_min > CEC_TIM_DATA_BIT_TOTAL_MAX) {
 			if (show)
 				printf("\n");
-			state = CEC_ST_IDLE;
+			d->state = CEC_ST_IDLE;
 		}
 		return;
 	}
 	if (usecs_min > CEC_TIM_DATA_BIT_1_LOW_MAX &&
-	    usecs < CEC_TIM_DATA_BIT_0_LOW_MIN - CEC_TIM_MARGIN && show) {
-		printf("%s: warn: data bit %d: invalid 0->1 transition (%.2f ms)\n",
-			ts2s(ts).c_str(), rx_bit, usecs / 1000.0);
+	    usecs < CEC_TIM_DATA_BIT_0_LOW_MIN - CEC_TIM_MARGIN) {
+		pin_err(d, PIN_ERR_INVALID_0_TO_1);
+		if (show)
+			printf("%s: warn: data bit %d: invalid 0->1 transition (%.2f ms)\n",
+				ts2s(d->ts).c_str(), d->rx_bit, usecs / 1000.0);
 	}
-	if (usecs < CEC_TIM_DATA_BIT_1_LOW_MIN - CEC_TIM_MARGIN && show) {
-		printf("%s: warn: data bit %d: low time too short (%.2f ms)\n",
-			ts2s(ts).c_str(), rx_bit, usecs / 1000.0);
+	if (usecs < CEC_TIM_DATA_BIT_1_LOW_MIN - CEC_TIM_MARGIN) {
+		pin_err(d, PIN_ERR_DATA_LOW_SHORT);
+		if (show)
+			printf("%s: warn: data bit %d: low time too short (%.2f ms)\n",
+				ts2s(d->ts).c_str(), d->rx_bit, usecs / 1000.0);
 	}
 
-	eob_ts = ev_ts + 1000 * (CEC_TIM_DATA_BIT_TOTAL - low_usecs);
-	eob_ts_max = ev_ts + 1000 * (CEC_TIM_DATA_BIT_TOTAL_LONG - low_usecs);
+	d->eob_ts = ev_ts + 1000 * (CEC_TIM_DATA_BIT_TOTAL - d->low_usecs);
+	d->eob_ts_max = ev_ts + 1000 * (CEC_TIM_DATA_BIT_TOTAL_LONG - d->low_usecs);
 }
 
-static void cec_pin_debug(__u64 ev_ts, __u64 usecs, bool was_high, bool is_high, bool show)
+static void cec_pin_debug(struct cec_pin_decoder *d, __u64 ev_ts, __u64 usecs, bool was_high, bool is_high, bool show)
 {
 	__u64 usecs_min = usecs > CEC_TIM_MARGIN ? usecs - CEC_TIM_MARGIN : 0;
 
-	switch (state) {
+	switch (d->state) {
 	case CEC_ST_RECEIVE_START_BIT:
-		eom_reached = false;
+		d->eom_reached = false;
 		if (was_high)
-			cec_pin_rx_start_bit_was_high(is_high, usecs, usecs_min, show);
+			cec_pin_rx_start_bit_was_high(d, is_high, usecs, usecs_min, show);
 		else
-			cec_pin_rx_start_bit_was_low(ev_ts, usecs, usecs_min, show);
+			cec_pin_rx_start_bit_was_low(d, ev_ts, usecs, usecs_min, show);
 		break;
 
 	case CEC_ST_RECEIVING_DATA:
 		if (was_high)
-			cec_pin_rx_data_bit_was_high(is_high, ev_ts, usecs, usecs_min, show);
+			cec_pin_rx_data_bit_was_high(d, is_high, ev_ts, usecs, usecs_min, show);
 		else
-			cec_pin_rx_data_bit_was_low(ev_ts, usecs, usecs_min, show);
+			cec_pin_rx_data_bit_was_low(d, ev_ts, usecs, usecs_min, show);
 		break;
 
 	case CEC_ST_IDLE:
-		eom_reached = false;
+		d->eom_reached = false;
 		if (!is_high)
-			state = CEC_ST_RECEIVE_START_BIT;
+			d->state = CEC_ST_RECEIVE_START_BIT;
 		break;
 	}
 }
@@ -320,61 +502,61 @@ static void cec_pin_debug(__u64 ev_ts, __u64 usecs, bool was_high, bool is_high,
 			printf(fmt, ##args);	\
 	} while (0)
 
-void log_event_pin(bool is_high, __u64 ev_ts, bool show)
+static void cec_pin_decode(struct cec_pin_decoder *d, bool is_high, __u64 ev_ts, bool show)
 {
-	static __u64 last_ts;
-	static __u64 last_change_ts;
-	static __u64 last_1_to_0_ts;
-	static bool was_high = true;
-	double bit_periods = ((ev_ts - last_ts) / 1000.0) / CEC_TIM_DATA_BIT_TOTAL;
+	double bit_periods = ((ev_ts - d->last_ts) / 1000.0) / CEC_TIM_DATA_BIT_TOTAL;
 
-	eob_ts = eob_ts_max = 0;
+	d->eob_ts = d->eob_ts_max = 0;
 
-	ts = ev_ts / 1000000000.0;
-	if (last_change_ts == 0) {
-		last_ts = last_change_ts = last_1_to_0_ts = ev_ts - CEC_TIM_DATA_BIT_TOTAL * 16000;
+	d->ts = ev_ts / 1000000000.0;
+	if (d->last_change_ts == 0) {
+		d->last_ts = d->last_change_ts = d->last_1_to_0_ts = ev_ts - CEC_TIM_DATA_BIT_TOTAL * 16000;
 		if (is_high)
 			return;
 	}
+	// The same condition as for the low drive warning below
+	if (!d->was_high && d->state != CEC_ST_RECEIVE_START_BIT &&
+	    (ev_ts - d->last_change_ts) / 1000 >= CEC_TIM_LOW_DRIVE_ERROR_MIN - CEC_TIM_MARGIN)
+		pin_err(d, PIN_ERR_LOW_DRIVE);
 	if (show) {
-		double delta = (ev_ts - last_change_ts) / 1000000.0;
+		double delta = (ev_ts - d->last_change_ts) / 1000000.0;
 
-		if (!was_high && last_change_ts && state == CEC_ST_RECEIVE_START_BIT &&
+		if (!d->was_high && d->last_change_ts && d->state == CEC_ST_RECEIVE_START_BIT &&
 		    delta * 1000 >= CEC_TIM_START_BIT_LOW_MIN - CEC_TIM_MARGIN)
 			verb_printf("\n");
-		verb_printf("%s: ", ts2s(ts).c_str());
-		if (last_change_ts && is_high && was_high &&
-		    (ev_ts - last_1_to_0_ts) / 1000000 <= 10) {
+		verb_printf("%s: ", ts2s(d->ts).c_str());
+		if (d->last_change_ts && is_high && d->was_high &&
+		    (ev_ts - d->last_1_to_0_ts) / 1000000 <= 10) {
 			verb_printf("1 -> 1 (was 1 for %.2f ms, period of previous %spulse %.2f ms)\n",
-				    delta, state == CEC_ST_RECEIVE_START_BIT ? "start " : "",
-				    (ev_ts - last_1_to_0_ts) / 1000000.0);
-		} else if (last_change_ts && is_high && was_high) {
+				    delta, d->state == CEC_ST_RECEIVE_START_BIT ? "start " : "",
+				    (ev_ts - d->last_1_to_0_ts) / 1000000.0);
+		} else if (d->last_change_ts && is_high && d->was_high) {
 			verb_printf("1 -> 1 (%.2f ms)\n", delta);
-		} else if (was_high && state == CEC_ST_IDLE) {
+		} else if (d->was_high && d->state == CEC_ST_IDLE) {
 			if (bit_periods > 1 && bit_periods < 10)
 				verb_printf("1 -> 0 (was 1 for %.2f ms, signal free time = %.1f bit periods)\n",
 					    delta, bit_periods);
 			else
 				verb_printf("1 -> 0 (was 1 for %.2f ms)\n", delta);
-		} else if (was_high && (ev_ts - last_1_to_0_ts) / 1000000 <= 10) {
+		} else if (d->was_high && (ev_ts - d->last_1_to_0_ts) / 1000000 <= 10) {
 			verb_printf("1 -> 0 (was 1 for %.2f ms, period of previous %spulse %.2f ms)\n",
-				    delta, state == CEC_ST_RECEIVE_START_BIT ? "start " : "",
-				    (ev_ts - last_1_to_0_ts) / 1000000.0);
-		} else if (was_high) {
+				    delta, d->state == CEC_ST_RECEIVE_START_BIT ? "start " : "",
+				    (ev_ts - d->last_1_to_0_ts) / 1000000.0);
+		} else if (d->was_high) {
 			verb_printf("1 -> 0 (was 1 for %.2f ms)\n", delta);
-		} else if (last_change_ts && state == CEC_ST_RECEIVE_START_BIT &&
+		} else if (d->last_change_ts && d->state == CEC_ST_RECEIVE_START_BIT &&
 			   delta * 1000 < CEC_TIM_START_BIT_LOW_MIN - CEC_TIM_MARGIN) {
 			verb_printf("0 -> 1 (was 0 for %.2f ms, might indicate %d bit)\n", delta,
 				    delta * 1000 < CEC_TIM_DATA_BIT_1_LOW_MAX + CEC_TIM_MARGIN);
-		} else if (last_change_ts && state == CEC_ST_RECEIVE_START_BIT) {
+		} else if (d->last_change_ts && d->state == CEC_ST_RECEIVE_START_BIT) {
 			verb_printf("0 -> 1 (was 0 for %.2f ms)\n", delta);
-		} else if (last_change_ts &&
+		} else if (d->last_change_ts &&
 			   delta * 1000 >= CEC_TIM_LOW_DRIVE_ERROR_MIN - CEC_TIM_MARGIN) {
 			if (verbose)
 				printf("0 -> 1 (was 0 for %.2f ms, warn: indicates low drive)\n", delta);
 			else
-				printf("\n%s: warn: low drive for %.2f ms\n", ts2s(ts).c_str(), delta);
-		} else if (last_change_ts) {
+				printf("\n%s: warn: low drive for %.2f ms\n", ts2s(d->ts).c_str(), delta);
+		} else if (d->last_change_ts) {
 			verb_printf("0 -> 1 (was 0 for %.2f ms, indicates %d bit)\n", delta,
 				    delta * 1000 < CEC_TIM_DATA_BIT_1_LOW_MAX + CEC_TIM_MARGIN);
 		} else {
@@ -383,12 +565,267 @@ void log_event_pin(bool is_high, __u64 ev_ts, bool show)
 
 		if (!verbose && !is_high && bit_periods > 1 && bit_periods < 10)
 			printf("%s: signal free time = %.1f bit periods\n",
-			       ts2s(ts).c_str(), bit_periods);
+			       ts2s(d->ts).c_str(), bit_periods);
 	}
-	cec_pin_debug(ev_ts, (ev_ts - last_ts) / 1000, was_high, is_high, show);
-	last_change_ts = ev_ts;
+	cec_pin_debug(d, ev_ts, (ev_ts - d->last_ts) / 1000, d->was_high, is_high, show);
+	d->last_change_ts = ev_ts;
 	if (!is_high)
-		last_1_to_0_ts = ev_ts;
-	last_ts = ev_ts;
-	was_high = is_high;
+		d->last_1_to_0_ts = ev_ts;
+	d->last_ts = ev_ts;
+	d->was_high = is_high;
+}
+
+void log_event_pin(bool is_high, __u64 ev_ts, bool show)
+{
+	cec_pin_decode(&pin_decoder, is_high, ev_ts, show);
+	eob_ts = pin_decoder.eob_ts;
+	eob_ts_max = pin_decoder.eob_ts_max;
+}
+
+/*
+ * The statistics don't depend on the order the messages are decoded in,
+ * so the CEC pin events are split in chunks that are decoded in parallel.
+ * Each chunk starts with a falling edge after the bus was idle for a while,
+ * where the decoder should be idle. That is checked once the previous chunk
+ * is decoded, and if it wasn't, the chunk is decoded again from the right
+ * state.
+ */
+
+// Time the bus should be idle before a chunk starts
+#define PIN_CHUNK_IDLE_NS	(10ULL * CEC_TIM_DATA_BIT_TOTAL * 1000)
+// Number of CEC pin events decoded at once
+#define PIN_BATCH_EVENTS	(1 << 20)
+
+struct pin_edge {
+	__u64 ts;
+	bool is_high;
+};
+
+struct pin_chunk {
+	const struct pin_edge *edges;
+	unsigned num;
+	struct cec_pin_decoder d;
+	struct cec_pin_stats stats;
+	pthread_t thread;
+	bool threaded;
+};
+
+static void decode_edges(struct cec_pin_decoder *d, const struct pin_edge *edges,
+			 unsigned num)
+{
+	for (unsigned i = 0; i < num; i++)
+		cec_pin_decode(d, edges[i].is_high, edges[i].ts, false);
+}
+
+static void *pin_chunk_thread(void *arg)
+{
+	struct pin_chunk *chunk = static_cast<struct pin_chunk *>(arg);
+
+	decode_edges(&chunk->d, chunk->edges, chunk->num);
+	return nullptr;
+}
+
+static void add_pin_stats(struct cec_pin_stats &to, const struct cec_pin_stats &from)
+{
+	to.msgs += from.msgs;
+	to.bytes += from.bytes;
+	for (unsigned i = 0; i < PIN_ERR_MAX; i++)
+		to.errs[i] += from.errs[i];
+	to.unknown_la_errs += from.unknown_la_errs;
+	for (unsigned i = 0; i < 16; i++) {
+		to.la[i].tx += from.la[i].tx;
+		to.la[i].rx += from.la[i].rx;
+		to.la[i].nacks += from.la[i].nacks;
+		to.la[i].errs += from.la[i].errs;
+	}
+	for (unsigned i = 0; i < PIN_HIST_MAX; i++) {
+		struct cec_pin_hist &h = to.hist[i];
+		const struct cec_pin_hist &f = from.hist[i];
+
+		if (!f.cnt)
+			continue;
+		if (!h.cnt || f.min < h.min)
+			h.min = f.min;
+		if (f.max > h.max)
+			h.max = f.max;
+		h.cnt += f.cnt;
+		h.sum += f.sum;
+		for (unsigned b = 0; b < PIN_HIST_BUCKETS; b++)
+			h.buckets[b] += f.buckets[b];
+	}
+}
+
+static void decode_batch(struct cec_pin_decoder *d, const std::vector<pin_edge> &edges,
+			 unsigned jobs)
+{
+	struct cec_pin_stats *stats = d->stats;
+	std::vector<pin_chunk> chunks;
+	unsigned num = edges.size();
+	unsigned start = 0;
+
+	for (unsigned j = 1; j < jobs; j++) {
+		unsigned i = (__u64)num * j / jobs;
+
+		if (i <= start)
+			i = start + 1;
+		while (i < num && !(edges[i - 1].is_high && !edges[i].is_high &&
+				    edges[i].ts - edges[i - 1].ts >= PIN_CHUNK_IDLE_NS))
+			i++;
+		if (i >= num)
+			break;
+		chunks.push_back(pin_chunk());
+		chunks.back().edges = &edges[start];
+		chunks.back().num = i - start;
+		start = i;
+	}
+	if (chunks.empty()) {
+		decode_edges(d, edges.data(), num);
+		return;
+	}
+	chunks.push_back(pin_chunk());
+	chunks.back().edges = &edges[start];
+	chunks.back().num = num - start;
+
+	for (unsigned j = 0; j < chunks.size(); j++) {
+		struct pin_chunk &chunk = chunks[j];
+
+		if (j == 0) {
+			chunk.d = *d;
+		} else {
+			__u64 prev_ts = chunk.edges[-1].ts;
+
+			chunk.d.state = CEC_ST_IDLE;
+			chunk.d.last_ts = chunk.d.last_change_ts = prev_ts;
+			chunk.d.last_1_to_0_ts = prev_ts;
+			chunk.d.was_high = true;
+		}
+		chunk.d.stats = &chunk.stats;
+		chunk.threaded = j && !pthread_create(&chunk.thread, nullptr,
+						      pin_chunk_thread, &chunk);
+	}
+	for (unsigned j = 0; j < chunks.size(); j++) {
+		struct pin_chunk &chunk = chunks[j];
+
+		if (!chunk.threaded)
+			pin_chunk_thread(&chunk);
+	}
+
+	for (unsigned j = 0; j < chunks.size(); j++) {
+		struct pin_chunk &chunk = chunks[j];
+
+		if (chunk.threaded)
+			pthread_join(chunk.thread, nullptr);
+		if (j && d->state != CEC_ST_IDLE) {
+			// The chunk started in the middle of a message
+			decode_edges(d, chunk.edges, chunk.num);
+			continue;
+		}
+		add_pin_stats(*stats, chunk.stats);
+		*d = chunk.d;
+		d->stats = stats;
+	}
+}
+
+static void show_pin_hist(const struct cec_pin_hist &hist, const char *name)
+{
+	if (!hist.cnt)
+		return;
+	printf("\n%s: %llu, min %.2f ms, avg %.2f ms, max %.2f ms\n", name, hist.cnt,
+	       hist.min / 1000.0, hist.sum / 1000.0 / hist.cnt, hist.max / 1000.0);
+	for (unsigned b = 0; b < PIN_HIST_BUCKETS; b++) {
+		if (!hist.buckets[b])
+			continue;
+		if (b == PIN_HIST_BUCKETS - 1)
+			printf("\t>= %.1f ms:      %llu\n",
+			       b * PIN_HIST_BUCKET_USECS / 1000.0, hist.buckets[b]);
+		else
+			printf("\t%.1f - %.1f ms: %llu\n",
+			       b * PIN_HIST_BUCKET_USECS / 1000.0,
+			       (b + 1) * PIN_HIST_BUCKET_USECS / 1000.0, hist.buckets[b]);
+	}
+}
+
+bool analyze_pin_stats(pin_reader &reader, unsigned jobs)
+{
+	struct cec_pin_stats stats = {};
+	struct cec_pin_decoder d = cec_pin_decoder();
+	std::vector<pin_edge> edges;
+	__u64 cec_events = 0, hpd_events = 0, v5_events = 0;
+	__u64 state_changes = 0, dropped = 0;
+	struct pin_rec rec;
+	__u64 errs = 0;
+	int ret;
+
+	d.stats = &stats;
+	edges.reserve(PIN_BATCH_EVENTS);
+	while ((ret = reader.next(rec)) > 0) {
+		if (rec.type != PIN_REC_EVENT)
+			continue;
+
+		unsigned event = rec.event & ~MONITOR_FL_DROPPED_EVENTS;
+
+		if (rec.event & MONITOR_FL_DROPPED_EVENTS)
+			dropped++;
+		switch (event + CEC_EVENT_PIN_CEC_LOW) {
+		case CEC_EVENT_PIN_CEC_LOW:
+		case CEC_EVENT_PIN_CEC_HIGH:
+			cec_events++;
+			edges.push_back(pin_edge());
+			edges.back().ts = rec.ts;
+			edges.back().is_high = event + CEC_EVENT_PIN_CEC_LOW == CEC_EVENT_PIN_CEC_HIGH;
+			if (edges.size() == PIN_BATCH_EVENTS) {
+				decode_batch(&d, edges, jobs);
+				edges.clear();
+			}
+			break;
+		case CEC_EVENT_PIN_HPD_LOW:
+		case CEC_EVENT_PIN_HPD_HIGH:
+			hpd_events++;
+			break;
+		case CEC_EVENT_PIN_5V_LOW:
+		case CEC_EVENT_PIN_5V_HIGH:
+			v5_events++;
+			break;
+		default:
+			if (event == MONITOR_STATE_CHANGE)
+				state_changes++;
+			break;
+		}
+	}
+	decode_batch(&d, edges, jobs);
+	if (d.eob_ts)
+		cec_pin_decode(&d, true, d.eob_ts, false);
+	if (ret < 0)
+		return false;
+
+	printf("CEC pin events:       %llu\n", cec_events);
+	printf("HPD pin events:       %llu\n", hpd_events);
+	printf("5V pin events:        %llu\n", v5_events);
+	printf("State changes:        %llu\n", state_changes);
+	printf("Dropped events:       %llu\n", dropped);
+	printf("Messages:             %llu\n", stats.msgs);
+	printf("Bytes:                %llu\n", stats.bytes);
+
+	for (unsigned i = 0; i < PIN_ERR_MAX; i++)
+		errs += stats.errs[i];
+	printf("Warnings:             %llu\n", errs);
+	for (unsigned i = 0; i < PIN_ERR_MAX; i++)
+		if (stats.errs[i])
+			printf("\t%-36s %llu\n", pin_err_names[i], stats.errs[i]);
+
+	printf("\nLogical Address         Transmitted    Received      NACKed    Warnings\n");
+	for (unsigned i = 0; i < 16; i++) {
+		const struct cec_pin_la_stats &la = stats.la[i];
+
+		if (!la.tx && !la.rx && !la.errs)
+			continue;
+		printf("\t%-2u %-18s %11llu %11llu %11llu %11llu\n", i, cec_la2s(i),
+		       la.tx, la.rx, la.nacks, la.errs);
+	}
+	if (stats.unknown_la_errs)
+		printf("\tunknown %59llu\n", stats.unknown_la_errs);
+
+	for (unsigned i = 0; i < PIN_HIST_MAX; i++)
+		show_pin_hist(stats.hist[i], pin_hist_names[i]);
+	return true;
 }
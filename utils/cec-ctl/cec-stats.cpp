@@ -0,0 +1,238 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <linux/cec.h>
+
+#include "cec-ctl.h"
+
+/*
+ * Message statistics
+ *
+ * The transmit status of the messages transmitted by this adapter tells
+ * how often a message had to be retried and why. The response times are
+ * either taken from the replies to the messages transmitted by cec-ctl,
+ * or, when monitoring, from the time between a directed message and the
+ * next message from its follower back to the initiator or to all.
+ *
+ * As for the approximate response time shown when transmitting, the time
+ * it took to transmit the reply is subtracted.
+ */
+
+// Replies are expected within a second, see the CEC 2.0 spec
+#define RESPONSE_TIMEOUT_NS	1000000000ULL
+
+static unsigned now_secs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static unsigned msg_time_ms(unsigned len)
+{
+	// Approx. duration of a message, 24 ms per byte
+	return len * 24;
+}
+
+void msg_stats::latency_hist::add(unsigned ms)
+{
+	if (buckets.empty())
+		buckets.resize(STATS_MAX_LATENCY_MS + 1);
+	if (!cnt || ms < min)
+		min = ms;
+	if (ms > max)
+		max = ms;
+	cnt++;
+	buckets[ms < STATS_MAX_LATENCY_MS ? ms : STATS_MAX_LATENCY_MS]++;
+}
+
+unsigned msg_stats::latency_hist::percentile(unsigned pct) const
+{
+	__u64 rank = (cnt * pct + 99) / 100;
+	__u64 sum = 0;
+
+	if (!rank)
+		rank = 1;
+	for (unsigned ms = 0; ms <= STATS_MAX_LATENCY_MS; ms++) {
+		sum += buckets[ms];
+		if (sum >= rank)
+			return ms < max ? ms : max;
+	}
+	return max;
+}
+
+msg_stats::msg_stats()
+{
+	memset(&tx, 0, sizeof(tx));
+	memset(pairs, 0, sizeof(pairs));
+	memset(pending, 0, sizeof(pending));
+	start = now_secs();
+	rx_msgs = 0;
+	reply_timeouts = 0;
+	feature_aborts = 0;
+}
+
+void msg_stats::add_tx_status(const struct cec_msg &msg, __u8 from, __u8 to)
+{
+	unsigned attempts = msg.tx_arb_lost_cnt + msg.tx_nack_cnt +
+			    msg.tx_low_drive_cnt + msg.tx_error_cnt;
+
+	tx.msgs++;
+	if (msg.tx_status & CEC_TX_STATUS_OK)
+		tx.ok++;
+	if (msg.tx_status & CEC_TX_STATUS_NACK)
+		tx.nack++;
+	if (msg.tx_status & CEC_TX_STATUS_ARB_LOST)
+		tx.arb_lost++;
+	if (msg.tx_status & CEC_TX_STATUS_LOW_DRIVE)
+		tx.low_drive++;
+	if (msg.tx_status & CEC_TX_STATUS_ERROR)
+		tx.error++;
+	if (msg.tx_status & CEC_TX_STATUS_MAX_RETRIES)
+		tx.max_retries++;
+	if (msg.tx_status & CEC_TX_STATUS_ABORTED)
+		tx.aborted++;
+	if (msg.tx_status & CEC_TX_STATUS_TIMEOUT)
+		tx.timeout++;
+	tx.arb_lost_cnt += msg.tx_arb_lost_cnt;
+	tx.nack_cnt += msg.tx_nack_cnt;
+	tx.low_drive_cnt += msg.tx_low_drive_cnt;
+	tx.error_cnt += msg.tx_error_cnt;
+	// The last failed attempt of a message that wasn't sent isn't retried
+	if (!(msg.tx_status & CEC_TX_STATUS_OK) && attempts)
+		attempts--;
+	tx.retries += attempts;
+	if (msg.tx_status & CEC_TX_STATUS_NACK)
+		pairs[from][to].nacks++;
+}
+
+void msg_stats::add_latency(__u8 from, __u8 to, unsigned opcode, unsigned ms)
+{
+	opcodes[opcode].add(ms);
+	pair_latency[(from << 4) | to].add(ms);
+}
+
+void msg_stats::add(const struct cec_msg &msg)
+{
+	__u8 from = cec_msg_initiator(&msg);
+	__u8 to = cec_msg_destination(&msg);
+	bool transmitted = msg.tx_status != 0;
+	__u64 ts = transmitted ? msg.tx_ts : msg.rx_ts;
+
+	if (transmitted)
+		add_tx_status(msg, from, to);
+	else
+		rx_msgs++;
+	pairs[from][to].msgs++;
+
+	if (transmitted && !(msg.tx_status & CEC_TX_STATUS_OK))
+		return;
+
+	// Is this the response to a message sent to its initiator?
+	for (unsigned la = 0; la < 16; la++) {
+		struct pending_msg &p = pending[la][from];
+
+		if (!p.ts || (to != la && to != CEC_LOG_ADDR_BROADCAST))
+			continue;
+		if (ts - p.ts <= RESPONSE_TIMEOUT_NS) {
+			unsigned ms = (ts - p.ts) / 1000000;
+
+			ms = ms >= msg_time_ms(msg.len) ? ms - msg_time_ms(msg.len) : 0;
+			add_latency(la, from, p.opcode, ms);
+			if (msg.len > 1 && msg.msg[1] == CEC_MSG_FEATURE_ABORT)
+				feature_aborts++;
+		}
+		p.ts = 0;
+	}
+
+	if (msg.len > 1 && to != CEC_LOG_ADDR_BROADCAST && from != to) {
+		pending[from][to].ts = ts;
+		pending[from][to].opcode = msg.msg[1];
+	}
+}
+
+void msg_stats::add_transmit(const struct cec_msg &msg, __u8 hdr, unsigned opcode)
+{
+	__u8 from = hdr >> 4;
+	__u8 to = hdr & 0xf;
+
+	add_tx_status(msg, from, to);
+	pairs[from][to].msgs++;
+	if (msg.rx_status & CEC_RX_STATUS_TIMEOUT)
+		reply_timeouts++;
+	if (msg.rx_status & CEC_RX_STATUS_FEATURE_ABORT)
+		feature_aborts++;
+	if (msg.rx_ts && (msg.rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT))) {
+		unsigned ms = (msg.rx_ts - msg.tx_ts) / 1000000;
+
+		ms = ms >= msg_time_ms(msg.len) ? ms - msg_time_ms(msg.len) : 0;
+		add_latency(from, to, opcode, ms);
+	}
+}
+
+void msg_stats::show() const
+{
+	printf("\nMessage statistics after %u s:\n", now_secs() - start);
+	printf("\tReceived:              %llu\n", rx_msgs);
+	printf("\tTransmitted:           %llu\n", tx.msgs);
+	if (tx.msgs) {
+		printf("\t  Status:              OK: %llu, NACK: %llu, Arbitration Lost: %llu, Low Drive: %llu,\n"
+		       "\t                       Error: %llu, Max Retries: %llu, Aborted: %llu, Timeout: %llu\n",
+		       tx.ok, tx.nack, tx.arb_lost, tx.low_drive, tx.error,
+		       tx.max_retries, tx.aborted, tx.timeout);
+		printf("\t  Failed attempts:     NACK: %llu, Arbitration Lost: %llu, Low Drive: %llu, Error: %llu\n",
+		       tx.nack_cnt, tx.arb_lost_cnt, tx.low_drive_cnt, tx.error_cnt);
+		printf("\t  Retries:             %llu\n", tx.retries);
+	}
+	if (reply_timeouts)
+		printf("\tReply timeouts:        %llu\n", reply_timeouts);
+	printf("\tFeature Abort replies: %llu\n", feature_aborts);
+
+	if (opcodes.empty())
+		return;
+
+	printf("\n\t%-44s %7s %6s %6s %6s %6s %6s\n", "Response time (ms) by request",
+	       "count", "min", "p50", "p90", "p99", "max");
+	for (const auto &it : opcodes) {
+		const char *name = cec_opcode2s(it.first);
+		char buf[16];
+
+		if (!name) {
+			sprintf(buf, "0x%02x", it.first);
+			name = buf;
+		}
+		printf("\t%-44s %7llu %6u %6u %6u %6u %6u\n", name, it.second.cnt,
+		       it.second.min, it.second.percentile(50), it.second.percentile(90),
+		       it.second.percentile(99), it.second.max);
+	}
+
+	printf("\n\t%-44s %7s %6s %6s %6s %6s %6s %7s %7s\n", "Response time (ms) by initiator -> follower",
+	       "count", "min", "p50", "p90", "p99", "max", "msgs", "NACKs");
+	for (unsigned from = 0; from < 16; from++) {
+		for (unsigned to = 0; to < 16; to++) {
+			const struct pair_stats &p = pairs[from][to];
+			auto lat = pair_latency.find((from << 4) | to);
+			char name[64];
+
+			if (!p.msgs)
+				continue;
+			snprintf(name, sizeof(name), "%x -> %x (%s)", from, to,
+				 to == CEC_LOG_ADDR_BROADCAST ? "all" : cec_la2s(to));
+			if (lat != pair_latency.end())
+				printf("\t%-44s %7llu %6u %6u %6u %6u %6u", name, lat->second.cnt,
+				       lat->second.min, lat->second.percentile(50),
+				       lat->second.percentile(90), lat->second.percentile(99),
+				       lat->second.max);
+			else
+				printf("\t%-44s %7s %6s %6s %6s %6s %6s", name, "0", "-", "-", "-", "-", "-");
+			printf(" %7llu %7llu\n", p.msgs, p.nacks);
+		}
+	}
+}
@@ -11,6 +11,7 @@
 #include <getopt.h>
 #include <sys/ioctl.h>
 
+#include "cec-emu.h"
 #include "cec-follower.h"
 #include "compiler.h"
 
@@ -83,6 +84,8 @@ static void usage()
 	printf("Usage:\n"
 	       "  -d, --device <dev>  Use device <dev> instead of /dev/cec0\n"
 	       "                      If <dev> starts with a digit, then /dev/cec<dev> is used.\n"
+	       "                      If <dev> is emu:<bus>:<n>, then emulated adapter <n> of\n"
+	       "                      the shared memory bus <bus> is used.\n"
 	       "  -D, --driver <driver>    Use a cec device with this driver name\n"
 	       "  -a, --adapter <adapter>  Use a cec device with this adapter name\n"
 	       "  -h, --help          Display this help message\n"
@@ -279,7 +282,7 @@ int cec_named_ioctl(int fd, const char *name,
 	int retval;
 	int e;
 
-	retval = ioctl(fd, request, parm);
+	retval = cec_ioctl(fd, request, parm);
 
 	e = retval == 0 ? 0 : errno;
 	if (options[OptTrace])
@@ -556,7 +559,11 @@ int main(int argc, char **argv)
 	if (device.empty())
 		device = "/dev/cec0";
 
-	if ((fd = open(device.c_str(), O_RDWR)) < 0) {
+	if (cec_emu_is_device(device.c_str()))
+		fd = cec_emu_open(device.c_str());
+	else
+		fd = open(device.c_str(), O_RDWR);
+	if (fd < 0) {
 		fprintf(stderr, "Failed to open %s: %s\n", device.c_str(),
 			strerror(errno));
 		std::exit(EXIT_FAILURE);
@@ -4,12 +4,18 @@
  */
 
 #include <cerrno>
+#include <cstring>
 #include <ctime>
 #include <string>
 
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
+#include "cec-emu.h"
 #include "cec-follower.h"
 #include "compiler.h"
 
@@ -1078,12 +1084,126 @@ static void update_programmed_timers(struct node *node)
 	}
 }
 
+/*
+ * The longest time a deadline based on the wall clock is trusted, so a jump
+ * of the wall clock only delays the checks by that much.
+ */
+#define MAX_WALL_CLOCK_WAIT_NS (60 * 1000000000ULL)
+
+/* Returns the CLOCK_MONOTONIC timestamp at which time(nullptr) reaches t */
+static __u64 wall_clock_to_ts(time_t t, __u64 ts_now)
+{
+	struct timespec now;
+	__s64 wait;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	wait = (__s64)(t - now.tv_sec) * 1000000000LL - now.tv_nsec;
+	if (wait <= 0)
+		return ts_now;
+	if ((__u64)wait > MAX_WALL_CLOCK_WAIT_NS)
+		wait = MAX_WALL_CLOCK_WAIT_NS;
+	return ts_now + wait;
+}
+
+static void add_deadline(__u64 &next, __u64 ts)
+{
+	if (!next || ts < next)
+		next = ts;
+}
+
+/* When update_programmed_timers() has to look at the first timer again */
+static __u64 programmed_timers_deadline(struct node *node, time_t t, __u64 ts_now)
+{
+	auto it = programmed_timers.begin();
+	time_t current_minute = t / 60;
+	time_t timer_start_minute = it->start_time / 60;
+	time_t timer_end_minute = (it->start_time + it->duration) / 60;
+
+	if (timer_start_minute > current_minute)
+		return wall_clock_to_ts(timer_start_minute * 60, ts_now);
+	if (node->state.recording_controlled_by_timer && timer_end_minute > current_minute)
+		return wall_clock_to_ts(timer_end_minute * 60, ts_now);
+	/* If the deck is already recording, the timer overlaps from the next minute */
+	if (timer_start_minute == current_minute)
+		return wall_clock_to_ts((current_minute + 1) * 60, ts_now);
+	/* Overlapped timers are deleted one at a time */
+	return wall_clock_to_ts(t + 1, ts_now);
+}
+
+/*
+ * Returns the time at which the next of the time based checks done by
+ * testProcessing() is due, or 0 if none is pending. Each check has its own
+ * deadline, so it is done exactly when due instead of on the next periodic
+ * wakeup.
+ */
+static __u64 next_deadline(struct node *node, unsigned me, time_t last_pwr_status_toggle)
+{
+	time_t pwr_changed = node->state.power_status_changed_time;
+	__u64 ts_now = get_ts();
+	time_t t = time(nullptr);
+	__u64 next = 0;
+
+	/* The reported power state goes through a transient state */
+	if (t - pwr_changed <= time_to_transient)
+		add_deadline(next, wall_clock_to_ts(pwr_changed + time_to_transient + 1, ts_now));
+	else if (t - pwr_changed < time_to_stable)
+		add_deadline(next, wall_clock_to_ts(pwr_changed + time_to_stable, ts_now));
+
+	if (node->state.toggle_power_status && cec_has_tv(1 << me))
+		add_deadline(next, wall_clock_to_ts(last_pwr_status_toggle +
+						    node->state.toggle_power_status + 1, ts_now));
+
+	/*
+	 * Each second one logical address is polled, if it was not heard
+	 * from for POLL_PERIOD. Wake up at the start of the first second
+	 * with something to poll.
+	 */
+	for (__u64 s = ts_to_s(ts_now) + 1; s <= ts_to_s(ts_now) + 2 * 16; s++) {
+		unsigned poll_la = s % 16;
+		__u64 ts = s * 1000000000ULL;
+
+		if (poll_la != me && poll_la < 15 && la_info[poll_la].ts &&
+		    ts_to_ms(ts - la_info[poll_la].ts) > POLL_PERIOD) {
+			add_deadline(next, ts);
+			break;
+		}
+	}
+
+	/* A Press and Hold stays in that state after the timeout */
+	__u64 rc_timeout = node->state.rc_press_rx_ts + (FOLLOWER_SAFETY_TIMEOUT + 1) * 1000000ULL;
+
+	if (node->state.rc_state != NOPRESS && rc_timeout > ts_now)
+		add_deadline(next, rc_timeout);
+
+	if (node->has_aud_rate && node->state.last_aud_rate_rx_ts)
+		add_deadline(next, node->state.last_aud_rate_rx_ts +
+				   MAX_AUD_RATE_MSG_INTERVAL_NS + 1);
+
+	if (node->state.deck_skip_start)
+		add_deadline(next, node->state.deck_skip_start + MAX_DECK_SKIP_NS + 1);
+
+	if (!programmed_timers.empty())
+		add_deadline(next, programmed_timers_deadline(node, t, ts_now));
+	return next;
+}
+
+static void set_timer(int timer_fd, __u64 deadline)
+{
+	struct itimerspec its = {};
+
+	/* A zero it_value disarms the timer */
+	its.it_value.tv_sec = deadline / 1000000000;
+	its.it_value.tv_nsec = deadline % 1000000000;
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+}
+
 void testProcessing(struct node *node, bool exclusive, bool wallclock)
 {
 	struct cec_log_addrs laddrs;
-	fd_set rd_fds;
-	fd_set ex_fds;
+	struct epoll_event epoll_ev = {};
 	int fd = node->fd;
+	int epoll_fd;
+	int timer_fd;
 	__u32 mode = CEC_MODE_INITIATOR |
 		(exclusive ? CEC_MODE_EXCL_FOLLOWER : CEC_MODE_FOLLOWER);
 	unsigned me;
@@ -1101,20 +1221,54 @@ void testProcessing(struct node *node, bool exclusive, bool wallclock)
 
 	poll_remote_devs(node, me);
 
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (epoll_fd < 0 || timer_fd < 0) {
+		fprintf(stderr, "Failed to create the event loop: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	/* Events are signaled with EPOLLPRI, messages with EPOLLIN */
+	epoll_ev.events = EPOLLIN | EPOLLPRI;
+	epoll_ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &epoll_ev)) {
+		fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	epoll_ev.events = EPOLLIN;
+	epoll_ev.data.fd = timer_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &epoll_ev)) {
+		fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+
 	while (true) {
+		struct epoll_event evs[2];
+		bool have_event = false;
+		bool have_msg = false;
 		int res;
-		struct timeval timeval = {};
 
 		fflush(stdout);
-		timeval.tv_sec = 1;
-		FD_ZERO(&rd_fds);
-		FD_ZERO(&ex_fds);
-		FD_SET(fd, &rd_fds);
-		FD_SET(fd, &ex_fds);
-		res = select(fd + 1, &rd_fds, nullptr, &ex_fds, &timeval);
+		/* This also clears the expiration of the previous deadline */
+		set_timer(timer_fd, next_deadline(node, me, last_pwr_status_toggle));
+		res = epoll_wait(epoll_fd, evs, 2, -1);
 		if (res < 0)
 			break;
-		if (FD_ISSET(fd, &ex_fds)) {
+		for (int i = 0; i < res; i++) {
+			/* The time based checks below are done on every wakeup */
+			if (evs[i].data.fd == timer_fd)
+				continue;
+			/* A disconnected device also signals EPOLLERR */
+			have_event = evs[i].events & EPOLLPRI;
+			have_msg = evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+			/* Emulated adapters only signal EPOLLIN */
+			if (have_msg && cec_emu_fd(fd)) {
+				short revents = cec_emu_revents(fd);
+
+				have_event = revents & POLLPRI;
+				have_msg = revents & POLLIN;
+			}
+		}
+		if (have_event) {
 			struct cec_event ev;
 
 			res = doioctl(node, CEC_DQEVENT, &ev);
@@ -1139,7 +1293,7 @@ void testProcessing(struct node *node, bool exclusive, bool wallclock)
 				memset(la_info, 0, sizeof(la_info));
 			}
 		}
-		if (FD_ISSET(fd, &rd_fds)) {
+		if (have_msg) {
 			struct cec_msg msg = { };
 
 			res = doioctl(node, CEC_RECEIVE, &msg);
@@ -1242,6 +1396,8 @@ void testProcessing(struct node *node, bool exclusive, bool wallclock)
 		if (!programmed_timers.empty())
 			update_programmed_timers(node);
 	}
+	close(timer_fd);
+	close(epoll_fd);
 	mode = CEC_MODE_INITIATOR;
 	doioctl(node, CEC_S_MODE, &mode);
 }
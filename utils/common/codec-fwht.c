@@ -193,11 +193,232 @@ static const int quant_table_p[] = {
 	3, 3, 3, 6, 6, 9,  9,  10,
 };
 
+/*
+ * When SSE2 is part of the compiler's baseline, the transforms and
+ * the quantizers work on whole 8x8 blocks of 16 bit values. The transforms
+ * only add and subtract, and the C versions below truncate to 16 bits
+ * between the passes, so 16 bit wrapping arithmetic gives exactly the same
+ * coefficients and the bitstream is unchanged. The C versions remain the
+ * reference and are used on other CPUs and for interleaved input.
+ */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define FWHT_SIMD
+
+typedef __m128i fwht_vec;
+
+#define vec_add(a, b)		_mm_add_epi16(a, b)
+#define vec_sub(a, b)		_mm_sub_epi16(a, b)
+#define vec_dup(x)		_mm_set1_epi16(x)
+#define vec_load(p)		_mm_loadu_si128((const __m128i *)(p))
+#define vec_store(p, v)		_mm_storeu_si128((__m128i *)(p), v)
+#define vec_load_u8(p)		_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), \
+						  _mm_setzero_si128())
+#define vec_store_u8(p, v)	_mm_storel_epi64((__m128i *)(p), _mm_packus_epi16(v, v))
+#define vec_clamp_u8(v)		_mm_min_epi16(_mm_max_epi16(v, _mm_setzero_si128()), \
+				      _mm_set1_epi16(255))
+#define vec_shr6(v)		_mm_srai_epi16(v, 6)
+
+/* multiply by 1 << quant and by 1 << (16 - quant) to shift per coefficient */
+static const s16 quant_mul_intra[64] = {
+	  4,   4,   4,   4,   4,   4,   4,   4,
+	  4,   4,   4,   4,   4,   4,   4,   4,
+	  4,   4,   4,   4,   4,   4,   4,   8,
+	  4,   4,   4,   4,   4,   4,   8,  64,
+	  4,   4,   4,   4,   4,   8,  64,  64,
+	  4,   4,   4,   4,   8,  64,  64,  64,
+	  4,   4,   4,   8,  64,  64,  64,  64,
+	  4,   4,   8,  64,  64,  64,  64, 256,
+};
+
+static const s16 quant_div_intra[64] = {
+	16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+	16384, 16384, 16384, 16384, 16384, 16384, 16384, 16384,
+	16384, 16384, 16384, 16384, 16384, 16384, 16384,  8192,
+	16384, 16384, 16384, 16384, 16384, 16384,  8192,  1024,
+	16384, 16384, 16384, 16384, 16384,  8192,  1024,  1024,
+	16384, 16384, 16384, 16384,  8192,  1024,  1024,  1024,
+	16384, 16384, 16384,  8192,  1024,  1024,  1024,  1024,
+	16384, 16384,  8192,  1024,  1024,  1024,  1024,   256,
+};
+
+static const s16 quant_mul_inter[64] = {
+	   8,    8,    8,    8,    8,    8,    8,    8,
+	   8,    8,    8,    8,    8,    8,    8,    8,
+	   8,    8,    8,    8,    8,    8,    8,    8,
+	   8,    8,    8,    8,    8,    8,    8,   64,
+	   8,    8,    8,    8,    8,    8,   64,   64,
+	   8,    8,    8,    8,    8,   64,   64,  512,
+	   8,    8,    8,    8,   64,   64,  512,  512,
+	   8,    8,    8,   64,   64,  512,  512, 1024,
+};
+
+static const s16 quant_div_inter[64] = {
+	 8192,  8192,  8192,  8192,  8192,  8192,  8192,  8192,
+	 8192,  8192,  8192,  8192,  8192,  8192,  8192,  8192,
+	 8192,  8192,  8192,  8192,  8192,  8192,  8192,  8192,
+	 8192,  8192,  8192,  8192,  8192,  8192,  8192,  1024,
+	 8192,  8192,  8192,  8192,  8192,  8192,  1024,  1024,
+	 8192,  8192,  8192,  8192,  8192,  1024,  1024,   128,
+	 8192,  8192,  8192,  8192,  1024,  1024,   128,   128,
+	 8192,  8192,  8192,  1024,  1024,   128,   128,    64,
+};
+
+static inline void fwht_vec_transpose(fwht_vec *r)
+{
+	__m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+	__m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+	__m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+	__m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+	__m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+	__m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+	__m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+	__m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+	r[0] = _mm_unpacklo_epi64(b0, b4);
+	r[1] = _mm_unpackhi_epi64(b0, b4);
+	r[2] = _mm_unpacklo_epi64(b1, b5);
+	r[3] = _mm_unpackhi_epi64(b1, b5);
+	r[4] = _mm_unpacklo_epi64(b2, b6);
+	r[5] = _mm_unpackhi_epi64(b2, b6);
+	r[6] = _mm_unpacklo_epi64(b3, b7);
+	r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+static void quantize_vec(s16 *coeff, s16 *de_coeff, u16 qp, bool intra)
+{
+	const s16 *mul = intra ? quant_mul_intra : quant_mul_inter;
+	const s16 *div = intra ? quant_div_intra : quant_div_inter;
+	__m128i max = _mm_set1_epi16(qp);
+	__m128i min = _mm_set1_epi16(-qp);
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8) {
+		__m128i c = _mm_mulhi_epi16(vec_load(coeff + i), vec_load(div + i));
+		__m128i keep = _mm_or_si128(_mm_cmpgt_epi16(c, max),
+					    _mm_cmplt_epi16(c, min));
+
+		c = _mm_and_si128(c, keep);
+		vec_store(coeff + i, c);
+		vec_store(de_coeff + i, _mm_mullo_epi16(c, vec_load(mul + i)));
+	}
+}
+
+static void dequantize_vec(s16 *coeff, bool intra)
+{
+	const s16 *mul = intra ? quant_mul_intra : quant_mul_inter;
+	unsigned int i;
+
+	for (i = 0; i < 64; i += 8)
+		vec_store(coeff + i, _mm_mullo_epi16(vec_load(coeff + i),
+						     vec_load(mul + i)));
+}
+
+/* one pass of the transform over the columns of an 8x8 block */
+static inline void fwht_vec_pass(fwht_vec *r)
+{
+	fwht_vec a0 = vec_add(r[0], r[1]);
+	fwht_vec a1 = vec_sub(r[0], r[1]);
+	fwht_vec a2 = vec_add(r[2], r[3]);
+	fwht_vec a3 = vec_sub(r[2], r[3]);
+	fwht_vec a4 = vec_add(r[4], r[5]);
+	fwht_vec a5 = vec_sub(r[4], r[5]);
+	fwht_vec a6 = vec_add(r[6], r[7]);
+	fwht_vec a7 = vec_sub(r[6], r[7]);
+	fwht_vec b0 = vec_add(a0, a2);
+	fwht_vec b1 = vec_sub(a0, a2);
+	fwht_vec b2 = vec_sub(a1, a3);
+	fwht_vec b3 = vec_add(a1, a3);
+	fwht_vec b4 = vec_add(a4, a6);
+	fwht_vec b5 = vec_sub(a4, a6);
+	fwht_vec b6 = vec_sub(a5, a7);
+	fwht_vec b7 = vec_add(a5, a7);
+
+	r[0] = vec_add(b0, b4);
+	r[1] = vec_sub(b0, b4);
+	r[2] = vec_sub(b1, b5);
+	r[3] = vec_add(b1, b5);
+	r[4] = vec_add(b2, b6);
+	r[5] = vec_sub(b2, b6);
+	r[6] = vec_sub(b3, b7);
+	r[7] = vec_add(b3, b7);
+}
+
+/* the row pass followed by the column pass, done as column passes */
+static inline void fwht_vec_2d(fwht_vec *r)
+{
+	fwht_vec_pass(r);
+	fwht_vec_transpose(r);
+	fwht_vec_pass(r);
+	fwht_vec_transpose(r);
+}
+
+static void fwht_vec_u8(const u8 *block, s16 *output_block,
+			unsigned int stride, bool intra)
+{
+	fwht_vec r[8];
+	unsigned int i;
+
+	/* subtracting 256 from each pair sum is subtracting 128 per pixel */
+	for (i = 0; i < 8; i++, block += stride) {
+		r[i] = vec_load_u8(block);
+		if (intra)
+			r[i] = vec_sub(r[i], vec_dup(128));
+	}
+	fwht_vec_2d(r);
+	for (i = 0; i < 8; i++)
+		vec_store(output_block + 8 * i, r[i]);
+}
+
+static void fwht_vec_s16(const s16 *block, s16 *output_block, int stride)
+{
+	fwht_vec r[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++, block += stride)
+		r[i] = vec_load(block);
+	fwht_vec_2d(r);
+	for (i = 0; i < 8; i++)
+		vec_store(output_block + 8 * i, r[i]);
+}
+
+static void ifwht_vec(const s16 *block, s16 *output_block, int intra)
+{
+	fwht_vec r[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = vec_load(block + 8 * i);
+	fwht_vec_2d(r);
+	for (i = 0; i < 8; i++) {
+		r[i] = vec_shr6(r[i]);
+		if (intra)
+			r[i] = vec_add(r[i], vec_dup(128));
+		vec_store(output_block + 8 * i, r[i]);
+	}
+}
+#endif
+
 static void quantize_intra(s16 *coeff, s16 *de_coeff, u16 qp)
 {
 	const int *quant = quant_table;
 	int i, j;
 
+#ifdef FWHT_SIMD
+	if (qp < 0x7fff) {
+		quantize_vec(coeff, de_coeff, qp, true);
+		return;
+	}
+#endif
+
 	for (j = 0; j < 8; j++) {
 		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
 			*coeff >>= *quant;
@@ -214,6 +435,11 @@ static void dequantize_intra(s16 *coeff)
 	const int *quant = quant_table;
 	int i, j;
 
+#ifdef FWHT_SIMD
+	dequantize_vec(coeff, true);
+	return;
+#endif
+
 	for (j = 0; j < 8; j++)
 		for (i = 0; i < 8; i++, quant++, coeff++)
 			*coeff <<= *quant;
@@ -224,6 +450,13 @@ static void quantize_inter(s16 *coeff, s16 *de_coeff, u16 qp)
 	const int *quant = quant_table_p;
 	int i, j;
 
+#ifdef FWHT_SIMD
+	if (qp < 0x7fff) {
+		quantize_vec(coeff, de_coeff, qp, false);
+		return;
+	}
+#endif
+
 	for (j = 0; j < 8; j++) {
 		for (i = 0; i < 8; i++, quant++, coeff++, de_coeff++) {
 			*coeff >>= *quant;
@@ -240,6 +473,11 @@ static void dequantize_inter(s16 *coeff)
 	const int *quant = quant_table_p;
 	int i, j;
 
+#ifdef FWHT_SIMD
+	dequantize_vec(coeff, false);
+	return;
+#endif
+
 	for (j = 0; j < 8; j++)
 		for (i = 0; i < 8; i++, quant++, coeff++)
 			*coeff <<= *quant;
@@ -256,6 +494,13 @@ static void noinline_for_stack fwht(const u8 *block, s16 *output_block,
 	int add = intra ? 256 : 0;
 	unsigned int i;
 
+#ifdef FWHT_SIMD
+	if (input_step == 1) {
+		fwht_vec_u8(block, output_block, stride, intra);
+		return;
+	}
+#endif
+
 	/* stage 1 */
 	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
 		switch (input_step) {
@@ -388,6 +633,11 @@ fwht16(const s16 *block, s16 *output_block, int stride, int intra)
 	s16 *out = output_block;
 	int i;
 
+#ifdef FWHT_SIMD
+	fwht_vec_s16(block, output_block, stride);
+	return;
+#endif
+
 	for (i = 0; i < 8; i++, tmp += stride, out += 8) {
 		/* stage 1 */
 		workspace1[0]  = tmp[0] + tmp[1];
@@ -476,6 +726,11 @@ ifwht(const s16 *block, s16 *output_block, int intra)
 	s16 *out = output_block;
 	int i;
 
+#ifdef FWHT_SIMD
+	ifwht_vec(block, output_block, intra);
+	return;
+#endif
+
 	for (i = 0; i < 8; i++, tmp += 8, out += 8) {
 		/* stage 1 */
 		workspace1[0]  = tmp[0] + tmp[1];
@@ -645,6 +900,15 @@ static void fill_decoder_block(u8 *dst, const s16 *input, int stride,
 {
 	int i, j;
 
+#ifdef FWHT_SIMD
+	if (dst_step == 1) {
+		/* the saturating pack does the clamping */
+		for (i = 0; i < 8; i++, input += 8, dst += stride)
+			vec_store_u8(dst, vec_load(input));
+		return;
+	}
+#endif
+
 	for (i = 0; i < 8; i++) {
 		for (j = 0; j < 8; j++, input++, dst += dst_step) {
 			if (*input < 0)
@@ -663,6 +927,15 @@ static void add_deltas(s16 *deltas, const u8 *ref, int stride,
 {
 	int k, l;
 
+#ifdef FWHT_SIMD
+	if (ref_step == 1) {
+		for (k = 0; k < 8; k++, deltas += 8, ref += stride)
+			vec_store(deltas, vec_clamp_u8(vec_add(vec_load(deltas),
+							       vec_load_u8(ref))));
+		return;
+	}
+#endif
+
 	for (k = 0; k < 8; k++) {
 		for (l = 0; l < 8; l++) {
 			*deltas += *ref;
@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * CRC32C (Castagnoli), used to verify the contents of the frames.
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include <endian.h>
+
+#include "crc32c.h"
+
+static __u32 crc32c_table[8][256];
+
+static void crc32c_init_table()
+{
+	for (unsigned i = 0; i < 256; i++) {
+		__u32 crc = i;
+
+		for (unsigned j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+		crc32c_table[0][i] = crc;
+	}
+	for (unsigned i = 0; i < 256; i++)
+		for (unsigned t = 1; t < 8; t++)
+			crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^
+				crc32c_table[0][crc32c_table[t - 1][i] & 0xff];
+}
+
+static __u32 crc32c_sw(__u32 crc, const __u8 *p, size_t len)
+{
+	while (len && ((uintptr_t)p & 7)) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		__u64 v;
+
+		memcpy(&v, p, 8);
+		v = le64toh(v) ^ crc;
+		crc = crc32c_table[7][v & 0xff] ^
+		      crc32c_table[6][(v >> 8) & 0xff] ^
+		      crc32c_table[5][(v >> 16) & 0xff] ^
+		      crc32c_table[4][(v >> 24) & 0xff] ^
+		      crc32c_table[3][(v >> 32) & 0xff] ^
+		      crc32c_table[2][(v >> 40) & 0xff] ^
+		      crc32c_table[1][(v >> 48) & 0xff] ^
+		      crc32c_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static __u32 crc32c_hw(__u32 crc, const __u8 *p, size_t len)
+{
+	__u64 crc64 = crc;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc64 = __builtin_ia32_crc32qi(crc64, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		__u64 v;
+
+		memcpy(&v, p, 8);
+		crc64 = __builtin_ia32_crc32di(crc64, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = crc64;
+	while (len--)
+		crc = __builtin_ia32_crc32qi(crc, *p++);
+	return crc;
+}
+
+static bool crc32c_has_hw()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static __u32 crc32c_hw(__u32 crc, const __u8 *p, size_t len)
+{
+	while (len && ((uintptr_t)p & 7)) {
+		crc = __builtin_aarch64_crc32cb(crc, *p++);
+		len--;
+	}
+	while (len >= 8) {
+		__u64 v;
+
+		memcpy(&v, p, 8);
+		crc = __builtin_aarch64_crc32cx(crc, v);
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = __builtin_aarch64_crc32cb(crc, *p++);
+	return crc;
+}
+
+static bool crc32c_has_hw()
+{
+	return true;
+}
+#else
+static __u32 crc32c_hw(__u32 crc, const __u8 *p, size_t len)
+{
+	return crc32c_sw(crc, p, len);
+}
+
+static bool crc32c_has_hw()
+{
+	return false;
+}
+#endif
+
+static bool crc32c_setup()
+{
+	bool has_hw = crc32c_has_hw();
+
+	if (!has_hw)
+		crc32c_init_table();
+	return has_hw;
+}
+
+__u32 crc32c(const void *buf, size_t len)
+{
+	/* Initialized once, also when called by several threads at once */
+	static const bool has_hw = crc32c_setup();
+	auto p = static_cast<const __u8 *>(buf);
+
+	if (has_hw)
+		return ~crc32c_hw(~0U, p, len);
+	return ~crc32c_sw(~0U, p, len);
+}
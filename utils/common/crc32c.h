@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * CRC32C (Castagnoli), used to verify the contents of the frames.
+ */
+
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <cstddef>
+
+#include <linux/types.h>
+
+/*
+ * Return the CRC32C of len bytes at buf. This uses the crc32 instruction of
+ * SSE4.2 or ARMv8 if available, otherwise slicing-by-8 tables, so hashing
+ * keeps up with the capture rate even for large frames.
+ */
+__u32 crc32c(const void *buf, size_t len);
+
+#endif
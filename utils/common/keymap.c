@@ -9,6 +9,8 @@
 #include <string.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <argp.h>
 
@@ -464,19 +466,19 @@ static error_t parse_toml_keymap(char *fname, struct keymap **keymap, bool verbo
 	struct toml_array_t *arr;
 	int ret, i = 0;
 	char buf[200];
-	FILE *fin;
+	int fd;
 
 	if (verbose)
 		fprintf(stderr, _("Parsing %s keycode file as toml\n"), fname);
 
-	fin = fopen(fname, "r");
-	if (!fin) {
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
 		fprintf(stderr, _("%s: error: cannot open: %m\n"), fname);
 		return EINVAL;
 	}
 
-	root = toml_parse_file(fin, buf, sizeof(buf));
-	fclose(fin);
+	root = toml_parse_fd(fd, buf, sizeof(buf));
+	close(fd);
 	if (!root) {
 		fprintf(stderr, _("%s: error: %s\n"), fname, buf);
 		return EINVAL;
@@ -31,6 +31,9 @@ SOFTWARE.
 #include <stdint.h>
 #include <ctype.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "toml.h"
 
 #ifdef _WIN32
@@ -245,9 +248,31 @@ struct toml_array_t {
 };
     
 
+typedef struct arena_block_t arena_block_t;
+struct arena_block_t {
+    arena_block_t* next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+/*
+ * Everything in a parsed document is allocated from the arena of its
+ * root table and released at once by toml_free(). The raw values point
+ * into the source text, which is owned by the arena too.
+ */
+typedef struct toml_arena_t toml_arena_t;
+struct toml_arena_t {
+    arena_block_t* block;
+    char* buf;                  /* malloc()ed source text */
+    void* map;                  /* or mmap()ed source text */
+    size_t maplen;
+};
+
 struct toml_table_t {
     const char* key;            /* key to this table */
     int implicit;               /* table was created implicitly */
+    toml_arena_t* arena;        /* only set in the root table */
 
     /* key-values in the table */
     int             nkval;
@@ -301,6 +326,11 @@ struct context_t {
     token_t tok;
     toml_table_t* root;
     toml_table_t* curtab;
+    toml_arena_t* arena;
+
+    /* ends of the raw values, NUL terminated once parsing is done */
+    int    nterm;
+    char** term;
 
     struct {
         int     top;
@@ -315,6 +345,79 @@ struct context_t {
 #define FLINE __FILE__ ":" TOSTRING(__LINE__)
 
 static tokentype_t next_token(context_t* ctx, int dotisspecial);
+static int e_outofmemory(context_t* ctx, const char* fline);
+
+#define ARENA_ALIGN     16
+#define ARENA_BLOCKSZ   (16 * 1024)
+
+static void* arena_alloc(toml_arena_t* arena, size_t sz)
+{
+    arena_block_t* b = arena->block;
+    void* p;
+
+    sz = (sz + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (!b || b->size - b->used < sz) {
+        size_t bsz = sz > ARENA_BLOCKSZ ? sz : ARENA_BLOCKSZ;
+
+        if (0 == (b = malloc(sizeof(*b) + bsz)))
+            return 0;
+        b->used = 0;
+        b->size = bsz;
+        b->next = arena->block;
+        arena->block = b;
+    }
+    p = b->data + b->used;
+    b->used += sz;
+    return p;
+}
+
+static void arena_free(toml_arena_t* arena)
+{
+    arena_block_t* b;
+
+    if (!arena) return;
+    while ((b = arena->block)) {
+        arena->block = b->next;
+        free(b);
+    }
+    free(arena->buf);
+    if (arena->map)
+        munmap(arena->map, arena->maplen);
+    free(arena);
+}
+
+/* Returns zeroed memory from the arena. Does not return on failure. */
+static void* xcalloc(context_t* ctx, size_t sz)
+{
+    void* p = arena_alloc(ctx->arena, sz);
+    if (!p) {
+        e_outofmemory(ctx, FLINE);
+        return 0;               /* not reached */
+    }
+    return memset(p, 0, sz);
+}
+
+static char* xstrndup(context_t* ctx, const char* s, size_t n)
+{
+    char* p = xcalloc(ctx, n + 1);
+    return memcpy(p, s, n);
+}
+
+/*
+ * Makes room for one more element in an array of n elements. The arrays
+ * are sized to powers of two, so that only log(n) copies are made.
+ */
+static void* xgrow(context_t* ctx, void* base, int n, size_t elemsz)
+{
+    void* p;
+
+    if (base && n != 4 && (n < 4 || (n & (n - 1))))
+        return base;
+    p = xcalloc(ctx, (n < 4 ? 4 : 2 * n) * elemsz);
+    if (n)
+        memcpy(p, base, n * elemsz);
+    return p;
+}
 
 /* error routines. All these functions longjmp to ctx->jmp */
 static int e_outofmemory(context_t* ctx, const char* fline)
@@ -502,22 +605,26 @@ static char* normalize_key(context_t* ctx, token_t strtok)
 
         if (ch == '\'') {
             /* for single quote, take it verbatim. */
-            if (! (ret = strndup(sp, sq - sp))) {
-                e_outofmemory(ctx, FLINE);
-                return 0;       /* not reached */
-            }
+            ret = xstrndup(ctx, sp, sq - sp);
         } else {
             /* for double quote, we need to normalize */
-            ret = normalize_string(sp, sq - sp, 0, ebuf, sizeof(ebuf));
-            if (!ret) {
+            char* tmp = normalize_string(sp, sq - sp, 0, ebuf, sizeof(ebuf));
+            if (!tmp) {
                 snprintf(ctx->errbuf, ctx->errbufsz, "line %d: %s", lineno, ebuf);
                 longjmp(ctx->jmp, 1);
             }
+            ret = arena_alloc(ctx->arena, strlen(tmp) + 1);
+            if (ret)
+                strcpy(ret, tmp);
+            free(tmp);
+            if (!ret) {
+                e_outofmemory(ctx, FLINE);
+                return 0;       /* not reached */
+            }
         }
 
         /* newlines are not allowed in keys */
         if (strchr(ret, '\n')) {
-            free(ret);
             e_bad_key_error(ctx, lineno);
             return 0;           /* not reached */
         }
@@ -535,11 +642,7 @@ static char* normalize_key(context_t* ctx, token_t strtok)
     }
 
     /* dup and return it */
-    if (! (ret = strndup(sp, sq - sp))) {
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
-    return ret;
+    return xstrndup(ctx, sp, sq - sp);
 }
 
 
@@ -586,34 +689,21 @@ static int check_key(toml_table_t* tab, const char* key,
  */
 static toml_keyval_t* create_keyval_in_table(context_t* ctx, toml_table_t* tab, token_t keytok)
 {
-    /* first, normalize the key to be used for lookup. 
-     * remember to free it if we error out. 
-     */
+    /* first, normalize the key to be used for lookup. */
     char* newkey = normalize_key(ctx, keytok);
 
     /* if key exists: error out. */
     toml_keyval_t* dest = 0;
     if (check_key(tab, newkey, 0, 0, 0)) {
-        free(newkey);
         e_key_exists_error(ctx, keytok);
         return 0;               /* not reached */
     }
 
     /* make a new entry */
     int n = tab->nkval;
-    toml_keyval_t** base;
-    if (0 == (base = (toml_keyval_t**) realloc(tab->kval, (n+1) * sizeof(*base)))) {
-        free(newkey);
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    toml_keyval_t** base = xgrow(ctx, tab->kval, n, sizeof(*base));
     tab->kval = base;
-    
-    if (0 == (base[n] = (toml_keyval_t*) calloc(1, sizeof(*base[n])))) {
-        free(newkey);
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    base[n] = xcalloc(ctx, sizeof(*base[n]));
     dest = tab->kval[tab->nkval++];
 
     /* save the key in the new value struct */
@@ -626,16 +716,12 @@ static toml_keyval_t* create_keyval_in_table(context_t* ctx, toml_table_t* tab,
  */
 static toml_table_t* create_keytable_in_table(context_t* ctx, toml_table_t* tab, token_t keytok)
 {
-    /* first, normalize the key to be used for lookup. 
-     * remember to free it if we error out. 
-     */
+    /* first, normalize the key to be used for lookup. */
     char* newkey = normalize_key(ctx, keytok);
 
     /* if key exists: error out */
     toml_table_t* dest = 0;
     if (check_key(tab, newkey, 0, 0, &dest)) {
-        free(newkey);           /* don't need this anymore */
-        
         /* special case: if table exists, but was created implicitly ... */
         if (dest && dest->implicit) {
             /* we make it explicit now, and simply return it. */
@@ -648,19 +734,9 @@ static toml_table_t* create_keytable_in_table(context_t* ctx, toml_table_t* tab,
 
     /* create a new table entry */
     int n = tab->ntab;
-    toml_table_t** base;
-    if (0 == (base = (toml_table_t**) realloc(tab->tab, (n+1) * sizeof(*base)))) {
-        free(newkey);
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    toml_table_t** base = xgrow(ctx, tab->tab, n, sizeof(*base));
     tab->tab = base;
-        
-    if (0 == (base[n] = (toml_table_t*) calloc(1, sizeof(*base[n])))) {
-        free(newkey);
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    base[n] = xcalloc(ctx, sizeof(*base[n]));
     dest = tab->tab[tab->ntab++];
     
     /* save the key in the new table struct */
@@ -676,16 +752,12 @@ static toml_array_t* create_keyarray_in_table(context_t* ctx,
                                               token_t keytok,
                                               int skip_if_exist)
 {
-    /* first, normalize the key to be used for lookup. 
-     * remember to free it if we error out. 
-     */
+    /* first, normalize the key to be used for lookup. */
     char* newkey = normalize_key(ctx, keytok);
     
     /* if key exists: error out */
     toml_array_t* dest = 0;
     if (check_key(tab, newkey, 0, &dest, 0)) {
-        free(newkey);           /* don't need this anymore */
-
         /* special case skip if exists? */
         if (skip_if_exist) return dest;
         
@@ -695,19 +767,9 @@ static toml_array_t* create_keyarray_in_table(context_t* ctx,
 
     /* make a new array entry */
     int n = tab->narr;
-    toml_array_t** base;
-    if (0 == (base = (toml_array_t**) realloc(tab->arr, (n+1) * sizeof(*base)))) {
-        free(newkey);
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    toml_array_t** base = xgrow(ctx, tab->arr, n, sizeof(*base));
     tab->arr = base;
-        
-    if (0 == (base[n] = (toml_array_t*) calloc(1, sizeof(*base[n])))) {
-        free(newkey);
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    base[n] = xcalloc(ctx, sizeof(*base[n]));
     dest = tab->arr[tab->narr++];
 
     /* save the key in the new array struct */
@@ -721,17 +783,9 @@ static toml_array_t* create_array_in_array(context_t* ctx,
                                            toml_array_t* parent)
 {
     int n = parent->nelem;
-    toml_array_t** base;
-    if (0 == (base = (toml_array_t**) realloc(parent->u.arr, (n+1) * sizeof(*base)))) {
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    toml_array_t** base = xgrow(ctx, parent->u.arr, n, sizeof(*base));
     parent->u.arr = base;
-    
-    if (0 == (base[n] = (toml_array_t*) calloc(1, sizeof(*base[n])))) {
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    base[n] = xcalloc(ctx, sizeof(*base[n]));
 
     return parent->u.arr[parent->nelem++];
 }
@@ -742,17 +796,9 @@ static toml_table_t* create_table_in_array(context_t* ctx,
                                            toml_array_t* parent)
 {
     int n = parent->nelem;
-    toml_table_t** base;
-    if (0 == (base = (toml_table_t**) realloc(parent->u.tab, (n+1) * sizeof(*base)))) {
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    toml_table_t** base = xgrow(ctx, parent->u.tab, n, sizeof(*base));
     parent->u.tab = base;
-    
-    if (0 == (base[n] = (toml_table_t*) calloc(1, sizeof(*base[n])))) {
-        e_outofmemory(ctx, FLINE);
-        return 0;               /* not reached */
-    }
+    base[n] = xcalloc(ctx, sizeof(*base[n]));
 
     return parent->u.tab[parent->nelem++];
 }
@@ -809,6 +855,14 @@ static void parse_table(context_t* ctx, toml_table_t* tab)
     EAT_TOKEN(ctx, RBRACE);
 }
 
+/* Remember to NUL terminate the raw value at tok once parsing is done */
+static char* raw_value(context_t* ctx, token_t tok)
+{
+    ctx->term = xgrow(ctx, ctx->term, ctx->nterm, sizeof(*ctx->term));
+    ctx->term[ctx->nterm++] = tok.ptr + tok.len;
+    return tok.ptr;
+}
+
 static int valtype(const char* val)
 {
     toml_timestamp_t ts;
@@ -824,6 +878,19 @@ static int valtype(const char* val)
     return 'u'; /* unknown */
 }
 
+/* valtype() of a raw value that isn't NUL terminated yet */
+static int raw_valtype(context_t* ctx, token_t tok)
+{
+    char buf[100];
+
+    if (*tok.ptr == '\'' || *tok.ptr == '"') return 's';
+    if (tok.len >= (int)sizeof(buf))
+        return valtype(xstrndup(ctx, tok.ptr, tok.len));
+    memcpy(buf, tok.ptr, tok.len);
+    buf[tok.len] = 0;
+    return valtype(buf);
+}
+
 
 /* We are at '[...]' */
 static void parse_array(context_t* ctx, toml_array_t* arr)
@@ -839,9 +906,6 @@ static void parse_array(context_t* ctx, toml_array_t* arr)
         switch (ctx->tok.tok) {
         case STRING:
             {
-                char* val = ctx->tok.ptr;
-                int   vlen = ctx->tok.len;
-
                 /* set array kind if this will be the first entry */
                 if (arr->kind == 0) arr->kind = 'v';
                 /* check array kind */
@@ -852,22 +916,13 @@ static void parse_array(context_t* ctx, toml_array_t* arr)
                 }
 
                 /* make a new value in array */
-                char** tmp = (char**) realloc(arr->u.val, (arr->nelem+1) * sizeof(*tmp));
-                if (!tmp) {
-                    e_outofmemory(ctx, FLINE);
-                    return;     /* not reached */
-                }
-                arr->u.val = tmp;
-                if (! (val = strndup(val, vlen))) {
-                    e_outofmemory(ctx, FLINE);
-                    return;     /* not reached */
-                }
-                arr->u.val[arr->nelem++] = val;
+                arr->u.val = xgrow(ctx, arr->u.val, arr->nelem, sizeof(*arr->u.val));
+                arr->u.val[arr->nelem++] = raw_value(ctx, ctx->tok);
 
                 /* set array type if this is the first entry, or check that the types matched. */
                 if (arr->nelem == 1) 
-                    arr->type = valtype(arr->u.val[0]);
-                else if (arr->type != valtype(val)) {
+                    arr->type = raw_valtype(ctx, ctx->tok);
+                else if (arr->type != raw_valtype(ctx, ctx->tok)) {
                     e_syntax_error(ctx, ctx->tok.lineno, "array type mismatch");
                     return;     /* not reached */
                 }
@@ -955,11 +1010,7 @@ static void parse_keyval(context_t* ctx, toml_table_t* tab)
             toml_keyval_t* keyval = create_keyval_in_table(ctx, tab, key);
             token_t val = ctx->tok;
             assert(keyval->val == 0);
-            keyval->val = strndup(val.ptr, val.len);
-            if (! keyval->val) {
-                e_outofmemory(ctx, FLINE);
-                return;         /* not reached */
-            }
+            keyval->val = raw_value(ctx, val);
 
             EAT_TOKEN(ctx, STRING);
             
@@ -1003,11 +1054,8 @@ static void fill_tabpath(context_t* ctx)
     int i;
     
     /* clear tpath */
-    for (i = 0; i < ctx->tpath.top; i++) {
-        char** p = &ctx->tpath.key[i];
-        xfree(*p);
-        *p = 0;
-    }
+    for (i = 0; i < ctx->tpath.top; i++)
+        ctx->tpath.key[i] = 0;
     ctx->tpath.top = 0;
     
     for (;;) {
@@ -1083,22 +1131,10 @@ static void walk_tabpath(context_t* ctx)
         default:
             { /* Not found. Let's create an implicit table. */
                 int n = curtab->ntab;
-                toml_table_t** base = (toml_table_t**) realloc(curtab->tab, (n+1) * sizeof(*base));
-                if (0 == base) {
-                    e_outofmemory(ctx, FLINE);
-                    return;     /* not reached */
-                }
+                toml_table_t** base = xgrow(ctx, curtab->tab, n, sizeof(*base));
                 curtab->tab = base;
-                
-                if (0 == (base[n] = (toml_table_t*) calloc(1, sizeof(*base[n])))) {
-                    e_outofmemory(ctx, FLINE);
-                    return;     /* not reached */
-                }
-                
-                if (0 == (base[n]->key = strdup(key))) {
-                    e_outofmemory(ctx, FLINE);
-                    return;     /* not reached */
-                }
+                base[n] = xcalloc(ctx, sizeof(*base[n]));
+                base[n]->key = key;
                 
                 nexttab = curtab->tab[curtab->ntab++];
                 
@@ -1139,7 +1175,6 @@ static void parse_select(context_t* ctx)
     /* For [x.y.z] or [[x.y.z]], remove z from tpath. 
      */
     token_t z = ctx->tpath.tok[ctx->tpath.top-1];
-    free(ctx->tpath.key[ctx->tpath.top-1]);
     ctx->tpath.top--;
 
 	/* set up ctx->curtab */
@@ -1166,22 +1201,10 @@ static void parse_select(context_t* ctx)
         toml_table_t* dest;
         {
             int n = arr->nelem;
-            toml_table_t** base = realloc(arr->u.tab, (n+1) * sizeof(*base));
-            if (0 == base) {
-                e_outofmemory(ctx, FLINE);
-                return;         /* not reached */
-            }
+            toml_table_t** base = xgrow(ctx, arr->u.tab, n, sizeof(*base));
             arr->u.tab = base;
-            
-            if (0 == (base[n] = calloc(1, sizeof(*base[n])))) {
-                e_outofmemory(ctx, FLINE);
-                return;         /* not reached */
-            }
-            
-            if (0 == (base[n]->key = strdup("__anon__"))) {
-                e_outofmemory(ctx, FLINE);
-                return;         /* not reached */
-            }
+            base[n] = xcalloc(ctx, sizeof(*base[n]));
+            base[n]->key = "__anon__";
             
             dest = arr->u.tab[arr->nelem++];
         }
@@ -1211,9 +1234,12 @@ static void parse_select(context_t* ctx)
 
 
 
-toml_table_t* toml_parse(char* conf,
-                         char* errbuf,
-                         int errbufsz)
+/*
+ * Parses conf, which must be NUL terminated and owned by arena. The
+ * arena is released on error.
+ */
+static toml_table_t* parse_in_arena(toml_arena_t* arena, char* conf,
+                                    char* errbuf, int errbufsz)
 {
     context_t ctx;
 
@@ -1227,6 +1253,7 @@ toml_table_t* toml_parse(char* conf,
     ctx.stop = ctx.start + strlen(conf);
     ctx.errbuf = errbuf;
     ctx.errbufsz = errbufsz;
+    ctx.arena = arena;
 
     // start with an artificial newline of length 0
     ctx.tok.tok = NEWLINE; 
@@ -1235,11 +1262,14 @@ toml_table_t* toml_parse(char* conf,
     ctx.tok.len = 0;
 
     // make a root table
-    if (0 == (ctx.root = calloc(1, sizeof(*ctx.root)))) {
+    if (0 == (ctx.root = arena_alloc(arena, sizeof(*ctx.root)))) {
         /* do not call outofmemory() here... setjmp not done yet */
         snprintf(ctx.errbuf, ctx.errbufsz, "ERROR: out of memory (%s)", FLINE);
+        arena_free(arena);
         return 0;
     }
+    memset(ctx.root, 0, sizeof(*ctx.root));
+    ctx.root->arena = arena;
 
     // set root as default table
     ctx.curtab = ctx.root;
@@ -1247,8 +1277,7 @@ toml_table_t* toml_parse(char* conf,
     if (0 != setjmp(ctx.jmp)) {
         // Got here from a long_jmp. Something bad has happened.
         // Free resources and return error.
-        for (int i = 0; i < ctx.tpath.top; i++) xfree(ctx.tpath.key[i]);
-        toml_free(ctx.root);
+        arena_free(arena);
         return 0;
     }
 
@@ -1280,16 +1309,35 @@ toml_table_t* toml_parse(char* conf,
         }
     }
 
-    /* success */
-    for (int i = 0; i < ctx.tpath.top; i++) xfree(ctx.tpath.key[i]);
+    /* success: the source text isn't scanned anymore, cap the raw values */
+    for (int i = 0; i < ctx.nterm; i++)
+        *ctx.term[i] = 0;
     return ctx.root;
 }
 
 
+toml_table_t* toml_parse(char* conf,
+                         char* errbuf,
+                         int errbufsz)
+{
+    toml_arena_t* arena = calloc(1, sizeof(*arena));
+
+    if (arena)
+        arena->buf = strdup(conf);
+    if (!arena || !arena->buf) {
+        snprintf(errbuf, errbufsz, "out of memory");
+        arena_free(arena);
+        return 0;
+    }
+    return parse_in_arena(arena, arena->buf, errbuf, errbufsz);
+}
+
+
 toml_table_t* toml_parse_file(FILE* fp,
                               char* errbuf,
                               int errbufsz)
 {
+    toml_arena_t* arena;
     int bufsz = 0;
     char* buf = 0;
     int off = 0;
@@ -1328,73 +1376,62 @@ toml_table_t* toml_parse_file(FILE* fp,
     /* tag on a NUL to cap the string */
     buf[off] = 0; /* we accounted for this byte in the realloc() above. */
 
-    /* parse it, cleanup and finish */
-    toml_table_t* ret = toml_parse(buf, errbuf, errbufsz);
-    free(buf);
-    return ret;
-}
-
-
-static void xfree_kval(toml_keyval_t* p)
-{
-    if (!p) return;
-    xfree(p->key);
-    xfree(p->val);
-    xfree(p);
-}
-
-static void xfree_tab(toml_table_t* p);
-
-static void xfree_arr(toml_array_t* p)
-{
-    if (!p) return;
-
-    xfree(p->key);
-    switch (p->kind) {
-    case 'v':
-        for (int i = 0; i < p->nelem; i++) xfree(p->u.val[i]);
-        xfree(p->u.val);
-        break;
-
-    case 'a':
-        for (int i = 0; i < p->nelem; i++) xfree_arr(p->u.arr[i]);
-        xfree(p->u.arr);
-        break;
-
-    case 't':
-        for (int i = 0; i < p->nelem; i++) xfree_tab(p->u.tab[i]);
-        xfree(p->u.tab);
-        break;
+    /* parse it, the table keeps buf */
+    if (! (arena = calloc(1, sizeof(*arena)))) {
+        snprintf(errbuf, errbufsz, "out of memory");
+        free(buf);
+        return 0;
     }
-
-    xfree(p);
+    arena->buf = buf;
+    return parse_in_arena(arena, buf, errbuf, errbufsz);
 }
 
 
-static void xfree_tab(toml_table_t* p)
+toml_table_t* toml_parse_fd(int fd,
+                            char* errbuf,
+                            int errbufsz)
 {
-    int i;
-    
-    if (!p) return;
-    
-    xfree(p->key);
-    
-    for (i = 0; i < p->nkval; i++) xfree_kval(p->kval[i]);
-    xfree(p->kval);
-
-    for (i = 0; i < p->narr; i++) xfree_arr(p->arr[i]);
-    xfree(p->arr);
-
-    for (i = 0; i < p->ntab; i++) xfree_tab(p->tab[i]);
-    xfree(p->tab);
-
-    xfree(p);
+    toml_arena_t* arena;
+    long pagesz = sysconf(_SC_PAGESIZE);
+    struct stat st;
+    FILE* fp;
+
+    /*
+     * A regular file is mapped, as long as the mapping is followed by
+     * zeroes to cap the string, i.e. the file doesn't end on a page
+     * boundary. The mapping is private, so the file isn't changed when
+     * the raw values are capped.
+     */
+    if (0 == fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+        pagesz > 0 && st.st_size % pagesz) {
+        if (! (arena = calloc(1, sizeof(*arena)))) {
+            snprintf(errbuf, errbufsz, "out of memory");
+            return 0;
+        }
+        arena->maplen = st.st_size;
+        arena->map = mmap(0, arena->maplen, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE, fd, 0);
+        if (arena->map != MAP_FAILED)
+            return parse_in_arena(arena, arena->map, errbuf, errbufsz);
+        free(arena);
+    }
+
+    /* fall back to reading it */
+    if (0 > (fd = dup(fd)) || ! (fp = fdopen(fd, "r"))) {
+        snprintf(errbuf, errbufsz, "%s", strerror(errno));
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    toml_table_t* ret = toml_parse_file(fp, errbuf, errbufsz);
+    fclose(fp);
+    return ret;
 }
 
 
 void toml_free(toml_table_t* tab)
 {
-    xfree_tab(tab);
+    if (tab)
+        arena_free(tab->arena);
 }
 
 
@@ -46,6 +46,14 @@ TOML_EXTERN toml_table_t* toml_parse_file(FILE* fp,
                                           char* errbuf,
                                           int errbufsz);
 
+/* Parse the file open on fd, mapping it into memory rather than
+ * reading it when possible. Return a table on success, or 0 otherwise.
+ * Caller must toml_free(the-return-value) after use.
+ */
+TOML_EXTERN toml_table_t* toml_parse_fd(int fd,
+                                        char* errbuf,
+                                        int errbufsz);
+
 /* Parse a string containing the full config. 
  * Return a table on success, or 0 otherwise.
  * Caller must toml_free(the-return-value) after use.
@@ -54,7 +62,9 @@ TOML_EXTERN toml_table_t* toml_parse(char* conf, /* NUL terminated, please. */
                                      char* errbuf,
                                      int errbufsz);
 
-/* Free the table returned by toml_parse() or toml_parse_file(). */
+/* Free the table returned by toml_parse(), toml_parse_file() or
+ * toml_parse_fd(). This frees all the tables, arrays and values in it.
+ */
 TOML_EXTERN void toml_free(toml_table_t* tab);
 
 /* Retrieve the key in table at keyidx. Return 0 if out of range. */
@@ -34,6 +34,12 @@ struct v4l_fd {
 	__u32 caps;
 	unsigned int trace;
 	bool direct;
+	/*
+	 * The have_* ioctl probes are done on first use through the
+	 * v4l_fd_g_have_*() accessors: unprobed has the V4L_FD_PROBE_*
+	 * bits of the probes that were not done yet.
+	 */
+	__u32 unprobed;
 	bool have_query_ext_ctrl;
 	bool have_ext_ctrls;
 	bool have_next_ctrl;
@@ -53,6 +59,15 @@ struct v4l_fd {
 	int (*munmap)(struct v4l_fd *f, void *addr, size_t length);
 };
 
+#define V4L_FD_PROBE_QUERY_EXT_CTRL	(1U << 0)
+#define V4L_FD_PROBE_EXT_CTRLS		(1U << 1)
+#define V4L_FD_PROBE_NEXT_CTRL		(1U << 2)
+#define V4L_FD_PROBE_SELECTION		(1U << 3)
+#define V4L_FD_PROBE_ALL		(V4L_FD_PROBE_QUERY_EXT_CTRL | \
+					 V4L_FD_PROBE_EXT_CTRLS | \
+					 V4L_FD_PROBE_NEXT_CTRL | \
+					 V4L_FD_PROBE_SELECTION)
+
 #ifdef __LIBV4L2_H
 
 static inline int v4l_wrap_open(struct v4l_fd *f, const char *file, int oflag, ...)
@@ -456,11 +471,6 @@ static inline __u32 v4l_determine_type(const struct v4l_fd *f)
 
 static inline int v4l_s_fd(struct v4l_fd *f, int fd, const char *devname, bool direct)
 {
-	struct v4l2_query_ext_ctrl qec;
-	struct v4l2_ext_controls ec;
-	struct v4l2_queryctrl qc;
-	struct v4l2_selection sel;
-
 	if (f->fd >= 0)
 		f->close(f);
 
@@ -469,13 +479,6 @@ static inline int v4l_s_fd(struct v4l_fd *f, int fd, const char *devname, bool d
 	if (fd < 0)
 		return fd;
 
-	memset(&qec, 0, sizeof(qec));
-	qec.id = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
-	memset(&ec, 0, sizeof(ec));
-	memset(&qc, 0, sizeof(qc));
-	qc.id = V4L2_CTRL_FLAG_NEXT_CTRL;
-	memset(&sel, 0, sizeof(sel));
-
 	if (f->devname != devname)
 		strncpy(f->devname, devname, sizeof(f->devname));
 	f->devname[sizeof(f->devname) - 1] = '\0';
@@ -489,18 +492,69 @@ static inline int v4l_s_fd(struct v4l_fd *f, int fd, const char *devname, bool d
 	f->is_media = false;
 	f->caps = v4l_capability_g_caps(&f->cap);
 	f->type = v4l_determine_type(f);
-
-	f->have_query_ext_ctrl = v4l_ioctl(f, VIDIOC_QUERY_EXT_CTRL, &qec) == 0;
-	f->have_ext_ctrls = v4l_ioctl(f, VIDIOC_TRY_EXT_CTRLS, &ec) == 0;
-	f->have_next_ctrl = v4l_ioctl(f, VIDIOC_QUERYCTRL, &qc) == 0;
-	sel.type = v4l_g_selection_type(f);
-	sel.target = sel.type == V4L2_BUF_TYPE_VIDEO_CAPTURE ?
-			V4L2_SEL_TGT_CROP : V4L2_SEL_TGT_COMPOSE;
-	f->have_selection = v4l_ioctl(f, VIDIOC_G_SELECTION, &sel) != ENOTTY;
+	/*
+	 * Most users of an fd only need a few of these, and on some
+	 * devices each probe is a round trip to the hardware, so they
+	 * are probed when first needed.
+	 */
+	f->unprobed = V4L_FD_PROBE_ALL;
 
 	return f->fd;
 }
 
+static inline bool v4l_fd_g_have_query_ext_ctrl(struct v4l_fd *f)
+{
+	if (f->unprobed & V4L_FD_PROBE_QUERY_EXT_CTRL) {
+		struct v4l2_query_ext_ctrl qec;
+
+		memset(&qec, 0, sizeof(qec));
+		qec.id = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
+		f->have_query_ext_ctrl = v4l_ioctl(f, VIDIOC_QUERY_EXT_CTRL, &qec) == 0;
+		f->unprobed &= ~V4L_FD_PROBE_QUERY_EXT_CTRL;
+	}
+	return f->have_query_ext_ctrl;
+}
+
+static inline bool v4l_fd_g_have_ext_ctrls(struct v4l_fd *f)
+{
+	if (f->unprobed & V4L_FD_PROBE_EXT_CTRLS) {
+		struct v4l2_ext_controls ec;
+
+		memset(&ec, 0, sizeof(ec));
+		f->have_ext_ctrls = v4l_ioctl(f, VIDIOC_TRY_EXT_CTRLS, &ec) == 0;
+		f->unprobed &= ~V4L_FD_PROBE_EXT_CTRLS;
+	}
+	return f->have_ext_ctrls;
+}
+
+static inline bool v4l_fd_g_have_next_ctrl(struct v4l_fd *f)
+{
+	if (f->unprobed & V4L_FD_PROBE_NEXT_CTRL) {
+		struct v4l2_queryctrl qc;
+
+		memset(&qc, 0, sizeof(qc));
+		qc.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+		f->have_next_ctrl = v4l_ioctl(f, VIDIOC_QUERYCTRL, &qc) == 0;
+		f->unprobed &= ~V4L_FD_PROBE_NEXT_CTRL;
+	}
+	return f->have_next_ctrl;
+}
+
+static inline bool v4l_fd_g_have_selection(struct v4l_fd *f)
+{
+	if (f->unprobed & V4L_FD_PROBE_SELECTION) {
+		struct v4l2_selection sel;
+
+		memset(&sel, 0, sizeof(sel));
+		sel.type = v4l_g_selection_type(f);
+		sel.target = sel.type == V4L2_BUF_TYPE_VIDEO_CAPTURE ?
+				V4L2_SEL_TGT_CROP : V4L2_SEL_TGT_COMPOSE;
+		f->have_selection = v4l_ioctl(f, VIDIOC_G_SELECTION, &sel) != ENOTTY;
+		f->unprobed &= ~V4L_FD_PROBE_SELECTION;
+	}
+	return f->have_selection;
+}
+
 static inline int v4l_open(struct v4l_fd *f, const char *devname, bool non_blocking)
 {
 	int fd = f->open(f, devname, O_RDWR | (non_blocking ? O_NONBLOCK : 0));
@@ -532,6 +586,7 @@ static inline int v4l_subdev_s_fd(struct v4l_fd *f, int fd, const char *devname)
 	f->is_subdev = true;
 	f->is_media = false;
 	f->type = 0;
+	f->unprobed = 0;
 	f->have_query_ext_ctrl = false;
 	f->have_ext_ctrls = false;
 	f->have_next_ctrl = false;
@@ -577,6 +632,7 @@ static inline int v4l_media_s_fd(struct v4l_fd *f, int fd, const char *devname)
 	f->is_subdev = false;
 	f->is_media = true;
 	f->type = 0;
+	f->unprobed = 0;
 	f->have_query_ext_ctrl = false;
 	f->have_ext_ctrls = false;
 	f->have_next_ctrl = false;
@@ -1887,7 +1943,7 @@ static inline int v4l_query_ext_ctrl(v4l_fd *f, struct v4l2_query_ext_ctrl *qec,
 	struct v4l2_queryctrl qc;
 	int ret;
 
-	if (next_compound && !f->have_query_ext_ctrl) {
+	if (next_compound && !v4l_fd_g_have_query_ext_ctrl(f)) {
 		if (!next_ctrl)
 			return -EINVAL;
 		next_compound = false;
@@ -1895,12 +1951,12 @@ static inline int v4l_query_ext_ctrl(v4l_fd *f, struct v4l2_query_ext_ctrl *qec,
 	if (next_compound)
 		qec->id |= V4L2_CTRL_FLAG_NEXT_COMPOUND;
 	if (next_ctrl) {
-		if (f->have_next_ctrl)
+		if (v4l_fd_g_have_next_ctrl(f))
 			qec->id |= V4L2_CTRL_FLAG_NEXT_CTRL;
 		else
 			qec->id = qec->id ? qec->id + 1 : V4L2_CID_BASE;
 	}
-	if (f->have_query_ext_ctrl)
+	if (v4l_fd_g_have_query_ext_ctrl(f))
 		return v4l_ioctl(f, VIDIOC_QUERY_EXT_CTRL, qec);
 
 	for (;;) {
@@ -1912,7 +1968,7 @@ static inline int v4l_query_ext_ctrl(v4l_fd *f, struct v4l2_query_ext_ctrl *qec,
 			break;
 		if (ret != EINVAL)
 			return ret;
-		if (!next_ctrl || f->have_next_ctrl)
+		if (!next_ctrl || v4l_fd_g_have_next_ctrl(f))
 			return ret;
 		if (qec->id >= V4L2_CID_PRIVATE_BASE)
 			return ret;
@@ -1957,7 +2013,7 @@ static inline int v4l_g_ext_ctrls(v4l_fd *f, struct v4l2_ext_controls *ec)
 {
 	unsigned i;
 
-	if (f->have_ext_ctrls)
+	if (v4l_fd_g_have_ext_ctrls(f))
 		return v4l_ioctl(f, VIDIOC_G_EXT_CTRLS, ec);
 	if (ec->count == 0)
 		return 0;
@@ -1978,7 +2034,7 @@ static inline int v4l_s_ext_ctrls(v4l_fd *f, struct v4l2_ext_controls *ec)
 {
 	unsigned i;
 
-	if (f->have_ext_ctrls)
+	if (v4l_fd_g_have_ext_ctrls(f))
 		return v4l_ioctl(f, VIDIOC_S_EXT_CTRLS, ec);
 	if (ec->count == 0)
 		return 0;
@@ -1998,7 +2054,7 @@ static inline int v4l_try_ext_ctrls(v4l_fd *f, struct v4l2_ext_controls *ec)
 {
 	unsigned i;
 
-	if (f->have_ext_ctrls)
+	if (v4l_fd_g_have_ext_ctrls(f))
 		return v4l_ioctl(f, VIDIOC_TRY_EXT_CTRLS, ec);
 	if (ec->count == 0)
 		return 0;
@@ -2025,7 +2081,7 @@ static inline int v4l_g_selection(v4l_fd *f, struct v4l2_selection *sel)
 	struct v4l2_crop crop;
 	int ret;
 
-	if (f->have_selection)
+	if (v4l_fd_g_have_selection(f))
 		return v4l_ioctl(f, VIDIOC_G_SELECTION, sel);
 	crop.type = sel->type;
 	cc.type = sel->type;
@@ -2070,7 +2126,7 @@ static inline int v4l_s_selection(v4l_fd *f, struct v4l2_selection *sel)
 	struct v4l2_crop crop;
 	int ret;
 
-	if (f->have_selection)
+	if (v4l_fd_g_have_selection(f))
 		return v4l_ioctl(f, VIDIOC_S_SELECTION, sel);
 	crop.type = sel->type;
 	ret = v4l_ioctl(f, VIDIOC_G_CROP, &crop);
@@ -17,6 +17,109 @@
 #define MIN_HEIGHT 64
 #define MAX_HEIGHT 2160
 
+/*
+ * When SSE2 is part of the compiler's baseline, the run-length encoder and
+ * decoder test four 32 bit words at a time while looking for runs and magic
+ * values, and fill runs with vector stores. As soon as a block does not
+ * match, the word-by-word loop takes over, so the encoded stream is exactly
+ * the same as without SIMD. The motion search of sliced FWHT frames also
+ * uses them for the sums of absolute differences.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RLE_SSE2
+#define RLE_SIMD
+
+typedef __m128i rle_vec;
+#define rle_load(p)	_mm_loadu_si128((const __m128i *)(p))
+#define rle_store(p, v)	_mm_storeu_si128((__m128i *)(p), v)
+#define rle_dup(v)	_mm_set1_epi32(v)
+#define rle_eq(a, b)	_mm_cmpeq_epi32(a, b)
+#define rle_or(a, b)	_mm_or_si128(a, b)
+#define rle_none(m)	(_mm_movemask_epi8(m) == 0)
+#define rle_all(m)	(_mm_movemask_epi8(m) == 0xffff)
+#endif
+
+/* Returns the number of words at the start of p (at most n) equal to v */
+static unsigned rle_run_length(const __u32 *p, unsigned n, __u32 v)
+{
+	unsigned k = 0;
+
+#ifdef RLE_SIMD
+	rle_vec vv = rle_dup(v);
+
+	while (k + 4 <= n && rle_all(rle_eq(rle_load(p + k), vv)))
+		k += 4;
+#endif
+	while (k < n && p[k] == v)
+		k++;
+	return k;
+}
+
+/*
+ * Returns the number of words at the start of p (at most n) that
+ * are neither m1 nor m2 and so can be copied as they are.
+ */
+static unsigned rle_literals(const __u32 *p, unsigned n, __u32 m1, __u32 m2)
+{
+	unsigned k = 0;
+
+#ifdef RLE_SIMD
+	rle_vec v1 = rle_dup(m1);
+	rle_vec v2 = rle_dup(m2);
+
+	while (k + 4 <= n) {
+		rle_vec v = rle_load(p + k);
+
+		if (!rle_none(rle_or(rle_eq(v, v1), rle_eq(v, v2))))
+			break;
+		k += 4;
+	}
+#endif
+	while (k < n && p[k] != m1 && p[k] != m2)
+		k++;
+	return k;
+}
+
+/*
+ * Like rle_literals, but also stops at the first word that is equal
+ * to the next one, since a run might start there. p[n] must be valid.
+ */
+static unsigned rle_no_runs(const __u32 *p, unsigned n, __u32 m1, __u32 m2)
+{
+	unsigned k = 0;
+
+#ifdef RLE_SIMD
+	rle_vec v1 = rle_dup(m1);
+	rle_vec v2 = rle_dup(m2);
+
+	while (k + 4 <= n) {
+		rle_vec v = rle_load(p + k);
+		rle_vec m = rle_or(rle_eq(v, rle_load(p + k + 1)),
+				   rle_or(rle_eq(v, v1), rle_eq(v, v2)));
+
+		if (!rle_none(m))
+			break;
+		k += 4;
+	}
+#endif
+	while (k < n && p[k] != m1 && p[k] != m2 && p[k] != p[k + 1])
+		k++;
+	return k;
+}
+
+static void rle_fill(__u32 *dst, __u32 v, unsigned n)
+{
+#ifdef RLE_SIMD
+	rle_vec vv = rle_dup(v);
+
+	for (; n >= 4; n -= 4, dst += 4)
+		rle_store(dst, vv);
+#endif
+	while (n--)
+		*dst++ = v;
+}
+
 /*
  * Since Bayer uses alternating lines of BG and GR color components
  * you cannot compare one line with the next to see if they are identical,
@@ -83,6 +186,17 @@ void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 		__u32 v = *p;
 		__u32 n = 1;
 
+		if (v != magic_x && v != magic_y) {
+			n = (rle_size - i) / 4;
+			if (next_line && n > (unsigned)(next_line - dst))
+				n = next_line - dst;
+			n = rle_literals(p, n, magic_x, magic_y);
+			memmove(dst, p, n * 4);
+			dst += n;
+			p += n - 1;
+			i += n * 4 - 4;
+			n = 0;
+		}
 		if (bpl && v == magic_y) {
 			l = ntohl(*++p);
 			i += 4;
@@ -95,8 +209,8 @@ void rle_decompress(__u8 *b, unsigned size, unsigned rle_size, unsigned bpl)
 			i += 8;
 		}
 
-		while (n--)
-			*dst++ = v;
+		rle_fill(dst, v, n);
+		dst += n;
 
 		if (dst == next_line) {
 			while (l--) {
@@ -151,6 +265,15 @@ unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
 			continue;
 		}
 		max = bpl ? bpl * (i / bpl + 1) : size;
+		/* copy all words up to the first possible run in one go */
+		n = rle_no_runs(p, (max - i) / 4 - 1, magic_x, magic_y);
+		if (n) {
+			memmove(dst, p, n * 4);
+			dst += n;
+			p += n - 1;
+			i += n * 4 - 4;
+			continue;
+		}
 		if (i >= max - 16) {
 			*dst++ = *p;
 			continue;
@@ -160,9 +283,8 @@ unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
 			continue;
 		}
 		n = 4;
-
-		while (i + n * 4 < max && *p == p[n])
-			n++;
+		if (i + n * 4 < max)
+			n += rle_run_length(p + n, (max - i) / 4 - n, *p);
 		*dst++ = magic_x;
 		*dst++ = p[1];
 		*dst++ = htonl(n);
@@ -172,6 +294,246 @@ unsigned rle_compress(__u8 *b, unsigned size, unsigned bpl)
 	return (__u8 *)dst - b;
 }
 
+/*
+ * Sliced frames, see V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT. Each slice is
+ * coded by v4l2_fwht_encode() and v4l2_fwht_decode() with a state that
+ * describes its band of the frame.
+ */
+#define FWHT_EXT_HDR_SIZE(slices)	(4 * (2 + (slices)))
+
+struct fwht_slice {
+	struct codec_ctx	*ctx;
+	struct v4l2_fwht_state	state;
+	unsigned int		first;		/* first line of the band */
+	__u8			*frame;
+	__u8			*in;		/* copy of the band to encode */
+	__u8			*tmp;		/* motion search and prediction */
+	__s8			*mv;		/* x, y of each block */
+	unsigned int		mv_alloc;
+	unsigned int		mv_size;	/* of the motion vectors after the frame */
+	bool			motion;
+	__u8			*data;
+	unsigned int		size;
+	bool			ok;
+};
+
+/* A luma, chroma or alpha plane of a frame as v4l2_fwht_encode() codes it */
+struct fwht_plane {
+	__u8		*p;
+	unsigned int	step;
+	unsigned int	stride;
+	unsigned int	width;		/* rounded up to 8 */
+	unsigned int	height;
+};
+
+static unsigned fwht_line_size(const struct v4l2_fwht_state *state)
+{
+	return state->coded_width * state->info->sizeimage_mult /
+	       state->info->sizeimage_div;
+}
+
+/* Point the planes of the state's reference frame into buf */
+static void fwht_ref_planes(struct v4l2_fwht_state *state, __u8 *buf)
+{
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	unsigned int chroma_div = info->width_div * info->height_div;
+	unsigned int size = state->coded_width * state->coded_height;
+
+	state->ref_frame.buf = buf;
+	state->ref_frame.luma = buf;
+	if (info->components_num >= 3) {
+		state->ref_frame.cb = state->ref_frame.luma + size;
+		state->ref_frame.cr = state->ref_frame.cb + size / chroma_div;
+	} else {
+		state->ref_frame.cb = NULL;
+		state->ref_frame.cr = NULL;
+	}
+
+	if (info->components_num == 4)
+		state->ref_frame.alpha =
+			state->ref_frame.cr + size / chroma_div;
+	else
+		state->ref_frame.alpha = NULL;
+}
+
+/*
+ * Fill in the luma, cb, cr and alpha planes of the frame in buf, in the
+ * order v4l2_fwht_encode() codes them. The layout is the one of
+ * prepare_raw_frame() in codec-v4l2-fwht.c. Returns the number of planes.
+ */
+static unsigned fwht_planes(const struct v4l2_fwht_state *state, __u8 *buf,
+			    struct fwht_plane planes[4])
+{
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	unsigned int size = state->stride * state->coded_height;
+	unsigned int chroma_stride = state->stride;
+	unsigned int luma = 0, cb = 0, cr = 0, alpha = 0;
+
+	if (info->planes_num == 3)
+		chroma_stride /= 2;
+	if (info->id == V4L2_PIX_FMT_NV24 ||
+	    info->id == V4L2_PIX_FMT_NV42)
+		chroma_stride *= 2;
+
+	switch (info->id) {
+	case V4L2_PIX_FMT_YUV420:
+		cb = size;
+		cr = size + size / 4;
+		break;
+	case V4L2_PIX_FMT_YVU420:
+		cr = size;
+		cb = size + size / 4;
+		break;
+	case V4L2_PIX_FMT_YUV422P:
+		cb = size;
+		cr = size + size / 2;
+		break;
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV16:
+	case V4L2_PIX_FMT_NV24:
+		cb = size;
+		cr = size + 1;
+		break;
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_NV61:
+	case V4L2_PIX_FMT_NV42:
+		cr = size;
+		cb = size + 1;
+		break;
+	case V4L2_PIX_FMT_YUYV:
+		cb = 1;
+		cr = 3;
+		break;
+	case V4L2_PIX_FMT_YVYU:
+		cr = 1;
+		cb = 3;
+		break;
+	case V4L2_PIX_FMT_UYVY:
+		luma = 1;
+		cr = 2;
+		break;
+	case V4L2_PIX_FMT_VYUY:
+	case V4L2_PIX_FMT_RGB24:
+	case V4L2_PIX_FMT_HSV24:
+		luma = 1;
+		cb = 2;
+		break;
+	case V4L2_PIX_FMT_BGR24:
+		luma = 1;
+		cr = 2;
+		break;
+	case V4L2_PIX_FMT_RGB32:
+	case V4L2_PIX_FMT_XRGB32:
+	case V4L2_PIX_FMT_HSV32:
+	case V4L2_PIX_FMT_ARGB32:
+		cr = 1;
+		luma = 2;
+		cb = 3;
+		break;
+	case V4L2_PIX_FMT_BGR32:
+	case V4L2_PIX_FMT_XBGR32:
+	case V4L2_PIX_FMT_ABGR32:
+		luma = 1;
+		cr = 2;
+		alpha = 3;
+		break;
+	case V4L2_PIX_FMT_BGRX32:
+	case V4L2_PIX_FMT_BGRA32:
+		cb = 1;
+		luma = 2;
+		cr = 3;
+		break;
+	case V4L2_PIX_FMT_RGBX32:
+	case V4L2_PIX_FMT_RGBA32:
+		luma = 1;
+		cb = 2;
+		alpha = 3;
+		break;
+	}
+
+	planes[0].p = buf + luma;
+	planes[0].step = info->luma_alpha_step;
+	planes[0].stride = state->stride;
+	planes[0].width = round_up(state->visible_width, 8);
+	planes[0].height = round_up(state->visible_height, 8);
+	if (info->components_num == 1)
+		return 1;
+	planes[1].p = buf + cb;
+	planes[1].step = info->chroma_step;
+	planes[1].stride = chroma_stride;
+	planes[1].width = round_up(state->visible_width / info->width_div, 8);
+	planes[1].height = round_up(state->visible_height / info->height_div, 8);
+	planes[2] = planes[1];
+	planes[2].p = buf + cr;
+	if (info->components_num == 3)
+		return 3;
+	planes[3] = planes[0];
+	planes[3].p = buf + alpha;
+	return 4;
+}
+
+/* Size of the padded motion vectors of a slice if all blocks have one */
+static unsigned fwht_mv_max_size(const struct v4l2_fwht_state *state)
+{
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	unsigned w = round_up(state->visible_width, 8) / 8;
+	unsigned h = round_up(state->visible_height, 8) / 8;
+	unsigned cw = round_up(state->visible_width / info->width_div, 8) / 8;
+	unsigned ch = round_up(state->visible_height / info->height_div, 8) / 8;
+	unsigned size = (w * h + 7) / 8 + 2 * w * h;
+
+	if (info->components_num >= 3)
+		size += 2 * ((cw * ch + 7) / 8 + 2 * cw * ch);
+	if (info->components_num == 4)
+		size += (w * h + 7) / 8 + 2 * w * h;
+	return round_up(size, 2);
+}
+
+/*
+ * Set up the state of slice s of a frame with the given number of slices
+ * and return the first line of its band. The bands before the last one are
+ * whole 16 line rows, so the band of slice s also starts at that line in the
+ * slice buffers.
+ */
+static unsigned fwht_band(const struct v4l2_fwht_state *state, unsigned s,
+			  unsigned slices, struct v4l2_fwht_state *band)
+{
+	unsigned rows = (state->visible_height + 15) / 16;
+	unsigned first = rows * s / slices * 16;
+	unsigned last = rows * (s + 1) / slices * 16;
+
+	if (last > state->visible_height)
+		last = state->visible_height;
+	*band = *state;
+	band->visible_height = last - first;
+	band->coded_height = round_up(band->visible_height, 16);
+	return first;
+}
+
+/* The largest FWHT_EXT plane data, with any number of slices */
+static unsigned fwht_ext_max_size(const struct codec_ctx *ctx)
+{
+	unsigned rows = (ctx->state.visible_height + 15) / 16;
+	unsigned max_size = 0;
+	unsigned slices, s;
+
+	for (slices = 1; slices <= V4L_STREAM_FWHT_MAX_SLICES && slices <= rows; slices++) {
+		unsigned size = FWHT_EXT_HDR_SIZE(slices);
+
+		for (s = 0; s < slices; s++) {
+			struct v4l2_fwht_state band;
+
+			fwht_band(&ctx->state, s, slices, &band);
+			size += round_up(fwht_line_size(&band) * band.coded_height +
+					 sizeof(struct fwht_cframe_hdr) +
+					 fwht_mv_max_size(&band), 4);
+		}
+		if (size > max_size)
+			max_size = size;
+	}
+	return max_size;
+}
+
 struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned visible_height,
 			     unsigned coded_width, unsigned coded_height,
 			     unsigned field, unsigned colorspace, unsigned xfer_func,
@@ -209,53 +571,603 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 		ctx->size = 2 * size + 2 * (size / chroma_div);
 	else if (info->components_num == 3)
 		ctx->size = size + 2 * (size / chroma_div);
-	ctx->state.ref_frame.buf = malloc(ctx->size);
-	ctx->state.ref_frame.luma = ctx->state.ref_frame.buf;
+	ctx->ref_buf = malloc(ctx->size);
+	/* the bands of a sliced frame are whole 16 line rows, see fwht_band() */
+	ctx->slice_ref_size = fwht_line_size(&ctx->state) * round_up(visible_height, 16);
 	ctx->comp_max_size = ctx->size + sizeof(struct fwht_cframe_hdr);
+	if (fwht_ext_max_size(ctx) > ctx->comp_max_size)
+		ctx->comp_max_size = fwht_ext_max_size(ctx);
 	ctx->state.compressed_frame = malloc(ctx->comp_max_size);
-	if (!ctx->state.ref_frame.luma || !ctx->state.compressed_frame) {
-		free(ctx->state.ref_frame.luma);
+	if (!ctx->ref_buf || !ctx->state.compressed_frame) {
+		free(ctx->ref_buf);
 		free(ctx->state.compressed_frame);
 		free(ctx);
 		return NULL;
 	}
-	if (info->components_num >= 3) {
-		ctx->state.ref_frame.cb = ctx->state.ref_frame.luma + size;
-		ctx->state.ref_frame.cr = ctx->state.ref_frame.cb + size / chroma_div;
-	} else {
-		ctx->state.ref_frame.cb = NULL;
-		ctx->state.ref_frame.cr = NULL;
-	}
-
-	if (info->components_num == 4)
-		ctx->state.ref_frame.alpha =
-			ctx->state.ref_frame.cr + size / chroma_div;
-	else
-		ctx->state.ref_frame.alpha = NULL;
+	fwht_ref_planes(&ctx->state, ctx->ref_buf);
 	ctx->state.gop_size = 10;
 	ctx->state.gop_cnt = 0;
+	ctx->rc_bitrate = 0;
+	ctx->rc_max_frame_size = 0;
+	ctx->rc_qp = FWHT_DEFAULT_QP;
+	ctx->rc_fullness = 0;
+	ctx->rc_last_ts = 0;
+	ctx->rc_ref_backup = NULL;
+	ctx->slices = 0;
+	ctx->mv_range = 0;
+	ctx->run = NULL;
+	ctx->run_priv = NULL;
+	ctx->slice_cnt = 0;
+	ctx->slice_ref = NULL;
+	ctx->slice_in = NULL;
+	ctx->slice_tmp = NULL;
+	ctx->slice = NULL;
 	return ctx;
 }
 
 void fwht_free(struct codec_ctx *ctx)
 {
-	free(ctx->state.ref_frame.luma);
+	unsigned s;
+
+	for (s = 0; ctx->slice && s < V4L_STREAM_FWHT_MAX_SLICES; s++)
+		free(ctx->slice[s].mv);
+	free(ctx->ref_buf);
 	free(ctx->state.compressed_frame);
+	free(ctx->rc_ref_backup);
+	free(ctx->slice_ref);
+	free(ctx->slice_in);
+	free(ctx->slice_tmp);
+	free(ctx->slice);
 	free(ctx);
 }
 
 __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned uncomp_size, unsigned *comp_size)
 {
-	ctx->state.i_frame_qp = ctx->state.p_frame_qp = 20;
-	*comp_size = v4l2_fwht_encode(&ctx->state, buf, ctx->state.compressed_frame);
-	return ctx->state.compressed_frame;
+	return fwht_compress_at(ctx, buf, uncomp_size, comp_size, 0);
+}
+
+static unsigned fwht_rc_clamp_qp(unsigned qp)
+{
+	if (qp < FWHT_MIN_QP)
+		return FWHT_MIN_QP;
+	return qp > FWHT_MAX_QP ? FWHT_MAX_QP : qp;
+}
+
+static bool fwht_slice_alloc(struct codec_ctx *ctx, bool encode, bool motion)
+{
+	if (!ctx->slice)
+		ctx->slice = calloc(V4L_STREAM_FWHT_MAX_SLICES, sizeof(*ctx->slice));
+	if (!ctx->slice_ref)
+		ctx->slice_ref = calloc(1, ctx->slice_ref_size);
+	if (encode && !ctx->slice_in)
+		ctx->slice_in = malloc(ctx->slice_ref_size);
+	if (motion && !ctx->slice_tmp)
+		ctx->slice_tmp = malloc(ctx->slice_ref_size);
+	return ctx->slice && ctx->slice_ref && (!encode || ctx->slice_in) &&
+	       (!motion || ctx->slice_tmp);
+}
+
+static void fwht_slice_init(struct codec_ctx *ctx, unsigned s, unsigned slices)
+{
+	struct fwht_slice *sl = &ctx->slice[s];
+	unsigned offset;
+
+	sl->ctx = ctx;
+	sl->first = fwht_band(&ctx->state, s, slices, &sl->state);
+	offset = fwht_line_size(&ctx->state) * sl->first;
+	fwht_ref_planes(&sl->state, ctx->slice_ref + offset);
+	sl->in = ctx->slice_in ? ctx->slice_in + offset : NULL;
+	sl->tmp = ctx->slice_tmp ? ctx->slice_tmp + offset : NULL;
+	sl->mv_size = 0;
+	sl->motion = false;
+}
+
+/* Copy a band between the frame and the slice buffer buf */
+static void fwht_copy_band(const struct fwht_slice *sl, __u8 *buf, bool to_frame)
+{
+	const struct v4l2_fwht_state *state = &sl->ctx->state;
+	const struct v4l2_fwht_pixfmt_info *info = state->info;
+	unsigned int stride = state->stride;
+	__u8 *frame = sl->frame;
+	int plane_idx;
+
+	for (plane_idx = 0; plane_idx < info->planes_num; plane_idx++) {
+		unsigned int h_div = (plane_idx == 1 || plane_idx == 2) ?
+			info->height_div : 1;
+		unsigned int lines = (sl->state.visible_height + h_div - 1) / h_div;
+		__u8 *row_frame;
+		__u8 *row_buf = buf;
+		unsigned int i;
+
+		if (info->planes_num == 3 && plane_idx == 1)
+			stride /= 2;
+
+		if (plane_idx == 1 &&
+		    (info->id == V4L2_PIX_FMT_NV24 ||
+		     info->id == V4L2_PIX_FMT_NV42))
+			stride *= 2;
+
+		row_frame = frame + sl->first / h_div * stride;
+		for (i = 0; i < lines; i++) {
+			if (to_frame)
+				memcpy(row_frame, row_buf, stride);
+			else
+				memcpy(row_buf, row_frame, stride);
+			row_frame += stride;
+			row_buf += stride;
+		}
+		frame += stride * (state->coded_height / h_div);
+		buf += stride * (sl->state.coded_height / h_div);
+	}
+}
+
+/* sum of absolute differences between an 8x8 block and a reference block */
+static unsigned mc_sad(const __u8 *cur, const __u8 *ref, unsigned stride)
+{
+	unsigned i;
+#ifdef RLE_SSE2
+	__m128i sum = _mm_setzero_si128();
+
+	for (i = 0; i < 8; i += 2, cur += 16, ref += 2 * stride) {
+		__m128i r = _mm_unpacklo_epi64(
+			_mm_loadl_epi64((const __m128i *)ref),
+			_mm_loadl_epi64((const __m128i *)(ref + stride)));
+
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(rle_load(cur), r));
+	}
+	return _mm_cvtsi128_si32(sum) +
+	       _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#else
+	unsigned sum = 0;
+	unsigned j;
+
+	for (i = 0; i < 8; i++, ref += stride - 8)
+		for (j = 0; j < 8; j++, cur++, ref++)
+			sum += *cur > *ref ? *cur - *ref : *ref - *cur;
+	return sum;
+#endif
+}
+
+/*
+ * A block that differs this little from the co-located block is not
+ * worth a motion search.
+ */
+#define MV_MIN_SAD 64
+
+struct motion_search {
+	const __u8 *cur;
+	const __u8 *ref;
+	unsigned width, height;
+	int x, y;
+	int range;
+};
+
+static bool mv_valid(const struct motion_search *ms, int mvx, int mvy)
+{
+	return mvx >= -ms->range && mvx <= ms->range &&
+	       mvy >= -ms->range && mvy <= ms->range &&
+	       ms->x + mvx >= 0 && ms->x + mvx + 8 <= (int)ms->width &&
+	       ms->y + mvy >= 0 && ms->y + mvy + 8 <= (int)ms->height;
+}
+
+static unsigned mv_sad(const struct motion_search *ms, int mvx, int mvy)
+{
+	return mc_sad(ms->cur, ms->ref + (ms->y + mvy) * ms->width +
+		      ms->x + mvx, ms->width);
+}
+
+/*
+ * Diamond search around the co-located block and the predicted motion
+ * vector *mvx, *mvy, with the step size halving from range / 2 to 1.
+ * Returns the motion vector of the best match in *mvx, *mvy.
+ */
+static void motion_search(const struct motion_search *ms, int *mvx, int *mvy)
+{
+	static const int diamond[4][2] = {
+		{ -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 }
+	};
+	unsigned best = mv_sad(ms, 0, 0);
+	int bx = 0, by = 0;
+	int step;
+
+	if (best > MV_MIN_SAD && (*mvx || *mvy) &&
+	    mv_valid(ms, *mvx, *mvy)) {
+		unsigned sad = mv_sad(ms, *mvx, *mvy);
+
+		if (sad < best) {
+			best = sad;
+			bx = *mvx;
+			by = *mvy;
+		}
+	}
+
+	for (step = 1; step * 4 <= ms->range; step *= 2)
+		;
+	for (; best > MV_MIN_SAD && step; step /= 2) {
+		bool moved = true;
+
+		while (moved) {
+			int cx = bx, cy = by;
+			unsigned k;
+
+			moved = false;
+			for (k = 0; k < 4; k++) {
+				int x = cx + diamond[k][0] * step;
+				int y = cy + diamond[k][1] * step;
+				unsigned sad;
+
+				if (!mv_valid(ms, x, y))
+					continue;
+				sad = mv_sad(ms, x, y);
+				if (sad < best) {
+					best = sad;
+					bx = x;
+					by = y;
+					moved = true;
+				}
+			}
+		}
+	}
+	*mvx = bx;
+	*mvy = by;
+}
+
+/*
+ * Search a motion vector for each block of the band and replace the
+ * co-located blocks of the reference by the blocks they point to, so
+ * v4l2_fwht_encode() codes the deltas against those. The encoder keeps
+ * its reference planes as consecutive 8x8 blocks, so each plane is first
+ * copied into a plain plane in sl->tmp. Returns false if all vectors are 0.
+ */
+static bool fwht_search_slice(struct fwht_slice *sl)
+{
+	struct fwht_raw_frame *rf = &sl->state.ref_frame;
+	__u8 *refs[4] = { rf->luma, rf->cb, rf->cr, rf->alpha };
+	struct fwht_plane planes[4];
+	unsigned n = fwht_planes(&sl->state, sl->in, planes);
+	unsigned range = sl->ctx->mv_range < V4L_STREAM_FWHT_MAX_MV_RANGE ?
+			 sl->ctx->mv_range : V4L_STREAM_FWHT_MAX_MV_RANGE;
+	__s8 *mv = sl->mv;
+	bool moved = false;
+	unsigned c;
+
+	for (c = 0; c < n; c++) {
+		const struct fwht_plane *pl = &planes[c];
+		struct motion_search ms = {
+			.ref = sl->tmp, .width = pl->width, .height = pl->height,
+			.range = range,
+		};
+		__u8 *refp = refs[c];
+		int mvx = 0, mvy = 0;
+		__u8 block[64];
+		unsigned i, j, k, l;
+
+		for (j = 0; j < pl->height; j += 8)
+			for (i = 0; i < pl->width; i += 8)
+				for (k = 0; k < 8; k++)
+					memcpy(sl->tmp + (j + k) * pl->width + i,
+					       refp + (j / 8 * (pl->width / 8) + i / 8) * 64 + k * 8, 8);
+
+		ms.cur = block;
+		for (j = 0; j < pl->height; j += 8) {
+			for (i = 0; i < pl->width; i += 8, refp += 64) {
+				const __u8 *cur = pl->p + j * pl->stride + i * pl->step;
+				const __u8 *ref;
+
+				for (k = 0; k < 8; k++, cur += pl->stride)
+					for (l = 0; l < 8; l++)
+						block[k * 8 + l] = cur[l * pl->step];
+				ms.x = i;
+				ms.y = j;
+				motion_search(&ms, &mvx, &mvy);
+				*mv++ = mvx;
+				*mv++ = mvy;
+				if (!mvx && !mvy)
+					continue;
+				moved = true;
+				ref = sl->tmp + (j + mvy) * pl->width + i + mvx;
+				for (k = 0; k < 8; k++, ref += pl->width)
+					memcpy(refp + k * 8, ref, 8);
+			}
+		}
+	}
+	return moved;
+}
+
+/* Write the motion vectors of the slice to out and return their size */
+static unsigned fwht_put_mvs(const struct fwht_slice *sl, __u8 *out)
+{
+	struct fwht_plane planes[4];
+	unsigned n = fwht_planes(&sl->state, sl->in, planes);
+	const __s8 *mv = sl->mv;
+	__u8 *p = out;
+	unsigned c, b;
+
+	for (c = 0; c < n; c++) {
+		unsigned blocks = planes[c].width / 8 * (planes[c].height / 8);
+		__u8 *bitmap = p;
+		int mvx = 0, mvy = 0;
+
+		memset(bitmap, 0, (blocks + 7) / 8);
+		p += (blocks + 7) / 8;
+		for (b = 0; b < blocks; b++, mv += 2) {
+			if (mv[0] == mvx && mv[1] == mvy)
+				continue;
+			bitmap[b / 8] |= 0x80 >> (b % 8);
+			mvx = *p++ = mv[0];
+			mvy = *p++ = mv[1];
+		}
+	}
+	if ((p - out) & 1)
+		*p++ = 0;
+	return p - out;
+}
+
+/*
+ * Build the prediction of the band in sl->tmp from the reference ref and
+ * the motion vectors that follow the FWHT frame of the slice.
+ */
+static bool fwht_get_mvs(struct fwht_slice *sl, const __u8 *ref)
+{
+	const __u8 *p = sl->data + sizeof(struct fwht_cframe_hdr) +
+			ntohl(sl->state.header.size);
+	const __u8 *end = p + sl->mv_size;
+	struct fwht_plane planes[4];
+	struct fwht_plane refs[4];
+	unsigned n = fwht_planes(&sl->state, sl->tmp, planes);
+	unsigned c, b, k, l;
+
+	fwht_planes(&sl->state, (__u8 *)ref, refs);
+	memcpy(sl->tmp, ref, fwht_line_size(&sl->state) * sl->state.coded_height);
+	for (c = 0; c < n; c++) {
+		const struct fwht_plane *pl = &planes[c];
+		unsigned blocks = pl->width / 8 * (pl->height / 8);
+		const __u8 *bitmap = p;
+		int mvx = 0, mvy = 0;
+
+		if ((unsigned)(end - p) < (blocks + 7) / 8)
+			return false;
+		p += (blocks + 7) / 8;
+		for (b = 0; b < blocks; b++) {
+			unsigned x = b % (pl->width / 8) * 8;
+			unsigned y = b / (pl->width / 8) * 8;
+			const __u8 *src;
+			__u8 *dst;
+
+			if (bitmap[b / 8] & (0x80 >> (b % 8))) {
+				if (end - p < 2)
+					return false;
+				mvx = (__s8)*p++;
+				mvy = (__s8)*p++;
+			}
+			if (!mvx && !mvy)
+				continue;
+			if (mvx < -V4L_STREAM_FWHT_MAX_MV_RANGE ||
+			    mvx > V4L_STREAM_FWHT_MAX_MV_RANGE ||
+			    mvy < -V4L_STREAM_FWHT_MAX_MV_RANGE ||
+			    mvy > V4L_STREAM_FWHT_MAX_MV_RANGE ||
+			    (int)x + mvx < 0 || x + mvx + 8 > pl->width ||
+			    (int)y + mvy < 0 || y + mvy + 8 > pl->height)
+				return false;
+			src = refs[c].p + (y + mvy) * pl->stride + (x + mvx) * pl->step;
+			dst = pl->p + y * pl->stride + x * pl->step;
+			for (k = 0; k < 8; k++, src += pl->stride, dst += pl->stride)
+				for (l = 0; l < 8; l++)
+					dst[l * pl->step] = src[l * pl->step];
+		}
+	}
+	return sl->mv_size % 2 == 0 && (p == end || (p + 1 == end && !*p));
+}
+
+static void fwht_encode_slice(void *job)
+{
+	struct fwht_slice *sl = job;
+	const struct fwht_cframe_hdr *hdr = (void *)sl->data;
+
+	fwht_copy_band(sl, sl->in, false);
+	if (sl->motion)
+		sl->motion = fwht_search_slice(sl);
+	sl->size = v4l2_fwht_encode(&sl->state, sl->in, sl->data);
+	if (sl->motion && !(ntohl(hdr->flags) & V4L2_FWHT_FL_I_FRAME))
+		sl->size += fwht_put_mvs(sl, sl->data + sl->size);
+}
+
+static void fwht_decode_slice(void *job)
+{
+	struct fwht_slice *sl = job;
+	__u8 *ref = sl->state.ref_frame.buf;
+
+	/*
+	 * Without motion vectors the band is decoded into its own reference,
+	 * as in fwht_decompress().
+	 */
+	if (sl->mv_size) {
+		sl->ok = fwht_get_mvs(sl, ref);
+		if (!sl->ok)
+			return;
+		sl->state.ref_frame.buf = sl->tmp;
+	}
+	sl->ok = !v4l2_fwht_decode(&sl->state, sl->data + sizeof(struct fwht_cframe_hdr),
+				   ref);
+	if (sl->ok)
+		fwht_copy_band(sl, ref, true);
+}
+
+static void fwht_run_slices(struct codec_ctx *ctx, fwht_job_func func, unsigned slices)
+{
+	unsigned s;
+
+	if (ctx->run) {
+		ctx->run(func, ctx->slice, sizeof(*ctx->slice), slices, ctx->run_priv);
+		return;
+	}
+	for (s = 0; s < slices; s++)
+		func(&ctx->slice[s]);
+}
+
+/*
+ * Returns the number of slices of the next FWHT_EXT frame, or 0 if it is
+ * coded as a single slice with ctx->state. Motion vectors need the slice
+ * buffers, so they are only used if the slices are not 0. If that changes,
+ * the reference frame no longer matches, so the next frame is an I-frame.
+ */
+static unsigned fwht_slice_count(struct codec_ctx *ctx)
+{
+	unsigned rows = (ctx->state.visible_height + 15) / 16;
+	unsigned slices = ctx->slices > 1 ? ctx->slices : 1;
+
+	if (slices > V4L_STREAM_FWHT_MAX_SLICES)
+		slices = V4L_STREAM_FWHT_MAX_SLICES;
+	if (slices > rows)
+		slices = rows;
+	if ((slices <= 1 && !ctx->mv_range) ||
+	    !fwht_slice_alloc(ctx, true, ctx->mv_range))
+		slices = 0;
+	if (slices != ctx->slice_cnt) {
+		ctx->state.gop_cnt = 0;
+		ctx->slice_cnt = slices;
+	}
+	return slices;
+}
+
+static unsigned fwht_compress_slices(struct codec_ctx *ctx, __u8 *buf, unsigned slices)
+{
+	struct v4l2_fwht_state *state = &ctx->state;
+	bool motion = ctx->mv_range && slices;
+	__u32 *h = (__u32 *)state->compressed_frame;
+	__u8 *data = state->compressed_frame + FWHT_EXT_HDR_SIZE(slices ? slices : 1);
+	__u8 *p = data;
+	bool p_frame = false;
+	unsigned s;
+
+	h[0] = htonl(motion ? V4L_STREAM_FWHT_EXT_MOTION : 0);
+	if (!slices) {
+		h[1] = htonl(1);
+		h[2] = htonl(v4l2_fwht_encode(state, buf, data));
+		return FWHT_EXT_HDR_SIZE(1) + ntohl(h[2]);
+	}
+	h[1] = htonl(slices);
+
+	/*
+	 * A slice is at most the size of its band plus the header and the
+	 * motion vectors, so each slice is compressed at the 32 bit aligned
+	 * offset of its band and then moved down.
+	 */
+	for (s = 0; s < slices; s++) {
+		struct fwht_slice *sl = &ctx->slice[s];
+		unsigned mv_max;
+
+		fwht_slice_init(ctx, s, slices);
+		mv_max = fwht_mv_max_size(&sl->state);
+		if (motion && state->gop_cnt && sl->mv_alloc < mv_max) {
+			free(sl->mv);
+			sl->mv = malloc(mv_max);
+			sl->mv_alloc = sl->mv ? mv_max : 0;
+		}
+		sl->motion = motion && state->gop_cnt && sl->mv;
+		sl->frame = buf;
+		sl->data = data;
+		data += round_up(fwht_line_size(&sl->state) * sl->state.coded_height +
+				 sizeof(struct fwht_cframe_hdr) + mv_max, 4);
+	}
+	fwht_run_slices(ctx, fwht_encode_slice, slices);
+
+	for (s = 0; s < slices; s++) {
+		struct fwht_slice *sl = &ctx->slice[s];
+		const struct fwht_cframe_hdr *hdr = (void *)sl->data;
+
+		if (!(ntohl(hdr->flags) & V4L2_FWHT_FL_I_FRAME))
+			p_frame = true;
+		h[2 + s] = htonl(sl->size);
+		memmove(p, sl->data, sl->size);
+		p += sl->size;
+	}
+
+	/* the GOP is counted as in v4l2_fwht_encode() */
+	if (!p_frame)
+		state->gop_cnt = 0;
+	if (++state->gop_cnt >= state->gop_size)
+		state->gop_cnt = 0;
+	return p - state->compressed_frame;
+}
+
+/*
+ * Compress the frame captured at ts_usecs.
+ *
+ * If rc_bitrate is set, then the QP of the next frame is raised or lowered
+ * depending on how the size of this frame compares to the bitrate times the
+ * time since the previous frame. The excess of earlier frames is kept in
+ * rc_fullness, so the bitrate is met on average.
+ *
+ * If rc_max_frame_size is set, then a frame larger than that is encoded
+ * again with a higher QP until it fits or the maximum QP is reached. That
+ * bounds the time a frame takes to send, at the cost of saving the
+ * reference frame before each frame.
+ */
+__u8 *fwht_compress_at(struct codec_ctx *ctx, __u8 *buf, unsigned uncomp_size,
+		       unsigned *comp_size, __u64 ts_usecs)
+{
+	struct v4l2_fwht_state *state = &ctx->state;
+	unsigned qp = ctx->rc_bitrate ? ctx->rc_qp : FWHT_DEFAULT_QP;
+	bool ext = fwht_packet(ctx) == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT;
+	unsigned slices = ext ? fwht_slice_count(ctx) : 0;
+	unsigned gop_cnt = state->gop_cnt;
+	__u8 *ref = slices ? ctx->slice_ref : ctx->ref_buf;
+	unsigned ref_size = slices ? ctx->slice_ref_size : ctx->size;
+
+	if (ctx->rc_max_frame_size && !ctx->rc_ref_backup)
+		ctx->rc_ref_backup = malloc(ctx->size > ctx->slice_ref_size ?
+					    ctx->size : ctx->slice_ref_size);
+	if (ctx->rc_max_frame_size && ctx->rc_ref_backup)
+		memcpy(ctx->rc_ref_backup, ref, ref_size);
+
+	for (;;) {
+		state->i_frame_qp = state->p_frame_qp = qp;
+		if (ext)
+			*comp_size = fwht_compress_slices(ctx, buf, slices);
+		else
+			*comp_size = v4l2_fwht_encode(state, buf, state->compressed_frame);
+		if (!ctx->rc_max_frame_size || !ctx->rc_ref_backup ||
+		    *comp_size <= ctx->rc_max_frame_size || qp == FWHT_MAX_QP)
+			break;
+		memcpy(ref, ctx->rc_ref_backup, ref_size);
+		state->gop_cnt = gop_cnt;
+		qp = fwht_rc_clamp_qp(qp * 3 / 2 + 1);
+	}
+
+	if (!ctx->rc_bitrate)
+		return state->compressed_frame;
+
+	if (ctx->rc_last_ts && ts_usecs > ctx->rc_last_ts) {
+		__u64 delta = ts_usecs - ctx->rc_last_ts;
+		__s64 window = ctx->rc_bitrate / 16;
+		__s64 budget;
+		__s64 pressure;
+
+		/* don't save up bandwidth while the stream is stalled */
+		if (delta > 1000000)
+			delta = 1000000;
+		budget = ctx->rc_bitrate / 8 * delta / 1000000;
+		ctx->rc_fullness += (__s64)*comp_size - budget;
+		if (ctx->rc_fullness > window)
+			ctx->rc_fullness = window;
+		else if (ctx->rc_fullness < -window)
+			ctx->rc_fullness = -window;
+		pressure = *comp_size + ctx->rc_fullness / 4;
+		if (pressure > budget + budget / 8)
+			qp = qp * 5 / 4 + 1;
+		else if (pressure < budget - budget / 4)
+			qp = qp * 4 / 5;
+	}
+	ctx->rc_qp = fwht_rc_clamp_qp(qp);
+	ctx->rc_last_ts = ts_usecs;
+	return state->compressed_frame;
 }
 
 static void copy_cap_to_ref(const u8 *cap, const struct v4l2_fwht_pixfmt_info *info,
-			    struct v4l2_fwht_state *state)
+			    struct v4l2_fwht_state *state, u8 *p_ref)
 {
 	int plane_idx;
-	u8 *p_ref = state->ref_frame.buf;
 	unsigned int cap_stride = state->stride;
 	unsigned int ref_stride = state->ref_stride;
 
@@ -295,6 +1207,413 @@ bool fwht_decompress(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
 	p_in += sizeof(ctx->state.header);
 	if (v4l2_fwht_decode(&ctx->state, p_in, p_out))
 		return false;
-	copy_cap_to_ref(p_out, ctx->state.info, &ctx->state);
+
+	/*
+	 * The next reference frame is either a copy in ctx->ref_buf or p_out
+	 * itself. A frame can be decoded into its own reference frame since
+	 * each block of the reference is read before it is overwritten.
+	 */
+	if ((ctx->flags & FWHT_CTX_KEEP_DECODED) &&
+	    ctx->state.stride == ctx->state.ref_stride &&
+	    uncomp_size >= ctx->size) {
+		ctx->state.ref_frame.buf = p_out;
+	} else {
+		copy_cap_to_ref(p_out, ctx->state.info, &ctx->state, ctx->ref_buf);
+		ctx->state.ref_frame.buf = ctx->ref_buf;
+	}
+	ctx->state.ref_frame.luma = ctx->state.ref_frame.buf;
+	return true;
+}
+
+__u32 fwht_packet(const struct codec_ctx *ctx)
+{
+	return ctx->slices > 1 || ctx->mv_range ?
+		V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT :
+		V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
+}
+
+bool fwht_decompress_ext(struct codec_ctx *ctx, __u8 *p_in, unsigned comp_size,
+			 __u8 *p_out, unsigned uncomp_size)
+{
+	const __u32 *h = (const __u32 *)p_in;
+	unsigned rows = (ctx->state.visible_height + 15) / 16;
+	unsigned slices, flags, left, s;
+	bool motion;
+	__u8 *p;
+
+	if (comp_size < FWHT_EXT_HDR_SIZE(0))
+		return false;
+	flags = ntohl(h[0]);
+	slices = ntohl(h[1]);
+	motion = flags & V4L_STREAM_FWHT_EXT_MOTION;
+	if ((flags & ~V4L_STREAM_FWHT_EXT_MOTION) || !slices ||
+	    slices > V4L_STREAM_FWHT_MAX_SLICES ||
+	    slices > rows || comp_size < FWHT_EXT_HDR_SIZE(slices))
+		return false;
+	p = p_in + FWHT_EXT_HDR_SIZE(slices);
+	left = comp_size - FWHT_EXT_HDR_SIZE(slices);
+	if (slices == 1 && !motion)
+		return ntohl(h[2]) <= left &&
+		       fwht_decompress(ctx, p, ntohl(h[2]), p_out, uncomp_size);
+
+	if (uncomp_size < ctx->size || !fwht_slice_alloc(ctx, false, motion))
+		return false;
+	for (s = 0; s < slices; s++) {
+		struct fwht_slice *sl = &ctx->slice[s];
+		unsigned size = ntohl(h[2 + s]);
+		unsigned frame_size;
+
+		if (size < sizeof(struct fwht_cframe_hdr) || size > left)
+			return false;
+		fwht_slice_init(ctx, s, slices);
+		memcpy(&sl->state.header, p, sizeof(sl->state.header));
+		frame_size = ntohl(sl->state.header.size);
+		if (frame_size > size - sizeof(sl->state.header))
+			return false;
+		sl->mv_size = size - sizeof(sl->state.header) - frame_size;
+		if (sl->mv_size &&
+		    (!motion || (ntohl(sl->state.header.flags) & V4L2_FWHT_FL_I_FRAME)))
+			return false;
+		sl->frame = p_out;
+		sl->data = p;
+		p += size;
+		left -= size;
+	}
+	fwht_run_slices(ctx, fwht_decode_slice, slices);
+
+	for (s = 0; s < slices; s++)
+		if (!ctx->slice[s].ok)
+			return false;
+	ctx->state.colorspace = ctx->slice[0].state.colorspace;
+	ctx->state.xfer_func = ctx->slice[0].state.xfer_func;
+	ctx->state.ycbcr_enc = ctx->slice[0].state.ycbcr_enc;
+	ctx->state.quantization = ctx->slice[0].state.quantization;
+	return true;
+}
+
+/*
+ * UDP stream reassembly, see the UDP description in v4l-stream.h.
+ */
+enum {
+	UDP_RX_IDLE,	/* no frame seen yet */
+	UDP_RX_DONE,	/* rx->seq was handed out, waiting for the next frame */
+	UDP_RX_BUSY,	/* collecting the fragments of frame rx->seq */
+};
+
+/* frames this much older than the current one mean the sender restarted */
+#define UDP_RX_SEQ_WINDOW 1024
+
+void v4l_stream_udp_rx_init(struct v4l_stream_udp_rx *rx)
+{
+	memset(rx, 0, sizeof(*rx));
+	rx->state = UDP_RX_IDLE;
+}
+
+void v4l_stream_udp_rx_free(struct v4l_stream_udp_rx *rx)
+{
+	unsigned p;
+
+	for (p = 0; p < VIDEO_MAX_PLANES; p++) {
+		free(rx->planes[p].data);
+		free(rx->planes[p].have);
+		free(rx->planes[p].parity);
+		free(rx->planes[p].have_parity);
+	}
+	v4l_stream_udp_rx_init(rx);
+}
+
+static bool udp_rx_realloc(__u8 **p, unsigned *alloc, unsigned size)
+{
+	__u8 *n;
+
+	if (size <= *alloc)
+		return true;
+	n = realloc(*p, size);
+	if (!n)
+		return false;
+	*p = n;
+	*alloc = size;
+	return true;
+}
+
+static unsigned udp_rx_frag_len(const struct v4l_stream_udp_rx *rx,
+				const struct v4l_stream_udp_plane *pl, unsigned idx)
+{
+	unsigned offset = idx * rx->frag_size;
+
+	return pl->data_size - offset < rx->frag_size ?
+		pl->data_size - offset : rx->frag_size;
+}
+
+/* Recover one lost fragment per FEC group from the parity */
+static void udp_rx_recover(struct v4l_stream_udp_rx *rx,
+			   struct v4l_stream_udp_plane *pl)
+{
+	unsigned groups = (pl->frags + rx->fec - 1) / rx->fec;
+	unsigned g;
+
+	for (g = 0; g < groups; g++) {
+		unsigned first = g * rx->fec;
+		unsigned last = first + rx->fec < pl->frags ? first + rx->fec : pl->frags;
+		__u8 *parity = pl->parity + g * rx->frag_size;
+		unsigned missing = 0, lost = 0;
+		unsigned i, j;
+
+		if (!pl->have_parity[g])
+			continue;
+		for (i = first; i < last; i++) {
+			if (!pl->have[i]) {
+				missing = i;
+				lost++;
+			}
+		}
+		if (lost != 1)
+			continue;
+		for (i = first; i < last; i++) {
+			const __u8 *d = pl->data + i * rx->frag_size;
+			unsigned len = udp_rx_frag_len(rx, pl, i);
+
+			if (i == missing)
+				continue;
+			for (j = 0; j < len; j++)
+				parity[j] ^= d[j];
+		}
+		memcpy(pl->data + missing * rx->frag_size, parity,
+		       udp_rx_frag_len(rx, pl, missing));
+		pl->have[missing] = 1;
+		pl->received++;
+		rx->recovered_frags++;
+	}
+}
+
+static int udp_rx_finish(struct v4l_stream_udp_rx *rx)
+{
+	bool complete = true;
+	unsigned p;
+
+	for (p = 0; p < rx->num_planes; p++) {
+		struct v4l_stream_udp_plane *pl = &rx->planes[p];
+
+		if (!pl->started) {
+			complete = false;
+			continue;
+		}
+		if (rx->fec && pl->received < pl->frags)
+			udp_rx_recover(rx, pl);
+		if (pl->received < pl->frags) {
+			rx->lost_frags += pl->frags - pl->received;
+			complete = false;
+		}
+	}
+	rx->frames++;
+	if (!complete)
+		rx->incomplete_frames++;
+	rx->state = UDP_RX_DONE;
+	return V4L_STREAM_UDP_RX_FRAME;
+}
+
+static bool udp_rx_start_plane(struct v4l_stream_udp_rx *rx,
+			       struct v4l_stream_udp_plane *pl,
+			       __u32 bytesused, __u32 data_size)
+{
+	unsigned frags = (data_size + rx->frag_size - 1) / rx->frag_size;
+	unsigned groups = rx->fec ? (frags + rx->fec - 1) / rx->fec : 0;
+
+	if (data_size > V4L_STREAM_UDP_MAX_PLANE_SIZE)
+		return false;
+	if (!udp_rx_realloc(&pl->data, &pl->alloc_size, data_size) ||
+	    !udp_rx_realloc(&pl->have, &pl->alloc_frags, frags) ||
+	    !udp_rx_realloc(&pl->have_parity, &pl->alloc_groups, groups) ||
+	    !udp_rx_realloc(&pl->parity, &pl->alloc_parity, groups * rx->frag_size))
+		return false;
+	if (frags)
+		memset(pl->have, 0, frags);
+	if (groups)
+		memset(pl->have_parity, 0, groups);
+	pl->bytesused = bytesused;
+	pl->data_size = data_size;
+	pl->frags = frags;
+	pl->received = 0;
+	pl->started = true;
 	return true;
 }
+
+int v4l_stream_udp_rx_packet(struct v4l_stream_udp_rx *rx, const __u8 *buf, unsigned len)
+{
+	const __u8 *payload = buf + V4L_STREAM_UDP_HDR_SIZE;
+	struct v4l_stream_udp_plane *pl;
+	__u32 h[V4L_STREAM_UDP_HDR_SIZE / 4];
+	unsigned plen, idx, i;
+
+	if (len < V4L_STREAM_UDP_HDR_SIZE)
+		return 0;
+	memcpy(h, buf, sizeof(h));
+	for (i = 0; i < V4L_STREAM_UDP_HDR_SIZE / 4; i++)
+		h[i] = ntohl(h[i]);
+	if (h[0] != V4L_STREAM_UDP_ID)
+		return 0;
+	plen = len - V4L_STREAM_UDP_HDR_SIZE;
+
+	switch (h[1]) {
+	case V4L_STREAM_PACKET_FMT_VIDEO: {
+		__u32 fmt[sizeof(rx->fmt) / 4];
+
+		if ((plen & 3) || plen < V4L_STREAM_PACKET_FMT_VIDEO_SIZE(0) - 4 ||
+		    plen > sizeof(fmt))
+			return 0;
+		memcpy(fmt, payload, plen);
+		for (i = 0; i < plen / 4; i++)
+			fmt[i] = ntohl(fmt[i]);
+		if (plen / 4 == rx->fmt_len && !memcmp(fmt, rx->fmt, plen))
+			return 0;
+		memcpy(rx->fmt, fmt, plen);
+		rx->fmt_len = plen / 4;
+		return V4L_STREAM_UDP_RX_FMT;
+	}
+	case V4L_STREAM_PACKET_END:
+		if (rx->state == UDP_RX_BUSY)
+			return udp_rx_finish(rx) | V4L_STREAM_UDP_RX_AGAIN;
+		rx->state = UDP_RX_IDLE;
+		return V4L_STREAM_UDP_RX_END;
+	case V4L_STREAM_PACKET_FRAME_VIDEO_RLE:
+	case V4L_STREAM_PACKET_FRAME_VIDEO_FWHT:
+	case V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT:
+		break;
+	default:
+		return 0;
+	}
+
+	if (rx->state != UDP_RX_IDLE) {
+		int d = (int)(h[2] - rx->seq);
+
+		if (d < 0 && d > -UDP_RX_SEQ_WINDOW)
+			return 0;
+		if (d == 0 && rx->state == UDP_RX_DONE)
+			return 0;
+		if (d && rx->state == UDP_RX_BUSY)
+			return udp_rx_finish(rx) | V4L_STREAM_UDP_RX_AGAIN;
+	}
+	if (rx->state != UDP_RX_BUSY) {
+		if (!h[3] || h[3] > VIDEO_MAX_PLANES || !h[10] ||
+		    h[10] > V4L_STREAM_UDP_MAX_SIZE)
+			return 0;
+		rx->seq = h[2];
+		rx->packet = h[1];
+		rx->num_planes = h[3];
+		rx->field = h[5];
+		rx->flags = h[6];
+		rx->frag_size = h[10];
+		rx->fec = h[11] & ~V4L_STREAM_UDP_FEC_PARITY;
+		for (i = 0; i < VIDEO_MAX_PLANES; i++)
+			rx->planes[i].started = false;
+		rx->state = UDP_RX_BUSY;
+	}
+	if (h[1] != rx->packet || h[3] != rx->num_planes || h[4] >= rx->num_planes ||
+	    h[10] != rx->frag_size || (h[11] & ~V4L_STREAM_UDP_FEC_PARITY) != rx->fec ||
+	    h[9] % rx->frag_size)
+		return 0;
+
+	pl = &rx->planes[h[4]];
+	if (!pl->started) {
+		if (!udp_rx_start_plane(rx, pl, h[7], h[8]))
+			return 0;
+	} else if (h[7] != pl->bytesused || h[8] != pl->data_size) {
+		return 0;
+	}
+	idx = h[9] / rx->frag_size;
+	if (idx >= pl->frags)
+		return 0;
+
+	if (h[11] & V4L_STREAM_UDP_FEC_PARITY) {
+		unsigned g = idx / rx->fec;
+
+		if (!rx->fec || idx % rx->fec || plen > rx->frag_size)
+			return 0;
+		memcpy(pl->parity + g * rx->frag_size, payload, plen);
+		memset(pl->parity + g * rx->frag_size + plen, 0, rx->frag_size - plen);
+		pl->have_parity[g] = 1;
+		return 0;
+	}
+
+	if (plen != udp_rx_frag_len(rx, pl, idx) || pl->have[idx])
+		return 0;
+	memcpy(pl->data + h[9], payload, plen);
+	pl->have[idx] = 1;
+	pl->received++;
+
+	for (i = 0; i < rx->num_planes; i++)
+		if (!rx->planes[i].started ||
+		    rx->planes[i].received < rx->planes[i].frags)
+			return 0;
+	return udp_rx_finish(rx);
+}
+
+bool v4l_stream_udp_rx_fmt(const struct v4l_stream_udp_rx *rx, struct v4l2_format *fmt,
+			   struct v4l2_fract *pixelaspect)
+{
+	const __u32 *f = rx->fmt;
+	struct v4l2_pix_format_mplane *pix = &fmt->fmt.pix_mp;
+	unsigned i;
+
+	if (rx->fmt_len < V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT / 4 + 1 ||
+	    f[0] != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT ||
+	    !f[1] || f[1] > VIDEO_MAX_PLANES ||
+	    rx->fmt_len < (V4L_STREAM_PACKET_FMT_VIDEO_SIZE(f[1]) - 4) / 4)
+		return false;
+
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	pix->num_planes = f[1];
+	pix->pixelformat = f[2];
+	pix->width = f[3];
+	pix->height = f[4];
+	pix->field = f[5];
+	pix->colorspace = f[6];
+	pix->ycbcr_enc = f[7];
+	pix->quantization = f[8];
+	pix->xfer_func = f[9];
+	pix->flags = f[10];
+	pixelaspect->numerator = f[11];
+	pixelaspect->denominator = f[12];
+	f += 13;
+	for (i = 0; i < pix->num_planes; i++, f += 3) {
+		if (f[0] != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE)
+			return false;
+		pix->plane_fmt[i].sizeimage = f[1];
+		pix->plane_fmt[i].bytesperline = f[2];
+	}
+	return true;
+}
+
+bool v4l_stream_udp_rx_plane(struct v4l_stream_udp_rx *rx, unsigned plane,
+			     struct codec_ctx *ctx, __u8 *buf, unsigned size,
+			     unsigned bytesperline)
+{
+	struct v4l_stream_udp_plane *pl = &rx->planes[plane];
+	unsigned i;
+
+	if (plane >= rx->num_planes || !pl->started)
+		return false;
+
+	if (pl->received == pl->frags) {
+		if (rx->packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT)
+			return ctx && fwht_decompress(ctx, pl->data, pl->data_size, buf, size);
+		if (rx->packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT)
+			return ctx && fwht_decompress_ext(ctx, pl->data, pl->data_size, buf, size);
+		if (pl->bytesused > size || pl->data_size > pl->bytesused)
+			return false;
+		memcpy(buf + pl->bytesused - pl->data_size, pl->data, pl->data_size);
+		rle_decompress(buf, pl->bytesused, pl->data_size, bytesperline);
+		return true;
+	}
+
+	/* use the fragments we have of an uncompressed plane */
+	if (rx->packet != V4L_STREAM_PACKET_FRAME_VIDEO_RLE ||
+	    pl->data_size != pl->bytesused || pl->bytesused > size)
+		return false;
+	for (i = 0; i < pl->frags; i++)
+		if (pl->have[i])
+			memcpy(buf + i * rx->frag_size, pl->data + i * rx->frag_size,
+			       udp_rx_frag_len(rx, pl, i));
+	return false;
+}
@@ -72,6 +72,8 @@ extern "C" {
 #define V4L_STREAM_PACKET_FRAME_VIDEO_RLE		v4l2_fourcc('f', 'r', 'm', 'v')
 /* FWHT compressed frame video packet */
 #define V4L_STREAM_PACKET_FRAME_VIDEO_FWHT		v4l2_fourcc('f', 'r', 'm', 'V')
+/* FWHT compressed frame video packet, split in slices */
+#define V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT		v4l2_fourcc('f', 'r', 'm', 'X')
 
 #define V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR		(8 * 4)
 #define V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR	(8 * 4)
@@ -130,18 +132,241 @@ extern "C" {
  * details.
  */
 
+/*
+ * FWHT_EXT description:
+ *
+ * The plane data of a FRAME_VIDEO_FWHT_EXT packet is defined as follows:
+ *
+ * uint32_t flags;	// V4L_STREAM_FWHT_EXT_* flags
+ * uint32_t slices;	// 1 to V4L_STREAM_FWHT_MAX_SLICES
+ * uint32_t slice_size[slices];
+ * uint8_t slice_data[slices][slice_size];
+ *
+ * The frame is split in bands of whole 16 line rows, slice s covers the
+ * rows from rows * s / slices until rows * (s + 1) / slices, with rows the
+ * number of 16 line rows of the visible height. Each slice is a complete
+ * FWHT frame with the visible width and the height of its band, the last
+ * band ends at the visible height. The slices only refer to the same band
+ * of the previous frame, so they can be compressed and decompressed in
+ * parallel. Decoders that do not know this packet reject the stream rather
+ * than misdecoding it.
+ *
+ * If V4L_STREAM_FWHT_EXT_MOTION is set, then the FWHT frame of a P-coded
+ * slice can be followed by motion vectors. The P-blocks of the slice are
+ * then coded against the blocks of the previous band that the vectors point
+ * to instead of the co-located blocks. For each plane in the order luma,
+ * cb, cr and alpha, with the rounded up to 8 dimensions the FWHT frame
+ * codes it with, the vectors are defined as follows:
+ *
+ * uint8_t changed[(blocks + 7) / 8];	// one bit per 8x8 block, MSB first
+ * int8_t mv[set bits in changed][2];	// x, y in pixels
+ *
+ * The blocks are in raster order and a set bit means that the vector of
+ * that block differs from the one of the previous block, starting at 0, 0.
+ * A 0 byte pads the vectors of the slice to an even size, so the FWHT
+ * frame of the next slice stays 16 bit aligned.
+ * The block a vector points to lies within the plane and the vectors are
+ * at most V4L_STREAM_FWHT_MAX_MV_RANGE. A slice without motion vectors is
+ * coded against the co-located blocks.
+ */
+#define V4L_STREAM_FWHT_MAX_SLICES	16
+#define V4L_STREAM_FWHT_EXT_MOTION	(1 << 0)
+#define V4L_STREAM_FWHT_MAX_MV_RANGE	16
+
 /*
  * This packet ends the stream and, after reading this, the socket can be closed
  * since no more data will follow.
  */
 #define V4L_STREAM_PACKET_END				v4l2_fourcc('e', 'n', 'd', ' ')
 
+/*
+ * UDP (and multicast) variant of the stream.
+ *
+ * Instead of one byte stream every datagram starts with this header,
+ * all values are again uint32_t in network order:
+ *
+ * uint32_t id;		// V4L_STREAM_UDP_ID
+ * uint32_t packet;	// FMT_VIDEO, FRAME_VIDEO_RLE/FWHT/FWHT_EXT or END
+ * uint32_t seq;	// frame sequence number, incremented for each frame
+ * uint32_t num_planes;
+ * uint32_t plane;	// the plane this fragment belongs to
+ * uint32_t field;
+ * uint32_t flags;
+ * uint32_t bytesused;	// of the plane, as in the FRAME_VIDEO plane header
+ * uint32_t data_size;	// of the plane, as in the FRAME_VIDEO plane header
+ * uint32_t offset;	// offset of this fragment in the plane data
+ * uint32_t frag_size;	// size of all but the last fragment of the plane
+ * uint32_t fec;	// FEC group size, 0 if no FEC is used
+ * uint8_t payload[];
+ *
+ * The FMT_VIDEO datagram carries the FMT_VIDEO packet content in its
+ * payload, starting with size_fmt, and is repeated regularly so receivers
+ * can join a running stream. The END datagram has no payload.
+ *
+ * The plane data of a FRAME_VIDEO packet is split in fragments of
+ * frag_size bytes, one per datagram. If fec is non-zero, every fec
+ * consecutive fragments of a plane are followed by a parity datagram with
+ * the V4L_STREAM_UDP_FEC_PARITY bit set in fec, offset set to the first
+ * fragment of the group and the XOR of the fragments of the group
+ * (zero-padded to frag_size) as payload. This allows the receiver to
+ * recover one lost fragment per group.
+ *
+ * A receiver can use a plane if all its fragments arrived. If the plane
+ * is not compressed (data_size == bytesused for FRAME_VIDEO_RLE) the
+ * fragments that did arrive can be used, the rest of the plane keeps
+ * the contents of the previous frame.
+ */
+#define V4L_STREAM_UDP_ID			v4l2_fourcc('V', '4', 'L', 'u')
+#define V4L_STREAM_UDP_HDR_SIZE			(12 * 4)
+#define V4L_STREAM_UDP_FEC_PARITY		0x80000000
+/* 1500 byte ethernet MTU minus the IPv4 and UDP headers */
+#define V4L_STREAM_UDP_DEFAULT_SIZE		1472
+#define V4L_STREAM_UDP_MAX_SIZE			65507
+#define V4L_STREAM_UDP_MAX_PLANE_SIZE		(64 * 1024 * 1024)
+
+struct v4l_stream_udp_plane {
+	__u8		*data;
+	__u8		*have;		/* received fragments */
+	__u8		*parity;	/* parity payload of each FEC group */
+	__u8		*have_parity;
+	unsigned int	alloc_size;
+	unsigned int	alloc_frags;
+	unsigned int	alloc_groups;
+	unsigned int	alloc_parity;
+	unsigned int	bytesused;
+	unsigned int	data_size;
+	unsigned int	frags;
+	unsigned int	received;
+	bool		started;	/* a fragment of the plane arrived */
+};
+
+struct v4l_stream_udp_rx {
+	__u32				seq;
+	int				state;
+	__u32				packet;
+	unsigned int			num_planes;
+	__u32				field;
+	__u32				flags;
+	unsigned int			frag_size;
+	unsigned int			fec;
+	struct v4l_stream_udp_plane	planes[VIDEO_MAX_PLANES];
+	__u32				fmt[V4L_STREAM_PACKET_FMT_VIDEO_SIZE(VIDEO_MAX_PLANES) / 4];
+	unsigned int			fmt_len;
+	/* statistics */
+	unsigned int			frames;
+	unsigned int			incomplete_frames;
+	unsigned int			lost_frags;
+	unsigned int			recovered_frags;
+};
+
+/* v4l_stream_udp_rx_packet() return flags */
+#define V4L_STREAM_UDP_RX_FMT		(1 << 0)	/* a new format was received */
+#define V4L_STREAM_UDP_RX_FRAME		(1 << 1)	/* a frame is ready */
+#define V4L_STREAM_UDP_RX_END		(1 << 2)	/* the END packet was received */
+#define V4L_STREAM_UDP_RX_AGAIN		(1 << 3)	/* pass the same datagram again */
+
+/*
+ * Shared memory variant of the stream, for a receiver on the same host.
+ *
+ * The stream is sent over a unix stream socket and starts as the TCP
+ * stream with the stream ID, the version and the FMT_VIDEO packet. This is
+ * followed by a SHM_RING packet with the layout of the frame ring:
+ *
+ * uint32_t size_ring;	// size in bytes of data after size_ring
+ * uint32_t frames;	// number of frames in the ring
+ * uint32_t frame_size;	// size in bytes of each frame in the ring
+ *
+ * The SHM_RING packet is sent with a single sendmsg() that passes two file
+ * descriptors as SCM_RIGHTS: a memfd with the ring and an eventfd. The
+ * memfd starts with a struct v4l_stream_shm_ring, the frames follow at
+ * V4L_STREAM_SHM_DATA_OFFSET. The planes of a frame follow each other, each
+ * taking the sizeimage of the plane given in the FMT_VIDEO packet.
+ *
+ * The receiver accepts the ring by answering with the SHM_RING ID once it
+ * mapped the memfd, or refuses it by closing the socket. From then on only
+ * the END packet is sent over the socket.
+ *
+ * The frames are neither compressed nor copied through the socket. The
+ * sender fills frame head % frames, increments head and adds 1 to the
+ * eventfd. The receiver takes the frames from tail up to head and
+ * increments tail once it is done with a frame. If the ring is full, the
+ * sender drops the frame. head and tail are free running counters in host
+ * order, they are written with release and read with acquire semantics.
+ */
+#define V4L_STREAM_PACKET_SHM_RING		v4l2_fourcc('s', 'h', 'm', 'r')
+#define V4L_STREAM_PACKET_SHM_RING_SIZE		(2 * 4)
+#define V4L_STREAM_SHM_MAX_FRAMES		32
+#define V4L_STREAM_SHM_DEFAULT_FRAMES		4
+#define V4L_STREAM_SHM_DATA_OFFSET		4096
+
+struct v4l_stream_shm_frame {
+	__u32	seq;
+	__u32	field;
+	__u32	flags;
+	__u32	bytesused[VIDEO_MAX_PLANES];
+};
+
+struct v4l_stream_shm_ring {
+	__u32				head;
+	__u32				tail;
+	struct v4l_stream_shm_frame	frame[V4L_STREAM_SHM_MAX_FRAMES];
+};
+
+/*
+ * The QP range of the rate control. The FWHT QP is the dead zone of the
+ * quantizer, so it is not signalled in the stream and can change for each
+ * frame. The upper limit is well beyond the 31 of the vicodec controls since
+ * noisy frames need a much larger dead zone to shrink.
+ */
+#define FWHT_DEFAULT_QP		20
+#define FWHT_MIN_QP		1
+#define FWHT_MAX_QP		255
+
+/*
+ * Set in codec_ctx flags if the frame that fwht_decompress() decoded is not
+ * changed until the next fwht_decompress() call. That frame is then used as
+ * the reference frame instead of copying it to the reference buffer.
+ */
+#define FWHT_CTX_KEEP_DECODED	(1 << 0)
+
+/*
+ * Runs func on each of the num_jobs jobs of job_size bytes at jobs and
+ * returns once all are done. The jobs are independent, so they can run in
+ * parallel.
+ */
+typedef void (*fwht_job_func)(void *job);
+typedef void (*fwht_run_func)(fwht_job_func func, void *jobs, unsigned job_size,
+			      unsigned num_jobs, void *priv);
+
+struct fwht_slice;
+
 struct codec_ctx {
 	struct v4l2_fwht_state	state;
 	unsigned int		flags;
 	unsigned int		size;
 	u32			field;
 	u32			comp_max_size;
+	__u8			*ref_buf;
+
+	/* rate control, see fwht_compress_at() */
+	unsigned int		rc_bitrate;		/* bits/s, 0 for a fixed QP */
+	unsigned int		rc_max_frame_size;	/* bytes, 0 for no limit */
+	unsigned int		rc_qp;
+	__s64			rc_fullness;
+	__u64			rc_last_ts;
+	__u8			*rc_ref_backup;
+
+	/* sliced frames if > 1, see V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT */
+	unsigned int		slices;
+	unsigned int		mv_range;		/* motion search range, 0 for none */
+	fwht_run_func		run;			/* NULL to run the slices in turn */
+	void			*run_priv;
+	unsigned int		slice_cnt;		/* slices of the reference */
+	unsigned int		slice_ref_size;
+	__u8			*slice_ref;
+	__u8			*slice_in;
+	__u8			*slice_tmp;
+	struct fwht_slice	*slice;
 };
 
 unsigned rle_compress(__u8 *buf, unsigned size, unsigned bytesperline);
@@ -152,9 +377,22 @@ struct codec_ctx *fwht_alloc(unsigned pixfmt, unsigned visible_width, unsigned v
 			     unsigned quantization);
 void fwht_free(struct codec_ctx *ctx);
 __u8 *fwht_compress(struct codec_ctx *ctx, __u8 *buf, unsigned size, unsigned *comp_size);
+__u8 *fwht_compress_at(struct codec_ctx *ctx, __u8 *buf, unsigned size,
+		       unsigned *comp_size, __u64 ts_usecs);
 bool fwht_decompress(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
 		     __u8 *buf, unsigned size);
+__u32 fwht_packet(const struct codec_ctx *ctx);
+bool fwht_decompress_ext(struct codec_ctx *ctx, __u8 *read_buf, unsigned comp_size,
+			 __u8 *buf, unsigned size);
 unsigned rle_calc_bpl(unsigned bpl, __u32 pixelformat);
+void v4l_stream_udp_rx_init(struct v4l_stream_udp_rx *rx);
+void v4l_stream_udp_rx_free(struct v4l_stream_udp_rx *rx);
+int v4l_stream_udp_rx_packet(struct v4l_stream_udp_rx *rx, const __u8 *buf, unsigned len);
+bool v4l_stream_udp_rx_fmt(const struct v4l_stream_udp_rx *rx, struct v4l2_format *fmt,
+			   struct v4l2_fract *pixelaspect);
+bool v4l_stream_udp_rx_plane(struct v4l_stream_udp_rx *rx, unsigned plane,
+			     struct codec_ctx *ctx, __u8 *buf, unsigned size,
+			     unsigned bytesperline);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * v4l2-tpg-cache.c - Shares the precalculated test pattern colors
+ *
+ * The colors only depend on the settings at struct tpg_colors_key, so the
+ * generators with the same settings share them, and going back to previous
+ * settings doesn't need to calculate them again.
+ */
+
+#include <pthread.h>
+
+#include "v4l2-tpg-cache.h"
+
+#define TPG_COLORS_CACHE_MAX	32
+
+struct tpg_colors_key {
+	u32 fourcc;
+	u32 colorspace;
+	u32 real_xfer_func;
+	u32 real_ycbcr_enc;
+	u32 real_hsv_enc;
+	u32 real_quantization;
+	u32 rgb_range;
+	u32 real_rgb_range;
+	u32 pattern;
+	u32 qual;
+	u32 qual_offset;
+	s16 hue;
+	u8 color_enc;
+	u8 brightness;
+	u8 contrast;
+	u8 saturation;
+};
+
+struct tpg_colors_entry {
+	struct tpg_colors_key key;
+	u8 colors[TPG_COLOR_MAX][3];
+};
+
+static pthread_mutex_t tpg_colors_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Most recently used first */
+static struct tpg_colors_entry *tpg_colors_list[TPG_COLORS_CACHE_MAX];
+static unsigned tpg_colors_count;
+
+static void tpg_colors_key(const struct tpg_data *tpg,
+			   struct tpg_colors_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	key->fourcc = tpg->fourcc;
+	key->colorspace = tpg->colorspace;
+	key->real_xfer_func = tpg->real_xfer_func;
+	key->real_ycbcr_enc = tpg->real_ycbcr_enc;
+	key->real_hsv_enc = tpg->real_hsv_enc;
+	key->real_quantization = tpg->real_quantization;
+	key->rgb_range = tpg->rgb_range;
+	key->real_rgb_range = tpg->real_rgb_range;
+	key->pattern = tpg->pattern;
+	key->qual = tpg->qual;
+	key->qual_offset = tpg->qual_offset;
+	key->hue = tpg->hue;
+	key->color_enc = tpg->color_enc;
+	key->brightness = tpg->brightness;
+	key->contrast = tpg->contrast;
+	key->saturation = tpg->saturation;
+}
+
+/* Moves entry i to the head of the list, with tpg_colors_lock held */
+static struct tpg_colors_entry *tpg_colors_use(unsigned i)
+{
+	struct tpg_colors_entry *e = tpg_colors_list[i];
+
+	memmove(tpg_colors_list + 1, tpg_colors_list,
+		i * sizeof(tpg_colors_list[0]));
+	tpg_colors_list[0] = e;
+	return e;
+}
+
+static bool tpg_colors_cache_lookup(struct tpg_data *tpg)
+{
+	struct tpg_colors_key key;
+	bool found = false;
+	unsigned i;
+
+	/* Every noise color is random */
+	if (tpg->pattern == TPG_PAT_NOISE)
+		return false;
+
+	tpg_colors_key(tpg, &key);
+	pthread_mutex_lock(&tpg_colors_lock);
+	for (i = 0; i < tpg_colors_count; i++) {
+		if (memcmp(&tpg_colors_list[i]->key, &key, sizeof(key)))
+			continue;
+		memcpy(tpg->colors, tpg_colors_use(i)->colors,
+		       sizeof(tpg->colors));
+		found = true;
+		break;
+	}
+	pthread_mutex_unlock(&tpg_colors_lock);
+	return found;
+}
+
+static void tpg_colors_cache_store(const struct tpg_data *tpg)
+{
+	struct tpg_colors_entry *e;
+	unsigned i;
+
+	if (tpg->pattern == TPG_PAT_NOISE)
+		return;
+
+	pthread_mutex_lock(&tpg_colors_lock);
+	if (tpg_colors_count < TPG_COLORS_CACHE_MAX) {
+		e = malloc(sizeof(*e));
+		if (!e)
+			goto unlock;
+		tpg_colors_list[tpg_colors_count++] = e;
+	}
+	/* Reuses the least recently used entry when full */
+	e = tpg_colors_use(tpg_colors_count - 1);
+	tpg_colors_key(tpg, &e->key);
+	memcpy(e->colors, tpg->colors, sizeof(e->colors));
+
+	/* Another generator may have stored the same settings meanwhile */
+	for (i = 1; i < tpg_colors_count; i++) {
+		if (memcmp(&tpg_colors_list[i]->key, &e->key, sizeof(e->key)))
+			continue;
+		free(tpg_colors_list[i]);
+		memmove(tpg_colors_list + i, tpg_colors_list + i + 1,
+			(tpg_colors_count - i - 1) * sizeof(tpg_colors_list[0]));
+		tpg_colors_count--;
+		break;
+	}
+unlock:
+	pthread_mutex_unlock(&tpg_colors_lock);
+}
+
+const struct tpg_colors_ops tpg_colors_cache_ops = {
+	.lookup = tpg_colors_cache_lookup,
+	.store = tpg_colors_cache_store,
+};
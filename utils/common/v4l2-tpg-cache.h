@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * v4l2-tpg-cache.h - Shares the precalculated test pattern colors
+ */
+
+#ifndef _V4L2_TPG_CACHE_H_
+#define _V4L2_TPG_CACHE_H_
+
+#include "v4l2-tpg.h"
+
+/*
+ * Set tpg->colors_ops to this after tpg_init() to share the colors between
+ * all the generators of the process with the same color settings.
+ */
+extern const struct tpg_colors_ops tpg_colors_cache_ops;
+
+#endif
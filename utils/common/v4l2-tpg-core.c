@@ -202,9 +202,115 @@ void tpg_free(struct tpg_data *tpg)
 	}
 }
 
+/*
+ * Specialised packers for the formats that store each component in its own
+ * byte. They are selected once in tpg_s_fourcc(), so gen_twopix() doesn't
+ * have to go through the big fourcc switch for the common formats. The
+ * generic switch in gen_twopix() remains the reference for all others.
+ */
+#define TPG_PACK_GREY(name)						\
+static void name(u8 buf[TPG_MAX_PLANES][8], unsigned offset, bool odd,	\
+		 u8 r_y_h, u8 g_u_s, u8 b_v, u8 alpha)			\
+{									\
+	buf[0][offset] = r_y_h;						\
+}
+
+/* packed 4:2:2: y is the offset of the first luma byte, c0/c1 the chroma */
+#define TPG_PACK_YUV422(name, y, c0, c1)				\
+static void name(u8 buf[TPG_MAX_PLANES][8], unsigned offset, bool odd,	\
+		 u8 r_y_h, u8 g_u_s, u8 b_v, u8 alpha)			\
+{									\
+	buf[0][offset + (y)] = r_y_h;					\
+	if (odd) {							\
+		buf[0][1 - (y)] = (buf[0][1 - (y)] + (c0)) / 2;		\
+		buf[0][3 - (y)] = (buf[0][3 - (y)] + (c1)) / 2;		\
+		return;							\
+	}								\
+	buf[0][1 - (y)] = (c0);						\
+	buf[0][3 - (y)] = (c1);						\
+}
+
+#define TPG_PACK_24(name, c0, c1, c2)					\
+static void name(u8 buf[TPG_MAX_PLANES][8], unsigned offset, bool odd,	\
+		 u8 r_y_h, u8 g_u_s, u8 b_v, u8 alpha)			\
+{									\
+	buf[0][offset] = (c0);						\
+	buf[0][offset + 1] = (c1);					\
+	buf[0][offset + 2] = (c2);					\
+}
+
+#define TPG_PACK_32(name, c0, c1, c2, c3)				\
+static void name(u8 buf[TPG_MAX_PLANES][8], unsigned offset, bool odd,	\
+		 u8 r_y_h, u8 g_u_s, u8 b_v, u8 alpha)			\
+{									\
+	buf[0][offset] = (c0);						\
+	buf[0][offset + 1] = (c1);					\
+	buf[0][offset + 2] = (c2);					\
+	buf[0][offset + 3] = (c3);					\
+}
+
+TPG_PACK_GREY(tpg_pack_grey)
+TPG_PACK_YUV422(tpg_pack_yuyv, 0, g_u_s, b_v)
+TPG_PACK_YUV422(tpg_pack_uyvy, 1, g_u_s, b_v)
+TPG_PACK_YUV422(tpg_pack_yvyu, 0, b_v, g_u_s)
+TPG_PACK_YUV422(tpg_pack_vyuy, 1, b_v, g_u_s)
+TPG_PACK_24(tpg_pack_rgb24, r_y_h, g_u_s, b_v)
+TPG_PACK_24(tpg_pack_bgr24, b_v, g_u_s, r_y_h)
+TPG_PACK_32(tpg_pack_argb32, alpha, r_y_h, g_u_s, b_v)
+TPG_PACK_32(tpg_pack_xrgb32, 0, r_y_h, g_u_s, b_v)
+TPG_PACK_32(tpg_pack_rgba32, r_y_h, g_u_s, b_v, alpha)
+TPG_PACK_32(tpg_pack_rgbx32, r_y_h, g_u_s, b_v, 0)
+TPG_PACK_32(tpg_pack_abgr32, b_v, g_u_s, r_y_h, alpha)
+TPG_PACK_32(tpg_pack_xbgr32, b_v, g_u_s, r_y_h, 0)
+TPG_PACK_32(tpg_pack_bgra32, alpha, b_v, g_u_s, r_y_h)
+TPG_PACK_32(tpg_pack_bgrx32, 0, b_v, g_u_s, r_y_h)
+
+static const struct {
+	u32 fourcc;
+	tpg_pack_func pack;
+} tpg_packs[] = {
+	{ V4L2_PIX_FMT_GREY, tpg_pack_grey },
+	{ V4L2_PIX_FMT_YUYV, tpg_pack_yuyv },
+	{ V4L2_PIX_FMT_UYVY, tpg_pack_uyvy },
+	{ V4L2_PIX_FMT_YVYU, tpg_pack_yvyu },
+	{ V4L2_PIX_FMT_VYUY, tpg_pack_vyuy },
+	{ V4L2_PIX_FMT_RGB24, tpg_pack_rgb24 },
+	{ V4L2_PIX_FMT_HSV24, tpg_pack_rgb24 },
+	{ V4L2_PIX_FMT_BGR24, tpg_pack_bgr24 },
+	{ V4L2_PIX_FMT_RGB32, tpg_pack_xrgb32 },
+	{ V4L2_PIX_FMT_XRGB32, tpg_pack_xrgb32 },
+	{ V4L2_PIX_FMT_HSV32, tpg_pack_xrgb32 },
+	{ V4L2_PIX_FMT_XYUV32, tpg_pack_xrgb32 },
+	{ V4L2_PIX_FMT_YUV32, tpg_pack_argb32 },
+	{ V4L2_PIX_FMT_ARGB32, tpg_pack_argb32 },
+	{ V4L2_PIX_FMT_AYUV32, tpg_pack_argb32 },
+	{ V4L2_PIX_FMT_RGBX32, tpg_pack_rgbx32 },
+	{ V4L2_PIX_FMT_YUVX32, tpg_pack_rgbx32 },
+	{ V4L2_PIX_FMT_RGBA32, tpg_pack_rgba32 },
+	{ V4L2_PIX_FMT_YUVA32, tpg_pack_rgba32 },
+	{ V4L2_PIX_FMT_BGR32, tpg_pack_xbgr32 },
+	{ V4L2_PIX_FMT_XBGR32, tpg_pack_xbgr32 },
+	{ V4L2_PIX_FMT_VUYX32, tpg_pack_xbgr32 },
+	{ V4L2_PIX_FMT_ABGR32, tpg_pack_abgr32 },
+	{ V4L2_PIX_FMT_VUYA32, tpg_pack_abgr32 },
+	{ V4L2_PIX_FMT_BGRX32, tpg_pack_bgrx32 },
+	{ V4L2_PIX_FMT_BGRA32, tpg_pack_bgra32 },
+};
+
+static tpg_pack_func tpg_find_pack(u32 fourcc)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(tpg_packs) / sizeof(tpg_packs[0]); i++)
+		if (tpg_packs[i].fourcc == fourcc)
+			return tpg_packs[i].pack;
+	return NULL;
+}
+
 bool tpg_s_fourcc(struct tpg_data *tpg, u32 fourcc)
 {
 	tpg->fourcc = fourcc;
+	tpg->pack = tpg_find_pack(fourcc);
 	tpg->planes = 1;
 	tpg->buffers = 1;
 	tpg->recalc_colors = true;
@@ -1116,8 +1222,12 @@ static void tpg_precalculate_colors(struct tpg_data *tpg)
 {
 	int k;
 
+	if (tpg->colors_ops && tpg->colors_ops->lookup(tpg))
+		return;
 	for (k = 0; k < TPG_COLOR_MAX; k++)
 		precalculate_color(tpg, k);
+	if (tpg->colors_ops)
+		tpg->colors_ops->store(tpg);
 }
 
 /* 'odd' is true for pixels 1, 3, 5, etc. and false for pixels 0, 2, 4, etc. */
@@ -1138,6 +1248,11 @@ static void gen_twopix(struct tpg_data *tpg,
 	g_u_s = tpg->colors[color][1]; /* G or precalculated U, V */
 	b_v = tpg->colors[color][2]; /* B or precalculated V */
 
+	if (tpg->pack) {
+		tpg->pack(buf, offset, odd, r_y_h, g_u_s, b_v, alpha);
+		return;
+	}
+
 	switch (tpg->fourcc) {
 	case V4L2_PIX_FMT_GREY:
 		buf[0][offset] = r_y_h;
@@ -1777,6 +1892,25 @@ static void tpg_calculate_square_border(struct tpg_data *tpg)
 	}
 }
 
+/*
+ * Fill len bytes at dst by repeating the size byte pattern at pat. After
+ * the first copy the already filled part is doubled each time, so a whole
+ * line takes a handful of large memcpy calls instead of one small memcpy
+ * per pixel pair.
+ */
+static void tpg_fill_line(u8 *dst, const u8 *pat, unsigned size, unsigned len)
+{
+	unsigned filled = size < len ? size : len;
+
+	memcpy(dst, pat, filled);
+	while (filled < len) {
+		unsigned n = filled < len - filled ? filled : len - filled;
+
+		memcpy(dst + filled, dst, n);
+		filled += n;
+	}
+}
+
 static void tpg_precalculate_line(struct tpg_data *tpg)
 {
 	enum tpg_color contrast;
@@ -1803,6 +1937,7 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 		unsigned fract_part = tpg->src_width % tpg->scaled_width;
 		unsigned src_x = 0;
 		unsigned error = 0;
+		int last1 = -1, last2 = -1;
 
 		for (x = 0; x < tpg->scaled_width * 2; x += 2) {
 			unsigned real_x = src_x;
@@ -1829,8 +1964,20 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 				src_x++;
 			}
 
-			gen_twopix(tpg, pix, tpg->hflip ? color2 : color1, 0);
-			gen_twopix(tpg, pix, tpg->hflip ? color1 : color2, 1);
+			/*
+			 * Most patterns consist of long runs of the same color,
+			 * and the odd pixel only combines with what the even
+			 * pixel wrote, so pix[] can be reused as long as the
+			 * color pair doesn't change.
+			 */
+			if (color1 != last1 || color2 != last2 ||
+			    color1 == TPG_COLOR_RANDOM ||
+			    color2 == TPG_COLOR_RANDOM) {
+				gen_twopix(tpg, pix, tpg->hflip ? color2 : color1, 0);
+				gen_twopix(tpg, pix, tpg->hflip ? color1 : color2, 1);
+				last1 = color1;
+				last2 = color2;
+			}
 			for (p = 0; p < tpg->planes; p++) {
 				unsigned twopixsize = tpg->twopixelsize[p];
 				unsigned hdiv = tpg->hdownsampling[p];
@@ -1863,20 +2010,18 @@ static void tpg_precalculate_line(struct tpg_data *tpg)
 	gen_twopix(tpg, pix, contrast, 1);
 	for (p = 0; p < tpg->planes; p++) {
 		unsigned twopixsize = tpg->twopixelsize[p];
-		u8 *pos = tpg->contrast_line[p];
 
-		for (x = 0; x < tpg->scaled_width; x += 2, pos += twopixsize)
-			memcpy(pos, pix[p], twopixsize);
+		tpg_fill_line(tpg->contrast_line[p], pix[p], twopixsize,
+			      (tpg->scaled_width + 1) / 2 * twopixsize);
 	}
 
 	gen_twopix(tpg, pix, TPG_COLOR_100_BLACK, 0);
 	gen_twopix(tpg, pix, TPG_COLOR_100_BLACK, 1);
 	for (p = 0; p < tpg->planes; p++) {
 		unsigned twopixsize = tpg->twopixelsize[p];
-		u8 *pos = tpg->black_line[p];
 
-		for (x = 0; x < tpg->scaled_width; x += 2, pos += twopixsize)
-			memcpy(pos, pix[p], twopixsize);
+		tpg_fill_line(tpg->black_line[p], pix[p], twopixsize,
+			      (tpg->scaled_width + 1) / 2 * twopixsize);
 	}
 
 	for (x = 0; x < tpg->scaled_width * 2; x += 2) {
@@ -2035,6 +2180,55 @@ void tpg_gen_text(const struct tpg_data *tpg, u8 *basep[TPG_MAX_PLANES][2],
 	}
 }
 
+/*
+ * Draw a timecode with tpg_gen_text(), using a font in which '1' is a
+ * full cell and '0' is an empty cell.
+ */
+void tpg_gen_timecode(const struct tpg_data *tpg, u8 *basep[TPG_MAX_PLANES][2],
+		      int y, int x, __u64 us)
+{
+	static u8 timecode_font[256 * 16];
+	const u8 *font = font8x16;
+	char text[TPG_TIMECODE_CELLS + 1];
+	unsigned i;
+
+	memset(timecode_font + '1' * 16, 0xff, 16);
+	text[0] = '1';
+	text[1] = '0';
+	for (i = 0; i < TPG_TIMECODE_BITS; i++)
+		text[2 + i] = (us >> (TPG_TIMECODE_BITS - 1 - i)) & 1 ? '1' : '0';
+	text[TPG_TIMECODE_CELLS] = 0;
+
+	font8x16 = timecode_font;
+	tpg_gen_text(tpg, basep, y, x, text);
+	font8x16 = font;
+}
+
+/*
+ * Decode a timecode from the brightness of the center of each cell. The
+ * marker cells give the brightness of a 1 and a 0 bit. Returns false if
+ * they are too close to be a timecode.
+ */
+bool tpg_decode_timecode(const u8 cells[TPG_TIMECODE_CELLS], __u64 *us)
+{
+	int one = cells[0];
+	int zero = cells[1];
+	int threshold = (one + zero) / 2;
+	unsigned i;
+
+	if (abs(one - zero) < 64)
+		return false;
+
+	*us = 0;
+	for (i = 0; i < TPG_TIMECODE_BITS; i++) {
+		bool bit = one > zero ? cells[2 + i] > threshold :
+					cells[2 + i] < threshold;
+
+		*us = (*us << 1) | bit;
+	}
+	return true;
+}
+
 const char *tpg_g_color_order(const struct tpg_data *tpg)
 {
 	switch (tpg->pattern) {
@@ -2178,6 +2372,11 @@ static void tpg_recalc(struct tpg_data *tpg)
 	}
 }
 
+void tpg_prepare_fill(struct tpg_data *tpg)
+{
+	tpg_recalc(tpg);
+}
+
 void tpg_calc_text_basep(struct tpg_data *tpg,
 		u8 *basep[TPG_MAX_PLANES][2], unsigned p, u8 *vbuf)
 {
@@ -2465,12 +2664,15 @@ static void tpg_fill_plane_extras(const struct tpg_data *tpg,
 	}
 }
 
-static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
-				   const struct tpg_draw_params *params,
-				   unsigned p, unsigned h, u8 *vbuf)
+/*
+ * Return the line that tpg_fill_plane_pattern() copies for line h, or NULL
+ * if the pattern leaves that line alone.
+ */
+static const u8 *tpg_get_plane_pattern_line(const struct tpg_data *tpg,
+					    const struct tpg_draw_params *params,
+					    unsigned p, unsigned h)
 {
 	unsigned twopixsize = params->twopixsize;
-	unsigned img_width = params->img_width;
 	unsigned mv_hor_old = params->mv_hor_old;
 	unsigned mv_hor_new = params->mv_hor_new;
 	unsigned mv_vert_old = params->mv_vert_old;
@@ -2491,9 +2693,9 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 
 	if (h >= params->hmax) {
 		if (params->hmax == tpg->compose.height)
-			return;
+			return NULL;
 		if (!tpg->perc_fill_blank)
-			return;
+			return NULL;
 		fill_blank = true;
 	}
 
@@ -2584,44 +2786,52 @@ static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
 	case V4L2_FIELD_INTERLACED_TB:
 	case V4L2_FIELD_SEQ_TB:
 	case V4L2_FIELD_SEQ_BT:
-		if (even)
-			memcpy(vbuf, linestart_top, img_width);
-		else
-			memcpy(vbuf, linestart_bottom, img_width);
-		break;
+		return even ? linestart_top : linestart_bottom;
 	case V4L2_FIELD_INTERLACED_BT:
-		if (even)
-			memcpy(vbuf, linestart_bottom, img_width);
-		else
-			memcpy(vbuf, linestart_top, img_width);
-		break;
+		return even ? linestart_bottom : linestart_top;
 	case V4L2_FIELD_TOP:
-		memcpy(vbuf, linestart_top, img_width);
-		break;
+		return linestart_top;
 	case V4L2_FIELD_BOTTOM:
-		memcpy(vbuf, linestart_bottom, img_width);
-		break;
+		return linestart_bottom;
 	case V4L2_FIELD_NONE:
 	default:
-		memcpy(vbuf, linestart_older, img_width);
-		break;
+		return linestart_older;
 	}
 }
 
-void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
-			   unsigned p, u8 *vbuf)
+static void tpg_fill_plane_pattern(const struct tpg_data *tpg,
+				   const struct tpg_draw_params *params,
+				   unsigned p, unsigned h, u8 *vbuf)
+{
+	const u8 *line = tpg_get_plane_pattern_line(tpg, params, p, h);
+
+	if (line)
+		memcpy(vbuf, line, params->img_width);
+}
+
+/*
+ * Fill lines [start, end) of the composed image. Each line only depends on
+ * its own position, so different line ranges of the same buffer can be
+ * rendered in parallel once tpg_prepare_fill() has been called.
+ */
+static void tpg_fill_plane_range(const struct tpg_data *tpg, v4l2_std_id std,
+				 unsigned p, u8 *vbuf, unsigned start,
+				 unsigned end, struct tpg_fill_state *st)
 {
 	struct tpg_draw_params params;
 	unsigned factor = V4L2_FIELD_HAS_T_OR_B(tpg->field) ? 2 : 1;
 
-	/* Coarse scaling with Bresenham */
-	unsigned int_part = (tpg->crop.height / factor) / tpg->compose.height;
-	unsigned fract_part = (tpg->crop.height / factor) % tpg->compose.height;
-	unsigned src_y = 0;
-	unsigned error = 0;
+	/* Coarse scaling with Bresenham, starting at line 'start' */
+	unsigned src_height = tpg->crop.height / factor;
+	unsigned int_part = src_height / tpg->compose.height;
+	unsigned fract_part = src_height % tpg->compose.height;
+	unsigned src_y = start * int_part +
+			 start * fract_part / tpg->compose.height;
+	unsigned error = start * fract_part % tpg->compose.height;
 	unsigned h;
 
-	tpg_recalc(tpg);
+	if (end > tpg->compose.height)
+		end = tpg->compose.height;
 
 	params.is_tv = std;
 	params.is_60hz = std & V4L2_STD_525_60;
@@ -2635,7 +2845,7 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 
 	vbuf += tpg_hdiv(tpg, p, tpg->compose.left);
 
-	for (h = 0; h < tpg->compose.height; h++) {
+	for (h = start; h < end; h++) {
 		unsigned buf_line;
 
 		params.frame_line = tpg_calc_frameline(tpg, src_y, tpg->field);
@@ -2684,13 +2894,132 @@ void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 
 			buf_line /= tpg->vdownsampling[p];
 		}
-		tpg_fill_plane_pattern(tpg, &params, p, h,
-				vbuf + buf_line * params.stride);
+		if (st) {
+			const u8 *line = tpg_get_plane_pattern_line(tpg, &params, p, h);
+			bool wss = params.is_tv && !params.is_60hz &&
+				   params.frame_line == 0 && params.wss_width;
+
+			/*
+			 * The extras only depend on the frame line, so the line
+			 * is unchanged if it was made from the same source line.
+			 * The WSS signal is random, so always redo that line.
+			 */
+			if (!wss && st->line_src[h] == line &&
+			    st->frame_line[h] == params.frame_line)
+				continue;
+			st->line_src[h] = line;
+			st->frame_line[h] = params.frame_line;
+			if (line)
+				memcpy(vbuf + buf_line * params.stride, line,
+				       params.img_width);
+		} else {
+			tpg_fill_plane_pattern(tpg, &params, p, h,
+					vbuf + buf_line * params.stride);
+		}
 		tpg_fill_plane_extras(tpg, &params, p, h,
 				vbuf + buf_line * params.stride);
 	}
 }
 
+void tpg_fill_plane_lines(const struct tpg_data *tpg, v4l2_std_id std,
+			  unsigned p, u8 *vbuf, unsigned start, unsigned end)
+{
+	tpg_fill_plane_range(tpg, std, p, vbuf, start, end, NULL);
+}
+
+void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
+			   unsigned p, u8 *vbuf)
+{
+	tpg_recalc(tpg);
+	tpg_fill_plane_lines(tpg, std, p, vbuf, 0, tpg->compose.height);
+}
+
+void tpg_fill_state_free(struct tpg_fill_state *st)
+{
+	vfree(st->line_src);
+	vfree(st->frame_line);
+	st->line_src = NULL;
+	st->frame_line = NULL;
+	st->height = 0;
+	st->valid = false;
+}
+
+void tpg_fill_state_invalidate(struct tpg_fill_state *st,
+			       unsigned start, unsigned end)
+{
+	if (end > st->height)
+		end = st->height;
+	/* no real frame line can match this */
+	for (; start < end; start++)
+		st->frame_line[start] = ~0U;
+}
+
+static void tpg_fill_plane_incremental(struct tpg_data *tpg, v4l2_std_id std,
+				       unsigned p, u8 *vbuf,
+				       struct tpg_fill_state *st)
+{
+	int mv_hor_count = tpg->mv_hor_count;
+	int mv_vert_count = tpg->mv_vert_count;
+	bool same;
+
+	tpg_recalc(tpg);
+
+	if (st->height < tpg->compose.height) {
+		tpg_fill_state_free(st);
+		st->line_src = vzalloc(tpg->compose.height * sizeof(*st->line_src));
+		st->frame_line = vzalloc(tpg->compose.height * sizeof(*st->frame_line));
+		if (!st->line_src || !st->frame_line) {
+			tpg_fill_state_free(st);
+			tpg_fill_plane_buffer(tpg, std, p, vbuf);
+			return;
+		}
+		st->height = tpg->compose.height;
+	}
+
+	/*
+	 * The moving pattern offsets are covered by the per-line source
+	 * pointers, any other change means the whole plane is redone.
+	 */
+	tpg->mv_hor_count = 0;
+	tpg->mv_vert_count = 0;
+	same = st->valid && st->std == std &&
+	       !memcmp(&st->tpg, tpg, sizeof(*tpg));
+	if (!same) {
+		memcpy(&st->tpg, tpg, sizeof(*tpg));
+		st->std = std;
+		st->valid = true;
+		tpg_fill_state_invalidate(st, 0, st->height);
+	}
+	tpg->mv_hor_count = mv_hor_count;
+	tpg->mv_vert_count = mv_vert_count;
+
+	tpg_fill_plane_range(tpg, std, p, vbuf, 0, tpg->compose.height, st);
+}
+
+/*
+ * Same as tpg_fillbuffer(), but vbuf still contains the frame that was
+ * rendered with the same fill states before, and only the lines that
+ * changed since then are rewritten. Use one array of TPG_MAX_PLANES states
+ * per buffer. Lines that the caller modified afterwards, e.g. with
+ * tpg_gen_text(), must be marked with tpg_fill_state_invalidate().
+ */
+void tpg_fillbuffer_incremental(struct tpg_data *tpg, v4l2_std_id std,
+				unsigned p, u8 *vbuf, struct tpg_fill_state *st)
+{
+	unsigned offset = 0;
+	unsigned i;
+
+	if (tpg->buffers > 1) {
+		tpg_fill_plane_incremental(tpg, std, p, vbuf, &st[p]);
+		return;
+	}
+
+	for (i = 0; i < tpg_g_planes(tpg); i++) {
+		tpg_fill_plane_incremental(tpg, std, i, vbuf + offset, &st[i]);
+		offset += tpg_calc_plane_size(tpg, i);
+	}
+}
+
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std, unsigned p, u8 *vbuf)
 {
 	unsigned offset = 0;
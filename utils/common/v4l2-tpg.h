@@ -180,8 +180,28 @@ enum tgp_color_enc {
 extern const char * const tpg_aspect_strings[];
 
 #define TPG_MAX_PLANES 3
+
+/*
+ * Packs the even or odd pixel of a pixel pair. Only set for formats with
+ * one byte per component, see tpg_find_pack().
+ */
+typedef void (*tpg_pack_func)(u8 buf[TPG_MAX_PLANES][8], unsigned offset,
+			      bool odd, u8 r_y_h, u8 g_u_s, u8 b_v, u8 alpha);
 #define TPG_MAX_PAT_LINES 8
 
+struct tpg_data;
+
+/*
+ * Lets the user of the generator share the precalculated colors between
+ * generators, see tpg_precalculate_colors().
+ */
+struct tpg_colors_ops {
+	/* Fills in tpg->colors for the current settings, false if unknown */
+	bool (*lookup)(struct tpg_data *tpg);
+	/* Remembers the newly calculated tpg->colors */
+	void (*store)(const struct tpg_data *tpg);
+};
+
 struct tpg_data {
 	/* Source frame size */
 	unsigned			src_width, src_height;
@@ -209,6 +229,7 @@ struct tpg_data {
 	u8				saturation;
 	s16				hue;
 	u32				fourcc;
+	tpg_pack_func			pack;
 	enum tgp_color_enc		color_enc;
 	u32				colorspace;
 	u32				xfer_func;
@@ -247,6 +268,8 @@ struct tpg_data {
 	unsigned			hmask[TPG_MAX_PLANES];
 	/* Used to store the colors in native format, either RGB or YUV */
 	u8				colors[TPG_COLOR_MAX][3];
+	/* Optional, set after tpg_init() */
+	const struct tpg_colors_ops	*colors_ops;
 	u8				textfg[TPG_MAX_PLANES][8], textbg[TPG_MAX_PLANES][8];
 	/* size in bytes for two pixels in each plane */
 	unsigned			twopixelsize[TPG_MAX_PLANES];
@@ -285,6 +308,28 @@ struct tpg_data {
 	u8				*black_line[TPG_MAX_PLANES];
 };
 
+/*
+ * A timecode is a row of 8x16 pixel cells in the text colors: a text
+ * foreground and a background marker cell, then TPG_TIMECODE_BITS bits of a
+ * time in microseconds, most significant bit first. It survives scaling and
+ * color conversion, so it can be read back from the displayed image.
+ */
+#define TPG_TIMECODE_BITS		48
+#define TPG_TIMECODE_CELLS		(TPG_TIMECODE_BITS + 2)
+#define TPG_TIMECODE_WIDTH		(TPG_TIMECODE_CELLS * 8)
+
+/* What was rendered into one plane, see tpg_fillbuffer_incremental() */
+struct tpg_fill_state {
+	bool				valid;
+	/* settings the plane was rendered with, without the movement */
+	struct tpg_data			tpg;
+	v4l2_std_id			std;
+	unsigned			height;
+	/* source line and frame line of each composed line */
+	const u8			**line_src;
+	unsigned			*frame_line;
+};
+
 void tpg_init(struct tpg_data *tpg, unsigned w, unsigned h);
 int tpg_alloc(struct tpg_data *tpg, unsigned max_w);
 void tpg_free(struct tpg_data *tpg);
@@ -297,11 +342,22 @@ void tpg_gen_text(const struct tpg_data *tpg,
 		u8 *basep[TPG_MAX_PLANES][2], int y, int x, const char *text);
 void tpg_calc_text_basep(struct tpg_data *tpg,
 		u8 *basep[TPG_MAX_PLANES][2], unsigned p, u8 *vbuf);
+void tpg_gen_timecode(const struct tpg_data *tpg,
+		u8 *basep[TPG_MAX_PLANES][2], int y, int x, __u64 us);
+bool tpg_decode_timecode(const u8 cells[TPG_TIMECODE_CELLS], __u64 *us);
 unsigned tpg_g_interleaved_plane(const struct tpg_data *tpg, unsigned buf_line);
+void tpg_prepare_fill(struct tpg_data *tpg);
+void tpg_fill_plane_lines(const struct tpg_data *tpg, v4l2_std_id std,
+			  unsigned p, u8 *vbuf, unsigned start, unsigned end);
 void tpg_fill_plane_buffer(struct tpg_data *tpg, v4l2_std_id std,
 			   unsigned p, u8 *vbuf);
 void tpg_fillbuffer(struct tpg_data *tpg, v4l2_std_id std,
 		    unsigned p, u8 *vbuf);
+void tpg_fill_state_free(struct tpg_fill_state *st);
+void tpg_fill_state_invalidate(struct tpg_fill_state *st,
+			       unsigned start, unsigned end);
+void tpg_fillbuffer_incremental(struct tpg_data *tpg, v4l2_std_id std,
+				unsigned p, u8 *vbuf, struct tpg_fill_state *st);
 bool tpg_s_fourcc(struct tpg_data *tpg, u32 fourcc);
 void tpg_s_crop_compose(struct tpg_data *tpg, const struct v4l2_rect *crop,
 		const struct v4l2_rect *compose);
@@ -51,12 +51,14 @@ struct arguments {
 	char *input_file, *output_file;
 	enum dvb_file_formats input_format, output_format;
 	int delsys;
+	unsigned jobs;
 };
 
 static const struct argp_option options[] = {
 	{"input-format",	'I',	N_("format"),	0, N_("Valid input formats: ZAP, CHANNEL, DVBV5"), 0},
 	{"output-format",	'O',	N_("format"),	0, N_("Valid output formats: VDR, ZAP, CHANNEL, DVBV5"), 0},
 	{"delsys",		's',	N_("system"),	0, N_("Delivery system type. Needed if input or output format is ZAP"), 0},
+	{"jobs",		'j',	N_("threads"),	0, N_("Number of threads used to parse large input files"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -79,6 +81,9 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 's':
 		args->delsys = dvb_parse_delsys(optarg);
 		break;
+	case 'j':
+		args->jobs = strtoul(optarg, NULL, 0);
+		break;
 	case '?':
 		argp_state_help(state, state->out_stream,
 				ARGP_HELP_SHORT_USAGE | ARGP_HELP_LONG
@@ -97,26 +102,50 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	return 0;
 }
 
+/*
+ * The entries are converted one at a time, so the whole file doesn't need
+ * to be kept in memory
+ */
 static int convert_file(struct arguments *args)
 {
-	struct dvb_file *dvb_file = NULL;
+	struct dvb_file_reader *reader;
+	struct dvb_file_writer *writer;
+	struct dvb_entry *entry;
 	int ret;
 
 	printf(_("Reading file %s\n"), args->input_file);
 
-	dvb_file = dvb_read_file_format(args->input_file, args->delsys,
-				    args->input_format);
-	if (!dvb_file) {
+	reader = dvb_file_reader_open(args->input_file, args->delsys,
+				      args->input_format, args->jobs);
+	if (!reader) {
 		fprintf(stderr, _("Error reading file %s\n"), args->input_file);
 		return -1;
 	}
 
 	printf(_("Writing file %s\n"), args->output_file);
-	ret = dvb_write_file_format(args->output_file, dvb_file,
-				    args->delsys, args->output_format);
-	dvb_file_free(dvb_file);
+	writer = dvb_file_writer_open(args->output_file, args->delsys,
+				      args->output_format);
+	if (!writer) {
+		dvb_file_reader_close(reader);
+		return -1;
+	}
 
-	return ret;
+	while ((ret = dvb_file_reader_next(reader, &entry)) > 0) {
+		ret = dvb_file_writer_write(writer, entry);
+		if (ret < 0)
+			break;
+	}
+	dvb_file_reader_close(reader);
+	if (dvb_file_writer_close(writer) < 0)
+		ret = -1;
+
+	if (ret < 0) {
+		fprintf(stderr, _("Error converting file %s\n"), args->input_file);
+		unlink(args->output_file);
+		return -1;
+	}
+
+	return 0;
 }
 
 int main(int argc, char **argv)
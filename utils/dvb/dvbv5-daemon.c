@@ -31,7 +31,6 @@
 #include <argp.h>
 #include <endian.h>
 #include <netinet/in.h>
-#include <poll.h>
 #include <pthread.h>
 #include <search.h>
 #include <signal.h>
@@ -40,9 +39,16 @@
 #include <stdio.h>
 #include <signal.h>
 #include <syslog.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <linux/sockios.h>
+
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -51,6 +57,7 @@
 #include "../../lib/libdvbv5/dvb-dev-priv.h"
 #include "libdvbv5/dvb-file.h"
 #include "libdvbv5/dvb-dev.h"
+#include "usdt.h"
 
 #ifdef ENABLE_NLS
 # define _(string) gettext(string)
@@ -84,6 +91,7 @@ static const char doc[] = N_(
 static const struct argp_option options[] = {
 	{"verbose",	'v',	0,		0,	N_("enables debug messages"), 0},
 	{"port",	'p',	"5555",		0,	N_("port to listen"), 0},
+	{"metrics-port", -4,	"9555",		0,	N_("port to serve the stats over HTTP, in the OpenMetrics format"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -91,6 +99,7 @@ static const struct argp_option options[] = {
 };
 
 static int port = 0;
+static int metrics_port = 0;
 static int verbose = 0;
 
 static error_t parse_opt(int k, char *arg, struct argp_state *state)
@@ -99,6 +108,9 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 'p':
 		port = atoi(arg);
 		break;
+	case -4:
+		metrics_port = atoi(arg);
+		break;
 	case 'v':
 		verbose	++;
 		break;
@@ -201,14 +213,21 @@ static pthread_t read_id = 0;
 struct dvb_descriptors {
 	int uid;
 	struct dvb_open_descriptor *open_dev;
+
+	/* Counters of the data sent to the client, for the metrics */
+	uint64_t bytes, reads, overflows;
 };
 
 static struct dvb_device *dvb = NULL;
 static void *desc_root = NULL;
 static int dvb_fd = -1;
 
-static struct pollfd fds[NUM_FOPEN];
-static nfds_t numfds = 0;
+/* Send read data as binary frames, if negotiated by the client */
+static int binary_data = 0;
+
+/* Demux and DVR devices whose data is sent to the client */
+static int epoll_fd = -1;
+static unsigned int numfds = 0;
 
 static char output_charset[256] = "utf-8";
 static char default_charset[256] = "iso-8859-1";
@@ -245,7 +264,7 @@ static int dvb_desc_compare(const void *__a, const void *__b)
 	return (b->uid - a->uid);
 }
 
-static struct dvb_open_descriptor *get_open_dev(int uid)
+static struct dvb_descriptors *get_desc(int uid)
 {
 	struct dvb_descriptors desc, **p;
 
@@ -260,7 +279,14 @@ static struct dvb_open_descriptor *get_open_dev(int uid)
 		return NULL;
 	}
 
-	return (*p)->open_dev;
+	return *p;
+}
+
+static struct dvb_open_descriptor *get_open_dev(int uid)
+{
+	struct dvb_descriptors *desc = get_desc(uid);
+
+	return desc ? desc->open_dev : NULL;
 }
 
 static void destroy_open_dev(int uid)
@@ -284,8 +310,12 @@ static void free_opendevs(void *node)
 	free (desc);
 }
 
+static void metrics_set_frontend(const char *sysname);
+
 static void close_all_devs(void)
 {
+	metrics_set_frontend(NULL);
+
 	dvb_fd = -1;
 	numfds = 0;
 	tdestroy(desc_root, free_opendevs);
@@ -429,20 +459,41 @@ static ssize_t prepare_data(char *buf, const size_t size,
 	return ret;
 }
 
-static int send_buf(int fd, const char *buf, size_t size)
+/*
+ * Send the whole iovec to the client with as few system calls as possible.
+ * Messages from different threads never get mixed, as they are sent with
+ * msg_mutex held.
+ */
+static int send_iov(int fd, struct iovec *iov, int iovcnt)
 {
-	int ret;
-	int32_t i32;
+	ssize_t ret = 0, total = 0;
 
 	if (fd < 0)
 		return ECONNRESET;
 
 	pthread_mutex_lock(&msg_mutex);
-	i32 = htobe32(size);
-	ret = send(fd, (void *)&i32, 4, MSG_MORE);
-	if (ret >= 0)
-		ret = send(fd, buf, size, 0);
+	while (iovcnt) {
+		ret = writev(fd, iov, iovcnt);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		total += ret;
+
+		/* Skip what was sent on a partial write */
+		while (iovcnt && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
 	pthread_mutex_unlock(&msg_mutex);
+	USDT(dvbv5_daemon, send, fd, total);
 	if (ret < 0) {
 		local_perror("write");
 		if (ret == ECONNRESET)
@@ -451,7 +502,42 @@ static int send_buf(int fd, const char *buf, size_t size)
 		return errno;
 	}
 
-	return ret;
+	return total;
+}
+
+/* Send a message, optionally followed by data that is not copied into it */
+static int send_msg(int fd, const char *buf, size_t size,
+		    const char *data, size_t data_size)
+{
+	int32_t i32 = htobe32(size + data_size);
+	struct iovec iov[3] = {
+		{ .iov_base = &i32, .iov_len = 4 },
+		{ .iov_base = (void *)buf, .iov_len = size },
+		{ .iov_base = (void *)data, .iov_len = data_size },
+	};
+
+	return send_iov(fd, iov, data_size ? 3 : 2);
+}
+
+static int send_buf(int fd, const char *buf, size_t size)
+{
+	return send_msg(fd, buf, size, NULL, 0);
+}
+
+static int send_data_frame(int fd, int uid, int retval, const char *data)
+{
+	uint32_t header[3];
+	size_t size = retval > 0 ? retval : 0;
+	struct iovec iov[2] = {
+		{ .iov_base = header, .iov_len = sizeof(header) },
+		{ .iov_base = (void *)data, .iov_len = size },
+	};
+
+	header[0] = htobe32(REMOTE_DATA_FRAME | (size + 8));
+	header[1] = htobe32(uid);
+	header[2] = htobe32(retval);
+
+	return send_iov(fd, iov, size ? 2 : 1);
 }
 
 static ssize_t send_data(int fd, const char *fmt, ...)
@@ -592,8 +678,18 @@ static int dev_change_monitor(char *sysname,
 static int daemon_get_version(uint32_t seq, char *cmd, int fd,
 			      char *buf, ssize_t size)
 {
+	char features[REMOTE_BUF_SIZE + 8] = "";
 	int ret = 0;
 
+	/* Older clients don't ask for any features */
+	if (size > 0 && scan_data(buf, size, "%s", features) < 0)
+		features[0] = '\0';
+
+	binary_data = !strcmp(features, REMOTE_FEATURE_BINARY_DATA);
+	if (binary_data)
+		return send_data(fd, "%i%s%i%s%s", seq, cmd, ret,
+				 argp_program_version, REMOTE_FEATURE_BINARY_DATA);
+
 	return send_data(fd, "%i%s%i%s", seq, cmd, ret, argp_program_version);
 }
 
@@ -668,17 +764,70 @@ error:
 	return send_data(fd, "%i%s%i", seq, cmd, ret);
 }
 
-static void *read_data(void *privdata)
+/* Read once from a ready device and send the data to the client */
+static int send_read_data(int fd)
 {
 	struct dvb_open_descriptor *open_dev;
-	int timeout;
-	int ret, read_ret = -1, fd, i;
-	char databuf[REMOTE_BUF_SIZE];
-	char buf[REMOTE_BUF_SIZE + 32], *p;
-	size_t size;
+	struct dvb_descriptors *desc;
+	static char databuf[REMOTE_DATA_FRAME_SIZE];
+	char buf[REMOTE_BUF_SIZE];
+	int ret, read_ret;
 	size_t count;
-	struct pollfd __fds[NUM_FOPEN];
-	nfds_t __numfds;
+
+	desc = get_desc(fd);
+	if (!desc) {
+		err("Couldn't find opened file %d", fd);
+		return 0;
+	}
+	open_dev = desc->open_dev;
+
+	count = binary_data ? REMOTE_DATA_FRAME_SIZE : REMOTE_BUF_SIZE;
+	read_ret = dvb_dev_read(open_dev, databuf, count);
+	if (read_ret > 0) {
+		desc->bytes += read_ret;
+		desc->reads++;
+	} else if (read_ret == -EOVERFLOW) {
+		desc->overflows++;
+	}
+	if (verbose) {
+		if (read_ret < 0)
+			dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
+		else
+			dbg("#%d: read %ul bytes (count %d)", fd, read_ret, count);
+	}
+
+	if (binary_data) {
+		ret = send_data_frame(dvb_fd, fd, read_ret, databuf);
+	} else {
+		ret = prepare_data(buf, sizeof(buf), "%i%s%i%i", 0, "data_read",
+				   read_ret, fd);
+		if (ret < 0) {
+			err("Failed to prepare answer to dvb_read()");
+			return ret;
+		}
+		ret = send_msg(dvb_fd, buf, ret, databuf,
+			       read_ret > 0 ? read_ret : 0);
+	}
+	if (ret < 0) {
+		err("Error %d sending buffer\n", ret);
+		if (ret == ECONNRESET) {
+			close_all_devs();
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Every device that is ready gets one read per iteration, so that a busy
+ * stream can't starve the others. Devices with more data pending are still
+ * ready on the next iteration.
+ */
+static void *read_data(void *privdata)
+{
+	struct epoll_event events[NUM_FOPEN];
+	int timeout;
+	int ret, i;
 
 	timeout = 10; /* ms */
 	while (1) {
@@ -687,87 +836,35 @@ static void *read_data(void *privdata)
 			pthread_mutex_unlock(&dvb_read_mutex);
 			break;
 		}
-		__numfds = numfds;
-		memcpy(__fds, fds, sizeof(fds));
 		pthread_mutex_unlock(&dvb_read_mutex);
 
-		ret = poll(__fds, __numfds, timeout);
+		ret = epoll_wait(epoll_fd, events, NUM_FOPEN, timeout);
 		if (!ret)
 			continue;
 		if (ret < 0) {
-			err("poll");
+			if (errno != EINTR)
+				err("epoll_wait");
 			continue;
 		}
 
-		for (i = 0; i < __numfds; i++) {
-			if (__fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
-				continue;
-			if (__fds[i].revents)
-				break;
-		}
-
-		/*
-		 * it means that one error condition happened.
-		 * Likely the file was closed.
-		 */
-		if (i == __numfds)
-			continue;
-
-		fd = __fds[i].fd;
-
 		if (!desc_root)
 			break;
 
-		open_dev = get_open_dev(fd);
-		if (!open_dev) {
-			err("Couldn't find opened file %d", fd);
-			continue;
-		}
-
-		count = REMOTE_BUF_SIZE;
-		read_ret = dvb_dev_read(open_dev, databuf, count);
-		if (verbose) {
-			if (read_ret < 0)
-				dbg("#%d: read error: %d on %p", fd, read_ret, open_dev);
-			else
-				dbg("#%d: read %ul bytes (count %d)", fd, read_ret, count);
-		}
-
-		/* Initialize to the start of the buffer */
-		p = buf;
-		size = sizeof(buf);
-
-		ret = prepare_data(p, size, "%i%s%i%i", 0, "data_read",
-				   read_ret, fd);
-		if (ret < 0) {
-			err("Failed to prepare answer to dvb_read()");
-			break;
-		}
-
-		p += ret;
-		size -= ret;
-
-		if (read_ret > 0) {
-			if (read_ret > size) {
-				dbg("buffer to short to store read data!");
-				read_ret = -EOVERFLOW;
-			} else {
-				memcpy(p, databuf, read_ret);
-				p += read_ret;
-			}
-		}
+		for (i = 0; i < ret; i++) {
+			/*
+			 * it means that one error condition happened.
+			 * Likely the file was closed.
+			 */
+			if (!(events[i].events & (EPOLLIN | EPOLLPRI)) ||
+			    events[i].events & EPOLLERR)
+				continue;
 
-		ret = send_buf(dvb_fd, buf, p - buf);
-		if (ret < 0) {
-			err("Error %d sending buffer\n", ret);
-			if (ret == ECONNRESET) {
-				close_all_devs();
-				break;
-			}
-			continue;
+			if (send_read_data(events[i].data.fd) < 0)
+				goto done;
 		}
 	}
 
+done:
 	dbg("Finishing kthread");
 	read_id = 0;
 	return NULL;
@@ -812,12 +909,21 @@ static int dev_open(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		dbg("open dev handler for %s: %p with uid#%d", sysname, open_dev, open_dev->fd);
 
 	dev = open_dev->dev;
+	if (dev->dvb_type == DVB_DEVICE_FRONTEND)
+		metrics_set_frontend(dev->sysname);
+
 	if (dev->dvb_type == DVB_DEVICE_DEMUX ||
 	    dev->dvb_type == DVB_DEVICE_DVR) {
+		struct epoll_event event = {
+			.events = EPOLLIN | EPOLLPRI,
+			.data.fd = open_dev->fd,
+		};
+
 		pthread_mutex_lock(&dvb_read_mutex);
-		fds[numfds].fd = open_dev->fd;
-		fds[numfds].events = POLLIN | POLLPRI;
-		numfds++;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, open_dev->fd, &event) < 0)
+			local_perror("epoll_ctl");
+		else
+			numfds++;
 		pthread_mutex_unlock(&dvb_read_mutex);
 	}
 
@@ -856,7 +962,7 @@ error:
 static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 {
 	struct dvb_open_descriptor *open_dev;
-	int uid, ret, i;
+	int uid, ret;
 
 	ret = scan_data(buf, size, "%i",  &uid);
 	if (ret < 0)
@@ -869,23 +975,19 @@ static int dev_close(uint32_t seq, char *cmd, int fd, char *buf, ssize_t size)
 		goto error;
 	}
 
-	/* Delete fd from the opened array */
+	/* Stop waiting for data from the fd */
 	pthread_mutex_lock(&dvb_read_mutex);
-	for (i = 0; i < numfds; i++) {
-		if (fds[i].fd != open_dev->fd)
-		    continue;
-		if (i < numfds - 1)
-			memmove(&fds[i], &fds[i + 1],
-				sizeof(*fds)*(numfds - i - 1));
+	if (!epoll_ctl(epoll_fd, EPOLL_CTL_DEL, open_dev->fd, NULL))
 		numfds--;
-		break;
-	}
 	pthread_mutex_unlock(&dvb_read_mutex);
 	if (read_id && !numfds) {
 		pthread_cancel(read_id);
 		read_id = 0;
 	}
 
+	if (open_dev->dev->dvb_type == DVB_DEVICE_FRONTEND)
+		metrics_set_frontend(NULL);
+
 	dvb_dev_close(open_dev);
 	destroy_open_dev(uid);
 
@@ -989,6 +1091,47 @@ error:
 	return send_data(fd, "%i%s%i", seq, cmd, ret);
 }
 
+static int dev_dmx_set_pids(uint32_t seq, char *cmd, int fd,
+			    char *buf, ssize_t size)
+{
+	struct dvb_open_descriptor *open_dev;
+	char pid_list[REMOTE_BUF_SIZE + 8], hex[5] = "";
+	uint16_t *pids = NULL;
+	int uid, ret, output, bufsize;
+	unsigned i, num_pids;
+
+	ret = scan_data(buf, size, "%i%i%i%s",
+			&uid, &output, &bufsize, pid_list);
+	if (ret < 0)
+		goto error;
+
+	open_dev = get_open_dev(uid);
+	if (!open_dev) {
+		ret = -1;
+		err("Can't find uid to set PIDs");
+		goto error;
+	}
+
+	num_pids = strlen(pid_list) / 4;
+	if (num_pids) {
+		pids = malloc(num_pids * sizeof(*pids));
+		if (!pids) {
+			ret = -ENOMEM;
+			goto error;
+		}
+	}
+	for (i = 0; i < num_pids; i++) {
+		memcpy(hex, &pid_list[i * 4], 4);
+		pids[i] = strtoul(hex, NULL, 16);
+	}
+
+	ret = dvb_dev_dmx_set_pids(open_dev, pids, num_pids, output, bufsize);
+	free(pids);
+
+error:
+	return send_data(fd, "%i%s%i", seq, cmd, ret);
+}
+
 static int dev_dmx_get_pmt_pid(uint32_t seq, char *cmd, int fd,
 			       char *buf, ssize_t size)
 {
@@ -1222,6 +1365,113 @@ error:
 	return send_data(fd, "%i%s%i", seq, cmd, ret);
 }
 
+/*
+ * Metrics
+ *
+ * With --metrics-port, the stats of the frontend, of the streams and of the
+ * clients are served over HTTP, in the OpenMetrics text format. The
+ * frontend stats are cached: they're updated when a client gets them and,
+ * if no client did it recently, by a sampler thread. Serving them never
+ * touches the frontend.
+ */
+
+#define METRICS_INTERVAL	1	/* seconds */
+
+struct fe_metrics {
+	char sysname[64];	/* empty if no frontend is open */
+	int valid;
+	struct timespec updated;
+	uint32_t status;
+	struct dtv_stats signal, cnr, ucb;
+	enum fecap_scale_params ber_scale;
+	float ber;
+};
+
+/* The frontend parameters at dvb->fe_parms are shared by all clients */
+static pthread_mutex_t fe_mutex;
+
+/* Protects fe_metrics */
+static pthread_mutex_t metrics_mutex;
+static struct fe_metrics fe_metrics;
+
+static void metrics_set_frontend(const char *sysname)
+{
+	if (!metrics_port)
+		return;
+
+	/* The sampler checks the frontend with fe_mutex held */
+	if (!sysname)
+		pthread_mutex_lock(&fe_mutex);
+	pthread_mutex_lock(&metrics_mutex);
+	if (sysname)
+		snprintf(fe_metrics.sysname, sizeof(fe_metrics.sysname),
+			 "%s", sysname);
+	else
+		fe_metrics.sysname[0] = '\0';
+	fe_metrics.valid = 0;
+	pthread_mutex_unlock(&metrics_mutex);
+	if (!sysname)
+		pthread_mutex_unlock(&fe_mutex);
+}
+
+static void metrics_copy_stat(struct dtv_stats *stat, unsigned cmd)
+{
+	struct dtv_stats *s;
+
+	s = dvb_fe_retrieve_stats_layer(dvb->fe_parms, cmd, 0);
+	if (s)
+		*stat = *s;
+	else
+		stat->scale = FE_SCALE_NOT_AVAILABLE;
+}
+
+/* Should be called with fe_mutex held, after getting the stats */
+static void metrics_update_fe(void)
+{
+	struct dvb_v5_fe_parms_priv *parms = (void *)dvb->fe_parms;
+
+	if (!metrics_port)
+		return;
+
+	pthread_mutex_lock(&metrics_mutex);
+	clock_gettime(CLOCK_MONOTONIC, &fe_metrics.updated);
+	fe_metrics.valid = 1;
+	fe_metrics.status = parms->stats.prev_status;
+	metrics_copy_stat(&fe_metrics.signal, DTV_STAT_SIGNAL_STRENGTH);
+	metrics_copy_stat(&fe_metrics.cnr, DTV_STAT_CNR);
+	metrics_copy_stat(&fe_metrics.ucb, DTV_STAT_ERROR_BLOCK_COUNT);
+	fe_metrics.ber = dvb_fe_retrieve_ber(dvb->fe_parms, 0,
+					     &fe_metrics.ber_scale);
+	pthread_mutex_unlock(&metrics_mutex);
+}
+
+static void *metrics_sampler(void *privdata)
+{
+	struct timespec now;
+	int sample;
+
+	while (1) {
+		sleep(METRICS_INTERVAL);
+
+		/* Don't wait for a client that is tuning */
+		if (pthread_mutex_trylock(&fe_mutex))
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		pthread_mutex_lock(&metrics_mutex);
+		sample = fe_metrics.sysname[0] &&
+			 (!fe_metrics.valid ||
+			  now.tv_sec - fe_metrics.updated.tv_sec >= METRICS_INTERVAL);
+		pthread_mutex_unlock(&metrics_mutex);
+
+		if (sample && __dvb_fe_get_stats(dvb->fe_parms) >= 0)
+			metrics_update_fe();
+		pthread_mutex_unlock(&fe_mutex);
+	}
+
+	return NULL;
+}
+
 static int dev_get_stats(uint32_t seq, char *cmd, int fd,
 			 char *inbuf, ssize_t insize)
 {
@@ -1239,6 +1489,8 @@ static int dev_get_stats(uint32_t seq, char *cmd, int fd,
 	if (ret < 0)
 		goto error;
 
+	metrics_update_fe();
+
 	ret = prepare_data(p, size, "%i%s%i%i", seq, cmd, ret, st->prev_status);
 	if (ret < 0)
 		goto error;
@@ -1309,43 +1561,564 @@ struct method_types {
 	char *name;
 	method_handler handler;
 	int locks_dvb;
+	int blocking;		/* may block on the frontend: run on a worker */
 };
 
 static const struct method_types methods[] = {
-	{"daemon_get_version", &daemon_get_version, 1},
-	{"dev_find", &dev_find, 0},
-	{"dev_stop_monitor", &dev_stop_monitor, 0},
-	{"dev_seek_by_adapter", &dev_seek_by_adapter, 0},
-	{"dev_get_dev_info", &dev_get_dev_info, 0},
-	{"dev_open", &dev_open, 0},
-	{"dev_close", &dev_close, 0},
-	{"dev_dmx_stop", &dev_dmx_stop, 0},
-	{"dev_set_bufsize", &dev_set_bufsize, 0},
-	{"dev_dmx_set_pesfilter", &dev_dmx_set_pesfilter, 0},
-	{"dev_dmx_set_section_filter", &dev_dmx_set_section_filter, 0},
-	{"dev_dmx_get_pmt_pid", &dev_dmx_get_pmt_pid, 0},
-
-	{"dev_scan", &dev_scan, 0},
-
-	{"dev_set_sys", &dev_set_sys, 0},
-	{"fe_get_parms", &dev_get_parms, 0},
-	{"fe_set_parms", &dev_set_parms, 0},
-	{"fe_get_stats", &dev_get_stats, 0},
+	{"daemon_get_version", &daemon_get_version, 1, 0},
+	{"dev_find", &dev_find, 0, 0},
+	{"dev_stop_monitor", &dev_stop_monitor, 0, 0},
+	{"dev_seek_by_adapter", &dev_seek_by_adapter, 0, 0},
+	{"dev_get_dev_info", &dev_get_dev_info, 0, 0},
+	{"dev_open", &dev_open, 0, 0},
+	{"dev_close", &dev_close, 0, 0},
+	{"dev_dmx_stop", &dev_dmx_stop, 0, 0},
+	{"dev_set_bufsize", &dev_set_bufsize, 0, 0},
+	{"dev_dmx_set_pesfilter", &dev_dmx_set_pesfilter, 0, 0},
+	{"dev_dmx_set_section_filter", &dev_dmx_set_section_filter, 0, 0},
+	{"dev_dmx_get_pmt_pid", &dev_dmx_get_pmt_pid, 0, 0},
+	{"dev_dmx_set_pids", &dev_dmx_set_pids, 0, 0},
+
+	{"dev_scan", &dev_scan, 0, 1},
+
+	{"dev_set_sys", &dev_set_sys, 0, 1},
+	{"fe_get_parms", &dev_get_parms, 0, 1},
+	{"fe_set_parms", &dev_set_parms, 0, 1},
+	{"fe_get_stats", &dev_get_stats, 0, 1},
 
 	{}
 };
 
-static void *start_server(void *fd_pointer)
-{
+/*
+ * Server: a single thread waits for the commands of all clients and runs
+ * the quick ones directly. The ones that may block on the frontend for a
+ * long time (tuning, scanning, getting stats) are queued to a small pool of
+ * workers, so a client tuning doesn't stall the others. While a command of
+ * a client is running on a worker, no more commands are read from that
+ * client, keeping its commands in order.
+ */
+
+#ifndef NUM_WORKERS
+#define NUM_WORKERS	2
+#endif
+
+struct client {
+	int fd;
+	int pending;
+	int closing;
+	int http;		/* connection to the metrics port */
+	struct client *next;
+	struct client *next_resume;
+	size_t len;
+	char buf[REMOTE_BUF_SIZE + 12];
+};
+
+struct job {
+	struct job *next;
 	const struct method_types *method;
-	int fd = *(int *)fd_pointer, ret, flag = 1;
-	char buf[REMOTE_BUF_SIZE + 8], cmd[CMD_SIZE], *p;
+	struct client *client;
+	uint32_t seq;
+	char cmd[CMD_SIZE];
 	ssize_t size;
+	char buf[];
+};
+
+static int server_epoll_fd = -1;
+static int wake_fd = -1;
+
+/* Protects the job queue and the list of clients to resume */
+static pthread_mutex_t job_mutex;
+static pthread_cond_t job_cond;
+static struct job *job_head, *job_tail;
+static struct client *resume_list;
+
+/* All clients, used by the metrics. Only changed by the server thread */
+static struct client *clients;
+
+static void *worker(void *privdata)
+{
+	struct job *job;
+
+	while (1) {
+		pthread_mutex_lock(&job_mutex);
+		while (!job_head)
+			pthread_cond_wait(&job_cond, &job_mutex);
+		job = job_head;
+		job_head = job->next;
+		if (!job_head)
+			job_tail = NULL;
+		pthread_mutex_unlock(&job_mutex);
+
+		if (verbose)
+			dbg("running command: %i '%s'", job->seq, job->cmd);
+
+		pthread_mutex_lock(&fe_mutex);
+		USDT(dvbv5_daemon, job_start, job->client->fd, job->seq, job->cmd);
+		job->method->handler(job->seq, job->cmd, job->client->fd,
+				     job->buf, job->size);
+		USDT(dvbv5_daemon, job_end, job->client->fd, job->seq);
+		pthread_mutex_unlock(&fe_mutex);
+
+		/* Let the server thread read the next commands of the client */
+		pthread_mutex_lock(&job_mutex);
+		job->client->next_resume = resume_list;
+		resume_list = job->client;
+		pthread_mutex_unlock(&job_mutex);
+		eventfd_write(wake_fd, 1);
+
+		free(job);
+	}
+
+	return NULL;
+}
+
+static int queue_job(struct client *c, const struct method_types *method,
+		     uint32_t seq, char *cmd, char *buf, ssize_t size)
+{
+	struct epoll_event ev = {};
+	struct job *job;
+
+	job = malloc(sizeof(*job) + size);
+	if (!job) {
+		send_data(c->fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			  "out of memory");
+		return 0;
+	}
+
+	job->next = NULL;
+	job->method = method;
+	job->client = c;
+	job->seq = seq;
+	strcpy(job->cmd, cmd);
+	job->size = size;
+	memcpy(job->buf, buf, size);
+
+	c->pending = 1;
+	epoll_ctl(server_epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+
+	pthread_mutex_lock(&job_mutex);
+	if (job_tail)
+		job_tail->next = job;
+	else
+		job_head = job;
+	job_tail = job;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+
+	return 1;
+}
+
+/* Returns 1 if the command was queued to a worker */
+static int client_dispatch(struct client *c, char *buf, ssize_t size)
+{
+	const struct method_types *method;
+	int fd = c->fd, ret;
+	char cmd[CMD_SIZE], *p;
 	uint32_t seq;
+
+	ret = scan_data(buf, size, "%i%s",  &seq, cmd);
+	if (ret < 0) {
+		if (verbose)
+			dbg("message too short: %ld", size);
+		send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+			  "msg too short");
+		return 0;
+	}
+
+	p = buf + ret;
+	size -= ret;
+
+	if (verbose)
+		dbg("received command: %i '%s'", seq, cmd);
+
+	USDT(dvbv5_daemon, receive, fd, seq, cmd, size);
+
+	method = methods;
+	while (method->name) {
+		if (!strcmp(cmd, method->name)) {
+			if (dvb_fd > 0 || method->locks_dvb) {
+				if (method->blocking)
+					return queue_job(c, method, seq,
+							 cmd, p, size);
+				ret = method->handler(seq, cmd, fd, p, size);
+				if (ret >= 0 && method->locks_dvb)
+					dvb_fd = fd;
+				return 0;
+			}
+			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
+				  "daemon busy");
+			return 0;
+		}
+		method++;
+	}
+
+	if (verbose)
+		dbg("invalid command: %s", cmd);
+	send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR, "invalid command");
+
+	return 0;
+}
+
+/* Run all complete commands already received from the client */
+static int client_process(struct client *c)
+{
+	size_t pos = 0;
+	uint32_t size;
+	char *p;
+	int ret = 0;
+
+	while (!c->pending && c->len - pos >= 4) {
+		p = c->buf + pos;
+		size = (uint32_t)(uint8_t)p[0] << 24 | (uint32_t)(uint8_t)p[1] << 16 |
+		       (uint32_t)(uint8_t)p[2] << 8 | (uint32_t)(uint8_t)p[3];
+		if (size > sizeof(c->buf) - 4) {
+			if (verbose)
+				dbg("message too big: %u", size);
+			ret = -1;
+			break;
+		}
+		if (c->len - pos < 4 + size)
+			break;
+
+		pos += 4 + size;
+		client_dispatch(c, p + 4, size);
+	}
+
+	c->len -= pos;
+	memmove(c->buf, c->buf + pos, c->len);
+
+	return ret;
+}
+
+static void client_close(struct client *c)
+{
+	struct client **p;
+
+	epoll_ctl(server_epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+
+	/* Freed once the worker running its command is done */
+	if (c->pending) {
+		c->closing = 1;
+		return;
+	}
+
+	if (verbose)
+		dbg("Closing socket %d", c->fd);
+
+	for (p = &clients; *p; p = &(*p)->next) {
+		if (*p == c) {
+			*p = c->next;
+			break;
+		}
+	}
+
+	if (c->fd == dvb_fd) {
+		if (read_id) {
+			pthread_cancel(read_id);
+			read_id = 0;
+		}
+		close_all_devs();
+		binary_data = 0;
+	}
+	close(c->fd);
+	free(c);
+}
+
+/*
+ * Metrics HTTP server: a scrape is answered by the server thread, as soon
+ * as its request is received, and the connection is then closed. The
+ * server thread is the only one changing the lists of devices and clients.
+ */
+
+static FILE *metrics_file;
+static int metrics_stream_field;
+
+static void metrics_family(FILE *f, const char *name, const char *type,
+			   const char *help)
+{
+	fprintf(f, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void metrics_stream(const void *nodep, const VISIT which,
+			   const int depth)
+{
+	const struct dvb_descriptors *desc = *(struct dvb_descriptors **)nodep;
+	uint64_t val;
+
+	if (which != postorder && which != leaf)
+		return;
+
+	switch (metrics_stream_field) {
+	case 0:
+		val = desc->bytes;
+		break;
+	case 1:
+		val = desc->reads;
+		break;
+	default:
+		val = desc->overflows;
+	}
+	if (desc->open_dev->dev->dvb_type != DVB_DEVICE_DEMUX &&
+	    desc->open_dev->dev->dvb_type != DVB_DEVICE_DVR)
+		return;
+
+	fprintf(metrics_file, "%s{device=\"%s\",uid=\"%d\"} %llu\n",
+		metrics_stream_field == 0 ? "dvb_stream_bytes_total" :
+		metrics_stream_field == 1 ? "dvb_stream_reads_total" :
+		"dvb_stream_overflows_total",
+		desc->open_dev->dev->sysname, desc->uid,
+		(unsigned long long)val);
+}
+
+static void metrics_stat(FILE *f, const char *name, const char *label,
+			 const struct dtv_stats *stat)
+{
+	switch (stat->scale) {
+	case FE_SCALE_DECIBEL:
+		fprintf(f, "%s_db{%s} %.3f\n", name, label,
+			stat->svalue / 1000.);
+		break;
+	case FE_SCALE_RELATIVE:
+		fprintf(f, "%s_ratio{%s} %.4f\n", name, label,
+			stat->uvalue / 65535.);
+		break;
+	default:
+		break;
+	}
+}
+
+static void metrics_write(FILE *f)
+{
+	struct fe_metrics fe;
+	struct timespec now;
+	struct client *c;
+	char label[80];
+	int qlen;
+
+	pthread_mutex_lock(&metrics_mutex);
+	fe = fe_metrics;
+	pthread_mutex_unlock(&metrics_mutex);
+
+	snprintf(label, sizeof(label), "frontend=\"%s\"", fe.sysname);
+	if (!fe.sysname[0] || !fe.valid)
+		fe.signal.scale = fe.cnr.scale = fe.ucb.scale =
+			fe.ber_scale = FE_SCALE_NOT_AVAILABLE;
+
+	metrics_family(f, "dvb_frontend_lock", "gauge",
+		       "Whether the frontend has lock");
+	metrics_family(f, "dvb_frontend_status", "gauge",
+		       "Status bits of the frontend, as in fe_status_t");
+	metrics_family(f, "dvb_frontend_stats_age_seconds", "gauge",
+		       "Time since the frontend stats were read");
+	if (fe.sysname[0] && fe.valid) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		fprintf(f, "dvb_frontend_lock{%s} %d\n", label,
+			fe.status & FE_HAS_LOCK ? 1 : 0);
+		fprintf(f, "dvb_frontend_status{%s} %u\n", label, fe.status);
+		fprintf(f, "dvb_frontend_stats_age_seconds{%s} %.3f\n", label,
+			now.tv_sec - fe.updated.tv_sec +
+			(now.tv_nsec - fe.updated.tv_nsec) / 1e9);
+	}
+	metrics_family(f, "dvb_frontend_signal_strength_db", "gauge",
+		       "Signal strength, in dBm");
+	metrics_family(f, "dvb_frontend_signal_strength_ratio", "gauge",
+		       "Relative signal strength");
+	metrics_stat(f, "dvb_frontend_signal_strength", label, &fe.signal);
+	metrics_family(f, "dvb_frontend_cnr_db", "gauge",
+		       "Carrier to noise ratio, in dB");
+	metrics_family(f, "dvb_frontend_cnr_ratio", "gauge",
+		       "Relative carrier to noise ratio");
+	metrics_stat(f, "dvb_frontend_cnr", label, &fe.cnr);
+	metrics_family(f, "dvb_frontend_ber", "gauge",
+		       "Bit error rate after the inner code");
+	if (fe.ber_scale != FE_SCALE_NOT_AVAILABLE)
+		fprintf(f, "dvb_frontend_ber{%s} %g\n", label, fe.ber);
+	metrics_family(f, "dvb_frontend_uncorrected_blocks", "counter",
+		       "Uncorrected blocks");
+	if (fe.ucb.scale == FE_SCALE_COUNTER)
+		fprintf(f, "dvb_frontend_uncorrected_blocks_total{%s} %llu\n",
+			label, (unsigned long long)fe.ucb.uvalue);
+
+	metrics_file = f;
+	metrics_family(f, "dvb_stream_bytes", "counter",
+		       "Bytes sent to the client");
+	metrics_stream_field = 0;
+	twalk(desc_root, metrics_stream);
+	metrics_family(f, "dvb_stream_reads", "counter",
+		       "Reads from the device");
+	metrics_stream_field = 1;
+	twalk(desc_root, metrics_stream);
+	metrics_family(f, "dvb_stream_overflows", "counter",
+		       "Buffer overflows of the device");
+	metrics_stream_field = 2;
+	twalk(desc_root, metrics_stream);
+
+	metrics_family(f, "dvb_client_pending_commands", "gauge",
+		       "Commands of the client running or waiting for a worker");
+	for (c = clients; c; c = c->next)
+		if (!c->http)
+			fprintf(f, "dvb_client_pending_commands{client=\"%d\"} %d\n",
+				c->fd, c->pending);
+	metrics_family(f, "dvb_client_input_bytes", "gauge",
+		       "Bytes received from the client, not yet processed");
+	for (c = clients; c; c = c->next)
+		if (!c->http)
+			fprintf(f, "dvb_client_input_bytes{client=\"%d\"} %zu\n",
+				c->fd, c->len);
+	metrics_family(f, "dvb_client_output_queue_bytes", "gauge",
+		       "Bytes sent to the client, not yet acknowledged");
+	for (c = clients; c; c = c->next)
+		if (!c->http && !ioctl(c->fd, SIOCOUTQ, &qlen))
+			fprintf(f, "dvb_client_output_queue_bytes{client=\"%d\"} %d\n",
+				c->fd, qlen);
+
+	fprintf(f, "# EOF\n");
+}
+
+static void metrics_send(int fd, const char *buf, size_t size)
+{
+	ssize_t ret;
+
+	while (size) {
+		ret = send(fd, buf, size, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return;
+		buf += ret;
+		size -= ret;
+	}
+}
+
+/* Returns 0 if the request is not complete yet */
+static int metrics_process(struct client *c)
+{
+	char hdr[256], *body = NULL;
+	const char *status = "200 OK";
+	size_t i, body_size = 0;
+	FILE *f;
+	int len;
+
+	/* Wait for all the headers, as closing with data unread resets */
+	for (i = 1; i < c->len; i++) {
+		if (c->buf[i] == '\n' &&
+		    (c->buf[i - 1] == '\n' ||
+		     (i > 1 && c->buf[i - 1] == '\r' && c->buf[i - 2] == '\n')))
+			break;
+	}
+	if (i >= c->len)
+		return 0;
+
+	f = open_memstream(&body, &body_size);
+	if (!f)
+		return 1;
+
+	if (strncmp(c->buf, "GET ", 4)) {
+		status = "405 Method Not Allowed";
+		fprintf(f, "Only GET is supported\n");
+	} else if (strncmp(c->buf + 4, "/metrics ", 9) &&
+		   strncmp(c->buf + 4, "/ ", 2)) {
+		status = "404 Not Found";
+		fprintf(f, "The metrics are at /metrics\n");
+	} else {
+		metrics_write(f);
+	}
+	fclose(f);
+
+	len = snprintf(hdr, sizeof(hdr),
+		       "HTTP/1.0 %s\r\n"
+		       "Content-Type: %s\r\n"
+		       "Content-Length: %zu\r\n"
+		       "Connection: close\r\n\r\n",
+		       status,
+		       strcmp(status, "200 OK") ? "text/plain" :
+		       "application/openmetrics-text; version=1.0.0; charset=utf-8",
+		       body_size);
+	metrics_send(c->fd, hdr, len);
+	metrics_send(c->fd, body, body_size);
+	free(body);
+
+	return 1;
+}
+
+static void client_read(struct client *c)
+{
+	ssize_t size;
+
+	/* With its input disabled, only a hangup or an error is reported */
+	if (c->pending) {
+		client_close(c);
+		return;
+	}
+
+	size = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len,
+		    MSG_DONTWAIT);
+	if (size < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (size <= 0) {
+		client_close(c);
+		return;
+	}
+
+	c->len += size;
+	if (c->http) {
+		if (metrics_process(c))
+			client_close(c);
+		return;
+	}
+	if (client_process(c) < 0)
+		client_close(c);
+}
+
+static void resume_clients(void)
+{
+	struct epoll_event ev = {};
+	struct client *c, *next;
+	eventfd_t val;
+
+	eventfd_read(wake_fd, &val);
+
+	pthread_mutex_lock(&job_mutex);
+	c = resume_list;
+	resume_list = NULL;
+	pthread_mutex_unlock(&job_mutex);
+
+	for (; c; c = next) {
+		next = c->next_resume;
+		c->pending = 0;
+		if (c->closing) {
+			client_close(c);
+			continue;
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(server_epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+
+		if (client_process(c) < 0)
+			client_close(c);
+	}
+}
+
+static int client_accept(int sockfd, int http)
+{
+	struct sockaddr_in cli_addr;
+	socklen_t addrlen = sizeof(cli_addr);
+	struct epoll_event ev = {};
+	struct client *c;
+	int fd, flag = 1;
 	int bufsize;
 
+	fd = accept(sockfd, (struct sockaddr *)&cli_addr, &addrlen);
+	if (fd < 0) {
+		if (errno == EINTR || errno == ECONNABORTED)
+			return 0;
+		local_perror("accept");
+		return -1;
+	}
+
 	if (verbose)
-		dbg("Opening socket %d", fd);
+		dbg("accepted connection %d", fd);
 
 	/* Set a large buffer for read() to work better */
 	bufsize = REMOTE_BUF_SIZE;
@@ -1359,78 +2132,101 @@ static void *start_server(void *fd_pointer)
 		dbg("Failed to avoid TCP delays");
 	};
 
-	/* Command dispatcher */
-	do {
-		size = recv(fd, buf, 4, MSG_WAITALL);
-		if (size <= 0)
-			break;
-		size = (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 |
-		       (uint32_t)buf[2] << 8 | (uint32_t)buf[3];
-		size = recv(fd, buf, size, MSG_WAITALL);
-		if (size <= 0)
-			break;
-
-		ret = scan_data(buf, size, "%i%s",  &seq, cmd);
-		if (ret < 0) {
-			if (verbose)
-				dbg("message too short: %ld", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-				  "msg too short");
-			continue;
-		}
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		err("Can't allocate client data");
+		close(fd);
+		return 0;
+	}
+	c->fd = fd;
+	c->http = http;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(server_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		local_perror("epoll_ctl");
+		close(fd);
+		free(c);
+		return 0;
+	}
+	c->next = clients;
+	clients = c;
 
-		p = buf + ret;
-		size -= ret;
+	return 0;
+}
 
-		if (verbose)
-			dbg("received command: %i '%s'", seq, cmd);
+static int start_server(int sockfd, int metrics_fd)
+{
+	struct epoll_event ev = {}, events[16];
+	pthread_t id;
+	int i, n, ret, wake;
+
+	server_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (server_epoll_fd < 0 || wake_fd < 0) {
+		local_perror("epoll_create1");
+		return -1;
+	}
 
-		if (size > buf + sizeof(buf) - p) {
-			if (verbose)
-				dbg("data length too big: %d", size);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-				  "data length too big");
-			continue;
+	/* The listening socket and the worker wakeups have no client data */
+	ev.events = EPOLLIN;
+	ev.data.ptr = &sockfd;
+	epoll_ctl(server_epoll_fd, EPOLL_CTL_ADD, sockfd, &ev);
+	ev.data.ptr = &wake_fd;
+	epoll_ctl(server_epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+	if (metrics_fd >= 0) {
+		ev.data.ptr = &metrics_fd;
+		epoll_ctl(server_epoll_fd, EPOLL_CTL_ADD, metrics_fd, &ev);
+
+		ret = pthread_create(&id, NULL, metrics_sampler, NULL);
+		if (ret) {
+			local_perror("pthread_create");
+			return -1;
 		}
+		pthread_detach(id);
+	}
 
-		method = methods;
-		while (method->name) {
-			if (!strcmp(cmd, method->name)) {
-				if (dvb_fd > 0 || method->locks_dvb) {
-					ret = method->handler(seq, cmd,
-							      fd, p, size);
-					if (ret < 0)
-						break;
-					if (method->locks_dvb)
-						dvb_fd = fd;
-					break;
-				}
-				send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-					  "daemon busy");
-				break;
-			}
-			method++;
-		}
-		if (!method->name) {
-			if (verbose)
-				dbg("invalid command: %s", cmd);
-			send_data(fd, "%i%s%i%s", 0, "log", LOG_ERR,
-				  "invalid command");
+	for (i = 0; i < NUM_WORKERS; i++) {
+		ret = pthread_create(&id, NULL, worker, NULL);
+		if (ret) {
+			local_perror("pthread_create");
+			return -1;
 		}
-	} while (1);
+		pthread_detach(id);
+	}
 
-	if (verbose)
-		dbg("Closing socket %d", fd);
+	while (1) {
+		n = epoll_wait(server_epoll_fd, events, ARRAY_SIZE(events), -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			local_perror("epoll_wait");
+			return -1;
+		}
 
-	close(fd);
-	if (read_id) {
-		pthread_cancel(read_id);
-		read_id = 0;
+		/*
+		 * Resume the clients only after handling all events, as
+		 * resuming may free a client with an event still pending.
+		 */
+		wake = 0;
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &sockfd) {
+				if (client_accept(sockfd, 0) < 0)
+					return -1;
+			} else if (events[i].data.ptr == &metrics_fd) {
+				if (client_accept(metrics_fd, 1) < 0)
+					return -1;
+			} else if (events[i].data.ptr == &wake_fd) {
+				wake = 1;
+			} else {
+				client_read(events[i].data.ptr);
+			}
+		}
+		if (wake)
+			resume_clients();
 	}
-	if (dvb_fd > 0)
-		close_all_devs();
 
-	return NULL;
+	return 0;
 }
 
 /*
@@ -1440,9 +2236,8 @@ static void *start_server(void *fd_pointer)
 int main(int argc, char *argv[])
 {
 	int ret;
-	int sockfd;
-	socklen_t addrlen;
-	struct sockaddr_in serv_addr, cli_addr;
+	int sockfd, metrics_fd = -1;
+	struct sockaddr_in serv_addr;
 
 #ifdef ENABLE_NLS
 	setlocale (LC_ALL, "");
@@ -1489,18 +2284,44 @@ int main(int argc, char *argv[])
 		goto error;
 	}
 
+	if (metrics_port) {
+		metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (metrics_fd < 0) {
+			local_perror("socket");
+			goto error;
+		}
+		ret = 1;
+		setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &ret, sizeof(ret));
+
+		serv_addr.sin_port = htons(metrics_port);
+		ret = bind(metrics_fd, (struct sockaddr *) &serv_addr,
+			   sizeof(serv_addr));
+		if (ret < 0) {
+			local_perror("bind");
+			goto error;
+		}
+		listen(metrics_fd, 5);
+	}
+
 	/* FIXME: should allow the caller to set the verbosity */
 	dvb_dev_set_logpriv(dvb, 1, dvb_remote_log, &dvb_fd);
 
 	/* Listen up to 5 connections */
 	listen(sockfd, 5);
-	addrlen = sizeof(cli_addr);
 
 	start_signal_handler();
 	pthread_mutex_init(&msg_mutex, NULL);
 	pthread_mutex_init(&dvb_read_mutex, NULL);
-
-	/* Accept actual connection from the client */
+	pthread_mutex_init(&job_mutex, NULL);
+	pthread_cond_init(&job_cond, NULL);
+	pthread_mutex_init(&fe_mutex, NULL);
+	pthread_mutex_init(&metrics_mutex, NULL);
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		local_perror("epoll_create1");
+		return -1;
+	}
 
 	warn("Support for Digital TV remote access is still highly experimental.\n"
 	     "\nKnown issues:\n"
@@ -1512,26 +2333,8 @@ int main(int argc, char *argv[])
 
 	info(PROGRAM_NAME" started.");
 
-	while (1) {
-		int fd;
-		pthread_t id;
-
-		if (verbose)
-			dbg("waiting for connections");
-		fd = accept(sockfd, (struct sockaddr *)&cli_addr, &addrlen);
-		if (fd < 0) {
-			local_perror("accept");
-			break;
-		}
-
-		if (verbose)
-			dbg("accepted connection %d", fd);
-		ret = pthread_create(&id, NULL, start_server, (void *)&fd);
-		if (ret < 0) {
-			local_perror("pthread_create");
-			break;
-		}
-	}
+	/* Wait for connections and commands */
+	start_server(sockfd, metrics_fd);
 
 	/* Just in case we add some way for the remote part to stop the daemon */
 	stop_signal_handler();
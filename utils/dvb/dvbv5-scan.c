@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <argp.h>
+#include <pthread.h>
 
 #ifdef ENABLE_NLS
 # define _(string) gettext(string)
@@ -51,17 +52,18 @@
 #include "libdvbv5/countries.h"
 
 #define PROGRAM_NAME	"dvbv5-scan"
+#define MAX_SCAN_ADAPTERS	16
 #define DEFAULT_OUTPUT  "dvb_channel.conf"
 
 const char *argp_program_version = PROGRAM_NAME " version " V4L_UTILS_VERSION;
 const char *argp_program_bug_address = "Mauro Carvalho Chehab <mchehab@kernel.org>";
 
 struct arguments {
-	char *confname, *lnb_name, *output, *demux_dev;
+	char *confname, *lnb_name, *output, *demux_dev, *table_cache, *ts_file;
 	unsigned adapter, n_adapter, adapter_fe, adapter_dmx, frontend, demux, get_detected, get_nit;
 	int lna, lnb, sat_number, freq_bpf;
-	unsigned diseqc_wait, dont_add_new_freqs, timeout_multiply;
-	unsigned other_nit;
+	unsigned diseqc_wait, diseqc_settle, dont_add_new_freqs, timeout_multiply;
+	unsigned other_nit, concurrent_tables, all_adapters;
 	enum dvb_file_formats input_format, output_format;
 	const char *cc;
 
@@ -78,6 +80,7 @@ static const struct argp_option options[] = {
 	{"sat_number",	'S',	N_("satellite_number"),	0, N_("satellite number. If not specified, disable DISEqC"), 0},
 	{"freq_bpf",	'U',	N_("frequency"),	0, N_("SCR/Unicable band-pass filter frequency to use, in kHz"), 0},
 	{"wait",	'W',	N_("time"),		0, N_("adds additional wait time for DISEqC command completion"), 0},
+	{"diseqc-settle", -5,	N_("time"),		0, N_("time between two DISEqC commands, in ms (default: 15)"), 0},
 	{"nit",		'N',	NULL,			0, N_("use data from NIT table on the output file"), 0},
 	{"get_frontend",'G',	NULL,			0, N_("use data from get_frontend on the output file"), 0},
 	{"verbose",	'v',	NULL,			0, N_("be (very) verbose"), 0},
@@ -85,6 +88,10 @@ static const struct argp_option options[] = {
 	{"file-freqs-only", 'F', NULL,			0, N_("don't use the other frequencies discovered during scan"), 0},
 	{"timeout-multiply", 'T', N_("factor"),		0, N_("Multiply scan timeouts by this factor"), 0},
 	{"parse-other-nit", 'p', NULL,			0, N_("Parse the other NIT/SDT tables"), 0},
+	{"concurrent-tables", 'P', NULL,		0, N_("Read the MPEG-TS tables at the same time"), 0},
+	{"table-cache", 'c',	N_("directory"),	0, N_("cache the MPEG-TS tables on this directory, skipping the unchanged ones on rescans"), 0},
+	{"ts-file",	-6,	N_("file"),		0, N_("parse the tables of a recorded MPEG-TS file, or of stdin if '-', instead of tuning"), 0},
+	{"all-adapters", 'A',	NULL,			0, N_("scan in parallel with all adapters that support the same delivery system"), 0},
 	{"input-format", 'I',	N_("format"),		0, N_("Input format: CHANNEL, DVBV5 (default: DVBV5)"), 0},
 	{"output-format", 'O',	N_("format"),		0, N_("Output format: VDR, CHANNEL, ZAP, DVBV5 (default: DVBV5)"), 0},
 	{"cc",		'C',	N_("country_code"),	0, N_("Set the default country to be used (in ISO 3166-1 two letter code)"), 0},
@@ -187,77 +194,85 @@ static int check_frontend(void *__args,
 	int rc, i;
 	fe_status_t status;
 
-	args->n_status_lines = 0;
+	if (!args->all_adapters)
+		args->n_status_lines = 0;
 	for (i = 0; i < args->timeout_multiply * 40; i++) {
 		if (parms->abort)
 			return 0;
-		rc = dvb_fe_get_stats(parms);
-		if (rc)
+		/* Returns as soon as locked, shows the stats every 100 ms */
+		rc = dvb_fe_wait_lock(parms, 100);
+		if (rc && rc != -ETIMEDOUT && rc != -EINTR) {
 			PERROR(_("dvb_fe_get_stats failed"));
+			usleep(100000);
+		}
 
 		rc = dvb_fe_retrieve_stats(parms, DTV_STATUS, &status);
 		if (rc)
 			status = 0;
-		print_frontend_stats(args, parms);
+		/* The status lines of several adapters would be mixed */
+		if (!args->all_adapters)
+			print_frontend_stats(args, parms);
 		if (status & FE_HAS_LOCK)
 			break;
-		usleep(100000);
 	};
 
-	if (isatty(STDERR_FILENO)) {
+	if (isatty(STDERR_FILENO) && !args->all_adapters) {
 		fprintf(stderr, "\x1b[37m");
 	}
 
 	return (status & FE_HAS_LOCK) ? 0 : -1;
 }
 
-static int run_scan(struct arguments *args, struct dvb_device *dvb)
+/*
+ * State shared by all adapters scanning the same channel file. Transponders
+ * are handed out in the order they're on the file, including the ones added
+ * from the NIT tables while scanning.
+ */
+struct scan_state {
+	struct arguments *args;
+	struct dvb_file *dvb_file, *dvb_file_new;
+	struct dvb_entry *last_entry;
+	int count, busy;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct scan_worker {
+	struct scan_state *state;
+	struct dvb_device *dvb;
+	struct dvb_open_descriptor *dmx_fd;
+	unsigned adapter;
+	pthread_t thread;
+};
+
+static struct dvb_entry *next_entry(struct scan_worker *w, int *count)
 {
-	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	struct dvb_file *dvb_file = NULL, *dvb_file_new = NULL;
+	struct scan_state *s = w->state;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
 	struct dvb_entry *entry;
-	struct dvb_open_descriptor *dmx_fd;
-	int count = 0, shift;
-	uint32_t freq, sys;
+	uint32_t freq, stream_id;
 	enum dvb_sat_polarization pol;
+	int shift;
 
-	/* This is used only when reading old formats */
-	switch (parms->current_sys) {
-	case SYS_DVBT:
-	case SYS_DVBS:
-	case SYS_DVBC_ANNEX_A:
-	case SYS_ATSC:
-		sys = parms->current_sys;
-		break;
-	case SYS_DVBC_ANNEX_C:
-		sys = SYS_DVBC_ANNEX_A;
-		break;
-	case SYS_DVBC_ANNEX_B:
-		sys = SYS_ATSC;
-		break;
-	case SYS_ISDBT:
-	case SYS_DTMB:
-		sys = SYS_DVBT;
-		break;
-	default:
-		sys = SYS_UNDEFINED;
-		break;
-	}
-	dvb_file = dvb_read_file_format(args->confname, sys,
-				    args->input_format);
-	if (!dvb_file)
-		return -2;
+	pthread_mutex_lock(&s->lock);
+	while (!parms->abort) {
+		if (s->last_entry)
+			entry = s->last_entry->next;
+		else
+			entry = s->dvb_file->first_entry;
 
-	/* FIXME: should be replaced by dvb_dev_open() */
-	dmx_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
-	if (!dmx_fd) {
-		perror(_("opening demux failed"));
-		return -3;
-	}
+		/* A recorded MPEG-TS has just one transponder */
+		if (s->args->ts_file && s->count)
+			entry = NULL;
 
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		struct dvb_v5_descriptors *dvb_scan_handler = NULL;
-		uint32_t stream_id;
+		if (!entry) {
+			/* The ones being scanned may still add transponders */
+			if (!s->busy)
+				break;
+			pthread_cond_wait(&s->cond, &s->lock);
+			continue;
+		}
+		s->last_entry = entry;
 
 		/*
 		 * If the channel file has duplicated frequencies, or some
@@ -273,12 +288,39 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		if (dvb_retrieve_entry_prop(entry, DTV_STREAM_ID, &stream_id))
 			stream_id = NO_STREAM_ID_FILTER;
 
-		if (!dvb_new_entry_is_needed(dvb_file->first_entry, entry,
+		if (!dvb_new_entry_is_needed(s->dvb_file->first_entry, entry,
 						  freq, shift, pol, stream_id))
 			continue;
 
-		count++;
-		dvb_log(_("Scanning frequency #%d %d"), count, freq);
+		s->busy++;
+		*count = ++s->count;
+		pthread_mutex_unlock(&s->lock);
+		return entry;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+static void *scan_worker(void *priv)
+{
+	struct scan_worker *w = priv;
+	struct scan_state *s = w->state;
+	struct arguments *args = s->args;
+	struct dvb_v5_fe_parms *parms = w->dvb->fe_parms;
+	struct dvb_entry *entry;
+	uint32_t freq;
+	int count;
+
+	while ((entry = next_entry(w, &count)) != NULL) {
+		struct dvb_v5_descriptors *dvb_scan_handler = NULL;
+
+		dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq);
+		if (args->all_adapters)
+			dvb_log(_("Scanning frequency #%d %d on adapter %d"),
+				count, freq, w->adapter);
+		else
+			dvb_log(_("Scanning frequency #%d %d"), count, freq);
 
 		/*
 		 * update params->lnb only if it differs from entry->lnb
@@ -293,30 +335,32 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		 * Run the scanning logic
 		 */
 
-		dvb_scan_handler = dvb_dev_scan(dmx_fd, entry,
+		dvb_scan_handler = dvb_dev_scan(w->dmx_fd, entry,
 						&check_frontend, args,
 						args->other_nit,
 						args->timeout_multiply);
 
-		if (parms->abort) {
-			dvb_scan_free_handler_table(dvb_scan_handler);
-			break;
+		pthread_mutex_lock(&s->lock);
+		s->busy--;
+		if (dvb_scan_handler && !parms->abort) {
+			/*
+			 * Store the service entry
+			 */
+			dvb_store_channel(&s->dvb_file_new, parms,
+					  dvb_scan_handler,
+					  args->get_detected, args->get_nit);
+
+			/*
+			 * Add new transponders based on NIT table information
+			 */
+			if (!args->dont_add_new_freqs)
+				dvb_add_scaned_transponders(parms,
+							    dvb_scan_handler,
+							    s->dvb_file->first_entry,
+							    entry);
 		}
-		if (!dvb_scan_handler)
-			continue;
-
-		/*
-		 * Store the service entry
-		 */
-		dvb_store_channel(&dvb_file_new, parms, dvb_scan_handler,
-				  args->get_detected, args->get_nit);
-
-		/*
-		 * Add new transponders based on NIT table information
-		 */
-		if (!args->dont_add_new_freqs)
-			dvb_add_scaned_transponders(parms, dvb_scan_handler,
-						    dvb_file->first_entry, entry);
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
 
 		/*
 		 * Free the scan handler associated with the transponder
@@ -325,15 +369,75 @@ static int run_scan(struct arguments *args, struct dvb_device *dvb)
 		dvb_scan_free_handler_table(dvb_scan_handler);
 	}
 
-	if (dvb_file_new)
-		dvb_write_file_format(args->output, dvb_file_new,
+	return NULL;
+}
+
+static int run_scan(struct arguments *args, struct scan_worker *workers,
+		    int num_workers)
+{
+	struct dvb_v5_fe_parms *parms = workers[0].dvb->fe_parms;
+	struct scan_state state = {
+		.args = args,
+	};
+	uint32_t sys;
+	int i;
+
+	/* This is used only when reading old formats */
+	switch (parms->current_sys) {
+	case SYS_DVBT:
+	case SYS_DVBS:
+	case SYS_DVBC_ANNEX_A:
+	case SYS_ATSC:
+		sys = parms->current_sys;
+		break;
+	case SYS_DVBC_ANNEX_C:
+		sys = SYS_DVBC_ANNEX_A;
+		break;
+	case SYS_DVBC_ANNEX_B:
+		sys = SYS_ATSC;
+		break;
+	case SYS_ISDBT:
+	case SYS_DTMB:
+		sys = SYS_DVBT;
+		break;
+	default:
+		sys = SYS_UNDEFINED;
+		break;
+	}
+	state.dvb_file = dvb_read_file_format(args->confname, sys,
+					      args->input_format);
+	if (!state.dvb_file)
+		return -2;
+
+	pthread_mutex_init(&state.lock, NULL);
+	pthread_cond_init(&state.cond, NULL);
+
+	/* The first adapter runs on this thread */
+	for (i = 0; i < num_workers; i++) {
+		workers[i].state = &state;
+		if (i && pthread_create(&workers[i].thread, NULL, scan_worker,
+					&workers[i])) {
+			PERROR(_("can't start scanning on adapter %d"),
+			       workers[i].adapter);
+			num_workers = i;
+			break;
+		}
+	}
+	scan_worker(&workers[0]);
+	for (i = 1; i < num_workers; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	pthread_cond_destroy(&state.cond);
+	pthread_mutex_destroy(&state.lock);
+
+	if (state.dvb_file_new)
+		dvb_write_file_format(args->output, state.dvb_file_new,
 				      parms->current_sys, args->output_format);
 
-	dvb_file_free(dvb_file);
-	if (dvb_file_new)
-		dvb_file_free(dvb_file_new);
+	dvb_file_free(state.dvb_file);
+	if (state.dvb_file_new)
+		dvb_file_free(state.dvb_file_new);
 
-	dvb_dev_close(dmx_fd);
 	return 0;
 }
 
@@ -382,6 +486,12 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'W':
 		args->diseqc_wait = strtoul(optarg, NULL, 0);
 		break;
+	case -5:
+		args->diseqc_settle = strtoul(optarg, NULL, 0);
+		break;
+	case -6:
+		args->ts_file = optarg;
+		break;
 	case 'N':
 		args->get_nit++;
 		break;
@@ -394,6 +504,15 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'p':
 		args->other_nit++;
 		break;
+	case 'P':
+		args->concurrent_tables++;
+		break;
+	case 'A':
+		args->all_adapters++;
+		break;
+	case 'c':
+		args->table_cache = optarg;
+		break;
 	case 'v':
 		verbose++;
 		break;
@@ -430,13 +549,17 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	return 0;
 }
 
-static int *timeout_flag;
+static int *timeout_flag[MAX_SCAN_ADAPTERS];
+static int num_timeout_flags;
 
 static void do_timeout(int x)
 {
+	int i;
+
 	(void)x;
-	if (*timeout_flag == 0) {
-		*timeout_flag = 1;
+	if (*timeout_flag[0] == 0) {
+		for (i = 0; i < num_timeout_flags; i++)
+			*timeout_flag[i] = 1;
 		alarm(5);
 		signal(SIGALRM, do_timeout);
 	} else {
@@ -445,6 +568,79 @@ static void do_timeout(int x)
 	}
 }
 
+static void setup_frontend(struct arguments *args,
+			   struct dvb_v5_fe_parms *parms, int lnb)
+{
+	int err;
+
+	if (lnb >= 0)
+		parms->lnb = dvb_sat_get_lnb(lnb);
+	if (args->sat_number >= 0)
+		parms->sat_number = args->sat_number;
+	parms->diseqc_wait = args->diseqc_wait;
+	parms->diseqc_settle = args->diseqc_settle;
+	parms->freq_bpf = args->freq_bpf;
+	parms->lna = args->lna;
+	if (args->concurrent_tables)
+		dvb_scan_set_concurrent_tables(parms, 1);
+	if (args->table_cache && dvb_scan_set_table_cache(parms, args->table_cache))
+		fprintf(stderr, _("Can't use the table cache at %s\n"), args->table_cache);
+	err = dvb_fe_set_default_country(parms, args->cc);
+	if (err < 0)
+		fprintf(stderr, _("Failed to set the country code:%s\n"), args->cc);
+}
+
+/*
+ * Open the first frontend and demux of an adapter, if it supports the
+ * delivery system used to scan.
+ */
+static int open_adapter(struct arguments *args, struct scan_worker *w,
+			unsigned adapter, uint32_t delsys, int lnb)
+{
+	struct dvb_dev_list *fe_dev, *dmx_dev;
+	struct dvb_v5_fe_parms *parms;
+	int i;
+
+	w->dvb = dvb_dev_alloc();
+	if (!w->dvb)
+		return -1;
+	dvb_dev_set_log(w->dvb, verbose, NULL);
+	dvb_dev_find(w->dvb, NULL, NULL);
+	parms = w->dvb->fe_parms;
+
+	fe_dev = dvb_dev_seek_by_adapter(w->dvb, adapter, 0, DVB_DEVICE_FRONTEND);
+	dmx_dev = dvb_dev_seek_by_adapter(w->dvb, adapter, 0, DVB_DEVICE_DEMUX);
+	if (!fe_dev || !dmx_dev || !dvb_dev_open(w->dvb, fe_dev->sysname, O_RDWR))
+		goto err;
+
+	for (i = 0; i < parms->num_systems; i++)
+		if (parms->systems[i] == delsys)
+			break;
+	if (i == parms->num_systems) {
+		if (verbose)
+			fprintf(stderr, _("adapter %d doesn't support %s. Skipping it.\n"),
+				adapter, delivery_system_name[delsys]);
+		goto err;
+	}
+	if (parms->current_sys != delsys && dvb_set_sys(parms, delsys))
+		goto err;
+
+	w->dmx_fd = dvb_dev_open(w->dvb, dmx_dev->sysname, O_RDWR);
+	if (!w->dmx_fd)
+		goto err;
+
+	if (verbose)
+		fprintf(stderr, _("using adapter %d\n"), adapter);
+
+	setup_frontend(args, parms, lnb);
+	w->adapter = adapter;
+
+	return 0;
+err:
+	dvb_dev_free(w->dvb);
+	w->dvb = NULL;
+	return -1;
+}
 
 int main(int argc, char **argv)
 {
@@ -453,6 +649,8 @@ int main(int argc, char **argv)
 	struct dvb_device *dvb;
 	struct dvb_dev_list *dvb_dev;
 	struct dvb_v5_fe_parms *parms;
+	struct scan_worker workers[MAX_SCAN_ADAPTERS] = {};
+	int i, num_workers = 1;
 	const struct argp argp = {
 		.options = options,
 		.parser = parse_opt,
@@ -518,6 +716,18 @@ int main(int argc, char **argv)
 	dvb = dvb_dev_alloc();
 	if (!dvb)
 		return -1;
+	if (args.ts_file) {
+		if (dvb_dev_file_init(dvb, args.ts_file) < 0) {
+			dvb_dev_free(dvb);
+			return -1;
+		}
+		args.adapter_fe = 0;
+		args.adapter_dmx = 0;
+		args.frontend = 0;
+		args.demux = 0;
+		args.all_adapters = 0;
+		args.dont_add_new_freqs = 1;
+	}
 	dvb_dev_set_log(dvb, verbose, NULL);
 	dvb_dev_find(dvb, NULL, NULL);
 	parms = dvb->fe_parms;
@@ -542,24 +752,40 @@ int main(int argc, char **argv)
 		free(args.demux_dev);
 		return -1;
 	}
-	if (lnb >= 0)
-		parms->lnb = dvb_sat_get_lnb(lnb);
-	if (args.sat_number >= 0)
-		parms->sat_number = args.sat_number;
-	parms->diseqc_wait = args.diseqc_wait;
-	parms->freq_bpf = args.freq_bpf;
-	parms->lna = args.lna;
-	err = dvb_fe_set_default_country(parms, args.cc);
-	if (err < 0)
-		fprintf(stderr, _("Failed to set the country code:%s\n"), args.cc);
+	setup_frontend(&args, parms, lnb);
+
+	workers[0].dvb = dvb;
+	workers[0].adapter = args.adapter_fe;
+	workers[0].dmx_fd = dvb_dev_open(dvb, args.demux_dev, O_RDWR);
+	if (!workers[0].dmx_fd) {
+		perror(_("opening demux failed"));
+		dvb_dev_free(dvb);
+		return -3;
+	}
+	timeout_flag[num_timeout_flags++] = &parms->abort;
+
+	if (args.all_adapters) {
+		for (i = 0; i < MAX_SCAN_ADAPTERS && num_workers < MAX_SCAN_ADAPTERS; i++) {
+			if (i == args.adapter_fe)
+				continue;
+			if (open_adapter(&args, &workers[num_workers], i,
+					 parms->current_sys, lnb))
+				continue;
+			timeout_flag[num_timeout_flags++] = &workers[num_workers].dvb->fe_parms->abort;
+			num_workers++;
+		}
+		fprintf(stderr, _("Scanning with %d adapters\n"), num_workers);
+	}
 
-	timeout_flag = &parms->abort;
 	signal(SIGTERM, do_timeout);
 	signal(SIGINT, do_timeout);
 
-	err = run_scan(&args, dvb);
+	err = run_scan(&args, workers, num_workers);
 
-	dvb_dev_free(dvb);
+	for (i = num_workers - 1; i >= 0; i--) {
+		dvb_dev_close(workers[i].dmx_fd);
+		dvb_dev_free(workers[i].dvb);
+	}
 
 	return err;
 }
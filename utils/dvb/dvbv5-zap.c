@@ -38,15 +38,26 @@
  */
 #define BUFLEN (188 * 512)
 
+/*
+ * Size of the buffer between the DVR reads and the output file writes,
+ * used to absorb the stalls of the storage while recording.
+ */
+#define RECBUF_SIZE (64 * BUFLEN)
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <errno.h>
 #include <signal.h>
 #include <argp.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <netdb.h>
 #include <time.h>
 
 #ifdef ENABLE_NLS
@@ -68,6 +79,9 @@
 #include "libdvbv5/dvb-scan.h"
 #include "libdvbv5/header.h"
 #include "libdvbv5/countries.h"
+#include "libdvbv5/crc32.h"
+#include "libdvbv5/mpeg_ts.h"
+#include "libdvbv5/pat.h"
 
 #define CHANNEL_FILE	"channels.conf"
 #define PROGRAM_NAME	"dvbv5-zap"
@@ -88,12 +102,16 @@ struct arguments {
 	char *filename, *dvr_pipe;
 	unsigned adapter, frontend, demux, get_detected, get_nit;
 	int lna, lnb, sat_number;
-	unsigned diseqc_wait, silent, verbose, frontend_only, freq_bpf;
-	unsigned timeout, dvr, rec_psi, exit_after_tuning;
+	unsigned diseqc_wait, diseqc_settle, silent, verbose, frontend_only, freq_bpf;
+	unsigned timeout, dvr, rec_psi, exit_after_tuning, dvr_bufsize;
 	unsigned n_apid, n_vpid, extra_pids, all_pids;
 	enum dvb_file_formats input_format, output_format;
-	unsigned traffic_monitor, low_traffic, non_human, port;
-	char *search, *server;
+	unsigned traffic_monitor, low_traffic, non_human, port, split;
+	unsigned lazy_parse, fast_zap, fe_tuned;
+	char *pmt_cache;
+	char *search, *server, *ts_file;
+	char *stream, *mcast_if;
+	int ttl;
 	const char *cc;
 
 	/* Used by status print */
@@ -103,15 +121,19 @@ struct arguments {
 static const struct argp_option options[] = {
 	{"adapter",	'a', N_("adapter#"),		0, N_("use given adapter (default 0)"), 0},
 	{"audio_pid",	'A', N_("audio_pid#"),		0, N_("audio pid program to use (default 0)"), 0},
+	{"dvr-bufsize",	'B', N_("bytes"),		0, N_("size of the DVR ringbuffer when recording"), 0},
 	{"channels",	'c', N_("file"),		0, N_("read channels list from 'file'"), 0},
 	{"extra-pids",	'E', NULL,			0, N_("output all channel pids"), 0 },
 	{"demux",	'd', N_("demux#"),		0, N_("use given demux (default 0)"), 0},
 	{"frontend",	'f', N_("frontend#"),		0, N_("use given frontend (default 0)"), 0},
+	{"fast-zap",	'F', N_("cachefile"),		OPTION_ARG_OPTIONAL, N_("don't tune if the frontend is already locked on the transponder, and use the PMT PID from a cache file (default: ~/.tzap/pmt_cache), checking it in background"), 0},
 	{"input-format", 'I',	N_("format"),		0, N_("Input format: ZAP, CHANNEL, DVBV5 (default: DVBV5)"), 0},
 	{"lna",		'w', N_("LNA (0, 1, -1)"),	0, N_("enable/disable/auto LNA power"), 0},
+	{"lazy-parse",	'z', NULL,			0, N_("read only the entry for the channel from a DVBV5 channels file. Ignored in split mode"), 0},
 	{"lnbf",	'l', N_("LNBf_type"),		0, N_("type of LNBf to use. 'help' lists the available ones"), 0},
 	{"search",	'L', N_("string"),		0, N_("search/look for a string inside the traffic"), 0},
 	{"monitor",	'm', NULL,			0, N_("monitors the DVB traffic"), 0},
+	{"split",	'M', NULL,			0, N_("record several services of the same transponder, each one to its own file. The output filename should have a %s, replaced by the channel name"), 0},
 	{"output",	'o', N_("file"),		0, N_("output filename (use -o - for stdout)"), 0},
 	{"pat",		'p', NULL,			0, N_("add pat and pmt to TS recording (implies -r)"), 0},
 	{"all-pids",	'P', NULL,			0, N_("don't filter any pids. Instead, outputs all of them"), 0 },
@@ -123,6 +145,7 @@ static const struct argp_option options[] = {
 	{"verbose",	'v', NULL,			0, N_("verbose debug messages (can be used more than once)"), 0},
 	{"video_pid",	'V', N_("video_pid#"),		0, N_("video pid program to use (default 0)"), 0},
 	{"wait",	'W', N_("time"),		0, N_("adds additional wait time for DISEqC command completion"), 0},
+	{"diseqc-settle", -5, N_("time"),		0, N_("time between two DISEqC commands, in ms (default: 15)"), 0},
 	{"exit",	'x', NULL,			0, N_("exit after tuning"), 0},
 	{"low_traffic",	'X', N_("packets_per_sec"),	0, N_("sets DVB low traffic threshold. PIDs with less than this amount of packets per second will be ignored. Default: 1 packet per second"), 0},
 	{"cc",		'C', N_("country_code"),	0, N_("Set the default country to be used (in ISO 3166-1 two letter code)"), 0},
@@ -130,6 +153,10 @@ static const struct argp_option options[] = {
 	{"server",	'H', N_("SERVER"),		0, N_("dvbv5-daemon host IP address"), 0},
 	{"tcp-port",	'T', N_("PORT"),		0, N_("dvbv5-daemon host tcp port"), 0},
 	{"dvr-pipe",	'D', N_("PIPE"),		0, N_("Named pipe for DVR output, when using remote access (by default: /tmp/dvr-pipe)"), 0},
+	{"ts-file",	-6,  N_("file"),		0, N_("read the MPEG-TS from a recorded file, or from stdin if '-', instead of tuning"), 0},
+	{"stream",	-7,  N_("url"),			0, N_("stream the TS over udp://host:port or rtp://host:port, e.g. to a multicast group (implies -r)"), 0},
+	{"ttl",		-8,  N_("hops"),		0, N_("time to live of the streamed datagrams"), 0},
+	{"mcast-if",	-9,  N_("interface"),		0, N_("network interface used to stream to a multicast group"), 0},
 	{"help",        '?', 0,				0, N_("Give this help list"), -1},
 	{"usage",	-3,  0,				0, N_("Give a short usage message")},
 	{"version",	-4,  0,				0, N_("Print program version"), -1},
@@ -164,6 +191,39 @@ static int timeout_flag = 0;
 	} while (0)
 
 
+/*
+ * Checks if the frontend is locked on the transponder of the entry, as it
+ * may be when zapping between services of the same transponder. As the
+ * polarization and the DiSEqC setup can't be read back, satellite
+ * systems are always tuned.
+ */
+static int frontend_is_tuned(struct dvb_v5_fe_parms *parms,
+			     struct dvb_entry *entry)
+{
+	uint32_t freq, sys, cur_freq, cur_sys;
+	fe_status_t status;
+
+	if (dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &freq) ||
+	    dvb_retrieve_entry_prop(entry, DTV_DELIVERY_SYSTEM, &sys))
+		return 0;
+	if (!freq || dvb_fe_is_satellite(sys))
+		return 0;
+
+	if (dvb_fe_get_stats(parms) < 0 ||
+	    dvb_fe_retrieve_stats(parms, DTV_STATUS, &status) < 0 ||
+	    !(status & FE_HAS_LOCK))
+		return 0;
+
+	if (dvb_fe_get_parms(parms) < 0 ||
+	    dvb_fe_retrieve_parm(parms, DTV_FREQUENCY, &cur_freq) < 0 ||
+	    dvb_fe_retrieve_parm(parms, DTV_DELIVERY_SYSTEM, &cur_sys) < 0 ||
+	    cur_sys != sys)
+		return 0;
+
+	/* Some drivers report the frequency they locked, a bit off */
+	return (uint64_t)abs((int)(cur_freq - freq)) * 1000 <= freq;
+}
+
 /*
  * Find channel configuration.
  * On success, the caller must dvb_file_free(*out_file).
@@ -175,9 +235,10 @@ static int parse(struct arguments *args,
 		 const struct dvb_entry **out_entry)
 {
 	struct dvb_file *dvb_file;
+	struct dvb_file_index *index;
 	struct dvb_entry *entry;
 	int i;
-	uint32_t sys;
+	uint32_t sys, freq = 0;
 
 	*out_file = NULL;
 	*out_entry = NULL;
@@ -204,28 +265,6 @@ static int parse(struct arguments *args,
 		sys = SYS_UNDEFINED;
 		break;
 	}
-	dvb_file = dvb_read_file_format(args->confname, sys,
-				    args->input_format);
-	if (!dvb_file)
-		return -2;
-
-	for (entry = dvb_file->first_entry; entry != NULL; entry = entry->next) {
-		if (entry->channel && !strcmp(entry->channel, channel))
-			break;
-		if (entry->vchannel && !strcmp(entry->vchannel, channel))
-			break;
-	}
-	/*
-	 * Give a second shot, using a case insensitive seek
-	 */
-	if (!entry) {
-		for (entry = dvb_file->first_entry; entry != NULL;
-		     entry = entry->next) {
-			if (entry->channel && !strcasecmp(entry->channel, channel))
-				break;
-		}
-	}
-
 	/*
 	 * When this tool is used to just tune to a channel, to monitor it or
 	 * to capture all PIDs, all it needs is a frequency.
@@ -234,17 +273,31 @@ static int parse(struct arguments *args,
 	 * This way, a file in "channel" format can be used instead of a zap file.
 	 * It is also easier to use it for testing purposes.
 	 */
-	if (!entry && (!args->dvr && !args->rec_psi)) {
-		uint32_t f, freq = atoi(channel);
-		if (freq) {
-			for (entry = dvb_file->first_entry; entry != NULL;
-			entry = entry->next) {
-				dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &f);
-				if (f == freq)
-					break;
-			}
-
+	if (!args->dvr && !args->rec_psi)
+		freq = atoi(channel);
+
+	if (args->lazy_parse && !args->split &&
+	    args->input_format == FILE_DVBV5) {
+		dvb_file = dvb_read_file_channel(args->confname, channel, freq);
+		if (!dvb_file)
+			return -2;
+		entry = dvb_file->first_entry;
+	} else {
+		dvb_file = dvb_read_file_format(args->confname, sys,
+						args->input_format);
+		if (!dvb_file)
+			return -2;
+
+		index = dvb_file_index_alloc(dvb_file);
+		if (!index) {
+			ERROR("out of memory");
+			dvb_file_free(dvb_file);
+			return -1;
 		}
+		entry = dvb_file_find_channel(index, channel);
+		if (!entry && freq)
+			entry = dvb_file_find_frequency(index, freq);
+		dvb_file_index_free(index);
 	}
 
 	if (!entry) {
@@ -272,6 +325,12 @@ static int parse(struct arguments *args,
 	if (parms->sat_number < 0 && entry->sat_number >= 0)
 		parms->sat_number = entry->sat_number;
 
+	if (args->fast_zap && frontend_is_tuned(parms, entry)) {
+		if (args->silent < 2)
+			fprintf(stderr, _("frontend is already locked on the transponder\n"));
+		args->fe_tuned = 1;
+	}
+
 	if (entry->other_el_pid) {
 		int i, type = -1;
 		for (i = 0; i < entry->other_el_pid_len; i++) {
@@ -340,6 +399,9 @@ static int setup_frontend(struct arguments *args,
 	int rc;
 	uint32_t freq;
 
+	if (args->fe_tuned)
+		return 0;
+
 	if (args->silent < 2) {
 		rc = dvb_fe_retrieve_parm(parms, DTV_FREQUENCY, &freq);
 		if (rc < 0) {
@@ -487,8 +549,9 @@ static int check_frontend(struct arguments *args,
 	int rc;
 	fe_status_t status = 0;
 	do {
-		rc = dvb_fe_get_stats(parms);
-		if (rc) {
+		/* Returns as soon as locked, shows the stats every second */
+		rc = dvb_fe_wait_lock(parms, 1000);
+		if (rc && rc != -ETIMEDOUT) {
 			ERROR("dvb_fe_get_stats failed");
 			usleep(1000000);
 			continue;
@@ -505,7 +568,6 @@ static int check_frontend(struct arguments *args,
 			print_frontend_stats(stderr, args, parms);
 		if (status & FE_HAS_LOCK)
 			break;
-		usleep(1000000);
 	} while (!timeout_flag);
 	if (args->silent < 2)
 		print_frontend_stats(stderr, args, parms);
@@ -549,19 +611,108 @@ static struct timespec *elapsed_time(struct timespec *start)
 	return &elapsed;
 }
 
+/*
+ * When recording, the data read from the DVR is passed to a writer thread
+ * through a large buffer. So, a write that takes long, like when the
+ * storage flushes its cache, doesn't keep the DVR from being read, which
+ * would overrun its ringbuffer at high bitrates.
+ */
+struct recbuf {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *buf;
+	unsigned long long read, write;
+	int out_fd, done, error;
+};
+
+static void *writer_thread(void *privdata)
+{
+	struct recbuf *rb = privdata;
+	size_t pos, len;
+	ssize_t r;
+
+	pthread_mutex_lock(&rb->lock);
+	while (1) {
+		while (rb->read == rb->write && !rb->done)
+			pthread_cond_wait(&rb->cond, &rb->lock);
+		if (rb->read == rb->write)
+			break;
+
+		pos = rb->read % RECBUF_SIZE;
+		len = rb->write - rb->read;
+		if (len > RECBUF_SIZE - pos)
+			len = RECBUF_SIZE - pos;
+		pthread_mutex_unlock(&rb->lock);
+
+		r = write(rb->out_fd, rb->buf + pos, len);
+
+		pthread_mutex_lock(&rb->lock);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			rb->error = errno;
+			break;
+		}
+		rb->read += r;
+	}
+	pthread_mutex_unlock(&rb->lock);
+
+	return NULL;
+}
+
 static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 			 int timeout, int silent)
 {
-	char buf[BUFLEN];
+	char buf[BUFLEN], *p;
 	int r, first = 1;
-	long long int rc = 0LL;
+	long long int rc = 0LL, dropped = 0LL;
 	struct timespec start, *elapsed;
+	struct recbuf rb = { .out_fd = out_fd };
+	sigset_t set, oldset;
+	pthread_t writer;
+	size_t pos, len;
+
+	rb.buf = malloc(RECBUF_SIZE);
+	if (!rb.buf) {
+		PERROR(_("Can't allocate the record buffer"));
+		return;
+	}
+	pthread_mutex_init(&rb.lock, NULL);
+	pthread_cond_init(&rb.cond, NULL);
+
+	/* Signals, like the timeout alarm, should interrupt only the reads */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	r = pthread_create(&writer, NULL, writer_thread, &rb);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (r) {
+		errno = r;
+		PERROR(_("Can't start the writer thread"));
+		free(rb.buf);
+		return;
+	}
 
 	/* Initialize start time, due to -EOVERFLOW with first == 1 */
 	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	while (timeout_flag == 0) {
-		r = dvb_dev_read(in_fd, buf, sizeof(buf));
+		pthread_mutex_lock(&rb.lock);
+		if (rb.error) {
+			pthread_mutex_unlock(&rb.lock);
+			break;
+		}
+		pos = rb.write % RECBUF_SIZE;
+		len = RECBUF_SIZE - (rb.write - rb.read);
+		pthread_mutex_unlock(&rb.lock);
+
+		if (len > RECBUF_SIZE - pos)
+			len = RECBUF_SIZE - pos;
+		if (len > BUFLEN)
+			len = BUFLEN;
+
+		/* Read straight into the buffer, or discard if it is full */
+		p = len ? rb.buf + pos : buf;
+		r = dvb_dev_read(in_fd, p, len ? len : sizeof(buf));
 		if (r < 0) {
 			if (r == -EOVERFLOW) {
 				elapsed = elapsed_time(&start);
@@ -594,13 +745,34 @@ static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 			first = 0;
 		}
 
-		if (write(out_fd, buf, r) < 0) {
-			PERROR(_("Write failed"));
-			break;
+		if (!len) {
+			dropped += r;
+			continue;
 		}
 
+		pthread_mutex_lock(&rb.lock);
+		rb.write += r;
+		pthread_cond_signal(&rb.cond);
+		pthread_mutex_unlock(&rb.lock);
+
 		rc += r;
 	}
+
+	pthread_mutex_lock(&rb.lock);
+	rb.done = 1;
+	pthread_cond_signal(&rb.cond);
+	pthread_mutex_unlock(&rb.lock);
+	pthread_join(writer, NULL);
+	free(rb.buf);
+
+	if (rb.error) {
+		errno = rb.error;
+		PERROR(_("Write failed"));
+	}
+	if (dropped)
+		fprintf(stderr, _("dropped %lld bytes, as the output is too slow\n"),
+			dropped);
+
 	if (silent < 2) {
 		if (timeout)
 			fprintf(stderr, _("received %lld bytes (%lld Kbytes/sec)\n"), rc,
@@ -610,6 +782,287 @@ static void copy_to_file(struct dvb_open_descriptor *in_fd, int out_fd,
 	}
 }
 
+/*
+ * Network streaming: the TS is sent in datagrams of STREAM_TS_PACKETS
+ * packets, as most receivers expect, with an RTP header (RFC 2250) on
+ * rtp:// URLs. All datagrams of a dvr read are sent at once, with
+ * sendmmsg(), straight from the read buffer. A multicast group reaches
+ * any number of receivers with a single copy of the stream.
+ */
+#define STREAM_TS_PACKETS	7
+#define STREAM_DGRAM_SIZE	(STREAM_TS_PACKETS * DVB_MPEG_TS_PACKET_SIZE)
+#define STREAM_BATCH		(BUFLEN / STREAM_DGRAM_SIZE + 1)
+#define STREAM_SNDBUF		(4 * 1024 * 1024)
+
+#define RTP_HDR_SIZE		12
+#define RTP_PT_MP2T		33
+
+struct stream_out {
+	int fd, rtp;
+	uint16_t seq;
+	uint32_t ssrc;
+};
+
+static int stream_set_multicast(struct arguments *args, int fd,
+				const struct addrinfo *ai)
+{
+	unsigned ifindex = 0;
+	int multicast;
+
+	if (args->mcast_if) {
+		ifindex = if_nametoindex(args->mcast_if);
+		if (!ifindex) {
+			PERROR(_("unknown network interface '%s'"), args->mcast_if);
+			return -1;
+		}
+	}
+
+	if (ai->ai_family == AF_INET6) {
+		const struct sockaddr_in6 *sa = (void *)ai->ai_addr;
+		int v = ifindex;
+
+		multicast = IN6_IS_ADDR_MULTICAST(&sa->sin6_addr);
+		if (multicast && ifindex &&
+		    setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &v, sizeof(v))) {
+			PERROR(_("can't set the multicast interface"));
+			return -1;
+		}
+		v = args->ttl;
+		if (args->ttl &&
+		    setsockopt(fd, IPPROTO_IPV6,
+			       multicast ? IPV6_MULTICAST_HOPS : IPV6_UNICAST_HOPS,
+			       &v, sizeof(v))) {
+			PERROR(_("can't set the TTL"));
+			return -1;
+		}
+	} else {
+		const struct sockaddr_in *sa = (void *)ai->ai_addr;
+		struct ip_mreqn mreq = { .imr_ifindex = ifindex };
+		int v = args->ttl;
+
+		multicast = IN_MULTICAST(ntohl(sa->sin_addr.s_addr));
+		if (multicast && ifindex &&
+		    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq))) {
+			PERROR(_("can't set the multicast interface"));
+			return -1;
+		}
+		if (args->ttl &&
+		    setsockopt(fd, IPPROTO_IP,
+			       multicast ? IP_MULTICAST_TTL : IP_TTL,
+			       &v, sizeof(v))) {
+			PERROR(_("can't set the TTL"));
+			return -1;
+		}
+	}
+	if (args->mcast_if && !multicast)
+		fprintf(stderr, _("%s is not a multicast address. Ignoring the interface\n"),
+			args->stream);
+
+	return 0;
+}
+
+static int stream_open(struct arguments *args, struct stream_out *s)
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_DGRAM }, *res;
+	char *host, *port, *p;
+	int sndbuf = STREAM_SNDBUF, ret;
+
+	memset(s, 0, sizeof(*s));
+	s->fd = -1;
+	if (!strncmp(args->stream, "rtp://", 6)) {
+		s->rtp = 1;
+	} else if (strncmp(args->stream, "udp://", 6)) {
+		ERROR("stream URL should be udp://host:port or rtp://host:port");
+		return -1;
+	}
+
+	host = strdup(args->stream + 6);
+	if (!host)
+		return -1;
+
+	/* IPv6 addresses are between brackets */
+	if (*host == '[' && (p = strchr(host, ']'))) {
+		*p++ = '\0';
+		port = (*p == ':') ? p + 1 : NULL;
+		p = host + 1;
+	} else {
+		port = strrchr(host, ':');
+		if (port)
+			*port++ = '\0';
+		p = host;
+	}
+	if (!port || !*port) {
+		ERROR("stream URL %s doesn't have a port", args->stream);
+		free(host);
+		return -1;
+	}
+
+	ret = getaddrinfo(p, port, &hints, &res);
+	free(host);
+	if (ret) {
+		ERROR("can't resolve %s: %s", args->stream, gai_strerror(ret));
+		return -1;
+	}
+
+	s->fd = socket(res->ai_family, SOCK_DGRAM, 0);
+	if (s->fd < 0) {
+		PERROR(_("can't create a socket"));
+		freeaddrinfo(res);
+		return -1;
+	}
+	ret = stream_set_multicast(args, s->fd, res);
+	if (!ret) {
+		ret = connect(s->fd, res->ai_addr, res->ai_addrlen);
+		if (ret)
+			PERROR(_("can't stream to %s"), args->stream);
+	}
+	freeaddrinfo(res);
+	if (ret) {
+		close(s->fd);
+		return -1;
+	}
+
+	/* Absorbs the bursts of the dvr reads */
+	setsockopt(s->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	s->ssrc = time(NULL) ^ (getpid() << 16);
+
+	return 0;
+}
+
+static void stream_rtp_header(struct stream_out *s, uint8_t *hdr,
+			      uint32_t timestamp)
+{
+	hdr[0] = 0x80;			/* version 2 */
+	hdr[1] = RTP_PT_MP2T;
+	hdr[2] = s->seq >> 8;
+	hdr[3] = s->seq;
+	hdr[4] = timestamp >> 24;
+	hdr[5] = timestamp >> 16;
+	hdr[6] = timestamp >> 8;
+	hdr[7] = timestamp;
+	hdr[8] = s->ssrc >> 24;
+	hdr[9] = s->ssrc >> 16;
+	hdr[10] = s->ssrc >> 8;
+	hdr[11] = s->ssrc;
+	s->seq++;
+}
+
+/* Sends the datagrams of a buffer, returning the bytes sent or -1 */
+static ssize_t stream_send(struct stream_out *s, uint8_t *buf, size_t len,
+			   unsigned long long *dgrams)
+{
+	static struct mmsghdr msgs[STREAM_BATCH];
+	static struct iovec iov[STREAM_BATCH][2];
+	static uint8_t hdr[STREAM_BATCH][RTP_HDR_SIZE];
+	struct timespec now;
+	uint32_t timestamp;
+	unsigned i, n, done = 0;
+	int ret;
+
+	n = len / STREAM_DGRAM_SIZE;
+	if (n > STREAM_BATCH)
+		n = STREAM_BATCH;
+
+	/* The RTP clock for MPEG-TS runs at 90 kHz */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timestamp = now.tv_sec * 90000ULL + now.tv_nsec / (NANO_SECONDS_IN_SEC / 90000);
+
+	memset(msgs, 0, sizeof(*msgs) * n);
+	for (i = 0; i < n; i++) {
+		struct iovec *v = iov[i];
+
+		if (s->rtp) {
+			stream_rtp_header(s, hdr[i], timestamp);
+			v->iov_base = hdr[i];
+			v->iov_len = RTP_HDR_SIZE;
+			v++;
+		}
+		v->iov_base = buf + i * STREAM_DGRAM_SIZE;
+		v->iov_len = STREAM_DGRAM_SIZE;
+		msgs[i].msg_hdr.msg_iov = iov[i];
+		msgs[i].msg_hdr.msg_iovlen = s->rtp ? 2 : 1;
+	}
+
+	while (done < n) {
+		ret = sendmmsg(s->fd, msgs + done, n - done, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			/* There may be no unicast receiver yet: just drop */
+			if (errno == ECONNREFUSED)
+				break;
+			return -1;
+		}
+		done += ret;
+	}
+	*dgrams += n;
+
+	return n * STREAM_DGRAM_SIZE;
+}
+
+static void stream_to_network(struct dvb_open_descriptor *in_fd,
+			      struct stream_out *s, int timeout, int silent)
+{
+	static uint8_t buf[BUFLEN + STREAM_DGRAM_SIZE];
+	unsigned long long dgrams = 0;
+	long long int rc = 0LL;
+	size_t len = 0;
+	ssize_t r;
+	int first = 1;
+
+	while (timeout_flag == 0) {
+		r = dvb_dev_read(in_fd, buf + len, BUFLEN);
+		if (r < 0) {
+			if (r == -EOVERFLOW) {
+				fprintf(stderr, _("buffer overrun at %lld\n"), rc);
+				continue;
+			}
+			ERROR("Read failed");
+			break;
+		}
+		if (!r)
+			break;
+
+		/* See copy_to_file() */
+		if (first) {
+			if (timeout > 0)
+				alarm(timeout);
+			first = 0;
+		}
+		len += r;
+
+		/* Keeps the packets of an incomplete datagram for later */
+		r = stream_send(s, buf, len, &dgrams);
+		if (r < 0) {
+			PERROR(_("Send failed"));
+			break;
+		}
+		len -= r;
+		memmove(buf, buf + r, len);
+		rc += r;
+	}
+
+	if (silent < 2) {
+		if (timeout)
+			fprintf(stderr, _("sent %lld bytes in %llu datagrams (%lld Kbytes/sec)\n"),
+				rc, dgrams, rc / (1024 * timeout));
+		else
+			fprintf(stderr, _("sent %lld bytes in %llu datagrams\n"),
+				rc, dgrams);
+	}
+}
+
+static void set_dvr_bufsize(struct arguments *args,
+			    struct dvb_open_descriptor *dvr_fd)
+{
+	if (!args->dvr_bufsize)
+		return;
+
+	fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), args->dvr_bufsize);
+	dvb_dev_set_bufsize(dvr_fd, args->dvr_bufsize);
+}
+
 static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 {
 	struct arguments *args = state->input;
@@ -674,12 +1127,31 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'W':
 		args->diseqc_wait = strtoul(optarg, NULL, 0);
 		break;
+	case -5:
+		args->diseqc_settle = strtoul(optarg, NULL, 0);
+		break;
+	case -6:
+		args->ts_file = optarg;
+		break;
+	case -7:
+		args->stream = optarg;
+		args->dvr = 1;
+		break;
+	case -8:
+		args->ttl = strtoul(optarg, NULL, 0);
+		break;
+	case -9:
+		args->mcast_if = optarg;
+		break;
 	case 's':
 		args->silent++;
 		break;
 	case 'v':
 		args->verbose++;
 		break;
+	case 'B':
+		args->dvr_bufsize = strtoul(optarg, NULL, 0);
+		break;
 	case 'A':
 		args->n_apid = strtoul(optarg, NULL, 0);
 		break;
@@ -695,9 +1167,21 @@ static error_t parse_opt(int k, char *optarg, struct argp_state *state)
 	case 'm':
 		args->traffic_monitor = 1;
 		break;
+	case 'M':
+		args->split = 1;
+		args->dvr = 1;
+		break;
 	case 'N':
 		args->non_human = 1;
 		break;
+	case 'z':
+		args->lazy_parse = 1;
+		break;
+	case 'F':
+		args->fast_zap = 1;
+		if (optarg)
+			args->pmt_cache = strdup(optarg);
+		break;
 	case 'X':
 		args->low_traffic = atoi(optarg);
 		break;
@@ -766,21 +1250,30 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	struct dvb_open_descriptor *fd, *dvr_fd;
 	struct timespec startt;
 	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
-	unsigned long long pidt[0x2001], wait, cont_err = 0;
-	unsigned long long err_cnt[0x2000];
-	signed char pid_cont[0x2000];
-	int i, first = 1;
-
-	memset(pidt, 0, sizeof(pidt));
-	memset(err_cnt, 0, sizeof(err_cnt));
-	memset(pid_cont, 0, sizeof(pid_cont));
+	struct dvb_mpeg_ts_stats *stats;
+	unsigned long long *found = NULL, wait, resyncs = 0;
+	unsigned char buffer[BUFLEN + DVB_MPEG_TS_PACKET_SIZE];
+	size_t len = 0;
+	int i, first = 1, last = 0, err = 0;
+
+	stats = malloc(sizeof(*stats));
+	if (args->search)
+		found = calloc(DVB_MPEG_TS_NUM_PIDS + 1, sizeof(*found));
+	if (!stats || (args->search && !found)) {
+		ERROR("out of memory");
+		free(stats);
+		return -1;
+	}
+	dvb_mpeg_ts_stats_reset(stats);
 
 	args->exit_after_tuning = 1;
 	check_frontend(args, parms);
 
 	dvr_fd = dvb_dev_open(dvb, args->dvr_dev, O_RDONLY);
-	if (!dvr_fd)
-		return -1;
+	if (!dvr_fd) {
+		err = -1;
+		goto free_stats;
+	}
 
 	fprintf(stderr, _("dvb_dev_set_bufsize: buffer set to %d\n"), DVB_BUF_SIZE);
 	dvb_dev_set_bufsize(dvr_fd, DVB_BUF_SIZE);
@@ -788,7 +1281,8 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
 	if (!fd) {
 		dvb_dev_close(dvr_fd);
-		return -1;
+		err = -1;
+		goto free_stats;
 	}
 
 	if (args->silent < 2)
@@ -797,12 +1291,14 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 				      DMX_OUT_TS_TAP, 0) < 0) {
 		dvb_dev_close(dvr_fd);
 		dvb_dev_close(fd);
-		return -1;
+		err = -1;
+		goto free_stats;
 	}
 
 	if (clock_gettime(CLOCK_MONOTONIC, &startt)) {
 		fprintf(stderr, _("Can't get timespec\n"));
-                return -1;
+		err = -1;
+		goto close_devs;
 	}
 
 	wait = 1000;
@@ -810,20 +1306,21 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 	monitor_log(_("%.2fs: Starting capture\n"));
 	while (1) {
 		struct timespec *elapsed;
-		unsigned char buffer[BUFLEN];
-		int pid, ok, diff;
-		ssize_t r;
+		int pid, diff;
+		ssize_t r, done;
 
 		if (timeout_flag)
 			break;
 
-		if ((r = dvb_dev_read(dvr_fd, buffer, BUFLEN)) <= 0) {
+		if ((r = dvb_dev_read(dvr_fd, buffer + len, BUFLEN)) <= 0) {
 			if (r == -EOVERFLOW) {
 				monitor_log(_("%.2fs: buffer overrun\n"));
 				continue;
 			}
-			monitor_log(_("%.2fs: read() returned error %zd\n"), r);
-			break;
+			if (r < 0 || !args->ts_file) {
+				monitor_log(_("%.2fs: read() returned error %zd\n"), r);
+				break;
+			}
 		}
 
 		/*
@@ -839,117 +1336,67 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 			first = 0;
 		}
 		if (out_fd >= 0) {
-			if (write(out_fd, buffer, r) < 0) {
+			if (write(out_fd, buffer + len, r) < 0) {
 				PERROR(_("Write failed"));
 				break;
 			}
 		}
 		if (r != BUFLEN) {
-			monitor_log(_("%.2fs: only read %zd bytes\n"), r);
-			break;
-		}
-
-		for (i = 0; i < BUFLEN; i += 188) {
-			struct dvb_ts_packet_header *h = (void *)&buffer[i];
-			if (h->sync_byte != 0x47) {
-				monitor_log(_("%.2fs: invalid sync byte. Discarding %zd bytes\n"), r);
-				continue;
+			if (!args->ts_file) {
+				monitor_log(_("%.2fs: only read %zd bytes\n"), r);
+				break;
 			}
+			/* The end of a recorded MPEG-TS: show the totals */
+			last = 1;
+		}
+		len += r;
 
-			bswap16(h->bitfield);
-
-#if 0
-			/*
-			 * ITU-T Rec. H.222.0 decoders shall discard Transport
-			 * Stream packets with the adaptation_field_control
-			 * field set to a value of '00' (invalid). Packets with
-			 * a value of '01' are NULL packets. Yet, as those are
-			 * actually part of the stream, we won't be discarding,
-			 * as we want to take them into account for traffic
-			 * estimation purposes.
-			 */
-			if (h->adaptation_field_control == 0)
-				continue;
-#endif
-			ok = 1;
-			pid = h->pid;
+		/*
+		 * Don't check continuity errors on the first second, as the
+		 * frontend is still starting streaming.
+		 */
+		done = dvb_mpeg_ts_stats_update(stats, buffer, len, wait >= 2000);
+		if (stats->resyncs != resyncs) {
+			monitor_log(_("%.2fs: invalid sync byte. Discarded %llu bytes so far\n"),
+				    (unsigned long long)stats->discarded);
+			resyncs = stats->resyncs;
+		}
 
-			if (pid > 0x1fff) {
-				monitor_log(_("%.2fs: invalid pid: 0x%04x\n"),
-					    pid);
-				pid = 0x1fff;
-			}
+		if (args->search) {
+			int sl = strlen(args->search);
 
-			/*
-			 * After 1 second of processing, check if are there
-			 * any issues with regards to frame continuity for
-			 * non-NULL packets.
-			 *
-			 * According to ITU-T H.222.0 | ISO/IEC 13818-1, the
-			 * continuity counter isn't incremented if the packet
-			 * is 00 or 10. It is only incremented on odd values.
-			 *
-			 * Also, don't check continuity errors on the first
-			 * second, as the frontend is still starting streaming
-			 */
-			if (pid < 0x1fff && h->adaptation_field_control & 1) {
-				int discontinued = 0;
-
-				if (h->adaptation_field_control & 2) {
-					if (h->adaptation_field_length >= 1) {
-						discontinued = h->discontinued;
-					} else {
-						monitor_log(_("%.2fs: pid %d has adaption layer, but size is too small!\n"),
-							    pid);
-					}
-				}
+			for (i = 0; i + DVB_MPEG_TS_PACKET_SIZE <= done;
+			     i += DVB_MPEG_TS_PACKET_SIZE) {
+				const unsigned char *p = buffer + i;
 
-				if (wait < 2000)
-					discontinued = 1;
-
-				if (!discontinued && pid_cont[pid] >= 0) {
-					unsigned int next = (pid_cont[pid] + 1) % 16;
-					if (next != h->continuity_counter) {
-						monitor_log(_("%.2fs: pid %d, expecting %d received %d\n"),
-							    pid, next,
-							    h->continuity_counter);
-						discontinued = 1;
-						cont_err++;
-						err_cnt[pid]++;
-					}
+				if (p[0] != DVB_MPEG_TS) {
+					i -= DVB_MPEG_TS_PACKET_SIZE - 1;
+					continue;
 				}
-				if (discontinued)
-					pid_cont[pid] = -1;
-				else
-					pid_cont[pid] = h->continuity_counter;
-			}
-
-			if (args->search) {
-				int i, sl = strlen(args->search);
-				ok = 0;
-				if (pid != 0x1fff) {
-					for (i = 0; i < (188 - sl); ++i) {
-						if (!memcmp((char *)h + i, args->search, sl))
-							ok = 1;
-					}
+				pid = (p[1] & 0x1f) << 8 | p[2];
+				if (pid != DVB_MPEG_TS_NULL_PID &&
+				    memmem(p, DVB_MPEG_TS_PACKET_SIZE - 1, args->search, sl)) {
+					found[pid]++;
+					found[DVB_MPEG_TS_NUM_PIDS]++;
 				}
 			}
-
-			if (ok) {
-				pidt[pid]++;
-				pidt[0x2000]++;
-			}
 		}
 
+		len -= done;
+		memmove(buffer, buffer + done, len);
+
 		elapsed = elapsed_time(&startt);
 		if (!elapsed)
 			diff = wait;
 		else
 			diff = (unsigned long long)elapsed->tv_sec * 1000
 				+ elapsed->tv_nsec * 1000 / NANO_SECONDS_IN_SEC;
+		if (!diff)
+			diff = 1;
 
-		if (diff > wait) {
+		if (diff > wait || last) {
 			unsigned long long other_pidt = 0, other_err_cnt = 0;
+			unsigned long long total = found ? found[DVB_MPEG_TS_NUM_PIDS] : stats->packets;
 
 			if (isatty(STDOUT_FILENO))
 				printf("\x1b[1H\x1b[2J");
@@ -957,24 +1404,31 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 			args->n_status_lines = 0;
 			printf(_(" PID           FREQ         SPEED       TOTAL\n"));
 			int _pid = 0;
-			for (_pid = 0; _pid < 0x2000; _pid++) {
-				if (pidt[_pid]) {
-					if (args->low_traffic && (pidt[_pid] * 1000. / diff) < args->low_traffic) {
-						other_pidt += pidt[_pid];
-						other_err_cnt += err_cnt[_pid];
+			for (_pid = 0; _pid < DVB_MPEG_TS_NUM_PIDS; _pid++) {
+				unsigned long long packets = found ? found[_pid] : stats->pid[_pid].packets;
+				unsigned long long cc_errors = stats->pid[_pid].cc_errors;
+				unsigned long long tei_errors = stats->pid[_pid].tei_errors;
+
+				if (packets) {
+					if (args->low_traffic && (packets * 1000. / diff) < args->low_traffic) {
+						other_pidt += packets;
+						other_err_cnt += cc_errors;
 						continue;
 					}
 					printf("%5d %9.2f p/s %sbps ",
 						_pid,
-						pidt[_pid] * 1000. / diff,
-						print_bytes(pidt[_pid] * 1000. * 8 * 188/ diff));
-					if (pidt[_pid] * 188 / 1024)
-						printf("%8llu KB", (pidt[_pid] * 188 + 512) / 1024);
+						packets * 1000. / diff,
+						print_bytes(packets * 1000. * 8 * 188/ diff));
+					if (packets * 188 / 1024)
+						printf("%8llu KB", (packets * 188 + 512) / 1024);
 					else
-						printf(" %8llu B", pidt[_pid] * 188);
-					if (err_cnt[_pid] > 0)
+						printf(" %8llu B", packets * 188);
+					if (cc_errors > 0)
 						printf(" %8llu continuity errors",
-						       err_cnt[_pid]);
+						       cc_errors);
+					if (tei_errors > 0)
+						printf(" %8llu transport errors",
+						       tei_errors);
 
 					printf("\n");
 				}
@@ -994,24 +1448,508 @@ int do_traffic_monitor(struct arguments *args, struct dvb_device *dvb,
 				printf("\n");
 			}
 
-			/* 0x2000 is the total traffic */
 			printf("TOT %11.2f p/s %sbps %8llu KB\n",
-				pidt[_pid] * 1000. / diff,
-				print_bytes(pidt[_pid] * 1000. * 8 * 188/ diff),
-				(pidt[_pid] * 188 + 512) / 1024);
+				total * 1000. / diff,
+				print_bytes(total * 1000. * 8 * 188/ diff),
+				(total * 188 + 512) / 1024);
 			printf("\n");
 			get_show_stats(stdout, args, parms, 0);
 			wait += 1000;
-			if (cont_err)
-				printf("CONTINUITY errors: %llu\n", cont_err);
+			if (stats->cc_errors)
+				printf("CONTINUITY errors: %llu\n",
+				       (unsigned long long)stats->cc_errors);
+			if (stats->tei_errors)
+				printf("TRANSPORT errors: %llu\n",
+				       (unsigned long long)stats->tei_errors);
 		}
+		if (last)
+			break;
 	}
 	monitor_log(_("%.2fs: Stopping capture\n"));
+close_devs:
 	dvb_dev_close(dvr_fd);
 	dvb_dev_close(fd);
+free_stats:
+	free(stats);
+	free(found);
+	return err;
+}
+
+/*
+ * Split recording: all services are on the same transponder, so it is
+ * tuned once and the DVR gets the PIDs of all of them. Each TS packet read
+ * is then copied to the outputs of the services using its PID, found on a
+ * per-PID bitmask of outputs. As the original PAT lists all services of
+ * the transponder, each output has its own PAT, with just its service.
+ */
+
+#define MAX_SPLIT_OUTPUTS	32
+
+struct split_output {
+	const char *channel;
+	const struct dvb_entry *entry;
+	int fd;
+	int pmt_pid;
+	unsigned char pat[188];
+	unsigned char pat_cc;
+	size_t len;
+	unsigned char buf[BUFLEN];
+};
+
+static char *split_filename(const char *template, const char *channel)
+{
+	const char *p = strstr(template, "%s");
+	char *name, *c;
+
+	if (asprintf(&name, "%.*s%s%s", (int)(p - template), template,
+		     channel, p + 2) < 0)
+		return NULL;
+
+	/* The channel name is used as part of the file name */
+	for (c = name + (p - template); c < name + (p - template) + strlen(channel); c++)
+		if (*c == '/')
+			*c = '_';
+
+	return name;
+}
+
+/* All PIDs are passed by a single demux filter, set at once */
+struct split_pids {
+	uint32_t *outputs;
+	uint16_t *pids;
+	unsigned num_pids;
+};
+
+static void split_add_pid(struct split_pids *p, int pid, int output)
+{
+	if (pid <= 0 || pid >= 0x1fff)
+		return;
+
+	if (!p->outputs[pid])
+		p->pids[p->num_pids++] = pid;
+	p->outputs[pid] |= 1U << output;
+}
+
+/* Record the PMT and all elementary streams of the service */
+static void split_add_service(struct split_pids *p, struct split_output *out,
+			      int output)
+{
+	const struct dvb_entry *entry = out->entry;
+	int i;
+
+	split_add_pid(p, out->pmt_pid, output);
+	for (i = 0; i < entry->video_pid_len; i++)
+		split_add_pid(p, entry->video_pid[i], output);
+	for (i = 0; i < entry->audio_pid_len; i++)
+		split_add_pid(p, entry->audio_pid[i], output);
+	for (i = 0; i < entry->other_el_pid_len; i++)
+		split_add_pid(p, entry->other_el_pid[i].pid, output);
+}
+
+static int split_flush(struct split_output *out)
+{
+	if (out->len && write(out->fd, out->buf, out->len) < 0) {
+		PERROR(_("Write failed"));
+		return -1;
+	}
+	out->len = 0;
+
 	return 0;
 }
 
+static int split_write(struct split_output *out, const unsigned char *pkt)
+{
+	if (out->len + 188 > sizeof(out->buf) && split_flush(out) < 0)
+		return -1;
+	memcpy(out->buf + out->len, pkt, 188);
+	out->len += 188;
+
+	return 0;
+}
+
+/* Build a single packet PAT with just the service of the output */
+static void split_build_pat(struct split_output *out,
+			    struct dvb_table_pat *pat)
+{
+	unsigned char *sec = out->pat + 5;
+	uint32_t crc;
+
+	memset(out->pat, 0xff, sizeof(out->pat));
+	out->pat[0] = 0x47;
+	out->pat[1] = 0x40;		/* payload unit start, PID 0 */
+	out->pat[2] = 0x00;
+	out->pat[4] = 0x00;		/* pointer field */
+
+	sec[0] = DVB_TABLE_PAT;
+	sec[1] = 0xb0;			/* syntax, section length of 13 */
+	sec[2] = 13;
+	sec[3] = pat->header.id >> 8;
+	sec[4] = pat->header.id & 0xff;
+	sec[5] = 0xc1 | pat->header.version << 1;
+	sec[6] = 0;
+	sec[7] = 0;
+	sec[8] = out->entry->service_id >> 8;
+	sec[9] = out->entry->service_id & 0xff;
+	sec[10] = 0xe0 | out->pmt_pid >> 8;
+	sec[11] = out->pmt_pid & 0xff;
+
+	crc = dvb_crc32(sec, 12, 0xFFFFFFFF);
+	sec[12] = crc >> 24;
+	sec[13] = crc >> 16;
+	sec[14] = crc >> 8;
+	sec[15] = crc;
+}
+
+/* Rebuild the PATs of the outputs, if the PAT changed. Returns 1 if they are valid */
+static int split_parse_pat(struct dvb_v5_fe_parms *parms,
+			   struct split_output *out, int n_out,
+			   const unsigned char *pkt,
+			   unsigned char *last_pat, size_t *last_pat_len)
+{
+	struct dvb_table_pat *pat = NULL;
+	const unsigned char *p = pkt + 4, *sec;
+	size_t len;
+	int i;
+
+	if (!(pkt[1] & 0x40) || !(pkt[3] & 0x10))
+		return *last_pat_len != 0;
+	if (pkt[3] & 0x20)
+		p += 1 + p[0];
+	if (p >= pkt + 188 || p + 1 + p[0] + 3 > pkt + 188)
+		return *last_pat_len != 0;
+
+	/* Only a PAT that fits into one packet is supported */
+	sec = p + 1 + p[0];
+	len = 3 + (((sec[1] & 0x0f) << 8) | sec[2]);
+	if (sec + len > pkt + 188)
+		return *last_pat_len != 0;
+
+	if (len == *last_pat_len && !memcmp(sec, last_pat, len))
+		return 1;
+
+	if (dvb_table_pat_init(parms, sec, len, &pat) < 0) {
+		dvb_table_pat_free(pat);
+		return *last_pat_len != 0;
+	}
+	for (i = 0; i < n_out; i++)
+		split_build_pat(&out[i], pat);
+	dvb_table_pat_free(pat);
+
+	memcpy(last_pat, sec, len);
+	*last_pat_len = len;
+
+	return 1;
+}
+
+static int do_split_record(struct arguments *args, struct dvb_device *dvb,
+			   struct dvb_file *dvb_file, char **channels,
+			   int n_channels)
+{
+	struct dvb_v5_fe_parms *parms = dvb->fe_parms;
+	struct dvb_open_descriptor *dvr_fd, *sid_fd;
+	struct dvb_file_index *index = NULL;
+	struct split_output *out;
+	unsigned char buffer[BUFLEN + 188], last_pat[188];
+	size_t last_pat_len = 0, len = 0, pos;
+	struct split_pids pids = { NULL, NULL, 0 };
+	uint32_t freq, f, mask;
+	int i, pid, first = 1, err = -1;
+	ssize_t r;
+
+	if (n_channels > MAX_SPLIT_OUTPUTS) {
+		ERROR("can't record more than %d services at once", MAX_SPLIT_OUTPUTS);
+		return -1;
+	}
+
+	out = calloc(n_channels, sizeof(*out));
+	pids.outputs = calloc(0x2000, sizeof(*pids.outputs));
+	pids.pids = calloc(0x2000, sizeof(*pids.pids));
+	index = dvb_file_index_alloc(dvb_file);
+	if (!out || !pids.outputs || !pids.pids || !index) {
+		ERROR("out of memory");
+		goto err;
+	}
+	for (i = 0; i < n_channels; i++)
+		out[i].fd = -1;
+
+	sid_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
+	if (!sid_fd) {
+		ERROR("opening sid demux failed");
+		goto err;
+	}
+
+	freq = 0;
+	for (i = 0; i < n_channels; i++) {
+		struct dvb_entry *entry;
+		char *filename;
+
+		entry = dvb_file_find_channel(index, channels[i]);
+		if (!entry) {
+			ERROR("Can't find channel %s", channels[i]);
+			break;
+		}
+		dvb_retrieve_entry_prop(entry, DTV_FREQUENCY, &f);
+		if (i && f != freq) {
+			ERROR("channel %s is not on the same transponder as %s",
+			      channels[i], channels[0]);
+			break;
+		}
+		freq = f;
+
+		out[i].channel = channels[i];
+		out[i].entry = entry;
+		out[i].pmt_pid = dvb_dev_dmx_get_pmt_pid(sid_fd, entry->service_id);
+		if (out[i].pmt_pid <= 0) {
+			fprintf(stderr, _("couldn't find pmt-pid for sid %04x\n"),
+				entry->service_id);
+			break;
+		}
+
+		filename = split_filename(args->filename, channels[i]);
+		if (!filename) {
+			ERROR("out of memory");
+			break;
+		}
+		out[i].fd = open(filename, O_LARGEFILE | O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out[i].fd < 0) {
+			PERROR(_("open of '%s' failed"), filename);
+			free(filename);
+			break;
+		}
+		if (args->silent < 2)
+			fprintf(stderr, _("recording %s (service %d) to '%s'\n"),
+				channels[i], entry->service_id, filename);
+		free(filename);
+
+		split_add_service(&pids, &out[i], i);
+	}
+	dvb_dev_close(sid_fd);
+	if (i < n_channels)
+		goto err;
+
+	/* The PAT is rebuilt for each output, instead of copied */
+	pids.pids[pids.num_pids++] = 0;
+
+	sid_fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
+	if (!sid_fd) {
+		ERROR("opening demux failed");
+		goto err;
+	}
+	if (args->silent < 2)
+		fprintf(stderr, _("  dvb_dev_dmx_set_pids: %d PIDs\n"),
+			pids.num_pids);
+	if (dvb_dev_dmx_set_pids(sid_fd, pids.pids, pids.num_pids,
+				 DMX_OUT_TS_TAP, 64 * 1024) < 0)
+		goto err;
+
+	if (!check_frontend(args, parms)) {
+		fprintf(stderr, _("frontend doesn't lock\n"));
+		goto err;
+	}
+
+	dvr_fd = dvb_dev_open(dvb, args->dvr_dev, O_RDONLY);
+	if (!dvr_fd) {
+		ERROR("failed opening '%s'", args->dvr_dev);
+		goto err;
+	}
+	set_dvr_bufsize(args, dvr_fd);
+
+	if (!timeout_flag)
+		fprintf(stderr, _("Record of %d services started\n"), n_channels);
+
+	err = 0;
+	while (!timeout_flag) {
+		r = dvb_dev_read(dvr_fd, buffer + len, BUFLEN);
+		if (r < 0) {
+			if (r == -EOVERFLOW) {
+				fprintf(stderr, _("buffer overrun\n"));
+				continue;
+			}
+			ERROR("Read failed");
+			err = -1;
+			break;
+		}
+
+		/* See copy_to_file() */
+		if (first) {
+			if (args->timeout > 0)
+				alarm(args->timeout);
+			first = 0;
+		}
+
+		len += r;
+		pos = 0;
+		while (pos + 188 <= len) {
+			const unsigned char *pkt = buffer + pos;
+
+			/* Resync, if the stream lost a few bytes */
+			if (pkt[0] != 0x47) {
+				pos++;
+				continue;
+			}
+			pos += 188;
+
+			pid = (pkt[1] & 0x1f) << 8 | pkt[2];
+			if (pid == 0) {
+				if (!split_parse_pat(parms, out, n_channels, pkt,
+						     last_pat, &last_pat_len))
+					continue;
+				for (i = 0; i < n_channels; i++) {
+					out[i].pat[3] = 0x10 | out[i].pat_cc;
+					out[i].pat_cc = (out[i].pat_cc + 1) & 0x0f;
+					if (split_write(&out[i], out[i].pat) < 0)
+						err = -1;
+				}
+				continue;
+			}
+
+			for (mask = pids.outputs[pid], i = 0; mask; mask >>= 1, i++)
+				if ((mask & 1) && split_write(&out[i], pkt) < 0)
+					err = -1;
+		}
+		len -= pos;
+		memmove(buffer, buffer + pos, len);
+
+		if (err < 0)
+			break;
+	}
+
+	for (i = 0; i < n_channels; i++)
+		if (split_flush(&out[i]) < 0)
+			err = -1;
+
+err:
+	if (out) {
+		for (i = 0; i < n_channels; i++)
+			if (out[i].fd >= 0)
+				close(out[i].fd);
+	}
+	free(out);
+	free(pids.outputs);
+	free(pids.pids);
+	dvb_file_index_free(index);
+
+	return err;
+}
+
+/*
+ * Fast zap: the PMT PID of each service is kept on a cache file, with one
+ * "<frequency> <service ID> <PMT PID>" line per service, so the filters
+ * can be set without waiting for the PAT. The PAT is still read in
+ * background, to fix the filter and the cache if the PMT PID changed.
+ */
+
+static int pmt_cache_get(const char *fname, uint32_t freq, uint16_t sid)
+{
+	unsigned f, s, pid;
+	int pmt_pid = 0;
+	FILE *fp;
+
+	fp = fopen(fname, "r");
+	if (!fp)
+		return 0;
+	while (fscanf(fp, "%u %u %u", &f, &s, &pid) == 3) {
+		if (f == freq && s == sid) {
+			pmt_pid = pid;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return pmt_pid;
+}
+
+static void pmt_cache_put(const char *fname, uint32_t freq, uint16_t sid,
+			  int pmt_pid)
+{
+	unsigned f, s, pid;
+	char *tmpname;
+	FILE *fp, *out;
+
+	if (asprintf(&tmpname, "%s.%d", fname, getpid()) < 0)
+		return;
+	out = fopen(tmpname, "w");
+	if (!out) {
+		free(tmpname);
+		return;
+	}
+
+	fp = fopen(fname, "r");
+	if (fp) {
+		while (fscanf(fp, "%u %u %u", &f, &s, &pid) == 3)
+			if (f != freq || s != sid)
+				fprintf(out, "%u %u %u\n", f, s, pid);
+		fclose(fp);
+	}
+	fprintf(out, "%u %u %u\n", freq, sid, pmt_pid);
+
+	if (fclose(out) || rename(tmpname, fname))
+		unlink(tmpname);
+	free(tmpname);
+}
+
+struct pmt_check {
+	struct arguments *args;
+	struct dvb_open_descriptor *sid_fd, *pmt_fd;
+	uint32_t freq;
+	uint16_t sid;
+	int pmt_pid;
+	pthread_t thread;
+	int running;
+};
+
+static void *pmt_check_thread(void *privdata)
+{
+	struct pmt_check *check = privdata;
+	struct arguments *args = check->args;
+	int pmt_pid;
+
+	pmt_pid = dvb_dev_dmx_get_pmt_pid(check->sid_fd, check->sid);
+	if (pmt_pid <= 0 || pmt_pid == check->pmt_pid)
+		return NULL;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	if (args->silent < 2)
+		fprintf(stderr, _("pmt pid changed from %d to %d\n"),
+			check->pmt_pid, pmt_pid);
+	dvb_dev_dmx_stop(check->pmt_fd);
+	dvb_dev_dmx_set_pesfilter(check->pmt_fd, pmt_pid, DMX_PES_OTHER,
+				  args->dvr ? DMX_OUT_TS_TAP : DMX_OUT_DECODER,
+				  args->dvr ? 64 * 1024 : 0);
+	pmt_cache_put(args->pmt_cache, check->freq, check->sid, pmt_pid);
+
+	return NULL;
+}
+
+static void start_pmt_check(struct pmt_check *check)
+{
+	sigset_t set, oldset;
+	int r;
+
+	/* Let the signals go to the main thread */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	r = pthread_create(&check->thread, NULL, pmt_check_thread, check);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (r) {
+		errno = r;
+		PERROR(_("Can't start the PMT check thread"));
+		return;
+	}
+	check->running = 1;
+}
+
+static void stop_pmt_check(struct pmt_check *check)
+{
+	if (!check->running)
+		return;
+
+	/* It may still be waiting for the PAT */
+	pthread_cancel(check->thread);
+	pthread_join(check->thread, NULL);
+	check->running = 0;
+}
+
 static void set_signals(struct arguments *args)
 {
 	signal(SIGTERM, do_timeout);
@@ -1024,6 +1962,63 @@ static void set_signals(struct arguments *args)
 
 static char *default_dvr_pipe = "/tmp/dvr-pipe";
 
+/* When recording, all extra PIDs are passed by a single demux filter */
+static int set_extra_pids(struct arguments *args, struct dvb_device *dvb,
+			  const struct dvb_entry *entry)
+{
+	struct dvb_open_descriptor *fd;
+	uint16_t *pids;
+	unsigned num_pids = 0;
+	int i, ret;
+
+	pids = malloc((entry->video_pid_len + entry->audio_pid_len +
+		       entry->other_el_pid_len) * sizeof(*pids));
+	if (!pids) {
+		ERROR("out of memory");
+		return -1;
+	}
+
+	for (i = 0; i < entry->video_pid_len; i++) {
+		if (i == args->n_vpid)
+			continue;
+		if (args->silent < 2)
+			fprintf(stderr, _("video+ pid %d\n"), entry->video_pid[i]);
+		pids[num_pids++] = entry->video_pid[i];
+	}
+	for (i = 0; i < entry->audio_pid_len; i++) {
+		if (i == args->n_apid)
+			continue;
+		if (args->silent < 2)
+			fprintf(stderr, _("audio+ pid %d\n"), entry->audio_pid[i]);
+		pids[num_pids++] = entry->audio_pid[i];
+	}
+	for (i = 0; i < entry->other_el_pid_len; i++) {
+		if (args->silent < 2)
+			fprintf(stderr, _("other pid %d (%d)\n"),
+				entry->other_el_pid[i].pid,
+				entry->other_el_pid[i].type);
+		pids[num_pids++] = entry->other_el_pid[i].pid;
+	}
+
+	if (!num_pids) {
+		free(pids);
+		return 0;
+	}
+
+	fd = dvb_dev_open(dvb, args->demux_dev, O_RDWR);
+	if (!fd) {
+		ERROR("failed opening '%s'", args->demux_dev);
+		free(pids);
+		return -1;
+	}
+
+	ret = dvb_dev_dmx_set_pids(fd, pids, num_pids, DMX_OUT_TS_TAP,
+				   64 * 1024);
+	free(pids);
+
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	struct arguments args = {};
@@ -1036,6 +2031,8 @@ int main(int argc, char **argv)
 	struct dvb_open_descriptor *pat_fd = NULL, *pmt_fd = NULL;
 	struct dvb_open_descriptor *sdt_fd = NULL;
 	struct dvb_open_descriptor *sid_fd = NULL, *dvr_fd = NULL;
+	struct pmt_check pmt_check = {};
+	uint32_t freq = 0;
 	int file_fd = -1;
 	int err = -1;
 	int r, ret;
@@ -1046,7 +2043,7 @@ int main(int argc, char **argv)
 		.options = options,
 		.parser = parse_opt,
 		.doc = N_("DVB zap utility"),
-		.args_doc = N_("<channel name> [or <frequency> if in monitor mode]"),
+		.args_doc = N_("<channel name> [or <frequency> if in monitor mode] [<channel name>... if in split mode]"),
 	};
 
 #ifdef ENABLE_NLS
@@ -1080,6 +2077,18 @@ int main(int argc, char **argv)
 		return -1;
 	}
 
+	if (args.stream && (args.filename || args.split)) {
+		ERROR("can't stream and record to a file at the same time");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
+	if (args.split && (!args.filename || !strstr(args.filename, "%s"))) {
+		ERROR("split recording needs an output filename with a %%s\n");
+		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
+		return -1;
+	}
+
 	if (!args.traffic_monitor && args.search) {
 		ERROR("search string can be used only on monitor mode\n");
 		argp_help(&argp, stderr, ARGP_HELP_STD_HELP, PROGRAM_NAME);
@@ -1107,6 +2116,13 @@ int main(int argc, char **argv)
 		ret = dvb_dev_remote_init(dvb, args.server, args.port);
 		if (ret < 0)
 			return -1;
+	} else if (args.ts_file) {
+		ret = dvb_dev_file_init(dvb, args.ts_file);
+		if (ret < 0)
+			return -1;
+		args.adapter = 0;
+		args.demux = 0;
+		args.frontend = 0;
 	}
 
 	dvb_dev_set_log(dvb, args.verbose, NULL);
@@ -1146,6 +2162,15 @@ int main(int argc, char **argv)
 	}
 	fprintf(stderr, _("reading channels from file '%s'\n"), args.confname);
 
+	/* The background PMT check needs its own demux, not a remote one */
+	if ((args.server && args.port) || args.ts_file)
+		args.fast_zap = 0;
+	if (args.fast_zap && !args.pmt_cache) {
+		if (!homedir)
+			ERROR("$HOME not set");
+		r = asprintf(&args.pmt_cache, "%s/.tzap/pmt_cache", homedir);
+	}
+
 	dvb_dev = dvb_dev_seek_by_adapter(dvb, args.adapter, args.frontend,
 					  DVB_DEVICE_FRONTEND);
 	if (!dvb_dev)
@@ -1158,6 +2183,7 @@ int main(int argc, char **argv)
 	if (args.sat_number >= 0)
 		parms->sat_number = args.sat_number;
 	parms->diseqc_wait = args.diseqc_wait;
+	parms->diseqc_settle = args.diseqc_settle;
 	parms->freq_bpf = args.freq_bpf;
 	parms->lna = args.lna;
 
@@ -1178,6 +2204,13 @@ int main(int argc, char **argv)
 		goto err;
 	}
 
+	if (args.split) {
+		set_signals(&args);
+		err = do_split_record(&args, dvb, dvb_file, &argv[idx],
+				      argc - idx);
+		goto err;
+	}
+
 	if (args.traffic_monitor) {
 		if (args.filename) {
 			file_fd = open(args.filename,
@@ -1200,8 +2233,23 @@ int main(int argc, char **argv)
 			ERROR("opening sid demux failed");
 			return -1;
 		}
-		pmtpid = dvb_dev_dmx_get_pmt_pid(sid_fd, dvb_entry->service_id);
-		dvb_dev_close(sid_fd);
+		dvb_fe_retrieve_parm(parms, DTV_FREQUENCY, &freq);
+		if (args.fast_zap)
+			pmtpid = pmt_cache_get(args.pmt_cache, freq,
+					       dvb_entry->service_id);
+		if (pmtpid > 0) {
+			pmt_check.args = &args;
+			pmt_check.sid_fd = sid_fd;
+			pmt_check.freq = freq;
+			pmt_check.sid = dvb_entry->service_id;
+			pmt_check.pmt_pid = pmtpid;
+		} else {
+			pmtpid = dvb_dev_dmx_get_pmt_pid(sid_fd, dvb_entry->service_id);
+			dvb_dev_close(sid_fd);
+			if (args.fast_zap && pmtpid > 0)
+				pmt_cache_put(args.pmt_cache, freq,
+					      dvb_entry->service_id, pmtpid);
+		}
 		if (pmtpid <= 0) {
 			fprintf(stderr, _("couldn't find pmt-pid for sid %04x\n"),
 				dvb_entry->service_id);
@@ -1227,6 +2275,10 @@ int main(int argc, char **argv)
 				args.dvr ? DMX_OUT_TS_TAP : DMX_OUT_DECODER,
 				args.dvr ? 64 * 1024 : 0) < 0)
 			goto err;
+		if (pmt_check.sid_fd) {
+			pmt_check.pmt_fd = pmt_fd;
+			start_pmt_check(&pmt_check);
+		}
 
 		/*
 		 * SDT may also be needed in order to play some streams
@@ -1277,7 +2329,7 @@ int main(int argc, char **argv)
 			}
 
 			for (int i = 0; i < dvb_entry->video_pid_len; i++) {
-				if (!args.extra_pids && i != args.n_vpid) {
+				if (i != args.n_vpid && (!args.extra_pids || args.dvr)) {
 					continue;
 				}
 
@@ -1301,7 +2353,7 @@ int main(int argc, char **argv)
 			}
 
 			for (int i = 0; i < dvb_entry->audio_pid_len; i++) {
-				if (!args.extra_pids && i != args.n_apid) {
+				if (i != args.n_apid && (!args.extra_pids || args.dvr)) {
 					continue;
 				}
 
@@ -1325,7 +2377,10 @@ int main(int argc, char **argv)
 			}
 		}
 
-		if (args.extra_pids && dvb_entry->other_el_pid_len) {
+		if (args.extra_pids && args.dvr) {
+			if (set_extra_pids(&args, dvb, dvb_entry) < 0)
+				goto err;
+		} else if (args.extra_pids && dvb_entry->other_el_pid_len) {
 			for (int i = dvb_entry->other_el_pid_len - 1; i >= 0; i--) {
 				struct dvb_open_descriptor * other_fd = dvb_dev_open(dvb, args.demux_dev, O_RDWR);
 				if (!other_fd) {
@@ -1381,12 +2436,29 @@ int main(int argc, char **argv)
 		if (args.silent < 2)
 			get_show_stats(stderr, &args, parms, 0);
 
-		if (file_fd >= 0) {
+		if (args.stream) {
+			struct stream_out stream;
+
+			if (stream_open(&args, &stream) < 0)
+				goto err;
+			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
+			if (!dvr_fd) {
+				ERROR("failed opening '%s'", args.dvr_dev);
+				close(stream.fd);
+				goto err;
+			}
+			set_dvr_bufsize(&args, dvr_fd);
+			if (!timeout_flag)
+				fprintf(stderr, _("Streaming to '%s' started\n"), args.stream);
+			stream_to_network(dvr_fd, &stream, args.timeout, args.silent);
+			close(stream.fd);
+		} else if (file_fd >= 0) {
 			dvr_fd = dvb_dev_open(dvb, args.dvr_dev, O_RDONLY);
 			if (!dvr_fd) {
 				ERROR("failed opening '%s'", args.dvr_dev);
 				goto err;
 			}
+			set_dvr_bufsize(&args, dvr_fd);
 			if (!timeout_flag)
 				fprintf(stderr, _("Record to file '%s' started\n"), args.filename);
 			copy_to_file(dvr_fd, file_fd, args.timeout, args.silent);
@@ -1415,6 +2487,7 @@ int main(int argc, char **argv)
 				err = -1;
 				goto err;
 			}
+			set_dvr_bufsize(&args, dvr_fd);
 
 			file_fd = open(args.dvr_pipe,
 #ifdef O_LARGEFILE
@@ -1447,6 +2520,7 @@ int main(int argc, char **argv)
 	err = 0;
 
 err:
+	stop_pmt_check(&pmt_check);
 	dvb_dev_free(dvb);
 
 	if (dvb_file) {
@@ -1470,6 +2544,8 @@ err:
 		free(args.server);
 	if (args.dvr_pipe != default_dvr_pipe)
 		free(args.dvr_pipe);
+	if (args.pmt_cache)
+		free(args.pmt_cache);
 
 	return err;
 }
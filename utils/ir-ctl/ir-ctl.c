@@ -14,6 +14,7 @@
  */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -25,6 +26,7 @@
 #include <fcntl.h>
 #include <argp.h>
 #include <sysexits.h>
+#include <time.h>
 
 #include <linux/lirc.h>
 
@@ -56,6 +58,8 @@
 
 /* See drivers/media/rc/lirc_dev.c line 22 */
 #define LIRCBUF_SIZE 1024
+/* Samples read at once when receiving */
+#define RECV_SAMPLES 4096
 #define IR_DEFAULT_TIMEOUT 125000
 #define UNSET UINT32_MAX
 
@@ -97,6 +101,7 @@ struct arguments {
 	bool receive;
 	bool verbose;
 	bool mode2;
+	bool binary;
 	struct keymap *keymap;
 	struct send *send;
 	bool oneshot;
@@ -109,9 +114,25 @@ struct arguments {
 	unsigned carrier;
 	unsigned duty;
 	unsigned emitters;
+	bool stream;
 	bool work_to_do;
+	// last send mode and carrier set on the device
+	int send_mode;
+	unsigned send_carrier;
 };
 
+/*
+ * Keycodes are encoded the first time they are sent, and the result is
+ * kept for sending them again.
+ */
+struct keycode_cache {
+	struct keycode_cache *next;
+	struct send *send;
+	char keycode[];
+};
+
+static struct keycode_cache *keycode_cache;
+
 static const struct argp_option options[] = {
 	{ "device",	'd',	N_("DEV"),	0,	N_("lirc device to use") },
 	{ "features",	'f',	0,		0,	N_("list lirc device features") },
@@ -123,6 +144,7 @@ static const struct argp_option options[] = {
 		{ .doc = N_("Receiving options:") },
 	{ "one-shot",	'1',	0,		0,	N_("end receiving after first message") },
 	{ "mode2",	2,	0,		0,	N_("output in mode2 format") },
+	{ "binary",	3,	0,		0,	N_("output the lirc mode2 samples as is") },
 	{ "wideband",	'w',	0,		0,	N_("use wideband receiver aka learning mode") },
 	{ "narrowband",	'n',	0,		0,	N_("use narrowband receiver, disable learning mode") },
 	{ "carrier-range", 'R', N_("RANGE"),	0,	N_("set receiver carrier range") },
@@ -135,6 +157,7 @@ static const struct argp_option options[] = {
 	{ "duty-cycle",	'D',	N_("DUTY"),	0,	N_("set send duty cycle") },
 	{ "emitters",	'e',	N_("EMITTERS"),	0,	N_("set send emitters") },
 	{ "gap",	'g',	N_("GAP"),	0,	N_("set gap between files or scancodes") },
+	{ "send-stdin",	4,	0,		0,	N_("send keycodes and scancodes read from stdin") },
 	{ }
 };
 
@@ -144,6 +167,7 @@ static const char args_doc[] = N_(
 	"--send [file to send]\n"
 	"--scancode [scancode to send]\n"
 	"--keycode [keycode to send]\n"
+	"--send-stdin\n"
 	"[to set lirc option]");
 
 static const char doc[] = N_(
@@ -592,13 +616,13 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 
 	switch (k) {
 	case 'f':
-		if (arguments->receive || arguments->send)
+		if (arguments->receive || arguments->send || arguments->stream)
 			argp_error(state, _("features can not be combined with receive or send option"));
 		arguments->features = true;
 		break;
 	// receiving
 	case 'r':
-		if (arguments->features || arguments->send)
+		if (arguments->features || arguments->send || arguments->stream)
 			argp_error(state, _("receive can not be combined with features or send option"));
 
 		arguments->receive = true;
@@ -613,8 +637,15 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		arguments->oneshot = true;
 		break;
 	case 2:
+		if (arguments->binary)
+			argp_error(state, _("cannot output in mode2 and binary format at once"));
 		arguments->mode2 = true;
 		break;
+	case 3:
+		if (arguments->mode2)
+			argp_error(state, _("cannot output in mode2 and binary format at once"));
+		arguments->binary = true;
+		break;
 	case 'v':
 		arguments->verbose = true;
 		break;
@@ -703,6 +734,12 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		add_to_send_list(arguments, s);
 		break;
 
+	case 4:
+		if (arguments->receive || arguments->features)
+			argp_error(state, _("send can not be combined with receive or features option"));
+		arguments->stream = true;
+		break;
+
 	case 'K':
 		if (arguments->receive || arguments->features)
 			argp_error(state, _("key send can not be combined with receive or features option"));
@@ -737,7 +774,7 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 		return ARGP_ERR_UNKNOWN;
 	}
 
-	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2)
+	if (k != '1' && k != 'd' && k != 'v' && k != 'k' && k != 2 && k != 3)
 		arguments->work_to_do = true;
 
 	return 0;
@@ -1040,11 +1077,23 @@ static void lirc_features(struct arguments *args, int fd, unsigned features)
 	}
 }
 
+static int lirc_set_send_mode(struct arguments *args, int fd, int mode)
+{
+	int rc;
+
+	if (mode == args->send_mode)
+		return 0;
+
+	rc = ioctl(fd, LIRC_SET_SEND_MODE, &mode);
+	args->send_mode = rc ? -1 : mode;
+	return rc;
+}
+
 static int lirc_send(struct arguments *args, int fd, unsigned features, struct send *f)
 {
 	const char *dev = args->device;
-	int rc, mode;
 	ssize_t ret;
+	int rc;
 
 	if (!(features & LIRC_CAN_SEND_PULSE)) {
 		fprintf(stderr, _("%s: device cannot send\n"), dev);
@@ -1056,8 +1105,7 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 			printf("Sending to kernel encoder protocol:%s scancode:0x%x\n",
 			       protocol_name(f->protocol), f->scancode);
 
-		mode = LIRC_MODE_SCANCODE;
-		rc = ioctl(fd, LIRC_SET_SEND_MODE, &mode);
+		rc = lirc_set_send_mode(args, fd, LIRC_MODE_SCANCODE);
 		if (rc == 0) {
 			struct lirc_scancode sc = {
 				.scancode = f->scancode,
@@ -1070,8 +1118,7 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 		}
 	}
 
-	mode = LIRC_MODE_PULSE;
-	rc = ioctl(fd, LIRC_SET_SEND_MODE, &mode);
+	rc = lirc_set_send_mode(args, fd, LIRC_MODE_PULSE);
 	if (rc) {
 		fprintf(stderr, _("%s: cannot set send mode\n"), dev);
 		return EX_UNAVAILABLE;
@@ -1087,14 +1134,21 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 		}
 		f->len = protocol_encode(f->protocol, f->scancode, f->buf);
 		f->carrier = protocol_carrier(proto);
+		// the device has no encoder, so send it as raw from now on
+		f->ty = SEND_RAW;
 	}
 
+	unsigned carrier = f->carrier;
+
 	if (args->carrier != UNSET) {
 		if (f->carrier != UNSET)
 			fprintf(stderr, _("warning: carrier specified but overwritten on command line\n"));
-		lirc_set_send_carrier(fd, dev, features, args->carrier);
-	} else if (f->carrier != UNSET)
-		lirc_set_send_carrier(fd, dev, features, f->carrier);
+		carrier = args->carrier;
+	}
+	if (carrier != UNSET && carrier != args->send_carrier) {
+		lirc_set_send_carrier(fd, dev, features, carrier);
+		args->send_carrier = carrier;
+	}
 
 	size_t size = f->len * sizeof(unsigned);
 	if (args->verbose) {
@@ -1123,10 +1177,150 @@ static int lirc_send(struct arguments *args, int fd, unsigned features, struct s
 	return 0;
 }
 
+static int send_keycode(struct arguments *args, int fd, unsigned features,
+			const char *keycode)
+{
+	struct keycode_cache *c;
+
+	if (!args->keymap) {
+		fprintf(stderr, _("error: no keymap specified\n"));
+		return EX_DATAERR;
+	}
+
+	for (c = keycode_cache; c; c = c->next)
+		if (!strcmp(c->keycode, keycode))
+			break;
+
+	if (!c) {
+		struct send *s = convert_keycode(args->keymap, keycode);
+
+		if (!s)
+			return EX_DATAERR;
+
+		c = malloc(sizeof(*c) + strlen(keycode) + 1);
+		if (!c) {
+			fprintf(stderr, _("Failed to allocate memory\n"));
+			free(s);
+			return EX_OSERR;
+		}
+		strcpy(c->keycode, keycode);
+		c->send = s;
+		c->next = keycode_cache;
+		keycode_cache = c;
+	}
+
+	return lirc_send(args, fd, features, c->send);
+}
+
+/*
+ * Send a keycode or protocol:scancode for each line read from stdin,
+ * keeping the device open. Commands which can't be sent are reported
+ * and skipped.
+ */
+static int lirc_send_stdin(struct arguments *args, int fd, unsigned features)
+{
+	struct timespec last = { 0 }, now;
+	char *line = NULL;
+	size_t line_size = 0;
+	int rc = 0;
+
+	while (getline(&line, &line_size, stdin) > 0) {
+		char *saveptr;
+		char *cmd = strtok_r(line, " \t\r\n", &saveptr);
+
+		if (cmd == NULL || *cmd == '#')
+			continue;
+
+		// the gap is the minimum time between the end of a send and the next
+		if (last.tv_sec || last.tv_nsec) {
+			long long elapsed;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			elapsed = (now.tv_sec - last.tv_sec) * 1000000LL +
+				  (now.tv_nsec - last.tv_nsec) / 1000;
+			if (elapsed < args->gap)
+				usleep(args->gap - elapsed);
+		}
+
+		if (strchr(cmd, ':')) {
+			struct send *s = read_scancode(cmd);
+
+			if (!s)
+				continue;
+			rc = lirc_send(args, fd, features, s);
+			free(s);
+		} else {
+			rc = send_keycode(args, fd, features, cmd);
+			if (rc == EX_DATAERR)
+				continue;
+		}
+		if (rc)
+			break;
+
+		if (args->verbose)
+			fflush(stdout);
+		clock_gettime(CLOCK_MONOTONIC, &last);
+	}
+
+	free(line);
+	return rc;
+}
+
+/*
+ * Received IR is formatted into a buffer which is written out after each
+ * read from the lirc device, rather than after each sample.
+ */
+struct outbuf {
+	int fd;
+	bool error;
+	size_t len;
+	char buf[65536];
+};
+
+static void out_flush(struct outbuf *out)
+{
+	size_t off = 0;
+
+	while (off < out->len && !out->error) {
+		ssize_t ret = TEMP_FAILURE_RETRY(write(out->fd, out->buf + off,
+						       out->len - off));
+		if (ret < 0)
+			out->error = true;
+		else
+			off += ret;
+	}
+	out->len = 0;
+}
+
+static void out_write(struct outbuf *out, const void *p, size_t len)
+{
+	if (out->len + len > sizeof(out->buf))
+		out_flush(out);
+	memcpy(out->buf + out->len, p, len);
+	out->len += len;
+}
+
+static void __attribute__((format(printf, 2, 3)))
+out_printf(struct outbuf *out, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	// a formatted sample is always much shorter than this
+	if (sizeof(out->buf) - out->len < 128)
+		out_flush(out);
+
+	va_start(ap, fmt);
+	len = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, fmt, ap);
+	va_end(ap);
+	if (len > 0)
+		out->len += len;
+}
+
 int lirc_receive(struct arguments *args, int fd, unsigned features)
 {
 	char *dev = args->device;
-	FILE *out = stdout;
+	struct outbuf *out;
 	int rc = EX_IOERR;
 	int mode = LIRC_MODE_MODE2;
 
@@ -1141,14 +1335,24 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 		return EX_IOERR;
 	}
 
+	out = malloc(sizeof(*out));
+	if (!out) {
+		fprintf(stderr, _("Failed to allocate memory\n"));
+		return EX_OSERR;
+	}
+	out->fd = STDOUT_FILENO;
+	out->error = false;
+	out->len = 0;
+
 	if (args->savetofile) {
-		out = fopen(args->savetofile, "w");
-		if (!out) {
+		out->fd = open(args->savetofile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (out->fd < 0) {
 			fprintf(stderr, _("%s: failed to open for writing: %m\n"), args->savetofile);
+			free(out);
 			return EX_CANTCREAT;
 		}
 	}
-	unsigned buf[LIRCBUF_SIZE];
+	unsigned buf[RECV_SAMPLES];
 
 	bool keep_reading = true;
 	bool leading_space = true;
@@ -1185,23 +1389,27 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 				break;
 			}
 
-			if (args->mode2) {
+			if (args->binary) {
+				out_write(out, &buf[i], sizeof(buf[i]));
+				if (msg == LIRC_MODE2_TIMEOUT || msg == LIRC_MODE2_OVERFLOW)
+					leading_space = true;
+			} else if (args->mode2) {
 				switch (msg) {
 				case LIRC_MODE2_TIMEOUT:
-					fprintf(out, "timeout %u\n", val);
+					out_printf(out, "timeout %u\n", val);
 					leading_space = true;
 					break;
 				case LIRC_MODE2_PULSE:
-					fprintf(out, "pulse %u\n", val);
+					out_printf(out, "pulse %u\n", val);
 					break;
 				case LIRC_MODE2_SPACE:
-					fprintf(out, "space %u\n", val);
+					out_printf(out, "space %u\n", val);
 					break;
 				case LIRC_MODE2_FREQUENCY:
-					fprintf(out, "carrier %u\n", val);
+					out_printf(out, "carrier %u\n", val);
 					break;
 				case LIRC_MODE2_OVERFLOW:
-					fprintf(out, "overflow\n");
+					out_printf(out, "overflow\n");
 					leading_space = true;
 					break;
 				}
@@ -1209,40 +1417,47 @@ int lirc_receive(struct arguments *args, int fd, unsigned features)
 				switch (msg) {
 				case LIRC_MODE2_TIMEOUT:
 					if (carrier)
-						fprintf(out, "-%u # carrier %uHz\n", val, carrier);
+						out_printf(out, "-%u # carrier %uHz\n", val, carrier);
 					else
-						fprintf(out, "-%u\n", val);
+						out_printf(out, "-%u\n", val);
 					leading_space = true;
 					carrier = 0;
 					break;
 				case LIRC_MODE2_PULSE:
-					fprintf(out, "+%u ", val);
+					out_printf(out, "+%u ", val);
 					break;
 				case LIRC_MODE2_SPACE:
-					fprintf(out, "-%u ", val);
+					out_printf(out, "-%u ", val);
 					break;
 				case LIRC_MODE2_FREQUENCY:
 					carrier = val;
 					break;
 				case LIRC_MODE2_OVERFLOW:
 					if (carrier)
-						fprintf(out, "# carrier %uHz, overflow\n", carrier);
+						out_printf(out, "# carrier %uHz, overflow\n", carrier);
 					else
-						fprintf(out, "# overflow\n");
+						out_printf(out, "# overflow\n");
 					leading_space = true;
 					carrier = 0;
 					break;
 				}
 			}
+		}
 
-			fflush(out);
+		out_flush(out);
+		if (out->error) {
+			fprintf(stderr, _("%s: failed to write: %m\n"),
+				args->savetofile ? args->savetofile : "stdout");
+			goto err;
 		}
 	}
 
 	rc = 0;
 err:
+	out_flush(out);
 	if (args->savetofile)
-		fclose(out);
+		close(out->fd);
+	free(out);
 
 	return rc;
 }
@@ -1253,6 +1468,8 @@ int main(int argc, char *argv[])
 		.gap = IR_DEFAULT_TIMEOUT,
 		.carrier = UNSET,
 		.timeout = UNSET,
+		.send_mode = -1,
+		.send_carrier = UNSET,
 	};
 
 #ifdef ENABLE_NLS
@@ -1283,23 +1500,10 @@ int main(int argc, char *argv[])
 		if (s->ty == SEND_GAP) {
 			usleep(s->gap);
 		} else {
-			if (s->ty == SEND_KEYCODE) {
-				struct send *k;
-
-				if (!args.keymap) {
-					fprintf(stderr, _("error: no keymap specified\n"));
-					exit(EX_DATAERR);
-				}
-
-				k = convert_keycode(args.keymap, s->keycode);
-				if (!k)
-					exit(EX_DATAERR);
-
-				free(s);
-				s = k;
-			}
-
-			rc = lirc_send(&args, fd, features, s);
+			if (s->ty == SEND_KEYCODE)
+				rc = send_keycode(&args, fd, features, s->keycode);
+			else
+				rc = lirc_send(&args, fd, features, s);
 			if (rc) {
 				close(fd);
 				exit(rc);
@@ -1310,6 +1514,14 @@ int main(int argc, char *argv[])
 		s = next;
 	}
 
+	if (args.stream) {
+		rc = lirc_send_stdin(&args, fd, features);
+		if (rc) {
+			close(fd);
+			exit(rc);
+		}
+	}
+
 	if (args.receive) {
 		rc = lirc_receive(&args, fd, features);
 		if (rc) {
@@ -1321,6 +1533,13 @@ int main(int argc, char *argv[])
 	if (args.features)
 		lirc_features(&args, fd, features);
 
+	while (keycode_cache) {
+		struct keycode_cache *c = keycode_cache;
+
+		keycode_cache = c->next;
+		free(c->send);
+		free(c);
+	}
 	free_keymap(args.keymap);
 	close(fd);
 
@@ -1 +0,0 @@
-../common/toml.c
\ No newline at end of file
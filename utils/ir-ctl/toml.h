@@ -1 +0,0 @@
-../common/toml.h
\ No newline at end of file
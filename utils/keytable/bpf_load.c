@@ -30,15 +30,34 @@
 
 #define LOG_BUF_SIZE (256 * 1024)
 
-// This should match the struct in the raw BPF decoder
-struct raw_pattern {
+// These should match the structs in the raw BPF decoder
+struct raw_node {
 	unsigned int scancode;
-	unsigned short raw[0];
+	unsigned int accept;
+	unsigned int edges;
+	unsigned int nr_edges;
 };
 
-// For the raw decoder, these values are calculated based on the raw
-// patterns and need to be patched into the BPF
-int max_length;
+struct raw_edge {
+	unsigned int min;
+	unsigned int max;
+	int node;
+};
+
+// The decoder does a binary search of at most 17 steps through the edges
+#define RAW_MAX_EDGES (1 << 16)
+#define RAW_MAX_NODES (1 << 16)
+
+// The raw patterns compiled into a trie, see the raw BPF decoder
+struct raw_trie {
+	struct raw_node *nodes;
+	struct raw_edge *edges;
+	int nr_nodes;
+	int nr_edges;
+};
+
+// For the raw decoder, this value is calculated based on the raw
+// patterns and needs to be patched into the BPF
 int trail_space;
 
 char bpf_log_buf[LOG_BUF_SIZE];
@@ -58,6 +77,7 @@ struct bpf_file {
 	int strtabidx;
 	Elf_Data *symbols;
 	struct protocol_param *param;
+	struct raw_trie *raw_trie;
 	char name[128];
 };
 
@@ -88,35 +108,335 @@ static int load_and_attach(int lirc_fd, struct bpf_file *bpf_file, struct bpf_in
 	return 0;
 }
 
-static int build_raw_map(struct bpf_map_data *map, struct raw_entry *raw, int numa_node)
+// A node of the trie while it is being built: the set of patterns that
+// match so far, at the given position in the patterns
+struct raw_state {
+	int pos;
+	int nr;
+	int *patterns;
+	unsigned int hash;
+	int next;
+};
+
+struct raw_builder {
+	struct raw_entry **patterns;
+	struct raw_state *states;
+	int nr_states;
+	int *hash;
+	struct raw_trie *trie;
+	int margin;
+};
+
+#define RAW_HASH_SIZE 4096
+
+struct raw_range {
+	unsigned int min;
+	unsigned int max;
+	int pattern;
+};
+
+static int cmp_uint(const void *l, const void *r)
+{
+	unsigned int a = *(const unsigned int *)l, b = *(const unsigned int *)r;
+
+	return a < b ? -1 : a > b;
+}
+
+static unsigned int raw_hash(int pos, int nr, const int *patterns)
+{
+	unsigned int h = 2166136261u ^ pos;
+	int i;
+
+	for (i = 0; i < nr; i++)
+		h = (h ^ patterns[i]) * 16777619u;
+	return h;
+}
+
+// Find the node for this set of patterns, adding it if needed. Takes
+// ownership of patterns.
+static int raw_node(struct raw_builder *b, int pos, int nr, int *patterns)
+{
+	unsigned int h = raw_hash(pos, nr, patterns);
+	struct raw_state *st;
+	int i;
+
+	for (i = b->hash[h % RAW_HASH_SIZE]; i >= 0; i = b->states[i].next) {
+		st = &b->states[i];
+		if (st->hash == h && st->pos == pos && st->nr == nr &&
+		    !memcmp(st->patterns, patterns, nr * sizeof(*patterns))) {
+			free(patterns);
+			return i;
+		}
+	}
+
+	if (b->nr_states == RAW_MAX_NODES) {
+		free(patterns);
+		return -1;
+	}
+
+	st = &b->states[b->nr_states];
+	st->pos = pos;
+	st->nr = nr;
+	st->patterns = patterns;
+	st->hash = h;
+	st->next = b->hash[h % RAW_HASH_SIZE];
+	b->hash[h % RAW_HASH_SIZE] = b->nr_states;
+
+	return b->nr_states++;
+}
+
+// Create the edges out of a node: split the durations into ranges, each
+// of which matches the same set of patterns at the next position
+static int raw_edges(struct raw_builder *b, int n)
+{
+	struct raw_state *st = &b->states[n];
+	struct raw_trie *t = b->trie;
+	struct raw_range *ranges;
+	unsigned int *bounds;
+	int i, j, nr_ranges = 0, nr_bounds = 0;
+
+	t->nodes[n].edges = t->nr_edges;
+	t->nodes[n].nr_edges = 0;
+
+	ranges = malloc(st->nr * sizeof(*ranges));
+	bounds = malloc(2 * st->nr * sizeof(*bounds));
+	if (!ranges || !bounds) {
+		free(ranges);
+		free(bounds);
+		return -1;
+	}
+
+	// Like eq_margin() in the other decoders, the margin is exclusive
+	for (i = 0; i < st->nr; i++) {
+		struct raw_entry *e = b->patterns[st->patterns[i]];
+		unsigned int d;
+
+		if (st->pos >= e->raw_length || b->margin <= 0)
+			continue;
+		d = e->raw[st->pos];
+		ranges[nr_ranges].min = d >= b->margin ? d - b->margin + 1 : 0;
+		ranges[nr_ranges].max = d + b->margin - 1;
+		ranges[nr_ranges].pattern = st->patterns[i];
+		bounds[nr_bounds++] = ranges[nr_ranges].min;
+		bounds[nr_bounds++] = ranges[nr_ranges].max + 1;
+		nr_ranges++;
+	}
+
+	qsort(bounds, nr_bounds, sizeof(*bounds), cmp_uint);
+
+	for (i = 0; i + 1 < nr_bounds; i++) {
+		unsigned int min = bounds[i], max = bounds[i + 1] - 1;
+		struct raw_edge *prev;
+		int *patterns, nr = 0, node;
+
+		if (bounds[i] == bounds[i + 1])
+			continue;
+
+		patterns = malloc(nr_ranges * sizeof(*patterns));
+		if (!patterns)
+			goto err;
+
+		// ranges are in the order of the patterns, so this is sorted
+		for (j = 0; j < nr_ranges; j++)
+			if (ranges[j].min <= min && min <= ranges[j].max)
+				patterns[nr++] = ranges[j].pattern;
+
+		if (!nr) {
+			free(patterns);
+			continue;
+		}
+
+		node = raw_node(b, st->pos + 1, nr, patterns);
+		if (node < 0)
+			goto err;
+
+		prev = t->nodes[n].nr_edges ? &t->edges[t->nr_edges - 1] : NULL;
+		if (prev && prev->node == node && prev->max + 1 == min) {
+			prev->max = max;
+			continue;
+		}
+
+		if (t->nr_edges == RAW_MAX_EDGES)
+			goto err;
+
+		t->edges[t->nr_edges].min = min;
+		t->edges[t->nr_edges].max = max;
+		t->edges[t->nr_edges].node = node;
+		t->nr_edges++;
+		t->nodes[n].nr_edges++;
+	}
+
+	free(ranges);
+	free(bounds);
+	return 0;
+
+err:
+	free(ranges);
+	free(bounds);
+	return -1;
+}
+
+static void free_raw_trie(struct raw_trie *t)
+{
+	if (!t)
+		return;
+	free(t->nodes);
+	free(t->edges);
+	free(t);
+}
+
+static struct raw_trie *build_raw_trie(struct raw_entry *raw, int margin)
 {
-	int no_patterns, value_size, fd, key, i;
+	struct raw_builder b = { .margin = margin };
+	struct raw_trie *t;
 	struct raw_entry *e;
-	struct raw_pattern *p;
+	int i, n, no_patterns = 0, *root;
+
+	for (e = raw; e; e = e->next) {
+		// 1ms extra for trailing space. This also ensure that the
+		// trail_space is larger than largest space + margin in the
+		// decoder
+		for (i = 1; i < e->raw_length; i += 2)
+			if (e->raw[i] + 1000 > trail_space)
+				trail_space = e->raw[i] + 1000;
+		no_patterns++;
+	}
+
+	t = calloc(1, sizeof(*t));
+	b.trie = t;
+	b.patterns = calloc(no_patterns + 1, sizeof(*b.patterns));
+	b.states = calloc(RAW_MAX_NODES, sizeof(*b.states));
+	b.hash = malloc(RAW_HASH_SIZE * sizeof(*b.hash));
+	root = calloc(no_patterns + 1, sizeof(*root));
+	if (t) {
+		t->nodes = calloc(RAW_MAX_NODES, sizeof(*t->nodes));
+		t->edges = calloc(RAW_MAX_EDGES, sizeof(*t->edges));
+	}
+	if (!t || !t->nodes || !t->edges || !b.patterns || !b.states ||
+	    !b.hash || !root) {
+		printf(_("Failed to allocate memory"));
+		free(root);
+		goto err;
+	}
+
+	memset(b.hash, 0xff, RAW_HASH_SIZE * sizeof(*b.hash));
+
+	for (e = raw, i = 0; e; e = e->next, i++) {
+		b.patterns[i] = e;
+		root[i] = i;
+	}
+	raw_node(&b, 0, no_patterns, root);
+
+	// Nodes are added while the edges are created, in breadth first order
+	for (n = 0; n < b.nr_states; n++) {
+		struct raw_state *st = &b.states[n];
+
+		// Of the patterns ending here, the last one wins, as before
+		for (i = 0; i < st->nr; i++) {
+			e = b.patterns[st->patterns[i]];
+			if (e->raw_length == st->pos) {
+				t->nodes[n].accept = 1;
+				t->nodes[n].scancode = e->scancode;
+			}
+		}
+
+		if (raw_edges(&b, n)) {
+			printf(_("Too many raw patterns to compile, the limit is %d nodes and %d edges\n"),
+			       RAW_MAX_NODES, RAW_MAX_EDGES);
+			goto err;
+		}
+	}
+
+	t->nr_nodes = b.nr_states;
+
+	if (debug)
+		printf(_("compiled %d raw patterns into %d nodes and %d edges\n"),
+		       no_patterns, t->nr_nodes, t->nr_edges);
+
+	for (n = 0; n < b.nr_states; n++)
+		free(b.states[n].patterns);
+	free(b.states);
+	free(b.hash);
+	free(b.patterns);
+
+	return t;
+
+err:
+	for (n = 0; n < b.nr_states; n++)
+		free(b.states[n].patterns);
+	free(b.states);
+	free(b.hash);
+	free(b.patterns);
+	free_raw_trie(t);
+	return NULL;
+}
+
+// Returns the value of a parameter, either overridden or from the data section
+static int bpf_file_param(struct bpf_file *bpf_file, const char *name, int *value)
+{
+	GElf_Sym sym;
+	int i;
+
+	if (!bpf_param(bpf_file->param, name, value))
+		return 0;
+
+	if (!bpf_file->data)
+		return -ENOENT;
+
+	for (i = 0; i < bpf_file->symbols->d_size / sizeof(GElf_Sym); i++) {
+		if (!gelf_getsym(bpf_file->symbols, i, &sym) ||
+		    sym.st_shndx != bpf_file->dataidx)
+			continue;
+
+		if (!strcmp(elf_strptr(bpf_file->elf, bpf_file->strtabidx, sym.st_name), name)) {
+			*value = *(int*)((unsigned char*)bpf_file->data->d_buf + sym.st_value);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static int build_raw_map(struct bpf_file *bpf_file, struct bpf_map_data *map,
+			 struct raw_entry *raw, int numa_node)
+{
+	bool nodes = !strcmp(map->name, "raw_nodes");
+	int entries, value_size, fd, key;
+	void *values;
 	LIBBPF_OPTS(bpf_map_create_opts, opts,
 		.map_flags = map->def.map_flags,
 	);
 
-	no_patterns = 0;
+	if (!bpf_file->raw_trie) {
+		int margin;
 
-	for (e = raw; e; e = e->next) {
-		if (e->raw_length > max_length)
-			max_length = e->raw_length;
-		no_patterns++;
-	}
+		if (bpf_file_param(bpf_file, "margin", &margin)) {
+			printf(_("raw decoder has no margin\n"));
+			return -1;
+		}
 
-	// pattern needs a trailing 0 to mark the end of
-	// the pattern
-	max_length++;
+		bpf_file->raw_trie = build_raw_trie(raw, margin);
+		if (!bpf_file->raw_trie)
+			return -1;
+	}
 
-	value_size = sizeof(struct raw_pattern) + max_length * sizeof(short);
+	if (nodes) {
+		entries = bpf_file->raw_trie->nr_nodes;
+		value_size = sizeof(struct raw_node);
+		values = bpf_file->raw_trie->nodes;
+	} else {
+		entries = bpf_file->raw_trie->nr_edges;
+		value_size = sizeof(struct raw_edge);
+		values = bpf_file->raw_trie->edges;
+	}
 
 	opts.numa_node = numa_node;
+	// An array map cannot be empty
 	fd = bpf_map_create(map->def.type,
 			    map->name,
 			    map->def.key_size,
 			    value_size,
-			    no_patterns,
+			    entries ? entries : 1,
 			    &opts);
 	if (fd < 0) {
 		printf(_("failed to create a map: %d %s\n"),
@@ -124,41 +444,13 @@ static int build_raw_map(struct bpf_map_data *map, struct raw_entry *raw, int nu
 		return -1;
 	}
 
-	p = malloc(value_size);
-	if (!p) {
-		printf(_("Failed to allocate memory"));
-		return -1;
-	}
-
-	key = 0;
-
-	for (e = raw; e; e = e->next) {
-		p->scancode = e->scancode;
-		for (i = 0; i < e->raw_length; i++) {
-			p->raw[i] = e->raw[i];
-			if (i % 2 && e->raw[i] > trail_space)
-				trail_space = e->raw[i];
-		}
-
-		// Add trailing space and clear rest of the struct
-		while (i < max_length)
-			p->raw[i++] = 0;
-
-		if (bpf_map_update_elem(fd, &key, p, BPF_ANY)) {
+	for (key = 0; key < entries; key++) {
+		if (bpf_map_update_elem(fd, &key, (char *)values + key * value_size, BPF_ANY)) {
 			printf(_("failed to update raw map: %d %s\n"),
 			       errno, strerror(errno));
-			free(p);
 			return -1;
 		}
-
-		key++;
 	}
-	free(p);
-
-	// 1ms extra for trailing space. This also ensure that the
-	// trail_space is larger than largest space + margin in the
-	// decoder
-	trail_space += 1000;
 
 	return fd;
 }
@@ -187,8 +479,9 @@ static int load_maps(struct bpf_file *bpf_file, struct raw_entry *raw)
 							4,
 							maps[i].def.max_entries,
 							&opts);
-		} else if (!strcmp(maps[i].name, "raw_map")) {
-			bpf_file->map_fd[i] = build_raw_map(&maps[i], raw, numa_node);
+		} else if (!strcmp(maps[i].name, "raw_nodes") ||
+			   !strcmp(maps[i].name, "raw_edges")) {
+			bpf_file->map_fd[i] = build_raw_map(bpf_file, &maps[i], raw, numa_node);
 		} else {
 			LIBBPF_OPTS(bpf_map_create_opts, opts,
 				.map_flags = maps[i].def.map_flags,
@@ -237,6 +530,21 @@ static int get_sec(Elf *elf, int i, GElf_Ehdr *ehdr, char **shname,
 	return 0;
 }
 
+// The parameters of the decoders which multi.o combines are prefixed with
+// the name of the decoder, but the keymaps name them without the prefix
+static int decoder_param(struct bpf_file *bpf_file, const char *name, int *value)
+{
+	size_t len = strlen(bpf_file->name);
+
+	if (!bpf_param(bpf_file->param, name, value))
+		return 0;
+
+	if (len && !strncmp(name, bpf_file->name, len) && name[len] == '_')
+		return bpf_param(bpf_file->param, name + len + 1, value);
+
+	return -ENOENT;
+}
+
 static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 				struct bpf_insn *insn, Elf_Data *data)
 {
@@ -289,7 +597,7 @@ static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 			const char *raw = NULL;
 			int value = 0;
 
-			if (!bpf_param(bpf_file->param, sym_name, &value)) {
+			if (!decoder_param(bpf_file, sym_name, &value)) {
 				if (value < INT_MIN && value > UINT_MAX) {
 					printf(_("variable %s out of range: %s\n"), sym_name, raw);
 					return 1;
@@ -297,12 +605,10 @@ static int parse_relo_and_apply(struct bpf_file *bpf_file, GElf_Shdr *shdr,
 			} else if (sym.st_shndx == bpf_file->dataidx) {
 				// Value is not overridden on command line
 				// or toml file. For the raw decoder, the
-				// max_length and trail_space needs to be
-				// patched in. Otherwise use value set in
-				// bpf object file from data section.
-				if (!strcmp(sym_name, "max_length") && max_length)
-					value = max_length;
-				else if (!strcmp(sym_name, "trail_space") && trail_space)
+				// trail_space needs to be patched in.
+				// Otherwise use value set in bpf object
+				// file from data section.
+				if (!strcmp(sym_name, "trail_space") && trail_space)
 					value = trail_space;
 				else
 					value = *(int*)((unsigned char*)bpf_file->data->d_buf + sym.st_value);
@@ -511,7 +817,6 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 		goto done;
 	}
 
-	max_length = 0;
 	trail_space = 0;
 
 	if (data_map) {
@@ -577,6 +882,7 @@ int load_bpf_file(const char *path, int lirc_fd, struct protocol_param *param,
 	}
 
 done:
+	free_raw_trie(bpf_file.raw_trie);
 	close(fd);
 	return ret;
 }
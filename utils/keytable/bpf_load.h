@@ -15,6 +15,17 @@ struct bpf_load_map_def {
 	unsigned int numa_node;
 };
 
+// This should match struct decoder_stats in bpf_protocols/decoder_stats.h
+struct decoder_stats {
+	__u64 edges;
+	__u64 keydowns;
+	__u64 repeats;
+	__u64 pointers;
+	__u64 resets;
+	__u64 ns;
+	__u64 event;
+};
+
 struct bpf_map_data {
 	int fd;
 	char *name;
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+//
+// Shared by the decoders whose state machines are in a header, so that
+// multi.c can combine them into one program.
+
+#ifndef __DECODER_H
+#define __DECODER_H
+
+#include <linux/lirc.h>
+#include <linux/bpf.h>
+
+#include "bpf_helpers.h"
+
+// The parameters can be overridden in the rc_keymap toml
+//
+// We abuse elf relocations. We cast the address of these variables to
+// an int, so that the compiler emits a mov immediate for the address
+// but uses it as an int. The bpf loader replaces the relocation with the
+// actual value (either overridden or taken from the data segment).
+//
+// The parameters of a decoder are prefixed with its name, so that they
+// do not clash in multi.c. When the decoder is loaded on its own, the
+// loader also accepts them without the prefix, as the keymaps use them.
+#define BPF_PARAM(x) (int)(long)(&(x))
+
+#include "decoder_stats.h"
+
+enum state {
+	STATE_INACTIVE,
+	STATE_HEADER_SPACE,
+	STATE_REPEAT_SPACE,
+	STATE_BITS_SPACE,
+	STATE_BITS_PULSE,
+	STATE_TRAILER,
+};
+
+struct decoder_state {
+	unsigned long bits;
+	enum state state;
+	unsigned int count;
+};
+
+static __always_inline int eq_margin(unsigned d1, unsigned d2, int margin)
+{
+	return ((d1 > (d2 - margin)) && (d1 < (d2 + margin)));
+}
+
+// Returns true for the timing samples, which are decoded
+static __always_inline int is_timing(unsigned int *sample)
+{
+	switch (*sample & LIRC_MODE2_MASK) {
+	case LIRC_MODE2_SPACE:
+	case LIRC_MODE2_PULSE:
+	case LIRC_MODE2_TIMEOUT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+#endif
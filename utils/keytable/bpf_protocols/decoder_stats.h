@@ -0,0 +1,119 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+//
+// Statistics shared by the decoders, shown with ir-keytable --bpf-stats.
+// They are only counted when the stats parameter is set, so that the
+// decoders do not pay for the per-cpu map lookup and the clock otherwise.
+//
+// Include this after BPF_PARAM is defined.
+
+#ifndef __DECODER_STATS_H
+#define __DECODER_STATS_H
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+
+// This should match struct decoder_stats in ir-keytable
+struct decoder_stats {
+	unsigned long long edges;
+	unsigned long long keydowns;
+	unsigned long long repeats;
+	unsigned long long pointers;
+	unsigned long long resets;
+	unsigned long long ns;
+	// set when the current edge produced an event
+	unsigned long long event;
+};
+
+struct bpf_map_def SEC("lirc_mode2/maps") decoder_stats = {
+	.type = BPF_MAP_TYPE_PERCPU_ARRAY,
+	.key_size = sizeof(unsigned int),
+	.value_size = sizeof(struct decoder_stats),
+	.max_entries = 1,
+};
+
+int stats = 0;
+
+static __always_inline struct decoder_stats *stats_get(void)
+{
+	unsigned int key = 0;
+
+	if (!BPF_PARAM(stats))
+		return 0;
+
+	return bpf_map_lookup_elem(&decoder_stats, &key);
+}
+
+// Returns the time the edge started, or 0 if no statistics are kept
+static __always_inline unsigned long long stats_begin(void)
+{
+	struct decoder_stats *st = stats_get();
+
+	if (!st)
+		return 0;
+
+	st->edges++;
+
+	return bpf_ktime_get_ns();
+}
+
+// A decoder which was active but is no longer, without producing an
+// event, has reset because the edge did not match
+static __always_inline void stats_end(unsigned long long start,
+				      int was_active, int active)
+{
+	struct decoder_stats *st;
+
+	if (!start)
+		return;
+
+	st = stats_get();
+	if (!st)
+		return;
+
+	if (was_active && !active && !st->event)
+		st->resets++;
+
+	st->event = 0;
+	st->ns += bpf_ktime_get_ns() - start;
+}
+
+static __always_inline int stats_keydown(void *ctx, unsigned int protocol,
+					 unsigned long long scancode,
+					 unsigned int toggle)
+{
+	struct decoder_stats *st = stats_get();
+
+	if (st) {
+		st->keydowns++;
+		st->event = 1;
+	}
+
+	return bpf_rc_keydown(ctx, protocol, scancode, toggle);
+}
+
+static __always_inline int stats_repeat(void *ctx)
+{
+	struct decoder_stats *st = stats_get();
+
+	if (st) {
+		st->repeats++;
+		st->event = 1;
+	}
+
+	return bpf_rc_repeat(ctx);
+}
+
+static __always_inline int stats_pointer_rel(void *ctx, int rel_x, int rel_y)
+{
+	struct decoder_stats *st = stats_get();
+
+	if (st) {
+		st->pointers++;
+		st->event = 1;
+	}
+
+	return bpf_rc_pointer_rel(ctx, rel_x, rel_y);
+}
+
+#endif
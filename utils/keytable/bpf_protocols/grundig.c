@@ -46,6 +46,8 @@ int leader_pulse = 1300;
 
 #define BPF_PARAM(x) (int)(long)(&(x))
 
+#include "decoder_stats.h"
+
 SEC("lirc_mode2/grundig")
 int bpf_decoder(unsigned int *sample)
 {
@@ -65,6 +67,9 @@ int bpf_decoder(unsigned int *sample)
 		return 0;
 	}
 
+	unsigned long long start = stats_begin();
+	int was_active = s->state != STATE_INACTIVE;
+
 	int duration = LIRC_VALUE(*sample);
 
 	if (s->state == STATE_INACTIVE) {
@@ -112,7 +117,7 @@ int bpf_decoder(unsigned int *sample)
 			}
 			s->count += 2;
 			if (s->count == 16) {
-				bpf_rc_keydown(sample, 0x40, s->bits, 0);
+				stats_keydown(sample, 0x40, s->bits, 0);
 				s->state = STATE_INACTIVE;
 			} else {
 				s->state = STATE_BITS_SPACE;
@@ -120,6 +125,8 @@ int bpf_decoder(unsigned int *sample)
 		}
 	}
 
+	stats_end(start, was_active, s->state != STATE_INACTIVE);
+
 	return 0;
 }
 
@@ -36,6 +36,8 @@ int margin = 325;
 
 #define BPF_PARAM(x) (int)(long)(&(x))
 
+#include "decoder_stats.h"
+
 static inline int eq_margin(unsigned d1, unsigned d2)
 {
 	return ((d1 > (d2 - BPF_PARAM(margin))) && (d1 < (d2 + BPF_PARAM(margin))));
@@ -60,6 +62,9 @@ int bpf_decoder(unsigned int *sample)
 		return 0;
 	}
 
+	unsigned long long start = stats_begin();
+	int was_active = s->state != STATE_INACTIVE;
+
 	int duration = LIRC_VALUE(*sample);
 	int pulse = LIRC_IS_PULSE(*sample);
 
@@ -116,7 +121,7 @@ int bpf_decoder(unsigned int *sample)
 			case 0xb: x = -4; y = -2; break;
 			}
 
-			bpf_rc_pointer_rel(sample, x, y);
+			stats_pointer_rel(sample, x, y);
 
 			s->state = STATE_INACTIVE;
 			break;
@@ -135,6 +140,8 @@ int bpf_decoder(unsigned int *sample)
 		break;
 	}
 
+	stats_end(start, was_active, s->state != STATE_INACTIVE);
+
 	return 0;
 }
 
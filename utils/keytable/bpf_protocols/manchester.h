@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+//
+// Copyright (C) 2018 Sean Young <sean@mess.org>
+//
+// See:
+// http://clearwater.com.au/code/rc5
+
+#ifndef __MANCHESTER_H
+#define __MANCHESTER_H
+
+#include "decoder.h"
+
+struct manchester_state {
+	unsigned int state;
+	unsigned int count;
+	unsigned long bits;
+};
+
+int manchester_margin = 200;
+int manchester_header_pulse = 0;
+int manchester_header_space = 0;
+int manchester_zero_pulse = 888;
+int manchester_zero_space = 888;
+int manchester_one_pulse = 888;
+int manchester_one_space = 888;
+int manchester_toggle_bit = 100;
+int manchester_bits = 14;
+int manchester_scancode_mask = 0;
+int manchester_rc_protocol = 66;
+
+#define MC(x) BPF_PARAM(manchester_##x)
+
+// STATE_INACTIVE is shared with the other decoders
+#define STATE_HEADER   1
+#define STATE_START1   2
+#define STATE_MID1     3
+#define STATE_MID0     4
+#define STATE_START0   5
+
+static __always_inline int manchester_emit_bit(unsigned int *sample,
+					       struct manchester_state *s,
+					       int bit, int state)
+{
+	s->bits <<= 1;
+	s->bits |= bit;
+	s->count++;
+
+	if (s->count == MC(bits)) {
+		unsigned int toggle = 0;
+		unsigned long mask = MC(scancode_mask);
+		if (MC(toggle_bit) < MC(bits)) {
+			unsigned int tmask = 1 << MC(toggle_bit);
+			if (s->bits & tmask)
+				toggle = 1;
+			mask |= tmask;
+		}
+
+		stats_keydown(sample, MC(rc_protocol), s->bits & ~mask, toggle);
+		state = STATE_INACTIVE;
+	}
+
+	return state;
+}
+
+static __always_inline void manchester_decode(struct manchester_state *s,
+					      unsigned int *sample,
+					      int duration, int pulse)
+{
+	unsigned int newState = s->state;
+
+	switch (s->state) {
+	case STATE_INACTIVE:
+		if (MC(header_pulse)) {
+			if (pulse &&
+			    eq_margin(MC(header_pulse), duration, MC(margin))) {
+				s->state = STATE_HEADER;
+			}
+			break;
+		}
+		/* pass through */
+	case STATE_HEADER:
+		if (MC(header_space)) {
+			if (!pulse &&
+			    eq_margin(MC(header_space), duration, MC(margin))) {
+				s->state = STATE_MID1;
+			}
+			break;
+		}
+		s->bits = 0;
+		s->count = 0;
+		/* pass through */
+	case STATE_MID1:
+		if (!pulse)
+			break;
+
+		if (eq_margin(MC(one_pulse), duration, MC(margin)))
+			newState = manchester_emit_bit(sample, s, 1, STATE_START1);
+		else if (eq_margin(MC(one_pulse) + MC(zero_pulse), duration,
+				   MC(margin)))
+			newState = manchester_emit_bit(sample, s, 1, STATE_MID0);
+		break;
+	case STATE_MID0:
+		if (pulse)
+			break;
+
+		if (eq_margin(MC(zero_space), duration, MC(margin)))
+			newState = manchester_emit_bit(sample, s, 0, STATE_START0);
+		else if (eq_margin(MC(zero_space) + MC(one_space), duration,
+				   MC(margin)))
+			newState = manchester_emit_bit(sample, s, 0, STATE_MID1);
+		else
+			newState = manchester_emit_bit(sample, s, 0, STATE_INACTIVE);
+		break;
+	case STATE_START1:
+		if (!pulse && eq_margin(MC(zero_space), duration, MC(margin)))
+			newState = STATE_MID1;
+		break;
+	case STATE_START0:
+		if (pulse && eq_margin(MC(one_pulse), duration, MC(margin)))
+			newState = STATE_MID0;
+		break;
+	}
+
+	if (newState == s->state)
+		s->state = STATE_INACTIVE;
+	else
+		s->state = newState;
+}
+
+#undef MC
+
+#endif
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-2.0+
+//
+// This combines the decoders which are in a header into one program. Each
+// BPF program attached to a lirc device is run for every pulse and space,
+// so when several of them are used, ir-keytable loads this instead: the
+// sample is filtered and the state looked up once, whatever the number of
+// decoders.
+//
+// ir-keytable enables the decoders that are used with the <name>_enabled
+// parameters, and passes their parameters with the <name>_ prefix.
+
+#include "manchester.h"
+#include "pulse_distance.h"
+#include "pulse_length.h"
+#include "samsung36.h"
+
+int manchester_enabled = 0;
+int pulse_distance_enabled = 0;
+int pulse_length_enabled = 0;
+int samsung36_enabled = 0;
+
+struct multi_state {
+	struct manchester_state manchester;
+	struct decoder_state pulse_distance;
+	struct decoder_state pulse_length;
+	struct decoder_state samsung36;
+};
+
+struct bpf_map_def SEC("lirc_mode2/maps") decoder_state_map = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(unsigned int),
+	.value_size = sizeof(struct multi_state),
+	.max_entries = 1,
+};
+
+static __always_inline int multi_active(struct multi_state *s)
+{
+	return s->manchester.state != STATE_INACTIVE ||
+	       s->pulse_distance.state != STATE_INACTIVE ||
+	       s->pulse_length.state != STATE_INACTIVE ||
+	       s->samsung36.state != STATE_INACTIVE;
+}
+
+SEC("lirc_mode2/multi")
+int bpf_decoder(unsigned int *sample)
+{
+	unsigned int key = 0;
+	struct multi_state *s = bpf_map_lookup_elem(&decoder_state_map, &key);
+
+	if (!s)
+		return 0;
+
+	if (!is_timing(sample))
+		return 0;
+
+	int duration = LIRC_VALUE(*sample);
+	int pulse = LIRC_IS_PULSE(*sample);
+	unsigned long long start = stats_begin();
+	int was_active = multi_active(s);
+
+	// The enabled parameters are patched in as immediates, so the
+	// verifier drops the decoders which are not used
+	if (BPF_PARAM(manchester_enabled))
+		manchester_decode(&s->manchester, sample, duration, pulse);
+	if (BPF_PARAM(pulse_distance_enabled))
+		pulse_distance_decode(&s->pulse_distance, sample, duration, pulse);
+	if (BPF_PARAM(pulse_length_enabled))
+		pulse_length_decode(&s->pulse_length, sample, duration, pulse);
+	if (BPF_PARAM(samsung36_enabled))
+		samsung36_decode(&s->samsung36, sample, duration, pulse);
+
+	stats_end(start, was_active, multi_active(s));
+
+	return 0;
+}
+
+char _license[] SEC("license") = "GPL";
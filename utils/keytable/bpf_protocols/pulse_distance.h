@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+//
+// Copyright (C) 2018 Sean Young <sean@mess.org>
+
+#ifndef __PULSE_DISTANCE_H
+#define __PULSE_DISTANCE_H
+
+#include "decoder.h"
+
+int pulse_distance_margin = 200;
+int pulse_distance_header_pulse = 2125;
+int pulse_distance_header_space = 1875;
+int pulse_distance_repeat_pulse = 0;
+int pulse_distance_repeat_space = 0;
+int pulse_distance_bit_pulse = 625;
+int pulse_distance_bit_0_space = 375;
+int pulse_distance_bit_1_space = 1625;
+int pulse_distance_trailer_pulse = 625;
+int pulse_distance_bits = 4;
+int pulse_distance_reverse = 0;
+int pulse_distance_header_optional = 0;
+int pulse_distance_rc_protocol = 64;
+
+#define PD(x) BPF_PARAM(pulse_distance_##x)
+
+static __always_inline void pulse_distance_decode(struct decoder_state *s,
+						  unsigned int *sample,
+						  int duration, int pulse)
+{
+	switch (s->state) {
+	case STATE_HEADER_SPACE:
+		if (!pulse && eq_margin(PD(header_space), duration, PD(margin)))
+			s->state = STATE_BITS_PULSE;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_REPEAT_SPACE:
+		if (!pulse && eq_margin(PD(repeat_space), duration, PD(margin)))
+			s->state = STATE_TRAILER;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_INACTIVE:
+		if (pulse && eq_margin(PD(header_pulse), duration, PD(margin))) {
+			s->bits = 0;
+			s->state = STATE_HEADER_SPACE;
+			s->count = 0;
+			break;
+		}
+		if (pulse && PD(repeat_pulse) > 0 &&
+		    eq_margin(PD(repeat_pulse), duration, PD(margin))) {
+			s->state = STATE_REPEAT_SPACE;
+			s->count = 0;
+			break;
+		}
+		if (!PD(header_optional))
+			break;
+		/* pass through */
+	case STATE_BITS_PULSE:
+		if (pulse && eq_margin(PD(bit_pulse), duration, PD(margin)))
+			s->state = STATE_BITS_SPACE;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_BITS_SPACE:
+		if (pulse) {
+			s->state = STATE_INACTIVE;
+			break;
+		}
+
+		unsigned long set_bit = 1;
+
+		if (PD(reverse))
+			set_bit <<= s->count;
+		else
+			s->bits <<= 1;
+
+		if (eq_margin(PD(bit_1_space), duration, PD(margin)))
+			s->bits |= set_bit;
+		else if (!eq_margin(PD(bit_0_space), duration, PD(margin))) {
+			s->state = STATE_INACTIVE;
+			break;
+		}
+
+		s->count++;
+		if (s->count == PD(bits))
+			s->state = STATE_TRAILER;
+		else
+			s->state = STATE_BITS_PULSE;
+		break;
+	case STATE_TRAILER:
+		if (pulse && eq_margin(PD(trailer_pulse), duration, PD(margin))) {
+			if (s->count == 0)
+				stats_repeat(sample);
+			else
+				stats_keydown(sample, PD(rc_protocol), s->bits, 0);
+		}
+
+		s->state = STATE_INACTIVE;
+	}
+}
+
+#undef PD
+
+#endif
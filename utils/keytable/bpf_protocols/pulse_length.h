@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+//
+// Copyright (C) 2018 Sean Young <sean@mess.org>
+
+#ifndef __PULSE_LENGTH_H
+#define __PULSE_LENGTH_H
+
+#include "decoder.h"
+
+int pulse_length_margin = 200;
+int pulse_length_header_pulse = 2125;
+int pulse_length_header_space = 1875;
+int pulse_length_repeat_pulse = 0;
+int pulse_length_repeat_space = 0;
+int pulse_length_bit_space = 625;
+int pulse_length_bit_0_pulse = 375;
+int pulse_length_bit_1_pulse = 1625;
+int pulse_length_trailer_pulse = 0;
+int pulse_length_bits = 4;
+int pulse_length_reverse = 0;
+int pulse_length_header_optional = 0;
+int pulse_length_rc_protocol = 67;
+
+#define PL(x) BPF_PARAM(pulse_length_##x)
+
+static __always_inline void pulse_length_decode(struct decoder_state *s,
+						unsigned int *sample,
+						int duration, int pulse)
+{
+	switch (s->state) {
+	case STATE_HEADER_SPACE:
+		if (!pulse && eq_margin(PL(header_space), duration, PL(margin)))
+			s->state = STATE_BITS_PULSE;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_REPEAT_SPACE:
+		if (!pulse && eq_margin(PL(repeat_space), duration, PL(margin)))
+			s->state = STATE_TRAILER;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_INACTIVE:
+		if (pulse && eq_margin(PL(header_pulse), duration, PL(margin))) {
+			s->bits = 0;
+			s->state = STATE_HEADER_SPACE;
+			s->count = 0;
+			break;
+		}
+		if (pulse && PL(repeat_pulse) > 0 &&
+		    eq_margin(PL(repeat_pulse), duration, PL(margin))) {
+			s->state = STATE_REPEAT_SPACE;
+			s->count = 0;
+			break;
+		}
+		if (!PL(header_optional))
+			break;
+		/* pass through */
+	case STATE_BITS_PULSE:
+		if (!pulse)
+			break;
+
+		unsigned long set_bit = 1;
+
+		if (PL(reverse))
+			set_bit <<= s->count;
+		else
+			s->bits <<= 1;
+
+		if (eq_margin(PL(bit_1_pulse), duration, PL(margin)))
+			s->bits |= set_bit;
+		else if (!eq_margin(PL(bit_0_pulse), duration, PL(margin))) {
+			s->state = STATE_INACTIVE;
+			break;
+		}
+
+		s->count++;
+		if (s->count == PL(bits)) {
+			stats_keydown(sample, PL(rc_protocol), s->bits, 0);
+			s->state = STATE_INACTIVE;
+		} else {
+			s->state = STATE_BITS_SPACE;
+		}
+		break;
+	case STATE_BITS_SPACE:
+		if (!pulse && eq_margin(PL(bit_space), duration, PL(margin)))
+			s->state = STATE_BITS_PULSE;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_TRAILER:
+		if (pulse && eq_margin(PL(trailer_pulse), duration, PL(margin)))
+			stats_repeat(sample);
+
+		s->state = STATE_INACTIVE;
+	}
+}
+
+#undef PL
+
+#endif
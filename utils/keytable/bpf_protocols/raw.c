@@ -2,29 +2,26 @@
 //
 // Copyright (C) 2019 Sean Young <sean@mess.org>
 //
-// This decoder matches pre-defined pulse-space sequences. It does so by
-// iterating through the list There are many optimisation possible, if
-// performance is an issue.
+// This decoder matches pre-defined pulse-space sequences. ir-keytable
+// compiles the patterns into a trie, much like a regex is compiled into a
+// state machine: each node is the set of patterns that match the pulses and
+// spaces seen so far, and each edge out of it covers a range of durations
+// which leads to the same set of patterns for the next pulse or space. The
+// ranges already include the margin, and do not overlap.
 //
-// First of all iterating through the list of patterns is one-by-one, even
-// though after the first few pulse space sequences, most patterns will be
-// will not be a match. The bitmap datastructure could use a "next clear bit"
-// function.
-//
-// Secondly this can be transformed into a much more efficient state machine,
-// where we pre-compile the patterns much like a regex.
+// So for each pulse or space, only the edges of a single node are searched,
+// whatever the number of patterns.
 
 #include <linux/lirc.h>
 #include <linux/bpf.h>
 
 #include "bpf_helpers.h"
-#include "bitmap.h"
 
-#define MAX_PATTERNS 1024
+// The edges of a node are found by binary search
+#define MAX_EDGES_SHIFT 16
 
 struct decoder_state {
-	int pos;
-	DECLARE_BITMAP(nomatch, MAX_PATTERNS);
+	int node;
 };
 
 struct bpf_map_def SEC("lirc_mode2/maps") decoder_state_map = {
@@ -34,19 +31,34 @@ struct bpf_map_def SEC("lirc_mode2/maps") decoder_state_map = {
 	.max_entries = 1,
 };
 
-struct raw_pattern {
+// This should match the structs in ir-keytable
+struct raw_node {
 	unsigned int scancode;
-	unsigned short raw[0];
+	unsigned int accept;
+	unsigned int edges;
+	unsigned int nr_edges;
+};
+
+struct raw_edge {
+	unsigned int min;
+	unsigned int max;
+	int node;
 };
 
-// ir-keytable will load the raw patterns here
-struct bpf_map_def SEC("lirc_mode2/maps") raw_map = {
+// ir-keytable will load the compiled patterns here, node 0 is the root
+struct bpf_map_def SEC("lirc_mode2/maps") raw_nodes = {
 	.type = BPF_MAP_TYPE_ARRAY,
 	.key_size = sizeof(unsigned int),
-	.value_size = sizeof(struct raw_pattern), // this is not used
-	.max_entries = MAX_PATTERNS,
+	.value_size = sizeof(struct raw_node),
+	.max_entries = 1, // this is not used
 };
 
+struct bpf_map_def SEC("lirc_mode2/maps") raw_edges = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(unsigned int),
+	.value_size = sizeof(struct raw_edge),
+	.max_entries = 1, // this is not used
+};
 
 // These values can be overridden in the rc_keymap toml
 //
@@ -54,26 +66,26 @@ struct bpf_map_def SEC("lirc_mode2/maps") raw_map = {
 // an int, so that the compiler emits a mov immediate for the address
 // but uses it as an int. The bpf loader replaces the relocation with the
 // actual value (either overridden or taken from the data segment).
+//
+// The margin is used by ir-keytable when compiling the patterns.
 int margin = 200;
 int rc_protocol = 68;
-// The following two values are calculated by ir-keytable
+// This value is calculated by ir-keytable
 int trail_space = 1000;
-int max_length = 1;
 
 #define BPF_PARAM(x) (int)(long)(&(x))
 
-static inline int eq_margin(unsigned d1, unsigned d2)
-{
-	return ((d1 > (d2 - BPF_PARAM(margin))) && (d1 < (d2 + BPF_PARAM(margin))));
-}
+#include "decoder_stats.h"
 
 SEC("lirc_mode2/raw")
 int bpf_decoder(unsigned int *sample)
 {
 	unsigned int key = 0;
 	struct decoder_state *s = bpf_map_lookup_elem(&decoder_state_map, &key);
-	struct raw_pattern *p;
-	unsigned int i;
+	struct raw_node *n;
+	struct raw_edge *e;
+	unsigned int lo, hi, mid, i;
+	int next = -1;
 
 	// Make verifier happy. Should never come to pass
 	if (!s)
@@ -89,60 +101,61 @@ int bpf_decoder(unsigned int *sample)
 		return 0;
 	}
 
-	int duration = LIRC_VALUE(*sample);
+	unsigned int duration = LIRC_VALUE(*sample);
 	int pulse = LIRC_IS_PULSE(*sample);
-	int pos = s->pos;
-
-	if (pos < 0 || pos >= BPF_PARAM(max_length)) {
-		if (!pulse && duration >= BPF_PARAM(trail_space)) {
-			bitmap_zero(s->nomatch, MAX_PATTERNS);
-			s->pos = 0;
-		}
+	int trail = !pulse && duration >= BPF_PARAM(trail_space);
+	unsigned long long start = stats_begin();
+	int was_active = s->node > 0;
+
+	// No pattern matches, wait for the trailing space
+	if (s->node < 0) {
+		if (trail)
+			s->node = 0;
+		goto out;
+	}
 
-		return 0;
+	key = s->node;
+	n = bpf_map_lookup_elem(&raw_nodes, &key);
+	// Make verifier happy. Should never come to pass
+	if (!n) {
+		s->node = -1;
+		goto out;
 	}
 
-	if (!pulse && duration >= BPF_PARAM(trail_space)) {
-		for (i = 0; i < MAX_PATTERNS; i++) {
-			key = i;
-			p = bpf_map_lookup_elem(&raw_map, &key);
-			// Make verifier happy. Should never come to pass
-			if (!p)
-				break;
-
-			// Has this pattern already mismatched?
-			if (bitmap_test(s->nomatch, i))
-				continue;
-
-			// Are we at the end of the pattern?
-			if (p->raw[pos] == 0)
-				bpf_rc_keydown(sample, BPF_PARAM(rc_protocol),
-					       p->scancode, 0);
-		}
+	if (trail) {
+		// Is this the end of a pattern?
+		if (n->accept)
+			stats_keydown(sample, BPF_PARAM(rc_protocol),
+				      n->scancode, 0);
+		s->node = 0;
+		goto out;
+	}
 
-		bitmap_zero(s->nomatch, MAX_PATTERNS);
-		s->pos = 0;
-	} else {
-		for (i = 0; i < MAX_PATTERNS; i++) {
-			key = i;
-			p = bpf_map_lookup_elem(&raw_map, &key);
-			// Make verifier happy. Should never come to pass
-			if (!p)
-				break;
-
-			// Has this pattern already mismatched?
-			if (bitmap_test(s->nomatch, i))
-				continue;
-
-			// If the pattern ended, or does not match
-			if (p->raw[pos] == 0 ||
-				!eq_margin(duration,  p->raw[pos]))
-				bitmap_set(s->nomatch, i);
+	lo = n->edges;
+	hi = n->edges + n->nr_edges;
+	for (i = 0; i <= MAX_EDGES_SHIFT && lo < hi; i++) {
+		mid = lo + (hi - lo) / 2;
+		key = mid;
+		e = bpf_map_lookup_elem(&raw_edges, &key);
+		// Make verifier happy. Should never come to pass
+		if (!e)
+			break;
+
+		if (duration < e->min) {
+			hi = mid;
+		} else if (duration > e->max) {
+			lo = mid + 1;
+		} else {
+			next = e->node;
+			break;
 		}
-
-		s->pos++;
 	}
 
+	s->node = next;
+out:
+	// A pattern which stops matching is counted as a reset
+	stats_end(start, was_active, s->node > 0);
+
 	return 0;
 }
 
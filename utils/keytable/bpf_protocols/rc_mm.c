@@ -39,6 +39,8 @@ struct bpf_map_def SEC("lirc_mode2/maps") decoder_state_map = {
 
 #define BPF_PARAM(x) (int)(long)(&(x))
 
+#include "decoder_stats.h"
+
 int margin = 100;
 int header_pulse = 417;
 int header_space = 278;
@@ -74,6 +76,9 @@ int bpf_decoder(unsigned int *sample)
 		return 0;
 	}
 
+	unsigned long long start = stats_begin();
+	int was_active = s->state != STATE_INACTIVE;
+
 	int duration = LIRC_VALUE(*sample);
 
 	switch (s->state) {
@@ -127,11 +132,13 @@ int bpf_decoder(unsigned int *sample)
 		break;
 	case STATE_TRAILER:
 		if (LIRC_IS_PULSE(*sample) && eq_margin(BPF_PARAM(trailer), duration))
-			bpf_rc_keydown(sample, BPF_PARAM(rc_protocol), s->bits, 0);
+			stats_keydown(sample, BPF_PARAM(rc_protocol), s->bits, 0);
 
 		s->state = STATE_INACTIVE;
 	}
 
+	stats_end(start, was_active, s->state != STATE_INACTIVE);
+
 	return 0;
 }
 
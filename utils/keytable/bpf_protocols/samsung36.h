@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+//
+// Remote protocol used by some Samsung remotes. It has 36 bits and the
+// 16th bit is not really a bit, but a marker to distinguish it from
+// shorter samsung protocols.
+//
+// http://www.hifi-remote.com/wiki/index.php/DecodeIR#Samsung36
+// Copyright (C) 2020 Sean Young <sean@mess.org>
+
+#ifndef __SAMSUNG36_H
+#define __SAMSUNG36_H
+
+#include "decoder.h"
+
+int samsung36_margin = 300;
+int samsung36_rc_protocol = 69;
+
+#define S36(x) BPF_PARAM(samsung36_##x)
+
+static __always_inline void samsung36_decode(struct decoder_state *s,
+					     unsigned int *sample,
+					     int duration, int pulse)
+{
+	switch (s->state) {
+	case STATE_INACTIVE:
+		if (pulse && eq_margin(duration, 4500, S36(margin))) {
+			s->bits = 0;
+			s->state = STATE_HEADER_SPACE;
+			s->count = 0;
+		}
+		break;
+	case STATE_HEADER_SPACE:
+		if (!pulse && eq_margin(duration, 4500, S36(margin)))
+			s->state = STATE_BITS_PULSE;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_BITS_PULSE:
+		if (pulse && eq_margin(duration, 500, S36(margin)))
+			s->state = STATE_BITS_SPACE;
+		else
+			s->state = STATE_INACTIVE;
+		break;
+	case STATE_BITS_SPACE:
+		if (pulse) {
+			s->state = STATE_INACTIVE;
+			break;
+		}
+
+		s->count++;
+
+		if (s->count == 17) {
+			if (eq_margin(duration, 4450, S36(margin))) {
+				s->state = STATE_BITS_PULSE;
+			} else {
+				s->state = STATE_INACTIVE;
+			}
+			break;
+		}
+
+		s->bits <<= 1;
+
+		if (eq_margin(duration, 1600, S36(margin))) {
+			s->bits |= 1;
+		} else if (!eq_margin(duration, 500, S36(margin))) {
+			s->state = STATE_INACTIVE;
+			break;
+		}
+
+		if (s->count == 37)
+			s->state = STATE_TRAILER;
+		else
+			s->state = STATE_BITS_PULSE;
+		break;
+	case STATE_TRAILER:
+		if (pulse && eq_margin(duration, 500, S36(margin))) {
+			stats_keydown(sample, S36(rc_protocol), s->bits, 0);
+		}
+
+		s->state = STATE_INACTIVE;
+		break;
+	default:
+		// samsung36 has no repeat
+		s->state = STATE_INACTIVE;
+	}
+}
+
+#undef S36
+
+#endif
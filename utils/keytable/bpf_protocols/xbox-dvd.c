@@ -46,6 +46,8 @@ int rc_protocol = 68;
 
 #define BPF_PARAM(x) (int)(long)(&(x))
 
+#include "decoder_stats.h"
+
 static inline int eq_margin(unsigned d1, unsigned d2)
 {
 	return ((d1 > (d2 - BPF_PARAM(margin))) && (d1 < (d2 + BPF_PARAM(margin))));
@@ -70,6 +72,9 @@ int bpf_decoder(unsigned int *sample)
 		return 0;
 	}
 
+	unsigned long long start = stats_begin();
+	int was_active = s->state != STATE_INACTIVE;
+
 	int duration = LIRC_VALUE(*sample);
 	int pulse = LIRC_IS_PULSE(*sample);
 
@@ -117,12 +122,14 @@ int bpf_decoder(unsigned int *sample)
 	case STATE_TRAILER:
 		if (pulse && eq_margin(BPF_PARAM(trailer_pulse), duration)) {
 			if (((s->bits >> 12) ^ (s->bits & 0xfff)) == 0xfff)
-				bpf_rc_keydown(sample, BPF_PARAM(rc_protocol), s->bits & 0xfff, 0);
+				stats_keydown(sample, BPF_PARAM(rc_protocol), s->bits & 0xfff, 0);
 		}
 
 		s->state = STATE_INACTIVE;
 	}
 
+	stats_end(start, was_active, s->state != STATE_INACTIVE);
+
 	return 0;
 }
 
@@ -1 +0,0 @@
-../common/ir-encode.c
\ No newline at end of file
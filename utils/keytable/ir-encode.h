@@ -1 +0,0 @@
-../common/ir-encode.h
\ No newline at end of file
@@ -1 +0,0 @@
-../common/keymap.c
\ No newline at end of file
@@ -1 +0,0 @@
-../common/keymap.h
\ No newline at end of file
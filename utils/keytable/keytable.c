@@ -23,6 +23,7 @@
 #include <linux/input.h>
 #include <linux/lirc.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
@@ -37,6 +38,7 @@
 
 #ifdef HAVE_BPF
 #include <bpf/bpf.h>
+#include <bpf/libbpf.h>
 #include "bpf_load.h"
 #endif
 
@@ -83,6 +85,7 @@ struct keytable_entry {
 	unsigned long long scancode;
 	uint32_t keycode;
 	struct keytable_entry *next;
+	struct keytable_entry *hash_next;
 };
 
 // Whenever for each key which has a raw entry rather than a scancode,
@@ -93,11 +96,9 @@ static int raw_scancode = 0;
 struct keytable_entry *keytable = NULL;
 struct raw_entry *rawtable = NULL;
 
-struct uevents {
-	char		*key;
-	char		*value;
-	struct uevents	*next;
-};
+// The keytable entries by scancode, so that large keymaps load in linear time
+#define KEYTABLE_HASH_SIZE 4096
+static struct keytable_entry *keytable_hash[KEYTABLE_HASH_SIZE];
 
 struct cfgfile {
 	char		*driver;
@@ -225,11 +226,46 @@ static void write_sysfs_protocols(enum sysfs_protocols protocols, FILE *fp, cons
 	}
 }
 
+// Case insensitive, as are the key names
+static unsigned int name_hash(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *s; s++)
+		h = (h ^ tolower((unsigned char)*s)) * 16777619u;
+	return h;
+}
+
+// Must be a power of two larger than the number of key names
+#define KEY_NAMES_HASH_SIZE 2048
+static struct parse_event *key_names_hash[KEY_NAMES_HASH_SIZE];
+
 static int parse_code(const char *string)
 {
+	static bool hashed;
 	struct parse_event *p;
+	unsigned int i;
 
-	for (p = key_events; p->name != NULL; p++) {
+	if (!hashed) {
+		for (p = key_events; p->name != NULL; p++) {
+			i = name_hash(p->name);
+			// Like a linear search, the first one of a name wins
+			for (;; i++) {
+				struct parse_event **h = &key_names_hash[i % KEY_NAMES_HASH_SIZE];
+
+				if (!*h) {
+					*h = p;
+					break;
+				}
+				if (!strcasecmp((*h)->name, p->name))
+					break;
+			}
+		}
+		hashed = true;
+	}
+
+	for (i = name_hash(string); key_names_hash[i % KEY_NAMES_HASH_SIZE]; i++) {
+		p = key_names_hash[i % KEY_NAMES_HASH_SIZE];
 		if (!strcasecmp(p->name, string))
 			return p->value;
 	}
@@ -273,6 +309,7 @@ static const struct argp_option options[] = {
 	{"delay",	'D',	N_("DELAY"),	0,	N_("Sets the delay before repeating a keystroke"), 0},
 	{"period",	'P',	N_("PERIOD"),	0,	N_("Sets the period to repeat a keystroke"), 0},
 	{"auto-load",	'a',	N_("CFGFILE"),	0,	N_("Auto-load keymaps, based on a configuration file. Only works with --sysdev."), 0},
+	{"bpf-stats",	-4,	0,		0,	N_("show the statistics of the attached BPF protocols"), 0},
 	{"help",        '?',	0,		0,	N_("Give this help list"), -1},
 	{"usage",	-3,	0,		0,	N_("Give a short usage message")},
 	{"version",	'V',	0,		0,	N_("Print program version"), -1},
@@ -287,6 +324,7 @@ static int readtable = 0;
 static int clear = 0;
 int debug = 0;
 static int test = 0;
+static int bpf_stats = 0;
 static int delay = -1;
 static int period = -1;
 static enum sysfs_protocols ch_proto = 0;
@@ -295,6 +333,7 @@ struct bpf_protocol {
 	struct bpf_protocol *next;
 	struct protocol_param *param;
 	char *name;
+	bool multi;
 };
 
 static struct bpf_protocol *bpf_protocol;
@@ -369,11 +408,54 @@ static void add_bpf_protocol(struct bpf_protocol *new)
 	bpf_protocol = new;
 }
 
+static struct keytable_entry **keytable_bucket(unsigned long long scancode)
+{
+	return &keytable_hash[(scancode * 0x9e3779b97f4a7c15ULL) >> 52];
+}
+
+static struct keytable_entry *find_keytable_entry(unsigned long long scancode)
+{
+	struct keytable_entry *ke;
+
+	for (ke = *keytable_bucket(scancode); ke; ke = ke->hash_next)
+		if (ke->scancode == scancode)
+			return ke;
+	return NULL;
+}
+
+/*
+ * The entries are written to the kernel from the most recently added one,
+ * so the first mapping of a scancode wins. Later ones are not added, which
+ * gives the same result with fewer ioctls.
+ */
+static int add_keytable_entry(unsigned long long scancode, uint32_t keycode)
+{
+	struct keytable_entry *ke = find_keytable_entry(scancode);
+
+	if (ke) {
+		if (debug && ke->keycode != keycode)
+			fprintf(stderr, _("scancode 0x%04llx is already mapped to 0x%04x, ignoring 0x%04x\n"),
+				scancode, ke->keycode, keycode);
+		return 0;
+	}
+
+	ke = malloc(sizeof(*ke));
+	if (!ke)
+		return ENOMEM;
+	ke->scancode = scancode;
+	ke->keycode = keycode;
+	ke->next = keytable;
+	ke->hash_next = *keytable_bucket(scancode);
+	*keytable_bucket(scancode) = ke;
+	keytable = ke;
+
+	return 0;
+}
+
 static int add_keymap(struct keymap *map, const char *fname)
 {
 	for (; map; map = map->next) {
 		enum sysfs_protocols protocol;
-		struct keytable_entry *ke;
 		struct scancode_entry *se;
 		struct raw_entry *re, *re_next;
 
@@ -409,12 +491,8 @@ static int add_keymap(struct keymap *map, const char *fname)
 				}
 			}
 
-			ke = malloc(sizeof(*ke));
-			ke->scancode = se->scancode;
-			ke->keycode = value;
-			ke->next = keytable;
-
-			keytable = ke;
+			if (add_keytable_entry(se->scancode, value))
+				return ENOMEM;
 		}
 
 		for (re = map->raw; re; re = re_next) {
@@ -435,12 +513,12 @@ static int add_keymap(struct keymap *map, const char *fname)
 				}
 			}
 
-			ke = malloc(sizeof(*ke));
-			ke->scancode = raw_scancode;
-			ke->keycode = value;
-			ke->next = keytable;
+			// Don't collide with the scancodes of other keymaps
+			while (find_keytable_entry(raw_scancode))
+				raw_scancode++;
 
-			keytable = ke;
+			if (add_keytable_entry(raw_scancode, value))
+				return ENOMEM;
 
 			re->scancode = raw_scancode++;
 			re->next = rawtable;
@@ -454,6 +532,379 @@ static int add_keymap(struct keymap *map, const char *fname)
 	return 0;
 }
 
+/*
+ * Keymap cache
+ *
+ * When auto-loading, the keymaps that match an rc device are parsed and
+ * resolved into keytable entries, raw patterns and protocols. The result
+ * is cached per driver and table, together with the keymap files it came
+ * from. As long as the configuration resolves to the same files and none
+ * of them changed, the cache is used instead.
+ *
+ * The cache is only for this machine, so it is in native byte order.
+ */
+#define KEYMAP_CACHE_MAGIC	0x4b435249
+#define KEYMAP_CACHE_VERSION	1
+
+struct cache_buf {
+	char *data;
+	size_t len, size;
+	bool error;
+};
+
+static void cache_put(struct cache_buf *b, const void *p, size_t len)
+{
+	if (b->len + len > b->size) {
+		size_t size = (b->size + len) * 2;
+		char *data = realloc(b->data, size);
+
+		if (!data) {
+			b->error = true;
+			return;
+		}
+		b->data = data;
+		b->size = size;
+	}
+	memcpy(b->data + b->len, p, len);
+	b->len += len;
+}
+
+static void cache_put_u32(struct cache_buf *b, uint32_t v)
+{
+	cache_put(b, &v, sizeof(v));
+}
+
+static void cache_put_u64(struct cache_buf *b, uint64_t v)
+{
+	cache_put(b, &v, sizeof(v));
+}
+
+static void cache_put_str(struct cache_buf *b, const char *s)
+{
+	cache_put_u32(b, strlen(s));
+	cache_put(b, s, strlen(s));
+}
+
+static void cache_get(struct cache_buf *b, void *p, size_t len)
+{
+	if (b->error || b->size - b->len < len) {
+		b->error = true;
+		memset(p, 0, len);
+		return;
+	}
+	memcpy(p, b->data + b->len, len);
+	b->len += len;
+}
+
+static uint32_t cache_get_u32(struct cache_buf *b)
+{
+	uint32_t v;
+
+	cache_get(b, &v, sizeof(v));
+	return v;
+}
+
+static uint64_t cache_get_u64(struct cache_buf *b)
+{
+	uint64_t v;
+
+	cache_get(b, &v, sizeof(v));
+	return v;
+}
+
+// Returns an allocated copy of the string, or NULL on error
+static char *cache_get_str(struct cache_buf *b)
+{
+	uint32_t len = cache_get_u32(b);
+	char *s;
+
+	if (b->error || b->size - b->len < len) {
+		b->error = true;
+		return NULL;
+	}
+	s = strndup(b->data + b->len, len);
+	if (!s)
+		b->error = true;
+	b->len += len;
+	return s;
+}
+
+static char *keymap_cache_name(const char *driver, const char *table)
+{
+	char *fname, *p;
+
+	if (asprintf(&fname, IR_KEYTABLE_CACHE_DIR "/%s:%s.cache", driver, table) < 0)
+		return NULL;
+	for (p = fname + strlen(IR_KEYTABLE_CACHE_DIR) + 1; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	return fname;
+}
+
+static void cache_put_header(struct cache_buf *b, const char *driver, const char *table,
+			     char **sources, int nr_sources)
+{
+	struct stat st;
+	int i;
+
+	cache_put_u32(b, KEYMAP_CACHE_MAGIC);
+	cache_put_u32(b, KEYMAP_CACHE_VERSION);
+	cache_put_str(b, V4L_UTILS_VERSION);
+	cache_put_str(b, driver);
+	cache_put_str(b, table);
+	cache_put_u32(b, nr_sources);
+	for (i = 0; i < nr_sources; i++) {
+		if (stat(sources[i], &st))
+			b->error = true;
+		cache_put_str(b, sources[i]);
+		cache_put_u64(b, st.st_ino);
+		cache_put_u64(b, st.st_size);
+		cache_put_u64(b, st.st_mtim.tv_sec);
+		cache_put_u64(b, st.st_mtim.tv_nsec);
+	}
+}
+
+static void free_tables(void)
+{
+	struct keytable_entry *ke;
+	struct raw_entry *re;
+	struct bpf_protocol *b;
+
+	while (keytable) {
+		ke = keytable;
+		keytable = ke->next;
+		free(ke);
+	}
+	memset(keytable_hash, 0, sizeof(keytable_hash));
+
+	while (rawtable) {
+		re = rawtable;
+		rawtable = re->next;
+		free(re->keycode);
+		free(re);
+	}
+	raw_scancode = 0;
+
+	while (bpf_protocol) {
+		struct protocol_param *param;
+
+		b = bpf_protocol;
+		bpf_protocol = b->next;
+		while (b->param) {
+			param = b->param;
+			b->param = param->next;
+			free(param->name);
+			free(param);
+		}
+		free(b->name);
+		free(b);
+	}
+	ch_proto = 0;
+}
+
+/*
+ * Loads the tables from the cache, if it was made from the same sources.
+ * Returns 0 on success. The tables must be empty.
+ */
+static int load_keymap_cache(const char *driver, const char *table,
+			     char **sources, int nr_sources)
+{
+	struct cache_buf expected = { 0 };
+	struct cache_buf b = { 0 };
+	uint32_t nr_keys, nr_raw, nr_bpf, i, j;
+	char *fname = keymap_cache_name(driver, table);
+	struct stat st;
+	void *data;
+	int fd;
+
+	if (!fname)
+		return -1;
+	fd = open(fname, O_RDONLY);
+	free(fname);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return -1;
+
+	b.data = data;
+	b.size = st.st_size;
+
+	// The header and sources must be exactly what they would be now
+	cache_put_header(&expected, driver, table, sources, nr_sources);
+	if (expected.error || expected.len > b.size ||
+	    memcmp(expected.data, b.data, expected.len)) {
+		free(expected.data);
+		munmap(data, st.st_size);
+		return -1;
+	}
+	b.len = expected.len;
+	free(expected.data);
+
+	ch_proto = cache_get_u32(&b);
+
+	nr_keys = cache_get_u32(&b);
+	for (i = 0; i < nr_keys && !b.error; i++) {
+		uint64_t scancode = cache_get_u64(&b);
+		uint32_t keycode = cache_get_u32(&b);
+
+		if (!b.error && add_keytable_entry(scancode, keycode))
+			b.error = true;
+	}
+
+	nr_raw = cache_get_u32(&b);
+	for (i = 0; i < nr_raw && !b.error; i++) {
+		uint64_t scancode = cache_get_u64(&b);
+		uint32_t raw_length = cache_get_u32(&b);
+		struct raw_entry *re;
+
+		if (b.error || raw_length > (b.size - b.len) / sizeof(re->raw[0])) {
+			b.error = true;
+			break;
+		}
+		re = calloc(1, sizeof(*re) + sizeof(re->raw[0]) * raw_length);
+		if (!re) {
+			b.error = true;
+			break;
+		}
+		re->scancode = scancode;
+		re->raw_length = raw_length;
+		cache_get(&b, re->raw, sizeof(re->raw[0]) * raw_length);
+		re->next = rawtable;
+		rawtable = re;
+	}
+	raw_scancode = cache_get_u32(&b);
+
+	nr_bpf = cache_get_u32(&b);
+	for (i = 0; i < nr_bpf && !b.error; i++) {
+		struct bpf_protocol *bp = calloc(1, sizeof(*bp));
+		uint32_t nr_params;
+
+		if (!bp) {
+			b.error = true;
+			break;
+		}
+		bp->name = cache_get_str(&b);
+		nr_params = cache_get_u32(&b);
+		for (j = 0; j < nr_params && !b.error; j++) {
+			struct protocol_param *param = calloc(1, sizeof(*param));
+
+			if (!param) {
+				b.error = true;
+				break;
+			}
+			param->name = cache_get_str(&b);
+			param->value = (int64_t)cache_get_u64(&b);
+			param->next = bp->param;
+			bp->param = param;
+		}
+		// Added in order, so that the list is as it was
+		bp->next = bpf_protocol;
+		bpf_protocol = bp;
+	}
+
+	if (b.len != b.size)
+		b.error = true;
+	munmap(data, st.st_size);
+
+	if (b.error) {
+		free_tables();
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Lists are built by prepending, so are stored from the tail: loading
+ * them prepends the entries in the order they were added.
+ */
+#define CACHE_PUT_REVERSED(b, type, head, put_entry)			\
+	do {								\
+		type *_e, **_a;						\
+		uint32_t _n = 0;					\
+									\
+		for (_e = head; _e; _e = _e->next)			\
+			_n++;						\
+		cache_put_u32(b, _n);					\
+		_a = malloc((_n + 1) * sizeof(*_a));			\
+		if (!_a) {						\
+			(b)->error = true;				\
+			break;						\
+		}							\
+		for (_e = head, _n = 0; _e; _e = _e->next)		\
+			_a[_n++] = _e;					\
+		while (_n--) {						\
+			_e = _a[_n];					\
+			put_entry;					\
+		}							\
+		free(_a);						\
+	} while (0)
+
+static void write_keymap_cache(const char *driver, const char *table,
+			       char **sources, int nr_sources)
+{
+	struct cache_buf b = { 0 };
+	char *fname, *tmp;
+	FILE *f;
+
+	cache_put_header(&b, driver, table, sources, nr_sources);
+	cache_put_u32(&b, ch_proto);
+
+	CACHE_PUT_REVERSED(&b, struct keytable_entry, keytable, {
+		cache_put_u64(&b, _e->scancode);
+		cache_put_u32(&b, _e->keycode);
+	});
+
+	CACHE_PUT_REVERSED(&b, struct raw_entry, rawtable, {
+		cache_put_u64(&b, _e->scancode);
+		cache_put_u32(&b, _e->raw_length);
+		cache_put(&b, _e->raw, sizeof(_e->raw[0]) * _e->raw_length);
+	});
+	cache_put_u32(&b, raw_scancode);
+
+	CACHE_PUT_REVERSED(&b, struct bpf_protocol, bpf_protocol, {
+		struct protocol_param *param;
+		uint32_t nr_params = 0;
+
+		cache_put_str(&b, _e->name);
+		for (param = _e->param; param; param = param->next)
+			nr_params++;
+		cache_put_u32(&b, nr_params);
+		// The order of the parameters doesn't matter
+		for (param = _e->param; param; param = param->next) {
+			cache_put_str(&b, param->name);
+			cache_put_u64(&b, (uint64_t)param->value);
+		}
+	});
+
+	fname = keymap_cache_name(driver, table);
+	if (b.error || !fname || asprintf(&tmp, "%s.%d", fname, getpid()) < 0) {
+		free(b.data);
+		free(fname);
+		return;
+	}
+
+	// The cache is optional, so failures are silently ignored
+	mkdir(IR_KEYTABLE_CACHE_DIR, 0755);
+	f = fopen(tmp, "w");
+	if (f) {
+		bool ok = fwrite(b.data, 1, b.len, f) == b.len;
+
+		if (fclose(f) || !ok || rename(tmp, fname))
+			unlink(tmp);
+		else if (debug)
+			fprintf(stderr, _("Wrote keymap cache %s\n"), fname);
+	}
+	free(tmp);
+	free(fname);
+	free(b.data);
+}
+
 static error_t parse_cfgfile(char *fname)
 {
 	FILE *fin;
@@ -585,29 +1036,21 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case 'k':
 		p = strtok(arg, ":=");
 		do {
-			struct keytable_entry *ke;
+			unsigned long long scancode;
 
 			if (!p) {
 				argp_error(state, _("Missing scancode: %s"), arg);
 				break;
 			}
 
-			ke = calloc(1, sizeof(*ke));
-			if (!ke) {
-				perror(_("No memory!\n"));
-				return ENOMEM;
-			}
-
-			ke->scancode = strtoull(p, NULL, 0);
+			scancode = strtoull(p, NULL, 0);
 			if (errno) {
-				free(ke);
 				argp_error(state, _("Invalid scancode: %s"), p);
 				break;
 			}
 
 			p = strtok(NULL, ",;");
 			if (!p) {
-				free(ke);
 				argp_error(state, _("Missing keycode"));
 				break;
 			}
@@ -616,20 +1059,19 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 			if (key == -1) {
 				key = strtol(p, NULL, 0);
 				if (errno) {
-					free(ke);
 					argp_error(state, _("Unknown keycode: %s"), p);
 					break;
 				}
 			}
 
-			ke->keycode = key;
-
 			if (debug)
 				fprintf(stderr, _("scancode 0x%04llx=%u\n"),
-					ke->scancode, ke->keycode);
+					scancode, (unsigned int)key);
 
-			ke->next = keytable;
-			keytable = ke;
+			if (add_keytable_entry(scancode, key)) {
+				perror(_("No memory!\n"));
+				return ENOMEM;
+			}
 
 			p = strtok(NULL, ":=");
 		} while (p);
@@ -707,6 +1149,9 @@ static error_t parse_opt(int k, char *arg, struct argp_state *state)
 	case -3:
 		argp_state_help(state, state->out_stream, ARGP_HELP_USAGE);
 		exit(0);
+	case -4:
+		bpf_stats++;
+		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
 	}
@@ -800,97 +1245,92 @@ err:
 	return NULL;
 }
 
-static void free_uevent(struct uevents *uevent)
+/*
+ * The sysfs attributes are never larger than a page, so each is read with
+ * a single read() relative to the directory it is in. dname is only used
+ * for the messages. Returns the length read, or -1 on error.
+ */
+static ssize_t read_sysfs_attr(int dirfd, const char *dname, const char *name,
+			       char *buf, size_t size)
 {
-	struct uevents *old;
-	do {
-		old = uevent;
-		uevent = uevent->next;
-		if (old->key)
-			free(old->key);
-		if (old->value)
-			free(old->value);
-		free(old);
-	} while (uevent);
-}
+	ssize_t len;
+	int fd;
 
-static struct uevents *read_sysfs_uevents(char *dname)
-{
-	FILE		*fp;
-	struct uevents	*next, *uevent;
-	char		*event = "uevent", *file, *line = NULL;
-	size_t		line_size;
+	if (debug)
+		fprintf(stderr, _("Reading %s%s\n"), dname, name);
 
-	next = uevent = calloc(1, sizeof(*uevent));
+	fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "%s%s: %m\n", dname, name);
+		return -1;
+	}
 
-	file = malloc(strlen(dname) + strlen(event) + 1);
-	strcpy(file, dname);
-	strcat(file, event);
+	len = read(fd, buf, size - 1);
+	if (len < 0)
+		fprintf(stderr, "%s%s: %m\n", dname, name);
+	else
+		buf[len] = '\0';
+	close(fd);
 
-	if (debug)
-		fprintf(stderr, _("Parsing uevent %s\n"), file);
+	return len;
+}
 
+// Returns a copy of the value of key in a uevent, after prefix
+static char *uevent_value(const char *uevent, const char *key, const char *prefix)
+{
+	size_t len = strlen(key);
+	const char *line, *end;
+	char *value;
 
-	fp = fopen(file, "r");
-	if (!fp) {
-		perror(file);
-		free(file);
-		return NULL;
-	}
-	while (getline(&line, &line_size, fp) > 0) {
-		char *p = strtok(line, "=");
-		if (!p)
+	for (line = uevent; *line; line = end + (*end == '\n')) {
+		end = strchrnul(line, '\n');
+		if (strncmp(line, key, len) || line[len] != '=')
 			continue;
-		next->key = malloc(strlen(p) + 1);
-		if (!next->key) {
-			perror("next->key");
-			fclose(fp);
-			free(line);
-			free(file);
-			free_uevent(uevent);
-			return NULL;
-		}
-		strcpy(next->key, p);
 
-		p = strtok(NULL, "\n");
-		if (!p) {
-			fprintf(stderr, _("Error on uevent information\n"));
-			fclose(fp);
-			free(line);
-			free(file);
-			free_uevent(uevent);
-			return NULL;
-		}
-		next->value = malloc(strlen(p) + 1);
-		if (!next->value) {
-			perror("next->value");
-			fclose(fp);
-			free(line);
-			free(file);
-			free_uevent(uevent);
+		line += len + 1;
+		if (asprintf(&value, "%s%.*s", prefix, (int)(end - line), line) < 0)
 			return NULL;
-		}
-		strcpy(next->value, p);
 
 		if (debug)
-			fprintf(stderr, _("%s uevent %s=%s\n"), file, next->key, next->value);
+			fprintf(stderr, _("uevent %s=%s\n"), key, value);
+		return value;
+	}
 
-		next->next = calloc(1, sizeof(*next));
-		if (!next->next) {
-			perror("next->next");
-			fclose(fp);
-			free(file);
-			free(line);
-			free_uevent(uevent);
-			return NULL;
+	return NULL;
+}
+
+/*
+ * Opens the first entry of dirfd which starts with prefix, and copies its
+ * name. count is set to the number of entries which match. Returns the fd,
+ * or -1 if none matches.
+ */
+static int open_sysfs_subdir(int dirfd, const char *prefix, char *name,
+			     size_t size, int *count)
+{
+	size_t len = strlen(prefix);
+	struct dirent *entry;
+	int fd = -1;
+	DIR *dir;
+
+	*count = 0;
+
+	dir = fdopendir(openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	if (!dir)
+		return -1;
+
+	while ((entry = readdir(dir))) {
+		if (strncmp(entry->d_name, prefix, len))
+			continue;
+
+		if (!(*count)++) {
+			snprintf(name, size, "%s", entry->d_name);
+			fd = openat(dirfd, entry->d_name,
+				    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 		}
-		next = next->next;
 	}
-	fclose(fp);
-	free(line);
-	free(file);
+	closedir(dir);
 
-	return uevent;
+	return fd;
 }
 
 static struct sysfs_names *find_device(char *name)
@@ -978,31 +1418,21 @@ static enum sysfs_protocols load_bpf_for_unsupported(enum sysfs_protocols protoc
 	return protocols;
 }
 
-static enum sysfs_protocols v1_get_hw_protocols(char *name)
+static enum sysfs_protocols v1_get_hw_protocols(struct rc_device *rc_dev,
+						int dirfd, const char *name)
 {
-	FILE *fp;
-	char *p, *buf = NULL;
-	size_t buf_size;
+	char *p, buf[4096];
 	enum sysfs_protocols protocols = 0;
 
-	fp = fopen(name, "r");
-	if (!fp) {
-		perror(name);
-		return 0;
-	}
-
-	if (getline(&buf, &buf_size, fp) <= 0) {
-		perror(name);
-		free(buf);
-		fclose(fp);
+	if (read_sysfs_attr(dirfd, rc_dev->sysfs_name, name, buf, sizeof(buf)) <= 0)
 		return 0;
-	}
 
 	for (p = strtok(buf, " \n"); p; p = strtok(NULL, " \n")) {
 		enum sysfs_protocols protocol;
 
 		if (debug)
-			fprintf(stderr, _("%s protocol %s\n"), name, p);
+			fprintf(stderr, _("%s%s protocol %s\n"),
+				rc_dev->sysfs_name, name, p);
 
 		protocol = parse_sysfs_protocol(p, false);
 		if (protocol == SYSFS_INVALID)
@@ -1011,9 +1441,6 @@ static enum sysfs_protocols v1_get_hw_protocols(char *name)
 		protocols |= protocol;
 	}
 
-	free(buf);
-	fclose(fp);
-
 	return protocols;
 }
 
@@ -1040,54 +1467,31 @@ static int v1_set_hw_protocols(struct rc_device *rc_dev)
 	return 0;
 }
 
-static int v1_get_sw_enabled_protocol(char *dirname)
+static int v1_get_sw_enabled_protocol(struct rc_device *rc_dev, int dirfd,
+				      const char *dirname)
 {
-	FILE *fp;
-	char *p, *buf = NULL, name[512];
-	size_t buf_size;
+	char *p, buf[4096], name[512];
 	int rc;
 
-	strcpy(name, dirname);
-	strcat(name, "/enabled");
-
-	fp = fopen(name, "r");
-	if (!fp) {
-		perror(name);
-		return 0;
-	}
+	snprintf(name, sizeof(name), "%s/enabled", dirname);
 
-	if (getline(&buf, &buf_size, fp) <= 0) {
-		perror(name);
-		free(buf);
-		fclose(fp);
+	if (read_sysfs_attr(dirfd, rc_dev->sysfs_name, name, buf, sizeof(buf)) <= 0)
 		return 0;
-	}
-
-	if (fclose(fp)) {
-		perror(name);
-		free(buf);
-		return errno;
-	}
 
 	p = strtok(buf, " \n");
 	if (!p) {
-		fprintf(stderr, _("%s has invalid content: '%s'\n"), name, buf);
+		fprintf(stderr, _("%s%s has invalid content: '%s'\n"),
+			rc_dev->sysfs_name, name, buf);
 		return 0;
 	}
 
 	rc = atoi(p);
 
 	if (debug)
-		fprintf(stderr, _("protocol %s is %s\n"),
+		fprintf(stderr, _("protocol %s%s is %s\n"), rc_dev->sysfs_name,
 			name, rc? _("enabled") : _("disabled"));
 
-	if (atoi(p) == 1) {
-		free(buf);
-		return 1;
-	}
-
-	free(buf);
-	return 0;
+	return rc == 1;
 }
 
 static int v1_set_sw_enabled_protocol(struct rc_device *rc_dev,
@@ -1119,25 +1523,14 @@ static int v1_set_sw_enabled_protocol(struct rc_device *rc_dev,
 	return 0;
 }
 
-static enum sysfs_protocols v2_get_protocols(struct rc_device *rc_dev, char *name)
+static enum sysfs_protocols v2_get_protocols(struct rc_device *rc_dev, int dirfd,
+					     const char *name)
 {
-	FILE *fp;
-	char *p, *buf = NULL;
-	size_t buf_size;
+	char *p, buf[4096];
 	int enabled;
 
-	fp = fopen(name, "r");
-	if (!fp) {
-		perror(name);
-		return 0;
-	}
-
-	if (getline(&buf, &buf_size, fp) <= 0) {
-		free(buf);
-		perror(name);
-		fclose(fp);
+	if (read_sysfs_attr(dirfd, rc_dev->sysfs_name, name, buf, sizeof(buf)) <= 0)
 		return 0;
-	}
 
 	for (p = strtok(buf, " \n"); p; p = strtok(NULL, " \n")) {
 		enum sysfs_protocols protocol;
@@ -1150,7 +1543,8 @@ static enum sysfs_protocols v2_get_protocols(struct rc_device *rc_dev, char *nam
 			enabled = 0;
 
 		if (debug)
-			fprintf(stderr, _("%s protocol %s (%s)\n"), name, p,
+			fprintf(stderr, _("%s%s protocol %s (%s)\n"),
+				rc_dev->sysfs_name, name, p,
 				enabled? _("enabled") : _("disabled"));
 
 		protocol = parse_sysfs_protocol(p, false);
@@ -1163,9 +1557,6 @@ static enum sysfs_protocols v2_get_protocols(struct rc_device *rc_dev, char *nam
 
 	}
 
-	fclose(fp);
-	free(buf);
-
 	return 0;
 }
 
@@ -1202,102 +1593,83 @@ static int v2_set_protocols(struct rc_device *rc_dev)
 	return 0;
 }
 
+/*
+ * Everything is read relative to the sysfs directory of the device, in a
+ * single pass over each directory.
+ */
 static int get_attribs(struct rc_device *rc_dev, char *sysfs_name)
 {
-	struct uevents  *uevent;
-	char		*input = "input", *event = "event", *lirc = "lirc";
-	char		*DEV = "/dev/";
-	static struct sysfs_names *input_names, *event_names, *attribs, *cur, *lirc_names;
+	char buf[4096], name[256], dname[512];
+	struct dirent *entry;
+	int dirfd, fd, event_fd, count;
+	DIR *dir;
 
 	/* Clean the attributes */
 	memset(rc_dev, 0, sizeof(*rc_dev));
 
 	rc_dev->sysfs_name = sysfs_name;
 
-	lirc_names = seek_sysfs_dir(rc_dev->sysfs_name, lirc);
-	if (lirc_names) {
-		uevent = read_sysfs_uevents(lirc_names->name);
-		free_names(lirc_names);
-		if (uevent) {
-			while (uevent->next) {
-				if (!strcmp(uevent->key, "DEVNAME")) {
-					rc_dev->lirc_name = malloc(strlen(uevent->value) + strlen(DEV) + 1);
-					strcpy(rc_dev->lirc_name, DEV);
-					strcat(rc_dev->lirc_name, uevent->value);
-					break;
-				}
-				uevent = uevent->next;
-			}
-			free_uevent(uevent);
-		}
+	dirfd = open(sysfs_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd < 0) {
+		perror(sysfs_name);
+		return EINVAL;
 	}
 
-	input_names = seek_sysfs_dir(rc_dev->sysfs_name, input);
-	if (!input_names)
-		return EINVAL;
-	if (input_names->next->next) {
+	fd = open_sysfs_subdir(dirfd, "lirc", name, sizeof(name), &count);
+	if (fd >= 0) {
+		snprintf(dname, sizeof(dname), "%s%s/", sysfs_name, name);
+		if (read_sysfs_attr(fd, dname, "uevent", buf, sizeof(buf)) >= 0)
+			rc_dev->lirc_name = uevent_value(buf, "DEVNAME", "/dev/");
+		close(fd);
+	}
+
+	fd = open_sysfs_subdir(dirfd, "input", name, sizeof(name), &count);
+	if (fd < 0)
+		goto err;
+	if (count > 1) {
 		fprintf(stderr, _("Found more than one input interface. This is currently unsupported\n"));
-		return EINVAL;
+		close(fd);
+		goto err;
 	}
+	snprintf(dname, sizeof(dname), "%s%s/", sysfs_name, name);
 	if (debug)
-		fprintf(stderr, _("Input sysfs node is %s\n"), input_names->name);
+		fprintf(stderr, _("Input sysfs node is %s\n"), dname);
 
-	event_names = seek_sysfs_dir(input_names->name, event);
-	if (!event_names) {
+	event_fd = open_sysfs_subdir(fd, "event", name, sizeof(name), &count);
+	close(fd);
+	fd = event_fd;
+	if (fd < 0) {
 		fprintf(stderr, _("Couldn't find any node at %s%s*.\n"),
-			input_names->name, event);
-		free_names(input_names);
-		return EINVAL;
+			dname, "event");
+		goto err;
 	}
-	free_names(input_names);
-	if (event_names->next->next) {
-		free_names(event_names);
+	if (count > 1) {
 		fprintf(stderr, _("Found more than one event interface. This is currently unsupported\n"));
-		return EINVAL;
+		close(fd);
+		goto err;
 	}
+	strncat(dname, name, sizeof(dname) - strlen(dname) - 2);
+	strcat(dname, "/");
 	if (debug)
-		fprintf(stderr, _("Event sysfs node is %s\n"), event_names->name);
+		fprintf(stderr, _("Event sysfs node is %s\n"), dname);
 
-	uevent = read_sysfs_uevents(event_names->name);
-	free_names(event_names);
-	if (!uevent)
-		return EINVAL;
-
-	while (uevent->next) {
-		if (!strcmp(uevent->key, "DEVNAME")) {
-			rc_dev->input_name = malloc(strlen(uevent->value) + strlen(DEV) + 1);
-			strcpy(rc_dev->input_name, DEV);
-			strcat(rc_dev->input_name, uevent->value);
-			break;
-		}
-		uevent = uevent->next;
-	}
-	free_uevent(uevent);
+	count = read_sysfs_attr(fd, dname, "uevent", buf, sizeof(buf));
+	close(fd);
+	if (count < 0)
+		goto err;
 
+	rc_dev->input_name = uevent_value(buf, "DEVNAME", "/dev/");
 	if (!rc_dev->input_name) {
 		fprintf(stderr, _("Input device name not found.\n"));
-		return EINVAL;
+		goto err;
 	}
 
-	uevent = read_sysfs_uevents(rc_dev->sysfs_name);
-	if (!uevent)
-		return EINVAL;
-	while (uevent->next) {
-		if (!strcmp(uevent->key, "DRV_NAME")) {
-			rc_dev->drv_name = malloc(strlen(uevent->value) + 1);
-			strcpy(rc_dev->drv_name, uevent->value);
-		}
-		if (!strcmp(uevent->key, "DEV_NAME")) {
-			rc_dev->dev_name = malloc(strlen(uevent->value) + 1);
-			strcpy(rc_dev->dev_name, uevent->value);
-		}
-		if (!strcmp(uevent->key, "NAME")) {
-			rc_dev->keytable_name = malloc(strlen(uevent->value) + 1);
-			strcpy(rc_dev->keytable_name, uevent->value);
-		}
-		uevent = uevent->next;
-	}
-	free_uevent(uevent);
+	if (read_sysfs_attr(dirfd, sysfs_name, "uevent", buf, sizeof(buf)) < 0)
+		goto err;
+
+	rc_dev->drv_name = uevent_value(buf, "DRV_NAME", "");
+	rc_dev->dev_name = uevent_value(buf, "DEV_NAME", "");
+	rc_dev->keytable_name = uevent_value(buf, "NAME", "");
 
 	if (debug)
 		fprintf(stderr, _("input device is %s\n"), rc_dev->input_name);
@@ -1307,21 +1679,21 @@ static int get_attribs(struct rc_device *rc_dev, char *sysfs_name)
 	rc_dev->type = SOFTWARE_DECODER;
 
 	/* Get the other attribs - basically IR decoders */
-	attribs = seek_sysfs_dir(rc_dev->sysfs_name, NULL);
-	for (cur = attribs; cur->next; cur = cur->next) {
-		if (!cur->name)
-			continue;
-		if (strstr(cur->name, "/protocols")) {
+	dir = fdopendir(openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+	while (dir && (entry = readdir(dir))) {
+		if (!strcmp(entry->d_name, "protocols")) {
 			rc_dev->version = VERSION_2;
 			rc_dev->type = UNKNOWN_TYPE;
-			v2_get_protocols(rc_dev, cur->name);
-		} else if (strstr(cur->name, "/protocol")) {
+			v2_get_protocols(rc_dev, dirfd, entry->d_name);
+		} else if (!strcmp(entry->d_name, "protocol")) {
 			rc_dev->version = VERSION_1;
 			rc_dev->type = HARDWARE_DECODER;
-			rc_dev->current = v1_get_hw_protocols(cur->name);
-		} else if (strstr(cur->name, "/supported_protocols")) {
+			rc_dev->current = v1_get_hw_protocols(rc_dev, dirfd,
+							      entry->d_name);
+		} else if (!strcmp(entry->d_name, "supported_protocols")) {
 			rc_dev->version = VERSION_1;
-			rc_dev->supported = v1_get_hw_protocols(cur->name);
+			rc_dev->supported = v1_get_hw_protocols(rc_dev, dirfd,
+								entry->d_name);
 		} else {
 			const struct protocol_map_entry *pme;
 
@@ -1329,17 +1701,25 @@ static int get_attribs(struct rc_device *rc_dev, char *sysfs_name)
 				if (!pme->sysfs1_name)
 					continue;
 
-				if (strstr(cur->name, pme->sysfs1_name)) {
+				if (!strncmp(entry->d_name, pme->sysfs1_name + 1,
+					     strlen(pme->sysfs1_name + 1))) {
 					rc_dev->supported |= pme->sysfs_protocol;
-					if (v1_get_sw_enabled_protocol(cur->name))
+					if (v1_get_sw_enabled_protocol(rc_dev, dirfd, entry->d_name))
 						rc_dev->supported |= pme->sysfs_protocol;
 					break;
 				}
 			}
 		}
 	}
+	if (dir)
+		closedir(dir);
+	close(dirfd);
 
 	return 0;
+
+err:
+	close(dirfd);
+	return EINVAL;
 }
 
 static int set_proto(struct rc_device *rc_dev)
@@ -1463,6 +1843,7 @@ static int add_keys(int fd)
 		keytable = ke->next;
 		free(ke);
 	}
+	memset(keytable_hash, 0, sizeof(keytable_hash));
 
 	return write_cnt;
 }
@@ -1798,6 +2179,90 @@ static bool attach_bpf(const char *lirc_name, const char *bpf_prog, struct proto
 	return ret == 0;
 }
 
+static void show_bpf_stats(unsigned int prog_id)
+{
+	unsigned int map_ids[MAX_MAPS], i;
+	struct bpf_prog_info info = {};
+	__u32 info_len = sizeof(info);
+	struct decoder_stats total = {}, *st;
+	int ret, prog_fd, map_fd = -1;
+	size_t value_size;
+	int cpus, cpu;
+	char *values;
+
+	prog_fd = bpf_prog_get_fd_by_id(prog_id);
+	if (prog_fd == -1)
+		return;
+
+	info.nr_map_ids = MAX_MAPS;
+	info.map_ids = (__u64)(unsigned long)map_ids;
+	ret = bpf_obj_get_info_by_fd(prog_fd, &info, &info_len);
+	close(prog_fd);
+	if (ret)
+		return;
+
+	for (i = 0; i < info.nr_map_ids && i < MAX_MAPS; i++) {
+		struct bpf_map_info map_info = {};
+		__u32 map_info_len = sizeof(map_info);
+
+		map_fd = bpf_map_get_fd_by_id(map_ids[i]);
+		if (map_fd == -1)
+			continue;
+
+		ret = bpf_obj_get_info_by_fd(map_fd, &map_info, &map_info_len);
+		if (!ret && map_info.type == BPF_MAP_TYPE_PERCPU_ARRAY &&
+		    map_info.value_size == sizeof(struct decoder_stats) &&
+		    !strcmp(map_info.name, "decoder_stats"))
+			break;
+
+		close(map_fd);
+		map_fd = -1;
+	}
+
+	if (map_fd == -1) {
+		fprintf(stderr, _("\t%s: no statistics\n"),
+			info.name[0] ? info.name : "?");
+		return;
+	}
+
+	// Per-cpu values are returned for each possible cpu, 8 byte aligned
+	cpus = libbpf_num_possible_cpus();
+	value_size = (sizeof(struct decoder_stats) + 7) & ~7;
+	values = cpus > 0 ? calloc(cpus, value_size) : NULL;
+	i = 0;
+	if (!values || bpf_map_lookup_elem(map_fd, &i, values)) {
+		fprintf(stderr, _("\t%s: failed to read statistics: %m\n"),
+			info.name);
+		free(values);
+		close(map_fd);
+		return;
+	}
+	close(map_fd);
+
+	for (cpu = 0; cpu < cpus; cpu++) {
+		st = (struct decoder_stats *)(values + cpu * value_size);
+		total.edges += st->edges;
+		total.keydowns += st->keydowns;
+		total.repeats += st->repeats;
+		total.pointers += st->pointers;
+		total.resets += st->resets;
+		total.ns += st->ns;
+	}
+	free(values);
+
+	fprintf(stderr, _("\t%s: %llu edges, %llu keydowns, %llu repeats, %llu pointer events, %llu resets"),
+		info.name,
+		(unsigned long long)total.edges,
+		(unsigned long long)total.keydowns,
+		(unsigned long long)total.repeats,
+		(unsigned long long)total.pointers,
+		(unsigned long long)total.resets);
+	if (total.edges)
+		fprintf(stderr, _(", %llu ns per edge"),
+			(unsigned long long)(total.ns / total.edges));
+	fprintf(stderr, "\n");
+}
+
 static void show_bpf(const char *lirc_name)
 {
 	unsigned int prog_ids[MAX_PROGS], count = MAX_PROGS;
@@ -1846,6 +2311,13 @@ static void show_bpf(const char *lirc_name)
 		fprintf(stderr, "%d", prog_ids[i]);
 	}
 	fprintf(stderr, _("\n"));
+
+	if (bpf_stats) {
+		if (count)
+			fprintf(stderr, _("\tBPF protocol statistics:\n"));
+		for (i = 0; i < count; i++)
+			show_bpf_stats(prog_ids[i]);
+	}
 	return;
 error:
 	fprintf(stderr, _("\tAttached BPF protocols: %m\n"));
@@ -2011,6 +2483,115 @@ int bpf_param(struct protocol_param *protocol_param, const char *name, int *val)
 	return -ENOENT;
 }
 
+/*
+ * The decoders which multi.o combines into one program. Every attached
+ * program sees each pulse and space, so it is cheaper to load one program
+ * for all of them.
+ */
+static const char *const multi_protocols[] = {
+	"manchester", "pulse_distance", "pulse_length", "samsung36", NULL
+};
+
+static bool is_multi_protocol(const char *name)
+{
+	int i;
+
+	for (i = 0; multi_protocols[i]; i++)
+		if (!strcmp(name, multi_protocols[i]))
+			return true;
+
+	return false;
+}
+
+static struct protocol_param **add_multi_params(struct protocol_param **tail,
+						const char *prefix,
+						struct protocol_param *param)
+{
+	struct protocol_param *p;
+
+	for (; param; param = param->next) {
+		p = calloc(1, sizeof(*p));
+		if (!p || asprintf(&p->name, "%s_%s", prefix, param->name) < 0) {
+			free(p);
+			break;
+		}
+		p->value = param->value;
+		*tail = p;
+		tail = &p->next;
+	}
+
+	return tail;
+}
+
+// Returns true if b is the only use of its decoder
+static bool bpf_protocol_unique(struct bpf_protocol *b)
+{
+	struct bpf_protocol *c;
+
+	for (c = bpf_protocol; c; c = c->next)
+		if (c != b && !strcmp(b->name, c->name))
+			return false;
+
+	return true;
+}
+
+/*
+ * Attach the decoders multi.o has as one program, if more than one of
+ * them is used, each with one set of parameters. Their parameters are
+ * passed with the name of the decoder as a prefix, the --parameter ones
+ * first so that they override the keymap. The decoders that are attached
+ * are removed from the list of BPF protocols.
+ */
+static void attach_multi_bpf(const char *lirc_name)
+{
+	struct protocol_param enabled = { NULL, "enabled", 1 };
+	struct protocol_param *param = NULL, **tail = &param, *p;
+	struct bpf_protocol *b, **prev;
+	int count = 0;
+	char *fname;
+
+	for (b = bpf_protocol; b; b = b->next) {
+		b->multi = is_multi_protocol(b->name) && bpf_protocol_unique(b);
+		if (b->multi)
+			count++;
+	}
+
+	if (count < 2)
+		return;
+
+	fname = find_bpf_file("multi");
+	if (!fname)
+		return;
+
+	for (b = bpf_protocol; b; b = b->next) {
+		if (!b->multi)
+			continue;
+
+		tail = add_multi_params(tail, b->name, &enabled);
+		tail = add_multi_params(tail, b->name, bpf_parameter);
+		tail = add_multi_params(tail, b->name, b->param);
+	}
+
+	if (attach_bpf(lirc_name, fname, param)) {
+		for (prev = &bpf_protocol; (b = *prev); ) {
+			if (!b->multi) {
+				prev = &b->next;
+				continue;
+			}
+			fprintf(stderr, _("Loaded BPF protocol %s\n"), b->name);
+			*prev = b->next;
+		}
+	}
+
+	while (param) {
+		p = param->next;
+		free(param->name);
+		free(param);
+		param = p;
+	}
+	free(fname);
+}
+
 char* keymap_to_filename(const char *fname)
 {
 	struct stat st;
@@ -2090,11 +2671,21 @@ int main(int argc, char *argv[])
 	if (cfg.next) {
 		struct cfgfile *cur;
 		struct keymap *map;
-		char *fname;
-		int rc;
+		char **fnames = NULL;
+		bool use_cache;
+		int rc, i;
 		int matches = 0;
 
+		/*
+		 * The cache only holds what the keymaps add, so it can't be
+		 * used if something else was set on the command line.
+		 */
+		use_cache = !keytable && !rawtable && !bpf_protocol && !ch_proto &&
+			    rc_dev.drv_name && rc_dev.keytable_name;
+
 		for (cur = &cfg; cur->next; cur = cur->next) {
+			char **p;
+
 			if ((!rc_dev.drv_name || strcasecmp(cur->driver, rc_dev.drv_name)) && strcasecmp(cur->driver, "*"))
 				continue;
 			if ((!rc_dev.keytable_name || strcasecmp(cur->table, rc_dev.keytable_name)) && strcasecmp(cur->table, "*"))
@@ -2105,20 +2696,13 @@ int main(int argc, char *argv[])
 					rc_dev.drv_name, rc_dev.keytable_name,
 					cur->fname);
 
-			fname = keymap_to_filename(cur->fname);
-			if (!fname)
+			p = realloc(fnames, (matches + 1) * sizeof(*fnames));
+			if (!p)
 				return -1;
-
-			rc = parse_keymap(fname, &map, debug);
-			if (rc < 0) {
-				fprintf(stderr, _("Can't load %s keymap\n"), fname);
-				free(fname);
+			fnames = p;
+			fnames[matches] = keymap_to_filename(cur->fname);
+			if (!fnames[matches])
 				return -1;
-			}
-			add_keymap(map, fname);
-			free_keymap(map);
-			free(fname);
-			clear = 1;
 			matches++;
 		}
 
@@ -2128,6 +2712,32 @@ int main(int argc, char *argv[])
 				       rc_dev.drv_name, rc_dev.keytable_name);
 			return 0;
 		}
+
+		clear = 1;
+
+		if (use_cache && !load_keymap_cache(rc_dev.drv_name, rc_dev.keytable_name,
+						    fnames, matches)) {
+			if (debug)
+				fprintf(stderr, _("Keymaps for %s, %s loaded from cache\n"),
+					rc_dev.drv_name, rc_dev.keytable_name);
+		} else {
+			for (i = 0; i < matches; i++) {
+				rc = parse_keymap(fnames[i], &map, debug);
+				if (rc < 0) {
+					fprintf(stderr, _("Can't load %s keymap\n"), fnames[i]);
+					return -1;
+				}
+				add_keymap(map, fnames[i]);
+				free_keymap(map);
+			}
+			if (use_cache)
+				write_keymap_cache(rc_dev.drv_name, rc_dev.keytable_name,
+						   fnames, matches);
+		}
+
+		for (i = 0; i < matches; i++)
+			free(fnames[i]);
+		free(fnames);
 	}
 
 	if (debug)
@@ -2180,6 +2790,9 @@ int main(int argc, char *argv[])
 			fprintf(stderr, _("Error: unable to attach bpf program, lirc device name was not found\n"));
 		}
 
+		if (rc_dev.lirc_name)
+			attach_multi_bpf(rc_dev.lirc_name);
+
 		for (b = bpf_protocol; b && rc_dev.lirc_name; b = b->next) {
 			char *fname = find_bpf_file(b->name);
 
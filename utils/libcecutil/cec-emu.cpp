@@ -0,0 +1,1119 @@
+// SPDX-License-Identifier: (LGPL-2.1-only OR BSD-3-Clause)
+/*
+ * Emulated CEC bus
+ *
+ * Copyright (c) 2026 - agent
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <linux/cec-funcs.h>
+
+#include "cec-emu.h"
+
+/*
+ * The bus lives in the shared memory object /cec-emu-<bus>, created by the
+ * first process that opens one of its adapters. It holds the configuration
+ * of every adapter and a bounded, lock-free ring with the messages received
+ * by it, written by the other processes and read by the process that has
+ * the adapter open. Only configuration changes take the bus lock.
+ *
+ * The transmitting process does what the CEC framework of the receiving
+ * adapters would do: it acks the message if its destination is claimed,
+ * answers the core messages on behalf of the destination and Feature
+ * Aborts messages for adapters without a follower. It then wakes up the
+ * receivers by sending a datagram to their abstract unix socket, which is
+ * also the file descriptor returned by cec_emu_open().
+ *
+ * Messages take as long as they would on a real bus, divided by the
+ * CEC_EMU_SPEED environment variable (default 1). With CEC_EMU_SPEED=0
+ * messages are exchanged at memory speed.
+ */
+
+#define EMU_MAGIC		0x43454345
+#define EMU_VERSION		1
+// Must be a power of 2
+#define EMU_RING_SIZE		64
+#define EMU_MAX_MSG_EVENTS	64
+
+// CEC bit timing in ns
+#define EMU_START_BIT_NS	4500000ULL
+#define EMU_BIT_NS		2400000ULL
+// 8 data bits, EOM and ACK
+#define EMU_BYTE_NS		(10 * EMU_BIT_NS)
+// Signal free time of a new initiator
+#define EMU_SFT_NS		(7 * EMU_BIT_NS)
+
+// The message was answered by the emulated CEC framework
+#define EMU_FL_CORE		(1 << 0)
+// The message isn't for this adapter, it's for MONITOR_ALL
+#define EMU_FL_OTHER		(1 << 1)
+
+// Core replies can cause a Feature Abort, but that's where it ends
+#define EMU_MAX_DEPTH		2
+
+struct emu_slot {
+	__u32 seq;
+	__u32 flags;
+	struct cec_msg msg;
+};
+
+/*
+ * Bounded multiple producer, single consumer ring: a producer reserves a
+ * slot by advancing head, and publishes it by setting its seq to the
+ * reserved position + 1. The consumer frees it by setting seq to the
+ * position of the next round.
+ */
+struct emu_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 lost;
+	struct emu_slot slots[EMU_RING_SIZE];
+};
+
+struct emu_adapter {
+	__s32 pid;
+	__u32 mode;
+	__u32 gen;
+	__u16 phys_addr;
+	struct cec_log_addrs log_addrs;
+	// The number of transmits waiting for each reply opcode
+	__u16 reply_waits[256];
+	struct emu_ring rx;
+};
+
+struct emu_bus {
+	__u32 magic;
+	__u32 version;
+	pthread_mutex_t lock;
+	__u64 bus_free_ts;
+	__u32 sequence;
+	struct emu_adapter adapters[CEC_EMU_MAX_ADAPTERS];
+};
+
+struct emu_wait {
+	struct cec_msg msg;
+	__u64 deadline;
+	bool blocking;
+	bool done;
+};
+
+struct emu_fh {
+	int fd;
+	ino_t ino;
+	std::string name;
+	std::string bus_name;
+	struct emu_bus *bus;
+	unsigned idx;
+	__u32 gen;
+	bool new_events;
+	std::deque<struct cec_msg> msgs;
+	std::deque<struct cec_event> events;
+	std::vector<struct emu_wait> waits;
+};
+
+static std::map<int, struct emu_fh *> emu_fhs;
+static int emu_tx_sock = -1;
+
+static __u64 emu_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void emu_sleep_until(__u64 ts)
+{
+	struct timespec t;
+
+	t.tv_sec = ts / 1000000000ULL;
+	t.tv_nsec = ts % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr) == EINTR)
+		;
+}
+
+static unsigned emu_speed()
+{
+	static int speed = -1;
+
+	if (speed < 0) {
+		const char *s = getenv("CEC_EMU_SPEED");
+
+		speed = s ? strtoul(s, nullptr, 0) : 1;
+	}
+	return speed;
+}
+
+static socklen_t emu_addr(const std::string &bus_name, unsigned idx,
+			  struct sockaddr_un &addr)
+{
+	int len;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	// Abstract socket address, starting with a NUL
+	len = snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+		       "cec-emu-%s-%u", bus_name.c_str(), idx);
+	return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static void emu_wake(const std::string &bus_name, unsigned idx)
+{
+	struct sockaddr_un addr;
+	socklen_t len = emu_addr(bus_name, idx, addr);
+	char c = 0;
+
+	if (emu_tx_sock < 0)
+		emu_tx_sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	// If the socket buffer is full the receiver is awake anyway
+	sendto(emu_tx_sock, &c, 1, MSG_DONTWAIT,
+	       reinterpret_cast<struct sockaddr *>(&addr), len);
+}
+
+static bool emu_alive(const struct emu_adapter *a)
+{
+	__s32 pid = __atomic_load_n(&a->pid, __ATOMIC_ACQUIRE);
+
+	return pid && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static bool ring_push(struct emu_ring *r, const struct cec_msg *msg, __u32 flags)
+{
+	__u32 pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		struct emu_slot *s = &r->slots[pos % EMU_RING_SIZE];
+		__s32 diff = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - pos;
+
+		if (diff < 0) {
+			__atomic_fetch_add(&r->lost, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+		if (diff > 0) {
+			pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+			continue;
+		}
+		// On failure pos is updated to the current head
+		if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			s->msg = *msg;
+			s->flags = flags;
+			__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+	}
+}
+
+static bool ring_pop(struct emu_ring *r, struct cec_msg *msg, __u32 *flags)
+{
+	__u32 pos = r->tail;
+	struct emu_slot *s = &r->slots[pos % EMU_RING_SIZE];
+
+	if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return false;
+	*msg = s->msg;
+	*flags = s->flags;
+	__atomic_store_n(&s->seq, pos + EMU_RING_SIZE, __ATOMIC_RELEASE);
+	r->tail = pos + 1;
+	return true;
+}
+
+static void emu_lock(struct emu_bus *bus)
+{
+	// Recover the lock of a process that died while holding it
+	if (pthread_mutex_lock(&bus->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&bus->lock);
+}
+
+static void emu_unlock(struct emu_bus *bus)
+{
+	pthread_mutex_unlock(&bus->lock);
+}
+
+static void emu_bus_init(struct emu_bus *bus)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&bus->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	for (auto &a : bus->adapters) {
+		a.phys_addr = CEC_PHYS_ADDR_INVALID;
+		memset(a.log_addrs.log_addr, CEC_LOG_ADDR_INVALID,
+		       sizeof(a.log_addrs.log_addr));
+		for (unsigned i = 0; i < EMU_RING_SIZE; i++)
+			a.rx.slots[i].seq = i;
+	}
+	bus->version = EMU_VERSION;
+	__atomic_store_n(&bus->magic, EMU_MAGIC, __ATOMIC_RELEASE);
+}
+
+static struct emu_bus *emu_bus_open(const std::string &bus_name)
+{
+	std::string shm_name = "/cec-emu-" + bus_name;
+	struct emu_bus *bus;
+	bool created = true;
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+	if (fd < 0 && errno == EEXIST) {
+		created = false;
+		fd = shm_open(shm_name.c_str(), O_RDWR | O_CLOEXEC, 0);
+	}
+	if (fd < 0)
+		return nullptr;
+	if (created && ftruncate(fd, sizeof(*bus))) {
+		int err = errno;
+
+		close(fd);
+		shm_unlink(shm_name.c_str());
+		errno = err;
+		return nullptr;
+	}
+	// The creator may not have set the size yet
+	for (unsigned i = 0; !fstat(fd, &st) && st.st_size < (off_t)sizeof(*bus); i++) {
+		if (i == 1000) {
+			close(fd);
+			errno = EAGAIN;
+			return nullptr;
+		}
+		usleep(1000);
+	}
+	p = mmap(nullptr, sizeof(*bus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return nullptr;
+	bus = static_cast<struct emu_bus *>(p);
+	if (created)
+		emu_bus_init(bus);
+	for (unsigned i = 0; __atomic_load_n(&bus->magic, __ATOMIC_ACQUIRE) != EMU_MAGIC; i++) {
+		if (i == 1000) {
+			munmap(bus, sizeof(*bus));
+			errno = EAGAIN;
+			return nullptr;
+		}
+		usleep(1000);
+	}
+	if (bus->version != EMU_VERSION) {
+		munmap(bus, sizeof(*bus));
+		errno = EPROTO;
+		return nullptr;
+	}
+	return bus;
+}
+
+// Reserves the bus for a message and returns when it ends
+static __u64 emu_bus_time(struct emu_bus *bus, unsigned len)
+{
+	unsigned speed = emu_speed();
+	__u64 now = emu_now();
+	__u64 free_ts, start, end;
+
+	if (!speed)
+		return now;
+	free_ts = __atomic_load_n(&bus->bus_free_ts, __ATOMIC_RELAXED);
+	do {
+		start = free_ts + EMU_SFT_NS / speed;
+		if (start < now)
+			start = now;
+		end = start + (EMU_START_BIT_NS + len * EMU_BYTE_NS) / speed;
+	} while (!__atomic_compare_exchange_n(&bus->bus_free_ts, &free_ts, end, false,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	return end;
+}
+
+static const __u8 *emu_type_las(__u8 type)
+{
+	static const __u8 tv[] = {
+		CEC_LOG_ADDR_TV, CEC_LOG_ADDR_SPECIFIC, CEC_LOG_ADDR_INVALID
+	};
+	static const __u8 record[] = {
+		CEC_LOG_ADDR_RECORD_1, CEC_LOG_ADDR_RECORD_2, CEC_LOG_ADDR_RECORD_3,
+		CEC_LOG_ADDR_BACKUP_1, CEC_LOG_ADDR_BACKUP_2, CEC_LOG_ADDR_INVALID
+	};
+	static const __u8 tuner[] = {
+		CEC_LOG_ADDR_TUNER_1, CEC_LOG_ADDR_TUNER_2, CEC_LOG_ADDR_TUNER_3,
+		CEC_LOG_ADDR_TUNER_4, CEC_LOG_ADDR_BACKUP_1, CEC_LOG_ADDR_BACKUP_2,
+		CEC_LOG_ADDR_INVALID
+	};
+	static const __u8 playback[] = {
+		CEC_LOG_ADDR_PLAYBACK_1, CEC_LOG_ADDR_PLAYBACK_2, CEC_LOG_ADDR_PLAYBACK_3,
+		CEC_LOG_ADDR_BACKUP_1, CEC_LOG_ADDR_BACKUP_2, CEC_LOG_ADDR_INVALID
+	};
+	static const __u8 audiosystem[] = {
+		CEC_LOG_ADDR_AUDIOSYSTEM, CEC_LOG_ADDR_INVALID
+	};
+	static const __u8 specific[] = {
+		CEC_LOG_ADDR_SPECIFIC, CEC_LOG_ADDR_BACKUP_1, CEC_LOG_ADDR_BACKUP_2,
+		CEC_LOG_ADDR_INVALID
+	};
+	static const __u8 none[] = { CEC_LOG_ADDR_INVALID };
+
+	switch (type) {
+	case CEC_LOG_ADDR_TYPE_TV: return tv;
+	case CEC_LOG_ADDR_TYPE_RECORD: return record;
+	case CEC_LOG_ADDR_TYPE_TUNER: return tuner;
+	case CEC_LOG_ADDR_TYPE_PLAYBACK: return playback;
+	case CEC_LOG_ADDR_TYPE_AUDIOSYSTEM: return audiosystem;
+	case CEC_LOG_ADDR_TYPE_SPECIFIC: return specific;
+	default: return none;
+	}
+}
+
+/*
+ * Claims the logical addresses of adapter idx, like the CEC framework
+ * does when both the physical address and the logical address types are
+ * set. Called with the bus lock held.
+ */
+static void emu_configure(struct emu_bus *bus, unsigned idx)
+{
+	struct emu_adapter *a = &bus->adapters[idx];
+	struct cec_log_addrs *la = &a->log_addrs;
+	__u16 used = 0, mask = 0;
+
+	memset(la->log_addr, CEC_LOG_ADDR_INVALID, sizeof(la->log_addr));
+	if (a->phys_addr == CEC_PHYS_ADDR_INVALID || !la->num_log_addrs) {
+		__atomic_store_n(&la->log_addr_mask, 0, __ATOMIC_RELEASE);
+		return;
+	}
+	for (unsigned i = 0; i < CEC_EMU_MAX_ADAPTERS; i++)
+		if (i != idx)
+			used |= bus->adapters[i].log_addrs.log_addr_mask;
+	used &= ~(1 << CEC_LOG_ADDR_UNREGISTERED);
+
+	for (unsigned i = 0; i < la->num_log_addrs; i++) {
+		if (la->log_addr_type[i] == CEC_LOG_ADDR_TYPE_UNREGISTERED) {
+			la->log_addr[i] = CEC_LOG_ADDR_UNREGISTERED;
+			mask |= 1 << CEC_LOG_ADDR_UNREGISTERED;
+			continue;
+		}
+		for (const __u8 *l = emu_type_las(la->log_addr_type[i]);
+		     *l != CEC_LOG_ADDR_INVALID; l++) {
+			if (!((used | mask) & (1 << *l))) {
+				la->log_addr[i] = *l;
+				mask |= 1 << *l;
+				break;
+			}
+		}
+	}
+	if (!mask && (la->flags & CEC_LOG_ADDRS_FL_ALLOW_UNREG_FALLBACK)) {
+		la->log_addr[0] = CEC_LOG_ADDR_UNREGISTERED;
+		mask = 1 << CEC_LOG_ADDR_UNREGISTERED;
+	}
+	__atomic_store_n(&la->log_addr_mask, mask, __ATOMIC_RELEASE);
+}
+
+static int emu_la_idx(const struct cec_log_addrs *la, unsigned log_addr)
+{
+	for (unsigned i = 0; i < la->num_log_addrs; i++)
+		if (la->log_addr[i] == log_addr)
+			return i;
+	return 0;
+}
+
+/*
+ * Fills in the reply of the CEC framework of adapter a to msg, returns
+ * false if the message is passed on to the follower instead.
+ */
+static bool emu_core_reply(const struct emu_adapter *a, const struct cec_msg *msg,
+			   struct cec_msg *reply)
+{
+	const struct cec_log_addrs *la = &a->log_addrs;
+	__u32 fmode = __atomic_load_n(&a->mode, __ATOMIC_RELAXED) & CEC_MODE_FOLLOWER_MSK;
+	bool alive = emu_alive(a);
+	bool has_follower = alive && fmode >= CEC_MODE_FOLLOWER &&
+			    fmode <= CEC_MODE_EXCL_FOLLOWER_PASSTHRU;
+	__u8 to = cec_msg_destination(msg);
+	int i = emu_la_idx(la, to);
+
+	if (msg->len < 2 || cec_msg_is_broadcast(msg) ||
+	    cec_msg_initiator(msg) == CEC_LOG_ADDR_UNREGISTERED ||
+	    (alive && fmode == CEC_MODE_EXCL_FOLLOWER_PASSTHRU))
+		return false;
+
+	cec_msg_init(reply, to, cec_msg_initiator(msg));
+	switch (msg->msg[1]) {
+	case CEC_MSG_GET_CEC_VERSION:
+		cec_msg_cec_version(reply, la->cec_version);
+		break;
+	case CEC_MSG_GIVE_PHYSICAL_ADDR:
+		cec_msg_report_physical_addr(reply, a->phys_addr,
+					     la->primary_device_type[i]);
+		break;
+	case CEC_MSG_GIVE_DEVICE_VENDOR_ID:
+		if (la->vendor_id == CEC_VENDOR_ID_NONE)
+			cec_msg_feature_abort(reply, msg->msg[1], CEC_OP_ABORT_UNRECOGNIZED_OP);
+		else
+			cec_msg_device_vendor_id(reply, la->vendor_id);
+		break;
+	case CEC_MSG_ABORT:
+		cec_msg_feature_abort(reply, msg->msg[1], CEC_OP_ABORT_REFUSED);
+		break;
+	case CEC_MSG_GIVE_OSD_NAME:
+		if (!la->osd_name[0])
+			cec_msg_feature_abort(reply, msg->msg[1], CEC_OP_ABORT_UNRECOGNIZED_OP);
+		else
+			cec_msg_set_osd_name(reply, la->osd_name);
+		break;
+	case CEC_MSG_GIVE_FEATURES: {
+		unsigned ops = 0;
+
+		if (la->cec_version < CEC_OP_CEC_VERSION_2_0) {
+			cec_msg_feature_abort(reply, msg->msg[1], CEC_OP_ABORT_UNRECOGNIZED_OP);
+			break;
+		}
+		cec_msg_report_features(reply, la->cec_version,
+					la->all_device_types[i], 0, 0);
+		// The RC profile and the device features, each can be extended
+		reply->len = 4;
+		for (unsigned j = 0; j < sizeof(la->features[i]) && ops < 2 &&
+		     reply->len < CEC_MAX_MSG_SIZE; j++) {
+			reply->msg[reply->len++] = la->features[i][j];
+			if (!(la->features[i][j] & CEC_OP_FEAT_EXT))
+				ops++;
+		}
+		break;
+	}
+	default:
+		// Replies are passed on, the others are aborted if there is no follower
+		if (has_follower || msg->msg[1] == CEC_MSG_FEATURE_ABORT ||
+		    __atomic_load_n(&a->reply_waits[msg->msg[1]], __ATOMIC_RELAXED))
+			return false;
+		cec_msg_feature_abort(reply, msg->msg[1], CEC_OP_ABORT_UNRECOGNIZED_OP);
+		break;
+	}
+	return true;
+}
+
+/*
+ * Puts msg from adapter idx on the bus: sets its transmit status and
+ * timestamp and delivers it to the other adapters, answering it for
+ * them as their CEC framework would.
+ */
+static void emu_bus_transmit(struct emu_fh *fh, unsigned idx, struct cec_msg *msg,
+			     unsigned depth)
+{
+	struct emu_bus *bus = fh->bus;
+	bool broadcast = cec_msg_is_broadcast(msg);
+	__u8 to = cec_msg_destination(msg);
+	std::vector<struct cec_msg> replies;
+	struct cec_msg rx = *msg;
+	bool acked = broadcast;
+
+	msg->tx_ts = emu_bus_time(bus, msg->len);
+	rx.rx_ts = msg->tx_ts;
+	rx.rx_status = CEC_RX_STATUS_OK;
+	rx.tx_status = 0;
+	rx.reply = 0;
+	rx.timeout = 0;
+
+	for (unsigned b = 0; b < CEC_EMU_MAX_ADAPTERS; b++) {
+		struct emu_adapter *a = &bus->adapters[b];
+		__u16 mask = __atomic_load_n(&a->log_addrs.log_addr_mask, __ATOMIC_ACQUIRE);
+		bool recipient = b != idx && (broadcast ? mask : mask & (1 << to));
+		bool alive = b != idx && emu_alive(a);
+		__u32 flags = 0;
+
+		if (recipient) {
+			struct cec_msg reply;
+
+			if (!broadcast)
+				acked = true;
+			if (depth < EMU_MAX_DEPTH && emu_core_reply(a, &rx, &reply)) {
+				flags = EMU_FL_CORE;
+				reply.sequence = b;
+				replies.push_back(reply);
+			}
+		} else if (!alive || (a->mode & CEC_MODE_FOLLOWER_MSK) != CEC_MODE_MONITOR_ALL) {
+			continue;
+		} else {
+			flags = EMU_FL_OTHER;
+		}
+		// Polls are only seen by monitors
+		if (alive && (rx.len > 1 || (a->mode & CEC_MODE_FOLLOWER_MSK) >= CEC_MODE_MONITOR)) {
+			ring_push(&a->rx, &rx, flags);
+			emu_wake(fh->bus_name, b);
+		}
+	}
+
+	if (acked) {
+		msg->tx_status = CEC_TX_STATUS_OK;
+	} else {
+		msg->tx_status = CEC_TX_STATUS_NACK | CEC_TX_STATUS_MAX_RETRIES;
+		msg->tx_nack_cnt = 1;
+	}
+
+	for (auto &reply : replies) {
+		unsigned from = reply.sequence;
+
+		reply.sequence = 0;
+		emu_bus_transmit(fh, from, &reply, depth + 1);
+	}
+}
+
+static void emu_state_event(struct emu_fh *fh, __u32 flags)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+	struct cec_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.ts = emu_now();
+	ev.event = CEC_EVENT_STATE_CHANGE;
+	ev.flags = flags;
+	ev.state_change.phys_addr = a->phys_addr;
+	ev.state_change.log_addr_mask = a->log_addrs.log_addr_mask;
+	if (fh->events.size() < EMU_MAX_MSG_EVENTS) {
+		fh->events.push_back(ev);
+		fh->new_events = true;
+	}
+}
+
+static void emu_wait_done(struct emu_fh *fh, size_t i, const struct cec_msg *reply)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+	struct emu_wait &w = fh->waits[i];
+
+	__atomic_fetch_sub(&a->reply_waits[w.msg.reply], 1, __ATOMIC_RELAXED);
+	if (reply) {
+		w.msg.len = reply->len;
+		memcpy(w.msg.msg, reply->msg, sizeof(w.msg.msg));
+		w.msg.rx_ts = reply->rx_ts;
+		w.msg.rx_status = CEC_RX_STATUS_OK;
+		if (reply->msg[1] == CEC_MSG_FEATURE_ABORT)
+			w.msg.rx_status |= CEC_RX_STATUS_FEATURE_ABORT;
+	} else {
+		w.msg.rx_ts = emu_now();
+		w.msg.rx_status = CEC_RX_STATUS_TIMEOUT;
+	}
+	if (w.blocking) {
+		w.done = true;
+		return;
+	}
+	fh->msgs.push_back(w.msg);
+	fh->waits.erase(fh->waits.begin() + i);
+}
+
+// Returns true if msg is the reply the transmit w waits for, as in the CEC framework
+static bool emu_is_reply(const struct emu_wait &w, const struct cec_msg *msg)
+{
+	bool abort = msg->len >= 4 && msg->msg[1] == CEC_MSG_FEATURE_ABORT;
+	__u8 cmd = abort ? msg->msg[2] : msg->msg[1];
+
+	if (w.done || msg->len < 2)
+		return false;
+	if (abort ? cmd != w.msg.msg[1] :
+	    cmd != w.msg.reply &&
+	    !(w.msg.msg[1] == CEC_MSG_INITIATE_ARC &&
+	      (cmd == CEC_MSG_REPORT_ARC_INITIATED || cmd == CEC_MSG_REPORT_ARC_TERMINATED)))
+		return false;
+	return cec_msg_initiator(msg) == cec_msg_destination(&w.msg) ||
+	       cec_msg_is_broadcast(&w.msg);
+}
+
+/*
+ * Moves the received messages and the events to the queues of fh,
+ * matches the replies and handles the reply timeouts.
+ */
+static void emu_pump(struct emu_fh *fh)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+	__u32 fmode = a->mode & CEC_MODE_FOLLOWER_MSK;
+	bool monitor = fmode >= CEC_MODE_MONITOR_PIN;
+	bool follower = fmode >= CEC_MODE_FOLLOWER && fmode <= CEC_MODE_EXCL_FOLLOWER_PASSTHRU;
+	struct cec_msg msg;
+	__u32 flags, lost;
+	char buf[16];
+	__u64 now;
+
+	while (recv(fh->fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+		;
+
+	if (__atomic_load_n(&a->gen, __ATOMIC_ACQUIRE) != fh->gen) {
+		fh->gen = __atomic_load_n(&a->gen, __ATOMIC_ACQUIRE);
+		emu_state_event(fh, 0);
+	}
+	lost = __atomic_exchange_n(&a->rx.lost, 0, __ATOMIC_RELAXED);
+	if (lost && fh->events.size() < EMU_MAX_MSG_EVENTS) {
+		struct cec_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.ts = emu_now();
+		ev.event = CEC_EVENT_LOST_MSGS;
+		ev.lost_msgs.lost_msgs = lost;
+		fh->events.push_back(ev);
+		fh->new_events = true;
+	}
+
+	while (ring_pop(&a->rx, &msg, &flags)) {
+		bool is_reply = false;
+
+		for (size_t i = 0; !(flags & EMU_FL_OTHER) && i < fh->waits.size(); i++) {
+			if (emu_is_reply(fh->waits[i], &msg)) {
+				emu_wait_done(fh, i, &msg);
+				is_reply = true;
+				break;
+			}
+		}
+		if (fh->msgs.size() >= EMU_MAX_MSG_EVENTS) {
+			lost++;
+			continue;
+		}
+		if (monitor || (follower && !is_reply && !(flags & (EMU_FL_CORE | EMU_FL_OTHER))))
+			fh->msgs.push_back(msg);
+	}
+
+	now = emu_now();
+	for (size_t i = 0; i < fh->waits.size(); i++) {
+		if (!fh->waits[i].done && fh->waits[i].deadline <= now) {
+			bool blocking = fh->waits[i].blocking;
+
+			emu_wait_done(fh, i, nullptr);
+			if (!blocking)
+				i--;
+		}
+	}
+}
+
+/*
+ * Makes the fd readable again if there are messages left to receive or if
+ * there are new events. Unlike messages, events that were already signaled
+ * don't keep the fd readable, so processes that don't dequeue events are
+ * not woken up over and over.
+ */
+static void emu_rearm(struct emu_fh *fh)
+{
+	if (!fh->msgs.empty() || fh->new_events)
+		emu_wake(fh->bus_name, fh->idx);
+	fh->new_events = false;
+}
+
+struct emu_timer {
+	std::string bus_name;
+	unsigned idx;
+	__u64 deadline;
+};
+
+static void *emu_timer_thread(void *arg)
+{
+	auto t = static_cast<struct emu_timer *>(arg);
+
+	emu_sleep_until(t->deadline);
+	emu_wake(t->bus_name, t->idx);
+	delete t;
+	return nullptr;
+}
+
+// Wakes up fh when the reply of a non-blocking transmit times out
+static void emu_start_timer(struct emu_fh *fh, __u64 deadline)
+{
+	auto t = new emu_timer;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	t->bus_name = fh->bus_name;
+	t->idx = fh->idx;
+	t->deadline = deadline;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, emu_timer_thread, t))
+		delete t;
+	pthread_attr_destroy(&attr);
+}
+
+// Waits for fd to become readable, until the deadline or the first reply timeout
+static void emu_poll(struct emu_fh *fh, __u64 deadline)
+{
+	struct pollfd pfd = { fh->fd, POLLIN, 0 };
+	__u64 now = emu_now();
+	int ms = -1;
+
+	for (const auto &w : fh->waits)
+		if (!w.done && (!deadline || w.deadline < deadline))
+			deadline = w.deadline;
+	if (deadline)
+		ms = deadline > now ? (deadline - now + 999999) / 1000000 : 0;
+	poll(&pfd, 1, ms);
+}
+
+static bool emu_nonblock(struct emu_fh *fh)
+{
+	return fcntl(fh->fd, F_GETFL) & O_NONBLOCK;
+}
+
+static int emu_transmit(struct emu_fh *fh, struct cec_msg *msg)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+	__u16 mask = a->log_addrs.log_addr_mask;
+	bool nonblock = emu_nonblock(fh);
+	struct emu_wait w;
+
+	if (!msg->len || msg->len > CEC_MAX_MSG_SIZE)
+		return EINVAL;
+	if (!mask && msg->msg[0] != 0xf0)
+		return ENONET;
+	if (msg->len == 1 && cec_msg_is_broadcast(msg))
+		return EINVAL;
+	if (cec_msg_initiator(msg) != CEC_LOG_ADDR_UNREGISTERED &&
+	    !(mask & (1 << cec_msg_initiator(msg))))
+		return EINVAL;
+	if (!cec_msg_is_broadcast(msg) && (mask & (1 << cec_msg_destination(msg))))
+		return EINVAL;
+	if (msg->reply && msg->timeout == 0)
+		msg->timeout = 1000;
+
+	msg->sequence = __atomic_add_fetch(&fh->bus->sequence, 1, __ATOMIC_RELAXED);
+	if (!msg->sequence)
+		msg->sequence = __atomic_add_fetch(&fh->bus->sequence, 1, __ATOMIC_RELAXED);
+	msg->tx_ts = msg->rx_ts = 0;
+	msg->rx_status = msg->tx_status = 0;
+	msg->tx_arb_lost_cnt = msg->tx_nack_cnt = 0;
+	msg->tx_low_drive_cnt = msg->tx_error_cnt = 0;
+
+	emu_bus_transmit(fh, fh->idx, msg, 0);
+	if (emu_speed())
+		emu_sleep_until(msg->tx_ts);
+	if ((a->mode & CEC_MODE_FOLLOWER_MSK) >= CEC_MODE_MONITOR_PIN &&
+	    fh->msgs.size() < EMU_MAX_MSG_EVENTS)
+		fh->msgs.push_back(*msg);
+
+	if (!msg->reply || !(msg->tx_status & CEC_TX_STATUS_OK)) {
+		if (!nonblock)
+			return 0;
+		fh->msgs.push_back(*msg);
+		emu_rearm(fh);
+		msg->tx_status = 0;
+		msg->tx_nack_cnt = 0;
+		return 0;
+	}
+
+	w.msg = *msg;
+	w.deadline = msg->tx_ts + msg->timeout * 1000000ULL;
+	w.blocking = !nonblock;
+	w.done = false;
+	__atomic_fetch_add(&a->reply_waits[msg->reply], 1, __ATOMIC_RELAXED);
+	fh->waits.push_back(w);
+	if (nonblock) {
+		emu_start_timer(fh, w.deadline);
+		emu_pump(fh);
+		emu_rearm(fh);
+		msg->tx_status = 0;
+		return 0;
+	}
+
+	for (;;) {
+		emu_pump(fh);
+		for (size_t i = 0; i < fh->waits.size(); i++) {
+			if (fh->waits[i].blocking && fh->waits[i].done) {
+				*msg = fh->waits[i].msg;
+				fh->waits.erase(fh->waits.begin() + i);
+				emu_rearm(fh);
+				return 0;
+			}
+		}
+		emu_poll(fh, 0);
+	}
+}
+
+static int emu_receive(struct emu_fh *fh, struct cec_msg *msg)
+{
+	__u64 deadline = msg->timeout ? emu_now() + msg->timeout * 1000000ULL : 0;
+	bool nonblock = emu_nonblock(fh);
+
+	for (;;) {
+		emu_pump(fh);
+		if (!fh->msgs.empty()) {
+			*msg = fh->msgs.front();
+			fh->msgs.pop_front();
+			emu_rearm(fh);
+			return 0;
+		}
+		if (nonblock) {
+			emu_rearm(fh);
+			return EAGAIN;
+		}
+		if (deadline && emu_now() >= deadline)
+			return ETIMEDOUT;
+		emu_poll(fh, deadline);
+	}
+}
+
+static int emu_dqevent(struct emu_fh *fh, struct cec_event *ev)
+{
+	bool nonblock = emu_nonblock(fh);
+
+	for (;;) {
+		emu_pump(fh);
+		if (!fh->events.empty()) {
+			*ev = fh->events.front();
+			fh->events.pop_front();
+			fh->new_events = !fh->events.empty();
+			emu_rearm(fh);
+			return 0;
+		}
+		if (nonblock) {
+			emu_rearm(fh);
+			return EAGAIN;
+		}
+		emu_poll(fh, 0);
+	}
+}
+
+// Reports the physical address of the claimed logical addresses
+static void emu_announce(struct emu_fh *fh)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+	const struct cec_log_addrs *la = &a->log_addrs;
+
+	for (unsigned i = 0; i < la->num_log_addrs; i++) {
+		struct cec_msg msg;
+
+		if (la->log_addr[i] >= CEC_LOG_ADDR_UNREGISTERED)
+			continue;
+		cec_msg_init(&msg, la->log_addr[i], CEC_LOG_ADDR_BROADCAST);
+		cec_msg_report_physical_addr(&msg, a->phys_addr,
+					     la->primary_device_type[i]);
+		emu_bus_transmit(fh, fh->idx, &msg, EMU_MAX_DEPTH);
+	}
+}
+
+static int emu_s_log_addrs(struct emu_fh *fh, struct cec_log_addrs *log_addrs)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+
+	if (log_addrs->num_log_addrs > CEC_MAX_LOG_ADDRS)
+		return EINVAL;
+	emu_lock(fh->bus);
+	if (log_addrs->num_log_addrs && a->log_addrs.num_log_addrs) {
+		emu_unlock(fh->bus);
+		return EBUSY;
+	}
+	if (log_addrs->num_log_addrs) {
+		a->log_addrs = *log_addrs;
+		emu_configure(fh->bus, fh->idx);
+	} else {
+		memset(&a->log_addrs, 0, sizeof(a->log_addrs));
+		memset(a->log_addrs.log_addr, CEC_LOG_ADDR_INVALID,
+		       sizeof(a->log_addrs.log_addr));
+	}
+	*log_addrs = a->log_addrs;
+	__atomic_add_fetch(&a->gen, 1, __ATOMIC_RELEASE);
+	emu_unlock(fh->bus);
+	emu_announce(fh);
+	return 0;
+}
+
+static int emu_s_phys_addr(struct emu_fh *fh, __u16 phys_addr)
+{
+	struct emu_adapter *a = &fh->bus->adapters[fh->idx];
+
+	emu_lock(fh->bus);
+	if (a->phys_addr == phys_addr) {
+		emu_unlock(fh->bus);
+		return 0;
+	}
+	a->phys_addr = phys_addr;
+	emu_configure(fh->bus, fh->idx);
+	__atomic_add_fetch(&a->gen, 1, __ATOMIC_RELEASE);
+	emu_unlock(fh->bus);
+	emu_announce(fh);
+	return 0;
+}
+
+static struct emu_fh *emu_find(int fd)
+{
+	auto it = emu_fhs.find(fd);
+	struct stat st;
+
+	// The fd may have been closed and reused
+	if (it == emu_fhs.end() || fstat(fd, &st) || st.st_ino != it->second->ino)
+		return nullptr;
+	return it->second;
+}
+
+bool cec_emu_is_device(const char *device)
+{
+	return !strncmp(device, CEC_EMU_PREFIX, strlen(CEC_EMU_PREFIX));
+}
+
+int cec_emu_open(const char *device)
+{
+	std::string bus_name = device + strlen(CEC_EMU_PREFIX);
+	size_t colon = bus_name.rfind(':');
+	struct sockaddr_un addr;
+	struct emu_adapter *a;
+	struct emu_fh *fh;
+	struct cec_msg msg;
+	struct stat st;
+	unsigned long idx;
+	__u32 flags;
+	char *end;
+	int fd;
+
+	if (colon == std::string::npos || !colon)
+		goto inval;
+	idx = strtoul(bus_name.c_str() + colon + 1, &end, 0);
+	if (*end || end == bus_name.c_str() + colon + 1 || idx >= CEC_EMU_MAX_ADAPTERS)
+		goto inval;
+	bus_name.resize(colon);
+	if (bus_name.find('/') != std::string::npos)
+		goto inval;
+
+	fh = new emu_fh();
+	fh->name = device;
+	fh->bus_name = bus_name;
+	fh->idx = idx;
+	fh->bus = emu_bus_open(bus_name);
+	if (!fh->bus) {
+		delete fh;
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || bind(fd, reinterpret_cast<struct sockaddr *>(&addr),
+			   emu_addr(bus_name, idx, addr))) {
+		int err = errno == EADDRINUSE ? EBUSY : errno;
+
+		if (fd >= 0)
+			close(fd);
+		munmap(fh->bus, sizeof(*fh->bus));
+		delete fh;
+		errno = err;
+		return -1;
+	}
+	fstat(fd, &st);
+	fh->fd = fd;
+	fh->ino = st.st_ino;
+
+	a = &fh->bus->adapters[idx];
+	// Drop what was received while nobody had the adapter open
+	while (ring_pop(&a->rx, &msg, &flags))
+		;
+	__atomic_store_n(&a->rx.lost, 0, __ATOMIC_RELAXED);
+	memset(a->reply_waits, 0, sizeof(a->reply_waits));
+	__atomic_store_n(&a->mode, CEC_MODE_INITIATOR, __ATOMIC_RELAXED);
+	__atomic_store_n(&a->pid, getpid(), __ATOMIC_RELEASE);
+	fh->gen = __atomic_load_n(&a->gen, __ATOMIC_ACQUIRE);
+	emu_state_event(fh, CEC_EVENT_FL_INITIAL_STATE);
+	emu_fhs[fd] = fh;
+	emu_rearm(fh);
+	return fd;
+
+inval:
+	errno = EINVAL;
+	return -1;
+}
+
+bool cec_emu_fd(int fd)
+{
+	return !emu_fhs.empty() && emu_find(fd);
+}
+
+short cec_emu_revents(int fd)
+{
+	struct emu_fh *fh = emu_find(fd);
+
+	if (!fh)
+		return 0;
+	emu_pump(fh);
+	// The caller is told about the events now
+	fh->new_events = false;
+	emu_rearm(fh);
+	return (fh->msgs.empty() ? 0 : POLLIN) | (fh->events.empty() ? 0 : POLLPRI);
+}
+
+int cec_emu_ioctl(int fd, unsigned long request, void *parm)
+{
+	struct emu_fh *fh = emu_find(fd);
+	struct emu_adapter *a;
+	int err = 0;
+
+	if (!fh) {
+		errno = EBADF;
+		return -1;
+	}
+	a = &fh->bus->adapters[fh->idx];
+
+	switch (request) {
+	case CEC_ADAP_G_CAPS: {
+		auto caps = static_cast<struct cec_caps *>(parm);
+
+		memset(caps, 0, sizeof(*caps));
+		strncpy(caps->driver, "cec-emu", sizeof(caps->driver) - 1);
+		strncpy(caps->name, fh->name.c_str(), sizeof(caps->name) - 1);
+		caps->available_log_addrs = CEC_MAX_LOG_ADDRS;
+		caps->capabilities = CEC_CAP_PHYS_ADDR | CEC_CAP_LOG_ADDRS |
+			CEC_CAP_TRANSMIT | CEC_CAP_PASSTHROUGH |
+			CEC_CAP_MONITOR_ALL | CEC_CAP_CONNECTOR_INFO;
+		// The CEC API version that is emulated
+		caps->version = (6 << 16);
+		break;
+	}
+	case CEC_ADAP_G_PHYS_ADDR:
+		*static_cast<__u16 *>(parm) = a->phys_addr;
+		break;
+	case CEC_ADAP_S_PHYS_ADDR:
+		err = emu_s_phys_addr(fh, *static_cast<__u16 *>(parm));
+		emu_pump(fh);
+		emu_rearm(fh);
+		break;
+	case CEC_ADAP_G_LOG_ADDRS:
+		emu_lock(fh->bus);
+		*static_cast<struct cec_log_addrs *>(parm) = a->log_addrs;
+		emu_unlock(fh->bus);
+		break;
+	case CEC_ADAP_S_LOG_ADDRS:
+		err = emu_s_log_addrs(fh, static_cast<struct cec_log_addrs *>(parm));
+		emu_pump(fh);
+		emu_rearm(fh);
+		break;
+	case CEC_ADAP_G_CONNECTOR_INFO:
+		memset(parm, 0, sizeof(struct cec_connector_info));
+		break;
+	case CEC_G_MODE:
+		*static_cast<__u32 *>(parm) = a->mode;
+		break;
+	case CEC_S_MODE:
+		__atomic_store_n(&a->mode, *static_cast<__u32 *>(parm), __ATOMIC_RELEASE);
+		break;
+	case CEC_TRANSMIT:
+		err = emu_transmit(fh, static_cast<struct cec_msg *>(parm));
+		break;
+	case CEC_RECEIVE:
+		err = emu_receive(fh, static_cast<struct cec_msg *>(parm));
+		break;
+	case CEC_DQEVENT:
+		err = emu_dqevent(fh, static_cast<struct cec_event *>(parm));
+		break;
+	default:
+		err = ENOTTY;
+		break;
+	}
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
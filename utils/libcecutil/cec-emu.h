@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: (LGPL-2.1-only OR BSD-3-Clause)
+/*
+ * Emulated CEC bus
+ *
+ * Copyright (c) 2026 - agent
+ */
+
+#ifndef _CEC_EMU_H_
+#define _CEC_EMU_H_
+
+#include <sys/ioctl.h>
+
+#include <linux/cec.h>
+
+/*
+ * Emulated CEC adapters are named emu:<bus>:<adapter>, where <bus> is
+ * the name of the bus and <adapter> a number from 0 to
+ * CEC_EMU_MAX_ADAPTERS - 1. The adapters of a bus exchange messages
+ * through shared memory instead of a kernel CEC device.
+ */
+#define CEC_EMU_PREFIX		"emu:"
+#define CEC_EMU_MAX_ADAPTERS	32
+
+// Returns true if device is the name of an emulated adapter
+bool cec_emu_is_device(const char *device);
+
+/*
+ * Opens an emulated adapter, creating the bus if needed. Only one process
+ * at a time can open an adapter. Returns a file descriptor that can be
+ * used with select() and epoll for incoming messages, or -1 with errno
+ * set on error.
+ */
+int cec_emu_open(const char *device);
+
+// Returns true if fd was returned by cec_emu_open()
+bool cec_emu_fd(int fd);
+
+// Emulates the CEC ioctls, returns like ioctl()
+int cec_emu_ioctl(int fd, unsigned long request, void *parm);
+
+/*
+ * Returns POLLIN if a message can be received and POLLPRI if an event can
+ * be dequeued. The fd of an emulated adapter is only ever readable, so
+ * callers should check this when it is.
+ */
+short cec_emu_revents(int fd);
+
+static inline int cec_ioctl(int fd, unsigned long request, void *parm)
+{
+	if (cec_emu_fd(fd))
+		return cec_emu_ioctl(fd, request, parm);
+	return ioctl(fd, request, parm);
+}
+
+#endif
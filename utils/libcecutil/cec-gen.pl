@@ -89,7 +89,7 @@ sub process_func
 		}
 		if (@args == 0) {
 			$logswitch .= "\tcase $cec_msg:\n";
-			$logswitch .= "\t\tprintf(\"$msg_name (0x%02x)\\n\", $cec_msg);\n";
+			$logswitch .= "\t\tlog_printf(\"$msg_name (0x%02x)\\n\", $cec_msg);\n";
 			$logswitch .= "\t\tbreak;\n\n";
 		} else {
 			$logswitch .= "\tcase $cec_msg: {\n";
@@ -133,7 +133,7 @@ sub process_func
 				}
 			}
 			$logswitch .= ");\n";
-			$logswitch .= "\t\tprintf(\"$msg_name (0x%02x):\\n\", $cec_msg);\n";
+			$logswitch .= "\t\tlog_printf(\"$msg_name (0x%02x):\\n\", $cec_msg);\n";
 			if ($cdc_case) {
 				$logswitch .= "\t\tlog_arg(&arg_phys_addr, \"phys-addr\", phys_addr);\n";
 			}
@@ -298,6 +298,41 @@ sub process_func
 	$messages .= "\t\t\"$msg_name\"\n";
 	$messages .= "\t}, {\n";
 	push @{$feature_usage{$feature}}, $msg;
+
+	# Index the standard messages by opcode, and decode their operands
+	# into one value per argument of their messages[] entry. That isn't
+	# possible if the arguments were expanded from a struct or an array.
+	if ($cec_msg eq $msg && !$cdc_case && !$htng_case &&
+	    !$has_digital && !$has_ui_command && !$has_short_aud_descr &&
+	    $func_args !~ /rc_profile|dev_features/) {
+		$msg_index{$msg_codes{$cec_msg}} = $num_messages + 1;
+		if (@args) {
+			my $ops_lc_name = $msg_lc_name;
+			$ops_lc_name =~ s/^cec_msg/cec_ops/;
+			my $decls = "";
+			foreach (@args) {
+				($type, $name) = /(.*?) ?([a-zA-Z_]\w+)$/;
+				$decls .= "\t\t$type $name;\n" if ($type ne "const char *");
+			}
+			$valswitch .= "\tcase $cec_msg: {\n";
+			$valswitch .= "$decls\n" if ($decls ne "");
+			$valswitch .= "\t\t$ops_lc_name(msg";
+			foreach (@args) {
+				($type, $name) = /(.*?) ?([a-zA-Z_]\w+)$/;
+				$valswitch .= $type eq "const char *" ? ", str" : ", &$name";
+			}
+			$valswitch .= ");\n";
+			my $cnt = 0;
+			foreach (@args) {
+				($type, $name) = /(.*?) ?([a-zA-Z_]\w+)$/;
+				$name = "0" if ($type eq "const char *");
+				$valswitch .= "\t\tvals[$cnt] = $name;\n";
+				$cnt++;
+			}
+			$valswitch .= "\t\tbreak;\n\t}\n";
+		}
+	}
+	$num_messages++;
 }
 
 while (<>) {
@@ -355,6 +390,7 @@ while (<>) {
 		($name, $val) = /define (\S+)\s+(\S+)/;
 		if ($name =~ /^CEC_MSG/) {
 			$msgs{$name} = 1;
+			$msg_codes{$name} = hex($val);
 		} elsif ($operand_name ne "" && $name =~ /^CEC_OP/) {
 			push @ops, $name;
 		}
@@ -474,11 +510,43 @@ printf $fh "%s%s\n", $enums, $arg_structs;
 printf $fh "static const struct cec_msg_args messages[] = {\n\t{\n";
 printf $fh "%s\t}\n};\n\n", $messages;
 
+# Index + 1 in messages[] of each opcode, 0 if not decoded
+printf $fh "static const __u16 msg_index[256] = {\n";
+for (my $i = 0; $i < 256; $i += 8) {
+	printf $fh "\t%s,\n", join(", ", map { sprintf("%3d", $msg_index{$_} // 0) } ($i .. $i + 7));
+}
+printf $fh "};\n\n";
+
+print $fh <<'EOF';
+/*
+ * Decode the operands of a standard message into vals, one value per
+ * argument of its messages[] entry, and a string operand into str, which
+ * must hold at least 16 characters. Returns nullptr if the message can't
+ * be decoded that way.
+ */
+static const struct cec_msg_args *log_msg_vals(const struct cec_msg *msg,
+					       __u32 *vals, char *str)
+{
+	if (msg->len < 2 || !msg_index[msg->msg[1]])
+		return nullptr;
+
+	switch (msg->msg[1]) {
+EOF
+printf $fh "%s", $valswitch;
+print $fh <<'EOF';
+	default:
+		break;
+	}
+	return &messages[msg_index[msg->msg[1]] - 1];
+}
+
+EOF
+
 print $fh <<'EOF';
 void cec_log_msg(const struct cec_msg *msg)
 {
 	if (msg->len == 1) {
-		printf("POLL\n");
+		log_printf("POLL\n");
 		goto status;
 	}
 
@@ -500,14 +568,14 @@ print $fh <<'EOF';
 status:
 	if ((msg->tx_status && !(msg->tx_status & CEC_TX_STATUS_OK)) ||
 	    (msg->rx_status && !(msg->rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT))))
-		printf("\t%s\n", cec_status2s(*msg).c_str());
+		log_printf("\t%s\n", cec_status2s(*msg).c_str());
 }
 
 static void log_htng_msg(const struct cec_msg *msg)
 {
 	if ((msg->tx_status && !(msg->tx_status & CEC_TX_STATUS_OK)) ||
 	    (msg->rx_status && !(msg->rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT))))
-		printf("\t%s\n", cec_status2s(*msg).c_str());
+		log_printf("\t%s\n", cec_status2s(*msg).c_str());
 
 	if (msg->len < 6)
 		return;
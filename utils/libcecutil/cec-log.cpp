@@ -3,6 +3,7 @@
  * Copyright 2016 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <cstdarg>
 #include <string>
 
 #include <unistd.h>
@@ -14,6 +15,42 @@
 #include "cec-log.h"
 #include "compiler.h"
 
+/*
+ * The log goes to stdout, or to the buffer given to cec_log_msg_text()
+ * or cec_log_msg_json().
+ */
+struct log_buf {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static thread_local struct log_buf *cur_log_buf;
+
+static void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void log_printf(const char *fmt, ...)
+{
+	struct log_buf *b = cur_log_buf;
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	if (!b) {
+		vprintf(fmt, ap);
+		va_end(ap);
+		return;
+	}
+	// Like snprintf(), keep counting the length once the buffer is full
+	if (b->len < b->size)
+		len = vsnprintf(b->buf + b->len, b->size - b->len, fmt, ap);
+	else
+		len = vsnprintf(nullptr, 0, fmt, ap);
+	va_end(ap);
+	if (len > 0)
+		b->len += len;
+}
+
 static const struct cec_arg arg_u8 = {
 	CEC_ARG_TYPE_U8,
 };
@@ -38,8 +75,8 @@ static void log_arg(const struct cec_arg *arg, const char *arg_name, __u32 val)
 	case CEC_ARG_TYPE_ENUM:
 		for (i = 0; i < arg->num_enum_values; i++) {
 			if (arg->values[i].value == val) {
-				printf("\t%s: %s (0x%02x)\n", arg_name,
-				       arg->values[i].type_name, val);
+				log_printf("\t%s: %s (0x%02x)\n", arg_name,
+					   arg->values[i].type_name, val);
 				return;
 			}
 		}
@@ -47,31 +84,31 @@ static void log_arg(const struct cec_arg *arg, const char *arg_name, __u32 val)
 	case CEC_ARG_TYPE_U8:
 		if (!strcmp(arg_name, "video-latency") ||
 		    !strcmp(arg_name, "audio-out-delay")) {
-			printf("\t%s: %u (0x%02x, %d ms)\n", arg_name, val, val,
-			       (val - 1) * 2);
+			log_printf("\t%s: %u (0x%02x, %d ms)\n", arg_name, val, val,
+				   (val - 1) * 2);
 		} else if (!strcmp(arg_name, "abort-msg")) {
 			if (cec_opcode2s(val))
-				printf("\t%s: %u (0x%02x, %s)\n",
-				       arg_name, val, val, cec_opcode2s(val));
+				log_printf("\t%s: %u (0x%02x, %s)\n",
+					   arg_name, val, val, cec_opcode2s(val));
 			else
-				printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
+				log_printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
 		} else {
-			printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
+			log_printf("\t%s: %u (0x%02x)\n", arg_name, val, val);
 		}
 		return;
 	case CEC_ARG_TYPE_U16:
 		if (strstr(arg_name, "phys-addr"))
-			printf("\t%s: %x.%x.%x.%x\n", arg_name, cec_phys_addr_exp(val));
+			log_printf("\t%s: %x.%x.%x.%x\n", arg_name, cec_phys_addr_exp(val));
 		else
-			printf("\t%s: %u (0x%04x)\n", arg_name, val, val);
+			log_printf("\t%s: %u (0x%04x)\n", arg_name, val, val);
 		return;
 	case CEC_ARG_TYPE_U32:
-		printf("\t%s: %u (0x%08x)\n", arg_name, val, val);
+		log_printf("\t%s: %u (0x%08x)\n", arg_name, val, val);
 		return;
 	default:
 		break;
 	}
-	printf("\t%s: unknown type\n", arg_name);
+	log_printf("\t%s: unknown type\n", arg_name);
 }
 
 static void log_arg(const struct cec_arg *arg, const char *arg_name,
@@ -79,12 +116,12 @@ static void log_arg(const struct cec_arg *arg, const char *arg_name,
 {
 	switch (arg->type) {
 	case CEC_ARG_TYPE_STRING:
-		printf("\t%s: %s\n", arg_name, s);
+		log_printf("\t%s: %s\n", arg_name, s);
 		return;
 	default:
 		break;
 	}
-	printf("\t%s: unknown type\n", arg_name);
+	log_printf("\t%s: unknown type\n", arg_name);
 }
 
 static const struct cec_arg_enum_values type_rec_src_type[] = {
@@ -232,9 +269,9 @@ static void log_vendor_id(const char *arg_name, __u32 vendor_id)
 	const char *vendor = cec_vendor2s(vendor_id);
 
 	if (vendor)
-		printf("\t%s: 0x%06x (%s)\n", arg_name, vendor_id, vendor);
+		log_printf("\t%s: 0x%06x (%s)\n", arg_name, vendor_id, vendor);
 	else
-		printf("\t%s: 0x%06x, %u\n", arg_name, vendor_id, vendor_id);
+		log_printf("\t%s: 0x%06x, %u\n", arg_name, vendor_id, vendor_id);
 }
 
 static void log_descriptors(const char *arg_name, unsigned num, const __u32 *descriptors)
@@ -257,13 +294,13 @@ static void log_htng_unknown_msg(const struct cec_msg *msg)
 	unsigned i;
 
 	cec_ops_vendor_command_with_id(msg, &vendor_id, &size, &bytes);
-	printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
-	       CEC_MSG_VENDOR_COMMAND_WITH_ID);
+	log_printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
+		   CEC_MSG_VENDOR_COMMAND_WITH_ID);
 	log_vendor_id("vendor-id", vendor_id);
-	printf("\tvendor-specific-data:");
+	log_printf("\tvendor-specific-data:");
 	for (i = 0; i < size; i++)
-		printf(" 0x%02x", bytes[i]);
-	printf("\n");
+		log_printf(" 0x%02x", bytes[i]);
+	log_printf("\n");
 }
 
 static void log_unknown_msg(const struct cec_msg *msg)
@@ -276,13 +313,13 @@ static void log_unknown_msg(const struct cec_msg *msg)
 
 	switch (msg->msg[1]) {
 	case CEC_MSG_VENDOR_COMMAND:
-		printf("VENDOR_COMMAND (0x%02x):\n",
-		       CEC_MSG_VENDOR_COMMAND);
+		log_printf("VENDOR_COMMAND (0x%02x):\n",
+			   CEC_MSG_VENDOR_COMMAND);
 		cec_ops_vendor_command(msg, &size, &bytes);
-		printf("\tvendor-specific-data:");
+		log_printf("\tvendor-specific-data:");
 		for (i = 0; i < size; i++)
-			printf(" 0x%02x", bytes[i]);
-		printf("\n");
+			log_printf(" 0x%02x", bytes[i]);
+		log_printf("\n");
 		break;
 	case CEC_MSG_VENDOR_COMMAND_WITH_ID:
 		cec_ops_vendor_command_with_id(msg, &vendor_id, &size, &bytes);
@@ -291,41 +328,41 @@ static void log_unknown_msg(const struct cec_msg *msg)
 			log_htng_msg(msg);
 			break;
 		default:
-			printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
-			       CEC_MSG_VENDOR_COMMAND_WITH_ID);
+			log_printf("VENDOR_COMMAND_WITH_ID (0x%02x):\n",
+				   CEC_MSG_VENDOR_COMMAND_WITH_ID);
 			log_vendor_id("vendor-id", vendor_id);
-			printf("\tvendor-specific-data:");
+			log_printf("\tvendor-specific-data:");
 			for (i = 0; i < size; i++)
-				printf(" 0x%02x", bytes[i]);
-			printf("\n");
+				log_printf(" 0x%02x", bytes[i]);
+			log_printf("\n");
 			break;
 		}
 		break;
 	case CEC_MSG_VENDOR_REMOTE_BUTTON_DOWN:
-		printf("VENDOR_REMOTE_BUTTON_DOWN (0x%02x):\n",
-		       CEC_MSG_VENDOR_REMOTE_BUTTON_DOWN);
+		log_printf("VENDOR_REMOTE_BUTTON_DOWN (0x%02x):\n",
+			   CEC_MSG_VENDOR_REMOTE_BUTTON_DOWN);
 		cec_ops_vendor_remote_button_down(msg, &size, &bytes);
-		printf("\tvendor-specific-rc-code:");
+		log_printf("\tvendor-specific-rc-code:");
 		for (i = 0; i < size; i++)
-			printf(" 0x%02x", bytes[i]);
-		printf("\n");
+			log_printf(" 0x%02x", bytes[i]);
+		log_printf("\n");
 		break;
 	case CEC_MSG_CDC_MESSAGE:
 		phys_addr = (msg->msg[2] << 8) | msg->msg[3];
 
-		printf("CDC_MESSAGE (0x%02x): 0x%02x:\n",
-		       CEC_MSG_CDC_MESSAGE, msg->msg[4]);
+		log_printf("CDC_MESSAGE (0x%02x): 0x%02x:\n",
+			   CEC_MSG_CDC_MESSAGE, msg->msg[4]);
 		log_arg(&arg_u16, "phys-addr", phys_addr);
-		printf("\tpayload:");
+		log_printf("\tpayload:");
 		for (i = 5; i < msg->len; i++)
-			printf(" 0x%02x", msg->msg[i]);
-		printf("\n");
+			log_printf(" 0x%02x", msg->msg[i]);
+		log_printf("\n");
 		break;
 	default:
-		printf("UNKNOWN (0x%02x)%s", msg->msg[1], msg->len > 2 ? ":\n\tpayload:" : "");
+		log_printf("UNKNOWN (0x%02x)%s", msg->msg[1], msg->len > 2 ? ":\n\tpayload:" : "");
 		for (i = 2; i < msg->len; i++)
-			printf(" 0x%02x", msg->msg[i]);
-		printf("\n");
+			log_printf(" 0x%02x", msg->msg[i]);
+		log_printf("\n");
 		break;
 	}
 }
@@ -338,3 +375,122 @@ const char *cec_log_ui_cmd_string(__u8 ui_cmd)
 	}
 	return nullptr;
 }
+
+int cec_log_msg_text(char *buf, size_t size, const struct cec_msg *msg)
+{
+	struct log_buf b = { buf, size, 0 };
+
+	if (size)
+		buf[0] = '\0';
+	cur_log_buf = &b;
+	cec_log_msg(msg);
+	cur_log_buf = nullptr;
+	return b.len;
+}
+
+static void log_json_string(const char *s)
+{
+	// The strings are names or at most 14 character operands
+	char esc[64 * 6 + 1];
+	unsigned len = 0;
+
+	for (; *s && len < sizeof(esc) - 7; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			esc[len++] = '\\';
+			esc[len++] = c;
+		} else if (c < 0x20 || c >= 0x7f) {
+			len += sprintf(esc + len, "\\u%04x", c);
+		} else {
+			esc[len++] = c;
+		}
+	}
+	esc[len] = '\0';
+	log_printf("\"%s\"", esc);
+}
+
+static void log_json_arg(const struct cec_arg *arg, const char *arg_name,
+			 __u32 val, const char *s)
+{
+	log_printf("\"%s\":", arg_name);
+	switch (arg->type) {
+	case CEC_ARG_TYPE_STRING:
+		log_json_string(s);
+		return;
+	case CEC_ARG_TYPE_ENUM:
+		for (unsigned i = 0; i < arg->num_enum_values; i++) {
+			if (arg->values[i].value == val) {
+				log_json_string(arg->values[i].type_name);
+				return;
+			}
+		}
+		break;
+	case CEC_ARG_TYPE_U16:
+		if (strstr(arg_name, "phys-addr")) {
+			log_printf("\"%x.%x.%x.%x\"", cec_phys_addr_exp(val));
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+	log_printf("%u", val);
+}
+
+int cec_log_msg_json(char *buf, size_t size, const struct cec_msg *msg)
+{
+	struct log_buf b = { buf, size, 0 };
+	const struct cec_msg_args *args = nullptr;
+	bool transmitted = msg->tx_status != 0;
+	__u32 vals[CEC_MAX_ARGS];
+	char s[16] = "";
+
+	if (size)
+		buf[0] = '\0';
+	cur_log_buf = &b;
+	log_printf("{\"dir\":\"%s\",\"ts\":%llu,\"sequence\":%u,\"from\":%u,\"to\":%u",
+		   transmitted ? "tx" : "rx",
+		   (unsigned long long)(transmitted ? msg->tx_ts : msg->rx_ts),
+		   msg->sequence, cec_msg_initiator(msg), cec_msg_destination(msg));
+	if (msg->len == 1) {
+		log_printf(",\"name\":\"POLL\"");
+	} else {
+		const char *name;
+
+		args = log_msg_vals(msg, vals, s);
+		name = args ? args->msg_name : cec_opcode2s(msg->msg[1]);
+		log_printf(",\"opcode\":%u", msg->msg[1]);
+		if (name) {
+			log_printf(",\"name\":");
+			log_json_string(name);
+		}
+	}
+	if (args && args->num_args) {
+		log_printf(",\"args\":{");
+		for (unsigned i = 0; i < args->num_args; i++) {
+			if (i)
+				log_printf(",");
+			log_json_arg(args->args[i], args->arg_names[i], vals[i], s);
+		}
+		log_printf("}");
+	}
+	char raw[CEC_MAX_MSG_SIZE * 3];
+
+	for (unsigned i = 0; i < msg->len; i++)
+		sprintf(raw + i * 3, "%02x:", msg->msg[i]);
+	raw[msg->len ? msg->len * 3 - 1 : 0] = '\0';
+	log_printf(",\"raw\":\"%s\"", raw);
+	if (msg->tx_status)
+		log_printf(",\"tx-status\":%u", msg->tx_status);
+	if (msg->rx_status)
+		log_printf(",\"rx-status\":%u", msg->rx_status);
+	if ((msg->tx_status && !(msg->tx_status & CEC_TX_STATUS_OK)) ||
+	    (msg->rx_status && !(msg->rx_status & (CEC_RX_STATUS_OK | CEC_RX_STATUS_FEATURE_ABORT)))) {
+		log_printf(",\"status\":");
+		log_json_string(cec_status2s(*msg).c_str());
+	}
+	log_printf("}");
+	cur_log_buf = nullptr;
+	return b.len;
+}
@@ -37,6 +37,17 @@ struct cec_msg_args {
 
 const struct cec_msg_args *cec_log_msg_args(unsigned int index);
 void cec_log_msg(const struct cec_msg *msg);
+/*
+ * Like cec_log_msg(), but the text is written to buf. Like snprintf(), the
+ * output is truncated to size and the length of the whole text is returned.
+ */
+int cec_log_msg_text(char *buf, size_t size, const struct cec_msg *msg);
+/*
+ * Writes a JSON object with the message, its decoded operands and its
+ * status to buf, without a trailing newline. Returns the length like
+ * cec_log_msg_text().
+ */
+int cec_log_msg_json(char *buf, size_t size, const struct cec_msg *msg);
 void cec_log_htng_msg(const struct cec_msg *msg);
 const char *cec_log_ui_cmd_string(__u8 ui_cmd);
 
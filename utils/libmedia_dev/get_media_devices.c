@@ -21,15 +21,34 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/sysmacros.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <linux/netlink.h>
 #include <string.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <dirent.h>
+#include <errno.h>
 #include <limits.h>
 #include "get_media_devices.h"
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+struct media_device_entry;
+
+typedef int (*fill_data_t)(struct media_device_entry *md);
+
+/**
+ * struct media_class - Describes a sysfs class with media devices
+ *
+ * @name:		class name, as found at /sys/class
+ * @fill:		identifies the type of the class nodes
+ */
+struct media_class {
+	const char *name;
+	fill_data_t fill;
+};
+
 /**
  * struct media_device_entry - Describes one device entry got via sysfs
  *
@@ -37,16 +56,42 @@
  *			PCI devices are like: pci0000:00/0000:00:1b.0
  *			USB devices are like: pci0000:00/0000:00:1d.7/usb1/1-8
  * @node:		Device node, in sysfs or alsa hw identifier
+ * @sysname:		Kernel name of the node, as found at the class
+ * @class:		Class of the node
  * @device_type:	Type of the device (V4L_*, DVB_*, SND_*)
  */
 struct media_device_entry {
 	char *device;
 	char *node;
+	char *sysname;
+	const struct media_class *class;
 	enum device_type type;
 	enum bus_type bus;
 	unsigned major, minor;		/* Device major/minor */
 };
 
+/*
+ * The keys of the lookup index. The first entry with a given key is
+ * stored at the hash table, the next ones are chained in order.
+ */
+enum media_key {
+	MEDIA_KEY_NODE,			/* node name */
+	MEDIA_KEY_TYPE_NODE,		/* type and node name */
+	MEDIA_KEY_DEVNUM,		/* type and major/minor */
+	MEDIA_KEY_COUNT,
+};
+
+struct media_lookup {
+	const char *node;
+	enum device_type type;
+	unsigned major, minor;
+};
+
+struct media_type_pos {
+	enum device_type type;
+	int pos;
+};
+
 /**
  * struct media_devices - Describes all devices found
  *
@@ -55,13 +100,25 @@ struct media_device_entry {
  *			USB devices are like: pci0000:00/0000:00:1d.7/usb1/1-8
  * @node:		Device node, in sysfs or alsa hw identifier
  * @device_type:	Type of the device (V4L_*, DVB_*, SND_*)
+ * @fd:			hotplug events socket, or -1
+ * @indexed:		the index below matches the entries
+ * @hash_size:		size of the hash tables, a power of two
+ * @hash:		entry positions per key, -1 for empty slots
+ * @chain:		next entry with the same key, or -1
+ * @by_type:		entry positions ordered by type
  */
 struct media_devices {
 	struct media_device_entry *md_entry;
 	unsigned int md_size;
-};
 
-typedef int (*fill_data_t)(struct media_device_entry *md);
+	int fd;
+
+	bool indexed;
+	unsigned int hash_size;
+	int *hash[MEDIA_KEY_COUNT];
+	int *chain[MEDIA_KEY_COUNT];
+	struct media_type_pos *by_type;
+};
 
 #define DEVICE_STR "devices"
 
@@ -117,24 +174,101 @@ static enum bus_type get_bus(char *device)
 	return MEDIA_BUS_UNKNOWN;
 }
 
-static int get_class(char *class,
-		     struct media_device_entry **md,
-		     unsigned int *md_size,
-		     fill_data_t fill)
+static int add_entry(struct media_devices *md,
+		     const struct media_class *class,
+		     const char *name)
 {
-	DIR		*dir;
-	struct dirent	*entry;
+	struct media_device_entry *md_entry, *md_ptr;
 	char		dname[PATH_MAX];
-	char		fname[PATH_MAX + sizeof(entry->d_name)];
+	char		fname[PATH_MAX + NAME_MAX + 1];
 	char		link[PATH_MAX];
 	char		virt_dev[60];
-	int		err = -2;
-	struct		media_device_entry *md_ptr = NULL;
 	char		*p, *device;
 	enum bus_type	bus;
 	static int	virtual = 0;
 
-	snprintf(dname, PATH_MAX, "/sys/class/%s", class);
+	/* Canonicalize the device name */
+	snprintf(dname, PATH_MAX, "/sys/class/%s", class->name);
+	snprintf(fname, sizeof(fname), "%s/%s", dname, name);
+	if (!realpath(fname, link))
+		return 0;
+	device = link;
+
+	/* Remove the subsystem/class_name from the string */
+	p = strstr(device, class->name);
+	if (!p)
+		return 0;
+	*(p - 1) = '\0';
+
+	bus = get_bus(device);
+
+	/* remove the /sys/devices/ from the name */
+	device += 13;
+
+	switch (bus) {
+	case MEDIA_BUS_PCI:
+		/* Remove the device function nr */
+		p = strrchr(device, '.');
+		if (!p)
+			return 0;
+		*p = '\0';
+		break;
+	case MEDIA_BUS_USB:
+		/* Remove USB interface from the path */
+		p = strrchr(device, '/');
+		if (!p)
+			return 0;
+		/* In case we have a device where the driver
+		   attaches directly to the usb device rather
+		   then to an interface */
+		if (!strchr(p, ':'))
+			break;
+		*p = '\0';
+		break;
+	case MEDIA_BUS_VIRTUAL:
+		/* Don't group virtual devices */
+		sprintf(virt_dev, "virtual%d", virtual++);
+		device = virt_dev;
+		break;
+	case MEDIA_BUS_UNKNOWN:
+		break;
+	}
+
+	/* Add one more element to the devices struct */
+	md_entry = realloc(md->md_entry, (md->md_size + 1) * sizeof(*md_ptr));
+	if (!md_entry)
+		return -1;
+	md->md_entry = md_entry;
+	md_ptr = md_entry + md->md_size;
+	md->md_size++;
+	md->indexed = false;
+
+	/* Cleans previous data and fills it with device/node */
+	memset(md_ptr, 0, sizeof(*md_ptr));
+	md_ptr->type = UNKNOWN;
+	md_ptr->class = class;
+	md_ptr->device = strdup(device);
+	md_ptr->node = strdup(name);
+	md_ptr->sysname = strdup(name);
+
+	/* Retrieve major and minor information */
+	get_uevent_info(md_ptr, dname);
+
+	/* Used to identify the type of node */
+	class->fill(md_ptr);
+
+	return 1;
+}
+
+static int get_class(struct media_devices *md,
+		     const struct media_class *class)
+{
+	DIR		*dir;
+	struct dirent	*entry;
+	char		dname[PATH_MAX];
+	int		err = -2;
+
+	snprintf(dname, PATH_MAX, "/sys/class/%s", class->name);
 	dir = opendir(dname);
 	if (!dir) {
 		return 0;
@@ -143,70 +277,8 @@ static int get_class(char *class,
 		/* Skip . and .. */
 		if (entry->d_name[0] == '.')
 			continue;
-		/* Canonicalize the device name */
-		snprintf(fname, sizeof(fname), "%s/%s", dname, entry->d_name);
-		if (realpath(fname, link)) {
-			device = link;
-
-			/* Remove the subsystem/class_name from the string */
-			p = strstr(device, class);
-			if (!p)
-				continue;
-			*(p - 1) = '\0';
-
-			bus = get_bus(device);
-
-			/* remove the /sys/devices/ from the name */
-			device += 13;
-
-			switch (bus) {
-			case MEDIA_BUS_PCI:
-				/* Remove the device function nr */
-				p = strrchr(device, '.');
-				if (!p)
-					continue;
-				*p = '\0';
-				break;
-			case MEDIA_BUS_USB:
-				/* Remove USB interface from the path */
-				p = strrchr(device, '/');
-				if (!p)
-					continue;
-				/* In case we have a device where the driver
-				   attaches directly to the usb device rather
-				   then to an interface */
-				if (!strchr(p, ':'))
-					break;
-				*p = '\0';
-				break;
-			case MEDIA_BUS_VIRTUAL:
-				/* Don't group virtual devices */
-				sprintf(virt_dev, "virtual%d", virtual++);
-				device = virt_dev;
-				break;
-			case MEDIA_BUS_UNKNOWN:
-				break;
-			}
-
-			/* Add one more element to the devices struct */
-			*md = realloc(*md, (*md_size + 1) * sizeof(*md_ptr));
-			if (!*md)
-				goto error;
-			md_ptr = (*md) + *md_size;
-			(*md_size)++;
-
-			/* Cleans previous data and fills it with device/node */
-			memset(md_ptr, 0, sizeof(*md_ptr));
-			md_ptr->type = UNKNOWN;
-			md_ptr->device = strdup(device);
-			md_ptr->node = strdup(entry->d_name);
-
-			/* Retrieve major and minor information */
-			get_uevent_info(md_ptr, dname);
-
-			/* Used to identify the type of node */
-			fill(md_ptr);
-		}
+		if (add_entry(md, class, entry->d_name) < 0)
+			goto error;
 	}
 	err = 0;
 error:
@@ -316,6 +388,323 @@ static int sort_media_device_entry(const void *a, const void *b)
 	return strcmp(md_a->node, md_b->node);
 }
 
+static const struct media_class media_classes[] = {
+	{ "video4linux", add_v4l_class },
+	{ "sound", add_snd_class },
+	{ "dvb", add_dvb_class },
+};
+
+static void free_entry(struct media_device_entry *md_ptr)
+{
+	free(md_ptr->node);
+	free(md_ptr->device);
+	free(md_ptr->sysname);
+}
+
+static void free_index(struct media_devices *md)
+{
+	unsigned int i;
+
+	for (i = 0; i < MEDIA_KEY_COUNT; i++) {
+		free(md->hash[i]);
+		free(md->chain[i]);
+		md->hash[i] = NULL;
+		md->chain[i] = NULL;
+	}
+	free(md->by_type);
+	md->by_type = NULL;
+	md->indexed = false;
+}
+
+static int scan_media_devices(struct media_devices *md)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++)
+		if (get_class(md, &media_classes[i]))
+			return -1;
+
+	if (md->md_entry)
+		qsort(md->md_entry, md->md_size, sizeof(*md->md_entry),
+		      sort_media_device_entry);
+
+	return 0;
+}
+
+/* FNV-1a */
+static unsigned int hash_key(enum media_key key, const struct media_lookup *l)
+{
+	unsigned int h = 2166136261u;
+	const char *p;
+
+	if (key != MEDIA_KEY_NODE)
+		h = (h ^ l->type) * 16777619u;
+
+	if (key == MEDIA_KEY_DEVNUM) {
+		h = (h ^ l->major) * 16777619u;
+		return (h ^ l->minor) * 16777619u;
+	}
+
+	for (p = l->node; *p; p++)
+		h = (h ^ (unsigned char)*p) * 16777619u;
+
+	return h;
+}
+
+static bool match_key(enum media_key key, const struct media_device_entry *md_ptr,
+		      const struct media_lookup *l)
+{
+	switch (key) {
+	case MEDIA_KEY_NODE:
+		return !strcmp(md_ptr->node, l->node);
+	case MEDIA_KEY_TYPE_NODE:
+		return md_ptr->type == l->type && !strcmp(md_ptr->node, l->node);
+	case MEDIA_KEY_DEVNUM:
+		return md_ptr->type == l->type && md_ptr->major == l->major &&
+		       md_ptr->minor == l->minor;
+	default:
+		return false;
+	}
+}
+
+/* Returns the slot with the key, or the empty slot where it belongs */
+static unsigned int find_slot(struct media_devices *md, enum media_key key,
+			      const struct media_lookup *l)
+{
+	unsigned int mask = md->hash_size - 1;
+	unsigned int slot = hash_key(key, l) & mask;
+	int pos;
+
+	while ((pos = md->hash[key][slot]) >= 0) {
+		if (match_key(key, &md->md_entry[pos], l))
+			break;
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+/* Returns the position of the first entry with the key, or -1 */
+static int find_entry(struct media_devices *md, enum media_key key,
+		      const struct media_lookup *l)
+{
+	return md->hash[key][find_slot(md, key, l)];
+}
+
+static int sort_type_pos(const void *a, const void *b)
+{
+	const struct media_type_pos *tp_a = a;
+	const struct media_type_pos *tp_b = b;
+
+	if (tp_a->type != tp_b->type)
+		return (int)tp_a->type - (int)tp_b->type;
+
+	return tp_a->pos - tp_b->pos;
+}
+
+/* Returns the index of the first entry of a type at or after pos */
+static unsigned int find_type(struct media_devices *md, enum device_type type,
+			      int pos)
+{
+	const struct media_type_pos key = { type, pos };
+	unsigned int lo = 0, hi = md->md_size;
+
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (sort_type_pos(&md->by_type[mid], &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int build_index(struct media_devices *md)
+{
+	unsigned int i, key;
+	int pos;
+
+	if (md->indexed)
+		return 0;
+
+	free_index(md);
+
+	for (md->hash_size = 16; md->hash_size < md->md_size * 2; )
+		md->hash_size *= 2;
+
+	for (key = 0; key < MEDIA_KEY_COUNT; key++) {
+		md->hash[key] = malloc(md->hash_size * sizeof(*md->hash[key]));
+		md->chain[key] = malloc((md->md_size + 1) * sizeof(*md->chain[key]));
+		if (!md->hash[key] || !md->chain[key])
+			goto error;
+		for (i = 0; i < md->hash_size; i++)
+			md->hash[key][i] = -1;
+	}
+
+	md->by_type = malloc((md->md_size + 1) * sizeof(*md->by_type));
+	if (!md->by_type)
+		goto error;
+
+	/*
+	 * Going backwards, so that the first entry with a key ends up at
+	 * the table, and the chains are in order.
+	 */
+	for (pos = md->md_size - 1; pos >= 0; pos--) {
+		struct media_device_entry *md_ptr = &md->md_entry[pos];
+		struct media_lookup l = {
+			.node = md_ptr->node,
+			.type = md_ptr->type,
+			.major = md_ptr->major,
+			.minor = md_ptr->minor,
+		};
+
+		for (key = 0; key < MEDIA_KEY_COUNT; key++) {
+			unsigned int slot = find_slot(md, key, &l);
+
+			md->chain[key][pos] = md->hash[key][slot];
+			md->hash[key][slot] = pos;
+		}
+
+		md->by_type[pos].type = md_ptr->type;
+		md->by_type[pos].pos = pos;
+	}
+
+	qsort(md->by_type, md->md_size, sizeof(*md->by_type), sort_type_pos);
+
+	md->indexed = true;
+	return 0;
+
+error:
+	free_index(md);
+	return -1;
+}
+
+/* Returns the next node of a type, at the same device as the entry at pos */
+static const char *find_associated(struct media_devices *md, int pos,
+				   const enum device_type desired_type,
+				   const char *skip_node,
+				   const enum device_type skip_type)
+{
+	struct media_device_entry *md_ptr = &md->md_entry[pos];
+	const char *prev = md_ptr->device;
+	unsigned int i;
+
+	for (i = pos + 1, md_ptr++;
+	     i < md->md_size && !strcmp(prev, md_ptr->device); i++, md_ptr++) {
+		if (skip_node && md_ptr->type == skip_type &&
+		    !strcmp(md_ptr->node, skip_node))
+			continue;
+		if (md_ptr->type == desired_type)
+			return md_ptr->node;
+	}
+
+	return NULL;
+}
+
+static int find_sysname(struct media_devices *md,
+			const struct media_class *class, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < md->md_size; i++)
+		if (md->md_entry[i].class == class &&
+		    !strcmp(md->md_entry[i].sysname, name))
+			return i;
+
+	return -1;
+}
+
+/* Adds a hotplugged node, keeping the entries ordered */
+static int hotplug_add(struct media_devices *md,
+		       const struct media_class *class, const char *name)
+{
+	struct media_device_entry entry;
+	unsigned int lo = 0, hi;
+	int ret;
+
+	if (find_sysname(md, class, name) >= 0)
+		return 0;
+
+	ret = add_entry(md, class, name);
+	if (ret <= 0)
+		return ret;
+
+	entry = md->md_entry[md->md_size - 1];
+	hi = md->md_size - 1;
+	while (lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if (sort_media_device_entry(&md->md_entry[mid], &entry) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	memmove(&md->md_entry[lo + 1], &md->md_entry[lo],
+		(md->md_size - 1 - lo) * sizeof(entry));
+	md->md_entry[lo] = entry;
+
+	return 1;
+}
+
+static int hotplug_remove(struct media_devices *md,
+			  const struct media_class *class, const char *name)
+{
+	int pos = find_sysname(md, class, name);
+
+	if (pos < 0)
+		return 0;
+
+	free_entry(&md->md_entry[pos]);
+	md->md_size--;
+	memmove(&md->md_entry[pos], &md->md_entry[pos + 1],
+		(md->md_size - pos) * sizeof(*md->md_entry));
+	md->indexed = false;
+
+	return 1;
+}
+
+/*
+ * Handles an uevent message: an "action@devpath" header, followed by
+ * KEY=value strings.
+ */
+static int hotplug_event(struct media_devices *md, char *buf, size_t len)
+{
+	const char *action = NULL, *devpath = NULL, *subsystem = NULL;
+	const char *name;
+	char *p;
+	unsigned int i;
+
+	for (p = buf + strlen(buf) + 1; p < buf + len; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", 7))
+			action = p + 7;
+		else if (!strncmp(p, "DEVPATH=", 8))
+			devpath = p + 8;
+		else if (!strncmp(p, "SUBSYSTEM=", 10))
+			subsystem = p + 10;
+	}
+	if (!action || !devpath || !subsystem)
+		return 0;
+
+	for (i = 0; i < ARRAY_SIZE(media_classes); i++)
+		if (!strcmp(subsystem, media_classes[i].name))
+			break;
+	if (i == ARRAY_SIZE(media_classes))
+		return 0;
+
+	name = strrchr(devpath, '/');
+	name = name ? name + 1 : devpath;
+
+	if (!strcmp(action, "add"))
+		return hotplug_add(md, &media_classes[i], name);
+	if (!strcmp(action, "remove"))
+		return hotplug_remove(md, &media_classes[i], name);
+
+	return 0;
+}
+
 
 /* Public functions */
 
@@ -325,10 +714,12 @@ void free_media_devices(void *opaque)
 	struct media_device_entry *md_ptr = md->md_entry;
 	int i;
 	for (i = 0; i < md->md_size; i++) {
-		free(md_ptr->node);
-		free(md_ptr->device);
+		free_entry(md_ptr);
 		md_ptr++;
 	}
+	if (md->fd >= 0)
+		close(md->fd);
+	free_index(md);
 	free(md->md_entry);
 	free(md);
 }
@@ -336,27 +727,48 @@ void free_media_devices(void *opaque)
 void *discover_media_devices(void)
 {
 	struct media_devices *md = NULL;
-	struct media_device_entry *md_entry = NULL;
 
 	md = calloc(1, sizeof(*md));
 	if (!md)
 		return NULL;
 
-	md->md_size = 0;
-	if (get_class("video4linux", &md_entry, &md->md_size, add_v4l_class))
-		goto error;
-	if (get_class("sound", &md_entry, &md->md_size, add_snd_class))
-		goto error;
-	if (get_class("dvb", &md_entry, &md->md_size, add_dvb_class))
+	md->fd = -1;
+	if (scan_media_devices(md))
 		goto error;
 
 	/* There's no media device */
-	if (!md_entry)
+	if (!md->md_entry)
 		goto error;
 
-	qsort(md_entry, md->md_size, sizeof(*md_entry), sort_media_device_entry);
+	return md;
 
-	md->md_entry = md_entry;
+error:
+	free_media_devices(md);
+	return NULL;
+}
+
+void *monitor_media_devices(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,		/* kernel uevents */
+	};
+	struct media_devices *md;
+
+	md = calloc(1, sizeof(*md));
+	if (!md)
+		return NULL;
+
+	md->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_KOBJECT_UEVENT);
+	if (md->fd < 0)
+		goto error;
+	if (bind(md->fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto error;
+
+	/* Subscribe before scanning, so that no hotplug gets missed */
+	if (scan_media_devices(md))
+		goto error;
 
 	return md;
 
@@ -365,6 +777,64 @@ error:
 	return NULL;
 }
 
+int get_media_devices_fd(void *opaque)
+{
+	struct media_devices *md = opaque;
+
+	return md->fd;
+}
+
+int update_media_devices(void *opaque)
+{
+	struct media_devices *md = opaque;
+	struct media_device_entry *md_ptr;
+	struct sockaddr_nl addr;
+	socklen_t addrlen;
+	char buf[8192];
+	ssize_t len;
+	int changes = 0, ret;
+	unsigned int i;
+
+	if (md->fd < 0)
+		return -1;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		len = recvfrom(md->fd, buf, sizeof(buf) - 1, 0,
+			       (struct sockaddr *)&addr, &addrlen);
+		if (len < 0)
+			break;
+
+		/* Only trust the messages sent by the kernel */
+		if (addrlen != sizeof(addr) || addr.nl_pid)
+			continue;
+
+		buf[len] = '\0';
+		ret = hotplug_event(md, buf, len);
+		if (ret < 0)
+			return -1;
+		changes += ret;
+	}
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return changes;
+	if (errno != ENOBUFS)
+		return -1;
+
+	/* Some events were lost: discover all devices again */
+	for (i = 0, md_ptr = md->md_entry; i < md->md_size; i++, md_ptr++)
+		free_entry(md_ptr);
+	free(md->md_entry);
+	md->md_entry = NULL;
+	md->md_size = 0;
+	md->indexed = false;
+
+	if (scan_media_devices(md))
+		return -1;
+
+	return changes + 1;
+}
+
 const char *media_device_type(enum device_type type)
 {
 	switch(type) {
@@ -450,9 +920,13 @@ const char *get_associated_device(void *opaque,
 				  const enum device_type seek_type)
 {
 	struct media_devices *md = opaque;
-	struct media_device_entry *md_ptr = md->md_entry;
-	int i, found = 0;
-	char *prev, *p;
+	struct media_lookup l = { 0 };
+	unsigned int i;
+	int pos, after;
+	char *p;
+
+	if (build_index(md))
+		return NULL;
 
 	if (seek_type != NONE && seek_device[0]) {
 		/* Get just the device name */
@@ -460,47 +934,43 @@ const char *get_associated_device(void *opaque,
 		if (p)
 			seek_device = p + 1;
 
-		/* Step 1: Find the seek node */
-		for (i = 0; i < md->md_size; i++, md_ptr++) {
-			if (last_seek && md_ptr->type == seek_type &&
-			    !strcmp(md_ptr->node, last_seek)) {
-				found = 1;
-				continue;
-			}
-			if (last_seek && !found)
-				continue;
-			if (md_ptr->type == seek_type &&
-			    !strcmp(seek_device, md_ptr->node))
-				break;
+		/* Step 1: Find the seek node, after the last seek one */
+		l.node = seek_device;
+		l.type = seek_type;
+		pos = find_entry(md, MEDIA_KEY_TYPE_NODE, &l);
+		if (last_seek) {
+			if (!strcmp(seek_device, last_seek))
+				return NULL;
+			l.node = last_seek;
+			after = find_entry(md, MEDIA_KEY_TYPE_NODE, &l);
+			if (after < 0)
+				return NULL;
+			while (pos >= 0 && pos < after)
+				pos = md->chain[MEDIA_KEY_TYPE_NODE][pos];
 		}
-		if (i == md->md_size)
+		if (pos < 0)
 			return NULL;
-		i++;
-		prev = md_ptr->device;
-		md_ptr++;
+
 		/* Step 2: find the associated node */
-		for (; i < md->md_size && !strcmp(prev, md_ptr->device); i++, md_ptr++) {
-			if (last_seek && md_ptr->type == seek_type &&
-			    !strcmp(md_ptr->node, last_seek)) {
-				found = 1;
-				continue;
-			}
-			if (last_seek && !found)
-				continue;
-			if (md_ptr->type == desired_type)
-				return md_ptr->node;
-		}
-	} else {
-		for (i = 0; i < md->md_size; i++, md_ptr++) {
-			if (last_seek && !strcmp(md_ptr->node, last_seek)) {
-				found = 1;
-				continue;
-			}
-			if (last_seek && !found)
-				continue;
-			if (md_ptr->type == desired_type)
-				return md_ptr->node;
-		}
+		return find_associated(md, pos, desired_type,
+				       last_seek, seek_type);
+	}
+
+	pos = 0;
+	if (last_seek) {
+		l.node = last_seek;
+		pos = find_entry(md, MEDIA_KEY_NODE, &l);
+		if (pos < 0)
+			return NULL;
+	}
+
+	for (i = find_type(md, desired_type, pos);
+	     i < md->md_size && md->by_type[i].type == desired_type; i++) {
+		const char *node = md->md_entry[md->by_type[i].pos].node;
+
+		if (last_seek && !strcmp(node, last_seek))
+			continue;
+		return node;
 	}
 
 	return NULL;
@@ -513,11 +983,9 @@ const char *fget_associated_device(void *opaque,
 				   const enum device_type seek_type)
 {
 	struct media_devices *md = opaque;
-	struct media_device_entry *md_ptr = md->md_entry;
 	struct stat f_status;
-	unsigned int dev_major, dev_minor;
-	int i, found = 0;
-	char *prev;
+	struct media_lookup l = { 0 };
+	int pos;
 
 	if (fstat(fd_seek_device, &f_status)) {
 		perror("Can't get file status");
@@ -527,43 +995,24 @@ const char *fget_associated_device(void *opaque,
 		fprintf(stderr, "File descriptor is not a char device\n");
 		return NULL;
 	}
-	dev_major = major(f_status.st_rdev);
-	dev_minor = minor(f_status.st_rdev);
+
+	/* There's a single association per device node */
+	if (last_seek)
+		return NULL;
+
+	if (build_index(md))
+		return NULL;
 
 	/* Step 1: Find the seek node */
-	for (i = 0; i < md->md_size; i++, md_ptr++) {
-		if (last_seek && md_ptr->type == seek_type
-		    && md_ptr->major == dev_major
-		    && md_ptr->minor == dev_minor) {
-			found = 1;
-			continue;
-		}
-		if (last_seek && !found)
-			continue;
-		if (md_ptr->type == seek_type
-		    && md_ptr->major == dev_major
-		    && md_ptr->minor == dev_minor)
-			break;
-	}
-	if (i == md->md_size)
+	l.type = seek_type;
+	l.major = major(f_status.st_rdev);
+	l.minor = minor(f_status.st_rdev);
+	pos = find_entry(md, MEDIA_KEY_DEVNUM, &l);
+	if (pos < 0)
 		return NULL;
-	i++;
-	prev = md_ptr->device;
-	md_ptr++;
+
 	/* Step 2: find the associated node */
-	for (; i < md->md_size && !strcmp(prev, md_ptr->device); i++, md_ptr++) {
-		if (last_seek && md_ptr->type == seek_type
-		    && md_ptr->major == dev_major
-		    && md_ptr->minor == dev_minor) {
-			found = 1;
-			continue;
-		}
-		if (last_seek && !found)
-			continue;
-		if (md_ptr->type == desired_type)
-			return md_ptr->node;
-	}
-	return NULL;
+	return find_associated(md, pos, desired_type, NULL, NONE);
 }
 
 const char *get_not_associated_device(void *opaque,
@@ -20,7 +20,7 @@
 /*
  * Version of the API
  */
-#define GET_MEDIA_DEVICES_VERSION	0x0105
+#define GET_MEDIA_DEVICES_VERSION	0x0106
 
 /**
  * enum device_type - Enumerates the type for each device
@@ -93,6 +93,42 @@ void *discover_media_devices(void);
  */
 void free_media_devices(void *opaque);
 
+/**
+ * monitor_media_devices() - Returns a list of the media devices, kept
+ *			     up to date with the hotplug events
+ *
+ * This function works like discover_media_devices(), but it also
+ * subscribes to the kernel hotplug events, so that the list can be
+ * updated by update_media_devices() instead of being discovered again.
+ * Unlike discover_media_devices(), it returns an empty list if there's
+ * no media device yet. The list should be released with
+ * free_media_devices().
+ */
+void *monitor_media_devices(void);
+
+/**
+ * get_media_devices_fd() - Returns the hotplug events file descriptor
+ *
+ * @opaque:	media devices opaque descriptor
+ *
+ * The file descriptor becomes readable when update_media_devices() has
+ * events to process, so it can be added to a poll()/select() loop. It
+ * is -1 for the lists returned by discover_media_devices().
+ */
+int get_media_devices_fd(void *opaque);
+
+/**
+ * update_media_devices() - Processes the pending hotplug events
+ *
+ * @opaque:	media devices opaque descriptor
+ *
+ * Adds the devices that appeared and removes the ones that are gone
+ * since the last call, without blocking. The names returned by the
+ * functions below for the removed devices are no longer valid. Returns
+ * the number of changes, or -1 on error.
+ */
+int update_media_devices(void *opaque);
+
 /**
  * media_device_type() - returns a string with the name of a given type
  *
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,11 +65,98 @@ struct media_pad *media_entity_remote_source(struct media_pad *pad)
 	return NULL;
 }
 
+/*
+ * The indexes are open addressing hash tables of sizes a power of two. As
+ * entities are inserted in order and looked up by probing linearly, the
+ * first of several entities with the same name or id (emulated devices use
+ * id 0) is found first, as with a linear walk of the entities.
+ */
+static unsigned int media_hash_id(__u32 id)
+{
+	return id * 2654435761U;
+}
+
+static unsigned int media_hash_name(const char *name)
+{
+	unsigned int hash = 2166136261U;
+
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619U;
+
+	return hash;
+}
+
+static void media_index_free(struct media_device *media)
+{
+	free(media->index.by_id);
+	free(media->index.by_name);
+	memset(&media->index, 0, sizeof(media->index));
+}
+
+/*
+ * Rebuild the indexes if entities have been added since they were built.
+ * Return false if they can't be allocated, the callers then walk the
+ * entities.
+ */
+static bool media_index_update(struct media_device *media)
+{
+	unsigned int size, mask, i, j;
+
+	if (media->index.by_id && media->index.count == media->entities_count)
+		return true;
+
+	media_index_free(media);
+
+	/* Keep the tables at most half full. */
+	for (size = 16; size < media->entities_count * 2; size *= 2);
+
+	media->index.by_id = calloc(size, sizeof(*media->index.by_id));
+	media->index.by_name = calloc(size, sizeof(*media->index.by_name));
+	if (media->index.by_id == NULL || media->index.by_name == NULL) {
+		media_index_free(media);
+		return false;
+	}
+
+	mask = size - 1;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		for (j = media_hash_id(entity->info.id) & mask;
+		     media->index.by_id[j]; j = (j + 1) & mask);
+		media->index.by_id[j] = i + 1;
+
+		for (j = media_hash_name(entity->info.name) & mask;
+		     media->index.by_name[j]; j = (j + 1) & mask);
+		media->index.by_name[j] = i + 1;
+	}
+
+	media->index.size = size;
+	media->index.count = media->entities_count;
+
+	return true;
+}
+
 struct media_entity *media_get_entity_by_name(struct media_device *media,
 					      const char *name)
 {
 	unsigned int i;
 
+	if (media_index_update(media)) {
+		unsigned int mask = media->index.size - 1;
+		unsigned int n;
+
+		for (i = media_hash_name(name) & mask;
+		     (n = media->index.by_name[i]); i = (i + 1) & mask) {
+			struct media_entity *entity = &media->entities[n - 1];
+
+			if (strcmp(entity->info.name, name) == 0)
+				return entity;
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -87,6 +175,21 @@ struct media_entity *media_get_entity_by_id(struct media_device *media,
 
 	id &= ~MEDIA_ENT_ID_FLAG_NEXT;
 
+	if (!next && media_index_update(media)) {
+		unsigned int mask = media->index.size - 1;
+		unsigned int n;
+
+		for (i = media_hash_id(id) & mask;
+		     (n = media->index.by_id[i]); i = (i + 1) & mask) {
+			struct media_entity *entity = &media->entities[n - 1];
+
+			if (entity->info.id == id)
+				return entity;
+		}
+
+		return NULL;
+	}
+
 	for (i = 0; i < media->entities_count; ++i) {
 		struct media_entity *entity = &media->entities[i];
 
@@ -315,6 +418,42 @@ static struct media_link *media_entity_add_link(struct media_entity *entity)
 	return &entity->links[entity->num_links++];
 }
 
+/*
+ * Add a link to its source entity and its twin to its sink entity. The pads
+ * of the sink entity may not have been enumerated yet.
+ */
+static int media_entity_add_link_pair(struct media_entity *source,
+				      unsigned int source_pad,
+				      struct media_entity *sink,
+				      unsigned int sink_pad, __u32 flags)
+{
+	struct media_link *fwdlink;
+	struct media_link *backlink;
+
+	fwdlink = media_entity_add_link(source);
+	if (fwdlink == NULL)
+		return -ENOMEM;
+
+	fwdlink->source = &source->pads[source_pad];
+	fwdlink->sink = &sink->pads[sink_pad];
+	fwdlink->flags = flags;
+
+	backlink = media_entity_add_link(sink);
+	if (backlink == NULL) {
+		source->num_links--;
+		return -ENOMEM;
+	}
+
+	backlink->source = &source->pads[source_pad];
+	backlink->sink = &sink->pads[sink_pad];
+	backlink->flags = flags;
+
+	fwdlink->twin = backlink;
+	backlink->twin = fwdlink;
+
+	return 0;
+}
+
 static int media_enum_links(struct media_device *media)
 {
 	__u32 id;
@@ -347,8 +486,6 @@ static int media_enum_links(struct media_device *media)
 
 		for (i = 0; i < entity->info.links; ++i) {
 			struct media_link_desc *link = &links.links[i];
-			struct media_link *fwdlink;
-			struct media_link *backlink;
 			struct media_entity *source;
 			struct media_entity *sink;
 
@@ -363,19 +500,12 @@ static int media_enum_links(struct media_device *media)
 					  link->sink.entity,
 					  link->sink.index);
 				ret = -EINVAL;
-			} else {
-				fwdlink = media_entity_add_link(source);
-				fwdlink->source = &source->pads[link->source.index];
-				fwdlink->sink = &sink->pads[link->sink.index];
-				fwdlink->flags = link->flags;
-
-				backlink = media_entity_add_link(sink);
-				backlink->source = &source->pads[link->source.index];
-				backlink->sink = &sink->pads[link->sink.index];
-				backlink->flags = link->flags;
-
-				fwdlink->twin = backlink;
-				backlink->twin = fwdlink;
+			} else if (media_entity_add_link_pair(source, link->source.index,
+							      sink, link->sink.index,
+							      link->flags) < 0) {
+				free(links.pads);
+				free(links.links);
+				return -ENOMEM;
 			}
 		}
 
@@ -499,6 +629,48 @@ static int media_get_devname_sysfs(struct media_entity *entity)
 	return 0;
 }
 
+static void media_entity_set_default(struct media_entity *entity)
+{
+	struct media_device *media = entity->media;
+
+	if (entity->info.flags & MEDIA_ENT_FL_DEFAULT) {
+		switch (entity->info.type) {
+		case MEDIA_ENT_T_DEVNODE_V4L:
+			media->def.v4l = entity;
+			break;
+		case MEDIA_ENT_T_DEVNODE_FB:
+			media->def.fb = entity;
+			break;
+		case MEDIA_ENT_T_DEVNODE_ALSA:
+			media->def.alsa = entity;
+			break;
+		case MEDIA_ENT_T_DEVNODE_DVB:
+			media->def.dvb = entity;
+			break;
+		}
+	}
+}
+
+static void media_entity_find_devname(struct media_entity *entity,
+				      struct udev *udev)
+{
+	/* Find the corresponding device name. */
+	if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
+	    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
+		return;
+
+	/* Don't try to parse empty major,minor */
+	if (!entity->info.dev.major && !entity->info.dev.minor)
+		return;
+
+	/* Try to get the device name via udev */
+	if (!media_get_devname_udev(udev, entity))
+		return;
+
+	/* Fall back to get the device name via sysfs */
+	media_get_devname_sysfs(entity);
+}
+
 static int media_enum_entities(struct media_device *media)
 {
 	struct media_entity *entity;
@@ -542,41 +714,547 @@ static int media_enum_entities(struct media_device *media)
 
 		media->entities_count++;
 
-		if (entity->info.flags & MEDIA_ENT_FL_DEFAULT) {
-			switch (entity->info.type) {
-			case MEDIA_ENT_T_DEVNODE_V4L:
-				media->def.v4l = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_FB:
-				media->def.fb = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_ALSA:
-				media->def.alsa = entity;
-				break;
-			case MEDIA_ENT_T_DEVNODE_DVB:
-				media->def.dvb = entity;
+		media_entity_set_default(entity);
+		media_entity_find_devname(entity, udev);
+	}
+
+	media_udev_close(udev);
+	return ret;
+}
+
+/*
+ * Enumerate the entities, pads and links with a single MEDIA_IOC_G_TOPOLOGY
+ * call instead of one MEDIA_IOC_ENUM_ENTITIES and one MEDIA_IOC_ENUM_LINKS
+ * per entity. Return -ENOTTY if the kernel doesn't support the ioctl or
+ * doesn't report the entity flags and pad indexes (before 4.19), the caller
+ * then falls back to the legacy ioctls.
+ */
+struct media_topology {
+	struct media_v2_topology topology;
+	struct media_v2_entity *entities;
+	struct media_v2_interface *interfaces;
+	struct media_v2_pad *pads;
+	struct media_v2_link *links;
+};
+
+static void media_topology_free(struct media_topology *topo)
+{
+	free(topo->entities);
+	free(topo->interfaces);
+	free(topo->pads);
+	free(topo->links);
+	memset(topo, 0, sizeof(*topo));
+}
+
+static int media_topology_get(struct media_device *media,
+			      struct media_topology *topo)
+{
+	struct media_v2_topology *t = &topo->topology;
+	__u64 version;
+
+	/* Retry until the topology doesn't change between the two calls. */
+	for (;;) {
+		media_topology_free(topo);
+
+		if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, t) < 0)
+			return -errno;
+
+		version = t->topology_version;
+
+		topo->entities = calloc(t->num_entities + 1, sizeof(*topo->entities));
+		topo->interfaces = calloc(t->num_interfaces + 1, sizeof(*topo->interfaces));
+		topo->pads = calloc(t->num_pads + 1, sizeof(*topo->pads));
+		topo->links = calloc(t->num_links + 1, sizeof(*topo->links));
+		if (topo->entities == NULL || topo->interfaces == NULL ||
+		    topo->pads == NULL || topo->links == NULL) {
+			media_topology_free(topo);
+			return -ENOMEM;
+		}
+
+		t->ptr_entities = (uintptr_t)topo->entities;
+		t->ptr_interfaces = (uintptr_t)topo->interfaces;
+		t->ptr_pads = (uintptr_t)topo->pads;
+		t->ptr_links = (uintptr_t)topo->links;
+
+		if (ioctl(media->fd, MEDIA_IOC_G_TOPOLOGY, t) < 0) {
+			/* Objects have been added since the first call. */
+			if (errno == ENOSPC)
+				continue;
+			media_topology_free(topo);
+			return -errno;
+		}
+
+		if (t->topology_version == version)
+			return 0;
+	}
+}
+
+static int media_v2_id_cmp(const void *a, const void *b)
+{
+	const __u32 *ida = a;
+	const __u32 *idb = b;
+
+	return *ida < *idb ? -1 : *ida > *idb;
+}
+
+/* The objects are sorted by id, which is their first member. */
+#define media_v2_find(array, num, obj_id) ({				\
+	__u32 __id = (obj_id);						\
+	(typeof(&(array)[0]))bsearch(&__id, (array), (num),		\
+				     sizeof((array)[0]), media_v2_id_cmp); \
+})
+
+/* A data link with its pads resolved, see media_topology_link_cmp(). */
+struct media_topology_link {
+	const struct media_v2_link *link;
+	const struct media_v2_pad *source;
+	const struct media_v2_pad *sink;
+};
+
+/*
+ * The legacy enumeration reports the links of the entities in the order of
+ * their ids, and the links of an entity in the order they have been created
+ * in, which is the order of their ids.
+ */
+static int media_topology_link_cmp(const void *a, const void *b)
+{
+	const struct media_topology_link *la = a;
+	const struct media_topology_link *lb = b;
+
+	if (la->source->entity_id != lb->source->entity_id)
+		return la->source->entity_id < lb->source->entity_id ? -1 : 1;
+
+	return la->link->id < lb->link->id ? -1 : la->link->id > lb->link->id;
+}
+
+/* The interfaces linked to an entity. */
+struct media_topology_intfs {
+	const struct media_v2_interface *subdev;
+	const struct media_v2_interface *devnode;
+	unsigned int count;
+};
+
+/*
+ * Fill the legacy type and device number of an entity from the interfaces
+ * linked to it. Return false if they can't be told apart from the topology,
+ * the entity has then to be enumerated with MEDIA_IOC_ENUM_ENTITIES.
+ */
+static bool media_entity_from_interfaces(struct media_entity *entity,
+					 const struct media_v2_entity *ent,
+					 const struct media_topology_intfs *intfs)
+{
+	const struct media_v2_interface *devnode;
+
+	/* Mirror the kernel mapping of the functions to the legacy types. */
+	if (ent->function >= MEDIA_ENT_F_OLD_BASE &&
+	    ent->function <= MEDIA_ENT_F_TUNER)
+		entity->info.type = ent->function;
+	else if (intfs->subdev)
+		entity->info.type = MEDIA_ENT_F_V4L2_SUBDEV_UNKNOWN;
+	else
+		/* Subdevices without a device node can't be recognized. */
+		return false;
+
+	/*
+	 * Interfaces are also linked to other entities than their own, for
+	 * instance a DVB frontend interface to the tuner subdevice.
+	 */
+	if (media_entity_type(entity) == MEDIA_ENT_T_V4L2_SUBDEV) {
+		devnode = intfs->subdev;
+	} else {
+		if (intfs->count > 1)
+			return false;
+		devnode = intfs->devnode;
+	}
+
+	if (devnode) {
+		entity->info.dev.major = devnode->devnode.major;
+		entity->info.dev.minor = devnode->devnode.minor;
+	}
+
+	return true;
+}
+
+/* -----------------------------------------------------------------------------
+ * Entities cache
+ *
+ * The cache stores the legacy type, device number and device node name of
+ * the entities, which take an ioctl or a udev or sysfs lookup per entity to
+ * retrieve. It is valid as long as the device information and the topology
+ * version don't change, and the device nodes still match.
+ */
+
+#define MEDIA_CACHE_MAGIC	"MCENTS01"
+
+struct media_cache_header {
+	char magic[8];
+	__u64 topology_version;
+	struct media_device_info info;
+	__u32 entities_count;
+	__u32 entity_size;
+};
+
+struct media_cache_entity {
+	__u32 id;
+	__u32 function;
+	__u32 type;
+	__u32 major;
+	__u32 minor;
+	char devname[32];
+};
+
+static char *media_cache_path(struct media_device *media)
+{
+	const char *key = media->info.serial[0] ? media->info.serial
+						 : media->info.bus_info;
+	char *path;
+	char *p;
+
+	if (asprintf(&path, "%s/%.*s-%.*s", media->cache_dir,
+		     (int)sizeof(media->info.driver), media->info.driver,
+		     (int)sizeof(media->info.serial), key) < 0)
+		return NULL;
+
+	/* Don't let the device information escape the cache directory. */
+	for (p = path + strlen(media->cache_dir) + 1; *p; ++p) {
+		if (!isalnum(*p) && *p != '-' && *p != '.' && *p != '_')
+			*p = '_';
+	}
+
+	return path;
+}
+
+/*
+ * Read the cache in one go, and check that it matches the topology. Return
+ * the cached entities in the order of the topology entities, or NULL.
+ */
+static struct media_cache_entity *
+media_cache_read(struct media_device *media, struct media_topology *topo)
+{
+	struct media_cache_header *header;
+	struct media_cache_entity *cache;
+	struct stat devstat;
+	unsigned int i;
+	size_t size;
+	char *path;
+	void *buf;
+	int fd;
+
+	if (media->cache_dir == NULL)
+		return NULL;
+
+	path = media_cache_path(media);
+	if (path == NULL)
+		return NULL;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return NULL;
+
+	size = sizeof(*header) + topo->topology.num_entities * sizeof(*cache);
+	buf = malloc(size + 1);
+	if (buf == NULL || read(fd, buf, size + 1) != (ssize_t)size) {
+		close(fd);
+		free(buf);
+		return NULL;
+	}
+
+	close(fd);
+
+	header = buf;
+	cache = (struct media_cache_entity *)(header + 1);
+
+	if (memcmp(header->magic, MEDIA_CACHE_MAGIC, sizeof(header->magic)) ||
+	    header->topology_version != topo->topology.topology_version ||
+	    memcmp(&header->info, &media->info, sizeof(header->info)) ||
+	    header->entities_count != topo->topology.num_entities ||
+	    header->entity_size != sizeof(*cache))
+		goto invalid;
+
+	for (i = 0; i < header->entities_count; ++i) {
+		const struct media_v2_entity *ent = &topo->entities[i];
+
+		if (cache[i].id != ent->id || cache[i].function != ent->function ||
+		    cache[i].devname[sizeof(cache[i].devname) - 1])
+			goto invalid;
+
+		/* udev might have renamed the device nodes. */
+		if (cache[i].devname[0] &&
+		    (stat(cache[i].devname, &devstat) < 0 ||
+		     major(devstat.st_rdev) != cache[i].major ||
+		     minor(devstat.st_rdev) != cache[i].minor))
+			goto invalid;
+	}
+
+	media_dbg(media, "Restoring %u entities from the cache\n",
+		  header->entities_count);
+
+	/* The entities are at the start of the buffer returned to the caller. */
+	memmove(buf, cache, header->entities_count * sizeof(*cache));
+	return buf;
+
+invalid:
+	media_dbg(media, "Ignoring stale entities cache\n");
+	free(buf);
+	return NULL;
+}
+
+/* Write the cache to a temporary file and rename it, for concurrent users. */
+static void media_cache_write(struct media_device *media,
+			      struct media_topology *topo)
+{
+	struct media_cache_header header = { { 0 } };
+	unsigned int i;
+	char *tmp = NULL;
+	char *path;
+	int error;
+	FILE *f;
+
+	if (media->cache_dir == NULL)
+		return;
+
+	path = media_cache_path(media);
+	if (path == NULL || asprintf(&tmp, "%s.%u", path, getpid()) < 0)
+		goto done;
+
+	mkdir(media->cache_dir, 0755);
+
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		media_dbg(media, "%s: Unable to create %s (%s)\n", __func__,
+			  tmp, strerror(errno));
+		goto done;
+	}
+
+	memcpy(header.magic, MEDIA_CACHE_MAGIC, sizeof(header.magic));
+	header.topology_version = topo->topology.topology_version;
+	header.info = media->info;
+	header.entities_count = media->entities_count;
+	header.entity_size = sizeof(struct media_cache_entity);
+	fwrite(&header, sizeof(header), 1, f);
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+		struct media_cache_entity ent = {
+			.id = entity->info.id,
+			.function = topo->entities[i].function,
+			.type = entity->info.type,
+			.major = entity->info.dev.major,
+			.minor = entity->info.dev.minor,
+		};
+
+		memcpy(ent.devname, entity->devname, sizeof(ent.devname));
+		fwrite(&ent, sizeof(ent), 1, f);
+	}
+
+	error = ferror(f);
+	if (fclose(f) || error || rename(tmp, path) < 0) {
+		media_dbg(media, "%s: Unable to write %s\n", __func__, path);
+		unlink(tmp);
+	}
+
+done:
+	free(tmp);
+	free(path);
+}
+
+static int media_enum_topology(struct media_device *media)
+{
+	struct media_topology topo = { { 0 } };
+	struct media_v2_topology *t = &topo.topology;
+	struct media_topology_intfs *intfs = NULL;
+	struct media_topology_link *links = NULL;
+	struct media_cache_entity *cache = NULL;
+	unsigned int num_links = 0;
+	struct udev *udev = NULL;
+	unsigned int i;
+	int ret;
+
+	if (!MEDIA_V2_ENTITY_HAS_FLAGS(media->info.media_version) ||
+	    !MEDIA_V2_PAD_HAS_INDEX(media->info.media_version))
+		return -ENOTTY;
+
+	ret = media_topology_get(media, &topo);
+	if (ret < 0)
+		return ret;
+
+	qsort(topo.entities, t->num_entities, sizeof(*topo.entities),
+	      media_v2_id_cmp);
+	qsort(topo.interfaces, t->num_interfaces, sizeof(*topo.interfaces),
+	      media_v2_id_cmp);
+	qsort(topo.pads, t->num_pads, sizeof(*topo.pads), media_v2_id_cmp);
+
+	media->entities = calloc(t->num_entities + 1, sizeof(*media->entities));
+	intfs = calloc(t->num_entities + 1, sizeof(*intfs));
+	links = calloc(t->num_links + 1, sizeof(*links));
+	if (media->entities == NULL || intfs == NULL || links == NULL) {
+		ret = -ENOMEM;
+		goto done;
+	}
+
+	for (i = 0; i < t->num_entities; ++i) {
+		struct media_entity *entity = &media->entities[i];
+		const struct media_v2_entity *ent = &topo.entities[i];
+
+		entity->fd = -1;
+		entity->media = media;
+		entity->info.id = ent->id;
+		entity->info.flags = ent->flags;
+		/* The legacy name is shorter, truncate it as the kernel does. */
+		memcpy(entity->info.name, ent->name, sizeof(entity->info.name) - 1);
+	}
+
+	media->entities_count = t->num_entities;
+
+	/* Count the pads and the outbound data links of every entity. */
+	for (i = 0; i < t->num_pads; ++i) {
+		const struct media_v2_entity *ent;
+
+		ent = media_v2_find(topo.entities, t->num_entities,
+				    topo.pads[i].entity_id);
+		if (ent == NULL) {
+			ret = -EINVAL;
+			goto done;
+		}
+
+		media->entities[ent - topo.entities].info.pads++;
+	}
+
+	for (i = 0; i < t->num_links; ++i) {
+		const struct media_v2_link *link = &topo.links[i];
+		const struct media_v2_interface *intf;
+		const struct media_v2_entity *ent;
+		struct media_topology_intfs *ei;
+
+		switch (link->flags & MEDIA_LNK_FL_LINK_TYPE) {
+		case MEDIA_LNK_FL_DATA_LINK:
+			links[num_links].link = link;
+			links[num_links].source =
+				media_v2_find(topo.pads, t->num_pads, link->source_id);
+			links[num_links].sink =
+				media_v2_find(topo.pads, t->num_pads, link->sink_id);
+			if (!links[num_links].source || !links[num_links].sink) {
+				ret = -EINVAL;
+				goto done;
+			}
+
+			media_get_entity_by_id(media, links[num_links].source->entity_id)
+				->info.links++;
+			num_links++;
+			break;
+
+		case MEDIA_LNK_FL_INTERFACE_LINK:
+			intf = media_v2_find(topo.interfaces, t->num_interfaces,
+					     link->source_id);
+			ent = media_v2_find(topo.entities, t->num_entities,
+					    link->sink_id);
+			if (intf == NULL || ent == NULL)
 				break;
+
+			ei = &intfs[ent - topo.entities];
+			if (intf->intf_type == MEDIA_INTF_T_V4L_SUBDEV) {
+				ei->subdev = intf;
+			} else {
+				ei->devnode = intf;
+				ei->count++;
 			}
+			break;
 		}
+	}
 
-		/* Find the corresponding device name. */
-		if (media_entity_type(entity) != MEDIA_ENT_T_DEVNODE &&
-		    media_entity_type(entity) != MEDIA_ENT_T_V4L2_SUBDEV)
-			continue;
+	cache = media_cache_read(media, &topo);
 
-		/* Don't try to parse empty major,minor */
-		if (!entity->info.dev.major && !entity->info.dev.minor)
-			continue;
+	ret = cache ? 0 : media_udev_open(&udev);
+	if (ret < 0)
+		media_dbg(media, "Can't get udev context\n");
 
-		/* Try to get the device name via udev */
-		if (!media_get_devname_udev(udev, entity))
+	for (i = 0, ret = 0; i < t->num_entities; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		entity->max_links = entity->info.pads + entity->info.links;
+		entity->pads = calloc(entity->info.pads + 1, sizeof(*entity->pads));
+		entity->links = malloc((entity->max_links + 1) * sizeof(*entity->links));
+		if (entity->pads == NULL || entity->links == NULL) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (cache) {
+			entity->info.type = cache[i].type;
+			entity->info.dev.major = cache[i].major;
+			entity->info.dev.minor = cache[i].minor;
+			memcpy(entity->devname, cache[i].devname,
+			       sizeof(entity->devname));
+			media_entity_set_default(entity);
 			continue;
+		}
 
-		/* Fall back to get the device name via sysfs */
-		media_get_devname_sysfs(entity);
+		if (!media_entity_from_interfaces(entity, &topo.entities[i],
+						  &intfs[i])) {
+			struct media_entity_desc info = { .id = entity->info.id };
+
+			media_dbg(media, "Enumerating entity %u\n", info.id);
+
+			if (ioctl(media->fd, MEDIA_IOC_ENUM_ENTITIES, &info) < 0) {
+				ret = -errno;
+				break;
+			}
+
+			entity->info.type = info.type;
+			entity->info.dev = info.dev;
+		}
+
+		media_entity_set_default(entity);
+		media_entity_find_devname(entity, udev);
 	}
 
-	media_udev_close(udev);
+	if (!cache)
+		media_udev_close(udev);
+	if (ret < 0)
+		goto done;
+
+	for (i = 0; i < t->num_pads; ++i) {
+		const struct media_v2_pad *pad = &topo.pads[i];
+		struct media_entity *entity;
+
+		entity = media_get_entity_by_id(media, pad->entity_id);
+		if (pad->index >= entity->info.pads) {
+			ret = -EINVAL;
+			goto done;
+		}
+
+		entity->pads[pad->index].entity = entity;
+		entity->pads[pad->index].index = pad->index;
+		entity->pads[pad->index].flags = pad->flags;
+	}
+
+	qsort(links, num_links, sizeof(*links), media_topology_link_cmp);
+
+	for (i = 0; i < num_links; ++i) {
+		struct media_entity *source;
+		struct media_entity *sink;
+
+		source = media_get_entity_by_id(media, links[i].source->entity_id);
+		sink = media_get_entity_by_id(media, links[i].sink->entity_id);
+
+		ret = media_entity_add_link_pair(source, links[i].source->index,
+						 sink, links[i].sink->index,
+						 links[i].link->flags);
+		if (ret < 0)
+			goto done;
+	}
+
+	if (!cache)
+		media_cache_write(media, &topo);
+
+	ret = 0;
+
+done:
+	free(cache);
+	free(links);
+	free(intfs);
+	media_topology_free(&topo);
 	return ret;
 }
 
@@ -602,6 +1280,20 @@ int media_device_enumerate(struct media_device *media)
 		goto done;
 	}
 
+	media_dbg(media, "Enumerating the topology\n");
+
+	ret = media_enum_topology(media);
+	if (ret != -ENOTTY) {
+		if (ret < 0)
+			media_dbg(media,
+				  "%s: Unable to enumerate the topology for device %s (%s)\n",
+				  __func__, media->devnode, strerror(-ret));
+		else
+			media_dbg(media, "Found %u entities\n",
+				  media->entities_count);
+		goto done;
+	}
+
 	media_dbg(media, "Enumerating entities\n");
 
 	ret = media_enum_entities(media);
@@ -638,6 +1330,22 @@ static void media_debug_default(void *ptr, ...)
 {
 }
 
+int media_device_set_cache_dir(struct media_device *media, const char *dir)
+{
+	char *cache_dir = NULL;
+
+	if (dir) {
+		cache_dir = strdup(dir);
+		if (cache_dir == NULL)
+			return -ENOMEM;
+	}
+
+	free(media->cache_dir);
+	media->cache_dir = cache_dir;
+
+	return 0;
+}
+
 void media_debug_set_handler(struct media_device *media,
 			     void (*debug_handler)(void *, ...),
 			     void *debug_priv)
@@ -720,8 +1428,10 @@ void media_device_unref(struct media_device *media)
 			close(entity->fd);
 	}
 
+	media_index_free(media);
 	free(media->entities);
 	free(media->devnode);
+	free(media->cache_dir);
 	free(media);
 }
 
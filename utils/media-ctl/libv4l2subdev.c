@@ -521,14 +521,17 @@ static int v4l2_subdev_parse_setup_route(struct media_device *media,
 	return 0;
 }
 
-int v4l2_subdev_parse_setup_routes(struct media_device *media,
-				   enum v4l2_subdev_format_whence which,
-				   const char *p)
+/*
+ * Parse the routes of an entity in @a routes, which must have room for
+ * NUM_ROUTES_MAX routes.
+ */
+static int v4l2_subdev_parse_routes(struct media_device *media, const char *p,
+				    struct media_entity **entityp,
+				    struct v4l2_subdev_route *routes,
+				    unsigned int *num_routesp)
 {
 	struct media_entity *entity;
-	struct v4l2_subdev_route *routes;
 	unsigned int num_routes;
-	unsigned int i;
 	char *end;
 	int ret;
 
@@ -545,18 +548,19 @@ int v4l2_subdev_parse_setup_routes(struct media_device *media,
 
 	p++;
 
-	routes = calloc(NUM_ROUTES_MAX, sizeof(routes[0]));
-	if (!routes)
-		return -ENOMEM;
-
 	num_routes = 0;
 
 	while (*p != 0) {
 		struct v4l2_subdev_route *r = &routes[num_routes];
 
+		if (num_routes == NUM_ROUTES_MAX) {
+			media_dbg(media, "Too many routes\n");
+			return -EINVAL;
+		}
+
 		ret = v4l2_subdev_parse_setup_route(media, r, p, &end);
 		if (ret)
-			goto out;
+			return ret;
 
 		p = end;
 
@@ -572,10 +576,33 @@ int v4l2_subdev_parse_setup_routes(struct media_device *media,
 
 	if (*p != ']') {
 		media_dbg(media, "Expected ']'\n");
-		ret = -EINVAL;
-		goto out;
+		return -EINVAL;
 	}
 
+	*entityp = entity;
+	*num_routesp = num_routes;
+
+	return 0;
+}
+
+int v4l2_subdev_parse_setup_routes(struct media_device *media,
+				   enum v4l2_subdev_format_whence which,
+				   const char *p)
+{
+	struct media_entity *entity;
+	struct v4l2_subdev_route *routes;
+	unsigned int num_routes;
+	unsigned int i;
+	int ret;
+
+	routes = calloc(NUM_ROUTES_MAX, sizeof(routes[0]));
+	if (!routes)
+		return -ENOMEM;
+
+	ret = v4l2_subdev_parse_routes(media, p, &entity, routes, &num_routes);
+	if (ret)
+		goto out;
+
 	for (i = 0; i < num_routes; ++i) {
 		struct v4l2_subdev_route *r = &routes[i];
 
@@ -1156,6 +1183,694 @@ int v4l2_subdev_parse_setup_formats(struct media_device *media,
 	return *end ? -EINVAL : 0;
 }
 
+/* -----------------------------------------------------------------------------
+ * Pipeline configuration
+ *
+ * A configuration collects the links, routes and formats of a pipeline
+ * before applying any of them. Applying it compares every setting with the
+ * current state of the device and only issues the ioctls that change it:
+ * links are disabled before others are enabled, the routing of a subdev is
+ * set once, and the formats are set from the sources of the pipeline to its
+ * sinks, so that the formats propagated downstream are final.
+ */
+
+struct v4l2_subdev_config_link {
+	struct media_link *link;
+	__u32 flags;
+};
+
+struct v4l2_subdev_config_routing {
+	struct media_entity *entity;
+	struct v4l2_subdev_route *routes;
+	unsigned int num_routes;
+};
+
+struct v4l2_subdev_config_format {
+	struct media_pad *pad;
+	unsigned int stream;
+	struct v4l2_mbus_framefmt format;
+	struct v4l2_rect crop;
+	struct v4l2_rect compose;
+	struct v4l2_fract interval;
+	/* Order along the data flow, then in the configuration, see
+	 * v4l2_subdev_config_format_cmp()
+	 */
+	unsigned int rank;
+	unsigned int seq;
+};
+
+struct v4l2_subdev_config {
+	struct media_device *media;
+	enum v4l2_subdev_format_whence which;
+
+	struct v4l2_subdev_config_link *links;
+	unsigned int num_links;
+	struct v4l2_subdev_config_routing *routings;
+	unsigned int num_routings;
+	struct v4l2_subdev_config_format *formats;
+	unsigned int num_formats;
+};
+
+struct v4l2_subdev_config *
+v4l2_subdev_config_new(struct media_device *media,
+		       enum v4l2_subdev_format_whence which)
+{
+	struct v4l2_subdev_config *config;
+
+	config = calloc(1, sizeof(*config));
+	if (config == NULL)
+		return NULL;
+
+	config->media = media;
+	config->which = which;
+
+	return config;
+}
+
+void v4l2_subdev_config_free(struct v4l2_subdev_config *config)
+{
+	unsigned int i;
+
+	if (config == NULL)
+		return;
+
+	for (i = 0; i < config->num_routings; ++i)
+		free(config->routings[i].routes);
+
+	free(config->links);
+	free(config->routings);
+	free(config->formats);
+	free(config);
+}
+
+/* Later settings of a link override earlier ones. */
+static int v4l2_subdev_config_add_link(struct v4l2_subdev_config *config,
+				       struct media_link *link, __u32 flags)
+{
+	struct v4l2_subdev_config_link *links;
+	unsigned int i;
+
+	for (i = 0; i < config->num_links; ++i) {
+		if (config->links[i].link == link) {
+			config->links[i].flags = flags;
+			return 0;
+		}
+	}
+
+	links = realloc(config->links, (config->num_links + 1) * sizeof(*links));
+	if (links == NULL)
+		return -ENOMEM;
+
+	links[config->num_links].link = link;
+	links[config->num_links].flags = flags;
+	config->links = links;
+	config->num_links++;
+
+	return 0;
+}
+
+int v4l2_subdev_config_reset_links(struct v4l2_subdev_config *config)
+{
+	struct media_device *media = config->media;
+	unsigned int i, j;
+	int ret;
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		for (j = 0; j < entity->num_links; j++) {
+			struct media_link *link = &entity->links[j];
+
+			if (link->flags & MEDIA_LNK_FL_IMMUTABLE ||
+			    link->source->entity != entity)
+				continue;
+
+			ret = v4l2_subdev_config_add_link(config, link,
+					link->flags & ~MEDIA_LNK_FL_ENABLED);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+int v4l2_subdev_config_parse_links(struct v4l2_subdev_config *config,
+				   const char *p)
+{
+	struct media_device *media = config->media;
+	struct media_link *link;
+	__u32 flags;
+	char *end;
+	int ret;
+
+	for (;;) {
+		const char *start = p;
+
+		link = media_parse_link(media, p, &end);
+		if (link == NULL) {
+			media_print_streampos(media, start, end);
+			media_dbg(media, "%s: Unable to parse link\n", __func__);
+			return -EINVAL;
+		}
+
+		p = end;
+		if (*p++ != '[') {
+			media_dbg(media, "Unable to parse link flags: expected '['.\n");
+			return -EINVAL;
+		}
+
+		flags = strtoul(p, &end, 10);
+		for (p = end; isspace(*p); p++);
+		if (*p++ != ']') {
+			media_dbg(media, "Unable to parse link flags: expected ']'.\n");
+			return -EINVAL;
+		}
+
+		for (; isspace(*p); p++);
+
+		ret = v4l2_subdev_config_add_link(config, link, flags);
+		if (ret < 0)
+			return ret;
+
+		if (*p != ',')
+			break;
+		p++;
+	}
+
+	return *p ? -EINVAL : 0;
+}
+
+int v4l2_subdev_config_parse_routes(struct v4l2_subdev_config *config,
+				    const char *p)
+{
+	struct v4l2_subdev_config_routing *routing = NULL;
+	struct v4l2_subdev_route *routes;
+	struct media_entity *entity;
+	unsigned int num_routes;
+	unsigned int i;
+	int ret;
+
+	routes = calloc(NUM_ROUTES_MAX, sizeof(routes[0]));
+	if (!routes)
+		return -ENOMEM;
+
+	ret = v4l2_subdev_parse_routes(config->media, p, &entity, routes,
+				       &num_routes);
+	if (ret) {
+		free(routes);
+		return ret;
+	}
+
+	/* The routing of an entity is set as a whole, the last one wins. */
+	for (i = 0; i < config->num_routings; ++i) {
+		if (config->routings[i].entity == entity) {
+			routing = &config->routings[i];
+			free(routing->routes);
+			break;
+		}
+	}
+
+	if (routing == NULL) {
+		routing = realloc(config->routings,
+				  (config->num_routings + 1) * sizeof(*routing));
+		if (routing == NULL) {
+			free(routes);
+			return -ENOMEM;
+		}
+
+		config->routings = routing;
+		routing = &config->routings[config->num_routings++];
+		routing->entity = entity;
+	}
+
+	routing->routes = routes;
+	routing->num_routes = num_routes;
+
+	return 0;
+}
+
+/*
+ * Later settings of a pad and stream override the properties they specify,
+ * the unspecified ones keep their earlier setting.
+ */
+static int v4l2_subdev_config_add_format(struct v4l2_subdev_config *config,
+					 const struct v4l2_subdev_config_format *f)
+{
+	struct v4l2_subdev_config_format *formats;
+	struct v4l2_subdev_config_format *cur;
+	unsigned int i;
+
+	for (i = 0; i < config->num_formats; ++i) {
+		cur = &config->formats[i];
+
+		if (cur->pad != f->pad || cur->stream != f->stream)
+			continue;
+
+		if (f->format.width && f->format.height)
+			cur->format = f->format;
+		if (f->crop.left != -1 && f->crop.top != -1)
+			cur->crop = f->crop;
+		if (f->compose.left != -1 && f->compose.top != -1)
+			cur->compose = f->compose;
+		if (f->interval.numerator)
+			cur->interval = f->interval;
+
+		return 0;
+	}
+
+	formats = realloc(config->formats,
+			  (config->num_formats + 1) * sizeof(*formats));
+	if (formats == NULL)
+		return -ENOMEM;
+
+	formats[config->num_formats] = *f;
+	formats[config->num_formats].seq = config->num_formats;
+	config->formats = formats;
+	config->num_formats++;
+
+	return 0;
+}
+
+int v4l2_subdev_config_parse_formats(struct v4l2_subdev_config *config,
+				     const char *p)
+{
+	struct media_device *media = config->media;
+	char *end;
+	int ret;
+
+	do {
+		struct v4l2_subdev_config_format f = {
+			.crop = { -1, -1, -1, -1 },
+			.compose = { -1, -1, -1, -1 },
+		};
+
+		f.pad = v4l2_subdev_parse_pad_format(media, &f.stream,
+						     &f.format, &f.crop,
+						     &f.compose, &f.interval,
+						     p, &end);
+		if (f.pad == NULL) {
+			media_print_streampos(media, p, end);
+			media_dbg(media, "Unable to parse format\n");
+			return -EINVAL;
+		}
+
+		ret = v4l2_subdev_config_add_format(config, &f);
+		if (ret < 0)
+			return ret;
+
+		for (; isspace(*end); end++);
+		p = end + 1;
+	} while (*end == ',');
+
+	return *end ? -EINVAL : 0;
+}
+
+static int v4l2_subdev_config_apply_links(struct v4l2_subdev_config *config)
+{
+	unsigned int pass, i;
+	int ret;
+
+	/*
+	 * Disable links first, drivers may refuse to enable a link to a pad
+	 * that another enabled link is connected to.
+	 */
+	for (pass = 0; pass < 2; ++pass) {
+		for (i = 0; i < config->num_links; ++i) {
+			struct v4l2_subdev_config_link *l = &config->links[i];
+			__u32 enabled = l->flags & MEDIA_LNK_FL_ENABLED;
+
+			if (!enabled != !pass)
+				continue;
+
+			if ((l->link->flags & MEDIA_LNK_FL_ENABLED) == enabled)
+				continue;
+
+			media_dbg(config->media,
+				  "Setting up link %u:%u -> %u:%u [%u]\n",
+				  l->link->source->entity->info.id,
+				  l->link->source->index,
+				  l->link->sink->entity->info.id,
+				  l->link->sink->index, l->flags);
+
+			ret = media_setup_link(config->media, l->link->source,
+					       l->link->sink, l->flags);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static bool v4l2_subdev_routing_equal(const struct v4l2_subdev_route *a,
+				      unsigned int num_a,
+				      const struct v4l2_subdev_route *b,
+				      unsigned int num_b)
+{
+	unsigned int i, j;
+
+	if (num_a != num_b)
+		return false;
+
+	for (i = 0; i < num_a; ++i) {
+		for (j = 0; j < num_b; ++j) {
+			if (a[i].sink_pad == b[j].sink_pad &&
+			    a[i].sink_stream == b[j].sink_stream &&
+			    a[i].source_pad == b[j].source_pad &&
+			    a[i].source_stream == b[j].source_stream &&
+			    a[i].flags == b[j].flags)
+				break;
+		}
+
+		if (j == num_b)
+			return false;
+	}
+
+	return true;
+}
+
+static int v4l2_subdev_config_apply_routes(struct v4l2_subdev_config *config)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < config->num_routings; ++i) {
+		struct v4l2_subdev_config_routing *r = &config->routings[i];
+		struct v4l2_subdev_route *routes;
+		unsigned int num_routes;
+
+		/* Setting the routing resets the formats of the subdev. */
+		ret = v4l2_subdev_get_routing(r->entity, &routes, &num_routes,
+					      config->which);
+		if (!ret) {
+			bool equal = v4l2_subdev_routing_equal(routes, num_routes,
+							       r->routes,
+							       r->num_routes);
+
+			free(routes);
+			if (equal) {
+				media_dbg(config->media, "Routes of %s already set\n",
+					  r->entity->info.name);
+				continue;
+			}
+		}
+
+		media_dbg(config->media, "Setting up %u routes on %s\n",
+			  r->num_routes, r->entity->info.name);
+
+		ret = v4l2_subdev_set_routing(r->entity, r->routes,
+					      r->num_routes, config->which);
+		if (ret) {
+			media_dbg(config->media,
+				  "VIDIOC_SUBDEV_S_ROUTING failed: %d\n", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Rank the entities by the length of the longest path of enabled links
+ * from a source of the pipeline. Entities in loops are ranked last.
+ */
+static unsigned int *v4l2_subdev_config_rank(struct media_device *media)
+{
+	unsigned int *indegree;
+	unsigned int *queue;
+	unsigned int *rank;
+	unsigned int head = 0, tail = 0;
+	unsigned int i, j;
+
+	rank = calloc(media->entities_count + 1, sizeof(*rank));
+	indegree = calloc(media->entities_count + 1, sizeof(*indegree));
+	queue = calloc(media->entities_count + 1, sizeof(*queue));
+	if (rank == NULL || indegree == NULL || queue == NULL) {
+		free(rank);
+		rank = NULL;
+		goto done;
+	}
+
+	for (i = 0; i < media->entities_count; ++i) {
+		struct media_entity *entity = &media->entities[i];
+
+		for (j = 0; j < entity->num_links; ++j) {
+			struct media_link *link = &entity->links[j];
+
+			if (link->source->entity == entity &&
+			    link->sink->entity != entity &&
+			    link->flags & MEDIA_LNK_FL_ENABLED)
+				indegree[link->sink->entity - media->entities]++;
+		}
+	}
+
+	for (i = 0; i < media->entities_count; ++i) {
+		if (!indegree[i])
+			queue[tail++] = i;
+	}
+
+	while (head < tail) {
+		struct media_entity *entity = &media->entities[queue[head++]];
+		unsigned int r = rank[entity - media->entities];
+
+		for (j = 0; j < entity->num_links; ++j) {
+			struct media_link *link = &entity->links[j];
+			unsigned int sink = link->sink->entity - media->entities;
+
+			if (link->source->entity != entity ||
+			    link->sink->entity == entity ||
+			    !(link->flags & MEDIA_LNK_FL_ENABLED))
+				continue;
+
+			if (rank[sink] < r + 1)
+				rank[sink] = r + 1;
+			if (!--indegree[sink])
+				queue[tail++] = sink;
+		}
+	}
+
+	for (i = 0; i < media->entities_count; ++i) {
+		if (indegree[i])
+			rank[i] = media->entities_count;
+	}
+
+done:
+	free(indegree);
+	free(queue);
+	return rank;
+}
+
+/*
+ * Entities of the same rank aren't linked to each other. Within an entity,
+ * the sink pads are configured before the source pads.
+ */
+static int v4l2_subdev_config_format_cmp(const void *a, const void *b)
+{
+	const struct v4l2_subdev_config_format *fa = a;
+	const struct v4l2_subdev_config_format *fb = b;
+	bool sa = fa->pad->flags & MEDIA_PAD_FL_SOURCE;
+	bool sb = fb->pad->flags & MEDIA_PAD_FL_SOURCE;
+
+	if (fa->rank != fb->rank)
+		return fa->rank < fb->rank ? -1 : 1;
+	if (fa->pad->entity != fb->pad->entity)
+		return fa->pad->entity < fb->pad->entity ? -1 : 1;
+	if (sa != sb)
+		return sa ? 1 : -1;
+
+	return fa->seq < fb->seq ? -1 : fa->seq > fb->seq;
+}
+
+static bool v4l2_subdev_format_matches(const struct v4l2_mbus_framefmt *cur,
+				       const struct v4l2_mbus_framefmt *fmt)
+{
+	/* Zero fields are left to the driver. */
+	return cur->code == fmt->code && cur->width == fmt->width &&
+	       cur->height == fmt->height &&
+	       (!fmt->field || cur->field == fmt->field) &&
+	       (!fmt->colorspace || cur->colorspace == fmt->colorspace) &&
+	       (!fmt->xfer_func || cur->xfer_func == fmt->xfer_func) &&
+	       (!fmt->ycbcr_enc || cur->ycbcr_enc == fmt->ycbcr_enc) &&
+	       (!fmt->quantization || cur->quantization == fmt->quantization);
+}
+
+/*
+ * The update_*() functions set a property unless it is unspecified or
+ * already set. They return the current value of the property.
+ */
+static int update_format(struct media_pad *pad, unsigned int stream,
+			 struct v4l2_mbus_framefmt *format,
+			 enum v4l2_subdev_format_whence which)
+{
+	struct v4l2_mbus_framefmt cur;
+
+	if (format->width == 0 || format->height == 0)
+		return 0;
+
+	if (!v4l2_subdev_get_format(pad->entity, &cur, pad->index, stream,
+				    which) &&
+	    v4l2_subdev_format_matches(&cur, format)) {
+		media_dbg(pad->entity->media, "Format of pad %s/%u/%u already set\n",
+			  pad->entity->info.name, pad->index, stream);
+		*format = cur;
+		return 0;
+	}
+
+	return set_format(pad, stream, format, which);
+}
+
+static int update_selection(struct media_pad *pad, unsigned int stream,
+			    unsigned int target, struct v4l2_rect *rect,
+			    enum v4l2_subdev_format_whence which)
+{
+	struct v4l2_rect cur;
+
+	if (rect->left == -1 || rect->top == -1)
+		return 0;
+
+	if (!v4l2_subdev_get_selection(pad->entity, &cur, pad->index, stream,
+				       target, which) &&
+	    !memcmp(&cur, rect, sizeof(cur))) {
+		media_dbg(pad->entity->media,
+			  "Selection target %u of pad %s/%u/%u already set\n",
+			  target, pad->entity->info.name, pad->index, stream);
+		return 0;
+	}
+
+	return set_selection(pad, stream, target, rect, which);
+}
+
+static int update_frame_interval(struct media_pad *pad, unsigned int stream,
+				 struct v4l2_fract *interval,
+				 enum v4l2_subdev_format_whence which)
+{
+	struct v4l2_fract cur;
+
+	if (interval->numerator == 0)
+		return 0;
+
+	if (!v4l2_subdev_get_frame_interval(pad->entity, &cur, pad->index,
+					    stream, which) &&
+	    (__u64)cur.numerator * interval->denominator ==
+	    (__u64)interval->numerator * cur.denominator) {
+		media_dbg(pad->entity->media,
+			  "Frame interval of pad %s/%u/%u already set\n",
+			  pad->entity->info.name, pad->index, stream);
+		return 0;
+	}
+
+	return set_frame_interval(pad, stream, interval, which);
+}
+
+/* Apply a format the way v4l2_subdev_parse_setup_format() does. */
+static int v4l2_subdev_config_apply_format(struct v4l2_subdev_config *config,
+					   struct v4l2_subdev_config_format *f)
+{
+	struct media_pad *pad = f->pad;
+	struct v4l2_mbus_framefmt format = f->format;
+	unsigned int i;
+	int ret;
+
+	if (pad->flags & MEDIA_PAD_FL_SINK) {
+		ret = update_format(pad, f->stream, &format, config->which);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = update_selection(pad, f->stream, V4L2_SEL_TGT_CROP, &f->crop,
+			       config->which);
+	if (ret < 0)
+		return ret;
+
+	ret = update_selection(pad, f->stream, V4L2_SEL_TGT_COMPOSE,
+			       &f->compose, config->which);
+	if (ret < 0)
+		return ret;
+
+	if (pad->flags & MEDIA_PAD_FL_SOURCE) {
+		ret = update_format(pad, f->stream, &format, config->which);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = update_frame_interval(pad, f->stream, &f->interval, config->which);
+	if (ret < 0)
+		return ret;
+
+	if (!(pad->flags & MEDIA_PAD_FL_SOURCE))
+		return 0;
+
+	for (i = 0; i < pad->entity->num_links; ++i) {
+		struct media_link *link = &pad->entity->links[i];
+		struct v4l2_mbus_framefmt remote_format;
+
+		if (!(link->flags & MEDIA_LNK_FL_ENABLED))
+			continue;
+
+		if (link->source == pad &&
+		    link->sink->entity->info.type == MEDIA_ENT_T_V4L2_SUBDEV) {
+			remote_format = format;
+			update_format(link->sink, f->stream, &remote_format,
+				      config->which);
+
+			ret = update_frame_interval(link->sink, f->stream,
+						    &f->interval, config->which);
+			if (ret < 0 && ret != -EINVAL && ret != -ENOTTY)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int v4l2_subdev_config_apply_formats(struct v4l2_subdev_config *config)
+{
+	struct media_device *media = config->media;
+	unsigned int *rank;
+	unsigned int i;
+	int ret;
+
+	/* Rank the entities once the links are set up. */
+	rank = v4l2_subdev_config_rank(media);
+	if (rank == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < config->num_formats; ++i) {
+		struct v4l2_subdev_config_format *f = &config->formats[i];
+
+		f->rank = rank[f->pad->entity - media->entities];
+	}
+
+	free(rank);
+
+	qsort(config->formats, config->num_formats, sizeof(*config->formats),
+	      v4l2_subdev_config_format_cmp);
+
+	for (i = 0; i < config->num_formats; ++i) {
+		ret = v4l2_subdev_config_apply_format(config, &config->formats[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+int v4l2_subdev_config_apply(struct v4l2_subdev_config *config)
+{
+	int ret;
+
+	ret = v4l2_subdev_config_apply_links(config);
+	if (ret < 0)
+		return ret;
+
+	ret = v4l2_subdev_config_apply_routes(config);
+	if (ret < 0)
+		return ret;
+
+	return v4l2_subdev_config_apply_formats(config);
+}
+
 static const struct {
 	const char *name;
 	enum v4l2_mbus_pixelcode code;
@@ -27,6 +27,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -54,7 +55,8 @@ struct flag_name {
 	char *name;
 };
 
-static void print_flags(const struct flag_name *flag_names, unsigned int num_entries, __u32 flags)
+static void print_flags(FILE *f, const struct flag_name *flag_names,
+			unsigned int num_entries, __u32 flags)
 {
 	bool first = true;
 	unsigned int i;
@@ -63,39 +65,39 @@ static void print_flags(const struct flag_name *flag_names, unsigned int num_ent
 		if (!(flags & flag_names[i].flag))
 			continue;
 		if (!first)
-			printf(",");
-		printf("%s", flag_names[i].name);
+			fprintf(f, ",");
+		fprintf(f, "%s", flag_names[i].name);
 		flags &= ~flag_names[i].flag;
 		first = false;
 	}
 
 	if (flags) {
 		if (!first)
-			printf(",");
-		printf("0x%x", flags);
+			fprintf(f, ",");
+		fprintf(f, "0x%x", flags);
 	}
 }
 
-static void v4l2_subdev_print_routes(struct media_entity *entity,
+static void v4l2_subdev_print_routes(FILE *f, struct media_entity *entity,
 				     struct v4l2_subdev_route *routes,
 				     unsigned int num_routes)
 {
 	unsigned int i;
 
 	if (num_routes)
-		printf("\troutes:\n");
+		fprintf(f, "\troutes:\n");
 
 	for (i = 0; i < num_routes; i++) {
 		const struct v4l2_subdev_route *route = &routes[i];
 
-		printf("\t\t%u/%u -> %u/%u [%s]\n",
-		       route->sink_pad, route->sink_stream,
-		       route->source_pad, route->source_stream,
-		       route->flags & V4L2_SUBDEV_ROUTE_FL_ACTIVE ? "ACTIVE" : "INACTIVE");
+		fprintf(f, "\t\t%u/%u -> %u/%u [%s]\n",
+			   route->sink_pad, route->sink_stream,
+			   route->source_pad, route->source_stream,
+			   route->flags & V4L2_SUBDEV_ROUTE_FL_ACTIVE ? "ACTIVE" : "INACTIVE");
 	}
 }
 
-static void v4l2_subdev_print_format(struct media_entity *entity,
+static void v4l2_subdev_print_format(FILE *f, struct media_entity *entity,
 	unsigned int pad, unsigned int stream,
 	enum v4l2_subdev_format_whence which)
 {
@@ -113,62 +115,62 @@ static void v4l2_subdev_print_format(struct media_entity *entity,
 	if (ret != 0 && ret != -ENOTTY && ret != -EINVAL)
 		return;
 
-	printf("\t\t[stream:%u fmt:%s/%ux%u", stream,
-	       v4l2_subdev_pixelcode_to_string(format.code),
-	       format.width, format.height);
+	fprintf(f, "\t\t[stream:%u fmt:%s/%ux%u", stream,
+		   v4l2_subdev_pixelcode_to_string(format.code),
+		   format.width, format.height);
 
 	if (interval.numerator || interval.denominator)
-		printf("@%u/%u", interval.numerator, interval.denominator);
+		fprintf(f, "@%u/%u", interval.numerator, interval.denominator);
 
 	if (format.field)
-		printf(" field:%s", v4l2_subdev_field_to_string(format.field));
+		fprintf(f, " field:%s", v4l2_subdev_field_to_string(format.field));
 
 	if (format.colorspace) {
-		printf(" colorspace:%s",
-		       v4l2_subdev_colorspace_to_string(format.colorspace));
+		fprintf(f, " colorspace:%s",
+			   v4l2_subdev_colorspace_to_string(format.colorspace));
 
 		if (format.xfer_func)
-			printf(" xfer:%s",
-			       v4l2_subdev_xfer_func_to_string(format.xfer_func));
+			fprintf(f, " xfer:%s",
+				   v4l2_subdev_xfer_func_to_string(format.xfer_func));
 
 		if (format.ycbcr_enc)
-			printf(" ycbcr:%s",
-			       v4l2_subdev_ycbcr_encoding_to_string(format.ycbcr_enc));
+			fprintf(f, " ycbcr:%s",
+				   v4l2_subdev_ycbcr_encoding_to_string(format.ycbcr_enc));
 
 		if (format.quantization)
-			printf(" quantization:%s",
-			       v4l2_subdev_quantization_to_string(format.quantization));
+			fprintf(f, " quantization:%s",
+				   v4l2_subdev_quantization_to_string(format.quantization));
 	}
 
 	ret = v4l2_subdev_get_selection(entity, &rect, pad, stream,
 					V4L2_SEL_TGT_CROP_BOUNDS,
 					which);
 	if (ret == 0)
-		printf("\n\t\t crop.bounds:(%u,%u)/%ux%u", rect.left, rect.top,
-		       rect.width, rect.height);
+		fprintf(f, "\n\t\t crop.bounds:(%u,%u)/%ux%u", rect.left, rect.top,
+			   rect.width, rect.height);
 
 	ret = v4l2_subdev_get_selection(entity, &rect, pad, stream,
 					V4L2_SEL_TGT_CROP,
 					which);
 	if (ret == 0)
-		printf("\n\t\t crop:(%u,%u)/%ux%u", rect.left, rect.top,
-		       rect.width, rect.height);
+		fprintf(f, "\n\t\t crop:(%u,%u)/%ux%u", rect.left, rect.top,
+			   rect.width, rect.height);
 
 	ret = v4l2_subdev_get_selection(entity, &rect, pad, stream,
 					V4L2_SEL_TGT_COMPOSE_BOUNDS,
 					which);
 	if (ret == 0)
-		printf("\n\t\t compose.bounds:(%u,%u)/%ux%u",
-		       rect.left, rect.top, rect.width, rect.height);
+		fprintf(f, "\n\t\t compose.bounds:(%u,%u)/%ux%u",
+			   rect.left, rect.top, rect.width, rect.height);
 
 	ret = v4l2_subdev_get_selection(entity, &rect, pad, stream,
 					V4L2_SEL_TGT_COMPOSE,
 					which);
 	if (ret == 0)
-		printf("\n\t\t compose:(%u,%u)/%ux%u",
-		       rect.left, rect.top, rect.width, rect.height);
+		fprintf(f, "\n\t\t compose:(%u,%u)/%ux%u",
+			   rect.left, rect.top, rect.width, rect.height);
 
-	printf("]\n");
+	fprintf(f, "]\n");
 }
 
 static const char *v4l2_dv_type_to_string(unsigned int type)
@@ -220,10 +222,11 @@ static const struct flag_name bt_flags[] = {
 	{ V4L2_DV_FL_CAN_DETECT_REDUCED_FPS, "can-detect-reduced-fps" },
 };
 
-static void v4l2_subdev_print_dv_timings(const struct v4l2_dv_timings *timings,
+static void v4l2_subdev_print_dv_timings(FILE *f,
+					 const struct v4l2_dv_timings *timings,
 					 const char *name)
 {
-	printf("\t\t[dv.%s:%s", name, v4l2_dv_type_to_string(timings->type));
+	fprintf(f, "\t\t[dv.%s:%s", name, v4l2_dv_type_to_string(timings->type));
 
 	switch (timings->type) {
 	case V4L2_DV_BT_656_1120: {
@@ -233,26 +236,26 @@ static void v4l2_subdev_print_dv_timings(const struct v4l2_dv_timings *timings,
 		htotal = V4L2_DV_BT_FRAME_WIDTH(bt);
 		vtotal = V4L2_DV_BT_FRAME_HEIGHT(bt);
 
-		printf(" %ux%u%s%llu (%ux%u)",
-		       bt->width, bt->height, bt->interlaced ? "i" : "p",
-		       (htotal * vtotal) > 0 ? (bt->pixelclock / (htotal * vtotal)) : 0ULL,
-		       htotal, vtotal);
+		fprintf(f, " %ux%u%s%llu (%ux%u)",
+			   bt->width, bt->height, bt->interlaced ? "i" : "p",
+			   (htotal * vtotal) > 0 ? (bt->pixelclock / (htotal * vtotal)) : 0ULL,
+			   htotal, vtotal);
 
-		printf(" stds:");
-		print_flags(bt_standards, ARRAY_SIZE(bt_standards),
+		fprintf(f, " stds:");
+		print_flags(f, bt_standards, ARRAY_SIZE(bt_standards),
 			    bt->standards);
-		printf(" flags:");
-		print_flags(bt_flags, ARRAY_SIZE(bt_flags),
+		fprintf(f, " flags:");
+		print_flags(f, bt_flags, ARRAY_SIZE(bt_flags),
 			    bt->flags);
 
 		break;
 	}
 	}
 
-	printf("]\n");
+	fprintf(f, "]\n");
 }
 
-static void v4l2_subdev_print_pad_dv(struct media_entity *entity,
+static void v4l2_subdev_print_pad_dv(FILE *f, struct media_entity *entity,
 	unsigned int pad, enum v4l2_subdev_format_whence which)
 {
 	struct v4l2_dv_timings_cap caps;
@@ -263,28 +266,28 @@ static void v4l2_subdev_print_pad_dv(struct media_entity *entity,
 	if (ret != 0)
 		return;
 
-	printf("\t\t[dv.caps:%s", v4l2_dv_type_to_string(caps.type));
+	fprintf(f, "\t\t[dv.caps:%s", v4l2_dv_type_to_string(caps.type));
 
 	switch (caps.type) {
 	case V4L2_DV_BT_656_1120:
-		printf(" min:%ux%u@%llu max:%ux%u@%llu",
-		       caps.bt.min_width, caps.bt.min_height, caps.bt.min_pixelclock,
-		       caps.bt.max_width, caps.bt.max_height, caps.bt.max_pixelclock);
+		fprintf(f, " min:%ux%u@%llu max:%ux%u@%llu",
+			   caps.bt.min_width, caps.bt.min_height, caps.bt.min_pixelclock,
+			   caps.bt.max_width, caps.bt.max_height, caps.bt.max_pixelclock);
 
-		printf(" stds:");
-		print_flags(bt_standards, ARRAY_SIZE(bt_standards),
+		fprintf(f, " stds:");
+		print_flags(f, bt_standards, ARRAY_SIZE(bt_standards),
 			    caps.bt.standards);
-		printf(" caps:");
-		print_flags(bt_capabilities, ARRAY_SIZE(bt_capabilities),
+		fprintf(f, " caps:");
+		print_flags(f, bt_capabilities, ARRAY_SIZE(bt_capabilities),
 			    caps.bt.capabilities);
 
 		break;
 	}
 
-	printf("]\n");
+	fprintf(f, "]\n");
 }
 
-static void v4l2_subdev_print_subdev_dv(struct media_entity *entity)
+static void v4l2_subdev_print_subdev_dv(FILE *f, struct media_entity *entity)
 {
 	struct v4l2_dv_timings timings;
 	int ret;
@@ -292,16 +295,16 @@ static void v4l2_subdev_print_subdev_dv(struct media_entity *entity)
 	ret = v4l2_subdev_query_dv_timings(entity, &timings);
 	switch (ret) {
 	case -ENOLINK:
-		printf("\t\t[dv.query:no-link]\n");
+		fprintf(f, "\t\t[dv.query:no-link]\n");
 		break;
 	case -ENOLCK:
-		printf("\t\t[dv.query:no-lock]\n");
+		fprintf(f, "\t\t[dv.query:no-lock]\n");
 		break;
 	case -ERANGE:
-		printf("\t\t[dv.query:out-of-range]\n");
+		fprintf(f, "\t\t[dv.query:out-of-range]\n");
 		break;
 	case 0:
-		v4l2_subdev_print_dv_timings(&timings, "detect");
+		v4l2_subdev_print_dv_timings(f, &timings, "detect");
 		break;
 	default:
 		return;
@@ -309,7 +312,7 @@ static void v4l2_subdev_print_subdev_dv(struct media_entity *entity)
 
 	ret = v4l2_subdev_get_dv_timings(entity, &timings);
 	if (ret == 0)
-		v4l2_subdev_print_dv_timings(&timings, "current");
+		v4l2_subdev_print_dv_timings(f, &timings, "current");
 }
 
 static const char *media_entity_type_to_string(unsigned type)
@@ -456,7 +459,7 @@ static void media_print_topology_dot(struct media_device *media)
 	printf("}\n");
 }
 
-static void media_print_pad_text(struct media_entity *entity,
+static void media_print_pad_text(FILE *f, struct media_entity *entity,
 				 const struct media_pad *pad,
 				 struct v4l2_subdev_route *routes,
 				 unsigned int num_routes,
@@ -469,7 +472,7 @@ static void media_print_pad_text(struct media_entity *entity,
 		return;
 
 	if (!routes) {
-		v4l2_subdev_print_format(entity, pad->index, 0, which);
+		v4l2_subdev_print_format(f, entity, pad->index, 0, which);
 	} else {
 		for (i = 0; i < num_routes; ++i) {
 			const struct v4l2_subdev_route *route = &routes[i];
@@ -493,20 +496,21 @@ static void media_print_pad_text(struct media_entity *entity,
 			if (printed_streams_mask & (1ULL << stream))
 				continue;
 
-			v4l2_subdev_print_format(entity, pad->index, stream,
+			v4l2_subdev_print_format(f, entity, pad->index, stream,
 						 which);
 
 			printed_streams_mask |= (1ULL << stream);
 		}
 	}
 
-	v4l2_subdev_print_pad_dv(entity, pad->index, which);
+	v4l2_subdev_print_pad_dv(f, entity, pad->index, which);
 
 	if (pad->flags & MEDIA_PAD_FL_SOURCE)
-		v4l2_subdev_print_subdev_dv(entity);
+		v4l2_subdev_print_subdev_dv(f, entity);
 }
 
-static void media_print_topology_text_entity(struct media_device *media,
+static void media_print_topology_text_entity(FILE *f,
+					     struct media_device *media,
 					     struct media_entity *entity,
 					     enum v4l2_subdev_format_whence which)
 {
@@ -531,33 +535,33 @@ static void media_print_topology_text_entity(struct media_device *media,
 	if (media_entity_type(entity) == MEDIA_ENT_T_V4L2_SUBDEV)
 		v4l2_subdev_get_routing(entity, &routes, &num_routes, which);
 
-	padding = printf("- entity %u: ", info->id);
-	printf("%s (%u pad%s, %u link%s", info->name,
-	       info->pads, info->pads > 1 ? "s" : "",
-	       num_links, num_links > 1 ? "s" : "");
+	padding = fprintf(f, "- entity %u: ", info->id);
+	fprintf(f, "%s (%u pad%s, %u link%s", info->name,
+		   info->pads, info->pads > 1 ? "s" : "",
+		   num_links, num_links > 1 ? "s" : "");
 
 	if (media_entity_type(entity) == MEDIA_ENT_T_V4L2_SUBDEV)
-		printf(", %u route%s", num_routes, num_routes != 1 ? "s" : "");
+		fprintf(f, ", %u route%s", num_routes, num_routes != 1 ? "s" : "");
 
-	printf(")\n");
+	fprintf(f, ")\n");
 
-	printf("%*ctype %s subtype %s flags %x\n", padding, ' ',
-	       media_entity_type_to_string(info->type),
-	       media_entity_subtype_to_string(info->type),
-	       info->flags);
+	fprintf(f, "%*ctype %s subtype %s flags %x\n", padding, ' ',
+		   media_entity_type_to_string(info->type),
+		   media_entity_subtype_to_string(info->type),
+		   info->flags);
 	if (devname)
-		printf("%*cdevice node name %s\n", padding, ' ', devname);
+		fprintf(f, "%*cdevice node name %s\n", padding, ' ', devname);
 
 	if (media_entity_type(entity) == MEDIA_ENT_T_V4L2_SUBDEV)
-		v4l2_subdev_print_routes(entity, routes, num_routes);
+		v4l2_subdev_print_routes(f, entity, routes, num_routes);
 
 	for (j = 0; j < info->pads; j++) {
 		const struct media_pad *pad = media_entity_get_pad(entity, j);
 
-		printf("\tpad%u: ", j);
-		print_flags(pad_flags, ARRAY_SIZE(pad_flags), pad->flags);
-		printf("\n");
-		media_print_pad_text(entity, pad, routes, num_routes, which);
+		fprintf(f, "\tpad%u: ", j);
+		print_flags(f, pad_flags, ARRAY_SIZE(pad_flags), pad->flags);
+		fprintf(f, "\n");
+		media_print_pad_text(f, entity, pad, routes, num_routes, which);
 
 		for (k = 0; k < num_links; k++) {
 			const struct media_link *link = media_entity_get_link(entity, k);
@@ -565,37 +569,196 @@ static void media_print_topology_text_entity(struct media_device *media,
 			const struct media_pad *sink = link->sink;
 
 			if (source->entity == entity && source->index == j)
-				printf("\t\t-> \"%s\":%u [",
-				       media_entity_get_info(sink->entity)->name,
-				       sink->index);
+				fprintf(f, "\t\t-> \"%s\":%u [",
+					   media_entity_get_info(sink->entity)->name,
+					   sink->index);
 			else if (sink->entity == entity && sink->index == j)
-				printf("\t\t<- \"%s\":%u [",
-				       media_entity_get_info(source->entity)->name,
-				       source->index);
+				fprintf(f, "\t\t<- \"%s\":%u [",
+					   media_entity_get_info(source->entity)->name,
+					   source->index);
 			else
 				continue;
 
-			print_flags(link_flags, ARRAY_SIZE(link_flags), link->flags);
+			print_flags(f, link_flags, ARRAY_SIZE(link_flags), link->flags);
 
-			printf("]\n");
+			fprintf(f, "]\n");
 		}
 	}
-	printf("\n");
+	fprintf(f, "\n");
 
 	free(routes);
 }
 
+/*
+ * Querying the subdevs of a large pipeline one after the other is slow when
+ * they sit behind I2C buses. The entities can be printed concurrently to
+ * memory buffers, which are then output in order.
+ */
+struct print_job {
+	char *buf;
+	size_t size;
+};
+
+struct print_jobs {
+	struct media_device *media;
+	enum v4l2_subdev_format_whence which;
+	pthread_mutex_t lock;
+	unsigned int next;
+	unsigned int count;
+	struct print_job *jobs;
+};
+
+static void *media_print_worker(void *arg)
+{
+	struct print_jobs *pj = arg;
+
+	for (;;) {
+		struct print_job *job;
+		unsigned int i;
+		FILE *f;
+
+		pthread_mutex_lock(&pj->lock);
+		i = pj->next++;
+		pthread_mutex_unlock(&pj->lock);
+
+		if (i >= pj->count)
+			break;
+
+		/* Entities without a buffer are printed by the main thread. */
+		job = &pj->jobs[i];
+		f = open_memstream(&job->buf, &job->size);
+		if (f == NULL)
+			continue;
+
+		media_print_topology_text_entity(f, pj->media,
+						 media_get_entity(pj->media, i),
+						 pj->which);
+		fclose(f);
+	}
+
+	return NULL;
+}
+
 static void media_print_topology_text(struct media_device *media,
-				      enum v4l2_subdev_format_whence which)
+				      enum v4l2_subdev_format_whence which,
+				      unsigned int jobs)
 {
 	unsigned int nents = media_get_entities_count(media);
+	struct print_jobs pj = {
+		.media = media,
+		.which = which,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.count = nents,
+	};
+	pthread_t *threads = NULL;
+	unsigned int nthreads = 0;
 	unsigned int i;
 
 	printf("Device topology\n");
 
-	for (i = 0; i < nents; ++i)
-		media_print_topology_text_entity(
-			media, media_get_entity(media, i), which);
+	if (jobs > 1 && nents > 1) {
+		pj.jobs = calloc(nents, sizeof(*pj.jobs));
+		threads = calloc(jobs - 1, sizeof(*threads));
+	}
+
+	if (pj.jobs == NULL || threads == NULL) {
+		for (i = 0; i < nents; ++i)
+			media_print_topology_text_entity(stdout,
+				media, media_get_entity(media, i), which);
+		goto done;
+	}
+
+	/* Open all subdevs up front, so that the workers only query them. */
+	for (i = 0; i < nents; ++i) {
+		struct media_entity *entity = media_get_entity(media, i);
+
+		if (media_entity_type(entity) == MEDIA_ENT_T_V4L2_SUBDEV)
+			v4l2_subdev_open(entity);
+	}
+
+	for (; nthreads < jobs - 1 && nthreads < nents - 1; ++nthreads) {
+		if (pthread_create(&threads[nthreads], NULL, media_print_worker, &pj))
+			break;
+	}
+
+	media_print_worker(&pj);
+
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < nents; ++i) {
+		if (pj.jobs[i].buf)
+			fwrite(pj.jobs[i].buf, 1, pj.jobs[i].size, stdout);
+		else
+			media_print_topology_text_entity(stdout,
+				media, media_get_entity(media, i), which);
+		free(pj.jobs[i].buf);
+	}
+
+done:
+	free(threads);
+	free(pj.jobs);
+}
+
+/*
+ * Apply the links, routes and formats as one configuration, only changing
+ * what differs from the current state of the device.
+ */
+static int setup_pipeline_minimal(struct media_device *media)
+{
+	struct v4l2_subdev_config *config;
+	int ret = 0;
+
+	config = v4l2_subdev_config_new(media, media_opts.which);
+	if (config == NULL) {
+		printf("Unable to allocate the configuration\n");
+		return -ENOMEM;
+	}
+
+	if (media_opts.reset) {
+		ret = v4l2_subdev_config_reset_links(config);
+		if (ret) {
+			printf("Unable to reset links: %s (%d)\n",
+			       strerror(-ret), -ret);
+			goto out;
+		}
+	}
+
+	if (media_opts.links) {
+		ret = v4l2_subdev_config_parse_links(config, media_opts.links);
+		if (ret) {
+			printf("Unable to parse link: %s (%d)\n",
+			       strerror(-ret), -ret);
+			goto out;
+		}
+	}
+
+	if (media_opts.routes) {
+		ret = v4l2_subdev_config_parse_routes(config, media_opts.routes);
+		if (ret) {
+			printf("Unable to parse routes: %s (%d)\n",
+			       strerror(-ret), -ret);
+			goto out;
+		}
+	}
+
+	if (media_opts.formats) {
+		ret = v4l2_subdev_config_parse_formats(config, media_opts.formats);
+		if (ret) {
+			printf("Unable to parse formats: %s (%d)\n",
+			       strerror(-ret), -ret);
+			goto out;
+		}
+	}
+
+	ret = v4l2_subdev_config_apply(config);
+	if (ret)
+		printf("Unable to apply the configuration: %s (%d)\n",
+		       strerror(-ret), -ret);
+
+out:
+	v4l2_subdev_config_free(config);
+	return ret;
 }
 
 int main(int argc, char **argv)
@@ -617,6 +780,12 @@ int main(int argc, char **argv)
 		media_debug_set_handler(media,
 			(void (*)(void *, ...))fprintf, stdout);
 
+	if (media_opts.cache_dir &&
+	    media_device_set_cache_dir(media, media_opts.cache_dir) < 0) {
+		printf("Failed to set the cache directory\n");
+		goto out;
+	}
+
 	/* Enumerate entities, pads and links. */
 	ret = media_device_enumerate(media);
 	if (ret < 0) {
@@ -666,8 +835,8 @@ int main(int argc, char **argv)
 			goto out;
 		}
 
-		v4l2_subdev_print_format(pad->entity, pad->index, stream,
-					 media_opts.which);
+		v4l2_subdev_print_format(stdout, pad->entity, pad->index,
+					 stream, media_opts.which);
 	}
 
 	if (media_opts.get_dv_pad) {
@@ -679,7 +848,7 @@ int main(int argc, char **argv)
 			goto out;
 		}
 
-		v4l2_subdev_print_subdev_dv(pad->entity);
+		v4l2_subdev_print_subdev_dv(stdout, pad->entity);
 	}
 
 	if (media_opts.dv_pad) {
@@ -709,10 +878,11 @@ int main(int argc, char **argv)
 		media_print_topology_dot(media);
 	} else if (media_opts.print) {
 		if (entity)
-			media_print_topology_text_entity(media, entity,
+			media_print_topology_text_entity(stdout, media, entity,
 							 media_opts.which);
 		else
-			media_print_topology_text(media, media_opts.which);
+			media_print_topology_text(media, media_opts.which,
+						  media_opts.jobs);
 	} else if (entity) {
 		const char *devname;
 
@@ -721,7 +891,13 @@ int main(int argc, char **argv)
 			printf("%s\n", devname);
 	}
 
-	if (media_opts.reset) {
+	if (media_opts.minimal) {
+		ret = setup_pipeline_minimal(media);
+		if (ret)
+			goto out;
+	}
+
+	if (media_opts.reset && !media_opts.minimal) {
 		if (media_opts.verbose)
 			printf("Resetting all links to inactive\n");
 		ret = media_reset_links(media);
@@ -732,7 +908,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (media_opts.links) {
+	if (media_opts.links && !media_opts.minimal) {
 		ret = media_parse_setup_links(media, media_opts.links);
 		if (ret) {
 			printf("Unable to parse link: %s (%d)\n",
@@ -741,7 +917,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (media_opts.routes) {
+	if (media_opts.routes && !media_opts.minimal) {
 		ret = v4l2_subdev_parse_setup_routes(media, media_opts.which,
 						     media_opts.routes);
 		if (ret) {
@@ -751,7 +927,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (media_opts.formats) {
+	if (media_opts.formats && !media_opts.minimal) {
 		ret = v4l2_subdev_parse_setup_formats(media, media_opts.which,
 						      media_opts.formats);
 		if (ret) {
@@ -43,11 +43,23 @@ struct media_device {
 	int fd;
 	int refcount;
 	char *devnode;
+	char *cache_dir;
 
 	struct media_device_info info;
 	struct media_entity *entities;
 	unsigned int entities_count;
 
+	/*
+	 * Hash tables of entity indexes plus one by id and by name, built
+	 * for entities_count entities, see media_index_update().
+	 */
+	struct {
+		unsigned int *by_id;
+		unsigned int *by_name;
+		unsigned int size;
+		unsigned int count;
+	} index;
+
 	void (*debug_handler)(void *, ...);
 	void *debug_priv;
 
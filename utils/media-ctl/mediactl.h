@@ -146,6 +146,25 @@ void media_debug_set_handler(
 	struct media_device *media, void (*debug_handler)(void *, ...),
 	void *debug_priv);
 
+/**
+ * @brief Cache the enumerated entities in a directory
+ * @param media - device instance.
+ * @param dir - cache directory, or NULL to disable the cache.
+ *
+ * When a cache directory is set, media_device_enumerate() stores the entities
+ * and their device node names in a file named after the media device in that
+ * directory. As long as the topology version reported by the kernel doesn't
+ * change, later enumerations restore them from the file instead of querying
+ * the entities and looking up their device nodes again. Pads and links are
+ * always enumerated, as the link flags change without the topology version.
+ *
+ * The cache requires MEDIA_IOC_G_TOPOLOGY (Linux 4.19 and newer), it is
+ * ignored otherwise.
+ *
+ * @return Zero on success or -ENOMEM if memory cannot be allocated.
+ */
+int media_device_set_cache_dir(struct media_device *media, const char *dir);
+
 /**
  * @brief Enumerate the device topology
  * @param media - device instance.
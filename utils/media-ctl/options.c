@@ -41,6 +41,7 @@
 struct media_options media_opts = {
 	.devname = MEDIA_DEVNAME_DEFAULT,
 	.which = V4L2_SUBDEV_FORMAT_ACTIVE,
+	.jobs = 1,
 };
 
 static void print_version()
@@ -55,6 +56,7 @@ static void usage(const char *argv0)
 	unsigned int i;
 
 	printf("%s [options]\n", argv0);
+	printf("    --cache-dir dir	Cache the entities and their device nodes in <dir>\n");
 	printf("-d, --device dev	Media device name (default: %s)\n", MEDIA_DEVNAME_DEFAULT);
 	printf("			If <dev> starts with a digit, then /dev/media<dev> is used.\n");
 	printf("			If <dev> doesn't exist, then find a media device that\n");
@@ -67,8 +69,12 @@ static void usage(const char *argv0)
 	printf("-R, --set-routes routes Configure routes on a given subdev entity\n");
 	printf("-h, --help		Show verbose help and exit\n");
 	printf("-i, --interactive	Modify links interactively\n");
+	printf("    --jobs n		Query the subdevs with <n> threads when printing the\n");
+	printf("			device topology (default: 1)\n");
 	printf("-l, --links links	Comma-separated list of link descriptors to setup\n");
 	printf("    --known-mbus-fmts	List known media bus formats and their numeric values\n");
+	printf("    --minimal		Only change the links, routes and formats that differ\n");
+	printf("			from the current configuration, formats in data flow order\n");
 	printf("-p, --print-topology	Print the device topology. If an entity\n");
 	printf("			is specified through the -e option, print\n");
 	printf("			information for that entity only.\n");
@@ -152,8 +158,12 @@ static void usage(const char *argv0)
 #define OPT_LIST_KNOWN_MBUS_FMTS	259
 #define OPT_GET_DV			260
 #define OPT_VERSION			261
+#define OPT_CACHE_DIR			262
+#define OPT_MINIMAL			263
+#define OPT_JOBS			264
 
 static struct option opts[] = {
+	{"cache-dir", 1, 0, OPT_CACHE_DIR},
 	{"device", 1, 0, 'd'},
 	{"entity", 1, 0, 'e'},
 	{"set-format", 1, 0, 'f'},
@@ -165,8 +175,10 @@ static struct option opts[] = {
 	{"set-routes", 1, 0, 'R'},
 	{"help", 0, 0, 'h'},
 	{"interactive", 0, 0, 'i'},
+	{"jobs", 1, 0, OPT_JOBS},
 	{"links", 1, 0, 'l'},
 	{"known-mbus-fmts", 0, 0, OPT_LIST_KNOWN_MBUS_FMTS},
+	{"minimal", 0, 0, OPT_MINIMAL},
 	{"print-dot", 0, 0, OPT_PRINT_DOT},
 	{"print-topology", 0, 0, 'p'},
 	{"reset", 0, 0, 'r'},
@@ -334,6 +346,25 @@ int parse_cmdline(int argc, char **argv)
 			print_version();
 			exit(0);
 
+		case OPT_CACHE_DIR:
+			media_opts.cache_dir = optarg;
+			break;
+
+		case OPT_MINIMAL:
+			media_opts.minimal = 1;
+			break;
+
+		case OPT_JOBS: {
+			char *end;
+
+			media_opts.jobs = strtoul(optarg, &end, 10);
+			if (*end || !media_opts.jobs) {
+				printf("Invalid number of jobs '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		}
+
 		default:
 			printf("Invalid option -%c\n", opt);
 			printf("Run %s -h for help.\n", argv[0]);
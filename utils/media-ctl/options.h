@@ -29,7 +29,8 @@ struct media_options
 		     print:1,
 		     print_dot:1,
 		     reset:1,
-		     verbose:1;
+		     verbose:1,
+		     minimal:1;
 	const char *entity;
 	const char *formats;
 	const char *links;
@@ -37,6 +38,8 @@ struct media_options
 	const char *get_dv_pad;
 	const char *dv_pad;
 	const char *routes;
+	const char *cache_dir;
+	unsigned int jobs;
 	enum v4l2_subdev_format_whence which;
 };
 
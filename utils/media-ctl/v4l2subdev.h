@@ -26,6 +26,7 @@
 
 struct media_device;
 struct media_entity;
+struct v4l2_subdev_config;
 
 /**
  * @brief Open a sub-device.
@@ -324,6 +325,100 @@ int v4l2_subdev_parse_setup_routes(struct media_device *media,
 				   enum v4l2_subdev_format_whence which,
 				   const char *p);
 
+/**
+ * @brief Create a pipeline configuration.
+ * @param media - media device.
+ * @param which - identifier of the routes and formats to set.
+ *
+ * A pipeline configuration collects links, routes and formats, which are
+ * then applied together with v4l2_subdev_config_apply(). Nothing is applied
+ * to the device before the whole configuration has been parsed.
+ *
+ * @return A pointer to the new configuration, or NULL if memory cannot be
+ * allocated.
+ */
+struct v4l2_subdev_config *
+v4l2_subdev_config_new(struct media_device *media,
+		       enum v4l2_subdev_format_whence which);
+
+/**
+ * @brief Free a pipeline configuration.
+ * @param config - pipeline configuration, or NULL.
+ */
+void v4l2_subdev_config_free(struct v4l2_subdev_config *config);
+
+/**
+ * @brief Disable all links in a pipeline configuration.
+ * @param config - pipeline configuration.
+ *
+ * Add all links of the media device but the immutable ones to @a config as
+ * disabled, as media_reset_links() does. Links parsed afterwards override
+ * this.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_config_reset_links(struct v4l2_subdev_config *config);
+
+/**
+ * @brief Parse links into a pipeline configuration.
+ * @param config - pipeline configuration.
+ * @param p - input string
+ *
+ * Parse the comma-separated list of links @a p, in the syntax of
+ * media_parse_setup_links(), and add the links to @a config. A link that
+ * is added twice keeps the last flags.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_config_parse_links(struct v4l2_subdev_config *config,
+				   const char *p);
+
+/**
+ * @brief Parse routes into a pipeline configuration.
+ * @param config - pipeline configuration.
+ * @param p - input string
+ *
+ * Parse the routes of an entity @a p, in the syntax of
+ * v4l2_subdev_parse_setup_routes(), and add them to @a config. They
+ * replace the routes of the entity added earlier.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_config_parse_routes(struct v4l2_subdev_config *config,
+				    const char *p);
+
+/**
+ * @brief Parse formats into a pipeline configuration.
+ * @param config - pipeline configuration.
+ * @param p - input string
+ *
+ * Parse the comma-separated list of pad formats @a p, in the syntax of
+ * v4l2_subdev_parse_setup_formats(), and add them to @a config. Properties
+ * of a pad and stream override the ones added earlier.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_config_parse_formats(struct v4l2_subdev_config *config,
+				     const char *p);
+
+/**
+ * @brief Apply a pipeline configuration.
+ * @param config - pipeline configuration.
+ *
+ * Apply the links, then the routes, then the formats of @a config. Every
+ * setting is compared with the current state of the device first, and only
+ * set if it differs. Links are disabled before others are enabled, and the
+ * formats are set from the sources of the pipeline to its sinks, the sink
+ * pads of an entity before its source pads. As with
+ * v4l2_subdev_parse_setup_formats(), the format of a source pad is also
+ * propagated to the subdev sink pads it is linked to.
+ *
+ * The device is left partially configured if an error occurs.
+ *
+ * @return 0 on success, or a negative error code on failure.
+ */
+int v4l2_subdev_config_apply(struct v4l2_subdev_config *config);
+
 /**
  * @brief Convert media bus pixel code to string.
  * @param code - input string
@@ -56,12 +56,94 @@ struct final_params {
     int rate;
     int latency;
     int channels;
+    int p_mmap;
+    int c_mmap;
 };
 
+/*
+ * The playback rate is adjusted by at most this fraction to follow the
+ * drift between the capture and playback clocks. 0.5% is not audible as
+ * a pitch change.
+ */
+#define MAX_DRIFT_CORRECTION 0.005
+
+/*
+ * Linear interpolating resampler that keeps the playback delay at the
+ * target latency: the capture and playback devices run from different
+ * clocks, so without correction the delay slowly grows until samples are
+ * dropped, or shrinks until the playback underruns.
+ */
+struct drift_resampler {
+    int channels;
+    int target;		/* Wanted playback delay in frames */
+    double filtered;	/* Low-pass filtered delay error in frames */
+    double ratio;	/* Output frames per input frame */
+    double pos;		/* Position of the next output frame in the input */
+    short last[2];	/* Last input frame of the previous chunk */
+};
+
+static void drift_resampler_init(struct drift_resampler *rs, int channels, int target)
+{
+    memset(rs, 0, sizeof(*rs));
+    rs->channels = channels;
+    rs->target = target;
+    rs->ratio = 1.0;
+}
+
+/*
+ * Update the ratio from the measured playback delay. This is a
+ * proportional controller with a time constant of about two seconds,
+ * reacting to a low-pass filtered delay to ignore the period jitter.
+ */
+static void drift_resampler_update(struct drift_resampler *rs, snd_pcm_sframes_t delay,
+				   int rate)
+{
+    double ratio;
+
+    rs->filtered += (delay - rs->target - rs->filtered) / 16.0;
+    ratio = 1.0 - 0.5 * rs->filtered / rate;
+    if (ratio < 1.0 - MAX_DRIFT_CORRECTION)
+	ratio = 1.0 - MAX_DRIFT_CORRECTION;
+    if (ratio > 1.0 + MAX_DRIFT_CORRECTION)
+	ratio = 1.0 + MAX_DRIFT_CORRECTION;
+    rs->ratio = ratio;
+}
+
+/* Resample len frames from in to out, returns the number of output frames */
+static long drift_resample(struct drift_resampler *rs, const short *in, long len, short *out)
+{
+    double step = 1.0 / rs->ratio;
+    long n = 0;
+    int ch;
+
+    if (len <= 0)
+	return 0;
+
+    /* Frame 0 is the last frame of the previous chunk, frame i is in[i - 1] */
+    while (rs->pos < len) {
+	long i = (long)rs->pos;
+	double frac = rs->pos - i;
+
+	for (ch = 0; ch < rs->channels; ch++) {
+	    int s0 = i ? in[(i - 1) * rs->channels + ch] : rs->last[ch];
+	    int s1 = in[i * rs->channels + ch];
+
+	    out[n * rs->channels + ch] = (short)lrint(s0 + (s1 - s0) * frac);
+	}
+	n++;
+	rs->pos += step;
+    }
+    rs->pos -= len;
+    for (ch = 0; ch < rs->channels; ch++)
+	rs->last[ch] = in[(len - 1) * rs->channels + ch];
+    return n;
+}
+
 static int setparams_stream(snd_pcm_t *handle,
 			    snd_pcm_hw_params_t *params,
 			    snd_pcm_format_t format,
 			    int *channels,
+			    int *use_mmap,
 			    const char *id)
 {
     int err;
@@ -74,8 +156,15 @@ static int setparams_stream(snd_pcm_t *handle,
 	return err;
     }
 
+    /* Prefer mmap access, which saves a copy through the kernel */
+    *use_mmap = 1;
     err = snd_pcm_hw_params_set_access(handle, params,
-				       SND_PCM_ACCESS_RW_INTERLEAVED);
+				       SND_PCM_ACCESS_MMAP_INTERLEAVED);
+    if (err < 0) {
+	*use_mmap = 0;
+	err = snd_pcm_hw_params_set_access(handle, params,
+					   SND_PCM_ACCESS_RW_INTERLEAVED);
+    }
     if (err < 0) {
 	fprintf(error_fp, "alsa: Access type not available for %s: %s\n", id,
 		snd_strerror(err));
@@ -266,10 +355,12 @@ static int setparams(snd_pcm_t *phandle, snd_pcm_t *chandle,
     snd_pcm_sw_params_alloca(&p_swparams);
     snd_pcm_sw_params_alloca(&c_swparams);
 
-    if (setparams_stream(chandle, c_hwparams, format, &channels, "capture"))
+    if (setparams_stream(chandle, c_hwparams, format, &channels,
+			 &negotiated->c_mmap, "capture"))
 	return 1;
 
-    if (setparams_stream(phandle, p_hwparams, format, &channels, "playback"))
+    if (setparams_stream(phandle, p_hwparams, format, &channels,
+			 &negotiated->p_mmap, "playback"))
 	return 1;
 
     if (allow_resample) {
@@ -425,12 +516,12 @@ static int setparams(snd_pcm_t *phandle, snd_pcm_t *chandle,
 }
 
 /* Read up to len frames */
-static snd_pcm_sframes_t readbuf(snd_pcm_t *handle, char *buf, long len)
+static snd_pcm_sframes_t readbuf(snd_pcm_t *handle, char *buf, long len, int use_mmap)
 {
     snd_pcm_sframes_t r;
     snd_pcm_uframes_t frames;
     snd_pcm_htimestamp(handle, &frames, &timestamp);
-    r = snd_pcm_readi(handle, buf, len);
+    r = use_mmap ? snd_pcm_mmap_readi(handle, buf, len) : snd_pcm_readi(handle, buf, len);
     if (r < 0 && !(r == -EAGAIN || r == -ENODEV)) {
 	r = snd_pcm_recover(handle, r, 0);
 	if (r < 0)
@@ -440,12 +531,13 @@ static snd_pcm_sframes_t readbuf(snd_pcm_t *handle, char *buf, long len)
 }
 
 /* Write len frames (note not up to len, but all of len!) */
-static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len)
+static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len,
+				  int frame_size, int use_mmap)
 {
     snd_pcm_sframes_t r;
 
     while (!stop_alsa) {
-	r = snd_pcm_writei(handle, buf, len);
+	r = use_mmap ? snd_pcm_mmap_writei(handle, buf, len) : snd_pcm_writei(handle, buf, len);
 	if (r == len)
 	    return 0;
 	if (r < 0) {
@@ -456,7 +548,7 @@ static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len)
 		return r;
 	    }
 	}
-	buf += r * 4;
+	buf += r * frame_size;
 	len -= r;
 	snd_pcm_wait(handle, 100);
     }
@@ -466,10 +558,13 @@ static snd_pcm_sframes_t writebuf(snd_pcm_t *handle, char *buf, long len)
 static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 {
     snd_pcm_t *phandle, *chandle;
-    char *buffer;
+    char *buffer, *resampled;
     int err;
     ssize_t r;
     struct final_params negotiated;
+    struct drift_resampler rs;
+    snd_pcm_sframes_t delay;
+    int frame_size;
     snd_pcm_format_t format = SND_PCM_FORMAT_S16_LE;
     char pdevice_new[32];
 
@@ -523,14 +618,19 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 	return 1;
     }
 
-    buffer = malloc((negotiated.bufsize * snd_pcm_format_width(format) / 8)
-		    * negotiated.channels);
-    if (buffer == NULL) {
+    frame_size = snd_pcm_format_width(format) / 8 * negotiated.channels;
+    buffer = malloc(negotiated.bufsize * frame_size);
+    /* Room for the frames added by the drift correction */
+    resampled = malloc((negotiated.bufsize * (1 + MAX_DRIFT_CORRECTION) + 2) * frame_size);
+    if (buffer == NULL || resampled == NULL) {
 	fprintf(error_fp, "alsa: Failed allocating buffer for audio\n");
+	free(buffer);
+	free(resampled);
 	snd_pcm_close(phandle);
 	snd_pcm_close(chandle);
 	return 0;
     }
+    drift_resampler_init(&rs, negotiated.channels, negotiated.latency);
 
     if (verbose)
         fprintf(error_fp,
@@ -540,11 +640,21 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 
     while (!stop_alsa) {
 	/* We start with a read and not a wait to auto(re)start the capture */
-	r = readbuf(chandle, buffer, negotiated.bufsize);
+	r = readbuf(chandle, buffer, negotiated.bufsize, negotiated.c_mmap);
 	if (r == 0)   /* Succesfully recovered from an overrun? */
 	    continue; /* Force restart of capture stream */
-	if (r > 0)
-	    writebuf(phandle, buffer, r);
+	if (r > 0) {
+	    r = drift_resample(&rs, (short *)buffer, r, (short *)resampled);
+	    writebuf(phandle, resampled, r, frame_size, negotiated.p_mmap);
+	    /* Only a running playback has a meaningful delay */
+	    if (snd_pcm_state(phandle) == SND_PCM_STATE_RUNNING &&
+		snd_pcm_delay(phandle, &delay) == 0) {
+		drift_resampler_update(&rs, delay, negotiated.rate);
+		if (verbose > 1)
+		    fprintf(error_fp, "alsa: delay %ld frames, ratio %.5f\n",
+			    (long)delay, rs.ratio);
+	    }
+	}
 	/* use poll to wait for next event */
 	while (!stop_alsa && !snd_pcm_wait(chandle, 50))
 	    ;
@@ -559,6 +669,8 @@ static int alsa_stream(const char *pdevice, const char *cdevice, int latency)
 
     snd_pcm_close(phandle);
     snd_pcm_close(chandle);
+    free(buffer);
+    free(resampled);
 
     return 0;
 }
@@ -0,0 +1,220 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <errno.h>
+#include <poll.h>
+
+#include <QMutexLocker>
+
+#include <libv4lconvert.h>
+
+#include "capture-thread.h"
+#include "alsa_stream.h"
+
+CaptureThread::CaptureThread(ApplicationWindow *win) :
+	m_win(win),
+	m_stop(false),
+	m_convert(true),
+	m_frame(0),
+	m_back(0),
+	m_pending(1),
+	m_front(2),
+	m_havePending(false)
+{
+	unsigned num_planes = m_win->m_queue.g_num_planes();
+
+#ifdef HAVE_ALSA
+	m_totalAudioLatency.tv_sec = 0;
+	m_totalAudioLatency.tv_usec = 0;
+#endif
+	memset(m_frames, 0, sizeof(m_frames));
+	for (unsigned i = 0; i < CAP_FRAMES; i++) {
+		for (unsigned p = 0; p < 3 && p < num_planes; p++) {
+			unsigned size = m_win->m_queue.g_length(p);
+
+			if (p == 0 && m_win->m_mustConvert &&
+			    size < m_win->m_capDestFormat.fmt.pix.sizeimage)
+				size = m_win->m_capDestFormat.fmt.pix.sizeimage;
+			m_frames[i].size[p] = size;
+			m_frames[i].data[p] = new unsigned char[size];
+		}
+	}
+}
+
+CaptureThread::~CaptureThread()
+{
+	for (unsigned i = 0; i < CAP_FRAMES; i++)
+		for (unsigned p = 0; p < 3; p++)
+			delete [] m_frames[i].data[p];
+}
+
+// The thread never waits for the GUI, so it stops within one poll timeout
+void CaptureThread::stop()
+{
+	m_stop = true;
+	wait();
+}
+
+// Returns the newest captured frame, or NULL if there is no new frame
+const CapFrame *CaptureThread::takeFrame()
+{
+	QMutexLocker locker(&m_lock);
+
+	if (!m_havePending)
+		return NULL;
+	std::swap(m_front, m_pending);
+	m_havePending = false;
+	return &m_frames[m_front];
+}
+
+void CaptureThread::publishFrame()
+{
+	QMutexLocker locker(&m_lock);
+	bool notify = !m_havePending;
+
+	std::swap(m_back, m_pending);
+	m_havePending = true;
+	locker.unlock();
+
+	// The GUI presents the newest frame published before it gets to run
+	if (notify)
+		QMetaObject::invokeMethod(m_win, "presentFrame", Qt::QueuedConnection);
+}
+
+void CaptureThread::fail(const QString &error)
+{
+	m_error = error;
+	QMetaObject::invokeMethod(m_win, "capThreadError", Qt::QueuedConnection);
+}
+
+void CaptureThread::run()
+{
+	while (!m_stop) {
+		struct pollfd pfd = { m_win->g_fd(), POLLIN, 0 };
+		int ret = poll(&pfd, 1, 100);
+
+		if (ret < 0 && errno != EINTR) {
+			fail("poll");
+			return;
+		}
+		if (ret > 0 && !captureFrame())
+			return;
+	}
+}
+
+bool CaptureThread::requeue(cv4l_buffer &buf)
+{
+	unsigned index = buf.g_index();
+
+	if (m_win->m_clear[index]) {
+		memset(m_win->m_queue.g_dataptr(index, 0), 0, buf.g_length());
+		if (V4L2_TYPE_IS_MULTIPLANAR(buf.g_type())) {
+			memset(m_win->m_queue.g_dataptr(index, 1), 0, buf.g_length(1));
+			if (m_win->m_queue.g_dataptr(index, 2))
+				memset(m_win->m_queue.g_dataptr(index, 2), 0, buf.g_length(2));
+		}
+		m_win->m_clear[index] = false;
+	}
+	if (m_win->qbuf(buf)) {
+		fail("Couldn't queue buffer\n");
+		return false;
+	}
+	return true;
+}
+
+// Returns false if capturing has to stop
+bool CaptureThread::captureFrame()
+{
+	cv4l_buffer buf(m_win->m_queue);
+	CapFrame &frame = m_frames[m_back];
+	int err = 0;
+#ifdef HAVE_ALSA
+	struct timeval tv_alsa;
+#endif
+
+	if (m_win->dqbuf(buf)) {
+		if (errno == EAGAIN)
+			return true;
+		fail("dqbuf");
+		return false;
+	}
+	if (buf.g_flags() & V4L2_BUF_FLAG_ERROR) {
+		printf("error\n");
+		return requeue(buf);
+	}
+
+#ifdef HAVE_ALSA
+	alsa_thread_timestamp(&tv_alsa);
+#endif
+
+	frame.frame = ++m_frame;
+	frame.sequence = buf.g_sequence();
+	frame.convertError = false;
+	frame.haveAVLatency = false;
+	for (unsigned p = 0; p < 3; p++) {
+		unsigned char *data = (__u8 *)m_win->m_queue.g_dataptr(buf.g_index(), p);
+
+		frame.plane[p] = NULL;
+		frame.bytesused[p] = 0;
+		if (!data || !frame.data[p])
+			continue;
+		frame.plane[p] = frame.data[p];
+		frame.bytesused[p] = buf.g_bytesused(p) - buf.g_data_offset(p);
+		if (frame.bytesused[p] > frame.size[p])
+			frame.bytesused[p] = frame.size[p];
+		if (p == 0 && m_convert && m_win->m_mustConvert) {
+			err = v4lconvert_convert(m_win->m_convertData,
+						 &m_win->m_capSrcFormat, &m_win->m_capDestFormat,
+						 data + buf.g_data_offset(0), frame.bytesused[0],
+						 frame.data[0], frame.size[0]);
+			if (err != -1) {
+				frame.bytesused[0] = m_win->m_capDestFormat.fmt.pix.sizeimage;
+				continue;
+			}
+			frame.convertError = true;
+		}
+		memcpy(frame.data[p], data + buf.g_data_offset(p), frame.bytesused[p]);
+	}
+
+	/*
+	 * The frame is copied, so the buffer can be returned to the driver
+	 * right away, long before the frame is presented.
+	 */
+	if (!requeue(buf))
+		return false;
+
+	m_win->m_saveRawLock.lock();
+	if (frame.plane[0] && m_win->m_saveRaw.openMode())
+		m_win->m_saveRaw.write((const char *)frame.plane[0], frame.bytesused[0]);
+	m_win->m_saveRawLock.unlock();
+
+#ifdef HAVE_ALSA
+	if (alsa_thread_is_running()) {
+		if (tv_alsa.tv_sec || tv_alsa.tv_usec) {
+			m_totalAudioLatency.tv_sec += buf.g_timestamp().tv_sec - tv_alsa.tv_sec;
+			m_totalAudioLatency.tv_usec += buf.g_timestamp().tv_usec - tv_alsa.tv_usec;
+		}
+		frame.haveAVLatency = true;
+		frame.avLatency = (m_totalAudioLatency.tv_sec * 1000 +
+				   m_totalAudioLatency.tv_usec / 1000) / m_frame;
+	}
+#endif
+	publishFrame();
+	return true;
+}
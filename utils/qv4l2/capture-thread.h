@@ -0,0 +1,100 @@
+/* qv4l2: a control panel controlling v4l2 devices.
+ *
+ * Copyright (c) 2026 - agent
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef CAPTURE_THREAD_H
+#define CAPTURE_THREAD_H
+
+#include <atomic>
+
+#include <QThread>
+#include <QMutex>
+#include <QString>
+
+#include "qv4l2.h"
+
+// Number of frames shared by the capture thread and the GUI
+#define CAP_FRAMES 3
+
+struct CapFrame {
+	// Number of captured frames, including the ones that were not presented
+	unsigned frame;
+	unsigned sequence;
+	bool convertError;
+	// Average A-V latency in ms, only valid if haveAVLatency is set
+	bool haveAVLatency;
+	int avLatency;
+	// The planes to present, NULL if not used
+	unsigned char *plane[3];
+	unsigned bytesused[3];
+	unsigned char *data[3];
+	unsigned size[3];
+};
+
+/*
+ * Dequeues, converts and requeues the captured buffers in its own thread,
+ * so painting and event handling in the GUI never delay the capture and
+ * the driver never runs out of buffers because the display is slow.
+ *
+ * The frames are handed to the GUI through a triple buffer: a frame is
+ * copied or converted into the back buffer, which then becomes the pending
+ * frame. A pending frame the GUI did not present yet is dropped: the GUI
+ * always presents the newest frame.
+ *
+ * The GUI is told about new frames with a queued call of its presentFrame()
+ * slot, and about fatal errors with a queued call of its capThreadError()
+ * slot.
+ */
+class CaptureThread : public QThread
+{
+public:
+	CaptureThread(ApplicationWindow *win);
+	~CaptureThread();
+
+	const CapFrame *takeFrame();
+	void setConvert(bool convert) { m_convert = convert; }
+	const QString &g_error() const { return m_error; }
+	void stop();
+
+protected:
+	void run();
+
+private:
+	bool captureFrame();
+	bool requeue(cv4l_buffer &buf);
+	void publishFrame();
+	void fail(const QString &error);
+
+	ApplicationWindow *m_win;
+	std::atomic<bool> m_stop;
+	std::atomic<bool> m_convert;
+	QString m_error;
+	unsigned m_frame;
+#ifdef HAVE_ALSA
+	struct timeval m_totalAudioLatency;
+#endif
+
+	QMutex m_lock;
+	CapFrame m_frames[CAP_FRAMES];
+	unsigned m_back;
+	unsigned m_pending;
+	unsigned m_front;
+	bool m_havePending;
+};
+
+#endif
@@ -182,6 +182,7 @@ void CaptureWinGLEngine::setColorspace(unsigned colorspace, unsigned xfer_func,
 	case V4L2_PIX_FMT_NV21:
 	case V4L2_PIX_FMT_NV12M:
 	case V4L2_PIX_FMT_NV21M:
+	case V4L2_PIX_FMT_HM12:
 	case V4L2_PIX_FMT_NV16:
 	case V4L2_PIX_FMT_NV61:
 	case V4L2_PIX_FMT_NV16M:
@@ -400,6 +401,14 @@ bool CaptureWinGLEngine::hasNativeFormat(__u32 format)
 		V4L2_PIX_FMT_SGBRG16,
 		V4L2_PIX_FMT_SGRBG16,
 		V4L2_PIX_FMT_SRGGB16,
+		V4L2_PIX_FMT_SBGGR10P,
+		V4L2_PIX_FMT_SGBRG10P,
+		V4L2_PIX_FMT_SGRBG10P,
+		V4L2_PIX_FMT_SRGGB10P,
+		V4L2_PIX_FMT_SBGGR12P,
+		V4L2_PIX_FMT_SGBRG12P,
+		V4L2_PIX_FMT_SGRBG12P,
+		V4L2_PIX_FMT_SRGGB12P,
 		V4L2_PIX_FMT_YUYV,
 		V4L2_PIX_FMT_YVYU,
 		V4L2_PIX_FMT_UYVY,
@@ -423,6 +432,7 @@ bool CaptureWinGLEngine::hasNativeFormat(__u32 format)
 		V4L2_PIX_FMT_YUV420M,
 		V4L2_PIX_FMT_NV12M,
 		V4L2_PIX_FMT_NV21M,
+		V4L2_PIX_FMT_HM12,
 		V4L2_PIX_FMT_YUV444,
 		V4L2_PIX_FMT_YUV555,
 		V4L2_PIX_FMT_YUV565,
@@ -440,6 +450,8 @@ bool CaptureWinGLEngine::hasNativeFormat(__u32 format)
 		V4L2_PIX_FMT_Y12,
 		V4L2_PIX_FMT_Y16,
 		V4L2_PIX_FMT_Y16_BE,
+		V4L2_PIX_FMT_Y10P,
+		V4L2_PIX_FMT_Y12P,
 		V4L2_PIX_FMT_HSV24,
 		V4L2_PIX_FMT_HSV32,
 		0
@@ -543,9 +555,23 @@ void CaptureWinGLEngine::changeShader()
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
 	case V4L2_PIX_FMT_SRGGB16:
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+	case V4L2_PIX_FMT_Y10P:
+	case V4L2_PIX_FMT_Y12P:
 		shader_Bayer(m_frameFormat);
 		break;
 
+	case V4L2_PIX_FMT_HM12:
+		shader_HM12(m_frameFormat);
+		break;
+
 	case V4L2_PIX_FMT_RGB332:
 	case V4L2_PIX_FMT_BGR666:
 	case V4L2_PIX_FMT_RGB555:
@@ -701,9 +727,23 @@ void CaptureWinGLEngine::paintGL()
 	case V4L2_PIX_FMT_SGBRG16:
 	case V4L2_PIX_FMT_SGRBG16:
 	case V4L2_PIX_FMT_SRGGB16:
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+	case V4L2_PIX_FMT_Y10P:
+	case V4L2_PIX_FMT_Y12P:
 		render_Bayer(m_frameFormat);
 		break;
 
+	case V4L2_PIX_FMT_HM12:
+		render_HM12(m_frameFormat);
+		break;
+
 	case V4L2_PIX_FMT_GREY:
 	case V4L2_PIX_FMT_Z16:
 	case V4L2_PIX_FMT_INZI:
@@ -1986,6 +2026,29 @@ void CaptureWinGLEngine::render_RGB(__u32 format)
 	checkError("RGB paint");
 }
 
+// Width in texels of the texture a Bayer or raw greyscale format is uploaded in
+static unsigned bayerTexWidth(__u32 format, unsigned width)
+{
+	switch (format) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_Y10P:
+		// 4 pixels are packed in 5 bytes
+		return width * 5 / 4;
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+	case V4L2_PIX_FMT_Y12P:
+		// 2 pixels are packed in 3 bytes
+		return width * 3 / 2;
+	default:
+		return width;
+	}
+}
+
 void CaptureWinGLEngine::shader_Bayer(__u32 format)
 {
 	m_screenTextureCount = 1;
@@ -2016,6 +2079,13 @@ void CaptureWinGLEngine::shader_Bayer(__u32 format)
 		glTexImage2D(GL_TEXTURE_2D, 0, m_glRed16, m_frameWidth, m_frameHeight, 0,
 			     m_glRed, GL_UNSIGNED_SHORT, NULL);
 		break;
+	default:
+		// The packed bytes are unpacked by the shader, so they must not be filtered
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexImage2D(GL_TEXTURE_2D, 0, m_glRed, bayerTexWidth(format, m_frameWidth),
+			     m_frameHeight, 0, m_glRed, GL_UNSIGNED_BYTE, NULL);
+		break;
 	}
 
 	checkError("Bayer shader");
@@ -2025,11 +2095,58 @@ void CaptureWinGLEngine::shader_Bayer(__u32 format)
 				   "uniform float tex_w;"
 				   "uniform float texl_h;"
 				   "uniform float texl_w;"
-				   "void main()"
+				   "uniform float packed_w;");
+
+	// fetch() returns the normalized value of the pixel at xy
+	switch (format) {
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_Y10P:
+		// The 5th byte holds the 2 LSBs of the 4 pixels, starting with the first
+		codeHead +=	   "float fetch(vec2 xy)"
+				   "{"
+				   "   float x = floor(xy.x * tex_w);"
+				   "   float group = floor(x / 4.0) * 5.0;"
+				   "   float i = mod(x, 4.0);"
+				   "   float msb = floor(texture2D(tex, vec2((group + i + 0.5) / packed_w, xy.y)).r * 255.0 + 0.5);"
+				   "   float lsb = floor(texture2D(tex, vec2((group + 4.5) / packed_w, xy.y)).r * 255.0 + 0.5);"
+				   "   float shift = (i == 0.0) ? 1.0 : (i == 1.0) ? 4.0 : (i == 2.0) ? 16.0 : 64.0;"
+				   "   lsb = mod(floor(lsb / shift), 4.0);"
+				   "   return (msb * 4.0 + lsb) / 1023.0;"
+				   "}";
+		break;
+	case V4L2_PIX_FMT_SBGGR12P:
+	case V4L2_PIX_FMT_SGBRG12P:
+	case V4L2_PIX_FMT_SGRBG12P:
+	case V4L2_PIX_FMT_SRGGB12P:
+	case V4L2_PIX_FMT_Y12P:
+		// The 3rd byte holds the 4 LSBs of the 2 pixels, starting with the first
+		codeHead +=	   "float fetch(vec2 xy)"
+				   "{"
+				   "   float x = floor(xy.x * tex_w);"
+				   "   float group = floor(x / 2.0) * 3.0;"
+				   "   float i = mod(x, 2.0);"
+				   "   float msb = floor(texture2D(tex, vec2((group + i + 0.5) / packed_w, xy.y)).r * 255.0 + 0.5);"
+				   "   float lsb = floor(texture2D(tex, vec2((group + 2.5) / packed_w, xy.y)).r * 255.0 + 0.5);"
+				   "   lsb = (i == 0.0) ? mod(lsb, 16.0) : floor(lsb / 16.0);"
+				   "   return (msb * 16.0 + lsb) / 4095.0;"
+				   "}";
+		break;
+	default:
+		codeHead +=	   "float fetch(vec2 xy)"
+				   "{"
+				   "   return texture2D(tex, xy).r;"
+				   "}";
+		break;
+	}
+
+	codeHead +=		   "void main()"
 				   "{"
 				   "   vec2 xy = vec2(gl_TexCoord[0].xy);"
 				   "   float xcoord = floor(xy.x * tex_w);"
-				   "   float ycoord = floor(xy.y * tex_h);");
+				   "   float ycoord = floor(xy.y * tex_h);";
 
 	if (m_field == V4L2_FIELD_SEQ_TB)
 		codeHead += "   xy.y = (mod(ycoord, 2.0) == 0.0) ? xy.y / 2.0 : xy.y / 2.0 + 0.5;";
@@ -2048,33 +2165,45 @@ void CaptureWinGLEngine::shader_Bayer(__u32 format)
 	case V4L2_PIX_FMT_SBGGR10:
 	case V4L2_PIX_FMT_SBGGR12:
 	case V4L2_PIX_FMT_SBGGR16:
-		codeHead +=	   "   r = texture2D(tex, vec2(cell.x + texl_w, cell.y + texl_h)).r;"
-				   "   g = texture2D(tex, vec2((cell.y == xy.y) ? cell.x + texl_w : cell.x, xy.y)).r;"
-				   "   b = texture2D(tex, cell).r;";
+	case V4L2_PIX_FMT_SBGGR10P:
+	case V4L2_PIX_FMT_SBGGR12P:
+		codeHead +=	   "   r = fetch(vec2(cell.x + texl_w, cell.y + texl_h));"
+				   "   g = fetch(vec2((cell.y == xy.y) ? cell.x + texl_w : cell.x, xy.y));"
+				   "   b = fetch(cell);";
 		break;
 	case V4L2_PIX_FMT_SGBRG8:
 	case V4L2_PIX_FMT_SGBRG10:
 	case V4L2_PIX_FMT_SGBRG12:
 	case V4L2_PIX_FMT_SGBRG16:
-		codeHead +=	   "   r = texture2D(tex, vec2(cell.x, cell.y + texl_h)).r;"
-				   "   g = texture2D(tex, vec2((cell.y == xy.y) ? cell.x : cell.x + texl_w, xy.y)).r;"
-				   "   b = texture2D(tex, vec2(cell.x + texl_w, cell.y)).r;";
+	case V4L2_PIX_FMT_SGBRG10P:
+	case V4L2_PIX_FMT_SGBRG12P:
+		codeHead +=	   "   r = fetch(vec2(cell.x, cell.y + texl_h));"
+				   "   g = fetch(vec2((cell.y == xy.y) ? cell.x : cell.x + texl_w, xy.y));"
+				   "   b = fetch(vec2(cell.x + texl_w, cell.y));";
 		break;
 	case V4L2_PIX_FMT_SGRBG8:
 	case V4L2_PIX_FMT_SGRBG10:
 	case V4L2_PIX_FMT_SGRBG12:
 	case V4L2_PIX_FMT_SGRBG16:
-		codeHead +=	   "   r = texture2D(tex, vec2(cell.x + texl_w, cell.y)).r;"
-				   "   g = texture2D(tex, vec2((cell.y == xy.y) ? cell.x : cell.x + texl_w, xy.y)).r;"
-				   "   b = texture2D(tex, vec2(cell.x, cell.y + texl_h)).r;";
+	case V4L2_PIX_FMT_SGRBG10P:
+	case V4L2_PIX_FMT_SGRBG12P:
+		codeHead +=	   "   r = fetch(vec2(cell.x + texl_w, cell.y));"
+				   "   g = fetch(vec2((cell.y == xy.y) ? cell.x : cell.x + texl_w, xy.y));"
+				   "   b = fetch(vec2(cell.x, cell.y + texl_h));";
 		break;
 	case V4L2_PIX_FMT_SRGGB8:
 	case V4L2_PIX_FMT_SRGGB10:
 	case V4L2_PIX_FMT_SRGGB12:
 	case V4L2_PIX_FMT_SRGGB16:
-		codeHead +=	   "   b = texture2D(tex, vec2(cell.x + texl_w, cell.y + texl_h)).r;"
-				   "   g = texture2D(tex, vec2((cell.y == xy.y) ? cell.x + texl_w : cell.x, xy.y)).r;"
-				   "   r = texture2D(tex, cell).r;";
+	case V4L2_PIX_FMT_SRGGB10P:
+	case V4L2_PIX_FMT_SRGGB12P:
+		codeHead +=	   "   b = fetch(vec2(cell.x + texl_w, cell.y + texl_h));"
+				   "   g = fetch(vec2((cell.y == xy.y) ? cell.x + texl_w : cell.x, xy.y));"
+				   "   r = fetch(cell);";
+		break;
+	case V4L2_PIX_FMT_Y10P:
+	case V4L2_PIX_FMT_Y12P:
+		codeHead +=	   "   r = g = b = fetch(xy);";
 		break;
 	}
 
@@ -2139,6 +2268,8 @@ void CaptureWinGLEngine::render_Bayer(__u32 format)
 	glUniform1f(idx, 1.0 / m_frameHeight);
 	idx = glGetUniformLocation(m_shaderProgram.programId(), "texl_w"); // Texture width
 	glUniform1f(idx, 1.0 / m_frameWidth);
+	idx = glGetUniformLocation(m_shaderProgram.programId(), "packed_w"); // Packed texture width
+	glUniform1f(idx, bayerTexWidth(format, m_frameWidth));
 
 	switch (format) {
 	case V4L2_PIX_FMT_SBGGR8:
@@ -2163,10 +2294,124 @@ void CaptureWinGLEngine::render_Bayer(__u32 format)
 		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_frameWidth, m_frameHeight,
 				m_glRed, GL_UNSIGNED_SHORT, m_frameData);
 		break;
+	default:
+		// The lines of packed formats need not be a multiple of 4 bytes
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, bayerTexWidth(format, m_frameWidth),
+				m_frameHeight, m_glRed, GL_UNSIGNED_BYTE, m_frameData);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		break;
 	}
 	checkError("Bayer paint");
 }
 
+/*
+ * HM12 (NV12_16L16) consists of 16x16 macroblocks, 45 per macroblock row
+ * since the lines are always 720 bytes long. The luma macroblocks are
+ * followed by the macroblocks with the interleaved chroma of 4:2:0.
+ * Each macroblock is uploaded as one line of a 256 texels wide texture.
+ */
+#define HM12_STRIDE 720
+
+static unsigned hm12LumaMacroblocks(unsigned height)
+{
+	return HM12_STRIDE * height / 256;
+}
+
+static unsigned hm12Macroblocks(unsigned height)
+{
+	return HM12_STRIDE * height * 3 / 2 / 256;
+}
+
+void CaptureWinGLEngine::shader_HM12(__u32 format)
+{
+	m_screenTextureCount = 1;
+	glGenTextures(m_screenTextureCount, m_screenTexture);
+	glActiveTexture(GL_TEXTURE0);
+	configureTexture(0);
+	// The macroblocks are detiled by the shader, so they must not be filtered
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, m_glRed, 256, hm12Macroblocks(m_frameHeight), 0,
+		     m_glRed, GL_UNSIGNED_BYTE, NULL);
+	checkError("HM12 shader");
+
+	QString codeHead = QString("uniform sampler2D tex;"
+				   "uniform float tex_w;"
+				   "uniform float tex_h;"
+				   "uniform float mb_rows;"
+				   "uniform float uv_mb;"
+				   "vec2 mb_coord(float x, float y, float first_mb)"
+				   "{"
+				   "   float mb = first_mb + floor(y / 16.0) * 45.0 + floor(x / 16.0);"
+				   "   float offset = mod(y, 16.0) * 16.0 + mod(x, 16.0);"
+				   "   return vec2((offset + 0.5) / 256.0, (mb + 0.5) / mb_rows);"
+				   "}"
+				   "void main()"
+				   "{"
+				   "   vec2 xy = vec2(gl_TexCoord[0].xy);"
+				   "   float ycoord = floor(xy.y * tex_h);");
+
+	if (m_field == V4L2_FIELD_SEQ_TB)
+		codeHead += "   xy.y = (mod(ycoord, 2.0) == 0.0) ? xy.y / 2.0 : xy.y / 2.0 + 0.5;";
+	else if (m_field == V4L2_FIELD_SEQ_BT)
+		codeHead += "   xy.y = (mod(ycoord, 2.0) == 0.0) ? xy.y / 2.0 + 0.5 : xy.y / 2.0;";
+
+	codeHead += "   float xcoord = floor(xy.x * tex_w);"
+		    "   ycoord = floor(xy.y * tex_h);"
+		    "   float y = texture2D(tex, mb_coord(xcoord, ycoord, 0.0)).r;"
+		    "   float cx = xcoord - mod(xcoord, 2.0);"
+		    "   float cy = floor(ycoord / 2.0);"
+		    "   float u = texture2D(tex, mb_coord(cx, cy, uv_mb)).r - 0.5;"
+		    "   float v = texture2D(tex, mb_coord(cx + 1.0, cy, uv_mb)).r - 0.5;";
+
+	QString codeTail = codeYUVNormalize() +
+			   codeYUV2RGB() +
+			   codeTransformToLinear() +
+			   codeColorspaceConversion() +
+			   codeTransformToNonLinear() +
+			   codeSuffix;
+
+	bool src_c = m_shaderProgram.addShaderFromSourceCode(
+#if QT_VERSION < 0x060000
+				QGLShader::Fragment,
+#else
+				QOpenGLShader::Fragment,
+#endif
+				QString("%1%2").arg(codeHead, codeTail));
+
+	if (!src_c)
+		fprintf(stderr, "OpenGL Error: HM12 shader compilation failed.\n");
+
+	m_shaderProgram.bind();
+}
+
+void CaptureWinGLEngine::render_HM12(__u32 format)
+{
+	int idx;
+
+	idx = glGetUniformLocation(m_shaderProgram.programId(), "tex_w"); // Texture width
+	glUniform1f(idx, m_frameWidth);
+	idx = glGetUniformLocation(m_shaderProgram.programId(), "tex_h"); // Texture height
+	glUniform1f(idx, m_frameHeight);
+	idx = glGetUniformLocation(m_shaderProgram.programId(), "mb_rows"); // Macroblock count
+	glUniform1f(idx, hm12Macroblocks(m_frameHeight));
+	idx = glGetUniformLocation(m_shaderProgram.programId(), "uv_mb"); // First chroma macroblock
+	glUniform1f(idx, hm12LumaMacroblocks(m_frameHeight));
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_screenTexture[0]);
+#if QT_VERSION < 0x060000
+	GLint Y = m_glfunction.glGetUniformLocation(m_shaderProgram.programId(), "tex");
+#else
+	GLint Y = glGetUniformLocation(m_shaderProgram.programId(), "tex");
+#endif
+	glUniform1i(Y, 0);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, hm12Macroblocks(m_frameHeight),
+			m_glRed, GL_UNSIGNED_BYTE, m_frameData);
+	checkError("HM12 paint");
+}
+
 void CaptureWinGLEngine::shader_YUV_packed(__u32 format)
 {
 	bool hasAlpha = false;
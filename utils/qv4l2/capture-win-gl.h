@@ -71,6 +71,7 @@ private:
 	QString shader_NV24_invariant(__u32 format);
 	void shader_RGB(__u32 format);
 	void shader_Bayer(__u32 format);
+	void shader_HM12(__u32 format);
 	void shader_YUV_packed(__u32 format);
 	void shader_YUY2(__u32 format);
 	QString shader_YUY2_invariant(__u32 format);
@@ -84,6 +85,7 @@ private:
 	// Colorspace conversion render
 	void render_RGB(__u32 format);
 	void render_Bayer(__u32 format);
+	void render_HM12(__u32 format);
 	void render_YUY2(__u32 format);
 	void render_YUV(__u32 format);
 	void render_YUV_packed(__u32 format);
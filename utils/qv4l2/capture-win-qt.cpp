@@ -106,10 +106,11 @@ void CaptureWinQt::paintFrame()
 			    m_image->width() * (m_image->depth() / 8),
 			    m_image->format());
 
-	QPixmap img = QPixmap::fromImage(displayFrame);
-
-	// No scaling is performed by scaled() if the scaled size is equal to original size
-	img = img.scaled(m_scaledSize.width(), m_scaledSize.height(), Qt::IgnoreAspectRatio);
+	// No scaling is performed by scaled() if the scaled size is equal to original size.
+	// Scale before converting, so only the scaled frame is converted to a pixmap.
+	QPixmap img = QPixmap::fromImage(displayFrame.scaled(m_scaledSize.width(),
+							     m_scaledSize.height(),
+							     Qt::IgnoreAspectRatio));
 
 	m_videoSurface->setPixmap(img);
 }
@@ -358,10 +358,11 @@ void ApplicationWindow::addCtrl(QGridLayout *grid, const v4l2_query_ext_ctrl &qe
 			qmenu.index = i;
 			if (querymenu(qmenu))
 				continue;
+			// The menu index is stored with the item, so it never has to be queried again
 			if (qec.type == V4L2_CTRL_TYPE_MENU)
-				combo->addItem((char *)qmenu.name);
+				combo->addItem((char *)qmenu.name, i);
 			else
-				combo->addItem(QString("%1").arg(qmenu.value));
+				combo->addItem(QString("%1").arg(qmenu.value), i);
 		}
 		addWidget(grid, m_widgetMap[qec.id]);
 		connect(m_widgetMap[qec.id], SIGNAL(activated(int)),
@@ -490,8 +491,7 @@ int ApplicationWindow::getVal(unsigned id)
 {
 	const v4l2_query_ext_ctrl &qec = m_ctrlMap[id];
 	QWidget *w = m_widgetMap[qec.id];
-	v4l2_querymenu qmenu;
-	int i, idx;
+	QComboBox *combo;
 	int v = 0;
 	unsigned dif;
 
@@ -514,16 +514,8 @@ int ApplicationWindow::getVal(unsigned id)
 		break;
 	case V4L2_CTRL_TYPE_MENU:
 	case V4L2_CTRL_TYPE_INTEGER_MENU:
-		idx = static_cast<QComboBox *>(w)->currentIndex();
-		for (i = qec.minimum; i <= qec.maximum; i++) {
-			qmenu.id = qec.id;
-			qmenu.index = i;
-			if (querymenu(qmenu))
-				continue;
-			if (idx-- == 0)
-				break;
-		}
-		v = i;
+		combo = static_cast<QComboBox *>(w);
+		v = combo->itemData(combo->currentIndex()).toInt();
 		break;
 
 	default:
@@ -625,9 +617,9 @@ void ApplicationWindow::updateCtrlRange(unsigned id, __s32 new_val)
 			if (querymenu(qmenu))
 				continue;
 			if (qec.type == V4L2_CTRL_TYPE_MENU)
-				combo->addItem((char *)qmenu.name);
+				combo->addItem((char *)qmenu.name, i);
 			else
-				combo->addItem(QString("%1").arg(qmenu.value));
+				combo->addItem(QString("%1").arg(qmenu.value), i);
 		}
 	}
 }
@@ -811,9 +803,8 @@ void ApplicationWindow::setWhat(QWidget *w, unsigned id, long long v)
 void ApplicationWindow::setVal(unsigned id, int v)
 {
 	const v4l2_query_ext_ctrl &qec = m_ctrlMap[id];
-	v4l2_querymenu qmenu;
 	QWidget *w = m_widgetMap[qec.id];
-	int i, idx;
+	QComboBox *combo;
 	unsigned dif;
 
 	switch (qec.type) {
@@ -835,15 +826,8 @@ void ApplicationWindow::setVal(unsigned id, int v)
 
 	case V4L2_CTRL_TYPE_MENU:
 	case V4L2_CTRL_TYPE_INTEGER_MENU:
-		idx = 0;
-		for (i = qec.minimum; i <= v; i++) {
-			qmenu.id = id;
-			qmenu.index = i;
-			if (querymenu(qmenu))
-				continue;
-			idx++;
-		}
-		static_cast<QComboBox *>(w)->setCurrentIndex(idx - 1);
+		combo = static_cast<QComboBox *>(w);
+		combo->setCurrentIndex(combo->findData(v));
 		break;
 	default:
 		break;
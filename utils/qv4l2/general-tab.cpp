@@ -2419,10 +2419,15 @@ int GeneralTab::matchAudioDevice()
 {
 	QStringList devPath = m_device.split("/");
 	QString curDev = devPath.value(devPath.count() - 1);
-	void *media;
+	static void *media;
 	int match;
 
-	media = discover_media_devices();
+	/* Keep the list across the lookups, the hotplug events update it */
+	if (!media)
+		media = monitor_media_devices();
+	if (!media)
+		return -1;
+	update_media_devices(media);
 
 	if ((match = checkMatchAudioDevice(media, curDev.toLatin1(), MEDIA_SND_CAP)) != -1)
 		return match;
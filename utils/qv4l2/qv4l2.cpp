@@ -40,6 +40,8 @@
 #include <QCloseEvent>
 #include <QInputDialog>
 #include <QActionGroup>
+#include <QMutexLocker>
+#include <QTimer>
 
 #include <assert.h>
 #include <sys/mman.h>
@@ -54,6 +56,7 @@
 #include "capture-win.h"
 #include "capture-win-qt.h"
 #include "capture-win-gl.h"
+#include "capture-thread.h"
 
 #include <libv4l-plugin.h>
 #include <libv4lconvert.h>
@@ -115,6 +118,7 @@ ApplicationWindow::ApplicationWindow() :
 	setAttribute(Qt::WA_DeleteOnClose, true);
 
 	m_capNotifier = NULL;
+	m_capThread = NULL;
 	m_outNotifier = NULL;
 	m_ctrlNotifier = NULL;
 	m_capImage = NULL;
@@ -532,6 +536,12 @@ void ApplicationWindow::setAudioBufferSize()
 }
 
 
+/*
+ * Control events often arrive in bursts, e.g. when a control changes many
+ * others. Only the last event of each control is kept and all of them
+ * are applied together at most once per frame tick (~16 ms), so the
+ * widgets are not updated for each intermediate value.
+ */
 void ApplicationWindow::ctrlEvent()
 {
 	v4l2_event ev;
@@ -544,63 +554,94 @@ void ApplicationWindow::ctrlEvent()
 		}
 		if (ev.type != V4L2_EVENT_CTRL)
 			continue;
-		m_ctrlMap[ev.id].flags = ev.u.ctrl.flags;
-		m_ctrlMap[ev.id].minimum = ev.u.ctrl.minimum;
-		m_ctrlMap[ev.id].maximum = ev.u.ctrl.maximum;
-		m_ctrlMap[ev.id].step = ev.u.ctrl.step;
-		m_ctrlMap[ev.id].default_value = ev.u.ctrl.default_value;
+		if (m_ctrlEvents.empty())
+			QTimer::singleShot(16, this, SLOT(applyCtrlEvents()));
 
-		bool disabled = m_ctrlMap[ev.id].flags & CTRL_FLAG_DISABLED;
+		auto iter = m_ctrlEvents.find(ev.id);
+		__u32 changes = iter == m_ctrlEvents.end() ? 0 : iter->second.changes;
 
-		if (qobject_cast<QLineEdit *>(m_widgetMap[ev.id]))
-			static_cast<QLineEdit *>(m_widgetMap[ev.id])->setReadOnly(disabled);
-		else
-			m_widgetMap[ev.id]->setDisabled(disabled);
-		if (m_sliderMap.find(ev.id) != m_sliderMap.end())
-			m_sliderMap[ev.id]->setDisabled(disabled);
-		if (ev.u.ctrl.changes & V4L2_EVENT_CTRL_CH_RANGE)
-			updateCtrlRange(ev.id, ev.u.ctrl.value);
-		switch (m_ctrlMap[ev.id].type) {
+		m_ctrlEvents[ev.id] = ev.u.ctrl;
+		m_ctrlEvents[ev.id].changes |= changes;
+	}
+
+	if (event_ret && errno == ENODEV) {
+		closeDevice();
+		if (m_capture) {
+			m_capture->stop();
+			delete m_capture;
+			m_capture = NULL;
+		}
+	}
+}
+
+/*
+ * Update the widgets of the controls from the event payloads. Only the
+ * value of string controls is not part of the payload and has to be read.
+ */
+void ApplicationWindow::applyCtrlEvents()
+{
+	CtrlEventMap events;
+
+	events.swap(m_ctrlEvents);
+	for (const auto &iter : events) {
+		unsigned id = iter.first;
+		const v4l2_event_ctrl &ctrl = iter.second;
+
+		if (m_widgetMap.find(id) == m_widgetMap.end())
+			continue;
+
+		m_ctrlMap[id].flags = ctrl.flags;
+		m_ctrlMap[id].minimum = ctrl.minimum;
+		m_ctrlMap[id].maximum = ctrl.maximum;
+		m_ctrlMap[id].step = ctrl.step;
+		m_ctrlMap[id].default_value = ctrl.default_value;
+
+		if (ctrl.changes & V4L2_EVENT_CTRL_CH_FLAGS) {
+			bool disabled = ctrl.flags & CTRL_FLAG_DISABLED;
+
+			if (qobject_cast<QLineEdit *>(m_widgetMap[id]))
+				static_cast<QLineEdit *>(m_widgetMap[id])->setReadOnly(disabled);
+			else
+				m_widgetMap[id]->setDisabled(disabled);
+			if (m_sliderMap.find(id) != m_sliderMap.end())
+				m_sliderMap[id]->setDisabled(disabled);
+		}
+		if (ctrl.changes & V4L2_EVENT_CTRL_CH_RANGE)
+			updateCtrlRange(id, ctrl.value);
+		if (!(ctrl.changes & (V4L2_EVENT_CTRL_CH_VALUE | V4L2_EVENT_CTRL_CH_RANGE)))
+			continue;
+
+		switch (m_ctrlMap[id].type) {
 		case V4L2_CTRL_TYPE_INTEGER:
 		case V4L2_CTRL_TYPE_INTEGER_MENU:
 		case V4L2_CTRL_TYPE_MENU:
 		case V4L2_CTRL_TYPE_BOOLEAN:
 		case V4L2_CTRL_TYPE_BITMASK:
-			setVal(ev.id, ev.u.ctrl.value);
+			setVal(id, ctrl.value);
 			break;
 		case V4L2_CTRL_TYPE_INTEGER64:
-			setVal64(ev.id, ev.u.ctrl.value64);
+			setVal64(id, ctrl.value64);
 			break;
 		default:
 			break;
 		}
-		if (m_ctrlMap[ev.id].type != V4L2_CTRL_TYPE_STRING)
+		if (m_ctrlMap[id].type != V4L2_CTRL_TYPE_STRING)
 			continue;
-		query_ext_ctrl(m_ctrlMap[ev.id]);
 
 		struct v4l2_ext_control c;
 		struct v4l2_ext_controls ctrls;
 
-		c.id = ev.id;
-		c.size = m_ctrlMap[ev.id].maximum + 1;
+		c.id = id;
+		c.size = m_ctrlMap[id].maximum + 1;
 		c.string = (char *)malloc(c.size);
 		memset(&ctrls, 0, sizeof(ctrls));
 		ctrls.count = 1;
 		ctrls.which = 0;
 		ctrls.controls = &c;
 		if (!g_ext_ctrls(ctrls))
-			setString(ev.id, c.string);
+			setString(id, c.string);
 		free(c.string);
 	}
-
-	if (event_ret && errno == ENODEV) {
-		closeDevice();
-		if (m_capture) {
-			m_capture->stop();
-			delete m_capture;
-			m_capture = NULL;
-		}
-	}
 }
 
 void ApplicationWindow::newCaptureWin()
@@ -1171,6 +1212,62 @@ void ApplicationWindow::capFrame()
 		refresh();
 }
 
+/*
+ * Present the newest frame of the capture thread. Frames captured since the
+ * previous call that were never presented are counted as dropped.
+ */
+void ApplicationWindow::presentFrame()
+{
+	const CapFrame *frame;
+
+	if (m_capThread == NULL || (frame = m_capThread->takeFrame()) == NULL)
+		return;
+
+	m_capThread->setConvert(showFrames());
+	if (frame->convertError && m_presented == 0)
+		error(v4lconvert_get_error_message(m_convertData));
+
+	QString status, curStatus;
+
+	calculateFps();
+	m_frame = frame->frame;
+	m_presented++;
+
+	float wscale = m_capture->getHorScaleFactor();
+	float hscale = m_capture->getVertScaleFactor();
+	status = QString("Frame: %1 Fps: %2 Presented: %3 Dropped: %4 Scale Factors: %5x%6")
+			 .arg(m_frame).arg(m_fps, 0, 'f', 2, '0')
+			 .arg(m_presented).arg(m_frame - m_presented)
+			 .arg(wscale).arg(hscale);
+	status.append(QString(" SeqNr: %1").arg(frame->sequence));
+	if (frame->haveAVLatency)
+		status.append(QString(" Average A-V: %1 ms").arg(frame->avLatency));
+	if (frame->plane[0] == NULL && showFrames())
+		status.append(" Error: Unsupported format.");
+
+	if (m_makeSnapshot)
+		makeSnapshot(frame->plane[0], frame->bytesused[0]);
+
+	if (showFrames())
+		m_capture->setFrame(m_capImage->width(), m_capImage->height(),
+				    m_capDestFormat.g_pixelformat(),
+				    frame->plane[0], frame->plane[1], frame->plane[2]);
+
+	curStatus = statusBar()->currentMessage();
+	if (curStatus.isEmpty() || curStatus.startsWith("Frame: ") || curStatus.startsWith("No frame"))
+		statusBar()->showMessage(status);
+	if (m_presented == 1)
+		refresh();
+}
+
+void ApplicationWindow::capThreadError()
+{
+	if (m_capThread == NULL)
+		return;
+	error(m_capThread->g_error());
+	m_capStartAct->setChecked(false);
+}
+
 void ApplicationWindow::stopStreaming()
 {
 	bool canStream = g_fd() >= 0 && (v4l_type_is_capture(g_type()) || has_vid_out()) &&
@@ -1204,6 +1301,11 @@ void ApplicationWindow::stopStreaming()
 
 	case methodMmap:
 	case methodUser:
+		if (m_capThread) {
+			m_capThread->stop();
+			delete m_capThread;
+			m_capThread = NULL;
+		}
 		m_queue.free(this);
 		break;
 	}
@@ -1599,10 +1701,23 @@ void ApplicationWindow::capStart(bool start)
 		m_capture->show();
 
 	statusBar()->showMessage("No frame");
-	if (startStreaming()) {
-		m_capNotifier = new QSocketNotifier(g_fd(), QSocketNotifier::Read, m_tabs);
-		connect(m_capNotifier, SIGNAL(activated(int)), this, SLOT(capFrame()));
+	if (!startStreaming())
+		return;
+
+	/*
+	 * Unless single stepping, capture streaming I/O in a separate thread
+	 * that always requeues the buffers right away, so a slow display
+	 * drops frames instead of starving the driver of buffers.
+	 */
+	if (m_capMethod != methodRead && !m_singleStep) {
+		m_presented = 0;
+		m_capThread = new CaptureThread(this);
+		m_capThread->setConvert(showFrames());
+		m_capThread->start();
+		return;
 	}
+	m_capNotifier = new QSocketNotifier(g_fd(), QSocketNotifier::Read, m_tabs);
+	connect(m_capNotifier, SIGNAL(activated(int)), this, SLOT(capFrame()));
 }
 
 void ApplicationWindow::makeFullScreen(bool checked)
@@ -1650,6 +1765,7 @@ void ApplicationWindow::closeDevice()
 	}
 	m_genTab = NULL;
 	m_ctrlMap.clear();
+	m_ctrlEvents.clear();
 	m_widgetMap.clear();
 	m_sliderMap.clear();
 	m_classMap.clear();
@@ -1709,16 +1825,20 @@ void ApplicationWindow::openRawFile(const QString &s)
 	if (s.isEmpty())
 		return;
 
+	m_saveRawLock.lock();
 	if (m_saveRaw.openMode())
 		m_saveRaw.close();
 	m_saveRaw.setFileName(s);
 	m_saveRaw.open(QIODevice::WriteOnly | QIODevice::Truncate);
+	m_saveRawLock.unlock();
 	m_saveRawAct->setChecked(true);
 }
 
 void ApplicationWindow::saveRaw(bool checked)
 {
 	if (!checked) {
+		QMutexLocker locker(&m_saveRawLock);
+
 		if (m_saveRaw.openMode())
 			m_saveRaw.close();
 		return;
@@ -28,6 +28,7 @@
 #include <QSocketNotifier>
 #include <QImage>
 #include <QFileDialog>
+#include <QMutex>
 #include <map>
 #include <vector>
 
@@ -53,6 +54,7 @@ using ClassIDVec = std::vector<unsigned>;
 using ClassMap = std::map<unsigned, ClassIDVec>;
 using CtrlMap = std::map<unsigned, v4l2_query_ext_ctrl>;
 using WidgetMap = std::map<unsigned, QWidget *>;
+using CtrlEventMap = std::map<unsigned, v4l2_event_ctrl>;
 
 enum {
 	CTRL_UPDATE_ON_CHANGE = 0x10,
@@ -84,12 +86,14 @@ struct buffer {
 				 V4L2_CTRL_FLAG_GRABBED)
 
 class CaptureWin;
+class CaptureThread;
 
 class ApplicationWindow: public QMainWindow, cv4l_fd
 {
 	Q_OBJECT
 
 	friend class CaptureWin;
+	friend class CaptureThread;
 public:
 	ApplicationWindow();
 	virtual ~ApplicationWindow();
@@ -135,8 +139,11 @@ private slots:
 	void outStart(bool);
 	void makeFullScreen(bool);
 	void capFrame();
+	void presentFrame();
+	void capThreadError();
 	void outFrame();
 	void ctrlEvent();
+	void applyCtrlEvents();
 	void snapshot();
 	void capVbiFrame();
 	void capSdrFrame();
@@ -274,11 +281,13 @@ private:
 	QSignalMapper *m_sigMapper;
 	QTabWidget *m_tabs;
 	QSocketNotifier *m_capNotifier;
+	CaptureThread *m_capThread;
 	QSocketNotifier *m_outNotifier;
 	QSocketNotifier *m_ctrlNotifier;
 	QImage *m_capImage;
 	int m_row, m_col, m_cols;
 	CtrlMap m_ctrlMap;
+	CtrlEventMap m_ctrlEvents;
 	WidgetMap m_widgetMap;
 	WidgetMap m_sliderMap;
 	ClassMap m_classMap;
@@ -291,6 +300,9 @@ private:
 	double m_fps;
 	struct timespec m_startTimestamp;
 	struct timeval m_totalAudioLatency;
+	unsigned m_presented;
+	// Serializes writing raw frames from the capture thread with opening and closing the file
+	QMutex m_saveRawLock;
 	QFile m_saveRaw;
 };
 
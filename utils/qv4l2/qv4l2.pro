@@ -29,18 +29,20 @@ INCLUDEPATH += $$PWD/../v4l2-compliance
 
 # Input
 HEADERS += alsa_stream.h
+HEADERS += capture-thread.h
 HEADERS += capture-win-gl.h
 HEADERS += capture-win.h
 HEADERS += capture-win-qt.h
 HEADERS += general-tab.h
 HEADERS += qv4l2.h
-HEADERS += raw2sliced.h
 HEADERS += vbi-tab.h
+HEADERS += ../common/raw2sliced.h
 HEADERS += ../common/v4l2-tpg.h
 HEADERS += ../common/v4l2-tpg-colors.h
 HEADERS += $$MESON_BUILD_PATH/config.h
 
 SOURCES += alsa_stream.c
+SOURCES += capture-thread.cpp
 SOURCES += capture-win.cpp
 SOURCES += capture-win-gl.cpp
 SOURCES += capture-win-qt.cpp
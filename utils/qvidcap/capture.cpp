@@ -8,7 +8,11 @@
  * Copyright 2018 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <time.h>
+
 #include "capture.h"
+#include "sock-receiver.h"
+#include "mosaic.h"
 
 #include <QtCore/QTextStream>
 #include <QtCore/QCoreApplication>
@@ -24,9 +28,9 @@
 #include <QtCore/QSocketNotifier>
 #include <QtMath>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QApplication>
 
-#include <netinet/in.h>
 #include "v4l2-info.h"
 
 const __u32 formats[] = {
@@ -214,10 +218,16 @@ static QAction *addSubMenuItem(QActionGroup *grp, QMenu *menu, const QString &te
 CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	QOpenGLWidget(parent),
 	m_fd(0),
-	m_sock(0),
+	m_sockReceiver(0),
+	m_sockSeq(0),
+	m_mosaic(0),
 	m_v4l_queue(0),
 	m_frame(0),
-	m_ctx(0),
+	m_overlay(false),
+	m_timingLog(0),
+	m_timecode(false),
+	m_receiveNs(0),
+	m_decodeNs(0),
 	m_origPixelFormat(0),
 	m_fps(0),
 	m_singleStep(false),
@@ -227,10 +237,19 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 	m_program(0),
 	m_curIndex(-1),
 	m_nextIndex(-1),
+	m_havePBO(false),
+	m_pboSize(0),
+	m_pboIdx(0),
+	m_useDmaBuf(true),
+	m_dmaBufExported(false),
+	m_haveEGLImport(false),
+	m_dmaBufFmt(false),
+	m_dmaBufFence(0),
 	m_scrollArea(sa)
 {
 	m_curSize[0] = 0;
 	m_curData[0] = 0;
+	memset(m_eglImage, 0, sizeof(m_eglImage));
 	m_canOverrideResolution = false;
 	m_pixelaspect.numerator = 1;
 	m_pixelaspect.denominator = 1;
@@ -322,7 +341,23 @@ CaptureWin::CaptureWin(QScrollArea *sa, QWidget *parent) :
 
 CaptureWin::~CaptureWin()
 {
+	// A receiver that is still blocked is left to exit with the process
+	if (m_sockReceiver && m_sockReceiver->stop())
+		delete m_sockReceiver;
+	// Stop all mosaic receivers at once, so they share the timeout
+	for (auto receiver : m_mosaicReceivers)
+		receiver->requestStop();
+
+	QElapsedTimer elapsed;
+
+	elapsed.start();
+	for (auto receiver : m_mosaicReceivers)
+		if (receiver->wait(qMax(1000 - elapsed.elapsed(), (qint64)0)))
+			delete receiver;
+	delete m_mosaic;
 	makeCurrent();
+	deletePBOs();
+	deleteEGLImages();
 	delete m_program;
 }
 
@@ -586,8 +621,12 @@ void CaptureWin::keyPressEvent(QKeyEvent *event)
 	case Qt::Key_Space:
 		if (m_mode == AppModeTest)
 			m_cnt = 1;
-		else if (m_singleStep && m_frame > m_singleStepStart)
+		else if (m_singleStep && m_frame > m_singleStepStart) {
 			m_singleStepNext = true;
+			// The receiver only notifies when it has a new frame
+			if (m_sockReceiver || m_mosaic)
+				sockFrameEvent();
+		}
 		return;
 	case Qt::Key_Escape:
 		if (!m_scrollArea->isFullScreen())
@@ -658,6 +697,10 @@ void CaptureWin::keyPressEvent(QKeyEvent *event)
 	case Qt::Key_Q:
 		QApplication::quit();
 		return;
+	case Qt::Key_T:
+		m_overlay = !m_overlay;
+		update();
+		return;
 	case Qt::Key_R:
 		cycleMenu(m_overrideQuantization, m_origQuantization,
 			  quantizations, hasShift, hasCtrl);
@@ -797,22 +840,43 @@ void CaptureWin::setModeV4L2(cv4l_fd *fd)
 		printf("using libv4l2\n");
 }
 
-void CaptureWin::setModeSocket(int socket, int port)
+void CaptureWin::setModeSocket(int socket, int port, struct v4l_stream_udp_rx *udp_rx)
 {
 	m_mode = AppModeSocket;
-	m_sock = socket;
-	m_port = port;
-	if (m_ctx)
-		free(m_ctx);
-	m_ctx = fwht_alloc(m_v4l_fmt.g_pixelformat(), m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			   m_v4l_fmt.g_width(), m_v4l_fmt.g_height(),
-			   m_v4l_fmt.g_field(), m_v4l_fmt.g_colorspace(), m_v4l_fmt.g_xfer_func(),
-			   m_v4l_fmt.g_ycbcr_enc(), m_v4l_fmt.g_quantization());
-
-	QSocketNotifier *readSock = new QSocketNotifier(m_sock,
-		QSocketNotifier::Read, this);
+	m_sockReceiver = new SockReceiver(this, socket, port, udp_rx, m_v4l_fmt);
+	// Single stepping must show every frame
+	m_sockReceiver->setDropFrames(!m_singleStep);
+	m_sockReceiver->start();
+}
 
-	connect(readSock, SIGNAL(activated(int)), this, SLOT(sockReadEvent()));
+// Receive a stream from the same host through a shared memory ring
+void CaptureWin::setModeLocal(int socket, const QString &path, const ShmRing &shm)
+{
+	m_mode = AppModeSocket;
+	m_sockReceiver = new SockReceiver(this, socket, 0, NULL, m_v4l_fmt);
+	m_sockReceiver->setLocal(path, shm);
+	m_sockReceiver->setDropFrames(!m_singleStep);
+	m_sockReceiver->start();
+}
+
+/*
+ * Receive the streams of all ports, each in its own thread, and show them
+ * as the tiles of a mosaic. The stream of the first port is already
+ * connected, all streams must have its format.
+ */
+void CaptureWin::setModeMosaic(int socket, const QList<int> &ports, const cv4l_fmt &tileFmt)
+{
+	m_mode = AppModeSocket;
+	m_mosaic = new Mosaic(tileFmt, ports.size());
+	for (int i = 0; i < ports.size(); i++) {
+		SockReceiver *receiver = new SockReceiver(this, i ? -1 : socket, ports[i],
+							  NULL, tileFmt);
+
+		receiver->setFixedFormat(true);
+		receiver->setDropFrames(!m_singleStep);
+		m_mosaicReceivers.append(receiver);
+		receiver->start();
+	}
 }
 
 void CaptureWin::setModeFile(const QString &filename)
@@ -840,6 +904,16 @@ void CaptureWin::setModeTest(unsigned cnt)
 void CaptureWin::setQueue(cv4l_queue *q)
 {
 	m_v4l_queue = q;
+	/*
+	 * Export the buffers so they can be imported as EGL images instead
+	 * of being copied. libv4l2 may convert the frames, and the exported
+	 * buffers would then contain the unconverted data.
+	 */
+	if (m_useDmaBuf && m_fd->g_direct() && q->g_buffers() <= VIDEO_MAX_FRAME)
+		m_dmaBufExported = !q->export_bufs(m_fd, m_fd->g_type());
+	if (m_verbose && m_useDmaBuf)
+		printf("The buffers can%s be exported as DMABUFs\n",
+		       m_dmaBufExported ? "" : "not");
 	if (m_origPixelFormat == 0)
 		updateOrigValues();
 }
@@ -1168,158 +1242,72 @@ void CaptureWin::v4l2ExceptionEvent()
 	}
 }
 
-void CaptureWin::listenForNewConnection()
-{
-	cv4l_fmt fmt;
-	v4l2_fract pixelaspect = { 1, 1 };
-
-	::close(m_sock);
-
-	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-		m_curSize[p] = 0;
-		delete [] m_curData[p];
-		m_curData[p] = NULL;
-	}
-
-	int sock_fd;
-
-	for (;;) {
-		sock_fd = initSocket(m_port, fmt, pixelaspect);
-		if (setV4LFormat(fmt))
-			break;
-		fprintf(stderr, "Unsupported format: '%s' %s\n",
-			fcc2s(fmt.g_pixelformat()).c_str(),
-			pixfmt2s(fmt.g_pixelformat()).c_str());
-		::close(sock_fd);
-	}
-	if (m_ctx)
-		free(m_ctx);
-	m_ctx = fwht_alloc(fmt.g_pixelformat(), fmt.g_width(), fmt.g_height(),
-			   fmt.g_width(), fmt.g_height(),
-			   fmt.g_field(), fmt.g_colorspace(), fmt.g_xfer_func(),
-			   fmt.g_ycbcr_enc(), fmt.g_quantization());
-	setPixelAspect(pixelaspect);
-	updateOrigValues();
-	setModeSocket(sock_fd, m_port);
-	restoreSize();
-}
-
-int CaptureWin::read_u32(__u32 &v)
+void CaptureWin::sockFrameEvent()
 {
-	int n;
+	if (m_singleStep && m_frame > m_singleStepStart && !m_singleStepNext)
+		return;
 
-	v = 0;
-	n = read(m_sock, &v, sizeof(v));
-	if (n != sizeof(v)) {
-		fprintf(stderr, "could not read __u32\n");
-		return -1;
+	if (m_mosaic) {
+		mosaicFrameEvent();
+		return;
 	}
-	v = ntohl(v);
-	return 0;
-}
 
-void CaptureWin::sockReadEvent()
-{
-	int n;
+	const SockFrame *frame = m_sockReceiver->takeFrame();
 
-	if (m_singleStep && m_frame > m_singleStepStart && !m_singleStepNext)
+	if (!frame)
 		return;
 	m_singleStepNext = false;
 
 	if (m_origPixelFormat == 0)
 		updateOrigValues();
 
-	if (m_curSize[0] == 0) {
-		for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-			m_curSize[p] = m_v4l_fmt.g_sizeimage(p);
-			m_curData[p] = new __u8[m_curSize[p]];
-		}
-	}
-
-	unsigned packet, sz;
-	bool is_fwht;
-
-	if (read_u32(packet))
-		goto new_conn;
-
-	if (packet == V4L_STREAM_PACKET_END) {
-		fprintf(stderr, "END packet read\n");
-		goto new_conn;
+	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
+		m_curData[p] = frame->data[p];
+		m_curSize[p] = frame->size[p];
 	}
+	m_receiveNs = frame->receiveNs;
+	m_decodeNs = frame->decodeNs;
 
-	if (read_u32(sz))
-		goto new_conn;
-
-	if (packet != V4L_STREAM_PACKET_FRAME_VIDEO_RLE &&
-	    packet != V4L_STREAM_PACKET_FRAME_VIDEO_FWHT) {
-		char buf[1024];
+	// Frames that the receiver dropped still count as captured
+	unsigned frames = frame->seq - m_sockSeq;
 
-		fprintf(stderr, "expected FRAME_VIDEO, got 0x%08x\n", packet);
-		while (sz) {
-			unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
+	m_sockSeq = frame->seq;
+	m_frame += frames;
+	update();
+	if (m_cnt == 0)
+		return;
+	if (m_cnt <= frames)
+		std::exit(EXIT_SUCCESS);
+	m_cnt -= frames;
+}
 
-			n = read(m_sock, buf, rdsize);
-			if (n < 0) {
-				fprintf(stderr, "error reading %d bytes\n", sz);
-				goto new_conn;
-			}
-			sz -= n;
+// Copy the new frames of all receivers into their tiles and show the mosaic
+void CaptureWin::mosaicFrameEvent()
+{
+	bool updated = false;
+
+	// Show the slowest of the tiles that are updated
+	m_receiveNs = m_decodeNs = 0;
+	for (int i = 0; i < m_mosaicReceivers.size(); i++) {
+		const SockFrame *frame = m_mosaicReceivers[i]->takeFrame();
+
+		if (frame) {
+			m_mosaic->copyTile(i, frame->data);
+			m_receiveNs = qMax(m_receiveNs, frame->receiveNs);
+			m_decodeNs = qMax(m_decodeNs, frame->decodeNs);
+			updated = true;
 		}
-		return;
 	}
+	if (!updated)
+		return;
+	m_singleStepNext = false;
 
-	is_fwht = m_ctx && packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
-
-	if (read_u32(sz))
-		goto new_conn;
-
-	if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR) {
-		fprintf(stderr, "unsupported FRAME_VIDEO size\n");
-		goto new_conn;
-	}
-	if (read_u32(sz) ||  // ignore field
-	    read_u32(sz))    // ignore flags
-		goto new_conn;
+	if (m_origPixelFormat == 0)
+		updateOrigValues();
 
 	for (unsigned p = 0; p < m_v4l_fmt.g_num_planes(); p++) {
-		__u32 max_size = is_fwht ? m_ctx->comp_max_size : m_curSize[p];
-		__u8 *dst = is_fwht ? m_ctx->state.compressed_frame : m_curData[p];
-		__u32 data_size;
-		__u32 offset;
-		__u32 size;
-
-		if (read_u32(sz))
-			goto new_conn;
-		if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR) {
-			fprintf(stderr, "unsupported FRAME_VIDEO plane size\n");
-			goto new_conn;
-		}
-		if (read_u32(size) || read_u32(data_size))
-			goto new_conn;
-		offset = is_fwht ? 0 : size - data_size;
-		sz = data_size;
-
-		if (data_size > max_size) {
-			fprintf(stderr, "data size is too large (%u > %u)\n",
-				data_size, max_size);
-			goto new_conn;
-		}
-		while (sz) {
-			n = read(m_sock, dst + offset, sz);
-			if (n < 0) {
-				fprintf(stderr, "error reading %d bytes\n", sz);
-				goto new_conn;
-			}
-			if ((__u32)n == sz)
-				break;
-			offset += n;
-			sz -= n;
-		}
-		if (is_fwht)
-			fwht_decompress(m_ctx, dst, data_size, m_curData[p], m_curSize[p]);
-		else
-			rle_decompress(dst, size, data_size,
-				       rle_calc_bpl(m_v4l_fmt.g_bytesperline(p), m_v4l_fmt.g_pixelformat()));
+		m_curData[p] = m_mosaic->g_data(p);
+		m_curSize[p] = m_mosaic->g_size(p);
 	}
 	m_frame++;
 	update();
@@ -1327,10 +1315,27 @@ void CaptureWin::sockReadEvent()
 		return;
 	if (--m_cnt == 0)
 		std::exit(EXIT_SUCCESS);
-	return;
+}
 
-new_conn:
-	listenForNewConnection();
+bool CaptureWin::sockNewFormat()
+{
+	cv4l_fmt fmt = m_sockReceiver->g_fmt();
+
+	// The frames of the old format are freed when this returns
+	for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++) {
+		m_curSize[p] = 0;
+		m_curData[p] = NULL;
+	}
+	if (!setV4LFormat(fmt)) {
+		fprintf(stderr, "Unsupported format: '%s' %s\n",
+			fcc2s(fmt.g_pixelformat()).c_str(),
+			pixfmt2s(fmt.g_pixelformat()).c_str());
+		return false;
+	}
+	setPixelAspect(m_sockReceiver->g_pixelaspect());
+	updateOrigValues();
+	restoreSize();
+	return true;
 }
 
 void CaptureWin::resizeGL(int w, int h)
@@ -1434,6 +1439,8 @@ void CaptureWin::startTimer()
 		else
 			tpg_fillbuffer(&m_tpg, 0, p, m_curData[p]);
 	}
+	if (m_mode == AppModeTPG && m_timecode)
+		stampTimecode();
 	bool is_alt = m_v4l_fmt.g_field() == V4L2_FIELD_ALTERNATE;
 	tpg_update_mv_count(&m_tpg, is_alt);
 	m_timer->setTimerType(Qt::PreciseTimer);
@@ -1463,6 +1470,24 @@ void CaptureWin::startTimer()
 	}
 }
 
+// Stamp the wall clock time into the frame, see tpg_gen_timecode()
+void CaptureWin::stampTimecode()
+{
+	u8 *basep[TPG_MAX_PLANES][2];
+	bool one_buffer = tpg_g_buffers(&m_tpg) == 1;
+	unsigned offset = 0;
+	struct timespec ts;
+
+	for (unsigned p = 0; p < tpg_g_planes(&m_tpg); p++) {
+		tpg_calc_text_basep(&m_tpg, basep, p,
+				    one_buffer ? m_curData[0] + offset : m_curData[p]);
+		offset += tpg_calc_plane_size(&m_tpg, p);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	tpg_gen_timecode(&m_tpg, basep, 0, 0,
+			 ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
 void CaptureWin::tpgUpdateFrame()
 {
 	bool is_alt = m_v4l_fmt.g_field() == V4L2_FIELD_ALTERNATE;
@@ -1488,6 +1513,8 @@ void CaptureWin::tpgUpdateFrame()
 		else
 			tpg_fillbuffer(&m_tpg, 0, p, m_curData[p]);
 	}
+	if (m_mode == AppModeTPG && m_timecode)
+		stampTimecode();
 	m_frame++;
 	update();
 	if (m_cnt != 1)
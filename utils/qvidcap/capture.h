@@ -26,6 +26,7 @@
 
 extern "C" {
 #include "v4l2-tpg.h"
+#include "v4l2-tpg-cache.h"
 #include "v4l-stream.h"
 }
 
@@ -38,6 +39,9 @@ extern const __u32 hsv_encs[];
 extern const __u32 quantizations[];
 
 class QOpenGLPaintDevice;
+class SockReceiver;
+struct ShmRing;
+class Mosaic;
 
 enum AppMode {
 	AppModeV4L2,
@@ -68,6 +72,9 @@ struct TestState {
 // This must be equal to the max number of textures that any shader uses
 #define MAX_TEXTURES_NEEDED 3
 
+// Number of pixel unpack buffers the frames are uploaded through
+#define PBO_RING 3
+
 class CaptureWin : public QOpenGLWidget, protected QOpenGLFunctions
 {
 	Q_OBJECT
@@ -76,7 +83,9 @@ public:
 	~CaptureWin();
 
 	void setModeV4L2(cv4l_fd *fd);
-	void setModeSocket(int sock, int port);
+	void setModeSocket(int sock, int port, struct v4l_stream_udp_rx *udp_rx = NULL);
+	void setModeLocal(int sock, const QString &path, const ShmRing &shm);
+	void setModeMosaic(int sock, const QList<int> &ports, const cv4l_fmt &tileFmt);
 	void setModeFile(const QString &filename);
 	void setModeTPG();
 	void setModeTest(unsigned cnt);
@@ -89,6 +98,10 @@ public:
 	void setOverrideHorPadding(__u32 p);
 	void setCount(unsigned cnt) { m_cnt = cnt; }
 	void setReportTimings(bool report) { m_reportTimings = report; }
+	void setOverlay(bool overlay) { m_overlay = overlay; }
+	void setTimingLog(FILE *log) { m_timingLog = log; }
+	void setTimecode(bool timecode) { m_timecode = timecode; }
+	void setUseDmaBuf(bool use) { m_useDmaBuf = use; }
 	void setVerbose(bool verbose) { m_verbose = verbose; }
 	void setOverridePixelFormat(__u32 fmt) { m_overridePixelFormat = fmt; }
 	void setOverrideField(__u32 field) { m_overrideField = field; }
@@ -107,7 +120,8 @@ public:
 private slots:
 	void v4l2ReadEvent();
 	void v4l2ExceptionEvent();
-	void sockReadEvent();
+	void sockFrameEvent();
+	bool sockNewFormat();
 	void tpgUpdateFrame();
 
 	void restoreAll(bool checked);
@@ -131,12 +145,14 @@ private:
 	void contextMenuEvent(QContextMenuEvent *event);
 	void keyPressEvent(QKeyEvent *event);
 	void mouseDoubleClickEvent(QMouseEvent * e);
-	void listenForNewConnection();
-	int read_u32(__u32 &v);
 	void showCurrentOverrides();
 	void cycleMenu(__u32 &overrideVal, __u32 origVal,
 		       const __u32 values[], bool hasShift, bool hasCtrl);
 
+	void mosaicFrameEvent();
+	void stampTimecode();
+	bool readTimecode(int x, int y, const QSize &s, __u64 &us);
+	void showTiming(int x, int y, const QSize &s, __u64 uploadNs, __u64 renderNs);
 	bool supportedFmt(__u32 fmt);
 	void checkError(const char *msg);
 	void configureTexture(size_t idx);
@@ -144,6 +160,12 @@ private:
 	void updateOrigValues();
 	void updateShader();
 	void changeShader();
+	void createPBOs(unsigned size);
+	void deletePBOs();
+	bool bindPBO(__u8 *saved[]);
+	void unbindPBO(__u8 *saved[]);
+	bool bindDmaBuf();
+	void deleteEGLImages();
 
 	// Colorspace conversion shaders
 	void shader_YUV();
@@ -167,8 +189,11 @@ private:
 
 	enum AppMode m_mode;
 	cv4l_fd *m_fd;
-	int m_sock;
-	int m_port;
+	SockReceiver *m_sockReceiver;
+	unsigned m_sockSeq;
+	// The receivers of the tiles of a mosaic, in tile order
+	Mosaic *m_mosaic;
+	QList<SockReceiver *> m_mosaicReceivers;
 	QFile m_file;
 	bool m_v4l2;
 	cv4l_fmt m_v4l_fmt;
@@ -181,6 +206,12 @@ private:
 	unsigned m_imageSize;
 	bool m_verbose;
 	bool m_reportTimings;
+	// The frame timing overlay and log, see showTiming()
+	bool m_overlay;
+	FILE *m_timingLog;
+	bool m_timecode;
+	__u64 m_receiveNs;
+	__u64 m_decodeNs;
 	bool m_is_sdtv;
 	v4l2_std_id m_std;
 	bool m_is_rgb;
@@ -192,7 +223,6 @@ private:
 	bool m_updateShader;
 	QSize m_viewSize;
 	bool m_canOverrideResolution;
-	codec_ctx *m_ctx;
 
 	__u32 m_overridePixelFormat;
 	__u32 m_overrideWidth;
@@ -228,6 +258,19 @@ private:
 	unsigned m_nextSize[MAX_TEXTURES_NEEDED];
 	int m_curIndex;
 	int m_nextIndex;
+	bool m_havePBO;
+	GLuint m_pbo[PBO_RING];
+	GLsync m_pboFence[PBO_RING];
+	__u8 *m_pboPtr[PBO_RING];
+	unsigned m_pboSize;
+	unsigned m_pboIdx;
+	bool m_useDmaBuf;
+	bool m_dmaBufExported;
+	bool m_haveEGLImport;
+	bool m_dmaBufFmt;
+	// The EGLImageKHR of each plane of the buffers, created on first use
+	void *m_eglImage[VIDEO_MAX_FRAME][MAX_TEXTURES_NEEDED];
+	GLsync m_dmaBufFence;
 	struct tpg_data m_tpg;
 
 	QScrollArea *m_scrollArea;
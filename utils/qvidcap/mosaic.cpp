@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#include <cmath>
+
+#include "mosaic.h"
+
+// The tiles are laid out in the squarest grid that fits them all
+static unsigned mosaicCols(unsigned tiles)
+{
+	return std::ceil(std::sqrt((double)tiles));
+}
+
+static unsigned mosaicRows(unsigned tiles)
+{
+	unsigned cols = mosaicCols(tiles);
+
+	return (tiles + cols - 1) / cols;
+}
+
+void Mosaic::initTPG(struct tpg_data *tpg, const cv4l_fmt &fmt)
+{
+	tpg_init(tpg, fmt.g_width(), fmt.g_frame_height());
+	tpg->colors_ops = &tpg_colors_cache_ops;
+	tpg_s_fourcc(tpg, fmt.g_pixelformat());
+	tpg_reset_source(tpg, fmt.g_width(), fmt.g_frame_height(), fmt.g_field());
+}
+
+/*
+ * The atlas is rendered as a single frame of the tile format, so each line
+ * of a tile plane must be a whole number of bytes and lines, and the fields
+ * of a tile must interleave with those of the other tiles. The frames must
+ * also be large enough to hold all planes.
+ */
+bool Mosaic::supported(const cv4l_fmt &fmt)
+{
+	struct tpg_data tpg;
+	unsigned size = 0;
+
+	switch (fmt.g_field()) {
+	case V4L2_FIELD_NONE:
+	case V4L2_FIELD_INTERLACED:
+	case V4L2_FIELD_INTERLACED_TB:
+	case V4L2_FIELD_INTERLACED_BT:
+		break;
+	default:
+		return false;
+	}
+
+	tpg_init(&tpg, fmt.g_width(), fmt.g_frame_height());
+	if (!tpg_s_fourcc(&tpg, fmt.g_pixelformat()) ||
+	    fmt.g_num_planes() != tpg_g_buffers(&tpg))
+		return false;
+	tpg_reset_source(&tpg, fmt.g_width(), fmt.g_frame_height(), fmt.g_field());
+	for (unsigned p = 0; p < fmt.g_num_planes(); p++)
+		tpg_s_bytesperline(&tpg, p, fmt.g_bytesperline(p));
+	for (unsigned p = 0; p < tpg_g_planes(&tpg); p++) {
+		if ((fmt.g_width() * tpg.twopixelsize[p]) % (2 * tpg.hdownsampling[p]) ||
+		    fmt.g_frame_height() % tpg.vdownsampling[p])
+			return false;
+		if (tpg_g_buffers(&tpg) > 1 &&
+		    fmt.g_sizeimage(p) < tpg_calc_plane_size(&tpg, p))
+			return false;
+		size += tpg_calc_plane_size(&tpg, p);
+	}
+	return tpg_g_buffers(&tpg) > 1 || fmt.g_sizeimage(0) >= size;
+}
+
+cv4l_fmt Mosaic::atlasFormat(const cv4l_fmt &fmt, unsigned tiles)
+{
+	struct tpg_data tpg;
+	cv4l_fmt atlas = fmt;
+
+	atlas.s_width(fmt.g_width() * mosaicCols(tiles));
+	atlas.s_frame_height(fmt.g_frame_height() * mosaicRows(tiles));
+
+	// The same layout the renderer computes for a frame of this size
+	initTPG(&tpg, atlas);
+	atlas.s_num_planes(tpg_g_buffers(&tpg));
+	for (unsigned p = 0; p < atlas.g_num_planes(); p++) {
+		atlas.s_bytesperline(tpg_g_bytesperline(&tpg, p), p);
+		atlas.s_sizeimage(tpg_calc_plane_size(&tpg, p), p);
+	}
+	if (tpg_g_buffers(&tpg) == 1) {
+		unsigned size = 0;
+
+		for (unsigned p = 0; p < tpg_g_planes(&tpg); p++)
+			size += tpg_calc_plane_size(&tpg, p);
+		atlas.s_sizeimage(size, 0);
+	}
+	return atlas;
+}
+
+Mosaic::Mosaic(const cv4l_fmt &fmt, unsigned tiles) :
+	m_tileFmt(fmt),
+	m_fmt(atlasFormat(fmt, tiles)),
+	m_tiles(tiles),
+	m_cols(mosaicCols(tiles)),
+	m_rows(mosaicRows(tiles))
+{
+	initTPG(&m_tileTPG, m_tileFmt);
+	for (unsigned p = 0; p < m_tileFmt.g_num_planes(); p++)
+		tpg_s_bytesperline(&m_tileTPG, p, m_tileFmt.g_bytesperline(p));
+	initTPG(&m_tpg, m_fmt);
+
+	memset(m_data, 0, sizeof(m_data));
+	for (unsigned p = 0; p < m_fmt.g_num_planes(); p++)
+		m_data[p] = new __u8[m_fmt.g_sizeimage(p)];
+
+	struct tpg_data tpg;
+
+	initTPG(&tpg, m_fmt);
+	tpg_alloc(&tpg, m_fmt.g_width());
+	tpg_s_fourcc(&tpg, m_fmt.g_pixelformat());
+	tpg_s_colorspace(&tpg, m_fmt.g_colorspace());
+	tpg_s_xfer_func(&tpg, m_fmt.g_xfer_func());
+	tpg_s_ycbcr_enc(&tpg, m_fmt.g_ycbcr_enc());
+	tpg_s_quantization(&tpg, m_fmt.g_quantization());
+	tpg_s_pattern(&tpg, TPG_PAT_BLACK);
+	for (unsigned p = 0; p < m_fmt.g_num_planes(); p++)
+		tpg_fillbuffer(&tpg, 0, p, m_data[p]);
+	tpg_free(&tpg);
+}
+
+Mosaic::~Mosaic()
+{
+	for (unsigned p = 0; p < VIDEO_MAX_PLANES; p++)
+		delete [] m_data[p];
+}
+
+// Copy the planes of a frame of the tile format into the given tile
+void Mosaic::copyTile(unsigned tile, __u8 * const data[])
+{
+	unsigned col = tile % m_cols;
+	unsigned row = tile / m_cols;
+	bool one_buffer = tpg_g_buffers(&m_tpg) == 1;
+	const __u8 *src = data[0];
+	__u8 *dst = m_data[0];
+
+	for (unsigned p = 0; p < tpg_g_planes(&m_tpg); p++) {
+		unsigned lines = m_tileTPG.buf_height / m_tileTPG.vdownsampling[p];
+		unsigned src_bpl = tpg_g_bytesperline(&m_tileTPG, p);
+		unsigned dst_bpl = tpg_g_bytesperline(&m_tpg, p);
+		unsigned line_size = m_tileFmt.g_width() * m_tpg.twopixelsize[p] /
+				     (2 * m_tpg.hdownsampling[p]);
+
+		if (!one_buffer) {
+			src = data[p];
+			dst = m_data[p];
+		}
+
+		__u8 *d = dst + row * lines * dst_bpl + col * line_size;
+
+		for (unsigned l = 0; l < lines; l++)
+			memcpy(d + l * dst_bpl, src + l * src_bpl, line_size);
+
+		// The next plane of a single buffer follows this one
+		src += lines * src_bpl;
+		dst += lines * m_rows * dst_bpl;
+	}
+}
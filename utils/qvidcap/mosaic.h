@@ -0,0 +1,49 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#ifndef MOSAIC_H
+#define MOSAIC_H
+
+#include "qvidcap.h"
+
+/*
+ * Lays out the frames of several streams with the same format as the
+ * tiles of one large frame of that format, the atlas. The renderer shows
+ * the atlas like any other frame, so the frames of all streams are
+ * uploaded together and drawn with a single draw call.
+ *
+ * Tiles that have not received a frame yet are black.
+ */
+class Mosaic
+{
+public:
+	Mosaic(const cv4l_fmt &fmt, unsigned tiles);
+	~Mosaic();
+
+	static bool supported(const cv4l_fmt &fmt);
+	static cv4l_fmt atlasFormat(const cv4l_fmt &fmt, unsigned tiles);
+
+	const cv4l_fmt &g_fmt() const { return m_fmt; }
+	const cv4l_fmt &g_tile_fmt() const { return m_tileFmt; }
+	unsigned g_tiles() const { return m_tiles; }
+	__u8 *g_data(unsigned plane) const { return m_data[plane]; }
+	unsigned g_size(unsigned plane) const { return m_fmt.g_sizeimage(plane); }
+	void copyTile(unsigned tile, __u8 * const data[]);
+
+private:
+	static void initTPG(struct tpg_data *tpg, const cv4l_fmt &fmt);
+
+	cv4l_fmt m_tileFmt;
+	cv4l_fmt m_fmt;
+	unsigned m_tiles;
+	unsigned m_cols;
+	unsigned m_rows;
+	// The plane layout of a tile and of the atlas
+	struct tpg_data m_tileTPG;
+	struct tpg_data m_tpg;
+	__u8 *m_data[VIDEO_MAX_PLANES];
+};
+
+#endif
@@ -8,6 +8,9 @@
  * Copyright 2018 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
  */
 
+#include <time.h>
+#include <vector>
+
 #include "capture.h"
 
 #include <QtCore/QTextStream>
@@ -24,10 +27,149 @@
 #include <QtCore/QSocketNotifier>
 #include <QtMath>
 #include <QTimer>
+#include <QElapsedTimer>
 #include <QApplication>
 
 #include "v4l2-info.h"
 
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifndef DRM_FORMAT_R8
+#define DRM_FORMAT_R8		v4l2_fourcc('R', '8', ' ', ' ')
+#endif
+#ifndef DRM_FORMAT_ABGR8888
+#define DRM_FORMAT_ABGR8888	v4l2_fourcc('A', 'B', '2', '4')
+#endif
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR	0ULL
+#endif
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static PFNEGLCREATEIMAGEKHRPROC egl_create_image;
+static PFNEGLDESTROYIMAGEKHRPROC egl_destroy_image;
+static void (*gl_image_target_texture)(GLenum target, void *image);
+static bool egl_import_modifiers;
+
+/*
+ * Importing DMABUFs needs an OpenGL context created through EGL, which is
+ * the case on Wayland or with QT_XCB_GL_INTEGRATION=xcb_egl, but not when
+ * Qt uses GLX.
+ */
+static bool initEGLImport(bool have_gl_ext)
+{
+	EGLDisplay dpy = eglGetCurrentDisplay();
+
+	if (dpy == EGL_NO_DISPLAY || !have_gl_ext)
+		return false;
+
+	const char *egl_exts = eglQueryString(dpy, EGL_EXTENSIONS);
+
+	if (!egl_exts)
+		return false;
+
+	QList<QByteArray> exts = QByteArray(egl_exts).split(' ');
+
+	if (!exts.contains("EGL_EXT_image_dma_buf_import"))
+		return false;
+	egl_import_modifiers = exts.contains("EGL_EXT_image_dma_buf_import_modifiers");
+	egl_create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+	egl_destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+	gl_image_target_texture = (void (*)(GLenum, void *))
+		eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	egl_display = dpy;
+	return egl_create_image && egl_destroy_image && gl_image_target_texture;
+}
+
+struct dmabuf_plane {
+	unsigned plane;
+	unsigned offset;
+	unsigned pitch;
+	unsigned width;
+	unsigned height;
+	__u32 fourcc;
+};
+
+/*
+ * Describe each texture of the shader of the format as a single plane
+ * EGL image with the same size and layout as the texture, so the shaders
+ * sample them exactly as the uploaded textures. Returns the number of
+ * textures, or 0 if the format cannot be imported.
+ */
+static unsigned dmaBufLayout(const cv4l_fmt &fmt, struct dmabuf_plane planes[])
+{
+	unsigned w = fmt.g_width();
+	unsigned h = fmt.g_height();
+	unsigned bpl = fmt.g_bytesperline();
+	unsigned offsetU = bpl * h;
+	unsigned offsetV = offsetU + (bpl / 2) * (h / 2);
+
+	memset(planes, 0, MAX_TEXTURES_NEEDED * sizeof(planes[0]));
+	planes[0] = { 0, 0, bpl, w, h, DRM_FORMAT_R8 };
+
+	switch (fmt.g_pixelformat()) {
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+	case V4L2_PIX_FMT_UYVY:
+	case V4L2_PIX_FMT_VYUY:
+		planes[0] = { 0, 0, bpl, w / 2, h, DRM_FORMAT_ABGR8888 };
+		return 1;
+
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+		planes[1] = { 0, offsetU, bpl, w, h / 2, DRM_FORMAT_R8 };
+		return 2;
+
+	case V4L2_PIX_FMT_NV12M:
+	case V4L2_PIX_FMT_NV21M:
+		planes[1] = { 1, 0, fmt.g_bytesperline(1), w, h / 2, DRM_FORMAT_R8 };
+		return 2;
+
+	case V4L2_PIX_FMT_YVU420:
+		std::swap(offsetU, offsetV);
+		/* fall through */
+	case V4L2_PIX_FMT_YUV420:
+		planes[1] = { 0, offsetU, bpl / 2, w / 2, h / 2, DRM_FORMAT_R8 };
+		planes[2] = { 0, offsetV, bpl / 2, w / 2, h / 2, DRM_FORMAT_R8 };
+		return 3;
+
+	case V4L2_PIX_FMT_YUV420M:
+		planes[1] = { 1, 0, fmt.g_bytesperline(1), w / 2, h / 2, DRM_FORMAT_R8 };
+		planes[2] = { 2, 0, fmt.g_bytesperline(2), w / 2, h / 2, DRM_FORMAT_R8 };
+		return 3;
+
+	case V4L2_PIX_FMT_YVU420M:
+		planes[1] = { 2, 0, fmt.g_bytesperline(2), w / 2, h / 2, DRM_FORMAT_R8 };
+		planes[2] = { 1, 0, fmt.g_bytesperline(1), w / 2, h / 2, DRM_FORMAT_R8 };
+		return 3;
+	}
+	return 0;
+}
+
+static EGLImageKHR createEGLImage(int fd, const struct dmabuf_plane &p)
+{
+	EGLint attrs[] = {
+		EGL_WIDTH, (EGLint)p.width,
+		EGL_HEIGHT, (EGLint)p.height,
+		EGL_LINUX_DRM_FOURCC_EXT, (EGLint)p.fourcc,
+		EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)p.offset,
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)p.pitch,
+		// V4L2 buffers are always linear
+		EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, (EGLint)(DRM_FORMAT_MOD_LINEAR & 0xffffffff),
+		EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, (EGLint)(DRM_FORMAT_MOD_LINEAR >> 32),
+		EGL_NONE
+	};
+
+	// Drop the modifier if the implementation does not know about them
+	if (!egl_import_modifiers)
+		attrs[12] = EGL_NONE;
+	return egl_create_image(egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+				NULL, attrs);
+}
+#endif
+
 void CaptureWin::initializeGL()
 {
 	initializeOpenGLFunctions();
@@ -45,11 +187,29 @@ void CaptureWin::initializeGL()
 	glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
 	m_haveSwapBytes = glGetError() == GL_NO_ERROR;
 
+	// Persistently mapped pixel unpack buffers need GL_ARB_buffer_storage
+	m_havePBO = !context()->isOpenGLES() &&
+		context()->hasExtension("GL_ARB_buffer_storage") &&
+		(context()->format().version() >= qMakePair(3, 2) ||
+		 context()->hasExtension("GL_ARB_sync"));
+
 	if (m_verbose) {
 		printf("OpenGL %sdoes%s support GL_UNPACK_SWAP_BYTES\n",
 		       context()->isOpenGLES() ? "ES " : "",
 		       m_haveSwapBytes ? "" : " not");
+		printf("OpenGL %sdoes%s support persistently mapped pixel buffers\n",
+		       context()->isOpenGLES() ? "ES " : "",
+		       m_havePBO ? "" : " not");
 	}
+
+#ifdef HAVE_EGL
+	m_haveEGLImport = m_dmaBufExported &&
+		initEGLImport(context()->hasExtension("GL_OES_EGL_image"));
+	if (m_verbose && m_dmaBufExported)
+		printf("OpenGL %sdoes%s support importing DMABUFs\n",
+		       context()->isOpenGLES() ? "ES " : "",
+		       m_haveEGLImport ? "" : " not");
+#endif
 	if (m_uses_gl_red && glGetString(GL_VERSION)[0] < '3') {
 		fprintf(stderr, "The openGL implementation does not support GL_RED/GL_RG\n");
 		std::exit(EXIT_FAILURE);
@@ -78,6 +238,13 @@ void CaptureWin::paintGL()
 
 		cv4l_buffer buf(*m_v4l_queue, m_curIndex);
 
+		// The GPU must be done sampling the buffer before it is requeued
+		if (m_dmaBufFence) {
+			glClientWaitSync(m_dmaBufFence, GL_SYNC_FLUSH_COMMANDS_BIT,
+					 1000000000ULL);
+			glDeleteSync(m_dmaBufFence);
+			m_dmaBufFence = 0;
+		}
 		m_fd->qbuf(buf);
 		for (unsigned i = 0; i < m_v4l_queue->g_num_planes(); i++) {
 			m_curData[i] = m_nextData[i];
@@ -116,138 +283,155 @@ void CaptureWin::paintGL()
 	if (!supportedFmt(m_v4l_fmt.g_pixelformat()))
 		return;
 
-	switch (m_v4l_fmt.g_pixelformat()) {
-	case V4L2_PIX_FMT_YUYV:
-	case V4L2_PIX_FMT_YVYU:
-	case V4L2_PIX_FMT_UYVY:
-	case V4L2_PIX_FMT_VYUY:
-		render_YUY2(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_NV16:
-	case V4L2_PIX_FMT_NV61:
-	case V4L2_PIX_FMT_NV16M:
-	case V4L2_PIX_FMT_NV61M:
-		render_NV16(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_NV12:
-	case V4L2_PIX_FMT_NV21:
-	case V4L2_PIX_FMT_NV12M:
-	case V4L2_PIX_FMT_NV21M:
-		render_NV12(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_NV24:
-	case V4L2_PIX_FMT_NV42:
-		render_NV24(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_YUV422P:
-	case V4L2_PIX_FMT_YUV420:
-	case V4L2_PIX_FMT_YVU420:
-	case V4L2_PIX_FMT_YUV420M:
-	case V4L2_PIX_FMT_YVU420M:
-	case V4L2_PIX_FMT_YUV422M:
-	case V4L2_PIX_FMT_YVU422M:
-	case V4L2_PIX_FMT_YUV444M:
-	case V4L2_PIX_FMT_YVU444M:
-		render_YUV(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_YUV444:
-	case V4L2_PIX_FMT_YUV555:
-	case V4L2_PIX_FMT_YUV565:
-	case V4L2_PIX_FMT_YUV32:
-	case V4L2_PIX_FMT_AYUV32:
-	case V4L2_PIX_FMT_XYUV32:
-	case V4L2_PIX_FMT_VUYA32:
-	case V4L2_PIX_FMT_VUYX32:
-	case V4L2_PIX_FMT_YUVA32:
-	case V4L2_PIX_FMT_YUVX32:
-		render_YUV_packed(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_SBGGR8:
-	case V4L2_PIX_FMT_SGBRG8:
-	case V4L2_PIX_FMT_SGRBG8:
-	case V4L2_PIX_FMT_SRGGB8:
-	case V4L2_PIX_FMT_SBGGR10:
-	case V4L2_PIX_FMT_SGBRG10:
-	case V4L2_PIX_FMT_SGRBG10:
-	case V4L2_PIX_FMT_SRGGB10:
-	case V4L2_PIX_FMT_SBGGR12:
-	case V4L2_PIX_FMT_SGBRG12:
-	case V4L2_PIX_FMT_SGRBG12:
-	case V4L2_PIX_FMT_SRGGB12:
-	case V4L2_PIX_FMT_SBGGR16:
-	case V4L2_PIX_FMT_SGBRG16:
-	case V4L2_PIX_FMT_SGRBG16:
-	case V4L2_PIX_FMT_SRGGB16:
-		render_Bayer(m_v4l_fmt.g_pixelformat());
-		break;
-
-	case V4L2_PIX_FMT_GREY:
-	case V4L2_PIX_FMT_Y10:
-	case V4L2_PIX_FMT_Y12:
-	case V4L2_PIX_FMT_Y16:
-	case V4L2_PIX_FMT_Y16_BE:
-	case V4L2_PIX_FMT_Z16:
-	case V4L2_PIX_FMT_RGB332:
-	case V4L2_PIX_FMT_BGR666:
-	case V4L2_PIX_FMT_RGB555:
-	case V4L2_PIX_FMT_XRGB555:
-	case V4L2_PIX_FMT_ARGB555:
-	case V4L2_PIX_FMT_RGB555X:
-	case V4L2_PIX_FMT_XRGB555X:
-	case V4L2_PIX_FMT_ARGB555X:
-	case V4L2_PIX_FMT_RGBX555:
-	case V4L2_PIX_FMT_RGBA555:
-	case V4L2_PIX_FMT_XBGR555:
-	case V4L2_PIX_FMT_ABGR555:
-	case V4L2_PIX_FMT_BGRX555:
-	case V4L2_PIX_FMT_BGRA555:
-	case V4L2_PIX_FMT_RGB444:
-	case V4L2_PIX_FMT_XRGB444:
-	case V4L2_PIX_FMT_ARGB444:
-	case V4L2_PIX_FMT_XBGR444:
-	case V4L2_PIX_FMT_ABGR444:
-	case V4L2_PIX_FMT_RGBX444:
-	case V4L2_PIX_FMT_RGBA444:
-	case V4L2_PIX_FMT_BGRX444:
-	case V4L2_PIX_FMT_BGRA444:
-	case V4L2_PIX_FMT_RGB565:
-	case V4L2_PIX_FMT_RGB565X:
-	case V4L2_PIX_FMT_RGB24:
-	case V4L2_PIX_FMT_BGR24:
-	case V4L2_PIX_FMT_RGB32:
-	case V4L2_PIX_FMT_BGR32:
-	case V4L2_PIX_FMT_XRGB32:
-	case V4L2_PIX_FMT_XBGR32:
-	case V4L2_PIX_FMT_ARGB32:
-	case V4L2_PIX_FMT_ABGR32:
-	case V4L2_PIX_FMT_RGBX32:
-	case V4L2_PIX_FMT_BGRX32:
-	case V4L2_PIX_FMT_RGBA32:
-	case V4L2_PIX_FMT_BGRA32:
-	case V4L2_PIX_FMT_HSV24:
-	case V4L2_PIX_FMT_HSV32:
-	default:
-		render_RGB(m_v4l_fmt.g_pixelformat());
-		break;
+	bool timing = m_reportTimings || m_overlay || m_timingLog;
+	QElapsedTimer upload;
+
+	if (timing)
+		upload.start();
+
+	bool useDmaBuf = m_dmaBufFmt && bindDmaBuf();
+	__u8 *saved[MAX_TEXTURES_NEEDED];
+	bool usePBO = !useDmaBuf && bindPBO(saved);
+
+	if (!useDmaBuf) {
+		switch (m_v4l_fmt.g_pixelformat()) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_YVYU:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_VYUY:
+			render_YUY2(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV61:
+		case V4L2_PIX_FMT_NV16M:
+		case V4L2_PIX_FMT_NV61M:
+			render_NV16(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_NV12M:
+		case V4L2_PIX_FMT_NV21M:
+			render_NV12(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_NV24:
+		case V4L2_PIX_FMT_NV42:
+			render_NV24(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_YUV422P:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_YUV420M:
+		case V4L2_PIX_FMT_YVU420M:
+		case V4L2_PIX_FMT_YUV422M:
+		case V4L2_PIX_FMT_YVU422M:
+		case V4L2_PIX_FMT_YUV444M:
+		case V4L2_PIX_FMT_YVU444M:
+			render_YUV(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_YUV444:
+		case V4L2_PIX_FMT_YUV555:
+		case V4L2_PIX_FMT_YUV565:
+		case V4L2_PIX_FMT_YUV32:
+		case V4L2_PIX_FMT_AYUV32:
+		case V4L2_PIX_FMT_XYUV32:
+		case V4L2_PIX_FMT_VUYA32:
+		case V4L2_PIX_FMT_VUYX32:
+		case V4L2_PIX_FMT_YUVA32:
+		case V4L2_PIX_FMT_YUVX32:
+			render_YUV_packed(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_SBGGR8:
+		case V4L2_PIX_FMT_SGBRG8:
+		case V4L2_PIX_FMT_SGRBG8:
+		case V4L2_PIX_FMT_SRGGB8:
+		case V4L2_PIX_FMT_SBGGR10:
+		case V4L2_PIX_FMT_SGBRG10:
+		case V4L2_PIX_FMT_SGRBG10:
+		case V4L2_PIX_FMT_SRGGB10:
+		case V4L2_PIX_FMT_SBGGR12:
+		case V4L2_PIX_FMT_SGBRG12:
+		case V4L2_PIX_FMT_SGRBG12:
+		case V4L2_PIX_FMT_SRGGB12:
+		case V4L2_PIX_FMT_SBGGR16:
+		case V4L2_PIX_FMT_SGBRG16:
+		case V4L2_PIX_FMT_SGRBG16:
+		case V4L2_PIX_FMT_SRGGB16:
+			render_Bayer(m_v4l_fmt.g_pixelformat());
+			break;
+
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_Y10:
+		case V4L2_PIX_FMT_Y12:
+		case V4L2_PIX_FMT_Y16:
+		case V4L2_PIX_FMT_Y16_BE:
+		case V4L2_PIX_FMT_Z16:
+		case V4L2_PIX_FMT_RGB332:
+		case V4L2_PIX_FMT_BGR666:
+		case V4L2_PIX_FMT_RGB555:
+		case V4L2_PIX_FMT_XRGB555:
+		case V4L2_PIX_FMT_ARGB555:
+		case V4L2_PIX_FMT_RGB555X:
+		case V4L2_PIX_FMT_XRGB555X:
+		case V4L2_PIX_FMT_ARGB555X:
+		case V4L2_PIX_FMT_RGBX555:
+		case V4L2_PIX_FMT_RGBA555:
+		case V4L2_PIX_FMT_XBGR555:
+		case V4L2_PIX_FMT_ABGR555:
+		case V4L2_PIX_FMT_BGRX555:
+		case V4L2_PIX_FMT_BGRA555:
+		case V4L2_PIX_FMT_RGB444:
+		case V4L2_PIX_FMT_XRGB444:
+		case V4L2_PIX_FMT_ARGB444:
+		case V4L2_PIX_FMT_XBGR444:
+		case V4L2_PIX_FMT_ABGR444:
+		case V4L2_PIX_FMT_RGBX444:
+		case V4L2_PIX_FMT_RGBA444:
+		case V4L2_PIX_FMT_BGRX444:
+		case V4L2_PIX_FMT_BGRA444:
+		case V4L2_PIX_FMT_RGB565:
+		case V4L2_PIX_FMT_RGB565X:
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+		case V4L2_PIX_FMT_RGB32:
+		case V4L2_PIX_FMT_BGR32:
+		case V4L2_PIX_FMT_XRGB32:
+		case V4L2_PIX_FMT_XBGR32:
+		case V4L2_PIX_FMT_ARGB32:
+		case V4L2_PIX_FMT_ABGR32:
+		case V4L2_PIX_FMT_RGBX32:
+		case V4L2_PIX_FMT_BGRX32:
+		case V4L2_PIX_FMT_RGBA32:
+		case V4L2_PIX_FMT_BGRA32:
+		case V4L2_PIX_FMT_HSV24:
+		case V4L2_PIX_FMT_HSV32:
+		default:
+			render_RGB(m_v4l_fmt.g_pixelformat());
+			break;
+		}
 	}
 
+	if (usePBO)
+		unbindPBO(saved);
+
+	// This is the CPU time of the upload, the GPU does the copy later
+	__u64 uploadNs = timing ? upload.nsecsElapsed() : 0;
 	static unsigned long long tot_t;
 	static unsigned cnt;
 	GLuint query;
 	QSize s = correctAspect(m_viewSize);
 	bool scale = m_scrollArea->widgetResizable();
+	int x = scale ? (size().width() - s.width()) / 2 : 0;
+	int y = scale ? (size().height() - s.height()) / 2 : 0;
 
-	glViewport(scale ? (size().width() - s.width()) / 2 : 0,
-		   scale ? (size().height() - s.height()) / 2 : 0,
-		   s.width(), s.height());
+	glViewport(x, y, s.width(), s.height());
 
-	if (m_reportTimings) {
+	if (timing) {
 		glGenQueries(1, &query);
 		glBeginQuery(GL_TIME_ELAPSED, query);
 	}
@@ -302,20 +486,284 @@ void CaptureWin::paintGL()
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glDeleteBuffers(1, &vertexbuffer);
 
+	if (useDmaBuf)
+		m_dmaBufFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
 	checkError("paintGL");
 
-	if (m_reportTimings) {
+	GLuint t = 0;
+
+	if (timing) {
 		glEndQuery(GL_TIME_ELAPSED);
-		GLuint t;
 		glGetQueryObjectuiv(query, GL_QUERY_RESULT, &t);
 		glDeleteQueries(1, &query);
+	}
 
+	if (m_reportTimings) {
 		cnt++;
 		tot_t += t;
 		unsigned ave = tot_t / cnt;
 		printf("Average render time: %09u ns, frame %d render time: %09u ns\n",
 		       ave, cnt, t);
 	}
+
+	if (m_overlay || m_timingLog)
+		showTiming(x, y, s, uploadNs, t);
+}
+
+/*
+ * Read back the timecode of a source that stamps one into its frames, see
+ * tpg_gen_timecode(). The image is drawn at x, y with size s. This waits
+ * for the GPU to finish drawing.
+ */
+bool CaptureWin::readTimecode(int x, int y, const QSize &s, __u64 &us)
+{
+	unsigned w = m_v4l_fmt.g_width();
+	unsigned h = m_v4l_fmt.g_frame_height();
+	__u8 cells[TPG_TIMECODE_CELLS];
+
+	if (w < TPG_TIMECODE_WIDTH || h < 16 ||
+	    x < 0 || x + s.width() > width())
+		return false;
+
+	// The middle line of the cells, OpenGL counts lines from the bottom
+	int line = y + s.height() - 1 - (8 * s.height()) / h;
+
+	if (line < 0 || line >= height())
+		return false;
+
+	std::vector<GLubyte> pixels(s.width() * 4);
+
+	glReadPixels(x, line, s.width(), 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	// Both colors of the cells are grey, so green is their brightness
+	for (unsigned i = 0; i < TPG_TIMECODE_CELLS; i++)
+		cells[i] = pixels[((i * 8 + 4) * s.width() / w) * 4 + 1];
+	return tpg_decode_timecode(cells, &us);
+}
+
+static QString nsToMs(double ns)
+{
+	return QString::number(ns / 1000000.0, 'f', 2) + " ms";
+}
+
+/*
+ * Show how long the steps of getting the current frame on screen took, and
+ * log them. A receive or decode time of 0 means that the step does not
+ * apply. The latency is from the time stamped in the frame to now, which is
+ * only meaningful if the clock of the source is synchronized with ours.
+ */
+void CaptureWin::showTiming(int x, int y, const QSize &s, __u64 uploadNs, __u64 renderNs)
+{
+	__u64 code;
+	bool haveLatency = readTimecode(x, y, s, code);
+	__s64 latencyUs = 0;
+
+	if (haveLatency) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		__u64 now = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+		unsigned shift = 64 - TPG_TIMECODE_BITS;
+
+		// The timecode wraps, and a clock that is a bit ahead gives < 0
+		latencyUs = (__s64)((now - code) << shift) >> shift;
+	}
+
+	if (m_timingLog) {
+		fprintf(m_timingLog, "%u,%llu,%llu,%llu,%llu,", m_frame,
+			m_receiveNs / 1000, m_decodeNs / 1000,
+			uploadNs / 1000, renderNs / 1000ULL);
+		if (haveLatency)
+			fprintf(m_timingLog, "%lld", latencyUs);
+		fprintf(m_timingLog, "\n");
+	}
+
+	if (!m_overlay)
+		return;
+
+	QString text = QString("Frame: %1").arg(m_frame);
+
+	if (m_receiveNs)
+		text += "\nReceive: " + nsToMs(m_receiveNs);
+	if (m_decodeNs)
+		text += "\nDecode: " + nsToMs(m_decodeNs);
+	text += "\nUpload: " + nsToMs(uploadNs);
+	text += "\nRender: " + nsToMs(renderNs);
+	if (haveLatency)
+		text += "\nLatency: " + nsToMs(latencyUs * 1000.0);
+
+	// Keep the top-left corner clear, that is where the timecode is
+	QPainter painter(this);
+	QRect area = visibleRegion().boundingRect().adjusted(8, 8, -8, -8);
+	QRect r = painter.boundingRect(area, Qt::AlignLeft | Qt::AlignBottom, text);
+
+	painter.fillRect(r.adjusted(-4, -4, 4, 4), QColor(0, 0, 0, 160));
+	painter.setPen(Qt::white);
+	painter.drawText(r, Qt::AlignLeft | Qt::AlignBottom, text);
+	painter.end();
+	// The painter leaves no shader program bound
+	m_program->bind();
+}
+
+// Each plane starts at a multiple of this in the pixel unpack buffers
+#define PBO_ALIGN 64
+
+void CaptureWin::createPBOs(unsigned size)
+{
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+		GL_MAP_COHERENT_BIT;
+
+	glGenBuffers(PBO_RING, m_pbo);
+	for (unsigned i = 0; i < PBO_RING; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, NULL, flags);
+		m_pboPtr[i] = (__u8 *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+		m_pboFence[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	m_pboSize = size;
+	m_pboIdx = 0;
+
+	for (unsigned i = 0; i < PBO_RING; i++) {
+		if (m_pboPtr[i])
+			continue;
+		fprintf(stderr, "Cannot map the pixel buffers, uploading from memory\n");
+		deletePBOs();
+		m_havePBO = false;
+		break;
+	}
+	checkError("createPBOs");
+}
+
+void CaptureWin::deletePBOs()
+{
+	if (!m_pboSize)
+		return;
+
+	for (unsigned i = 0; i < PBO_RING; i++) {
+		if (m_pboFence[i])
+			glDeleteSync(m_pboFence[i]);
+		if (!m_pboPtr[i])
+			continue;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glDeleteBuffers(PBO_RING, m_pbo);
+	m_pboSize = 0;
+}
+
+/*
+ * Copy the frame into the next buffer of the ring and bind it as the pixel
+ * unpack buffer, so the texture uploads of the render functions are done
+ * by the GPU without blocking on a copy from client memory. A fence keeps
+ * a buffer from being overwritten until the GPU is done with it.
+ *
+ * m_curData is replaced by the offsets of the planes in the buffer, which
+ * unbindPBO() reverts. The first plane does not start at offset 0, as the
+ * render functions check m_curData[0] for NULL.
+ */
+bool CaptureWin::bindPBO(__u8 *saved[])
+{
+	unsigned planes = m_v4l_fmt.g_num_planes();
+	unsigned offset[MAX_TEXTURES_NEEDED];
+	unsigned size = PBO_ALIGN;
+
+	if (!m_havePBO)
+		return false;
+
+	for (unsigned p = 0; p < planes && p < MAX_TEXTURES_NEEDED; p++) {
+		unsigned plane_size = qMax(m_curSize[p], m_v4l_fmt.g_sizeimage(p));
+
+		offset[p] = size;
+		size += (plane_size + PBO_ALIGN - 1) & ~(PBO_ALIGN - 1);
+	}
+
+	if (size != m_pboSize) {
+		deletePBOs();
+		createPBOs(size);
+		if (!m_havePBO)
+			return false;
+	}
+
+	unsigned idx = m_pboIdx;
+
+	m_pboIdx = (m_pboIdx + 1) % PBO_RING;
+	if (m_pboFence[idx]) {
+		glClientWaitSync(m_pboFence[idx], GL_SYNC_FLUSH_COMMANDS_BIT,
+				 1000000000ULL);
+		glDeleteSync(m_pboFence[idx]);
+		m_pboFence[idx] = 0;
+	}
+
+	for (unsigned p = 0; p < planes && p < MAX_TEXTURES_NEEDED; p++) {
+		if (m_curData[p])
+			memcpy(m_pboPtr[idx] + offset[p], m_curData[p], m_curSize[p]);
+		saved[p] = m_curData[p];
+		m_curData[p] = reinterpret_cast<__u8 *>(static_cast<uintptr_t>(offset[p]));
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[idx]);
+	return true;
+}
+
+void CaptureWin::unbindPBO(__u8 *saved[])
+{
+	unsigned planes = m_v4l_fmt.g_num_planes();
+	unsigned idx = (m_pboIdx + PBO_RING - 1) % PBO_RING;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	for (unsigned p = 0; p < planes && p < MAX_TEXTURES_NEEDED; p++)
+		m_curData[p] = saved[p];
+	m_pboFence[idx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	checkError("unbindPBO");
+}
+
+/*
+ * Attach the EGL images of the planes of the current buffer to the
+ * textures, so the shader samples the captured frame without a copy.
+ * The images are created the first time a buffer is shown. If that
+ * fails, the textures are recreated and the frames are uploaded instead.
+ */
+bool CaptureWin::bindDmaBuf()
+{
+#ifdef HAVE_EGL
+	struct dmabuf_plane planes[MAX_TEXTURES_NEEDED];
+	unsigned cnt = dmaBufLayout(m_v4l_fmt, planes);
+	void **images = m_eglImage[m_curIndex];
+
+	for (unsigned i = 0; i < cnt; i++) {
+		if (!images[i])
+			images[i] = createEGLImage(m_v4l_queue->g_fd(m_curIndex, planes[i].plane),
+						   planes[i]);
+		if (images[i] == EGL_NO_IMAGE_KHR) {
+			fprintf(stderr, "Cannot import the DMABUF, uploading from memory\n");
+			m_haveEGLImport = false;
+			changeShader();
+			return false;
+		}
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, m_screenTexture[i]);
+		gl_image_target_texture(GL_TEXTURE_2D, images[i]);
+	}
+	checkError("bindDmaBuf");
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CaptureWin::deleteEGLImages()
+{
+#ifdef HAVE_EGL
+	for (unsigned b = 0; b < VIDEO_MAX_FRAME; b++) {
+		for (unsigned p = 0; p < MAX_TEXTURES_NEEDED; p++) {
+			if (m_eglImage[b][p])
+				egl_destroy_image(egl_display, m_eglImage[b][p]);
+			m_eglImage[b][p] = 0;
+		}
+	}
+#endif
 }
 
 static const char *prog =
@@ -478,6 +926,17 @@ void CaptureWin::changeShader()
 {
 	if (m_screenTextureCount)
 		glDeleteTextures(m_screenTextureCount, m_screenTexture);
+	deleteEGLImages();
+#ifdef HAVE_EGL
+	struct dmabuf_plane planes[MAX_TEXTURES_NEEDED];
+	unsigned cnt = m_haveEGLImport ? dmaBufLayout(m_v4l_fmt, planes) : 0;
+
+	// An overridden pixel format may need more planes than the buffers have
+	m_dmaBufFmt = m_mode == AppModeV4L2 && cnt;
+	for (unsigned i = 0; i < cnt; i++)
+		if (planes[i].plane >= m_v4l_queue->g_num_planes())
+			m_dmaBufFmt = false;
+#endif
 	m_program->removeAllShaders();
 	checkError("Render settings.\n");
 
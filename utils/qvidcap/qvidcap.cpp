@@ -6,15 +6,24 @@
  */
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <map>
 
 #include <QApplication>
 #include <QScrollArea>
+#include <QMutex>
+#include <QScreen>
 #include <QtMath>
 
 #include "qvidcap.h"
 #include "capture.h"
+#include "mosaic.h"
 
 #include <libv4lconvert.h>
 #include "v4l-stream.h"
@@ -29,9 +38,18 @@ static void usage()
 	       "  -f, --file=<file>        read from the file <file> for the raw frame data\n"
 	       "  -p, --port[=<port>]      listen for a network connection on the given port\n"
 	       "                           The default port is %d\n"
+	       "                           If given more than once, then show the streams of\n"
+	       "                           all ports as a mosaic. All streams must have the\n"
+	       "                           format of the first stream.\n"
+	       "  -u, --udp[=<port>]       receive the UDP stream on the given port\n"
+	       "                           The default port is %d\n"
+	       "  --multicast=<group>      join the multicast group <group> (implies --udp)\n"
+	       "  -L, --local=<socket>     listen for a connection from the same host on the\n"
+	       "                           unix socket <socket>, the frames are received\n"
+	       "                           through shared memory (v4l2-ctl --stream-to-local)\n"
 	       "  -T, --tpg                use the test pattern generator\n"
 	       "\n"
-	       "  If neither -d, -f, -p nor -T is specified then use /dev/video0.\n"
+	       "  If neither -d, -f, -p, -u, -L nor -T is specified then use /dev/video0.\n"
 	       "\n"
 	       "  -c, --count=<cnt>        stop after <cnt> captured frames\n"
 	       "  -b, --buffers=<bufs>     request <bufs> buffers (default 4) when streaming\n"
@@ -62,11 +80,18 @@ static void usage()
 	       "  -l, --list-formats       display all supported formats\n"
 	       "  -h, --help               display this help message\n"
 	       "  -t, --timings            report frame render timings\n"
+	       "  --overlay                show the receive, decode, upload and render time\n"
+	       "                           of each frame on top of the video. If the source\n"
+	       "                           stamps a timecode into the frame (see --timecode),\n"
+	       "                           then also show the latency. Toggle with the T key.\n"
+	       "  --timing-log=<file>      write the timings of each frame to <file> as CSV\n"
 	       "  -v, --verbose            be more verbose\n"
 	       "  -R, --raw                open device in raw mode\n"
 	       "\n"
 	       "  --opengl                 force openGL to display the video\n"
 	       "  --opengles               force openGL ES to display the video\n"
+	       "  --no-dmabuf              always copy the frames of a video device to the\n"
+	       "                           GPU instead of importing the buffers as DMABUFs\n"
 	       "\n"
 	       "  The following options are ignored when capturing from a video device:\n"
 	       "\n"
@@ -101,6 +126,8 @@ static void usage()
 	       "  --vert-speed=<speed>     choose speed for vertical movement, the default is 0\n"
 	       "                           and the range is [-3...3]\n"
 	       "  --perc-fill=<percentage> percentage of the frame to actually fill. the default is 100%%\n"
+	       "  --timecode               stamp the wall clock time into the top-left corner of\n"
+	       "                           each frame, for use with --overlay\n"
 	       "\n"
 	       "  These options use the test pattern generator to test the OpenGL backend:\n"
 	       "\n"
@@ -113,7 +140,7 @@ static void usage()
 	       "                           0x08: mask iterating over transfer functions\n"
 	       "                           0x10: mask iterating over Y'CbCr/HSV encodings\n"
 	       "                           0x20: mask iterating over quantization ranges\n",
-		V4L_STREAM_PORT);
+		V4L_STREAM_PORT, V4L_STREAM_PORT);
 }
 
 static void usageError(const char *msg)
@@ -324,37 +351,9 @@ __u32 read_u32(int fd)
 	return ntohl(v);
 }
 
-int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
+// Reads the stream ID, the version and the format of a new connection
+static void readStreamHeader(int sock_fd, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 {
-	static int listen_fd = -1;
-	int sock_fd;
-	socklen_t clilen;
-	struct sockaddr_in serv_addr = {}, cli_addr;
-	int val = 1;
-
-	if (listen_fd < 0) {
-		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-		if (listen_fd < 0) {
-			fprintf(stderr, "could not opening socket\n");
-			std::exit(EXIT_FAILURE);
-		}
-		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(int));
-
-		serv_addr.sin_family = AF_INET;
-		serv_addr.sin_addr.s_addr = INADDR_ANY;
-		serv_addr.sin_port = htons(port);
-		if (bind(listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-			fprintf(stderr, "could not bind: %s\n", strerror(errno));
-			std::exit(EXIT_FAILURE);
-		}
-	}
-	listen(listen_fd, 1);
-	clilen = sizeof(cli_addr);
-	sock_fd = accept(listen_fd, (struct sockaddr *)&cli_addr, &clilen);
-	if (sock_fd < 0) {
-		fprintf(stderr, "could not accept\n");
-		std::exit(EXIT_FAILURE);
-	}
 	if (read_u32(sock_fd) != V4L_STREAM_ID) {
 		fprintf(stderr, "unknown protocol ID\n");
 		std::exit(EXIT_FAILURE);
@@ -421,9 +420,214 @@ int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
 		fmt.s_sizeimage(read_u32(sock_fd), i);
 		fmt.s_bytesperline(read_u32(sock_fd), i);
 	}
+}
+
+int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect)
+{
+	// The receivers of a mosaic each wait for a connection on their port
+	static QMutex listen_lock;
+	static std::map<int, int> listen_fds;
+	int listen_fd;
+	int sock_fd;
+	socklen_t clilen;
+	struct sockaddr_in serv_addr = {}, cli_addr;
+	int val = 1;
+
+	listen_lock.lock();
+	if (listen_fds.find(port) == listen_fds.end()) {
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (listen_fd < 0) {
+			fprintf(stderr, "could not opening socket\n");
+			std::exit(EXIT_FAILURE);
+		}
+		setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(int));
+
+		serv_addr.sin_family = AF_INET;
+		serv_addr.sin_addr.s_addr = INADDR_ANY;
+		serv_addr.sin_port = htons(port);
+		if (bind(listen_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+			fprintf(stderr, "could not bind: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		listen_fds[port] = listen_fd;
+	}
+	listen_fd = listen_fds[port];
+	listen_lock.unlock();
+	listen(listen_fd, 1);
+	clilen = sizeof(cli_addr);
+	sock_fd = accept(listen_fd, (struct sockaddr *)&cli_addr, &clilen);
+	if (sock_fd < 0) {
+		fprintf(stderr, "could not accept\n");
+		std::exit(EXIT_FAILURE);
+	}
+	readStreamHeader(sock_fd, fmt, pixelaspect);
+	return sock_fd;
+}
+
+/*
+ * Waits for a connection on the unix socket at path and maps the frame
+ * ring passed with the SHM_RING packet, see v4l-stream.h.
+ */
+int initLocalSocket(const char *path, cv4l_fmt &fmt, v4l2_fract &pixelaspect,
+		    struct ShmRing &shm)
+{
+	static int listen_fd = -1;
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	__u32 pkt[5];
+	struct iovec iov = { pkt, sizeof(pkt) };
+	struct msghdr msg = {};
+	struct cmsghdr *cm;
+	struct stat st;
+	unsigned frame_size = 0;
+	int fds[2] = { -1, -1 };
+	int sock_fd;
+	__u32 ack;
+	void *p;
+
+	if (listen_fd < 0) {
+		struct sockaddr_un addr = {};
+
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "socket path %s is too long\n", path);
+			std::exit(EXIT_FAILURE);
+		}
+		listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listen_fd < 0) {
+			fprintf(stderr, "could not opening socket\n");
+			std::exit(EXIT_FAILURE);
+		}
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, path);
+		// A socket left behind by an earlier run
+		unlink(path);
+		if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			fprintf(stderr, "could not bind: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		listen(listen_fd, 1);
+	}
+	sock_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (sock_fd < 0) {
+		fprintf(stderr, "could not accept\n");
+		std::exit(EXIT_FAILURE);
+	}
+	readStreamHeader(sock_fd, fmt, pixelaspect);
+
+	// The file descriptors come with the first byte of the packet
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	if (recvmsg(sock_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(pkt) ||
+	    ntohl(pkt[0]) != V4L_STREAM_PACKET_SHM_RING ||
+	    ntohl(pkt[2]) != V4L_STREAM_PACKET_SHM_RING_SIZE) {
+		fprintf(stderr, "expected SHM_RING\n");
+		std::exit(EXIT_FAILURE);
+	}
+	for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+		    cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+			memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+	}
+	shm.frames = ntohl(pkt[3]);
+	shm.frameSize = ntohl(pkt[4]);
+	shm.mapSize = V4L_STREAM_SHM_DATA_OFFSET + (size_t)shm.frames * shm.frameSize;
+	for (unsigned i = 0; i < fmt.g_num_planes(); i++)
+		frame_size += fmt.g_sizeimage(i);
+	if (fds[0] < 0 || fds[1] < 0 || !shm.frames ||
+	    shm.frames > V4L_STREAM_SHM_MAX_FRAMES || shm.frameSize < frame_size ||
+	    fstat(fds[0], &st) || (size_t)st.st_size < shm.mapSize) {
+		fprintf(stderr, "invalid SHM_RING\n");
+		std::exit(EXIT_FAILURE);
+	}
+	p = mmap(NULL, shm.mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "could not map the frame ring: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	::close(fds[0]);
+	shm.ring = (struct v4l_stream_shm_ring *)p;
+	shm.data = (const __u8 *)p + V4L_STREAM_SHM_DATA_OFFSET;
+	shm.eventFd = fds[1];
+
+	ack = htonl(V4L_STREAM_PACKET_SHM_RING);
+	if (write(sock_fd, &ack, sizeof(ack)) != sizeof(ack)) {
+		fprintf(stderr, "could not accept the frame ring\n");
+		std::exit(EXIT_FAILURE);
+	}
 	return sock_fd;
 }
 
+void freeShmRing(struct ShmRing &shm)
+{
+	if (!shm.ring)
+		return;
+	munmap(shm.ring, shm.mapSize);
+	::close(shm.eventFd);
+	shm.ring = NULL;
+	shm.data = NULL;
+}
+
+int initUdpSocket(int port, const char *group, cv4l_fmt &fmt, v4l2_fract &pixelaspect,
+		  struct v4l_stream_udp_rx *rx)
+{
+	static int sock_fd = -1;
+	struct sockaddr_in serv_addr = {};
+	static __u8 buf[V4L_STREAM_UDP_MAX_SIZE];
+	int val = 1;
+
+	if (sock_fd < 0) {
+		sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock_fd < 0) {
+			fprintf(stderr, "could not opening socket\n");
+			std::exit(EXIT_FAILURE);
+		}
+		setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(int));
+		/* room for a few frames, a too small buffer means lost datagrams */
+		val = 8 * 1024 * 1024;
+		setsockopt(sock_fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(int));
+
+		serv_addr.sin_family = AF_INET;
+		serv_addr.sin_addr.s_addr = INADDR_ANY;
+		serv_addr.sin_port = htons(port);
+		if (bind(sock_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+			fprintf(stderr, "could not bind: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		if (group) {
+			struct ip_mreq mreq = {};
+
+			if (!inet_aton(group, &mreq.imr_multiaddr)) {
+				fprintf(stderr, "invalid multicast group %s\n", group);
+				std::exit(EXIT_FAILURE);
+			}
+			mreq.imr_interface.s_addr = INADDR_ANY;
+			if (setsockopt(sock_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+				       &mreq, sizeof(mreq)) < 0) {
+				fprintf(stderr, "could not join %s: %s\n", group, strerror(errno));
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		v4l_stream_udp_rx_init(rx);
+	}
+	/* wait until the (next) format is received */
+	for (;;) {
+		ssize_t n = recv(sock_fd, buf, sizeof(buf), 0);
+		int ret;
+
+		if (n < 0) {
+			fprintf(stderr, "could not receive: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		do {
+			ret = v4l_stream_udp_rx_packet(rx, buf, n);
+			if ((ret & V4L_STREAM_UDP_RX_FMT) &&
+			    v4l_stream_udp_rx_fmt(rx, &fmt, &pixelaspect))
+				return sock_fd;
+		} while (ret & V4L_STREAM_UDP_RX_AGAIN);
+	}
+}
+
 int main(int argc, char **argv)
 {
 	QApplication disp(argc, argv);
@@ -442,8 +646,20 @@ int main(int argc, char **argv)
 	bool single_step = false;
 	unsigned single_step_start = 1;
 	int port = 0;
+	QList<int> ports;
+	bool mosaic = false;
+	cv4l_fmt tile_fmt;
+	QString multicast;
+	struct v4l_stream_udp_rx udp_rx;
+	bool udp = false;
+	QString local;
+	struct ShmRing shm = { };
 	bool info_option = false;
 	bool report_timings = false;
+	bool overlay = false;
+	QString timing_log;
+	bool timecode = false;
+	bool use_dmabuf = true;
 	bool verbose = false;
 	__u32 overridePixelFormat = 0;
 	__u32 overrideWidth = 0;
@@ -491,10 +707,32 @@ int main(int argc, char **argv)
 		} else if (isOption(args[i], "--port", "-p")) {
 			mode = AppModeSocket;
 			port = V4L_STREAM_PORT;
+			ports.append(port);
 		} else if (isOptArg(args[i], "--port", "-p")) {
 			if (!processOption(args, i, port))
 				return 0;
 			mode = AppModeSocket;
+			ports.append(port);
+		} else if (isOption(args[i], "--udp", "-u")) {
+			mode = AppModeSocket;
+			port = V4L_STREAM_PORT;
+			udp = true;
+		} else if (isOptArg(args[i], "--udp", "-u")) {
+			if (!processOption(args, i, port))
+				return 0;
+			mode = AppModeSocket;
+			udp = true;
+		} else if (isOptArg(args[i], "--multicast")) {
+			if (!processOption(args, i, multicast))
+				return 0;
+			mode = AppModeSocket;
+			if (!udp)
+				port = V4L_STREAM_PORT;
+			udp = true;
+		} else if (isOptArg(args[i], "--local", "-L")) {
+			if (!processOption(args, i, local))
+				return 0;
+			mode = AppModeSocket;
 		} else if (isOption(args[i], "--tpg", "-T")) {
 			mode = AppModeTPG;
 		} else if (isOptArg(args[i], "--test-mask")) {
@@ -642,10 +880,19 @@ int main(int argc, char **argv)
 			info_option = true;
 		} else if (isOption(args[i], "--timings", "-t")) {
 			report_timings = true;
+		} else if (isOption(args[i], "--overlay")) {
+			overlay = true;
+		} else if (isOptArg(args[i], "--timing-log")) {
+			if (!processOption(args, i, timing_log))
+				return 0;
+		} else if (isOption(args[i], "--timecode")) {
+			timecode = true;
 		} else if (isOptArg(args[i], "--opengles")) {
 			force_opengles = true;
 		} else if (isOptArg(args[i], "--opengl")) {
 			force_opengl = true;
+		} else if (isOptArg(args[i], "--no-dmabuf")) {
+			use_dmabuf = false;
 		} else if (isOption(args[i], "--verbose", "-v")) {
 			verbose = true;
 		} else if (isOption(args[i], "--raw", "-R")) {
@@ -671,6 +918,25 @@ int main(int argc, char **argv)
 	if (info_option)
 		return 0;
 
+	if (udp && !local.isEmpty()) {
+		fprintf(stderr, "--local cannot be combined with --udp\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (ports.size() > 1) {
+		if (udp || !local.isEmpty()) {
+			fprintf(stderr, "a mosaic cannot be combined with --udp or --local\n");
+			std::exit(EXIT_FAILURE);
+		}
+		for (int i = 1; i < ports.size(); i++) {
+			if (ports.indexOf(ports[i]) < i) {
+				fprintf(stderr, "port %d is given more than once\n", ports[i]);
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		port = ports.first();
+		mosaic = true;
+	}
+
 	if (mode == AppModeV4L2) {
 		fps = 0;
 		video_device = getDeviceName("/dev/video", video_device);
@@ -716,7 +982,13 @@ int main(int argc, char **argv)
 		pixelaspect = fd.g_pixel_aspect(tmp_w, tmp_h);
 	} else if (mode == AppModeSocket) {
 		fps = 0;
-		sock_fd = initSocket(port, fmt, pixelaspect);
+		if (!local.isEmpty())
+			sock_fd = initLocalSocket(local.toUtf8().data(), fmt, pixelaspect, shm);
+		else if (udp)
+			sock_fd = initUdpSocket(port, multicast.isEmpty() ? NULL : multicast.toUtf8().data(),
+						fmt, pixelaspect, &udp_rx);
+		else
+			sock_fd = initSocket(port, fmt, pixelaspect);
 	} else {
 		fmt.s_type(V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE);
 		fmt.s_num_planes(1);
@@ -759,6 +1031,20 @@ int main(int argc, char **argv)
 	win.setFps(fps);
 	win.setFormat(format);
 	win.setReportTimings(report_timings);
+	win.setOverlay(overlay);
+	win.setTimecode(timecode);
+	if (!timing_log.isEmpty()) {
+		FILE *log = fopen(timing_log.toUtf8().data(), "w");
+
+		if (!log) {
+			fprintf(stderr, "could not open %s: %s\n",
+				timing_log.toUtf8().data(), strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		fprintf(log, "frame,receive_us,decode_us,upload_us,render_us,latency_us\n");
+		win.setTimingLog(log);
+	}
+	win.setUseDmaBuf(use_dmabuf);
 	win.setCount(test ? test : cnt);
 	if (mode == AppModeTest) {
 		win.setModeTest(test);
@@ -783,13 +1069,32 @@ int main(int argc, char **argv)
 	win.setOverrideHSVEnc(overrideHSVEnc);
 	win.setOverrideXferFunc(overrideXferFunc);
 	win.setOverrideQuantization(overrideQuantization);
+	if (mosaic) {
+		if (!Mosaic::supported(fmt)) {
+			fprintf(stderr, "Unsupported mosaic format: '%s' %s, %s\n",
+				fcc2s(fmt.g_pixelformat()).c_str(),
+				pixfmt2s(fmt.g_pixelformat()).c_str(),
+				field2s(fmt.g_field()).c_str());
+			std::exit(EXIT_FAILURE);
+		}
+		tile_fmt = fmt;
+		fmt = Mosaic::atlasFormat(tile_fmt, ports.size());
+	}
 	while (!win.setV4LFormat(fmt)) {
 		fprintf(stderr, "Unsupported format: '%s' %s\n",
 			fcc2s(fmt.g_pixelformat()).c_str(),
 			pixfmt2s(fmt.g_pixelformat()).c_str());
-		if (mode != AppModeSocket)
+		if (mode != AppModeSocket || mosaic)
 			std::exit(EXIT_FAILURE);
-		sock_fd = initSocket(port, fmt, pixelaspect);
+		if (!local.isEmpty()) {
+			::close(sock_fd);
+			freeShmRing(shm);
+			sock_fd = initLocalSocket(local.toUtf8().data(), fmt, pixelaspect, shm);
+		} else if (udp)
+			sock_fd = initUdpSocket(port, multicast.isEmpty() ? NULL : multicast.toUtf8().data(),
+						fmt, pixelaspect, &udp_rx);
+		else
+			sock_fd = initSocket(port, fmt, pixelaspect);
 	}
 	win.setPixelAspect(pixelaspect);
 	win.setMinimumSize(16, 16);
@@ -802,11 +1107,22 @@ int main(int argc, char **argv)
 	sa->setAlignment(Qt::AlignVCenter | Qt::AlignHCenter);
 	sa->setWidget(win.window());
 	sa->setFrameShape(QFrame::NoFrame);
-	sa->resize(win.correctAspect(QSize(fmt.g_width(), fmt.g_frame_height())));
+
+	QSize size = win.correctAspect(QSize(fmt.g_width(), fmt.g_frame_height()));
+	QSize avail = disp.primaryScreen()->availableSize();
+
+	// A mosaic of many streams is usually larger than the screen
+	if (mosaic && (size.width() > avail.width() || size.height() > avail.height()))
+		size.scale(avail, Qt::KeepAspectRatio);
+	sa->resize(size);
 	sa->setWidgetResizable(true);
 
-	if (mode == AppModeSocket)
-		win.setModeSocket(sock_fd, port);
+	if (mosaic)
+		win.setModeMosaic(sock_fd, ports, tile_fmt);
+	else if (!local.isEmpty())
+		win.setModeLocal(sock_fd, local, shm);
+	else if (mode == AppModeSocket)
+		win.setModeSocket(sock_fd, port, udp ? &udp_rx : NULL);
 	else if (mode == AppModeV4L2) {
 		q.init(fd.g_type(), V4L2_MEMORY_MMAP);
 		q.reqbufs(&fd, v4l2_bufs);
@@ -819,6 +1135,7 @@ int main(int argc, char **argv)
 		struct tpg_data *tpg = win.getTPG();
 
 		tpg_init(tpg, fmt.g_width(), fmt.g_height());
+		tpg->colors_ops = &tpg_colors_cache_ops;
 		tpg_alloc(tpg, fmt.g_width());
 		tpg_s_pattern(tpg, (tpg_pattern)pattern);
 		tpg_s_mv_hor_mode(tpg, hor_mode);
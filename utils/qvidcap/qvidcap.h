@@ -14,7 +14,22 @@
 #include "cv4l-helpers.h"
 #include "capture.h"
 
+// The shared memory frame ring of a local stream, see v4l-stream.h
+struct ShmRing {
+	struct v4l_stream_shm_ring *ring;
+	const __u8 *data;
+	size_t mapSize;
+	unsigned frames;
+	unsigned frameSize;
+	int eventFd;
+};
+
 __u32 read_u32(int fd);
 int initSocket(int port, cv4l_fmt &fmt, v4l2_fract &pixelaspect);
+int initLocalSocket(const char *path, cv4l_fmt &fmt, v4l2_fract &pixelaspect,
+		    struct ShmRing &shm);
+void freeShmRing(struct ShmRing &shm);
+int initUdpSocket(int port, const char *group, cv4l_fmt &fmt, v4l2_fract &pixelaspect,
+		  struct v4l_stream_udp_rx *rx);
 
 #endif
@@ -30,21 +30,28 @@ PRE_TARGETDEPS += v4l2_convert_hook
 
 # Input
 HEADERS += capture.h
+HEADERS += mosaic.h
 HEADERS += qvidcap.h
+HEADERS += sock-receiver.h
 HEADERS += $$MESON_BUILD_PATH/config.h
 
 SOURCES += capture.cpp paint.cpp
+SOURCES += mosaic.cpp
 SOURCES += qvidcap.cpp
+SOURCES += sock-receiver.cpp
 SOURCES += ../common/v4l-stream.c
 SOURCES += ../common/codec-fwht.c
 SOURCES += ../common/codec-v4l2-fwht.c
 SOURCES += ../common/v4l2-info.cpp
 SOURCES += ../common/v4l2-tpg-core.c
+SOURCES += ../common/v4l2-tpg-cache.c
 SOURCES += ../common/v4l2-tpg-colors.c
 
 LIBS += -L$$MESON_BUILD_PATH/lib/libv4l2 -lv4l2
 LIBS += -L$$MESON_BUILD_PATH/lib/libv4lconvert -lv4lconvert
 LIBS += -L$$MESON_BUILD_PATH/utils/libv4l2util -lv4l2util
 LIBS += -lrt -ldl -ljpeg
+# DMABUF import: remove if config.h does not define HAVE_EGL
+LIBS += -lEGL
 
 RESOURCES += qvidcap.qrc
@@ -0,0 +1,492 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Copyright 2018 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ * Copyright (c) 2026 - agent
+ */
+
+#include <algorithm>
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <QMutexLocker>
+
+#include "sock-receiver.h"
+#include "capture.h"
+
+static __u64 monotonicNs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+SockReceiver::SockReceiver(CaptureWin *win, int sock, int port,
+			   struct v4l_stream_udp_rx *udp_rx, const cv4l_fmt &fmt) :
+	m_win(win),
+	m_sock(sock),
+	m_port(port),
+	m_udpRx(udp_rx),
+	m_fmt(fmt),
+	m_fmtOk(true),
+	m_fixedFmt(false),
+	m_ctx(0),
+	m_stop(false),
+	m_back(0),
+	m_pending(1),
+	m_front(2),
+	m_havePending(false),
+	m_havePrevious(false),
+	m_dropFrames(true),
+	m_seq(0)
+{
+	m_pixelaspect.numerator = 1;
+	m_pixelaspect.denominator = 1;
+	memset(&m_shm, 0, sizeof(m_shm));
+	memset(m_frames, 0, sizeof(m_frames));
+	allocFrames();
+}
+
+SockReceiver::~SockReceiver()
+{
+	freeFrames();
+	freeShmRing(m_shm);
+	if (m_ctx)
+		fwht_free(m_ctx);
+}
+
+/*
+ * Stop the thread. It cannot be interrupted while it waits for a new
+ * connection or for the renderer to apply a new format, so give up after
+ * a while: false is returned if the thread is still running.
+ */
+bool SockReceiver::stop()
+{
+	requestStop();
+	return wait(1000);
+}
+
+// Ask the thread to stop without waiting for it
+void SockReceiver::requestStop()
+{
+	m_lock.lock();
+	m_stop = true;
+	m_taken.wakeAll();
+	m_lock.unlock();
+	shutdown(m_sock, SHUT_RDWR);
+}
+
+void SockReceiver::allocFrames()
+{
+	QMutexLocker locker(&m_lock);
+
+	freeFrames();
+	for (unsigned i = 0; i < SOCK_FRAMES; i++) {
+		for (unsigned p = 0; p < m_fmt.g_num_planes(); p++) {
+			m_frames[i].size[p] = m_fmt.g_sizeimage(p);
+			m_frames[i].data[p] = new __u8[m_frames[i].size[p]];
+		}
+	}
+	m_havePending = false;
+	m_havePrevious = false;
+	allocCodec();
+}
+
+void SockReceiver::allocCodec()
+{
+	if (m_ctx)
+		fwht_free(m_ctx);
+	m_ctx = fwht_alloc(m_fmt.g_pixelformat(), m_fmt.g_width(), m_fmt.g_height(),
+			   m_fmt.g_width(), m_fmt.g_height(),
+			   m_fmt.g_field(), m_fmt.g_colorspace(), m_fmt.g_xfer_func(),
+			   m_fmt.g_ycbcr_enc(), m_fmt.g_quantization());
+	if (m_ctx)
+		m_ctx->flags |= FWHT_CTX_KEEP_DECODED;
+}
+
+void SockReceiver::freeFrames()
+{
+	for (unsigned i = 0; i < SOCK_FRAMES; i++) {
+		for (unsigned p = 0; p < VIDEO_MAX_PLANES; p++) {
+			delete [] m_frames[i].data[p];
+			m_frames[i].data[p] = NULL;
+			m_frames[i].size[p] = 0;
+		}
+	}
+}
+
+// Returns the latest decoded frame, or NULL if there is no new frame
+const SockFrame *SockReceiver::takeFrame()
+{
+	QMutexLocker locker(&m_lock);
+
+	if (!m_havePending)
+		return NULL;
+	std::swap(m_front, m_pending);
+	m_havePending = false;
+	m_taken.wakeAll();
+	return &m_frames[m_front];
+}
+
+void SockReceiver::publishFrame()
+{
+	QMutexLocker locker(&m_lock);
+
+	while (!m_dropFrames && m_havePending && !m_stop)
+		m_taken.wait(&m_lock);
+
+	bool notify = !m_havePending;
+
+	m_frames[m_back].seq = ++m_seq;
+	std::swap(m_back, m_pending);
+	m_havePending = true;
+	m_havePrevious = true;
+	locker.unlock();
+
+	// The renderer takes all frames published before it gets to run
+	if (notify)
+		QMetaObject::invokeMethod(m_win, "sockFrameEvent", Qt::QueuedConnection);
+}
+
+/*
+ * The renderer applies the new format and stops using the frames of the
+ * old format before the frames are reallocated. Returns false if the
+ * format is not supported.
+ */
+bool SockReceiver::newFormat(const cv4l_fmt &fmt, const v4l2_fract &pixelaspect)
+{
+	bool ok = false;
+
+	if (m_fixedFmt) {
+		ok = fmt.g_pixelformat() == m_fmt.g_pixelformat() &&
+		     fmt.g_width() == m_fmt.g_width() &&
+		     fmt.g_height() == m_fmt.g_height() &&
+		     fmt.g_field() == m_fmt.g_field() &&
+		     fmt.g_num_planes() == m_fmt.g_num_planes();
+		for (unsigned p = 0; ok && p < fmt.g_num_planes(); p++)
+			ok = fmt.g_bytesperline(p) == m_fmt.g_bytesperline(p) &&
+			     fmt.g_sizeimage(p) == m_fmt.g_sizeimage(p);
+		if (!ok)
+			fprintf(stderr, "port %d: the stream format differs from the other streams\n",
+				m_port);
+		m_fmtOk = ok;
+		// A new stream starts without FWHT reference frame
+		if (ok)
+			allocCodec();
+		return ok;
+	}
+
+	m_lock.lock();
+	m_havePending = false;
+	m_fmt = fmt;
+	m_pixelaspect = pixelaspect;
+	m_lock.unlock();
+
+	QMetaObject::invokeMethod(m_win, "sockNewFormat", Qt::BlockingQueuedConnection,
+				  Q_RETURN_ARG(bool, ok));
+	m_fmtOk = ok;
+	if (ok)
+		allocFrames();
+	return ok;
+}
+
+void SockReceiver::run()
+{
+	if (m_udpRx) {
+		udpRead();
+		return;
+	}
+
+	if (m_sock < 0)
+		listenForNewConnection();
+	while (!m_stop) {
+		bool ok = m_shm.ring ? shmRead() : readFrame();
+
+		if (!ok && !m_stop)
+			listenForNewConnection();
+	}
+}
+
+void SockReceiver::listenForNewConnection()
+{
+	cv4l_fmt fmt;
+	v4l2_fract pixelaspect = { 1, 1 };
+
+	::close(m_sock);
+	freeShmRing(m_shm);
+
+	for (;;) {
+		if (m_local.isEmpty())
+			m_sock = initSocket(m_port, fmt, pixelaspect);
+		else
+			m_sock = initLocalSocket(m_local.toUtf8().data(), fmt,
+						 pixelaspect, m_shm);
+		if (newFormat(fmt, pixelaspect))
+			break;
+		::close(m_sock);
+		freeShmRing(m_shm);
+	}
+}
+
+int SockReceiver::read_u32(__u32 &v)
+{
+	int n;
+
+	v = 0;
+	n = read(m_sock, &v, sizeof(v));
+	if (n != sizeof(v)) {
+		if (!m_stop)
+			fprintf(stderr, "could not read __u32\n");
+		return -1;
+	}
+	v = ntohl(v);
+	return 0;
+}
+
+// Returns false if a new connection has to be made
+bool SockReceiver::readFrame()
+{
+	SockFrame &frame = m_frames[m_back];
+	unsigned packet, sz;
+	bool is_fwht, is_fwht_ext;
+	__u64 start;
+	int n;
+
+	if (read_u32(packet))
+		return false;
+
+	// Waiting for the next frame does not count as receive time
+	start = monotonicNs();
+	frame.decodeNs = 0;
+
+	if (packet == V4L_STREAM_PACKET_END) {
+		fprintf(stderr, "END packet read\n");
+		return false;
+	}
+
+	if (read_u32(sz))
+		return false;
+
+	if (packet != V4L_STREAM_PACKET_FRAME_VIDEO_RLE &&
+	    packet != V4L_STREAM_PACKET_FRAME_VIDEO_FWHT &&
+	    packet != V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT) {
+		char buf[1024];
+
+		fprintf(stderr, "expected FRAME_VIDEO, got 0x%08x\n", packet);
+		while (sz) {
+			unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
+
+			n = read(m_sock, buf, rdsize);
+			if (n <= 0) {
+				fprintf(stderr, "error reading %d bytes\n", sz);
+				return false;
+			}
+			sz -= n;
+		}
+		return true;
+	}
+
+	is_fwht_ext = m_ctx && packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT;
+	is_fwht = is_fwht_ext || (m_ctx && packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT);
+
+	if (read_u32(sz))
+		return false;
+
+	if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR) {
+		fprintf(stderr, "unsupported FRAME_VIDEO size\n");
+		return false;
+	}
+	if (read_u32(sz) ||  // ignore field
+	    read_u32(sz))    // ignore flags
+		return false;
+
+	for (unsigned p = 0; p < m_fmt.g_num_planes(); p++) {
+		__u32 max_size = is_fwht ? m_ctx->comp_max_size : frame.size[p];
+		__u8 *dst = is_fwht ? m_ctx->state.compressed_frame : frame.data[p];
+		__u32 data_size;
+		__u32 offset;
+		__u32 size;
+
+		if (read_u32(sz))
+			return false;
+		if (sz != V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR) {
+			fprintf(stderr, "unsupported FRAME_VIDEO plane size\n");
+			return false;
+		}
+		if (read_u32(size) || read_u32(data_size))
+			return false;
+		offset = is_fwht ? 0 : size - data_size;
+		sz = data_size;
+
+		if (data_size > max_size) {
+			fprintf(stderr, "data size is too large (%u > %u)\n",
+				data_size, max_size);
+			return false;
+		}
+		while (sz) {
+			n = read(m_sock, dst + offset, sz);
+			if (n <= 0) {
+				if (!m_stop)
+					fprintf(stderr, "error reading %d bytes\n", sz);
+				return false;
+			}
+			if ((__u32)n == sz)
+				break;
+			offset += n;
+			sz -= n;
+		}
+
+		__u64 decode = monotonicNs();
+
+		if (is_fwht_ext)
+			fwht_decompress_ext(m_ctx, dst, data_size, frame.data[p], frame.size[p]);
+		else if (is_fwht)
+			fwht_decompress(m_ctx, dst, data_size, frame.data[p], frame.size[p]);
+		else
+			rle_decompress(dst, size, data_size,
+				       rle_calc_bpl(m_fmt.g_bytesperline(p), m_fmt.g_pixelformat()));
+		frame.decodeNs += monotonicNs() - decode;
+	}
+	frame.receiveNs = monotonicNs() - start - frame.decodeNs;
+	publishFrame();
+	return true;
+}
+
+/*
+ * Waits until the sender signals new frames or sends a packet. Returns
+ * false if a new connection has to be made.
+ */
+bool SockReceiver::shmRead()
+{
+	struct pollfd pfd[2] = {
+		{ m_shm.eventFd, POLLIN, 0 },
+		{ m_sock, POLLIN, 0 },
+	};
+	__u64 cnt;
+	__u32 packet;
+
+	if (poll(pfd, 2, -1) < 0) {
+		if (errno == EINTR)
+			return true;
+		fprintf(stderr, "could not poll: %s\n", strerror(errno));
+		return false;
+	}
+	if ((pfd[0].revents & POLLIN) &&
+	    read(m_shm.eventFd, &cnt, sizeof(cnt)) == sizeof(cnt))
+		shmFrames();
+	if (!pfd[1].revents)
+		return true;
+
+	// Take the frames sent before the END packet
+	shmFrames();
+	if (read_u32(packet))
+		return false;
+	if (packet == V4L_STREAM_PACKET_END)
+		fprintf(stderr, "END packet read\n");
+	else
+		fprintf(stderr, "unexpected packet 0x%08x\n", packet);
+	return false;
+}
+
+void SockReceiver::shmFrames()
+{
+	struct v4l_stream_shm_ring *ring = m_shm.ring;
+	__u32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	__u32 tail = ring->tail;
+
+	// Only the latest frame can be shown, unless frames must not be dropped
+	if (m_dropFrames && head - tail > 1) {
+		tail = head - 1;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	for (; tail != head && !m_stop; tail++) {
+		const struct v4l_stream_shm_frame &f = ring->frame[tail % m_shm.frames];
+		const __u8 *src = m_shm.data + (size_t)(tail % m_shm.frames) * m_shm.frameSize;
+		SockFrame &frame = m_frames[m_back];
+		__u64 start = monotonicNs();
+
+		for (unsigned p = 0; m_fmtOk && p < m_fmt.g_num_planes(); p++) {
+			memcpy(frame.data[p], src, std::min(f.bytesused[p], frame.size[p]));
+			src += frame.size[p];
+		}
+		__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+		frame.receiveNs = monotonicNs() - start;
+		frame.decodeNs = 0;
+		if (m_fmtOk)
+			publishFrame();
+	}
+}
+
+void SockReceiver::udpNewFormat()
+{
+	cv4l_fmt fmt;
+	v4l2_fract pixelaspect = { 1, 1 };
+
+	if (!v4l_stream_udp_rx_fmt(m_udpRx, &fmt, &pixelaspect))
+		return;
+	newFormat(fmt, pixelaspect);
+}
+
+void SockReceiver::udpFrame()
+{
+	SockFrame &frame = m_frames[m_back];
+
+	if (!m_fmtOk || m_udpRx->num_planes != m_fmt.g_num_planes())
+		return;
+
+	/*
+	 * Planes that did not (completely) arrive keep (part of) the
+	 * contents of the previous frame. Only the renderer swaps the
+	 * pending and front frames, and it does not write to either.
+	 */
+	m_lock.lock();
+	const SockFrame *prev = m_havePrevious ?
+		&m_frames[m_havePending ? m_pending : m_front] : NULL;
+	m_lock.unlock();
+
+	__u64 start = monotonicNs();
+
+	for (unsigned p = 0; p < m_fmt.g_num_planes(); p++) {
+		if (prev)
+			memcpy(frame.data[p], prev->data[p], frame.size[p]);
+		v4l_stream_udp_rx_plane(m_udpRx, p, m_ctx, frame.data[p], frame.size[p],
+					rle_calc_bpl(m_fmt.g_bytesperline(p),
+						     m_fmt.g_pixelformat()));
+	}
+	// The packets were received as they arrived
+	frame.receiveNs = 0;
+	frame.decodeNs = monotonicNs() - start;
+	publishFrame();
+}
+
+void SockReceiver::udpRead()
+{
+	static __u8 buf[V4L_STREAM_UDP_MAX_SIZE];
+
+	while (!m_stop) {
+		ssize_t n = recv(m_sock, buf, sizeof(buf), 0);
+		int ret;
+
+		if (n < 0 && errno != EINTR && !m_stop) {
+			fprintf(stderr, "could not receive: %s\n", strerror(errno));
+			return;
+		}
+		if (n <= 0)
+			continue;
+		do {
+			ret = v4l_stream_udp_rx_packet(m_udpRx, buf, n);
+			if (ret & V4L_STREAM_UDP_RX_FMT)
+				udpNewFormat();
+			if (ret & V4L_STREAM_UDP_RX_FRAME)
+				udpFrame();
+			if (ret & V4L_STREAM_UDP_RX_END)
+				fprintf(stderr, "END packet read\n");
+		} while (ret & V4L_STREAM_UDP_RX_AGAIN);
+	}
+}
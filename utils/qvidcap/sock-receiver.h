@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#ifndef SOCK_RECEIVER_H
+#define SOCK_RECEIVER_H
+
+#include <atomic>
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "qvidcap.h"
+
+class CaptureWin;
+
+// Number of frames shared by the receiver thread and the renderer
+#define SOCK_FRAMES 3
+
+struct SockFrame {
+	// Incremented for each received frame, including dropped frames
+	unsigned seq;
+	__u8 *data[VIDEO_MAX_PLANES];
+	unsigned size[VIDEO_MAX_PLANES];
+	// Time spent on reading the payload and decoding it, 0 if unknown
+	__u64 receiveNs;
+	__u64 decodeNs;
+};
+
+/*
+ * Reads and decodes the frames streamed over the network in its own
+ * thread, so decoding does not compete with painting and event handling.
+ *
+ * The frames are handed to the renderer through a triple buffer: a frame
+ * is decoded into the back buffer, which then becomes the pending frame.
+ * A pending frame the renderer did not take yet is dropped, unless frames
+ * must not be dropped, e.g. when single stepping. Then the receiver waits
+ * for the renderer to take the pending frame first.
+ *
+ * The renderer is told about new frames with a queued call of its
+ * sockFrameEvent() slot. Format changes are applied by a blocking call of
+ * its sockNewFormat() slot, unless the format is fixed: then connections
+ * with another format are refused. This is used for the tiles of a mosaic.
+ *
+ * If no socket is given, the receiver waits for the first connection in
+ * its own thread.
+ *
+ * A local stream only carries the END packet over the socket, the frames
+ * are copied out of the shared memory ring when its eventfd signals them.
+ */
+class SockReceiver : public QThread
+{
+public:
+	SockReceiver(CaptureWin *win, int sock, int port,
+		     struct v4l_stream_udp_rx *udp_rx, const cv4l_fmt &fmt);
+	~SockReceiver();
+
+	const SockFrame *takeFrame();
+	void setDropFrames(bool drop) { m_dropFrames = drop; }
+	void setFixedFormat(bool fixed) { m_fixedFmt = fixed; }
+	void setLocal(const QString &path, const ShmRing &shm) { m_local = path; m_shm = shm; }
+	const cv4l_fmt &g_fmt() const { return m_fmt; }
+	const v4l2_fract &g_pixelaspect() const { return m_pixelaspect; }
+	bool stop();
+	void requestStop();
+
+protected:
+	void run();
+
+private:
+	int read_u32(__u32 &v);
+	bool readFrame();
+	bool shmRead();
+	void shmFrames();
+	void listenForNewConnection();
+	void udpRead();
+	void udpNewFormat();
+	void udpFrame();
+	bool newFormat(const cv4l_fmt &fmt, const v4l2_fract &pixelaspect);
+	void allocFrames();
+	void allocCodec();
+	void freeFrames();
+	void publishFrame();
+
+	CaptureWin *m_win;
+	int m_sock;
+	int m_port;
+	struct v4l_stream_udp_rx *m_udpRx;
+	QString m_local;
+	ShmRing m_shm;
+	cv4l_fmt m_fmt;
+	v4l2_fract m_pixelaspect;
+	bool m_fmtOk;
+	bool m_fixedFmt;
+	codec_ctx *m_ctx;
+	std::atomic<bool> m_stop;
+
+	QMutex m_lock;
+	QWaitCondition m_taken;
+	SockFrame m_frames[SOCK_FRAMES];
+	unsigned m_back;
+	unsigned m_pending;
+	unsigned m_front;
+	bool m_havePending;
+	bool m_havePrevious;
+	bool m_dropFrames;
+	unsigned m_seq;
+};
+
+#endif
@@ -0,0 +1 @@
+../common/v4l2-tpg-cache.c
\ No newline at end of file
@@ -21,6 +21,8 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
 
@@ -52,9 +54,11 @@ enum Option {
 	OptFreqSeek,
 	OptListDevices,
 	OptListFreqBands,
+	OptMonitor,
 	OptOpenFile,
 	OptPrintBlock,
 	OptSilent,
+	OptStatsInterval,
 	OptTMC,
 	OptTunerIndex,
 	OptVerbose,
@@ -69,6 +73,7 @@ struct ctl_parameters {
 	bool filemode_active;
 	double freq;
 	uint32_t wait_limit;
+	uint32_t stats_interval;
 	uint8_t tuner_index;
 	struct v4l2_hw_freq_seek freq_seek;
 };
@@ -88,12 +93,14 @@ static struct option long_options[] = {
 	{"info", no_argument, nullptr, OptGetDriverInfo},
 	{"list-devices", no_argument, nullptr, OptListDevices},
 	{"list-freq-bands", no_argument, nullptr, OptListFreqBands},
+	{"monitor", no_argument, nullptr, OptMonitor},
 	{"print-block", no_argument, nullptr, OptPrintBlock},
 	{"read-rds", no_argument, nullptr, OptReadRds},
 	{"set-freq", required_argument, nullptr, OptSetFreq},
 	{"tmc", no_argument, nullptr, OptTMC},
 	{"tuner-index", required_argument, nullptr, OptTunerIndex},
 	{"silent", no_argument, nullptr, OptSilent},
+	{"stats-interval", required_argument, nullptr, OptStatsInterval},
 	{"verbose", no_argument, nullptr, OptVerbose},
 	{"wait-limit", required_argument, nullptr, OptWaitLimit},
 	{nullptr, 0, nullptr, 0}
@@ -144,7 +151,7 @@ static void usage_rds()
 	       "  --file <path>      open a RDS stream file dump instead of a device\n"
 	       "                     all General and Tuner Options are disabled in this mode\n"
 	       "  --wait-limit <ms>  defines the maximum wait duration for avaibility of new\n"
-	       "                     RDS data\n"
+	       "                     RDS data, reading stops after 3 timeouts in a row\n"
 	       "                     <default>: 5000 ms\n"
 	       "  --print-block      prints all valid RDS fields, whenever a value is updated\n"
 	       "                     instead of printing only updated values\n"
@@ -152,6 +159,13 @@ static void usage_rds()
 	       "  --silent           only set the result code, do not print any messages\n"
 	       "  --verbose          turn on verbose mode - every received RDS group\n"
 	       "                     will be printed\n"
+	       "  --monitor          read the RDS data of all RDS-capable devices at once and\n"
+	       "                     print the changes of PI, PS, PTY, RT, CT, AF and TMC as\n"
+	       "                     one JSON object per line\n"
+	       "  --stats-interval <s>\n"
+	       "                     print the block and group statistics of each device every\n"
+	       "                     <s> seconds in monitor mode, 0 disables them\n"
+	       "                     <default>: 10 s\n"
 	       );
 }
 
@@ -570,38 +584,64 @@ static void print_rds_data(const struct v4l2_rds *handle, uint32_t updated_field
 		print_rds_tmc(handle, updated_fields);
 }
 
+/* number of RDS blocks read at once, the transmission of 1 group of 4 blocks
+ * takes ~88.7ms */
+#define RDS_READ_BLOCKS 64
+
 static void read_rds(struct v4l2_rds *handle, const int fd, const int wait_limit)
 {
 	int byte_cnt = 0;
 	int error_cnt = 0;
+	unsigned int fill = 0; /* bytes of an incomplete block in the buffer */
 	uint32_t updated_fields = 0x00;
-	struct v4l2_rds_data rds_data; /* read buffer for rds blocks */
+	struct v4l2_rds_data rds_data[RDS_READ_BLOCKS]; /* read buffer for rds blocks */
+	struct pollfd pfd = { fd, POLLIN, 0 };
 
 	while (!params.terminate_decoding) {
-		memset(&rds_data, 0, sizeof(rds_data));
-		if ((byte_cnt=read(fd, &rds_data, 3)) != 3) {
+		/* wait for new data to arrive */
+		int ret = poll(&pfd, 1, wait_limit);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret > 0) {
+			byte_cnt = read(fd, (uint8_t *)rds_data + fill,
+					sizeof(rds_data) - fill);
 			if (byte_cnt == 0) {
 				printf("\nEnd of input file reached \n");
 				break;
 			}
+			if (byte_cnt < 0 && errno == EINTR)
+				continue;
+		}
+		if (ret <= 0 || byte_cnt < 0) {
 			if (++error_cnt > 2) {
 				fprintf(stderr, "\nError reading from "
 					"device (no RDS data available)\n");
 				break;
 			}
-			/* wait for new data to arrive: transmission of 1
-			 * group takes ~88.7ms */
-			usleep(wait_limit * 1000);
+			continue;
 		}
-		else if (byte_cnt == 3) {
-			error_cnt = 0;
-			/* true if a new group was decoded */
-			if ((updated_fields = v4l2_rds_add(handle, &rds_data))) {
-				print_rds_data(handle, updated_fields);
-				if (params.options[OptVerbose])
-					 print_rds_group(v4l2_rds_get_group(handle));
+		error_cnt = 0;
+		fill += byte_cnt;
+
+		unsigned int blocks = fill / sizeof(rds_data[0]);
+
+		if (params.options[OptVerbose]) {
+			/* every group is shown, so decode them one by one */
+			for (unsigned int i = 0; i < blocks; i++) {
+				updated_fields = v4l2_rds_add(handle, &rds_data[i]);
+				/* true if a new group was decoded */
+				if (updated_fields) {
+					print_rds_data(handle, updated_fields);
+					print_rds_group(v4l2_rds_get_group(handle));
+				}
 			}
+		} else if ((updated_fields = v4l2_rds_add_blocks(handle, rds_data, blocks))) {
+			print_rds_data(handle, updated_fields);
 		}
+		/* keep an incomplete block for the next read */
+		fill -= blocks * sizeof(rds_data[0]);
+		memmove(rds_data, &rds_data[blocks], fill);
 	}
 	/* print a summary of all valid RDS-fields before exiting */
 	printf("\nSummary of valid RDS-fields:");
@@ -627,6 +667,219 @@ static void read_rds_from_fd(const int fd)
 	v4l2_rds_destroy(rds_handle);
 }
 
+/* state of one device in monitor mode */
+struct rds_tuner {
+	std::string name;
+	int fd;
+	struct v4l2_rds *handle;
+	unsigned int fill;	/* bytes of an incomplete block in the buffer */
+	struct v4l2_rds_data rds_data[RDS_READ_BLOCKS];
+};
+
+static double wall_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_json_str(const char *key, const uint8_t *str)
+{
+	printf(",\"%s\":\"", key);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if (*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+/* print the changes of the fields that are monitored as one JSON object */
+static void print_json_event(const struct rds_tuner &tuner, uint32_t updated_fields)
+{
+	const struct v4l2_rds *handle = tuner.handle;
+	const uint32_t fields = V4L2_RDS_PI | V4L2_RDS_PS | V4L2_RDS_PTY |
+		V4L2_RDS_RT | V4L2_RDS_TIME | V4L2_RDS_AF |
+		V4L2_RDS_TMC_SG | V4L2_RDS_TMC_MG;
+
+	updated_fields &= handle->valid_fields & fields;
+	if (!updated_fields)
+		return;
+
+	printf("{\"time\":%.3f,\"dev\":\"%s\"", wall_time(), tuner.name.c_str());
+	if (updated_fields & V4L2_RDS_PI)
+		printf(",\"pi\":\"%04x\"", handle->pi);
+	if (updated_fields & V4L2_RDS_PS)
+		print_json_str("ps", handle->ps);
+	if (updated_fields & V4L2_RDS_PTY)
+		printf(",\"pty\":%u", handle->pty);
+	if (updated_fields & V4L2_RDS_RT)
+		print_json_str("rt", handle->rt);
+	if (updated_fields & V4L2_RDS_TIME)
+		printf(",\"ct\":%lld", static_cast<long long>(handle->time));
+	if (updated_fields & V4L2_RDS_AF) {
+		const struct v4l2_rds_af_set *af_set = &handle->rds_af;
+
+		printf(",\"af\":[");
+		for (int i = 0; i < af_set->size && i < af_set->announced_af; i++)
+			printf("%s%u", i ? "," : "", af_set->af[i]);
+		putchar(']');
+	}
+	if (updated_fields & (V4L2_RDS_TMC_SG | V4L2_RDS_TMC_MG)) {
+		const struct v4l2_rds_tmc_msg *msg = &handle->tmc.tmc_msg;
+
+		printf(",\"tmc\":{\"location\":%u,\"event\":%u,\"extent\":%u,\"duration\":%u",
+		       msg->location, msg->event, msg->extent, msg->dp);
+		if (updated_fields & V4L2_RDS_TMC_MG) {
+			printf(",\"additional\":[");
+			for (int i = 0; i < msg->additional.size; i++)
+				printf("%s{\"label\":%u,\"value\":%u}", i ? "," : "",
+				       msg->additional.fields[i].label,
+				       msg->additional.fields[i].data);
+			putchar(']');
+		}
+		putchar('}');
+	}
+	printf("}\n");
+}
+
+static void print_json_stats(const struct rds_tuner &tuner)
+{
+	const struct v4l2_rds_statistics *statistics = &tuner.handle->rds_statistics;
+
+	printf("{\"time\":%.3f,\"dev\":\"%s\",\"stats\":{\"blocks\":%u,"
+	       "\"block_errors\":%u,\"blocks_corrected\":%u,\"groups\":%u,"
+	       "\"group_errors\":%u}}\n",
+	       wall_time(), tuner.name.c_str(), statistics->block_cnt,
+	       statistics->block_error_cnt, statistics->block_corrected_cnt,
+	       statistics->group_cnt, statistics->group_error_cnt);
+}
+
+/* read and decode all RDS blocks that are available, false on errors and
+ * at the end of the data, errno is 0 then */
+static bool monitor_read(struct rds_tuner &tuner)
+{
+	uint32_t updated_fields = 0;
+
+	for (;;) {
+		errno = 0;
+
+		int byte_cnt = read(tuner.fd, reinterpret_cast<uint8_t *>(tuner.rds_data) + tuner.fill,
+				    sizeof(tuner.rds_data) - tuner.fill);
+
+		if (byte_cnt < 0 && errno == EINTR)
+			continue;
+		if (byte_cnt <= 0) {
+			print_json_event(tuner, updated_fields);
+			return byte_cnt < 0 && errno == EAGAIN;
+		}
+		tuner.fill += byte_cnt;
+
+		unsigned int blocks = tuner.fill / sizeof(tuner.rds_data[0]);
+
+		updated_fields |= v4l2_rds_add_blocks(tuner.handle, tuner.rds_data, blocks);
+		tuner.fill -= blocks * sizeof(tuner.rds_data[0]);
+		memmove(tuner.rds_data, &tuner.rds_data[blocks], tuner.fill);
+	}
+}
+
+/* decode the RDS data of all devices in one thread, until interrupted */
+static void monitor_rds(const dev_vec &devices)
+{
+	std::vector<struct rds_tuner> tuners(devices.size());
+	unsigned int active = 0;
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epfd < 0) {
+		fprintf(stderr, "Failed to create epoll: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	for (unsigned int i = 0; i < tuners.size(); i++) {
+		struct rds_tuner &tuner = tuners[i];
+		struct epoll_event ev = {};
+
+		tuner.name = devices[i];
+		tuner.fill = 0;
+		tuner.handle = nullptr;
+		tuner.fd = open(tuner.name.c_str(), O_RDONLY | O_NONBLOCK);
+		if (tuner.fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", tuner.name.c_str(),
+				strerror(errno));
+			continue;
+		}
+		if (!(tuner.handle = v4l2_rds_create(params.options[OptRBDS]))) {
+			fprintf(stderr, "Failed to init RDS lib: %s\n", strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, tuner.fd, &ev)) {
+			fprintf(stderr, "Failed to poll %s: %s\n", tuner.name.c_str(),
+				strerror(errno));
+			close(tuner.fd);
+			tuner.fd = -1;
+			continue;
+		}
+		active++;
+	}
+	if (!active) {
+		fprintf(stderr, "No RDS-capable device found\n");
+		std::exit(EXIT_FAILURE);
+	}
+
+	double next_stats = wall_time() + params.stats_interval;
+
+	while (!params.terminate_decoding && active) {
+		struct epoll_event events[16];
+		int timeout = -1;
+
+		if (params.stats_interval) {
+			double now = wall_time();
+
+			if (now >= next_stats) {
+				for (const auto &tuner : tuners)
+					if (tuner.fd >= 0)
+						print_json_stats(tuner);
+				next_stats = now + params.stats_interval;
+			}
+			timeout = (next_stats - now) * 1000 + 1;
+		}
+		fflush(stdout);
+
+		int n = epoll_wait(epfd, events, 16, timeout);
+
+		for (int i = 0; i < n; i++) {
+			struct rds_tuner &tuner = tuners[events[i].data.u32];
+
+			if (monitor_read(tuner))
+				continue;
+			/* e.g. the device was disconnected */
+			printf("{\"time\":%.3f,\"dev\":\"%s\",\"error\":\"%s\"}\n",
+			       wall_time(), tuner.name.c_str(),
+			       errno ? strerror(errno) : "end of data");
+			epoll_ctl(epfd, EPOLL_CTL_DEL, tuner.fd, nullptr);
+			close(tuner.fd);
+			tuner.fd = -1;
+			active--;
+			app_result = -1;
+		}
+	}
+	for (auto &tuner : tuners) {
+		if (tuner.fd >= 0) {
+			print_json_stats(tuner);
+			close(tuner.fd);
+		}
+		if (tuner.handle)
+			v4l2_rds_destroy(tuner.handle);
+	}
+	close(epfd);
+	fflush(stdout);
+}
+
 static int parse_cl(int argc, char **argv)
 {
 	int i = 0;
@@ -695,6 +948,9 @@ static int parse_cl(int argc, char **argv)
 		case OptWaitLimit:
 			params.wait_limit = strtoul(optarg, nullptr, 0);
 			break;
+		case OptStatsInterval:
+			params.stats_interval = strtoul(optarg, nullptr, 0);
+			break;
 		case ':':
 			fprintf(stderr, "Option '%s' requires a value\n",
 				argv[optind]);
@@ -724,6 +980,8 @@ static int parse_cl(int argc, char **argv)
 	/* set default value for wait limit, if not specified by user */
 	if (!params.options[OptWaitLimit])
 		params.wait_limit = 5000;
+	if (!params.options[OptStatsInterval])
+		params.stats_interval = 10;
 
 	return 0;
 }
@@ -851,6 +1109,12 @@ int main(int argc, char **argv)
 		std::exit(EXIT_SUCCESS);
 	}
 
+	/* Monitor Mode: decode all RDS-capable devices, nothing else */
+	if (params.options[OptMonitor]) {
+		monitor_rds(list_devices());
+		std::exit(app_result);
+	}
+
 	/* File Mode: disables all other features, except for RDS decoding */
 	if (params.filemode_active) {
 		if ((fd = open(params.fd_name, O_RDONLY|O_NONBLOCK)) < 0){
@@ -22,6 +22,7 @@ LOCAL_SRC_FILES := \
     v4l2-compliance.cpp v4l2-test-debug.cpp v4l2-test-input-output.cpp \
     v4l2-test-controls.cpp v4l2-test-io-config.cpp v4l2-test-formats.cpp \
     v4l2-test-buffers.cpp v4l2-test-codecs.cpp v4l2-test-colors.cpp \
-    v4l2-test-media.cpp v4l2-test-subdevs.cpp media-info.cpp v4l2-info.cpp
+    v4l2-test-media.cpp v4l2-test-perf.cpp v4l2-test-subdevs.cpp media-info.cpp \
+    v4l2-info.cpp crc32c.cpp
 
 include $(BUILD_EXECUTABLE)
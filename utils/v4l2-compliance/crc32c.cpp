@@ -0,0 +1 @@
+../common/crc32c.cpp
\ No newline at end of file
@@ -27,7 +27,9 @@
 
 #include <dirent.h>
 #include <getopt.h>
+#include <sys/file.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "v4l2-compliance.h"
@@ -60,6 +62,7 @@ enum Option {
 	OptSetTouchDevice = 't',
 	OptTrace = 'T',
 	OptSetSubDevDevice = 'u',
+	OptJobs = 'j',
 	OptVerbose = 'v',
 	OptSetVbiDevice = 'V',
 	OptUseWrapper = 'w',
@@ -67,6 +70,11 @@ enum Option {
 	OptMediaBusInfo = 'z',
 	OptStreamFrom = 128,
 	OptStreamFromHdr,
+	OptPerf,
+	OptReport,
+	OptFast,
+	OptStreamHash,
+	OptStreamHashSave,
 	OptVersion,
 	OptLast = 256
 };
@@ -89,6 +97,9 @@ bool is_uvcvideo;
 int media_fd = -1;
 unsigned warnings;
 bool has_mmu = true;
+unsigned parallel_jobs = 1;
+double stream_budget;
+unsigned stream_budget_hits;
 
 static unsigned color_component;
 static unsigned color_skip;
@@ -116,6 +127,42 @@ struct dev_state {
 
 static struct dev_state state;
 
+/*
+ * The report records the result and the wall time of each test. The
+ * names of the tests are only known from their output, so the output of
+ * a node is captured to a file while it is being tested: ok() records
+ * the offset of the line that reports the test, and the names are read
+ * back when the node is done.
+ */
+struct test_record {
+	std::string name;
+	double secs;
+	int result;
+	off_t offset;
+};
+
+struct node_record {
+	std::string device;
+	std::string driver;
+	double secs;
+	int total, ok, warnings;
+	std::vector<test_record> tests;
+};
+
+static const char *report_file;
+static std::vector<node_record> report;
+static double node_start, test_start;
+static FILE *capture_file;
+static int capture_fd = -1;
+
+static double now_secs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 static struct option long_options[] = {
 	{"device", required_argument, nullptr, OptSetDevice},
 	{"radio-device", required_argument, nullptr, OptSetRadioDevice},
@@ -144,6 +191,12 @@ static struct option long_options[] = {
 	{"stream-all-formats", optional_argument, nullptr, OptStreamAllFormats},
 	{"stream-all-io", no_argument, nullptr, OptStreamAllIO},
 	{"stream-all-color", required_argument, nullptr, OptStreamAllColorTest},
+	{"perf", optional_argument, nullptr, OptPerf},
+	{"jobs", required_argument, nullptr, OptJobs},
+	{"report", required_argument, nullptr, OptReport},
+	{"fast", optional_argument, nullptr, OptFast},
+	{"stream-hash", required_argument, nullptr, OptStreamHash},
+	{"stream-hash-save", required_argument, nullptr, OptStreamHashSave},
 	{"version", no_argument, nullptr, OptVersion},
 	{nullptr, 0, nullptr, 0}
 };
@@ -241,6 +294,12 @@ static void usage()
 	printf("                     for one second for all formats, at all sizes, at all intervals\n");
 	printf("                     and with all field values. If <count> is given, then stream\n");
 	printf("                     for that many frames instead of one second.\n");
+	printf("  --stream-hash <file>\n");
+	printf("                     Compare the CRC32C of each plane of the frames captured by\n");
+	printf("                     --stream-all-formats with the golden hashes in <file>.\n");
+	printf("  --stream-hash-save <file>\n");
+	printf("                     Save the CRC32C of the frames captured by --stream-all-formats\n");
+	printf("                     to <file>, to be used by --stream-hash.\n");
 	printf("  -a, --stream-all-io\n");
 	printf("                     Do streaming tests for all inputs or outputs instead of just\n");
 	printf("                     the current input or output. This requires that a valid video\n");
@@ -253,6 +312,24 @@ static void usage()
 	printf("                     signal is present on the input(s). If <skip> is not specified,\n");
 	printf("                     then just capture the first frame. If <perc> is not specified,\n");
 	printf("                     then this defaults to 90%%.\n");
+	printf("  --perf [<baselines>]\n");
+	printf("                     Measure the streaming performance of each memory model with the\n");
+	printf("                     current format, streaming the number of frames set by --streaming.\n");
+	printf("                     If a <baselines> file is given, then fail if the frame rate, the\n");
+	printf("                     QBUF/DQBUF latencies, the timestamp jitter or the buffer turnaround\n");
+	printf("                     regressed for the driver. See the man page for the file format.\n");
+	printf("                     For M2M devices and stateful codecs measure the first frame\n");
+	printf("                     latency, the frame rate and the drain time with 2, 4 and 8 buffers.\n");
+	printf("  -j, --jobs <n>     With --media-device, test the interfaces of up to <n> independent\n");
+	printf("                     parts of the topology concurrently. The output of each part is\n");
+	printf("                     buffered and shown in order once it is tested.\n");
+	printf("  --report <file>    Write the result and wall time of each test to <file>, as JUnit XML\n");
+	printf("                     if it ends with .xml, or as JSON otherwise. The output of each\n");
+	printf("                     device is then shown once it is tested.\n");
+	printf("  --fast [<secs>]    Stop each streaming test after <secs> seconds (default 1) and\n");
+	printf("                     only stream the smallest, median and largest discrete frame sizes\n");
+	printf("                     and the first and last discrete frame intervals with\n");
+	printf("                     --stream-all-formats. The coverage that was achieved is reported.\n");
 	printf("  -E, --exit-on-fail Exit on the first fail.\n");
 	printf("  -h, --help         Display this help message.\n");
 	printf("  -C, --color <when> Highlight OK/warn/fail/FAIL strings with colors\n");
@@ -272,6 +349,15 @@ const char *ok(int res)
 {
 	static char buf[100];
 
+	if (capture_file) {
+		double now = now_secs();
+
+		fflush(stdout);
+		report.back().tests.push_back({ "", now - test_start, res,
+						lseek(STDOUT_FILENO, 0, SEEK_CUR) });
+		test_start = now;
+	}
+
 	if (res == ENOTTY) {
 		strcpy(buf, show_colors ?
 		       COLOR_GREEN("OK") " (Not Supported)" :
@@ -290,6 +376,265 @@ const char *ok(int res)
 	return buf;
 }
 
+static void reportNodeBegin(const struct node &node)
+{
+	node_record rec = {};
+
+	rec.device = node.device;
+	report.push_back(rec);
+	node_start = test_start = now_secs();
+
+	fflush(stdout);
+	capture_file = tmpfile();
+	if (!capture_file)
+		return;
+	capture_fd = dup(STDOUT_FILENO);
+	dup2(fileno(capture_file), STDOUT_FILENO);
+}
+
+static void reportNodeEnd(const std::string &driver)
+{
+	node_record &rec = report.back();
+	char buf[4096];
+	size_t sz;
+
+	rec.driver = driver;
+	rec.secs = now_secs() - node_start;
+	rec.total = tests_total;
+	rec.ok = tests_ok;
+	rec.warnings = warnings;
+
+	if (!capture_file)
+		return;
+	fflush(stdout);
+
+	for (auto &test : rec.tests) {
+		ssize_t len = pread(fileno(capture_file), buf, sizeof(buf) - 1,
+				    test.offset);
+		char *p, *end;
+
+		if (len <= 0)
+			continue;
+		buf[len] = '\0';
+		buf[strcspn(buf, "\n")] = '\0';
+		p = buf + strspn(buf, "\r\t ");
+		if (!strncmp(p, "test ", 5))
+			p += 5;
+		end = strrchr(p, ':');
+		if (end)
+			*end = '\0';
+		test.name = p;
+	}
+
+	dup2(capture_fd, STDOUT_FILENO);
+	close(capture_fd);
+	capture_fd = -1;
+	rewind(capture_file);
+	while ((sz = fread(buf, 1, sizeof(buf), capture_file)))
+		fwrite(buf, 1, sz, stdout);
+	fclose(capture_file);
+	capture_file = nullptr;
+}
+
+void resetResults()
+{
+	grand_total = grand_ok = grand_warnings = 0;
+	app_result = 0;
+	report.clear();
+}
+
+void writeResults(FILE *f)
+{
+	fprintf(f, "totals\t%d\t%d\t%d\t%d\n",
+		grand_total, grand_ok, grand_warnings, app_result);
+	for (const auto &rec : report) {
+		fprintf(f, "node\t%f\t%d\t%d\t%d\t%s\t%s\n", rec.secs,
+			rec.total, rec.ok, rec.warnings,
+			rec.driver.c_str(), rec.device.c_str());
+		for (const auto &test : rec.tests)
+			fprintf(f, "test\t%f\t%d\t%s\n",
+				test.secs, test.result, test.name.c_str());
+	}
+}
+
+bool readResults(FILE *f)
+{
+	char line[1024];
+	bool have_totals = false;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line;
+		const char *field[7] = {};
+		unsigned n = 0;
+
+		line[strcspn(line, "\n")] = '\0';
+		while (n < 7 && (field[n] = strsep(&p, "\t")))
+			n++;
+
+		if (!strcmp(field[0], "totals") && n == 5) {
+			grand_total += strtol(field[1], nullptr, 0);
+			grand_ok += strtol(field[2], nullptr, 0);
+			grand_warnings += strtol(field[3], nullptr, 0);
+			if (strtol(field[4], nullptr, 0))
+				app_result = strtol(field[4], nullptr, 0);
+			have_totals = true;
+		} else if (!strcmp(field[0], "node") && n == 7) {
+			node_record rec = {};
+
+			rec.secs = strtod(field[1], nullptr);
+			rec.total = strtol(field[2], nullptr, 0);
+			rec.ok = strtol(field[3], nullptr, 0);
+			rec.warnings = strtol(field[4], nullptr, 0);
+			rec.driver = field[5];
+			rec.device = field[6];
+			report.push_back(rec);
+		} else if (!strcmp(field[0], "test") && n == 4 && !report.empty()) {
+			test_record test = {};
+
+			test.secs = strtod(field[1], nullptr);
+			test.result = strtol(field[2], nullptr, 0);
+			test.name = field[3];
+			report.back().tests.push_back(test);
+		}
+	}
+	return have_totals;
+}
+
+static const char *result2s(int result)
+{
+	if (result == ENOTTY)
+		return "OK (Not Supported)";
+	return result ? "FAIL" : "OK";
+}
+
+static std::string json_escape(const std::string &s)
+{
+	std::string res;
+
+	for (auto c : s) {
+		if (c == '"' || c == '\\') {
+			res += '\\';
+			res += c;
+		} else if (static_cast<unsigned char>(c) < 0x20) {
+			char hex[8];
+
+			sprintf(hex, "\\u%04x", c);
+			res += hex;
+		} else {
+			res += c;
+		}
+	}
+	return res;
+}
+
+static std::string xml_escape(const std::string &s)
+{
+	std::string res;
+
+	for (auto c : s) {
+		switch (c) {
+		case '&': res += "&amp;"; break;
+		case '<': res += "&lt;"; break;
+		case '>': res += "&gt;"; break;
+		case '"': res += "&quot;"; break;
+		default:
+			if (static_cast<unsigned char>(c) >= 0x20)
+				res += c;
+			break;
+		}
+	}
+	return res;
+}
+
+static void writeReportJSON(FILE *f)
+{
+	fprintf(f, "{\n\t\"version\": \"%s%s\",\n\t\"nodes\": [", PACKAGE_VERSION,
+		STRING(GIT_COMMIT_CNT));
+	for (unsigned i = 0; i < report.size(); i++) {
+		const node_record &rec = report[i];
+
+		fprintf(f, "%s\n\t\t{\n", i ? "," : "");
+		fprintf(f, "\t\t\t\"device\": \"%s\",\n", json_escape(rec.device).c_str());
+		fprintf(f, "\t\t\t\"driver\": \"%s\",\n", json_escape(rec.driver).c_str());
+		fprintf(f, "\t\t\t\"seconds\": %.6f,\n", rec.secs);
+		fprintf(f, "\t\t\t\"total\": %d,\n\t\t\t\"succeeded\": %d,\n", rec.total, rec.ok);
+		fprintf(f, "\t\t\t\"failed\": %d,\n\t\t\t\"warnings\": %d,\n",
+			rec.total - rec.ok, rec.warnings);
+		fprintf(f, "\t\t\t\"tests\": [");
+		for (unsigned t = 0; t < rec.tests.size(); t++) {
+			const test_record &test = rec.tests[t];
+
+			fprintf(f, "%s\n\t\t\t\t{ \"name\": \"%s\", \"seconds\": %.6f, \"result\": \"%s\" }",
+				t ? "," : "", json_escape(test.name).c_str(),
+				test.secs, result2s(test.result));
+		}
+		fprintf(f, "\n\t\t\t]\n\t\t}");
+	}
+	fprintf(f, "\n\t]\n}\n");
+}
+
+static void writeReportJUnit(FILE *f)
+{
+	int total = 0, failures = 0;
+	double secs = 0;
+
+	for (const auto &rec : report) {
+		total += rec.total;
+		failures += rec.total - rec.ok;
+		secs += rec.secs;
+	}
+
+	fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(f, "<testsuites name=\"v4l2-compliance\" tests=\"%d\" failures=\"%d\" time=\"%.6f\">\n",
+		total, failures, secs);
+	for (const auto &rec : report) {
+		std::string name = xml_escape(rec.driver.empty() ? rec.device :
+					      rec.driver + " " + rec.device);
+
+		fprintf(f, "\t<testsuite name=\"%s\" tests=\"%d\" failures=\"%d\" time=\"%.6f\">\n",
+			name.c_str(), rec.total, rec.total - rec.ok, rec.secs);
+		for (const auto &test : rec.tests) {
+			fprintf(f, "\t\t<testcase classname=\"%s\" name=\"%s\" time=\"%.6f\"",
+				name.c_str(), xml_escape(test.name).c_str(), test.secs);
+			if (test.result == ENOTTY)
+				fprintf(f, ">\n\t\t\t<skipped message=\"Not Supported\"/>\n\t\t</testcase>\n");
+			else if (test.result)
+				fprintf(f, ">\n\t\t\t<failure message=\"FAIL\"/>\n\t\t</testcase>\n");
+			else
+				fprintf(f, "/>\n");
+		}
+		fprintf(f, "\t</testsuite>\n");
+	}
+	fprintf(f, "</testsuites>\n");
+}
+
+static void writeReport(const char *file)
+{
+	size_t len = strlen(file);
+	FILE *f = fopen(file, "w");
+
+	if (!f) {
+		fprintf(stderr, "Failed to write %s: %s\n", file, strerror(errno));
+		return;
+	}
+	if (len > 4 && !strcmp(file + len - 4, ".xml"))
+		writeReportJUnit(f);
+	else
+		writeReportJSON(f);
+	fclose(f);
+}
+
+/*
+ * With parallel jobs the expbuf device can be shared by several
+ * processes, but only one of them can stream with it at a time.
+ */
+static void lockExpBuf(struct node &expbuf_node, bool lock)
+{
+	if (parallel_jobs > 1 && expbuf_node.g_fd() >= 0)
+		flock(expbuf_node.g_fd(), lock ? LOCK_EX : LOCK_UN);
+}
+
 int check_string(const char *s, size_t len)
 {
 	size_t sz = strnlen(s, len);
@@ -985,6 +1330,9 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 	std::string driver;
 
 	tests_total = tests_ok = warnings = 0;
+	stream_budget_hits = 0;
+	if (report_file)
+		reportNodeBegin(node);
 
 	node.is_video = type == MEDIA_TYPE_VIDEO;
 	node.is_vbi = type == MEDIA_TYPE_VBI;
@@ -1518,7 +1866,8 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			break;
 
 		if (options[OptStreaming] || (node.is_video && options[OptStreamAllFormats]) ||
-		    (node.is_video && node.can_capture && options[OptStreamAllColorTest]))
+		    (node.is_video && node.can_capture && options[OptStreamAllColorTest]) ||
+		    options[OptPerf])
 			printf("Test %s %d:\n\n",
 				node.can_capture ? "input" : "output", io);
 
@@ -1556,6 +1905,7 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 			node.reopen();
 			if (options[OptSetExpBufDevice] ||
 			    !(node.valid_memorytype & (1 << V4L2_MEMORY_DMABUF))) {
+				lockExpBuf(expbuf_node, true);
 				if (!(node.codec_mask & (STATEFUL_ENCODER | STATEFUL_DECODER))) {
 					printf("\ttest DMABUF (no poll): %s\n",
 					       ok(testDmaBuf(&expbuf_node, &node, &node_m2m_cap,
@@ -1565,6 +1915,7 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 				printf("\ttest DMABUF (select): %s\n",
 				       ok(testDmaBuf(&expbuf_node, &node, &node_m2m_cap, frame_count, POLL_MODE_SELECT)));
 				node.reopen();
+				lockExpBuf(expbuf_node, false);
 			} else if (!options[OptSetExpBufDevice]) {
 				printf("\ttest DMABUF: Cannot test, specify --expbuf-device\n");
 			}
@@ -1599,6 +1950,47 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 						     color_skip, color_perc);
 			}
 		}
+
+		if (options[OptPerf]) {
+			printf("Streaming performance:\n");
+
+			if (node.is_m2m) {
+				cv4l_fmt out_fmt;
+				bool use_hdr;
+
+				node.g_fmt(out_fmt, v4l_type_invert(node.g_type()));
+				if (node.codec_mask & (STATELESS_ENCODER | STATELESS_DECODER)) {
+					printf("\tNot supported for stateless codecs\n");
+				} else if ((node.codec_mask & STATEFUL_DECODER) &&
+					   stream_from(fcc2s(out_fmt.g_pixelformat()), use_hdr).empty()) {
+					printf("\tCannot test, specify --stream-from\n");
+				} else {
+					for (unsigned depth = 2; depth <= 8; depth *= 2) {
+						printf("\ttest queue depth %u: %s\n", depth,
+						       ok(testCodecPerf(&node, frame_count, depth)));
+						node.reopen();
+					}
+				}
+			} else {
+				streamingSetup(&node);
+				printf("\ttest MMAP: %s\n",
+				       ok(testPerf(&node, &expbuf_node, V4L2_MEMORY_MMAP, frame_count)));
+				node.reopen();
+				printf("\ttest USERPTR: %s\n",
+				       ok(testPerf(&node, &expbuf_node, V4L2_MEMORY_USERPTR, frame_count)));
+				node.reopen();
+				if (options[OptSetExpBufDevice]) {
+					lockExpBuf(expbuf_node, true);
+					printf("\ttest DMABUF: %s\n",
+					       ok(testPerf(&node, &expbuf_node, V4L2_MEMORY_DMABUF, frame_count)));
+					node.reopen();
+					lockExpBuf(expbuf_node, false);
+				} else {
+					printf("\ttest DMABUF: Cannot test, specify --expbuf-device\n");
+				}
+			}
+			printf("\n");
+		}
 	}
 
 	/*
@@ -1616,6 +2008,10 @@ void testNode(struct node &node, struct node &node_m2m_cap, struct node &expbuf_
 
 	restoreState();
 
+	if (stream_budget)
+		printf("Fast mode: %u streaming test(s) stopped after %.1f seconds\n\n",
+		       stream_budget_hits, stream_budget);
+
 show_total:
 	/* Final test report */
 	if (driver.empty())
@@ -1629,6 +2025,8 @@ show_total:
 	grand_total += tests_total;
 	grand_ok += tests_ok;
 	grand_warnings += warnings;
+	if (report_file)
+		reportNodeEnd(driver);
 
 	if (node.is_media() && options[OptSetMediaDevice]) {
 		walkTopology(node, expbuf_node,
@@ -1659,6 +2057,7 @@ int main(int argc, char **argv)
 	std::string expbuf_device;	/* --expbuf-device device */
 	unsigned frame_count = 60;
 	unsigned all_fmt_frame_count = 0;
+	const char *hash_save_file = nullptr;
 	char short_options[26 * 2 * 3 + 1];
 	char *value, *subs;
 	int idx = 0;
@@ -1761,6 +2160,31 @@ int main(int argc, char **argv)
 			}
 			break;
 		}
+		case OptPerf:
+			if (optarg && !loadPerfBaselines(optarg))
+				std::exit(EXIT_FAILURE);
+			break;
+		case OptJobs:
+			parallel_jobs = strtoul(optarg, nullptr, 0);
+			if (!parallel_jobs)
+				parallel_jobs = 1;
+			break;
+		case OptReport:
+			report_file = optarg;
+			break;
+		case OptStreamHash:
+			if (!loadStreamHashes(optarg))
+				std::exit(EXIT_FAILURE);
+			break;
+		case OptStreamHashSave:
+			hash_save_file = optarg;
+			recordStreamHashes();
+			break;
+		case OptFast:
+			stream_budget = optarg ? strtod(optarg, nullptr) : 1.0;
+			if (stream_budget <= 0)
+				stream_budget = 1.0;
+			break;
 		case OptStreamAllFormats:
 			if (optarg)
 				all_fmt_frame_count = strtoul(optarg, nullptr, 0);
@@ -1856,6 +2280,10 @@ int main(int argc, char **argv)
 		std::exit(EXIT_FAILURE);
 	}
 
+	// The hashes are recorded by the process that streams
+	if (hash_save_file)
+		parallel_jobs = 1;
+
 	print_sha();
 	printf("\n");
 
@@ -1910,6 +2338,11 @@ int main(int argc, char **argv)
 
 	testNode(node, node, expbuf_node, type, frame_count, all_fmt_frame_count);
 
+	if (report_file)
+		writeReport(report_file);
+	if (hash_save_file && !saveStreamHashes(hash_save_file))
+		app_result = EXIT_FAILURE;
+
 	if (!expbuf_device.empty())
 		expbuf_node.close();
 	if (media_fd >= 0)
@@ -54,6 +54,9 @@ extern int kernel_version;
 extern int media_fd;
 extern unsigned warnings;
 extern bool has_mmu;
+extern unsigned parallel_jobs;
+extern double stream_budget; // Maximum seconds of a streaming test, 0 if unlimited
+extern unsigned stream_budget_hits;
 
 enum poll_mode {
 	POLL_MODE_NONE,
@@ -330,6 +333,11 @@ int testMediaSetupLink(struct node *node);
 void walkTopology(struct node &node, struct node &expbuf_node,
 		  unsigned frame_count, unsigned all_fmt_frame_count);
 
+// Results of the nodes tested by a worker process
+void resetResults();
+void writeResults(FILE *f);
+bool readResults(FILE *f);
+
 // Debug ioctl tests
 int testRegister(struct node *node);
 int testLogStatus(struct node *node);
@@ -421,9 +429,18 @@ int testDmaBuf(struct node *expbuf_node, struct node *node,
 int testRequests(struct node *node, bool test_streaming);
 void streamAllFormats(struct node *node, unsigned frame_count);
 void streamM2MAllFormats(struct node *node, unsigned frame_count);
+bool loadStreamHashes(const char *file);
+void recordStreamHashes();
+bool saveStreamHashes(const char *file);
 
 // Color tests
 int testColorsAllFormats(struct node *node, unsigned component,
 			 unsigned skip, unsigned perc);
 
+// Streaming performance tests
+bool loadPerfBaselines(const char *file);
+int testPerf(struct node *node, struct node *expbuf_node, unsigned memory,
+	     unsigned frame_count);
+int testCodecPerf(struct node *node, unsigned frame_count, unsigned depth);
+
 #endif
@@ -20,9 +20,11 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cerrno>
 #include <csignal>
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 
 #include <arpa/inet.h>
@@ -31,6 +33,7 @@
 #include <sys/epoll.h>
 
 #include "v4l2-compliance.h"
+#include "crc32c.h"
 
 static cv4l_fmt cur_fmt;
 static cv4l_fmt cur_m2m_fmt;
@@ -62,6 +65,40 @@ static struct buf_seq last_seq, last_m2m_seq;
 
 static int buf_req_fds[VIDEO_MAX_FRAME * 2];
 
+/*
+ * What part of the frame sizes and intervals was streamed by
+ * --stream-all-formats, which is reduced by --fast.
+ */
+struct stream_coverage {
+	unsigned sizes, sizes_tested;
+	unsigned intervals, intervals_tested;
+	unsigned budget_hits;
+};
+
+static stream_coverage coverage;
+
+static timespec streamStart()
+{
+	timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts;
+}
+
+// Returns true if a streaming test that started at start ran out of time
+static bool streamBudgetExceeded(const timespec &start)
+{
+	timespec ts;
+
+	if (!stream_budget)
+		return false;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (ts.tv_sec - start.tv_sec + (ts.tv_nsec - start.tv_nsec) / 1e9 < stream_budget)
+		return false;
+	stream_budget_hits++;
+	return true;
+}
+
 static inline int named_ioctl_fd(int fd, bool trace, const char *cmd_name, unsigned long cmd, void *arg)
 {
 	int retval;
@@ -1117,6 +1154,7 @@ static int captureBufs(struct node *node, struct node *node_m2m_cap, const cv4l_
 	buffer buf(q);
 	unsigned count = frame_count;
 	unsigned req_idx = q.g_buffers();
+	timespec start = streamStart();
 	bool stopped = false;
 	bool got_eos = false;
 	bool got_source_change = false;
@@ -1311,6 +1349,8 @@ static int captureBufs(struct node *node, struct node *node_m2m_cap, const cv4l_
 				} while (buf_req_fds[req_idx] < 0);
 			}
 			count--;
+			if (count && streamBudgetExceeded(start))
+				count = 0;
 			if (!node->is_m2m && !count)
 				break;
 			if (!count && (node->codec_mask & STATEFUL_ENCODER)) {
@@ -3038,15 +3078,19 @@ static int testBlockingDQBuf(struct node *node, cv4l_queue &q)
 	thread_dqbuf.start();
 
 	/* Wait for the child thread to start and block */
-	sleep(1);
+	if (stream_budget)
+		usleep(200000);
+	else
+		sleep(1);
 	/* Check that it is really blocking */
 	fail_on_test(thread_dqbuf.done);
 
 	fflush(stdout);
 	thread_streamoff.start();
 
-	/* Wait for the second child to start and exit */
-	sleep(3);
+	/* Wait up to 3 seconds for the second child to start and exit */
+	for (unsigned i = 0; i < 300 && !thread_streamoff.done; i++)
+		usleep(10000);
 	fail_on_test(!thread_streamoff.done);
 
 	fail_on_test(node->streamoff(q.g_type()));
@@ -3158,6 +3202,152 @@ int restoreFormat(struct node *node)
 	return 0;
 }
 
+/*
+ * --stream-hash: the CRC32C of each plane of the frames captured by the
+ * all formats streaming tests is compared with the golden hashes, which
+ * --stream-hash-save records. This only makes sense for drivers that
+ * generate the same frames each time, such as vivid with its moving
+ * pattern and OSD text disabled.
+ *
+ * Each line of the file is:
+ *
+ * <format> <width>x<height>[@<interval>] <field> <colorspace> stride <bpl>
+ *	[crop <rect>] [compose <rect>] frame <n>: <crc> [<crc>...]
+ */
+static std::map<std::string, std::string> golden_hashes;
+static std::vector<std::pair<std::string, std::string>> saved_hashes;
+static bool save_hashes;
+static std::string hash_key;
+
+bool loadStreamHashes(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char line[512];
+	unsigned lineno = 0;
+
+	if (!f) {
+		fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		line[strcspn(line, "#\n")] = '\0';
+		if (!line[0])
+			continue;
+
+		char *colon = strrchr(line, ':');
+
+		if (!colon || colon[1] != ' ') {
+			fprintf(stderr, "%s:%u: invalid line\n", file, lineno);
+			fclose(f);
+			return false;
+		}
+		*colon = '\0';
+		golden_hashes[line] = colon + 2;
+	}
+	fclose(f);
+	return true;
+}
+
+void recordStreamHashes()
+{
+	save_hashes = true;
+}
+
+bool saveStreamHashes(const char *file)
+{
+	FILE *f = fopen(file, "w");
+
+	if (!f) {
+		fprintf(stderr, "Cannot create %s: %s\n", file, strerror(errno));
+		return false;
+	}
+	for (const auto &hash : saved_hashes)
+		fprintf(f, "%s: %s\n", hash.first.c_str(), hash.second.c_str());
+	fclose(f);
+	return true;
+}
+
+static void setHashKey(struct node *node, const cv4l_fmt &fmt,
+		       const v4l2_selection *crop, const v4l2_selection *compose)
+{
+	v4l2_fract ival;
+	char s[64];
+
+	if (golden_hashes.empty() && !save_hashes)
+		return;
+
+	sprintf(s, "%ux%u", fmt.g_width(), fmt.g_frame_height());
+	hash_key = fcc2s(fmt.g_pixelformat()) + " " + s;
+	if (!node->get_interval(ival)) {
+		sprintf(s, "@%u/%u", ival.numerator, ival.denominator);
+		hash_key += s;
+	}
+	hash_key += " " + field2s(fmt.g_field()) + " " +
+		colorspace2s(fmt.g_colorspace()) + " stride " +
+		std::to_string(fmt.g_bytesperline());
+	if (crop) {
+		sprintf(s, " crop %ux%u@%dx%d", crop->r.width, crop->r.height,
+			crop->r.left, crop->r.top);
+		hash_key += s;
+	}
+	if (compose) {
+		sprintf(s, " compose %ux%u@%dx%d", compose->r.width, compose->r.height,
+			compose->r.left, compose->r.top);
+		hash_key += s;
+	}
+}
+
+static int checkFrameHash(const __u8 *planes[], const unsigned sizes[],
+			  unsigned num_planes, unsigned frame)
+{
+	if (golden_hashes.empty() && !save_hashes)
+		return 0;
+
+	std::string key = hash_key + " frame " + std::to_string(frame);
+	std::string hashes;
+	char s[16];
+
+	for (unsigned p = 0; p < num_planes; p++) {
+		sprintf(s, "%s%08x", p ? " " : "", crc32c(planes[p], sizes[p]));
+		hashes += s;
+	}
+	if (save_hashes)
+		saved_hashes.push_back({ key, hashes });
+	if (golden_hashes.empty())
+		return 0;
+
+	auto iter = golden_hashes.find(key);
+
+	if (iter == golden_hashes.end()) {
+		warn_once("No golden hash for %s\n", key.c_str());
+		return 0;
+	}
+	if (iter->second != hashes)
+		return fail("%s: got %s, expected %s\n", key.c_str(),
+			    hashes.c_str(), iter->second.c_str());
+	return 0;
+}
+
+static int checkFrameHash(const cv4l_queue &q, const cv4l_buffer &buf,
+			  unsigned frame)
+{
+	const __u8 *planes[VIDEO_MAX_PLANES];
+	unsigned sizes[VIDEO_MAX_PLANES];
+
+	for (unsigned p = 0; p < buf.g_num_planes(); p++) {
+		unsigned used = buf.g_bytesused(p);
+		unsigned offset = buf.g_data_offset(p);
+
+		if (offset > used)
+			offset = 0;
+		planes[p] = static_cast<const __u8 *>(q.g_dataptr(buf.g_index(), p)) + offset;
+		sizes[p] = used - offset;
+	}
+	return checkFrameHash(planes, sizes, buf.g_num_planes(), frame);
+}
+
 static int testStreaming(struct node *node, unsigned frame_count)
 {
 	int type = node->g_type();
@@ -3171,6 +3361,7 @@ static int testStreaming(struct node *node, unsigned frame_count)
 	node->g_fmt(cur_fmt);
 
 	bool is_output = v4l_type_is_output(type);
+	timespec start = streamStart();
 
 	if (node->g_caps() & V4L2_CAP_STREAMING) {
 		cv4l_queue q(type, V4L2_MEMORY_MMAP);
@@ -3200,13 +3391,15 @@ static int testStreaming(struct node *node, unsigned frame_count)
 		}
 		fail_on_test(node->streamon());
 
-		while (node->dqbuf(buf) == 0) {
+		for (unsigned frame = 0; node->dqbuf(buf) == 0; frame++) {
 			if (!no_progress)
 				printf("\r\t\t%s: Frame #%03d Field %s   ",
 				       buftype2s(q.g_type()).c_str(),
 				       buf.g_sequence(), field2s(buf.g_field()).c_str());
 			fflush(stdout);
 			fail_on_test(buf.g_flags() & V4L2_BUF_FLAG_DONE);
+			if (!is_output)
+				fail_on_test(checkFrameHash(q, buf, frame));
 			buf.s_field(field);
 			if (alternate)
 				field ^= 1;
@@ -3215,7 +3408,7 @@ static int testStreaming(struct node *node, unsigned frame_count)
 				return 0;
 			fail_on_test(node->qbuf(buf));
 			fail_on_test(buf.g_flags() & V4L2_BUF_FLAG_DONE);
-			if (--frame_count == 0)
+			if (--frame_count == 0 || streamBudgetExceeded(start))
 				break;
 		}
 		q.free(node);
@@ -3238,9 +3431,17 @@ static int testStreaming(struct node *node, unsigned frame_count)
 		else
 			ret = node->write(tmp, size);
 		fail_on_test(ret != size);
+		if (node->can_capture) {
+			const __u8 *planes[1] = { static_cast<const __u8 *>(tmp) };
+			unsigned sizes[1] = { static_cast<unsigned>(size) };
+
+			fail_on_test(checkFrameHash(planes, sizes, 1, i));
+		}
 		if (!no_progress)
 			printf("\r\t\t%s: Frame #%03d", buftype2s(type).c_str(), i);
 		fflush(stdout);
+		if (streamBudgetExceeded(start))
+			break;
 	}
 	if (!no_progress)
 		printf("\r\t\t                                                            ");
@@ -3324,6 +3525,8 @@ static void streamFmtRun(struct node *node, cv4l_fmt &fmt, unsigned frame_count,
 				compose.r.width, compose.r.height,
 				compose.r.left, compose.r.top);
 	}
+	setHashKey(node, fmt, has_crop ? &crop : nullptr,
+		   has_compose ? &compose : nullptr);
 	printf("\r\t\t%s%sStride %u, Field %s%s: %s   \n",
 			s_crop, s_compose,
 			fmt.g_bytesperline(),
@@ -3567,14 +3770,67 @@ static void streamIntervals(struct node *node, __u32 pixelformat, __u32 w, __u32
 	}
 
 	if (frmival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+		std::vector<v4l2_fract> ivals;
+
 		do {
-			streamFmt(node, pixelformat, w, h, &frmival.discrete,
-				  frame_count);
+			ivals.push_back(frmival.discrete);
 		} while (!node->enum_frameintervals(frmival));
+
+		// In fast mode only stream the first and last interval
+		for (unsigned i = 0; i < ivals.size(); i++) {
+			if (stream_budget && i && i != ivals.size() - 1)
+				continue;
+			streamFmt(node, pixelformat, w, h, &ivals[i], frame_count);
+			coverage.intervals_tested++;
+		}
+		coverage.intervals += ivals.size();
 		return;
 	}
 	streamFmt(node, pixelformat, w, h, &frmival.stepwise.min, frame_count);
 	streamFmt(node, pixelformat, w, h, &frmival.stepwise.max, frame_count);
+	coverage.intervals += 2;
+	coverage.intervals_tested += 2;
+}
+
+/*
+ * Return the discrete frame sizes to stream, starting with the one in
+ * frmsize. In fast mode these are only the smallest, the median and the
+ * largest frame size.
+ */
+static std::vector<v4l2_frmsize_discrete> sampleFrameSizes(struct node *node,
+							    v4l2_frmsizeenum &frmsize)
+{
+	std::vector<v4l2_frmsize_discrete> sizes;
+
+	do {
+		sizes.push_back(frmsize.discrete);
+	} while (!node->enum_framesizes(frmsize));
+	coverage.sizes += sizes.size();
+
+	if (stream_budget && sizes.size() > 3) {
+		std::stable_sort(sizes.begin(), sizes.end(),
+				 [](const v4l2_frmsize_discrete &a, const v4l2_frmsize_discrete &b)
+				 { return a.width * a.height < b.width * b.height; });
+		sizes = { sizes.front(), sizes[sizes.size() / 2], sizes.back() };
+	}
+	coverage.sizes_tested += sizes.size();
+	return sizes;
+}
+
+static void startCoverage()
+{
+	memset(&coverage, 0, sizeof(coverage));
+	coverage.budget_hits = stream_budget_hits;
+}
+
+static void showCoverage()
+{
+	if (!stream_budget)
+		return;
+	printf("\tCoverage: %u of %u discrete frame sizes, %u of %u frame intervals, %u test(s) stopped after %.1f seconds\n",
+	       coverage.sizes_tested, coverage.sizes,
+	       coverage.intervals_tested, coverage.intervals,
+	       stream_budget_hits - coverage.budget_hits, stream_budget);
 }
 
 void streamAllFormats(struct node *node, unsigned frame_count)
@@ -3584,6 +3840,7 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 	if (node->enum_fmt(fmtdesc, true))
 		return;
 	selTests.clear();
+	startCoverage();
 	do {
 		v4l2_frmsizeenum frmsize;
 		cv4l_fmt fmt;
@@ -3625,12 +3882,10 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 
 		switch (frmsize.type) {
 		case V4L2_FRMSIZE_TYPE_DISCRETE:
-			do {
+			for (const auto &size : sampleFrameSizes(node, frmsize))
 				streamIntervals(node, fmtdesc.pixelformat,
-						frmsize.discrete.width,
-						frmsize.discrete.height,
+						size.width, size.height,
 						frame_count);
-			} while (!node->enum_framesizes(frmsize));
 			break;
 		default:
 			restoreFormat(node);
@@ -3656,6 +3911,7 @@ void streamAllFormats(struct node *node, unsigned frame_count)
 			break;
 		}
 	} while (!node->enum_fmt(fmtdesc));
+	showCoverage();
 }
 
 static void streamM2MRun(struct node *node, unsigned frame_count)
@@ -3716,6 +3972,7 @@ void streamM2MAllFormats(struct node *node, unsigned frame_count)
 	if (node->enum_fmt(fmtdesc, true, 0, out_type))
 		return;
 	selTests.clear();
+	startCoverage();
 	do {
 		v4l2_frmsizeenum frmsize;
 		cv4l_fmt fmt;
@@ -3757,12 +4014,10 @@ void streamM2MAllFormats(struct node *node, unsigned frame_count)
 
 		switch (frmsize.type) {
 		case V4L2_FRMSIZE_TYPE_DISCRETE:
-			do {
+			for (const auto &size : sampleFrameSizes(node, frmsize))
 				streamM2MOutFormat(node, fmtdesc.pixelformat,
-						   frmsize.discrete.width,
-						   frmsize.discrete.height,
+						   size.width, size.height,
 						   frame_count);
-			} while (!node->enum_framesizes(frmsize));
 			break;
 		default:
 			node->g_fmt(fmt, out_type);
@@ -3788,4 +4043,5 @@ void streamM2MAllFormats(struct node *node, unsigned frame_count)
 			break;
 		}
 	} while (!node->enum_fmt(fmtdesc));
+	showCoverage();
 }
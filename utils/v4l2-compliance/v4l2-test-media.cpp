@@ -20,10 +20,15 @@
 
 #include <map>
 #include <set>
+#include <string>
+#include <vector>
 
+#include <csignal>
 #include <dirent.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "v4l2-compliance.h"
 
@@ -535,84 +540,291 @@ int testMediaSetupLink(struct node *node)
 	return 0;
 }
 
-void walkTopology(struct node &node, struct node &expbuf_node,
-		  unsigned frame_count, unsigned all_fmt_frame_count)
+static void testInterface(struct node &node, struct node &expbuf_node,
+			  const std::string &dev, unsigned frame_count,
+			  unsigned all_fmt_frame_count)
 {
-	media_v2_topology topology;
+	printf("--------------------------------------------------------------------------------\n");
 
-	memset(&topology, 0, sizeof(topology));
-	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+	media_type type = mi_media_detect_type(dev.c_str());
+	if (type == MEDIA_TYPE_CANT_STAT) {
+		fprintf(stderr, "\nCannot open device %s, skipping.\n\n",
+			dev.c_str());
 		return;
+	}
 
-	media_v2_interface v2_ifaces[topology.num_interfaces];
+	switch (type) {
+	// For now we can only handle V4L2 devices
+	case MEDIA_TYPE_VIDEO:
+	case MEDIA_TYPE_VBI:
+	case MEDIA_TYPE_RADIO:
+	case MEDIA_TYPE_SDR:
+	case MEDIA_TYPE_TOUCH:
+	case MEDIA_TYPE_SUBDEV:
+		break;
+	default:
+		type = MEDIA_TYPE_UNKNOWN;
+		break;
+	}
 
-	topology.ptr_interfaces = (uintptr_t)v2_ifaces;
-	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+	if (type == MEDIA_TYPE_UNKNOWN) {
+		fprintf(stderr, "\nUnable to detect what device %s is, skipping.\n\n",
+			dev.c_str());
 		return;
+	}
 
-	for (unsigned i = 0; i < topology.num_interfaces; i++) {
-		media_v2_interface &iface = v2_ifaces[i];
-		std::string dev = mi_media_get_device(iface.devnode.major,
-						      iface.devnode.minor);
-		if (dev.empty())
-			continue;
+	struct node test_node;
+	int fd = -1;
+
+	test_node.device = dev.c_str();
+	test_node.s_trace(node.g_trace());
+	switch (type) {
+	case MEDIA_TYPE_MEDIA:
+		test_node.s_direct(true);
+		fd = test_node.media_open(dev.c_str(), false);
+		break;
+	case MEDIA_TYPE_SUBDEV:
+		test_node.s_direct(true);
+		fd = test_node.subdev_open(dev.c_str(), false);
+		break;
+	default:
+		test_node.s_direct(node.g_direct());
+		fd = test_node.open(dev.c_str(), false);
+		break;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "\nFailed to open device %s, skipping\n\n",
+			dev.c_str());
+		return;
+	}
 
-		printf("--------------------------------------------------------------------------------\n");
+	testNode(test_node, test_node, expbuf_node, type,
+		 frame_count, all_fmt_frame_count, node.g_fd());
+	test_node.close();
+}
 
-		media_type type = mi_media_detect_type(dev.c_str());
-		if (type == MEDIA_TYPE_CANT_STAT) {
-			fprintf(stderr, "\nCannot open device %s, skipping.\n\n",
-				dev.c_str());
-			continue;
-		}
+static __u32 findRoot(std::map<__u32, __u32> &parent, __u32 id)
+{
+	while (parent.find(id) != parent.end() && parent[id] != id)
+		id = parent[id] = parent[parent[id]];
+	return id;
+}
+
+/*
+ * Interfaces whose entities are linked, directly or not, are part of the
+ * same pipeline and cannot be tested independently. Group the interfaces
+ * by the connected parts of the graph.
+ */
+static void groupInterfaces(const media_v2_topology &topology,
+			    const std::vector<std::string> &devs,
+			    std::vector<std::vector<std::string>> &groups)
+{
+	auto v2_ents = reinterpret_cast<media_v2_entity *>(topology.ptr_entities);
+	auto v2_ifaces = reinterpret_cast<media_v2_interface *>(topology.ptr_interfaces);
+	auto v2_pads = reinterpret_cast<media_v2_pad *>(topology.ptr_pads);
+	auto v2_links = reinterpret_cast<media_v2_link *>(topology.ptr_links);
+	std::map<__u32, __u32> parent, pad_entity, iface_entity;
+	std::map<__u32, unsigned> root_group;
+
+	for (unsigned i = 0; i < topology.num_entities; i++)
+		parent[v2_ents[i].id] = v2_ents[i].id;
+	for (unsigned i = 0; i < topology.num_pads; i++)
+		pad_entity[v2_pads[i].id] = v2_pads[i].entity_id;
+
+	for (unsigned i = 0; i < topology.num_links; i++) {
+		const media_v2_link &link = v2_links[i];
+		__u32 source, sink;
 
-		switch (type) {
-		// For now we can only handle V4L2 devices
-		case MEDIA_TYPE_VIDEO:
-		case MEDIA_TYPE_VBI:
-		case MEDIA_TYPE_RADIO:
-		case MEDIA_TYPE_SDR:
-		case MEDIA_TYPE_TOUCH:
-		case MEDIA_TYPE_SUBDEV:
+		switch (link.flags & MEDIA_LNK_FL_LINK_TYPE) {
+		case MEDIA_LNK_FL_INTERFACE_LINK:
+			iface_entity[link.source_id] = link.sink_id;
+			continue;
+		case MEDIA_LNK_FL_DATA_LINK:
+			source = pad_entity[link.source_id];
+			sink = pad_entity[link.sink_id];
 			break;
 		default:
-			type = MEDIA_TYPE_UNKNOWN;
+			source = link.source_id;
+			sink = link.sink_id;
 			break;
 		}
+		parent[findRoot(parent, source)] = findRoot(parent, sink);
+	}
+
+	for (unsigned i = 0; i < topology.num_interfaces; i++) {
+		if (devs[i].empty())
+			continue;
 
-		if (type == MEDIA_TYPE_UNKNOWN) {
-			fprintf(stderr, "\nUnable to detect what device %s is, skipping.\n\n",
-				dev.c_str());
+		auto iter = iface_entity.find(v2_ifaces[i].id);
+
+		if (iter == iface_entity.end()) {
+			groups.push_back({ devs[i] });
 			continue;
 		}
 
-		struct node test_node;
-		int fd = -1;
+		__u32 root = findRoot(parent, iter->second);
 
-		test_node.device = dev.c_str();
-		test_node.s_trace(node.g_trace());
-		switch (type) {
-		case MEDIA_TYPE_MEDIA:
-			test_node.s_direct(true);
-			fd = test_node.media_open(dev.c_str(), false);
-			break;
-		case MEDIA_TYPE_SUBDEV:
-			test_node.s_direct(true);
-			fd = test_node.subdev_open(dev.c_str(), false);
-			break;
-		default:
-			test_node.s_direct(node.g_direct());
-			fd = test_node.open(dev.c_str(), false);
-			break;
+		if (root_group.find(root) == root_group.end()) {
+			root_group[root] = groups.size();
+			groups.push_back({});
 		}
-		if (fd < 0) {
-			fprintf(stderr, "\nFailed to open device %s, skipping\n\n",
-				dev.c_str());
-			continue;
+		groups[root_group[root]].push_back(devs[i]);
+	}
+}
+
+struct worker {
+	pid_t pid;
+	FILE *output;
+	FILE *results;
+	int status;
+	bool done;
+};
+
+static void startWorker(struct worker &w, const std::vector<std::string> &group,
+			struct node &node, struct node &expbuf_node,
+			unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	w.output = tmpfile();
+	w.results = tmpfile();
+	w.status = 0;
+	w.done = false;
+
+	fflush(stdout);
+	fflush(stderr);
+	w.pid = (w.output && w.results) ? fork() : -1;
+
+	if (w.pid == 0) {
+		resetResults();
+		dup2(fileno(w.output), STDOUT_FILENO);
+		if (expbuf_node.g_fd() >= 0)
+			expbuf_node.reopen();
+		for (const auto &dev : group)
+			testInterface(node, expbuf_node, dev, frame_count,
+				      all_fmt_frame_count);
+		fflush(stdout);
+		writeResults(w.results);
+		fflush(w.results);
+		_exit(EXIT_SUCCESS);
+	}
+
+	if (w.pid > 0)
+		return;
+
+	// Could not start a worker, test the group in this process
+	for (const auto &dev : group)
+		testInterface(node, expbuf_node, dev, frame_count,
+			      all_fmt_frame_count);
+	w.done = true;
+}
+
+static bool finishWorker(struct worker &w)
+{
+	bool ok = true;
+
+	char buf[4096];
+	size_t sz;
+
+	if (w.output) {
+		rewind(w.output);
+		while ((sz = fread(buf, 1, sizeof(buf), w.output)))
+			fwrite(buf, 1, sz, stdout);
+		fflush(stdout);
+		fclose(w.output);
+	}
+
+	if (w.results) {
+		if (w.pid > 0 && !readResults(w.results)) {
+			fprintf(stderr, "\nTest process %d did not complete\n\n", w.pid);
+			ok = false;
+		}
+		fclose(w.results);
+	}
+	return ok;
+}
+
+static void walkGroups(const std::vector<std::vector<std::string>> &groups,
+		       struct node &node, struct node &expbuf_node,
+		       unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	std::vector<worker> workers(groups.size());
+	unsigned running = 0, started = 0, finished = 0;
+
+	while (finished < groups.size()) {
+		while (running < parallel_jobs && started < groups.size()) {
+			startWorker(workers[started], groups[started], node,
+				    expbuf_node, frame_count, all_fmt_frame_count);
+			if (workers[started].pid > 0)
+				running++;
+			started++;
+		}
+
+		if (running) {
+			int status;
+			pid_t pid = wait(&status);
+
+			if (pid < 0)
+				break;
+			for (auto &w : workers) {
+				if (w.pid == pid) {
+					w.status = status;
+					w.done = true;
+					running--;
+				}
+			}
+		}
+
+		// Show the output in the order of the topology
+		while (finished < started && workers[finished].done) {
+			if (finishWorker(workers[finished++]) || !exit_on_fail)
+				continue;
+			for (auto &w : workers)
+				if (w.pid > 0 && !w.done)
+					kill(w.pid, SIGKILL);
+			std::exit(EXIT_FAILURE);
 		}
+	}
+}
 
-		testNode(test_node, test_node, expbuf_node, type,
-			 frame_count, all_fmt_frame_count, node.g_fd());
-		test_node.close();
+void walkTopology(struct node &node, struct node &expbuf_node,
+		  unsigned frame_count, unsigned all_fmt_frame_count)
+{
+	media_v2_topology topology;
+
+	memset(&topology, 0, sizeof(topology));
+	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+		return;
+
+	media_v2_entity v2_ents[topology.num_entities];
+	media_v2_interface v2_ifaces[topology.num_interfaces];
+	media_v2_pad v2_pads[topology.num_pads];
+	media_v2_link v2_links[topology.num_links];
+
+	topology.ptr_entities = (uintptr_t)v2_ents;
+	topology.ptr_interfaces = (uintptr_t)v2_ifaces;
+	topology.ptr_pads = (uintptr_t)v2_pads;
+	topology.ptr_links = (uintptr_t)v2_links;
+	if (ioctl(node.g_fd(), MEDIA_IOC_G_TOPOLOGY, &topology))
+		return;
+
+	std::vector<std::string> devs(topology.num_interfaces);
+
+	for (unsigned i = 0; i < topology.num_interfaces; i++)
+		devs[i] = mi_media_get_device(v2_ifaces[i].devnode.major,
+					      v2_ifaces[i].devnode.minor);
+
+	if (parallel_jobs > 1) {
+		std::vector<std::vector<std::string>> groups;
+
+		groupInterfaces(topology, devs, groups);
+		walkGroups(groups, node, expbuf_node, frame_count,
+			   all_fmt_frame_count);
+		return;
+	}
+
+	for (const auto &dev : devs) {
+		if (dev.empty())
+			continue;
+		testInterface(node, expbuf_node, dev, frame_count,
+			      all_fmt_frame_count);
 	}
 }
@@ -0,0 +1,601 @@
+/*
+    V4L2 API compliance streaming performance tests.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "v4l2-compliance.h"
+
+/*
+ * Number of buffers to stream with, and of frames to skip before
+ * measuring the frame rate and the jitter, as the first frames are
+ * often delayed while the pipeline starts up.
+ */
+#define PERF_BUFFERS	4
+#define PERF_WARMUP	2
+
+#define FILE_HDR_ID	v4l2_fourcc('V', 'h', 'd', 'r')
+
+/*
+ * Baseline for a driver and memory model. The frame rate is a minimum,
+ * the other metrics are maximums. A metric set to 0 is not checked.
+ */
+struct perf_baseline {
+	double fps;
+	double qbuf_us;
+	double dqbuf_us;
+	double jitter_us;
+	double turnaround_ms;
+	double tolerance;	/* in percent */
+};
+
+static std::map<std::string, perf_baseline> perf_baselines;
+
+static const char *memory2s(unsigned memory)
+{
+	switch (memory) {
+	case V4L2_MEMORY_MMAP:
+		return "mmap";
+	case V4L2_MEMORY_USERPTR:
+		return "userptr";
+	case V4L2_MEMORY_DMABUF:
+		return "dmabuf";
+	default:
+		return "unknown";
+	}
+}
+
+/*
+ * Each line of the baseline file is:
+ *
+ * <driver> <mmap|userptr|dmabuf> [fps=<fps>] [qbuf=<us>] [dqbuf=<us>]
+ *	[jitter=<us>] [turnaround=<ms>] [tolerance=<percent>]
+ *
+ * Empty lines and lines starting with '#' are ignored.
+ */
+bool loadPerfBaselines(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	char line[512];
+	unsigned lineno = 0;
+
+	if (!f) {
+		fprintf(stderr, "Cannot open %s: %s\n", file, strerror(errno));
+		return false;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		perf_baseline base = {};
+		char *p = line;
+		char *driver, *memory, *metric;
+
+		lineno++;
+		p[strcspn(p, "#\n")] = '\0';
+		driver = strtok(p, " \t");
+		if (!driver)
+			continue;
+		memory = strtok(nullptr, " \t");
+		if (!memory || (strcmp(memory, "mmap") && strcmp(memory, "userptr") &&
+				strcmp(memory, "dmabuf"))) {
+			fprintf(stderr, "%s:%u: invalid memory model\n", file, lineno);
+			fclose(f);
+			return false;
+		}
+
+		base.tolerance = 10;
+		while ((metric = strtok(nullptr, " \t"))) {
+			char *value = strchr(metric, '=');
+			double *dst = nullptr;
+
+			if (value)
+				*value++ = '\0';
+			if (!strcmp(metric, "fps"))
+				dst = &base.fps;
+			else if (!strcmp(metric, "qbuf"))
+				dst = &base.qbuf_us;
+			else if (!strcmp(metric, "dqbuf"))
+				dst = &base.dqbuf_us;
+			else if (!strcmp(metric, "jitter"))
+				dst = &base.jitter_us;
+			else if (!strcmp(metric, "turnaround"))
+				dst = &base.turnaround_ms;
+			else if (!strcmp(metric, "tolerance"))
+				dst = &base.tolerance;
+			if (!dst || !value) {
+				fprintf(stderr, "%s:%u: invalid metric '%s'\n",
+					file, lineno, metric);
+				fclose(f);
+				return false;
+			}
+			*dst = strtod(value, nullptr);
+		}
+		perf_baselines[std::string(driver) + " " + memory] = base;
+	}
+	fclose(f);
+	return true;
+}
+
+static double now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static double mean(const std::vector<double> &v)
+{
+	double sum = 0;
+
+	for (auto x : v)
+		sum += x;
+	return v.empty() ? 0 : sum / v.size();
+}
+
+static double stddev(const std::vector<double> &v)
+{
+	double m = mean(v);
+	double sum = 0;
+
+	for (auto x : v)
+		sum += (x - m) * (x - m);
+	return v.size() < 2 ? 0 : std::sqrt(sum / (v.size() - 1));
+}
+
+static int checkBaseline(const char *metric, double value, double limit,
+			 double tolerance, bool is_min)
+{
+	if (!limit)
+		return 0;
+	if (is_min && value < limit * (1 - tolerance / 100))
+		return fail("%s of %.2f is below the baseline of %.2f\n",
+			    metric, value, limit);
+	if (!is_min && value > limit * (1 + tolerance / 100))
+		return fail("%s of %.2f is above the baseline of %.2f\n",
+			    metric, value, limit);
+	return 0;
+}
+
+static int setupPerfDmaBuf(struct node *expbuf_node, cv4l_queue &q,
+			   cv4l_queue &exp_q)
+{
+	fail_on_test(exp_q.reqbufs(expbuf_node, q.g_buffers()));
+	fail_on_test(exp_q.g_buffers() < q.g_buffers());
+	fail_on_test(exp_q.export_bufs(expbuf_node, exp_q.g_type()));
+	fail_on_test(exp_q.g_num_planes() < q.g_num_planes());
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		for (unsigned p = 0; p < q.g_num_planes(); p++) {
+			fail_on_test(exp_q.g_length(p) < q.g_length(p));
+			q.s_fd(i, p, exp_q.g_fd(i, p));
+		}
+	}
+	return 0;
+}
+
+static int perfQbuf(struct node *node, const cv4l_queue &q, cv4l_buffer &buf,
+		    std::vector<double> &qbuf_us, double *queued)
+{
+	double start;
+
+	buf.update(q, buf.g_index());
+	if (v4l_type_is_output(q.g_type()))
+		for (unsigned p = 0; p < q.g_num_planes(); p++)
+			buf.s_bytesused(q.g_length(p), p);
+
+	start = now_us();
+	fail_on_test(node->qbuf(buf));
+	queued[buf.g_index()] = now_us();
+	qbuf_us.push_back(queued[buf.g_index()] - start);
+	return 0;
+}
+
+/*
+ * Streams frame_count frames with the current format and the given
+ * memory model, and measures the sustained frame rate against the
+ * nominal frame interval, the VIDIOC_QBUF and VIDIOC_DQBUF latencies,
+ * the jitter of the buffer timestamps and the time between queuing a
+ * buffer and dequeuing it.
+ */
+int testPerf(struct node *node, struct node *expbuf_node, unsigned memory,
+	     unsigned frame_count)
+{
+	cv4l_queue q(node->g_type(), memory);
+	cv4l_queue exp_q;
+	std::vector<double> qbuf_us, dqbuf_us, turnaround_us, deltas_us;
+	double queued[VIDEO_MAX_FRAME] = {};
+	double first = 0, last = 0, prev_ts = 0;
+	unsigned frames = 0;
+	v4l2_capability vcap;
+	v4l2_fract interval;
+	double nominal_fps = 0;
+	double fps = 0;
+	int ret = 0;
+
+	if (!(node->g_caps() & V4L2_CAP_STREAMING) ||
+	    !(node->valid_memorytype & (1 << memory)))
+		return ENOTTY;
+
+	if (frame_count <= PERF_WARMUP + 1)
+		frame_count = PERF_WARMUP + 2;
+
+	if (!node->get_interval(interval) && interval.numerator)
+		nominal_fps = static_cast<double>(interval.denominator) /
+			      interval.numerator;
+
+	fail_on_test(q.reqbufs(node, PERF_BUFFERS));
+	fail_on_test(q.g_buffers() > VIDEO_MAX_FRAME);
+	if (memory == V4L2_MEMORY_DMABUF) {
+		unsigned expbuf_type;
+
+		if (expbuf_node->g_caps() & V4L2_CAP_VIDEO_CAPTURE_MPLANE)
+			expbuf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		else if (expbuf_node->g_caps() & V4L2_CAP_VIDEO_CAPTURE)
+			expbuf_type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		else if (expbuf_node->g_caps() & V4L2_CAP_VIDEO_OUTPUT_MPLANE)
+			expbuf_type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+		else
+			expbuf_type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+		exp_q.init(expbuf_type, V4L2_MEMORY_MMAP);
+		fail_on_test(setupPerfDmaBuf(expbuf_node, q, exp_q));
+	} else {
+		fail_on_test(q.obtain_bufs(node));
+	}
+
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		cv4l_buffer buf(q, i);
+
+		fail_on_test(perfQbuf(node, q, buf, qbuf_us, queued));
+	}
+	fail_on_test(node->streamon(q.g_type()));
+
+	while (frames < frame_count) {
+		struct timeval tv = { 2, 0 };
+		cv4l_buffer buf(q);
+		fd_set fds;
+		double start, end, ts;
+
+		FD_ZERO(&fds);
+		FD_SET(node->g_fd(), &fds);
+		if (v4l_type_is_output(q.g_type()))
+			ret = select(node->g_fd() + 1, nullptr, &fds, nullptr, &tv);
+		else
+			ret = select(node->g_fd() + 1, &fds, nullptr, nullptr, &tv);
+		fail_on_test(ret <= 0);
+
+		start = now_us();
+		fail_on_test(node->dqbuf(buf));
+		end = now_us();
+		dqbuf_us.push_back(end - start);
+		turnaround_us.push_back(end - queued[buf.g_index()]);
+
+		/* Fall back to the dequeue time if the timestamps are not monotonic */
+		if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+		    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+			ts = buf.g_timestamp().tv_sec * 1000000.0 +
+			     buf.g_timestamp().tv_usec;
+		else
+			ts = end;
+
+		if (frames >= PERF_WARMUP) {
+			if (frames == PERF_WARMUP)
+				first = end;
+			else
+				deltas_us.push_back(ts - prev_ts);
+			last = end;
+		}
+		prev_ts = ts;
+		frames++;
+
+		fail_on_test(perfQbuf(node, q, buf, qbuf_us, queued));
+	}
+
+	fail_on_test(node->streamoff(q.g_type()));
+	q.release_bufs(node);
+	fail_on_test(q.reqbufs(node, 0));
+	if (memory == V4L2_MEMORY_DMABUF) {
+		exp_q.close_exported_fds();
+		exp_q.reqbufs(expbuf_node, 0);
+	}
+
+	if (last > first)
+		fps = (frames - PERF_WARMUP - 1) * 1000000.0 / (last - first);
+
+	if (nominal_fps)
+		printf("\t\t%u frames: %.2f fps (nominal %.2f fps)\n",
+		       frames, fps, nominal_fps);
+	else
+		printf("\t\t%u frames: %.2f fps\n", frames, fps);
+	printf("\t\tQBUF %.1f us, DQBUF %.1f us, jitter %.1f us, turnaround %.2f ms\n",
+	       mean(qbuf_us), mean(dqbuf_us), stddev(deltas_us),
+	       mean(turnaround_us) / 1000.0);
+
+	fail_on_test(node->querycap(vcap));
+	std::string key = std::string(reinterpret_cast<const char *>(vcap.driver)) +
+			  " " + memory2s(memory);
+	auto iter = perf_baselines.find(key);
+
+	if (iter == perf_baselines.end())
+		return 0;
+
+	const perf_baseline &base = iter->second;
+
+	ret = checkBaseline("fps", fps, base.fps, base.tolerance, true);
+	ret |= checkBaseline("QBUF us", mean(qbuf_us), base.qbuf_us,
+			     base.tolerance, false);
+	ret |= checkBaseline("DQBUF us", mean(dqbuf_us), base.dqbuf_us,
+			     base.tolerance, false);
+	ret |= checkBaseline("jitter us", stddev(deltas_us), base.jitter_us,
+			     base.tolerance, false);
+	ret |= checkBaseline("turnaround ms", mean(turnaround_us) / 1000.0,
+			     base.turnaround_ms, base.tolerance, false);
+	return ret;
+}
+
+/*
+ * Read the next frame from the --stream-from file into an output buffer,
+ * in the same way as the other streaming tests.
+ */
+static bool perfRead(int fd, bool use_hdr, const cv4l_queue &q, cv4l_buffer &buf)
+{
+	__u32 v;
+
+	if (use_hdr && (read(fd, &v, sizeof(v)) != sizeof(v) ||
+			ntohl(v) != FILE_HDR_ID))
+		return false;
+
+	for (unsigned p = 0; p < q.g_num_planes(); p++) {
+		__u32 len = q.g_length(p);
+
+		if (use_hdr) {
+			if (read(fd, &len, sizeof(len)) != sizeof(len))
+				return false;
+			len = ntohl(len);
+			if (len > q.g_length(p))
+				return false;
+		}
+		if (read(fd, q.g_dataptr(buf.g_index(), p), len) != static_cast<ssize_t>(len))
+			return false;
+		buf.s_bytesused(len, p);
+		buf.s_data_offset(0, p);
+	}
+	return true;
+}
+
+// Without a file the buffers are queued with whatever they contain
+static bool perfFill(int fd, bool use_hdr, const cv4l_queue &q, cv4l_buffer &buf)
+{
+	if (fd < 0) {
+		for (unsigned p = 0; p < q.g_num_planes(); p++)
+			buf.s_bytesused(q.g_length(p), p);
+		return true;
+	}
+	if (perfRead(fd, use_hdr, q, buf))
+		return true;
+	lseek(fd, 0, SEEK_SET);
+	return perfRead(fd, use_hdr, q, buf);
+}
+
+static int perfSetupCapture(struct node *node, cv4l_queue &q, unsigned depth,
+			    bool restart)
+{
+	if (restart) {
+		fail_on_test(node->streamoff(q.g_type()));
+		q.release_bufs(node);
+		fail_on_test(q.reqbufs(node, 0));
+	}
+	fail_on_test(q.reqbufs(node, depth));
+	fail_on_test(q.g_buffers() > VIDEO_MAX_FRAME);
+	fail_on_test(q.obtain_bufs(node));
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		cv4l_buffer buf(q, i);
+
+		fail_on_test(node->qbuf(buf));
+	}
+	fail_on_test(node->streamon(q.g_type()));
+	if (restart) {
+		struct v4l2_decoder_cmd cmd = {};
+
+		cmd.cmd = V4L2_DEC_CMD_START;
+		fail_on_test(doioctl(node, VIDIOC_DECODER_CMD, &cmd));
+	}
+	return 0;
+}
+
+/*
+ * Streams frame_count frames through an M2M device with depth buffers
+ * on both queues and measures the time from VIDIOC_STREAMON of the output
+ * queue (and from the source change event of a decoder) to the first
+ * frame, the sustained frame rate and, for stateful codecs, the time from
+ * the STOP command to the last buffer. Decoders need a bitstream from
+ * --stream-from, other devices use it if given.
+ */
+int testCodecPerf(struct node *node, unsigned frame_count, unsigned depth)
+{
+	bool is_decoder = node->codec_mask & STATEFUL_DECODER;
+	bool is_codec = node->codec_mask & (STATEFUL_ENCODER | STATEFUL_DECODER);
+	unsigned out_type = v4l_type_invert(node->g_type());
+	cv4l_queue out_q(out_type, V4L2_MEMORY_MMAP);
+	cv4l_queue cap_q(node->g_type(), V4L2_MEMORY_MMAP);
+	double streamon, source_change = 0, first_frame = 0;
+	double first = 0, last = 0, stop = 0, drained = 0;
+	unsigned frames = 0, steady_frames = 0;
+	bool cap_ready = !is_decoder;
+	bool stopped = false;
+	bool use_hdr = false;
+	cv4l_fmt out_fmt;
+	int stream_fd = -1;
+
+	if (!(node->g_caps() & V4L2_CAP_STREAMING))
+		return ENOTTY;
+
+	if (frame_count <= PERF_WARMUP + 1)
+		frame_count = PERF_WARMUP + 2;
+
+	node->g_fmt(out_fmt, out_type);
+	std::string file = stream_from(fcc2s(out_fmt.g_pixelformat()), use_hdr);
+	if (!file.empty()) {
+		stream_fd = open(file.c_str(), O_RDONLY);
+		if (stream_fd < 0)
+			return fail("cannot open %s\n", file.c_str());
+	}
+	fail_on_test(is_decoder && stream_fd < 0);
+
+	if (is_codec) {
+		struct v4l2_event_subscription sub = {};
+
+		sub.type = V4L2_EVENT_EOS;
+		doioctl(node, VIDIOC_SUBSCRIBE_EVENT, &sub);
+		sub.type = V4L2_EVENT_SOURCE_CHANGE;
+		if (is_decoder)
+			fail_on_test(doioctl(node, VIDIOC_SUBSCRIBE_EVENT, &sub));
+	}
+
+	fail_on_test(out_q.reqbufs(node, depth));
+	fail_on_test(out_q.g_buffers() > VIDEO_MAX_FRAME);
+	fail_on_test(out_q.obtain_bufs(node));
+	for (unsigned i = 0; i < out_q.g_buffers(); i++) {
+		cv4l_buffer buf(out_q, i);
+
+		fail_on_test(!perfFill(stream_fd, use_hdr, out_q, buf));
+		fail_on_test(node->qbuf(buf));
+	}
+	// A decoder sets up its capture queue once it parsed the bitstream
+	if (!is_decoder)
+		fail_on_test(perfSetupCapture(node, cap_q, depth, false));
+
+	fcntl(node->g_fd(), F_SETFL, fcntl(node->g_fd(), F_GETFL) | O_NONBLOCK);
+	streamon = now_us();
+	fail_on_test(node->streamon(out_type));
+
+	for (;;) {
+		struct pollfd pfd = { node->g_fd(), POLLIN | POLLOUT | POLLPRI, 0 };
+		int ret = poll(&pfd, 1, 2000);
+
+		fail_on_test(ret <= 0);
+
+		if (pfd.revents & POLLPRI) {
+			struct v4l2_event ev;
+
+			while (!doioctl(node, VIDIOC_DQEVENT, &ev)) {
+				if (ev.type != V4L2_EVENT_SOURCE_CHANGE)
+					continue;
+				if (!source_change)
+					source_change = now_us();
+				fail_on_test(perfSetupCapture(node, cap_q, depth, cap_ready));
+				cap_ready = true;
+			}
+		}
+
+		if (pfd.revents & POLLOUT) {
+			cv4l_buffer buf(out_q);
+
+			if (!node->dqbuf(buf) && !stopped) {
+				fail_on_test(!perfFill(stream_fd, use_hdr, out_q, buf));
+				fail_on_test(node->qbuf(buf));
+			}
+		}
+
+		if (!cap_ready || !(pfd.revents & POLLIN))
+			continue;
+
+		cv4l_buffer buf(cap_q);
+
+		ret = node->dqbuf(buf);
+		if (ret == EAGAIN)
+			continue;
+		fail_on_test_val(ret, ret);
+
+		double now = now_us();
+
+		if (buf.g_bytesused()) {
+			if (!frames)
+				first_frame = now;
+			if (frames == PERF_WARMUP)
+				first = now;
+			if (!stopped) {
+				last = now;
+				steady_frames = frames + 1;
+			}
+			frames++;
+		}
+		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
+			if (stopped) {
+				drained = now;
+				break;
+			}
+			// A resolution change, wait for the source change event
+			continue;
+		}
+		fail_on_test(node->qbuf(buf));
+
+		if (frames < frame_count || stopped)
+			continue;
+		if (!is_codec)
+			break;
+
+		stop = now_us();
+		if (is_decoder) {
+			struct v4l2_decoder_cmd cmd = {};
+
+			cmd.cmd = V4L2_DEC_CMD_STOP;
+			fail_on_test(doioctl(node, VIDIOC_DECODER_CMD, &cmd));
+		} else {
+			struct v4l2_encoder_cmd cmd = {};
+
+			cmd.cmd = V4L2_ENC_CMD_STOP;
+			fail_on_test(doioctl(node, VIDIOC_ENCODER_CMD, &cmd));
+		}
+		stopped = true;
+	}
+
+	fail_on_test(node->streamoff(out_type));
+	fail_on_test(node->streamoff(cap_q.g_type()));
+	out_q.release_bufs(node);
+	cap_q.release_bufs(node);
+	fail_on_test(out_q.reqbufs(node, 0));
+	fail_on_test(cap_q.reqbufs(node, 0));
+	if (stream_fd >= 0)
+		close(stream_fd);
+
+	double fps = 0;
+
+	if (last > first && steady_frames > PERF_WARMUP + 1)
+		fps = (steady_frames - PERF_WARMUP - 1) * 1000000.0 / (last - first);
+
+	printf("\t\t%u frames with %u/%u buffers: first frame %.2f ms",
+	       frames, out_q.g_buffers(), cap_q.g_buffers(),
+	       (first_frame - streamon) / 1000.0);
+	if (source_change)
+		printf(" (%.2f ms after the source change)",
+		       (first_frame - source_change) / 1000.0);
+	printf(", %.2f fps", fps);
+	if (is_codec)
+		printf(", drain %.2f ms", (drained - stop) / 1000.0);
+	printf("\n");
+	return 0;
+}
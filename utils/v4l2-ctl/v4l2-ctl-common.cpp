@@ -3,6 +3,7 @@
 #include <cstring>
 #include <list>
 #include <map>
+#include <unordered_map>
 #include <vector>
 
 #include <dirent.h>
@@ -24,9 +25,10 @@ struct ctrl_subset {
 
 using class2ctrls_map = std::map<unsigned int, std::vector<struct v4l2_ext_control> >;
 
-using ctrl_qmap = std::map<std::string, struct v4l2_query_ext_ctrl>;
+// The controls are enumerated once and looked up by name or ID
+using ctrl_qmap = std::unordered_map<std::string, struct v4l2_query_ext_ctrl>;
 static ctrl_qmap ctrl_str2q;
-using ctrl_idmap = std::map<unsigned int, std::string>;
+using ctrl_idmap = std::unordered_map<unsigned int, std::string>;
 static ctrl_idmap ctrl_id2str;
 
 using ctrl_subset_map = std::map<std::string, ctrl_subset>;
@@ -55,6 +57,9 @@ void common_usage()
 	       "                     devices of the media device with the bus info string as\n"
 	       "                     specified by the -z option.\n"
 	       "  --all              display all information available\n"
+	       "  --batch <file>     run the commands of each line of <file> (- for stdin)\n"
+	       "                     on the device. The controls are enumerated only once.\n"
+	       "                     Stops at the first line that fails.\n"
 	       "  -C, --get-ctrl <ctrl>[,<ctrl>...]\n"
 	       "                     get the value of the controls [VIDIOC_G_EXT_CTRLS]\n"
 	       "  -c, --set-ctrl <ctrl>=<val>[,<ctrl>=<val>...]\n"
@@ -981,12 +986,16 @@ void common_process_controls(cv4l_fd &fd)
 	struct v4l2_query_ext_ctrl qc = {
 		V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND
 	};
+	static bool found_controls;
 	int rc;
 
-	rc = test_ioctl(fd.g_fd(), VIDIOC_QUERY_EXT_CTRL, &qc);
-	have_query_ext_ctrl = rc == 0;
-
-	find_controls(fd);
+	// The lines of a batch file share the controls of the first
+	if (!found_controls) {
+		rc = test_ioctl(fd.g_fd(), VIDIOC_QUERY_EXT_CTRL, &qc);
+		have_query_ext_ctrl = rc == 0;
+		find_controls(fd);
+		found_controls = true;
+	}
 	for (const auto &get_ctrl : get_ctrls) {
 		std::string s = get_ctrl;
 		if (isdigit(s[0])) {
@@ -1183,6 +1192,60 @@ static bool idx_in_subset(const struct v4l2_query_ext_ctrl &qc, const ctrl_subse
 	return true;
 }
 
+/*
+ * Devices with extended controls can get or set controls of all classes
+ * with a single ioctl. Old-style private controls can only be accessed
+ * with VIDIOC_G/S_CTRL, so those are left to the per-class fallback.
+ */
+static bool flatten_ctrls(class2ctrls_map &class2ctrls,
+			  std::vector<struct v4l2_ext_control> &all)
+{
+	if (!have_query_ext_ctrl ||
+	    class2ctrls.find(V4L2_CID_PRIVATE_BASE) != class2ctrls.end())
+		return false;
+	for (const auto &class2ctrl : class2ctrls)
+		all.insert(all.end(), class2ctrl.second.begin(),
+			   class2ctrl.second.end());
+	return true;
+}
+
+static bool bulk_ctrls_ioctl(int fd, unsigned long request, const char *name,
+			     std::vector<struct v4l2_ext_control> &all)
+{
+	struct v4l2_ext_controls ctrls;
+
+	memset(&ctrls, 0, sizeof(ctrls));
+	ctrls.which = V4L2_CTRL_WHICH_CUR_VAL;
+	ctrls.count = all.size();
+	ctrls.controls = &all[0];
+	// On failure the per-class ioctls are tried to report the error
+	if (test_ioctl(fd, request, &ctrls))
+		return false;
+	if (verbose)
+		info("%s: ok\n", name);
+	return true;
+}
+
+static void print_ctrl(int fd, const struct v4l2_ext_control &ctrl, bool use_ext_ctrls)
+{
+	std::string &name = ctrl_id2str[ctrl.id];
+	struct v4l2_query_ext_ctrl &qc = ctrl_str2q[name];
+
+	// Keep the VIDIOC_G_CTRL output for user controls
+	if (!use_ext_ctrls && V4L2_CTRL_ID2WHICH(ctrl.id) == V4L2_CTRL_CLASS_USER) {
+		printf("%s: %d\n", name.c_str(), ctrl.value);
+		return;
+	}
+	if (qc.nr_of_dims) {
+		print_value(fd, qc, ctrl, true, true);
+		return;
+	}
+
+	printf("%s: ", name.c_str());
+	print_value(fd, qc, ctrl, true, false);
+	printf("\n");
+}
+
 void common_set(cv4l_fd &_fd)
 {
 	int fd = _fd.g_fd();
@@ -1194,6 +1257,7 @@ void common_set(cv4l_fd &_fd)
 	}
 
 	if (options[OptSetCtrl] && !set_ctrls.empty()) {
+		std::vector<struct v4l2_ext_control> all;
 		struct v4l2_ext_controls ctrls;
 		class2ctrls_map class2ctrls;
 		bool use_ext_ctrls = false;
@@ -1294,6 +1358,9 @@ void common_set(cv4l_fd &_fd)
 			}
 			class2ctrls[V4L2_CTRL_ID2WHICH(ctrl.id)].push_back(ctrl);
 		}
+		if (flatten_ctrls(class2ctrls, all) &&
+		    bulk_ctrls_ioctl(fd, VIDIOC_S_EXT_CTRLS, "VIDIOC_S_EXT_CTRLS", all))
+			class2ctrls.clear();
 		for (auto &class2ctrl : class2ctrls) {
 			if (!use_ext_ctrls &&
 			    (class2ctrl.first == V4L2_CTRL_CLASS_USER ||
@@ -1336,6 +1403,7 @@ void common_get(cv4l_fd &_fd)
 	int fd = _fd.g_fd();
 
 	if (options[OptGetCtrl] && !get_ctrls.empty()) {
+		std::vector<struct v4l2_ext_control> all;
 		struct v4l2_ext_controls ctrls;
 		class2ctrls_map class2ctrls;
 		bool use_ext_ctrls = false;
@@ -1364,6 +1432,12 @@ void common_get(cv4l_fd &_fd)
 				use_ext_ctrls = true;
 			class2ctrls[V4L2_CTRL_ID2WHICH(ctrl.id)].push_back(ctrl);
 		}
+		if (flatten_ctrls(class2ctrls, all) &&
+		    bulk_ctrls_ioctl(fd, VIDIOC_G_EXT_CTRLS, "VIDIOC_G_EXT_CTRLS", all)) {
+			for (const auto &ctrl : all)
+				print_ctrl(fd, ctrl, use_ext_ctrls);
+			class2ctrls.clear();
+		}
 		for (auto &class2ctrl : class2ctrls) {
 			if (!use_ext_ctrls &&
 			    (class2ctrl.first == V4L2_CTRL_CLASS_USER ||
@@ -1382,19 +1456,8 @@ void common_get(cv4l_fd &_fd)
 				ctrls.count = class2ctrl.second.size();
 				ctrls.controls = &class2ctrl.second[0];
 				doioctl(fd, VIDIOC_G_EXT_CTRLS, &ctrls);
-				for (auto ctrl : class2ctrl.second) {
-					std::string &name = ctrl_id2str[ctrl.id];
-					struct v4l2_query_ext_ctrl &qc = ctrl_str2q[name];
-
-					if (qc.nr_of_dims) {
-						print_value(fd, qc, ctrl, true, true);
-						continue;
-					}
-
-					printf("%s: ", name.c_str());
-					print_value(fd, qc, ctrl, true, false);
-					printf("\n");
-				}
+				for (const auto &ctrl : class2ctrl.second)
+					print_ctrl(fd, ctrl, true);
 			}
 		}
 	}
@@ -7,6 +7,8 @@ static unsigned mbus_code;
 static unsigned mbus_code_out;
 static bool enum_all;
 static bool enum_all_out;
+static const char *log_file;
+static FILE *log_fout;
 
 void meta_usage()
 {
@@ -39,6 +41,11 @@ void meta_usage()
 	       "  --try-fmt-meta-out <f> try the metadata output format [VIDIOC_TRY_FMT]\n"
 	       "                     parameter is either the format index as reported by\n"
 	       "                     --list-formats-meta-out, or the fourcc value as a string\n"
+	       "  --meta-log <file>  write the captured metadata buffers to <file> as a binary log:\n"
+	       "                     each buffer is preceded by a 16 byte little endian header\n"
+	       "                     with the 32 bit sequence number, the 32 bit size of the data\n"
+	       "                     and the 64 bit timestamp in ns, so the metadata can be matched\n"
+	       "                     to the video frames by sequence number or timestamp.\n"
 	       );
 }
 
@@ -75,6 +82,9 @@ void meta_cmd(int ch, char *optarg)
 				mbus_code_out = strtoul(optarg, nullptr, 0);
 		}
 		break;
+	case OptMetaLog:
+		log_file = optarg;
+		break;
 	}
 }
 
@@ -215,3 +225,41 @@ void meta_fillbuffer(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q)
 			break;
 	}
 }
+
+void meta_log_buffer(cv4l_buffer &buf, cv4l_queue &q)
+{
+	__u32 hdr[4];
+	__u64 ts = buf.g_timestamp_ns();
+	__u32 used = buf.g_bytesused(0);
+	unsigned offset = buf.g_data_offset(0);
+
+	if (!log_file || !v4l_type_is_meta(buf.g_type()))
+		return;
+	if (!log_fout) {
+		log_fout = fopen(log_file, "w");
+		if (!log_fout) {
+			fprintf(stderr, "could not open %s for writing\n", log_file);
+			log_file = nullptr;
+			return;
+		}
+	}
+
+	if (offset > used)
+		offset = 0;
+	used -= offset;
+	hdr[0] = htole32(buf.g_sequence());
+	hdr[1] = htole32(used);
+	hdr[2] = htole32(ts & 0xffffffff);
+	hdr[3] = htole32(ts >> 32);
+	if (fwrite(hdr, sizeof(hdr), 1, log_fout) != 1 ||
+	    fwrite(static_cast<__u8 *>(q.g_dataptr(buf.g_index(), 0)) + offset,
+		   1, used, log_fout) != used)
+		fprintf(stderr, "%s: write error\n", log_file);
+}
+
+void meta_log_close()
+{
+	if (log_fout)
+		fclose(log_fout);
+	log_fout = nullptr;
+}
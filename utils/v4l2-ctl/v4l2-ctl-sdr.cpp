@@ -1,6 +1,9 @@
+#include <endian.h>
+
 #include "v4l2-ctl.h"
 
 static struct v4l2_format vfmt;	/* set_format/get_format */
+static unsigned decimation = 1;
 
 void sdr_usage()
 {
@@ -24,6 +27,10 @@ void sdr_usage()
 	       "                     try the SDR output format [VIDIOC_TRY_FMT]\n"
 	       "                     parameter is either the format index as reported by\n"
 	       "                     --list-formats-sdr-out, or the fourcc value as a string\n"
+	       "  --sdr-decimate <factor>\n"
+	       "                     average each <factor> consecutive samples of the captured\n"
+	       "                     SDR data into one before it is written with --stream-to.\n"
+	       "                     Supported for the CU8, CS8, CU16LE, CS14LE and RU12LE formats.\n"
 	       );
 }
 
@@ -44,6 +51,11 @@ void sdr_cmd(int ch, char *optarg)
 			vfmt.fmt.sdr.pixelformat = strtol(optarg, nullptr, 0);
 		}
 		break;
+	case OptSdrDecimate:
+		decimation = strtoul(optarg, nullptr, 0);
+		if (!decimation)
+			decimation = 1;
+		break;
 	}
 }
 
@@ -129,3 +141,90 @@ void sdr_list(cv4l_fd &fd)
 		print_video_formats(fd, V4L2_BUF_TYPE_SDR_OUTPUT, 0, false);
 	}
 }
+
+/*
+ * Decimate the samples in p by averaging, which also acts as a (crude) low
+ * pass filter. Samples left over at the end of a buffer are carried over to
+ * the next one. Returns the new size, p is changed to point to the result.
+ */
+unsigned sdr_decimate(cv4l_fmt &fmt, __u8 *&p, unsigned size)
+{
+	static __u8 *out;
+	static unsigned out_size;
+	static int acc[2];
+	static unsigned acc_cnt;
+	static bool warned;
+	unsigned comps = 2, bytes = 1;
+	bool is_signed = false;
+	unsigned sample_size;
+	unsigned n = 0;
+
+	if (decimation == 1 || !v4l_type_is_sdr(fmt.g_type()))
+		return size;
+
+	switch (fmt.g_pixelformat()) {
+	case V4L2_SDR_FMT_CU8:
+		break;
+	case V4L2_SDR_FMT_CS8:
+		is_signed = true;
+		break;
+	case V4L2_SDR_FMT_CU16LE:
+		bytes = 2;
+		break;
+	case V4L2_SDR_FMT_CS14LE:
+		bytes = 2;
+		is_signed = true;
+		break;
+	case V4L2_SDR_FMT_RU12LE:
+		comps = 1;
+		bytes = 2;
+		break;
+	default:
+		if (!warned)
+			fprintf(stderr, "--sdr-decimate: unsupported SDR format, not decimating\n");
+		warned = true;
+		return size;
+	}
+
+	sample_size = comps * bytes;
+	if (out_size < size / decimation + sample_size) {
+		free(out);
+		out_size = size / decimation + sample_size;
+		out = static_cast<__u8 *>(malloc(out_size));
+		if (!out) {
+			out_size = 0;
+			return size;
+		}
+	}
+
+	for (unsigned i = 0; i + sample_size <= size; i += sample_size) {
+		for (unsigned c = 0; c < comps; c++) {
+			const __u8 *s = p + i + c * bytes;
+
+			if (bytes == 1)
+				acc[c] += is_signed ? static_cast<__s8>(*s) : *s;
+			else if (is_signed)
+				acc[c] += static_cast<__s16>(le16toh(*reinterpret_cast<const __u16 *>(s)));
+			else
+				acc[c] += le16toh(*reinterpret_cast<const __u16 *>(s));
+		}
+		if (++acc_cnt < decimation)
+			continue;
+		for (unsigned c = 0; c < comps; c++) {
+			int v = acc[c] / static_cast<int>(decimation);
+
+			if (bytes == 1) {
+				out[n++] = v;
+			} else {
+				__u16 le = htole16(v);
+
+				memcpy(out + n, &le, 2);
+				n += 2;
+			}
+			acc[c] = 0;
+		}
+		acc_cnt = 0;
+	}
+	p = out;
+	return n;
+}
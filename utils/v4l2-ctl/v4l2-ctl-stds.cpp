@@ -1,4 +1,10 @@
 #include <cctype>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+
+#include <linux/cec.h>
 
 #include "v4l2-ctl.h"
 
@@ -10,6 +16,16 @@ static int enum_and_set_dv_timings = -1;
 static unsigned set_dv_timing_opts;
 static __u32 list_dv_timings_pad;
 static __u32 dv_timings_cap_pad;
+static const char *watch_cec_dev;
+static const char *watch_hook;
+
+/* The HDMI controls that signal a source being (dis)connected */
+static constexpr __u32 watch_ctrls[] = {
+	V4L2_CID_DV_RX_POWER_PRESENT,
+	V4L2_CID_DV_TX_HOTPLUG,
+	V4L2_CID_DV_TX_RXSENSE,
+	V4L2_CID_DV_TX_EDID_PRESENT,
+};
 
 void stds_usage()
 {
@@ -59,6 +75,17 @@ void stds_usage()
 	       "  --get-dv-timings-cap [<pad>]\n"
 	       "                     get the dv timings capabilities [VIDIOC_DV_TIMINGS_CAP]\n"
 	       "                     for subdevs the pad can be specified (default is 0)\n"
+	       "  --watch-source     wait for source changes and HDMI hotplug control events\n"
+	       "                     and show the detected dv timings and the EDID state of the\n"
+	       "                     current input after each change. This runs until the\n"
+	       "                     program is interrupted [VIDIOC_DQEVENT]\n"
+	       "  --watch-source-cec <dev>\n"
+	       "                     with --watch-source, also watch the HPD and physical\n"
+	       "                     address changes of CEC device <dev> [CEC_DQEVENT]\n"
+	       "  --watch-source-hook <cmd>\n"
+	       "                     with --watch-source, run <cmd> through the shell after each\n"
+	       "                     change. The V4L2_WATCH_EVENTS environment variable holds a\n"
+	       "                     space separated list of the events that caused the change.\n"
 	       );
 }
 
@@ -464,6 +491,12 @@ void stds_cmd(int ch, char *optarg)
 		if (optarg)
 			dv_timings_cap_pad = strtoul(optarg, nullptr, 0);
 		break;
+	case OptWatchSourceCec:
+		watch_cec_dev = optarg;
+		break;
+	case OptWatchSourceHook:
+		watch_hook = optarg;
+		break;
 	}
 }
 
@@ -667,3 +700,193 @@ void stds_list(cv4l_fd &_fd)
 		}
 	}
 }
+
+static void watch_subscribe(cv4l_fd &fd)
+{
+	struct v4l2_event_subscription sub = {};
+	struct v4l2_input in;
+
+	sub.type = V4L2_EVENT_SOURCE_CHANGE;
+	if (fd.is_subdev() || fd.enum_input(in, true)) {
+		fd.subscribe_event(sub);
+	} else {
+		do {
+			sub.id = in.index;
+			fd.subscribe_event(sub);
+		} while (!fd.enum_input(in));
+	}
+
+	sub.type = V4L2_EVENT_CTRL;
+	for (auto id : watch_ctrls) {
+		sub.id = id;
+		fd.subscribe_event(sub);
+	}
+}
+
+static void watch_report(cv4l_fd &fd, int cec_fd, const std::string &events)
+{
+	struct v4l2_dv_timings t = {};
+	struct v4l2_edid edid = {};
+	struct timespec ts;
+	__u32 input = 0;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	printf("%lld.%06ld: %s\n", static_cast<long long>(ts.tv_sec),
+	       ts.tv_nsec / 1000, events.c_str());
+
+	for (auto id : watch_ctrls) {
+		struct v4l2_queryctrl qc = {};
+		struct v4l2_control ctrl = {};
+
+		qc.id = ctrl.id = id;
+		if (!fd.queryctrl(qc) && !fd.g_ctrl(ctrl))
+			printf("\t%s: 0x%x\n", qc.name, ctrl.value);
+	}
+
+	if (!fd.is_subdev())
+		fd.g_input(input);
+	edid.pad = input;
+	err = fd.g_edid(edid);
+	if (!err)
+		printf("\tEDID blocks: %u\n", edid.blocks);
+	else if (err != ENOTTY)
+		printf("\tEDID: %s\n", strerror(err));
+
+	if (cec_fd >= 0) {
+		__u16 pa;
+
+		if (!ioctl(cec_fd, CEC_ADAP_G_PHYS_ADDR, &pa))
+			printf("\tCEC physical address: %x.%x.%x.%x\n",
+			       pa >> 12, (pa >> 8) & 0xf, (pa >> 4) & 0xf, pa & 0xf);
+	}
+
+	err = fd.query_dv_timings(t);
+	if (!err) {
+		printf("\tDV timings:\n");
+		print_dv_timings(&t);
+	} else if (err == ENOLINK) {
+		printf("\tDV timings: no link\n");
+	} else if (err == ENOLCK) {
+		printf("\tDV timings: unstable signal\n");
+	} else if (err == ERANGE) {
+		printf("\tDV timings: out of range\n");
+	} else if (err != ENOTTY) {
+		printf("\tDV timings: %s\n", strerror(err));
+	}
+	fflush(stdout);
+}
+
+static void watch_add(std::string &events, const char *ev)
+{
+	if (events.find(ev) != std::string::npos)
+		return;
+	if (!events.empty())
+		events += " ";
+	events += ev;
+}
+
+static void watch_run_hook(const std::string &events)
+{
+	int ret;
+
+	if (!watch_hook)
+		return;
+	setenv("V4L2_WATCH_EVENTS", events.c_str(), 1);
+	ret = system(watch_hook);
+	if (ret)
+		fprintf(stderr, "%s: exit status %d\n", watch_hook, ret);
+}
+
+/*
+ * Report each change of the source right after it happens. All events that
+ * arrive together, such as the source change and the power present control
+ * event of a cable being plugged in, result in one report.
+ */
+void stds_watch(cv4l_fd &fd)
+{
+	struct epoll_event epoll_ev = {};
+	int epollfd;
+	int cec_fd = -1;
+
+	if (!options[OptWatchSource])
+		return;
+
+	cv4l_disable_trace dt(fd);
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+
+	epollfd = epoll_create1(0);
+	if (epollfd < 0) {
+		fprintf(stderr, "epoll_create1: %s\n", strerror(errno));
+		return;
+	}
+	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	watch_subscribe(fd);
+	epoll_ev.events = EPOLLPRI;
+	epoll_ev.data.fd = fd.g_fd();
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, fd.g_fd(), &epoll_ev);
+
+	if (watch_cec_dev) {
+		cec_fd = open(watch_cec_dev, O_RDWR | O_NONBLOCK);
+		if (cec_fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", watch_cec_dev,
+				strerror(errno));
+		} else {
+			epoll_ev.data.fd = cec_fd;
+			epoll_ctl(epollfd, EPOLL_CTL_ADD, cec_fd, &epoll_ev);
+		}
+	}
+
+	watch_report(fd, cec_fd, "initial state");
+
+	for (;;) {
+		struct epoll_event evs[2];
+		std::string events;
+		int n;
+
+		n = epoll_wait(epollfd, evs, 2, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		for (int i = 0; i < n; i++) {
+			if (evs[i].data.fd == fd.g_fd()) {
+				struct v4l2_event ev;
+
+				while (!fd.dqevent(ev)) {
+					if (ev.type == V4L2_EVENT_SOURCE_CHANGE)
+						watch_add(events, "source_change");
+					else if (ev.type == V4L2_EVENT_CTRL &&
+						 (ev.u.ctrl.changes & V4L2_EVENT_CTRL_CH_VALUE))
+						watch_add(events, "ctrl");
+				}
+				continue;
+			}
+
+			struct cec_event ev;
+
+			while (!ioctl(cec_fd, CEC_DQEVENT, &ev)) {
+				switch (ev.event) {
+				case CEC_EVENT_PIN_HPD_LOW:
+				case CEC_EVENT_PIN_HPD_HIGH:
+					watch_add(events, "hpd");
+					break;
+				case CEC_EVENT_STATE_CHANGE:
+					if (!(ev.flags & CEC_EVENT_FL_INITIAL_STATE))
+						watch_add(events, "phys_addr");
+					break;
+				}
+			}
+		}
+		if (events.empty())
+			continue;
+		watch_report(fd, cec_fd, events);
+		watch_run_hook(events);
+	}
+
+	if (cec_fd >= 0)
+		close(cec_fd);
+	close(epollfd);
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+}
@@ -1,17 +1,32 @@
 #include <cstring>
+#include <map>
+#include <vector>
 
+#include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
 
+#include <linux/errqueue.h>
 #include <linux/media.h>
 
 #include "compiler.h"
 #include "v4l2-ctl.h"
 #include "v4l-stream.h"
 #include <media-info.h>
+#include <crc32c.h>
 
 extern "C" {
 #include "v4l2-tpg.h"
+#include "v4l2-tpg-cache.h"
 }
 
 static unsigned stream_count;
@@ -34,6 +49,9 @@ static u8 stream_out_alpha;
 static bool stream_out_alpha_red_only;
 static bool stream_out_rgb_lim_range;
 static unsigned stream_out_perc_fill = 100;
+static unsigned stream_out_cache_mb = 256;
+static bool stream_out_timecode;
+static unsigned stream_out_threads;
 static v4l2_std_id stream_out_std;
 static bool stream_out_refresh;
 static tpg_move_mode stream_out_hor_mode = TPG_MOVE_NONE;
@@ -43,14 +61,52 @@ static unsigned reqbufs_count_out = 4;
 static char *file_to;
 static bool to_with_hdr;
 static char *host_to;
+static char *host_local;
 #ifndef NO_STREAM_TO
 static unsigned host_port_to = V4L_STREAM_PORT;
+static bool host_nodelay;
+static bool host_zerocopy;
+static unsigned host_sndbuf;
+static bool host_udp;
+static bool host_raw;
+static unsigned host_udp_size = V4L_STREAM_UDP_DEFAULT_SIZE;
+static unsigned host_udp_fec;
+static unsigned host_udp_ttl = 1;
+static unsigned host_bitrate;
+static unsigned host_max_frame;
+static unsigned host_motion;
 static unsigned bpl_cap[VIDEO_MAX_PLANES];
 #endif
 static bool host_lossless;
+static unsigned ring_size;
+#define TEE_DEFAULT_FRAMES 4
+#define TEE_MAX_FRAMES 32
+static bool tee_enabled;
+static unsigned tee_queue_size = TEE_DEFAULT_FRAMES;
+static bool tee_file_drop_old;
+static bool tee_host_drop_old = true;
+static bool tee_hash_drop_old;
+static char *tee_stats_file;
+static unsigned stream_to_io;
 static int host_fd_to = -1;
 static unsigned comp_perc;
 static unsigned comp_perc_count;
+static __u64 comp_usecs;
+static __u64 comp_bytes;
+static unsigned comp_threads;
+static unsigned comp_slices;
+static char *sync_devices;
+static char *chain_devices;
+static char *ctrl_sched_file;
+static unsigned sync_skew_us;
+static unsigned stream_latency;
+static unsigned stream_latency_interval;
+static bool stream_benchmark;
+static bool bufs_auto;
+static unsigned bench_bufs[VIDEO_MAX_FRAME];
+static unsigned bench_bufs_cnt;
+static char *file_hash;
+static FILE *hash_fout;
 static char *file_from;
 static bool from_with_hdr;
 static char *host_from;
@@ -78,11 +134,14 @@ struct request_fwht {
 	int fd;
 	__u64 ts;
 	struct v4l2_ctrl_fwht_params params;
+	bool in_flight;
 };
 
 static request_fwht fwht_reqs[VIDEO_MAX_FRAME];
 
 #define TS_WINDOW 241
+#define BENCH_DEFAULT_COUNT 300
+#define BUFS_AUTO_MIN 2
 #define FILE_HDR_ID			v4l2_fourcc('V', 'h', 'd', 'r')
 
 enum codec_type {
@@ -93,10 +152,132 @@ enum codec_type {
 
 static enum codec_type codec_type;
 
+enum stream_to_io {
+	STREAM_TO_IO_BUFFERED,
+	STREAM_TO_IO_PREALLOC,
+	STREAM_TO_IO_DIRECT
+};
+
 #define QUEUE_ERROR -1
 #define QUEUE_STOPPED -2
 #define QUEUE_OFF_ON -3
 
+enum stream_latency {
+	STREAM_LATENCY_NONE,
+	STREAM_LATENCY_TEXT,
+	STREAM_LATENCY_CSV,
+	STREAM_LATENCY_JSON
+};
+
+static __u64 now_usecs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Histogram of usec values in the style of HdrHistogram: values below
+ * 2 * LAT_SUB_COUNT have a bucket of their own, larger values are recorded
+ * with LAT_SUB_BITS bits of precision, so within ~3%.
+ */
+#define LAT_SUB_BITS 5
+#define LAT_SUB_COUNT (1U << LAT_SUB_BITS)
+#define LAT_BUCKETS (2 * LAT_SUB_COUNT + (63 - LAT_SUB_BITS) * LAT_SUB_COUNT)
+
+class latency_hist {
+private:
+	unsigned counts[LAT_BUCKETS];
+	__u64 total;
+	__u64 max_value;
+
+	static unsigned bucket(__u64 v);
+	static __u64 bucket_max(unsigned b);
+
+public:
+	latency_hist()
+	{
+		reset();
+	}
+
+	void reset() {
+		memset(counts, 0, sizeof(counts));
+		total = max_value = 0;
+	}
+
+	void add(__u64 v);
+	__u64 percentile(double perc) const;
+	__u64 count() const { return total; }
+	__u64 max() const { return max_value; }
+};
+
+unsigned latency_hist::bucket(__u64 v)
+{
+	if (v < 2 * LAT_SUB_COUNT)
+		return v;
+
+	unsigned msb = 63 - __builtin_clzll(v);
+	unsigned shift = msb - LAT_SUB_BITS;
+
+	return 2 * LAT_SUB_COUNT + (shift - 1) * LAT_SUB_COUNT +
+	       (v >> shift) - LAT_SUB_COUNT;
+}
+
+/* The highest value that ends up in bucket b */
+__u64 latency_hist::bucket_max(unsigned b)
+{
+	if (b < 2 * LAT_SUB_COUNT)
+		return b;
+
+	b -= 2 * LAT_SUB_COUNT;
+
+	unsigned shift = b / LAT_SUB_COUNT + 1;
+	__u64 sub = b % LAT_SUB_COUNT + LAT_SUB_COUNT;
+
+	return ((sub + 1) << shift) - 1;
+}
+
+void latency_hist::add(__u64 v)
+{
+	counts[bucket(v)]++;
+	total++;
+	if (v > max_value)
+		max_value = v;
+}
+
+__u64 latency_hist::percentile(double perc) const
+{
+	__u64 target = static_cast<__u64>(perc / 100.0 * total + 0.999999);
+	__u64 sum = 0;
+
+	if (!target)
+		target = 1;
+	for (unsigned b = 0; b < LAT_BUCKETS; b++) {
+		sum += counts[b];
+		if (sum >= target)
+			return std::min(bucket_max(b), max_value);
+	}
+	return max_value;
+}
+
+/* When the capture buffers were queued, for the QBUF to DQBUF latency */
+static __u64 cap_qbuf_usecs[VIDEO_MAX_FRAME];
+
+static void latency_queued(const cv4l_buffer &buf)
+{
+	if (stream_latency && buf.g_index() < VIDEO_MAX_FRAME)
+		cap_qbuf_usecs[buf.g_index()] = now_usecs();
+}
+
+static void latency_queued_all(const cv4l_queue &q)
+{
+	__u64 now = now_usecs();
+
+	for (unsigned i = 0; stream_latency && i < q.g_buffers() && i < VIDEO_MAX_FRAME; i++)
+		cap_qbuf_usecs[i] = now;
+}
+
 class fps_timestamps {
 private:
 	unsigned idx;
@@ -109,11 +290,20 @@ private:
 	bool alternate_fields;
 	unsigned field_cnt;
 	unsigned last_field;
+	latency_hist lat_dqbuf;
+	latency_hist lat_qbuf;
+	latency_hist lat_jitter;
+	double lat_last_ts;
+	double lat_last_delta;
+	bool lat_csv_hdr;
 
 public:
 	fps_timestamps()
 	{
 		reset();
+		lat_last_ts = 0;
+		lat_last_delta = -1;
+		lat_csv_hdr = false;
 	}
 
 	void reset() {
@@ -131,6 +321,8 @@ public:
 	bool has_fps(bool continuous);
 	double fps();
 	unsigned dropped();
+	void add_latency(const cv4l_buffer &buf);
+	void print_latency(unsigned frames);
 };
 
 static bool need_sleep(unsigned count)
@@ -281,6 +473,79 @@ unsigned fps_timestamps::dropped()
 	return res;
 }
 
+/*
+ * --stream-latency: record the time from the buffer timestamp to DQBUF (only
+ * meaningful for monotonic timestamps), the time from QBUF to DQBUF and the
+ * jitter, i.e. the difference between two consecutive frame intervals.
+ */
+void fps_timestamps::add_latency(const cv4l_buffer &buf)
+{
+	__u64 now = now_usecs();
+	unsigned index = buf.g_index();
+	double ts = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+
+	if (!stream_latency)
+		return;
+
+	if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+		__u64 ts_usecs = buf.g_timestamp_ns() / 1000;
+
+		if (now >= ts_usecs)
+			lat_dqbuf.add(now - ts_usecs);
+	}
+	if (index < VIDEO_MAX_FRAME && cap_qbuf_usecs[index] &&
+	    now >= cap_qbuf_usecs[index])
+		lat_qbuf.add(now - cap_qbuf_usecs[index]);
+	if (lat_last_ts > 0 && ts > lat_last_ts) {
+		double delta = ts - lat_last_ts;
+
+		if (lat_last_delta >= 0)
+			lat_jitter.add(std::abs(delta - lat_last_delta) * 1000000.0);
+		lat_last_delta = delta;
+	}
+	lat_last_ts = ts;
+}
+
+void fps_timestamps::print_latency(unsigned frames)
+{
+	static constexpr const char *names[] = {
+		"dqbuf", "qbuf-dqbuf", "jitter"
+	};
+	const latency_hist *hists[] = { &lat_dqbuf, &lat_qbuf, &lat_jitter };
+
+	switch (stream_latency) {
+	case STREAM_LATENCY_TEXT:
+		fprintf(stderr, "\nlatency after %u frames (usecs):\n", frames);
+		for (unsigned i = 0; i < 3; i++)
+			fprintf(stderr, "\t%-10s: count: %llu p50: %llu p99: %llu p99.9: %llu max: %llu\n",
+				names[i], hists[i]->count(), hists[i]->percentile(50),
+				hists[i]->percentile(99), hists[i]->percentile(99.9),
+				hists[i]->max());
+		break;
+	case STREAM_LATENCY_CSV:
+		if (!lat_csv_hdr)
+			fprintf(stderr, "frames,metric,count,p50,p99,p99.9,max\n");
+		lat_csv_hdr = true;
+		for (unsigned i = 0; i < 3; i++)
+			fprintf(stderr, "%u,%s,%llu,%llu,%llu,%llu,%llu\n",
+				frames, names[i], hists[i]->count(), hists[i]->percentile(50),
+				hists[i]->percentile(99), hists[i]->percentile(99.9),
+				hists[i]->max());
+		break;
+	case STREAM_LATENCY_JSON:
+		fprintf(stderr, "{\"frames\": %u", frames);
+		for (unsigned i = 0; i < 3; i++)
+			fprintf(stderr, ", \"%s\": {\"count\": %llu, \"p50\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"max\": %llu}",
+				names[i], hists[i]->count(), hists[i]->percentile(50),
+				hists[i]->percentile(99), hists[i]->percentile(99.9),
+				hists[i]->max());
+		fprintf(stderr, "}\n");
+		break;
+	default:
+		break;
+	}
+}
+
 double fps_timestamps::fps()
 {
 	unsigned prev_idx = (idx + TS_WINDOW - 1) % TS_WINDOW;
@@ -321,9 +586,97 @@ void streaming_usage()
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-to-host <hostname[:port]>\n"
                "                     stream to this host. The default port is %d.\n"
+	       "  --stream-to-host-opts nodelay=<0/1>,zerocopy=<0/1>,sndbuf=<bytes>,udp=<0/1>,\n"
+	       "                     size=<bytes>,fec=<frags>,ttl=<hops>,raw=<0/1>,threads=<n>,\n"
+	       "                     slices=<n>,bitrate=<kbps>,maxframe=<bytes>,motion=<pixels>\n"
+	       "                     socket options for --stream-to-host:\n"
+	       "                     nodelay=1: disable Nagle's algorithm (TCP_NODELAY).\n"
+	       "                     zerocopy=1: send the frames with MSG_ZEROCOPY.\n"
+	       "                     sndbuf: the size of the socket send buffer.\n"
+	       "                     udp=1: send UDP datagrams instead of using TCP, the host\n"
+	       "                     can be a multicast group.\n"
+	       "                     size: the UDP datagram size, the default is %d.\n"
+	       "                     fec: send a parity datagram for every <frags> datagrams\n"
+	       "                     of a plane, so a lost datagram can be recovered.\n"
+	       "                     ttl: the multicast TTL, the default is 1.\n"
+	       "                     raw=1: do not compress the frames. With UDP the receiver\n"
+	       "                     can then use the parts of a frame that did arrive.\n"
+	       "                     threads: compress the frames with a pool of <n> threads,\n"
+	       "                     the frames are still sent in order. Each thread holds on\n"
+	       "                     to a capture buffer, so use --stream-mmap to allocate\n"
+	       "                     more buffers. The FWHT codec then only sends I-frames.\n"
+	       "                     slices: split each FWHT frame in <n> slices (at most 16)\n"
+	       "                     that are compressed in parallel. Older FWHT decoders\n"
+	       "                     reject sliced frames.\n"
+	       "                     bitrate: adjust the FWHT QP of each frame to send on\n"
+	       "                     average <kbps> kbit/s.\n"
+	       "                     maxframe: low latency mode, compress each frame again\n"
+	       "                     with a higher QP until it is at most <bytes>.\n"
+	       "                     motion: search motion vectors of up to <pixels> (at most\n"
+	       "                     16) for the blocks of FWHT P-frames. Older FWHT decoders\n"
+	       "                     reject streams that use motion vectors.\n"
+	       "  --stream-to-local <socket>\n"
+	       "                     stream to a receiver on this host that listens on the\n"
+	       "                     unix socket <socket>, e.g. 'qvidcap --local=<socket>'.\n"
+	       "                     The frames are passed uncompressed through a ring of\n"
+	       "                     %d frames in shared memory, frames are dropped if the\n"
+	       "                     receiver falls behind.\n"
 	       "  --stream-lossless  always use lossless video compression.\n"
+	       "  --stream-to-ring <count>\n"
+	       "                     write the --stream-to(-hdr) file from a separate thread,\n"
+	       "                     through a ring of <count> frames. Frames are copied into\n"
+	       "                     the ring when the driver runs low on buffers and are\n"
+	       "                     dropped when the ring is full. The backlog and the number\n"
+	       "                     of dropped frames are reported with the fps.\n"
+	       "  --stream-to-io <mode>\n"
+	       "                     how the --stream-to(-hdr) file is written:\n"
+	       "                     <mode>=buffered: through the page cache (default).\n"
+	       "                     <mode>=prealloc: as buffered, but preallocate the file\n"
+	       "                     with fallocate for the expected number of frames.\n"
+	       "                     <mode>=direct: as prealloc, but bypass the page cache\n"
+	       "                     using O_DIRECT writes of aligned blocks.\n"
 #endif
+	       "  --stream-tee frames=<n>,file=<drop>,host=<drop>,hash=<drop>,stats=<file>\n"
+	       "                     copy each captured frame once and hand it to all outputs:\n"
+	       "                     --stream-to(-hdr), --stream-to-host/local, --stream-hash\n"
+	       "                     and the stats file. Each output is written by its own\n"
+	       "                     thread from its own queue, so a slow output delays neither\n"
+	       "                     the others nor the capture. --stream-to(-hdr) and\n"
+	       "                     --stream-to-host/local can then be combined.\n"
+	       "                     frames: the queue length of each output, the default is %d.\n"
+	       "                     file, host, hash: the frame to drop if the queue of the\n"
+	       "                     output is full: new drops the new frame (default for file\n"
+	       "                     and hash), old the oldest queued frame (default for host).\n"
+	       "                     stats: write the sequence, timestamp, field, flags, queue\n"
+	       "                     delay and bytesused of each frame as CSV to <file>.\n"
+	       "                     The backlog and the dropped frames of each output are\n"
+	       "                     reported with the fps.\n"
 	       "  --stream-poll      use non-blocking mode and select() to stream.\n"
+	       "  --stream-ctrl-schedule <file>\n"
+	       "                     set controls for specific capture frames. Each line of <file>\n"
+	       "                     is '<frame> <ctrl>=<val>[,<ctrl>=<val>...]', frame <n> being\n"
+	       "                     the n-th buffer queued. If the queue supports requests, the\n"
+	       "                     controls are set in the request of that buffer, otherwise\n"
+	       "                     they are set together just before the buffer is queued.\n"
+	       "  --stream-benchmark <count>[,<count>...]\n"
+	       "                     run the capture QBUF/DQBUF cycle with mmap, userptr and,\n"
+	       "                     if --export-device is given, dmabuf buffers for each of\n"
+	       "                     the given buffer counts, without writing, printing or\n"
+	       "                     sleeping. Report the buffer rate and the CPU time per\n"
+	       "                     buffer of each run. A run lasts --stream-count buffers,\n"
+	       "                     the default is %d.\n"
+	       "  --stream-latency format=<fmt>,interval=<count>\n"
+	       "                     record histograms of the capture latency: from the buffer\n"
+	       "                     timestamp to DQBUF, from QBUF to DQBUF and the jitter of the\n"
+	       "                     frame interval. The p50/p99/p99.9/max values are written to\n"
+	       "                     stderr at the end of the stream and every <count> frames.\n"
+	       "                     <fmt> can be one of: text (default), csv, json\n"
+	       "  --stream-hash <file>\n"
+	       "                     write a line with the sequence number, the timestamp and\n"
+	       "                     the CRC32C of each plane of the captured frames to <file>.\n"
+	       "                     Can be used with or instead of --stream-to to verify the\n"
+	       "                     captured data without storing it. If <file> is '-', then\n"
+	       "                     the list is written to stdout.\n"
 	       "  --stream-buf-caps  show capture buffer capabilities\n"
 	       "  --stream-show-delta-now\n"
 	       "                     output the difference between the buffer timestamp and current\n"
@@ -332,11 +685,36 @@ void streaming_usage()
 	       "  --stream-mmap <count>\n"
 	       "                     capture video using mmap() [VIDIOC_(D)QBUF]\n"
 	       "                     count: the number of buffers to allocate. The default is 3.\n"
+	       "                     If count is 'auto', then start with 2 buffers, add buffers\n"
+	       "                     [VIDIOC_CREATE_BUFS] when frames are dropped or dequeued\n"
+	       "                     late and remove them again [VIDIOC_REMOVE_BUFS] when the\n"
+	       "                     stream is steady.\n"
 	       "  --stream-user <count>\n"
 	       "                     capture video using user pointers [VIDIOC_(D)QBUF]\n"
 	       "                     count: the number of buffers to allocate. The default is 3.\n"
+	       "                     count can be 'auto' as well, see --stream-mmap.\n"
 	       "  --stream-dmabuf    capture video using dmabuf [VIDIOC_(D)QBUF]\n"
 	       "                     Requires a corresponding --stream-out-mmap option.\n"
+	       "  --stream-sync-devices <dev>[,<dev>...]\n"
+	       "                     capture from these devices as well as from the -d device\n"
+	       "                     in a single epoll() loop. Only sets of frames, one for each\n"
+	       "                     device, whose timestamps are within --stream-sync-skew of\n"
+	       "                     each other are kept. With --stream-to(-hdr) <file> device\n"
+	       "                     <n> is written to <file>.<n>, the -d device being 0, so\n"
+	       "                     frame <i> of each file belongs to set <i>.\n"
+	       "                     --stream-count and --stream-skip count sets.\n"
+	       "  --stream-sync-skew <usecs>\n"
+	       "                     the maximum timestamp difference within a set. The default\n"
+	       "                     is half the frame period of the -d device.\n"
+	       "  --stream-chain <dev>[,<dev>...]\n"
+	       "                     pass the frames captured from the -d device through these\n"
+	       "                     devices in turn: each m2m device gets the capture buffers of\n"
+	       "                     the previous stage as exported DMABUFs on its output queue.\n"
+	       "                     The last device can also be a video output device. The\n"
+	       "                     current formats are used and all stages use the buffer count\n"
+	       "                     of --stream-mmap. The capture queue of the last m2m device is\n"
+	       "                     written with --stream-to. At the end the queue depth and\n"
+	       "                     latency of each stage and the end-to-end latency are shown.\n"
 	       "  --stream-from <file>\n"
 	       "                     stream from this file. The default is to generate a pattern.\n"
 	       "                     If <file> is '-', then the data is read from stdin.\n"
@@ -344,6 +722,9 @@ void streaming_usage()
 	       "                     frame is prefixed by a header. Use for compressed data.\n"
 	       "  --stream-from-host <hostname[:port]>\n"
 	       "                     stream from this host. The default port is %d.\n"
+	       "  --stream-from-mmap read the --stream-from(-hdr) file through a memory mapping\n"
+	       "                     instead of stdio. With --stream-out-user and raw frames\n"
+	       "                     the buffers point into the mapping where possible.\n"
 	       "  --stream-no-query  Do not query and set the DV timings or standard before streaming.\n"
 	       "  --stream-loop      loop when the end of the file we are streaming from is reached.\n"
 	       "                     The default is to stop.\n"
@@ -376,6 +757,17 @@ void streaming_usage()
 	       "                     and the range is [-3...3].\n"
 	       "  --stream-out-perc-fill <percentage>\n"
 	       "                     percentage of the frame to actually fill. The default is 100%%.\n"
+	       "  --stream-out-cache <mbytes>\n"
+	       "                     keep up to <mbytes> MB of rendered test pattern frames, so\n"
+	       "                     moving patterns and alternating fields are rendered only\n"
+	       "                     once and then copied. 0 disables the cache. The default is 256.\n"
+	       "  --stream-out-timecode\n"
+	       "                     stamp the wall clock time in microseconds as a row of black\n"
+	       "                     and white cells into the top-left corner of each frame.\n"
+	       "                     qvidcap --overlay reads it back to show the latency.\n"
+	       "  --stream-out-threads <n>\n"
+	       "                     render the test pattern with <n> threads, each thread\n"
+	       "                     rendering a horizontal stripe of the frame.\n"
 	       "  --stream-out-buf-caps\n"
 	       "                     show output buffer capabilities\n"
 	       "  --stream-out-mmap <count>\n"
@@ -404,9 +796,10 @@ void streaming_usage()
 	       "  --list-buffers-meta\n"
 	       "                     list all Meta RX buffers [VIDIOC_QUERYBUF]\n",
 #ifndef NO_STREAM_TO
-		V4L_STREAM_PORT,
+		V4L_STREAM_PORT, V4L_STREAM_UDP_DEFAULT_SIZE,
+		V4L_STREAM_SHM_DEFAULT_FRAMES,
 #endif
-	       	V4L_STREAM_PORT);
+		TEE_DEFAULT_FRAMES, BENCH_DEFAULT_COUNT, V4L_STREAM_PORT);
 }
 
 static void get_codec_type(cv4l_fd &fd)
@@ -706,6 +1099,17 @@ static void list_buffers(cv4l_fd &fd, unsigned buftype)
 	}
 }
 
+static bool tee_parse_drop(const char *value)
+{
+	if (!strcmp(value, "old"))
+		return true;
+	if (strcmp(value, "new")) {
+		fprintf(stderr, "unknown --stream-tee drop policy '%s'\n", value);
+		std::exit(EXIT_FAILURE);
+	}
+	return false;
+}
+
 void streaming_cmd(int ch, char *optarg)
 {
 	char *value, *subs;
@@ -747,6 +1151,58 @@ void streaming_cmd(int ch, char *optarg)
 			}
 		}
 		break;
+	case OptStreamLatency:
+		stream_latency = STREAM_LATENCY_TEXT;
+		subs = optarg;
+		while (*subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"format",
+				"interval",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				if (!strcmp(value, "text"))
+					stream_latency = STREAM_LATENCY_TEXT;
+				else if (!strcmp(value, "csv"))
+					stream_latency = STREAM_LATENCY_CSV;
+				else if (!strcmp(value, "json"))
+					stream_latency = STREAM_LATENCY_JSON;
+				else
+					stream_latency = STREAM_LATENCY_NONE;
+				if (stream_latency)
+					break;
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			case 1:
+				stream_latency_interval = strtoul(value, nullptr, 0);
+				break;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
+	case OptStreamBenchmark:
+		subs = optarg;
+		bench_bufs_cnt = 0;
+		while (*subs && bench_bufs_cnt < VIDEO_MAX_FRAME) {
+			bench_bufs[bench_bufs_cnt] = strtoul(subs, &subs, 0);
+			if (!bench_bufs[bench_bufs_cnt] || (*subs && *subs != ',')) {
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+			bench_bufs_cnt++;
+			if (*subs)
+				subs++;
+		}
+		break;
+	case OptStreamHash:
+		file_hash = optarg;
+		if (!strcmp(file_hash, "-"))
+			options[OptSilent] = true;
+		break;
 	case OptStreamNoQuery:
 		stream_no_query = true;
 		break;
@@ -814,6 +1270,15 @@ void streaming_cmd(int ch, char *optarg)
 		else
 			stream_out_vert_mode = static_cast<tpg_move_mode>(speed + 3);
 		break;
+	case OptStreamOutCache:
+		stream_out_cache_mb = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamOutTimecode:
+		stream_out_timecode = true;
+		break;
+	case OptStreamOutThreads:
+		stream_out_threads = strtoul(optarg, nullptr, 0);
+		break;
 	case OptStreamOutPercFill:
 		stream_out_perc_fill = strtoul(optarg, nullptr, 0);
 		if (stream_out_perc_fill > 100)
@@ -836,6 +1301,150 @@ void streaming_cmd(int ch, char *optarg)
 	case OptStreamToHost:
 		host_to = optarg;
 		break;
+#ifndef NO_STREAM_TO
+	case OptStreamToLocal:
+		host_local = optarg;
+		/* there is nothing to gain from compressing the frames */
+		host_raw = true;
+		break;
+	case OptStreamToHostOpts:
+		subs = optarg;
+		while (*subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"nodelay",
+				"zerocopy",
+				"sndbuf",
+				"udp",
+				"size",
+				"fec",
+				"ttl",
+				"raw",
+				"threads",
+				"slices",
+				"bitrate",
+				"maxframe",
+				"motion",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				host_nodelay = strtoul(value, nullptr, 0);
+				break;
+			case 1:
+				host_zerocopy = strtoul(value, nullptr, 0);
+				break;
+			case 2:
+				host_sndbuf = strtoul(value, nullptr, 0);
+				break;
+			case 3:
+				host_udp = strtoul(value, nullptr, 0);
+				break;
+			case 4:
+				host_udp_size = strtoul(value, nullptr, 0);
+				if (host_udp_size > V4L_STREAM_UDP_HDR_SIZE &&
+				    host_udp_size <= V4L_STREAM_UDP_MAX_SIZE)
+					break;
+				fprintf(stderr, "invalid UDP datagram size\n");
+				std::exit(EXIT_FAILURE);
+			case 5:
+				host_udp_fec = strtoul(value, nullptr, 0);
+				break;
+			case 6:
+				host_udp_ttl = strtoul(value, nullptr, 0);
+				break;
+			case 7:
+				host_raw = strtoul(value, nullptr, 0);
+				break;
+			case 8:
+				comp_threads = strtoul(value, nullptr, 0);
+				break;
+			case 9:
+				comp_slices = strtoul(value, nullptr, 0);
+				break;
+			case 10:
+				host_bitrate = strtoul(value, nullptr, 0);
+				break;
+			case 11:
+				host_max_frame = strtoul(value, nullptr, 0);
+				break;
+			case 12:
+				host_motion = strtoul(value, nullptr, 0);
+				break;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
+#endif
+	case OptStreamToRing:
+		ring_size = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamTee:
+		tee_enabled = true;
+		subs = optarg;
+		while (*subs != '\0') {
+			static constexpr const char *subopts[] = {
+				"frames",
+				"file",
+				"host",
+				"hash",
+				"stats",
+				nullptr
+			};
+
+			switch (parse_subopt(&subs, subopts, &value)) {
+			case 0:
+				tee_queue_size = strtoul(value, nullptr, 0);
+				if (!tee_queue_size || tee_queue_size > TEE_MAX_FRAMES) {
+					fprintf(stderr, "--stream-tee frames must be 1-%d\n",
+						TEE_MAX_FRAMES);
+					std::exit(EXIT_FAILURE);
+				}
+				break;
+			case 1:
+				tee_file_drop_old = tee_parse_drop(value);
+				break;
+			case 2:
+				tee_host_drop_old = tee_parse_drop(value);
+				break;
+			case 3:
+				tee_hash_drop_old = tee_parse_drop(value);
+				break;
+			case 4:
+				tee_stats_file = value;
+				break;
+			default:
+				streaming_usage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		break;
+	case OptStreamSyncDevices:
+		sync_devices = optarg;
+		break;
+	case OptStreamChain:
+		chain_devices = optarg;
+		break;
+	case OptStreamCtrlSchedule:
+		ctrl_sched_file = optarg;
+		break;
+	case OptStreamSyncSkew:
+		sync_skew_us = strtoul(optarg, nullptr, 0);
+		break;
+	case OptStreamToIo:
+		if (!strcmp(optarg, "buffered"))
+			stream_to_io = STREAM_TO_IO_BUFFERED;
+		else if (!strcmp(optarg, "prealloc"))
+			stream_to_io = STREAM_TO_IO_PREALLOC;
+		else if (!strcmp(optarg, "direct"))
+			stream_to_io = STREAM_TO_IO_DIRECT;
+		else {
+			fprintf(stderr, "unknown --stream-to-io mode '%s'\n", optarg);
+			std::exit(EXIT_FAILURE);
+		}
+		break;
 	case OptStreamLossless:
 		host_lossless = true;
 		break;
@@ -854,7 +1463,10 @@ void streaming_cmd(int ch, char *optarg)
 		memory = V4L2_MEMORY_USERPTR;
 		fallthrough;
 	case OptStreamMmap:
-		if (optarg) {
+		if (optarg && !strcmp(optarg, "auto")) {
+			bufs_auto = true;
+			reqbufs_count_cap = BUFS_AUTO_MIN;
+		} else if (optarg) {
 			reqbufs_count_cap = strtoul(optarg, nullptr, 0);
 			if (reqbufs_count_cap == 0)
 				reqbufs_count_cap = 3;
@@ -947,6 +1559,7 @@ static void set_fwht_req_by_idx(unsigned idx, const struct fwht_cframe_hdr *hdr,
 
 	fwht_reqs[idx].ts = ts;
 	fwht_reqs[idx].params = fwht_params;
+	fwht_reqs[idx].in_flight = true;
 }
 
 static int get_fwht_req_by_ts(__u64 ts)
@@ -958,6 +1571,24 @@ static int get_fwht_req_by_ts(__u64 ts)
 	return -1;
 }
 
+/*
+ * A decoded capture buffer has to stay dequeued for as long as a request
+ * that is still in flight refers to it. The same goes for the most recently
+ * queued frame, since the next request will refer to that one.
+ */
+static bool fwht_ts_is_ref(__u64 ts)
+{
+	if (ts == last_fwht_bf_ts)
+		return true;
+	for (auto &fwht_req : fwht_reqs) {
+		if (fwht_req.in_flight &&
+		    !(fwht_req.params.flags & V4L2_FWHT_FL_I_FRAME) &&
+		    fwht_req.params.backward_ref_ts == ts)
+			return true;
+	}
+	return false;
+}
+
 static bool set_fwht_req_by_fd(const struct fwht_cframe_hdr *hdr,
 			       int req_fd, __u64 last_bf_ts, __u64 ts)
 {
@@ -969,6 +1600,7 @@ static bool set_fwht_req_by_fd(const struct fwht_cframe_hdr *hdr,
 		if (fwht_req.fd == req_fd) {
 			fwht_req.ts = ts;
 			fwht_req.params = fwht_params;
+			fwht_req.in_flight = true;
 			return true;
 		}
 	}
@@ -1062,11 +1694,121 @@ static bool read_write_padded_frame(cv4l_fmt &fmt, unsigned char *buf,
 	return true;
 }
 
+/*
+ * --stream-from-mmap: the input file is mapped once and read through a
+ * cookie stream, so each frame is a single memcpy from the mapping. The
+ * mapping is read sequentially, and the kernel is asked to read ahead the
+ * next MMAP_PREFETCH bytes whenever the read position gets there.
+ * fill_buffer_from_file() uses mmap_from to let USERPTR buffers point
+ * into the mapping directly.
+ */
+#define MMAP_PREFETCH (16 * 1024 * 1024)
+
+struct mmap_file {
+	u8 *map;
+	size_t size;
+	size_t pos;
+	size_t prefetched;
+};
+
+static mmap_file *mmap_from;
+
+static void mmap_file_prefetch(mmap_file *f)
+{
+	size_t start = f->pos & ~static_cast<size_t>(getpagesize() - 1);
+	size_t end = std::min(f->size, start + MMAP_PREFETCH);
+
+	if (end > start)
+		madvise(f->map + start, end - start, MADV_WILLNEED);
+	f->prefetched = end;
+}
+
+static ssize_t mmap_file_read(void *cookie, char *data, size_t size)
+{
+	auto f = static_cast<mmap_file *>(cookie);
+
+	size = std::min(size, f->size - f->pos);
+	memcpy(data, f->map + f->pos, size);
+	f->pos += size;
+	if (f->pos + MMAP_PREFETCH / 2 > f->prefetched && f->prefetched < f->size)
+		mmap_file_prefetch(f);
+	return size;
+}
+
+static int mmap_file_seek(void *cookie, off64_t *offset, int whence)
+{
+	auto f = static_cast<mmap_file *>(cookie);
+	off64_t pos = *offset;
+
+	if (whence == SEEK_CUR)
+		pos += f->pos;
+	else if (whence == SEEK_END)
+		pos += f->size;
+	if (pos < 0 || pos > static_cast<off64_t>(f->size))
+		return -1;
+	f->pos = pos;
+	if (f->pos >= f->prefetched || f->pos + MMAP_PREFETCH < f->prefetched)
+		mmap_file_prefetch(f);
+	*offset = pos;
+	return 0;
+}
+
+static int mmap_file_close(void *cookie)
+{
+	auto f = static_cast<mmap_file *>(cookie);
+
+	munmap(f->map, f->size);
+	if (mmap_from == f)
+		mmap_from = nullptr;
+	delete f;
+	return 0;
+}
+
+static FILE *open_file_from()
+{
+	if (!options[OptStreamFromMmap])
+		return fopen(file_from, "r");
+
+	int fd = open(file_from, O_RDONLY);
+	cookie_io_functions_t io = {};
+	struct stat st;
+	void *map;
+	FILE *fin;
+
+	if (fd < 0)
+		return nullptr;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size ||
+	    (map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "cannot mmap %s, using stdio\n", file_from);
+		close(fd);
+		return fopen(file_from, "r");
+	}
+	close(fd);
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	auto f = new mmap_file();
+
+	f->map = static_cast<u8 *>(map);
+	f->size = st.st_size;
+	mmap_file_prefetch(f);
+	io.read = mmap_file_read;
+	io.seek = mmap_file_seek;
+	io.close = mmap_file_close;
+	fin = fopencookie(f, "r", io);
+	if (!fin) {
+		mmap_file_close(f);
+		return nullptr;
+	}
+	mmap_from = f;
+	return fin;
+}
+
 static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 				  cv4l_fmt &fmt, FILE *fin)
 {
 	static bool first = true;
 	static bool is_fwht = false;
+	static bool is_fwht_ext = false;
 
 	if (host_fd_from >= 0) {
 		for (;;) {
@@ -1081,8 +1823,11 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 			unsigned sz = read_u32(fin);
 
 			if (packet == V4L_STREAM_PACKET_FRAME_VIDEO_RLE ||
-			    packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT) {
-				is_fwht = packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
+			    packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT ||
+			    packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT) {
+				is_fwht_ext = packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT_EXT;
+				is_fwht = is_fwht_ext ||
+					  packet == V4L_STREAM_PACKET_FRAME_VIDEO_FWHT;
 				if (is_fwht && !ctx) {
 					fprintf(stderr, "cannot support FWHT encoding\n");
 					return false;
@@ -1146,7 +1891,10 @@ static bool fill_buffer_from_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &b,
 				offset += n;
 				sz -= n;
 			}
-			if (is_fwht) {
+			if (is_fwht_ext) {
+				fwht_decompress_ext(ctx, read_buf, comp_size, buf, size);
+				delete [] read_buf;
+			} else if (is_fwht) {
 				fwht_decompress(ctx, read_buf, comp_size, buf, size);
 				delete [] read_buf;
 			} else {
@@ -1185,6 +1933,7 @@ restart:
 		unsigned sz;
 		cv4l_fmt fmt;
 		bool res = true;
+		long pos;
 
 		fd.g_fmt(fmt, q.g_type());
 		if (from_with_hdr) {
@@ -1203,8 +1952,19 @@ restart:
 			 v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
 			res = read_write_padded_frame(fmt, static_cast<unsigned char *>(buf),
 						      fin, sz, expected_len, buf_len, true);
-		else
+		else if (mmap_from && q.g_memory() == V4L2_MEMORY_USERPTR &&
+			 (pos = ftell(fin)) >= 0 && !(pos & (getpagesize() - 1)) &&
+			 pos + buf_len <= static_cast<long>(mmap_from->size)) {
+			/* let the buffer point into the mapping, no copy needed */
+			b.s_userptr(mmap_from->map + pos, j);
+			sz = std::min(static_cast<size_t>(expected_len),
+				      mmap_from->size - pos);
+			fseek(fin, sz, SEEK_CUR);
+		} else {
+			if (q.g_memory() == V4L2_MEMORY_USERPTR)
+				b.s_userptr(buf, j);
 			sz = fread(buf, 1, expected_len, fin);
+		}
 
 		if (!res) {
 			fprintf(stderr, "amount intended to be read/written is larger than the buffer size\n");
@@ -1232,41 +1992,338 @@ restart:
 	return true;
 }
 
-static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf,
-				bool ignore_count_skip)
+/*
+ * Moving patterns repeat after tpg_mv_period frames, so each of those
+ * frames, times the two fields when alternating, only has to be rendered
+ * once if there is room to keep them in tpg_cache. The noise pattern is
+ * different every time, so it is never cached.
+ *
+ * Without the cache each buffer keeps a tpg_fill_state instead, so only the
+ * lines that differ from the frame that buffer contained before are
+ * rendered again.
+ */
+static u8 **tpg_cache;
+static tpg_fill_state (*tpg_fill_states)[TPG_MAX_PLANES];
+static unsigned tpg_fill_buffers;
+static unsigned tpg_cache_fields;
+static unsigned tpg_cache_planes;
+static unsigned tpg_cache_size[VIDEO_MAX_PLANES];
+static unsigned tpg_mv_hor_inc;
+static unsigned tpg_mv_vert_inc;
+static unsigned tpg_mv_period = 1;
+static unsigned tpg_mv_frame;
+
+static unsigned tpg_gcd(unsigned a, unsigned b)
 {
-	tpg_pixel_aspect aspect = TPG_PIXEL_ASPECT_SQUARE;
-	cv4l_fmt fmt(q.g_type());
-	u32 field;
-	unsigned p;
-	bool can_fill = false;
-	bool is_video = q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT ||
-			q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
+	while (b) {
+		unsigned t = a % b;
 
-	if (q.obtain_bufs(&fd)) {
-		fprintf(stderr, "%s q.obtain_bufs failed\n", __func__);
-		return QUEUE_ERROR;
+		a = b;
+		b = t;
 	}
+	return a;
+}
 
-	fd.g_fmt(fmt, q.g_type());
-	{
-		cv4l_disable_trace dt(fd);
-		if (fd.g_std(stream_out_std)) {
-			struct v4l2_dv_timings timings;
-
-			stream_out_std = 0;
-			if (fd.g_dv_timings(timings))
-				memset(&timings, 0, sizeof(timings));
-			else if (timings.bt.width == 720 && timings.bt.height == 480)
-				aspect = TPG_PIXEL_ASPECT_NTSC;
-			else if (timings.bt.width == 720 && timings.bt.height == 576)
-				aspect = TPG_PIXEL_ASPECT_PAL;
-		} else if (stream_out_std & V4L2_STD_525_60) {
-			aspect = TPG_PIXEL_ASPECT_NTSC;
-		} else if (stream_out_std & V4L2_STD_625_50) {
-			aspect = TPG_PIXEL_ASPECT_PAL;
-		}
+static void tpg_cache_free()
+{
+	if (tpg_cache) {
+		for (unsigned i = 0; i < tpg_mv_period * tpg_cache_fields * tpg_cache_planes; i++)
+			free(tpg_cache[i]);
+		free(tpg_cache);
+	}
+	tpg_cache = nullptr;
+	for (unsigned i = 0; i < tpg_fill_buffers; i++)
+		for (unsigned p = 0; p < TPG_MAX_PLANES; p++)
+			tpg_fill_state_free(&tpg_fill_states[i][p]);
+	free(tpg_fill_states);
+	tpg_fill_states = nullptr;
+	tpg_fill_buffers = 0;
+}
+
+static void tpg_cache_init(cv4l_queue &q, u32 field)
+{
+	unsigned mult = V4L2_FIELD_HAS_T_OR_B(field) ? 1 : 2;
+	unsigned hor, vert;
+	__u64 size = 0;
+
+	tpg_cache_free();
+	tpg_mv_frame = 0;
+	tpg_mv_hor_inc = tpg.src_width ?
+		(tpg.mv_hor_step * mult) % tpg.src_width : 0;
+	tpg_mv_vert_inc = tpg.src_height ?
+		(tpg.mv_vert_step * mult) % tpg.src_height : 0;
+	hor = tpg_mv_hor_inc ? tpg.src_width / tpg_gcd(tpg.src_width, tpg_mv_hor_inc) : 1;
+	vert = tpg_mv_vert_inc ? tpg.src_height / tpg_gcd(tpg.src_height, tpg_mv_vert_inc) : 1;
+	tpg_mv_period = hor / tpg_gcd(hor, vert) * vert;
+
+	if (!stream_out_refresh || tpg.pattern == TPG_PAT_NOISE)
+		return;
+
+	tpg_fill_states = static_cast<tpg_fill_state (*)[TPG_MAX_PLANES]>(
+		calloc(q.g_buffers(), sizeof(*tpg_fill_states)));
+	if (tpg_fill_states)
+		tpg_fill_buffers = q.g_buffers();
+
+	tpg_cache_fields = output_field_alt ? 2 : 1;
+	tpg_cache_planes = q.g_num_planes();
+	for (unsigned j = 0; j < tpg_cache_planes; j++) {
+		tpg_cache_size[j] = q.g_length(j);
+		size += tpg_cache_size[j];
+	}
+	size *= static_cast<__u64>(tpg_mv_period) * tpg_cache_fields;
+	if (!size || size > (static_cast<__u64>(stream_out_cache_mb) << 20))
+		return;
+	tpg_cache = static_cast<u8 **>(calloc(tpg_mv_period * tpg_cache_fields * tpg_cache_planes,
+					     sizeof(*tpg_cache)));
+}
+
+/*
+ * --stream-out-threads: render each test pattern frame as horizontal
+ * stripes, one per thread. The calling thread renders the first stripe
+ * and waits for the workers to finish the others.
+ */
+#define FILL_MAX_THREADS 32
+
+static bool fill_active;
+static pthread_t fill_thread[FILL_MAX_THREADS];
+static pthread_mutex_t fill_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fill_cond = PTHREAD_COND_INITIALIZER;
+static bool fill_quit;
+static unsigned fill_gen;	/* incremented for each new frame */
+static unsigned fill_next;	/* next stripe to pick up */
+static unsigned fill_done;	/* stripes rendered by the workers */
+static unsigned fill_planes;
+static unsigned fill_plane[TPG_MAX_PLANES];
+static u8 *fill_vbuf[TPG_MAX_PLANES];
+
+static void fill_stripe(unsigned stripe)
+{
+	/* keep the stripes a multiple of 4 lines for vertical downsampling */
+	unsigned lines = (tpg.compose.height + stream_out_threads - 1) / stream_out_threads;
+	unsigned start, end;
+
+	lines = (lines + 3) & ~3U;
+	start = stripe * lines;
+	end = start + lines;
+	for (unsigned i = 0; i < fill_planes; i++)
+		tpg_fill_plane_lines(&tpg, stream_out_std, fill_plane[i],
+				     fill_vbuf[i], start, end);
+}
+
+static void *fill_worker(void *)
+{
+	unsigned gen = 0;
+
+	pthread_mutex_lock(&fill_lock);
+	for (;;) {
+		while (gen == fill_gen && !fill_quit)
+			pthread_cond_wait(&fill_cond, &fill_lock);
+		if (fill_quit)
+			break;
+		gen = fill_gen;
+		while (fill_next < stream_out_threads) {
+			unsigned stripe = fill_next++;
+
+			pthread_mutex_unlock(&fill_lock);
+			fill_stripe(stripe);
+			pthread_mutex_lock(&fill_lock);
+			fill_done++;
+		}
+		pthread_cond_broadcast(&fill_cond);
+	}
+	pthread_mutex_unlock(&fill_lock);
+	return nullptr;
+}
+
+static void fill_stop()
+{
+	if (!fill_active)
+		return;
+
+	pthread_mutex_lock(&fill_lock);
+	fill_quit = true;
+	pthread_cond_broadcast(&fill_cond);
+	pthread_mutex_unlock(&fill_lock);
+	for (unsigned i = 1; i < stream_out_threads; i++)
+		pthread_join(fill_thread[i], nullptr);
+	fill_active = false;
+}
+
+static bool fill_start()
+{
+	if (fill_active)
+		return true;
+	if (stream_out_threads > FILL_MAX_THREADS)
+		stream_out_threads = FILL_MAX_THREADS;
+	if (stream_out_threads <= 1)
+		return false;
+
+	fill_quit = false;
+	fill_gen = 0;
+	for (unsigned i = 1; i < stream_out_threads; i++) {
+		if (pthread_create(&fill_thread[i], nullptr, fill_worker, nullptr)) {
+			fprintf(stderr, "could not start the test pattern threads\n");
+			pthread_mutex_lock(&fill_lock);
+			fill_quit = true;
+			pthread_cond_broadcast(&fill_cond);
+			pthread_mutex_unlock(&fill_lock);
+			while (--i)
+				pthread_join(fill_thread[i], nullptr);
+			stream_out_threads = 0;
+			return false;
+		}
+	}
+	fill_active = true;
+	return true;
+}
+
+/* Same as tpg_fillbuffer(), but split over the --stream-out-threads threads */
+static void fill_buffer(unsigned p, u8 *vbuf)
+{
+	if (!fill_start()) {
+		tpg_fillbuffer(&tpg, stream_out_std, p, vbuf);
+		return;
+	}
+
+	/* the workers only read the tpg state, so update it beforehand */
+	tpg_prepare_fill(&tpg);
+	if (tpg.buffers > 1) {
+		fill_planes = 1;
+		fill_plane[0] = p;
+		fill_vbuf[0] = vbuf;
+	} else {
+		unsigned offset = 0;
+
+		fill_planes = tpg_g_planes(&tpg);
+		for (unsigned i = 0; i < fill_planes; i++) {
+			fill_plane[i] = i;
+			fill_vbuf[i] = vbuf + offset;
+			offset += tpg_calc_plane_size(&tpg, i);
+		}
+	}
+
+	pthread_mutex_lock(&fill_lock);
+	fill_next = 1;
+	fill_done = 0;
+	fill_gen++;
+	pthread_cond_broadcast(&fill_cond);
+	pthread_mutex_unlock(&fill_lock);
+
+	fill_stripe(0);
+
+	pthread_mutex_lock(&fill_lock);
+	while (fill_done < stream_out_threads - 1)
+		pthread_cond_wait(&fill_cond, &fill_lock);
+	pthread_mutex_unlock(&fill_lock);
+}
+
+/*
+ * Stamp the wall clock time into the top-left corner of a filled buffer,
+ * see tpg_gen_timecode().
+ */
+static void tpg_stamp_timecode(cv4l_queue &q, unsigned index)
+{
+	u8 *basep[TPG_MAX_PLANES][2];
+	unsigned offset = 0;
+	timespec ts;
+
+	for (unsigned p = 0; p < tpg_g_planes(&tpg); p++) {
+		u8 *vbuf = static_cast<u8 *>(q.g_dataptr(index, q.g_num_planes() > 1 ? p : 0));
+
+		if (q.g_num_planes() == 1) {
+			vbuf += offset;
+			offset += tpg_calc_plane_size(&tpg, p);
+		}
+		tpg_calc_text_basep(&tpg, basep, p, vbuf);
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	tpg_gen_timecode(&tpg, basep, 0, 0,
+			 ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+
+	if (index >= tpg_fill_buffers)
+		return;
+
+	/*
+	 * The incremental fill has to redraw the lines under the timecode.
+	 * They are not at the top when flipped or for sequential fields.
+	 */
+	bool all = tpg.vflip || tpg.field == V4L2_FIELD_SEQ_TB ||
+		   tpg.field == V4L2_FIELD_SEQ_BT;
+
+	for (unsigned p = 0; p < tpg_g_planes(&tpg); p++)
+		tpg_fill_state_invalidate(&tpg_fill_states[index][p],
+					  0, all ? ~0U : 16);
+}
+
+static void tpg_fill(cv4l_queue &q, unsigned index)
+{
+	unsigned slot = (tpg_mv_frame * tpg_cache_fields +
+			 (tpg_cache_fields > 1 && tpg.field == V4L2_FIELD_BOTTOM)) *
+			tpg_cache_planes;
+
+	tpg.mv_hor_count = static_cast<__u64>(tpg_mv_frame) * tpg_mv_hor_inc % tpg.src_width;
+	tpg.mv_vert_count = static_cast<__u64>(tpg_mv_frame) * tpg_mv_vert_inc % tpg.src_height;
+	tpg_mv_frame = (tpg_mv_frame + 1) % tpg_mv_period;
+
+	for (unsigned j = 0; j < q.g_num_planes(); j++) {
+		u8 *vbuf = static_cast<u8 *>(q.g_dataptr(index, j));
+		u8 **frame = tpg_cache ? &tpg_cache[slot + j] : nullptr;
+
+		if (frame && *frame) {
+			memcpy(vbuf, *frame, tpg_cache_size[j]);
+			continue;
+		}
+		if (!frame && index < tpg_fill_buffers && stream_out_threads <= 1) {
+			tpg_fillbuffer_incremental(&tpg, stream_out_std, j, vbuf,
+						   tpg_fill_states[index]);
+			continue;
+		}
+		fill_buffer(j, vbuf);
+		if (frame) {
+			*frame = static_cast<u8 *>(malloc(tpg_cache_size[j]));
+			if (*frame)
+				memcpy(*frame, vbuf, tpg_cache_size[j]);
+		}
+	}
+	if (stream_out_timecode)
+		tpg_stamp_timecode(q, index);
+}
+
+static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf,
+				bool ignore_count_skip)
+{
+	tpg_pixel_aspect aspect = TPG_PIXEL_ASPECT_SQUARE;
+	cv4l_fmt fmt(q.g_type());
+	u32 field;
+	unsigned p;
+	bool can_fill = false;
+	bool is_video = q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT ||
+			q.g_type() == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
+
+	if (q.obtain_bufs(&fd)) {
+		fprintf(stderr, "%s q.obtain_bufs failed\n", __func__);
+		return QUEUE_ERROR;
+	}
+
+	fd.g_fmt(fmt, q.g_type());
+	{
+		cv4l_disable_trace dt(fd);
+		if (fd.g_std(stream_out_std)) {
+			struct v4l2_dv_timings timings;
+
+			stream_out_std = 0;
+			if (fd.g_dv_timings(timings))
+				memset(&timings, 0, sizeof(timings));
+			else if (timings.bt.width == 720 && timings.bt.height == 480)
+				aspect = TPG_PIXEL_ASPECT_NTSC;
+			else if (timings.bt.width == 720 && timings.bt.height == 576)
+				aspect = TPG_PIXEL_ASPECT_PAL;
+		} else if (stream_out_std & V4L2_STD_525_60) {
+			aspect = TPG_PIXEL_ASPECT_NTSC;
+		} else if (stream_out_std & V4L2_STD_625_50) {
+			aspect = TPG_PIXEL_ASPECT_PAL;
+		}
 	}
 
 	field = fmt.g_field();
@@ -1279,6 +2336,7 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 
 	if (is_video) {
 		tpg_init(&tpg, 640, 360);
+		tpg.colors_ops = &tpg_colors_cache_ops;
 		tpg_alloc(&tpg, fmt.g_width());
 		can_fill = tpg_s_fourcc(&tpg, fmt.g_pixelformat());
 		tpg_reset_source(&tpg, fmt.g_width(), fmt.g_frame_height(), field);
@@ -1314,6 +2372,7 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 		if (can_fill && ((V4L2_FIELD_HAS_T_OR_B(field) && (stream_count & 1)) ||
 				 !tpg_pattern_is_static(&tpg)))
 			stream_out_refresh = true;
+		tpg_cache_init(q, fmt.g_field());
 	}
 
 	for (unsigned i = 0; i < q.g_buffers(); i++) {
@@ -1337,10 +2396,8 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 					field = V4L2_FIELD_TOP;
 			}
 
-			if (can_fill) {
-				for (unsigned j = 0; j < q.g_num_planes(); j++)
-					tpg_fillbuffer(&tpg, stream_out_std, j, static_cast<u8 *>(q.g_dataptr(i, j)));
-			}
+			if (can_fill)
+				tpg_fill(q, i);
 		}
 		if (is_meta)
 			meta_fillbuffer(buf, fmt, q);
@@ -1400,1559 +2457,4512 @@ static int do_setup_out_buffers(cv4l_fd &fd, cv4l_queue &q, FILE *fin, bool qbuf
 	return 0;
 }
 
-static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
-				 cv4l_fmt &fmt, FILE *fout)
+static void buffer_planes(cv4l_queue &q, cv4l_buffer &buf, u8 *data[])
 {
-#ifndef NO_STREAM_TO
-	unsigned comp_size[VIDEO_MAX_PLANES];
-	__u8 *comp_ptr[VIDEO_MAX_PLANES];
-
-	if (host_fd_to >= 0) {
-		unsigned tot_comp_size = 0;
-		unsigned tot_used = 0;
+	for (unsigned j = 0; j < buf.g_num_planes(); j++)
+		data[j] = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j));
+}
 
-		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-			__u32 used = buf.g_bytesused(j);
-			unsigned offset = buf.g_data_offset(j);
-			u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset;
+static void write_plane_to_file(cv4l_fmt &fmt, u8 *p, unsigned used, FILE *fout)
+{
+	unsigned sz;
 
-			if (ctx) {
-				comp_ptr[j] = fwht_compress(ctx, p,
-							    used - offset, &comp_size[j]);
-			} else {
-				comp_ptr[j] = p;
-				comp_size[j] = rle_compress(p, used - offset,
-							    bpl_cap[j]);
-			}
-			tot_comp_size += comp_size[j];
-			tot_used += used - offset;
-		}
-		write_u32(fout, ctx ? V4L_STREAM_PACKET_FRAME_VIDEO_FWHT :
-				V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
-		write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(buf.g_num_planes()) + tot_comp_size);
-		write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
-		write_u32(fout, buf.g_field());
-		write_u32(fout, buf.g_flags());
-		comp_perc += (tot_comp_size * 100 / tot_used);
-		comp_perc_count++;
-	}
+	used = sdr_decimate(fmt, p, used);
 	if (to_with_hdr)
-		write_u32(fout, FILE_HDR_ID);
-	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-		__u32 used = buf.g_bytesused(j);
-		unsigned offset = buf.g_data_offset(j);
-		unsigned sz;
+		write_u32(fout, used);
+	if (codec_type != NOT_CODEC && support_cap_compose &&
+	    v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
+		read_write_padded_frame(fmt, p, fout, sz, used, used, false);
+	else
+		sz = fwrite(p, 1, used, fout);
 
-		if (offset > used) {
-			// Should never happen
-			fprintf(stderr, "offset %d > used %d!\n",
-				offset, used);
-			offset = 0;
-		}
-		used -= offset;
-		if (host_fd_to >= 0) {
-			write_u32(fout, V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
-			write_u32(fout, used);
-			write_u32(fout, comp_size[j]);
-			used = comp_size[j];
-		} else if (to_with_hdr) {
-			write_u32(fout, used);
+	if (sz != used)
+		fprintf(stderr, "%u != %u\n", sz, used);
+}
+
+#ifndef NO_STREAM_TO
+/*
+ * --stream-to-host: each frame is sent with a single sendmsg() of the
+ * packet header, the plane headers and the plane data instead of through
+ * stdio. With MSG_ZEROCOPY the kernel sends from the buffers themselves,
+ * so we have to wait for the completion notifications before the buffers
+ * (or the compression scratch buffer) may be reused.
+ */
+static __u32 host_zc_sent, host_zc_done;
+static unsigned host_zc_copied;
+
+static bool host_zerocopy_wait()
+{
+	while (host_zc_done != host_zc_sent) {
+		struct pollfd pfd = { host_fd_to, 0, 0 };
+		char control[100];
+		struct msghdr msg = {};
+		struct cmsghdr *cm;
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return false;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(host_fd_to, &msg, MSG_ERRQUEUE) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			fprintf(stderr, "MSG_ERRQUEUE: %s\n", strerror(errno));
+			return false;
 		}
-		if (host_fd_to >= 0)
-			sz = fwrite(comp_ptr[j] + offset, 1, used, fout);
-		else if (codec_type != NOT_CODEC && support_cap_compose &&
-			 v4l2_fwht_find_pixfmt(fmt.g_pixelformat()))
-			read_write_padded_frame(fmt, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
-						fout, sz, used, used, false);
-		else
-			sz = fwrite(static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset, 1, used, fout);
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			auto serr = reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cm));
 
-		if (sz != used)
-			fprintf(stderr, "%u != %u\n", sz, used);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			host_zc_done = serr->ee_data + 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				host_zc_copied++;
+		}
 	}
-	if (host_fd_to >= 0)
-		fflush(fout);
-#endif
+	return true;
 }
 
-static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
-			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
-			 bool ignore_count_skip)
+static bool host_sendmsg(struct iovec *iov, unsigned iovcnt)
 {
-	char ch = '<';
-	int ret;
-	cv4l_buffer buf(q);
+	struct msghdr msg = {};
+	int flags = host_zerocopy ? MSG_ZEROCOPY : 0;
 
-	for (;;) {
-		ret = fd.dqbuf(buf);
-		if (ret == EAGAIN)
-			return 0;
-		if (ret == EPIPE)
-			return QUEUE_STOPPED;
-		if (ret) {
-			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
-			return QUEUE_ERROR;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovcnt;
+	while (msg.msg_iovlen) {
+		ssize_t ret = sendmsg(host_fd_to, &msg, flags);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			fprintf(stderr, "sendmsg: %s\n", strerror(errno));
+			return false;
 		}
-		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
-			last_buffer = true;
-			break;
+		if (host_zerocopy)
+			host_zc_sent++;
+		while (msg.msg_iovlen && static_cast<size_t>(ret) >= msg.msg_iov->iov_len) {
+			ret -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if (msg.msg_iovlen) {
+			msg.msg_iov->iov_base = static_cast<u8 *>(msg.msg_iov->iov_base) + ret;
+			msg.msg_iov->iov_len -= ret;
 		}
-		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR))
-			break;
-		if (verbose)
-			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
-		if (fd.qbuf(buf))
-			return QUEUE_ERROR;
 	}
+	return !host_zerocopy || host_zerocopy_wait();
+}
 
-	bool is_empty_frame = !buf.g_bytesused(0);
-	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
-
-	double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
-	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+static void host_setup_socket(const struct sockaddr_in &addr)
+{
+	int one = 1;
+
+	if (host_udp) {
+		if (host_zerocopy)
+			fprintf(stderr, "zerocopy is not supported with udp\n");
+		host_zerocopy = host_nodelay = false;
+		if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr)) &&
+		    setsockopt(host_fd_to, IPPROTO_IP, IP_MULTICAST_TTL,
+			       &host_udp_ttl, sizeof(host_udp_ttl)))
+			fprintf(stderr, "cannot set IP_MULTICAST_TTL: %s\n", strerror(errno));
+	}
+	if (host_nodelay &&
+	    setsockopt(host_fd_to, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		fprintf(stderr, "cannot set TCP_NODELAY: %s\n", strerror(errno));
+	if (host_sndbuf &&
+	    setsockopt(host_fd_to, SOL_SOCKET, SO_SNDBUF, &host_sndbuf, sizeof(host_sndbuf)))
+		fprintf(stderr, "cannot set SO_SNDBUF: %s\n", strerror(errno));
+	if (host_zerocopy &&
+	    setsockopt(host_fd_to, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+		fprintf(stderr, "cannot set SO_ZEROCOPY: %s\n", strerror(errno));
+		host_zerocopy = false;
+	}
+}
 
-	if (fout && (!stream_skip || ignore_count_skip) &&
-	    !is_empty_frame && !is_error_frame)
-		write_buffer_to_file(fd, q, buf, fmt, fout);
+/*
+ * --stream-to-local: the shared memory variant of the stream protocol as
+ * described in v4l-stream.h. Each frame is copied once into a free frame
+ * of the ring instead of being sent through the socket.
+ */
+static struct v4l_stream_shm_ring *host_shm;
+static u8 *host_shm_data;
+static unsigned host_shm_frames = V4L_STREAM_SHM_DEFAULT_FRAMES;
+static unsigned host_shm_frame_size;
+static unsigned host_shm_num_planes;
+static unsigned host_shm_plane_size[VIDEO_MAX_PLANES];
+static unsigned host_shm_dropped;
+static int host_shm_event_fd = -1;
+
+static int host_local_connect()
+{
+	struct sockaddr_un addr = {};
+	int sock;
 
-	if (buf.g_flags() & V4L2_BUF_FLAG_KEYFRAME)
-		ch = 'K';
-	else if (buf.g_flags() & V4L2_BUF_FLAG_PFRAME)
-		ch = 'P';
-	else if (buf.g_flags() & V4L2_BUF_FLAG_BFRAME)
-		ch = 'B';
-	if (verbose) {
-		print_concise_buffer(stderr, buf, fmt, q, fps_ts,
-				     host_fd_to >= 0 ? 100 - comp_perc / comp_perc_count : -1);
-		comp_perc_count = comp_perc = 0;
+	if (strlen(host_local) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path %s is too long\n", host_local);
+		std::exit(EXIT_FAILURE);
 	}
-	if (!last_buffer && index == nullptr) {
-		/*
-		 * EINVAL in qbuf can happen if this is the last buffer before
-		 * a dynamic resolution change sequence. In this case the buffer
-		 * has the size that fits the old resolution and might not
-		 * fit to the new one.
-		 */
-		if (fd.qbuf(buf) && errno != EINVAL) {
-			fprintf(stderr, "%s: qbuf error\n", __func__);
-			return QUEUE_ERROR;
-		}
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		fprintf(stderr, "cannot open socket: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
 	}
-	if (index)
-		*index = buf.g_index();
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, host_local);
+	if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+		fprintf(stderr, "could not connect to %s: %s\n", host_local, strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	return sock;
+}
 
-	if (!verbose) {
-		stderr_info("%c", ch);
-		fflush(stderr);
+/* Called after the FMT_VIDEO packet has been sent */
+static void host_local_setup(const cv4l_fmt &fmt)
+{
+#ifdef HAVE_MEMFD_CREATE
+	char control[CMSG_SPACE(2 * sizeof(int))] = {};
+	__u32 pkt[5];
+	struct iovec iov = { pkt, sizeof(pkt) };
+	struct msghdr msg = {};
+	struct cmsghdr *cm;
+	int fds[2];
+	size_t size;
+	__u32 ack;
+	void *p;
+
+	host_shm_num_planes = fmt.g_num_planes();
+	host_shm_frame_size = 0;
+	for (unsigned i = 0; i < host_shm_num_planes; i++) {
+		host_shm_plane_size[i] = fmt.g_sizeimage(i);
+		host_shm_frame_size += fmt.g_sizeimage(i);
+	}
+	/* keep the frames page aligned */
+	host_shm_frame_size = (host_shm_frame_size + 4095) & ~4095U;
+	size = V4L_STREAM_SHM_DATA_OFFSET +
+	       static_cast<size_t>(host_shm_frames) * host_shm_frame_size;
+
+	fds[0] = memfd_create("v4l2-ctl-stream", MFD_CLOEXEC);
+	fds[1] = host_shm_event_fd = eventfd(0, EFD_CLOEXEC);
+	if (fds[0] < 0 || fds[1] < 0 || ftruncate(fds[0], size)) {
+		fprintf(stderr, "cannot create the frame ring: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "cannot map the frame ring: %s\n", strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+	host_shm = static_cast<struct v4l_stream_shm_ring *>(p);
+	host_shm_data = static_cast<u8 *>(p) + V4L_STREAM_SHM_DATA_OFFSET;
+
+	pkt[0] = htonl(V4L_STREAM_PACKET_SHM_RING);
+	pkt[1] = htonl(V4L_STREAM_PACKET_SHM_RING_SIZE + 4);
+	pkt[2] = htonl(V4L_STREAM_PACKET_SHM_RING_SIZE);
+	pkt[3] = htonl(host_shm_frames);
+	pkt[4] = htonl(host_shm_frame_size);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+	if (sendmsg(host_fd_to, &msg, 0) != sizeof(pkt) ||
+	    read(host_fd_to, &ack, sizeof(ack)) != sizeof(ack) ||
+	    ntohl(ack) != V4L_STREAM_PACKET_SHM_RING) {
+		fprintf(stderr, "the receiver did not accept the frame ring\n");
+		std::exit(EXIT_FAILURE);
+	}
+	/* the receiver has mapped the ring itself */
+	close(fds[0]);
+#else
+	fprintf(stderr, "--stream-to-local is not supported, memfd_create() is missing\n");
+	std::exit(EXIT_FAILURE);
+#endif
+}
 
-		if (fps_ts.has_fps()) {
-			unsigned dropped = fps_ts.dropped();
+static void host_local_send(cv4l_buffer &buf, u8 * const data[])
+{
+	__u32 head = host_shm->head;
+	__u32 tail = __atomic_load_n(&host_shm->tail, __ATOMIC_ACQUIRE);
+	__u64 one = 1;
 
-			stderr_info(" %.02f fps", fps_ts.fps());
-			if (dropped)
-				stderr_info(", dropped buffers: %u", dropped);
-			if (host_fd_to >= 0)
-				stderr_info(" %d%% compression", 100 - comp_perc / comp_perc_count);
-			comp_perc_count = comp_perc = 0;
-			stderr_info("\n");
-		}
+	if (head - tail >= host_shm_frames) {
+		host_shm_dropped++;
+		return;
 	}
-	count++;
 
-	if (ignore_count_skip)
-		return 0;
+	unsigned slot = head % host_shm_frames;
+	struct v4l_stream_shm_frame &f = host_shm->frame[slot];
+	u8 *dst = host_shm_data + slot * host_shm_frame_size;
 
-	if (need_sleep(count)) {
-		if (stream_sleep_mode & 2)
-			return QUEUE_OFF_ON;
-		do_sleep();
+	f.seq = buf.g_sequence();
+	f.field = buf.g_field();
+	f.flags = buf.g_flags();
+	for (unsigned j = 0; j < host_shm_num_planes; j++) {
+		__u32 used = j < buf.g_num_planes() ? buf.g_bytesused(j) : 0;
+		unsigned offset = j < buf.g_num_planes() ? buf.g_data_offset(j) : 0;
+
+		if (offset > used)
+			offset = 0;
+		used = std::min(used - offset, host_shm_plane_size[j]);
+		if (used)
+			memcpy(dst, data[j] + offset, used);
+		f.bytesused[j] = used;
+		dst += host_shm_plane_size[j];
 	}
+	__atomic_store_n(&host_shm->head, head + 1, __ATOMIC_RELEASE);
+	if (write(host_shm_event_fd, &one, sizeof(one)) != sizeof(one))
+		fprintf(stderr, "cannot signal the frame: %s\n", strerror(errno));
+}
 
-	if (is_empty_frame || is_error_frame)
-		return 0;
+/*
+ * --stream-to-host-opts udp=1: the UDP variant of the stream protocol as
+ * described in v4l-stream.h. The datagrams of a frame are sent in batches
+ * of HOST_UDP_BATCH with sendmmsg(), and the format is repeated every
+ * HOST_UDP_FMT_INTERVAL frames for receivers that join later.
+ */
+#define HOST_UDP_BATCH 64
+#define HOST_UDP_FMT_INTERVAL 30
+
+static __u32 host_udp_seq;
+static __u32 host_udp_fmt[V4L_STREAM_PACKET_FMT_VIDEO_SIZE(VIDEO_MAX_PLANES) / 4];
+static unsigned host_udp_fmt_len;
+
+struct host_udp_batch {
+	struct mmsghdr msgs[HOST_UDP_BATCH];
+	struct iovec iov[HOST_UDP_BATCH][2];
+	__u32 hdr[HOST_UDP_BATCH][V4L_STREAM_UDP_HDR_SIZE / 4];
+	u8 *parity;
+	unsigned cnt;
+};
 
-	if (stream_skip) {
-		stream_skip--;
-		return 0;
+static void host_udp_flush(host_udp_batch &b)
+{
+	unsigned done = 0;
+
+	while (done < b.cnt) {
+		int ret = sendmmsg(host_fd_to, b.msgs + done, b.cnt - done, 0);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			/* e.g. ECONNREFUSED if nobody listens (yet), just drop */
+			if (verbose)
+				fprintf(stderr, "sendmmsg: %s\n", strerror(errno));
+			break;
+		}
+		done += ret;
 	}
+	b.cnt = 0;
+}
 
-	if (stream_count == 0)
-		return 0;
+static __u32 *host_udp_add(host_udp_batch &b, __u32 packet, const void *payload,
+			   unsigned len)
+{
+	unsigned i = b.cnt++;
+
+	memset(&b.msgs[i], 0, sizeof(b.msgs[i]));
+	memset(b.hdr[i], 0, sizeof(b.hdr[i]));
+	b.hdr[i][0] = htonl(V4L_STREAM_UDP_ID);
+	b.hdr[i][1] = htonl(packet);
+	b.hdr[i][2] = htonl(host_udp_seq);
+	b.iov[i][0].iov_base = b.hdr[i];
+	b.iov[i][0].iov_len = sizeof(b.hdr[i]);
+	b.iov[i][1].iov_base = const_cast<void *>(payload);
+	b.iov[i][1].iov_len = len;
+	b.msgs[i].msg_hdr.msg_iov = b.iov[i];
+	b.msgs[i].msg_hdr.msg_iovlen = 2;
+	return b.hdr[i];
+}
 
-	if (--stream_count == 0)
-		return QUEUE_STOPPED;
+static void host_udp_send_packet(__u32 packet, const void *payload, unsigned len)
+{
+	static host_udp_batch b;
 
-	return 0;
+	host_udp_add(b, packet, payload, len);
+	host_udp_flush(b);
 }
 
-static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap,
-			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt fmt,
-			 bool stopped, bool ignore_count_skip)
+static void host_udp_send_frame(cv4l_buffer &buf, __u32 packet, u8 * const comp_ptr[],
+				const unsigned comp_size[], const unsigned used[])
 {
-	cv4l_buffer buf(q);
-	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
-	int ret = 0;
+	static host_udp_batch b;
+	unsigned frag_size = host_udp_size - V4L_STREAM_UDP_HDR_SIZE;
 
-	if (cap) {
-		buf.s_index(cap->g_index());
+	if (!b.parity)
+		b.parity = new u8[HOST_UDP_BATCH * V4L_STREAM_UDP_MAX_SIZE];
+	if (host_udp_seq % HOST_UDP_FMT_INTERVAL == 0)
+		host_udp_send_packet(V4L_STREAM_PACKET_FMT_VIDEO, host_udp_fmt,
+				     host_udp_fmt_len * 4);
 
-		if (fd.querybuf(buf)) {
-			fprintf(stderr, "%s fd.querybuf failed\n", __func__);
-			return QUEUE_ERROR;
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		unsigned frags = (comp_size[j] + frag_size - 1) / frag_size;
+
+		for (unsigned i = 0; i < frags; i++) {
+			unsigned offset = i * frag_size;
+			unsigned len = std::min(frag_size, comp_size[j] - offset);
+			bool parity = host_udp_fec &&
+				(i % host_udp_fec == host_udp_fec - 1 || i == frags - 1);
+			unsigned n = parity ? 2 : 1;
+
+			if (b.cnt + n > HOST_UDP_BATCH)
+				host_udp_flush(b);
+
+			__u32 *h = host_udp_add(b, packet, comp_ptr[j] + offset, len);
+
+			h[3] = htonl(buf.g_num_planes());
+			h[4] = htonl(j);
+			h[5] = htonl(buf.g_field());
+			h[6] = htonl(buf.g_flags());
+			h[7] = htonl(used[j]);
+			h[8] = htonl(comp_size[j]);
+			h[9] = htonl(offset);
+			h[10] = htonl(frag_size);
+			h[11] = htonl(host_udp_fec);
+			if (!parity)
+				continue;
+
+			/* XOR of the fragments of this FEC group */
+			unsigned first = i - i % host_udp_fec;
+			u8 *par = b.parity + b.cnt * V4L_STREAM_UDP_MAX_SIZE;
+			__u32 *ph = host_udp_add(b, packet, par, frag_size);
+
+			memcpy(ph + 3, h + 3, 8 * sizeof(__u32));
+			ph[9] = htonl(first * frag_size);
+			ph[11] = htonl(host_udp_fec | V4L_STREAM_UDP_FEC_PARITY);
+			memset(par, 0, frag_size);
+			for (unsigned k = first; k <= i; k++) {
+				const u8 *d = comp_ptr[j] + k * frag_size;
+				unsigned l = std::min(frag_size, comp_size[j] - k * frag_size);
+
+				for (unsigned x = 0; x < l; x++)
+					par[x] ^= d[x];
+			}
 		}
+	}
+	host_udp_flush(b);
+	host_udp_seq++;
+}
 
-		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
-			unsigned data_offset = cap->g_data_offset(j);
+/*
+ * Compress the planes of buf, starting at data[], with the FWHT codec context
+ * c, or with RLE if c is NULL. If out is set, the FWHT data of each plane is
+ * copied there so it is still valid once the next frame has been compressed
+ * with c. Returns the size of the compressed data as a percentage of the
+ * frame size.
+ */
+static unsigned host_compress(codec_ctx *c, u8 * const data[], cv4l_buffer &buf,
+			      u8 *out, u8 *comp_ptr[], unsigned comp_size[],
+			      unsigned plane_used[])
+{
+	unsigned tot_comp_size = 0;
+	unsigned tot_used = 0;
+	__u64 ts = buf.g_timestamp().tv_sec * 1000000ULL + buf.g_timestamp().tv_usec;
 
-			if (q.g_memory() == V4L2_MEMORY_USERPTR) {
-				buf.s_userptr(static_cast<u8 *>(cap->g_userptr(j)) + data_offset, j);
-				buf.s_bytesused(cap->g_bytesused(j) - data_offset, j);
-				buf.s_data_offset(0, j);
-			} else if (q.g_memory() == V4L2_MEMORY_DMABUF) {
-				__u32 bytesused = cap->g_bytesused(j);
-				/*
-				 * bytesused comes from the exported cap buffer
-				 * but the length of the out buffer might be smaller
-				 * so take the smaller of the two
-				 */
-				if (bytesused > buf.g_length(j))
-					bytesused = buf.g_length(j);
-				buf.s_bytesused(bytesused, j);
-				buf.s_data_offset(data_offset, j);
-				buf.s_fd(q.g_fd(buf.g_index(), j));
+	/* the rate control needs a capture time */
+	if (!ts)
+		ts = now_usecs();
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		u8 *p = data[j] + offset;
+
+		if (c) {
+			comp_ptr[j] = fwht_compress_at(c, p, used - offset,
+						       &comp_size[j], ts);
+			if (out) {
+				memcpy(out, comp_ptr[j], comp_size[j]);
+				comp_ptr[j] = out;
+				out += c->comp_max_size;
 			}
+		} else if (host_raw) {
+			comp_ptr[j] = p;
+			comp_size[j] = used - offset;
+		} else {
+			comp_ptr[j] = p;
+			comp_size[j] = rle_compress(p, used - offset,
+						    bpl_cap[j]);
 		}
-	} else {
-		ret = fd.dqbuf(buf);
-		if (ret == EAGAIN)
-			return 0;
+		tot_comp_size += comp_size[j];
+		tot_used += used - offset;
+		plane_used[j] = used - offset;
+	}
+	return tot_comp_size * 100 / tot_used;
+}
 
-		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
-		fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
-		if (verbose)
-			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+static void host_send(cv4l_buffer &buf, u8 * const comp_ptr[],
+		      const unsigned comp_size[], const unsigned plane_used[])
+{
+	__u32 hdr[5 + 3 * VIDEO_MAX_PLANES];
+	struct iovec iov[1 + 2 * VIDEO_MAX_PLANES];
+	unsigned tot_comp_size = 0;
+	unsigned iovcnt = 0;
+	__u32 *h = hdr;
+
+	if (host_udp) {
+		host_udp_send_frame(buf, ctx ? fwht_packet(ctx) :
+				    V4L_STREAM_PACKET_FRAME_VIDEO_RLE,
+				    comp_ptr, comp_size, plane_used);
+		return;
+	}
+	for (unsigned j = 0; j < buf.g_num_planes(); j++)
+		tot_comp_size += comp_size[j];
+	*h++ = htonl(ctx ? fwht_packet(ctx) :
+			   V4L_STREAM_PACKET_FRAME_VIDEO_RLE);
+	*h++ = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE(buf.g_num_planes()) + tot_comp_size);
+	*h++ = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_HDR);
+	*h++ = htonl(buf.g_field());
+	*h++ = htonl(buf.g_flags());
+	iov[iovcnt].iov_base = hdr;
+	iov[iovcnt++].iov_len = 5 * sizeof(__u32);
 
-		for (unsigned j = 0; j < buf.g_num_planes(); j++)
-			buf.s_bytesused(buf.g_length(j), j);
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+
+		if (offset > used) {
+			// Should never happen
+			fprintf(stderr, "offset %d > used %d!\n",
+				offset, used);
+			offset = 0;
+		}
+		used -= offset;
+		iov[iovcnt].iov_base = h;
+		iov[iovcnt++].iov_len = 3 * sizeof(__u32);
+		*h++ = htonl(V4L_STREAM_PACKET_FRAME_VIDEO_SIZE_PLANE_HDR);
+		*h++ = htonl(used);
+		*h++ = htonl(comp_size[j]);
+		iov[iovcnt].iov_base = comp_ptr[j] + offset;
+		iov[iovcnt++].iov_len = comp_size[j];
 	}
-	if (ret) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(ret));
-		return QUEUE_ERROR;
+	host_sendmsg(iov, iovcnt);
+}
+
+static void write_buffer_to_host(cv4l_queue &q, cv4l_buffer &buf)
+{
+	unsigned comp_size[VIDEO_MAX_PLANES];
+	__u8 *comp_ptr[VIDEO_MAX_PLANES];
+	unsigned plane_used[VIDEO_MAX_PLANES];
+	u8 *data[VIDEO_MAX_PLANES];
+	__u64 start = now_usecs();
+
+	buffer_planes(q, buf, data);
+	if (host_shm) {
+		host_local_send(buf, data);
+		return;
 	}
-	if (fps_ts.has_fps()) {
-		unsigned dropped = fps_ts.dropped();
+	comp_perc += host_compress(ctx, data, buf, nullptr,
+				   comp_ptr, comp_size, plane_used);
+	comp_usecs += now_usecs() - start;
+	comp_perc_count++;
+	for (unsigned j = 0; j < buf.g_num_planes(); j++)
+		comp_bytes += comp_size[j];
+	host_send(buf, comp_ptr, comp_size, plane_used);
+}
+#endif
 
-		stderr_info(" %.02f fps", fps_ts.fps());
-		if (dropped)
-			stderr_info(", dropped buffers: %u", dropped);
-		stderr_info("\n");
+static void write_host_end(FILE *fout)
+{
+#ifndef NO_STREAM_TO
+	if (host_shm_dropped)
+		fprintf(stderr, "%u frames dropped, the local receiver fell behind\n",
+			host_shm_dropped);
+	if (host_udp) {
+		host_udp_send_packet(V4L_STREAM_PACKET_END, nullptr, 0);
+		return;
 	}
-	if (stopped)
-		return 0;
+#endif
+	write_u32(fout, V4L_STREAM_PACKET_END);
+}
 
-	buf.s_field(output_field);
-	tpg_s_field(&tpg, output_field, output_field_alt);
-	if (output_field_alt) {
-		if (output_field == V4L2_FIELD_TOP)
-			output_field = V4L2_FIELD_BOTTOM;
-		else if (output_field == V4L2_FIELD_BOTTOM)
-			output_field = V4L2_FIELD_TOP;
+/*
+ * --stream-hash: CRC32C (Castagnoli) of each plane, see crc32c.h.
+ */
+static void hash_frame(cv4l_buffer &buf, u8 * const data[])
+{
+	if (!hash_fout) {
+		hash_fout = strcmp(file_hash, "-") ? fopen(file_hash, "w") : stdout;
+		if (!hash_fout) {
+			fprintf(stderr, "could not open %s for writing\n", file_hash);
+			file_hash = nullptr;
+			return;
+		}
 	}
 
-	if (fin && !fill_buffer_from_file(fd, q, buf, fmt, fin))
-		return QUEUE_STOPPED;
+	fprintf(hash_fout, "%u %lld.%06ld", buf.g_sequence(),
+		static_cast<long long>(buf.g_timestamp().tv_sec),
+		static_cast<long>(buf.g_timestamp().tv_usec));
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
 
-	if (!fin && stream_out_refresh) {
-		for (unsigned j = 0; j < buf.g_num_planes(); j++)
-			tpg_fillbuffer(&tpg, stream_out_std, j,
-				       static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)));
+		if (offset > used)
+			offset = 0;
+		fprintf(hash_fout, " %08x", crc32c(data[j] + offset, used - offset));
 	}
-	if (is_meta)
-		meta_fillbuffer(buf, fmt, q);
+	fprintf(hash_fout, "\n");
+}
 
-	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
-		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_REINIT, NULL)) {
-			fprintf(stderr, "Unable to reinit media request: %s\n",
-				strerror(errno));
-			return QUEUE_ERROR;
-		}
+static void hash_buffer(cv4l_queue &q, cv4l_buffer &buf)
+{
+	u8 *data[VIDEO_MAX_PLANES];
 
-		if (set_fwht_ext_ctrl(fd, &last_fwht_hdr, last_fwht_bf_ts,
-				      buf.g_request_fd())) {
-			fprintf(stderr, "%s: set_fwht_ext_ctrl failed: %s\n",
-				__func__, strerror(errno));
-			return QUEUE_ERROR;
+	buffer_planes(q, buf, data);
+	hash_frame(buf, data);
+}
+
+static void write_buffer_to_file(cv4l_fd &fd, cv4l_queue &q, cv4l_buffer &buf,
+				 cv4l_fmt &fmt, FILE *fout)
+{
+#ifndef NO_STREAM_TO
+	if (host_fd_to >= 0) {
+		write_buffer_to_host(q, buf);
+		return;
+	}
+	if (to_with_hdr)
+		write_u32(fout, FILE_HDR_ID);
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+
+		if (offset > used) {
+			// Should never happen
+			fprintf(stderr, "offset %d > used %d!\n",
+				offset, used);
+			offset = 0;
 		}
+		used -= offset;
+		write_plane_to_file(fmt, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset,
+				    used, fout);
 	}
+#endif
+}
 
-	set_time_stamp(buf);
+/*
+ * --stream-ctrl-schedule: the controls of each scheduled frame are applied
+ * with a single VIDIOC_S_EXT_CTRLS call. If the capture queue supports
+ * requests, then every buffer is queued with a request of its own, since vb2
+ * does not allow mixing buffers with and without requests, and the controls
+ * are set in the request of the scheduled frame. The request of a buffer is
+ * reused once the buffer is dequeued.
+ */
+using ctrl_sched_map = std::map<unsigned, std::vector<v4l2_ext_control> >;
 
-	if (fd.qbuf(buf)) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
-		return QUEUE_ERROR;
-	}
-	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
-		if (!set_fwht_req_by_fd(&last_fwht_hdr, buf.g_request_fd(), last_fwht_bf_ts,
-					buf.g_timestamp_ns())) {
-			fprintf(stderr, "%s: request for fd %d does not exist\n",
-				__func__, buf.g_request_fd());
-			return QUEUE_ERROR;
-		}
+static ctrl_sched_map ctrl_sched;
+static ctrl_sched_map::iterator ctrl_sched_next;
+static bool ctrl_sched_active;
+static unsigned ctrl_sched_frame;
+static int ctrl_sched_media_fd = -1;
+static int ctrl_sched_reqs[VIDEO_MAX_FRAME];
 
-		last_fwht_bf_ts = buf.g_timestamp_ns();
-		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_QUEUE) < 0) {
-			fprintf(stderr, "Unable to queue media request: %s\n",
-				strerror(errno));
-			return QUEUE_ERROR;
+static bool ctrl_sched_parse(cv4l_fd &fd)
+{
+	FILE *f = fopen(ctrl_sched_file, "r");
+	char line[1024];
+	unsigned line_nr = 0;
+
+	if (!f) {
+		fprintf(stderr, "could not open %s for reading\n", ctrl_sched_file);
+		return false;
+	}
+	ctrl_sched.clear();
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line;
+		unsigned frame;
+
+		line_nr++;
+		while (isspace(*p))
+			p++;
+		if (!*p || *p == '#')
+			continue;
+		frame = strtoul(p, &p, 0);
+		for (char *tok = strtok(p, ", \t\r\n"); tok; tok = strtok(nullptr, ", \t\r\n")) {
+			char *equal = strchr(tok, '=');
+			v4l2_query_ext_ctrl qc = {};
+			v4l2_ext_control ctrl = {};
+
+			if (equal)
+				*equal = '\0';
+			if (isdigit(tok[0]))
+				qc.id = strtoul(tok, nullptr, 0);
+			else
+				qc.id = common_find_ctrl_id(tok);
+			if (!equal || !qc.id || fd.query_ext_ctrl(qc) ||
+			    (qc.flags & V4L2_CTRL_FLAG_HAS_PAYLOAD)) {
+				fprintf(stderr, "%s:%u: invalid control '%s'\n",
+					ctrl_sched_file, line_nr, tok);
+				fclose(f);
+				return false;
+			}
+			ctrl.id = qc.id;
+			if (qc.type == V4L2_CTRL_TYPE_INTEGER64)
+				ctrl.value64 = strtoll(equal + 1, nullptr, 0);
+			else
+				ctrl.value = strtol(equal + 1, nullptr, 0);
+			ctrl_sched[frame].push_back(ctrl);
 		}
 	}
+	fclose(f);
+	return true;
+}
 
-	tpg_update_mv_count(&tpg, V4L2_FIELD_HAS_T_OR_B(output_field));
+static bool ctrl_sched_start(cv4l_fd &fd, cv4l_queue &q)
+{
+	ctrl_sched_active = false;
+	if (!ctrl_sched_file)
+		return true;
+	if (!ctrl_sched_parse(fd))
+		return false;
 
-	if (!verbose)
-		stderr_info(">");
-	fflush(stderr);
+	ctrl_sched_next = ctrl_sched.begin();
+	ctrl_sched_frame = 0;
+	for (unsigned i = 0; i < VIDEO_MAX_FRAME; i++)
+		ctrl_sched_reqs[i] = -1;
+	if (q.g_capabilities() & V4L2_BUF_CAP_SUPPORTS_REQUESTS) {
+		struct v4l2_capability vcap = {};
 
-	count++;
+		fd.querycap(vcap);
+		ctrl_sched_media_fd = mi_get_media_fd(fd.g_fd(),
+						      reinterpret_cast<const char *>(vcap.bus_info));
+	}
+	if (verbose)
+		stderr_info("%s: %zu scheduled frames, %s\n", __func__, ctrl_sched.size(),
+			    ctrl_sched_media_fd >= 0 ? "using requests" : "using VIDIOC_S_EXT_CTRLS");
+	ctrl_sched_active = true;
+	return true;
+}
 
-	if (ignore_count_skip)
-		return 0;
+static void ctrl_sched_stop()
+{
+	for (unsigned i = 0; ctrl_sched_active && i < VIDEO_MAX_FRAME; i++)
+		if (ctrl_sched_reqs[i] >= 0)
+			close(ctrl_sched_reqs[i]);
+	if (ctrl_sched_media_fd >= 0)
+		close(ctrl_sched_media_fd);
+	ctrl_sched_media_fd = -1;
+	ctrl_sched_active = false;
+}
 
-	if (need_sleep(count)) {
-		if (stream_sleep_mode & 2)
-			return QUEUE_OFF_ON;
-		do_sleep();
+static int cap_qbuf(cv4l_fd &fd, cv4l_buffer &buf)
+{
+	std::vector<v4l2_ext_control> *ctrls = nullptr;
+	v4l2_ext_controls ext = {};
+	unsigned index = buf.g_index();
+	unsigned frame;
+	int ret;
+
+	if (!ctrl_sched_active)
+		return fd.qbuf(buf);
+
+	frame = ctrl_sched_frame++;
+	while (ctrl_sched_next != ctrl_sched.end() && ctrl_sched_next->first < frame)
+		ctrl_sched_next++;
+	if (ctrl_sched_next != ctrl_sched.end() && ctrl_sched_next->first == frame)
+		ctrls = &(ctrl_sched_next++)->second;
+	if (ctrls) {
+		ext.count = ctrls->size();
+		ext.controls = &(*ctrls)[0];
 	}
 
-	if (stream_skip) {
-		stream_skip--;
-		return 0;
+	if (ctrl_sched_media_fd < 0 || index >= VIDEO_MAX_FRAME) {
+		if (ctrls && fd.s_ext_ctrls(ext))
+			fprintf(stderr, "frame %u: VIDIOC_S_EXT_CTRLS failed: %s\n",
+				frame, strerror(errno));
+		return fd.qbuf(buf);
 	}
 
-	if (stream_count == 0)
-		return 0;
-	if (--stream_count == 0)
-		return QUEUE_STOPPED;
+	int &req = ctrl_sched_reqs[index];
 
+	if (req < 0 ? ioctl(ctrl_sched_media_fd, MEDIA_IOC_REQUEST_ALLOC, &req) :
+		      ioctl(req, MEDIA_REQUEST_IOC_REINIT, NULL)) {
+		fprintf(stderr, "%s: could not set up request: %s\n", __func__, strerror(errno));
+		return errno;
+	}
+	if (ctrls) {
+		ext.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+		ext.request_fd = req;
+		if (fd.s_ext_ctrls(ext))
+			fprintf(stderr, "frame %u: VIDIOC_S_EXT_CTRLS failed: %s\n",
+				frame, strerror(errno));
+	}
+	buf.s_request_fd(req);
+	buf.or_flags(V4L2_BUF_FLAG_REQUEST_FD);
+	ret = fd.qbuf(buf);
+	if (ret)
+		return ret;
+	if (ioctl(req, MEDIA_REQUEST_IOC_QUEUE, NULL)) {
+		fprintf(stderr, "%s: could not queue request: %s\n", __func__, strerror(errno));
+		return errno;
+	}
 	return 0;
 }
 
-static int do_handle_out_to_in(cv4l_fd &out_fd, cv4l_fd &fd, cv4l_queue &out, cv4l_queue &in)
+static int cap_queue_all(cv4l_fd &fd, cv4l_queue &q)
 {
-	cv4l_buffer buf(out);
-	int ret;
+	for (unsigned i = 0; i < q.g_buffers(); i++) {
+		cv4l_buffer buf(q, i);
+		int ret = cap_qbuf(fd, buf);
 
-	do {
-		ret = out_fd.dqbuf(buf);
-	} while (ret == EAGAIN);
-	if (ret) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
-		return QUEUE_ERROR;
-	}
-	buf.init(in, buf.g_index());
-	ret = fd.querybuf(buf);
-	if (ret == 0)
-		ret = fd.qbuf(buf);
-	if (ret) {
-		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
-		return QUEUE_ERROR;
+		if (ret)
+			return ret;
 	}
 	return 0;
 }
 
-static FILE *open_output_file(cv4l_fd &fd)
-{
-	FILE *fout = nullptr;
-
-#ifndef NO_STREAM_TO
-	if (file_to) {
-		if (!strcmp(file_to, "-"))
-			return stdout;
-		fout = fopen(file_to, "w+");
-		if (!fout)
-			fprintf(stderr, "could not open %s for writing\n", file_to);
-		return fout;
-	}
-	if (!host_to)
-		return nullptr;
-
-	char *p = std::strchr(host_to, ':');
-	struct sockaddr_in serv_addr;
-	struct hostent *server;
-	struct v4l2_fract aspect;
-	unsigned width, height;
-	cv4l_fmt cfmt;
-
-	fd.g_fmt(cfmt);
+/*
+ * --stream-to-ring: the frames are written by a separate thread, so a
+ * stalling file system does not keep the capture buffers from being
+ * requeued. A buffer is handed to the writer as it is as long as at least
+ * RING_MIN_QUEUED others are still queued to the driver, it gets requeued
+ * once written. Otherwise the frame is copied into its preallocated ring
+ * slot and the buffer is requeued right away. If all ring slots are in use
+ * the frame is dropped.
+ */
+#define RING_MIN_QUEUED 2
+
+struct ring_frame {
+	int index;		/* the held buffer, -1 if copied into data */
+	unsigned num_planes;
+	u8 *ptr[VIDEO_MAX_PLANES];
+	unsigned used[VIDEO_MAX_PLANES];
+	u8 *data;
+};
 
-	aspect = fd.g_pixel_aspect(width, height);
-	if (p) {
-		host_port_to = strtoul(p + 1, nullptr, 0);
-		*p = '\0';
-	}
-	host_fd_to = socket(AF_INET, SOCK_STREAM, 0);
-	if (host_fd_to < 0) {
-		fprintf(stderr, "cannot open socket");
-		std::exit(EXIT_SUCCESS);
-	}
-	server = gethostbyname(host_to);
-	if (server == nullptr) {
-		fprintf(stderr, "no such host %s\n", host_to);
-		std::exit(EXIT_SUCCESS);
-	}
-	memset(reinterpret_cast<char *>(&serv_addr), 0, sizeof(serv_addr));
-	serv_addr.sin_family = AF_INET;
-	memcpy(reinterpret_cast<char *>(&serv_addr.sin_addr.s_addr),
-	       server->h_addr,
-	       server->h_length);
-	serv_addr.sin_port = htons(host_port_to);
-	if (connect(host_fd_to, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
-		fprintf(stderr, "could not connect\n");
-		std::exit(EXIT_SUCCESS);
-	}
-	fout = fdopen(host_fd_to, "a");
-	write_u32(fout, V4L_STREAM_ID);
-	write_u32(fout, V4L_STREAM_VERSION);
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO);
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
-	write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT);
-	write_u32(fout, cfmt.g_num_planes());
-	write_u32(fout, cfmt.g_pixelformat());
-	write_u32(fout, cfmt.g_width());
-	write_u32(fout, cfmt.g_height());
-	write_u32(fout, cfmt.g_field());
-	write_u32(fout, cfmt.g_colorspace());
-	write_u32(fout, cfmt.g_ycbcr_enc());
-	write_u32(fout, cfmt.g_quantization());
-	write_u32(fout, cfmt.g_xfer_func());
-	write_u32(fout, cfmt.g_flags());
-	write_u32(fout, aspect.numerator);
-	write_u32(fout, aspect.denominator);
-	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
-		write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE);
-		write_u32(fout, cfmt.g_sizeimage(i));
-		write_u32(fout, cfmt.g_bytesperline(i));
-		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
-	}
-	if (!host_lossless) {
-		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
-		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
+static bool ring_active;
+static pthread_t ring_thread;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+static bool ring_quit;
+static ring_frame *ring_frames;
+static unsigned ring_first;
+static unsigned ring_count;
+static unsigned ring_max_count;
+static int ring_done[VIDEO_MAX_FRAME];
+static unsigned ring_done_count;
+static unsigned ring_driver_queued;
+static unsigned ring_written, ring_copied, ring_dropped, ring_last_dropped;
+static cv4l_fmt ring_fmt;
+static FILE *ring_fout;
+
+static void *ring_writer(void *)
+{
+	pthread_mutex_lock(&ring_lock);
+	for (;;) {
+		while (!ring_count && !ring_quit)
+			pthread_cond_wait(&ring_cond, &ring_lock);
+		if (!ring_count)
+			break;
 
-		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
-				 cfmt.g_width(), cfmt.g_height(),
-				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
-				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+		/* The producer never touches the oldest frame, so write unlocked */
+		ring_frame *f = &ring_frames[ring_first];
+
+		pthread_mutex_unlock(&ring_lock);
+		if (to_with_hdr)
+			write_u32(ring_fout, FILE_HDR_ID);
+		for (unsigned j = 0; j < f->num_planes; j++)
+			write_plane_to_file(ring_fmt, f->ptr[j], f->used[j], ring_fout);
+		pthread_mutex_lock(&ring_lock);
+
+		if (f->index >= 0)
+			ring_done[ring_done_count++] = f->index;
+		ring_first = (ring_first + 1) % ring_size;
+		ring_count--;
+		ring_written++;
+		pthread_cond_broadcast(&ring_cond);
 	}
-	fflush(fout);
-#endif
-	return fout;
+	pthread_mutex_unlock(&ring_lock);
+	return nullptr;
 }
 
-static void streaming_set_cap(cv4l_fd &fd, cv4l_fd &exp_fd)
+static void ring_start(cv4l_queue &q, cv4l_fmt &fmt, FILE *fout)
 {
-	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
-	cv4l_queue q(fd.g_type(), memory);
-	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
-	fps_timestamps fps_ts;
-	bool use_poll = options[OptStreamPoll];
-	unsigned count;
-	bool eos;
-	bool source_change;
-	FILE *fout = nullptr;
-	cv4l_fmt fmt;
+	unsigned frame_size = 0;
 
-	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE |
-			      V4L2_CAP_VBI_CAPTURE | V4L2_CAP_SLICED_VBI_CAPTURE |
-			      V4L2_CAP_META_CAPTURE | V4L2_CAP_SDR_CAPTURE |
-			      V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
-		fprintf(stderr, "unsupported stream type\n");
+	if (!ring_size || !fout || ring_active)
 		return;
-	}
-	if (options[OptStreamDmaBuf] && exp_fd.g_fd() < 0) {
-		fprintf(stderr, "--stream-dmabuf can only work in combination with --export-device\n");
+	if (tee_enabled) {
+		fprintf(stderr, "--stream-to-ring is not supported with --stream-tee\n");
 		return;
 	}
-	switch (q.g_type()) {
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
-	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
-		break;
-	default:
-		if (host_to) {
-			fprintf(stderr, "--stream-to-host is not supported for non-video streams\n");
-			return;
-		}
-		break;
+	if (host_fd_to >= 0) {
+		fprintf(stderr, "--stream-to-ring is not supported with --stream-to-host\n");
+		return;
 	}
 
-	subscribe_event(fd, V4L2_EVENT_EOS);
-	if (use_poll)
-		subscribe_event(fd, V4L2_EVENT_SOURCE_CHANGE);
-
-recover:
-	eos = false;
-	source_change = false;
-	count = 0;
+	for (unsigned j = 0; j < q.g_num_planes(); j++)
+		frame_size += q.g_length(j);
 
-	if (!stream_no_query) {
-		cv4l_disable_trace dt(fd);
-		struct v4l2_dv_timings new_dv_timings = {};
-		v4l2_std_id new_std;
-		struct v4l2_input in = { };
+	ring_frames = new ring_frame[ring_size];
+	for (unsigned i = 0; i < ring_size; i++)
+		ring_frames[i].data = new u8[frame_size];
+	ring_first = ring_count = ring_max_count = ring_done_count = 0;
+	ring_written = ring_copied = ring_dropped = ring_last_dropped = 0;
+	ring_quit = false;
+	ring_fmt = fmt;
+	ring_fout = fout;
 
-		if (!fd.g_input(in.index) && !fd.enum_input(in, true, in.index)) {
-			if (in.capabilities & V4L2_IN_CAP_DV_TIMINGS) {
-				while (fd.query_dv_timings(new_dv_timings))
-					sleep(1);
-				fd.s_dv_timings(new_dv_timings);
-				stderr_info("New timings found\n");
-			} else if (in.capabilities & V4L2_IN_CAP_STD) {
-				if (!fd.query_std(new_std))
-					fd.s_std(new_std);
-			}
-		}
+	if (pthread_create(&ring_thread, nullptr, ring_writer, nullptr)) {
+		fprintf(stderr, "could not start the --stream-to-ring writer\n");
+		std::exit(EXIT_FAILURE);
 	}
+	ring_active = true;
+}
 
-	fout = open_output_file(fd);
+/* Wait until all frames are written, the held buffers are then all done */
+static void ring_drain()
+{
+	if (!ring_active)
+		return;
 
-	if (q.reqbufs(&fd, reqbufs_count_cap)) {
-		if (q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE ||
-		    !fd.has_raw_vbi_cap() || !fd.has_sliced_vbi_cap())
-			goto done;
-		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_CAPTURE);
-		q.init(fd.g_type(), memory);
-		if (q.reqbufs(&fd, reqbufs_count_cap))
-			goto done;
-	}
+	pthread_mutex_lock(&ring_lock);
+	while (ring_count)
+		pthread_cond_wait(&ring_cond, &ring_lock);
+	ring_done_count = 0;
+	pthread_mutex_unlock(&ring_lock);
+}
 
-	if (options[OptStreamDmaBuf]) {
-		if (exp_q.reqbufs(&exp_fd, reqbufs_count_cap))
-			goto done;
-		if (q.export_bufs(&exp_fd, exp_fd.g_type()))
-			goto done;
-	}
+static void ring_stop()
+{
+	if (!ring_active)
+		return;
 
-	if (q.obtain_bufs(&fd))
-		goto done;
+	pthread_mutex_lock(&ring_lock);
+	ring_quit = true;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_lock);
+	pthread_join(ring_thread, nullptr);
 
-	fd.g_fmt(fmt);
+	stderr_info("ring: %u frames written, %u copied, %u dropped, max backlog %u/%u\n",
+		    ring_written, ring_copied, ring_dropped, ring_max_count, ring_size);
 
-restart:
-	if (q.queue_all(&fd))
-		goto done;
+	for (unsigned i = 0; i < ring_size; i++)
+		delete [] ring_frames[i].data;
+	delete [] ring_frames;
+	ring_frames = nullptr;
+	ring_active = false;
+}
 
-	fps_ts.determine_field(fd.g_fd(), q.g_type());
+/* Requeue the buffers the writer is done with */
+static int ring_requeue_done(cv4l_fd &fd, cv4l_queue &q)
+{
+	int done[VIDEO_MAX_FRAME];
+	unsigned done_count;
 
-	if (fd.streamon())
-		goto done;
+	pthread_mutex_lock(&ring_lock);
+	done_count = ring_done_count;
+	memcpy(done, ring_done, done_count * sizeof(done[0]));
+	ring_done_count = 0;
+	pthread_mutex_unlock(&ring_lock);
 
-	fd.s_trace(0);
-	exp_fd.s_trace(0);
+	for (unsigned i = 0; i < done_count; i++) {
+		cv4l_buffer buf(q, done[i]);
 
-	if (stream_sleep_count == 0)
-		do_sleep();
+		latency_queued(buf);
+		if (cap_qbuf(fd, buf)) {
+			fprintf(stderr, "%s: qbuf error\n", __func__);
+			return QUEUE_ERROR;
+		}
+		ring_driver_queued++;
+	}
+	return 0;
+}
 
-	if (use_poll)
-		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+/* Returns true if the writer holds on to buf, false if it can be requeued */
+static bool ring_queue(cv4l_queue &q, cv4l_buffer &buf)
+{
+	unsigned slot;
 
-	while (!eos && !source_change) {
-		fd_set read_fds;
-		fd_set exception_fds;
-		struct timeval tv = { use_poll ? 2 : 0, 0 };
-		int r;
+	pthread_mutex_lock(&ring_lock);
+	if (ring_count == ring_size) {
+		ring_dropped++;
+		pthread_mutex_unlock(&ring_lock);
+		return false;
+	}
+	slot = (ring_first + ring_count) % ring_size;
+	pthread_mutex_unlock(&ring_lock);
 
-		FD_ZERO(&exception_fds);
-		FD_SET(fd.g_fd(), &exception_fds);
-		FD_ZERO(&read_fds);
-		FD_SET(fd.g_fd(), &read_fds);
-		r = select(fd.g_fd() + 1, use_poll ? &read_fds : nullptr, nullptr, &exception_fds, &tv);
+	/* The writer does not look at this slot until it is published */
+	ring_frame *f = &ring_frames[slot];
+	bool hand_over = ring_driver_queued >= RING_MIN_QUEUED;
+	u8 *data = f->data;
 
-		if (r == -1) {
-			if (EINTR == errno)
-				continue;
-			stderr_info("select error: %s\n",
-					strerror(errno));
-			goto done;
-		}
-		if (use_poll && r == 0) {
-			stderr_info("select timeout\n");
-			goto done;
+	f->index = hand_over ? static_cast<int>(buf.g_index()) : -1;
+	f->num_planes = buf.g_num_planes();
+	for (unsigned j = 0; j < f->num_planes; j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
+		u8 *p = static_cast<u8 *>(q.g_dataptr(buf.g_index(), j));
+
+		if (offset > used)
+			offset = 0;
+		used -= offset;
+		if (used > q.g_length(j) - offset)
+			used = q.g_length(j) - offset;
+		f->used[j] = used;
+		if (hand_over) {
+			f->ptr[j] = p + offset;
+		} else {
+			memcpy(data, p + offset, used);
+			f->ptr[j] = data;
+			data += used;
 		}
+	}
 
-		if (FD_ISSET(fd.g_fd(), &exception_fds)) {
-			struct v4l2_event ev;
+	pthread_mutex_lock(&ring_lock);
+	ring_count++;
+	if (ring_count > ring_max_count)
+		ring_max_count = ring_count;
+	if (!hand_over)
+		ring_copied++;
+	pthread_cond_broadcast(&ring_cond);
+	pthread_mutex_unlock(&ring_lock);
 
-			while (!fd.dqevent(ev)) {
-				switch (ev.type) {
-				case V4L2_EVENT_SOURCE_CHANGE:
-					source_change = true;
-					if (!verbose)
-						stderr_info("\n");
-					stderr_info("SOURCE CHANGE EVENT\n");
-					break;
-				case V4L2_EVENT_EOS:
-					eos = true;
-					if (!verbose)
-						stderr_info("\n");
-					stderr_info("EOS EVENT\n");
-					fflush(stderr);
-					break;
-				}
-			}
-		}
+	return hand_over;
+}
 
-		if (FD_ISSET(fd.g_fd(), &read_fds)) {
-			r = do_handle_cap(fd, q, fout, nullptr,
-					  count, fps_ts, fmt, false);
-			if (r == QUEUE_OFF_ON) {
-				fd.streamoff();
-				fps_ts.reset();
-				do_sleep();
-				goto restart;
-			}
+/*
+ * --stream-to-host-opts threads=<n>: the frames are compressed by a pool of
+ * worker threads. A captured buffer is held by its job until the frame has
+ * been compressed, the frames are then sent from the capture thread in the
+ * order they were captured and the buffers are requeued. As for the ring,
+ * at least RING_MIN_QUEUED buffers are kept queued to the driver.
+ * FWHT P-frames are encoded against the previous frame, so each worker has
+ * its own codec context that only produces I-frames.
+ */
+#define COMP_MAX_THREADS 32
+
+struct comp_job {
+	cv4l_buffer buf;
+	bool requeue;
+	bool done;
+	u8 *out;		/* FWHT data of all planes */
+	u8 *comp_ptr[VIDEO_MAX_PLANES];
+	unsigned comp_size[VIDEO_MAX_PLANES];
+	unsigned used[VIDEO_MAX_PLANES];
+	unsigned perc;
+	__u64 usecs;
+};
 
-			if (r < 0)
-				break;
-		}
+static bool comp_active;
+static pthread_t comp_thread[COMP_MAX_THREADS];
+static codec_ctx *comp_ctx[COMP_MAX_THREADS];
+static pthread_mutex_t comp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t comp_cond = PTHREAD_COND_INITIALIZER;
+static bool comp_quit;
+static comp_job *comp_jobs;
+static unsigned comp_max_jobs;
+static unsigned comp_first;
+static unsigned comp_count;	/* jobs not sent yet */
+static unsigned comp_pending;	/* jobs not picked up by a worker yet */
+static cv4l_queue *comp_q;
+
+static void comp_compress(comp_job *job, codec_ctx *c)
+{
+#ifndef NO_STREAM_TO
+	__u64 start = now_usecs();
+	u8 *data[VIDEO_MAX_PLANES];
 
-	}
-	fd.streamoff();
-	fcntl(fd.g_fd(), F_SETFL, fd_flags);
-	stderr_info("\n");
+	buffer_planes(*comp_q, job->buf, data);
+	job->perc = host_compress(c, data, job->buf, job->out,
+				  job->comp_ptr, job->comp_size, job->used);
+	job->usecs = now_usecs() - start;
+#endif
+}
 
-	q.free(&fd);
-	tpg_free(&tpg);
-	if (source_change && !stream_no_query)
-		goto recover;
+static void comp_send(comp_job *job)
+{
+#ifndef NO_STREAM_TO
+	host_send(job->buf, job->comp_ptr, job->comp_size, job->used);
+#endif
+	comp_perc += job->perc;
+	comp_usecs += job->usecs;
+	comp_perc_count++;
+	for (unsigned j = 0; j < job->buf.g_num_planes(); j++)
+		comp_bytes += job->comp_size[j];
+}
 
-done:
-	if (options[OptStreamDmaBuf])
-		exp_q.close_exported_fds();
-	if (fout && fout != stdout) {
-		if (host_fd_to >= 0)
-			write_u32(fout, V4L_STREAM_PACKET_END);
-		fclose(fout);
+static void *comp_worker(void *arg)
+{
+	codec_ctx *c = *static_cast<codec_ctx **>(arg);
+
+	pthread_mutex_lock(&comp_lock);
+	for (;;) {
+		while (!comp_pending && !comp_quit)
+			pthread_cond_wait(&comp_cond, &comp_lock);
+		if (!comp_pending)
+			break;
+
+		/* the pending jobs are the newest ones */
+		comp_job *job = &comp_jobs[(comp_first + comp_count - comp_pending) %
+					   comp_max_jobs];
+
+		comp_pending--;
+		pthread_mutex_unlock(&comp_lock);
+		comp_compress(job, c);
+		pthread_mutex_lock(&comp_lock);
+		job->done = true;
+		pthread_cond_broadcast(&comp_cond);
 	}
+	pthread_mutex_unlock(&comp_lock);
+	return nullptr;
 }
 
-static FILE *open_input_file(cv4l_fd &fd, __u32 type)
+static void comp_free()
 {
-	FILE *fin = nullptr;
-
-	if (file_from) {
-		if (!strcmp(file_from, "-"))
-			return stdin;
-		fin = fopen(file_from, "r");
-		if (!fin)
-			fprintf(stderr, "could not open %s for reading\n", file_from);
-		return fin;
+	for (unsigned i = 0; i < COMP_MAX_THREADS; i++) {
+		if (comp_ctx[i])
+			fwht_free(comp_ctx[i]);
+		comp_ctx[i] = nullptr;
 	}
-	if (!host_from)
-		return nullptr;
+	for (unsigned i = 0; comp_jobs && i < comp_max_jobs; i++)
+		delete [] comp_jobs[i].out;
+	delete [] comp_jobs;
+	comp_jobs = nullptr;
+}
 
-	char *p = std::strchr(host_from, ':');
-	int listen_fd;
-	socklen_t clilen;
-	struct sockaddr_in serv_addr = {}, cli_addr;
+static void comp_stop()
+{
+	if (!comp_active)
+		return;
 
-	if (p) {
-		host_port_from = strtoul(p + 1, nullptr, 0);
-		*p = '\0';
-	}
-	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-	if (listen_fd < 0) {
-		fprintf(stderr, "could not opening socket\n");
-		std::exit(EXIT_FAILURE);
-	}
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = INADDR_ANY;
-	serv_addr.sin_port = htons(host_port_from);
-	if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
-		fprintf(stderr, "could not bind\n");
-		std::exit(EXIT_FAILURE);
-	}
-	listen(listen_fd, 1);
-	clilen = sizeof(cli_addr);
-	host_fd_from = accept(listen_fd, reinterpret_cast<struct sockaddr *>(&cli_addr), &clilen);
-	if (host_fd_from < 0) {
-		fprintf(stderr, "could not accept\n");
-		std::exit(EXIT_FAILURE);
+	pthread_mutex_lock(&comp_lock);
+	comp_quit = true;
+	pthread_cond_broadcast(&comp_cond);
+	pthread_mutex_unlock(&comp_lock);
+	for (unsigned i = 0; i < comp_threads; i++)
+		pthread_join(comp_thread[i], nullptr);
+	comp_free();
+	comp_active = false;
+}
+
+static void comp_start(cv4l_queue &q)
+{
+	/* with --stream-tee the host output compresses in its own thread */
+	if (comp_threads <= 1 || host_fd_to < 0 || comp_active || tee_enabled)
+		return;
+#ifndef NO_STREAM_TO
+	if (host_raw)
+		return;
+#endif
+	if (comp_threads > COMP_MAX_THREADS)
+		comp_threads = COMP_MAX_THREADS;
+
+	comp_max_jobs = std::min(2 * comp_threads, static_cast<unsigned>(VIDEO_MAX_FRAME));
+	comp_jobs = new comp_job[comp_max_jobs];
+	for (unsigned i = 0; i < comp_max_jobs; i++)
+		comp_jobs[i].out = ctx ? new u8[ctx->comp_max_size * q.g_num_planes()] : nullptr;
+	for (unsigned i = 0; ctx && i < comp_threads; i++) {
+		codec_ctx *c = fwht_alloc(ctx->state.info->id,
+					  ctx->state.visible_width, ctx->state.visible_height,
+					  ctx->state.coded_width, ctx->state.coded_height,
+					  ctx->field, ctx->state.colorspace, ctx->state.xfer_func,
+					  ctx->state.ycbcr_enc, ctx->state.quantization);
+
+		if (!c) {
+			fprintf(stderr, "could not allocate the FWHT context of compression thread %u\n", i);
+			comp_free();
+			return;
+		}
+		c->state.gop_size = 1;
+		c->slices = ctx->slices;
+		c->mv_range = ctx->mv_range;
+		c->rc_bitrate = ctx->rc_bitrate;
+		c->rc_max_frame_size = ctx->rc_max_frame_size;
+		comp_ctx[i] = c;
 	}
-	fin = fdopen(host_fd_from, "r");
-	if (read_u32(fin) != V4L_STREAM_ID) {
-		fprintf(stderr, "unknown protocol ID\n");
-		std::exit(EXIT_FAILURE);
+	comp_first = comp_count = comp_pending = 0;
+	comp_quit = false;
+	comp_q = &q;
+
+	for (unsigned i = 0; i < comp_threads; i++) {
+		if (!pthread_create(&comp_thread[i], nullptr, comp_worker, &comp_ctx[i]))
+			continue;
+		fprintf(stderr, "could not create compression thread %u\n", i);
+		comp_threads = i;
+		comp_active = true;
+		comp_stop();
+		return;
 	}
-	if (read_u32(fin) != V4L_STREAM_VERSION) {
-		fprintf(stderr, "unknown protocol version\n");
-		std::exit(EXIT_FAILURE);
+	comp_active = true;
+}
+
+/*
+ * --stream-to-host-opts slices=<n>: the slices of a FWHT frame are compressed
+ * by a pool of <n> - 1 worker threads and the capture thread. This is not
+ * used with threads=<n>, the slices are then compressed one after another
+ * by each compression thread.
+ */
+static bool slice_active;
+static pthread_t slice_thread[V4L_STREAM_FWHT_MAX_SLICES];
+static pthread_mutex_t slice_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slice_cond = PTHREAD_COND_INITIALIZER;
+static bool slice_quit;
+static unsigned slice_workers;
+static unsigned slice_gen;	/* incremented for each new frame */
+static unsigned slice_next;	/* next job to pick up */
+static unsigned slice_done;	/* jobs done */
+static unsigned slice_count;
+static fwht_job_func slice_func;
+static u8 *slice_jobs;
+static unsigned slice_job_size;
+
+/* run the jobs that are not picked up yet, called with slice_lock held */
+static void slice_run_jobs()
+{
+	while (slice_next < slice_count) {
+		unsigned i = slice_next++;
+
+		pthread_mutex_unlock(&slice_lock);
+		slice_func(slice_jobs + i * slice_job_size);
+		pthread_mutex_lock(&slice_lock);
+		if (++slice_done == slice_count)
+			pthread_cond_broadcast(&slice_cond);
 	}
-	for (;;) {
-		__u32 packet = read_u32(fin);
-		char buf[1024];
+}
 
-		if (packet == V4L_STREAM_PACKET_END) {
-			fprintf(stderr, "END packet read\n");
-			std::exit(EXIT_FAILURE);
-		}
+static void *slice_worker(void *)
+{
+	unsigned gen = 0;
 
-		if (packet == V4L_STREAM_PACKET_FMT_VIDEO)
+	pthread_mutex_lock(&slice_lock);
+	for (;;) {
+		while (gen == slice_gen && !slice_quit)
+			pthread_cond_wait(&slice_cond, &slice_lock);
+		if (slice_quit)
 			break;
+		gen = slice_gen;
+		slice_run_jobs();
+	}
+	pthread_mutex_unlock(&slice_lock);
+	return nullptr;
+}
 
-		unsigned sz = read_u32(fin);
-		while (sz) {
-			unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
-			int n;
+static void slice_run(fwht_job_func func, void *jobs, unsigned job_size,
+		      unsigned num_jobs, void *)
+{
+	pthread_mutex_lock(&slice_lock);
+	slice_func = func;
+	slice_jobs = static_cast<u8 *>(jobs);
+	slice_job_size = job_size;
+	slice_count = num_jobs;
+	slice_next = slice_done = 0;
+	slice_gen++;
+	pthread_cond_broadcast(&slice_cond);
+	slice_run_jobs();
+	while (slice_done < slice_count)
+		pthread_cond_wait(&slice_cond, &slice_lock);
+	pthread_mutex_unlock(&slice_lock);
+}
 
-			n = fread(buf, 1, rdsize, fin);
-			if (n < 0) {
-				fprintf(stderr, "error reading %d bytes\n", sz);
-				std::exit(EXIT_FAILURE);
-			}
-			sz -= n;
-		}
-	}
-	read_u32(fin);
+static void slice_stop()
+{
+	if (!slice_active)
+		return;
 
-	cv4l_fmt cfmt(type);
+	pthread_mutex_lock(&slice_lock);
+	slice_quit = true;
+	pthread_cond_broadcast(&slice_cond);
+	pthread_mutex_unlock(&slice_lock);
+	for (unsigned i = 0; i < slice_workers; i++)
+		pthread_join(slice_thread[i], nullptr);
+	if (ctx)
+		ctx->run = nullptr;
+	slice_active = false;
+}
 
-	unsigned sz = read_u32(fin);
+static void slice_start()
+{
+	if (!ctx || ctx->slices <= 1 || comp_active || slice_active)
+		return;
 
-	if (sz != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT) {
-		fprintf(stderr, "unsupported FMT_VIDEO size\n");
-		std::exit(EXIT_FAILURE);
+	/* without the workers the slices are compressed one after another */
+	slice_quit = false;
+	slice_gen = 0;
+	for (slice_workers = 0; slice_workers < ctx->slices - 1; slice_workers++) {
+		if (!pthread_create(&slice_thread[slice_workers], nullptr,
+				    slice_worker, nullptr))
+			continue;
+		fprintf(stderr, "could not create slice compression thread %u\n",
+			slice_workers);
+		slice_active = true;
+		slice_stop();
+		return;
 	}
-	cfmt.s_num_planes(read_u32(fin));
-	cfmt.s_pixelformat(read_u32(fin));
-	cfmt.s_width(read_u32(fin));
-	cfmt.s_height(read_u32(fin));
-	cfmt.s_field(read_u32(fin));
-	cfmt.s_colorspace(read_u32(fin));
-	cfmt.s_ycbcr_enc(read_u32(fin));
-	cfmt.s_quantization(read_u32(fin));
-	cfmt.s_xfer_func(read_u32(fin));
-	cfmt.s_flags(read_u32(fin));
-	unsigned visible_width = support_out_crop ? cropped_width : cfmt.g_width();
-	unsigned visible_height = support_out_crop ? cropped_height : cfmt.g_height();
+	ctx->run = slice_run;
+	slice_active = true;
+}
 
-	ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
-			 cfmt.g_width(), cfmt.g_height(),
-			 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
-			 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+/* Send the oldest frame once it is compressed and requeue its buffer */
+static int comp_send_oldest(cv4l_fd &fd)
+{
+	comp_job *job = &comp_jobs[comp_first];
 
-	read_u32(fin); // pixelaspect.numerator
-	read_u32(fin); // pixelaspect.denominator
+	pthread_mutex_lock(&comp_lock);
+	while (!job->done)
+		pthread_cond_wait(&comp_cond, &comp_lock);
+	pthread_mutex_unlock(&comp_lock);
 
-	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
-		unsigned sz = read_u32(fin);
+	comp_send(job);
 
-		if (sz != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE) {
-			fprintf(stderr, "unsupported FMT_VIDEO plane size\n");
-			std::exit(EXIT_FAILURE);
+	pthread_mutex_lock(&comp_lock);
+	comp_first = (comp_first + 1) % comp_max_jobs;
+	comp_count--;
+	pthread_mutex_unlock(&comp_lock);
+
+	if (!job->requeue)
+		return 0;
+	latency_queued(job->buf);
+	if (cap_qbuf(fd, job->buf)) {
+		/* see do_handle_cap() */
+		if (errno != EINVAL) {
+			fprintf(stderr, "%s: qbuf error\n", __func__);
+			return QUEUE_ERROR;
 		}
-		cfmt.s_sizeimage(read_u32(fin), i);
-		cfmt.s_bytesperline(read_u32(fin), i);
-		bpl_out[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
+	} else {
+		ring_driver_queued++;
 	}
-	if (fd.s_fmt(cfmt)) {
-		fprintf(stderr, "failed to set new format\n");
-		std::exit(EXIT_FAILURE);
+	return 0;
+}
+
+/* Send the frames that are compressed without waiting for the others */
+static int comp_send_done(cv4l_fd &fd)
+{
+	for (;;) {
+		bool done;
+
+		pthread_mutex_lock(&comp_lock);
+		done = comp_count && comp_jobs[comp_first].done;
+		pthread_mutex_unlock(&comp_lock);
+		if (!done)
+			return 0;
+		if (comp_send_oldest(fd))
+			return QUEUE_ERROR;
 	}
-	return fin;
 }
 
-static void streaming_set_out(cv4l_fd &fd, cv4l_fd &exp_fd)
+static int comp_drain(cv4l_fd &fd)
 {
-	__u32 type = fd.has_vid_m2m() ? v4l_type_invert(fd.g_type()) : fd.g_type();
-	cv4l_queue q(type, out_memory);
-	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
-	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
-	bool use_poll = options[OptStreamPoll];
-	fps_timestamps fps_ts;
-	unsigned count = 0;
-	bool stopped = false;
-	FILE *fin = nullptr;
-	cv4l_fmt fmt;
+	if (!comp_active)
+		return 0;
 
-	fd.g_fmt(fmt);
+	while (comp_count)
+		if (comp_send_oldest(fd))
+			return QUEUE_ERROR;
+	return 0;
+}
 
-	if (!(capabilities & (V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_VIDEO_OUTPUT_MPLANE |
-			      V4L2_CAP_VBI_OUTPUT | V4L2_CAP_SLICED_VBI_OUTPUT |
-			      V4L2_CAP_SDR_OUTPUT | V4L2_CAP_META_OUTPUT |
-			      V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
-		fprintf(stderr, "unsupported stream type\n");
+/* Hands buf over to the compression threads, it is requeued once sent */
+static int comp_queue(cv4l_fd &fd, cv4l_buffer &buf, bool requeue)
+{
+	if (comp_count == comp_max_jobs && comp_send_oldest(fd))
+		return QUEUE_ERROR;
+
+	comp_job *job = &comp_jobs[(comp_first + comp_count) % comp_max_jobs];
+
+	job->buf.init(buf);
+	job->requeue = requeue;
+	job->done = false;
+	pthread_mutex_lock(&comp_lock);
+	comp_count++;
+	comp_pending++;
+	pthread_cond_broadcast(&comp_cond);
+	pthread_mutex_unlock(&comp_lock);
+
+	while (comp_count && ring_driver_queued < RING_MIN_QUEUED)
+		if (comp_send_oldest(fd))
+			return QUEUE_ERROR;
+	return 0;
+}
+
+/*
+ * --stream-tee: each frame is copied once into a frame of a shared pool and
+ * the buffer is requeued right away. The frame is then handed to each
+ * output: the --stream-to(-hdr) file, the --stream-to-host/local receiver,
+ * the --stream-hash file and the stats file. Every output is written by its
+ * own thread from its own queue of tee_queue_size frames, so a slow output
+ * neither delays the others nor the capture. If the queue of an output is
+ * full, either the new frame or the oldest queued frame is dropped for that
+ * output only. A frame goes back to the pool when all outputs are done.
+ */
+#define TEE_MAX_SINKS 4
+
+struct tee_frame {
+	cv4l_buffer buf;	/* the planes start at offset 0 of ptr[] */
+	u8 *ptr[VIDEO_MAX_PLANES];
+	u8 *data;
+	unsigned refs;
+	__u64 queued;
+	tee_frame *next;	/* in tee_pool */
+};
+
+struct tee_sink {
+	const char *name;
+	void (*write)(tee_sink *s, tee_frame *f);
+	bool drop_old;
+	pthread_t thread;
+	pthread_cond_t cond;
+	tee_frame *queue[TEE_MAX_FRAMES];
+	unsigned first;
+	unsigned count;
+	unsigned max_count;
+	unsigned written;
+	unsigned dropped;
+	unsigned last_dropped;
+	FILE *fout;
+	u8 *scratch;
+};
+
+static bool tee_active;
+static bool tee_quit;
+static pthread_mutex_t tee_lock = PTHREAD_MUTEX_INITIALIZER;
+static tee_sink tee_sinks[TEE_MAX_SINKS];
+static unsigned tee_num_sinks;
+static tee_frame *tee_pool;
+static std::vector<tee_frame *> tee_all_frames;
+static unsigned tee_frame_size;
+static cv4l_fmt tee_fmt;
+static FILE *tee_host_fout;
+static FILE *tee_stats_fout;
+
+/* Called with tee_lock held */
+static void tee_unref(tee_frame *f)
+{
+	if (--f->refs)
 		return;
+	f->next = tee_pool;
+	tee_pool = f;
+}
+
+static void *tee_worker(void *arg)
+{
+	tee_sink *s = static_cast<tee_sink *>(arg);
+
+	pthread_mutex_lock(&tee_lock);
+	for (;;) {
+		while (!s->count && !tee_quit)
+			pthread_cond_wait(&s->cond, &tee_lock);
+		/* the queue is written out before quitting */
+		if (!s->count)
+			break;
+
+		tee_frame *f = s->queue[s->first];
+
+		s->first = (s->first + 1) % tee_queue_size;
+		s->count--;
+		pthread_mutex_unlock(&tee_lock);
+		s->write(s, f);
+		pthread_mutex_lock(&tee_lock);
+		s->written++;
+		tee_unref(f);
 	}
-	if (options[OptStreamOutDmaBuf] && exp_fd.g_fd() < 0) {
-		fprintf(stderr, "--stream-out-dmabuf can only work in combination with --export-device\n");
+	pthread_mutex_unlock(&tee_lock);
+	return nullptr;
+}
+
+#ifndef NO_STREAM_TO
+static void tee_write_file(tee_sink *s, tee_frame *f)
+{
+	if (to_with_hdr)
+		write_u32(s->fout, FILE_HDR_ID);
+	for (unsigned j = 0; j < f->buf.g_num_planes(); j++)
+		write_plane_to_file(tee_fmt, f->ptr[j], f->buf.g_bytesused(j), s->fout);
+}
+
+static void tee_write_host(tee_sink *s, tee_frame *f)
+{
+	unsigned comp_size[VIDEO_MAX_PLANES];
+	__u8 *comp_ptr[VIDEO_MAX_PLANES];
+	unsigned plane_used[VIDEO_MAX_PLANES];
+	u8 *data[VIDEO_MAX_PLANES];
+
+	memcpy(data, f->ptr, sizeof(data));
+	if (host_shm) {
+		host_local_send(f->buf, data);
 		return;
 	}
-	switch (q.g_type()) {
-	case V4L2_BUF_TYPE_VIDEO_OUTPUT:
-	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
-		break;
-	default:
-		if (host_from) {
-			fprintf(stderr, "--stream-from-host is not supported for non-video streams\n");
-			return;
+	if (s->scratch) {
+		/* RLE compresses in place, the other outputs need the frame */
+		u8 *p = s->scratch;
+
+		for (unsigned j = 0; j < f->buf.g_num_planes(); j++) {
+			memcpy(p, f->ptr[j], f->buf.g_bytesused(j));
+			data[j] = p;
+			p += f->buf.g_bytesused(j);
 		}
-		break;
 	}
+	host_compress(ctx, data, f->buf, nullptr, comp_ptr, comp_size, plane_used);
+	host_send(f->buf, comp_ptr, comp_size, plane_used);
+}
+#endif
 
-	fin = open_input_file(fd, type);
+static void tee_write_hash(tee_sink *, tee_frame *f)
+{
+	hash_frame(f->buf, f->ptr);
+}
 
-	if (q.reqbufs(&fd, reqbufs_count_out)) {
-		if (q.g_type() != V4L2_BUF_TYPE_VBI_OUTPUT ||
-		    !fd.has_raw_vbi_out() || !fd.has_sliced_vbi_out())
-			goto done;
-		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_OUTPUT);
-		q.init(fd.g_type(), memory);
-		if (q.reqbufs(&fd, reqbufs_count_out))
-			goto done;
-	}
+static void tee_write_stats(tee_sink *s, tee_frame *f)
+{
+	fprintf(s->fout, "%u,%lld.%06lld,%u,0x%08x,%llu", f->buf.g_sequence(),
+		static_cast<long long>(f->buf.g_timestamp().tv_sec),
+		static_cast<long long>(f->buf.g_timestamp().tv_usec),
+		f->buf.g_field(), f->buf.g_flags(), now_usecs() - f->queued);
+	for (unsigned j = 0; j < f->buf.g_num_planes(); j++)
+		fprintf(s->fout, ",%u", f->buf.g_bytesused(j));
+	fprintf(s->fout, "\n");
+}
 
-	if (options[OptStreamOutDmaBuf]) {
-		if (exp_q.reqbufs(&exp_fd, reqbufs_count_out))
-			goto done;
-		if (q.export_bufs(&exp_fd, exp_fd.g_type()))
-			goto done;
-	}
+static void tee_add_sink(const char *name, void (*write)(tee_sink *, tee_frame *),
+			 bool drop_old, FILE *fout)
+{
+	tee_sink *s = &tee_sinks[tee_num_sinks++];
+
+	s->name = name;
+	s->write = write;
+	s->drop_old = drop_old;
+	pthread_cond_init(&s->cond, nullptr);
+	s->first = s->count = s->max_count = 0;
+	s->written = s->dropped = s->last_dropped = 0;
+	s->fout = fout;
+	s->scratch = nullptr;
+}
 
-	if (q.obtain_bufs(&fd))
-		goto done;
+static void tee_start(cv4l_queue &q, cv4l_fmt &fmt, FILE *fout)
+{
+	if (!tee_enabled || tee_active)
+		return;
 
-restart:
-	if (do_setup_out_buffers(fd, q, fin, true, false) < 0)
-		goto done;
+	tee_frame_size = 0;
+	for (unsigned j = 0; j < q.g_num_planes(); j++)
+		tee_frame_size += q.g_length(j);
+	tee_fmt = fmt;
+	tee_num_sinks = 0;
+	tee_quit = false;
 
-	fps_ts.determine_field(fd.g_fd(), type);
+#ifndef NO_STREAM_TO
+	if (file_to && fout)
+		tee_add_sink("file", tee_write_file, tee_file_drop_old, fout);
+	if (host_fd_to >= 0) {
+		tee_add_sink("host", tee_write_host, tee_host_drop_old, nullptr);
+		if (!ctx && !host_raw && !host_shm)
+			tee_sinks[tee_num_sinks - 1].scratch = new u8[tee_frame_size];
+	}
+#endif
+	if (file_hash)
+		tee_add_sink("hash", tee_write_hash, tee_hash_drop_old, nullptr);
+	if (tee_stats_file && !tee_stats_fout) {
+		tee_stats_fout = strcmp(tee_stats_file, "-") ?
+			fopen(tee_stats_file, "w") : stdout;
+		if (!tee_stats_fout)
+			fprintf(stderr, "could not open %s for writing\n", tee_stats_file);
+		else
+			fprintf(tee_stats_fout, "sequence,timestamp,field,flags,delay_us,bytesused\n");
+	}
+	if (tee_stats_fout)
+		tee_add_sink("stats", tee_write_stats, false, tee_stats_fout);
+	if (!tee_num_sinks)
+		return;
 
-	if (fd.streamon())
-		goto done;
+	for (unsigned i = 0; i < tee_num_sinks; i++) {
+		if (pthread_create(&tee_sinks[i].thread, nullptr, tee_worker, &tee_sinks[i])) {
+			fprintf(stderr, "could not start the --stream-tee %s writer\n",
+				tee_sinks[i].name);
+			std::exit(EXIT_FAILURE);
+		}
+	}
+	tee_active = true;
+}
 
-	fd.s_trace(0);
-	exp_fd.s_trace(0);
+static void tee_stop()
+{
+	if (!tee_active)
+		return;
 
-	if (stream_sleep_count == 0)
-		do_sleep();
+	pthread_mutex_lock(&tee_lock);
+	tee_quit = true;
+	for (unsigned i = 0; i < tee_num_sinks; i++)
+		pthread_cond_signal(&tee_sinks[i].cond);
+	pthread_mutex_unlock(&tee_lock);
 
-	if (use_poll)
-		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	for (unsigned i = 0; i < tee_num_sinks; i++) {
+		tee_sink *s = &tee_sinks[i];
 
-	for (;;) {
-		int r;
+		pthread_join(s->thread, nullptr);
+		stderr_info("tee %s: %u frames written, %u dropped, max backlog %u/%u\n",
+			    s->name, s->written, s->dropped, s->max_count, tee_queue_size);
+		pthread_cond_destroy(&s->cond);
+		delete [] s->scratch;
+	}
+	for (auto f : tee_all_frames) {
+		delete [] f->data;
+		delete f;
+	}
+	tee_all_frames.clear();
+	tee_pool = nullptr;
+	tee_active = false;
+}
 
-		if (use_poll) {
-			fd_set fds;
-			struct timeval tv;
+static void tee_queue(cv4l_queue &q, cv4l_buffer &buf)
+{
+	tee_frame *f;
+
+	pthread_mutex_lock(&tee_lock);
+	f = tee_pool;
+	if (f)
+		tee_pool = f->next;
+	pthread_mutex_unlock(&tee_lock);
+	if (!f) {
+		f = new tee_frame;
+		f->data = new u8[tee_frame_size];
+		tee_all_frames.push_back(f);
+	}
 
-			FD_ZERO(&fds);
-			FD_SET(fd.g_fd(), &fds);
+	u8 *p = f->data;
 
-			/* Timeout. */
-			tv.tv_sec = 2;
-			tv.tv_usec = 0;
+	f->buf.init(buf);
+	for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+		__u32 used = buf.g_bytesused(j);
+		unsigned offset = buf.g_data_offset(j);
 
-			r = select(fd.g_fd() + 1, nullptr, &fds, nullptr, &tv);
+		if (offset > used)
+			offset = 0;
+		used = std::min(used - offset, q.g_length(j) - offset);
+		memcpy(p, static_cast<u8 *>(q.g_dataptr(buf.g_index(), j)) + offset, used);
+		f->ptr[j] = p;
+		f->buf.s_bytesused(used, j);
+		f->buf.s_data_offset(0, j);
+		p += used;
+	}
+	f->queued = now_usecs();
+	/* our own reference, dropped once the frame is queued everywhere */
+	f->refs = 1;
 
-			if (r == -1) {
-				if (EINTR == errno)
-					continue;
-				stderr_info("select error: %s\n",
-					strerror(errno));
-				goto done;
-			}
+	pthread_mutex_lock(&tee_lock);
+	for (unsigned i = 0; i < tee_num_sinks; i++) {
+		tee_sink *s = &tee_sinks[i];
 
-			if (r == 0) {
-				stderr_info("select timeout\n");
-				goto done;
-			}
-		}
-		r = do_handle_out(fd, q, fin, nullptr,
-				  count, fps_ts, fmt, stopped, false);
-		if (r == QUEUE_OFF_ON) {
-			fd.streamoff();
-			fps_ts.reset();
-			do_sleep();
-			goto restart;
+		if (s->count == tee_queue_size) {
+			s->dropped++;
+			if (!s->drop_old)
+				continue;
+			tee_unref(s->queue[s->first]);
+			s->first = (s->first + 1) % tee_queue_size;
+			s->count--;
 		}
-		if (r == QUEUE_STOPPED)
-			stopped = true;
-		if (r < 0)
-			break;
-
+		f->refs++;
+		s->queue[(s->first + s->count) % tee_queue_size] = f;
+		s->count++;
+		s->max_count = std::max(s->max_count, s->count);
+		pthread_cond_signal(&s->cond);
 	}
+	tee_unref(f);
+	pthread_mutex_unlock(&tee_lock);
+}
 
-	if (options[OptDecoderCmd]) {
-		fd.decoder_cmd(dec_cmd);
-		options[OptDecoderCmd] = false;
+static void tee_print_status()
+{
+	pthread_mutex_lock(&tee_lock);
+	for (unsigned i = 0; i < tee_num_sinks; i++) {
+		tee_sink *s = &tee_sinks[i];
+
+		stderr_info(", %s backlog: %u/%u", s->name, s->count, tee_queue_size);
+		if (s->dropped != s->last_dropped)
+			stderr_info(" (dropped %u)", s->dropped - s->last_dropped);
+		s->last_dropped = s->dropped;
 	}
-	fd.streamoff();
-	fcntl(fd.g_fd(), F_SETFL, fd_flags);
-	stderr_info("\n");
-
-	q.free(&fd);
-	tpg_free(&tpg);
-
-done:
-	if (options[OptStreamOutDmaBuf])
-		exp_q.close_exported_fds();
-	if (fin && fin != stdin)
-		fclose(fin);
+	pthread_mutex_unlock(&tee_lock);
 }
 
-enum stream_type {
-	CAP,
-	OUT,
-};
+/*
+ * --stream-mmap/user auto: a buffer is added with VIDIOC_CREATE_BUFS whenever
+ * a frame was dropped or was dequeued more than two frame periods after its
+ * timestamp. After that the queue gets as many frames as it has buffers to
+ * settle before it can grow again. After BUFS_AUTO_STEADY frames without
+ * trouble the last buffer is removed with VIDIOC_REMOVE_BUFS, if supported.
+ */
+#define BUFS_AUTO_STEADY 300
+
+static cv4l_queue *bufs_auto_q;
+static unsigned bufs_auto_max;
+static unsigned bufs_auto_steady;
+static unsigned bufs_auto_settle;
+static bool bufs_auto_shrink;
+static bool bufs_auto_have_seq;
+static __u32 bufs_auto_last_seq;
+static double bufs_auto_last_ts;
+static double bufs_auto_period;
+
+static void bufs_auto_start(cv4l_fd &fd, cv4l_queue &q)
+{
+	bufs_auto_q = nullptr;
+	if (!bufs_auto)
+		return;
+	if (ring_active || comp_active || q.g_memory() == V4L2_MEMORY_DMABUF ||
+	    !q.has_create_bufs(&fd)) {
+		fprintf(stderr, "automatic buffer count not supported here, using %u buffers\n",
+			q.g_buffers());
+		return;
+	}
+	bufs_auto_q = &q;
+	bufs_auto_max = std::min(q.g_max_num_buffers(), static_cast<unsigned>(VIDEO_MAX_FRAME));
+	bufs_auto_steady = bufs_auto_settle = 0;
+	bufs_auto_shrink = false;
+	bufs_auto_have_seq = false;
+	bufs_auto_period = 0;
+}
 
-static int capture_setup(cv4l_fd &fd, cv4l_queue &in, cv4l_fd *exp_fd, cv4l_fmt *new_fmt = nullptr)
+static int bufs_auto_grow(cv4l_fd &fd, cv4l_queue &q)
 {
-	if (fd.streamoff(in.g_type())) {
-		fprintf(stderr, "%s: fd.streamoff error\n", __func__);
-		return -1;
+	unsigned from = q.g_buffers();
+
+	if (q.create_bufs(&fd, 1) || q.obtain_bufs(&fd, from)) {
+		fprintf(stderr, "%s: could not add a buffer: %s\n", __func__, strerror(errno));
+		bufs_auto_max = from;
+		return 0;
 	}
+	for (unsigned i = from; i < q.g_buffers(); i++) {
+		cv4l_buffer buf(q, i);
 
-	/* release any buffer allocated */
-	if (in.reqbufs(&fd)) {
-		fprintf(stderr, "%s: in.reqbufs 0 error\n", __func__);
-		return -1;
+		latency_queued(buf);
+		if (cap_qbuf(fd, buf))
+			return QUEUE_ERROR;
+		ring_driver_queued++;
 	}
+	if (verbose)
+		stderr_info("%s: %u buffers\n", __func__, q.g_buffers());
+	return 0;
+}
 
-	if (options[OptSetVideoFormat]) {
-		cv4l_fmt fmt;
+static int bufs_auto_check(cv4l_fd &fd, cv4l_queue &q, const cv4l_buffer &buf)
+{
+	double ts = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+	bool trouble = false;
 
-		if (vidcap_get_and_update_fmt(fd, fmt)) {
-			fprintf(stderr, "%s: vidcap_get_and_update_fmt error\n",
-				__func__);
-			return -1;
+	if (&q != bufs_auto_q)
+		return 0;
+
+	if (bufs_auto_have_seq) {
+		__u32 gap = buf.g_sequence() - bufs_auto_last_seq;
+
+		trouble = gap > 1;
+		if (gap && ts > bufs_auto_last_ts) {
+			double period = (ts - bufs_auto_last_ts) / gap;
+
+			bufs_auto_period = bufs_auto_period ?
+				0.9 * bufs_auto_period + 0.1 * period : period;
 		}
-		fd.s_fmt(fmt, in.g_type());
-		if (new_fmt)
-			*new_fmt = fmt;
-	} else if (new_fmt) {
-		fd.g_fmt(*new_fmt, in.g_type());
 	}
-	get_cap_compose_rect(fd);
+	bufs_auto_have_seq = true;
+	bufs_auto_last_seq = buf.g_sequence();
+	bufs_auto_last_ts = ts;
 
-	if (in.reqbufs(&fd, reqbufs_count_cap)) {
-		fprintf(stderr, "%s: in.reqbufs %u error\n", __func__,
-			reqbufs_count_cap);
-		return -1;
-	}
+	if (bufs_auto_period &&
+	    (buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+	    now_usecs() / 1000000.0 - ts > 2 * bufs_auto_period)
+		trouble = true;
 
-	if (exp_fd && in.export_bufs(exp_fd, exp_fd->g_type()))
-		return -1;
-	if (in.obtain_bufs(&fd) || in.queue_all(&fd)) {
-		fprintf(stderr, "%s: in.obtain_bufs error\n", __func__);
-		return -1;
+	if (bufs_auto_settle) {
+		bufs_auto_settle--;
+		return 0;
 	}
-
-	if (fd.streamon(in.g_type())) {
-		fprintf(stderr, "%s: fd.streamon error\n", __func__);
-		return -1;
+	if (trouble) {
+		bufs_auto_steady = 0;
+		bufs_auto_shrink = false;
+		if (q.g_buffers() >= bufs_auto_max)
+			return 0;
+		bufs_auto_settle = q.g_buffers() + 1;
+		return bufs_auto_grow(fd, q);
+	}
+	if (++bufs_auto_steady >= BUFS_AUTO_STEADY && q.g_buffers() > BUFS_AUTO_MIN &&
+	    (q.g_capabilities() & V4L2_BUF_CAP_SUPPORTS_REMOVE_BUFS)) {
+		bufs_auto_steady = 0;
+		bufs_auto_shrink = true;
 	}
 	return 0;
 }
 
-static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
-			 FILE *fin, FILE *fout, cv4l_fmt &fmt_in,
-			 const cv4l_fmt &fmt_out, cv4l_fd *exp_fd_p)
+/* Returns true if buf was removed instead of having to be requeued */
+static bool bufs_auto_retire(cv4l_fd &fd, cv4l_queue &q, const cv4l_buffer &buf)
 {
-	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
-	fps_timestamps fps_ts[2];
-	unsigned count[2] = { 0, 0 };
-	fd_set fds[3];
-	fd_set *rd_fds = &fds[0]; /* for capture */
-	fd_set *ex_fds = &fds[1]; /* for capture */
-	fd_set *wr_fds = &fds[2]; /* for output */
-	bool cap_streaming = false;
-	static struct v4l2_encoder_cmd enc_stop = {
-		.cmd = V4L2_ENC_CMD_STOP,
-	};
-	static struct v4l2_decoder_cmd dec_stop = {
-		.cmd = V4L2_DEC_CMD_STOP,
-	};
-
-	bool have_eos = subscribe_event(fd, V4L2_EVENT_EOS);
-	bool is_encoder = false;
-	bool ignore_count_skip = codec_type == ENCODER;
+	unsigned index = buf.g_index();
 
-	if (have_eos) {
-		cv4l_fmt fmt(in.g_type());
-
-		fd.g_fmt(fmt);
-		is_encoder = !fmt.g_bytesperline();
+	if (&q != bufs_auto_q || !bufs_auto_shrink || index + 1 != q.g_buffers())
+		return false;
+	bufs_auto_shrink = false;
+	q.release_bufs(&fd, index);
+	if (q.remove_bufs(&fd, index, 1)) {
+		q.obtain_bufs(&fd, index);
+		return false;
 	}
+	bufs_auto_settle = q.g_buffers();
+	if (verbose)
+		stderr_info("%s: %u buffers\n", __func__, q.g_buffers());
+	return true;
+}
 
-	bool have_source_change = subscribe_event(fd, V4L2_EVENT_SOURCE_CHANGE);
-	bool stopped = false;
+static int do_handle_cap(cv4l_fd &fd, cv4l_queue &q, FILE *fout, int *index,
+			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt &fmt,
+			 bool ignore_count_skip)
+{
+	char ch = '<';
+	int ret;
+	bool held = false;
+	cv4l_buffer buf(q);
 
-	if (out.reqbufs(&fd, reqbufs_count_out))
-		return;
+	if (ring_active && ring_requeue_done(fd, q))
+		return QUEUE_ERROR;
+	if (comp_active && comp_send_done(fd))
+		return QUEUE_ERROR;
 
-	switch (do_setup_out_buffers(fd, out, fout, true, !ignore_count_skip)) {
-	case 0:
-		break;
-	case QUEUE_STOPPED:
-		stopped = true;
-		break;
-	default:
-		return;
+	for (;;) {
+		ret = fd.dqbuf(buf);
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
+		ring_driver_queued--;
+		if (buf.g_flags() & V4L2_BUF_FLAG_LAST) {
+			last_buffer = true;
+			break;
+		}
+		if (!(buf.g_flags() & V4L2_BUF_FLAG_ERROR))
+			break;
+		if (verbose)
+			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+		latency_queued(buf);
+		if (cap_qbuf(fd, buf))
+			return QUEUE_ERROR;
+		ring_driver_queued++;
 	}
 
-	if (fd.streamon(out.g_type()))
-		return;
+	bool is_empty_frame = !buf.g_bytesused(0);
+	bool is_error_frame = buf.g_flags() & V4L2_BUF_FLAG_ERROR;
 
-	fd.s_trace(0);
-	if (exp_fd_p)
-		exp_fd_p->s_trace(0);
+	double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+	fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+	fps_ts.add_latency(buf);
+	if (bufs_auto_check(fd, q, buf))
+		return QUEUE_ERROR;
 
-	if (codec_type != DECODER || !have_source_change)
-		if (capture_setup(fd, in, exp_fd_p))
-			return;
+	if (file_hash && !tee_active && (!stream_skip || ignore_count_skip) &&
+	    !is_empty_frame && !is_error_frame)
+		hash_buffer(q, buf);
+	if ((!stream_skip || ignore_count_skip) && !is_empty_frame && !is_error_frame) {
+		meta_log_buffer(buf, q);
+		vbi_log_buffer(buf, q);
+	}
 
-	fps_ts[CAP].determine_field(fd.g_fd(), in.g_type());
-	fps_ts[OUT].determine_field(fd.g_fd(), out.g_type());
+	if (tee_active) {
+		if ((!stream_skip || ignore_count_skip) && !is_empty_frame && !is_error_frame)
+			tee_queue(q, buf);
+	} else if (fout && (!stream_skip || ignore_count_skip) &&
+		   !is_empty_frame && !is_error_frame) {
+		if (ring_active) {
+			held = ring_queue(q, buf);
+		} else if (comp_active) {
+			if (comp_queue(fd, buf, !last_buffer && index == nullptr))
+				return QUEUE_ERROR;
+			held = true;
+		} else {
+			write_buffer_to_file(fd, q, buf, fmt, fout);
+		}
+	}
 
-	if (stream_sleep_count == 0)
-		do_sleep();
+	if (buf.g_flags() & V4L2_BUF_FLAG_KEYFRAME)
+		ch = 'K';
+	else if (buf.g_flags() & V4L2_BUF_FLAG_PFRAME)
+		ch = 'P';
+	else if (buf.g_flags() & V4L2_BUF_FLAG_BFRAME)
+		ch = 'B';
+	if (verbose && !stream_benchmark) {
+		print_concise_buffer(stderr, buf, fmt, q, fps_ts,
+				     host_fd_to >= 0 && comp_perc_count ?
+				     100 - comp_perc / comp_perc_count : -1);
+		comp_perc_count = comp_perc = 0;
+		comp_usecs = comp_bytes = 0;
+	}
+	if (!last_buffer && index == nullptr && !held && !bufs_auto_retire(fd, q, buf)) {
+		/*
+		 * EINVAL in qbuf can happen if this is the last buffer before
+		 * a dynamic resolution change sequence. In this case the buffer
+		 * has the size that fits the old resolution and might not
+		 * fit to the new one.
+		 */
+		latency_queued(buf);
+		if (cap_qbuf(fd, buf)) {
+			if (errno != EINVAL) {
+				fprintf(stderr, "%s: qbuf error\n", __func__);
+				return QUEUE_ERROR;
+			}
+		} else {
+			ring_driver_queued++;
+		}
+	}
+	if (index)
+		*index = buf.g_index();
 
-	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+	if (!verbose && !stream_benchmark) {
+		if (!vbi_log_active()) {
+			stderr_info("%c", ch);
+			fflush(stderr);
+		}
 
-	if (have_eos && stopped) {
-		if (!verbose)
+		if (fps_ts.has_fps()) {
+			unsigned dropped = fps_ts.dropped();
+
+			stderr_info(" %.02f fps", fps_ts.fps());
+			if (dropped)
+				stderr_info(", dropped buffers: %u", dropped);
+			if (&q == bufs_auto_q)
+				stderr_info(", buffers: %u", q.g_buffers());
+			if (host_fd_to >= 0 && comp_perc_count)
+				stderr_info(" %d%% compression, %.1f ms/frame, %.2f Mbit/s",
+					    100 - comp_perc / comp_perc_count,
+					    comp_usecs / 1000.0 / comp_perc_count,
+					    comp_bytes * 8.0 / comp_perc_count *
+					    fps_ts.fps() / 1000000.0);
+			comp_perc_count = comp_perc = 0;
+			comp_usecs = comp_bytes = 0;
+			if (ring_active) {
+				pthread_mutex_lock(&ring_lock);
+				stderr_info(", ring backlog: %u/%u (max %u)",
+					    ring_count, ring_size, ring_max_count);
+				if (ring_dropped != ring_last_dropped)
+					stderr_info(", ring dropped: %u",
+						    ring_dropped - ring_last_dropped);
+				ring_last_dropped = ring_dropped;
+				pthread_mutex_unlock(&ring_lock);
+			}
+			if (tee_active)
+				tee_print_status();
 			stderr_info("\n");
-		stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
-		if (is_encoder)
-			fd.encoder_cmd(enc_stop);
-		else
-			fd.decoder_cmd(dec_stop);
+		}
 	}
+	count++;
+	if (stream_latency_interval && !(count % stream_latency_interval))
+		fps_ts.print_latency(count);
 
-	while (rd_fds || wr_fds || ex_fds) {
-		struct timeval tv = { 2, 0 };
-		struct timeval stopped_tv = { 0, 500000 };
-		int r = 0;
+	if (ignore_count_skip)
+		return 0;
+
+	if (!stream_benchmark && need_sleep(count)) {
+		if (stream_sleep_mode & 2)
+			return QUEUE_OFF_ON;
+		do_sleep();
+	}
+
+	if (is_empty_frame || is_error_frame)
+		return 0;
+
+	if (stream_skip) {
+		stream_skip--;
+		return 0;
+	}
+
+	if (stream_count == 0)
+		return 0;
+
+	if (--stream_count == 0)
+		return QUEUE_STOPPED;
+
+	return 0;
+}
+
+static int do_handle_out(cv4l_fd &fd, cv4l_queue &q, FILE *fin, cv4l_buffer *cap,
+			 unsigned &count, fps_timestamps &fps_ts, cv4l_fmt fmt,
+			 bool stopped, bool ignore_count_skip)
+{
+	cv4l_buffer buf(q);
+	bool is_meta = q.g_type() == V4L2_BUF_TYPE_META_OUTPUT;
+	int ret = 0;
+
+	if (cap) {
+		buf.s_index(cap->g_index());
+
+		if (fd.querybuf(buf)) {
+			fprintf(stderr, "%s fd.querybuf failed\n", __func__);
+			return QUEUE_ERROR;
+		}
+
+		for (unsigned j = 0; j < buf.g_num_planes(); j++) {
+			unsigned data_offset = cap->g_data_offset(j);
+
+			if (q.g_memory() == V4L2_MEMORY_USERPTR) {
+				buf.s_userptr(static_cast<u8 *>(cap->g_userptr(j)) + data_offset, j);
+				buf.s_bytesused(cap->g_bytesused(j) - data_offset, j);
+				buf.s_data_offset(0, j);
+			} else if (q.g_memory() == V4L2_MEMORY_DMABUF) {
+				__u32 bytesused = cap->g_bytesused(j);
+				/*
+				 * bytesused comes from the exported cap buffer
+				 * but the length of the out buffer might be smaller
+				 * so take the smaller of the two
+				 */
+				if (bytesused > buf.g_length(j))
+					bytesused = buf.g_length(j);
+				buf.s_bytesused(bytesused, j);
+				buf.s_data_offset(data_offset, j);
+				buf.s_fd(q.g_fd(buf.g_index(), j));
+			}
+		}
+	} else {
+		ret = fd.dqbuf(buf);
+		if (ret == EAGAIN)
+			return 0;
+
+		double ts_secs = buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+		fps_ts.add_ts(ts_secs, buf.g_sequence(), buf.g_field());
+		if (verbose)
+			print_concise_buffer(stderr, buf, fmt, q, fps_ts, -1);
+
+		for (unsigned j = 0; j < buf.g_num_planes(); j++)
+			buf.s_bytesused(buf.g_length(j), j);
+	}
+	if (ret) {
+		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(ret));
+		return QUEUE_ERROR;
+	}
+	if (fps_ts.has_fps()) {
+		unsigned dropped = fps_ts.dropped();
+
+		stderr_info(" %.02f fps", fps_ts.fps());
+		if (dropped)
+			stderr_info(", dropped buffers: %u", dropped);
+		stderr_info("\n");
+	}
+	if (stopped)
+		return 0;
+
+	buf.s_field(output_field);
+	tpg_s_field(&tpg, output_field, output_field_alt);
+	if (output_field_alt) {
+		if (output_field == V4L2_FIELD_TOP)
+			output_field = V4L2_FIELD_BOTTOM;
+		else if (output_field == V4L2_FIELD_BOTTOM)
+			output_field = V4L2_FIELD_TOP;
+	}
+
+	if (fin && !fill_buffer_from_file(fd, q, buf, fmt, fin))
+		return QUEUE_STOPPED;
+
+	if (!fin && stream_out_refresh)
+		tpg_fill(q, buf.g_index());
+	if (is_meta)
+		meta_fillbuffer(buf, fmt, q);
+
+	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
+		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_REINIT, NULL)) {
+			fprintf(stderr, "Unable to reinit media request: %s\n",
+				strerror(errno));
+			return QUEUE_ERROR;
+		}
+
+		if (set_fwht_ext_ctrl(fd, &last_fwht_hdr, last_fwht_bf_ts,
+				      buf.g_request_fd())) {
+			fprintf(stderr, "%s: set_fwht_ext_ctrl failed: %s\n",
+				__func__, strerror(errno));
+			return QUEUE_ERROR;
+		}
+	}
+
+	set_time_stamp(buf);
+
+	if (fd.qbuf(buf)) {
+		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
+		return QUEUE_ERROR;
+	}
+	if (fmt.g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS) {
+		if (!set_fwht_req_by_fd(&last_fwht_hdr, buf.g_request_fd(), last_fwht_bf_ts,
+					buf.g_timestamp_ns())) {
+			fprintf(stderr, "%s: request for fd %d does not exist\n",
+				__func__, buf.g_request_fd());
+			return QUEUE_ERROR;
+		}
+
+		last_fwht_bf_ts = buf.g_timestamp_ns();
+		if (ioctl(buf.g_request_fd(), MEDIA_REQUEST_IOC_QUEUE) < 0) {
+			fprintf(stderr, "Unable to queue media request: %s\n",
+				strerror(errno));
+			return QUEUE_ERROR;
+		}
+	}
+
+	tpg_update_mv_count(&tpg, V4L2_FIELD_HAS_T_OR_B(output_field));
+
+	if (!verbose)
+		stderr_info(">");
+	fflush(stderr);
+
+	count++;
+
+	if (ignore_count_skip)
+		return 0;
+
+	if (need_sleep(count)) {
+		if (stream_sleep_mode & 2)
+			return QUEUE_OFF_ON;
+		do_sleep();
+	}
+
+	if (stream_skip) {
+		stream_skip--;
+		return 0;
+	}
+
+	if (stream_count == 0)
+		return 0;
+	if (--stream_count == 0)
+		return QUEUE_STOPPED;
+
+	return 0;
+}
+
+static int do_handle_out_to_in(cv4l_fd &out_fd, cv4l_fd &fd, cv4l_queue &out, cv4l_queue &in)
+{
+	cv4l_buffer buf(out);
+	int ret;
+
+	do {
+		ret = out_fd.dqbuf(buf);
+	} while (ret == EAGAIN);
+	if (ret) {
+		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_DQBUF", strerror(errno));
+		return QUEUE_ERROR;
+	}
+	buf.init(in, buf.g_index());
+	ret = fd.querybuf(buf);
+	if (ret == 0)
+		ret = fd.qbuf(buf);
+	if (ret) {
+		fprintf(stderr, "%s: failed: %s\n", "VIDIOC_QBUF", strerror(errno));
+		return QUEUE_ERROR;
+	}
+	return 0;
+}
+
+/*
+ * --stream-to-io: instead of stdio the output file is written through a
+ * cookie stream. The file is preallocated with fallocate in chunks of
+ * PREALLOC_FRAMES frames (or stream_count frames up front), so the file
+ * system does not have to allocate blocks for every write. In direct mode the
+ * file is opened with O_DIRECT and written in DIRECT_ALIGN aligned blocks,
+ * keeping the captured data out of the page cache. Data that is aligned
+ * already (mmap-ed buffers) is written without copying it first. The tail
+ * is padded to the block size and truncated again when the file is closed.
+ */
+#define PREALLOC_FRAMES 64
+#define DIRECT_ALIGN 4096
+#define DIRECT_BUF_SIZE (4 * 1024 * 1024)
+
+struct direct_file {
+	int fd;
+	bool direct;
+	u8 *buf;
+	size_t buf_used;
+	off_t pos;
+	off_t size;
+	off_t alloc_end;
+	off_t alloc_step;
+};
+
+static int direct_file_write_out(direct_file *f, const u8 *p, size_t len)
+{
+	if (f->alloc_step && f->pos + static_cast<off_t>(len) > f->alloc_end) {
+		off_t end = f->alloc_end + f->alloc_step;
+
+		if (end < f->pos + static_cast<off_t>(len))
+			end = f->pos + len;
+		if (fallocate(f->fd, FALLOC_FL_KEEP_SIZE, f->alloc_end,
+			      end - f->alloc_end)) {
+			fprintf(stderr, "fallocate failed: %s, not preallocating\n",
+				strerror(errno));
+			f->alloc_step = 0;
+		} else {
+			f->alloc_end = end;
+		}
+	}
+	while (len) {
+		ssize_t ret = write(f->fd, p, len);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			fprintf(stderr, "%s: write error: %s\n", file_to,
+				ret ? strerror(errno) : "short write");
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+		f->pos += ret;
+	}
+	return 0;
+}
+
+static ssize_t direct_file_write(void *cookie, const char *data, size_t size)
+{
+	auto f = static_cast<direct_file *>(cookie);
+	auto p = reinterpret_cast<const u8 *>(data);
+	size_t left = size;
+
+	while (left) {
+		size_t n;
+
+		if (!f->buf_used && f->direct && left >= DIRECT_ALIGN &&
+		    !(reinterpret_cast<uintptr_t>(p) & (DIRECT_ALIGN - 1))) {
+			n = left & ~static_cast<size_t>(DIRECT_ALIGN - 1);
+			if (direct_file_write_out(f, p, n))
+				return 0;
+		} else {
+			n = std::min(left, static_cast<size_t>(DIRECT_BUF_SIZE) - f->buf_used);
+			memcpy(f->buf + f->buf_used, p, n);
+			f->buf_used += n;
+			if (f->buf_used == DIRECT_BUF_SIZE) {
+				if (direct_file_write_out(f, f->buf, f->buf_used))
+					return 0;
+				f->buf_used = 0;
+			}
+		}
+		p += n;
+		left -= n;
+		f->size += n;
+	}
+	return size;
+}
+
+static int direct_file_close(void *cookie)
+{
+	auto f = static_cast<direct_file *>(cookie);
+	int ret = 0;
+
+	if (f->buf_used) {
+		size_t len = f->buf_used;
+
+		if (f->direct) {
+			len = (len + DIRECT_ALIGN - 1) & ~static_cast<size_t>(DIRECT_ALIGN - 1);
+			memset(f->buf + f->buf_used, 0, len - f->buf_used);
+		}
+		ret = direct_file_write_out(f, f->buf, len);
+	}
+	/* drop the padding and any blocks preallocated beyond the end */
+	if (ftruncate(f->fd, f->size))
+		ret = -1;
+	if (close(f->fd))
+		ret = -1;
+	free(f->buf);
+	delete f;
+	return ret;
+}
+
+static FILE *open_file_to(cv4l_fmt &fmt)
+{
+	if (stream_to_io == STREAM_TO_IO_BUFFERED)
+		return fopen(file_to, "w+");
+
+	cookie_io_functions_t io = {};
+	auto f = new direct_file();
+	off_t frame_size = 0;
+	FILE *fout;
+
+	f->direct = stream_to_io == STREAM_TO_IO_DIRECT;
+	f->fd = open(file_to, O_WRONLY | O_CREAT | O_TRUNC |
+		     (f->direct ? O_DIRECT : 0), 0666);
+	if (f->fd < 0 && f->direct && errno == EINVAL) {
+		fprintf(stderr, "%s does not support O_DIRECT, using buffered writes\n",
+			file_to);
+		f->direct = false;
+		f->fd = open(file_to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (f->fd < 0) {
+		delete f;
+		return nullptr;
+	}
+	if (posix_memalign(reinterpret_cast<void **>(&f->buf), DIRECT_ALIGN,
+			   DIRECT_BUF_SIZE)) {
+		close(f->fd);
+		delete f;
+		return nullptr;
+	}
+
+	for (unsigned i = 0; i < fmt.g_num_planes(); i++)
+		frame_size += fmt.g_sizeimage(i) + (to_with_hdr ? 4 : 0);
+	if (to_with_hdr)
+		frame_size += 4;
+	f->alloc_step = frame_size * PREALLOC_FRAMES;
+	if (stream_count && f->alloc_step && fallocate(f->fd, FALLOC_FL_KEEP_SIZE, 0,
+						       frame_size * stream_count) == 0)
+		f->alloc_end = frame_size * stream_count;
+
+	io.write = direct_file_write;
+	io.close = direct_file_close;
+	fout = fopencookie(f, "w", io);
+	if (!fout) {
+		direct_file_close(f);
+		return nullptr;
+	}
+	/* the cookie does its own buffering */
+	setvbuf(fout, nullptr, _IONBF, 0);
+	return fout;
+}
+
+#ifndef NO_STREAM_TO
+static FILE *open_host_output(cv4l_fd &fd)
+{
+	FILE *fout;
+
+	if (!host_to && !host_local)
+		return nullptr;
+
+	struct v4l2_fract aspect;
+	unsigned width, height;
+	cv4l_fmt cfmt;
+
+	fd.g_fmt(cfmt);
+
+	aspect = fd.g_pixel_aspect(width, height);
+	if (host_local) {
+		host_udp = false;
+		host_fd_to = host_local_connect();
+	} else {
+		char *p = std::strchr(host_to, ':');
+		struct sockaddr_in serv_addr;
+		struct hostent *server;
+
+		if (p) {
+			host_port_to = strtoul(p + 1, nullptr, 0);
+			*p = '\0';
+		}
+		host_fd_to = socket(AF_INET, host_udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+		if (host_fd_to < 0) {
+			fprintf(stderr, "cannot open socket");
+			std::exit(EXIT_SUCCESS);
+		}
+		server = gethostbyname(host_to);
+		if (server == nullptr) {
+			fprintf(stderr, "no such host %s\n", host_to);
+			std::exit(EXIT_SUCCESS);
+		}
+		memset(reinterpret_cast<char *>(&serv_addr), 0, sizeof(serv_addr));
+		serv_addr.sin_family = AF_INET;
+		memcpy(reinterpret_cast<char *>(&serv_addr.sin_addr.s_addr),
+		       server->h_addr,
+		       server->h_length);
+		serv_addr.sin_port = htons(host_port_to);
+		if (connect(host_fd_to, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
+			fprintf(stderr, "could not connect\n");
+			std::exit(EXIT_SUCCESS);
+		}
+		host_setup_socket(serv_addr);
+	}
+	fout = fdopen(host_fd_to, "a");
+
+	__u32 *f = host_udp_fmt;
+
+	*f++ = V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT;
+	*f++ = cfmt.g_num_planes();
+	*f++ = cfmt.g_pixelformat();
+	*f++ = cfmt.g_width();
+	*f++ = cfmt.g_height();
+	*f++ = cfmt.g_field();
+	*f++ = cfmt.g_colorspace();
+	*f++ = cfmt.g_ycbcr_enc();
+	*f++ = cfmt.g_quantization();
+	*f++ = cfmt.g_xfer_func();
+	*f++ = cfmt.g_flags();
+	*f++ = aspect.numerator;
+	*f++ = aspect.denominator;
+	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
+		*f++ = V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE;
+		*f++ = cfmt.g_sizeimage(i);
+		*f++ = cfmt.g_bytesperline(i);
+		bpl_cap[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
+	}
+	host_udp_fmt_len = f - host_udp_fmt;
+	if (host_udp) {
+		/* sent in network order as the payload of the FMT_VIDEO datagrams */
+		for (unsigned i = 0; i < host_udp_fmt_len; i++)
+			host_udp_fmt[i] = htonl(host_udp_fmt[i]);
+	} else {
+		write_u32(fout, V4L_STREAM_ID);
+		write_u32(fout, V4L_STREAM_VERSION);
+		write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO);
+		write_u32(fout, V4L_STREAM_PACKET_FMT_VIDEO_SIZE(cfmt.g_num_planes()));
+		for (unsigned i = 0; i < host_udp_fmt_len; i++)
+			write_u32(fout, host_udp_fmt[i]);
+	}
+	if (host_local) {
+		fflush(fout);
+		host_local_setup(cfmt);
+		return fout;
+	}
+	if (host_raw)
+		host_lossless = true;
+	if (!host_lossless) {
+		unsigned visible_width = support_cap_compose ? composed_width : cfmt.g_width();
+		unsigned visible_height = support_cap_compose ? composed_height : cfmt.g_height();
+
+		ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
+				 cfmt.g_width(), cfmt.g_height(),
+				 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
+				 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+		if (ctx) {
+			ctx->rc_bitrate = host_bitrate * 1000;
+			ctx->rc_max_frame_size = host_max_frame;
+			ctx->mv_range = host_motion;
+			ctx->slices = std::min(comp_slices,
+					       static_cast<unsigned>(V4L_STREAM_FWHT_MAX_SLICES));
+		}
+	}
+	fflush(fout);
+	return fout;
+}
+#endif
+
+static FILE *open_output_file(cv4l_fd &fd)
+{
+	FILE *fout = nullptr;
+
+#ifndef NO_STREAM_TO
+	if (file_to) {
+		if (!strcmp(file_to, "-"))
+			return stdout;
+
+		cv4l_fmt fmt;
+
+		fd.g_fmt(fmt);
+		fout = open_file_to(fmt);
+		if (!fout)
+			fprintf(stderr, "could not open %s for writing\n", file_to);
+		return fout;
+	}
+	fout = open_host_output(fd);
+#endif
+	return fout;
+}
+
+static void streaming_set_cap(cv4l_fd &fd, cv4l_fd &exp_fd)
+{
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	cv4l_queue q(fd.g_type(), memory);
+	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
+	fps_timestamps fps_ts;
+	bool use_poll = options[OptStreamPoll];
+	unsigned count;
+	bool eos;
+	bool source_change;
+	FILE *fout = nullptr;
+	cv4l_fmt fmt;
+
+	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+			      V4L2_CAP_VBI_CAPTURE | V4L2_CAP_SLICED_VBI_CAPTURE |
+			      V4L2_CAP_META_CAPTURE | V4L2_CAP_SDR_CAPTURE |
+			      V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "unsupported stream type\n");
+		return;
+	}
+	if (options[OptStreamDmaBuf] && exp_fd.g_fd() < 0) {
+		fprintf(stderr, "--stream-dmabuf can only work in combination with --export-device\n");
+		return;
+	}
+	switch (q.g_type()) {
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE:
+	case V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE:
+		break;
+	default:
+		if (host_to || host_local) {
+			fprintf(stderr, "--stream-to-host/local is not supported for non-video streams\n");
+			return;
+		}
+		break;
+	}
+
+	subscribe_event(fd, V4L2_EVENT_EOS);
+	if (use_poll)
+		subscribe_event(fd, V4L2_EVENT_SOURCE_CHANGE);
+
+recover:
+	eos = false;
+	source_change = false;
+	count = 0;
+
+	if (!stream_no_query) {
+		cv4l_disable_trace dt(fd);
+		struct v4l2_dv_timings new_dv_timings = {};
+		v4l2_std_id new_std;
+		struct v4l2_input in = { };
+
+		if (!fd.g_input(in.index) && !fd.enum_input(in, true, in.index)) {
+			if (in.capabilities & V4L2_IN_CAP_DV_TIMINGS) {
+				while (fd.query_dv_timings(new_dv_timings))
+					sleep(1);
+				fd.s_dv_timings(new_dv_timings);
+				stderr_info("New timings found\n");
+			} else if (in.capabilities & V4L2_IN_CAP_STD) {
+				if (!fd.query_std(new_std))
+					fd.s_std(new_std);
+			}
+		}
+	}
+
+	fout = open_output_file(fd);
+#ifndef NO_STREAM_TO
+	/* with --stream-tee the frames go to the file and to the host */
+	if (tee_enabled && file_to && !tee_host_fout)
+		tee_host_fout = open_host_output(fd);
+#endif
+
+	if (!vbi_log_start(fd, q))
+		goto done;
+
+	if (q.reqbufs(&fd, reqbufs_count_cap)) {
+		if (q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE ||
+		    !fd.has_raw_vbi_cap() || !fd.has_sliced_vbi_cap())
+			goto done;
+		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_CAPTURE);
+		q.init(fd.g_type(), memory);
+		if (q.reqbufs(&fd, reqbufs_count_cap))
+			goto done;
+	}
+
+	if (options[OptStreamDmaBuf]) {
+		if (exp_q.reqbufs(&exp_fd, reqbufs_count_cap))
+			goto done;
+		if (q.export_bufs(&exp_fd, exp_fd.g_type()))
+			goto done;
+	}
+
+	if (q.obtain_bufs(&fd))
+		goto done;
+
+	fd.g_fmt(fmt);
+	ring_start(q, fmt, fout);
+	comp_start(q);
+	tee_start(q, fmt, fout);
+	slice_start();
+	bufs_auto_start(fd, q);
+	if (!ctrl_sched_start(fd, q))
+		goto done;
+
+restart:
+	if (cap_queue_all(fd, q))
+		goto done;
+	latency_queued_all(q);
+	ring_driver_queued = q.g_buffers();
+
+	fps_ts.determine_field(fd.g_fd(), q.g_type());
+
+	if (fd.streamon())
+		goto done;
+
+	fd.s_trace(0);
+	exp_fd.s_trace(0);
+
+	if (stream_sleep_count == 0)
+		do_sleep();
+
+	if (use_poll)
+		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+
+	while (!eos && !source_change) {
+		fd_set read_fds;
+		fd_set exception_fds;
+		struct timeval tv = { use_poll ? 2 : 0, 0 };
+		int r;
+
+		FD_ZERO(&exception_fds);
+		FD_SET(fd.g_fd(), &exception_fds);
+		FD_ZERO(&read_fds);
+		FD_SET(fd.g_fd(), &read_fds);
+		r = select(fd.g_fd() + 1, use_poll ? &read_fds : nullptr, nullptr, &exception_fds, &tv);
+
+		if (r == -1) {
+			if (EINTR == errno)
+				continue;
+			stderr_info("select error: %s\n",
+					strerror(errno));
+			goto done;
+		}
+		if (use_poll && r == 0) {
+			stderr_info("select timeout\n");
+			goto done;
+		}
+
+		if (FD_ISSET(fd.g_fd(), &exception_fds)) {
+			struct v4l2_event ev;
+
+			while (!fd.dqevent(ev)) {
+				switch (ev.type) {
+				case V4L2_EVENT_SOURCE_CHANGE:
+					source_change = true;
+					if (!verbose)
+						stderr_info("\n");
+					stderr_info("SOURCE CHANGE EVENT\n");
+					break;
+				case V4L2_EVENT_EOS:
+					eos = true;
+					if (!verbose)
+						stderr_info("\n");
+					stderr_info("EOS EVENT\n");
+					fflush(stderr);
+					break;
+				}
+			}
+		}
+
+		if (FD_ISSET(fd.g_fd(), &read_fds)) {
+			r = do_handle_cap(fd, q, fout, nullptr,
+					  count, fps_ts, fmt, false);
+			if (r == QUEUE_OFF_ON) {
+				ring_drain();
+				comp_drain(fd);
+				fd.streamoff();
+				fps_ts.reset();
+				do_sleep();
+				goto restart;
+			}
+
+			if (r < 0)
+				break;
+		}
+
+	}
+	ring_drain();
+	comp_drain(fd);
+	fd.streamoff();
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	stderr_info("\n");
+	fps_ts.print_latency(count);
+
+	ring_stop();
+	comp_stop();
+	tee_stop();
+	slice_stop();
+	bufs_auto_q = nullptr;
+	q.free(&fd);
+	ctrl_sched_stop();
+	tpg_cache_free();
+	fill_stop();
+	tpg_free(&tpg);
+	if (source_change && !stream_no_query)
+		goto recover;
+
+done:
+	ring_stop();
+	comp_stop();
+	tee_stop();
+	slice_stop();
+	bufs_auto_q = nullptr;
+	ctrl_sched_stop();
+	if (options[OptStreamDmaBuf])
+		exp_q.close_exported_fds();
+	if (tee_stats_fout && tee_stats_fout != stdout)
+		fclose(tee_stats_fout);
+	tee_stats_fout = nullptr;
+	if (tee_host_fout) {
+		/* fout is the file, the host got its own connection */
+		write_host_end(tee_host_fout);
+		fclose(tee_host_fout);
+		tee_host_fout = nullptr;
+		host_fd_to = -1;
+	}
+	if (fout && fout != stdout) {
+		if (host_fd_to >= 0)
+			write_host_end(fout);
+#ifndef NO_STREAM_TO
+		if (host_zc_copied)
+			fprintf(stderr, "MSG_ZEROCOPY copied %u of %u sends\n",
+				host_zc_copied, host_zc_sent);
+#endif
+		fclose(fout);
+	}
+}
+
+static FILE *open_input_file(cv4l_fd &fd, __u32 type)
+{
+	FILE *fin = nullptr;
+
+	if (file_from) {
+		if (!strcmp(file_from, "-"))
+			return stdin;
+		fin = open_file_from();
+		if (!fin)
+			fprintf(stderr, "could not open %s for reading\n", file_from);
+		return fin;
+	}
+	if (!host_from)
+		return nullptr;
+
+	char *p = std::strchr(host_from, ':');
+	int listen_fd;
+	socklen_t clilen;
+	struct sockaddr_in serv_addr = {}, cli_addr;
+
+	if (p) {
+		host_port_from = strtoul(p + 1, nullptr, 0);
+		*p = '\0';
+	}
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "could not opening socket\n");
+		std::exit(EXIT_FAILURE);
+	}
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = INADDR_ANY;
+	serv_addr.sin_port = htons(host_port_from);
+	if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&serv_addr), sizeof(serv_addr)) < 0) {
+		fprintf(stderr, "could not bind\n");
+		std::exit(EXIT_FAILURE);
+	}
+	listen(listen_fd, 1);
+	clilen = sizeof(cli_addr);
+	host_fd_from = accept(listen_fd, reinterpret_cast<struct sockaddr *>(&cli_addr), &clilen);
+	if (host_fd_from < 0) {
+		fprintf(stderr, "could not accept\n");
+		std::exit(EXIT_FAILURE);
+	}
+	fin = fdopen(host_fd_from, "r");
+	if (read_u32(fin) != V4L_STREAM_ID) {
+		fprintf(stderr, "unknown protocol ID\n");
+		std::exit(EXIT_FAILURE);
+	}
+	if (read_u32(fin) != V4L_STREAM_VERSION) {
+		fprintf(stderr, "unknown protocol version\n");
+		std::exit(EXIT_FAILURE);
+	}
+	for (;;) {
+		__u32 packet = read_u32(fin);
+		char buf[1024];
+
+		if (packet == V4L_STREAM_PACKET_END) {
+			fprintf(stderr, "END packet read\n");
+			std::exit(EXIT_FAILURE);
+		}
+
+		if (packet == V4L_STREAM_PACKET_FMT_VIDEO)
+			break;
+
+		unsigned sz = read_u32(fin);
+		while (sz) {
+			unsigned rdsize = sz > sizeof(buf) ? sizeof(buf) : sz;
+			int n;
+
+			n = fread(buf, 1, rdsize, fin);
+			if (n < 0) {
+				fprintf(stderr, "error reading %d bytes\n", sz);
+				std::exit(EXIT_FAILURE);
+			}
+			sz -= n;
+		}
+	}
+	read_u32(fin);
+
+	cv4l_fmt cfmt(type);
+
+	unsigned sz = read_u32(fin);
+
+	if (sz != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT) {
+		fprintf(stderr, "unsupported FMT_VIDEO size\n");
+		std::exit(EXIT_FAILURE);
+	}
+	cfmt.s_num_planes(read_u32(fin));
+	cfmt.s_pixelformat(read_u32(fin));
+	cfmt.s_width(read_u32(fin));
+	cfmt.s_height(read_u32(fin));
+	cfmt.s_field(read_u32(fin));
+	cfmt.s_colorspace(read_u32(fin));
+	cfmt.s_ycbcr_enc(read_u32(fin));
+	cfmt.s_quantization(read_u32(fin));
+	cfmt.s_xfer_func(read_u32(fin));
+	cfmt.s_flags(read_u32(fin));
+	unsigned visible_width = support_out_crop ? cropped_width : cfmt.g_width();
+	unsigned visible_height = support_out_crop ? cropped_height : cfmt.g_height();
+
+	ctx = fwht_alloc(cfmt.g_pixelformat(), visible_width, visible_height,
+			 cfmt.g_width(), cfmt.g_height(),
+			 cfmt.g_field(), cfmt.g_colorspace(), cfmt.g_xfer_func(),
+			 cfmt.g_ycbcr_enc(), cfmt.g_quantization());
+	/*
+	 * The output buffers are only written by the decoder, so the last
+	 * decoded buffer can be the reference frame. Imported dmabufs may
+	 * be changed by their exporter.
+	 */
+	if (ctx && out_memory != V4L2_MEMORY_DMABUF)
+		ctx->flags |= FWHT_CTX_KEEP_DECODED;
+
+	read_u32(fin); // pixelaspect.numerator
+	read_u32(fin); // pixelaspect.denominator
+
+	for (unsigned i = 0; i < cfmt.g_num_planes(); i++) {
+		unsigned sz = read_u32(fin);
+
+		if (sz != V4L_STREAM_PACKET_FMT_VIDEO_SIZE_FMT_PLANE) {
+			fprintf(stderr, "unsupported FMT_VIDEO plane size\n");
+			std::exit(EXIT_FAILURE);
+		}
+		cfmt.s_sizeimage(read_u32(fin), i);
+		cfmt.s_bytesperline(read_u32(fin), i);
+		bpl_out[i] = rle_calc_bpl(cfmt.g_bytesperline(i), cfmt.g_pixelformat());
+	}
+	if (fd.s_fmt(cfmt)) {
+		fprintf(stderr, "failed to set new format\n");
+		std::exit(EXIT_FAILURE);
+	}
+	return fin;
+}
+
+static void streaming_set_out(cv4l_fd &fd, cv4l_fd &exp_fd)
+{
+	__u32 type = fd.has_vid_m2m() ? v4l_type_invert(fd.g_type()) : fd.g_type();
+	cv4l_queue q(type, out_memory);
+	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	bool use_poll = options[OptStreamPoll];
+	fps_timestamps fps_ts;
+	unsigned count = 0;
+	bool stopped = false;
+	FILE *fin = nullptr;
+	cv4l_fmt fmt;
+
+	fd.g_fmt(fmt);
+
+	if (!(capabilities & (V4L2_CAP_VIDEO_OUTPUT | V4L2_CAP_VIDEO_OUTPUT_MPLANE |
+			      V4L2_CAP_VBI_OUTPUT | V4L2_CAP_SLICED_VBI_OUTPUT |
+			      V4L2_CAP_SDR_OUTPUT | V4L2_CAP_META_OUTPUT |
+			      V4L2_CAP_VIDEO_M2M | V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "unsupported stream type\n");
+		return;
+	}
+	if (options[OptStreamOutDmaBuf] && exp_fd.g_fd() < 0) {
+		fprintf(stderr, "--stream-out-dmabuf can only work in combination with --export-device\n");
+		return;
+	}
+	switch (q.g_type()) {
+	case V4L2_BUF_TYPE_VIDEO_OUTPUT:
+	case V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE:
+		break;
+	default:
+		if (host_from) {
+			fprintf(stderr, "--stream-from-host is not supported for non-video streams\n");
+			return;
+		}
+		break;
+	}
+
+	fin = open_input_file(fd, type);
+
+	if (q.reqbufs(&fd, reqbufs_count_out)) {
+		if (q.g_type() != V4L2_BUF_TYPE_VBI_OUTPUT ||
+		    !fd.has_raw_vbi_out() || !fd.has_sliced_vbi_out())
+			goto done;
+		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_OUTPUT);
+		q.init(fd.g_type(), memory);
+		if (q.reqbufs(&fd, reqbufs_count_out))
+			goto done;
+	}
+
+	if (options[OptStreamOutDmaBuf]) {
+		if (exp_q.reqbufs(&exp_fd, reqbufs_count_out))
+			goto done;
+		if (q.export_bufs(&exp_fd, exp_fd.g_type()))
+			goto done;
+	}
+
+	if (q.obtain_bufs(&fd))
+		goto done;
+
+restart:
+	if (do_setup_out_buffers(fd, q, fin, true, false) < 0)
+		goto done;
+
+	fps_ts.determine_field(fd.g_fd(), type);
+
+	if (fd.streamon())
+		goto done;
+
+	fd.s_trace(0);
+	exp_fd.s_trace(0);
+
+	if (stream_sleep_count == 0)
+		do_sleep();
+
+	if (use_poll)
+		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+
+	for (;;) {
+		int r;
+
+		if (use_poll) {
+			fd_set fds;
+			struct timeval tv;
+
+			FD_ZERO(&fds);
+			FD_SET(fd.g_fd(), &fds);
+
+			/* Timeout. */
+			tv.tv_sec = 2;
+			tv.tv_usec = 0;
+
+			r = select(fd.g_fd() + 1, nullptr, &fds, nullptr, &tv);
+
+			if (r == -1) {
+				if (EINTR == errno)
+					continue;
+				stderr_info("select error: %s\n",
+					strerror(errno));
+				goto done;
+			}
+
+			if (r == 0) {
+				stderr_info("select timeout\n");
+				goto done;
+			}
+		}
+		r = do_handle_out(fd, q, fin, nullptr,
+				  count, fps_ts, fmt, stopped, false);
+		if (r == QUEUE_OFF_ON) {
+			fd.streamoff();
+			fps_ts.reset();
+			do_sleep();
+			goto restart;
+		}
+		if (r == QUEUE_STOPPED)
+			stopped = true;
+		if (r < 0)
+			break;
+
+	}
+
+	if (options[OptDecoderCmd]) {
+		fd.decoder_cmd(dec_cmd);
+		options[OptDecoderCmd] = false;
+	}
+	fd.streamoff();
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	stderr_info("\n");
+
+	q.free(&fd);
+	tpg_cache_free();
+	fill_stop();
+	tpg_free(&tpg);
+
+done:
+	if (options[OptStreamOutDmaBuf])
+		exp_q.close_exported_fds();
+	if (fin && fin != stdin)
+		fclose(fin);
+}
+
+enum stream_type {
+	CAP,
+	OUT,
+};
+
+static int capture_setup(cv4l_fd &fd, cv4l_queue &in, cv4l_fd *exp_fd, cv4l_fmt *new_fmt = nullptr)
+{
+	if (fd.streamoff(in.g_type())) {
+		fprintf(stderr, "%s: fd.streamoff error\n", __func__);
+		return -1;
+	}
+
+	/* release any buffer allocated */
+	if (in.reqbufs(&fd)) {
+		fprintf(stderr, "%s: in.reqbufs 0 error\n", __func__);
+		return -1;
+	}
+
+	if (options[OptSetVideoFormat]) {
+		cv4l_fmt fmt;
+
+		if (vidcap_get_and_update_fmt(fd, fmt)) {
+			fprintf(stderr, "%s: vidcap_get_and_update_fmt error\n",
+				__func__);
+			return -1;
+		}
+		fd.s_fmt(fmt, in.g_type());
+		if (new_fmt)
+			*new_fmt = fmt;
+	} else if (new_fmt) {
+		fd.g_fmt(*new_fmt, in.g_type());
+	}
+	get_cap_compose_rect(fd);
+
+	if (in.reqbufs(&fd, reqbufs_count_cap)) {
+		fprintf(stderr, "%s: in.reqbufs %u error\n", __func__,
+			reqbufs_count_cap);
+		return -1;
+	}
+
+	if (exp_fd && in.export_bufs(exp_fd, exp_fd->g_type()))
+		return -1;
+	if (in.obtain_bufs(&fd) || in.queue_all(&fd)) {
+		fprintf(stderr, "%s: in.obtain_bufs error\n", __func__);
+		return -1;
+	}
+	latency_queued_all(in);
+
+	if (fd.streamon(in.g_type())) {
+		fprintf(stderr, "%s: fd.streamon error\n", __func__);
+		return -1;
+	}
+	return 0;
+}
+
+static __u64 cpu_usecs()
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000ULL +
+	       ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/*
+ * --stream-benchmark: run the QBUF/DQBUF cycle of do_handle_cap() for each
+ * memory type and buffer count. Nothing is written or printed per buffer and
+ * there is no --stream-sleep throttling, so this measures the driver and the
+ * buffer handling only. The first buffer of each run is not measured since
+ * it includes the stream startup.
+ */
+static void streaming_benchmark(cv4l_fd &fd, cv4l_fd &exp_fd)
+{
+	static constexpr unsigned memories[] = {
+		V4L2_MEMORY_MMAP, V4L2_MEMORY_USERPTR, V4L2_MEMORY_DMABUF
+	};
+	static constexpr const char *names[] = {
+		"mmap", "userptr", "dmabuf"
+	};
+	unsigned frames = stream_count ? stream_count : BENCH_DEFAULT_COUNT;
+	unsigned saved_reqbufs_count_cap = reqbufs_count_cap;
+	unsigned default_bufs = reqbufs_count_cap;
+	const unsigned *bufs = bench_bufs_cnt ? bench_bufs : &default_bufs;
+	unsigned bufs_cnt = bench_bufs_cnt ? bench_bufs_cnt : 1;
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+
+	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_VIDEO_CAPTURE_MPLANE))) {
+		fprintf(stderr, "--stream-benchmark requires a video capture device\n");
+		return;
+	}
+	if (frames < 2)
+		frames = 2;
+
+	fcntl(fd.g_fd(), F_SETFL, fd_flags & ~O_NONBLOCK);
+	fd.s_trace(0);
+	exp_fd.s_trace(0);
+	stream_benchmark = true;
+	printf("%-8s %8s %8s %12s %12s\n", "memory", "buffers", "frames",
+	       "buffers/s", "cpu us/buf");
+
+	for (unsigned m = 0; m < 3; m++) {
+		if (memories[m] == V4L2_MEMORY_DMABUF && exp_fd.g_fd() < 0) {
+			printf("%-8s %8s requires --export-device\n", names[m], "-");
+			continue;
+		}
+		for (unsigned b = 0; b < bufs_cnt; b++) {
+			bool dmabuf = memories[m] == V4L2_MEMORY_DMABUF;
+			cv4l_queue q(fd.g_type(), memories[m]);
+			cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
+			fps_timestamps fps_ts;
+			unsigned count = 0;
+			__u64 start, start_cpu, usecs, cpu;
+			cv4l_fmt fmt;
+			int r;
+
+			reqbufs_count_cap = bufs[b];
+			if ((dmabuf && exp_q.reqbufs(&exp_fd, bufs[b])) ||
+			    capture_setup(fd, q, dmabuf ? &exp_fd : nullptr, &fmt)) {
+				printf("%-8s %8u not supported\n", names[m], bufs[b]);
+				goto next;
+			}
+
+			/* the first buffer includes the stream startup */
+			stream_count = frames;
+			r = do_handle_cap(fd, q, nullptr, nullptr, count, fps_ts, fmt, false);
+			start = now_usecs();
+			start_cpu = cpu_usecs();
+			while (!r)
+				r = do_handle_cap(fd, q, nullptr, nullptr, count, fps_ts, fmt, false);
+			usecs = now_usecs() - start;
+			cpu = cpu_usecs() - start_cpu;
+
+			if (r == QUEUE_ERROR || count < 2)
+				printf("%-8s %8u failed\n", names[m], q.g_buffers());
+			else
+				printf("%-8s %8u %8u %12.2f %12.2f\n", names[m], q.g_buffers(),
+				       count - 1, usecs ? (count - 1) * 1000000.0 / usecs : 0.0,
+				       static_cast<double>(cpu) / (count - 1));
+next:
+			fd.streamoff(q.g_type());
+			if (dmabuf) {
+				/* the exported fds are owned by the dmabuf queue */
+				for (unsigned i = 0; i < q.g_buffers(); i++)
+					for (unsigned p = 0; p < q.g_num_planes(); p++)
+						if (q.g_fd(i, p) >= 0)
+							close(q.g_fd(i, p));
+				exp_q.free(&exp_fd);
+			}
+			q.free(&fd);
+		}
+	}
+
+	stream_benchmark = false;
+	stream_count = 0;
+	reqbufs_count_cap = saved_reqbufs_count_cap;
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+}
+
+static void stateful_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
+			 FILE *fin, FILE *fout, cv4l_fmt &fmt_in,
+			 const cv4l_fmt &fmt_out, cv4l_fd *exp_fd_p)
+{
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	fps_timestamps fps_ts[2];
+	unsigned count[2] = { 0, 0 };
+	fd_set fds[3];
+	fd_set *rd_fds = &fds[0]; /* for capture */
+	fd_set *ex_fds = &fds[1]; /* for capture */
+	fd_set *wr_fds = &fds[2]; /* for output */
+	bool cap_streaming = false;
+	static struct v4l2_encoder_cmd enc_stop = {
+		.cmd = V4L2_ENC_CMD_STOP,
+	};
+	static struct v4l2_decoder_cmd dec_stop = {
+		.cmd = V4L2_DEC_CMD_STOP,
+	};
+
+	bool have_eos = subscribe_event(fd, V4L2_EVENT_EOS);
+	bool is_encoder = false;
+	bool ignore_count_skip = codec_type == ENCODER;
+
+	if (have_eos) {
+		cv4l_fmt fmt(in.g_type());
+
+		fd.g_fmt(fmt);
+		is_encoder = !fmt.g_bytesperline();
+	}
+
+	bool have_source_change = subscribe_event(fd, V4L2_EVENT_SOURCE_CHANGE);
+	bool stopped = false;
+
+	if (out.reqbufs(&fd, reqbufs_count_out))
+		return;
+
+	switch (do_setup_out_buffers(fd, out, fout, true, !ignore_count_skip)) {
+	case 0:
+		break;
+	case QUEUE_STOPPED:
+		stopped = true;
+		break;
+	default:
+		return;
+	}
+
+	if (fd.streamon(out.g_type()))
+		return;
+
+	fd.s_trace(0);
+	if (exp_fd_p)
+		exp_fd_p->s_trace(0);
+
+	if (codec_type != DECODER || !have_source_change)
+		if (capture_setup(fd, in, exp_fd_p))
+			return;
+
+	fps_ts[CAP].determine_field(fd.g_fd(), in.g_type());
+	fps_ts[OUT].determine_field(fd.g_fd(), out.g_type());
+
+	if (stream_sleep_count == 0)
+		do_sleep();
+
+	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+
+	if (have_eos && stopped) {
+		if (!verbose)
+			stderr_info("\n");
+		stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
+		if (is_encoder)
+			fd.encoder_cmd(enc_stop);
+		else
+			fd.decoder_cmd(dec_stop);
+	}
+
+	while (rd_fds || wr_fds || ex_fds) {
+		struct timeval tv = { 2, 0 };
+		struct timeval stopped_tv = { 0, 500000 };
+		int r = 0;
 
 		if (rd_fds) {
 			FD_ZERO(rd_fds);
 			FD_SET(fd.g_fd(), rd_fds);
 		}
 
-		if (ex_fds) {
-			FD_ZERO(ex_fds);
-			FD_SET(fd.g_fd(), ex_fds);
-		}
+		if (ex_fds) {
+			FD_ZERO(ex_fds);
+			FD_SET(fd.g_fd(), ex_fds);
+		}
+
+		if (wr_fds) {
+			FD_ZERO(wr_fds);
+			FD_SET(fd.g_fd(), wr_fds);
+		}
+
+		r = select(fd.g_fd() + 1, rd_fds, wr_fds, ex_fds,
+			   stopped ? &stopped_tv : &tv);
+
+		if (r == -1) {
+			if (EINTR == errno)
+				continue;
+			stderr_info("select error: %s\n",
+					strerror(errno));
+			return;
+		}
+		if (r == 0) {
+			if (!stopped)
+				stderr_info("select timeout");
+			stderr_info("\n");
+			return;
+		}
+
+		if (rd_fds && FD_ISSET(fd.g_fd(), rd_fds)) {
+			r = do_handle_cap(fd, in, fin, nullptr,
+					  count[CAP], fps_ts[CAP], fmt_in,
+					  ignore_count_skip);
+			if (r == QUEUE_STOPPED)
+				break;
+			if (r < 0) {
+				rd_fds = nullptr;
+				if (!have_eos) {
+					ex_fds = nullptr;
+					break;
+				}
+			}
+		}
+
+		if (wr_fds && FD_ISSET(fd.g_fd(), wr_fds)) {
+			r = do_handle_out(fd, out, fout, nullptr,
+					  count[OUT], fps_ts[OUT], fmt_out, stopped,
+					  !ignore_count_skip);
+			if (r == QUEUE_STOPPED) {
+				stopped = true;
+				if (have_eos) {
+					if (!verbose)
+						stderr_info("\n");
+					stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
+					if (is_encoder)
+						fd.encoder_cmd(enc_stop);
+					else
+						fd.decoder_cmd(dec_stop);
+				}
+			} else if (r < 0) {
+				break;
+			}
+		}
+
+		if (ex_fds && FD_ISSET(fd.g_fd(), ex_fds)) {
+			struct v4l2_event ev;
+
+			while (!fd.dqevent(ev)) {
+				if (ev.type == V4L2_EVENT_EOS) {
+					wr_fds = nullptr;
+					if (!verbose)
+						stderr_info("\n");
+					stderr_info("EOS EVENT\n");
+					fflush(stderr);
+				} else if (ev.type == V4L2_EVENT_SOURCE_CHANGE) {
+					if (!verbose)
+						stderr_info("\n");
+					stderr_info("SOURCE CHANGE EVENT\n");
+					in_source_change_event = true;
+
+					/*
+					 * if capture is not streaming, the
+					 * driver will not send a last buffer so
+					 * we set it here
+					 */
+					if (!cap_streaming)
+						last_buffer = true;
+				}
+			}
+		}
+
+		if (last_buffer) {
+			if (in_source_change_event) {
+				in_source_change_event = false;
+				last_buffer = false;
+				if (capture_setup(fd, in, exp_fd_p, &fmt_in))
+					return;
+				fps_ts[CAP].reset();
+				fps_ts[OUT].reset();
+				cap_streaming = true;
+			} else {
+				break;
+			}
+		}
+	}
+
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	stderr_info("\n");
+	fps_ts[CAP].print_latency(count[CAP]);
+
+	fd.streamoff(in.g_type());
+	fd.streamoff(out.g_type());
+	in.free(&fd);
+	out.free(&fd);
+	tpg_cache_free();
+	fill_stop();
+	tpg_free(&tpg);
+}
+
+static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
+			  FILE *fin, FILE *fout, cv4l_fmt &fmt_in,
+			  const cv4l_fmt &fmt_out, cv4l_fd *exp_fd_p)
+{
+	fps_timestamps fps_ts[2];
+	unsigned count[2] = { 0, 0 };
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	bool stopped = false;
+
+	if (out.reqbufs(&fd, reqbufs_count_out)) {
+		fprintf(stderr, "%s: out.reqbufs failed\n", __func__);
+		return;
+	}
+
+	if (in.reqbufs(&fd, reqbufs_count_cap)) {
+		fprintf(stderr, "%s: in.reqbufs failed\n", __func__);
+		return;
+	}
+
+	if (exp_fd_p && in.export_bufs(exp_fd_p, exp_fd_p->g_type()))
+		return;
+
+	if (in.obtain_bufs(&fd)) {
+		fprintf(stderr, "%s: in.obtain_bufs error\n", __func__);
+		return;
+	}
+
+	if (do_setup_out_buffers(fd, out, fout, true, true) == QUEUE_ERROR) {
+		fprintf(stderr, "%s: do_setup_out_buffers failed\n", __func__);
+		return;
+	}
+
+	if (in.queue_all(&fd)) {
+		fprintf(stderr, "%s: in.queue_all failed\n", __func__);
+		return;
+	}
+	latency_queued_all(in);
+
+	if (fd.streamon(out.g_type())) {
+		fprintf(stderr, "%s: streamon for out failed\n", __func__);
+		return;
+	}
+
+	if (fd.streamon(in.g_type())) {
+		fprintf(stderr, "%s: streamon for in failed\n", __func__);
+		return;
+	}
+	/* the decoded capture buffers that may still be used as a reference */
+	cv4l_buffer held[VIDEO_MAX_FRAME];
+	unsigned held_cnt = 0;
+
+	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+
+	/*
+	 * All output buffers have a request of their own, wait for any of the
+	 * requests in flight to complete instead of for the oldest one, so the
+	 * decoder always has as many requests queued as there are buffers.
+	 */
+	while (true) {
+		struct pollfd pfds[VIDEO_MAX_FRAME];
+		unsigned req_idx[VIDEO_MAX_FRAME];
+		unsigned num_reqs = 0;
+
+		for (unsigned i = 0; i < out.g_buffers() && i < VIDEO_MAX_FRAME; i++) {
+			if (fwht_reqs[i].fd < 0 || !fwht_reqs[i].in_flight)
+				continue;
+			pfds[num_reqs].fd = fwht_reqs[i].fd;
+			pfds[num_reqs].events = POLLPRI;
+			pfds[num_reqs].revents = 0;
+			req_idx[num_reqs++] = i;
+		}
+		if (!num_reqs)
+			break;
+
+		int rc = poll(pfds, num_reqs, 2000);
+
+		if (rc == 0) {
+			fprintf(stderr, "Timeout when waiting for media request\n");
+			return;
+		}
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Unable to poll media requests: %s\n",
+				strerror(errno));
+			return;
+		}
+
+		for (unsigned r = 0; r < num_reqs; r++) {
+			unsigned index = req_idx[r];
+			int buf_idx = -1;
+
+			if (!(pfds[r].revents & POLLPRI))
+				continue;
+			fwht_reqs[index].in_flight = false;
+
+			/*
+			 * fin is not sent to do_handle_cap since the capture buf is
+			 * written to the file in current function
+			 */
+			rc = do_handle_cap(fd, in, nullptr, &buf_idx, count[CAP],
+					   fps_ts[CAP], fmt_in, false);
+			if (rc && rc != QUEUE_STOPPED) {
+				stderr_info("%s: do_handle_cap err\n", __func__);
+				return;
+			}
+			/*
+			 * in case of an error in the frame, set last ts to 0 as a
+			 * means to recover so that next request will not use a
+			 * reference buffer. Otherwise the error flag will be set to
+			 * all the future capture buffers.
+			 */
+			if (buf_idx == -1) {
+				stderr_info("%s: frame returned with error\n", __func__);
+				last_fwht_bf_ts	= 0;
+			} else {
+				cv4l_buffer cap_buf(in, buf_idx);
+				if (fd.querybuf(cap_buf))
+					return;
+				held[held_cnt++].init(cap_buf);
+				if (file_hash && cap_buf.g_bytesused(0) &&
+				    !(cap_buf.g_flags() & V4L2_BUF_FLAG_ERROR))
+					hash_buffer(in, cap_buf);
+				if (fin && cap_buf.g_bytesused(0) &&
+				    !(cap_buf.g_flags() & V4L2_BUF_FLAG_ERROR)) {
+					int idx = get_fwht_req_by_ts(cap_buf.g_timestamp_ns());
+
+					if (idx < 0) {
+						fprintf(stderr, "%s: could not find request from buffer\n", __func__);
+						fprintf(stderr, "%s: ts = %llu\n", __func__, cap_buf.g_timestamp_ns());
+						return;
+					}
+					composed_width = fwht_reqs[idx].params.width;
+					composed_height = fwht_reqs[idx].params.height;
+					write_buffer_to_file(fd, in, cap_buf,
+							     fmt_in, fin);
+				}
+			}
+			if (rc == QUEUE_STOPPED)
+				return;
+
+			if (!stopped) {
+				rc = do_handle_out(fd, out, fout, nullptr, count[OUT],
+						   fps_ts[OUT], fmt_out, false, true);
+				if (rc) {
+					stopped = true;
+					if (rc != QUEUE_STOPPED)
+						stderr_info("%s: output stream ended\n", __func__);
+					close(fwht_reqs[index].fd);
+					fwht_reqs[index].fd = -1;
+				}
+			}
+
+			/* requeue the capture buffers that are no longer referenced */
+			for (unsigned i = 0; i < held_cnt; ) {
+				if (fwht_ts_is_ref(held[i].g_timestamp_ns())) {
+					i++;
+					continue;
+				}
+				if (fd.qbuf(held[i])) {
+					stderr_info("%s: qbuf failed\n", __func__);
+					return;
+				}
+				if (i != --held_cnt)
+					held[i].init(held[held_cnt]);
+			}
+		}
+	}
+
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	stderr_info("\n");
+	fps_ts[CAP].print_latency(count[CAP]);
+
+	fd.streamoff(in.g_type());
+	fd.streamoff(out.g_type());
+	in.free(&fd);
+	out.free(&fd);
+	tpg_cache_free();
+	fill_stop();
+	tpg_free(&tpg);
+}
+
+static void streaming_set_m2m(cv4l_fd &fd, cv4l_fd &exp_fd)
+{
+	cv4l_queue in(fd.g_type(), memory);
+	cv4l_queue out(v4l_type_invert(fd.g_type()), out_memory);
+	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
+	cv4l_fd *exp_fd_p = nullptr;
+	FILE *file[2] = {nullptr, nullptr};
+	cv4l_fmt fmt[2];
+
+	fd.g_fmt(fmt[OUT], out.g_type());
+	fd.g_fmt(fmt[CAP], in.g_type());
+
+	if (!fd.has_vid_m2m()) {
+		fprintf(stderr, "unsupported m2m stream type\n");
+		return;
+	}
+	if (options[OptStreamDmaBuf] && options[OptStreamOutDmaBuf]) {
+		fprintf(stderr, "--stream-dmabuf and --stream-out-dmabuf not supported for m2m devices\n");
+		return;
+	}
+	if ((options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf]) && exp_fd.g_fd() < 0) {
+		fprintf(stderr, "--stream-dmabuf or --stream-out-dmabuf can only work in combination with --export-device\n");
+		return;
+	}
+
+	file[CAP] = open_output_file(fd);
+	file[OUT] = open_input_file(fd, out.g_type());
+
+	if (options[OptStreamDmaBuf]) {
+		if (exp_q.reqbufs(&exp_fd, reqbufs_count_cap))
+			goto done;
+		exp_fd_p = &exp_fd;
+	}
+
+	if (options[OptStreamOutDmaBuf]) {
+		if (exp_q.reqbufs(&exp_fd, reqbufs_count_out))
+			goto done;
+		if (out.export_bufs(&exp_fd, exp_fd.g_type()))
+			goto done;
+	}
+	if (fmt[OUT].g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS)
+		stateless_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
+	else
+		stateful_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
+
+done:
+	if (options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf])
+		exp_q.close_exported_fds();
+
+	if (file[CAP] && file[CAP] != stdout)
+		fclose(file[CAP]);
+
+	if (file[OUT] && file[OUT] != stdin)
+		fclose(file[OUT]);
+}
+
+static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
+{
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	bool use_poll = options[OptStreamPoll];
+	bool use_dmabuf = options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf];
+	bool use_userptr = options[OptStreamUser] && options[OptStreamOutUser];
+	__u32 out_type = out_fd.has_vid_m2m() ? v4l_type_invert(out_fd.g_type()) : out_fd.g_type();
+	cv4l_queue in(fd.g_type(), memory);
+	cv4l_queue out(out_type, out_memory);
+	fps_timestamps fps_ts[2];
+	unsigned count[2] = { 0, 0 };
+	FILE *file[2] = {nullptr, nullptr};
+	fd_set fds;
+	unsigned cnt = 0;
+	cv4l_fmt fmt[2];
+
+	out_fd.g_fmt(fmt[OUT], out.g_type());
+	fd.g_fmt(fmt[CAP], in.g_type());
+	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE |
+			      V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+			      V4L2_CAP_VIDEO_M2M |
+			      V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "unsupported capture stream type\n");
+		return;
+	}
+	if (!(out_capabilities & (V4L2_CAP_VIDEO_OUTPUT |
+					 V4L2_CAP_VIDEO_OUTPUT_MPLANE |
+					 V4L2_CAP_VIDEO_M2M |
+					 V4L2_CAP_VIDEO_M2M_MPLANE))) {
+		fprintf(stderr, "unsupported output stream type\n");
+		return;
+	}
+	if (options[OptStreamDmaBuf] && !options[OptStreamOutMmap]) {
+		fprintf(stderr, "--stream-dmabuf can only work in combination with --stream-out-mmap\n");
+		return;
+	}
+	if (options[OptStreamOutDmaBuf] && !options[OptStreamMmap]) {
+		fprintf(stderr, "--stream-out-dmabuf can only work in combination with --stream-mmap\n");
+		return;
+	}
+	if (options[OptStreamDmaBuf])
+		reqbufs_count_cap = reqbufs_count_out;
+	if (options[OptStreamOutDmaBuf])
+		reqbufs_count_out = reqbufs_count_cap;
+	if (!use_dmabuf && !use_userptr) {
+		fprintf(stderr, "Allowed combinations (for now):\n");
+		fprintf(stderr, "\t--stream-mmap and --stream-out-dmabuf\n");
+		fprintf(stderr, "\t--stream-dmabuf and --stream-out-mmap\n");
+		fprintf(stderr, "\t--stream-user and --stream-out-user\n");
+		return;
+	}
+
+	if (file_to) {
+		if (!strcmp(file_to, "-"))
+			file[CAP] = stdout;
+		else
+			file[CAP] = open_file_to(fmt[CAP]);
+		if (!file[CAP]) {
+			fprintf(stderr, "could not open %s for writing\n", file_to);
+			return;
+		}
+	}
+
+	if (file_from) {
+		if (!strcmp(file_from, "-"))
+			file[OUT] = stdin;
+		else
+			file[OUT] = open_file_from();
+		if (!file[OUT]) {
+			fprintf(stderr, "could not open %s for reading\n", file_from);
+			return;
+		}
+	}
+
+	if (in.reqbufs(&fd, reqbufs_count_cap) ||
+	    out.reqbufs(&out_fd, reqbufs_count_out))
+		goto done;
+
+	if (options[OptStreamDmaBuf]) {
+		if (in.export_bufs(&out_fd, out.g_type()))
+			goto done;
+	} else if (options[OptStreamOutDmaBuf]) {
+		if (out.export_bufs(&fd, in.g_type()))
+			goto done;
+	}
+
+	if (in.g_num_planes() != out.g_num_planes()) {
+		fprintf(stderr, "mismatch between number of planes\n");
+		goto done;
+	}
+	if (in.obtain_bufs(&fd)) {
+		fprintf(stderr, "%s: in.obtain_bufs failed\n", __func__);
+		goto done;
+	}
+
+	if (in.queue_all(&fd)) {
+		fprintf(stderr, "%s: in.queue_all failed\n", __func__);
+		goto done;
+	}
+	latency_queued_all(in);
+
+
+	if (do_setup_out_buffers(out_fd, out, file[OUT], false, false) == QUEUE_ERROR) {
+		fprintf(stderr, "%s: do_setup_out_buffers failed\n", __func__);
+		goto done;
+	}
+
+	fps_ts[CAP].determine_field(fd.g_fd(), in.g_type());
+	fps_ts[OUT].determine_field(out_fd.g_fd(), out.g_type());
+
+	if (fd.streamon() || out_fd.streamon())
+		goto done;
+
+	fd.s_trace(0);
+	out_fd.s_trace(0);
+
+	if (stream_sleep_count == 0)
+		do_sleep();
+
+	if (use_poll)
+		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+
+	while (true) {
+		struct timeval tv = { use_poll ? 2 : 0, 0 };
+		int r = 0;
+
+		FD_ZERO(&fds);
+		FD_SET(fd.g_fd(), &fds);
+
+		if (use_poll)
+			r = select(fd.g_fd() + 1, &fds, nullptr, nullptr, &tv);
+
+		if (r == -1) {
+			if (EINTR == errno)
+				continue;
+			stderr_info("select error: %s\n",
+					strerror(errno));
+			goto done;
+		}
+		if (use_poll && r == 0) {
+			stderr_info("select timeout\n");
+			goto done;
+		}
+
+		if (FD_ISSET(fd.g_fd(), &fds)) {
+			int index = -1;
+
+			r = do_handle_cap(fd, in, file[CAP], &index,
+					  count[CAP], fps_ts[CAP], fmt[CAP], true);
+			if (r)
+				stderr_info("handle cap %d\n", r);
+			if (!r) {
+				cv4l_buffer buf(in, index);
+
+				if (fd.querybuf(buf))
+					break;
+				r = do_handle_out(out_fd, out, file[OUT], &buf,
+						  count[OUT], fps_ts[OUT], fmt[OUT],
+						  false, false);
+			}
+			if (r)
+				stderr_info("handle out %d\n", r);
+			if (!r && cnt++ > 1)
+				r = do_handle_out_to_in(out_fd, fd, out, in);
+			if (r)
+				stderr_info("handle out2in %d\n", r);
+			if (r < 0) {
+				fd.streamoff();
+				out_fd.streamoff();
+				break;
+			}
+		}
+	}
+
+done:
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	stderr_info("\n");
+	fps_ts[CAP].print_latency(count[CAP]);
+
+	if (options[OptStreamDmaBuf])
+		out.close_exported_fds();
+	if (options[OptStreamOutDmaBuf])
+		in.close_exported_fds();
+
+	in.free(&fd);
+	out.free(&out_fd);
+	tpg_cache_free();
+	fill_stop();
+	tpg_free(&tpg);
+
+	if (file[CAP] && file[CAP] != stdout)
+		fclose(file[CAP]);
+
+	if (file[OUT] && file[OUT] != stdin)
+		fclose(file[OUT]);
+}
+
+/*
+ * --stream-sync-devices: the buffers dequeued from each device are held until
+ * every device has a frame whose timestamp is within sync_skew of the others.
+ * The frames of such a set are written out together and requeued. Frames that
+ * are too old to be part of a set are dropped, as is the oldest frame of a
+ * device that would otherwise run out of queued buffers.
+ */
+#define SYNC_MAX_DEVICES 16
+
+struct sync_dev {
+	cv4l_fd *fd;
+	const char *name;
+	cv4l_queue q;
+	cv4l_fmt fmt;
+	fps_timestamps fps_ts;
+	FILE *fout;
+	cv4l_buffer held[VIDEO_MAX_FRAME];
+	unsigned first;
+	unsigned count;
+	unsigned dropped;
+};
+
+static double sync_ts(const cv4l_buffer &buf)
+{
+	return buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0;
+}
+
+static int sync_requeue_oldest(sync_dev *d)
+{
+	cv4l_buffer &buf = d->held[d->first];
+
+	d->first = (d->first + 1) % VIDEO_MAX_FRAME;
+	d->count--;
+	if (d->fd->qbuf(buf)) {
+		fprintf(stderr, "%s: qbuf error\n", __func__);
+		return QUEUE_ERROR;
+	}
+	return 0;
+}
+
+static int sync_dqbuf(sync_dev *d)
+{
+	for (;;) {
+		cv4l_buffer buf(d->q);
+		int ret = d->fd->dqbuf(buf);
+
+		if (ret == EAGAIN)
+			return 0;
+		if (ret == EPIPE)
+			return QUEUE_STOPPED;
+		if (ret) {
+			fprintf(stderr, "%s: %s: failed: %s\n", d->name,
+				"VIDIOC_DQBUF", strerror(errno));
+			return QUEUE_ERROR;
+		}
+		d->fps_ts.add_ts(sync_ts(buf), buf.g_sequence(), buf.g_field());
+		if ((buf.g_flags() & V4L2_BUF_FLAG_ERROR) || !buf.g_bytesused(0)) {
+			if (d->fd->qbuf(buf))
+				return QUEUE_ERROR;
+			continue;
+		}
+		d->held[(d->first + d->count++) % VIDEO_MAX_FRAME].init(buf);
+		if (d->count > 1 && d->count + 1 >= d->q.g_buffers()) {
+			d->dropped++;
+			if (sync_requeue_oldest(d))
+				return QUEUE_ERROR;
+		}
+	}
+}
+
+/*
+ * Returns true if the oldest held frames of all devices form a set, dropping
+ * the frames that can no longer be matched.
+ */
+static bool sync_match(sync_dev **devs, unsigned num_devs, double skew, double &set_skew)
+{
+	for (;;) {
+		double oldest_min = 0, oldest_max = 0;
 
-		if (wr_fds) {
-			FD_ZERO(wr_fds);
-			FD_SET(fd.g_fd(), wr_fds);
-		}
+		for (unsigned i = 0; i < num_devs; i++) {
+			if (!devs[i]->count)
+				return false;
 
-		r = select(fd.g_fd() + 1, rd_fds, wr_fds, ex_fds,
-			   stopped ? &stopped_tv : &tv);
+			double ts = sync_ts(devs[i]->held[devs[i]->first]);
 
-		if (r == -1) {
-			if (EINTR == errno)
-				continue;
-			stderr_info("select error: %s\n",
-					strerror(errno));
-			return;
-		}
-		if (r == 0) {
-			if (!stopped)
-				stderr_info("select timeout");
-			stderr_info("\n");
-			return;
+			if (!i || ts < oldest_min)
+				oldest_min = ts;
+			if (!i || ts > oldest_max)
+				oldest_max = ts;
 		}
-
-		if (rd_fds && FD_ISSET(fd.g_fd(), rd_fds)) {
-			r = do_handle_cap(fd, in, fin, nullptr,
-					  count[CAP], fps_ts[CAP], fmt_in,
-					  ignore_count_skip);
-			if (r == QUEUE_STOPPED)
-				break;
-			if (r < 0) {
-				rd_fds = nullptr;
-				if (!have_eos) {
-					ex_fds = nullptr;
-					break;
-				}
-			}
+		if (oldest_max - oldest_min <= skew) {
+			set_skew = oldest_max - oldest_min;
+			return true;
 		}
+		for (unsigned i = 0; i < num_devs; i++) {
+			sync_dev *d = devs[i];
 
-		if (wr_fds && FD_ISSET(fd.g_fd(), wr_fds)) {
-			r = do_handle_out(fd, out, fout, nullptr,
-					  count[OUT], fps_ts[OUT], fmt_out, stopped,
-					  !ignore_count_skip);
-			if (r == QUEUE_STOPPED) {
-				stopped = true;
-				if (have_eos) {
-					if (!verbose)
-						stderr_info("\n");
-					stderr_info("STOP %sCODER\n", is_encoder ? "EN" : "DE");
-					if (is_encoder)
-						fd.encoder_cmd(enc_stop);
-					else
-						fd.decoder_cmd(dec_stop);
-				}
-			} else if (r < 0) {
-				break;
+			while (d->count && sync_ts(d->held[d->first]) < oldest_max - skew) {
+				d->dropped++;
+				if (sync_requeue_oldest(d))
+					return false;
 			}
 		}
+	}
+}
 
-		if (ex_fds && FD_ISSET(fd.g_fd(), ex_fds)) {
-			struct v4l2_event ev;
-
-			while (!fd.dqevent(ev)) {
-				if (ev.type == V4L2_EVENT_EOS) {
-					wr_fds = nullptr;
-					if (!verbose)
-						stderr_info("\n");
-					stderr_info("EOS EVENT\n");
-					fflush(stderr);
-				} else if (ev.type == V4L2_EVENT_SOURCE_CHANGE) {
-					if (!verbose)
-						stderr_info("\n");
-					stderr_info("SOURCE CHANGE EVENT\n");
-					in_source_change_event = true;
+static sync_dev *sync_open(cv4l_fd &main_fd, const char *name, unsigned n)
+{
+	sync_dev *d = new sync_dev;
 
-					/*
-					 * if capture is not streaming, the
-					 * driver will not send a last buffer so
-					 * we set it here
-					 */
-					if (!cap_streaming)
-						last_buffer = true;
-				}
-			}
+	d->name = name;
+	d->fout = nullptr;
+	d->first = d->count = d->dropped = 0;
+	if (!n) {
+		d->fd = &main_fd;
+	} else {
+		d->fd = new cv4l_fd;
+		d->fd->s_direct(main_fd.g_direct());
+		if (d->fd->open(name, true) < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+			delete d->fd;
+			delete d;
+			return nullptr;
 		}
+		d->fd->s_trace(main_fd.g_trace());
+	}
+	if (!d->fd->has_vid_cap()) {
+		fprintf(stderr, "%s: not a video capture device\n", name);
+		goto err;
+	}
+	d->q.init(d->fd->g_type(), memory);
+	if (d->q.reqbufs(d->fd, reqbufs_count_cap) || d->q.obtain_bufs(d->fd))
+		goto err;
+	if (d->q.g_buffers() > VIDEO_MAX_FRAME) {
+		fprintf(stderr, "%s: too many buffers\n", name);
+		goto err;
+	}
+	d->fd->g_fmt(d->fmt);
+	d->fps_ts.determine_field(d->fd->g_fd(), d->q.g_type());
+#ifndef NO_STREAM_TO
+	if (file_to) {
+		std::string fname = std::string(file_to) + "." + std::to_string(n);
 
-		if (last_buffer) {
-			if (in_source_change_event) {
-				in_source_change_event = false;
-				last_buffer = false;
-				if (capture_setup(fd, in, exp_fd_p, &fmt_in))
-					return;
-				fps_ts[CAP].reset();
-				fps_ts[OUT].reset();
-				cap_streaming = true;
-			} else {
-				break;
-			}
+		d->fout = fopen(fname.c_str(), "w");
+		if (!d->fout) {
+			fprintf(stderr, "could not open %s for writing\n", fname.c_str());
+			goto err;
 		}
 	}
+#endif
+	return d;
 
-	fcntl(fd.g_fd(), F_SETFL, fd_flags);
-	stderr_info("\n");
+err:
+	d->q.free(d->fd);
+	if (n) {
+		d->fd->close();
+		delete d->fd;
+	}
+	delete d;
+	return nullptr;
+}
 
-	fd.streamoff(in.g_type());
-	fd.streamoff(out.g_type());
-	in.free(&fd);
-	out.free(&fd);
-	tpg_free(&tpg);
+static void sync_close(sync_dev *d, bool is_main)
+{
+	if (d->fout)
+		fclose(d->fout);
+	d->q.free(d->fd);
+	if (!is_main) {
+		d->fd->close();
+		delete d->fd;
+	}
+	delete d;
 }
 
-static void stateless_m2m(cv4l_fd &fd, cv4l_queue &in, cv4l_queue &out,
-			  FILE *fin, FILE *fout, cv4l_fmt &fmt_in,
-			  const cv4l_fmt &fmt_out, cv4l_fd *exp_fd_p)
+/*
+ * Split a comma separated list of devices, a plain number <n> being shorthand
+ * for /dev/video<n>.
+ */
+static bool parse_devices(const char *devices, std::string *names, unsigned &num,
+			  unsigned max, const char *opt)
 {
-	fps_timestamps fps_ts[2];
-	unsigned count[2] = { 0, 0 };
-	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
-	bool stopped = false;
+	std::string list(devices);
 
-	if (out.reqbufs(&fd, reqbufs_count_out)) {
-		fprintf(stderr, "%s: out.reqbufs failed\n", __func__);
-		return;
+	for (size_t pos = 0; pos <= list.size(); ) {
+		size_t end = list.find(',', pos);
+		std::string name = list.substr(pos, end == std::string::npos ? end : end - pos);
+
+		if (num == max) {
+			fprintf(stderr, "%s supports at most %u devices\n", opt, max);
+			return false;
+		}
+		if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos)
+			name = "/dev/video" + name;
+		if (!name.empty())
+			names[num++] = name;
+		if (end == std::string::npos)
+			break;
+		pos = end + 1;
 	}
+	return true;
+}
 
-	if (in.reqbufs(&fd, reqbufs_count_cap)) {
-		fprintf(stderr, "%s: in.reqbufs failed\n", __func__);
+static void streaming_set_cap_sync(cv4l_fd &fd)
+{
+	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
+	sync_dev *devs[SYNC_MAX_DEVICES];
+	unsigned num_devs = 0;
+	std::string names[SYNC_MAX_DEVICES];
+	fps_timestamps set_fps_ts;
+	struct v4l2_fract interval;
+	double skew, set_skew, max_skew = 0;
+	unsigned sets = 0;
+	bool stop = false;
+	int epollfd;
+
+	if (options[OptStreamDmaBuf] || host_to || host_local || !strcmp(file_to ? file_to : "", "-")) {
+		fprintf(stderr, "--stream-sync-devices does not support --stream-dmabuf, --stream-to-host/local or --stream-to -\n");
 		return;
 	}
 
-	if (exp_fd_p && in.export_bufs(exp_fd_p, exp_fd_p->g_type()))
+	names[num_devs++] = fd.g_v4l_fd()->devname;
+	if (!parse_devices(sync_devices, names, num_devs, SYNC_MAX_DEVICES,
+			   "--stream-sync-devices"))
 		return;
 
-	if (in.obtain_bufs(&fd)) {
-		fprintf(stderr, "%s: in.obtain_bufs error\n", __func__);
+	if (sync_skew_us)
+		skew = sync_skew_us / 1000000.0;
+	else if (!fd.get_interval(interval) && interval.denominator)
+		skew = interval.numerator / 2.0 / interval.denominator;
+	else
+		skew = 0.02;
+
+	epollfd = epoll_create1(0);
+	if (epollfd < 0) {
+		fprintf(stderr, "epoll_create1 error: %s\n", strerror(errno));
 		return;
 	}
 
-	if (do_setup_out_buffers(fd, out, fout, true, true) == QUEUE_ERROR) {
-		fprintf(stderr, "%s: do_setup_out_buffers failed\n", __func__);
-		return;
+	for (unsigned i = 0; i < num_devs; i++) {
+		struct epoll_event ev = {};
+
+		devs[i] = sync_open(fd, names[i].c_str(), i);
+		if (!devs[i]) {
+			num_devs = i;
+			goto done;
+		}
+		fcntl(devs[i]->fd->g_fd(), F_SETFL,
+		      fcntl(devs[i]->fd->g_fd(), F_GETFL) | O_NONBLOCK);
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(epollfd, EPOLL_CTL_ADD, devs[i]->fd->g_fd(), &ev)) {
+			fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+			num_devs = i + 1;
+			goto done;
+		}
 	}
 
-	if (in.queue_all(&fd)) {
-		fprintf(stderr, "%s: in.queue_all failed\n", __func__);
-		return;
+	/* queue everything first so the devices start as close together as possible */
+	for (unsigned i = 0; i < num_devs; i++)
+		if (devs[i]->q.queue_all(devs[i]->fd))
+			goto done;
+	for (unsigned i = 0; i < num_devs; i++)
+		if (devs[i]->fd->streamon())
+			goto done;
+
+	while (!stop) {
+		struct epoll_event evs[SYNC_MAX_DEVICES];
+		int n = epoll_wait(epollfd, evs, SYNC_MAX_DEVICES, 2000);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			stderr_info("epoll_wait error: %s\n", strerror(errno));
+			break;
+		}
+		if (n == 0) {
+			stderr_info("epoll timeout\n");
+			break;
+		}
+		for (int e = 0; e < n; e++)
+			if (sync_dqbuf(devs[evs[e].data.u32]) < 0)
+				stop = true;
+
+		while (!stop && sync_match(devs, num_devs, skew, set_skew)) {
+			cv4l_buffer &buf = devs[0]->held[devs[0]->first];
+
+			if (set_skew > max_skew)
+				max_skew = set_skew;
+			set_fps_ts.add_ts(sync_ts(buf), buf.g_sequence(), buf.g_field());
+			if (stream_skip) {
+				stream_skip--;
+			} else {
+				for (unsigned i = 0; i < num_devs; i++) {
+					sync_dev *d = devs[i];
+
+					if (d->fout)
+						write_buffer_to_file(*d->fd, d->q, d->held[d->first],
+								     d->fmt, d->fout);
+				}
+				sets++;
+				if (verbose)
+					stderr_info("set: %u seq: %u skew: %.03f ms\n",
+						    sets, buf.g_sequence(), set_skew * 1000.0);
+				if (stream_count && !--stream_count)
+					stop = true;
+			}
+			for (unsigned i = 0; i < num_devs; i++)
+				if (sync_requeue_oldest(devs[i]))
+					stop = true;
+
+			if (verbose || !set_fps_ts.has_fps())
+				continue;
+			stderr_info("%.02f sets/s, max skew: %.03f ms", set_fps_ts.fps(), max_skew * 1000.0);
+			for (unsigned i = 0; i < num_devs; i++)
+				if (devs[i]->fps_ts.has_fps())
+					stderr_info(", %s: %.02f fps", devs[i]->name, devs[i]->fps_ts.fps());
+			stderr_info("\n");
+		}
 	}
 
-	if (fd.streamon(out.g_type())) {
-		fprintf(stderr, "%s: streamon for out failed\n", __func__);
-		return;
+done:
+	for (unsigned i = 0; i < num_devs; i++)
+		devs[i]->fd->streamoff();
+	stderr_info("synchronized sets: %u, max skew: %.03f ms\n", sets, max_skew * 1000.0);
+	for (unsigned i = 0; i < num_devs; i++) {
+		stderr_info("%s: dropped frames: %u\n", devs[i]->name, devs[i]->dropped);
+		sync_close(devs[i], i == 0);
 	}
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	close(epollfd);
+}
 
-	if (fd.streamon(in.g_type())) {
-		fprintf(stderr, "%s: streamon for in failed\n", __func__);
-		return;
+/*
+ * --stream-chain: stage 0 is the -d capture device, every following stage an
+ * m2m device whose output queue imports the capture buffers of the previous
+ * stage, except that the last stage may also be a plain video output device.
+ * Output buffer <i> of a stage always carries capture buffer <i> of the
+ * previous stage, which is requeued once the output buffer is dequeued.
+ *
+ * The m2m devices copy the timestamp from the output to the capture buffer,
+ * which is used to find the output buffer a capture buffer was made from to
+ * measure the latency of each stage and of the whole chain.
+ */
+#define CHAIN_MAX_STAGES 16
+
+struct chain_stage {
+	cv4l_fd *fd;
+	const char *name;
+	cv4l_queue q[2];	/* indexed by CAP/OUT */
+	bool has[2];
+	bool polled;
+	cv4l_fmt fmt;
+	fps_timestamps fps_ts;
+	unsigned frames;
+	unsigned queued[2];	/* buffers queued to the driver */
+	unsigned max_queued[2];
+	__u64 sum_queued[2];
+	unsigned samples[2];
+	bool out_valid[VIDEO_MAX_FRAME];
+	__u64 out_ts[VIDEO_MAX_FRAME];
+	__u64 out_usecs[VIDEO_MAX_FRAME];	/* when the output buffer was queued */
+	__u64 out_start[VIDEO_MAX_FRAME];	/* when its frame entered the chain */
+	latency_hist lat;
+};
+
+static latency_hist chain_lat;
+static unsigned chain_count;
+
+static void chain_sample(chain_stage *s, unsigned t)
+{
+	s->sum_queued[t] += s->queued[t];
+	s->samples[t]++;
+	if (s->queued[t] > s->max_queued[t])
+		s->max_queued[t] = s->queued[t];
+}
+
+static int chain_qbuf(chain_stage *s, unsigned t, cv4l_buffer &buf)
+{
+	if (s->fd->qbuf(buf)) {
+		fprintf(stderr, "%s: %s: qbuf error\n", s->name, __func__);
+		return QUEUE_ERROR;
 	}
-	int index = 0;
-	bool queue_lst_buf = false;
-	cv4l_buffer last_in_buf;
+	s->queued[t]++;
+	return 0;
+}
 
-	fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
+static int chain_dqbuf(chain_stage *s, unsigned t, cv4l_buffer &buf)
+{
+	int ret = s->fd->dqbuf(buf);
 
-	while (true) {
-		fd_set except_fds;
-		int req_fd = fwht_reqs[index].fd;
-		struct timeval tv = { 2, 0 };
+	if (ret == EAGAIN)
+		return ret;
+	if (ret == EPIPE)
+		return QUEUE_STOPPED;
+	if (ret) {
+		fprintf(stderr, "%s: %s: failed: %s\n", s->name,
+			"VIDIOC_DQBUF", strerror(errno));
+		return QUEUE_ERROR;
+	}
+	chain_sample(s, t);
+	s->queued[t]--;
+	return 0;
+}
 
-		if (req_fd < 0)
-			break;
+/* Pass capture buffer buf of stage prev on to the output queue of stage s */
+static int chain_qbuf_out(chain_stage *s, chain_stage *prev,
+			  const cv4l_buffer &cap_buf, __u64 start)
+{
+	unsigned index = cap_buf.g_index();
+	cv4l_buffer buf(s->q[OUT], index);
 
-		FD_ZERO(&except_fds);
-		FD_SET(req_fd, &except_fds);
+	for (unsigned j = 0; j < s->q[OUT].g_num_planes(); j++) {
+		buf.s_fd(prev->q[CAP].g_fd(index, j), j);
+		buf.s_bytesused(cap_buf.g_bytesused(j), j);
+		buf.s_data_offset(cap_buf.g_data_offset(j), j);
+	}
+	buf.s_field(cap_buf.g_field());
+	buf.s_timestamp(cap_buf.g_timestamp());
+	s->out_valid[index] = true;
+	s->out_ts[index] = cap_buf.g_timestamp_ns();
+	s->out_usecs[index] = now_usecs();
+	s->out_start[index] = start;
+	return chain_qbuf(s, OUT, buf);
+}
 
-		int rc = select(req_fd + 1, nullptr, nullptr, &except_fds, &tv);
+static int chain_handle_cap(chain_stage **stages, unsigned i, unsigned num,
+			    FILE *fout)
+{
+	chain_stage *s = stages[i];
 
-		if (rc == 0) {
-			fprintf(stderr, "Timeout when waiting for media request\n");
-			return;
-		}
-		if (rc < 0) {
-			fprintf(stderr, "Unable to select media request: %s\n",
-				strerror(errno));
-			return;
+	for (;;) {
+		cv4l_buffer buf(s->q[CAP]);
+		int ret = chain_dqbuf(s, CAP, buf);
+		__u64 now = now_usecs();
+		__u64 start = now;
+
+		if (ret == EAGAIN)
+			return 0;
+		if (ret)
+			return ret;
+		if ((buf.g_flags() & V4L2_BUF_FLAG_ERROR) || !buf.g_bytesused(0)) {
+			if (chain_qbuf(s, CAP, buf))
+				return QUEUE_ERROR;
+			continue;
 		}
-		/*
-		 * it is safe to queue back last cap buffer only after
-		 * the following request is done so that the buffer
-		 * is not needed anymore as a reference frame
-		 */
-		if (queue_lst_buf) {
-			if (fd.qbuf(last_in_buf)) {
-				stderr_info("%s: qbuf failed\n", __func__);
-				return;
+		s->frames++;
+		s->fps_ts.add_ts(buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0,
+				 buf.g_sequence(), buf.g_field());
+
+		if (!i) {
+			__u64 ts = buf.g_timestamp_ns() / 1000;
+
+			if ((buf.g_flags() & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+			    V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC && ts && ts <= now) {
+				s->lat.add(now - ts);
+				start = ts;
+			}
+		} else {
+			for (unsigned b = 0; b < s->q[OUT].g_buffers(); b++) {
+				if (!s->out_valid[b] || s->out_ts[b] != buf.g_timestamp_ns())
+					continue;
+				s->out_valid[b] = false;
+				s->lat.add(now - s->out_usecs[b]);
+				start = s->out_start[b];
+				break;
 			}
 		}
-		int buf_idx = -1;
-		/*
-		 * fin is not sent to do_handle_cap since the capture buf is
-		 * written to the file in current function
-		 */
-		rc = do_handle_cap(fd, in, nullptr, &buf_idx, count[CAP],
-				   fps_ts[CAP], fmt_in, false);
-		if (rc && rc != QUEUE_STOPPED) {
-			stderr_info("%s: do_handle_cap err\n", __func__);
-			return;
+
+		if (i + 1 < num) {
+			if (chain_qbuf_out(stages[i + 1], s, buf, start))
+				return QUEUE_ERROR;
+			continue;
 		}
-		/*
-		 * in case of an error in the frame, set last ts to 0 as a
-		 * means to recover so that next request will not use a
-		 * reference buffer. Otherwise the error flag will be set to
-		 * all the future capture buffers.
-		 */
-		if (buf_idx == -1) {
-			stderr_info("%s: frame returned with error\n", __func__);
-			last_fwht_bf_ts	= 0;
+
+		chain_lat.add(now - start);
+		if (stream_skip) {
+			stream_skip--;
 		} else {
-			cv4l_buffer cap_buf(in, index);
-			if (fd.querybuf(cap_buf))
-				return;
-			last_in_buf = cap_buf;
-			queue_lst_buf = true;
-			if (fin && cap_buf.g_bytesused(0) &&
-			    !(cap_buf.g_flags() & V4L2_BUF_FLAG_ERROR)) {
-				int idx = get_fwht_req_by_ts(cap_buf.g_timestamp_ns());
-
-				if (idx < 0) {
-					fprintf(stderr, "%s: could not find request from buffer\n", __func__);
-					fprintf(stderr, "%s: ts = %llu\n", __func__, cap_buf.g_timestamp_ns());
-					return;
-				}
-				composed_width = fwht_reqs[idx].params.width;
-				composed_height = fwht_reqs[idx].params.height;
-				write_buffer_to_file(fd, in, cap_buf,
-						     fmt_in, fin);
-			}
+			if (file_hash)
+				hash_buffer(s->q[CAP], buf);
+			if (fout)
+				write_buffer_to_file(*s->fd, s->q[CAP], buf, s->fmt, fout);
+			chain_count++;
 		}
-		if (rc == QUEUE_STOPPED)
-			return;
+		if (chain_qbuf(s, CAP, buf))
+			return QUEUE_ERROR;
+		if (stream_count && chain_count >= stream_count)
+			return QUEUE_STOPPED;
+	}
+}
+
+static int chain_handle_out(chain_stage **stages, unsigned i)
+{
+	chain_stage *s = stages[i];
+	chain_stage *prev = stages[i - 1];
+
+	for (;;) {
+		cv4l_buffer buf(s->q[OUT]);
+		int ret = chain_dqbuf(s, OUT, buf);
+		unsigned index = buf.g_index();
 
-		if (!stopped) {
-			rc = do_handle_out(fd, out, fout, nullptr, count[OUT],
-					   fps_ts[OUT], fmt_out, false, true);
-			if (rc) {
-				stopped = true;
-				if (rc != QUEUE_STOPPED)
-					stderr_info("%s: output stream ended\n", __func__);
-				close(req_fd);
-				fwht_reqs[index].fd = -1;
-			}
+		if (ret == EAGAIN)
+			return 0;
+		if (ret)
+			return ret;
+
+		if (!s->has[CAP]) {
+			__u64 now = now_usecs();
+
+			s->frames++;
+			s->fps_ts.add_ts(buf.g_timestamp().tv_sec + buf.g_timestamp().tv_usec / 1000000.0,
+					 buf.g_sequence(), buf.g_field());
+			s->lat.add(now - s->out_usecs[index]);
+			chain_lat.add(now - s->out_start[index]);
+			s->out_valid[index] = false;
+			if (stream_skip)
+				stream_skip--;
+			else
+				chain_count++;
 		}
-		index = (index + 1) % out.g_buffers();
-	}
 
-	fcntl(fd.g_fd(), F_SETFL, fd_flags);
-	stderr_info("\n");
+		cv4l_buffer cap_buf(prev->q[CAP], index);
 
-	fd.streamoff(in.g_type());
-	fd.streamoff(out.g_type());
-	in.free(&fd);
-	out.free(&fd);
-	tpg_free(&tpg);
+		if (chain_qbuf(prev, CAP, cap_buf))
+			return QUEUE_ERROR;
+		if (!s->has[CAP] && stream_count && chain_count >= stream_count)
+			return QUEUE_STOPPED;
+	}
 }
 
-static void streaming_set_m2m(cv4l_fd &fd, cv4l_fd &exp_fd)
+/* Only poll devices with buffers queued, an idle vb2 queue signals EPOLLERR */
+static int chain_update_poll(int epollfd, chain_stage *s, unsigned i)
 {
-	cv4l_queue in(fd.g_type(), memory);
-	cv4l_queue out(v4l_type_invert(fd.g_type()), out_memory);
-	cv4l_queue exp_q(exp_fd.g_type(), V4L2_MEMORY_MMAP);
-	cv4l_fd *exp_fd_p = nullptr;
-	FILE *file[2] = {nullptr, nullptr};
-	cv4l_fmt fmt[2];
-
-	fd.g_fmt(fmt[OUT], out.g_type());
-	fd.g_fmt(fmt[CAP], in.g_type());
+	struct epoll_event ev = {};
+	bool want = s->queued[CAP] || s->queued[OUT];
 
-	if (!fd.has_vid_m2m()) {
-		fprintf(stderr, "unsupported m2m stream type\n");
-		return;
+	if (want == s->polled)
+		return 0;
+	ev.events = EPOLLIN | EPOLLOUT;
+	ev.data.u32 = i;
+	if (epoll_ctl(epollfd, want ? EPOLL_CTL_ADD : EPOLL_CTL_DEL,
+		      s->fd->g_fd(), &ev)) {
+		fprintf(stderr, "epoll_ctl error: %s\n", strerror(errno));
+		return QUEUE_ERROR;
 	}
-	if (options[OptStreamDmaBuf] && options[OptStreamOutDmaBuf]) {
-		fprintf(stderr, "--stream-dmabuf and --stream-out-dmabuf not supported for m2m devices\n");
-		return;
+	s->polled = want;
+	return 0;
+}
+
+static chain_stage *chain_open(cv4l_fd &main_fd, const char *name, unsigned n,
+			       chain_stage *prev, bool last)
+{
+	chain_stage *s = new chain_stage;
+
+	s->name = name;
+	s->polled = false;
+	s->frames = 0;
+	for (unsigned t = CAP; t <= OUT; t++) {
+		s->has[t] = false;
+		s->queued[t] = s->max_queued[t] = s->samples[t] = 0;
+		s->sum_queued[t] = 0;
 	}
-	if ((options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf]) && exp_fd.g_fd() < 0) {
-		fprintf(stderr, "--stream-dmabuf or --stream-out-dmabuf can only work in combination with --export-device\n");
-		return;
+	memset(s->out_valid, 0, sizeof(s->out_valid));
+	if (!n) {
+		s->fd = &main_fd;
+	} else {
+		s->fd = new cv4l_fd;
+		s->fd->s_direct(main_fd.g_direct());
+		if (s->fd->open(name, true) < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+			delete s->fd;
+			delete s;
+			return nullptr;
+		}
+		s->fd->s_trace(main_fd.g_trace());
 	}
 
-	file[CAP] = open_output_file(fd);
-	file[OUT] = open_input_file(fd, out.g_type());
-
-	if (options[OptStreamDmaBuf]) {
-		if (exp_q.reqbufs(&exp_fd, reqbufs_count_cap))
-			goto done;
-		exp_fd_p = &exp_fd;
+	if (!n) {
+		if (!s->fd->has_vid_cap() || s->fd->has_vid_m2m()) {
+			fprintf(stderr, "%s: not a video capture device\n", name);
+			goto err;
+		}
+		s->has[CAP] = true;
+	} else if (s->fd->has_vid_m2m()) {
+		s->has[CAP] = s->has[OUT] = true;
+	} else if (last && s->fd->has_vid_out()) {
+		s->has[OUT] = true;
+	} else {
+		fprintf(stderr, "%s: not a mem2mem%s device\n", name,
+			last ? " or video output" : "");
+		goto err;
 	}
 
-	if (options[OptStreamOutDmaBuf]) {
-		if (exp_q.reqbufs(&exp_fd, reqbufs_count_out))
-			goto done;
-		if (out.export_bufs(&exp_fd, exp_fd.g_type()))
-			goto done;
+	if (s->has[CAP]) {
+		s->q[CAP].init(s->fd->g_type(), V4L2_MEMORY_MMAP);
+		if (s->q[CAP].reqbufs(s->fd, reqbufs_count_cap))
+			goto err;
+		if (last ? s->q[CAP].obtain_bufs(s->fd) :
+			   s->q[CAP].export_bufs(s->fd, s->q[CAP].g_type())) {
+			fprintf(stderr, "%s: could not %s the capture buffers\n", name,
+				last ? "map" : "export");
+			goto err;
+		}
+		s->fd->g_fmt(s->fmt, s->q[CAP].g_type());
+		s->fps_ts.determine_field(s->fd->g_fd(), s->q[CAP].g_type());
 	}
-	if (fmt[OUT].g_pixelformat() == V4L2_PIX_FMT_FWHT_STATELESS)
-		stateless_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
-	else
-		stateful_m2m(fd, in, out, file[CAP], file[OUT], fmt[CAP], fmt[OUT], exp_fd_p);
-
-done:
-	if (options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf])
-		exp_q.close_exported_fds();
+	if (s->has[OUT]) {
+		s->q[OUT].init(s->has[CAP] ? v4l_type_invert(s->fd->g_type()) :
+			       s->fd->g_type(), V4L2_MEMORY_DMABUF);
+		if (s->q[OUT].reqbufs(s->fd, prev->q[CAP].g_buffers()))
+			goto err;
+		if (s->q[OUT].g_buffers() != prev->q[CAP].g_buffers() ||
+		    s->q[OUT].g_num_planes() != prev->q[CAP].g_num_planes()) {
+			fprintf(stderr, "%s: buffer count or number of planes differ from %s\n",
+				name, prev->name);
+			goto err;
+		}
+		if (!s->has[CAP])
+			s->fps_ts.determine_field(s->fd->g_fd(), s->q[OUT].g_type());
+	}
+	if (s->q[CAP].g_buffers() > VIDEO_MAX_FRAME ||
+	    s->q[OUT].g_buffers() > VIDEO_MAX_FRAME) {
+		fprintf(stderr, "%s: too many buffers\n", name);
+		goto err;
+	}
+	return s;
+
+err:
+	for (unsigned t = CAP; t <= OUT; t++)
+		if (s->q[t].g_buffers())
+			s->q[t].free(s->fd);
+	if (n) {
+		s->fd->close();
+		delete s->fd;
+	}
+	delete s;
+	return nullptr;
+}
 
-	if (file[CAP] && file[CAP] != stdout)
-		fclose(file[CAP]);
+static void chain_close(chain_stage *s, bool is_main)
+{
+	if (s->has[OUT])
+		s->q[OUT].free(s->fd);
+	if (s->has[CAP])
+		s->q[CAP].free(s->fd);
+	if (!is_main) {
+		s->fd->close();
+		delete s->fd;
+	}
+	delete s;
+}
 
-	if (file[OUT] && file[OUT] != stdin)
-		fclose(file[OUT]);
+static void chain_print_stats(chain_stage **stages, unsigned num)
+{
+	static constexpr const char *names[] = { "cap", "out" };
+
+	for (unsigned i = 0; i < num; i++) {
+		chain_stage *s = stages[i];
+
+		stderr_info("%s: frames: %u", s->name, s->frames);
+		for (unsigned t = CAP; t <= OUT; t++)
+			if (s->has[t] && s->samples[t])
+				stderr_info(", %s queued: avg %.1f max %u", names[t],
+					    static_cast<double>(s->sum_queued[t]) / s->samples[t],
+					    s->max_queued[t]);
+		if (s->lat.count())
+			stderr_info(", latency (usecs): p50: %llu p99: %llu max: %llu",
+				    s->lat.percentile(50), s->lat.percentile(99),
+				    s->lat.max());
+		stderr_info("\n");
+	}
+	if (chain_lat.count())
+		stderr_info("end-to-end latency (usecs): count: %llu p50: %llu p99: %llu p99.9: %llu max: %llu\n",
+			    chain_lat.count(), chain_lat.percentile(50),
+			    chain_lat.percentile(99), chain_lat.percentile(99.9),
+			    chain_lat.max());
 }
 
-static void streaming_set_cap2out(cv4l_fd &fd, cv4l_fd &out_fd)
+static void streaming_set_chain(cv4l_fd &fd)
 {
 	int fd_flags = fcntl(fd.g_fd(), F_GETFL);
-	bool use_poll = options[OptStreamPoll];
-	bool use_dmabuf = options[OptStreamDmaBuf] || options[OptStreamOutDmaBuf];
-	bool use_userptr = options[OptStreamUser] && options[OptStreamOutUser];
-	__u32 out_type = out_fd.has_vid_m2m() ? v4l_type_invert(out_fd.g_type()) : out_fd.g_type();
-	cv4l_queue in(fd.g_type(), memory);
-	cv4l_queue out(out_type, out_memory);
-	fps_timestamps fps_ts[2];
-	unsigned count[2] = { 0, 0 };
-	FILE *file[2] = {nullptr, nullptr};
-	fd_set fds;
-	unsigned cnt = 0;
-	cv4l_fmt fmt[2];
+	chain_stage *stages[CHAIN_MAX_STAGES];
+	std::string names[CHAIN_MAX_STAGES];
+	unsigned num = 0;
+	FILE *fout = nullptr;
+	bool stop = false;
+	int epollfd;
 
-	out_fd.g_fmt(fmt[OUT], out.g_type());
-	fd.g_fmt(fmt[CAP], in.g_type());
-	if (!(capabilities & (V4L2_CAP_VIDEO_CAPTURE |
-			      V4L2_CAP_VIDEO_CAPTURE_MPLANE |
-			      V4L2_CAP_VIDEO_M2M |
-			      V4L2_CAP_VIDEO_M2M_MPLANE))) {
-		fprintf(stderr, "unsupported capture stream type\n");
-		return;
-	}
-	if (!(out_capabilities & (V4L2_CAP_VIDEO_OUTPUT |
-					 V4L2_CAP_VIDEO_OUTPUT_MPLANE |
-					 V4L2_CAP_VIDEO_M2M |
-					 V4L2_CAP_VIDEO_M2M_MPLANE))) {
-		fprintf(stderr, "unsupported output stream type\n");
+	if (memory != V4L2_MEMORY_MMAP || host_to || host_local) {
+		fprintf(stderr, "--stream-chain requires --stream-mmap and does not support --stream-to-host/local\n");
 		return;
 	}
-	if (options[OptStreamDmaBuf] && !options[OptStreamOutMmap]) {
-		fprintf(stderr, "--stream-dmabuf can only work in combination with --stream-out-mmap\n");
+
+	names[num++] = fd.g_v4l_fd()->devname;
+	if (!parse_devices(chain_devices, names, num, CHAIN_MAX_STAGES, "--stream-chain"))
 		return;
-	}
-	if (options[OptStreamOutDmaBuf] && !options[OptStreamMmap]) {
-		fprintf(stderr, "--stream-out-dmabuf can only work in combination with --stream-mmap\n");
+	if (num < 2) {
+		fprintf(stderr, "--stream-chain needs at least one device\n");
 		return;
 	}
-	if (options[OptStreamDmaBuf])
-		reqbufs_count_cap = reqbufs_count_out;
-	if (options[OptStreamOutDmaBuf])
-		reqbufs_count_out = reqbufs_count_cap;
-	if (!use_dmabuf && !use_userptr) {
-		fprintf(stderr, "Allowed combinations (for now):\n");
-		fprintf(stderr, "\t--stream-mmap and --stream-out-dmabuf\n");
-		fprintf(stderr, "\t--stream-dmabuf and --stream-out-mmap\n");
-		fprintf(stderr, "\t--stream-user and --stream-out-user\n");
+
+	epollfd = epoll_create1(0);
+	if (epollfd < 0) {
+		fprintf(stderr, "epoll_create1 error: %s\n", strerror(errno));
 		return;
 	}
 
-	if (file_to) {
-		if (!strcmp(file_to, "-"))
-			file[CAP] = stdout;
-		else
-			file[CAP] = fopen(file_to, "w+");
-		if (!file[CAP]) {
-			fprintf(stderr, "could not open %s for writing\n", file_to);
-			return;
+	chain_lat.reset();
+	chain_count = 0;
+	for (unsigned i = 0; i < num; i++) {
+		stages[i] = chain_open(fd, names[i].c_str(), i,
+				       i ? stages[i - 1] : nullptr, i + 1 == num);
+		if (!stages[i]) {
+			num = i;
+			goto done;
 		}
+		fcntl(stages[i]->fd->g_fd(), F_SETFL,
+		      fcntl(stages[i]->fd->g_fd(), F_GETFL) | O_NONBLOCK);
 	}
 
-	if (file_from) {
-		if (!strcmp(file_from, "-"))
-			file[OUT] = stdin;
+	if (file_to && stages[num - 1]->has[CAP]) {
+		if (!strcmp(file_to, "-"))
+			fout = stdout;
 		else
-			file[OUT] = fopen(file_from, "r");
-		if (!file[OUT]) {
-			fprintf(stderr, "could not open %s for reading\n", file_from);
-			return;
+			fout = open_file_to(stages[num - 1]->fmt);
+		if (!fout) {
+			fprintf(stderr, "could not open %s for writing\n", file_to);
+			goto done;
 		}
 	}
 
-	if (in.reqbufs(&fd, reqbufs_count_cap) ||
-	    out.reqbufs(&out_fd, reqbufs_count_out))
-		goto done;
+	/* all capture buffers start out queued, the output buffers get them later */
+	for (unsigned i = 0; i < num; i++) {
+		chain_stage *s = stages[i];
 
-	if (options[OptStreamDmaBuf]) {
-		if (in.export_bufs(&out_fd, out.g_type()))
-			goto done;
-	} else if (options[OptStreamOutDmaBuf]) {
-		if (out.export_bufs(&fd, in.g_type()))
+		if (!s->has[CAP])
+			continue;
+		if (s->q[CAP].queue_all(s->fd))
 			goto done;
+		s->queued[CAP] = s->q[CAP].g_buffers();
 	}
+	/* start with the sink, so no stage produces frames nobody is ready for */
+	for (unsigned i = num; i-- > 0; ) {
+		chain_stage *s = stages[i];
 
-	if (in.g_num_planes() != out.g_num_planes()) {
-		fprintf(stderr, "mismatch between number of planes\n");
-		goto done;
-	}
-	if (in.obtain_bufs(&fd)) {
-		fprintf(stderr, "%s: in.obtain_bufs failed\n", __func__);
-		goto done;
-	}
-
-	if (in.queue_all(&fd)) {
-		fprintf(stderr, "%s: in.queue_all failed\n", __func__);
-		goto done;
-	}
-
-
-	if (do_setup_out_buffers(out_fd, out, file[OUT], false, false) == QUEUE_ERROR) {
-		fprintf(stderr, "%s: do_setup_out_buffers failed\n", __func__);
-		goto done;
+		if (s->has[OUT] && s->fd->streamon(s->q[OUT].g_type()))
+			goto done;
+		if (s->has[CAP] && s->fd->streamon(s->q[CAP].g_type()))
+			goto done;
 	}
 
-	fps_ts[CAP].determine_field(fd.g_fd(), in.g_type());
-	fps_ts[OUT].determine_field(out_fd.g_fd(), out.g_type());
-
-	if (fd.streamon() || out_fd.streamon())
-		goto done;
-
-	fd.s_trace(0);
-	out_fd.s_trace(0);
-
-	if (stream_sleep_count == 0)
-		do_sleep();
-
-	if (use_poll)
-		fcntl(fd.g_fd(), F_SETFL, fd_flags | O_NONBLOCK);
-
-	while (true) {
-		struct timeval tv = { use_poll ? 2 : 0, 0 };
-		int r = 0;
-
-		FD_ZERO(&fds);
-		FD_SET(fd.g_fd(), &fds);
+	while (!stop) {
+		struct epoll_event evs[CHAIN_MAX_STAGES];
+		int n;
 
-		if (use_poll)
-			r = select(fd.g_fd() + 1, &fds, nullptr, nullptr, &tv);
+		for (unsigned i = 0; i < num; i++)
+			if (chain_update_poll(epollfd, stages[i], i))
+				stop = true;
+		if (stop)
+			break;
 
-		if (r == -1) {
-			if (EINTR == errno)
+		n = epoll_wait(epollfd, evs, CHAIN_MAX_STAGES, 2000);
+		if (n < 0) {
+			if (errno == EINTR)
 				continue;
-			stderr_info("select error: %s\n",
-					strerror(errno));
-			goto done;
+			stderr_info("epoll_wait error: %s\n", strerror(errno));
+			break;
 		}
-		if (use_poll && r == 0) {
-			stderr_info("select timeout\n");
-			goto done;
+		if (n == 0) {
+			stderr_info("epoll timeout\n");
+			break;
+		}
+		for (int e = 0; e < n && !stop; e++) {
+			unsigned i = evs[e].data.u32;
+
+			if (stages[i]->has[OUT] && chain_handle_out(stages, i))
+				stop = true;
+			if (!stop && stages[i]->has[CAP] &&
+			    chain_handle_cap(stages, i, num, fout))
+				stop = true;
 		}
 
-		if (FD_ISSET(fd.g_fd(), &fds)) {
-			int index = -1;
-
-			r = do_handle_cap(fd, in, file[CAP], &index,
-					  count[CAP], fps_ts[CAP], fmt[CAP], true);
-			if (r)
-				stderr_info("handle cap %d\n", r);
-			if (!r) {
-				cv4l_buffer buf(in, index);
+		chain_stage *last = stages[num - 1];
 
-				if (fd.querybuf(buf))
-					break;
-				r = do_handle_out(out_fd, out, file[OUT], &buf,
-						  count[OUT], fps_ts[OUT], fmt[OUT],
-						  false, false);
-			}
-			if (r)
-				stderr_info("handle out %d\n", r);
-			if (!r && cnt++ > 1)
-				r = do_handle_out_to_in(out_fd, fd, out, in);
-			if (r)
-				stderr_info("handle out2in %d\n", r);
-			if (r < 0) {
-				fd.streamoff();
-				out_fd.streamoff();
-				break;
-			}
-		}
+		if (verbose || !last->fps_ts.has_fps())
+			continue;
+		stderr_info("%.02f fps", last->fps_ts.fps());
+		for (unsigned i = 0; i < num - 1; i++)
+			if (stages[i]->fps_ts.has_fps(true))
+				stderr_info(", %s: %.02f fps", stages[i]->name,
+					    stages[i]->fps_ts.fps());
+		stderr_info("\n");
 	}
 
 done:
-	fcntl(fd.g_fd(), F_SETFL, fd_flags);
-	stderr_info("\n");
-
-	if (options[OptStreamDmaBuf])
-		out.close_exported_fds();
-	if (options[OptStreamOutDmaBuf])
-		in.close_exported_fds();
-
-	in.free(&fd);
-	out.free(&out_fd);
-	tpg_free(&tpg);
-
-	if (file[CAP] && file[CAP] != stdout)
-		fclose(file[CAP]);
+	for (unsigned i = 0; i < num; i++) {
+		chain_stage *s = stages[i];
 
-	if (file[OUT] && file[OUT] != stdin)
-		fclose(file[OUT]);
+		if (s->has[CAP])
+			s->fd->streamoff(s->q[CAP].g_type());
+		if (s->has[OUT])
+			s->fd->streamoff(s->q[OUT].g_type());
+	}
+	stderr_info("\n");
+	chain_print_stats(stages, num);
+	for (unsigned i = num; i-- > 0; )
+		chain_close(stages[i], i == 0);
+	if (fout && fout != stdout)
+		fclose(fout);
+	fcntl(fd.g_fd(), F_SETFL, fd_flags);
+	close(epollfd);
 }
 
 void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
@@ -2982,15 +6992,27 @@ void streaming_set(cv4l_fd &fd, cv4l_fd &out_fd, cv4l_fd &exp_fd)
 	get_out_crop_rect(fd);
 	get_codec_type(fd);
 
-	if (do_cap && do_out && out_fd.g_fd() < 0)
+	if (options[OptStreamBenchmark])
+		streaming_benchmark(fd, exp_fd);
+	else if (do_cap && do_out && out_fd.g_fd() < 0)
 		streaming_set_m2m(fd, exp_fd);
 	else if (do_cap && do_out)
 		streaming_set_cap2out(fd, out_fd);
+	else if (do_cap && chain_devices)
+		streaming_set_chain(fd);
+	else if (do_cap && sync_devices)
+		streaming_set_cap_sync(fd);
 	else if (do_cap)
 		streaming_set_cap(fd, exp_fd);
 	else if (do_out)
 		streaming_set_out(fd, exp_fd);
 
+	if (hash_fout && hash_fout != stdout)
+		fclose(hash_fout);
+	hash_fout = nullptr;
+	meta_log_close();
+	vbi_log_close();
+
 	fd.s_trace(old_trace_fd);
 	out_fd.s_trace(old_trace_out_fd);
 	exp_fd.s_trace(old_trace_exp_fd);
@@ -1,13 +1,46 @@
 #include <cstring>
+#include <vector>
+
+#include <endian.h>
 
 #include "compiler.h"
 #include "v4l2-ctl.h"
+#include "raw2sliced.h"
 
 static struct v4l2_format sliced_fmt;	  /* set_format/get_format for sliced VBI */
 static struct v4l2_format sliced_fmt_out; /* set_format/get_format for sliced VBI output */
 static struct v4l2_format raw_fmt;	  /* set_format/get_format for VBI */
 static struct v4l2_format raw_fmt_out;	  /* set_format/get_format for VBI output */
 
+/*
+ * The size of the stdio buffer of each --vbi-log file, so the packets of
+ * many buffers are written to disk at once.
+ */
+#define VBI_LOG_BUFSIZE (1 << 20)
+
+struct vbi_log_service {
+	__u32 service;
+	const char *ext;
+	const char *name;
+	unsigned len;
+	FILE *fout;
+	unsigned packets;
+	// The records of the current buffer
+	std::vector<__u8> batch;
+};
+
+static vbi_log_service vbi_log_services[] = {
+	{ V4L2_SLICED_TELETEXT_B, "ttx", "teletext", 42 },
+	{ V4L2_SLICED_VPS, "vps", "VPS", 13 },
+	{ V4L2_SLICED_CAPTION_525, "cc", "CC", 2 },
+	{ V4L2_SLICED_WSS_625, "wss", "WSS", 2 },
+};
+
+static const char *vbi_log_prefix;
+static bool vbi_log_raw;
+static struct vbi_handle vbi_log_handle;
+static std::vector<v4l2_sliced_vbi_data> vbi_log_sliced;
+
 void vbi_usage()
 {
 	printf("\nVBI Formats options:\n"
@@ -48,6 +81,13 @@ void vbi_usage()
 	       "                     count0: number of lines in the first field\n"
 	       "                     start1: start line number of the second field\n"
 	       "                     count1: number of lines in the second field\n"
+	       "  --vbi-log <prefix> write the teletext, VPS, CC and WSS packets of the captured\n"
+	       "                     VBI buffers to <prefix>.ttx, .vps, .cc and .wss instead of\n"
+	       "                     printing a character for each buffer. Each packet is\n"
+	       "                     preceded by a 6 byte header with the 32 bit little endian\n"
+	       "                     sequence number, the field and the line number. Sliced VBI\n"
+	       "                     is captured if the sliced VBI format has services set,\n"
+	       "                     otherwise the raw VBI lines are sliced by v4l2-ctl.\n"
 	       );
 }
 
@@ -162,6 +202,9 @@ void vbi_cmd(int ch, char *optarg)
 			}
 		}
 		break;
+	case OptVbiLog:
+		vbi_log_prefix = optarg;
+		break;
 	}
 }
 
@@ -286,3 +329,143 @@ void vbi_list(cv4l_fd &fd)
 		}
 	}
 }
+
+bool vbi_log_active()
+{
+	return vbi_log_prefix;
+}
+
+bool vbi_log_start(cv4l_fd &fd, cv4l_queue &q)
+{
+	cv4l_disable_trace dt(fd);
+	cv4l_fmt fmt;
+	v4l2_std_id std;
+
+	vbi_log_raw = false;
+	if (!vbi_log_prefix || q.g_type() != V4L2_BUF_TYPE_VBI_CAPTURE)
+		return true;
+
+	// Let the hardware do the slicing if it is set up for it
+	if (fd.has_sliced_vbi_cap() &&
+	    !fd.g_fmt(fmt, V4L2_BUF_TYPE_SLICED_VBI_CAPTURE) &&
+	    fmt.fmt.sliced.service_set) {
+		fd.s_type(V4L2_BUF_TYPE_SLICED_VBI_CAPTURE);
+		q.init(fd.g_type(), q.g_memory());
+		return true;
+	}
+
+	if (fd.g_std(std) || fd.g_fmt(fmt, V4L2_BUF_TYPE_VBI_CAPTURE)) {
+		fprintf(stderr, "--vbi-log: cannot get the VBI format and standard\n");
+		return false;
+	}
+	if (fmt.fmt.vbi.sample_format != V4L2_PIX_FMT_GREY) {
+		fprintf(stderr, "--vbi-log: only GREY raw VBI can be sliced\n");
+		return false;
+	}
+	if (!vbi_prepare(&vbi_log_handle, &fmt.fmt.vbi, std)) {
+		fprintf(stderr, "--vbi-log: no VBI services for this format and standard\n");
+		return false;
+	}
+	vbi_log_sliced.resize(vbi_log_handle.count[0] + vbi_log_handle.count[1]);
+	vbi_log_raw = true;
+	return true;
+}
+
+static void vbi_log_write(vbi_log_service &s)
+{
+	if (s.batch.empty())
+		return;
+	if (!s.fout) {
+		std::string name = std::string(vbi_log_prefix) + "." + s.ext;
+
+		s.fout = fopen(name.c_str(), "w");
+		if (!s.fout) {
+			fprintf(stderr, "could not open %s for writing\n", name.c_str());
+			vbi_log_prefix = nullptr;
+			return;
+		}
+		setvbuf(s.fout, nullptr, _IOFBF, VBI_LOG_BUFSIZE);
+	}
+	if (fwrite(s.batch.data(), 1, s.batch.size(), s.fout) != s.batch.size())
+		fprintf(stderr, "%s.%s: write error\n", vbi_log_prefix, s.ext);
+	s.batch.clear();
+}
+
+void vbi_log_buffer(cv4l_buffer &buf, cv4l_queue &q)
+{
+	const struct v4l2_sliced_vbi_data *data;
+	__u32 used = buf.g_bytesused(0);
+	unsigned offset = buf.g_data_offset(0);
+	const __u8 *p;
+	unsigned lines;
+
+	if (!vbi_log_prefix)
+		return;
+	if (offset > used)
+		offset = 0;
+	used -= offset;
+	p = static_cast<__u8 *>(q.g_dataptr(buf.g_index(), 0)) + offset;
+
+	if (buf.g_type() == V4L2_BUF_TYPE_SLICED_VBI_CAPTURE) {
+		data = reinterpret_cast<const v4l2_sliced_vbi_data *>(p);
+		lines = used / sizeof(*data);
+	} else if (buf.g_type() == V4L2_BUF_TYPE_VBI_CAPTURE && vbi_log_raw) {
+		struct v4l2_sliced_vbi_format sfmt;
+
+		lines = vbi_log_sliced.size();
+		if (used < vbi_log_handle.stride * lines)
+			return;
+		// vbi_parse only fills in the lines that can carry a service
+		memset(vbi_log_sliced.data(), 0,
+		       lines * sizeof(v4l2_sliced_vbi_data));
+		vbi_parse(&vbi_log_handle, p, &sfmt, vbi_log_sliced.data());
+		data = vbi_log_sliced.data();
+	} else {
+		return;
+	}
+
+	__u32 seq = htole32(buf.g_sequence());
+
+	for (unsigned i = 0; i < lines; i++) {
+		if (!data[i].id)
+			continue;
+		for (auto &s : vbi_log_services) {
+			if (!(data[i].id & s.service))
+				continue;
+
+			const __u8 *d = reinterpret_cast<const __u8 *>(&seq);
+
+			s.batch.insert(s.batch.end(), d, d + sizeof(seq));
+			s.batch.push_back(data[i].field);
+			s.batch.push_back(data[i].line);
+			s.batch.insert(s.batch.end(), data[i].data,
+				       data[i].data + s.len);
+			s.packets++;
+			break;
+		}
+	}
+	for (auto &s : vbi_log_services) {
+		if (!vbi_log_prefix)
+			break;
+		vbi_log_write(s);
+	}
+}
+
+void vbi_log_close()
+{
+	bool first = true;
+
+	for (auto &s : vbi_log_services) {
+		if (s.fout)
+			fclose(s.fout);
+		s.fout = nullptr;
+		if (s.packets) {
+			stderr_info("%s%u %s packets", first ? "VBI log: " : ", ",
+				    s.packets, s.name);
+			first = false;
+		}
+		s.packets = 0;
+	}
+	if (!first)
+		stderr_info("\n");
+}
@@ -21,11 +21,13 @@
  */
 
 #include <cctype>
+#include <string>
 #include <vector>
 
 #include <dirent.h>
 #include <getopt.h>
 #include <sys/epoll.h>
+#include <sys/wait.h>
 
 #include <linux/media.h>
 
@@ -161,12 +163,15 @@ static struct option long_options[] = {
 	{"get-fmt-sdr-out", no_argument, nullptr, OptGetSdrOutFormat},
 	{"set-fmt-sdr-out", required_argument, nullptr, OptSetSdrOutFormat},
 	{"try-fmt-sdr-out", required_argument, nullptr, OptTrySdrOutFormat},
+	{"sdr-decimate", required_argument, nullptr, OptSdrDecimate},
 	{"get-fmt-meta", no_argument, nullptr, OptGetMetaFormat},
 	{"set-fmt-meta", required_argument, nullptr, OptSetMetaFormat},
 	{"try-fmt-meta", required_argument, nullptr, OptTryMetaFormat},
 	{"get-fmt-meta-out", no_argument, nullptr, OptGetMetaOutFormat},
 	{"set-fmt-meta-out", required_argument, nullptr, OptSetMetaOutFormat},
 	{"try-fmt-meta-out", required_argument, nullptr, OptTryMetaOutFormat},
+	{"meta-log", required_argument, nullptr, OptMetaLog},
+	{"vbi-log", required_argument, nullptr, OptVbiLog},
 	{"get-subdev-fmt", optional_argument, nullptr, OptGetSubDevFormat},
 	{"set-subdev-fmt", required_argument, nullptr, OptSetSubDevFormat},
 	{"try-subdev-fmt", required_argument, nullptr, OptTrySubDevFormat},
@@ -206,6 +211,7 @@ static struct option long_options[] = {
 	{"epoll-for-event", required_argument, nullptr, OptEPollForEvent},
 	{"overlay", required_argument, nullptr, OptOverlay},
 	{"sleep", required_argument, nullptr, OptSleep},
+	{"batch", required_argument, nullptr, OptBatch},
 	{"list-devices", no_argument, nullptr, OptListDevices},
 	{"list-devices-input", required_argument, nullptr, OptListDevicesInput},
 	{"list-devices-output", required_argument, nullptr, OptListDevicesOutput},
@@ -214,6 +220,9 @@ static struct option long_options[] = {
 	{"get-dv-timings", no_argument, nullptr, OptGetDvTimings},
 	{"set-dv-bt-timings", required_argument, nullptr, OptSetDvBtTimings},
 	{"get-dv-timings-cap", optional_argument, nullptr, OptGetDvTimingsCap},
+	{"watch-source", no_argument, nullptr, OptWatchSource},
+	{"watch-source-cec", required_argument, nullptr, OptWatchSourceCec},
+	{"watch-source-hook", required_argument, nullptr, OptWatchSourceHook},
 	{"freq-seek", required_argument, nullptr, OptFreqSeek},
 	{"encoder-cmd", required_argument, nullptr, OptEncoderCmd},
 	{"try-encoder-cmd", required_argument, nullptr, OptTryEncoderCmd},
@@ -241,21 +250,34 @@ static struct option long_options[] = {
 	{"stream-loop", no_argument, nullptr, OptStreamLoop},
 	{"stream-sleep", required_argument, nullptr, OptStreamSleep},
 	{"stream-poll", no_argument, nullptr, OptStreamPoll},
+	{"stream-latency", required_argument, nullptr, OptStreamLatency},
+	{"stream-benchmark", required_argument, nullptr, OptStreamBenchmark},
+	{"stream-hash", required_argument, nullptr, OptStreamHash},
 	{"stream-no-query", no_argument, nullptr, OptStreamNoQuery},
 #ifndef NO_STREAM_TO
 	{"stream-to", required_argument, nullptr, OptStreamTo},
 	{"stream-to-hdr", required_argument, nullptr, OptStreamToHdr},
 	{"stream-lossless", no_argument, nullptr, OptStreamLossless},
 	{"stream-to-host", required_argument, nullptr, OptStreamToHost},
+	{"stream-to-host-opts", required_argument, nullptr, OptStreamToHostOpts},
+	{"stream-to-local", required_argument, nullptr, OptStreamToLocal},
+	{"stream-to-ring", required_argument, nullptr, OptStreamToRing},
+	{"stream-to-io", required_argument, nullptr, OptStreamToIo},
 #endif
 	{"stream-buf-caps", no_argument, nullptr, OptStreamBufCaps},
 	{"stream-show-delta-now", no_argument, nullptr, OptStreamShowDeltaNow},
 	{"stream-mmap", optional_argument, nullptr, OptStreamMmap},
 	{"stream-user", optional_argument, nullptr, OptStreamUser},
 	{"stream-dmabuf", no_argument, nullptr, OptStreamDmaBuf},
+	{"stream-sync-devices", required_argument, nullptr, OptStreamSyncDevices},
+	{"stream-sync-skew", required_argument, nullptr, OptStreamSyncSkew},
+	{"stream-chain", required_argument, nullptr, OptStreamChain},
+	{"stream-ctrl-schedule", required_argument, nullptr, OptStreamCtrlSchedule},
+	{"stream-tee", required_argument, nullptr, OptStreamTee},
 	{"stream-from", required_argument, nullptr, OptStreamFrom},
 	{"stream-from-hdr", required_argument, nullptr, OptStreamFromHdr},
 	{"stream-from-host", required_argument, nullptr, OptStreamFromHost},
+	{"stream-from-mmap", no_argument, nullptr, OptStreamFromMmap},
 	{"stream-out-pattern", required_argument, nullptr, OptStreamOutPattern},
 	{"stream-out-square", no_argument, nullptr, OptStreamOutSquare},
 	{"stream-out-border", no_argument, nullptr, OptStreamOutBorder},
@@ -269,6 +291,9 @@ static struct option long_options[] = {
 	{"stream-out-hor-speed", required_argument, nullptr, OptStreamOutHorSpeed},
 	{"stream-out-vert-speed", required_argument, nullptr, OptStreamOutVertSpeed},
 	{"stream-out-perc-fill", required_argument, nullptr, OptStreamOutPercFill},
+	{"stream-out-cache", required_argument, nullptr, OptStreamOutCache},
+	{"stream-out-timecode", no_argument, nullptr, OptStreamOutTimecode},
+	{"stream-out-threads", required_argument, nullptr, OptStreamOutThreads},
 	{"stream-out-buf-caps", no_argument, nullptr, OptStreamOutBufCaps},
 	{"stream-out-mmap", optional_argument, nullptr, OptStreamOutMmap},
 	{"stream-out-user", optional_argument, nullptr, OptStreamOutUser},
@@ -1119,42 +1144,58 @@ err:
 	return device;
 }
 
-int main(int argc, char **argv)
-{
-	struct event {
-		int type;
-		__u32 ev;
-		__u32 id;
-		std::string name;
-	};
-	int i;
+struct cmd_event {
+	int type;
+	__u32 ev;
+	__u32 id;
+	std::string name;
+};
+
+// The options of a command line, or of a line of a batch file
+struct cmd_line {
+	const char *device = nullptr;
+	const char *out_device = nullptr;
+	const char *export_device = nullptr;
+	const char *batch = nullptr;
+	std::string media_bus_info;
+	std::vector<cmd_event> events;
+	unsigned secs = 0;
+};
+
+// The devices opened for the command line, shared by all lines of a batch
+struct cmd_devs {
 	cv4l_fd c_fd;
 	cv4l_fd c_out_fd;
 	cv4l_fd c_exp_fd;
-	int fd = -1;
-	int out_fd = -1;
-	int exp_fd = -1;
+	bool have_out = false;
+	bool have_exp = false;
 	int media_fd = -1;
 	bool is_subdev = false;
-	std::string media_bus_info;
-
-	/* command args */
-	int ch;
-	const char *device = "/dev/video0";	/* -d device */
-	const char *out_device = nullptr;
-	const char *export_device = nullptr;
 	struct v4l2_capability vcap = {};
 	struct v4l2_subdev_capability subdevcap = {};
 	struct v4l2_subdev_client_capability subdevclientcap = {};
-	std::vector<event> events;
-	unsigned secs = 0;
-	char short_options[26 * 2 * 3 + 1];
+};
+
+// The options that apply to all lines of a batch file
+static const int batch_global_options[] = {
+	OptSilent,
+	OptVerbose,
+	OptConcise,
+	OptUseWrapper,
+	0
+};
+
+/*
+ * Parse the options of a command line. Returns -1 if the commands should
+ * be run, otherwise the exit code.
+ */
+static int parse_cmdline(int argc, char **argv, cmd_line &cl)
+{
+	static char short_options[26 * 2 * 3 + 1];
 	int idx = 0;
+	int ch;
+	int i;
 
-	if (argc == 1) {
-		common_usage();
-		return 0;
-	}
 	for (i = 0; long_options[i].name; i++) {
 		if (!isalpha(long_options[i].val))
 			continue;
@@ -1169,7 +1210,7 @@ int main(int argc, char **argv)
 	while (true) {
 		int option_index = 0;
 		const char *name;
-		event new_ev;
+		cmd_event new_ev;
 
 		short_options[idx] = 0;
 		ch = getopt_long(argc, argv, short_options,
@@ -1240,16 +1281,19 @@ int main(int argc, char **argv)
 			usage_all();
 			return 0;
 		case OptSetDevice:
-			device = make_devname(optarg, "video", media_bus_info);
+			cl.device = make_devname(optarg, "video", cl.media_bus_info);
 			break;
 		case OptSetOutDevice:
-			out_device = make_devname(optarg, "video", media_bus_info);
+			cl.out_device = make_devname(optarg, "video", cl.media_bus_info);
 			break;
 		case OptSetExportDevice:
-			export_device = make_devname(optarg, "video", media_bus_info);
+			cl.export_device = make_devname(optarg, "video", cl.media_bus_info);
 			break;
 		case OptMediaBusInfo:
-			media_bus_info = optarg;
+			cl.media_bus_info = optarg;
+			break;
+		case OptBatch:
+			cl.batch = optarg;
 			break;
 		case OptWaitForEvent:
 		case OptPollForEvent:
@@ -1263,10 +1307,10 @@ int main(int argc, char **argv)
 				new_ev.id = strtoul(name, nullptr, 0);
 			else if (new_ev.ev == V4L2_EVENT_CTRL)
 				new_ev.name = name;
-			events.push_back(new_ev);
+			cl.events.push_back(new_ev);
 			break;
 		case OptSleep:
-			secs = strtoul(optarg, nullptr, 0);
+			cl.secs = strtoul(optarg, nullptr, 0);
 			break;
 		case OptVersion:
 			print_version();
@@ -1308,124 +1352,20 @@ int main(int argc, char **argv)
 		common_usage();
 		return 1;
 	}
+	return -1;
+}
 
-	verbose = options[OptVerbose];
-
-	if (common_list_devices(media_bus_info, c_fd))
-		return 0;
-
-	media_type type = mi_media_detect_type(device);
-	if (type == MEDIA_TYPE_CANT_STAT) {
-		fprintf(stderr, "Cannot open device %s, exiting.\n",
-			device);
-		std::exit(EXIT_FAILURE);
-	}
-
-	switch (type) {
-		// For now we can only handle V4L2 devices
-	case MEDIA_TYPE_VIDEO:
-	case MEDIA_TYPE_VBI:
-	case MEDIA_TYPE_RADIO:
-	case MEDIA_TYPE_SDR:
-	case MEDIA_TYPE_TOUCH:
-	case MEDIA_TYPE_SUBDEV:
-		break;
-	default:
-		type = MEDIA_TYPE_UNKNOWN;
-		break;
-	}
-
-	if (type == MEDIA_TYPE_UNKNOWN) {
-		fprintf(stderr, "Unable to detect what device %s is, exiting.\n",
-			device);
-		std::exit(EXIT_FAILURE);
-	}
-	is_subdev = type == MEDIA_TYPE_SUBDEV;
-	if (is_subdev)
-		options[OptUseWrapper] = 0;
-	c_fd.s_direct(!options[OptUseWrapper]);
-	c_out_fd.s_direct(!options[OptUseWrapper]);
-	c_exp_fd.s_direct(!options[OptUseWrapper]);
-
-	if (is_subdev)
-		fd = c_fd.subdev_open(device);
-	else
-		fd = c_fd.open(device);
-
-	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s: %s\n", device,
-			strerror(errno));
-		std::exit(EXIT_FAILURE);
-	}
-
-	c_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
-
-	if (!is_subdev && doioctl(fd, VIDIOC_QUERYCAP, &vcap)) {
-		fprintf(stderr, "%s: not a v4l2 node\n", device);
-		std::exit(EXIT_FAILURE);
-	} else if (is_subdev) {
-		// This ioctl was introduced in kernel 5.10, so don't
-		// exit if this ioctl returns an error.
-		doioctl(fd, VIDIOC_SUBDEV_QUERYCAP, &subdevcap);
-		subdevclientcap.capabilities = ~0ULL;
-		if (doioctl(fd, VIDIOC_SUBDEV_S_CLIENT_CAP, &subdevclientcap))
-			subdevclientcap.capabilities = 0ULL;
-	}
-	if (!is_subdev) {
-		capabilities = vcap.capabilities;
-		if (capabilities & V4L2_CAP_DEVICE_CAPS)
-			capabilities = vcap.device_caps;
-	}
-
-	media_fd = mi_get_media_fd(fd, is_subdev ? 0 : (const char *)vcap.bus_info);
-
-	priv_magic = (capabilities & V4L2_CAP_EXT_PIX_FORMAT) ?
-			V4L2_PIX_FMT_PRIV_MAGIC : 0;
-	is_multiplanar = capabilities & (V4L2_CAP_VIDEO_CAPTURE_MPLANE |
-					 V4L2_CAP_VIDEO_M2M_MPLANE |
-					 V4L2_CAP_VIDEO_OUTPUT_MPLANE);
-
-	vidcap_buftype = is_multiplanar ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
-					  V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	vidout_buftype = is_multiplanar ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
-					  V4L2_BUF_TYPE_VIDEO_OUTPUT;
-
-	if (out_device) {
-		out_fd = c_out_fd.open(out_device);
-		if (out_fd < 0) {
-			fprintf(stderr, "Failed to open %s: %s\n", out_device,
-					strerror(errno));
-			std::exit(EXIT_FAILURE);
-		}
-		c_out_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
-		if (doioctl(out_fd, VIDIOC_QUERYCAP, &vcap)) {
-			fprintf(stderr, "%s: not a v4l2 node\n", out_device);
-			std::exit(EXIT_FAILURE);
-		}
-		out_capabilities = vcap.capabilities;
-		if (out_capabilities & V4L2_CAP_DEVICE_CAPS)
-			out_capabilities = vcap.device_caps;
-		out_priv_magic = (out_capabilities & V4L2_CAP_EXT_PIX_FORMAT) ?
-				V4L2_PIX_FMT_PRIV_MAGIC : 0;
-	}
-
-	if (export_device) {
-		exp_fd = c_exp_fd.open(export_device);
-		if (exp_fd < 0) {
-			fprintf(stderr, "Failed to open %s: %s\n", export_device,
-					strerror(errno));
-			std::exit(EXIT_FAILURE);
-		}
-		c_exp_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
-		if (doioctl(exp_fd, VIDIOC_QUERYCAP, &vcap)) {
-			fprintf(stderr, "%s: not a v4l2 node\n", export_device);
-			std::exit(EXIT_FAILURE);
-		}
-	}
+// Run the commands of a command line, returns the exit code
+static int run_cmds(cmd_line &cl, cmd_devs &d)
+{
+	cv4l_fd &c_fd = d.c_fd;
+	cv4l_fd &c_out_fd = d.c_out_fd;
+	cv4l_fd &c_exp_fd = d.c_exp_fd;
+	int fd = c_fd.g_fd();
 
 	common_process_controls(c_fd);
 
-	for (auto &e : events) {
+	for (auto &e : cl.events) {
 		if (e.ev != V4L2_EVENT_CTRL)
 			continue;
 		e.id = common_find_ctrl_id(e.name.c_str());
@@ -1476,14 +1416,14 @@ int main(int argc, char **argv)
 	if (options[OptGetDriverInfo]) {
 		printf("Driver Info%s:\n",
 				options[OptUseWrapper] ? " (using libv4l2)" : "");
-		if (is_subdev) {
-			v4l2_info_subdev_capability(subdevcap, subdevclientcap);
+		if (d.is_subdev) {
+			v4l2_info_subdev_capability(d.subdevcap, d.subdevclientcap);
 		} else {
-			v4l2_info_capability(vcap);
+			v4l2_info_capability(d.vcap);
 		}
 	}
-	if (options[OptGetDriverInfo] && media_fd >= 0)
-		mi_media_info_for_fd(media_fd, fd);
+	if (options[OptGetDriverInfo] && d.media_fd >= 0)
+		mi_media_info_for_fd(d.media_fd, fd);
 
 	/* Set options */
 
@@ -1492,7 +1432,7 @@ int main(int argc, char **argv)
 	io_set(c_fd);
 	stds_set(c_fd);
 	vidcap_set(c_fd);
-	vidout_set(out_device ? c_out_fd : c_fd);
+	vidout_set(d.have_out ? c_out_fd : c_fd);
 	overlay_set(c_fd);
 	vbi_set(c_fd);
 	sdr_set(c_fd);
@@ -1509,7 +1449,7 @@ int main(int argc, char **argv)
 	io_get(c_fd);
 	stds_get(c_fd);
 	vidcap_get(c_fd);
-	vidout_get(out_device ? c_out_fd : c_fd);
+	vidout_get(d.have_out ? c_out_fd : c_fd);
 	overlay_get(c_fd);
 	vbi_get(c_fd);
 	sdr_get(c_fd);
@@ -1525,7 +1465,7 @@ int main(int argc, char **argv)
 	io_list(c_fd);
 	stds_list(c_fd);
 	vidcap_list(c_fd);
-	vidout_list(out_device ? c_out_fd : c_fd);
+	vidout_list(d.have_out ? c_out_fd : c_fd);
 	overlay_list(c_fd);
 	vbi_list(c_fd);
 	sdr_list(c_fd);
@@ -1537,7 +1477,7 @@ int main(int argc, char **argv)
 
 	streaming_set(c_fd, c_out_fd, c_exp_fd);
 
-	for (const auto &e : events) {
+	for (const auto &e : cl.events) {
 		struct v4l2_event_subscription sub;
 		struct v4l2_event ev;
 
@@ -1552,7 +1492,7 @@ int main(int argc, char **argv)
 		doioctl(fd, VIDIOC_UNSUBSCRIBE_EVENT, &sub);
 	}
 
-	for (const auto &e : events) {
+	for (const auto &e : cl.events) {
 		struct v4l2_event_subscription sub;
 
 		if (e.type == OptWaitForEvent)
@@ -1615,25 +1555,334 @@ int main(int argc, char **argv)
 		close(epollfd);
 	}
 
+	stds_watch(c_fd);
+
 	if (options[OptSleep]) {
-		sleep(secs);
+		sleep(cl.secs);
 		printf("Test VIDIOC_QUERYCAP:\n");
-		if (c_fd.querycap(vcap, true) == 0)
-			printf("\tDriver name   : %s\n", vcap.driver);
+		if (c_fd.querycap(d.vcap, true) == 0)
+			printf("\tDriver name   : %s\n", d.vcap.driver);
 		else
 			perror("VIDIOC_QUERYCAP");
 	}
 
-	c_fd.close();
-	if (out_device)
-		c_out_fd.close();
-	if (export_device)
-		c_exp_fd.close();
-	if (media_fd >= 0)
-		close(media_fd);
 
 	// --all sets --silent to avoid ioctl errors to be shown when an ioctl
 	// is not implemented by the driver. Which is fine, but we shouldn't
 	// return an application error in that specific case.
-	std::exit(options[OptAll] ? 0 : app_result);
+	return options[OptAll] ? 0 : app_result;
+}
+
+/*
+ * Split a line of a batch file into its arguments. The arguments are
+ * separated by whitespace, quotes and backslashes work as in the shell
+ * and a '#' at the start of an argument starts a comment. Returns false
+ * if a quote is not terminated.
+ */
+static bool split_batch_line(const char *s, std::vector<std::string> &args)
+{
+	std::string arg;
+	bool in_arg = false;
+	char quote = 0;
+
+	for (; *s; s++) {
+		if (quote) {
+			if (*s == quote)
+				quote = 0;
+			else if (quote == '"' && *s == '\\' && (s[1] == '"' || s[1] == '\\'))
+				arg += *++s;
+			else
+				arg += *s;
+			continue;
+		}
+		if (isspace((unsigned char)*s)) {
+			if (in_arg)
+				args.push_back(arg);
+			arg.clear();
+			in_arg = false;
+			continue;
+		}
+		if (*s == '#' && !in_arg)
+			break;
+		in_arg = true;
+		if (*s == '\'' || *s == '"')
+			quote = *s;
+		else if (*s == '\\' && s[1])
+			arg += *++s;
+		else
+			arg += *s;
+	}
+	if (in_arg)
+		args.push_back(arg);
+	return !quote;
+}
+
+static int run_batch_line(const std::vector<std::string> &args, cmd_devs &d)
+{
+	std::vector<char *> argv;
+	char global_options[OptLast] = {};
+	cmd_line cl;
+	int ret;
+
+	argv.push_back((char *)"v4l2-ctl");
+	for (const auto &arg : args)
+		argv.push_back((char *)arg.c_str());
+	argv.push_back(nullptr);
+
+	for (unsigned i = 0; batch_global_options[i]; i++)
+		global_options[batch_global_options[i]] = options[batch_global_options[i]];
+	memcpy(options, global_options, sizeof(options));
+
+	// Restart the option scanning of getopt_long()
+	optind = 0;
+	ret = parse_cmdline(argv.size() - 1, argv.data(), cl);
+	if (ret >= 0)
+		return ret;
+	if (cl.device || cl.out_device || cl.export_device || cl.batch ||
+	    !cl.media_bus_info.empty()) {
+		fprintf(stderr, "The devices cannot be changed in a batch file\n");
+		return 1;
+	}
+
+	verbose = options[OptVerbose];
+	d.c_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+	d.c_out_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+	d.c_exp_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+	return run_cmds(cl, d);
+}
+
+/*
+ * Run the lines of a batch file against the devices opened for the
+ * command line, stopping at the first line that fails.
+ *
+ * The options are parsed into state of the option modules that assumes a
+ * single command line, so each line is run by a child process that starts
+ * with the state of the parent: the open devices and the controls that
+ * the parent enumerated, but none of the options of the earlier lines.
+ * The whole file is read before the first child is started, as a child
+ * exiting could move the shared file offset of the batch file.
+ */
+static int run_batch(const char *batch, cmd_devs &d)
+{
+	std::vector<std::string> lines;
+	FILE *f = strcmp(batch, "-") ? fopen(batch, "r") : stdin;
+	char *line = nullptr;
+	size_t size = 0;
+
+	if (!f) {
+		fprintf(stderr, "Cannot open batch file %s: %s\n",
+			batch, strerror(errno));
+		return 1;
+	}
+	while (getline(&line, &size, f) >= 0)
+		lines.push_back(line);
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	// Make sure the controls are only enumerated once
+	common_process_controls(d.c_fd);
+
+	for (unsigned i = 0; i < lines.size(); i++) {
+		std::vector<std::string> args;
+		int status;
+		pid_t pid;
+
+		if (!split_batch_line(lines[i].c_str(), args)) {
+			fprintf(stderr, "%s:%u: unterminated quote\n", batch, i + 1);
+			return 1;
+		}
+		// Allow lines copied from scripts that run v4l2-ctl
+		if (!args.empty() && args[0] == "v4l2-ctl")
+			args.erase(args.begin());
+		if (args.empty())
+			continue;
+
+		fflush(stdout);
+		fflush(stderr);
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (!pid)
+			std::exit(run_batch_line(args, d));
+		if (waitpid(pid, &status, 0) < 0) {
+			perror("waitpid");
+			return 1;
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "%s:%u: command failed\n", batch, i + 1);
+			return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	cmd_line cl;
+	cmd_devs d;
+	cv4l_fd &c_fd = d.c_fd;
+	cv4l_fd &c_out_fd = d.c_out_fd;
+	cv4l_fd &c_exp_fd = d.c_exp_fd;
+	struct v4l2_capability &vcap = d.vcap;
+	const char *device;
+	int fd = -1;
+	int out_fd = -1;
+	int exp_fd = -1;
+	int ret;
+
+	if (argc == 1) {
+		common_usage();
+		return 0;
+	}
+	ret = parse_cmdline(argc, argv, cl);
+	if (ret >= 0)
+		return ret;
+	device = cl.device ? cl.device : "/dev/video0";
+
+	if (cl.batch) {
+		char global_options[OptLast] = {};
+
+		for (unsigned i = 0; batch_global_options[i]; i++)
+			global_options[batch_global_options[i]] = options[batch_global_options[i]];
+		global_options[OptBatch] = 1;
+		global_options[OptSetDevice] = options[OptSetDevice];
+		global_options[OptSetOutDevice] = options[OptSetOutDevice];
+		global_options[OptSetExportDevice] = options[OptSetExportDevice];
+		global_options[OptMediaBusInfo] = options[OptMediaBusInfo];
+		if (memcmp(options, global_options, sizeof(options))) {
+			fprintf(stderr, "Only the device and the --silent, --verbose, --concise\n"
+				"and --wrapper options can be combined with --batch\n");
+			return 1;
+		}
+	}
+
+	verbose = options[OptVerbose];
+
+	if (common_list_devices(cl.media_bus_info, c_fd))
+		return 0;
+
+	media_type type = mi_media_detect_type(device);
+	if (type == MEDIA_TYPE_CANT_STAT) {
+		fprintf(stderr, "Cannot open device %s, exiting.\n",
+			device);
+		std::exit(EXIT_FAILURE);
+	}
+
+	switch (type) {
+		// For now we can only handle V4L2 devices
+	case MEDIA_TYPE_VIDEO:
+	case MEDIA_TYPE_VBI:
+	case MEDIA_TYPE_RADIO:
+	case MEDIA_TYPE_SDR:
+	case MEDIA_TYPE_TOUCH:
+	case MEDIA_TYPE_SUBDEV:
+		break;
+	default:
+		type = MEDIA_TYPE_UNKNOWN;
+		break;
+	}
+
+	if (type == MEDIA_TYPE_UNKNOWN) {
+		fprintf(stderr, "Unable to detect what device %s is, exiting.\n",
+			device);
+		std::exit(EXIT_FAILURE);
+	}
+	d.is_subdev = type == MEDIA_TYPE_SUBDEV;
+	if (d.is_subdev)
+		options[OptUseWrapper] = 0;
+	c_fd.s_direct(!options[OptUseWrapper]);
+	c_out_fd.s_direct(!options[OptUseWrapper]);
+	c_exp_fd.s_direct(!options[OptUseWrapper]);
+
+	if (d.is_subdev)
+		fd = c_fd.subdev_open(device);
+	else
+		fd = c_fd.open(device);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", device,
+			strerror(errno));
+		std::exit(EXIT_FAILURE);
+	}
+
+	c_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+
+	if (!d.is_subdev && doioctl(fd, VIDIOC_QUERYCAP, &vcap)) {
+		fprintf(stderr, "%s: not a v4l2 node\n", device);
+		std::exit(EXIT_FAILURE);
+	} else if (d.is_subdev) {
+		// This ioctl was introduced in kernel 5.10, so don't
+		// exit if this ioctl returns an error.
+		doioctl(fd, VIDIOC_SUBDEV_QUERYCAP, &d.subdevcap);
+		d.subdevclientcap.capabilities = ~0ULL;
+		if (doioctl(fd, VIDIOC_SUBDEV_S_CLIENT_CAP, &d.subdevclientcap))
+			d.subdevclientcap.capabilities = 0ULL;
+	}
+	if (!d.is_subdev) {
+		capabilities = vcap.capabilities;
+		if (capabilities & V4L2_CAP_DEVICE_CAPS)
+			capabilities = vcap.device_caps;
+	}
+
+	d.media_fd = mi_get_media_fd(fd, d.is_subdev ? 0 : (const char *)vcap.bus_info);
+
+	priv_magic = (capabilities & V4L2_CAP_EXT_PIX_FORMAT) ?
+			V4L2_PIX_FMT_PRIV_MAGIC : 0;
+	is_multiplanar = capabilities & (V4L2_CAP_VIDEO_CAPTURE_MPLANE |
+					 V4L2_CAP_VIDEO_M2M_MPLANE |
+					 V4L2_CAP_VIDEO_OUTPUT_MPLANE);
+
+	vidcap_buftype = is_multiplanar ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE :
+					  V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	vidout_buftype = is_multiplanar ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE :
+					  V4L2_BUF_TYPE_VIDEO_OUTPUT;
+
+	if (cl.out_device) {
+		out_fd = c_out_fd.open(cl.out_device);
+		if (out_fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", cl.out_device,
+					strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		c_out_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+		if (doioctl(out_fd, VIDIOC_QUERYCAP, &vcap)) {
+			fprintf(stderr, "%s: not a v4l2 node\n", cl.out_device);
+			std::exit(EXIT_FAILURE);
+		}
+		out_capabilities = vcap.capabilities;
+		if (out_capabilities & V4L2_CAP_DEVICE_CAPS)
+			out_capabilities = vcap.device_caps;
+		out_priv_magic = (out_capabilities & V4L2_CAP_EXT_PIX_FORMAT) ?
+				V4L2_PIX_FMT_PRIV_MAGIC : 0;
+		d.have_out = true;
+	}
+
+	if (cl.export_device) {
+		exp_fd = c_exp_fd.open(cl.export_device);
+		if (exp_fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n", cl.export_device,
+					strerror(errno));
+			std::exit(EXIT_FAILURE);
+		}
+		c_exp_fd.s_trace(options[OptSilent] ? 0 : (verbose ? 2 : 1));
+		if (doioctl(exp_fd, VIDIOC_QUERYCAP, &vcap)) {
+			fprintf(stderr, "%s: not a v4l2 node\n", cl.export_device);
+			std::exit(EXIT_FAILURE);
+		}
+		d.have_exp = true;
+	}
+
+	ret = cl.batch ? run_batch(cl.batch, d) : run_cmds(cl, d);
+
+	c_fd.close();
+	if (d.have_out)
+		c_out_fd.close();
+	if (d.have_exp)
+		c_exp_fd.close();
+	if (d.media_fd >= 0)
+		close(d.media_fd);
+	std::exit(ret);
 }
@@ -123,6 +123,9 @@ enum Option {
 	OptListOutFormatsExt,
 	OptListMetaFormats,
 	OptListMetaOutFormats,
+	OptSdrDecimate,
+	OptMetaLog,
+	OptVbiLog,
 	OptListSubDevMBusCodes,
 	OptListSubDevFrameSizes,
 	OptListSubDevFrameIntervals,
@@ -168,6 +171,7 @@ enum Option {
 	OptGetOutputOverlayCropCap,
 	OptOverlay,
 	OptSleep,
+	OptBatch,
 	OptGetJpegComp,
 	OptSetJpegComp,
 	OptGetModulator,
@@ -188,6 +192,9 @@ enum Option {
 	OptGetDvTimings,
 	OptSetDvBtTimings,
 	OptGetDvTimingsCap,
+	OptWatchSource,
+	OptWatchSourceCec,
+	OptWatchSourceHook,
 	OptSetEdid,
 	OptClearEdid,
 	OptGetEdid,
@@ -218,19 +225,32 @@ enum Option {
 	OptStreamLoop,
 	OptStreamSleep,
 	OptStreamPoll,
+	OptStreamLatency,
+	OptStreamBenchmark,
+	OptStreamHash,
 	OptStreamNoQuery,
 	OptStreamTo,
 	OptStreamToHdr,
 	OptStreamToHost,
+	OptStreamToHostOpts,
+	OptStreamToLocal,
+	OptStreamToRing,
+	OptStreamToIo,
 	OptStreamLossless,
 	OptStreamShowDeltaNow,
 	OptStreamBufCaps,
 	OptStreamMmap,
 	OptStreamUser,
 	OptStreamDmaBuf,
+	OptStreamSyncDevices,
+	OptStreamSyncSkew,
+	OptStreamChain,
+	OptStreamCtrlSchedule,
+	OptStreamTee,
 	OptStreamFrom,
 	OptStreamFromHdr,
 	OptStreamFromHost,
+	OptStreamFromMmap,
 	OptStreamOutPattern,
 	OptStreamOutSquare,
 	OptStreamOutBorder,
@@ -239,6 +259,9 @@ enum Option {
 	OptStreamOutHorSpeed,
 	OptStreamOutVertSpeed,
 	OptStreamOutPercFill,
+	OptStreamOutCache,
+	OptStreamOutTimecode,
+	OptStreamOutThreads,
 	OptStreamOutAlphaComponent,
 	OptStreamOutAlphaRedOnly,
 	OptStreamOutRGBLimitedRange,
@@ -375,6 +398,7 @@ void stds_cmd(int ch, char *optarg);
 void stds_set(cv4l_fd &fd);
 void stds_get(cv4l_fd &fd);
 void stds_list(cv4l_fd &fd);
+void stds_watch(cv4l_fd &fd);
 
 // v4l2-ctl-vidcap.cpp
 void vidcap_usage(void);
@@ -405,6 +429,10 @@ void vbi_cmd(int ch, char *optarg);
 void vbi_set(cv4l_fd &fd);
 void vbi_get(cv4l_fd &fd);
 void vbi_list(cv4l_fd &fd);
+bool vbi_log_active();
+bool vbi_log_start(cv4l_fd &fd, cv4l_queue &q);
+void vbi_log_buffer(cv4l_buffer &buf, cv4l_queue &q);
+void vbi_log_close();
 
 // v4l2-ctl-sdr.cpp
 void sdr_usage(void);
@@ -412,6 +440,7 @@ void sdr_cmd(int ch, char *optarg);
 void sdr_set(cv4l_fd &fd);
 void sdr_get(cv4l_fd &fd);
 void sdr_list(cv4l_fd &fd);
+unsigned sdr_decimate(cv4l_fmt &fmt, __u8 *&p, unsigned size);
 
 // v4l2-ctl-meta.cpp
 void meta_usage(void);
@@ -421,6 +450,8 @@ void meta_get(cv4l_fd &fd);
 void meta_list(cv4l_fd &fd);
 void print_meta_buffer(FILE *f, cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
 void meta_fillbuffer(cv4l_buffer &buf, cv4l_fmt &fmt, cv4l_queue &q);
+void meta_log_buffer(cv4l_buffer &buf, cv4l_queue &q);
+void meta_log_close();
 
 // v4l2-ctl-subdev.cpp
 void subdev_usage(void);
@@ -19,7 +19,10 @@
 #include <cctype>
 #include <cerrno>
 #include <cstring>
+#include <ctime>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <fcntl.h>
@@ -119,6 +122,10 @@ enum Option {
 	OptLogStatus = 128,
 	OptVerbose,
 	OptListSymbols,
+	OptCompact,
+	OptDiffRegisters,
+	OptWatchRegisters,
+	OptParallel,
 	OptLast = 256
 };
 
@@ -139,6 +146,10 @@ static struct option long_options[] = {
 	{"log-status", no_argument, nullptr, OptLogStatus},
 	{"list-symbols", no_argument, nullptr, OptListSymbols},
 	{"wide", required_argument, nullptr, OptSetStride},
+	{"compact", no_argument, nullptr, OptCompact},
+	{"diff-registers", required_argument, nullptr, OptDiffRegisters},
+	{"watch-registers", optional_argument, nullptr, OptWatchRegisters},
+	{"parallel", no_argument, nullptr, OptParallel},
 	{nullptr, 0, nullptr, 0}
 };
 
@@ -155,8 +166,17 @@ static void usage()
 	       "                         bridge<num>: bridge chip number <num>\n"
 	       "                         bridge (default): same as bridge0\n"
 	       "                         subdev<num>: sub-device number <num>\n"
+	       "                     It can be given more than once, to dump several chips\n"
 	       "  -l, --list-registers[=min=<addr>[,max=<addr>]]\n"
 	       "		     Dump registers from <min> to <max> [VIDIOC_DBG_G_REGISTER]\n"
+	       "  --compact          Dump the registers as '<chip> <addr> <value>' lines\n"
+	       "  --diff-registers <file>\n"
+	       "                     Only show the registers whose value differ from the\n"
+	       "                     ones at <file>, saved from a --compact dump\n"
+	       "  --watch-registers[=<ms>]\n"
+	       "                     Keep reading the registers every <ms> milliseconds\n"
+	       "                     (default: 1000), showing the ones whose value changed\n"
+	       "  --parallel         Read the registers of each chip at the same time\n"
 	       "  -g, --get-register <addr>\n"
 	       "		     Get the specified register [VIDIOC_DBG_G_REGISTER]\n"
 	       "  -s, --set-register <addr>\n"
@@ -169,51 +189,6 @@ static void usage()
 	       "  --log-status       Log the board status in the kernel log [VIDIOC_LOG_STATUS]\n");
 }
 
-static void print_regs(int fd, struct v4l2_dbg_register *reg, unsigned long min, unsigned long max, int stride)
-{
-	unsigned long mask;
-	unsigned long i;
-	int line = 0;
-
-	/* Query size of the first register */
-	reg->reg = min;
-	if (ioctl(fd, VIDIOC_DBG_G_REGISTER, reg) == 0) {
-		/* If size is set, then use this as the stride */
-		if (reg->size)
-			stride = reg->size;
-	}
-
-	mask = stride > 2 ? 0x1f : 0x0f;
-
-	for (i = min & ~mask; i <= max; i += stride) {
-		if ((i & mask) == 0 && line % 32 == 0) {
-			if (stride == 4)
-				printf("\n                00       04       08       0C       10       14       18       1C");
-			else if (stride == 2)
-				printf("\n            00   02   04   06   08   0A   0C   0E");
-			else
-				printf("\n          00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F");
-		}
-
-		if ((i & mask) == 0) {
-			printf("\n%08lx: ", i);
-			line++;
-		}
-		if (i < min) {
-			printf("%*s ", 2 * stride, "");
-			continue;
-		}
-		reg->reg = i;
-		if (ioctl(fd, VIDIOC_DBG_G_REGISTER, reg) < 0) {
-			perror("ioctl: VIDIOC_DBG_G_REGISTER failed\n");
-			break;
-		}
-		printf("%0*llx ", 2 * stride, reg->val);
-		usleep(1);
-	}
-	printf("\n");
-}
-
 static void print_name(struct v4l2_dbg_chip_info *chip)
 {
 	printf("%-10s (%c%c)\n", chip->name,
@@ -286,6 +261,21 @@ static const char *binary(unsigned long long val)
 	return bin;
 }
 
+static void print_named_reg(const struct board_list *curr_bd,
+			    unsigned long long reg, unsigned long long val)
+{
+	const char *name = reg_name(curr_bd, reg);
+
+	printf("Register ");
+
+	if (name)
+		printf("%s (0x%08llx)", name, reg);
+	else
+		printf("0x%08llx", reg);
+
+	printf(" = %llxh (%lldd  %sb)\n", val, val, binary(val));
+}
+
 static int doioctl(int fd, unsigned long int request, void *parm, const char *name)
 {
 	int retVal = ioctl(fd, request, parm);
@@ -300,6 +290,297 @@ static int doioctl(int fd, unsigned long int request, void *parm, const char *na
 	return retVal;
 }
 
+/*
+ * Register dumps
+ *
+ * All the registers of a dump are read at once, and only then printed, so
+ * that the reads, usually over a slow I2C bus, don't wait for the output.
+ * With --parallel, each chip is read on its own thread. Successive reads of
+ * the same dump can be compared, to only show what changed.
+ */
+struct reg_range {
+	unsigned long long min, max;
+	int stride;
+	size_t first, count;	/* registers of the range, at values */
+};
+
+struct reg_value {
+	unsigned long long reg;
+	unsigned long long val;
+	int err;		/* errno, if reading it failed */
+};
+
+struct chip_dump {
+	struct v4l2_dbg_match match;
+	std::string label;	/* bridge<num> or subdev<num> */
+	const struct board_list *bd;
+	bool named;		/* board registers, instead of ranges */
+	std::vector<reg_range> ranges;
+	std::vector<reg_value> values;
+};
+
+static const struct board_list *find_board(const struct v4l2_dbg_match &match,
+					   const char *chip_name)
+{
+	if (!strncasecmp(match.name, "ac97", 4))
+		return &boards[AC97_BOARD];
+	for (size_t board = boards.size(); board; board--) {
+		if (!strcasecmp(chip_name, boards[board - 1].name))
+			return &boards[board - 1];
+	}
+	return nullptr;
+}
+
+static void dump_add_range(int fd, struct chip_dump &d,
+			   unsigned long min, unsigned long max, int stride)
+{
+	struct v4l2_dbg_register reg = {};
+	struct reg_range r;
+	unsigned long mask;
+
+	/* Query size of the first register */
+	reg.match = d.match;
+	reg.reg = min;
+	if (ioctl(fd, VIDIOC_DBG_G_REGISTER, &reg) == 0) {
+		/* If size is set, then use this as the stride */
+		if (reg.size)
+			stride = reg.size;
+	}
+
+	mask = stride > 2 ? 0x1f : 0x0f;
+
+	r.min = min;
+	r.max = max;
+	r.stride = stride;
+	r.first = d.values.size();
+	for (unsigned long i = min & ~mask; i <= max; i += stride)
+		if (i >= min)
+			d.values.push_back({ i, 0, 0 });
+	r.count = d.values.size() - r.first;
+	d.ranges.push_back(r);
+}
+
+static void dump_setup(int fd, struct chip_dump &d, bool probe,
+		       const std::string &reg_min_arg,
+		       const std::string &reg_max_arg, int forcedstride)
+{
+	struct v4l2_dbg_chip_info chip_info = {};
+	unsigned long long reg_min, reg_max;
+	std::string name;
+	int stride = 1;
+	char *p;
+
+	d.label = (d.match.type == V4L2_CHIP_MATCH_SUBDEV ? "subdev" : "bridge") +
+		  std::to_string(d.match.addr);
+	d.bd = nullptr;
+	d.named = false;
+
+	if (probe) {
+		/* try to figure out which chip it is */
+		chip_info.match = d.match;
+		if (doioctl(fd, VIDIOC_DBG_G_CHIP_INFO, &chip_info, "VIDIOC_DBG_G_CHIP_INFO") != 0)
+			chip_info.name[0] = '\0';
+		d.bd = find_board(d.match, chip_info.name);
+	}
+
+	if (forcedstride) {
+		stride = forcedstride;
+	} else if (d.match.type == V4L2_CHIP_MATCH_BRIDGE) {
+		stride = 4;
+	}
+
+	if (d.bd) {
+		if (reg_min_arg.empty())
+			reg_min = 0;
+		else
+			reg_min = parse_reg(d.bd, reg_min_arg);
+
+		if (reg_max_arg.empty())
+			reg_max = (1ll << 32) - 1;
+		else
+			reg_max = parse_reg(d.bd, reg_max_arg);
+
+		d.named = true;
+		for (const auto &curr : d.bd->regs)
+			if (reg_min_arg.empty() || ((curr.reg >= reg_min) && curr.reg <= reg_max))
+				d.values.push_back({ curr.reg, 0, 0 });
+		return;
+	}
+
+	if (!reg_min_arg.empty()) {
+		reg_min = parse_reg(d.bd, reg_min_arg);
+		if (reg_max_arg.empty())
+			reg_max = reg_min + 0xff;
+		else
+			reg_max = parse_reg(d.bd, reg_max_arg);
+		/* Explicit memory range: just do it */
+		dump_add_range(fd, d, reg_min, reg_max, stride);
+		return;
+	}
+
+	p = std::strchr(chip_info.name, ' ');
+	if (p)
+		*p = '\0';
+	name = chip_info.name;
+
+	if (name == "saa7115") {
+		dump_add_range(fd, d, 0, 0xff, stride);
+	} else if (name == "saa717x") {
+		// FIXME: use correct reg regions
+		dump_add_range(fd, d, 0, 0xff, stride);
+	} else if (name == "saa7127") {
+		dump_add_range(fd, d, 0, 0x7f, stride);
+	} else if (name == "ov7670") {
+		dump_add_range(fd, d, 0, 0x89, stride);
+	} else if (name == "cx25840") {
+		dump_add_range(fd, d, 0, 2, stride);
+		dump_add_range(fd, d, 0x100, 0x15f, stride);
+		dump_add_range(fd, d, 0x200, 0x23f, stride);
+		dump_add_range(fd, d, 0x400, 0x4bf, stride);
+		dump_add_range(fd, d, 0x800, 0x9af, stride);
+	} else if (name == "cs5345") {
+		dump_add_range(fd, d, 1, 0x10, stride);
+	} else if (name == "cx23416") {
+		dump_add_range(fd, d, 0x02000000, 0x020000ff, stride);
+	} else if (name == "cx23418") {
+		dump_add_range(fd, d, 0x02c40000, 0x02c409c7, stride);
+	} else if (name == "cafe") {
+		dump_add_range(fd, d, 0, 0x43, stride);
+		dump_add_range(fd, d, 0x88, 0x8f, stride);
+		dump_add_range(fd, d, 0xb4, 0xbb, stride);
+		dump_add_range(fd, d, 0x3000, 0x300c, stride);
+	} else {
+		/* unknown chip, dump 0-0xff by default */
+		dump_add_range(fd, d, 0, 0xff, stride);
+	}
+}
+
+static void dump_read(int fd, struct chip_dump &d)
+{
+	struct v4l2_dbg_register reg = {};
+
+	reg.match = d.match;
+	for (auto &v : d.values) {
+		reg.reg = v.reg;
+		if (ioctl(fd, VIDIOC_DBG_G_REGISTER, &reg) < 0) {
+			v.err = errno;
+		} else {
+			v.val = reg.val;
+			v.err = 0;
+		}
+	}
+}
+
+static void dump_read_all(int fd, std::vector<chip_dump> &dumps, bool parallel)
+{
+	std::vector<std::thread> threads;
+
+	if (!parallel || dumps.size() < 2) {
+		for (auto &d : dumps)
+			dump_read(fd, d);
+		return;
+	}
+
+	for (auto &d : dumps)
+		threads.emplace_back(dump_read, fd, std::ref(d));
+	for (auto &t : threads)
+		t.join();
+}
+
+static void print_range(const struct chip_dump &d, const struct reg_range &r)
+{
+	unsigned long mask = r.stride > 2 ? 0x1f : 0x0f;
+	size_t n = r.first;
+	int line = 0;
+
+	for (unsigned long i = r.min & ~mask; i <= r.max; i += r.stride) {
+		if ((i & mask) == 0 && line % 32 == 0) {
+			if (r.stride == 4)
+				printf("\n                00       04       08       0C       10       14       18       1C");
+			else if (r.stride == 2)
+				printf("\n            00   02   04   06   08   0A   0C   0E");
+			else
+				printf("\n          00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F");
+		}
+
+		if ((i & mask) == 0) {
+			printf("\n%08lx: ", i);
+			line++;
+		}
+		if (i < r.min) {
+			printf("%*s ", 2 * r.stride, "");
+			continue;
+		}
+		const struct reg_value &v = d.values[n++];
+		if (v.err) {
+			fprintf(stderr, "ioctl: VIDIOC_DBG_G_REGISTER failed: %s\n",
+				strerror(v.err));
+			break;
+		}
+		printf("%0*llx ", 2 * r.stride, v.val);
+	}
+	printf("\n");
+}
+
+static void dump_print(const struct chip_dump &d, bool compact)
+{
+	if (compact) {
+		for (const auto &v : d.values)
+			if (!v.err)
+				printf("%s 0x%08llx 0x%llx\n", d.label.c_str(), v.reg, v.val);
+		return;
+	}
+
+	if (!d.named) {
+		for (const auto &r : d.ranges)
+			print_range(d, r);
+		return;
+	}
+
+	for (const auto &v : d.values) {
+		if (v.err)
+			fprintf(stderr, "ioctl: VIDIOC_DBG_G_REGISTER "
+					"failed for 0x%llx\n", v.reg);
+		else
+			print_named_reg(d.bd, v.reg, v.val);
+	}
+}
+
+/* Reads a --compact dump, indexed by chip and register */
+static bool dump_load(const char *fname,
+		      std::map<std::pair<std::string, unsigned long long>,
+			       unsigned long long> &saved)
+{
+	char label[32];
+	unsigned long long reg, val;
+	char line[128];
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%31s %llx %llx", label, &reg, &val) == 3)
+			saved[{ label, reg }] = val;
+	}
+	fclose(f);
+	return true;
+}
+
+static void print_change(const struct chip_dump &d, const struct reg_value &v,
+			 unsigned long long old, bool timestamp)
+{
+	if (timestamp) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		printf("%ld.%03ld: ", ts.tv_sec, ts.tv_nsec / 1000000);
+	}
+	printf("%s 0x%08llx: 0x%llx -> 0x%llx\n", d.label.c_str(), v.reg, old, v.val);
+}
+
 static int parse_subopt(char **subs, const char * const *subopts, char **value)
 {
 	int opt = v4l_getsubopt(subs, const_cast<char * const *>(subopts), value);
@@ -337,10 +618,11 @@ int main(int argc, char **argv)
 	int idx = 0;
 	std::string reg_min_arg, reg_max_arg;
 	std::string reg_set_arg;
-	unsigned long long reg_min = 0, reg_max = 0;
 	std::vector<std::string> get_regs;
+	std::vector<struct v4l2_dbg_match> dump_matches;
+	const char *diff_file = nullptr;
+	unsigned long watch_ms = 1000;
 	struct v4l2_dbg_match match;
-	char *p;
 
 	match.type = V4L2_CHIP_MATCH_BRIDGE;
 	match.addr = 0;
@@ -403,15 +685,23 @@ int main(int argc, char **argv)
 			if (!memcmp(optarg, "subdev", 6) && isdigit(optarg[6])) {
 				match.type = V4L2_CHIP_MATCH_SUBDEV;
 				match.addr = strtoul(optarg + 6, nullptr, 0);
-				break;
-			}
-			if (!memcmp(optarg, "bridge", 6)) {
+			} else if (!memcmp(optarg, "bridge", 6)) {
 				match.type = V4L2_CHIP_MATCH_BRIDGE;
 				match.addr = strtoul(optarg + 6, nullptr, 0);
-				break;
+			} else {
+				match.type = V4L2_CHIP_MATCH_BRIDGE;
+				match.addr = 0;
 			}
-			match.type = V4L2_CHIP_MATCH_BRIDGE;
-			match.addr = 0;
+			dump_matches.push_back(match);
+			break;
+
+		case OptDiffRegisters:
+			diff_file = optarg;
+			break;
+
+		case OptWatchRegisters:
+			if (optarg)
+				watch_ms = strtoul(optarg, nullptr, 0);
 			break;
 
 		case OptSetRegister:
@@ -490,17 +780,7 @@ int main(int argc, char **argv)
 		chip_info.match = match;
 		if (doioctl(fd, VIDIOC_DBG_G_CHIP_INFO, &chip_info, "VIDIOC_DBG_G_CHIP_INFO") != 0)
 			chip_info.name[0] = '\0';
-
-		if (!strncasecmp(match.name, "ac97", 4)) {
-			curr_bd = &boards[AC97_BOARD];
-		} else {
-			for (size_t board = boards.size(); board; board--) {
-				if (!strcasecmp(chip_info.name, boards[board - 1].name)) {
-					curr_bd = &boards[board - 1];
-					break;
-				}
-			}
-		}
+		curr_bd = find_board(match, chip_info.name);
 	}
 
 	/* Set options */
@@ -584,102 +864,62 @@ int main(int argc, char **argv)
 	}
 
 	if (options[OptListRegisters]) {
-		std::string name;
-		int stride = 1;
+		std::vector<chip_dump> dumps;
 
-		get_reg.match = match;
-		if (forcedstride) {
-			stride = forcedstride;
-		} else if (get_reg.match.type == V4L2_CHIP_MATCH_BRIDGE) {
-			stride = 4;
-		}
-		printf("ioctl: VIDIOC_DBG_G_REGISTER\n");
-
-		if (curr_bd) {
-			if (reg_min_arg.empty())
-				reg_min = 0;
-			else
-				reg_min = parse_reg(curr_bd, reg_min_arg);
-
-
-			if (reg_max_arg.empty())
-				reg_max = (1ll << 32) - 1;
-			else
-				reg_max = parse_reg(curr_bd, reg_max_arg);
+		if (dump_matches.empty())
+			dump_matches.push_back(match);
+		for (const auto &m : dump_matches) {
+			struct chip_dump d;
 
-			for (const auto &curr : curr_bd->regs) {
-				if (reg_min_arg.empty() || ((curr.reg >= reg_min) && curr.reg <= reg_max)) {
-					get_reg.reg = curr.reg;
+			d.match = m;
+			dump_setup(fd, d, options[OptChip], reg_min_arg,
+				   reg_max_arg, forcedstride);
+			dumps.push_back(d);
+		}
 
-					if (ioctl(fd, VIDIOC_DBG_G_REGISTER, &get_reg) < 0)
-						fprintf(stderr, "ioctl: VIDIOC_DBG_G_REGISTER "
-								"failed for 0x%llx\n", get_reg.reg);
-					else {
-						const char *name = reg_name(curr_bd, get_reg.reg);
+		dump_read_all(fd, dumps, options[OptParallel]);
 
-						printf("Register ");
+		if (options[OptDiffRegisters]) {
+			std::map<std::pair<std::string, unsigned long long>,
+				 unsigned long long> saved;
 
-						if (name)
-							printf("%s (0x%08llx)", name, get_reg.reg);
-						else
-							printf("0x%08llx", get_reg.reg);
+			if (!dump_load(diff_file, saved))
+				std::exit(EXIT_FAILURE);
+			for (const auto &d : dumps) {
+				for (const auto &v : d.values) {
+					auto it = saved.find({ d.label, v.reg });
 
-						printf(" = %llxh (%lldd  %sb)\n",
-							get_reg.val, get_reg.val, binary(get_reg.val));
-					}
+					if (!v.err && it != saved.end() && it->second != v.val)
+						print_change(d, v, it->second, false);
 				}
 			}
-			goto list_done;
+		} else {
+			if (!options[OptCompact])
+				printf("ioctl: VIDIOC_DBG_G_REGISTER\n");
+			for (const auto &d : dumps) {
+				if (!options[OptCompact] && dumps.size() > 1)
+					printf("\n%s:\n", d.label.c_str());
+				dump_print(d, options[OptCompact]);
+			}
 		}
 
-		if (!reg_min_arg.empty()) {
-			reg_min = parse_reg(curr_bd, reg_min_arg);
-			if (reg_max_arg.empty())
-				reg_max = reg_min + 0xff;
-			else
-				reg_max = parse_reg(curr_bd, reg_max_arg);
-			/* Explicit memory range: just do it */
-			print_regs(fd, &get_reg, reg_min, reg_max, stride);
-			goto list_done;
-		}
+		while (options[OptWatchRegisters]) {
+			std::vector<chip_dump> prev = dumps;
 
-		p = std::strchr(chip_info.name, ' ');
-		if (p)
-			*p = '\0';
-		name = chip_info.name;
-
-		if (name == "saa7115") {
-			print_regs(fd, &get_reg, 0, 0xff, stride);
-		} else if (name == "saa717x") {
-			// FIXME: use correct reg regions
-			print_regs(fd, &get_reg, 0, 0xff, stride);
-		} else if (name == "saa7127") {
-			print_regs(fd, &get_reg, 0, 0x7f, stride);
-		} else if (name == "ov7670") {
-			print_regs(fd, &get_reg, 0, 0x89, stride);
-		} else if (name == "cx25840") {
-			print_regs(fd, &get_reg, 0, 2, stride);
-			print_regs(fd, &get_reg, 0x100, 0x15f, stride);
-			print_regs(fd, &get_reg, 0x200, 0x23f, stride);
-			print_regs(fd, &get_reg, 0x400, 0x4bf, stride);
-			print_regs(fd, &get_reg, 0x800, 0x9af, stride);
-		} else if (name == "cs5345") {
-			print_regs(fd, &get_reg, 1, 0x10, stride);
-		} else if (name == "cx23416") {
-			print_regs(fd, &get_reg, 0x02000000, 0x020000ff, stride);
-		} else if (name == "cx23418") {
-			print_regs(fd, &get_reg, 0x02c40000, 0x02c409c7, stride);
-		} else if (name == "cafe") {
-			print_regs(fd, &get_reg, 0, 0x43, stride);
-			print_regs(fd, &get_reg, 0x88, 0x8f, stride);
-			print_regs(fd, &get_reg, 0xb4, 0xbb, stride);
-			print_regs(fd, &get_reg, 0x3000, 0x300c, stride);
-		} else {
-			/* unknown chip, dump 0-0xff by default */
-			print_regs(fd, &get_reg, 0, 0xff, stride);
+			fflush(stdout);
+			usleep(watch_ms * 1000);
+			dump_read_all(fd, dumps, options[OptParallel]);
+			for (size_t i = 0; i < dumps.size(); i++) {
+				for (size_t n = 0; n < dumps[i].values.size(); n++) {
+					const struct reg_value &v = dumps[i].values[n];
+					const struct reg_value &old = prev[i].values[n];
+
+					if (!v.err && !old.err && v.val != old.val)
+						print_change(dumps[i], v, old.val, true);
+				}
+			}
 		}
 	}
-list_done:
 
 	if (options[OptLogStatus]) {
 		static char buf[40960];
@@ -5,6 +5,7 @@
 
 #include "trace.h"
 #include <dlfcn.h>
+#include <signal.h>
 #include <stdarg.h>
 
 extern struct trace_context ctx_trace;
@@ -59,6 +60,93 @@ const std::list<unsigned long> ioctls = {
 	MEDIA_REQUEST_IOC_REINIT,
 };
 
+/* The original functions, resolved once instead of on every call. */
+static struct {
+	int (*open)(const char *path, int oflag, ...);
+	int (*open64)(const char *path, int oflag, ...);
+	ssize_t (*write)(int fd, const void *buf, size_t count);
+	int (*close)(int fd);
+	void *(*mmap)(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+	void *(*mmap64)(void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+	int (*munmap)(void *start, size_t length);
+	int (*ioctl)(int fd, unsigned long cmd, ...);
+	int (*dup)(int fd);
+} original;
+
+/*
+ * Traced ioctls indexed by ioctl type and number. An ioctl is traced if the
+ * command at its index is the same command. Only V4L2 and media ioctls are traced.
+ */
+static unsigned long traced_ioctls[2][256];
+
+static inline bool is_traced_ioctl(unsigned long cmd)
+{
+	int type;
+
+	switch (_IOC_TYPE(cmd)) {
+	case 'V':
+		type = 0;
+		break;
+	case '|':
+		type = 1;
+		break;
+	default:
+		return false;
+	}
+	return traced_ioctls[type][_IOC_NR(cmd)] == cmd;
+}
+
+/*
+ * Toggle tracing with SIGUSR2, e.g. to only trace the part of a long running
+ * application that shows a problem.
+ */
+static void pause_trace_sig_handler(int)
+{
+	toggle_trace_pause();
+}
+
+static void resolve_original_functions(void)
+{
+	original.open = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open");
+	original.open64 = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open64");
+	original.write = (ssize_t (*)(int, const void *, size_t)) dlsym(RTLD_NEXT, "write");
+	original.close = (int (*)(int)) dlsym(RTLD_NEXT, "close");
+	original.mmap = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap");
+	original.mmap64 = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap64");
+	original.munmap = (int(*)(void *, size_t)) dlsym(RTLD_NEXT, "munmap");
+	original.dup = (int(*)(int)) dlsym(RTLD_NEXT, "dup");
+	/* The ioctl wrapper checks this one to know if all are resolved. */
+	__atomic_store_n(&original.ioctl,
+	                 (int (*)(int, long unsigned int, ...)) dlsym(RTLD_NEXT, "ioctl"),
+	                 __ATOMIC_RELEASE);
+}
+
+/*
+ * A wrapper can be called before the library constructor ran, e.g. from the
+ * constructor of another library, so the original functions are looked up then.
+ */
+#define ORIGINAL(func) \
+	(__atomic_load_n(&original.ioctl, __ATOMIC_ACQUIRE) ? \
+	 original.func : (resolve_original_functions(), original.func))
+
+__attribute__((constructor))
+static void libv4l2tracer_init(void)
+{
+	resolve_original_functions();
+	read_trace_options();
+
+	for (unsigned long cmd : ioctls)
+		traced_ioctls[_IOC_TYPE(cmd) == 'V' ? 0 : 1][_IOC_NR(cmd)] = cmd;
+
+	struct sigaction act = {};
+	sigaction(SIGUSR2, nullptr, &act);
+	if (act.sa_handler == SIG_DFL) {
+		act.sa_handler = pause_trace_sig_handler;
+		act.sa_flags = SA_RESTART;
+		sigaction(SIGUSR2, &act, nullptr);
+	}
+}
+
 int open(const char *path, int oflag, ...)
 {
 	errno = 0;
@@ -71,18 +159,17 @@ int open(const char *path, int oflag, ...)
 		va_end(argp);
 	}
 
-	int (*original_open)(const char *path, int oflag, ...) = nullptr;
-	original_open = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open");
-	int fd = (*original_open)(path, oflag, mode);
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	int fd = ORIGINAL(open)(path, oflag, mode);
+	time.end_ns = get_time_ns();
 	debug_line_info("\n\tfd: %d, path: %s", fd, path);
 
-	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr || !ctx_trace.init)
+	if (!is_video_or_media_device(path) || is_trace_paused() || !ctx_trace.init)
 		return fd;
 
-	if (is_video_or_media_device(path)) {
-		trace_open(fd, path, oflag, mode, false);
-		add_device(fd, path);
-	}
+	trace_open(fd, path, oflag, mode, false, time);
+	add_device(fd, path);
 	print_devices();
 
 	return fd;
@@ -90,16 +177,14 @@ int open(const char *path, int oflag, ...)
 
 ssize_t write(int fd, const void *buf, size_t count)
 {
-	ssize_t (*original_write)(int fd, const void *buf, size_t count) = nullptr;
-	original_write = (ssize_t (*)(int, const void *, size_t)) dlsym(RTLD_NEXT, "write");
-	ssize_t ret = (*original_write)(fd, buf, count);
+	ssize_t ret = ORIGINAL(write)(fd, buf, count);
 
 	/*
 	 * If the write message starts with "v4l2-tracer", then assume it came from the
 	 * v4l2_tracer_info macro and trace it.
 	 */
-	std::string buf_string(static_cast<const char*>(buf), count);
-	if (buf_string.find("v4l2-tracer") == 0) {
+	const char prefix[] = "v4l2-tracer";
+	if (count >= strlen(prefix) && !strncmp(static_cast<const char*>(buf), prefix, strlen(prefix))) {
 		json_object *write_obj = json_object_new_object();
 		json_object_object_add(write_obj, "write", json_object_new_string((const char*)buf));
 		write_json_object_to_json_file(write_obj);
@@ -121,18 +206,17 @@ int open64(const char *path, int oflag, ...)
 		va_end(argp);
 	}
 
-	int (*original_open64)(const char *path, int oflag, ...) = nullptr;
-	original_open64 = (int (*)(const char*, int, ...)) dlsym(RTLD_NEXT, "open64");
-	int fd = (*original_open64)(path, oflag, mode);
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	int fd = ORIGINAL(open64)(path, oflag, mode);
+	time.end_ns = get_time_ns();
 	debug_line_info("\n\tfd: %d, path: %s", fd, path);
 
-	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr || !ctx_trace.init)
+	if (!is_video_or_media_device(path) || is_trace_paused() || !ctx_trace.init)
 		return fd;
 
-	if (is_video_or_media_device(path)) {
-		add_device(fd, path);
-		trace_open(fd, path, oflag, mode, true);
-	}
+	add_device(fd, path);
+	trace_open(fd, path, oflag, mode, true, time);
 	print_devices();
 
 	return fd;
@@ -142,20 +226,23 @@ int open64(const char *path, int oflag, ...)
 int close(int fd)
 {
 	errno = 0;
-	int (*original_close)(int fd) = nullptr;
-	original_close = (int (*)(int)) dlsym(RTLD_NEXT, "close");
-
-	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr || !ctx_trace.init)
-		return (*original_close)(fd);
+	if (is_trace_paused() || !ctx_trace.init)
+		return ORIGINAL(close)(fd);
 
 	std::string path = get_device(fd);
 	debug_line_info("\n\tfd: %d, path: %s", fd, path.c_str());
 
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	int ret = ORIGINAL(close)(fd);
+	time.end_ns = get_time_ns();
+
 	/* Only trace the close if a corresponding open was also traced. */
 	if (!path.empty()) {
 		json_object *close_obj = json_object_new_object();
 		json_object_object_add(close_obj, "fd", json_object_new_int(fd));
 		json_object_object_add(close_obj, "close", json_object_new_string(path.c_str()));
+		trace_syscall_time(close_obj, time);
 		write_json_object_to_json_file(close_obj);
 		json_object_put(close_obj);
 		ctx_trace.devices.erase(fd);
@@ -166,15 +253,16 @@ int close(int fd)
 	}
 	print_devices();
 
-	return (*original_close)(fd);
+	return ret;
 }
 
 void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 {
 	errno = 0;
-	void *(*original_mmap)(void *addr, size_t len, int prot, int flags, int fildes, off_t off) = nullptr;
-	original_mmap = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap");
-	void *buf_address_pointer = (*original_mmap)(addr, len, prot, flags, fildes, off);
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	void *buf_address_pointer = ORIGINAL(mmap)(addr, len, prot, flags, fildes, off);
+	time.end_ns = get_time_ns();
 
 	if (!ctx_trace.init)
 		return buf_address_pointer;
@@ -182,7 +270,8 @@ void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 	set_buffer_address_trace(fildes, off, (unsigned long) buf_address_pointer);
 
 	if (buffer_in_trace_context(fildes, off))
-		trace_mmap(addr, len, prot, flags, fildes, off, (unsigned long) buf_address_pointer, false);
+		trace_mmap(addr, len, prot, flags, fildes, off, (unsigned long) buf_address_pointer, false,
+		           time);
 
 	return buf_address_pointer;
 }
@@ -191,9 +280,10 @@ void *mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 void *mmap64(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 {
 	errno = 0;
-	void *(*original_mmap64)(void *addr, size_t len, int prot, int flags, int fildes, off_t off) = nullptr;
-	original_mmap64 = (void*(*)(void*, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap64");
-	void *buf_address_pointer = (*original_mmap64)(addr, len, prot, flags, fildes, off);
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	void *buf_address_pointer = ORIGINAL(mmap64)(addr, len, prot, flags, fildes, off);
+	time.end_ns = get_time_ns();
 
 	if (!ctx_trace.init)
 		return buf_address_pointer;
@@ -201,7 +291,8 @@ void *mmap64(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 	set_buffer_address_trace(fildes, off, (unsigned long) buf_address_pointer);
 
 	if (buffer_in_trace_context(fildes, off))
-		trace_mmap(addr, len, prot, flags, fildes, off, (unsigned long) buf_address_pointer, true);
+		trace_mmap(addr, len, prot, flags, fildes, off, (unsigned long) buf_address_pointer, true,
+		           time);
 
 	return buf_address_pointer;
 }
@@ -210,9 +301,10 @@ void *mmap64(void *addr, size_t len, int prot, int flags, int fildes, off_t off)
 int munmap(void *start, size_t length)
 {
 	errno = 0;
-	int(*original_munmap)(void *start, size_t length) = nullptr;
-	original_munmap = (int(*)(void *, size_t)) dlsym(RTLD_NEXT, "munmap");
-	int ret = (*original_munmap)(start, length);
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	int ret = ORIGINAL(munmap)(start, length);
+	time.end_ns = get_time_ns();
 
 	if (!ctx_trace.init)
 		return ret;
@@ -230,6 +322,7 @@ int munmap(void *start, size_t length)
 	json_object_object_add(munmap_args, "start", json_object_new_int64((int64_t)start));
 	json_object_object_add(munmap_args, "length", json_object_new_uint64(length));
 	json_object_object_add(munmap_obj, "munmap", munmap_args);
+	trace_syscall_time(munmap_obj, time);
 
 	write_json_object_to_json_file(munmap_obj);
 	json_object_put(munmap_obj);
@@ -245,14 +338,10 @@ int ioctl(int fd, unsigned long cmd, ...)
 	void *arg = va_arg(argp, void *);
 	va_end(argp);
 
-	int (*original_ioctl)(int fd, unsigned long cmd, ...) = nullptr;
-	original_ioctl = (int (*)(int, long unsigned int, ...)) dlsym(RTLD_NEXT, "ioctl");
-
-	if (getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr || !ctx_trace.init)
-		return (*original_ioctl)(fd, cmd, arg);
+	int (*original_ioctl)(int fd, unsigned long cmd, ...) = ORIGINAL(ioctl);
 
 	/* Don't trace ioctls that are not in the specified ioctls list. */
-	if (find(ioctls.begin(), ioctls.end(), cmd) == ioctls.end())
+	if (!is_traced_ioctl(cmd) || is_trace_paused() || !ctx_trace.init)
 		return (*original_ioctl)(fd, cmd, arg);
 
 	json_object *ioctl_obj = json_object_new_object();
@@ -261,8 +350,12 @@ int ioctl(int fd, unsigned long cmd, ...)
 	                       json_object_new_string(val2s(cmd, ioctl_val_def).c_str()));
 
 	/* Don't attempt to trace a nullptr. */
+	struct syscall_time time;
 	if (arg == nullptr) {
+		time.start_ns = get_time_ns();
 		int ret = (*original_ioctl)(fd, cmd, arg);
+		time.end_ns = get_time_ns();
+		trace_syscall_time(ioctl_obj, time);
 		if (errno)
 			json_object_object_add(ioctl_obj, "errno",
 			                       json_object_new_string(STRERR(errno)));
@@ -284,7 +377,7 @@ int ioctl(int fd, unsigned long cmd, ...)
 	 * or if the option to trace them is selected.
 	 */
 	if (((cmd & IOC_INOUT) == IOC_IN) ||
-		(getenv("V4L2_TRACER_OPTION_TRACE_USERSPACE_ARG") != nullptr) ||
+		trace_opts.trace_userspace_arg ||
 		(cmd == VIDIOC_QBUF)) {
 		json_object *ioctl_args_userspace = trace_ioctl_args(cmd, arg);
 		/* Some ioctls won't have arguments to trace e.g. MEDIA_REQUEST_IOC_QUEUE. */
@@ -295,7 +388,10 @@ int ioctl(int fd, unsigned long cmd, ...)
 	}
 
 	/* Make the original ioctl call. */
+	time.start_ns = get_time_ns();
 	int ret = (*original_ioctl)(fd, cmd, arg);
+	time.end_ns = get_time_ns();
+	trace_syscall_time(ioctl_obj, time);
 
 	if (errno)
 		json_object_object_add(ioctl_obj, "errno", json_object_new_string(STRERR(errno)));
@@ -335,13 +431,15 @@ int ioctl(int fd, unsigned long cmd, ...)
 int dup(int fd) {
 	errno = 0;
 
-	int (*original_dup)(int fd) = (int(*)(int)) dlsym(RTLD_NEXT, "dup");
-
-	int dup_fd = (*original_dup)(fd);
+	struct syscall_time time;
+	time.start_ns = get_time_ns();
+	int dup_fd = ORIGINAL(dup)(fd);
+	time.end_ns = get_time_ns();
 
 	json_object *dup_obj = json_object_new_object();
 	json_object_object_add(dup_obj, "fd", json_object_new_int(fd));
 	json_object_object_add(dup_obj, "dup", json_object_new_int(dup_fd));
+	trace_syscall_time(dup_obj, time);
 	write_json_object_to_json_file(dup_obj);
 	json_object_put(dup_obj);
 
@@ -171,40 +171,66 @@ std::string get_path_retrace_from_path_trace(std::string path_trace, json_object
 	return "";
 }
 
-void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj)
+/*
+ * Get the payload of a memory dump: the raw data of a binary trace record or the
+ * "mem_array" of a JSON object. A payload that refers to an earlier memory dump
+ * is looked up by its hash. The payload is returned compressed if it was traced
+ * compressed.
+ */
+struct trace_mem_payload get_mem_payload(json_object *mem_obj, const unsigned char *data,
+                                         size_t data_len)
 {
-	int byteswritten = 0;
-	const int hex_base = 16;
-	json_object *line_obj;
-	size_t number_of_lines;
-	std::string compressed_video_data;
-
-	json_object *mem_array_obj;
-	json_object_object_get_ex(mem_obj, "mem_array", &mem_array_obj);
-	number_of_lines = json_object_array_length(mem_array_obj);
-
-	for (long unsigned int i = 0; i < number_of_lines; i++) {
-		line_obj = json_object_array_get_idx(mem_array_obj, i);
-		if (json_object_get_string(line_obj) != nullptr)
-			compressed_video_data = json_object_get_string(line_obj);
-
-		for (long unsigned i = 0; i < compressed_video_data.length(); i++) {
-			if (std::isspace(compressed_video_data[i]) != 0)
-				continue;
-			try {
-				/* Two values from the string e.g. "D9" are needed to write one byte. */
-				*buffer_pointer = (char) std::stoi(compressed_video_data.substr(i,2), nullptr, hex_base);
-				buffer_pointer++;
-				i++;
-				byteswritten++;
-			} catch (std::invalid_argument& ia) {
-				line_info("\n\t\'%s\' is an invalid argument.\n",
-				          compressed_video_data.substr(i,2).c_str());
-			} catch (std::out_of_range& oor) {
-				line_info("\n\t\'%s\' is out of range.\n",
-				          compressed_video_data.substr(i,2).c_str());
-			}
+	struct trace_mem_payload payload;
+	json_object *hash_obj = nullptr;
+	json_object *ref_obj;
+	json_object *compression_obj;
+
+	json_object_object_get_ex(mem_obj, "mem_hash", &hash_obj);
+	std::string hash = hash_obj ? json_object_get_string(hash_obj) : "";
+
+	if (json_object_object_get_ex(mem_obj, "mem_ref", &ref_obj) &&
+	    json_object_get_boolean(ref_obj)) {
+		struct trace_mem_payload *cached = ctx_retrace.mem_dumps.find(hash);
+		if (cached == nullptr) {
+			line_info("\n\tWarning: can't find payload \'%s\'.", hash.c_str());
+			return payload;
+		}
+		return *cached;
+	}
+
+	if (data != nullptr)
+		payload.data.assign(data, data + data_len);
+	else
+		payload.data = mem_array_to_buffer(mem_obj);
+	if (json_object_object_get_ex(mem_obj, "mem_compression", &compression_obj))
+		payload.compression = json_object_get_string(compression_obj);
+	if (!hash.empty())
+		ctx_retrace.mem_dumps.add(hash, payload);
+	return payload;
+}
+
+void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj,
+                            const unsigned char *data, size_t data_len)
+{
+	static bool warned_partial;
+	struct trace_mem_payload payload = get_mem_payload(mem_obj, data, data_len);
+	json_object *mem_len_obj;
+	size_t mem_len = bytesused;
+
+	if (json_object_object_get_ex(mem_obj, "mem_len", &mem_len_obj))
+		mem_len = json_object_get_int64(mem_len_obj);
+	if (trace_mem_decompress(payload.compression, payload.data, mem_len) < 0)
+		return;
+	int byteswritten = std::min((size_t) bytesused, payload.data.size());
+
+	memcpy(buffer_pointer, payload.data.data(), byteswritten);
+	/* Synthesize the part of the payload that wasn't traced. */
+	if (byteswritten < bytesused) {
+		if (mem_len < (size_t) bytesused && !warned_partial) {
+			line_info("\n\tWarning: the trace has partial memory dumps, the rest is zeroed.");
+			warned_partial = true;
 		}
+		memset(buffer_pointer + byteswritten, 0, bytesused - byteswritten);
 	}
 	debug_line_info("\n\tbytesused: %d, byteswritten: %d", bytesused, byteswritten);
 }
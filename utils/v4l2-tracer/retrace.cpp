@@ -5,6 +5,7 @@
 
 #include "retrace.h"
 #include "linux/videodev2.h"
+#include <climits>
 
 extern struct retrace_context ctx_retrace;
 
@@ -1423,7 +1424,11 @@ void retrace_ioctl(json_object *syscall_obj)
 	}
 }
 
-void retrace_mem(json_object *mem_obj)
+/*
+ * The encoded data is either passed as the raw payload of a binary trace record,
+ * or read from the "mem_array" of the JSON object.
+ */
+void retrace_mem(json_object *mem_obj, const unsigned char *data = nullptr, size_t data_len = 0)
 {
 	json_object *type_obj;
 	json_object_object_get_ex(mem_obj, "mem_dump", &type_obj);
@@ -1447,9 +1452,13 @@ void retrace_mem(json_object *mem_obj)
 
 	unsigned char *buffer_pointer = (unsigned char *) buffer_address_retrace;
 
-	/* Get the encoded data from the json file and write it to output buffer memory. */
+	/* Get the encoded data from the trace file and write it to output buffer memory. */
+	json_object *hash_obj;
 	if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE || type == V4L2_BUF_TYPE_VIDEO_OUTPUT)
-		write_to_output_buffer(buffer_pointer, bytesused, mem_obj);
+		write_to_output_buffer(buffer_pointer, bytesused, mem_obj, data, data_len);
+	else if (json_object_object_get_ex(mem_obj, "mem_hash", &hash_obj))
+		/* Remember the payload in case a later memory dump refers to it. */
+		get_mem_payload(mem_obj, data, data_len);
 
 	debug_line_info("\n\t%s, bytesused: %d, offset: %d, addr: %ld",
 			val2s(type, v4l2_buf_type_val_def).c_str(),
@@ -1520,22 +1529,96 @@ void retrace_object(json_object *jobj)
 	line_info("\n\tWarning: unexpected JSON object in trace file.");
 }
 
-void retrace_array(json_object *root_array_obj)
+/*
+ * Parse the top-level array of the JSON trace file one object at a time and
+ * pass each object to the handler as soon as it is parsed, instead of building
+ * the whole file as a tree of objects first.
+ */
+static int read_json_file(const char *json_str, size_t len, trace_record_handler handler)
 {
-	json_object *jobj;
-	struct array_list *array_list_pointer = json_object_get_array(root_array_obj);
-	size_t json_objects_in_file = array_list_length(array_list_pointer);
+	const char *end = json_str + len;
+	const char *p = json_str;
+	size_t json_objects_in_file = 0;
+	int ret = 0;
+
+	while (p < end && std::isspace(*p))
+		p++;
+	if (p == end || *p != '[') {
+		line_info("\n\tTrace file must contain a JSON array.");
+		return 1;
+	}
+	p++;
+
+	json_tokener *tok = json_tokener_new();
+	while (true) {
+		while (p < end && (std::isspace(*p) || *p == ','))
+			p++;
+		/* The closing bracket is missing if the tracee was killed. */
+		if (p == end || *p == ']')
+			break;
+
+		json_object *jobj = nullptr;
+		enum json_tokener_error jerr;
+		do {
+			int chunk = std::min(end - p, (ptrdiff_t) INT_MAX);
+			jobj = json_tokener_parse_ex(tok, p, chunk);
+			jerr = json_tokener_get_error(tok);
+			p += json_tokener_get_parse_end(tok);
+		} while (jerr == json_tokener_continue && p < end);
+
+		if (jobj == nullptr) {
+			line_info("\n\t%s\tCan't get JSON-object from trace file at offset %zu",
+			          json_tokener_error_desc(jerr), (size_t) (p - json_str));
+			ret = 1;
+			break;
+		}
+		json_tokener_reset(tok);
 
-	if (json_objects_in_file < 3)
+		json_objects_in_file++;
+		handler(jobj, nullptr, 0);
+		json_object_put(jobj);
+	}
+	json_tokener_free(tok);
+
+	if (!ret && json_objects_in_file < 3)
 		line_info("\n\tWarning: trace file may be empty.");
 
-	for (size_t i = 0; i < json_objects_in_file; i++) {
-		jobj = (json_object *) array_list_get_idx(array_list_pointer, i);
-		retrace_object(jobj);
+	return ret;
+}
+
+static int read_bin_file(FILE *trace_file, trace_record_handler handler)
+{
+	struct trace_bin_record record;
+	std::vector<unsigned char> data;
+	json_object *jobj;
+	size_t records_in_file = 0;
+	int ret;
+
+	ret = trace_bin_read_header(trace_file);
+	if (ret < 0)
+		return 1;
+
+	/* Records are read one at a time instead of loading the whole file. */
+	while ((ret = trace_bin_read_record(trace_file, &record, &jobj, data)) > 0) {
+		records_in_file++;
+		if (record.type == TRACE_BIN_MEM)
+			handler(jobj, data.data(), data.size());
+		else
+			handler(jobj, nullptr, 0);
+		json_object_put(jobj);
 	}
+
+	if (ret == 0 && records_in_file < 3)
+		line_info("\n\tWarning: trace file may be empty.");
+
+	return ret < 0 ? 1 : 0;
 }
 
-int retrace(std::string trace_filename)
+/*
+ * Pass each object of a JSON or binary trace file to the handler. The raw payload
+ * of a binary memory dump record is passed as data, otherwise data is nullptr.
+ */
+int read_trace_file(std::string trace_filename, trace_record_handler handler)
 {
 	struct stat sb;
 	if (stat(trace_filename.c_str(), &sb) == -1) {
@@ -1543,19 +1626,93 @@ int retrace(std::string trace_filename)
 		return -EINVAL;
 	}
 
-	fprintf(stderr, "Retracing: %s\n", trace_filename.c_str());
+	if (is_trace_bin_file(trace_filename)) {
+		FILE *trace_file = fopen(trace_filename.c_str(), "r");
+		if (trace_file == nullptr) {
+			line_info("\n\tCan't open \'%s\'", trace_filename.c_str());
+			return 1;
+		}
+		int ret = read_bin_file(trace_file, handler);
+		fclose(trace_file);
+		return ret;
+	}
 
-	json_object *root_array_obj = json_object_from_file(trace_filename.c_str());
+	if (sb.st_size == 0) {
+		line_info("\n\tTrace file is empty: \'%s\'", trace_filename.c_str());
+		return 1;
+	}
 
-	if (root_array_obj == nullptr) {
-		line_info("\n\t%s\tCan't get JSON-object from file: %s",
-			  json_util_get_last_err(),
-			  trace_filename.c_str());
+	int fd = open(trace_filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		line_info("\n\tCan't open \'%s\'", trace_filename.c_str());
 		return 1;
 	}
 
-	retrace_array(root_array_obj);
-	json_object_put(root_array_obj);
+	void *json_str = mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (json_str == MAP_FAILED) {
+		line_info("\n\tCan't map \'%s\'", trace_filename.c_str());
+		return 1;
+	}
+	/* Each part of the file is only parsed once. */
+	madvise(json_str, sb.st_size, MADV_SEQUENTIAL);
+
+	int ret = read_json_file((const char *) json_str, sb.st_size, handler);
+	munmap(json_str, sb.st_size);
+
+	return ret;
+}
+
+/*
+ * Wait until as much time has passed since the first traced system call as had
+ * passed in the trace, so that the gaps between system calls are the same.
+ */
+static void retrace_wait(json_object *jobj)
+{
+	static __u64 trace_start_ns;
+	static __u64 retrace_start_ns;
+	json_object *time_obj;
+
+	if (!json_object_object_get_ex(jobj, "time_ns", &time_obj))
+		return;
+
+	__u64 time_ns = json_object_get_uint64(time_obj);
+	if (!retrace_start_ns) {
+		trace_start_ns = time_ns;
+		retrace_start_ns = get_time_ns();
+		return;
+	}
+	if (time_ns <= trace_start_ns)
+		return;
+
+	__u64 wait_until_ns = retrace_start_ns + (time_ns - trace_start_ns);
+	struct timespec ts;
+	ts.tv_sec = wait_until_ns / 1000000000ULL;
+	ts.tv_nsec = wait_until_ns % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+		;
+}
+
+static void retrace_record(json_object *jobj, const unsigned char *data, size_t data_len)
+{
+	if (getenv("V4L2_TRACER_OPTION_TIMING") != nullptr)
+		retrace_wait(jobj);
+
+	if (data != nullptr)
+		retrace_mem(jobj, data, data_len);
+	else
+		retrace_object(jobj);
+}
+
+int retrace(std::string trace_filename)
+{
+	struct stat sb;
+	if (stat(trace_filename.c_str(), &sb) == -1) {
+		line_info("\n\tTrace file error: \'%s\'", trace_filename.c_str());
+		return -EINVAL;
+	}
+
+	fprintf(stderr, "Retracing: %s\n", trace_filename.c_str());
 
-	return 0;
+	return read_trace_file(trace_filename, retrace_record);
 }
@@ -8,6 +8,7 @@
 
 #include "v4l2-tracer-common.h"
 #include "retrace-gen.h"
+#include "trace-bin.h"
 
 struct buffer_retrace {
 	int fd;
@@ -23,9 +24,17 @@ struct retrace_context {
 	std::unordered_map<int, int> retrace_fds;
 	/* List of output and capture buffers being retraced. */
 	std::list<struct buffer_retrace> buffers;
+	/* Payloads of the last memory dumps, looked up by hash. */
+	struct trace_mem_cache mem_dumps;
 };
 
+typedef void (*trace_record_handler)(json_object *jobj, const unsigned char *data,
+                                     size_t data_len);
+
+int read_trace_file(std::string trace_filename, trace_record_handler handler);
 int retrace(std::string trace_filename);
+int export_perfetto(std::string trace_filename);
+int stats(std::string trace_filename);
 
 bool buffer_in_retrace_context(int fd, __u32 offset = 0);
 int get_buffer_fd_retrace(__u32 type, __u32 index);
@@ -36,7 +45,10 @@ long get_retrace_address_from_trace_address(long address_trace);
 void add_fd(int fd_trace, int fd_retrace);
 int get_fd_retrace_from_fd_trace(int fd_trace);
 std::string get_path_retrace_from_path_trace(std::string path_trace, json_object *jobj);
-void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj);
+struct trace_mem_payload get_mem_payload(json_object *mem_obj, const unsigned char *data,
+                                         size_t data_len);
+void write_to_output_buffer(unsigned char *buffer_pointer, int bytesused, json_object *mem_obj,
+                            const unsigned char *data = nullptr, size_t data_len = 0);
 void compare_program_versions(json_object *v4l2_tracer_info_obj);
 void print_context(void);
 
@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#include "trace-bin.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+bool is_binary_trace(void)
+{
+	return (getenv("V4L2_TRACER_OPTION_BINARY") != nullptr);
+}
+
+bool is_trace_bin_file(std::string trace_filename)
+{
+	struct trace_bin_header header = {};
+
+	FILE *fp = fopen(trace_filename.c_str(), "r");
+	if (fp == nullptr)
+		return false;
+	size_t count = fread(&header, sizeof(header), 1, fp);
+	fclose(fp);
+
+	return count == 1 && !memcmp(header.magic, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC));
+}
+
+std::string trace_file_extension(void)
+{
+	return is_binary_trace() ? TRACE_BIN_EXTENSION : ".json";
+}
+
+int trace_bin_write_header(FILE *fp)
+{
+	struct trace_bin_header header = {};
+
+	memcpy(header.magic, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC));
+	header.version = TRACE_BIN_VERSION;
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		return -EIO;
+	return 0;
+}
+
+enum trace_bin_record_type get_record_type(json_object *jobj)
+{
+	json_object *temp_obj;
+
+	if (json_object_object_get_ex(jobj, "ioctl", &temp_obj))
+		return TRACE_BIN_IOCTL;
+	if (json_object_object_get_ex(jobj, "mem_dump", &temp_obj))
+		return TRACE_BIN_MEM;
+	if (json_object_object_get_ex(jobj, "open", &temp_obj))
+		return TRACE_BIN_OPEN;
+	if (json_object_object_get_ex(jobj, "open64", &temp_obj))
+		return TRACE_BIN_OPEN64;
+	if (json_object_object_get_ex(jobj, "close", &temp_obj))
+		return TRACE_BIN_CLOSE;
+	if (json_object_object_get_ex(jobj, "dup", &temp_obj))
+		return TRACE_BIN_DUP;
+	if (json_object_object_get_ex(jobj, "mmap", &temp_obj))
+		return TRACE_BIN_MMAP;
+	if (json_object_object_get_ex(jobj, "mmap64", &temp_obj))
+		return TRACE_BIN_MMAP64;
+	if (json_object_object_get_ex(jobj, "munmap", &temp_obj))
+		return TRACE_BIN_MUNMAP;
+	if (json_object_object_get_ex(jobj, "write", &temp_obj))
+		return TRACE_BIN_WRITE;
+	if (json_object_object_get_ex(jobj, "package_version", &temp_obj) ||
+	    json_object_object_get_ex(jobj, "Trace", &temp_obj))
+		return TRACE_BIN_INFO;
+	return TRACE_BIN_OTHER;
+}
+
+int trace_bin_write_record(FILE *fp, json_object *jobj, const unsigned char *data, __u32 data_len)
+{
+	return trace_bin_write_record(fp, get_record_type(jobj),
+	                              json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN),
+	                              data, data_len);
+}
+
+int trace_bin_write_record(FILE *fp, __u32 type, const std::string &json_str,
+                           const unsigned char *data, __u32 data_len)
+{
+	struct trace_bin_record record = {};
+
+	record.type = type;
+	record.json_len = json_str.length();
+	record.data_len = data ? data_len : 0;
+
+	if (fwrite(&record, sizeof(record), 1, fp) != 1 ||
+	    fwrite(json_str.c_str(), sizeof(char), record.json_len, fp) != record.json_len)
+		return -EIO;
+	if (record.data_len && fwrite(data, sizeof(unsigned char), record.data_len, fp) != record.data_len)
+		return -EIO;
+	return 0;
+}
+
+int trace_bin_read_header(FILE *fp)
+{
+	struct trace_bin_header header = {};
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header.magic, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC))) {
+		line_info("\n\tNot a binary trace file.");
+		return -EINVAL;
+	}
+	if (header.version > TRACE_BIN_VERSION) {
+		line_info("\n\tUnsupported binary trace file version: %u", header.version);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Read the next record. Returns 1 if a record was read, 0 at the end of the file
+ * or a negative error code if the file is truncated or the JSON text is invalid.
+ * On success the caller owns *jobj and must release it with json_object_put().
+ */
+int trace_bin_read_record(FILE *fp, struct trace_bin_record *record,
+                          json_object **jobj, std::vector<unsigned char> &data)
+{
+	*jobj = nullptr;
+	data.clear();
+
+	size_t count = fread(record, 1, sizeof(*record), fp);
+	if (count == 0 && feof(fp))
+		return 0;
+	if (count != sizeof(*record)) {
+		line_info("\n\tTruncated binary trace record.");
+		return -EINVAL;
+	}
+
+	std::string json_str(record->json_len, '\0');
+	if (fread(&json_str[0], sizeof(char), record->json_len, fp) != record->json_len) {
+		line_info("\n\tTruncated binary trace record.");
+		return -EINVAL;
+	}
+	data.resize(record->data_len);
+	if (record->data_len &&
+	    fread(data.data(), sizeof(unsigned char), record->data_len, fp) != record->data_len) {
+		line_info("\n\tTruncated binary trace record.");
+		return -EINVAL;
+	}
+
+	*jobj = json_tokener_parse(json_str.c_str());
+	if (*jobj == nullptr) {
+		line_info("\n\tCan't get JSON-object from binary trace record.");
+		return -EINVAL;
+	}
+	return 1;
+}
+
+json_object *trace_buffer(const unsigned char *buffer_pointer, __u32 bytesused)
+{
+	const int MAX_BYTES_PER_LINE = 32;
+	std::string str;
+	int byte_count_per_line = 0;
+	json_object *mem_array_obj = json_object_new_array();
+	bool compact = getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr;
+	const char hex[] = "0123456789abcdef";
+
+	for (__u32 i = 0; i < bytesused; i++) {
+		/* Each byte e.g. D9 will write a string of two characters "D9". */
+		str += hex[buffer_pointer[i] >> 4];
+		str += hex[buffer_pointer[i] & 0xf];
+		byte_count_per_line++;
+
+		/*  Add a newline every 32 bytes. */
+		if (byte_count_per_line == MAX_BYTES_PER_LINE) {
+			byte_count_per_line = 0;
+			json_object_array_add(mem_array_obj, json_object_new_string(str.c_str()));
+			str.clear();
+		} else if (!compact) {
+			/* Add a space every byte e.g. "01 2A 40 01" */
+			str += " ";
+		}
+	}
+
+	/* Trace the last line if it was less than a full line. */
+	if (byte_count_per_line)
+		json_object_array_add(mem_array_obj, json_object_new_string(str.c_str()));
+
+	return mem_array_obj;
+}
+
+std::vector<unsigned char> mem_array_to_buffer(json_object *mem_obj)
+{
+	const int hex_base = 16;
+	json_object *line_obj;
+	size_t number_of_lines;
+	std::string compressed_video_data;
+	std::vector<unsigned char> data;
+
+	json_object *mem_array_obj;
+	if (!json_object_object_get_ex(mem_obj, "mem_array", &mem_array_obj))
+		return data;
+	number_of_lines = json_object_array_length(mem_array_obj);
+
+	for (long unsigned int i = 0; i < number_of_lines; i++) {
+		line_obj = json_object_array_get_idx(mem_array_obj, i);
+		if (json_object_get_string(line_obj) != nullptr)
+			compressed_video_data = json_object_get_string(line_obj);
+
+		for (long unsigned i = 0; i < compressed_video_data.length(); i++) {
+			if (std::isspace(compressed_video_data[i]) != 0)
+				continue;
+			try {
+				/* Two values from the string e.g. "D9" are needed to write one byte. */
+				data.push_back(std::stoi(compressed_video_data.substr(i,2), nullptr, hex_base));
+				i++;
+			} catch (std::invalid_argument& ia) {
+				line_info("\n\t\'%s\' is an invalid argument.\n",
+				          compressed_video_data.substr(i,2).c_str());
+			} catch (std::out_of_range& oor) {
+				line_info("\n\t\'%s\' is out of range.\n",
+				          compressed_video_data.substr(i,2).c_str());
+			}
+		}
+	}
+	return data;
+}
+
+struct trace_mem_payload *trace_mem_cache::find(const std::string &hash)
+{
+	auto it = payloads.find(hash);
+	return it == payloads.end() ? nullptr : &it->second;
+}
+
+void trace_mem_cache::add(const std::string &hash, const struct trace_mem_payload &payload)
+{
+	if (find(hash) != nullptr)
+		return;
+	if (hashes.size() == TRACE_MEM_CACHE_SIZE) {
+		payloads.erase(hashes.front());
+		hashes.pop_front();
+	}
+	hashes.push_back(hash);
+	payloads[hash] = payload;
+}
+
+static inline __u64 rotl64(__u64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+/* A 64-bit hash in the style of MurmurHash3, processing eight bytes at a time. */
+std::string trace_mem_hash(const unsigned char *data, size_t size)
+{
+	const __u64 c1 = 0x87c37b91114253d5ULL;
+	const __u64 c2 = 0x4cf5ad432745937fULL;
+	__u64 h = size;
+	__u64 k;
+	size_t i;
+
+	for (i = 0; i + 8 <= size; i += 8) {
+		memcpy(&k, data + i, sizeof(k));
+		k = rotl64(k * c1, 31) * c2;
+		h = rotl64(h ^ k, 27) * 5 + 0x52dce729;
+	}
+	k = 0;
+	memcpy(&k, data + i, size - i);
+	h ^= rotl64(k * c1, 31) * c2;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	char buf[17];
+	sprintf(buf, "%016llx", (unsigned long long) h);
+	return buf;
+}
+
+/* Compress the payload in place. Returns false if it was left uncompressed. */
+bool trace_mem_compress(std::vector<unsigned char> &data)
+{
+#ifdef HAVE_ZSTD
+	std::vector<unsigned char> compressed(ZSTD_compressBound(data.size()));
+	size_t size = ZSTD_compress(compressed.data(), compressed.size(),
+	                            data.data(), data.size(), ZSTD_CLEVEL_DEFAULT);
+
+	if (ZSTD_isError(size) || size >= data.size())
+		return false;
+	compressed.resize(size);
+	data.swap(compressed);
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* Decompress the payload in place to its original size. */
+int trace_mem_decompress(const std::string &compression, std::vector<unsigned char> &data,
+                         size_t size)
+{
+	if (compression.empty())
+		return 0;
+#ifdef HAVE_ZSTD
+	if (compression == "zstd") {
+		std::vector<unsigned char> decompressed(size);
+		size_t ret = ZSTD_decompress(decompressed.data(), size, data.data(), data.size());
+
+		if (ZSTD_isError(ret)) {
+			line_info("\n\tCan't decompress payload: %s", ZSTD_getErrorName(ret));
+			return -EINVAL;
+		}
+		decompressed.resize(ret);
+		data.swap(decompressed);
+		return 0;
+	}
+#endif
+	line_info("\n\tUnsupported payload compression: \'%s\'", compression.c_str());
+	return -EINVAL;
+}
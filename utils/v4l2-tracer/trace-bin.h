@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#ifndef TRACE_BIN_H
+#define TRACE_BIN_H
+
+#include "v4l2-tracer-common.h"
+
+/*
+ * Binary trace file format
+ *
+ * The binary trace file is an alternative to the JSON trace file that avoids
+ * hex-encoding the video frame data. It starts with a struct trace_bin_header
+ * followed by any number of records. Each record is a struct trace_bin_record
+ * followed by json_len bytes of JSON text (without a terminating NUL) that
+ * describe the system call, exactly as it would appear in the JSON trace file,
+ * followed by data_len bytes of raw buffer memory.
+ *
+ * Only memory dump records carry data: the raw bytes take the place of the
+ * "mem_array" member of the JSON trace file. All fields are in host byte order.
+ */
+
+/*
+ * Memory dump payloads
+ *
+ * Each memory dump gets the "mem_hash" of its buffer memory. If the same memory
+ * was dumped before, the dump only gets "mem_ref" set to true and no payload.
+ * The tracer and the retracer both remember the last TRACE_MEM_CACHE_SIZE
+ * different payloads, so a reference always points to one of those.
+ *
+ * A payload compressed with zstd has "mem_compression" set to "zstd". The
+ * uncompressed size of the payload is "bytesused", or "mem_len" if set.
+ *
+ * A memory dump may also carry only part of the memory, see the --mem_* options.
+ * Then "mem_len" is the size of the payload, the first "mem_len" bytes of the
+ * memory, and "mem_hash" is still the hash of all "bytesused" bytes. If
+ * "mem_len" is 0 there is no payload and no hash. The retracer fills the
+ * memory that wasn't traced with zeros.
+ */
+#define TRACE_MEM_CACHE_SIZE	64
+
+#define TRACE_BIN_MAGIC		"V4L2TRC"
+#define TRACE_BIN_VERSION	1
+#define TRACE_BIN_EXTENSION	".bin"
+
+enum trace_bin_record_type {
+	TRACE_BIN_INFO = 1,
+	TRACE_BIN_OPEN,
+	TRACE_BIN_OPEN64,
+	TRACE_BIN_CLOSE,
+	TRACE_BIN_DUP,
+	TRACE_BIN_MMAP,
+	TRACE_BIN_MMAP64,
+	TRACE_BIN_MUNMAP,
+	TRACE_BIN_IOCTL,
+	TRACE_BIN_MEM,
+	TRACE_BIN_WRITE,
+	TRACE_BIN_OTHER,
+};
+
+struct trace_mem_payload {
+	std::string compression;
+	std::vector<unsigned char> data;
+};
+
+struct trace_mem_cache {
+	std::list<std::string> hashes;
+	std::unordered_map<std::string, struct trace_mem_payload> payloads;
+
+	struct trace_mem_payload *find(const std::string &hash);
+	void add(const std::string &hash, const struct trace_mem_payload &payload);
+};
+
+struct trace_bin_header {
+	char magic[8];
+	__u32 version;
+	__u32 reserved;
+};
+
+struct trace_bin_record {
+	__u32 type;
+	__u32 json_len;
+	__u32 data_len;
+	__u32 reserved;
+};
+
+bool is_binary_trace(void);
+bool is_trace_bin_file(std::string trace_filename);
+std::string trace_file_extension(void);
+int trace_bin_write_header(FILE *fp);
+enum trace_bin_record_type get_record_type(json_object *jobj);
+int trace_bin_write_record(FILE *fp, json_object *jobj,
+                           const unsigned char *data = nullptr, __u32 data_len = 0);
+int trace_bin_write_record(FILE *fp, __u32 type, const std::string &json_str,
+                           const unsigned char *data = nullptr, __u32 data_len = 0);
+int trace_bin_read_header(FILE *fp);
+int trace_bin_read_record(FILE *fp, struct trace_bin_record *record,
+                          json_object **jobj, std::vector<unsigned char> &data);
+json_object *trace_buffer(const unsigned char *buffer_pointer, __u32 bytesused);
+std::vector<unsigned char> mem_array_to_buffer(json_object *mem_obj);
+std::string trace_mem_hash(const unsigned char *data, size_t size);
+bool trace_mem_compress(std::vector<unsigned char> &data);
+int trace_mem_decompress(const std::string &compression, std::vector<unsigned char> &data,
+                         size_t size);
+
+#endif
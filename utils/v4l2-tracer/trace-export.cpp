@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#include "retrace.h"
+
+/*
+ * Export a trace to the Chrome trace event format, which can be opened with
+ * Perfetto or chrome://tracing. Each file descriptor gets its own track with
+ * the system calls made on it, and each buffer gets a span from its QBUF to
+ * its DQBUF.
+ */
+
+static FILE *export_file;
+static bool first_event;
+
+static void write_event(json_object *event_obj)
+{
+	if (!first_event)
+		fputs(",\n", export_file);
+	first_event = false;
+	fputs(json_object_to_json_string_ext(event_obj, JSON_C_TO_STRING_PLAIN), export_file);
+	json_object_put(event_obj);
+}
+
+static json_object *new_event(const char *name, const char *cat, const char *ph,
+                              double ts, int fd)
+{
+	json_object *event_obj = json_object_new_object();
+
+	json_object_object_add(event_obj, "name", json_object_new_string(name));
+	if (cat != nullptr)
+		json_object_object_add(event_obj, "cat", json_object_new_string(cat));
+	json_object_object_add(event_obj, "ph", json_object_new_string(ph));
+	json_object_object_add(event_obj, "ts", json_object_new_double(ts));
+	json_object_object_add(event_obj, "pid", json_object_new_int(1));
+	json_object_object_add(event_obj, "tid", json_object_new_int(fd));
+	return event_obj;
+}
+
+static void export_track_name(int fd, std::string name)
+{
+	json_object *event_obj = new_event("thread_name", nullptr, "M", 0, fd);
+	json_object *args_obj = json_object_new_object();
+
+	json_object_object_add(args_obj, "name", json_object_new_string(name.c_str()));
+	json_object_object_add(event_obj, "args", args_obj);
+	write_event(event_obj);
+}
+
+static const char *ioctl_category(std::string name)
+{
+	if (name == "VIDIOC_QBUF" || name == "VIDIOC_DQBUF" || name == "VIDIOC_PREPARE_BUF")
+		return "buffer";
+	if (name == "VIDIOC_STREAMON" || name == "VIDIOC_STREAMOFF")
+		return "stream";
+	if (name == "VIDIOC_S_CTRL" || name == "VIDIOC_S_EXT_CTRLS" || name == "VIDIOC_TRY_EXT_CTRLS")
+		return "controls";
+	if (name.find("MEDIA_REQUEST_IOC_") == 0 || name == "MEDIA_IOC_REQUEST_ALLOC")
+		return "request";
+	return "ioctl";
+}
+
+/* Start or end the span of the buffer passed to QBUF or returned by DQBUF. */
+static void export_buffer_span(json_object *args_obj, int fd, double ts, bool queue)
+{
+	json_object *buf_obj;
+	json_object *type_obj;
+	json_object *index_obj;
+
+	if (args_obj == nullptr ||
+	    !json_object_object_get_ex(args_obj, "v4l2_buffer", &buf_obj) ||
+	    !json_object_object_get_ex(buf_obj, "type", &type_obj) ||
+	    !json_object_object_get_ex(buf_obj, "index", &index_obj))
+		return;
+
+	std::string type = json_object_get_string(type_obj);
+	if (type.find("V4L2_BUF_TYPE_") == 0)
+		type = type.substr(strlen("V4L2_BUF_TYPE_"));
+	std::string name = type + " " + std::to_string(json_object_get_int(index_obj));
+	std::string id = std::to_string(fd) + " " + name;
+
+	json_object *event_obj = new_event(name.c_str(), "buffer", queue ? "b" : "e", ts, fd);
+	json_object_object_add(event_obj, "id", json_object_new_string(id.c_str()));
+	if (queue) {
+		json_object *args = json_object_new_object();
+		json_object *temp_obj;
+		if (json_object_object_get_ex(buf_obj, "bytesused", &temp_obj))
+			json_object_object_add(args, "bytesused", json_object_get(temp_obj));
+		if (json_object_object_get_ex(buf_obj, "request_fd", &temp_obj))
+			json_object_object_add(args, "request_fd", json_object_get(temp_obj));
+		json_object_object_add(event_obj, "args", args);
+	}
+	write_event(event_obj);
+}
+
+static void export_record(json_object *jobj, const unsigned char *data, size_t data_len)
+{
+	json_object *temp_obj;
+	json_object *fd_obj;
+	json_object *time_obj;
+	json_object *duration_obj;
+
+	if (json_object_object_get_ex(jobj, "Trace", &temp_obj)) {
+		json_object *event_obj = new_event("process_name", nullptr, "M", 0, 0);
+		json_object *args_obj = json_object_new_object();
+		json_object_object_add(args_obj, "name", json_object_get(temp_obj));
+		json_object_object_add(event_obj, "args", args_obj);
+		write_event(event_obj);
+		return;
+	}
+
+	/* Only system calls traced with their timing can be placed on the timeline. */
+	if (!json_object_object_get_ex(jobj, "fd", &fd_obj) ||
+	    !json_object_object_get_ex(jobj, "time_ns", &time_obj) ||
+	    !json_object_object_get_ex(jobj, "duration_ns", &duration_obj))
+		return;
+
+	int fd = json_object_get_int(fd_obj);
+	double ts = json_object_get_uint64(time_obj) / 1000.0;
+	double dur = json_object_get_uint64(duration_obj) / 1000.0;
+	std::string name;
+	const char *cat = "syscall";
+	bool has_errno = json_object_object_get_ex(jobj, "errno", &temp_obj);
+
+	if (json_object_object_get_ex(jobj, "ioctl", &temp_obj)) {
+		name = json_object_get_string(temp_obj);
+		cat = ioctl_category(name);
+	} else if (json_object_object_get_ex(jobj, "open", &temp_obj) ||
+	           json_object_object_get_ex(jobj, "open64", &temp_obj)) {
+		json_object *path_obj;
+		name = "open";
+		if (json_object_object_get_ex(temp_obj, "path", &path_obj))
+			export_track_name(fd, "fd " + std::to_string(fd) + ": " +
+			                  json_object_get_string(path_obj));
+	} else if (json_object_object_get_ex(jobj, "close", &temp_obj)) {
+		name = "close";
+	} else if (json_object_object_get_ex(jobj, "dup", &temp_obj)) {
+		name = "dup";
+	} else {
+		return;
+	}
+
+	json_object *event_obj = new_event(name.c_str(), cat, "X", ts, fd);
+	json_object_object_add(event_obj, "dur", json_object_new_double(dur));
+	if (has_errno) {
+		json_object *args_obj = json_object_new_object();
+		json_object_object_get_ex(jobj, "errno", &temp_obj);
+		json_object_object_add(args_obj, "errno", json_object_get(temp_obj));
+		json_object_object_add(event_obj, "args", args_obj);
+	}
+	write_event(event_obj);
+
+	if (has_errno)
+		return;
+
+	json_object *args_obj = nullptr;
+	if (name == "VIDIOC_QBUF") {
+		json_object_object_get_ex(jobj, "from_userspace", &args_obj);
+		export_buffer_span(args_obj, fd, ts, true);
+	} else if (name == "VIDIOC_DQBUF") {
+		json_object_object_get_ex(jobj, "from_driver", &args_obj);
+		export_buffer_span(args_obj, fd, ts + dur, false);
+	}
+}
+
+int export_perfetto(std::string trace_filename)
+{
+	std::string export_filename = trace_filename.substr(0, trace_filename.rfind('.'));
+	export_filename += "_perfetto.json";
+
+	fprintf(stderr, "Exporting: %s\n", trace_filename.c_str());
+
+	export_file = fopen(export_filename.c_str(), "w");
+	if (export_file == nullptr) {
+		line_info("\n\tCan't open \'%s\'", export_filename.c_str());
+		return 1;
+	}
+
+	first_event = true;
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", export_file);
+	int ret = read_trace_file(trace_filename, export_record);
+	fputs("\n]}\n", export_file);
+	fclose(export_file);
+
+	if (ret) {
+		line_info("\n\tCan't export \'%s\'", trace_filename.c_str());
+		return 1;
+	}
+	fprintf(stderr, "Export complete: %s\n", export_filename.c_str());
+	return 0;
+}
@@ -4,10 +4,69 @@
  */
 
 #include "trace.h"
+#include <atomic>
 #include <math.h>
+#include <mutex>
+#include <semaphore.h>
+#include <signal.h>
 
 struct trace_context ctx_trace = {};
 
+/* Plain data, so it is initialized before any constructor reads the options into it. */
+struct trace_options trace_opts;
+
+/* Pauses for the system calls made by the tracer itself on the current thread. */
+static thread_local unsigned trace_paused_internally;
+/* Pause toggled at runtime by the user. */
+static std::atomic<bool> trace_paused_by_user(false);
+
+void read_trace_options(void)
+{
+	trace_opts.compact_print = getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr;
+	trace_opts.compress = getenv("V4L2_TRACER_OPTION_COMPRESS") != nullptr;
+	trace_opts.trace_userspace_arg = getenv("V4L2_TRACER_OPTION_TRACE_USERSPACE_ARG") != nullptr;
+	trace_opts.write_decoded_to_json_file =
+		getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_JSON_FILE") != nullptr;
+	trace_opts.write_decoded_to_yuv_file =
+		getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE") != nullptr;
+	trace_opts.write_decoded_md5 = getenv("V4L2_TRACER_OPTION_WRITE_DECODED_MD5") != nullptr;
+
+	const char *value = getenv("V4L2_TRACER_OPTION_MEM_EVERY");
+	trace_opts.mem_every = value != nullptr ? strtoul(value, nullptr, 0) : 0;
+	value = getenv("V4L2_TRACER_OPTION_MEM_PREFIX");
+	trace_opts.mem_prefix = value != nullptr ? strtoul(value, nullptr, 0) : 0;
+	trace_opts.mem_queues = 0;
+	value = getenv("V4L2_TRACER_OPTION_MEM_QUEUES");
+	if (value != nullptr && strstr(value, "output") != nullptr)
+		trace_opts.mem_queues |= TRACE_MEM_QUEUE_OUTPUT;
+	if (value != nullptr && strstr(value, "capture") != nullptr)
+		trace_opts.mem_queues |= TRACE_MEM_QUEUE_CAPTURE;
+	trace_opts.mem_devices = getenv("V4L2_TRACER_OPTION_MEM_DEVICES");
+}
+
+void pause_trace(bool pause)
+{
+	if (pause)
+		trace_paused_internally++;
+	else
+		trace_paused_internally--;
+}
+
+void toggle_trace_pause(void)
+{
+	trace_paused_by_user.store(!trace_paused_by_user.load());
+}
+
+/*
+ * V4L2_TRACER_PAUSE_TRACE is still checked, since the retracer uses it to avoid
+ * tracing its own system calls. Only traced system calls get here.
+ */
+bool is_trace_paused(void)
+{
+	return trace_paused_internally || trace_paused_by_user.load(std::memory_order_relaxed) ||
+	       getenv("V4L2_TRACER_PAUSE_TRACE") != nullptr;
+}
+
 bool is_video_or_media_device(const char *path)
 {
 	std::string dev_path_video = "/dev/video";
@@ -47,8 +106,9 @@ void print_decode_order(void)
 {
 	if (!is_debug())
 		return;
+
 	fprintf(stderr, "Decode order: ");
-	for (auto &num : ctx_trace.decode_order)
+	for (auto &num : ctx_trace.decode_order_pending)
 		fprintf(stderr, "%ld, ",  num);
 	fprintf(stderr, ".\n");
 }
@@ -57,9 +117,10 @@ void set_decode_order(long decode_order)
 {
 	debug_line_info("\n\t%ld", decode_order);
 
-	auto it = find(ctx_trace.decode_order.begin(), ctx_trace.decode_order.end(), decode_order);
-	if (it == ctx_trace.decode_order.end())
-		ctx_trace.decode_order.push_front(decode_order);
+	if (ctx_trace.decode_order_pending.insert(decode_order).second) {
+		ctx_trace.decode_order.push(decode_order);
+		ctx_trace.last_decode_order = decode_order;
+	}
 
 	print_decode_order();
 }
@@ -67,11 +128,52 @@ void set_decode_order(long decode_order)
 long get_decode_order(void)
 {
 	long decode_order = 0;
-	if (!ctx_trace.decode_order.empty())
-		decode_order = ctx_trace.decode_order.front();
+	if (!ctx_trace.decode_order_pending.empty())
+		decode_order = ctx_trace.last_decode_order;
 	return decode_order;
 }
 
+static inline __u64 buffer_key(__u32 a, __u32 b)
+{
+	return ((__u64) a << 32) | b;
+}
+
+static buffer_trace_iterator find_buffer_trace(int fd, __u32 offset)
+{
+	auto it = ctx_trace.buffers_by_offset.find(buffer_key(fd, offset));
+	if (it == ctx_trace.buffers_by_offset.end())
+		return ctx_trace.buffers.end();
+	return it->second;
+}
+
+static buffer_trace_iterator find_buffer_trace_by_index(__u32 type, __u32 index)
+{
+	auto it = ctx_trace.buffers_by_index.find(buffer_key(type, index));
+	if (it == ctx_trace.buffers_by_index.end())
+		return ctx_trace.buffers.end();
+	return it->second;
+}
+
+/* Remove the key from the index if it points to the buffer. */
+template <typename K>
+static void unindex_buffer_trace(std::unordered_map<K, buffer_trace_iterator> &buffers,
+                                 K key, buffer_trace_iterator buf)
+{
+	auto it = buffers.find(key);
+	if (it != buffers.end() && it->second == buf)
+		buffers.erase(it);
+}
+
+static void index_buffer_trace(buffer_trace_iterator buf)
+{
+	ctx_trace.buffers_by_offset[buffer_key(buf->fd, buf->offset)] = buf;
+	ctx_trace.buffers_by_index[buffer_key(buf->type, buf->index)] = buf;
+	if (buf->address)
+		ctx_trace.buffers_by_address[buf->address] = buf;
+	if (buf->display_order >= 0)
+		ctx_trace.buffers_by_display_order[buf->display_order] = buf;
+}
+
 void add_buffer_trace(int fd, __u32 type, __u32 index, __u32 offset = 0)
 {
 	struct buffer_trace buf = {};
@@ -81,143 +183,129 @@ void add_buffer_trace(int fd, __u32 type, __u32 index, __u32 offset = 0)
 	buf.offset = offset;
 	buf.display_order = -1;
 	ctx_trace.buffers.push_front(buf);
+	index_buffer_trace(ctx_trace.buffers.begin());
 }
 
 void remove_buffer_trace(__u32 type, __u32 index)
 {
-	for (auto it = ctx_trace.buffers.begin(); it != ctx_trace.buffers.end(); ++it) {
-		if ((it->type == type) && (it->index == index)) {
-			ctx_trace.buffers.erase(it);
-			break;
-		}
-	}
+	buffer_trace_iterator buf = find_buffer_trace_by_index(type, index);
+	if (buf == ctx_trace.buffers.end())
+		return;
+
+	unindex_buffer_trace(ctx_trace.buffers_by_offset, buffer_key(buf->fd, buf->offset), buf);
+	unindex_buffer_trace(ctx_trace.buffers_by_index, buffer_key(buf->type, buf->index), buf);
+	unindex_buffer_trace(ctx_trace.buffers_by_address, buf->address, buf);
+	unindex_buffer_trace(ctx_trace.buffers_by_display_order, buf->display_order, buf);
+	ctx_trace.buffers.erase(buf);
+
+	/* Let any older buffer that shared a key with the removed one take it back. */
+	for (auto it = ctx_trace.buffers.end(); it != ctx_trace.buffers.begin();)
+		index_buffer_trace(--it);
 }
 
 bool buffer_in_trace_context(int fd, __u32 offset)
 {
-	bool buffer_in_trace_context = false;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			buffer_in_trace_context = true;
-			break;
-		}
-	}
-	return buffer_in_trace_context;
+	return find_buffer_trace(fd, offset) != ctx_trace.buffers.end();
 }
 
 int get_buffer_fd_trace(__u32 type, __u32 index)
 {
-	int fd = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.type == type) && (b.index == index)) {
-			fd = b.fd;
-			break;
-		}
-	}
-	return fd;
+	buffer_trace_iterator buf = find_buffer_trace_by_index(type, index);
+	return buf == ctx_trace.buffers.end() ? 0 : buf->fd;
 }
 
 __u32 get_buffer_type_trace(int fd, __u32 offset)
 {
-	__u32 type = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			type = b.type;
-			break;
-		}
-	}
-	return type;
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	return buf == ctx_trace.buffers.end() ? 0 : buf->type;
 }
 
 int get_buffer_index_trace(int fd, __u32 offset)
 {
-	int index = -1;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			index = b.index;
-			break;
-		}
-	}
-	return index;
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	return buf == ctx_trace.buffers.end() ? -1 : (int) buf->index;
 }
 
 __u32 get_buffer_offset_trace(__u32 type, __u32 index)
 {
-	__u32 offset = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.type == type) && (b.index == index)) {
-			offset = b.offset;
-			break;
-		}
-	}
-	return offset;
+	buffer_trace_iterator buf = find_buffer_trace_by_index(type, index);
+	return buf == ctx_trace.buffers.end() ? 0 : buf->offset;
 }
 
 void set_buffer_bytesused_trace(int fd, __u32 offset, __u32 bytesused)
 {
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.bytesused = bytesused;
-			break;
-		}
-	}
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	if (buf != ctx_trace.buffers.end())
+		buf->bytesused = bytesused;
 }
 
 long get_buffer_bytesused_trace(int fd, __u32 offset)
 {
-	long bytesused = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			bytesused = b.bytesused;
-			break;
-		}
-	}
-	return bytesused;
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	return buf == ctx_trace.buffers.end() ? 0 : buf->bytesused;
+}
+
+static void set_buffer_display_order(buffer_trace_iterator buf, long display_order)
+{
+	unindex_buffer_trace(ctx_trace.buffers_by_display_order, buf->display_order, buf);
+	buf->display_order = display_order;
+	if (display_order >= 0)
+		ctx_trace.buffers_by_display_order[display_order] = buf;
 }
 
 void set_buffer_display_order(int fd, __u32 offset, long display_order)
 {
 	debug_line_info("\n\t%ld", display_order);
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.display_order = display_order;
-			break;
-		}
-	}
+
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	if (buf != ctx_trace.buffers.end())
+		set_buffer_display_order(buf, display_order);
+}
+
+/* Get the buffer holding the next decoded frame in display order, if it is known. */
+struct buffer_trace *get_next_buffer_to_display_trace(void)
+{
+	if (ctx_trace.decode_order.empty())
+		return nullptr;
+
+	auto it = ctx_trace.buffers_by_display_order.find(ctx_trace.decode_order.top());
+	if (it == ctx_trace.buffers_by_display_order.end())
+		return nullptr;
+	return &*it->second;
+}
+
+void set_buffer_displayed_trace(struct buffer_trace *buf)
+{
+	ctx_trace.decode_order_pending.erase(ctx_trace.decode_order.top());
+	ctx_trace.decode_order.pop();
+
+	auto it = ctx_trace.buffers_by_display_order.find(buf->display_order);
+	if (it != ctx_trace.buffers_by_display_order.end() && &*it->second == buf)
+		set_buffer_display_order(it->second, -1);
 }
 
 void set_buffer_address_trace(int fd, __u32 offset, unsigned long address)
 {
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			b.address = address;
-			break;
-		}
-	}
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	if (buf == ctx_trace.buffers.end())
+		return;
+
+	unindex_buffer_trace(ctx_trace.buffers_by_address, buf->address, buf);
+	buf->address = address;
+	if (address)
+		ctx_trace.buffers_by_address[address] = buf;
 }
 
 unsigned long get_buffer_address_trace(int fd, __u32 offset)
 {
-	unsigned long address = 0;
-	for (auto &b : ctx_trace.buffers) {
-		if ((b.fd == fd) && (b.offset == offset)) {
-			address = b.address;
-			break;
-		}
-	}
-	return address;
+	buffer_trace_iterator buf = find_buffer_trace(fd, offset);
+	return buf == ctx_trace.buffers.end() ? 0 : buf->address;
 }
 
 bool buffer_is_mapped(unsigned long buffer_address)
 {
-	bool ret = false;
-	for (auto &b : ctx_trace.buffers) {
-		if (b.address == buffer_address) {
-			ret = true;
-			break;
-		}
-	}
-	return ret;
+	return buffer_address &&
+	       ctx_trace.buffers_by_address.find(buffer_address) != ctx_trace.buffers_by_address.end();
 }
 
 void print_buffers_trace(void)
@@ -376,7 +464,7 @@ void dqbuf_setup(struct v4l2_buffer *buf)
 void streamoff_cleanup(v4l2_buf_type buf_type)
 {
 	debug_line_info();
-	if (is_verbose() || (getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE") != nullptr)) {
+	if (is_verbose() || trace_opts.write_decoded_to_yuv_file || trace_opts.write_decoded_md5) {
 		fprintf(stderr, "VIDIOC_STREAMOFF: %s\n", val2s(buf_type, v4l2_buf_type_val_def).c_str());
 		fprintf(stderr, "%s, %s %s, width: %d, height: %d\n",
 		        val2s(ctx_trace.compression_format, v4l2_pix_fmt_val_def).c_str(),
@@ -398,11 +486,13 @@ void g_fmt_setup_trace(struct v4l2_format *format)
 	if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
 		ctx_trace.width = format->fmt.pix.width;
 		ctx_trace.height = format->fmt.pix.height;
+		ctx_trace.bytesperline = format->fmt.pix.bytesperline;
 		ctx_trace.pixelformat = format->fmt.pix.pixelformat;
 	}
 	if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
 		ctx_trace.width = format->fmt.pix_mp.width;
 		ctx_trace.height = format->fmt.pix_mp.height;
+		ctx_trace.bytesperline = format->fmt.pix_mp.plane_fmt[0].bytesperline;
 		ctx_trace.pixelformat = format->fmt.pix_mp.pixelformat;
 	}
 	if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT)
@@ -465,32 +555,288 @@ void query_ext_ctrl_setup(int fd, struct v4l2_query_ext_ctrl *ptr)
 	}
 }
 
-void write_json_object_to_json_file(json_object *jobj)
+void trace_syscall_time(json_object *jobj, const struct syscall_time &time)
 {
+	json_object_object_add(jobj, "time_ns", json_object_new_uint64(time.start_ns));
+	json_object_object_add(jobj, "duration_ns",
+	                       json_object_new_uint64(time.end_ns - time.start_ns));
+}
+
+/*
+ * Traced objects are serialized by the traced thread and pushed onto a lock-free
+ * list of records. A writer thread takes the whole list at once and writes it
+ * to the trace file in one batch, so the traced thread never waits for the
+ * trace file. The batch is also written when the last device is closed, at exit
+ * and from fatal signal handlers.
+ */
+#define TRACE_WRITER_BATCH		256
+#define TRACE_WRITER_INTERVAL_MS	100
+
+struct trace_record {
+	struct trace_record *next;
+	__u32 type;
+	bool has_data;
 	std::string json_str;
-	if (getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr)
-		json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
-	else
-		json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
+	std::vector<unsigned char> data;
+};
+
+static std::atomic<struct trace_record *> trace_records(nullptr);
+static std::atomic<unsigned> trace_records_pending(0);
+static std::atomic<bool> trace_writer_running(false);
+static std::atomic<bool> trace_writer_stop(false);
+static std::mutex trace_writer_start_mutex;
+static std::mutex trace_file_mutex;
+static pthread_t trace_writer_thread;
+static sem_t trace_writer_sem;
+/* The payloads of the last memory dumps, only the hashes are needed here. */
+static struct trace_mem_cache trace_mem_dumps;
+
+static void write_trace_record(struct trace_record *record)
+{
+	std::string json_str = record->json_str;
+
+	/*
+	 * Hashing, compressing and hex-encoding the buffer memory is slow, so it is
+	 * done here and not when tracing.
+	 */
+	if (record->has_data) {
+		json_object *jobj = json_tokener_parse(record->json_str.c_str());
+
+		if (!record->data.empty()) {
+			json_object *hash_obj;
+			std::string hash;
+
+			/* A partial memory dump comes with the hash of all of the memory. */
+			if (json_object_object_get_ex(jobj, "mem_hash", &hash_obj)) {
+				hash = json_object_get_string(hash_obj);
+			} else {
+				hash = trace_mem_hash(record->data.data(), record->data.size());
+				json_object_object_add(jobj, "mem_hash",
+				                       json_object_new_string(hash.c_str()));
+			}
+			if (trace_mem_dumps.find(hash) != nullptr) {
+				/* The same memory was dumped recently, only refer to it. */
+				json_object_object_add(jobj, "mem_ref", json_object_new_boolean(true));
+				record->data.clear();
+				record->has_data = false;
+			} else {
+				trace_mem_dumps.add(hash, {});
+				if (trace_opts.compress &&
+				    trace_mem_compress(record->data))
+					json_object_object_add(jobj, "mem_compression",
+					                       json_object_new_string("zstd"));
+			}
+		}
+
+		if (is_binary_trace()) {
+			json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+		} else {
+			if (record->has_data)
+				json_object_object_add(jobj, "mem_array",
+				                       trace_buffer(record->data.data(), record->data.size()));
+			if (trace_opts.compact_print)
+				json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+			else
+				json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
+		}
+		json_object_put(jobj);
+	}
+
+	if (is_binary_trace()) {
+		trace_bin_write_record(ctx_trace.trace_file, record->type, json_str,
+		                       record->data.data(), record->data.size());
+		return;
+	}
+
+	fwrite(json_str.c_str(), sizeof(char), json_str.length(), ctx_trace.trace_file);
+	fputs(",\n", ctx_trace.trace_file);
+}
+
+/* Write all submitted records to the trace file. Must be called with trace_file_mutex held. */
+static void trace_writer_drain(void)
+{
+	struct trace_record *record = trace_records.exchange(nullptr, std::memory_order_acquire);
+	struct trace_record *fifo = nullptr;
+
+	if (record == nullptr)
+		return;
+
+	/* The list is in reverse order of submission. */
+	while (record != nullptr) {
+		struct trace_record *next = record->next;
+		record->next = fifo;
+		fifo = record;
+		record = next;
+	}
 
 	if (ctx_trace.trace_file == nullptr) {
 		std::string filename;
 		if (getenv("TRACE_ID") != nullptr)
 			filename = getenv("TRACE_ID");
 		ctx_trace.trace_filename = filename;
-		ctx_trace.trace_filename += ".json";
+		ctx_trace.trace_filename += trace_file_extension();
 		ctx_trace.trace_file = fopen(ctx_trace.trace_filename.c_str(), "a");
 	}
 
-	fwrite(json_str.c_str(), sizeof(char), json_str.length(), ctx_trace.trace_file);
-	fputs(",\n", ctx_trace.trace_file);
-	fflush(ctx_trace.trace_file);
+	while (fifo != nullptr) {
+		record = fifo;
+		fifo = fifo->next;
+		if (ctx_trace.trace_file != nullptr)
+			write_trace_record(record);
+		delete record;
+	}
+
+	if (ctx_trace.trace_file != nullptr)
+		fflush(ctx_trace.trace_file);
+}
+
+static void *trace_writer(void *)
+{
+	while (!trace_writer_stop.load()) {
+		struct timespec timeout;
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += TRACE_WRITER_INTERVAL_MS * 1000000L;
+		if (timeout.tv_nsec >= 1000000000L) {
+			timeout.tv_sec++;
+			timeout.tv_nsec -= 1000000000L;
+		}
+		sem_timedwait(&trace_writer_sem, &timeout);
+
+		trace_records_pending.store(0);
+		std::lock_guard<std::mutex> lock(trace_file_mutex);
+		trace_writer_drain();
+	}
+	return nullptr;
+}
+
+static void trace_writer_exit(void)
+{
+	if (trace_writer_running.load()) {
+		trace_writer_stop.store(true);
+		sem_post(&trace_writer_sem);
+		pthread_join(trace_writer_thread, nullptr);
+		trace_writer_running.store(false);
+	}
+
+	std::lock_guard<std::mutex> lock(trace_file_mutex);
+	trace_writer_drain();
+}
+
+static void trace_writer_sig_handler(int signum)
+{
+	/*
+	 * This is not async-signal-safe, but losing the end of the trace is worse.
+	 * Don't wait for the lock: the interrupted thread might be holding it.
+	 */
+	if (trace_file_mutex.try_lock()) {
+		trace_writer_drain();
+		trace_file_mutex.unlock();
+	}
+	signal(signum, SIG_DFL);
+	raise(signum);
+}
+
+static void trace_writer_atfork_prepare(void)
+{
+	/* Write the pending records now so that the child doesn't write them again. */
+	trace_file_mutex.lock();
+	trace_writer_drain();
+}
+
+static void trace_writer_atfork_parent(void)
+{
+	trace_file_mutex.unlock();
+}
+
+static void trace_writer_atfork_child(void)
+{
+	trace_file_mutex.unlock();
+	/* The writer thread is not duplicated, start a new one on the next write. */
+	trace_writer_running.store(false);
+}
+
+static void trace_writer_start(void)
+{
+	static bool initialized;
+	const int signums[] = { SIGINT, SIGTERM, SIGHUP, SIGQUIT, SIGABRT,
+	                        SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+
+	std::lock_guard<std::mutex> lock(trace_writer_start_mutex);
+	if (trace_writer_running.load())
+		return;
+
+	if (!initialized) {
+		sem_init(&trace_writer_sem, 0, 0);
+		atexit(trace_writer_exit);
+		pthread_atfork(trace_writer_atfork_prepare, trace_writer_atfork_parent,
+		               trace_writer_atfork_child);
+
+		/* Don't replace the signal handlers of the traced application. */
+		for (int signum : signums) {
+			struct sigaction act = {};
+			sigaction(signum, nullptr, &act);
+			if (act.sa_handler != SIG_DFL)
+				continue;
+			act.sa_handler = trace_writer_sig_handler;
+			act.sa_flags = SA_RESETHAND;
+			sigaction(signum, &act, nullptr);
+		}
+		initialized = true;
+	}
+
+	/* The writer thread must not receive the signals meant for the traced application. */
+	sigset_t all_signals, old_signals;
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	trace_writer_stop.store(false);
+	if (pthread_create(&trace_writer_thread, nullptr, trace_writer, nullptr) == 0)
+		trace_writer_running.store(true);
+	else
+		line_info("\n\tCan't start the trace writer thread, writing synchronously.");
+	pthread_sigmask(SIG_SETMASK, &old_signals, nullptr);
+}
+
+/*
+ * Write a traced object to the trace file. If data is set, the buffer memory is
+ * added to the object as "mem_array", or as the raw payload of a binary trace record.
+ */
+void write_json_object_to_json_file(json_object *jobj, const unsigned char *data, __u32 data_len)
+{
+	struct trace_record *record = new trace_record;
+
+	record->type = get_record_type(jobj);
+	record->has_data = data != nullptr;
+	if (is_binary_trace() || data != nullptr || trace_opts.compact_print)
+		record->json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+	else
+		record->json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
+	if (data != nullptr)
+		record->data.assign(data, data + data_len);
+
+	if (!trace_writer_running.load())
+		trace_writer_start();
+
+	record->next = trace_records.load(std::memory_order_relaxed);
+	while (!trace_records.compare_exchange_weak(record->next, record,
+	                                            std::memory_order_release,
+	                                            std::memory_order_relaxed))
+		;
+
+	if (!trace_writer_running.load()) {
+		std::lock_guard<std::mutex> lock(trace_file_mutex);
+		trace_writer_drain();
+	} else if (trace_records_pending.fetch_add(1) + 1 == TRACE_WRITER_BATCH) {
+		sem_post(&trace_writer_sem);
+	}
 }
 
 void close_json_file(void)
 {
+	std::lock_guard<std::mutex> lock(trace_file_mutex);
+	trace_writer_drain();
 	if (ctx_trace.trace_file != nullptr) {
 		fclose(ctx_trace.trace_file);
 		ctx_trace.trace_file = 0;
 	}
+	close_yuv_file();
 }
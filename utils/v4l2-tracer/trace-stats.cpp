@@ -0,0 +1,363 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#include "retrace.h"
+#include <map>
+
+/*
+ * Aggregate statistics of a trace, collected in a single pass over the trace
+ * file. Nothing is kept per record: latencies go into fixed-size histograms and
+ * the reorder depth only looks at a bounded window of recently decoded frames,
+ * so the memory used does not depend on the length of the trace.
+ */
+
+/* Latencies are binned by power of two, each split into STATS_SUB_BUCKETS. */
+#define STATS_SUB_BUCKETS	8
+#define STATS_BUCKETS		(64 * STATS_SUB_BUCKETS)
+
+/* Frames further apart than this in decode order are not compared. */
+#define STATS_REORDER_WINDOW	32
+
+struct ioctl_stats {
+	__u64 count;
+	__u64 errors;
+	__u64 timed;
+	__u64 max_ns;
+	__u32 histogram[STATS_BUCKETS];
+};
+
+struct queue_stats {
+	__u64 queued;
+	__u64 dequeued;
+	__u64 bytes;
+	unsigned occupancy;
+	unsigned max_occupancy;
+	__u64 last_ns;
+	/* Time spent with each number of buffers queued, the last entry has the rest. */
+	__u64 time_at_occupancy[VIDEO_MAX_FRAME + 1];
+};
+
+struct reorder_stats {
+	__u64 frames;
+	__u64 reordered;
+	unsigned max_depth;
+	__u64 total_depth;
+	std::list<long> window;
+};
+
+static std::map<std::string, struct ioctl_stats> stats_ioctls;
+static std::map<std::string, struct queue_stats> stats_queues;
+static struct reorder_stats stats_reorder;
+static __u64 stats_first_ns;
+static __u64 stats_last_ns;
+
+static unsigned latency_bucket(__u64 ns)
+{
+	if (ns < STATS_SUB_BUCKETS)
+		return ns;
+	unsigned msb = 63 - __builtin_clzll(ns);
+	unsigned sub = (ns >> (msb - 3)) & (STATS_SUB_BUCKETS - 1);
+	return (msb - 2) * STATS_SUB_BUCKETS + sub;
+}
+
+/* The largest latency that falls into the bucket. */
+static __u64 latency_bucket_limit(unsigned bucket)
+{
+	if (bucket < STATS_SUB_BUCKETS)
+		return bucket;
+	unsigned msb = bucket / STATS_SUB_BUCKETS + 2;
+	unsigned sub = bucket % STATS_SUB_BUCKETS;
+	return ((__u64) (STATS_SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+}
+
+static __u64 latency_percentile(const struct ioctl_stats &stats, unsigned percentile)
+{
+	__u64 target = (stats.timed * percentile + 99) / 100;
+	__u64 sum = 0;
+
+	for (unsigned i = 0; i < STATS_BUCKETS; i++) {
+		sum += stats.histogram[i];
+		if (sum >= target)
+			return std::min(latency_bucket_limit(i), stats.max_ns);
+	}
+	return stats.max_ns;
+}
+
+static std::string queue_name(int fd, std::string type)
+{
+	if (type.find("V4L2_BUF_TYPE_") == 0)
+		type = type.substr(strlen("V4L2_BUF_TYPE_"));
+	return "fd " + std::to_string(fd) + " " + type;
+}
+
+static void set_queue_occupancy(struct queue_stats &queue, unsigned occupancy, __u64 time_ns)
+{
+	if (queue.last_ns && time_ns > queue.last_ns)
+		queue.time_at_occupancy[std::min(queue.occupancy, (unsigned) VIDEO_MAX_FRAME)] +=
+			time_ns - queue.last_ns;
+	queue.last_ns = time_ns;
+	queue.occupancy = occupancy;
+	queue.max_occupancy = std::max(queue.max_occupancy, occupancy);
+}
+
+static void stats_buffer(int fd, json_object *args_obj, __u64 time_ns, bool queue)
+{
+	json_object *buf_obj;
+	json_object *type_obj;
+	json_object *temp_obj;
+
+	if (args_obj == nullptr ||
+	    !json_object_object_get_ex(args_obj, "v4l2_buffer", &buf_obj) ||
+	    !json_object_object_get_ex(buf_obj, "type", &type_obj))
+		return;
+
+	std::string type = json_object_get_string(type_obj);
+	struct queue_stats &stats = stats_queues[queue_name(fd, type)];
+	bool output = type.find("OUTPUT") != std::string::npos;
+
+	/* Count the payload where it is filled: when queued to output, when dequeued from capture. */
+	__u64 bytesused = 0;
+	json_object *planes_obj;
+	if (json_object_object_get_ex(buf_obj, "m", &temp_obj) &&
+	    json_object_object_get_ex(temp_obj, "planes", &planes_obj)) {
+		for (size_t i = 0; i < json_object_array_length(planes_obj); i++) {
+			json_object *plane_obj = json_object_array_get_idx(planes_obj, i);
+			if (json_object_object_get_ex(plane_obj, "bytesused", &temp_obj))
+				bytesused += json_object_get_uint64(temp_obj);
+		}
+	} else if (json_object_object_get_ex(buf_obj, "bytesused", &temp_obj)) {
+		bytesused = json_object_get_uint64(temp_obj);
+	}
+	if (queue == output)
+		stats.bytes += bytesused;
+
+	if (queue) {
+		stats.queued++;
+		set_queue_occupancy(stats, stats.occupancy + 1, time_ns);
+	} else {
+		stats.dequeued++;
+		set_queue_occupancy(stats, stats.occupancy ? stats.occupancy - 1 : 0, time_ns);
+	}
+}
+
+static void stats_streamoff(int fd, json_object *args_obj, __u64 time_ns)
+{
+	json_object *type_obj;
+
+	if (args_obj == nullptr || !json_object_object_get_ex(args_obj, "type", &type_obj))
+		return;
+	auto it = stats_queues.find(queue_name(fd, json_object_get_string(type_obj)));
+	if (it != stats_queues.end())
+		set_queue_occupancy(it->second, 0, time_ns);
+}
+
+/*
+ * The reorder depth of a frame is the number of frames decoded before it that
+ * are displayed after it, i.e. how many decoded frames must be held back.
+ */
+static void stats_decoded_frame(long order_cnt, bool idr)
+{
+	struct reorder_stats &stats = stats_reorder;
+	unsigned depth = 0;
+
+	if (idr)
+		stats.window.clear();
+	/* The slices of a frame share its order count. */
+	else if (!stats.window.empty() && stats.window.back() == order_cnt)
+		return;
+	for (long prev : stats.window)
+		if (prev > order_cnt)
+			depth++;
+	stats.window.push_back(order_cnt);
+	if (stats.window.size() > STATS_REORDER_WINDOW)
+		stats.window.pop_front();
+
+	stats.frames++;
+	if (depth)
+		stats.reordered++;
+	stats.total_depth += depth;
+	stats.max_depth = std::max(stats.max_depth, depth);
+}
+
+static void stats_ext_controls(json_object *args_obj)
+{
+	json_object *ext_controls_obj;
+	json_object *controls_obj;
+
+	if (args_obj == nullptr ||
+	    !json_object_object_get_ex(args_obj, "v4l2_ext_controls", &ext_controls_obj) ||
+	    !json_object_object_get_ex(ext_controls_obj, "controls", &controls_obj))
+		return;
+
+	for (size_t i = 0; i < json_object_array_length(controls_obj); i++) {
+		json_object *ctrl_obj = json_object_array_get_idx(controls_obj, i);
+		json_object *params_obj;
+		json_object *order_obj;
+		json_object *flags_obj;
+		const char *order_key;
+
+		if (json_object_object_get_ex(ctrl_obj, "v4l2_ctrl_h264_decode_params", &params_obj))
+			order_key = "top_field_order_cnt";
+		else if (json_object_object_get_ex(ctrl_obj, "v4l2_ctrl_hevc_decode_params", &params_obj))
+			order_key = "pic_order_cnt_val";
+		else
+			continue;
+
+		if (!json_object_object_get_ex(params_obj, order_key, &order_obj))
+			continue;
+		bool idr = json_object_object_get_ex(params_obj, "flags", &flags_obj) &&
+		           strstr(json_object_get_string(flags_obj), "IDR_PIC") != nullptr;
+		stats_decoded_frame(json_object_get_int64(order_obj), idr);
+	}
+}
+
+static void stats_record(json_object *jobj, const unsigned char *data, size_t data_len)
+{
+	json_object *ioctl_obj;
+	json_object *temp_obj;
+	__u64 time_ns = 0;
+
+	if (json_object_object_get_ex(jobj, "time_ns", &temp_obj)) {
+		time_ns = json_object_get_uint64(temp_obj);
+		if (!stats_first_ns)
+			stats_first_ns = time_ns;
+		stats_last_ns = time_ns;
+	}
+
+	if (!json_object_object_get_ex(jobj, "ioctl", &ioctl_obj))
+		return;
+
+	std::string name = json_object_get_string(ioctl_obj);
+	struct ioctl_stats &stats = stats_ioctls[name];
+	stats.count++;
+
+	if (json_object_object_get_ex(jobj, "duration_ns", &temp_obj)) {
+		__u64 duration_ns = json_object_get_uint64(temp_obj);
+		stats.timed++;
+		stats.max_ns = std::max(stats.max_ns, duration_ns);
+		stats.histogram[latency_bucket(duration_ns)]++;
+	}
+
+	if (json_object_object_get_ex(jobj, "errno", &temp_obj)) {
+		stats.errors++;
+		return;
+	}
+
+	int fd = json_object_object_get_ex(jobj, "fd", &temp_obj) ? json_object_get_int(temp_obj) : -1;
+	json_object *args_obj = nullptr;
+
+	if (name == "VIDIOC_QBUF") {
+		json_object_object_get_ex(jobj, "from_userspace", &args_obj);
+		stats_buffer(fd, args_obj, time_ns, true);
+	} else if (name == "VIDIOC_DQBUF") {
+		json_object_object_get_ex(jobj, "from_driver", &args_obj);
+		stats_buffer(fd, args_obj, time_ns, false);
+	} else if (name == "VIDIOC_STREAMOFF") {
+		json_object_object_get_ex(jobj, "from_userspace", &args_obj);
+		stats_streamoff(fd, args_obj, time_ns);
+	} else if (name == "VIDIOC_S_EXT_CTRLS") {
+		json_object_object_get_ex(jobj, "from_userspace", &args_obj);
+		stats_ext_controls(args_obj);
+	}
+}
+
+static void print_ioctl_stats(void)
+{
+	fprintf(stderr, "\nioctls (latency in us):\n");
+	fprintf(stderr, "%-32s %8s %7s %9s %9s %9s %9s\n", "ioctl", "count", "errors",
+	        "p50", "p90", "p99", "max");
+	for (auto &pair : stats_ioctls) {
+		const struct ioctl_stats &s = pair.second;
+
+		fprintf(stderr, "%-32s %8llu %7llu ", pair.first.c_str(),
+		        (unsigned long long) s.count, (unsigned long long) s.errors);
+		if (!s.timed) {
+			fprintf(stderr, "%9s %9s %9s %9s\n", "-", "-", "-", "-");
+			continue;
+		}
+		fprintf(stderr, "%9.1f %9.1f %9.1f %9.1f\n", latency_percentile(s, 50) / 1000.0,
+		        latency_percentile(s, 90) / 1000.0, latency_percentile(s, 99) / 1000.0,
+		        s.max_ns / 1000.0);
+	}
+}
+
+static void print_queue_stats(void)
+{
+	if (stats_queues.empty())
+		return;
+
+	fprintf(stderr, "\nBuffer queues:\n");
+	fprintf(stderr, "%-36s %8s %8s %14s %9s %9s\n", "queue", "queued", "dequeued",
+	        "bytes", "avg depth", "max depth");
+	for (auto &pair : stats_queues) {
+		struct queue_stats &s = pair.second;
+
+		/* Account for the time from the last change of occupancy to the end of the trace. */
+		set_queue_occupancy(s, s.occupancy, stats_last_ns);
+
+		__u64 total_ns = 0;
+		double weighted = 0;
+		for (unsigned i = 0; i <= VIDEO_MAX_FRAME; i++) {
+			total_ns += s.time_at_occupancy[i];
+			weighted += (double) i * s.time_at_occupancy[i];
+		}
+		fprintf(stderr, "%-36s %8llu %8llu %14llu ", pair.first.c_str(),
+		        (unsigned long long) s.queued, (unsigned long long) s.dequeued,
+		        (unsigned long long) s.bytes);
+		if (total_ns)
+			fprintf(stderr, "%9.2f %9u\n", weighted / total_ns, s.max_occupancy);
+		else
+			fprintf(stderr, "%9s %9u\n", "-", s.max_occupancy);
+	}
+
+	/* Show how the occupancy was distributed over the time of the trace. */
+	for (auto &pair : stats_queues) {
+		const struct queue_stats &s = pair.second;
+		__u64 total_ns = 0;
+
+		for (unsigned i = 0; i <= VIDEO_MAX_FRAME; i++)
+			total_ns += s.time_at_occupancy[i];
+		if (!total_ns)
+			continue;
+		fprintf(stderr, "\n%s, time with n buffers queued:\n", pair.first.c_str());
+		for (unsigned i = 0; i <= std::min(s.max_occupancy, (unsigned) VIDEO_MAX_FRAME); i++)
+			fprintf(stderr, "\t%2u%s: %5.1f%%\n", i, i == VIDEO_MAX_FRAME ? "+" : "",
+			        s.time_at_occupancy[i] * 100.0 / total_ns);
+	}
+}
+
+static void print_reorder_stats(void)
+{
+	const struct reorder_stats &s = stats_reorder;
+
+	if (!s.frames)
+		return;
+	fprintf(stderr, "\nDecode order vs display order:\n");
+	fprintf(stderr, "\tframes: %llu, reordered: %llu, average depth: %.2f, max depth: %u\n",
+	        (unsigned long long) s.frames, (unsigned long long) s.reordered,
+	        (double) s.total_depth / s.frames, s.max_depth);
+}
+
+int stats(std::string trace_filename)
+{
+	stats_ioctls.clear();
+	stats_queues.clear();
+	stats_reorder = {};
+	stats_first_ns = 0;
+	stats_last_ns = 0;
+
+	if (read_trace_file(trace_filename, stats_record)) {
+		line_info("\n\tCan't read \'%s\'", trace_filename.c_str());
+		return 1;
+	}
+
+	fprintf(stderr, "Statistics: %s\n", trace_filename.c_str());
+	if (stats_last_ns > stats_first_ns)
+		fprintf(stderr, "Duration: %.3f s\n", (stats_last_ns - stats_first_ns) / 1e9);
+	print_ioctl_stats();
+	print_queue_stats();
+	print_reorder_stats();
+	return 0;
+}
@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Copyright (c) 2026 - agent
+ */
+
+#include "trace.h"
+
+extern struct trace_context ctx_trace;
+
+/*
+ * Decoded frames are written to <TRACE_ID>.yuv without padding, i.e. with the
+ * lines of each plane packed to the visible width. The file stays open with a
+ * large stdio buffer, so a frame without padding costs a single fwrite() and a
+ * padded one only a buffered copy per line. With the option to
+ * hash the frames, one MD5 per frame goes to <TRACE_ID>.md5 instead, which can
+ * be compared with the checksums of decoder conformance suites.
+ */
+
+#define YUV_FILE_BUFFER_SIZE	(4 * 1024 * 1024)
+
+static FILE *yuv_file;
+static FILE *md5_file;
+
+struct md5_context {
+	__u32 state[4];
+	__u64 length;
+	unsigned char block[64];
+};
+
+static const __u32 md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const unsigned char md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_init(struct md5_context *ctx)
+{
+	ctx->state[0] = 0x67452301;
+	ctx->state[1] = 0xefcdab89;
+	ctx->state[2] = 0x98badcfe;
+	ctx->state[3] = 0x10325476;
+	ctx->length = 0;
+}
+
+static void md5_block(struct md5_context *ctx, const unsigned char *block)
+{
+	__u32 w[16];
+	__u32 a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+
+	for (unsigned i = 0; i < 16; i++)
+		w[i] = block[i * 4] | (block[i * 4 + 1] << 8) |
+		       (block[i * 4 + 2] << 16) | ((__u32) block[i * 4 + 3] << 24);
+
+	for (unsigned i = 0; i < 64; i++) {
+		__u32 f;
+		unsigned g;
+
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+		f += a + md5_k[i] + w[g];
+		a = d;
+		d = c;
+		c = b;
+		b += (f << md5_r[i]) | (f >> (32 - md5_r[i]));
+	}
+	ctx->state[0] += a;
+	ctx->state[1] += b;
+	ctx->state[2] += c;
+	ctx->state[3] += d;
+}
+
+static void md5_update(struct md5_context *ctx, const unsigned char *data, size_t len)
+{
+	size_t used = ctx->length % 64;
+
+	ctx->length += len;
+	if (used) {
+		size_t n = std::min(len, 64 - used);
+		memcpy(ctx->block + used, data, n);
+		data += n;
+		len -= n;
+		if (used + n < 64)
+			return;
+		md5_block(ctx, ctx->block);
+	}
+	for (; len >= 64; data += 64, len -= 64)
+		md5_block(ctx, data);
+	memcpy(ctx->block, data, len);
+}
+
+static std::string md5_final(struct md5_context *ctx)
+{
+	unsigned char padding[72] = { 0x80 };
+	__u64 bits = ctx->length * 8;
+	size_t pad_len = 64 - (ctx->length + 8) % 64;
+	char hex[33];
+
+	for (unsigned i = 0; i < 8; i++)
+		padding[pad_len + i] = bits >> (8 * i);
+	md5_update(ctx, padding, pad_len + 8);
+
+	for (unsigned i = 0; i < 16; i++)
+		sprintf(&hex[i * 2], "%02x", (ctx->state[i / 4] >> (8 * (i % 4))) & 0xff);
+	return hex;
+}
+
+static FILE *open_decoded_file(std::string extension)
+{
+	std::string filename;
+	if (getenv("TRACE_ID") != nullptr)
+		filename = getenv("TRACE_ID");
+	filename += extension;
+
+	FILE *fp = fopen(filename.c_str(), "a");
+	if (fp == nullptr) {
+		line_info("\n\tCan't open \'%s\'", filename.c_str());
+		return nullptr;
+	}
+	setvbuf(fp, nullptr, _IOFBF, YUV_FILE_BUFFER_SIZE);
+	return fp;
+}
+
+/* Pass each plane of the frame, without the padding at the end of its lines, to the sink. */
+template <typename Sink>
+static void for_each_plane(const unsigned char *frame, __u32 bytesused,
+                           unsigned expected_length, Sink sink)
+{
+	__u32 width = ctx_trace.width;
+	__u32 height = ctx_trace.height;
+	__u32 stride = ctx_trace.bytesperline;
+	bool planar_420 = ctx_trace.pixelformat == V4L2_PIX_FMT_NV12 ||
+	                  ctx_trace.pixelformat == V4L2_PIX_FMT_YUV420;
+
+	if (!planar_420 || stride <= width || (__u64) stride * height * 3 / 2 > bytesused) {
+		sink(frame, expected_length);
+		return;
+	}
+
+	struct {
+		__u32 width;
+		__u32 height;
+		__u32 stride;
+	} planes[3] = {
+		{ width, height, stride },
+	};
+	unsigned num_planes = 1;
+
+	if (ctx_trace.pixelformat == V4L2_PIX_FMT_NV12) {
+		planes[num_planes++] = { width, height / 2, stride };
+	} else {
+		planes[num_planes++] = { width / 2, height / 2, stride / 2 };
+		planes[num_planes++] = { width / 2, height / 2, stride / 2 };
+	}
+
+	for (unsigned p = 0; p < num_planes; p++) {
+		for (__u32 line = 0; line < planes[p].height; line++)
+			sink(frame + line * planes[p].stride, planes[p].width);
+		frame += planes[p].stride * planes[p].height;
+	}
+}
+
+void trace_yuv_frame(const unsigned char *frame, __u32 bytesused, unsigned expected_length)
+{
+	if (trace_opts.write_decoded_md5) {
+		struct md5_context ctx;
+
+		if (md5_file == nullptr && (md5_file = open_decoded_file(".md5")) == nullptr)
+			return;
+		md5_init(&ctx);
+		for_each_plane(frame, bytesused, expected_length,
+		               [&ctx](const unsigned char *data, size_t len) {
+			md5_update(&ctx, data, len);
+		});
+		fprintf(md5_file, "%s\n", md5_final(&ctx).c_str());
+		return;
+	}
+
+	if (yuv_file == nullptr && (yuv_file = open_decoded_file(".yuv")) == nullptr)
+		return;
+	for_each_plane(frame, bytesused, expected_length,
+	               [](const unsigned char *data, size_t len) {
+		fwrite(data, sizeof(unsigned char), len, yuv_file);
+	});
+}
+
+void close_yuv_file(void)
+{
+	if (yuv_file != nullptr) {
+		fclose(yuv_file);
+		yuv_file = nullptr;
+	}
+	if (md5_file != nullptr) {
+		fclose(md5_file);
+		md5_file = nullptr;
+	}
+}
@@ -7,10 +7,12 @@
 
 extern struct trace_context ctx_trace;
 
-void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64)
+void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64,
+                const struct syscall_time &time)
 {
 	json_object *open_obj = json_object_new_object();
 	json_object_object_add(open_obj, "fd", json_object_new_int(fd));
+	trace_syscall_time(open_obj, time);
 
 	json_object *open_args = json_object_new_object();
 	json_object_object_add(open_args, "path", json_object_new_string(path));
@@ -34,15 +36,15 @@ void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64
 	std::string driver;
 	if (is_video) {
 		struct v4l2_capability cap = {};
-		setenv("V4L2_TRACER_PAUSE_TRACE", "true", 0);
+		pause_trace(true);
 		ioctl(fd, VIDIOC_QUERYCAP, &cap);
-		unsetenv("V4L2_TRACER_PAUSE_TRACE");
+		pause_trace(false);
 
 		std::string path_media = get_path_media(reinterpret_cast<const char *>(cap.driver));
 
-		setenv("V4L2_TRACER_PAUSE_TRACE", "true", 0);
+		pause_trace(true);
 		media_fd = open(path_media.c_str(), O_RDONLY);
-		unsetenv("V4L2_TRACER_PAUSE_TRACE");
+		pause_trace(false);
 	}
 
 	struct media_device_info info = {};
@@ -57,16 +59,17 @@ void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64
 		for (auto &name : linked_entities)
 			json_object_array_add(linked_entities_obj, json_object_new_string(name.c_str()));
 		json_object_object_add(open_obj, "linked_entities", linked_entities_obj);
-		setenv("V4L2_TRACER_PAUSE_TRACE", "true", 0);
+		pause_trace(true);
 		close(media_fd);
-		unsetenv("V4L2_TRACER_PAUSE_TRACE");
+		pause_trace(false);
 	}
 
 	write_json_object_to_json_file(open_obj);
 	json_object_put(open_obj);
 }
 
-void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off, unsigned long buf_address, bool is_mmap64)
+void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off, unsigned long buf_address, bool is_mmap64,
+                const struct syscall_time &time)
 {
 	json_object *mmap_obj = json_object_new_object();
 
@@ -87,43 +90,54 @@ void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t o
 		json_object_object_add(mmap_obj, "mmap", mmap_args);
 
 	json_object_object_add(mmap_obj, "buffer_address", json_object_new_uint64(buf_address));
+	trace_syscall_time(mmap_obj, time);
 
 	write_json_object_to_json_file(mmap_obj);
 	json_object_put(mmap_obj);
 }
 
-json_object *trace_buffer(unsigned char *buffer_pointer, __u32 bytesused)
+/* Check if the device of fd is in the comma-separated --mem_devices list of fds and paths. */
+static bool trace_mem_device_selected(int fd)
 {
-	const int BUF_SIZE = 5;
-	const int MAX_BYTES_PER_LINE = 32;
-	char buf[BUF_SIZE];
-	std::string str;
-	int byte_count_per_line = 0;
-	json_object *mem_array_obj = json_object_new_array();
-
-	for (__u32 i = 0; i < bytesused; i++) {
-		memset(buf, 0, BUF_SIZE);
-		/* Each byte e.g. D9 will write a string of two characters "D9". */
-		sprintf(buf, "%02x", buffer_pointer[i]);
-		str += buf;
-		byte_count_per_line++;
-
-		/*  Add a newline every 32 bytes. */
-		if (byte_count_per_line == MAX_BYTES_PER_LINE) {
-			byte_count_per_line = 0;
-			json_object_array_add(mem_array_obj, json_object_new_string(str.c_str()));
-			str.clear();
-		} else if (getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") == nullptr) {
-			/* Add a space every byte e.g. "01 2A 40 01" */
-			str += " ";
-		}
+	std::string devices = trace_opts.mem_devices;
+	std::string path = get_device(fd);
+	std::string fd_str = std::to_string(fd);
+	size_t start = 0;
+
+	while (start <= devices.length()) {
+		size_t end = devices.find(',', start);
+		if (end == std::string::npos)
+			end = devices.length();
+		std::string device = devices.substr(start, end - start);
+		if (device == fd_str || (!path.empty() && device == path))
+			return true;
+		start = end + 1;
 	}
+	return false;
+}
 
-	/* Trace the last line if it was less than a full line. */
-	if (byte_count_per_line)
-		json_object_array_add(mem_array_obj, json_object_new_string(str.c_str()));
-
-	return mem_array_obj;
+/*
+ * Get how many bytes of the buffer memory to dump: all of them, the first
+ * --mem_prefix bytes, or none if the queue or device isn't selected or it's not
+ * the turn of this queue for --mem_every. The metadata of the dump is always
+ * traced, so that the trace can still be retraced.
+ */
+static __u32 trace_mem_len(int fd, __u32 type, __u32 bytesused)
+{
+	if (trace_opts.mem_queues) {
+		unsigned queue = V4L2_TYPE_IS_OUTPUT(type) ? TRACE_MEM_QUEUE_OUTPUT :
+		                                             TRACE_MEM_QUEUE_CAPTURE;
+		if (!(trace_opts.mem_queues & queue))
+			return 0;
+	}
+	if (trace_opts.mem_devices != nullptr && !trace_mem_device_selected(fd))
+		return 0;
+	if (trace_opts.mem_every > 1 &&
+	    ctx_trace.mem_dumps_by_queue[((__u64) fd << 32) | type]++ % trace_opts.mem_every)
+		return 0;
+	if (trace_opts.mem_prefix && trace_opts.mem_prefix < bytesused)
+		return trace_opts.mem_prefix;
+	return bytesused;
 }
 
 void trace_mem(int fd, __u32 offset, __u32 type, int index, __u32 bytesused, unsigned long start)
@@ -138,13 +152,21 @@ void trace_mem(int fd, __u32 offset, __u32 type, int index, __u32 bytesused, uns
 	json_object_object_add(mem_obj, "address", json_object_new_uint64(start));
 
 	if ((type == V4L2_BUF_TYPE_VIDEO_OUTPUT || type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE) ||
-	    (getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_JSON_FILE") != nullptr)) {
-		json_object *mem_array_obj = trace_buffer((unsigned char*) start, bytesused);
-		json_object_object_add(mem_obj, "mem_array", mem_array_obj);
+	    trace_opts.write_decoded_to_json_file) {
+		__u32 mem_len = trace_mem_len(fd, type, bytesused);
+
+		if (mem_len < bytesused) {
+			json_object_object_add(mem_obj, "mem_len", json_object_new_uint64(mem_len));
+			if (mem_len)
+				json_object_object_add(mem_obj, "mem_hash",
+				                       json_object_new_string(trace_mem_hash((unsigned char*) start,
+				                                                             bytesused).c_str()));
+		}
+		write_json_object_to_json_file(mem_obj, mem_len ? (unsigned char*) start : nullptr, mem_len);
+	} else {
+		write_json_object_to_json_file(mem_obj);
 	}
 
-	write_json_object_to_json_file(mem_obj);
-
 	json_object_put(mem_obj);
 }
 
@@ -165,44 +187,25 @@ void trace_mem_decoded(void)
 	int displayed_count = 0;
 	unsigned expected_length = get_expected_length_trace();
 
-	while (!ctx_trace.decode_order.empty()) {
-		std::list<buffer_trace>::iterator it;
-		long next_frame_to_be_displayed = *std::min_element(ctx_trace.decode_order.begin(),
-		                                                    ctx_trace.decode_order.end());
-		for (it = ctx_trace.buffers.begin(); it != ctx_trace.buffers.end(); ++it) {
-			if (it->display_order != next_frame_to_be_displayed)
-				continue;
-			if (!it->address)
-				break;
-			/*
-			 * If bytesused exceeds the expected length of the decoded video data,
-			 * then assume that this is extraneous padding or info added by the driver
-			 * and do not trace it.
-			 */
-			if (it->bytesused < expected_length)
-				break;
-			debug_line_info("\n\tDisplaying: %ld, %s, index: %d", it->display_order,
-					val2s(it->type, v4l2_buf_type_val_def).c_str(), it->index);
-			displayed_count++;
-
-			if (getenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE") != nullptr) {
-				std::string filename;
-				if (getenv("TRACE_ID") != nullptr)
-					filename = getenv("TRACE_ID");
-				filename +=  ".yuv";
-				FILE *fp = fopen(filename.c_str(), "a");
-				unsigned char *buffer_pointer = (unsigned char*) it->address;
-				for (__u32 i = 0; i < expected_length; i++)
-					fwrite(&buffer_pointer[i], sizeof(unsigned char), 1, fp);
-				fclose(fp);
-			}
-			trace_mem(it->fd, it->offset, it->type, it->index, it->bytesused, it->address);
-			ctx_trace.decode_order.remove(next_frame_to_be_displayed);
-			it->display_order = -1;
+	struct buffer_trace *buf;
+	while ((buf = get_next_buffer_to_display_trace()) != nullptr) {
+		if (!buf->address)
 			break;
-		}
-		if (!it->address || it == ctx_trace.buffers.end() || it->bytesused < expected_length)
+		/*
+		 * If bytesused exceeds the expected length of the decoded video data,
+		 * then assume that this is extraneous padding or info added by the driver
+		 * and do not trace it.
+		 */
+		if (buf->bytesused < expected_length)
 			break;
+		debug_line_info("\n\tDisplaying: %ld, %s, index: %d", buf->display_order,
+				val2s(buf->type, v4l2_buf_type_val_def).c_str(), buf->index);
+		displayed_count++;
+
+		if (trace_opts.write_decoded_to_yuv_file || trace_opts.write_decoded_md5)
+			trace_yuv_frame((unsigned char*) buf->address, buf->bytesused, expected_length);
+		trace_mem(buf->fd, buf->offset, buf->type, buf->index, buf->bytesused, buf->address);
+		set_buffer_displayed_trace(buf);
 	}
 }
 
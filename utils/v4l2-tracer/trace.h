@@ -8,6 +8,9 @@
 
 #include "v4l2-tracer-common.h"
 #include "trace-gen.h"
+#include "trace-bin.h"
+#include <queue>
+#include <unordered_set>
 
 struct buffer_trace {
 	int fd;
@@ -19,6 +22,8 @@ struct buffer_trace {
 	unsigned long address;
 };
 
+typedef std::list<struct buffer_trace>::iterator buffer_trace_iterator;
+
 struct h264_info {
 	int pic_order_cnt_lsb;
 	int max_pic_order_cnt_lsb;
@@ -31,6 +36,7 @@ struct trace_context {
 	__u32 elems;
 	__u32 width;
 	__u32 height;
+	__u32 bytesperline;
 	FILE *trace_file;
 	__u32 pixelformat;
 	std::string media_device;
@@ -39,16 +45,61 @@ struct trace_context {
 		struct h264_info h264;
 	} fmt;
 	std::string trace_filename;
-	std::list<long> decode_order;
+	/* Display order of the decoded frames not traced yet, the next one on top. */
+	std::priority_queue<long, std::vector<long>, std::greater<long>> decode_order;
+	std::unordered_set<long> decode_order_pending;
+	long last_decode_order;
 	std::list<struct buffer_trace> buffers;
+	/* Indexes into buffers, each key points to the buffer most recently given it. */
+	std::unordered_map<__u64, buffer_trace_iterator> buffers_by_offset; /* key: fd, offset */
+	std::unordered_map<__u64, buffer_trace_iterator> buffers_by_index; /* key: type, index */
+	std::unordered_map<unsigned long, buffer_trace_iterator> buffers_by_address;
+	std::unordered_map<long, buffer_trace_iterator> buffers_by_display_order;
 	std::unordered_map<int, std::string> devices; /* key:fd, value: path of the device */
+	/* Memory dumps so far of each queue, for --mem_every. */
+	std::unordered_map<__u64, unsigned long> mem_dumps_by_queue; /* key: fd, type */
+};
+
+/* CLOCK_MONOTONIC time before and after a traced system call. */
+struct syscall_time {
+	__u64 start_ns;
+	__u64 end_ns;
 };
 
-void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64);
-void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off, unsigned long buf_address, bool is_mmap64);
+/* Options of the tracer, read from the environment when the library is loaded. */
+struct trace_options {
+	bool compact_print;
+	bool compress;
+	bool trace_userspace_arg;
+	bool write_decoded_to_json_file;
+	bool write_decoded_to_yuv_file;
+	bool write_decoded_md5;
+	/* Selective memory dumps, see trace_mem_len(). */
+	unsigned mem_every;
+	unsigned mem_prefix;
+	unsigned mem_queues;
+	const char *mem_devices;
+};
+
+#define TRACE_MEM_QUEUE_OUTPUT		(1 << 0)
+#define TRACE_MEM_QUEUE_CAPTURE		(1 << 1)
+
+extern struct trace_options trace_opts;
+
+void read_trace_options(void);
+void pause_trace(bool pause);
+void toggle_trace_pause(void);
+bool is_trace_paused(void);
+void trace_open(int fd, const char *path, int oflag, mode_t mode, bool is_open64,
+                const struct syscall_time &time);
+void trace_mmap(void *addr, size_t len, int prot, int flags, int fildes, off_t off, unsigned long buf_address, bool is_mmap64,
+                const struct syscall_time &time);
+void trace_syscall_time(json_object *jobj, const struct syscall_time &time);
 void trace_mem(int fd, __u32 offset, __u32 type, int index, __u32 bytesused, unsigned long start);
 void trace_mem_encoded(int fd, __u32 offset);
 void trace_mem_decoded(void);
+void trace_yuv_frame(const unsigned char *frame, __u32 bytesused, unsigned expected_length);
+void close_yuv_file(void);
 json_object *trace_ioctl_args(unsigned long cmd, void *arg);
 
 bool is_video_or_media_device(const char *path);
@@ -62,6 +113,8 @@ long get_buffer_bytesused_trace(int fd, __u32 offset);
 void set_buffer_address_trace(int fd, __u32 offset, unsigned long address);
 unsigned long get_buffer_address_trace(int fd, __u32 offset);
 bool buffer_is_mapped(unsigned long buffer_address);
+struct buffer_trace *get_next_buffer_to_display_trace(void);
+void set_buffer_displayed_trace(struct buffer_trace *buf);
 unsigned get_expected_length_trace(void);
 void s_ext_ctrls_setup(struct v4l2_ext_controls *ext_controls);
 void qbuf_setup(struct v4l2_buffer *buf);
@@ -72,7 +125,8 @@ void s_fmt_setup(struct v4l2_format *format);
 void expbuf_setup(struct v4l2_exportbuffer *export_buffer);
 void querybuf_setup(int fd, struct v4l2_buffer *buf);
 void query_ext_ctrl_setup(int fd, struct v4l2_query_ext_ctrl *ptr);
-void write_json_object_to_json_file(json_object *jobj);
+void write_json_object_to_json_file(json_object *jobj,
+                                    const unsigned char *data = nullptr, __u32 data_len = 0);
 void close_json_file(void);
 
 #endif
@@ -18,6 +18,14 @@ bool is_verbose(void)
 	return (getenv("V4L2_TRACER_OPTION_VERBOSE") != nullptr);
 }
 
+__u64 get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (__u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 void print_v4l2_tracer_info(void)
 {
 	fprintf(stderr, "v4l2-tracer %s%s\n", PACKAGE_VERSION, STRING(GIT_COMMIT_CNT));
@@ -29,17 +37,35 @@ void print_usage(void)
 {
 	print_v4l2_tracer_info();
 	fprintf(stderr, "Usage:\n\tv4l2-tracer [options] trace <tracee>\n"
-	        "\tv4l2-tracer [options] retrace <trace_file>.json\n"
-	        "\tv4l2-tracer clean <trace_file>.json\n\n"
+	        "\tv4l2-tracer [options] retrace <trace_file>.json|bin\n"
+	        "\tv4l2-tracer clean <trace_file>.json\n"
+	        "\tv4l2-tracer [options] convert <trace_file>.json|bin\n"
+	        "\tv4l2-tracer export --perfetto <trace_file>.json|bin\n"
+	        "\tv4l2-tracer stats <trace_file>.json|bin\n\n"
 
 	        "\tCommon options:\n"
+	        "\t\t-b, --binary      Write a binary trace file with raw video frame data.\n"
 	        "\t\t-c, --compact     Write minimal whitespace in JSON file.\n"
 	        "\t\t-g, --debug       Turn on verbose reporting plus additional debug info.\n"
 	        "\t\t-h, --help        Display this message.\n"
+	        "\t\t    --md5         Write the MD5 of each decoded video frame to md5 file.\n"
 	        "\t\t-r  --raw         Write decoded video frame data to JSON file.\n"
 	        "\t\t-u  --userspace   Trace userspace arguments.\n"
 	        "\t\t-v, --verbose     Turn on verbose reporting.\n"
-	        "\t\t-y, --yuv         Write decoded video frame data to yuv file.\n\n"
+	        "\t\t-y, --yuv         Write decoded video frame data to yuv file.\n"
+	        "\t\t-z, --zstd        Compress video frame data with zstd.\n\n"
+
+	        "\tTrace options:\n"
+	        "\t\t-e, --mem_every <n>          Only dump the video frame data of every nth\n"
+	        "\t\t                             buffer of each queue.\n"
+	        "\t\t-q, --mem_queues <queues>    Only dump the video frame data of the output\n"
+	        "\t\t                             and/or capture queues, e.g. \"output\".\n"
+	        "\t\t-D, --mem_devices <devs>     Only dump the video frame data of the given\n"
+	        "\t\t                             comma-separated fds or device paths.\n"
+	        "\t\t-k, --mem_prefix <bytes>     Only dump the first <bytes> of the video frame\n"
+	        "\t\t                             data, plus the hash of all of it.\n"
+	        "\t\t                             The metadata is always traced. The retracer\n"
+	        "\t\t                             fills the data that wasn't dumped with zeros.\n\n"
 
 	        "\tRetrace options:\n"
 	        "\t\t-d, --video_device <dev>   Retrace with a specific video device.\n"
@@ -47,7 +73,14 @@ void print_usage(void)
 	        "\t\t                           /dev/video<dev> \n\n"
 	        "\t\t-m, --media_device <dev>   Retrace with a specific media device.\n"
 	        "\t\t                           <dev> must be a digit corresponding to\n"
-	        "\t\t                           /dev/media<dev> \n\n");
+	        "\t\t                           /dev/media<dev> \n\n"
+	        "\t\t-p, --perf                 Report how long each system call took in the\n"
+	        "\t\t                           retrace compared to the trace.\n\n"
+	        "\t\t-t, --timing               Keep the same gaps between system calls as\n"
+	        "\t\t                           in the trace.\n\n"
+
+	        "\tExport options:\n"
+	        "\t\t--perfetto                 Export to the Chrome trace event format for Perfetto.\n\n");
 }
 
 void add_separator(std::string &str)
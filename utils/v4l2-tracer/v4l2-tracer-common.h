@@ -27,6 +27,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <unordered_map>
 #include <vector>
@@ -63,6 +64,7 @@ struct val_def {
 
 bool is_debug(void);
 bool is_verbose(void);
+__u64 get_time_ns(void);
 void print_v4l2_tracer_info(void);
 void print_usage(void);
 std::string ver2s(unsigned int version);
@@ -5,6 +5,7 @@
 
 #include "retrace.h"
 #include <climits>
+#include <map>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <time.h>
@@ -25,40 +26,68 @@ void v4l2_tracer_sig_handler(int signum)
 }
 
 enum Options {
+	V4l2TracerOptBinary = 'b',
 	V4l2TracerOptCompactPrint = 'c',
 	V4l2TracerOptSetVideoDevice = 'd',
+	V4l2TracerOptMemDevices = 'D',
+	V4l2TracerOptMemEvery = 'e',
 	V4l2TracerOptDebug = 'g',
 	V4l2TracerOptHelp = 'h',
+	V4l2TracerOptMemPrefix = 'k',
 	V4l2TracerOptSetMediaDevice = 'm',
+	V4l2TracerOptWriteDecodedMD5 = 'M',
+	V4l2TracerOptPerf = 'p',
+	V4l2TracerOptExportPerfetto = 'P',
+	V4l2TracerOptMemQueues = 'q',
 	V4l2TracerOptWriteDecodedToJson = 'r',
+	V4l2TracerOptTiming = 't',
 	V4l2TracerOptTraceUserspaceArg = 'u',
 	V4l2TracerOptVerbose = 'v',
 	V4l2TracerOptWriteDecodedToYUVFile = 'y',
+	V4l2TracerOptCompress = 'z',
 };
 
 const static struct option long_options[] = {
+	{ "binary", no_argument, nullptr, V4l2TracerOptBinary },
 	{ "compact", no_argument, nullptr, V4l2TracerOptCompactPrint },
 	{ "video_device", required_argument, nullptr, V4l2TracerOptSetVideoDevice },
 	{ "debug", no_argument, nullptr, V4l2TracerOptDebug },
 	{ "help", no_argument, nullptr, V4l2TracerOptHelp },
 	{ "media_device", required_argument, nullptr, V4l2TracerOptSetMediaDevice },
+	{ "md5", no_argument, nullptr, V4l2TracerOptWriteDecodedMD5 },
+	{ "mem_devices", required_argument, nullptr, V4l2TracerOptMemDevices },
+	{ "mem_every", required_argument, nullptr, V4l2TracerOptMemEvery },
+	{ "mem_prefix", required_argument, nullptr, V4l2TracerOptMemPrefix },
+	{ "mem_queues", required_argument, nullptr, V4l2TracerOptMemQueues },
+	{ "perf", no_argument, nullptr, V4l2TracerOptPerf },
+	{ "perfetto", no_argument, nullptr, V4l2TracerOptExportPerfetto },
 	{ "raw", no_argument, nullptr, V4l2TracerOptWriteDecodedToJson },
+	{ "timing", no_argument, nullptr, V4l2TracerOptTiming },
 	{ "userspace", no_argument, nullptr, V4l2TracerOptTraceUserspaceArg},
 	{ "verbose", no_argument, nullptr, V4l2TracerOptVerbose },
 	{ "yuv", no_argument, nullptr, V4l2TracerOptWriteDecodedToYUVFile },
+	{ "zstd", no_argument, nullptr, V4l2TracerOptCompress },
 	{ nullptr, 0, nullptr, 0 }
 };
 
 const char short_options[] = {
+	V4l2TracerOptBinary,
 	V4l2TracerOptCompactPrint,
 	V4l2TracerOptSetVideoDevice, ':',
+	V4l2TracerOptMemDevices, ':',
+	V4l2TracerOptMemEvery, ':',
 	V4l2TracerOptDebug,
 	V4l2TracerOptHelp,
+	V4l2TracerOptMemPrefix, ':',
 	V4l2TracerOptSetMediaDevice, ':',
+	V4l2TracerOptPerf,
+	V4l2TracerOptMemQueues, ':',
 	V4l2TracerOptWriteDecodedToJson,
+	V4l2TracerOptTiming,
 	V4l2TracerOptTraceUserspaceArg,
 	V4l2TracerOptVerbose,
-	V4l2TracerOptWriteDecodedToYUVFile
+	V4l2TracerOptWriteDecodedToYUVFile,
+	V4l2TracerOptCompress
 };
 
 int get_options(int argc, char *argv[])
@@ -78,6 +107,9 @@ int get_options(int argc, char *argv[])
 
 		option = getopt_long(argc, argv, short_options, long_options, NULL);
 		switch (option) {
+		case V4l2TracerOptBinary:
+			setenv("V4L2_TRACER_OPTION_BINARY", "true", 0);
+			break;
 		case V4l2TracerOptCompactPrint: {
 			setenv("V4L2_TRACER_OPTION_COMPACT_PRINT", "true", 0);
 			break;
@@ -125,6 +157,41 @@ int get_options(int argc, char *argv[])
 			}
 			break;
 		}
+		case V4l2TracerOptPerf:
+			setenv("V4L2_TRACER_OPTION_PERF", "true", 0);
+			break;
+		case V4l2TracerOptMemDevices:
+			setenv("V4L2_TRACER_OPTION_MEM_DEVICES", optarg, 0);
+			break;
+		case V4l2TracerOptMemEvery:
+		case V4l2TracerOptMemPrefix: {
+			char *end;
+			unsigned long value = strtoul(optarg, &end, 0);
+			if (*optarg == '\0' || *end != '\0' || value > UINT_MAX) {
+				line_info("\n\tCan't convert \'%s\' to a number.", optarg);
+				return -1;
+			}
+			setenv(option == V4l2TracerOptMemEvery ? "V4L2_TRACER_OPTION_MEM_EVERY" :
+			                                         "V4L2_TRACER_OPTION_MEM_PREFIX",
+			       optarg, 0);
+			break;
+		}
+		case V4l2TracerOptMemQueues: {
+			std::string queues = optarg;
+			if (queues != "output" && queues != "capture" &&
+			    queues != "output,capture" && queues != "capture,output") {
+				line_info("\n\tUnknown queues \'%s\', use output and/or capture.", optarg);
+				return -1;
+			}
+			setenv("V4L2_TRACER_OPTION_MEM_QUEUES", optarg, 0);
+			break;
+		}
+		case V4l2TracerOptExportPerfetto:
+			setenv("V4L2_TRACER_OPTION_EXPORT_PERFETTO", "true", 0);
+			break;
+		case V4l2TracerOptTiming:
+			setenv("V4L2_TRACER_OPTION_TIMING", "true", 0);
+			break;
 		case V4l2TracerOptWriteDecodedToJson:
 			setenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_JSON_FILE", "true", 0);
 			break;
@@ -137,6 +204,16 @@ int get_options(int argc, char *argv[])
 		case V4l2TracerOptWriteDecodedToYUVFile:
 			setenv("V4L2_TRACER_OPTION_WRITE_DECODED_TO_YUV_FILE", "true", 0);
 			break;
+		case V4l2TracerOptWriteDecodedMD5:
+			setenv("V4L2_TRACER_OPTION_WRITE_DECODED_MD5", "true", 0);
+			break;
+		case V4l2TracerOptCompress:
+#ifdef HAVE_ZSTD
+			setenv("V4L2_TRACER_OPTION_COMPRESS", "true", 0);
+#else
+			line_info("\n\tWarning: built without zstd support, not compressing.");
+#endif
+			break;
 		default:
 			break;
 		}
@@ -197,6 +274,11 @@ int clean(std::string trace_filename)
 			count_lines_removed++;
 			continue;
 		}
+		if (line.find("\"time_ns\"") != std::string::npos ||
+		    line.find("\"duration_ns\"") != std::string::npos) {
+			count_lines_removed++;
+			continue;
+		}
 
 		fputs(buf, clean_file);
 	}
@@ -209,6 +291,189 @@ int clean(std::string trace_filename)
 	return 0;
 }
 
+int convert(std::string trace_filename)
+{
+	bool to_json = is_trace_bin_file(trace_filename);
+	std::string convert_filename = trace_filename.substr(0, trace_filename.rfind('.'));
+	convert_filename += to_json ? ".json" : TRACE_BIN_EXTENSION;
+	if (convert_filename == trace_filename) {
+		line_info("\n\tCan't convert \'%s\' to itself", trace_filename.c_str());
+		return 1;
+	}
+
+	fprintf(stderr, "Converting: %s\n", trace_filename.c_str());
+
+	FILE *convert_file = fopen(convert_filename.c_str(), "w");
+	if (convert_file == nullptr) {
+		line_info("\n\tCan't open \'%s\'", convert_filename.c_str());
+		return 1;
+	}
+
+	int ret = 0;
+	if (to_json) {
+		FILE *trace_file = fopen(trace_filename.c_str(), "r");
+		if (trace_file == nullptr) {
+			line_info("\n\tCan't open \'%s\'", trace_filename.c_str());
+			fclose(convert_file);
+			return 1;
+		}
+
+		struct trace_bin_record record;
+		std::vector<unsigned char> data;
+		json_object *jobj;
+		bool first = true;
+
+		ret = trace_bin_read_header(trace_file);
+		fputs("[\n", convert_file);
+		while (ret == 0 && (ret = trace_bin_read_record(trace_file, &record, &jobj, data)) > 0) {
+			if (record.data_len)
+				json_object_object_add(jobj, "mem_array",
+				                       trace_buffer(data.data(), data.size()));
+			std::string json_str;
+			if (getenv("V4L2_TRACER_OPTION_COMPACT_PRINT") != nullptr)
+				json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PLAIN);
+			else
+				json_str = json_object_to_json_string_ext(jobj, JSON_C_TO_STRING_PRETTY);
+			if (!first)
+				fputs(",\n", convert_file);
+			fwrite(json_str.c_str(), sizeof(char), json_str.length(), convert_file);
+			json_object_put(jobj);
+			first = false;
+			ret = 0;
+		}
+		fputs("\n]\n", convert_file);
+		fclose(trace_file);
+	} else {
+		json_object *root_array_obj = json_object_from_file(trace_filename.c_str());
+		if (root_array_obj == nullptr) {
+			line_info("\n\t%s\tCan't get JSON-object from file: %s",
+			          json_util_get_last_err(), trace_filename.c_str());
+			fclose(convert_file);
+			return 1;
+		}
+
+		ret = trace_bin_write_header(convert_file);
+		size_t json_objects_in_file = json_object_array_length(root_array_obj);
+		for (size_t i = 0; ret == 0 && i < json_objects_in_file; i++) {
+			json_object *jobj = json_object_array_get_idx(root_array_obj, i);
+			json_object *mem_array_obj;
+
+			/* The hex-encoded "mem_array" becomes the raw payload of the record. */
+			if (json_object_object_get_ex(jobj, "mem_array", &mem_array_obj)) {
+				std::vector<unsigned char> data = mem_array_to_buffer(jobj);
+				json_object_object_del(jobj, "mem_array");
+				ret = trace_bin_write_record(convert_file, jobj, data.data(), data.size());
+			} else {
+				ret = trace_bin_write_record(convert_file, jobj);
+			}
+		}
+		json_object_put(root_array_obj);
+	}
+	fclose(convert_file);
+
+	if (ret < 0) {
+		line_info("\n\tCan't convert \'%s\'", trace_filename.c_str());
+		return 1;
+	}
+	fprintf(stderr, "Conversion complete: %s\n", convert_filename.c_str());
+	return 0;
+}
+
+struct syscall_timing {
+	unsigned count;
+	__u64 total_ns;
+	__u64 max_ns;
+};
+
+static std::map<std::string, struct syscall_timing> *syscall_timings;
+
+static void collect_timing(json_object *jobj, const unsigned char *data, size_t data_len)
+{
+	const char *syscalls[] = { "open", "open64", "close", "dup", "mmap", "mmap64", "munmap" };
+	json_object *duration_obj;
+	json_object *temp_obj;
+	std::string name;
+
+	if (!json_object_object_get_ex(jobj, "duration_ns", &duration_obj))
+		return;
+
+	if (json_object_object_get_ex(jobj, "ioctl", &temp_obj)) {
+		name = json_object_get_string(temp_obj);
+	} else {
+		for (const char *syscall : syscalls) {
+			if (json_object_object_get_ex(jobj, syscall, &temp_obj)) {
+				name = syscall;
+				break;
+			}
+		}
+	}
+	if (name.empty())
+		return;
+
+	__u64 duration_ns = json_object_get_uint64(duration_obj);
+	struct syscall_timing &timing = (*syscall_timings)[name];
+	timing.count++;
+	timing.total_ns += duration_ns;
+	timing.max_ns = std::max(timing.max_ns, duration_ns);
+}
+
+/*
+ * Compare the time each system call took in the trace with the time it took
+ * in the retrace, e.g. to find performance regressions between kernel versions.
+ */
+int timing_report(std::string trace_filename, std::string retrace_filename)
+{
+	std::map<std::string, struct syscall_timing> trace_timings;
+	std::map<std::string, struct syscall_timing> retrace_timings;
+
+	syscall_timings = &trace_timings;
+	if (read_trace_file(trace_filename, collect_timing))
+		return 1;
+	syscall_timings = &retrace_timings;
+	if (read_trace_file(retrace_filename, collect_timing))
+		return 1;
+
+	if (trace_timings.empty()) {
+		fprintf(stderr, "No timing information in: %s\n", trace_filename.c_str());
+		return 1;
+	}
+
+	fprintf(stderr, "\nTiming report (average/maximum duration in us):\n");
+	fprintf(stderr, "%-32s %7s %10s %10s %7s %10s %10s %8s\n", "system call",
+	        "trace", "avg", "max", "retrace", "avg", "max", "diff");
+	for (auto &trace_pair : trace_timings) {
+		const struct syscall_timing &t = trace_pair.second;
+		const struct syscall_timing &r = retrace_timings[trace_pair.first];
+		double trace_avg = t.total_ns / 1000.0 / t.count;
+
+		fprintf(stderr, "%-32s %7u %10.1f %10.1f ", trace_pair.first.c_str(),
+		        t.count, trace_avg, t.max_ns / 1000.0);
+		if (!r.count) {
+			fprintf(stderr, "%7u\n", 0);
+			continue;
+		}
+		double retrace_avg = r.total_ns / 1000.0 / r.count;
+		fprintf(stderr, "%7u %10.1f %10.1f ", r.count, retrace_avg, r.max_ns / 1000.0);
+		if (trace_avg > 0)
+			fprintf(stderr, "%+7.1f%%\n", (retrace_avg - trace_avg) * 100.0 / trace_avg);
+		else
+			fprintf(stderr, "%8s\n", "-");
+	}
+	return 0;
+}
+
+void write_trace_info(FILE *trace_file, json_object *jobj)
+{
+	if (is_binary_trace()) {
+		trace_bin_write_record(trace_file, jobj);
+		return;
+	}
+
+	std::string json_str = json_object_to_json_string(jobj);
+	fwrite(json_str.c_str(), sizeof(char), json_str.length(), trace_file);
+	fputs(",\n", trace_file);
+}
+
 int tracer(int argc, char *argv[], bool retrace)
 {
 	char *exec[argc];
@@ -218,9 +483,10 @@ int tracer(int argc, char *argv[], bool retrace)
 
 	if (retrace) {
 		std::string trace_file = argv[optind];
-		if (trace_file.find(".json") == std::string::npos) {
-			line_info("\n\tTrace file \'%s\' must have .json file extension",
-			          trace_file.c_str());
+		if (trace_file.find(".json") == std::string::npos &&
+		    trace_file.find(TRACE_BIN_EXTENSION) == std::string::npos) {
+			line_info("\n\tTrace file \'%s\' must have .json or %s file extension",
+			          trace_file.c_str(), TRACE_BIN_EXTENSION);
 			print_usage();
 			return -1;
 		}
@@ -241,7 +507,7 @@ int tracer(int argc, char *argv[], bool retrace)
 	std::string trace_id;
 	if (retrace) {
 		std::string json_file_name = argv[optind];
-		trace_id = json_file_name.substr(0, json_file_name.find(".json"));
+		trace_id = json_file_name.substr(0, json_file_name.rfind('.'));
 		trace_id += "_retrace";
 	} else {
 		const int timestamp_start_pos = 1;
@@ -249,7 +515,7 @@ int tracer(int argc, char *argv[], bool retrace)
 		trace_id = trace_id.substr(timestamp_start_pos) + "_trace";
 	}
 	setenv("TRACE_ID", trace_id.c_str(), 0);
-	std::string trace_filename = trace_id + ".json";
+	std::string trace_filename = trace_id + trace_file_extension();
 	FILE *trace_file = fopen(trace_filename.c_str(), "w");
 	if (trace_file == nullptr) {
 		fprintf(stderr, "Could not open trace file: %s\n", trace_filename.c_str());
@@ -257,11 +523,13 @@ int tracer(int argc, char *argv[], bool retrace)
 		return errno;
 	}
 
-	/* Open the json array.*/
-	fputs("[\n", trace_file);
+	/* Open the json array or write the binary trace file header. */
+	if (is_binary_trace())
+		trace_bin_write_header(trace_file);
+	else
+		fputs("[\n", trace_file);
 
 	/* Add v4l-utils package and git info to the top of the trace file. */
-	std::string json_str;
 	json_object *v4l2_tracer_info_obj = json_object_new_object();
 	json_object_object_add(v4l2_tracer_info_obj, "package_version",
 	                       json_object_new_string(PACKAGE_VERSION));
@@ -273,9 +541,7 @@ int tracer(int argc, char *argv[], bool retrace)
 	                       json_object_new_string(STRING(GIT_SHA)));
 	json_object_object_add(v4l2_tracer_info_obj, "git_commit_date",
 	                       json_object_new_string(STRING(GIT_COMMIT_DATE)));
-	json_str = json_object_to_json_string(v4l2_tracer_info_obj);
-	fwrite(json_str.c_str(), sizeof(char), json_str.length(), trace_file);
-	fputs(",\n", trace_file);
+	write_trace_info(trace_file, v4l2_tracer_info_obj);
 	json_object_put(v4l2_tracer_info_obj);
 
 	/* Add v4l2-tracer command line to the top of the trace file. */
@@ -289,9 +555,7 @@ int tracer(int argc, char *argv[], bool retrace)
 	const time_t current_time = time(nullptr);
 	json_object_object_add(tracee_obj, "Timestamp", json_object_new_string(ctime(&current_time)));
 
-	json_str = json_object_to_json_string(tracee_obj);
-	fwrite(json_str.c_str(), sizeof(char), json_str.length(), trace_file);
-	fputs(",\n", trace_file);
+	write_trace_info(trace_file, tracee_obj);
 	json_object_put(tracee_obj);
 	fclose(trace_file);
 
@@ -347,11 +611,13 @@ int tracer(int argc, char *argv[], bool retrace)
 
 	fprintf(stderr, "Tracee exited with status: %d\n", exec_result);
 
-	/* Close the json-array and the trace file. */
-	trace_file = fopen(trace_filename.c_str(), "r+");
-	fseek(trace_file, -2L, SEEK_END);
-	fputs("\n]\n", trace_file);
-	fclose(trace_file);
+	/* Close the json-array and the trace file. Binary trace files need no closing. */
+	if (!is_binary_trace()) {
+		trace_file = fopen(trace_filename.c_str(), "r+");
+		fseek(trace_file, -2L, SEEK_END);
+		fputs("\n]\n", trace_file);
+		fclose(trace_file);
+	}
 
 	if (retrace)
 		fprintf(stderr, "Retrace complete: ");
@@ -361,6 +627,9 @@ int tracer(int argc, char *argv[], bool retrace)
 	fprintf(stderr, "\n");
 
 	unsetenv("LD_PRELOAD");
+	if (retrace && getenv("V4L2_TRACER_OPTION_PERF") != nullptr)
+		timing_report(argv[optind], trace_filename);
+
 	return exec_result;
 }
 
@@ -411,6 +680,17 @@ int main(int argc, char *argv[])
 		ret = retrace(argv[optind]);
 	} else if (command == "clean") {
 		ret = clean (argv[optind]);
+	} else if (command == "convert") {
+		ret = convert(argv[optind]);
+	} else if (command == "stats") {
+		ret = stats(argv[optind]);
+	} else if (command == "export") {
+		if (getenv("V4L2_TRACER_OPTION_EXPORT_PERFETTO") != nullptr) {
+			ret = export_perfetto(argv[optind]);
+		} else {
+			line_info("\n\tSelect an export format, e.g. --perfetto");
+			print_usage();
+		}
 	} else {
 		if (is_debug()) {
 			line_info("Invalid command");